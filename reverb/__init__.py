@@ -28,6 +28,7 @@ from reverb import item_selectors as selectors
 from reverb import rate_limiters
 
 from reverb.client import Client
+from reverb.client import Sampler
 from reverb.client import Writer
 
 from reverb.dataset import ReplayDataset
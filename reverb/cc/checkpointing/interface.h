@@ -15,7 +15,15 @@
 #ifndef REVERB_CC_CHECKPOINTING_INTERFACE_H_
 #define REVERB_CC_CHECKPOINTING_INTERFACE_H_
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/time/time.h"
 #include "reverb/cc/table.h"
+#include "tensorflow/core/lib/core/errors.h"
 
 namespace deepmind {
 namespace reverb {
@@ -25,6 +33,25 @@ namespace reverb {
 // retrieved at a later point and restore a copy of the checkpointed tables.
 class Checkpointer {
  public:
+  // Configures a single `Save`.
+  struct SaveOptions {
+    // Maximum number of bytes per second written by the save, shared by all
+    // the files which are written concurrently. A value <= 0 means that there
+    // is no limit.
+    int64_t max_bytes_per_second = 0;
+  };
+
+  // Stats of a successful `Save`.
+  struct SaveStats {
+    // Number of bytes written. Data which was persisted by earlier checkpoints
+    // and reused by the new one is not included.
+    int64_t num_bytes_written = 0;
+
+    // Time spent writing the chunks of the checkpoint, from the first chunk
+    // until the last chunk file was closed.
+    absl::Duration write_duration = absl::ZeroDuration();
+  };
+
   virtual ~Checkpointer() = default;
 
   // Save a new checkpoint for every table in `tables` to permanent storage. If
@@ -33,6 +60,15 @@ class Checkpointer {
   virtual tensorflow::Status Save(std::vector<Table*> tables, int keep_latest,
                                   std::string* path) = 0;
 
+  // Same as above but configured by `options`. If `stats` is not null then it
+  // is populated on success. The default implementation ignores `options` and
+  // leaves `stats` untouched.
+  virtual tensorflow::Status Save(std::vector<Table*> tables, int keep_latest,
+                                  const SaveOptions& options,
+                                  std::string* path, SaveStats* stats) {
+    return Save(std::move(tables), keep_latest, path);
+  }
+
   // Attempts to load a checkpoint from the active workspace.
   //
   // Tables loaded from checkpoint must already exist in `tables`. When
@@ -46,6 +82,18 @@ class Checkpointer {
   // for more details.
   virtual tensorflow::Status LoadLatest(
       ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) = 0;
+
+  // Inserts the items of the most recent checkpoint into `tables` while they
+  // are serving traffic. Unlike `Load`, the tables are not replaced: they
+  // keep their current configuration and rate limiter and the items are
+  // inserted in the order that they were inserted into the checkpointed
+  // tables. Every table must be prepared with `Table::BeginRestore`.
+  virtual tensorflow::Status RestoreLatest(
+      ChunkStore* chunk_store,
+      const std::vector<std::shared_ptr<Table>>& tables) {
+    return tensorflow::errors::Unimplemented(
+        "RestoreLatest is not supported by this checkpointer.");
+  }
 };
 
 }  // namespace reverb
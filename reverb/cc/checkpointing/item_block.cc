@@ -0,0 +1,150 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/checkpointing/item_block.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+
+void ItemBlockEncoder::Add(uint64_t key, double priority,
+                           int32_t times_sampled, int64_t inserted_at_ns,
+                           int32_t offset, int32_t length,
+                           absl::Span<const int32_t> columns,
+                           absl::Span<const uint64_t> chunk_keys) {
+  block_.add_keys(key);
+  block_.add_priorities(priority);
+  block_.add_times_sampled(times_sampled);
+  block_.add_inserted_at_deltas(inserted_at_ns - last_inserted_at_ns_);
+  last_inserted_at_ns_ = inserted_at_ns;
+  block_.add_offsets(offset);
+  block_.add_lengths(length);
+
+  block_.add_num_chunks(chunk_keys.size());
+  for (uint64_t chunk_key : chunk_keys) {
+    auto it = chunk_indices_.try_emplace(chunk_key, block_.chunk_keys_size())
+                  .first;
+    if (it->second == block_.chunk_keys_size()) {
+      block_.add_chunk_keys(chunk_key);
+    }
+    block_.add_chunk_index_deltas(it->second - last_chunk_index_);
+    last_chunk_index_ = it->second;
+  }
+
+  // `num_columns` is only populated once an item of the block has columns.
+  if (!columns.empty() && block_.num_columns_size() == 0) {
+    block_.mutable_num_columns()->Resize(block_.keys_size() - 1, 0);
+  }
+  if (block_.num_columns_size() != 0) {
+    block_.add_num_columns(columns.size());
+    block_.mutable_columns()->Add(columns.begin(), columns.end());
+  }
+}
+
+PrioritizedItemBlock ItemBlockEncoder::Finish() {
+  PrioritizedItemBlock block = std::move(block_);
+  block_.Clear();
+  chunk_indices_.clear();
+  last_inserted_at_ns_ = 0;
+  last_chunk_index_ = 0;
+  return block;
+}
+
+tensorflow::Status DecodeItemBlock(const PrioritizedItemBlock& block,
+                                   absl::string_view table,
+                                   std::vector<PrioritizedItem>* items) {
+  const int num_items = block.keys_size();
+  if (block.priorities_size() != num_items ||
+      block.times_sampled_size() != num_items ||
+      block.inserted_at_deltas_size() != num_items ||
+      block.offsets_size() != num_items || block.lengths_size() != num_items ||
+      block.num_chunks_size() != num_items ||
+      (block.num_columns_size() != 0 &&
+       block.num_columns_size() != num_items)) {
+    return tensorflow::errors::DataLoss(
+        "PrioritizedItemBlock of ", num_items,
+        " items has columns of inconsistent sizes.");
+  }
+
+  items->reserve(items->size() + num_items);
+  int64_t inserted_at_ns = 0;
+  int32_t chunk_index = 0;
+  int next_chunk_reference = 0;
+  int next_column = 0;
+  for (int i = 0; i < num_items; i++) {
+    PrioritizedItem item;
+    item.set_key(block.keys(i));
+    item.set_table(table.data(), table.size());
+    item.set_priority(block.priorities(i));
+    item.set_times_sampled(block.times_sampled(i));
+
+    inserted_at_ns += block.inserted_at_deltas(i);
+    const absl::Time inserted_at = absl::FromUnixNanos(inserted_at_ns);
+    const int64_t seconds = absl::ToUnixSeconds(inserted_at);
+    item.mutable_inserted_at()->set_seconds(seconds);
+    item.mutable_inserted_at()->set_nanos(
+        (inserted_at - absl::FromUnixSeconds(seconds)) / absl::Nanoseconds(1));
+
+    if (block.offsets(i) != 0 || block.lengths(i) != 0) {
+      item.mutable_sequence_range()->set_offset(block.offsets(i));
+      item.mutable_sequence_range()->set_length(block.lengths(i));
+    }
+
+    const int num_chunks = block.num_chunks(i);
+    if (num_chunks < 0 ||
+        next_chunk_reference + num_chunks > block.chunk_index_deltas_size()) {
+      return tensorflow::errors::DataLoss(
+          "PrioritizedItemBlock references more chunks than it holds.");
+    }
+    for (int j = 0; j < num_chunks; j++) {
+      chunk_index += block.chunk_index_deltas(next_chunk_reference++);
+      if (chunk_index < 0 || chunk_index >= block.chunk_keys_size()) {
+        return tensorflow::errors::DataLoss(
+            "PrioritizedItemBlock references chunk ", chunk_index, " of ",
+            block.chunk_keys_size(), ".");
+      }
+      item.add_chunk_keys(block.chunk_keys(chunk_index));
+    }
+
+    if (block.num_columns_size() != 0) {
+      const int num_columns = block.num_columns(i);
+      if (num_columns < 0 ||
+          next_column + num_columns > block.columns_size()) {
+        return tensorflow::errors::DataLoss(
+            "PrioritizedItemBlock references more columns than it holds.");
+      }
+      item.mutable_columns()->Add(
+          block.columns().begin() + next_column,
+          block.columns().begin() + next_column + num_columns);
+      next_column += num_columns;
+    }
+
+    items->push_back(std::move(item));
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace reverb
+}  // namespace deepmind
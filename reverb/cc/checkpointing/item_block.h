@@ -0,0 +1,70 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_CHECKPOINTING_ITEM_BLOCK_H_
+#define REVERB_CC_CHECKPOINTING_ITEM_BLOCK_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Number of items per `PrioritizedItemBlock` written by checkpoints. Bounds
+// the size of the records of the checkpoint and the number of items which are
+// materialized at once when it is loaded.
+constexpr int kCheckpointItemsPerBlock = 1 << 16;
+
+// Encodes items, in the order they are added, into a `PrioritizedItemBlock`.
+class ItemBlockEncoder {
+ public:
+  void Add(uint64_t key, double priority, int32_t times_sampled,
+           int64_t inserted_at_ns, int32_t offset, int32_t length,
+           absl::Span<const int32_t> columns,
+           absl::Span<const uint64_t> chunk_keys);
+
+  // Number of items added since the last call to `Finish`.
+  int num_items() const { return block_.keys_size(); }
+
+  // Returns the block of the items added since the last call to `Finish` and
+  // resets the encoder.
+  PrioritizedItemBlock Finish();
+
+ private:
+  PrioritizedItemBlock block_;
+
+  // Index in `block_.chunk_keys` of each chunk key referenced so far.
+  absl::flat_hash_map<uint64_t, int32_t> chunk_indices_;
+
+  int64_t last_inserted_at_ns_ = 0;
+  int32_t last_chunk_index_ = 0;
+};
+
+// Appends the items of `block`, which belong to the table `table`, to `items`.
+// Returns `DataLossError` if the block is malformed.
+tensorflow::Status DecodeItemBlock(const PrioritizedItemBlock& block,
+                                   absl::string_view table,
+                                   std::vector<PrioritizedItem>* items);
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_CHECKPOINTING_ITEM_BLOCK_H_
@@ -0,0 +1,118 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/checkpointing/item_block.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::deepmind::reverb::testing::EqualsProto;
+using ::testing::ElementsAre;
+
+TEST(ItemBlockTest, RoundTrip) {
+  ItemBlockEncoder encoder;
+  encoder.Add(/*key=*/10, /*priority=*/0.5, /*times_sampled=*/2,
+              /*inserted_at_ns=*/1000000000123, /*offset=*/1, /*length=*/3,
+              /*columns=*/{}, /*chunk_keys=*/{100, 101});
+  encoder.Add(/*key=*/7, /*priority=*/1.5, /*times_sampled=*/0,
+              /*inserted_at_ns=*/1000000000124, /*offset=*/0, /*length=*/0,
+              /*columns=*/{0, 2}, /*chunk_keys=*/{101, 102});
+  EXPECT_EQ(encoder.num_items(), 2);
+
+  PrioritizedItemBlock block = encoder.Finish();
+  EXPECT_EQ(encoder.num_items(), 0);
+  EXPECT_THAT(block.chunk_keys(), ElementsAre(100, 101, 102));
+  EXPECT_THAT(block.chunk_index_deltas(), ElementsAre(0, 1, 0, 1));
+  EXPECT_THAT(block.inserted_at_deltas(), ElementsAre(1000000000123, 1));
+  EXPECT_THAT(block.num_columns(), ElementsAre(0, 2));
+
+  std::vector<PrioritizedItem> items;
+  TF_ASSERT_OK(DecodeItemBlock(block, "table", &items));
+  EXPECT_THAT(items, ElementsAre(EqualsProto(R"pb(
+                                   key: 10
+                                   table: 'table'
+                                   priority: 0.5
+                                   times_sampled: 2
+                                   inserted_at { seconds: 1000 nanos: 123 }
+                                   sequence_range { offset: 1 length: 3 }
+                                   chunk_keys: [ 100, 101 ]
+                                 )pb"),
+                                 EqualsProto(R"pb(
+                                   key: 7
+                                   table: 'table'
+                                   priority: 1.5
+                                   inserted_at { seconds: 1000 nanos: 124 }
+                                   chunk_keys: [ 101, 102 ]
+                                   columns: [ 0, 2 ]
+                                 )pb")));
+}
+
+TEST(ItemBlockTest, FinishResetsEncoder) {
+  ItemBlockEncoder encoder;
+  encoder.Add(1, 1, 0, 5, 0, 1, {}, {100});
+  encoder.Finish();
+  encoder.Add(2, 1, 0, 6, 0, 1, {}, {100});
+
+  PrioritizedItemBlock block = encoder.Finish();
+  EXPECT_THAT(block.keys(), ElementsAre(2));
+  EXPECT_THAT(block.chunk_keys(), ElementsAre(100));
+  EXPECT_THAT(block.inserted_at_deltas(), ElementsAre(6));
+  EXPECT_THAT(block.num_columns(), ::testing::IsEmpty());
+}
+
+TEST(ItemBlockTest, DecodeAppendsToItems) {
+  ItemBlockEncoder encoder;
+  encoder.Add(1, 1, 0, 5, 0, 1, {}, {100});
+  std::vector<PrioritizedItem> items(1);
+  TF_ASSERT_OK(DecodeItemBlock(encoder.Finish(), "table", &items));
+  ASSERT_EQ(items.size(), 2);
+  EXPECT_EQ(items[1].key(), 1);
+}
+
+TEST(ItemBlockTest, DecodeRejectsMalformedBlocks) {
+  ItemBlockEncoder encoder;
+  encoder.Add(1, 1, 0, 5, 0, 1, {}, {100});
+  const PrioritizedItemBlock block = encoder.Finish();
+  std::vector<PrioritizedItem> items;
+
+  PrioritizedItemBlock missing_priority = block;
+  missing_priority.clear_priorities();
+  EXPECT_TRUE(tensorflow::errors::IsDataLoss(
+      DecodeItemBlock(missing_priority, "table", &items)));
+
+  PrioritizedItemBlock missing_chunk = block;
+  missing_chunk.clear_chunk_keys();
+  EXPECT_TRUE(tensorflow::errors::IsDataLoss(
+      DecodeItemBlock(missing_chunk, "table", &items)));
+
+  PrioritizedItemBlock missing_reference = block;
+  missing_reference.clear_chunk_index_deltas();
+  EXPECT_TRUE(tensorflow::errors::IsDataLoss(
+      DecodeItemBlock(missing_reference, "table", &items)));
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
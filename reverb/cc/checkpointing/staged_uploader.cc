@@ -0,0 +1,110 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/checkpointing/staged_uploader.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+tensorflow::Status WriteFile(const std::string& path,
+                             const std::string& data) {
+  std::unique_ptr<tensorflow::WritableFile> file;
+  TF_RETURN_IF_ERROR(tensorflow::Env::Default()->NewWritableFile(path, &file));
+  TF_RETURN_IF_ERROR(file->Append(data));
+  return file->Close();
+}
+
+}  // namespace
+
+StagedUploader::StagedUploader(int num_streams, int64_t max_staged_bytes)
+    : max_staged_bytes_(max_staged_bytes),
+      pool_(absl::make_unique<internal::ThreadPool>(num_streams,
+                                                    "checkpoint_uploader")) {
+  REVERB_CHECK_GE(num_streams, 1);
+}
+
+StagedUploader::~StagedUploader() { pool_ = nullptr; }
+
+tensorflow::Status StagedUploader::Upload(std::string path,
+                                          std::string data) {
+  {
+    absl::MutexLock lock(&mu_);
+    const int64_t size = data.size();
+    auto fits = [this, size]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return !status_.ok() || staged_bytes_ == 0 ||
+             staged_bytes_ + size <= max_staged_bytes_;
+    };
+    mu_.Await(absl::Condition(&fits));
+    TF_RETURN_IF_ERROR(status_);
+    if (start_ == absl::InfinitePast()) start_ = absl::Now();
+    staged_bytes_ += size;
+    num_staged_files_++;
+  }
+  pool_->Schedule([this, path = std::move(path), data = std::move(data)] {
+    Write(path, data);
+  });
+  return tensorflow::Status::OK();
+}
+
+void StagedUploader::Write(const std::string& path, const std::string& data) {
+  tensorflow::Status status = WriteFile(path, data);
+  if (!status.ok()) {
+    tensorflow::errors::AppendToMessage(&status, "While uploading ", path);
+  }
+  absl::MutexLock lock(&mu_);
+  staged_bytes_ -= data.size();
+  num_staged_files_--;
+  end_ = absl::Now();
+  if (!status.ok()) {
+    if (status_.ok()) status_ = std::move(status);
+    return;
+  }
+  stats_.num_files++;
+  stats_.num_bytes += data.size();
+}
+
+tensorflow::Status StagedUploader::Finish(Stats* stats) {
+  absl::MutexLock lock(&mu_);
+  auto done = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return num_staged_files_ == 0;
+  };
+  mu_.Await(absl::Condition(&done));
+  if (stats != nullptr) {
+    *stats = stats_;
+    stats->duration = start_ == absl::InfinitePast() ? absl::ZeroDuration()
+                                                     : end_ - start_;
+  }
+  return status_;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
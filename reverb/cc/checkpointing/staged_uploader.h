@@ -0,0 +1,96 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_CHECKPOINTING_STAGED_UPLOADER_H_
+#define REVERB_CC_CHECKPOINTING_STAGED_UPLOADER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Writes files which have been staged in memory through a fixed number of
+// concurrent upload streams. The files are written through `tensorflow::Env`,
+// where remote file systems (e.g GCS or S3) upload each file over a single
+// stream, so spreading the data over several files written in parallel raises
+// the throughput while the callers keep serializing the next files.
+//
+// The memory held by staged files is bounded by `max_staged_bytes`: `Upload`
+// blocks until the earlier files have been written. A file larger than the
+// bound is staged once nothing else is.
+//
+// This object is thread-safe.
+class StagedUploader {
+ public:
+  struct Stats {
+    // Number of files, and bytes, written.
+    int64_t num_files = 0;
+    int64_t num_bytes = 0;
+
+    // From the first call to `Upload` until the last file was closed.
+    absl::Duration duration = absl::ZeroDuration();
+  };
+
+  // `num_streams` must be >= 1.
+  StagedUploader(int num_streams, int64_t max_staged_bytes);
+
+  // Waits for the staged files to be written.
+  ~StagedUploader();
+
+  // Stages `data` to be written to a new file at `path`. Returns the error of
+  // an earlier upload, if any has failed, in which case `data` is dropped.
+  tensorflow::Status Upload(std::string path, std::string data)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Waits until every staged file has been written. Returns the error of the
+  // first upload which failed. `stats` is populated if not null.
+  tensorflow::Status Finish(Stats* stats = nullptr) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // StagedUploader is neither copyable nor movable.
+  StagedUploader(const StagedUploader&) = delete;
+  StagedUploader& operator=(const StagedUploader&) = delete;
+
+ private:
+  // Writes a staged file and releases its bytes.
+  void Write(const std::string& path, const std::string& data)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  const int64_t max_staged_bytes_;
+
+  absl::Mutex mu_;
+  int64_t staged_bytes_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_staged_files_ ABSL_GUARDED_BY(mu_) = 0;
+  tensorflow::Status status_ ABSL_GUARDED_BY(mu_);
+  absl::Time start_ ABSL_GUARDED_BY(mu_) = absl::InfinitePast();
+  absl::Time end_ ABSL_GUARDED_BY(mu_) = absl::InfinitePast();
+  Stats stats_ ABSL_GUARDED_BY(mu_);
+
+  // Destroyed first so that the pending uploads complete while the members
+  // they use are still alive.
+  std::unique_ptr<internal::ThreadPool> pool_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_CHECKPOINTING_STAGED_UPLOADER_H_
@@ -0,0 +1,89 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/checkpointing/staged_uploader.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "reverb/cc/platform/logging.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+std::string MakeDir() {
+  std::string name;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(&name));
+  TF_CHECK_OK(tensorflow::Env::Default()->RecursivelyCreateDir(name));
+  return name;
+}
+
+TEST(StagedUploaderTest, WritesFilesAndReportsStats) {
+  const std::string dir = MakeDir();
+  // Every file exceeds `max_staged_bytes` on its own so they are staged one
+  // at a time.
+  StagedUploader uploader(/*num_streams=*/3, /*max_staged_bytes=*/1);
+  for (int i = 0; i < 10; i++) {
+    TF_ASSERT_OK(uploader.Upload(
+        tensorflow::io::JoinPath(dir, absl::StrCat("file-", i)),
+        absl::StrCat("data-", i)));
+  }
+  StagedUploader::Stats stats;
+  TF_ASSERT_OK(uploader.Finish(&stats));
+  EXPECT_EQ(stats.num_files, 10);
+  EXPECT_EQ(stats.num_bytes, 10 * 6);
+  EXPECT_GE(stats.duration, absl::ZeroDuration());
+
+  for (int i = 0; i < 10; i++) {
+    std::string data;
+    TF_ASSERT_OK(tensorflow::ReadFileToString(
+        tensorflow::Env::Default(),
+        tensorflow::io::JoinPath(dir, absl::StrCat("file-", i)), &data));
+    EXPECT_EQ(data, absl::StrCat("data-", i));
+  }
+}
+
+TEST(StagedUploaderTest, FinishWithoutUploads) {
+  StagedUploader uploader(/*num_streams=*/1, /*max_staged_bytes=*/100);
+  StagedUploader::Stats stats;
+  TF_EXPECT_OK(uploader.Finish(&stats));
+  EXPECT_EQ(stats.num_files, 0);
+  EXPECT_EQ(stats.duration, absl::ZeroDuration());
+}
+
+TEST(StagedUploaderTest, FailedUploadFailsLaterCalls) {
+  const std::string dir = MakeDir();
+  StagedUploader uploader(/*num_streams=*/1, /*max_staged_bytes=*/100);
+  TF_ASSERT_OK(uploader.Upload(
+      tensorflow::io::JoinPath(dir, "missing", "file"), "data"));
+
+  tensorflow::Status status = uploader.Finish();
+  EXPECT_FALSE(status.ok());
+  EXPECT_THAT(status.error_message(), ::testing::HasSubstr("missing"));
+  EXPECT_EQ(
+      uploader.Upload(tensorflow::io::JoinPath(dir, "file"), "data").code(),
+      status.code());
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
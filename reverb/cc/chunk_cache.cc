@@ -0,0 +1,120 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/chunk_cache.h"
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+
+int64_t ChunkCache::Entry::num_timesteps() const {
+  return tensors.empty() || tensors.front().dims() == 0
+             ? 0
+             : tensors.front().dim_size(0);
+}
+
+int64_t ChunkCache::Entry::bytes() const {
+  int64_t bytes = 0;
+  for (const auto& tensor : tensors) {
+    bytes += tensor.TotalBytes();
+  }
+  return bytes;
+}
+
+bool ChunkCache::Entry::Contains(int64_t begin, int64_t end) const {
+  return start <= begin && end <= start + num_timesteps();
+}
+
+double ChunkCache::Stats::hit_rate() const {
+  const int64_t lookups = hits + misses;
+  return lookups == 0 ? 0 : static_cast<double>(hits) / lookups;
+}
+
+ChunkCache::ChunkCache(int64_t max_bytes) : max_bytes_(max_bytes) {
+  REVERB_CHECK_GE(max_bytes_, 0);
+}
+
+std::shared_ptr<const ChunkCache::Entry> ChunkCache::Get(Key key,
+                                                         int64_t start,
+                                                         int64_t end) {
+  absl::MutexLock lock(&mu_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    stats_.misses++;
+    return nullptr;
+  }
+
+  if (!it->second->entry->Contains(start, end)) {
+    stats_.misses++;
+    return nullptr;
+  }
+
+  lru_.splice(lru_.begin(), lru_, it->second);
+  stats_.hits++;
+  return it->second->entry;
+}
+
+void ChunkCache::Insert(Key key, std::shared_ptr<const Entry> entry) {
+  const int64_t bytes = entry->bytes();
+  if (bytes > max_bytes_) return;
+
+  absl::MutexLock lock(&mu_);
+  if (auto it = index_.find(key); it != index_.end()) {
+    EraseLocked(it->second);
+  }
+
+  while (!lru_.empty() && stats_.bytes + bytes > max_bytes_) {
+    EraseLocked(std::prev(lru_.end()));
+    stats_.evictions++;
+  }
+
+  lru_.push_front(Item{key, std::move(entry), bytes});
+  index_[key] = lru_.begin();
+  stats_.num_chunks++;
+  stats_.bytes += bytes;
+}
+
+std::vector<ChunkCache::KeyAndEntry> ChunkCache::Entries() const {
+  absl::MutexLock lock(&mu_);
+  std::vector<KeyAndEntry> entries;
+  entries.reserve(lru_.size());
+  for (const auto& item : lru_) {
+    entries.emplace_back(item.key, item.entry);
+  }
+  return entries;
+}
+
+ChunkCache::Stats ChunkCache::stats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
+void ChunkCache::EraseLocked(List::iterator it) {
+  stats_.num_chunks--;
+  stats_.bytes -= it->bytes;
+  index_.erase(it->key);
+  lru_.erase(it);
+}
+
+}  // namespace reverb
+}  // namespace deepmind
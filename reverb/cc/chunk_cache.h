@@ -0,0 +1,129 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_CHUNK_CACHE_H_
+#define REVERB_CC_CHUNK_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+
+// LRU cache of decompressed chunks. Samples of overlapping items reference the
+// same chunks, so caching the decompressed tensors allows the time steps of
+// the later samples to be copied rather than decompressed again.
+//
+// The cache is bounded by the total size of the cached tensors. Entries are
+// immutable and handed out as shared pointers, so evicting an entry never
+// invalidates tensors which are still being read.
+//
+// All public methods are thread safe.
+class ChunkCache {
+ public:
+  using Key = uint64_t;
+
+  // The decompressed tensors of a chunk (or of a range of its time steps).
+  struct Entry {
+    // Index within the episode of the first time step of `tensors`.
+    int64_t start = 0;
+
+    // One tensor for each tensor of the chunk, all with the same number of
+    // time steps in the first dimension.
+    std::vector<tensorflow::Tensor> tensors;
+
+    // Number of time steps in `tensors`.
+    int64_t num_timesteps() const;
+
+    // Total size of `tensors`.
+    int64_t bytes() const;
+
+    // Returns true if `tensors` holds the time steps [`begin`, `end`) of the
+    // episode.
+    bool Contains(int64_t begin, int64_t end) const;
+  };
+
+  using KeyAndEntry = std::pair<Key, std::shared_ptr<const Entry>>;
+
+  struct Stats {
+    // Number of calls to `Get` which returned (or did not return) an entry.
+    int64_t hits = 0;
+    int64_t misses = 0;
+
+    // Number of entries which have been removed to respect `max_bytes`.
+    int64_t evictions = 0;
+
+    // Number of entries and their total size.
+    int64_t num_chunks = 0;
+    int64_t bytes = 0;
+
+    // Fraction of calls to `Get` which returned an entry.
+    double hit_rate() const;
+  };
+
+  explicit ChunkCache(int64_t max_bytes);
+
+  // Returns the entry of `key` if it holds the time steps [`start`, `end`) of
+  // the episode, otherwise returns nullptr. Marks the entry as the most
+  // recently used.
+  std::shared_ptr<const Entry> Get(Key key, int64_t start, int64_t end)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Inserts or replaces the entry of `key` and evicts the least recently used
+  // entries until the total size is <= `max_bytes`. Entries larger than
+  // `max_bytes` are not inserted.
+  void Insert(Key key, std::shared_ptr<const Entry> entry)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns the cached entries ordered from the most to the least recently
+  // used.
+  std::vector<KeyAndEntry> Entries() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns the counters of the cache.
+  Stats stats() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  int64_t max_bytes() const { return max_bytes_; }
+
+ private:
+  struct Item {
+    Key key;
+    std::shared_ptr<const Entry> entry;
+    int64_t bytes;
+  };
+  using List = std::list<Item>;
+
+  void EraseLocked(List::iterator it) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const int64_t max_bytes_;
+
+  mutable absl::Mutex mu_;
+
+  // Entries ordered from the most to the least recently used.
+  List lru_ ABSL_GUARDED_BY(mu_);
+  internal::flat_hash_map<Key, List::iterator> index_ ABSL_GUARDED_BY(mu_);
+  Stats stats_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_CHUNK_CACHE_H_
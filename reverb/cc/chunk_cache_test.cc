@@ -0,0 +1,155 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/chunk_cache.h"
+
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/platform/thread.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+// Creates an entry with `num_timesteps` time steps of 4 bytes each, starting
+// at index `start` of the episode.
+std::shared_ptr<const ChunkCache::Entry> MakeEntry(int64_t start,
+                                                   int64_t num_timesteps) {
+  auto entry = std::make_shared<ChunkCache::Entry>();
+  entry->start = start;
+  entry->tensors.emplace_back(tensorflow::DT_FLOAT,
+                              tensorflow::TensorShape({num_timesteps}));
+  return entry;
+}
+
+TEST(ChunkCacheTest, GetReturnsInsertedEntry) {
+  ChunkCache cache(1000);
+  auto entry = MakeEntry(10, 5);
+  cache.Insert(1, entry);
+
+  EXPECT_EQ(cache.Get(1, 10, 15), entry);
+  EXPECT_EQ(cache.Get(1, 12, 13), entry);
+  EXPECT_EQ(cache.Get(2, 10, 15), nullptr);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.num_chunks, 1);
+  EXPECT_EQ(stats.bytes, 20);
+  EXPECT_DOUBLE_EQ(stats.hit_rate(), 2. / 3);
+}
+
+TEST(ChunkCacheTest, GetMissesIfEntryDoesNotCoverRange) {
+  ChunkCache cache(1000);
+  cache.Insert(1, MakeEntry(10, 5));
+
+  EXPECT_EQ(cache.Get(1, 9, 12), nullptr);
+  EXPECT_EQ(cache.Get(1, 14, 16), nullptr);
+  EXPECT_EQ(cache.stats().misses, 2);
+}
+
+TEST(ChunkCacheTest, InsertReplacesEntry) {
+  ChunkCache cache(1000);
+  cache.Insert(1, MakeEntry(10, 2));
+  auto entry = MakeEntry(10, 5);
+  cache.Insert(1, entry);
+
+  EXPECT_EQ(cache.Get(1, 10, 15), entry);
+  EXPECT_EQ(cache.stats().num_chunks, 1);
+  EXPECT_EQ(cache.stats().bytes, 20);
+  EXPECT_EQ(cache.stats().evictions, 0);
+}
+
+TEST(ChunkCacheTest, EvictsLeastRecentlyUsed) {
+  ChunkCache cache(60);
+  cache.Insert(1, MakeEntry(0, 5));
+  cache.Insert(2, MakeEntry(0, 5));
+  cache.Insert(3, MakeEntry(0, 5));
+
+  // Makes 1 the most recently used entry so 2 is evicted instead.
+  EXPECT_NE(cache.Get(1, 0, 5), nullptr);
+  cache.Insert(4, MakeEntry(0, 5));
+
+  EXPECT_NE(cache.Get(1, 0, 5), nullptr);
+  EXPECT_EQ(cache.Get(2, 0, 5), nullptr);
+  EXPECT_NE(cache.Get(3, 0, 5), nullptr);
+  EXPECT_NE(cache.Get(4, 0, 5), nullptr);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.evictions, 1);
+  EXPECT_EQ(stats.num_chunks, 3);
+  EXPECT_EQ(stats.bytes, 60);
+}
+
+TEST(ChunkCacheTest, EntriesLargerThanCacheAreNotInserted) {
+  ChunkCache cache(10);
+  cache.Insert(1, MakeEntry(0, 5));
+  EXPECT_EQ(cache.Get(1, 0, 5), nullptr);
+  EXPECT_EQ(cache.stats().num_chunks, 0);
+}
+
+TEST(ChunkCacheTest, EvictedEntriesRemainValid) {
+  ChunkCache cache(20);
+  cache.Insert(1, MakeEntry(0, 5));
+  auto entry = cache.Get(1, 0, 5);
+  cache.Insert(2, MakeEntry(0, 5));
+
+  EXPECT_EQ(cache.Get(1, 0, 5), nullptr);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->num_timesteps(), 5);
+}
+
+TEST(ChunkCacheTest, EntriesAreOrderedByRecency) {
+  ChunkCache cache(1000);
+  auto first = MakeEntry(0, 5);
+  auto second = MakeEntry(5, 5);
+  cache.Insert(1, first);
+  cache.Insert(2, second);
+  EXPECT_NE(cache.Get(1, 0, 5), nullptr);
+
+  EXPECT_THAT(cache.Entries(), ElementsAre(Pair(1, first), Pair(2, second)));
+}
+
+TEST(ChunkCacheTest, ConcurrentAccess) {
+  ChunkCache cache(400);
+  std::vector<std::unique_ptr<internal::Thread>> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.push_back(internal::StartThread("", [&cache, i] {
+      for (int j = 0; j < 1000; j++) {
+        const ChunkCache::Key key = (i * 1000 + j) % 50;
+        if (cache.Get(key, 0, 5) == nullptr) {
+          cache.Insert(key, MakeEntry(0, 5));
+        }
+      }
+    }));
+  }
+  threads.clear();  // Joins the threads.
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.hits + stats.misses, 8000);
+  EXPECT_LE(stats.bytes, 400);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
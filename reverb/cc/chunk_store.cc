@@ -14,50 +14,449 @@
 
 #include "reverb/cc/chunk_store.h"
 
+#include <functional>
 #include <memory>
 #include <utility>
 #include <vector>
 
 #include <cstdint>
+#include "google/protobuf/arena.h"
+#include "absl/hash/hash.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/chunk_spill_file.h"
+#include "reverb/cc/support/periodic_closure.h"
 #include "reverb/cc/support/queue.h"
+#include "reverb/cc/support/reclaimer.h"
+#include "reverb/cc/support/tracing.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/hash.h"
 
 namespace deepmind {
 namespace reverb {
+namespace {
 
-ChunkStore::ChunkStore(int cleanup_batch_size)
-    : delete_keys_(std::make_shared<internal::Queue<Key>>(10000000)),
-      cleaner_(internal::StartThread(
-          "ChunkStore-Cleaner", [this, cleanup_batch_size] {
-            while (CleanupInternal(cleanup_batch_size)) {
-            }
-          })) {}
+// Hands the chunk over the the shared reclaimer so that the (potentially
+// large) payload is deallocated away from the thread which released the last
+// reference. Chunks released by the reclaimer itself (i.e as part of
+// destroying an item) are deleted right away.
+void ReclaimChunk(ChunkStore::Chunk* chunk) {
+  if (internal::Reclaimer::IsReclaimerThread()) {
+    delete chunk;
+  } else {
+    internal::Reclaimer::Default()->Reclaim(
+        std::unique_ptr<ChunkStore::Chunk>(chunk));
+  }
+}
+
+// Initial arena block size of a chunk with `n` tensors is
+// kArenaBytesPerChunk + n * kArenaBytesPerTensor.
+constexpr int kArenaBytesPerChunk = 256;
+constexpr int kArenaBytesPerTensor = 256;
+
+// Hash of the tensors of `data` and of the fields which determine how they are
+// encoded. The key and the sequence range are not included.
+uint64_t PayloadHash(const ChunkData& data) {
+  uint64_t hash = tensorflow::Hash64Combine(
+      tensorflow::Hash64Combine(data.codec(), data.delta_encoded()),
+      data.block_length());
+  for (const auto& tensor : data.data().tensors()) {
+    hash = tensorflow::Hash64Combine(hash, tensor.dtype());
+    for (const auto& dim : tensor.tensor_shape().dim()) {
+      hash = tensorflow::Hash64Combine(hash, dim.size());
+    }
+    hash = tensorflow::Hash64Combine(
+        hash, tensorflow::Hash64(tensor.tensor_content().data(),
+                                 tensor.tensor_content().size()));
+    for (const auto& value : tensor.string_val()) {
+      hash = tensorflow::Hash64Combine(
+          hash, tensorflow::Hash64(value.data(), value.size()));
+    }
+  }
+  for (const auto& index : data.data().block_indices()) {
+    for (int64_t limit : index.limits()) {
+      hash = tensorflow::Hash64Combine(hash, limit);
+    }
+  }
+  return hash;
+}
+
+// True if `a` and `b` hold identical tensors encoded the same way. Only called
+// when the hashes match, i.e almost always for chunks which are identical, so
+// the cost of serializing both is not worth avoiding. The serialization is
+// deterministic as the tensors do not contain maps.
+bool SamePayload(const ChunkData& a, const ChunkData& b) {
+  return a.codec() == b.codec() && a.delta_encoded() == b.delta_encoded() &&
+         a.block_length() == b.block_length() &&
+         a.data().ByteSizeLong() == b.data().ByteSizeLong() &&
+         a.data().SerializeAsString() == b.data().SerializeAsString();
+}
+
+}  // namespace
+
+ChunkStore::Chunk::Chunk(ChunkData data)
+    : Chunk(std::move(data), /*use_arena=*/false, /*spill_file=*/nullptr) {}
+
+ChunkStore::Chunk::Chunk(ChunkData data, bool use_arena,
+                         std::shared_ptr<internal::ChunkSpillFile> spill_file)
+    : use_arena_(use_arena),
+      spill_file_(std::move(spill_file)),
+      data_byte_size_(data.ByteSizeLong()),
+      last_access_(absl::Now()) {
+  if (spill_file_ != nullptr) {
+    SetHeader(data);
+    resident_ = MakeResident(std::move(data), &allocated_bytes_);
+  } else {
+    data_ = MakeResident(std::move(data), &allocated_bytes_);
+  }
+}
+
+ChunkStore::Chunk::Chunk(const ChunkData& header, size_t data_byte_size,
+                         bool use_arena,
+                         std::shared_ptr<internal::ChunkSpillFile> file,
+                         const internal::ChunkSpillFile::Location& location)
+    : use_arena_(use_arena),
+      spill_file_(std::move(file)),
+      data_byte_size_(data_byte_size),
+      // The data has never been parsed so its serialized size is the best
+      // available estimate of its size in memory.
+      allocated_bytes_(data_byte_size),
+      location_(location),
+      last_access_(absl::Now()) {
+  REVERB_CHECK(spill_file_ != nullptr);
+  SetHeader(header);
+}
+
+ChunkStore::Chunk::Chunk(const ChunkData& header,
+                         std::shared_ptr<Chunk> payload)
+    : use_arena_(false),
+      payload_(std::move(payload)),
+      data_byte_size_(payload_->DataByteSizeLong()),
+      last_access_(absl::Now()) {
+  REVERB_CHECK(payload_->payload_ == nullptr);
+  SetHeader(header);
+  allocated_bytes_ = header_.SpaceUsedLong();
+}
+
+void ChunkStore::Chunk::SetHeader(const ChunkData& data) {
+  header_.set_chunk_key(data.chunk_key());
+  *header_.mutable_sequence_range() = data.sequence_range();
+  header_.set_delta_encoded(data.delta_encoded());
+  header_.set_codec(data.codec());
+  header_.set_block_length(data.block_length());
+}
+
+ChunkStore::Chunk::~Chunk() {
+  if (location_.has_value()) {
+    spill_file_->Release(*location_);
+  }
+}
+
+std::shared_ptr<const ChunkData> ChunkStore::Chunk::MakeResident(
+    ChunkData data, size_t* allocated_bytes) const {
+  if (!use_arena_) {
+    auto resident = std::make_shared<ChunkData>(std::move(data));
+    *allocated_bytes = resident->SpaceUsedLong();
+    return resident;
+  }
+
+  // The arena only holds the message objects and not the payload of the
+  // strings, so the first block is sized by the number of tensors.
+  google::protobuf::ArenaOptions options;
+  options.start_block_size =
+      kArenaBytesPerChunk + kArenaBytesPerTensor * data.data().tensors_size();
+  auto arena = std::make_shared<google::protobuf::Arena>(options);
+  auto* resident =
+      google::protobuf::Arena::CreateMessage<ChunkData>(arena.get());
+  resident->CopyFrom(data);
+  *allocated_bytes =
+      resident->SpaceUsedLong() + arena->SpaceAllocated() - arena->SpaceUsed();
+
+  // The aliasing constructor makes the arena the owner of the message.
+  return std::shared_ptr<const ChunkData>(std::move(arena), resident);
+}
+
+tensorflow::Status ChunkStore::Chunk::Load(
+    std::shared_ptr<const ChunkData>* data) const {
+  if (payload_ != nullptr) {
+    std::shared_ptr<const ChunkData> payload;
+    TF_RETURN_IF_ERROR(payload_->Load(&payload));
+    // The tensors are borrowed from the payload rather than copied and are
+    // released again before the merged proto is deleted.
+    auto* merged = new ChunkData(header_);
+    merged->unsafe_arena_set_allocated_data(
+        const_cast<ChunkData::Data*>(&payload->data()));
+    *data = std::shared_ptr<const ChunkData>(
+        merged, [payload = std::move(payload)](ChunkData* merged) {
+          merged->unsafe_arena_release_data();
+          delete merged;
+        });
+    return tensorflow::Status::OK();
+  }
+  if (spill_file_ == nullptr) {
+    *data = data_;
+    return tensorflow::Status::OK();
+  }
+
+  absl::MutexLock lock(&mu_);
+  last_access_ = absl::Now();
+  if (resident_ == nullptr) {
+    ChunkData loaded;
+    TF_RETURN_IF_ERROR(spill_file_->Read(*location_, &loaded));
+    // The allocation of the reloaded data matches the original allocation.
+    size_t unused_allocated_bytes;
+    resident_ = MakeResident(std::move(loaded), &unused_allocated_bytes);
+  }
+  *data = resident_;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ChunkStore::Chunk::Spill(absl::Duration cold_after) {
+  if (spill_file_ == nullptr) return tensorflow::Status::OK();
+
+  absl::MutexLock lock(&mu_);
+  if (resident_ == nullptr || absl::Now() - last_access_ < cold_after) {
+    return tensorflow::Status::OK();
+  }
+  if (!location_.has_value()) {
+    internal::ChunkSpillFile::Location location;
+    TF_RETURN_IF_ERROR(spill_file_->Append(*resident_, &location));
+    location_ = location;
+  }
+  // Callers of `Load` may still hold a reference to the data in which case it
+  // is released once they are done with it.
+  resident_ = nullptr;
+  return tensorflow::Status::OK();
+}
+
+void ChunkStore::Chunk::AddTableReference() {
+  if (num_table_references_.fetch_add(1, std::memory_order_relaxed) == 1 &&
+      stats_ != nullptr) {
+    stats_->num_shared_chunks.fetch_add(1, std::memory_order_relaxed);
+    stats_->shared_bytes.fetch_add(data_byte_size_, std::memory_order_relaxed);
+  }
+}
+
+void ChunkStore::Chunk::RemoveTableReference() {
+  const int previous =
+      num_table_references_.fetch_sub(1, std::memory_order_relaxed);
+  REVERB_CHECK_GT(previous, 0);
+  if (previous == 2 && stats_ != nullptr) {
+    stats_->num_shared_chunks.fetch_sub(1, std::memory_order_relaxed);
+    stats_->shared_bytes.fetch_sub(data_byte_size_, std::memory_order_relaxed);
+  }
+}
+
+bool ChunkStore::Chunk::IsResident() const {
+  if (payload_ != nullptr) return payload_->IsResident();
+  if (spill_file_ == nullptr) return true;
+  absl::MutexLock lock(&mu_);
+  return resident_ != nullptr;
+}
+
+ChunkStore::ChunkStore(int cleanup_batch_size, int num_shards)
+    : cleanup_batch_size_(cleanup_batch_size),
+      stats_(std::make_shared<Stats>()) {
+  REVERB_CHECK_GT(num_shards, 0);
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.push_back(absl::make_unique<Shard>());
+  }
+}
+
+tensorflow::Status ChunkStore::Create(const Options& options,
+                                      std::unique_ptr<ChunkStore>* store) {
+  if (options.cleanup_batch_size <= 0 || options.num_shards <= 0) {
+    return tensorflow::errors::InvalidArgument(
+        "cleanup_batch_size and num_shards must be > 0 but got ",
+        options.cleanup_batch_size, " and ", options.num_shards);
+  }
+  auto new_store = absl::make_unique<ChunkStore>(options.cleanup_batch_size,
+                                                 options.num_shards);
+  new_store->use_arenas_ = options.use_arenas;
+  if (options.deduplicate) {
+    new_store->content_index_ = std::make_shared<ContentIndex>();
+  }
+
+  const TieringOptions& tiering = options.tiering;
+  if (!tiering.spill_path.empty()) {
+    if (tiering.prefetch_queue_size <= 0) {
+      return tensorflow::errors::InvalidArgument(
+          "prefetch_queue_size must be > 0 but got ",
+          tiering.prefetch_queue_size);
+    }
+    std::unique_ptr<internal::ChunkSpillFile> spill_file;
+    TF_RETURN_IF_ERROR(
+        internal::ChunkSpillFile::Create(tiering.spill_path, &spill_file));
+
+    ChunkStore* raw = new_store.get();
+    raw->tiering_ = tiering;
+    raw->spill_file_ = std::move(spill_file);
+    raw->prefetch_queue_ =
+        absl::make_unique<internal::Queue<std::shared_ptr<Chunk>>>(
+            tiering.prefetch_queue_size);
+    raw->prefetcher_ = internal::StartThread("ChunkStore-Prefetcher", [raw] {
+      std::shared_ptr<Chunk> chunk;
+      std::shared_ptr<const ChunkData> unused;
+      while (raw->prefetch_queue_->Pop(&chunk)) {
+        auto status = chunk->Load(&unused);
+        if (!status.ok()) {
+          REVERB_LOG(REVERB_ERROR) << "Failed to prefetch chunk "
+                                   << chunk->data().chunk_key() << ": "
+                                   << status.ToString();
+        }
+        unused = nullptr;
+        chunk = nullptr;
+      }
+    });
+    raw->spiller_ = absl::make_unique<internal::PeriodicClosure>(
+        [raw] { raw->SpillColdChunks(); }, tiering.scan_interval,
+        "ChunkStore-Spiller");
+    TF_RETURN_IF_ERROR(raw->spiller_->Start());
+  }
+  *store = std::move(new_store);
+  return tensorflow::Status::OK();
+}
 
 ChunkStore::~ChunkStore() {
-  // Closing the queue makes all calls to `CleanupInternal` to return false
-  // which will break the loop in `cleaner_` making it joinable.
-  delete_keys_->Close();
-  cleaner_ = nullptr;  // Joins thread.
+  if (spiller_ != nullptr) {
+    REVERB_CHECK(spiller_->Stop().ok());
+  }
+  if (prefetch_queue_ != nullptr) {
+    prefetch_queue_->Close();
+    prefetcher_ = nullptr;  // Joins thread.
+  }
 }
 
 std::shared_ptr<ChunkStore::Chunk> ChunkStore::Insert(ChunkData item) {
-  absl::WriterMutexLock lock(&mu_);
-  std::weak_ptr<Chunk>& wp = data_[item.chunk_key()];
+  internal::ScopedSpan span("ChunkStore::Insert");
+  const Key key = item.chunk_key();
+  if (content_index_ == nullptr) {
+    return InsertIfAbsent(&ShardFor(key), key, [&] {
+      return new Chunk(std::move(item), use_arenas_, spill_file_);
+    });
+  }
+
+  const uint64_t hash = PayloadHash(item);
+  if (auto existing = FindByContent(hash, item)) {
+    return AliasIfAbsent(&ShardFor(key), item, std::move(existing));
+  }
+  Chunk* created = nullptr;
+  auto chunk = InsertIfAbsent(&ShardFor(key), key, [&] {
+    created = new Chunk(std::move(item), use_arenas_, spill_file_);
+    created->content_hash_ = hash;
+    created->content_index_ = content_index_;
+    return created;
+  });
+  if (chunk.get() == created) {
+    // A chunk with the same tensors may have been inserted concurrently, in
+    // which case only the first one is found by later inserts.
+    absl::MutexLock lock(&content_index_->mu);
+    std::weak_ptr<Chunk>& indexed = content_index_->chunks[hash];
+    if (indexed.expired()) indexed = chunk;
+  }
+  return chunk;
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::FindByContent(
+    uint64_t hash, const ChunkData& data) {
+  std::shared_ptr<Chunk> candidate;
+  {
+    absl::MutexLock lock(&content_index_->mu);
+    auto it = content_index_->chunks.find(hash);
+    if (it != content_index_->chunks.end()) candidate = it->second.lock();
+  }
+  // The candidate is compared (and possibly released) outside of the lock as
+  // its deleter removes it from the index.
+  if (candidate == nullptr) return nullptr;
+  std::shared_ptr<const ChunkData> candidate_data;
+  if (!candidate->Load(&candidate_data).ok() ||
+      !SamePayload(*candidate_data, data)) {
+    return nullptr;
+  }
+  return candidate;
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::AliasIfAbsent(
+    Shard* shard, const ChunkData& header, std::shared_ptr<Chunk> payload) {
+  absl::MutexLock lock(&shard->mu);
+  if (shard->expired->size.load(std::memory_order_relaxed) >=
+      cleanup_batch_size_) {
+    Cleanup(shard);
+  }
+
+  std::weak_ptr<Chunk>& wp = shard->data[header.chunk_key()];
   std::shared_ptr<Chunk> sp = wp.lock();
   if (sp == nullptr) {
-    wp = (sp = std::shared_ptr<Chunk>(new Chunk(std::move(item)),
-                                      [q = delete_keys_](Chunk* chunk) {
-                                        q->Push(chunk->data().chunk_key());
-                                        delete chunk;
-                                      }));
+    Chunk* alias = new Chunk(header, std::move(payload));
+    alias->stats_ = stats_;
+    stats_->num_deduplicated_keys.fetch_add(1, std::memory_order_relaxed);
+    stats_->deduplicated_bytes.fetch_add(alias->DataByteSizeLong(),
+                                         std::memory_order_relaxed);
+    wp = (sp = std::shared_ptr<Chunk>(
+              alias,
+              [expired = shard->expired, stats = stats_](Chunk* alias) {
+                stats->num_deduplicated_keys.fetch_sub(
+                    1, std::memory_order_relaxed);
+                stats->deduplicated_bytes.fetch_sub(
+                    alias->DataByteSizeLong(), std::memory_order_relaxed);
+                expired->Add(alias->data().chunk_key());
+                ReclaimChunk(alias);
+              }));
+  }
+  return sp;
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::InsertMapped(
+    const ChunkData& header, size_t data_byte_size,
+    std::shared_ptr<internal::ChunkSpillFile> file,
+    const internal::ChunkSpillFile::Location& location) {
+  const Key key = header.chunk_key();
+  return InsertIfAbsent(&ShardFor(key), key, [&] {
+    return new Chunk(header, data_byte_size, use_arenas_, std::move(file),
+                     location);
+  });
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::InsertIfAbsent(
+    Shard* shard, Key key, const std::function<Chunk*()>& make_chunk) {
+  absl::MutexLock lock(&shard->mu);
+  if (shard->expired->size.load(std::memory_order_relaxed) >=
+      cleanup_batch_size_) {
+    Cleanup(shard);
+  }
+
+  std::weak_ptr<Chunk>& wp = shard->data[key];
+  std::shared_ptr<Chunk> sp = wp.lock();
+  if (sp == nullptr) {
+    Chunk* chunk = make_chunk();
+    chunk->stats_ = stats_;
+    stats_->num_chunks.fetch_add(1, std::memory_order_relaxed);
+    stats_->data_bytes.fetch_add(chunk->DataByteSizeLong(),
+                                 std::memory_order_relaxed);
+    stats_->allocated_bytes.fetch_add(chunk->AllocatedBytes(),
+                                      std::memory_order_relaxed);
+    wp = (sp = std::shared_ptr<Chunk>(
+              chunk,
+              [expired = shard->expired, stats = stats_](Chunk* chunk) {
+                stats->num_chunks.fetch_sub(1, std::memory_order_relaxed);
+                stats->data_bytes.fetch_sub(chunk->DataByteSizeLong(),
+                                            std::memory_order_relaxed);
+                stats->allocated_bytes.fetch_sub(chunk->AllocatedBytes(),
+                                                 std::memory_order_relaxed);
+                expired->Add(chunk->data().chunk_key());
+                ReleaseContent(chunk);
+                ReclaimChunk(chunk);
+              }));
   }
   return sp;
 }
@@ -65,37 +464,147 @@ std::shared_ptr<ChunkStore::Chunk> ChunkStore::Insert(ChunkData item) {
 tensorflow::Status ChunkStore::Get(
     absl::Span<const ChunkStore::Key> keys,
     std::vector<std::shared_ptr<ChunkStore::Chunk>>* chunks) {
-  absl::ReaderMutexLock lock(&mu_);
   chunks->clear();
   chunks->reserve(keys.size());
-  for (int i = 0; i < keys.size(); i++) {
-    chunks->push_back(GetItem(keys[i]));
-    if (!chunks->at(i)) {
+  for (Key key : keys) {
+    Shard& shard = ShardFor(key);
+    {
+      absl::ReaderMutexLock lock(&shard.mu);
+      auto it = shard.data.find(key);
+      chunks->push_back(it == shard.data.end() ? nullptr : it->second.lock());
+    }
+    if (chunks->back() == nullptr) {
       return tensorflow::errors::NotFound(
-          absl::StrCat("Chunk ", keys[i], " cannot be found."));
+          absl::StrCat("Chunk ", key, " cannot be found."));
     }
   }
   return tensorflow::Status::OK();
 }
 
-std::shared_ptr<ChunkStore::Chunk> ChunkStore::GetItem(Key key) {
-  auto it = data_.find(key);
-  return it == data_.end() ? nullptr : it->second.lock();
+void ChunkStore::CleanupInternal() {
+  for (auto& shard : shards_) {
+    absl::MutexLock lock(&shard->mu);
+    Cleanup(shard.get());
+  }
+}
+
+void ChunkStore::Prefetch(absl::Span<const std::shared_ptr<Chunk>> chunks) {
+  if (prefetch_queue_ == nullptr) return;
+  for (const auto& chunk : chunks) {
+    if (chunk->IsResident()) continue;
+    // Prefetching is best effort so the caller should never block on it.
+    if (prefetch_queue_->size() >= tiering_.prefetch_queue_size) return;
+    prefetch_queue_->Push(chunk);
+  }
 }
 
-bool ChunkStore::CleanupInternal(int num_chunks) {
-  std::vector<Key> popped_keys;
-  popped_keys.reserve(num_chunks);
-  if (!delete_keys_->PopBatch(num_chunks, &popped_keys).ok()) {
-    return false;
+void ChunkStore::SpillColdChunks() {
+  std::vector<std::shared_ptr<Chunk>> chunks;
+  for (auto& shard : shards_) {
+    // Collect the chunks first so the spilling does not block the shard.
+    {
+      absl::MutexLock lock(&shard->mu);
+      chunks.reserve(shard->data.size());
+      for (const auto& entry : shard->data) {
+        if (auto chunk = entry.second.lock()) {
+          chunks.push_back(std::move(chunk));
+        }
+      }
+    }
+    for (const auto& chunk : chunks) {
+      auto status = chunk->Spill(tiering_.cold_after);
+      if (!status.ok()) {
+        REVERB_LOG(REVERB_ERROR) << "Failed to spill chunk "
+                                 << chunk->data().chunk_key() << ": "
+                                 << status.ToString();
+        break;
+      }
+    }
+    // Releasing the references outside of the lock as it might destroy chunks.
+    chunks.clear();
   }
+}
+
+ChunkStoreInfo ChunkStore::info() const {
+  ChunkStoreInfo info;
+  info.set_num_chunks(stats_->num_chunks.load(std::memory_order_relaxed));
+  info.set_data_bytes(stats_->data_bytes.load(std::memory_order_relaxed));
+  info.set_allocated_bytes(
+      stats_->allocated_bytes.load(std::memory_order_relaxed));
+  info.set_num_shared_chunks(
+      stats_->num_shared_chunks.load(std::memory_order_relaxed));
+  info.set_shared_bytes(stats_->shared_bytes.load(std::memory_order_relaxed));
+  info.set_num_deduplicated_keys(
+      stats_->num_deduplicated_keys.load(std::memory_order_relaxed));
+  info.set_deduplicated_bytes(
+      stats_->deduplicated_bytes.load(std::memory_order_relaxed));
+  return info;
+}
+
+void ChunkStore::ExportMetrics(internal::MetricsWriter* writer) const {
+  const ChunkStoreInfo store_info = info();
+  writer->AddGauge("reverb_chunk_store_chunks", "Number of live chunks.", {},
+                   store_info.num_chunks());
+  writer->AddGauge("reverb_chunk_store_data_bytes",
+                   "Serialized size of the live chunks.", {},
+                   store_info.data_bytes());
+  writer->AddGauge("reverb_chunk_store_allocated_bytes",
+                   "Memory allocated for the data of the live chunks.", {},
+                   store_info.allocated_bytes());
+  writer->AddGauge("reverb_chunk_store_shared_chunks",
+                   "Number of chunks referenced by more than one table.", {},
+                   store_info.num_shared_chunks());
+  writer->AddGauge("reverb_chunk_store_shared_bytes",
+                   "Serialized size of the chunks referenced by more than one "
+                   "table.",
+                   {}, store_info.shared_bytes());
+  writer->AddGauge("reverb_chunk_store_deduplicated_keys",
+                   "Number of keys which alias a chunk with identical "
+                   "tensors.",
+                   {}, store_info.num_deduplicated_keys());
+  writer->AddGauge("reverb_chunk_store_deduplicated_bytes",
+                   "Serialized size of the chunks aliased by deduplicated "
+                   "keys.",
+                   {}, store_info.deduplicated_bytes());
+  // Ratio of the bytes which would be stored without deduplication to the
+  // bytes which are actually stored.
+  writer->AddGauge(
+      "reverb_chunk_store_dedup_ratio",
+      "Ratio of the logical to the stored size of the live chunks.", {},
+      store_info.data_bytes() == 0
+          ? 1.0
+          : static_cast<double>(store_info.data_bytes() +
+                                store_info.deduplicated_bytes()) /
+                store_info.data_bytes());
+}
 
-  absl::WriterMutexLock data_lock(&mu_);
-  for (const Key& key : popped_keys) {
-    data_.erase(key);
+void ChunkStore::ReleaseContent(Chunk* chunk) {
+  if (chunk->content_index_ == nullptr) return;
+  ContentIndex* index = chunk->content_index_.get();
+  absl::MutexLock lock(&index->mu);
+  auto it = index->chunks.find(chunk->content_hash_);
+  if (it != index->chunks.end() && it->second.expired()) {
+    index->chunks.erase(it);
   }
+}
+
+ChunkStore::Shard& ChunkStore::ShardFor(Key key) {
+  return *shards_[absl::Hash<Key>()(key) % shards_.size()];
+}
 
-  return true;
+void ChunkStore::Cleanup(Shard* shard) {
+  std::vector<Key> keys;
+  {
+    absl::MutexLock lock(&shard->expired->mu);
+    std::swap(keys, shard->expired->keys);
+    shard->expired->size.store(0, std::memory_order_relaxed);
+  }
+  for (Key key : keys) {
+    auto it = shard->data.find(key);
+    if (it != shard->data.end() && it->second.expired()) {
+      shard->data.erase(it);
+    }
+  }
 }
 
 }  // namespace reverb
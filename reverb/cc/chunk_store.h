@@ -15,18 +15,26 @@
 #ifndef REVERB_CC_CHUNK_STORE_H_
 #define REVERB_CC_CHUNK_STORE_H_
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
-#include "absl/base/call_once.h"
 #include <cstdint>
 #include "absl/base/thread_annotations.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
 #include "absl/types/span.h"
 #include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/metrics.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/chunk_spill_file.h"
+#include "reverb/cc/support/incremental_hash_map.h"
+#include "reverb/cc/support/periodic_closure.h"
 #include "reverb/cc/support/queue.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -45,78 +53,368 @@ namespace reverb {
 // reason, Insert() returns a shared pointer, as otherwise the Chunk would be
 // destroyed right away.
 //
+// The mapping is split into shards by the hash of the key. Every shard has its
+// own lock and its own list of expired keys, so concurrent calls only contend
+// when they touch keys of the same shard. Expired entries are removed by the
+// next `Insert` into a shard once `cleanup_batch_size` keys of the shard have
+// expired, so no background thread is required.
+//
+// A store created with `TieringOptions` keeps only the metadata of chunks in
+// memory once they have not been loaded for `cold_after`. Their tensors are
+// written to an append-only spill file and read back on the next `Load`.
+//
+// Chunks inserted with `InsertMapped` start out with only their metadata in
+// memory and read their tensors from a memory mapped file (e.g the chunk file
+// of a checkpoint) on the first `Load`. Spilling such a chunk only drops the
+// parsed copy as the data remains available in the file.
+//
+// A store created with `deduplicate` set detects chunks whose tensors are
+// identical to those of a live chunk, e.g the same observations written by
+// several writers. Such a chunk isn't stored again; its key becomes an alias of
+// the live chunk instead. An alias is a chunk of its own which keeps the key,
+// the sequence range and thus the episode of the inserted data but shares the
+// tensors of the chunk it aliases, which is kept alive by the alias.
+//
 // All public methods are thread safe.
 class ChunkStore {
+ private:
+  struct Stats;
+  struct ExpiredKeys;
+  struct ContentIndex;
+
  public:
   using Key = uint64_t;
 
+  // Number of shards used unless a different value is passed to constructor.
+  static constexpr int kDefaultNumShards = 64;
+
   class Chunk {
    public:
-    explicit Chunk(ChunkData data) : data_(std::move(data)) {}
+    // Creates a chunk which is always resident in memory and whose data is
+    // allocated on the heap.
+    explicit Chunk(ChunkData data);
+
+    // Creates a chunk whose data is allocated on a protobuf arena owned by the
+    // chunk if `use_arena` is true. If `spill_file` is not null then the
+    // tensors of the chunk can be moved to `spill_file` by `Spill`.
+    Chunk(ChunkData data, bool use_arena,
+          std::shared_ptr<internal::ChunkSpillFile> spill_file);
+
+    // Creates a chunk which is not resident and whose complete proto data, of
+    // `data_byte_size` bytes when serialized, is stored at `location` of
+    // `file`. The tensors of `header` are ignored.
+    Chunk(const ChunkData& header, size_t data_byte_size, bool use_arena,
+          std::shared_ptr<internal::ChunkSpillFile> file,
+          const internal::ChunkSpillFile::Location& location);
+
+    // Creates an alias which holds all fields of `header` except for its
+    // tensors and shares the tensors of `payload`.
+    Chunk(const ChunkData& header, std::shared_ptr<Chunk> payload);
 
-    // Returns the proto data of the chunk.
-    const ChunkData& data() const { return data_; }
+    // Releases the space of the chunk in the spill file (if any).
+    ~Chunk();
 
-    // (Potentially cached) size of `data`.
-    size_t DataByteSizeLong() const {
-      absl::call_once(data_byte_size_once_,
-                      [this]() { data_byte_size_ = data_.ByteSizeLong(); });
-      return data_byte_size_;
+    // Returns the proto data of the chunk. For chunks which can be spilled and
+    // for aliases the tensors (i.e `data().data()`) are always empty and
+    // `Load` must be used to access them. All other fields are always
+    // populated.
+    const ChunkData& data() const {
+      return data_ != nullptr ? *data_ : header_;
+    }
+
+    // Returns the complete proto data of the chunk, reading it back from the
+    // spill file if required.
+    tensorflow::Status Load(std::shared_ptr<const ChunkData>* data) const
+        ABSL_LOCKS_EXCLUDED(mu_);
+
+    // Writes the tensors of the chunk to the spill file and releases them from
+    // memory. Chunks which are not spillable, already spilled or which have
+    // been loaded more recently than `cold_after` ago are left untouched.
+    tensorflow::Status Spill(absl::Duration cold_after)
+        ABSL_LOCKS_EXCLUDED(mu_);
+
+    // True if the tensors of the chunk are held in memory.
+    bool IsResident() const ABSL_LOCKS_EXCLUDED(mu_);
+
+    // Size of the complete proto data when serialized.
+    size_t DataByteSizeLong() const { return data_byte_size_; }
+
+    // Approximate number of bytes allocated to hold the complete proto data in
+    // memory, including unused space of the arena (if any).
+    size_t AllocatedBytes() const { return allocated_bytes_; }
+
+    // Called by a table when it starts and stops referencing the chunk, i.e
+    // when the first item of the table which references the chunk is inserted
+    // and when the last one is removed. Used to keep track of how many chunks
+    // are shared between tables.
+    void AddTableReference();
+    void RemoveTableReference();
+
+    // Number of tables which currently reference the chunk.
+    int num_table_references() const {
+      return num_table_references_.load(std::memory_order_relaxed);
     }
 
    private:
-    ChunkData data_;
-    mutable size_t data_byte_size_;
-    mutable absl::once_flag data_byte_size_once_;
+    friend class ChunkStore;
+
+    // Copies all fields but the tensors of `data` to `header_`.
+    void SetHeader(const ChunkData& data);
+
+    // Takes ownership of `data` and moves it to the heap or to a new arena.
+    // `allocated_bytes` is set to the number of bytes allocated for the data.
+    std::shared_ptr<const ChunkData> MakeResident(
+        ChunkData data, size_t* allocated_bytes) const;
+
+    const bool use_arena_;
+
+    // Only set for chunks which can be spilled or which are mapped.
+    const std::shared_ptr<internal::ChunkSpillFile> spill_file_;
+
+    // Complete proto data of chunks which can not be spilled.
+    std::shared_ptr<const ChunkData> data_;
+
+    // Proto data without the tensors of chunks which can be spilled and of
+    // aliases.
+    ChunkData header_;
+
+    // Chunk whose tensors are shared by an alias. Null for all other chunks.
+    const std::shared_ptr<Chunk> payload_;
+
+    size_t data_byte_size_;
+    size_t allocated_bytes_;
+
+    mutable absl::Mutex mu_;
+
+    // Complete proto data if a spillable chunk is resident. Null for spilled
+    // chunks.
+    mutable std::shared_ptr<const ChunkData> resident_ ABSL_GUARDED_BY(mu_);
+
+    // Location of the data in `spill_file_`. Set the first time the chunk is
+    // spilled and kept after loading so repeated spills don't rewrite it.
+    absl::optional<internal::ChunkSpillFile::Location> location_
+        ABSL_GUARDED_BY(mu_);
+
+    // Time of the last call to `Load` (or construction).
+    mutable absl::Time last_access_ ABSL_GUARDED_BY(mu_);
+
+    std::atomic<int> num_table_references_{0};
+
+    // Totals of the store which created the chunk. Null for chunks which were
+    // not created by a store.
+    std::shared_ptr<Stats> stats_;
+
+    // Hash of the tensors if the chunk is in the content index of a store
+    // with deduplication, together with the index.
+    uint64_t content_hash_ = 0;
+    std::shared_ptr<ContentIndex> content_index_;
   };
 
-  // Starts `cleaner_`. `cleanup_batch_size` is the number of keys the cleaner
-  // should wait for before acquiring the lock and erasing them from `data_`.
-  explicit ChunkStore(int cleanup_batch_size = 1000);
+  // Configures a tiered store which spills the tensors of chunks that have
+  // not been loaded for a while to a file on local disk.
+  struct TieringOptions {
+    // Path of the spill file. Tiering is disabled if empty.
+    std::string spill_path;
+
+    // Chunks which have not been loaded for this long are spilled.
+    absl::Duration cold_after = absl::Minutes(5);
+
+    // How often all chunks are scanned for cold chunks.
+    absl::Duration scan_interval = absl::Seconds(30);
+
+    // Maximum number of chunks queued with `Prefetch`. Chunks are dropped
+    // from the request when the queue is full.
+    int prefetch_queue_size = 10000;
+  };
 
-  // Stops `cleaner_` closes `delete_keys_`.
+  struct Options {
+    // Number of expired keys a shard collects before they are erased from the
+    // shard.
+    int cleanup_batch_size = 1000;
+
+    // Number of shards of the mapping. Must be positive.
+    int num_shards = kDefaultNumShards;
+
+    // If true, the data of every chunk is copied to a protobuf arena owned by
+    // the chunk when inserted, so that the many small allocations of a parsed
+    // chunk are made from a few blocks and released together with the chunk.
+    bool use_arenas = false;
+
+    // If true, chunks whose tensors are identical to those of a live chunk are
+    // stored as aliases of that chunk (see the class comment). Costs a hash of
+    // the tensors of every inserted chunk.
+    bool deduplicate = false;
+
+    TieringOptions tiering;
+  };
+
+  // `cleanup_batch_size` is the number of expired keys a shard collects before
+  // they are erased from the shard. `num_shards` must be positive.
+  explicit ChunkStore(int cleanup_batch_size = 1000,
+                      int num_shards = kDefaultNumShards);
+
+  // Creates a store configured by `options`.
+  static tensorflow::Status Create(const Options& options,
+                                   std::unique_ptr<ChunkStore>* store);
+
+  // Stops the spilling and prefetching threads (if any).
   ~ChunkStore();
 
   // Attempts to insert a Chunk into the map using the key inside `item`. If no
   // entry existed for the key, a new Chunk is created, inserted and returned.
-  // Otherwise, the existing chunk is returned.
-  std::shared_ptr<Chunk> Insert(ChunkData item) ABSL_LOCKS_EXCLUDED(mu_);
+  // Otherwise, the existing chunk is returned. With deduplication, a live
+  // chunk with the same tensors is returned (and aliased by the key of
+  // `item`) rather than creating a new one.
+  std::shared_ptr<Chunk> Insert(ChunkData item);
+
+  // Like `Insert` but creates a chunk which reads its data from `location` of
+  // `file` the first time it is loaded. `header` holds all fields of the chunk
+  // except for its tensors and `data_byte_size` is the size of the serialized
+  // chunk in `file`.
+  std::shared_ptr<Chunk> InsertMapped(
+      const ChunkData& header, size_t data_byte_size,
+      std::shared_ptr<internal::ChunkSpillFile> file,
+      const internal::ChunkSpillFile::Location& location);
 
   // Gets the Chunk for each given key. Returns an error if one of the items
-  // does not exist or if `Close` has been called. On success, the returned
-  // items are in the same order as given in `keys`.
+  // does not exist. On success, the returned items are in the same order as
+  // given in `keys`.
   tensorflow::Status Get(absl::Span<const Key> keys,
-                         std::vector<std::shared_ptr<Chunk>>* chunks)
-      ABSL_LOCKS_EXCLUDED(mu_);
+                         std::vector<std::shared_ptr<Chunk>>* chunks);
 
-  // Blocks until `num_chunks` expired entries have been cleaned up from
-  // `data_`. This method is called automatically by a background thread to
-  // limit memory size, but does not have any effect on the semantics of Get()
-  // or Insert() calls.
-  //
-  // Returns false if `delete_keys_` closed before `num_chunks` could be popped.
-  bool CleanupInternal(int num_chunks) ABSL_LOCKS_EXCLUDED(mu_);
+  // Erases all expired entries from every shard. This is called automatically
+  // by `Insert` to limit memory size, but does not have any effect on the
+  // semantics of Get() or Insert() calls.
+  void CleanupInternal();
+
+  // Loads spilled chunks back into memory on a background thread so that a
+  // subsequent `Chunk::Load` doesn't have to block on disk. No-op if tiering
+  // is disabled.
+  void Prefetch(absl::Span<const std::shared_ptr<Chunk>> chunks);
+
+  // Spills all chunks which are cold according to the tiering options. This
+  // method is called periodically by a background thread.
+  void SpillColdChunks();
+
+  // Returns the number and memory usage of the live chunks.
+  ChunkStoreInfo info() const;
+
+  // Exports `info()` as gauges.
+  void ExportMetrics(internal::MetricsWriter* writer) const;
 
  private:
-  // Gets an item. Returns nullptr if the item does not exist.
-  std::shared_ptr<Chunk> GetItem(Key key) ABSL_SHARED_LOCKS_REQUIRED(mu_);
+  // Keys of chunks which have been destroyed. The deleter of every Chunk holds
+  // a reference to the list of its shard, which is why it is allocated on the
+  // heap. This avoids dereferencing errors caused by a stack allocated
+  // ChunkStore getting destroyed before all Chunk have been destroyed.
+  struct ExpiredKeys {
+    absl::Mutex mu;
+    std::vector<Key> keys ABSL_GUARDED_BY(mu);
+
+    // Size of `keys`. Read without holding `mu` to keep `Insert` cheap.
+    std::atomic<int> size{0};
+
+    void Add(Key key) ABSL_LOCKS_EXCLUDED(mu) {
+      absl::MutexLock lock(&mu);
+      keys.push_back(key);
+      size.store(keys.size(), std::memory_order_relaxed);
+    }
+  };
+
+  // Running totals over all live chunks. Shared with the deleters of the
+  // chunks for the same reason as `ExpiredKeys`.
+  struct Stats {
+    std::atomic<int64_t> num_chunks{0};
+    std::atomic<int64_t> data_bytes{0};
+    std::atomic<int64_t> allocated_bytes{0};
+
+    // Chunks which are referenced by more than one table and the sum of their
+    // `DataByteSizeLong`.
+    std::atomic<int64_t> num_shared_chunks{0};
+    std::atomic<int64_t> shared_bytes{0};
+
+    // Keys which alias a live chunk and the sum of the `DataByteSizeLong` of
+    // the chunks they alias, i.e the bytes which deduplication saved.
+    std::atomic<int64_t> num_deduplicated_keys{0};
+    std::atomic<int64_t> deduplicated_bytes{0};
+  };
+
+  // Live chunks of a store with deduplication, keyed by the hash of their
+  // tensors. Shared with the deleters of the chunks, which remove their
+  // entries.
+  struct ContentIndex {
+    absl::Mutex mu;
+    internal::flat_hash_map<uint64_t, std::weak_ptr<Chunk>> chunks
+        ABSL_GUARDED_BY(mu);
+  };
+
+  struct Shard {
+    Shard() : expired(std::make_shared<ExpiredKeys>()) {}
+
+    // Mutex protecting access to `data`.
+    absl::Mutex mu;
+
+    // Holds the actual mapping of key to Chunk. We only hold a weak pointer to
+    // the Chunk, which means that destruction and reference counting of the
+    // chunks happens independently of this map. The number of chunks is
+    // unbounded so the map grows incrementally rather than rehashing all of
+    // its chunks at once.
+    internal::IncrementalHashMap<Key, std::weak_ptr<Chunk>> data
+        ABSL_GUARDED_BY(mu);
+
+    std::shared_ptr<ExpiredKeys> expired;
+  };
+
+  // Returns the shard which holds `key`.
+  Shard& ShardFor(Key key);
+
+  // Returns a live chunk whose tensors are identical to those of `data`, or
+  // null if there is none. `hash` is the hash of the tensors of `data`.
+  std::shared_ptr<Chunk> FindByContent(uint64_t hash, const ChunkData& data)
+      ABSL_LOCKS_EXCLUDED(content_index_->mu);
+
+  // Returns the live chunk of the key of `header` in `shard` or, if there is
+  // none, inserts and returns an alias with the fields of `header` which
+  // shares the tensors of `payload`.
+  std::shared_ptr<Chunk> AliasIfAbsent(Shard* shard, const ChunkData& header,
+                                       std::shared_ptr<Chunk> payload)
+      ABSL_LOCKS_EXCLUDED(shard->mu);
+
+  // Returns the live chunk of `key` in `shard` or, if there is none, inserts
+  // and returns the chunk created by `make_chunk`.
+  std::shared_ptr<Chunk> InsertIfAbsent(
+      Shard* shard, Key key, const std::function<Chunk*()>& make_chunk)
+      ABSL_LOCKS_EXCLUDED(shard->mu);
+
+  // Called by the deleter of `chunk`. Removes the chunk from the content
+  // index.
+  static void ReleaseContent(Chunk* chunk);
+
+  // Erases the entries of the expired keys of `shard` from `shard->data`.
+  // Entries which have been replaced by a live chunk since the key expired are
+  // kept.
+  static void Cleanup(Shard* shard) ABSL_EXCLUSIVE_LOCKS_REQUIRED(shard->mu);
+
+  // Number of expired keys in a shard which trigger a cleanup.
+  const int cleanup_batch_size_;
+
+  // Shards of the mapping. Never resized after construction.
+  std::vector<std::unique_ptr<Shard>> shards_;
 
-  // Holds the actual mapping of key to Chunk. We only hold a weak pointer to
-  // the Chunk, which means that destruction and reference counting of the
-  // chunks happens independently of this map.
-  internal::flat_hash_map<Key, std::weak_ptr<Chunk>> data_ ABSL_GUARDED_BY(mu_);
+  // Allocate the data of chunks on protobuf arenas.
+  bool use_arenas_ = false;
 
-  // Mutex protecting access to `data_`.
-  mutable absl::Mutex mu_;
+  // Only set if deduplication is enabled.
+  std::shared_ptr<ContentIndex> content_index_;
 
-  // Queue of keys of deleted items that will be cleaned up by `cleaner_`. Note
-  // the queue have to be allocated on the heap in order to avoid dereferencing
-  // errors caused by a stack allocated ChunkStore getting destroyed before all
-  // Chunk have been destroyed.
-  std::shared_ptr<internal::Queue<Key>> delete_keys_;
+  std::shared_ptr<Stats> stats_;
 
-  // Consumes `delete_keys_` to remove dead pointers in `data_`.
-  std::unique_ptr<internal::Thread> cleaner_;
+  // Only set if tiering is enabled.
+  TieringOptions tiering_;
+  std::shared_ptr<internal::ChunkSpillFile> spill_file_;
+  std::unique_ptr<internal::PeriodicClosure> spiller_;
+  std::unique_ptr<internal::Queue<std::shared_ptr<Chunk>>> prefetch_queue_;
+  std::unique_ptr<internal::Thread> prefetcher_;
 };
 
 }  // namespace reverb
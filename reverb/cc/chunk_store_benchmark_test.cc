@@ -0,0 +1,177 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of `ChunkStore` when many insert streams insert and
+// release chunks concurrently, with and without sharding, the heap usage with
+// and without arena allocation and the latency of loading chunks which have
+// been spilled to disk by a tiered store. The test
+// is tagged as manual and has to be run explicitly:
+//
+//   bazel test -c opt //reverb/cc:chunk_store_benchmark_test \
+//     --test_output=streamed
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/heap_stats.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/reclaimer.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr int kNumProducers = 128;
+constexpr int kChunksPerProducer = 20000;
+
+// Every producer mimics an insert stream: it inserts chunks, looks them up
+// again when the item referencing them is created and keeps the last few
+// alive so that chunks expire while other producers are inserting.
+void RunBenchmark(int num_shards) {
+  ChunkStore store(/*cleanup_batch_size=*/1000, num_shards);
+  absl::Notification start;
+  std::vector<std::unique_ptr<internal::Thread>> producers;
+  for (int p = 0; p < kNumProducers; p++) {
+    producers.push_back(internal::StartThread("", [p, &store, &start] {
+      std::vector<std::shared_ptr<ChunkStore::Chunk>> alive(10);
+      std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+      start.WaitForNotification();
+      for (int i = 0; i < kChunksPerProducer; i++) {
+        ChunkStore::Key key =
+            static_cast<ChunkStore::Key>(p) * kChunksPerProducer + i;
+        alive[i % alive.size()] = store.Insert(testing::MakeChunkData(key));
+        TF_ASSERT_OK(store.Get({key}, &chunks));
+      }
+    }));
+  }
+
+  absl::Time begin = absl::Now();
+  start.Notify();
+  producers.clear();  // Joins all threads.
+  absl::Duration elapsed = absl::Now() - begin;
+
+  REVERB_LOG(REVERB_INFO)
+      << num_shards << " shard(s), " << kNumProducers
+      << " producers: " << absl::ToDoubleSeconds(elapsed) << "s, "
+      << (kNumProducers * kChunksPerProducer) / absl::ToDoubleSeconds(elapsed)
+      << " chunks/s";
+}
+
+TEST(ChunkStoreBenchmark, SingleShard) { RunBenchmark(1); }
+
+TEST(ChunkStoreBenchmark, DefaultNumShards) {
+  RunBenchmark(ChunkStore::kDefaultNumShards);
+}
+
+// Inserts and releases chunks with tensors of varying size while a window of
+// recent chunks is kept alive, and reports the heap usage afterwards.
+void RunChurn(bool use_arenas) {
+  constexpr int kNumChunks = 50000;
+  constexpr int kNumAlive = 1000;
+  constexpr int kTensorsPerChunk = 8;
+
+  ChunkStore::Options options;
+  options.use_arenas = use_arenas;
+  std::unique_ptr<ChunkStore> store;
+  TF_ASSERT_OK(ChunkStore::Create(options, &store));
+
+  absl::BitGen bit_gen;
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> alive(kNumAlive);
+  absl::Time start = absl::Now();
+  for (int i = 0; i < kNumChunks; i++) {
+    ChunkData data = testing::MakeChunkData(i);
+    for (int t = 0; t < kTensorsPerChunk; t++) {
+      data.mutable_data()->add_tensors()->set_tensor_content(
+          std::string(absl::Uniform<int>(bit_gen, 1 << 10, 64 << 10), 'x'));
+    }
+    alive[i % kNumAlive] = store->Insert(std::move(data));
+  }
+  absl::Duration elapsed = absl::Now() - start;
+  internal::Reclaimer::Default()->Flush();
+
+  ChunkStoreInfo info = store->info();
+  internal::HeapStats heap;
+  internal::GetHeapStats(&heap);
+  REVERB_LOG(REVERB_INFO)
+      << (use_arenas ? "arena" : "heap") << " chunks: insert="
+      << elapsed / kNumChunks << " data_bytes=" << info.data_bytes()
+      << " allocated_bytes=" << info.allocated_bytes()
+      << " heap_allocated=" << heap.allocated_bytes
+      << " heap_in_use=" << heap.in_use_bytes;
+}
+
+TEST(ChunkStoreBenchmark, HeapChurn) { RunChurn(/*use_arenas=*/false); }
+
+TEST(ChunkStoreBenchmark, ArenaChurn) { RunChurn(/*use_arenas=*/true); }
+
+// Compares `Chunk::Load` of resident chunks with loads of spilled chunks. The
+// spill file is most likely still in the page cache so the spilled numbers are
+// a lower bound for the latency on a server under memory pressure.
+TEST(ChunkStoreBenchmark, SpilledLoadLatency) {
+  constexpr int kNumChunks = 10000;
+  constexpr int kChunkBytes = 64 << 10;
+
+  ChunkStore::Options options;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(
+      &options.tiering.spill_path));
+  options.tiering.cold_after = absl::ZeroDuration();
+  options.tiering.scan_interval = absl::Hours(1);
+  std::unique_ptr<ChunkStore> store;
+  TF_ASSERT_OK(ChunkStore::Create(options, &store));
+
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  for (int i = 0; i < kNumChunks; i++) {
+    ChunkData data = testing::MakeChunkData(i);
+    data.mutable_data()->add_tensors()->set_tensor_content(
+        std::string(kChunkBytes, 'a' + i % 26));
+    chunks.push_back(store->Insert(std::move(data)));
+  }
+
+  auto load_all = [&chunks] {
+    std::shared_ptr<const ChunkData> data;
+    absl::Time start = absl::Now();
+    for (const auto& chunk : chunks) {
+      TF_CHECK_OK(chunk->Load(&data));
+    }
+    return (absl::Now() - start) / chunks.size();
+  };
+
+  absl::Duration resident = load_all();
+  absl::Time start = absl::Now();
+  store->SpillColdChunks();
+  absl::Duration spill = (absl::Now() - start) / chunks.size();
+  absl::Duration spilled = load_all();
+
+  REVERB_LOG(REVERB_INFO) << "Chunks of " << kChunkBytes
+                          << " bytes: resident load=" << resident
+                          << " spill=" << spill
+                          << " spilled load=" << spilled;
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -16,15 +16,21 @@
 
 #include <atomic>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/chunk_spill_file.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
 
 namespace deepmind {
 namespace reverb {
@@ -103,8 +109,41 @@ TEST(ChunkStoreTest, CleanupDoesNotDeleteRequiredChunks) {
   }
 }
 
-TEST(ChunkStoreTest, ConcurrentCalls) {
-  ChunkStore store;
+TEST(ChunkStoreTest, CleanupKeepsReinsertedChunks) {
+  ChunkStore store(/*cleanup_batch_size=*/1);
+  store.Insert(testing::MakeChunkData(1));
+
+  // The key has expired but is inserted again before the cleanup.
+  std::shared_ptr<ChunkStore::Chunk> second =
+      store.Insert(testing::MakeChunkData(1));
+  store.CleanupInternal();
+
+  ChunkVector chunks;
+  TF_ASSERT_OK(store.Get({1}, &chunks));
+  EXPECT_EQ(chunks[0], second);
+}
+
+TEST(ChunkStoreTest, GetReturnsChunksFromAllShards) {
+  ChunkStore store(/*cleanup_batch_size=*/1000, /*num_shards=*/4);
+  ChunkVector inserted;
+  for (ChunkStore::Key i = 0; i < 100; i++) {
+    inserted.push_back(store.Insert(testing::MakeChunkData(i)));
+  }
+  std::vector<ChunkStore::Key> keys;
+  for (ChunkStore::Key i = 100; i > 0; i--) {
+    keys.push_back(i - 1);
+  }
+  ChunkVector chunks;
+  TF_ASSERT_OK(store.Get(keys, &chunks));
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(chunks[i], inserted[99 - i]);
+  }
+}
+
+class ChunkStoreConcurrencyTest : public ::testing::TestWithParam<int> {};
+
+TEST_P(ChunkStoreConcurrencyTest, ConcurrentCalls) {
+  ChunkStore store(/*cleanup_batch_size=*/10, /*num_shards=*/GetParam());
   std::vector<std::unique_ptr<internal::Thread>> bundle;
   std::atomic<int> count(0);
   for (ChunkStore::Key i = 0; i < 1000; i++) {
@@ -123,6 +162,284 @@ TEST(ChunkStoreTest, ConcurrentCalls) {
   EXPECT_EQ(count, 1000);
 }
 
+INSTANTIATE_TEST_SUITE_P(NumShards, ChunkStoreConcurrencyTest,
+                         ::testing::Values(1, ChunkStore::kDefaultNumShards));
+
+ChunkData MakeChunkWithTensors(ChunkStore::Key key) {
+  ChunkData data = testing::MakeChunkData(key);
+  data.set_delta_encoded(true);
+  data.mutable_data()->add_tensors()->set_tensor_content(
+      std::string(1000, 'x'));
+  return data;
+}
+
+std::unique_ptr<ChunkStore> MakeTieredStore(absl::Duration cold_after,
+                                            bool use_arenas = false) {
+  ChunkStore::Options options;
+  options.use_arenas = use_arenas;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(
+      &options.tiering.spill_path));
+  options.tiering.cold_after = cold_after;
+  options.tiering.scan_interval = absl::Hours(1);
+  std::unique_ptr<ChunkStore> store;
+  REVERB_CHECK(ChunkStore::Create(options, &store).ok());
+  return store;
+}
+
+TEST(ChunkStoreTest, LoadReturnsDataOfResidentChunk) {
+  ChunkStore store;
+  auto chunk = store.Insert(MakeChunkWithTensors(1));
+  std::shared_ptr<const ChunkData> data;
+  TF_ASSERT_OK(chunk->Load(&data));
+  EXPECT_EQ(data.get(), &chunk->data());
+  EXPECT_TRUE(chunk->IsResident());
+}
+
+TEST(ChunkStoreTest, ArenaChunksHoldCopyOfData) {
+  ChunkStore::Options options;
+  options.use_arenas = true;
+  std::unique_ptr<ChunkStore> store;
+  TF_ASSERT_OK(ChunkStore::Create(options, &store));
+
+  ChunkData expected = MakeChunkWithTensors(1);
+  auto chunk = store->Insert(expected);
+  EXPECT_THAT(chunk->data(), testing::EqualsProto(expected));
+  EXPECT_NE(chunk->data().GetArena(), nullptr);
+  EXPECT_EQ(chunk->DataByteSizeLong(), expected.ByteSizeLong());
+  EXPECT_GE(chunk->AllocatedBytes(), chunk->DataByteSizeLong());
+}
+
+TEST(ChunkStoreTest, TieredStoreWithArenasReloadsIntoArena) {
+  auto store = MakeTieredStore(absl::ZeroDuration(), /*use_arenas=*/true);
+  ChunkData expected = MakeChunkWithTensors(1);
+  auto chunk = store->Insert(expected);
+  store->SpillColdChunks();
+
+  std::shared_ptr<const ChunkData> data;
+  TF_ASSERT_OK(chunk->Load(&data));
+  EXPECT_THAT(*data, testing::EqualsProto(expected));
+  EXPECT_NE(data->GetArena(), nullptr);
+}
+
+TEST(ChunkStoreTest, InfoTracksLiveChunks) {
+  ChunkStore store;
+  EXPECT_EQ(store.info().data_bytes(), 0);
+  EXPECT_EQ(store.info().allocated_bytes(), 0);
+
+  auto first = store.Insert(MakeChunkWithTensors(1));
+  auto second = store.Insert(MakeChunkWithTensors(2));
+  // Inserting an existing chunk again does not count it twice.
+  auto first_again = store.Insert(MakeChunkWithTensors(1));
+
+  ChunkStoreInfo info = store.info();
+  EXPECT_EQ(info.num_chunks(), 2);
+  EXPECT_EQ(info.data_bytes(),
+            first->DataByteSizeLong() + second->DataByteSizeLong());
+  EXPECT_EQ(info.allocated_bytes(),
+            first->AllocatedBytes() + second->AllocatedBytes());
+
+  first = nullptr;
+  first_again = nullptr;
+  EXPECT_EQ(store.info().num_chunks(), 1);
+  EXPECT_EQ(store.info().data_bytes(), second->DataByteSizeLong());
+
+  second = nullptr;
+  EXPECT_EQ(store.info().num_chunks(), 0);
+  EXPECT_EQ(store.info().data_bytes(), 0);
+  EXPECT_EQ(store.info().allocated_bytes(), 0);
+}
+
+TEST(ChunkStoreTest, InfoTracksChunksSharedBetweenTables) {
+  ChunkStore store;
+  auto chunk = store.Insert(MakeChunkWithTensors(1));
+
+  chunk->AddTableReference();
+  EXPECT_EQ(store.info().num_shared_chunks(), 0);
+
+  chunk->AddTableReference();
+  chunk->AddTableReference();
+  EXPECT_EQ(chunk->num_table_references(), 3);
+  EXPECT_EQ(store.info().num_shared_chunks(), 1);
+  EXPECT_EQ(store.info().shared_bytes(), chunk->DataByteSizeLong());
+
+  chunk->RemoveTableReference();
+  EXPECT_EQ(store.info().num_shared_chunks(), 1);
+  chunk->RemoveTableReference();
+  EXPECT_EQ(store.info().num_shared_chunks(), 0);
+  EXPECT_EQ(store.info().shared_bytes(), 0);
+  chunk->RemoveTableReference();
+  EXPECT_EQ(chunk->num_table_references(), 0);
+}
+
+TEST(ChunkStoreTest, TieredStoreSpillsColdChunks) {
+  auto store = MakeTieredStore(absl::ZeroDuration());
+  ChunkData expected = MakeChunkWithTensors(1);
+  auto chunk = store->Insert(expected);
+  EXPECT_EQ(chunk->DataByteSizeLong(), expected.ByteSizeLong());
+
+  // Only the metadata is held outside of `Load`.
+  EXPECT_EQ(chunk->data().chunk_key(), 1);
+  EXPECT_TRUE(chunk->data().delta_encoded());
+  EXPECT_EQ(chunk->data().data().tensors_size(), 0);
+
+  store->SpillColdChunks();
+  EXPECT_FALSE(chunk->IsResident());
+
+  std::shared_ptr<const ChunkData> data;
+  TF_ASSERT_OK(chunk->Load(&data));
+  EXPECT_THAT(*data, testing::EqualsProto(expected));
+  EXPECT_TRUE(chunk->IsResident());
+  EXPECT_EQ(chunk->DataByteSizeLong(), expected.ByteSizeLong());
+}
+
+TEST(ChunkStoreTest, TieredStoreKeepsRecentlyLoadedChunks) {
+  auto store = MakeTieredStore(absl::Hours(1));
+  auto chunk = store->Insert(MakeChunkWithTensors(1));
+  store->SpillColdChunks();
+  EXPECT_TRUE(chunk->IsResident());
+}
+
+TEST(ChunkStoreTest, PrefetchLoadsSpilledChunks) {
+  auto store = MakeTieredStore(absl::ZeroDuration());
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  for (ChunkStore::Key i = 0; i < 10; i++) {
+    chunks.push_back(store->Insert(MakeChunkWithTensors(i)));
+  }
+  store->SpillColdChunks();
+  store->Prefetch(chunks);
+  for (const auto& chunk : chunks) {
+    while (!chunk->IsResident()) {
+      absl::SleepFor(absl::Milliseconds(1));
+    }
+  }
+}
+
+TEST(ChunkStoreTest, InsertMappedLoadsDataFromFile) {
+  std::string path;
+  ASSERT_TRUE(tensorflow::Env::Default()->LocalTempFilename(&path));
+  std::unique_ptr<internal::ChunkSpillFile> writer;
+  TF_ASSERT_OK(internal::ChunkSpillFile::Create(path, &writer));
+  ChunkData expected = MakeChunkWithTensors(1);
+  internal::ChunkSpillFile::Location location;
+  TF_ASSERT_OK(writer->Append(expected, &location));
+
+  ChunkStore store;
+  auto chunk = store.InsertMapped(expected, expected.ByteSizeLong(),
+                                  std::move(writer), location);
+  EXPECT_FALSE(chunk->IsResident());
+  EXPECT_EQ(chunk->data().chunk_key(), 1);
+  EXPECT_EQ(chunk->data().data().tensors_size(), 0);
+  EXPECT_EQ(chunk->DataByteSizeLong(), expected.ByteSizeLong());
+  EXPECT_EQ(store.info().data_bytes(), expected.ByteSizeLong());
+
+  // Inserting the same key again returns the existing chunk.
+  EXPECT_EQ(store.Insert(expected), chunk);
+
+  std::shared_ptr<const ChunkData> data;
+  TF_ASSERT_OK(chunk->Load(&data));
+  EXPECT_THAT(*data, testing::EqualsProto(expected));
+  EXPECT_TRUE(chunk->IsResident());
+
+  // Spilling drops the parsed data without writing it again.
+  data = nullptr;
+  TF_ASSERT_OK(chunk->Spill(absl::ZeroDuration()));
+  EXPECT_FALSE(chunk->IsResident());
+  TF_ASSERT_OK(chunk->Load(&data));
+  EXPECT_THAT(*data, testing::EqualsProto(expected));
+}
+
+std::unique_ptr<ChunkStore> MakeDeduplicatingStore() {
+  ChunkStore::Options options;
+  options.deduplicate = true;
+  std::unique_ptr<ChunkStore> store;
+  REVERB_CHECK(ChunkStore::Create(options, &store).ok());
+  return store;
+}
+
+TEST(ChunkStoreTest, DeduplicatingStoreAliasesIdenticalChunks) {
+  auto store = MakeDeduplicatingStore();
+  auto first = store->Insert(MakeChunkWithTensors(1));
+  auto second = store->Insert(MakeChunkWithTensors(2));
+  EXPECT_NE(first, second);
+  EXPECT_EQ(second->data().chunk_key(), 2);
+  EXPECT_EQ(second->DataByteSizeLong(), first->DataByteSizeLong());
+
+  ChunkVector chunks;
+  TF_ASSERT_OK(store->Get({1, 2}, &chunks));
+  EXPECT_EQ(chunks[0], first);
+  EXPECT_EQ(chunks[1], second);
+
+  ChunkStoreInfo info = store->info();
+  EXPECT_EQ(info.num_chunks(), 1);
+  EXPECT_EQ(info.data_bytes(), first->DataByteSizeLong());
+  EXPECT_EQ(info.num_deduplicated_keys(), 1);
+  EXPECT_EQ(info.deduplicated_bytes(), first->DataByteSizeLong());
+}
+
+TEST(ChunkStoreTest, AliasKeepsItsHeaderAndSharesTensors) {
+  auto store = MakeDeduplicatingStore();
+  ChunkData first_data = MakeChunkWithTensors(1);
+  *first_data.mutable_sequence_range() = testing::MakeSequenceRange(10, 0, 0);
+  ChunkData second_data = MakeChunkWithTensors(2);
+  *second_data.mutable_sequence_range() =
+      testing::MakeSequenceRange(20, 5, 5);
+
+  auto first = store->Insert(first_data);
+  auto second = store->Insert(second_data);
+  EXPECT_EQ(second->data().sequence_range().episode_id(), 20);
+  EXPECT_THAT(second->data().data().tensors(), ::testing::IsEmpty());
+
+  std::shared_ptr<const ChunkData> loaded_first;
+  std::shared_ptr<const ChunkData> loaded_second;
+  TF_ASSERT_OK(first->Load(&loaded_first));
+  TF_ASSERT_OK(second->Load(&loaded_second));
+  EXPECT_THAT(*loaded_second, testing::EqualsProto(second_data));
+  EXPECT_EQ(&loaded_second->data(), &loaded_first->data());
+
+  // The tensors outlive the original key as long as the alias is alive.
+  first = nullptr;
+  loaded_first = nullptr;
+  loaded_second = nullptr;
+  TF_ASSERT_OK(second->Load(&loaded_second));
+  EXPECT_THAT(*loaded_second, testing::EqualsProto(second_data));
+}
+
+TEST(ChunkStoreTest, DeduplicatingStoreKeepsDifferentChunks) {
+  auto store = MakeDeduplicatingStore();
+  auto first = store->Insert(MakeChunkWithTensors(1));
+
+  ChunkData other_content = MakeChunkWithTensors(2);
+  other_content.mutable_data()->mutable_tensors(0)->set_tensor_content(
+      std::string(1000, 'y'));
+  ChunkData other_encoding = MakeChunkWithTensors(3);
+  other_encoding.set_delta_encoded(false);
+
+  EXPECT_NE(store->Insert(other_content), first);
+  EXPECT_NE(store->Insert(other_encoding), first);
+  EXPECT_EQ(store->info().num_deduplicated_keys(), 0);
+}
+
+TEST(ChunkStoreTest, DeduplicatedKeysExpireWithChunk) {
+  auto store = MakeDeduplicatingStore();
+  auto chunk = store->Insert(MakeChunkWithTensors(1));
+  auto alias = store->Insert(MakeChunkWithTensors(2));
+  alias = nullptr;
+  EXPECT_EQ(store->info().num_deduplicated_keys(), 0);
+  chunk = nullptr;
+
+  ChunkVector chunks;
+  EXPECT_EQ(store->Get({1}, &chunks).code(), tensorflow::error::NOT_FOUND);
+  EXPECT_EQ(store->Get({2}, &chunks).code(), tensorflow::error::NOT_FOUND);
+  EXPECT_EQ(store->info().num_deduplicated_keys(), 0);
+  EXPECT_EQ(store->info().deduplicated_bytes(), 0);
+
+  // The content is no longer indexed so the next insert creates a new chunk.
+  chunk = store->Insert(MakeChunkWithTensors(3));
+  EXPECT_EQ(chunk->data().chunk_key(), 3);
+  store->CleanupInternal();
+  TF_EXPECT_OK(store->Get({3}, &chunks));
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
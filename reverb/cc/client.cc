@@ -15,17 +15,27 @@
 #include "reverb/cc/client.h"
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
 
 #include "grpcpp/support/channel_arguments.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "reverb/cc/platform/grpc_utils.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/channel_pool.h"
+#include "reverb/cc/support/consistent_hash.h"
 #include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/thread_pool.h"
 #include "reverb/cc/support/uint128.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/errors.h"
@@ -34,6 +44,10 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
+// Upper bound of the number of threads which compress the chunks of the
+// writers of a client.
+constexpr int kMaxCompressionThreads = 8;
+
 grpc::ChannelArguments CreateChannelArguments() {
   grpc::ChannelArguments arguments;
   arguments.SetMaxReceiveMessageSize(-1);  // Unlimited.
@@ -43,21 +57,120 @@ grpc::ChannelArguments CreateChannelArguments() {
   return arguments;
 }
 
+internal::ChannelPool* ChannelPool() {
+  return internal::ChannelPool::Default(CreateChannelArguments());
+}
+
+// Returns one stub per channel of the process wide pool to `server_address`.
+std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+NewPooledStubs(absl::string_view server_address) {
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  for (auto& channel : ChannelPool()->GetChannels(server_address)) {
+    stubs.push_back(/* grpc_gen:: */ReverbService::NewStub(std::move(channel)));
+  }
+  return stubs;
+}
+
+std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> NewStub(
+    absl::string_view server_address) {
+  return /* grpc_gen:: */ReverbService::NewStub(
+      ChannelPool()->GetChannels(server_address).front());
+}
+
+std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+NewStubs(const std::vector<std::string>& server_addresses) {
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  stubs.reserve(server_addresses.size());
+  for (const auto& address : server_addresses) {
+    stubs.push_back(NewStub(address));
+  }
+  return stubs;
+}
+
+// Checks that `validation_dtypes` and `validation_shapes` are compatible with
+// the signature of `table` if the table has one, otherwise the signature is
+// built from them.
+tensorflow::Status CheckValidationSpecs(
+    const std::string& table,
+    const tensorflow::DataTypeVector& validation_dtypes,
+    const std::vector<tensorflow::PartialTensorShape>& validation_shapes,
+    internal::DtypesAndShapes* dtypes_and_shapes) {
+  // Only perform check if the table had a signature associated with it.
+  if (*dtypes_and_shapes) {
+    const auto& signature = **dtypes_and_shapes;
+    if (signature.size() != validation_shapes.size()) {
+      return tensorflow::errors::InvalidArgument(
+          "Inconsistent number of tensors requested from table '", table,
+          "'.  Requested ", validation_shapes.size(),
+          " tensors, but table signature shows ", signature.size(),
+          " tensors.  Table signature: ",
+          internal::DtypesShapesString(signature));
+    }
+    for (int i = 0; i < signature.size(); ++i) {
+      if (signature[i].dtype != validation_dtypes[i] ||
+          !signature[i].shape.IsCompatibleWith(validation_shapes[i])) {
+        return tensorflow::errors::InvalidArgument(
+            "Requested incompatible tensor at flattened index ", i,
+            " from table '", table, "'.  Requested (dtype, shape): (",
+            tensorflow::DataTypeString(validation_dtypes[i]), ", ",
+            validation_shapes[i].DebugString(),
+            ").  Signature (dtype, shape): (",
+            tensorflow::DataTypeString(signature[i].dtype), ", ",
+            signature[i].shape.DebugString(),
+            ").  Table signature: ", internal::DtypesShapesString(signature));
+      }
+    }
+  } else {
+    // dtypes_and_shapes lacks any signature info; build it from
+    // the validation inputs.
+    std::vector<internal::TensorSpec> dtypes_and_shapes_vec;
+    dtypes_and_shapes_vec.reserve(validation_shapes.size());
+    for (int i = 0; i < validation_shapes.size(); ++i) {
+      dtypes_and_shapes_vec.push_back(
+          {/*name=*/"?", validation_dtypes[i], validation_shapes[i]});
+    }
+    dtypes_and_shapes->emplace(std::move(dtypes_and_shapes_vec));
+  }
+
+  return tensorflow::Status::OK();
+}
+
 }  // namespace
 
 Client::Client(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub)
-    : stub_(std::move(stub)) {
+    : stubs_({stub}), stub_(std::move(stub)) {
   REVERB_CHECK(stub_ != nullptr);
 }
 
 Client::Client(absl::string_view server_address)
-    : stub_(/* grpc_gen:: */ReverbService::NewStub(
-          CreateCustomGrpcChannel(server_address, MakeChannelCredentials(),
-                                  CreateChannelArguments()))) {}
+    : stubs_(NewPooledStubs(server_address)), stub_(stubs_.front()) {}
+
+void Client::SetNumChannelsPerServer(int num_channels) {
+  ChannelPool()->SetNumChannels(num_channels);
+}
+
+std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>
+Client::NextStreamStub() {
+  return stubs_[next_stub_.fetch_add(1, std::memory_order_relaxed) %
+                stubs_.size()];
+}
+
+Client::~Client() {
+  absl::MutexLock lock(&priority_stream_mu_);
+  auto status = FinishPriorityStream();
+  if (!status.ok()) {
+    REVERB_LOG(REVERB_WARNING)
+        << "Failed to apply streamed priority updates: " << status;
+  }
+}
 
 tensorflow::Status Client::MaybeUpdateServerInfoCache(
     absl::Duration timeout,
-    std::shared_ptr<internal::FlatSignatureMap>* cached_flat_signatures) {
+    std::shared_ptr<internal::FlatSignatureMap>* cached_flat_signatures,
+    std::shared_ptr<internal::SignatureValidatorMap>*
+        cached_signature_validators) {
   // TODO(b/154927570): Once tables can be mutated on the server, we'll need to
   // decide a new rule for updating the server info, instead of doing it just
   // once at the beginning.
@@ -66,6 +179,9 @@ tensorflow::Status Client::MaybeUpdateServerInfoCache(
     absl::ReaderMutexLock lock(&cached_table_mu_);
     if (cached_flat_signatures_) {
       *cached_flat_signatures = cached_flat_signatures_;
+      if (cached_signature_validators != nullptr) {
+        *cached_signature_validators = cached_signature_validators_;
+      }
       return tensorflow::Status::OK();
     }
   }
@@ -75,6 +191,10 @@ tensorflow::Status Client::MaybeUpdateServerInfoCache(
     // immediately and without error; but we don't have anything already cached.
     // Just act like everything is fine! (Return empty signatures).
     *cached_flat_signatures = std::make_shared<internal::FlatSignatureMap>();
+    if (cached_signature_validators != nullptr) {
+      *cached_signature_validators =
+          std::make_shared<internal::SignatureValidatorMap>();
+    }
     return tensorflow::Status::OK();
   }
 
@@ -102,27 +222,94 @@ tensorflow::Status Client::MaybeUpdateServerInfoCache(
   absl::MutexLock lock(&cached_table_mu_);
   TF_RETURN_IF_ERROR(LockedUpdateServerInfoCache(info));
   *cached_flat_signatures = cached_flat_signatures_;
+  if (cached_signature_validators != nullptr) {
+    *cached_signature_validators = cached_signature_validators_;
+  }
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status Client::NewWriter(int chunk_length, int max_timesteps,
                                      bool delta_encoded,
                                      absl::optional<int> max_in_flight_items,
+                                     CompressionCodec codec, int block_length,
+                                     int64_t max_pending_bytes,
+                                     int64_t max_chunk_bytes,
                                      std::unique_ptr<Writer>* writer) {
+  if (block_length < 0) {
+    return tensorflow::errors::InvalidArgument(
+        "block_length (", block_length, ") must be >= 0.");
+  }
+  if (max_pending_bytes < 0) {
+    return tensorflow::errors::InvalidArgument(
+        "max_pending_bytes (", max_pending_bytes, ") must be >= 0.");
+  }
+  if (max_chunk_bytes < 0) {
+    return tensorflow::errors::InvalidArgument(
+        "max_chunk_bytes (", max_chunk_bytes, ") must be >= 0.");
+  }
   // TODO(b/154928265): caching this request?  For example, if
   // it's been N seconds or minutes, it may be time to
   // get an updated ServerInfo and see if there are new tables.
   std::shared_ptr<internal::FlatSignatureMap> cached_flat_signatures;
+  std::shared_ptr<internal::SignatureValidatorMap> cached_signature_validators;
   // TODO(b/154927687): It is not ideal that this blocks forever. We should
   // probably limit this and ignore the signature if it couldn't be found within
   // some limits.
   TF_RETURN_IF_ERROR(MaybeUpdateServerInfoCache(absl::InfiniteDuration(),
-                                                &cached_flat_signatures));
-  *writer = absl::make_unique<Writer>(
-      stub_, chunk_length, max_timesteps, delta_encoded,
-      std::move(cached_flat_signatures), std::move(max_in_flight_items));
+                                                &cached_flat_signatures,
+                                                &cached_signature_validators));
+
+  std::shared_ptr<ChunkStore> chunk_store;
+  if (GetLocalChunkStorePtr(&chunk_store).ok()) {
+    REVERB_LOG_EVERY_POW_2(REVERB_INFO)
+        << "Writer and server are owned by the same process (" << getpid()
+        << ") so chunks and items are inserted directly without gRPC.";
+    *writer = absl::make_unique<Writer>(
+        std::move(chunk_store),
+        [this](absl::string_view table, std::shared_ptr<Table>* out) {
+          return GetLocalTablePtr(table, out);
+        },
+        chunk_length, max_timesteps, delta_encoded,
+        std::move(cached_signature_validators), std::move(max_in_flight_items),
+        codec, block_length, max_pending_bytes, CompressionPool(),
+        max_chunk_bytes);
+  } else {
+    *writer = absl::make_unique<Writer>(
+        NextStreamStub(), chunk_length, max_timesteps, delta_encoded,
+        std::move(cached_signature_validators), std::move(max_in_flight_items),
+        codec, block_length, SharedMemorySupported(), max_pending_bytes,
+        CompressionPool(), max_chunk_bytes);
+  }
   return tensorflow::Status::OK();
 }
+
+tensorflow::Status Client::NewWriter(int chunk_length, int max_timesteps,
+                                     bool delta_encoded,
+                                     absl::optional<int> max_in_flight_items,
+                                     CompressionCodec codec, int block_length,
+                                     std::unique_ptr<Writer>* writer) {
+  return NewWriter(chunk_length, max_timesteps, delta_encoded,
+                   std::move(max_in_flight_items), codec, block_length,
+                   /*max_pending_bytes=*/0, /*max_chunk_bytes=*/0, writer);
+}
+
+tensorflow::Status Client::NewWriter(int chunk_length, int max_timesteps,
+                                     bool delta_encoded,
+                                     absl::optional<int> max_in_flight_items,
+                                     CompressionCodec codec,
+                                     std::unique_ptr<Writer>* writer) {
+  return NewWriter(chunk_length, max_timesteps, delta_encoded,
+                   std::move(max_in_flight_items), codec, /*block_length=*/0,
+                   writer);
+}
+
+tensorflow::Status Client::NewWriter(int chunk_length, int max_timesteps,
+                                     bool delta_encoded,
+                                     absl::optional<int> max_in_flight_items,
+                                     std::unique_ptr<Writer>* writer) {
+  return NewWriter(chunk_length, max_timesteps, delta_encoded,
+                   std::move(max_in_flight_items), CODEC_SNAPPY, writer);
+}
 tensorflow::Status Client::NewWriter(int chunk_length, int max_timesteps,
                                      bool delta_encoded,
                                      std::unique_ptr<Writer>* writer) {
@@ -130,6 +317,25 @@ tensorflow::Status Client::NewWriter(int chunk_length, int max_timesteps,
                    writer);
 }
 
+tensorflow::Status Client::NewMultiEpisodeWriter(
+    int num_lanes, int chunk_length, int max_timesteps, bool delta_encoded,
+    absl::optional<int> max_in_flight_items, CompressionCodec codec,
+    std::unique_ptr<MultiEpisodeWriter>* writer) {
+  if (num_lanes < 1) {
+    return tensorflow::errors::InvalidArgument(
+        "num_lanes (", num_lanes, ") must be >= 1.");
+  }
+  if (chunk_length < 1 || max_timesteps < 1) {
+    return tensorflow::errors::InvalidArgument(
+        "chunk_length (", chunk_length, ") and max_timesteps (", max_timesteps,
+        ") must be >= 1.");
+  }
+  *writer = absl::make_unique<MultiEpisodeWriter>(
+      NextStreamStub(), num_lanes, chunk_length, max_timesteps, delta_encoded,
+      std::move(max_in_flight_items), codec, CompressionPool());
+  return tensorflow::Status::OK();
+}
+
 tensorflow::Status Client::MutatePriorities(
     absl::string_view table, const std::vector<KeyWithPriority>& updates,
     const std::vector<uint64_t>& deletes, absl::Duration timeout) {
@@ -148,6 +354,45 @@ tensorflow::Status Client::MutatePriorities(
   return FromGrpcStatus(stub_->MutatePriorities(&context, request, &response));
 }
 
+tensorflow::Status Client::StreamPriorityUpdates(
+    absl::string_view table, const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes) {
+  MutatePrioritiesRequest request;
+  request.set_table(table.data(), table.size());
+  for (const KeyWithPriority& item : updates) {
+    *request.add_updates() = item;
+  }
+  for (int64_t key : deletes) {
+    request.add_delete_keys(key);
+  }
+
+  absl::MutexLock lock(&priority_stream_mu_);
+  if (priority_stream_ == nullptr) {
+    priority_stream_ = absl::make_unique<PriorityStream>();
+    priority_stream_->context.set_wait_for_ready(true);
+    priority_stream_->writer = stub_->MutatePrioritiesStream(
+        &priority_stream_->context, &priority_stream_->response);
+  }
+  if (priority_stream_->writer->Write(request)) {
+    return tensorflow::Status::OK();
+  }
+
+  // The stream has been closed, e.g because the server failed to apply one of
+  // the earlier requests. The request is not retried.
+  auto status = FinishPriorityStream();
+  return status.ok() ? tensorflow::errors::Unavailable(
+                           "The priority update stream was closed.")
+                     : status;
+}
+
+tensorflow::Status Client::FinishPriorityStream() {
+  if (priority_stream_ == nullptr) return tensorflow::Status::OK();
+  priority_stream_->writer->WritesDone();
+  auto status = FromGrpcStatus(priority_stream_->writer->Finish());
+  priority_stream_ = nullptr;
+  return status;
+}
+
 tensorflow::Status Client::NewSampler(
     const std::string& table, const Sampler::Options& options,
     internal::DtypesAndShapes dtypes_and_shapes,
@@ -162,7 +407,10 @@ tensorflow::Status Client::NewSampler(
     *sampler = absl::make_unique<Sampler>(std::move(table_ptr), options,
                                           std::move(dtypes_and_shapes));
   } else {
-    *sampler = absl::make_unique<Sampler>(stub_, table, options,
+    Sampler::Options grpc_options = options;
+    grpc_options.shared_memory = SharedMemorySupported();
+    *sampler = absl::make_unique<Sampler>(NextStreamStub(), table,
+                                          grpc_options,
                                           std::move(dtypes_and_shapes));
   }
 
@@ -189,6 +437,73 @@ tensorflow::Status Client::NewSampler(const std::string& table,
   return NewSampler(table, options, std::move(dtypes_and_shapes), sampler);
 }
 
+tensorflow::Status Client::NewReplicaSampler(
+    const std::string& table, const Sampler::Options& options,
+    absl::Duration validation_timeout, std::unique_ptr<Sampler>* sampler) {
+  struct ServerInfo info;
+  TF_RETURN_IF_ERROR(GetServerInfo(validation_timeout, &info));
+  std::vector<std::string> addresses;
+  for (const auto& replica : info.replicas) {
+    if (!replica.address().empty() &&
+        std::find(replica.tables().begin(), replica.tables().end(), table) !=
+            replica.tables().end()) {
+      addresses.push_back(replica.address());
+    }
+  }
+  if (addresses.empty()) {
+    return NewSampler(table, options, validation_timeout, sampler);
+  }
+  return NewMultiServerSampler(addresses, table, options, sampler);
+}
+
+tensorflow::Status Client::NewMultiServerSampler(
+    const std::vector<std::string>& server_addresses, const std::string& table,
+    const Sampler::Options& options, std::unique_ptr<Sampler>* sampler) {
+  TF_RETURN_IF_ERROR(options.Validate());
+  if (server_addresses.empty()) {
+    return tensorflow::errors::InvalidArgument(
+        "At least one server address must be provided.");
+  }
+
+  Sampler::Options grpc_options = options;
+  grpc_options.shared_memory = false;
+  *sampler = absl::make_unique<Sampler>(NewStubs(server_addresses), table,
+                                        grpc_options);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Client::NewMultiServerSampler(
+    const std::vector<std::string>& server_addresses, const std::string& table,
+    const Sampler::Options& options,
+    const tensorflow::DataTypeVector& validation_dtypes,
+    const std::vector<tensorflow::PartialTensorShape>& validation_shapes,
+    absl::Duration validation_timeout, std::unique_ptr<Sampler>* sampler) {
+  TF_RETURN_IF_ERROR(options.Validate());
+  if (server_addresses.empty()) {
+    return tensorflow::errors::InvalidArgument(
+        "At least one server address must be provided.");
+  }
+  if (validation_dtypes.size() != validation_shapes.size()) {
+    return tensorflow::errors::InvalidArgument(
+        "validation_shapes.size() != validation_dtypes.size() (",
+        validation_shapes.size(), " vs. ", validation_dtypes.size(), ")");
+  }
+
+  internal::DtypesAndShapes dtypes_and_shapes;
+  TF_RETURN_IF_ERROR(GetDtypesAndShapesForSampler(table, validation_timeout,
+                                                  &dtypes_and_shapes));
+  TF_RETURN_IF_ERROR(CheckValidationSpecs(table, validation_dtypes,
+                                          validation_shapes,
+                                          &dtypes_and_shapes));
+
+  Sampler::Options grpc_options = options;
+  grpc_options.shared_memory = false;
+  *sampler = absl::make_unique<Sampler>(NewStubs(server_addresses), table,
+                                        grpc_options,
+                                        std::move(dtypes_and_shapes));
+  return tensorflow::Status::OK();
+}
+
 tensorflow::Status Client::GetDtypesAndShapesForSampler(
     const std::string& table, absl::Duration validation_timeout,
     internal::DtypesAndShapes* dtypes_and_shapes) {
@@ -256,45 +571,99 @@ tensorflow::Status Client::NewSampler(
   internal::DtypesAndShapes dtypes_and_shapes;
   TF_RETURN_IF_ERROR(GetDtypesAndShapesForSampler(table, validation_timeout,
                                                   &dtypes_and_shapes));
-  // Only perform check if the table had a signature associated with it.
-  if (dtypes_and_shapes) {
-    if (dtypes_and_shapes->size() != validation_shapes.size()) {
-      return tensorflow::errors::InvalidArgument(
-          "Inconsistent number of tensors requested from table '", table,
-          "'.  Requested ", validation_shapes.size(),
-          " tensors, but table signature shows ", dtypes_and_shapes->size(),
-          " tensors.  Table signature: ",
-          internal::DtypesShapesString(*dtypes_and_shapes));
-    }
-    for (int i = 0; i < dtypes_and_shapes->size(); ++i) {
-      if (dtypes_and_shapes->at(i).dtype != validation_dtypes[i] ||
-          !dtypes_and_shapes->at(i).shape.IsCompatibleWith(
-              validation_shapes[i])) {
-        return tensorflow::errors::InvalidArgument(
-            "Requested incompatible tensor at flattened index ", i,
-            " from table '", table, "'.  Requested (dtype, shape): (",
-            tensorflow::DataTypeString(validation_dtypes[i]), ", ",
-            validation_shapes[i].DebugString(),
-            ").  Signature (dtype, shape): (",
-            tensorflow::DataTypeString(dtypes_and_shapes->at(i).dtype), ", ",
-            dtypes_and_shapes->at(i).shape.DebugString(),
-            ").  Table signature: ",
-            internal::DtypesShapesString(*dtypes_and_shapes));
-      }
-    }
+  TF_RETURN_IF_ERROR(CheckValidationSpecs(table, validation_dtypes,
+                                          validation_shapes,
+                                          &dtypes_and_shapes));
+  return NewSampler(table, options, std::move(dtypes_and_shapes), sampler);
+}
+
+tensorflow::Status Client::NewSampler(
+    const std::vector<TableWeight>& tables, const Sampler::Options& options,
+    absl::Duration validation_timeout, std::unique_ptr<Sampler>* sampler) {
+  internal::DtypesAndShapes dtypes_and_shapes;
+  auto status = GetDtypesAndShapesForTables(tables, validation_timeout,
+                                            &dtypes_and_shapes);
+  if (tensorflow::errors::IsDeadlineExceeded(status)) {
+    REVERB_LOG(REVERB_WARNING)
+        << "Unable to validate shapes and dtypes of new sampler as server "
+           "could not be reached in time ("
+        << validation_timeout
+        << "). The sampler will be constructed without validating the dtypes "
+           "and shapes.";
   } else {
-    // dtypes_and_shapes lacks any signature info; build it from
-    // the validation inputs.
-    std::vector<internal::TensorSpec> dtypes_and_shapes_vec;
-    dtypes_and_shapes_vec.reserve(validation_shapes.size());
-    for (int i = 0; i < validation_shapes.size(); ++i) {
-      dtypes_and_shapes_vec.push_back(
-          {/*name=*/"?", validation_dtypes[i], validation_shapes[i]});
-    }
-    dtypes_and_shapes.emplace(std::move(dtypes_and_shapes_vec));
+    TF_RETURN_IF_ERROR(status);
   }
+  return NewSampler(tables, options, std::move(dtypes_and_shapes), sampler);
+}
 
-  return NewSampler(table, options, std::move(dtypes_and_shapes), sampler);
+tensorflow::Status Client::NewSampler(
+    const std::vector<TableWeight>& tables, const Sampler::Options& options,
+    const tensorflow::DataTypeVector& validation_dtypes,
+    const std::vector<tensorflow::PartialTensorShape>& validation_shapes,
+    absl::Duration validation_timeout, std::unique_ptr<Sampler>* sampler) {
+  if (validation_dtypes.size() != validation_shapes.size()) {
+    return tensorflow::errors::InvalidArgument(
+        "validation_shapes.size() != validation_dtypes.size() (",
+        validation_shapes.size(), " vs. ", validation_dtypes.size(), ")");
+  }
+
+  internal::DtypesAndShapes dtypes_and_shapes;
+  TF_RETURN_IF_ERROR(GetDtypesAndShapesForTables(tables, validation_timeout,
+                                                 &dtypes_and_shapes));
+  TF_RETURN_IF_ERROR(CheckValidationSpecs(tables.front().table(),
+                                          validation_dtypes, validation_shapes,
+                                          &dtypes_and_shapes));
+  return NewSampler(tables, options, std::move(dtypes_and_shapes), sampler);
+}
+
+tensorflow::Status Client::NewSampler(
+    const std::vector<TableWeight>& tables, const Sampler::Options& options,
+    internal::DtypesAndShapes dtypes_and_shapes,
+    std::unique_ptr<Sampler>* sampler) {
+  if (tables.size() == 1) {
+    return NewSampler(tables.front().table(), options,
+                      std::move(dtypes_and_shapes), sampler);
+  }
+  TF_RETURN_IF_ERROR(options.Validate());
+
+  Sampler::Options grpc_options = options;
+  grpc_options.shared_memory = SharedMemorySupported();
+  *sampler = absl::make_unique<Sampler>(NextStreamStub(), tables, grpc_options,
+                                        std::move(dtypes_and_shapes));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Client::GetDtypesAndShapesForTables(
+    const std::vector<TableWeight>& tables, absl::Duration validation_timeout,
+    internal::DtypesAndShapes* dtypes_and_shapes) {
+  if (tables.empty()) {
+    return tensorflow::errors::InvalidArgument(
+        "At least one table must be provided.");
+  }
+
+  dtypes_and_shapes->reset();
+  std::string signature_table;
+  for (const auto& table : tables) {
+    internal::DtypesAndShapes table_dtypes_and_shapes;
+    TF_RETURN_IF_ERROR(GetDtypesAndShapesForSampler(
+        table.table(), validation_timeout, &table_dtypes_and_shapes));
+    if (!table_dtypes_and_shapes) continue;
+    if (!*dtypes_and_shapes) {
+      *dtypes_and_shapes = std::move(table_dtypes_and_shapes);
+      signature_table = table.table();
+      continue;
+    }
+    if (internal::DtypesShapesString(*table_dtypes_and_shapes) !=
+        internal::DtypesShapesString(**dtypes_and_shapes)) {
+      return tensorflow::errors::InvalidArgument(
+          "Tables '", signature_table, "' and '", table.table(),
+          "' have different signatures and can't be sampled together.  "
+          "Signatures: ",
+          internal::DtypesShapesString(**dtypes_and_shapes), " vs. ",
+          internal::DtypesShapesString(*table_dtypes_and_shapes));
+    }
+  }
+  return tensorflow::Status::OK();
 }
 
 tensorflow::Status Client::GetServerInfo(absl::Duration timeout,
@@ -314,6 +683,15 @@ tensorflow::Status Client::GetServerInfo(absl::Duration timeout,
   for (class TableInfo& table : *response.mutable_table_info()) {
     info->table_info.emplace_back(std::move(table));
   }
+  info->reclaimer_info = std::move(*response.mutable_reclaimer_info());
+  info->chunk_store_info = std::move(*response.mutable_chunk_store_info());
+  info->heap_info = std::move(*response.mutable_heap_info());
+  for (ReplicaInfo& replica : *response.mutable_replicas()) {
+    info->replicas.push_back(std::move(replica));
+  }
+  info->replication_info = std::move(*response.mutable_replication_info());
+  info->memory_admission_info =
+      std::move(*response.mutable_memory_admission_info());
   return tensorflow::Status::OK();
 }
 
@@ -343,6 +721,9 @@ tensorflow::Status Client::LockedUpdateServerInfoCache(
     }
     cached_flat_signatures_.reset(
         new internal::FlatSignatureMap(std::move(signatures)));
+    cached_signature_validators_ =
+        std::make_shared<internal::SignatureValidatorMap>(
+            internal::CompileSignatures(*cached_flat_signatures_));
     tables_state_id_ = info.tables_state_id;
   }
   return tensorflow::Status::OK();
@@ -368,15 +749,51 @@ tensorflow::Status Client::Checkpoint(std::string* path) {
   return tensorflow::Status::OK();
 }
 
+tensorflow::Status Client::ExportTable(
+    const ExportTableRequest& request,
+    const std::function<tensorflow::Status(const ExportTableResponse&)>&
+        consumer) {
+  grpc::ClientContext context;
+  context.set_wait_for_ready(true);
+  std::unique_ptr<grpc::ClientReaderInterface<ExportTableResponse>> reader =
+      stub_->ExportTable(&context, request);
+  ExportTableResponse response;
+  while (reader->Read(&response)) {
+    if (auto status = consumer(response); !status.ok()) {
+      context.TryCancel();
+      reader->Finish();
+      return status;
+    }
+  }
+  return FromGrpcStatus(reader->Finish());
+}
+
 tensorflow::Status Client::GetLocalTablePtr(absl::string_view table_name,
                                             std::shared_ptr<Table>* out) {
+  InitializeConnectionRequest request;
+  request.set_table_name(table_name.data(), table_name.size());
+  return GetLocalPtr(std::move(request), [out](int64_t address) {
+    *out = *reinterpret_cast<std::shared_ptr<Table>*>(address);
+  });
+}
+
+tensorflow::Status Client::GetLocalChunkStorePtr(
+    std::shared_ptr<ChunkStore>* out) {
+  InitializeConnectionRequest request;
+  request.set_chunk_store(true);
+  return GetLocalPtr(std::move(request), [out](int64_t address) {
+    *out = *reinterpret_cast<std::shared_ptr<ChunkStore>*>(address);
+  });
+}
+
+tensorflow::Status Client::GetLocalPtr(
+    InitializeConnectionRequest request,
+    const std::function<void(int64_t)>& copy) {
   grpc::ClientContext context;
   context.set_wait_for_ready(false);
   auto stream = stub_->InitializeConnection(&context);
 
-  InitializeConnectionRequest request;
   request.set_pid(getpid());
-  request.set_table_name(table_name.data(), table_name.size());
   if (!stream->Write(request)) {
     TF_RETURN_IF_ERROR(FromGrpcStatus(stream->Finish()));
     return tensorflow::errors::Internal(
@@ -395,12 +812,112 @@ tensorflow::Status Client::GetLocalTablePtr(absl::string_view table_name,
         "Client and server are not running in the same process.");
   }
 
-  *out = *reinterpret_cast<std::shared_ptr<Table>*>(response.address());
+  copy(response.address());
   request.set_ownership_transferred(true);
   stream->Write(request);
 
   return FromGrpcStatus(stream->Finish());
 }
 
+std::shared_ptr<internal::ThreadPool> Client::CompressionPool() {
+  absl::MutexLock lock(&compression_pool_mu_);
+  if (compression_pool_ == nullptr) {
+    const int num_threads = std::clamp<int>(std::thread::hardware_concurrency(),
+                                            1, kMaxCompressionThreads);
+    compression_pool_ = std::make_shared<internal::ThreadPool>(
+        num_threads, "WriterCompression");
+  }
+  return compression_pool_;
+}
+
+bool Client::SharedMemorySupported() {
+  absl::MutexLock lock(&shared_memory_mu_);
+  if (shared_memory_.has_value()) return shared_memory_.value();
+
+  // The server reads (and thus removes) the probe if it can access the
+  // segments of this process.
+  InitializeConnectionRequest request;
+  request.set_pid(getpid());
+  if (!internal::WriteSharedMemoryChunk(ChunkData(),
+                                        request.mutable_shared_memory_probe())
+           .ok()) {
+    shared_memory_ = false;
+    return false;
+  }
+
+  grpc::ClientContext context;
+  context.set_wait_for_ready(false);
+  auto stream = stub_->InitializeConnection(&context);
+  InitializeConnectionResponse response;
+  const bool responded = stream->Write(request) && stream->Read(&response);
+  stream->WritesDone();
+  auto status = stream->Finish();
+  internal::RemoveSharedMemoryChunk(request.shared_memory_probe());
+
+  // Servers which are not on the same host finish the stream without
+  // responding, while servers in the same process fail as no table has been
+  // requested. Only unreachable servers are asked again.
+  if (!responded && status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+    return false;
+  }
+  shared_memory_ = responded && response.shared_memory();
+  if (shared_memory_.value()) {
+    REVERB_LOG(REVERB_INFO) << "Client and server are on the same host so "
+                               "chunks are passed through shared memory.";
+  }
+  return shared_memory_.value();
+}
+
+ShardedClient::ShardedClient(
+    std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+        stubs)
+    : stubs_(std::move(stubs)) {
+  REVERB_CHECK(!stubs_.empty());
+  shards_.reserve(stubs_.size());
+  for (const auto& stub : stubs_) {
+    shards_.push_back(absl::make_unique<Client>(stub));
+  }
+}
+
+ShardedClient::ShardedClient(const std::vector<std::string>& server_addresses)
+    : ShardedClient(NewStubs(server_addresses)) {}
+
+int ShardedClient::ShardOf(uint64_t episode_id) const {
+  return internal::JumpConsistentHash(episode_id, shards_.size());
+}
+
+tensorflow::Status ShardedClient::NewWriter(
+    uint64_t episode_id, int chunk_length, int max_timesteps,
+    bool delta_encoded, absl::optional<int> max_in_flight_items,
+    CompressionCodec codec, int block_length, std::unique_ptr<Writer>* writer) {
+  std::unique_ptr<Writer> new_writer;
+  TF_RETURN_IF_ERROR(shards_[ShardOf(episode_id)]->NewWriter(
+      chunk_length, max_timesteps, delta_encoded,
+      std::move(max_in_flight_items), codec, block_length, &new_writer));
+  TF_RETURN_IF_ERROR(new_writer->SetEpisodeId(episode_id));
+  *writer = std::move(new_writer);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ShardedClient::NewSampler(
+    const std::string& table, const Sampler::Options& options,
+    std::unique_ptr<Sampler>* sampler) {
+  TF_RETURN_IF_ERROR(options.Validate());
+  Sampler::Options grpc_options = options;
+  grpc_options.shared_memory = false;
+  *sampler = absl::make_unique<Sampler>(stubs_, table, grpc_options);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ShardedClient::MutatePriorities(
+    absl::string_view table, const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes, absl::Duration timeout) {
+  tensorflow::Status status;
+  for (auto& shard : shards_) {
+    status.Update(shard->MutatePriorities(table, updates, deletes, timeout));
+  }
+  return status;
+}
+
 }  // namespace reverb
 }  // namespace deepmind
@@ -17,6 +17,8 @@
 
 #include <stddef.h>
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -27,11 +29,15 @@
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/multi_episode_writer.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/sampler.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/thread_pool.h"
 #include "reverb/cc/writer.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -49,11 +55,29 @@ class Client {
     // field documentation.
     absl::uint128 tables_state_id;
     std::vector<TableInfo> table_info;
+    ReclaimerInfo reclaimer_info;
+    ChunkStoreInfo chunk_store_info;
+    HeapInfo heap_info;
+    std::vector<ReplicaInfo> replicas;
+    ReplicationInfo replication_info;
+    MemoryAdmissionInfo memory_admission_info;
   };
 
   explicit Client(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub);
+  // Connects to `server_address` over the channels shared by all clients of
+  // the process which are connected to the same address.
   explicit Client(absl::string_view server_address);
 
+  // Sets the number of channels, each with a connection of its own, that the
+  // clients which are constructed later spread the streams of their writers
+  // and samplers over. Clients which connect to the same address share the
+  // channels. Defaults to 1. Must be >= 1.
+  static void SetNumChannelsPerServer(int num_channels);
+
+  // Waits for the priority updates streamed by `StreamPriorityUpdates` to be
+  // applied.
+  ~Client();
+
   // Upon successful return, `writer` will contain an instance of Writer.
   tensorflow::Status NewWriter(int chunk_length, int max_timesteps,
                                bool delta_encoded,
@@ -62,6 +86,40 @@ class Client {
                                bool delta_encoded,
                                absl::optional<int> max_in_flight_items,
                                std::unique_ptr<Writer>* writer);
+  // `codec` is used to compress the tensors of the chunks. Use `CODEC_NONE`
+  // for data which does not compress well, e.g low dimensional states.
+  tensorflow::Status NewWriter(int chunk_length, int max_timesteps,
+                               bool delta_encoded,
+                               absl::optional<int> max_in_flight_items,
+                               CompressionCodec codec,
+                               std::unique_ptr<Writer>* writer);
+  // If `block_length` > 0 then the chunks are compressed in blocks of
+  // `block_length` time steps which allows samples to be read without
+  // decompressing (or transmitting) the entire chunk.
+  tensorflow::Status NewWriter(int chunk_length, int max_timesteps,
+                               bool delta_encoded,
+                               absl::optional<int> max_in_flight_items,
+                               CompressionCodec codec, int block_length,
+                               std::unique_ptr<Writer>* writer);
+  // If `max_pending_bytes` > 0 then the writer is asynchronous: chunks are
+  // batched, compressed and sent by a background thread while at most
+  // `max_pending_bytes` bytes of timesteps are queued for it (see `Writer`).
+  // If `max_chunk_bytes` > 0 then chunks are cut once their timesteps hold
+  // `max_chunk_bytes` bytes, or after `chunk_length` timesteps if sooner.
+  tensorflow::Status NewWriter(int chunk_length, int max_timesteps,
+                               bool delta_encoded,
+                               absl::optional<int> max_in_flight_items,
+                               CompressionCodec codec, int block_length,
+                               int64_t max_pending_bytes,
+                               int64_t max_chunk_bytes,
+                               std::unique_ptr<Writer>* writer);
+
+  // Upon successful return, `writer` will contain a writer for the episodes of
+  // `num_lanes` environments stepped in lockstep (see `MultiEpisodeWriter`).
+  tensorflow::Status NewMultiEpisodeWriter(
+      int num_lanes, int chunk_length, int max_timesteps, bool delta_encoded,
+      absl::optional<int> max_in_flight_items, CompressionCodec codec,
+      std::unique_ptr<MultiEpisodeWriter>* writer);
 
   // Upon successful return, `sampler` will contain an instance of
   // Sampler.
@@ -102,6 +160,52 @@ class Client {
       const std::vector<tensorflow::PartialTensorShape>& validation_shapes,
       absl::Duration validation_timeout, std::unique_ptr<Sampler>* sampler);
 
+  // Versions of the above which return a `Sampler` that mixes the samples of
+  // `tables` in proportion to their weights over a single stream per worker.
+  // All tables with a signature must have the same one, which is used for the
+  // validation. Samplers of a single table are constructed as above.
+  tensorflow::Status NewSampler(const std::vector<TableWeight>& tables,
+                                const Sampler::Options& options,
+                                absl::Duration validation_timeout,
+                                std::unique_ptr<Sampler>* sampler);
+  tensorflow::Status NewSampler(
+      const std::vector<TableWeight>& tables, const Sampler::Options& options,
+      const tensorflow::DataTypeVector& validation_dtypes,
+      const std::vector<tensorflow::PartialTensorShape>& validation_shapes,
+      absl::Duration validation_timeout, std::unique_ptr<Sampler>* sampler);
+
+  // Upon successful return, `sampler` will contain a `Sampler` which keeps
+  // streams open to each of `server_addresses` and spreads its requests
+  // across them according to the load of their `table`. Unlike the samplers
+  // of a `Client`, the sampler neither validates the signature of `table` nor
+  // passes chunks through shared memory.
+  static tensorflow::Status NewMultiServerSampler(
+      const std::vector<std::string>& server_addresses,
+      const std::string& table, const Sampler::Options& options,
+      std::unique_ptr<Sampler>* sampler);
+
+  // Same as the static overload but validates the samples against
+  // `validation_dtypes` and `validation_shapes` like `NewSampler`. The
+  // signature of `table` is fetched from the server of this client, which
+  // must share it with all of `server_addresses`.
+  tensorflow::Status NewMultiServerSampler(
+      const std::vector<std::string>& server_addresses,
+      const std::string& table, const Sampler::Options& options,
+      const tensorflow::DataTypeVector& validation_dtypes,
+      const std::vector<tensorflow::PartialTensorShape>& validation_shapes,
+      absl::Duration validation_timeout, std::unique_ptr<Sampler>* sampler);
+
+  // Upon successful return, `sampler` will contain a `Sampler` which samples
+  // `table` from the read replicas which follow it on the server of this
+  // client (see `ServerInfo::replicas`), spread across them like
+  // `NewMultiServerSampler`. Falls back to `NewSampler` if no replica follows
+  // `table`. `validation_timeout` bounds the `ServerInfo` call which looks up
+  // the replicas.
+  tensorflow::Status NewReplicaSampler(const std::string& table,
+                                       const Sampler::Options& options,
+                                       absl::Duration validation_timeout,
+                                       std::unique_ptr<Sampler>* sampler);
+
   // Simultaneously mutates priorities and deletes elements from replay table
   // `table`. If `timeout` is specified, function may return a
   // DEADLINE_EXCEEDED error. If `timeout` is not specified, function may block
@@ -111,10 +215,29 @@ class Client {
       const std::vector<uint64_t>& deletes,
       absl::Duration timeout = absl::InfiniteDuration());
 
+  // Same as `MutatePriorities` but the request is written to a stream which is
+  // kept open between calls, so the call returns without waiting for the
+  // server to apply the request. The server merges requests which arrive in
+  // quick succession. Errors are therefore reported by a later call, after
+  // which a new stream is opened by the next call. Use `MutatePriorities` if
+  // the mutation must have been applied when the call returns.
+  tensorflow::Status StreamPriorityUpdates(
+      absl::string_view table, const std::vector<KeyWithPriority>& updates,
+      const std::vector<uint64_t>& deletes);
+
   tensorflow::Status Reset(const std::string& table);
 
   tensorflow::Status Checkpoint(std::string* path);
 
+  // Streams the items of `request.table()` (see `ExportTable` in
+  // reverb_service.proto) and passes every page to `consumer` as it arrives,
+  // e.g to append it to a TFRecord file. The export is cancelled if `consumer`
+  // returns an error, which is then returned.
+  tensorflow::Status ExportTable(
+      const ExportTableRequest& request,
+      const std::function<tensorflow::Status(const ExportTableResponse&)>&
+          consumer);
+
   // Requests ServerInfo. Forces an update of internal signature caches.
   tensorflow::Status ServerInfo(absl::Duration timeout,
                                 struct ServerInfo* info);
@@ -122,7 +245,18 @@ class Client {
   tensorflow::Status ServerInfo(struct ServerInfo* info);
 
  private:
+  // Returns the stub which the next writer or sampler opens its streams with.
+  // Cycles through `stubs_`.
+  std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>
+  NextStreamStub();
+
+  // One stub per channel to the server. Unary calls (and the priority stream)
+  // use `stub_`, which is the first of them.
+  const std::vector<
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs_;
   const std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub_;
+  std::atomic<size_t> next_stub_{0};
 
   // Request direct access to Table managed by server. Result will only be
   // populated when the stub was created using a localhost address of a server
@@ -130,6 +264,28 @@ class Client {
   tensorflow::Status GetLocalTablePtr(absl::string_view table_name,
                                       std::shared_ptr<Table>* out);
 
+  // Same as `GetLocalTablePtr` but requests direct access to the ChunkStore
+  // of the server.
+  tensorflow::Status GetLocalChunkStorePtr(std::shared_ptr<ChunkStore>* out);
+
+  // Sends `request` to `InitializeConnection` and passes the address of the
+  // heap allocated shared_ptr to `copy`, which must copy it before the
+  // ownership transfer is confirmed to the server.
+  tensorflow::Status GetLocalPtr(InitializeConnectionRequest request,
+                                 const std::function<void(int64_t)>& copy);
+
+  // Returns true if chunks can be exchanged with the server through shared
+  // memory, i.e if the server is running on the same host (but in another
+  // process) and can read the segments created by this process. The answer is
+  // cached once the server has been reached.
+  bool SharedMemorySupported() ABSL_LOCKS_EXCLUDED(shared_memory_mu_);
+
+  // Returns the pool which compresses the chunks of the writers of the client
+  // in parallel. The pool is created by the first call and is shared by all
+  // writers.
+  std::shared_ptr<internal::ThreadPool> CompressionPool()
+      ABSL_LOCKS_EXCLUDED(compression_pool_mu_);
+
   // Upon successful return, `sampler` will contain an instance of
   // Sampler.  This version is called by the public `NewSampler` methods.
   //
@@ -139,10 +295,20 @@ class Client {
                                 const Sampler::Options& options,
                                 internal::DtypesAndShapes dtypes_and_shapes,
                                 std::unique_ptr<Sampler>* sampler);
+  tensorflow::Status NewSampler(const std::vector<TableWeight>& tables,
+                                const Sampler::Options& options,
+                                internal::DtypesAndShapes dtypes_and_shapes,
+                                std::unique_ptr<Sampler>* sampler);
 
+  // Fetches the `ServerInfo` unless it is already cached and returns the
+  // cached flattened signatures of the tables. If set then
+  // `cached_signature_validators` is set to the compiled signatures, which are
+  // only compiled once per `tables_state_id`.
   tensorflow::Status MaybeUpdateServerInfoCache(
       absl::Duration timeout,
-      std::shared_ptr<internal::FlatSignatureMap>* cached_flat_signatures);
+      std::shared_ptr<internal::FlatSignatureMap>* cached_flat_signatures,
+      std::shared_ptr<internal::SignatureValidatorMap>*
+          cached_signature_validators = nullptr);
 
   // Uses MaybeUpdateServerInfoCache to get ServerInfo and pull the
   // dtypes_and_shapes for `table`.  If `table` is not in the ServerInfo, then
@@ -151,19 +317,108 @@ class Client {
       const std::string& table, absl::Duration validation_timeout,
       internal::DtypesAndShapes* dtypes_and_shapes);
 
+  // Like `GetDtypesAndShapesForSampler` but for all of `tables`. Returns
+  // InvalidArgument if two of the tables have different signatures.
+  tensorflow::Status GetDtypesAndShapesForTables(
+      const std::vector<TableWeight>& tables, absl::Duration validation_timeout,
+      internal::DtypesAndShapes* dtypes_and_shapes);
+
   // Purely functional request for server info.  Does not update any internal
   // caches.
   tensorflow::Status GetServerInfo(absl::Duration timeout,
                                    struct ServerInfo* info);
 
-  // Updates tables_state_id_ and cached_flat_signatures_ using info.
+  // Updates tables_state_id_, cached_flat_signatures_ and
+  // cached_signature_validators_ using info.
   tensorflow::Status LockedUpdateServerInfoCache(const struct ServerInfo& info)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(cached_table_mu_);
 
+  // Stream of `StreamPriorityUpdates`. Opened by the first call.
+  struct PriorityStream {
+    grpc::ClientContext context;
+    MutatePrioritiesResponse response;
+    std::unique_ptr<grpc::ClientWriterInterface<MutatePrioritiesRequest>>
+        writer;
+  };
+
+  // Closes `priority_stream_`, if open, and returns its status.
+  tensorflow::Status FinishPriorityStream()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(priority_stream_mu_);
+
+  absl::Mutex shared_memory_mu_;
+  absl::optional<bool> shared_memory_ ABSL_GUARDED_BY(shared_memory_mu_);
+
+  absl::Mutex compression_pool_mu_;
+  std::shared_ptr<internal::ThreadPool> compression_pool_
+      ABSL_GUARDED_BY(compression_pool_mu_);
+
+  absl::Mutex priority_stream_mu_;
+  std::unique_ptr<PriorityStream> priority_stream_
+      ABSL_GUARDED_BY(priority_stream_mu_);
+
   absl::Mutex cached_table_mu_;
   absl::uint128 tables_state_id_ ABSL_GUARDED_BY(cached_table_mu_);
   std::shared_ptr<internal::FlatSignatureMap> cached_flat_signatures_
       ABSL_GUARDED_BY(cached_table_mu_);
+  std::shared_ptr<internal::SignatureValidatorMap> cached_signature_validators_
+      ABSL_GUARDED_BY(cached_table_mu_);
+};
+
+// Client of a sharded table, i.e a logical table whose items are spread
+// across the tables with the same name on multiple servers (the shards). This
+// lets a table grow beyond the memory of a single host and the throughput of
+// a single table lock.
+//
+// Every episode is written to a single shard picked by consistent hashing of
+// its id, so the chunks of an episode are never split across shards and
+// adding a shard only moves the (future) episodes which hash to the new
+// shard. Samplers draw from all shards in proportion to the total priority of
+// their tables (see `Sampler`), which preserves the sampling probabilities of
+// a single table.
+class ShardedClient {
+ public:
+  explicit ShardedClient(
+      std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+          stubs);
+  explicit ShardedClient(const std::vector<std::string>& server_addresses);
+
+  int num_shards() const { return shards_.size(); }
+
+  // Returns the index of the shard which episode `episode_id` is written to.
+  int ShardOf(uint64_t episode_id) const;
+
+  // Returns the client of the shard with index `index`.
+  Client* shard(int index) const { return shards_[index].get(); }
+
+  // Upon successful return, `writer` will contain a Writer which appends
+  // timesteps to episode `episode_id` on shard `ShardOf(episode_id)`. See
+  // `Client::NewWriter` for the other arguments.
+  tensorflow::Status NewWriter(uint64_t episode_id, int chunk_length,
+                               int max_timesteps, bool delta_encoded,
+                               absl::optional<int> max_in_flight_items,
+                               CompressionCodec codec, int block_length,
+                               std::unique_ptr<Writer>* writer);
+
+  // Upon successful return, `sampler` will contain a Sampler which samples
+  // `table` from all shards. See `Client::NewMultiServerSampler`.
+  tensorflow::Status NewSampler(const std::string& table,
+                                const Sampler::Options& options,
+                                std::unique_ptr<Sampler>* sampler);
+
+  // Sends the mutations to every shard, which ignore the keys they don't
+  // hold. Returns the first error of any shard.
+  tensorflow::Status MutatePriorities(
+      absl::string_view table, const std::vector<KeyWithPriority>& updates,
+      const std::vector<uint64_t>& deletes,
+      absl::Duration timeout = absl::InfiniteDuration());
+
+ private:
+  const std::vector<
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs_;
+
+  // Client of the shard with the same index.
+  std::vector<std::unique_ptr<Client>> shards_;
 };
 
 }  // namespace reverb
@@ -16,6 +16,7 @@
 
 #include <chrono>  // NOLINT(build/c++11) - grpc API requires it.
 #include <memory>
+#include <vector>
 
 #include "grpcpp/impl/codegen/client_context.h"
 #include "grpcpp/impl/codegen/status.h"
@@ -26,6 +27,7 @@
 #include "reverb/cc/support/uint128.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/errors.h"
 
 namespace deepmind {
 namespace reverb {
@@ -33,8 +35,60 @@ namespace {
 
 constexpr char kCheckpointPath[] = "/path/to/checkpoint";
 
+// Records the requests of a `MutatePrioritiesStream`. Writes fail once
+// `num_success_writes` requests have been written, after which `Finish`
+// returns `status`.
+class FakePriorityStream
+    : public grpc::ClientWriterInterface<MutatePrioritiesRequest> {
+ public:
+  FakePriorityStream(std::vector<MutatePrioritiesRequest>* requests,
+                     int num_success_writes, grpc::Status status,
+                     bool* finished)
+      : requests_(requests),
+        num_success_writes_(num_success_writes),
+        status_(std::move(status)),
+        finished_(finished) {}
+
+  bool Write(const MutatePrioritiesRequest& request,
+             grpc::WriteOptions options) override {
+    if (num_success_writes_-- <= 0) return false;
+    requests_->push_back(request);
+    return true;
+  }
+
+  bool WritesDone() override { return true; }
+
+  grpc::Status Finish() override {
+    *finished_ = true;
+    return num_success_writes_ >= 0 ? grpc::Status::OK : status_;
+  }
+
+ private:
+  std::vector<MutatePrioritiesRequest>* requests_;
+  int num_success_writes_;
+  grpc::Status status_;
+  bool* finished_;
+};
+
 class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
  public:
+  // Each stream accepts `num_success_writes` requests before failing with
+  // `status`.
+  void set_priority_streams(int num_success_writes, grpc::Status status) {
+    num_success_writes_ = num_success_writes;
+    priority_stream_status_ = std::move(status);
+  }
+
+  grpc::ClientWriterInterface<MutatePrioritiesRequest>*
+  MutatePrioritiesStreamRaw(grpc::ClientContext* context,
+                            MutatePrioritiesResponse* response) override {
+    num_priority_streams_++;
+    priority_stream_finished_ = false;
+    return new FakePriorityStream(&priority_stream_requests_,
+                                  num_success_writes_, priority_stream_status_,
+                                  &priority_stream_finished_);
+  }
+
   grpc::Status MutatePriorities(grpc::ClientContext* context,
                                 const MutatePrioritiesRequest& request,
                                 MutatePrioritiesResponse* response) override {
@@ -65,6 +119,9 @@ class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
     *response->mutable_tables_state_id() =
         Uint128ToMessage(absl::MakeUint128(1, 2));
     response->add_table_info()->set_max_size(2);
+    response->mutable_chunk_store_info()->set_num_chunks(3);
+    response->mutable_chunk_store_info()->set_data_bytes(100);
+    response->mutable_heap_info()->set_in_use_bytes(200);
     return grpc::Status::OK;
   }
 
@@ -78,7 +135,19 @@ class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
 
   const ResetRequest& reset_request() const { return reset_request_; }
 
+  const std::vector<MutatePrioritiesRequest>& priority_stream_requests() const {
+    return priority_stream_requests_;
+  }
+  int num_priority_streams() const { return num_priority_streams_; }
+  bool priority_stream_finished() const { return priority_stream_finished_; }
+
  private:
+  int num_success_writes_ = 1000;
+  grpc::Status priority_stream_status_;
+  std::vector<MutatePrioritiesRequest> priority_stream_requests_;
+  int num_priority_streams_ = 0;
+  bool priority_stream_finished_ = false;
+
   std::chrono::system_clock::time_point last_deadline_;
   MutatePrioritiesRequest mutate_priorities_request_;
   ResetRequest reset_request_;
@@ -120,6 +189,45 @@ TEST(ClientTest, Deadline) {
             absl::ToChronoTime(absl::Now() + absl::Seconds(1)));
 }
 
+TEST(ClientTest, StreamPriorityUpdatesReusesStream) {
+  auto stub = std::make_shared<FakeStub>();
+  {
+    Client client(stub);
+    auto pair = testing::MakeKeyWithPriority(123, 456);
+    TF_EXPECT_OK(client.StreamPriorityUpdates("table", {pair}, {4}));
+    TF_EXPECT_OK(client.StreamPriorityUpdates("table", {}, {5}));
+    EXPECT_EQ(stub->num_priority_streams(), 1);
+    EXPECT_FALSE(stub->priority_stream_finished());
+
+    MutatePrioritiesRequest expected;
+    expected.set_table("table");
+    *expected.add_updates() = pair;
+    expected.add_delete_keys(4);
+    ASSERT_EQ(stub->priority_stream_requests().size(), 2);
+    EXPECT_THAT(stub->priority_stream_requests()[0],
+                testing::EqualsProto(expected));
+  }
+
+  // The stream is closed when the client is destroyed.
+  EXPECT_TRUE(stub->priority_stream_finished());
+}
+
+TEST(ClientTest, StreamPriorityUpdatesReportsErrorOfServer) {
+  auto stub = std::make_shared<FakeStub>();
+  stub->set_priority_streams(
+      1, grpc::Status(grpc::StatusCode::NOT_FOUND, "not found"));
+  Client client(stub);
+
+  TF_EXPECT_OK(client.StreamPriorityUpdates("table", {}, {1}));
+  EXPECT_TRUE(tensorflow::errors::IsNotFound(
+      client.StreamPriorityUpdates("table", {}, {2})));
+  EXPECT_TRUE(stub->priority_stream_finished());
+
+  // The next call opens a new stream.
+  TF_EXPECT_OK(client.StreamPriorityUpdates("table", {}, {3}));
+  EXPECT_EQ(stub->num_priority_streams(), 2);
+}
+
 TEST(ClientTest, ResetRequestFilled) {
   auto stub = std::make_shared<FakeStub>();
   Client client(stub);
@@ -149,6 +257,42 @@ TEST(ClientTest, ServerInfoRequestFilled) {
   EXPECT_EQ(info.tables_state_id, absl::MakeUint128(1, 2));
   EXPECT_EQ(info.table_info.size(), 1);
   EXPECT_THAT(info.table_info[0], testing::EqualsProto(expected_info));
+  EXPECT_THAT(info.chunk_store_info, testing::EqualsProto(R"pb(
+                num_chunks: 3 data_bytes: 100
+              )pb"));
+  EXPECT_EQ(info.heap_info.in_use_bytes(), 200);
+}
+
+TEST(ShardedClientTest, ShardOfIsStable) {
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  for (int i = 0; i < 3; i++) stubs.push_back(std::make_shared<FakeStub>());
+  ShardedClient client(stubs);
+  ShardedClient same_client(stubs);
+  EXPECT_EQ(client.num_shards(), 3);
+  for (uint64_t episode_id = 0; episode_id < 100; episode_id++) {
+    int shard = client.ShardOf(episode_id);
+    EXPECT_GE(shard, 0);
+    EXPECT_LT(shard, 3);
+    EXPECT_EQ(same_client.ShardOf(episode_id), shard);
+  }
+}
+
+TEST(ShardedClientTest, MutatePrioritiesIsSentToEveryShard) {
+  auto stub_a = std::make_shared<FakeStub>();
+  auto stub_b = std::make_shared<FakeStub>();
+  ShardedClient client({stub_a, stub_b});
+  auto pair = testing::MakeKeyWithPriority(123, 456);
+  TF_EXPECT_OK(client.MutatePriorities("table", {pair}, {4}));
+
+  MutatePrioritiesRequest expected;
+  expected.set_table("table");
+  *expected.add_updates() = pair;
+  expected.add_delete_keys(4);
+  EXPECT_THAT(stub_a->mutate_priorities_request(),
+              testing::EqualsProto(expected));
+  EXPECT_THAT(stub_b->mutate_priorities_request(),
+              testing::EqualsProto(expected));
 }
 
 }  // namespace
@@ -0,0 +1,604 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/multi_episode_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/bind_front.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/tensor_compression.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Chunks smaller than this are compressed on the calling thread even if the
+// writer has a compression pool, as scheduling the columns would cost more
+// than compressing them.
+constexpr int64_t kMinParallelCompressionBytes = 64 * 1024;
+
+int64_t NumTimesteps(const ChunkData& chunk) {
+  return chunk.sequence_range().end() - chunk.sequence_range().start() + 1;
+}
+
+// Copies row `src_row` of `src` into row `dst_row` of `dst`. The tensors must
+// have the same dtype and shape, except for the first dimension.
+void CopyRow(const tensorflow::Tensor& src, int64_t src_row, int64_t dst_row,
+             tensorflow::Tensor* dst) {
+  if (src.NumElements() == 0) return;
+  if (src.dtype() == tensorflow::DT_STRING) {
+    auto from = src.flat_outer_dims<tensorflow::tstring>();
+    auto to = dst->flat_outer_dims<tensorflow::tstring>();
+    for (int64_t j = 0; j < from.dimension(1); j++) {
+      to(dst_row, j) = from(src_row, j);
+    }
+    return;
+  }
+  const int64_t row_bytes = src.TotalBytes() / src.dim_size(0);
+  std::memcpy(
+      const_cast<char*>(dst->tensor_data().data()) + dst_row * row_bytes,
+      src.tensor_data().data() + src_row * row_bytes, row_bytes);
+}
+
+}  // namespace
+
+MultiEpisodeWriter::MultiEpisodeWriter(
+    std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+    int num_lanes, int chunk_length, int max_timesteps, bool delta_encoded,
+    absl::optional<int> max_in_flight_items, CompressionCodec codec,
+    std::shared_ptr<internal::ThreadPool> compression_pool)
+    : stub_(std::move(stub)),
+      chunk_length_(chunk_length),
+      max_timesteps_(max_timesteps),
+      delta_encoded_(delta_encoded),
+      max_in_flight_items_(std::move(max_in_flight_items)),
+      codec_(codec),
+      compression_pool_(std::move(compression_pool)),
+      lanes_(num_lanes) {
+  REVERB_CHECK_GE(num_lanes, 1);
+  REVERB_CHECK_GE(chunk_length_, 1);
+  REVERB_CHECK_GE(max_timesteps_, 1);
+  for (Lane& lane : lanes_) {
+    lane.episode_id = NewID();
+    lane.next_chunk_key = NewID();
+  }
+}
+
+MultiEpisodeWriter::~MultiEpisodeWriter() {
+  if (!closed_) Close().IgnoreError();
+}
+
+int32_t MultiEpisodeWriter::index_within_episode(int lane) const {
+  return lanes_[lane].index_within_episode + lanes_[lane].buffer_size;
+}
+
+tensorflow::Status MultiEpisodeWriter::CheckLane(int lane) const {
+  if (lane < 0 || lane >= num_lanes()) {
+    return tensorflow::errors::InvalidArgument(
+        "Lane ", lane, " is out of range as the writer has ", num_lanes(),
+        " lanes.");
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status MultiEpisodeWriter::Append(
+    std::vector<tensorflow::Tensor> data) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method Append after Close has been called");
+  }
+  if (data.empty()) {
+    return tensorflow::errors::InvalidArgument(
+        "Timesteps must hold at least one tensor.");
+  }
+  for (int i = 0; i < data.size(); i++) {
+    if (data[i].dims() == 0 || data[i].dim_size(0) != num_lanes()) {
+      return tensorflow::errors::InvalidArgument(
+          "Tensor ", i, " has shape ", data[i].shape().DebugString(),
+          " but the tensors must be batched over the ", num_lanes(),
+          " lanes.");
+    }
+  }
+  for (Lane& lane : lanes_) {
+    TF_RETURN_IF_ERROR(PrepareBuffer(&lane, data));
+  }
+
+  std::vector<int> full_lanes;
+  for (int l = 0; l < num_lanes(); l++) {
+    Lane& lane = lanes_[l];
+    for (int i = 0; i < data.size(); i++) {
+      CopyRow(data[i], l, lane.buffer_size, &lane.buffer[i]);
+    }
+    if (++lane.buffer_size == chunk_length_) full_lanes.push_back(l);
+  }
+  if (full_lanes.empty()) return tensorflow::Status::OK();
+
+  TF_RETURN_IF_ERROR(ChunkLanes(full_lanes));
+  if (ready_items_.empty()) return tensorflow::Status::OK();
+  return WriteWithRetries(/*retry_on_unavailable=*/true);
+}
+
+tensorflow::Status MultiEpisodeWriter::PrepareBuffer(
+    Lane* lane, const std::vector<tensorflow::Tensor>& data) {
+  auto matches = [&data](const std::vector<tensorflow::Tensor>& buffer) {
+    if (buffer.size() != data.size()) return false;
+    for (int i = 0; i < data.size(); i++) {
+      tensorflow::TensorShape shape = data[i].shape();
+      shape.set_dim(0, buffer[i].dim_size(0));
+      if (buffer[i].dtype() != data[i].dtype() || buffer[i].shape() != shape) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (matches(lane->buffer)) return tensorflow::Status::OK();
+  if (lane->buffer_size > 0) {
+    return tensorflow::errors::InvalidArgument(
+        "The dtypes and shapes of the tensors can only change once the "
+        "buffered timesteps have been chunked.");
+  }
+  lane->buffer.clear();
+  for (const auto& tensor : data) {
+    tensorflow::TensorShape shape = tensor.shape();
+    shape.set_dim(0, chunk_length_);
+    lane->buffer.emplace_back(tensor.dtype(), shape);
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status MultiEpisodeWriter::ChunkLanes(
+    const std::vector<int>& lanes) {
+  // One task per column of every chunk, all allocated up front so the chunks
+  // are the same whether or not they are encoded in parallel.
+  struct Task {
+    const Lane* lane;
+    int column;
+    tensorflow::TensorProto* proto;
+  };
+  std::vector<ChunkData> chunks(lanes.size());
+  std::vector<Task> tasks;
+  int64_t num_bytes = 0;
+  for (int i = 0; i < lanes.size(); i++) {
+    const Lane& lane = lanes_[lanes[i]];
+    ChunkData& chunk = chunks[i];
+    chunk.set_chunk_key(lane.next_chunk_key);
+    chunk.mutable_sequence_range()->set_episode_id(lane.episode_id);
+    chunk.mutable_sequence_range()->set_start(lane.index_within_episode);
+    chunk.mutable_sequence_range()->set_end(lane.index_within_episode +
+                                            lane.buffer_size - 1);
+    chunk.set_codec(codec_);
+    chunk.set_delta_encoded(delta_encoded_);
+    for (int c = 0; c < lane.buffer.size(); c++) {
+      tasks.push_back({&lane, c, chunk.mutable_data()->add_tensors()});
+      num_bytes += lane.buffer[c].TotalBytes() / chunk_length_ *
+                   lane.buffer_size;
+    }
+  }
+
+  auto encode = [this, &tasks](int i) {
+    const Task& task = tasks[i];
+    tensorflow::Tensor batched =
+        task.lane->buffer[task.column].Slice(0, task.lane->buffer_size);
+    if (delta_encoded_) batched = DeltaEncode(batched, true);
+    CompressTensorAsProto(batched, task.proto, codec_);
+  };
+  const int num_tasks = tasks.size();
+  if (compression_pool_ != nullptr && num_tasks > 1 &&
+      num_bytes >= kMinParallelCompressionBytes) {
+    absl::BlockingCounter pending(num_tasks - 1);
+    for (int i = 1; i < num_tasks; ++i) {
+      compression_pool_->Schedule([&encode, &pending, i] {
+        encode(i);
+        pending.DecrementCount();
+      });
+    }
+    encode(0);
+    pending.Wait();
+  } else {
+    for (int i = 0; i < num_tasks; ++i) encode(i);
+  }
+
+  for (int i = 0; i < lanes.size(); i++) {
+    Lane& lane = lanes_[lanes[i]];
+    lane.chunks.push_back(std::move(chunks[i]));
+    lane.index_within_episode += lane.buffer_size;
+    lane.buffer_size = 0;
+    lane.next_chunk_key = NewID();
+    ready_items_.splice(ready_items_.end(), lane.pending_items);
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status MultiEpisodeWriter::MakeItem(int lane_index,
+                                                const std::string& table,
+                                                int num_timesteps,
+                                                double priority,
+                                                PrioritizedItem* item) {
+  TF_RETURN_IF_ERROR(CheckLane(lane_index));
+  const Lane& lane = lanes_[lane_index];
+  if (num_timesteps <= 0) {
+    return tensorflow::errors::InvalidArgument(
+        "`num_timesteps` must be > 0 but got ", num_timesteps);
+  }
+  if (num_timesteps > max_timesteps_) {
+    return tensorflow::errors::InvalidArgument(
+        "`num_timesteps` must be <= `max_timesteps`");
+  }
+  int64_t num_buffered_timesteps = lane.buffer_size;
+  for (const ChunkData& chunk : lane.chunks) {
+    num_buffered_timesteps += NumTimesteps(chunk);
+  }
+  if (num_timesteps > num_buffered_timesteps) {
+    return tensorflow::errors::InvalidArgument(
+        "Argument `num_timesteps` is larger than number of buffered "
+        "timesteps of lane ", lane_index, ".");
+  }
+
+  // Walk back through the chunks until they cover the timesteps which are not
+  // in the buffer. The item starts `offset` timesteps into the first chunk it
+  // references.
+  int num_chunks = 0;
+  int64_t offset = lane.buffer_size - num_timesteps;
+  for (auto it = lane.chunks.rbegin(); offset < 0; ++it) {
+    offset += NumTimesteps(*it);
+    num_chunks++;
+  }
+
+  item->set_key(NewID());
+  item->set_table(table);
+  item->set_priority(priority);
+  item->mutable_sequence_range()->set_length(num_timesteps);
+  item->mutable_sequence_range()->set_offset(offset);
+  for (auto it = std::next(lane.chunks.begin(),
+                           lane.chunks.size() - num_chunks);
+       it != lane.chunks.end(); it++) {
+    item->add_chunk_keys(it->chunk_key());
+  }
+  if (lane.buffer_size > 0) item->add_chunk_keys(lane.next_chunk_key);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status MultiEpisodeWriter::CreateItem(int lane,
+                                                  const std::string& table,
+                                                  int num_timesteps,
+                                                  double priority) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method CreateItem after Close has been called");
+  }
+  std::vector<PrioritizedItem> items(1);
+  TF_RETURN_IF_ERROR(
+      MakeItem(lane, table, num_timesteps, priority, &items.front()));
+  return AddItems({lane}, std::move(items));
+}
+
+tensorflow::Status MultiEpisodeWriter::CreateItems(
+    const std::string& table, int num_timesteps,
+    absl::Span<const double> priorities) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method CreateItems after Close has been called");
+  }
+  if (priorities.size() != num_lanes()) {
+    return tensorflow::errors::InvalidArgument(
+        "Expected one priority per lane (", num_lanes(), ") but got ",
+        priorities.size(), ".");
+  }
+  std::vector<int> lanes(num_lanes());
+  std::vector<PrioritizedItem> items(num_lanes());
+  for (int lane = 0; lane < num_lanes(); lane++) {
+    lanes[lane] = lane;
+    TF_RETURN_IF_ERROR(MakeItem(lane, table, num_timesteps, priorities[lane],
+                                &items[lane]));
+  }
+  return AddItems(lanes, std::move(items));
+}
+
+tensorflow::Status MultiEpisodeWriter::AddItems(
+    const std::vector<int>& lanes, std::vector<PrioritizedItem> items) {
+  internal::flat_hash_set<uint64_t> ready_keys;
+  for (int i = 0; i < items.size(); i++) {
+    Lane& lane = lanes_[lanes[i]];
+    if (lane.buffer_size > 0) {
+      lane.pending_items.push_back(std::move(items[i]));
+    } else {
+      ready_keys.insert(items[i].key());
+      ready_items_.push_back(std::move(items[i]));
+    }
+  }
+  if (ready_keys.empty()) return tensorflow::Status::OK();
+
+  auto status = WriteWithRetries(/*retry_on_unavailable=*/true);
+  if (!status.ok()) {
+    ready_items_.remove_if([&ready_keys](const PrioritizedItem& item) {
+      return ready_keys.contains(item.key());
+    });
+  }
+  return status;
+}
+
+tensorflow::Status MultiEpisodeWriter::EndEpisode(int lane_index) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method EndEpisode after Close has been called");
+  }
+  TF_RETURN_IF_ERROR(CheckLane(lane_index));
+  Lane& lane = lanes_[lane_index];
+  if (lane.buffer_size > 0) TF_RETURN_IF_ERROR(ChunkLanes({lane_index}));
+  if (!ready_items_.empty()) {
+    TF_RETURN_IF_ERROR(WriteWithRetries(/*retry_on_unavailable=*/true));
+  }
+
+  ClearChunks(&lane);
+  lane.episode_id = NewID();
+  lane.index_within_episode = 0;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status MultiEpisodeWriter::Flush() {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method Flush after Close has been called");
+  }
+  std::vector<int> lanes;
+  for (int l = 0; l < num_lanes(); l++) {
+    if (!lanes_[l].pending_items.empty()) lanes.push_back(l);
+  }
+  if (!lanes.empty()) TF_RETURN_IF_ERROR(ChunkLanes(lanes));
+  if (!ready_items_.empty()) {
+    TF_RETURN_IF_ERROR(WriteWithRetries(/*retry_on_unavailable=*/true));
+  }
+  if (!ConfirmItems(0)) {
+    return tensorflow::errors::Internal(
+        "Error when confirming that all items written to table.");
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status MultiEpisodeWriter::Close(bool retry_on_unavailable) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method Close after Close has been called");
+  }
+  std::vector<int> lanes;
+  for (int l = 0; l < num_lanes(); l++) {
+    if (!lanes_[l].pending_items.empty()) lanes.push_back(l);
+  }
+  if (!lanes.empty()) TF_RETURN_IF_ERROR(ChunkLanes(lanes));
+  if (!ready_items_.empty()) {
+    auto status = WriteWithRetries(retry_on_unavailable);
+    if (!status.ok()) {
+      if (!tensorflow::errors::IsUnavailable(status) || retry_on_unavailable) {
+        return status;
+      }
+      REVERB_LOG(REVERB_INFO) << "The MultiEpisodeWriter will be closed "
+                                 "although the server was Unavailable";
+    }
+  }
+  if (stream_) {
+    stream_->WritesDone();
+    REVERB_LOG_IF(REVERB_ERROR, !ConfirmItems(0))
+        << "Unable to confirm that items were written.";
+    TF_RETURN_IF_ERROR(StopItemConfirmationWorker());
+    auto status = stream_->Finish();
+    if (!status.ok()) {
+      REVERB_LOG(REVERB_INFO) << "Received error when closing the stream: "
+                              << FormatGrpcStatus(status);
+    }
+    stream_ = nullptr;
+  }
+  lanes_.assign(lanes_.size(), Lane());
+  ready_items_.clear();
+  closed_ = true;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status MultiEpisodeWriter::WriteWithRetries(
+    bool retry_on_unavailable) {
+  while (!WritePendingData()) {
+    stream_->WritesDone();
+    TF_RETURN_IF_ERROR(StopItemConfirmationWorker());
+    auto status = FromGrpcStatus(stream_->Finish());
+    stream_ = nullptr;
+    if (!tensorflow::errors::IsUnavailable(status) || !retry_on_unavailable) {
+      return status;
+    }
+  }
+  for (Lane& lane : lanes_) TrimChunks(&lane);
+  return tensorflow::Status::OK();
+}
+
+bool MultiEpisodeWriter::WritePendingData() {
+  if (!stream_) {
+    streamed_chunk_keys_.clear();
+    context_ = absl::make_unique<grpc::ClientContext>();
+    stream_ = stub_->InsertStream(context_.get());
+    StartItemConfirmationWorker();
+  }
+
+  // Stream the chunks which are referenced by the ready items and haven't
+  // been sent yet. The server only keeps the chunks which are listed in
+  // `keep_chunk_keys` of each item, so the streamed chunks of all lanes which
+  // the writer still holds on to are listed.
+  internal::flat_hash_set<uint64_t> item_chunk_keys;
+  for (const auto& item : ready_items_) {
+    item_chunk_keys.insert(item.chunk_keys().begin(), item.chunk_keys().end());
+  }
+  std::vector<uint64_t> keep_chunk_keys;
+  for (const Lane& lane : lanes_) {
+    for (const ChunkData& chunk : lane.chunks) {
+      if (item_chunk_keys.contains(chunk.chunk_key()) &&
+          !streamed_chunk_keys_.contains(chunk.chunk_key())) {
+        InsertStreamRequest request;
+        request.set_allocated_chunk(const_cast<ChunkData*>(&chunk));
+        grpc::WriteOptions options;
+        options.set_no_compression();
+        const bool ok = stream_->Write(request, options);
+        request.release_chunk();
+        if (!ok) return false;
+        streamed_chunk_keys_.insert(chunk.chunk_key());
+      }
+      if (streamed_chunk_keys_.contains(chunk.chunk_key())) {
+        keep_chunk_keys.push_back(chunk.chunk_key());
+      }
+    }
+  }
+
+  while (!ready_items_.empty()) {
+    if (max_in_flight_items_.has_value() &&
+        !ConfirmItems(max_in_flight_items_.value() - 1)) {
+      return false;
+    }
+    InsertStreamRequest request;
+    *request.mutable_item()->mutable_item() = ready_items_.front();
+    *request.mutable_item()->mutable_keep_chunk_keys() = {
+        keep_chunk_keys.begin(), keep_chunk_keys.end()};
+    request.mutable_item()->set_send_confirmation(
+        max_in_flight_items_.has_value());
+    request.mutable_item()->set_batch_confirmations(
+        max_in_flight_items_.has_value());
+    if (!stream_->Write(request)) return false;
+    ready_items_.pop_front();
+    if (request.item().send_confirmation()) {
+      absl::MutexLock lock(&mu_);
+      ++num_items_in_flight_;
+    }
+  }
+  return true;
+}
+
+void MultiEpisodeWriter::TrimChunks(Lane* lane) {
+  int64_t num_chunked_timesteps = 0;
+  for (const ChunkData& chunk : lane->chunks) {
+    num_chunked_timesteps += NumTimesteps(chunk);
+  }
+  while (!lane->chunks.empty() &&
+         num_chunked_timesteps - NumTimesteps(lane->chunks.front()) >=
+             max_timesteps_) {
+    num_chunked_timesteps -= NumTimesteps(lane->chunks.front());
+    streamed_chunk_keys_.erase(lane->chunks.front().chunk_key());
+    lane->chunks.pop_front();
+  }
+}
+
+void MultiEpisodeWriter::ClearChunks(Lane* lane) {
+  for (const ChunkData& chunk : lane->chunks) {
+    streamed_chunk_keys_.erase(chunk.chunk_key());
+  }
+  lane->chunks.clear();
+}
+
+std::string MultiEpisodeWriter::DebugString() const {
+  return absl::StrCat("MultiEpisodeWriter(num_lanes=", num_lanes(),
+                      ", chunk_length=", chunk_length_,
+                      ", max_timesteps=", max_timesteps_,
+                      ", delta_encoded=", delta_encoded_,
+                      ", codec=", CompressionCodec_Name(codec_),
+                      ", closed=", closed_, ")");
+}
+
+uint64_t MultiEpisodeWriter::NewID() {
+  return absl::Uniform<uint64_t>(bit_gen_, 0, UINT64_MAX);
+}
+
+bool MultiEpisodeWriter::ConfirmItems(int limit) {
+  absl::ReaderMutexLock lock(&mu_);
+  auto done = [limit, this]() ABSL_SHARED_LOCKS_REQUIRED(mu_) {
+    return num_items_in_flight_ <= limit || !item_confirmation_worker_running_;
+  };
+  mu_.Await(absl::Condition(&done));
+  return num_items_in_flight_ <= limit;
+}
+
+void MultiEpisodeWriter::StartItemConfirmationWorker() {
+  if (!max_in_flight_items_.has_value()) return;
+
+  absl::MutexLock lock(&mu_);
+  REVERB_CHECK(stream_ != nullptr);
+  REVERB_CHECK(item_confirmation_worker_thread_ == nullptr);
+  REVERB_CHECK_EQ(num_items_in_flight_, 0);
+
+  item_confirmation_worker_thread_ = internal::StartThread(
+      "MultiEpisodeWriterItemConfirmer",
+      absl::bind_front(&MultiEpisodeWriter::ItemConfirmationWorker, this));
+  mu_.Await(absl::Condition(&item_confirmation_worker_running_));
+}
+
+tensorflow::Status MultiEpisodeWriter::StopItemConfirmationWorker() {
+  if (!max_in_flight_items_.has_value()) return tensorflow::Status::OK();
+
+  // The thread is joined outside of the lock as it needs it to finish.
+  std::unique_ptr<internal::Thread> thread;
+  {
+    absl::MutexLock lock(&mu_);
+    item_confirmation_worker_stop_requested_ = true;
+    mu_.Await(absl::Condition(
+        +[](bool* running) { return !(*running); },
+        &item_confirmation_worker_running_));
+    item_confirmation_worker_stop_requested_ = false;
+    thread = std::move(item_confirmation_worker_thread_);
+  }
+  thread = nullptr;
+
+  absl::MutexLock lock(&mu_);
+  if (num_items_in_flight_ > 0) {
+    const int num_items_in_flight = num_items_in_flight_;
+    num_items_in_flight_ = 0;
+    return tensorflow::errors::DataLoss(
+        "Item confirmation worker were stopped when ", num_items_in_flight,
+        " unconfirmed items (sent to server but validation response not yet "
+        "received).");
+  }
+  return tensorflow::Status::OK();
+}
+
+void MultiEpisodeWriter::ItemConfirmationWorker() {
+  InsertStreamResponse response;
+  while (true) {
+    {
+      absl::MutexLock lock(&mu_);
+      item_confirmation_worker_running_ = true;
+      mu_.Await(absl::Condition(
+          +[](MultiEpisodeWriter* w) ABSL_SHARED_LOCKS_REQUIRED(w->mu_) {
+            return w->num_items_in_flight_ > 0 ||
+                   w->item_confirmation_worker_stop_requested_;
+          },
+          this));
+      if (item_confirmation_worker_stop_requested_) break;
+    }
+    if (!stream_->Read(&response)) break;
+
+    // Servers which don't coalesce confirmations only set `key`.
+    absl::MutexLock lock(&mu_);
+    num_items_in_flight_ -= std::max(response.keys_size(), 1);
+  }
+  absl::MutexLock lock(&mu_);
+  item_confirmation_worker_running_ = false;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
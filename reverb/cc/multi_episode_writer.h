@@ -0,0 +1,239 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_MULTI_EPISODE_WRITER_H_
+#define REVERB_CC_MULTI_EPISODE_WRITER_H_
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grpcpp/impl/codegen/client_context.h"
+#include "grpcpp/impl/codegen/sync_stream.h"
+#include <cstdint>
+#include "absl/base/thread_annotations.h"
+#include "absl/random/random.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Writes the episodes of `num_lanes` environments which are stepped in
+// lockstep, e.g by a vectorized environment, over a single `InsertStream`.
+// Each lane is an episode of its own, with its own `episode_id` and
+// `index_within_episode`, but the lanes share the stream, the thread which
+// reads the item confirmations and the compression of the chunks: the chunks
+// of all lanes which are complete after an `Append` are compressed together
+// (in parallel if a `compression_pool` is set) and streamed back to back.
+// Using one `Writer` per lane instead costs a stream, a confirmation thread and
+// a round of compression of one tiny chunk per lane.
+//
+// Unlike `Writer` the timesteps are not validated against the signatures of the
+// tables (the server still validates the items) and neither shared memory nor
+// the local insertion into a server in the same process is supported.
+//
+// If streaming fails the chunks and items are kept and are streamed again by
+// the next call, except for items created by a failed `CreateItem(s)`.
+//
+// None of the methods are thread safe.
+class MultiEpisodeWriter {
+ public:
+  // The timesteps of each lane are batched into chunks of (at most)
+  // `chunk_length` timesteps, and items can reference the `max_timesteps`
+  // latest timesteps of their lane. See `Writer` for the other arguments.
+  MultiEpisodeWriter(
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+      int num_lanes, int chunk_length, int max_timesteps,
+      bool delta_encoded = false,
+      absl::optional<int> max_in_flight_items = absl::nullopt,
+      CompressionCodec codec = CODEC_SNAPPY,
+      std::shared_ptr<internal::ThreadPool> compression_pool = nullptr);
+
+  // Closes the writer if `Close` hasn't been called.
+  ~MultiEpisodeWriter();
+
+  // Appends a timestep to every lane. The tensors of `data` have shape
+  // `[num_lanes] + shape_of_timestep_element` and row `i` is appended to lane
+  // `i`. The dtypes and shapes must be the same for all timesteps of a chunk,
+  // so they can only change right after chunks have been cut.
+  tensorflow::Status Append(std::vector<tensorflow::Tensor> data);
+
+  // Creates an item in `table` which spans the latest `num_timesteps` of
+  // `lane`. The item is streamed once its timesteps have been chunked.
+  tensorflow::Status CreateItem(int lane, const std::string& table,
+                                int num_timesteps, double priority);
+
+  // Like `CreateItem` but creates an item for every lane, with priority
+  // `priorities[lane]`. No item is created if any of them is invalid.
+  tensorflow::Status CreateItems(const std::string& table, int num_timesteps,
+                                 absl::Span<const double> priorities);
+
+  // Ends the episode of `lane`: its buffered timesteps are chunked, the items
+  // which reference them are streamed and the next timestep appended to the
+  // lane starts a new episode (with a new random id). The other lanes are
+  // unaffected.
+  tensorflow::Status EndEpisode(int lane);
+
+  // Chunks the buffered timesteps of lanes which are referenced by items, and
+  // streams all pending items. Blocks until the server has confirmed that the
+  // items have been written if `max_in_flight_items` is set.
+  tensorflow::Status Flush();
+
+  // Flushes the writer and closes the stream. The object must be abandoned
+  // after calling this method. If `retry_on_unavailable` then streaming is
+  // retried for as long as the server is unavailable.
+  tensorflow::Status Close(bool retry_on_unavailable = true);
+
+  int num_lanes() const { return lanes_.size(); }
+
+  // Id of the episode of `lane` and the index (within the episode) of the next
+  // timestep appended to it. Must only be called with a valid lane.
+  uint64_t episode_id(int lane) const { return lanes_[lane].episode_id; }
+  int32_t index_within_episode(int lane) const;
+
+  // Returns a summary string description.
+  std::string DebugString() const;
+
+ private:
+  // Episode of one lane and the recent timesteps which new items can
+  // reference.
+  struct Lane {
+    uint64_t episode_id;
+
+    // Index of the first timestep of `buffer`.
+    int32_t index_within_episode = 0;
+
+    // Key of the chunk which `buffer` becomes.
+    uint64_t next_chunk_key;
+
+    // Timesteps not yet chunked, stored by column: the first `buffer_size`
+    // rows of `buffer[i]` hold tensor `i` of each buffered timestep.
+    std::vector<tensorflow::Tensor> buffer;
+    int64_t buffer_size = 0;
+
+    // Chunked timesteps which can be referenced by new items.
+    std::list<ChunkData> chunks;
+
+    // Items which reference timesteps of `buffer`. They are moved to
+    // `ready_items_` when the buffer is chunked.
+    std::list<PrioritizedItem> pending_items;
+  };
+
+  // Returns InvalidArgument unless `lane` is in [0, num_lanes).
+  tensorflow::Status CheckLane(int lane) const;
+
+  // Validates and builds an item which spans the latest `num_timesteps` of
+  // `lane`.
+  tensorflow::Status MakeItem(int lane, const std::string& table,
+                              int num_timesteps, double priority,
+                              PrioritizedItem* item);
+
+  // Adds `items` (item `i` belongs to lane `lanes[i]`) to the pending items of
+  // their lane, or to `ready_items_` if the lane has no buffered timesteps,
+  // and streams the ready items. The items are dropped if streaming fails.
+  tensorflow::Status AddItems(const std::vector<int>& lanes,
+                              std::vector<PrioritizedItem> items);
+
+  // Makes room in the buffer of `lane` for one more timestep with the tensors
+  // of row `lane` of `data`. Returns an error if their dtypes or shapes differ
+  // from those of the timesteps already in the buffer.
+  tensorflow::Status PrepareBuffer(Lane* lane,
+                                   const std::vector<tensorflow::Tensor>& data);
+
+  // Chunks the buffers of `lanes`, compressing all their columns together,
+  // and moves the pending items of the lanes to `ready_items_`.
+  tensorflow::Status ChunkLanes(const std::vector<int>& lanes);
+
+  // Retries `WritePendingData` until successful or, unless
+  // `retry_on_unavailable`, until an error other than Unavailable. Drops the
+  // chunks which are no longer needed once the items have been written.
+  tensorflow::Status WriteWithRetries(bool retry_on_unavailable);
+
+  // Streams the chunks referenced by `ready_items_` which haven't been
+  // streamed yet, followed by the items.
+  bool WritePendingData();
+
+  // Drops the oldest chunks of `lane` once the newer ones alone cover
+  // `max_timesteps_`.
+  void TrimChunks(Lane* lane);
+
+  // Forgets the chunks of `lane`, which no longer have to be kept by the
+  // server.
+  void ClearChunks(Lane* lane);
+
+  uint64_t NewID();
+
+  // See the methods of the same name in `Writer`.
+  bool ConfirmItems(int limit) ABSL_LOCKS_EXCLUDED(mu_);
+  void ItemConfirmationWorker() ABSL_LOCKS_EXCLUDED(mu_);
+  void StartItemConfirmationWorker() ABSL_LOCKS_EXCLUDED(mu_);
+  tensorflow::Status StopItemConfirmationWorker() ABSL_LOCKS_EXCLUDED(mu_);
+
+  std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub_;
+
+  std::unique_ptr<grpc::ClientReaderWriterInterface<InsertStreamRequest,
+                                                    InsertStreamResponse>>
+      stream_;
+  std::unique_ptr<grpc::ClientContext> context_;
+
+  const int chunk_length_;
+  const int max_timesteps_;
+  const bool delta_encoded_;
+  const absl::optional<int> max_in_flight_items_;
+  const CompressionCodec codec_;
+
+  // Threads which compress the columns of the chunks in parallel. May be
+  // shared with other writers. If nullptr then the chunks are compressed
+  // serially.
+  std::shared_ptr<internal::ThreadPool> compression_pool_;
+
+  absl::BitGen bit_gen_;
+
+  std::vector<Lane> lanes_;
+
+  // Items of all lanes whose timesteps have been chunked, in the order they
+  // are streamed.
+  std::list<PrioritizedItem> ready_items_;
+
+  // Keys of the chunks which have been streamed on `stream_`.
+  internal::flat_hash_set<uint64_t> streamed_chunk_keys_;
+
+  // Set if `Close` has been called.
+  bool closed_ = false;
+
+  // Protects the state shared with `item_confirmation_worker_thread_`. See
+  // the members of the same name in `Writer`.
+  absl::Mutex mu_;
+  int num_items_in_flight_ ABSL_GUARDED_BY(mu_) = 0;
+  bool item_confirmation_worker_running_ ABSL_GUARDED_BY(mu_) = false;
+  bool item_confirmation_worker_stop_requested_ ABSL_GUARDED_BY(mu_) = false;
+  std::unique_ptr<internal::Thread> item_confirmation_worker_thread_
+      ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_MULTI_EPISODE_WRITER_H_
@@ -0,0 +1,409 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/multi_episode_writer.h"
+
+#include <list>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "grpcpp/impl/codegen/call_op_set.h"
+#include "grpcpp/impl/codegen/status.h"
+#include "grpcpp/impl/codegen/sync_stream.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/reverb_service_mock.grpc.pb.h"
+#include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "reverb/cc/tensor_compression.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::tensorflow::errors::Internal;
+using ::tensorflow::errors::Unavailable;
+using ::testing::ElementsAre;
+using ::testing::SizeIs;
+
+// A timestep of every lane, where the value of lane `i` is `offset + i`.
+std::vector<tensorflow::Tensor> MakeTimesteps(int num_lanes, float offset = 0) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape{num_lanes, 2});
+  for (int i = 0; i < num_lanes; i++) {
+    tensor.matrix<float>()(i, 0) = offset + i;
+    tensor.matrix<float>()(i, 1) = offset + i;
+  }
+  return {tensor};
+}
+
+MATCHER(IsChunk, "") { return arg.has_chunk(); }
+
+MATCHER_P3(IsItemWithRangeAndPriority, offset, length, priority, "") {
+  return arg.has_item() &&
+         arg.item().item().sequence_range().offset() == offset &&
+         arg.item().item().sequence_range().length() == length &&
+         arg.item().item().priority() == priority;
+}
+
+class FakeInsertStream
+    : public grpc::ClientReaderWriterInterface<InsertStreamRequest,
+                                               InsertStreamResponse> {
+ public:
+  FakeInsertStream(std::vector<InsertStreamRequest>* requests,
+                   int num_success_writes, grpc::Status bad_status)
+      : requests_(requests),
+        num_success_writes_(num_success_writes),
+        bad_status_(std::move(bad_status)) {}
+
+  bool Write(const InsertStreamRequest& msg,
+             grpc::WriteOptions options) override {
+    requests_->push_back(msg);
+    if (msg.item().send_confirmation()) {
+      written_item_ids_.push(msg.item().item().key());
+    }
+    return num_success_writes_-- > 0;
+  }
+
+  bool Read(InsertStreamResponse* response) override {
+    if (written_item_ids_.empty()) return false;
+    response->set_key(written_item_ids_.front());
+    written_item_ids_.pop();
+    return true;
+  }
+
+  grpc::Status Finish() override {
+    return num_success_writes_ >= 0 ? grpc::Status::OK : bad_status_;
+  }
+
+  bool WritesDone() override { return num_success_writes_-- > 0; }
+
+  bool NextMessageSize(uint32_t* sz) override {
+    if (written_item_ids_.empty()) return false;
+    *sz = InsertStreamResponse().ByteSizeLong();
+    return true;
+  }
+
+  void WaitForInitialMetadata() override {}
+
+ private:
+  std::vector<InsertStreamRequest>* requests_;
+  std::queue<uint64_t> written_item_ids_;
+  int num_success_writes_;
+  grpc::Status bad_status_;
+};
+
+class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
+ public:
+  explicit FakeStub(std::list<FakeInsertStream*> streams)
+      : streams_(std::move(streams)) {}
+
+  ~FakeStub() override {
+    // Streams which haven't been handed to the writer are still owned here.
+    for (auto* stream : streams_) delete stream;
+  }
+
+  grpc::ClientReaderWriterInterface<InsertStreamRequest, InsertStreamResponse>*
+  InsertStreamRaw(grpc::ClientContext* context) override {
+    num_streams_++;
+    auto stream = streams_.front();
+    streams_.pop_front();
+    return stream;
+  }
+
+  int num_streams() const { return num_streams_; }
+
+ private:
+  std::list<FakeInsertStream*> streams_;
+  int num_streams_ = 0;
+};
+
+std::shared_ptr<FakeStub> MakeGoodStub(
+    std::vector<InsertStreamRequest>* requests) {
+  return std::make_shared<FakeStub>(std::list<FakeInsertStream*>{
+      new FakeInsertStream(requests, 10000, ToGrpcStatus(Internal("")))});
+}
+
+std::shared_ptr<FakeStub> MakeFlakyStub(
+    std::vector<InsertStreamRequest>* requests, int num_success,
+    grpc::Status error) {
+  return std::make_shared<FakeStub>(std::list<FakeInsertStream*>{
+      new FakeInsertStream(requests, num_success, error),
+      new FakeInsertStream(requests, 10000, ToGrpcStatus(Internal("")))});
+}
+
+TEST(MultiEpisodeWriterTest, DoesNotSendTimestepsWhenThereAreNoItems) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 3, 2, 10);
+  for (int i = 0; i < 5; i++) TF_ASSERT_OK(writer.Append(MakeTimesteps(3)));
+  EXPECT_THAT(requests, SizeIs(0));
+  EXPECT_EQ(stub->num_streams(), 0);
+}
+
+TEST(MultiEpisodeWriterTest, LanesAreSeparateEpisodes) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 2, 2, 10);
+  EXPECT_NE(writer.episode_id(0), writer.episode_id(1));
+
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(2, 0)));
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(2, 10)));
+  EXPECT_EQ(writer.index_within_episode(0), 2);
+  EXPECT_EQ(writer.index_within_episode(1), 2);
+  TF_ASSERT_OK(writer.CreateItem(1, "dist", 2, 1.0));
+
+  ASSERT_THAT(requests, SizeIs(2));
+  ASSERT_THAT(requests[0], IsChunk());
+  EXPECT_EQ(requests[0].chunk().sequence_range().episode_id(),
+            writer.episode_id(1));
+  EXPECT_EQ(requests[0].chunk().sequence_range().start(), 0);
+  EXPECT_EQ(requests[0].chunk().sequence_range().end(), 1);
+  EXPECT_THAT(requests[1], IsItemWithRangeAndPriority(0, 2, 1.0));
+  EXPECT_THAT(requests[1].item().item().chunk_keys(),
+              ElementsAre(requests[0].chunk().chunk_key()));
+
+  // The chunk holds the rows of lane 1 only.
+  tensorflow::Tensor column;
+  TF_ASSERT_OK(DecompressTensorFromProto(requests[0].chunk().data().tensors(0),
+                                         CODEC_SNAPPY, &column));
+  tensorflow::Tensor expected(tensorflow::DT_FLOAT,
+                              tensorflow::TensorShape{2, 2});
+  expected.matrix<float>().setValues({{1, 1}, {11, 11}});
+  tensorflow::test::ExpectTensorEqual<float>(column, expected);
+}
+
+TEST(MultiEpisodeWriterTest, CreateItemsCreatesAnItemPerLane) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 3, 2, 10);
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(3)));
+  TF_ASSERT_OK(writer.CreateItems("dist", 1, {1.0, 2.0, 3.0}));
+
+  // The items reference the buffers, so nothing is sent until they are full.
+  EXPECT_THAT(requests, SizeIs(0));
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(3)));
+
+  // All the lanes are chunked by the same `Append` and written on one stream.
+  ASSERT_THAT(requests, SizeIs(6));
+  EXPECT_EQ(stub->num_streams(), 1);
+  for (int lane = 0; lane < 3; lane++) {
+    EXPECT_THAT(requests[2 * lane], IsChunk());
+    EXPECT_EQ(requests[2 * lane].chunk().sequence_range().episode_id(),
+              writer.episode_id(lane));
+    EXPECT_THAT(requests[2 * lane + 1],
+                IsItemWithRangeAndPriority(0, 1, lane + 1.0));
+    EXPECT_THAT(requests[2 * lane + 1].item().item().chunk_keys(),
+                ElementsAre(requests[2 * lane].chunk().chunk_key()));
+  }
+}
+
+TEST(MultiEpisodeWriterTest, CreateItemsRequiresOnePriorityPerLane) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 3, 1, 10);
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(3)));
+  EXPECT_EQ(writer.CreateItems("dist", 1, {1.0, 2.0}).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_THAT(requests, SizeIs(0));
+}
+
+TEST(MultiEpisodeWriterTest, AppendRequiresTensorsBatchedOverLanes) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 3, 2, 10);
+  EXPECT_EQ(writer.Append(MakeTimesteps(2)).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(writer.Append({tensorflow::Tensor(1.0f)}).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+}
+
+TEST(MultiEpisodeWriterTest, CreateItemValidatesArguments) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 2, 2, 3);
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(2)));
+  EXPECT_EQ(writer.CreateItem(2, "dist", 1, 1.0).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(writer.CreateItem(0, "dist", 0, 1.0).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(writer.CreateItem(0, "dist", 2, 1.0).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  for (int i = 0; i < 4; i++) TF_ASSERT_OK(writer.Append(MakeTimesteps(2)));
+  EXPECT_EQ(writer.CreateItem(0, "dist", 4, 1.0).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+}
+
+TEST(MultiEpisodeWriterTest, ItemsCanSpanSeveralChunks) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 1, 2, 10);
+  for (int i = 0; i < 5; i++) TF_ASSERT_OK(writer.Append(MakeTimesteps(1)));
+  TF_ASSERT_OK(writer.CreateItem(0, "dist", 4, 1.0));
+  TF_ASSERT_OK(writer.Flush());
+
+  ASSERT_THAT(requests, SizeIs(4));
+  EXPECT_THAT(requests[0], IsChunk());
+  EXPECT_THAT(requests[1], IsChunk());
+  EXPECT_THAT(requests[2], IsChunk());
+  EXPECT_THAT(requests[3], IsItemWithRangeAndPriority(1, 4, 1.0));
+  EXPECT_THAT(requests[3].item().item().chunk_keys(),
+              ElementsAre(requests[0].chunk().chunk_key(),
+                          requests[1].chunk().chunk_key(),
+                          requests[2].chunk().chunk_key()));
+}
+
+TEST(MultiEpisodeWriterTest, EndEpisodeOnlyAffectsItsLane) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 2, 2, 10);
+  const uint64_t first_episode_id = writer.episode_id(0);
+  const uint64_t other_episode_id = writer.episode_id(1);
+
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(2)));
+  TF_ASSERT_OK(writer.CreateItem(0, "dist", 1, 1.0));
+  TF_ASSERT_OK(writer.EndEpisode(0));
+
+  // The partial chunk of the lane is cut and the item is sent.
+  ASSERT_THAT(requests, SizeIs(2));
+  EXPECT_EQ(requests[0].chunk().sequence_range().episode_id(),
+            first_episode_id);
+  EXPECT_EQ(requests[0].chunk().sequence_range().end(), 0);
+  EXPECT_THAT(requests[1], IsItemWithRangeAndPriority(0, 1, 1.0));
+
+  EXPECT_NE(writer.episode_id(0), first_episode_id);
+  EXPECT_EQ(writer.index_within_episode(0), 0);
+  EXPECT_EQ(writer.episode_id(1), other_episode_id);
+  EXPECT_EQ(writer.index_within_episode(1), 1);
+
+  // The timesteps of the old episode can no longer be referenced.
+  EXPECT_EQ(writer.CreateItem(0, "dist", 1, 1.0).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  TF_EXPECT_OK(writer.CreateItem(1, "dist", 1, 1.0));
+}
+
+TEST(MultiEpisodeWriterTest, KeepsStreamedChunksOfAllLanes) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 2, 1, 10);
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(2)));
+  TF_ASSERT_OK(writer.CreateItem(0, "dist", 1, 1.0));
+  TF_ASSERT_OK(writer.CreateItem(1, "dist", 1, 1.0));
+
+  ASSERT_THAT(requests, SizeIs(4));
+  EXPECT_THAT(requests[3].item().keep_chunk_keys(),
+              ElementsAre(requests[0].chunk().chunk_key(),
+                          requests[2].chunk().chunk_key()));
+}
+
+TEST(MultiEpisodeWriterTest, RetriesOnTransientError) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeFlakyStub(&requests, 1, ToGrpcStatus(Unavailable("")));
+  MultiEpisodeWriter writer(stub, 2, 1, 10);
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(2)));
+  TF_ASSERT_OK(writer.CreateItem(0, "dist", 1, 1.0));
+
+  // The chunk is sent again on the new stream.
+  ASSERT_THAT(requests, SizeIs(4));
+  EXPECT_THAT(requests[0], IsChunk());
+  EXPECT_THAT(requests[2], IsChunk());
+  EXPECT_EQ(requests[0].chunk().chunk_key(), requests[2].chunk().chunk_key());
+  EXPECT_THAT(requests[3], IsItemWithRangeAndPriority(0, 1, 1.0));
+  EXPECT_EQ(stub->num_streams(), 2);
+}
+
+TEST(MultiEpisodeWriterTest, DropsItemsOnPermanentError) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeFlakyStub(&requests, 1, ToGrpcStatus(Internal("")));
+  MultiEpisodeWriter writer(stub, 1, 1, 10);
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(1)));
+  EXPECT_EQ(writer.CreateItem(0, "dist", 1, 1.0).code(),
+            tensorflow::error::INTERNAL);
+
+  requests.clear();
+  TF_ASSERT_OK(writer.Flush());
+  EXPECT_THAT(requests, SizeIs(0));
+}
+
+TEST(MultiEpisodeWriterTest, FlushWaitsForConfirmations) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 2, 3, 10, /*delta_encoded=*/false,
+                            /*max_in_flight_items=*/1);
+  TF_ASSERT_OK(writer.Append(MakeTimesteps(2)));
+  TF_ASSERT_OK(writer.CreateItems("dist", 1, {1.0, 1.0}));
+  EXPECT_THAT(requests, SizeIs(0));
+
+  TF_ASSERT_OK(writer.Flush());
+  ASSERT_THAT(requests, SizeIs(4));
+  EXPECT_TRUE(requests[1].item().send_confirmation());
+  EXPECT_TRUE(requests[3].item().send_confirmation());
+}
+
+TEST(MultiEpisodeWriterTest, CompressesLanesOnPool) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  auto pool = std::make_shared<internal::ThreadPool>(4, "compression");
+  constexpr int kNumLanes = 4;
+  MultiEpisodeWriter writer(stub, kNumLanes, 1, 10, /*delta_encoded=*/true,
+                            absl::nullopt, CODEC_SNAPPY, pool);
+
+  // Large enough to be compressed in parallel.
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape{kNumLanes, 64 * 1024});
+  for (int i = 0; i < kNumLanes; i++) {
+    for (int j = 0; j < tensor.dim_size(1); j++) {
+      tensor.matrix<int32_t>()(i, j) = i * j;
+    }
+  }
+  TF_ASSERT_OK(writer.Append({tensor}));
+  TF_ASSERT_OK(writer.CreateItems("dist", 1, {1.0, 1.0, 1.0, 1.0}));
+
+  ASSERT_THAT(requests, SizeIs(2 * kNumLanes));
+  for (int lane = 0; lane < kNumLanes; lane++) {
+    const ChunkData& chunk = requests[2 * lane].chunk();
+    EXPECT_TRUE(chunk.delta_encoded());
+    tensorflow::Tensor column;
+    TF_ASSERT_OK(DecompressTensorFromProto(chunk.data().tensors(0),
+                                           CODEC_SNAPPY, &column));
+    column = DeltaEncode(column, false);
+    tensorflow::test::ExpectTensorEqual<int32_t>(
+        column, tensor.Slice(lane, lane + 1));
+  }
+}
+
+TEST(MultiEpisodeWriterTest, MethodsFailAfterClose) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  MultiEpisodeWriter writer(stub, 2, 2, 10);
+  TF_ASSERT_OK(writer.Close());
+  EXPECT_EQ(writer.Append(MakeTimesteps(2)).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(writer.CreateItem(0, "dist", 1, 1.0).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(writer.EndEpisode(0).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(writer.Close().code(), tensorflow::error::FAILED_PRECONDITION);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -19,12 +19,15 @@
 #include <vector>
 
 #include <cstdint>
+#include "absl/base/thread_annotations.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/resource_op_kernel.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/refcount.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
@@ -77,15 +80,28 @@ of the request.
 
 REGISTER_OP("ReverbClientInsert")
     .Attr("T: list(type) >= 0")
+    .Attr("chunk_length: int >= 1 = 1")
+    .Attr("max_in_flight_items: int >= 0 = 0")
     .Input("handle: resource")
     .Input("data: T")
     .Input("tables: string")
     .Input("priorities: double")
+    .SetIsStateful()
     .Doc(R"doc(
-Blocking call to insert a single trajectory into one or more tables. The data
-is treated as an episode constituting of a single timestep. Note that this mean
-that when the item is sampled, it will be returned as a sequence of length 1,
-containing `data`.
+Inserts a single trajectory into one or more tables. The data is appended as a
+single timestep. Note that this mean that when the item is sampled, it will be
+returned as a sequence of length 1, containing `data`.
+
+Every instance of the op keeps a writer, and thus a stream to the server, open
+across calls. The timesteps of consecutive calls are batched into chunks of
+`chunk_length` timesteps.
+
+If `max_in_flight_items` is 0 then the call blocks until the server has
+confirmed that the items were inserted. This requires the current chunk to be
+sent so the chunks always hold a single timestep. Otherwise the items are
+confirmed asynchronously and the call only blocks while more than
+`max_in_flight_items` items are unconfirmed. The items are sent once their
+chunk is complete, i.e after `chunk_length` calls.
 )doc");
 
 class ClientResource : public tensorflow::ResourceBase {
@@ -206,14 +222,16 @@ class UpdatePrioritiesOp : public tensorflow::OpKernel {
       updates.push_back(std::move(update));
     }
 
-    // The call will only fail if the Reverb-server is brought down during an
-    // active call (e.g preempted). When this happens the request is retried and
-    // since MutatePriorities sets `wait_for_ready` the request will no be sent
-    // before the server is brought up again. It is therefore no problem to have
-    // this retry in this tight loop.
+    // The updates are streamed so the op doesn't wait for the server to apply
+    // them. The call will only fail if the Reverb-server is brought down while
+    // the stream is open (e.g preempted). When this happens the request is
+    // retried on a new stream and since the stream sets `wait_for_ready` the
+    // request will no be sent before the server is brought up again. It is
+    // therefore no problem to have this retry in this tight loop.
     tensorflow::Status status;
     do {
-      status = resource->client()->MutatePriorities(table_str, updates, {});
+      status =
+          resource->client()->StreamPriorityUpdates(table_str, updates, {});
     } while (tensorflow::errors::IsUnavailable(status) ||
              tensorflow::errors::IsDeadlineExceeded(status));
     OP_REQUIRES_OK(context, status);
@@ -225,12 +243,22 @@ class UpdatePrioritiesOp : public tensorflow::OpKernel {
 class InsertOp : public tensorflow::OpKernel {
  public:
   explicit InsertOp(tensorflow::OpKernelConstruction* context)
-      : OpKernel(context) {}
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("chunk_length", &chunk_length_));
+    OP_REQUIRES_OK(context, context->GetAttr("max_in_flight_items",
+                                             &max_in_flight_items_));
+  }
+
+  ~InsertOp() override {
+    absl::MutexLock lock(&mu_);
+    ResetWriter();
+  }
 
   void Compute(tensorflow::OpKernelContext* context) override {
     ClientResource* resource;
     OP_REQUIRES_OK(context, LookupResource(context, HandleFromInput(context, 0),
                                            &resource));
+    tensorflow::core::ScopedUnref unref(resource);
 
     const tensorflow::Tensor* tables;
     OP_REQUIRES_OK(context, context->input("tables", &tables));
@@ -253,21 +281,68 @@ class InsertOp : public tensorflow::OpKernel {
       tensors.push_back(i);
     }
 
-    std::unique_ptr<Writer> writer;
-    OP_REQUIRES_OK(context,
-                   resource->client()->NewWriter(1, 1, false, &writer));
-    OP_REQUIRES_OK(context, writer->Append(std::move(tensors)));
+    // The writer is not thread safe and the op can be run concurrently.
+    absl::MutexLock lock(&mu_);
+    tensorflow::Status status =
+        Insert(resource, std::move(tensors), *tables, *priorities);
+    // The writer must be abandoned after a failure. The next call creates a
+    // new one.
+    if (!status.ok()) ResetWriter();
+    OP_REQUIRES_OK(context, status);
+  }
 
-    auto tables_t = tables->flat<tstring>();
-    auto priorities_t = priorities->flat<double>();
-    for (int i = 0; i < tables->dim_size(0); i++) {
-      OP_REQUIRES_OK(context,
-                     writer->CreateItem(tables_t(i), 1, priorities_t(i)));
+ private:
+  tensorflow::Status Insert(ClientResource* resource,
+                            std::vector<tensorflow::Tensor> tensors,
+                            const tensorflow::Tensor& tables,
+                            const tensorflow::Tensor& priorities)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    // The writer is bound to the client of the resource which it was created
+    // with.
+    if (resource != writer_resource_) ResetWriter();
+    if (writer_ == nullptr) {
+      const int chunk_length = max_in_flight_items_ == 0 ? 1 : chunk_length_;
+      const int max_in_flight_items =
+          max_in_flight_items_ == 0 ? 1 : max_in_flight_items_;
+      TF_RETURN_IF_ERROR(resource->client()->NewWriter(
+          chunk_length, /*max_timesteps=*/1, /*delta_encoded=*/false,
+          max_in_flight_items, &writer_));
+      // Keep the client alive for as long as the writer uses it.
+      resource->Ref();
+      writer_resource_ = resource;
     }
 
-    OP_REQUIRES_OK(context, writer->Close());
+    TF_RETURN_IF_ERROR(writer_->Append(std::move(tensors)));
+    auto tables_t = tables.flat<tstring>();
+    auto priorities_t = priorities.flat<double>();
+    for (int i = 0; i < tables.dim_size(0); i++) {
+      TF_RETURN_IF_ERROR(writer_->CreateItem(tables_t(i), 1, priorities_t(i)));
+    }
+    if (max_in_flight_items_ == 0) {
+      TF_RETURN_IF_ERROR(writer_->Flush());
+    }
+    return tensorflow::Status::OK();
   }
 
+  // Closes the writer, which sends its pending items, and releases its client.
+  void ResetWriter() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    if (writer_ != nullptr) {
+      writer_->Close().IgnoreError();
+      writer_ = nullptr;
+    }
+    if (writer_resource_ != nullptr) {
+      writer_resource_->Unref();
+      writer_resource_ = nullptr;
+    }
+  }
+
+  int chunk_length_;
+  int max_in_flight_items_;
+
+  absl::Mutex mu_;
+  std::unique_ptr<Writer> writer_ ABSL_GUARDED_BY(mu_);
+  ClientResource* writer_resource_ ABSL_GUARDED_BY(mu_) = nullptr;
+
   TF_DISALLOW_COPY_AND_ASSIGN(InsertOp);
 };
 
@@ -18,7 +18,9 @@
 #include "reverb/cc/client.h"
 #include "reverb/cc/errors.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/sampler.h"
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/common_shape_fns.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
@@ -39,11 +41,18 @@ REGISTER_OP("ReverbDataset")
     .Input("table: string")
     .Attr("sequence_length: int = -1")
     .Attr("emit_timesteps: bool = true")
+    .Attr("batch_size: int = -1")
+    .Attr("drop_remainder: bool = false")
+    .Attr("max_samples: int = -1")
     .Attr("max_in_flight_samples_per_worker: int = 100")
     .Attr("num_workers_per_iterator: int = -1")
     .Attr("max_samples_per_stream: int = -1")
     .Attr("rate_limiter_timeout_ms: int = -1")
     .Attr("flexible_batch_size: int = -1")
+    .Attr("mixed_tables: list(string) = []")
+    .Attr("mixed_table_weights: list(float) = []")
+    .Attr("server_addresses: list(string) = []")
+    .Attr("pinned_memory: bool = false")
     .Attr("dtypes: list(type) >= 1")
     .Attr("shapes: list(shape) >= 1")
     .Output("dataset: variant")
@@ -73,6 +82,24 @@ complete sequences should be returned from the iterators. When set to false
 Emitting complete samples is more efficient as it avoids the memcopies involved
 in splitting up a sequence and then batching it up again.
 
+`batch_size` (defaults to -1, i.e. not batched) is the number of complete
+samples to return in each element. When set, `emit_timesteps` must be false and
+the samples of a batch are written directly into tensors of shape
+[batch_size, sequence_length, ...] (see `Sampler::GetNextBatch`). The key,
+probability, table size and priority are returned as tensors of shape
+[batch_size]. `shapes` must have dim[0] equal to `batch_size` (or unknown) and
+the data shapes must have dim[1] equal to `sequence_length`. The final batch
+may hold fewer than `batch_size` samples when `max_samples` is reached or the
+rate limiter times out.
+
+`drop_remainder` (defaults to false) drops the final batch if it holds fewer
+than `batch_size` samples. Requires `batch_size` to be set.
+
+`max_samples` (defaults to -1, i.e unlimited) is the number of elements that
+each iterator returns before the end of the sequence is reached. Elements are
+batches when `batch_size` is set and samples otherwise (even if timesteps are
+emitted).
+
 `max_in_flight_samples_per_worker` (defaults to 100) is the maximum number of
  sampled item allowed to exist in flight (per iterator). See
 `Sampler::Options::max_in_flight_samples_per_worker` for more details.
@@ -108,6 +135,28 @@ auto selected value should almost always be preferred.
 Larger `flexible_batch_size` values result a bias towards sampling over
 inserts. In highly overloaded systems this results in higher sample QPS
 and lower insert QPS compared to lower `flexible_batch_size` values.
+
+`mixed_tables` and `mixed_table_weights` (default to empty) are the names of
+tables to sample from instead of `table`, which must then be empty, and the
+weights in proportion to which their samples are mixed by the server. The
+samples are fetched over a single stream per worker (see
+`SampleStreamRequest.tables`). All the tables must share the same signature.
+
+`server_addresses` (defaults to empty) are the addresses of servers to sample
+`table` from instead of `server_address`, which must then be empty. Each
+iterator then keeps streams open to all of the servers and merges their samples
+into a single queue, spreading its requests according to the load of the
+tables (see `Client::NewMultiServerSampler`). The signature is fetched from the
+first server and the tables of all servers must share it. Cannot be combined
+with `mixed_tables`.
+
+`pinned_memory` (defaults to false) allocates the tensors of the samples (and
+batches) returned by the iterators from the pinned host allocator of the device,
+so that they can be copied to GPUs without first being staged in pinned memory
+(see `Sampler::Options::output_allocator`). The samples are decompressed
+straight into these tensors. Has no effect if the process has no GPU. Pair it
+with `tf.data.experimental.prefetch_to_device` to overlap the copy of an element
+to the device with the decoding of the next ones.
 )doc");
 
 class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
@@ -125,6 +174,14 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
                                      &sampler_options_.flexible_batch_size));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("sequence_length", &sequence_length_));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("emit_timesteps", &emit_timesteps_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("batch_size", &batch_size_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("drop_remainder", &drop_remainder_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("max_samples", &max_samples_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("mixed_tables", &mixed_tables_));
+    OP_REQUIRES_OK(
+        ctx, ctx->GetAttr("mixed_table_weights", &mixed_table_weights_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("server_addresses", &server_addresses_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("pinned_memory", &pinned_memory_));
     tensorflow::int64 rate_limiter_timeout_ms;
     OP_REQUIRES_OK(
         ctx, ctx->GetAttr("rate_limiter_timeout_ms", &rate_limiter_timeout_ms));
@@ -134,7 +191,64 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
     sampler_options_.rate_limiter_timeout =
         Int64MillisToNonnegativeDuration(rate_limiter_timeout_ms);
 
-    if (!emit_timesteps_) {
+    OP_REQUIRES(ctx, mixed_tables_.size() == mixed_table_weights_.size(),
+                InvalidArgument("mixed_tables and mixed_table_weights must "
+                                "have the same length but got ",
+                                mixed_tables_.size(), " vs. ",
+                                mixed_table_weights_.size(), "."));
+    for (float weight : mixed_table_weights_) {
+      OP_REQUIRES(ctx, weight > 0,
+                  InvalidArgument("mixed_table_weights must be positive but "
+                                  "got ",
+                                  weight, "."));
+    }
+    OP_REQUIRES(ctx, server_addresses_.empty() || mixed_tables_.empty(),
+                InvalidArgument("server_addresses and mixed_tables cannot "
+                                "both be set."));
+
+    OP_REQUIRES(ctx, batch_size_ > 0 || batch_size_ == -1,
+                InvalidArgument("batch_size (", batch_size_,
+                                ") must be a positive integer or -1."));
+    OP_REQUIRES(ctx, batch_size_ == -1 || !emit_timesteps_,
+                InvalidArgument(
+                    "emit_timesteps must be false when batch_size is set."));
+    OP_REQUIRES(ctx, batch_size_ > 0 || !drop_remainder_,
+                InvalidArgument(
+                    "drop_remainder can only be set when batch_size is set."));
+    OP_REQUIRES(ctx, max_samples_ > 0 || max_samples_ == -1,
+                InvalidArgument("max_samples (", max_samples_,
+                                ") must be a positive integer or -1."));
+    if (max_samples_ > 0) {
+      sampler_options_.max_samples =
+          batch_size_ > 0 ? max_samples_ * batch_size_ : max_samples_;
+    }
+
+    if (batch_size_ > 0) {
+      for (int i = 0; i < shapes_.size(); i++) {
+        // The first four tensors hold the metadata with one value per sample.
+        const int min_dims = i < 4 ? 1 : 2;
+        OP_REQUIRES(ctx, shapes_[i].dims() >= min_dims,
+                    InvalidArgument("When batch_size is set, element ", i,
+                                    " of flattened shapes must have at least ",
+                                    min_dims, " dimensions but has shape ",
+                                    shapes_[i].DebugString(), "."));
+        OP_REQUIRES(ctx,
+                    shapes_[i].dim_size(0) == -1 ||
+                        shapes_[i].dim_size(0) == batch_size_,
+                    InvalidArgument("When batch_size is set, all elements of "
+                                    "shapes must have dim[0] = batch_size (",
+                                    batch_size_, ") or unknown. Element ", i,
+                                    " of flattened shapes has dim[0] = ",
+                                    shapes_[i].dim_size(0), "."));
+        OP_REQUIRES(ctx, i < 4 || shapes_[i].dim_size(1) == sequence_length_,
+                    InvalidArgument("When batch_size is set, all data elements "
+                                    "of shapes must have dim[1] = "
+                                    "sequence_length (",
+                                    sequence_length_, "). Element ", i,
+                                    " of flattened shapes has dim[1] = ",
+                                    shapes_[i].dim_size(1), "."));
+      }
+    } else if (!emit_timesteps_) {
       for (int i = 0; i < shapes_.size(); i++) {
         OP_REQUIRES(ctx, shapes_[i].dims() != 0,
                     InvalidArgument(
@@ -167,36 +281,70 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
     OP_REQUIRES_OK(ctx,
                    tensorflow::data::ParseScalarArgument<tensorflow::tstring>(
                        ctx, "table", &table));
+    OP_REQUIRES(ctx, mixed_tables_.empty() || table.empty(),
+                InvalidArgument("table must be empty when mixed_tables is "
+                                "set but got '",
+                                table, "'."));
+    OP_REQUIRES(ctx, server_addresses_.empty() || server_address.empty(),
+                InvalidArgument("server_address must be empty when "
+                                "server_addresses is set but got '",
+                                server_address, "'."));
+
+    std::vector<TableWeight> tables;
+    if (mixed_tables_.empty()) {
+      tables.emplace_back();
+      tables.back().set_table(table);
+      tables.back().set_weight(1);
+    }
+    for (int i = 0; i < mixed_tables_.size(); i++) {
+      tables.emplace_back();
+      tables.back().set_table(mixed_tables_[i]);
+      tables.back().set_weight(mixed_table_weights_[i]);
+    }
 
-    *output = new Dataset(ctx, server_address, dtypes_, shapes_, table,
-                          sampler_options_, sequence_length_, emit_timesteps_);
+    *output = new Dataset(ctx, server_address, server_addresses_, dtypes_,
+                          shapes_, table, std::move(tables), sampler_options_,
+                          sequence_length_, emit_timesteps_, batch_size_,
+                          drop_remainder_, max_samples_, pinned_memory_);
   }
 
  private:
   class Dataset : public tensorflow::data::DatasetBase {
    public:
     Dataset(tensorflow::OpKernelContext* ctx, std::string server_address,
+            std::vector<std::string> server_addresses,
             tensorflow::DataTypeVector dtypes,
             std::vector<tensorflow::PartialTensorShape> shapes,
-            std::string table, const Sampler::Options& sampler_options,
-            int sequence_length, bool emit_timesteps)
+            std::string table, std::vector<TableWeight> tables,
+            const Sampler::Options& sampler_options, int sequence_length,
+            bool emit_timesteps, int batch_size, bool drop_remainder,
+            tensorflow::int64 max_samples, bool pinned_memory)
         : tensorflow::data::DatasetBase(tensorflow::data::DatasetContext(ctx)),
           server_address_(std::move(server_address)),
+          server_addresses_(std::move(server_addresses)),
           dtypes_(std::move(dtypes)),
           shapes_(std::move(shapes)),
           table_(std::move(table)),
+          tables_(std::move(tables)),
           sampler_options_(sampler_options),
           sequence_length_(sequence_length),
           emit_timesteps_(emit_timesteps),
-          client_(absl::make_unique<Client>(server_address_)) {}
+          batch_size_(batch_size),
+          drop_remainder_(drop_remainder),
+          max_samples_(max_samples),
+          pinned_memory_(pinned_memory),
+          client_(absl::make_unique<Client>(server_addresses_.empty()
+                                                ? server_address_
+                                                : server_addresses_.front())) {}
 
     std::unique_ptr<tensorflow::data::IteratorBase> MakeIteratorInternal(
         const std::string& prefix) const override {
       return absl::make_unique<Iterator>(
           tensorflow::data::DatasetIterator<Dataset>::Params{
               this, absl::StrCat(prefix, "::ReverbDataset")},
-          client_.get(), table_, sampler_options_, sequence_length_,
-          emit_timesteps_, dtypes_, shapes_);
+          client_.get(), server_addresses_, tables_, sampler_options_,
+          sequence_length_, emit_timesteps_, batch_size_, drop_remainder_,
+          pinned_memory_, dtypes_, shapes_);
     }
 
     const tensorflow::DataTypeVector& output_dtypes() const override {
@@ -225,8 +373,15 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
       tensorflow::AttrValue max_samples_per_stream_attr;
       tensorflow::AttrValue sequence_length_attr;
       tensorflow::AttrValue emit_timesteps_attr;
+      tensorflow::AttrValue batch_size_attr;
+      tensorflow::AttrValue drop_remainder_attr;
+      tensorflow::AttrValue max_samples_attr;
       tensorflow::AttrValue rate_limiter_timeout_ms_attr;
       tensorflow::AttrValue flexible_batch_size_attr;
+      tensorflow::AttrValue mixed_tables_attr;
+      tensorflow::AttrValue mixed_table_weights_attr;
+      tensorflow::AttrValue server_addresses_attr;
+      tensorflow::AttrValue pinned_memory_attr;
       tensorflow::AttrValue dtypes_attr;
       tensorflow::AttrValue shapes_attr;
 
@@ -247,8 +402,23 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
           &rate_limiter_timeout_ms_attr);
       b->BuildAttrValue(sequence_length_, &sequence_length_attr);
       b->BuildAttrValue(emit_timesteps_, &emit_timesteps_attr);
+      b->BuildAttrValue(batch_size_, &batch_size_attr);
+      b->BuildAttrValue(drop_remainder_, &drop_remainder_attr);
+      b->BuildAttrValue(max_samples_, &max_samples_attr);
       b->BuildAttrValue(sampler_options_.flexible_batch_size,
                         &flexible_batch_size_attr);
+      std::vector<std::string> mixed_tables;
+      std::vector<float> mixed_table_weights;
+      if (table_.empty()) {
+        for (const auto& table : tables_) {
+          mixed_tables.push_back(table.table());
+          mixed_table_weights.push_back(table.weight());
+        }
+      }
+      b->BuildAttrValue(mixed_tables, &mixed_tables_attr);
+      b->BuildAttrValue(mixed_table_weights, &mixed_table_weights_attr);
+      b->BuildAttrValue(server_addresses_, &server_addresses_attr);
+      b->BuildAttrValue(pinned_memory_, &pinned_memory_attr);
       b->BuildAttrValue(dtypes_, &dtypes_attr);
       b->BuildAttrValue(shapes_, &shapes_attr);
 
@@ -263,8 +433,15 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
               {"max_samples_per_stream", max_samples_per_stream_attr},
               {"sequence_length", sequence_length_attr},
               {"emit_timesteps", emit_timesteps_attr},
+              {"batch_size", batch_size_attr},
+              {"drop_remainder", drop_remainder_attr},
+              {"max_samples", max_samples_attr},
               {"rate_limiter_timeout_ms", rate_limiter_timeout_ms_attr},
               {"flexible_batch_size", flexible_batch_size_attr},
+              {"mixed_tables", mixed_tables_attr},
+              {"mixed_table_weights", mixed_table_weights_attr},
+              {"server_addresses", server_addresses_attr},
+              {"pinned_memory", pinned_memory_attr},
               {"dtypes", dtypes_attr},
               {"shapes", shapes_attr},
           },
@@ -277,16 +454,23 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
     class Iterator : public tensorflow::data::DatasetIterator<Dataset> {
      public:
       explicit Iterator(
-          const Params& params, Client* client, const std::string& table,
+          const Params& params, Client* client,
+          const std::vector<std::string>& server_addresses,
+          const std::vector<TableWeight>& tables,
           const Sampler::Options& sampler_options, int sequence_length,
-          bool emit_timesteps, const tensorflow::DataTypeVector& dtypes,
+          bool emit_timesteps, int batch_size, bool drop_remainder,
+          bool pinned_memory, const tensorflow::DataTypeVector& dtypes,
           const std::vector<tensorflow::PartialTensorShape>& shapes)
           : DatasetIterator<Dataset>(params),
             client_(client),
-            table_(table),
+            server_addresses_(server_addresses),
+            tables_(tables),
             sampler_options_(sampler_options),
             sequence_length_(sequence_length),
             emit_timesteps_(emit_timesteps),
+            batch_size_(batch_size),
+            drop_remainder_(drop_remainder),
+            pinned_memory_(pinned_memory),
             dtypes_(dtypes),
             shapes_(shapes),
             step_within_sample_(0) {}
@@ -296,31 +480,61 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
         // If sequences are emitted then the all shapes will start with the
         // sequence length. The validation expects the shapes of a single
         // timestep so if sequences are emitted then we need to trim the leading
-        // dim on all shapes before validating it.
+        // dim on all shapes before validating it. Batches have an additional
+        // leading batch dimension which is trimmed as well.
         auto validation_shapes = shapes_;
-        if (!emit_timesteps_) {
+        if (batch_size_ > 0) {
+          for (int i = 0; i < validation_shapes.size(); i++) {
+            validation_shapes[i].RemoveDim(0);
+            if (i >= 4) validation_shapes[i].RemoveDim(0);
+          }
+        } else if (!emit_timesteps_) {
           for (auto& shape : validation_shapes) {
             shape.RemoveDim(0);
           }
         }
 
+        // The pinned host allocator is the CPU allocator in processes without
+        // a GPU.
+        Sampler::Options sampler_options = sampler_options_;
+        if (pinned_memory_) {
+          tensorflow::AllocatorAttributes attrs;
+          attrs.set_on_host(true);
+          attrs.set_gpu_compatible(true);
+          sampler_options.output_allocator = ctx->allocator(attrs);
+        }
+
         constexpr auto kValidationTimeout = absl::Seconds(30);
-        auto status = client_->NewSampler(table_, sampler_options_,
-                                          /*validation_dtypes=*/dtypes_,
-                                          validation_shapes, kValidationTimeout,
-                                          &sampler_);
+        tensorflow::Status status;
+        if (server_addresses_.empty()) {
+          status = client_->NewSampler(tables_, sampler_options,
+                                       /*validation_dtypes=*/dtypes_,
+                                       validation_shapes, kValidationTimeout,
+                                       &sampler_);
+        } else {
+          status = client_->NewMultiServerSampler(
+              server_addresses_, tables_.front().table(), sampler_options,
+              /*validation_dtypes=*/dtypes_, validation_shapes,
+              kValidationTimeout, &sampler_);
+        }
         if (tensorflow::errors::IsDeadlineExceeded(status)) {
           REVERB_LOG(REVERB_WARNING)
               << "Unable to validate shapes and dtypes of new sampler for '"
-              << table_ << "' as server could not be reached in time ("
+              << tables_.front().table()
+              << "' as server could not be reached in time ("
               << kValidationTimeout
               << "). We were thus unable to fetch signature from server. The "
                  "sampler will be constructed without validating the dtypes "
                  "and shapes.";
+          if (!server_addresses_.empty()) {
+            return Client::NewMultiServerSampler(server_addresses_,
+                                                 tables_.front().table(),
+                                                 sampler_options, &sampler_);
+          }
           // Ask for a NewSampler with negative validation_timeout Duration,
           // which causes it to skip the validation and return an OK status.
           return client_->NewSampler(
-              table_, sampler_options_,
+              tables_, sampler_options,
               /*validation_timeout=*/-absl::InfiniteDuration(), &sampler_);
         }
         return status;
@@ -340,6 +554,7 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
         }
 
         tensorflow::Status status;
+        bool dropped_remainder = false;
         if (emit_timesteps_) {
           bool last_timestep = false;
           status = sampler_->GetNextTimestep(out_tensors, &last_timestep);
@@ -361,6 +576,14 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
           if (last_timestep) {
             step_within_sample_ = 0;
           }
+        } else if (batch_size_ > 0) {
+          // `batch_` keeps sharing the buffers handed out by the previous call
+          // so they are filled in place once downstream has released them.
+          status = sampler_->GetNextBatch(batch_size_, &batch_);
+          // Only the last batch can be partial so the sequence ends here.
+          dropped_remainder = status.ok() && drop_remainder_ &&
+                              batch_.front().dim_size(0) < batch_size_;
+          if (status.ok() && !dropped_remainder) *out_tensors = batch_;
         } else {
           status = sampler_->GetNextSample(out_tensors);
         }
@@ -371,8 +594,14 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
         }
 
         if (status.ok()) {
-          *end_of_sequence = false;
+          *end_of_sequence = dropped_remainder;
           return status;
+        } else if (tensorflow::errors::IsOutOfRange(status) &&
+                   sampler_options_.max_samples !=
+                       Sampler::kUnlimitedMaxSamples) {
+          // All of the `max_samples` elements have been returned.
+          *end_of_sequence = true;
+          return tensorflow::Status::OK();
         } else if (sampler_options_.rate_limiter_timeout <
                        absl::InfiniteDuration() &&
                    errors::IsRateLimiterTimeout(status)) {
@@ -398,29 +627,52 @@ class ReverbDatasetOp : public tensorflow::data::DatasetOpKernel {
 
      private:
       Client* client_;
-      const std::string& table_;
+      const std::vector<std::string>& server_addresses_;
+      const std::vector<TableWeight>& tables_;
       const Sampler::Options sampler_options_;
       const int sequence_length_;
       const bool emit_timesteps_;
+      const int batch_size_;
+      const bool drop_remainder_;
+      const bool pinned_memory_;
       const tensorflow::DataTypeVector& dtypes_;
       const std::vector<tensorflow::PartialTensorShape>& shapes_;
       std::unique_ptr<Sampler> sampler_;
+      std::vector<tensorflow::Tensor> batch_;
       int step_within_sample_;
     };  // Iterator.
 
     const std::string server_address_;
+    // Servers to sample from instead of `server_address_`. `client_` is
+    // connected to the first of them and only used to fetch the signature.
+    const std::vector<std::string> server_addresses_;
     const tensorflow::DataTypeVector dtypes_;
     const std::vector<tensorflow::PartialTensorShape> shapes_;
+    // The `table` input and the tables to sample from. `table_` is empty if
+    // the samples of several tables are mixed.
     const std::string table_;
+    const std::vector<TableWeight> tables_;
     const Sampler::Options sampler_options_;
     const int sequence_length_;
     const bool emit_timesteps_;
+    const int batch_size_;
+    const bool drop_remainder_;
+    // The `max_samples` attr. Already applied to `sampler_options_`.
+    const tensorflow::int64 max_samples_;
+    const bool pinned_memory_;
     std::unique_ptr<Client> client_;
   };  // Dataset.
 
   Sampler::Options sampler_options_;
   int sequence_length_;
   bool emit_timesteps_;
+  int batch_size_;
+  bool drop_remainder_;
+  tensorflow::int64 max_samples_;
+  std::vector<std::string> mixed_tables_;
+  std::vector<float> mixed_table_weights_;
+  std::vector<std::string> server_addresses_;
+  bool pinned_memory_;
   tensorflow::DataTypeVector dtypes_;
   std::vector<tensorflow::PartialTensorShape> shapes_;
 
@@ -276,6 +276,23 @@ def reverb_cc_test(name, srcs, deps = [], **kwargs):
         **kwargs
     )
 
+def reverb_cc_binary(name, srcs, deps = [], **kwargs):
+    """Reverb-specific version of cc_binary.
+
+    Args:
+      name: Target name.
+      srcs: Target sources.
+      deps: Target deps.
+      **kwargs: Additional args to cc_binary.
+    """
+    native.cc_binary(
+        name = name,
+        copts = tf_copts(),
+        srcs = srcs,
+        deps = depset(deps + reverb_tf_deps()),
+        **kwargs
+    )
+
 def reverb_gen_op_wrapper_py(name, out, kernel_lib, linkopts = [], **kwargs):
     """Generates the py_library `name` with a data dep on the ops in kernel_lib.
 
@@ -541,6 +558,7 @@ def reverb_absl_deps():
         "@com_google_absl//absl/base",
         "@com_google_absl//absl/base:core_headers",
         "@com_google_absl//absl/container:flat_hash_set",
+        "@com_google_absl//absl/container:inlined_vector",
         "@com_google_absl//absl/functional:bind_front",
         "@com_google_absl//absl/memory",
         "@com_google_absl//absl/numeric:int128",
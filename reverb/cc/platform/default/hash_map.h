@@ -15,6 +15,8 @@
 #ifndef REVERB_CC_PLATFORM_DEFAULT_HASH_MAP_H_
 #define REVERB_CC_PLATFORM_DEFAULT_HASH_MAP_H_
 
+#include <cstddef>
+
 #include "absl/container/flat_hash_map.h"
 #include "reverb/cc/platform/default/hash.h"
 
@@ -27,6 +29,14 @@ template <class K, class V, class Hash = typename HashEq<K>::Hash,
           class Allocator = typename absl::flat_hash_map<K, V>::allocator_type>
 using flat_hash_map = absl::flat_hash_map<K, V, Hash, Eq, Allocator>;
 
+// Approximate memory per element of a `flat_hash_map` which has been reserved
+// for its number of elements: a slot plus a control byte, of which at most 7/8
+// are used.
+template <class Map>
+constexpr size_t HashMapBytesPerElement() {
+  return (sizeof(typename Map::value_type) + 1) * 8 / 7;
+}
+
 }  // namespace internal
 }  // namespace reverb
 }  // namespace deepmind
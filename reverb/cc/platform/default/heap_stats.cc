@@ -0,0 +1,47 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/heap_stats.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+bool GetHeapStats(HeapStats* stats) {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 info = mallinfo2();
+#else
+  // The fields of `mallinfo` are ints and wrap around beyond 2GiB.
+  struct mallinfo info = mallinfo();
+#endif
+  // `arena` covers the memory of the main and the thread arenas obtained with
+  // sbrk/mmap, `hblkhd` the chunks allocated directly with mmap.
+  stats->allocated_bytes = static_cast<int64_t>(info.arena) +
+                           static_cast<int64_t>(info.hblkhd);
+  stats->in_use_bytes = static_cast<int64_t>(info.uordblks) +
+                        static_cast<int64_t>(info.hblkhd);
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,117 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/huge_pages.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr size_t k2MB = size_t{2} << 20;
+constexpr size_t k1GB = size_t{1} << 30;
+
+// Flags of `mmap(2)` which select the size of explicit huge pages. Defined
+// here as older headers lack them.
+constexpr int kMapHugeShift = 26;
+constexpr int kMapHuge2MB = 21 << kMapHugeShift;
+constexpr int kMapHuge1GB = 30 << kMapHugeShift;
+
+void* MapAnonymous(size_t size, int flags) {
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  return data == MAP_FAILED ? nullptr : data;
+}
+
+// Maps `size` bytes at a 2 MB boundary, so that the kernel can back all of it
+// with transparent huge pages, and asks for them. Returns null if nothing
+// could be mapped and sets `*advised` if the kernel accepted the advice.
+void* MapTransparent(size_t size, bool* advised) {
+  *advised = false;
+  auto* data = static_cast<char*>(MapAnonymous(size + k2MB, 0));
+  if (data == nullptr) return nullptr;
+
+  // Trim the mapping to the aligned range.
+  const uintptr_t address = reinterpret_cast<uintptr_t>(data);
+  char* aligned = data + ((k2MB - address % k2MB) % k2MB);
+  if (aligned != data) munmap(data, aligned - data);
+  char* end = aligned + size;
+  if (end != data + size + k2MB) munmap(end, data + size + k2MB - end);
+
+#ifdef MADV_HUGEPAGE
+  *advised = madvise(aligned, size, MADV_HUGEPAGE) == 0;
+#endif
+  return aligned;
+}
+
+}  // namespace
+
+size_t PageSize(PageKind kind) {
+  switch (kind) {
+    case PageKind::kRegular:
+      return sysconf(_SC_PAGESIZE);
+    case PageKind::kTransparentHuge:
+    case PageKind::kHuge2MB:
+      return k2MB;
+    case PageKind::kHuge1GB:
+      return k1GB;
+  }
+  return k2MB;
+}
+
+void* MapPages(size_t size, PageKind kind, PageKind* backing) {
+  REVERB_CHECK_EQ(size % PageSize(kind), size_t{0})
+      << "Mapping of " << size << " bytes isn't a multiple of the page size.";
+#ifdef MAP_HUGETLB
+  if (kind == PageKind::kHuge1GB) {
+    if (void* data = MapAnonymous(size, MAP_HUGETLB | kMapHuge1GB)) {
+      *backing = PageKind::kHuge1GB;
+      return data;
+    }
+    kind = PageKind::kHuge2MB;
+  }
+  if (kind == PageKind::kHuge2MB) {
+    if (void* data = MapAnonymous(size, MAP_HUGETLB | kMapHuge2MB)) {
+      *backing = PageKind::kHuge2MB;
+      return data;
+    }
+    kind = PageKind::kTransparentHuge;
+  }
+#endif
+  if (kind != PageKind::kRegular) {
+    bool advised;
+    void* data = MapTransparent(size, &advised);
+    *backing = advised ? PageKind::kTransparentHuge : PageKind::kRegular;
+    return data;
+  }
+  *backing = PageKind::kRegular;
+  return MapAnonymous(size, 0);
+}
+
+void UnmapPages(void* data, size_t size) {
+  REVERB_CHECK_EQ(munmap(data, size), 0) << "Failed to unmap " << size
+                                         << " bytes.";
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,43 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/lz4.h"
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "reverb/cc/platform/logging.h"
+#include "lz4.h"  // NOLINT(build/include)
+
+namespace deepmind {
+namespace reverb {
+
+void Lz4CompressFromString(absl::string_view input, std::string* output) {
+  output->resize(LZ4_compressBound(input.size()));
+  const int size = LZ4_compress_default(input.data(), &(*output)[0],
+                                        input.size(), output->size());
+  // Even empty input compresses to at least one byte.
+  REVERB_CHECK_GT(size, 0) << "lz4 compression failed.";
+  output->resize(size);
+}
+
+bool Lz4UncompressToBuffer(absl::string_view input, size_t output_size,
+                           char* output) {
+  const int size = LZ4_decompress_safe(input.data(), output, input.size(),
+                                       output_size);
+  return size >= 0 && static_cast<size_t>(size) == output_size;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
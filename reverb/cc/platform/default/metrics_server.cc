@@ -0,0 +1,316 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/metrics_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/metrics.h"
+#include "reverb/cc/platform/profiler.h"
+#include "reverb/cc/platform/thread.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// How often the serving thread checks whether it has been stopped.
+constexpr int kPollIntervalMs = 100;
+
+// Requests are small GETs so anything beyond this is rejected.
+constexpr size_t kMaxRequestBytes = 8192;
+
+// Time a client has to send its request, and to make room for each part of
+// the response once the send buffer of the connection is full.
+constexpr int kReceiveTimeoutSeconds = 5;
+constexpr int kSendTimeoutSeconds = 5;
+
+// Duration of a CPU profile if the request doesn't set `seconds`, and the
+// longest which can be requested.
+constexpr int kDefaultProfileSeconds = 30;
+constexpr int kMaxProfileSeconds = 600;
+
+// Writes all of `data` to `fd`. Returns false if the connection failed or the
+// send timed out.
+bool SendAll(int fd, absl::string_view data) {
+  while (!data.empty()) {
+    const ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data.remove_prefix(sent);
+  }
+  return true;
+}
+
+// Reads the request line and headers from `fd`. Returns false if the
+// connection failed or the request is too large.
+bool ReadRequest(int fd, std::string* request) {
+  char buffer[1024];
+  while (!absl::StrContains(*request, "\r\n\r\n")) {
+    const ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received < 0 && errno == EINTR) continue;
+    if (received <= 0) return false;
+    request->append(buffer, received);
+    if (request->size() > kMaxRequestBytes) return false;
+  }
+  return true;
+}
+
+std::string HttpResponse(absl::string_view status,
+                         absl::string_view content_type,
+                         absl::string_view body) {
+  return absl::StrCat("HTTP/1.1 ", status, "\r\nContent-Type: ", content_type,
+                      "\r\nContent-Length: ", body.size(),
+                      "\r\nConnection: close\r\n\r\n", body);
+}
+
+// Responds with `profile`, or with the error that prevented collecting it.
+std::string ProfileResponse(const tensorflow::Status& status,
+                            absl::string_view profile) {
+  if (status.ok()) {
+    return HttpResponse("200 OK", "application/octet-stream", profile);
+  }
+  absl::string_view http_status = "500 Internal Server Error";
+  if (tensorflow::errors::IsUnimplemented(status)) {
+    http_status = "501 Not Implemented";
+  } else if (tensorflow::errors::IsUnavailable(status) ||
+             tensorflow::errors::IsFailedPrecondition(status)) {
+    http_status = "503 Service Unavailable";
+  }
+  return HttpResponse(http_status, "text/plain", status.error_message());
+}
+
+// Returns the value of `key` in the query string `query`, e.g `a=1&b=2`, or
+// the empty string if it is not set.
+absl::string_view QueryValue(absl::string_view query, absl::string_view key) {
+  while (!query.empty()) {
+    absl::string_view param = query.substr(0, query.find('&'));
+    query.remove_prefix(std::min(query.size(), param.size() + 1));
+    if (absl::ConsumePrefix(&param, key) && absl::ConsumePrefix(&param, "=")) {
+      return param;
+    }
+  }
+  return "";
+}
+
+class MetricsServerImpl : public MetricsServer {
+ public:
+  MetricsServerImpl(int fd, int port, const MetricsRegistry* registry,
+                    bool enable_profiling)
+      : fd_(fd),
+        port_(port),
+        registry_(registry),
+        enable_profiling_(enable_profiling) {
+    thread_ = StartThread("MetricsServer", [this] { Serve(); });
+  }
+
+  ~MetricsServerImpl() override { Stop(); }
+
+  int port() const override { return port_; }
+
+  void Stop() override {
+    if (stopped_.exchange(true)) return;
+    stop_profiling_.Notify();
+    thread_ = nullptr;
+    profile_thread_ = nullptr;
+    if (close(fd_) < 0) {
+      REVERB_LOG(REVERB_ERROR) << "close() failed: " << strerror(errno);
+    }
+  }
+
+ private:
+  void Serve() {
+    while (!stopped_.load()) {
+      struct pollfd pfd = {fd_, POLLIN, 0};
+      const int ready = poll(&pfd, 1, kPollIntervalMs);
+      if (ready <= 0) continue;
+      const int client = accept(fd_, nullptr, nullptr);
+      if (client < 0) continue;
+      if (!HandleConnection(client)) close(client);
+    }
+  }
+
+  // Returns true if the connection has been handed over to another thread,
+  // which closes it.
+  bool HandleConnection(int client) {
+    // A client which stops reading would otherwise block the serving thread,
+    // or the profiling thread, in `SendAll` forever.
+    struct timeval receive_timeout = {kReceiveTimeoutSeconds, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout,
+               sizeof(receive_timeout));
+    struct timeval send_timeout = {kSendTimeoutSeconds, 0};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &send_timeout,
+               sizeof(send_timeout));
+
+    std::string request;
+    if (!ReadRequest(client, &request)) {
+      SendAll(client, HttpResponse("400 Bad Request", "text/plain", ""));
+      return false;
+    }
+    if (!absl::StartsWith(request, "GET ")) {
+      SendAll(client,
+              HttpResponse("405 Method Not Allowed", "text/plain", ""));
+      return false;
+    }
+    absl::string_view path = absl::string_view(request).substr(4);
+    path = path.substr(0, path.find(' '));
+    absl::string_view query;
+    if (auto pos = path.find('?'); pos != absl::string_view::npos) {
+      query = path.substr(pos + 1);
+      path = path.substr(0, pos);
+    }
+    if (path == "/metrics") {
+      SendAll(client, HttpResponse("200 OK", "text/plain; version=0.0.4",
+                                   registry_->ToText()));
+      return false;
+    }
+    if (enable_profiling_ && path == "/debug/pprof/heap") {
+      std::string profile;
+      auto status = CollectHeapProfile(&profile);
+      SendAll(client, ProfileResponse(status, profile));
+      return false;
+    }
+    if (enable_profiling_ && path == "/debug/pprof/profile") {
+      return HandleCpuProfile(client, QueryValue(query, "seconds"));
+    }
+    SendAll(client, HttpResponse("404 Not Found", "text/plain", ""));
+    return false;
+  }
+
+  bool HandleCpuProfile(int client, absl::string_view seconds_arg) {
+    int seconds = kDefaultProfileSeconds;
+    if (!seconds_arg.empty() &&
+        (!absl::SimpleAtoi(seconds_arg, &seconds) || seconds <= 0 ||
+         seconds > kMaxProfileSeconds)) {
+      SendAll(client,
+              HttpResponse("400 Bad Request", "text/plain",
+                           absl::StrCat("seconds must be in [1, ",
+                                        kMaxProfileSeconds, "]")));
+      return false;
+    }
+    if (profiling_.exchange(true)) {
+      SendAll(client,
+              HttpResponse("503 Service Unavailable", "text/plain",
+                           "A CPU profile is already being collected."));
+      return false;
+    }
+
+    // The previous profile has completed so this doesn't block.
+    profile_thread_ = nullptr;
+    profile_thread_ = StartThread("MetricsProfiler", [this, client, seconds] {
+      std::string profile;
+      auto status =
+          CollectCpuProfile(absl::Seconds(seconds), &stop_profiling_, &profile);
+      SendAll(client, ProfileResponse(status, profile));
+      close(client);
+      profiling_.store(false);
+    });
+    return true;
+  }
+
+  const int fd_;
+  const int port_;
+  const MetricsRegistry* registry_;
+  const bool enable_profiling_;
+  std::atomic<bool> stopped_{false};
+  std::unique_ptr<Thread> thread_;
+
+  // Collects the CPU profile requested last. `profiling_` is set until the
+  // profile has been sent and `stop_profiling_` cuts it short on `Stop`.
+  std::atomic<bool> profiling_{false};
+  absl::Notification stop_profiling_;
+  std::unique_ptr<Thread> profile_thread_;
+};
+
+}  // namespace
+
+tensorflow::Status StartMetricsServer(int port,
+                                      const MetricsRegistry* registry,
+                                      std::unique_ptr<MetricsServer>* server) {
+  return StartMetricsServer(kDefaultMetricsAddress, port, registry,
+                            /*enable_profiling=*/false, server);
+}
+
+tensorflow::Status StartMetricsServer(const std::string& address, int port,
+                                      const MetricsRegistry* registry,
+                                      bool enable_profiling,
+                                      std::unique_ptr<MetricsServer>* server) {
+  if (port < 0 || port > 65535) {
+    return tensorflow::errors::InvalidArgument("Invalid metrics port ", port);
+  }
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    return tensorflow::errors::InvalidArgument(
+        "Invalid metrics address '", address,
+        "', expected an IPv4 address such as ", kDefaultMetricsAddress);
+  }
+  const int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return tensorflow::errors::Internal("socket() failed: ", strerror(errno));
+  }
+
+  int one = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+      bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, /*backlog=*/16) < 0 ||
+      getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len) <
+          0) {
+    const std::string error = strerror(errno);
+    close(fd);
+    return tensorflow::errors::Unavailable(
+        "Failed to listen for metrics requests on ", address, ":", port, ": ",
+        error);
+  }
+
+  const int bound_port = ntohs(addr.sin_port);
+  *server = absl::make_unique<MetricsServerImpl>(fd, bound_port, registry,
+                                                 enable_profiling);
+  REVERB_LOG(REVERB_INFO) << "Serving metrics on " << address << ":"
+                          << bound_port;
+  return tensorflow::Status::OK();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
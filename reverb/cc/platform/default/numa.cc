@@ -0,0 +1,162 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/numa.h"
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Memory policies of `set_mempolicy(2)`. Defined here so that the build does
+// not depend on the numa headers.
+constexpr int kMpolDefault = 0;
+constexpr int kMpolPreferred = 1;
+
+// NUMA topology read from sysfs once per process.
+struct Topology {
+  // CPUs of each node.
+  std::vector<std::vector<int>> node_cpus;
+
+  // Node of each CPU. CPUs which are not listed by any node map to node 0.
+  std::vector<int> cpu_nodes;
+};
+
+// Parses a sysfs CPU list such as "0-3,8,10-11".
+std::vector<int> ParseCpuList(absl::string_view list) {
+  std::vector<int> cpus;
+  for (absl::string_view range :
+       absl::StrSplit(list, ',', absl::SkipWhitespace())) {
+    std::vector<absl::string_view> bounds = absl::StrSplit(range, '-');
+    int first, last;
+    if (!absl::SimpleAtoi(bounds[0], &first)) return {};
+    last = first;
+    if (bounds.size() == 2 && !absl::SimpleAtoi(bounds[1], &last)) return {};
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+Topology ReadTopology() {
+  Topology topology;
+  for (int node = 0;; node++) {
+    std::ifstream file(
+        absl::StrCat("/sys/devices/system/node/node", node, "/cpulist"));
+    std::string list;
+    if (!file || !std::getline(file, list)) break;
+    topology.node_cpus.push_back(ParseCpuList(list));
+  }
+  if (topology.node_cpus.empty()) {
+    topology.node_cpus.emplace_back();
+    return topology;
+  }
+  for (int node = 0; node < static_cast<int>(topology.node_cpus.size());
+       node++) {
+    for (int cpu : topology.node_cpus[node]) {
+      if (cpu >= static_cast<int>(topology.cpu_nodes.size())) {
+        topology.cpu_nodes.resize(cpu + 1, 0);
+      }
+      topology.cpu_nodes[cpu] = node;
+    }
+  }
+  return topology;
+}
+
+const Topology& GetTopology() {
+  static const auto* topology = new Topology(ReadTopology());
+  return *topology;
+}
+
+class LinuxNumaBinding : public ScopedNumaBinding {
+ public:
+  explicit LinuxNumaBinding(int node) {
+    const Topology& topology = GetTopology();
+    REVERB_CHECK(node >= 0 && node < NumNumaNodes())
+        << "Invalid NUMA node " << node;
+    // Nothing to gain (and a CPU list may be missing) on single node hosts.
+    if (topology.node_cpus.size() == 1) return;
+
+    if (sched_getaffinity(0, sizeof(previous_), &previous_) != 0) return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : topology.node_cpus[node]) {
+      if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpus);
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+      REVERB_LOG(REVERB_WARNING)
+          << "Failed to bind thread to the CPUs of NUMA node " << node;
+      return;
+    }
+    bound_ = true;
+
+    // Memory is only preferred, rather than bound, to the node so that
+    // allocations fall back to other nodes rather than failing.
+    using NodeMask = unsigned long;  // NOLINT(runtime/int)
+    constexpr int kMaxNodes = 8 * sizeof(NodeMask);
+    if (node < kMaxNodes) {
+      NodeMask nodemask = NodeMask{1} << node;
+      mempolicy_set_ = syscall(SYS_set_mempolicy, kMpolPreferred, &nodemask,
+                               kMaxNodes) == 0;
+    }
+  }
+
+  ~LinuxNumaBinding() override {
+    if (mempolicy_set_) syscall(SYS_set_mempolicy, kMpolDefault, nullptr, 0);
+    if (bound_) sched_setaffinity(0, sizeof(previous_), &previous_);
+  }
+
+  bool bound() const override { return bound_; }
+
+ private:
+  cpu_set_t previous_;
+  bool bound_ = false;
+  bool mempolicy_set_ = false;
+};
+
+}  // namespace
+
+int NumNumaNodes() { return GetTopology().node_cpus.size(); }
+
+int CurrentNumaNode() {
+  const Topology& topology = GetTopology();
+  if (topology.node_cpus.size() == 1) return 0;
+  const int cpu = sched_getcpu();
+  if (cpu < 0 || cpu >= static_cast<int>(topology.cpu_nodes.size())) return 0;
+  return topology.cpu_nodes[cpu];
+}
+
+std::unique_ptr<ScopedNumaBinding> BindToNumaNode(int node) {
+  return absl::make_unique<LinuxNumaBinding>(node);
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,131 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/profiler.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+// The gperftools profilers are resolved at runtime so that the binary neither
+// depends on them nor pays for them unless they are linked in or preloaded.
+extern "C" {
+int ProfilerStart(const char* fname) __attribute__((weak));
+void ProfilerStop() __attribute__((weak));
+int IsHeapProfilerRunning() __attribute__((weak));
+char* GetHeapProfile() __attribute__((weak));
+}
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Set while a CPU profile is being collected.
+std::atomic<bool> cpu_profiling{false};
+
+std::string TempDir() {
+  const char* dir = std::getenv("TMPDIR");
+  return dir != nullptr && *dir != '\0' ? dir : "/tmp";
+}
+
+}  // namespace
+
+bool CpuProfilerAvailable() {
+  return ProfilerStart != nullptr && ProfilerStop != nullptr;
+}
+
+tensorflow::Status CollectCpuProfile(absl::Duration duration,
+                                     const absl::Notification* stop,
+                                     std::string* profile) {
+  if (!CpuProfilerAvailable()) {
+    return tensorflow::errors::Unimplemented(
+        "CPU profiling requires the gperftools profiler (libprofiler) to be "
+        "linked in or preloaded.");
+  }
+  if (cpu_profiling.exchange(true)) {
+    return tensorflow::errors::Unavailable(
+        "A CPU profile is already being collected.");
+  }
+  struct Done {
+    ~Done() { cpu_profiling.store(false); }
+  } done;
+
+  // The profiler writes the profile to a file when it is stopped.
+  std::string path = absl::StrCat(TempDir(), "/reverb_cpu_profile_XXXXXX");
+  const int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    return tensorflow::errors::Internal(
+        "Failed to create the file of the CPU profile: ", strerror(errno));
+  }
+  close(fd);
+  if (!ProfilerStart(path.c_str())) {
+    unlink(path.c_str());
+    return tensorflow::errors::Unavailable(
+        "Failed to start the CPU profiler, is it already running?");
+  }
+  if (stop != nullptr) {
+    stop->WaitForNotificationWithTimeout(duration);
+  } else {
+    absl::SleepFor(duration);
+  }
+  ProfilerStop();
+
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  unlink(path.c_str());
+  if (!file) {
+    return tensorflow::errors::Internal("Failed to read the CPU profile.");
+  }
+  *profile = contents.str();
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status CollectHeapProfile(std::string* profile) {
+  if (IsHeapProfilerRunning == nullptr || GetHeapProfile == nullptr) {
+    return tensorflow::errors::Unimplemented(
+        "Heap profiling requires the gperftools heap profiler (tcmalloc) to be "
+        "linked in or preloaded.");
+  }
+  if (!IsHeapProfilerRunning()) {
+    return tensorflow::errors::FailedPrecondition(
+        "The heap profiler is not running. Start the process with HEAPPROFILE "
+        "set to enable it.");
+  }
+  char* snapshot = GetHeapProfile();
+  if (snapshot == nullptr) {
+    return tensorflow::errors::Internal("Failed to collect the heap profile.");
+  }
+  profile->assign(snapshot);
+  free(snapshot);
+  return tensorflow::Status::OK();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
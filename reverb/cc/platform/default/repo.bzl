@@ -320,6 +320,31 @@ def reverb_python_deps():
         ],
     )
 
+def reverb_codec_deps():
+    """Compression libraries used for the tensors of chunks.
+
+    Snappy is provided by the TensorFlow installation.
+    """
+    http_archive(
+        name = "zstd",
+        urls = [
+            "https://github.com/facebook/zstd/releases/download/v1.4.5/zstd-1.4.5.tar.gz",
+        ],
+        sha256 = "98e91c7c6bf162bf90e4e70fdbc41a8188b9fa8de5ad840c401198014406ce9e",
+        strip_prefix = "zstd-1.4.5",
+        build_file = clean_dep("//third_party:zstd.BUILD"),
+    )
+
+    http_archive(
+        name = "lz4",
+        urls = [
+            "https://github.com/lz4/lz4/archive/v1.9.2.tar.gz",
+        ],
+        sha256 = "658ba6191fa44c92280d4aa2c271b0f4fbc0e34d249578dd05e50e76d0e5efcc",
+        strip_prefix = "lz4-1.9.2",
+        build_file = clean_dep("//third_party:lz4.BUILD"),
+    )
+
 def _reverb_protoc_archive(ctx):
     version = ctx.attr.version
     sha256 = ctx.attr.sha256
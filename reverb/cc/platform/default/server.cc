@@ -18,11 +18,15 @@
 #include <memory>
 
 #include "grpcpp/server_builder.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/client.h"
 #include "reverb/cc/platform/grpc_utils.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/metrics_server.h"
+#include "reverb/cc/replica.h"
+#include "reverb/cc/reverb_service_async_impl.h"
 #include "reverb/cc/reverb_service_impl.h"
 
 namespace deepmind {
@@ -31,25 +35,70 @@ namespace {
 
 class ServerImpl : public Server {
  public:
-  ServerImpl(int port) : port_(port) {}
+  ServerImpl(int port, const ServerOptions& options)
+      : port_(port), options_(options) {}
 
   tensorflow::Status Initialize(std::vector<std::shared_ptr<Table>> tables,
                                 std::shared_ptr<Checkpointer> checkpointer) {
     absl::WriterMutexLock lock(&mu_);
     REVERB_CHECK(!running_) << "Initialize() called twice?";
+    ReverbServiceImpl::Options service_options;
+    service_options.warm_start = options_.warm_start;
+    service_options.default_min_restored_fraction_to_sample =
+        options_.default_min_restored_fraction_to_sample;
+    service_options.min_restored_fraction_to_sample =
+        options_.min_restored_fraction_to_sample;
+    service_options.checkpoint_interval = options_.checkpoint_interval;
+    service_options.checkpoint_max_bytes_per_second =
+        options_.checkpoint_max_bytes_per_second;
+    service_options.table_numa_nodes = options_.table_numa_nodes;
+    service_options.table_item_rules = options_.table_item_rules;
+    service_options.enable_replication = options_.enable_replication;
+    service_options.primary_address = options_.primary_address;
+    service_options.replica.address = options_.replica_address;
+    if (options_.coordinate_replica_rate_limiting) {
+      service_options.replica.rate_limiting =
+          Replica::RateLimiting::kCoordinated;
+    }
+    service_options.memory_soft_limit_bytes = options_.memory_soft_limit_bytes;
+    service_options.memory_hard_limit_bytes = options_.memory_hard_limit_bytes;
+    service_options.workload_trace_path = options_.workload_trace_path;
+    service_options.stream_classes = options_.stream_classes;
+    service_options.default_stream_class = options_.default_stream_class;
+    service_options.max_concurrent_stream_operations =
+        options_.max_concurrent_stream_operations;
+    service_options.chunk_store.tiering = options_.tiering;
+    service_options.chunk_store.deduplicate = options_.deduplicate_chunks;
     TF_RETURN_IF_ERROR(ReverbServiceImpl::Create(
-        std::move(tables), std::move(checkpointer), &reverb_service_));
-    server_ = grpc::ServerBuilder()
-                  .AddListeningPort(absl::StrCat("[::]:", port_),
-                                    MakeServerCredentials())
-                  .RegisterService(reverb_service_.get())
-                  .SetMaxSendMessageSize(kMaxMessageSize)
-                  .SetMaxReceiveMessageSize(kMaxMessageSize)
-                  .BuildAndStart();
+        std::move(tables), std::move(checkpointer), service_options,
+        &reverb_service_));
+    if (options_.metrics_port > 0) {
+      TF_RETURN_IF_ERROR(internal::StartMetricsServer(
+          options_.metrics_address, options_.metrics_port,
+          &reverb_service_->metrics(), options_.enable_profiling,
+          &metrics_server_));
+    } else if (options_.enable_profiling) {
+      return tensorflow::errors::InvalidArgument(
+          "enable_profiling requires metrics_port to be set.");
+    }
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(absl::StrCat("[::]:", port_),
+                             MakeServerCredentials())
+        .SetMaxSendMessageSize(kMaxMessageSize)
+        .SetMaxReceiveMessageSize(kMaxMessageSize);
+    if (options_.num_async_threads > 0) {
+      async_service_ = absl::make_unique<ReverbServiceAsyncImpl>(
+          reverb_service_.get(), options_.num_async_threads);
+      async_service_->RegisterWith(&builder);
+    } else {
+      builder.RegisterService(reverb_service_.get());
+    }
+    server_ = builder.BuildAndStart();
     if (!server_) {
       return tensorflow::errors::InvalidArgument(
           "Failed to BuildAndStart gRPC server");
     }
+    if (async_service_ != nullptr) async_service_->Start();
     running_ = true;
     REVERB_LOG(REVERB_INFO) << "Started replay server on port " << port_;
     return tensorflow::Status::OK();
@@ -67,6 +116,8 @@ class ServerImpl : public Server {
     // Set a deadline as the sampler streams never closes by themselves.
     server_->Shutdown(std::chrono::system_clock::now() +
                       std::chrono::seconds(5));
+    if (async_service_ != nullptr) async_service_->Stop();
+    if (metrics_server_ != nullptr) metrics_server_->Stop();
 
     running_ = false;
   }
@@ -87,7 +138,14 @@ class ServerImpl : public Server {
 
  private:
   int port_;
+  const ServerOptions options_;
   std::unique_ptr<ReverbServiceImpl> reverb_service_;
+
+  // Serves the metrics of `reverb_service_` if `metrics_port` > 0.
+  std::unique_ptr<internal::MetricsServer> metrics_server_;
+
+  // Drives the calls of `reverb_service_` if `num_async_threads` > 0.
+  std::unique_ptr<ReverbServiceAsyncImpl> async_service_;
   std::unique_ptr<grpc::Server> server_ = nullptr;
 
   absl::Mutex mu_;
@@ -100,7 +158,16 @@ tensorflow::Status StartServer(std::vector<std::shared_ptr<Table>> tables,
                                int port,
                                std::shared_ptr<Checkpointer> checkpointer,
                                std::unique_ptr<Server> *server) {
-  auto s = absl::make_unique<ServerImpl>(port);
+  return StartServer(std::move(tables), port, std::move(checkpointer),
+                     ServerOptions(), server);
+}
+
+tensorflow::Status StartServer(std::vector<std::shared_ptr<Table>> tables,
+                               int port,
+                               std::shared_ptr<Checkpointer> checkpointer,
+                               const ServerOptions &options,
+                               std::unique_ptr<Server> *server) {
+  auto s = absl::make_unique<ServerImpl>(port, options);
   TF_RETURN_IF_ERROR(s->Initialize(std::move(tables), std::move(checkpointer)));
   *server = std::move(s);
   return tensorflow::Status::OK();
@@ -167,5 +167,13 @@ bool SnappyUncompressToString(const std::string& input, size_t output_capacity,
   return snappy::Uncompress(&source, &sink);
 }
 
+template <>
+bool SnappyUncompressToString(const absl::string_view& input,
+                              size_t output_capacity, char* output) {
+  snappy::ByteArraySource source(input.data(), input.size());
+  CheckedByteArraySink sink(output, output_capacity);
+  return snappy::Uncompress(&source, &sink);
+}
+
 }  // namespace reverb
 }  // namespace deepmind
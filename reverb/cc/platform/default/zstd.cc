@@ -0,0 +1,46 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/zstd.h"
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "reverb/cc/platform/logging.h"
+#include "zstd.h"  // NOLINT(build/include)
+
+namespace deepmind {
+namespace reverb {
+
+void ZstdCompressFromString(absl::string_view input, int level,
+                            std::string* output) {
+  output->resize(ZSTD_compressBound(input.size()));
+  const size_t size = ZSTD_compress(&(*output)[0], output->size(),
+                                    input.data(), input.size(), level);
+  // The output buffer is large enough for any input so compression only fails
+  // on invalid arguments (e.g the level), which is a programming error.
+  REVERB_CHECK(!ZSTD_isError(size))
+      << "zstd compression failed: " << ZSTD_getErrorName(size);
+  output->resize(size);
+}
+
+bool ZstdUncompressToBuffer(absl::string_view input, size_t output_size,
+                            char* output) {
+  const size_t size =
+      ZSTD_decompress(output, output_size, input.data(), input.size());
+  return !ZSTD_isError(size) && size == output_size;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
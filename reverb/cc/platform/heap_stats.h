@@ -0,0 +1,40 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_HEAP_STATS_H_
+#define REVERB_CC_PLATFORM_HEAP_STATS_H_
+
+#include <cstdint>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+struct HeapStats {
+  // Bytes the allocator has obtained from the operating system.
+  int64_t allocated_bytes = 0;
+
+  // Bytes of `allocated_bytes` which are currently handed out.
+  int64_t in_use_bytes = 0;
+};
+
+// Populates `stats` with the process wide heap usage. Returns false if the
+// memory allocator does not expose these stats.
+bool GetHeapStats(HeapStats* stats);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_HEAP_STATS_H_
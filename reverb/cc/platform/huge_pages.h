@@ -0,0 +1,54 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_HUGE_PAGES_H_
+#define REVERB_CC_PLATFORM_HUGE_PAGES_H_
+
+#include <cstddef>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Pages which can back an anonymous mapping, from the smallest to the largest.
+enum class PageKind {
+  // Pages of the base size of the platform (usually 4 KB).
+  kRegular,
+  // Regular pages which the kernel may collapse into 2 MB pages (Transparent
+  // Huge Pages on Linux).
+  kTransparentHuge,
+  // Explicit 2 MB (respectively 1 GB) pages from the huge page pool of the
+  // host (hugetlbfs on Linux), which has to be reserved by the administrator.
+  kHuge2MB,
+  kHuge1GB,
+};
+
+// Size of the pages of `kind`. Transparent huge pages count as 2 MB pages.
+size_t PageSize(PageKind kind);
+
+// Maps `size` bytes of zeroed, readable and writable memory backed by pages of
+// `kind` if possible. If those are unavailable then the next smaller kind is
+// tried, down to regular pages, and the kind which backs the memory is stored
+// in `*backing`. `size` must be a multiple of `PageSize(kind)`. Returns null
+// if no memory could be mapped at all.
+void* MapPages(size_t size, PageKind kind, PageKind* backing);
+
+// Unmaps memory returned by `MapPages(size, ...)`.
+void UnmapPages(void* data, size_t size);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_HUGE_PAGES_H_
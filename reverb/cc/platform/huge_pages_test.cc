@@ -0,0 +1,65 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/huge_pages.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(HugePagesTest, PageSizes) {
+  EXPECT_GT(PageSize(PageKind::kRegular), 0);
+  EXPECT_EQ(PageSize(PageKind::kTransparentHuge), size_t{2} << 20);
+  EXPECT_EQ(PageSize(PageKind::kHuge2MB), size_t{2} << 20);
+  EXPECT_EQ(PageSize(PageKind::kHuge1GB), size_t{1} << 30);
+}
+
+TEST(HugePagesTest, MapsZeroedMemoryOfEveryKind) {
+  // Hosts without a huge page pool fall back to smaller pages, so only the
+  // order of the fallbacks is checked.
+  for (PageKind kind : {PageKind::kRegular, PageKind::kTransparentHuge,
+                        PageKind::kHuge2MB}) {
+    const size_t size = 2 * PageSize(kind);
+    PageKind backing;
+    auto* data = static_cast<uint8_t*>(MapPages(size, kind, &backing));
+    ASSERT_NE(data, nullptr);
+    EXPECT_LE(static_cast<int>(backing), static_cast<int>(kind));
+    EXPECT_EQ(data[0], 0);
+    EXPECT_EQ(data[size - 1], 0);
+    std::memset(data, 1, size);
+    EXPECT_EQ(data[size - 1], 1);
+    if (backing != PageKind::kRegular) {
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(data) % (size_t{2} << 20), 0);
+    }
+    UnmapPages(data, size);
+  }
+}
+
+TEST(HugePagesTest, SizeMustBeMultipleOfPageSize) {
+  PageKind backing;
+  EXPECT_DEATH(MapPages(4096, PageKind::kHuge2MB, &backing), "page size");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,276 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/metrics.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+std::string EscapeLabelValue(absl::string_view value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      default:
+        escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string EscapeHelp(absl::string_view help) {
+  std::string escaped;
+  escaped.reserve(help.size());
+  for (char c : help) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+// Formats `labels` as `{a="1",b="2"}`, or the empty string if there are none.
+std::string FormatLabels(const MetricLabels& labels) {
+  if (labels.empty()) return "";
+  return absl::StrCat(
+      "{",
+      absl::StrJoin(labels, ",",
+                    [](std::string* out,
+                       const std::pair<std::string, std::string>& label) {
+                      absl::StrAppend(out, label.first, "=\"",
+                                      EscapeLabelValue(label.second), "\"");
+                    }),
+      "}");
+}
+
+// Integral values are printed in full rather than in scientific notation.
+std::string FormatValue(double value) {
+  if (std::isnan(value)) return "NaN";
+  if (std::isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+  if (std::abs(value) < 9007199254740992.0 && value == std::floor(value)) {
+    return absl::StrCat(static_cast<int64_t>(value));
+  }
+  return absl::StrFormat("%.15g", value);
+}
+
+double ToSeconds(const google::protobuf::Duration& proto) {
+  return proto.seconds() + proto.nanos() * 1e-9;
+}
+
+std::string MetricKey(absl::string_view name, const MetricLabels& labels) {
+  return absl::StrCat(name, FormatLabels(labels));
+}
+
+}  // namespace
+
+void Histogram::Record(absl::Duration duration) {
+  absl::MutexLock lock(&mu_);
+  histogram_.Record(duration);
+}
+
+DurationHistogram Histogram::ToProto() const {
+  absl::MutexLock lock(&mu_);
+  return histogram_.ToProto();
+}
+
+MetricsWriter::Family* MetricsWriter::GetFamily(absl::string_view name,
+                                                absl::string_view type,
+                                                absl::string_view help) {
+  auto it = family_index_.find(std::string(name));
+  if (it != family_index_.end()) {
+    return &families_[it->second].second;
+  }
+  family_index_[std::string(name)] = families_.size();
+  families_.emplace_back(std::string(name), Family());
+  Family* family = &families_.back().second;
+  family->type = std::string(type);
+  family->help = std::string(help);
+  return family;
+}
+
+void MetricsWriter::AddCounter(absl::string_view name, absl::string_view help,
+                               const MetricLabels& labels, double value) {
+  GetFamily(name, "counter", help)
+      ->samples.push_back(
+          absl::StrCat(name, FormatLabels(labels), " ", FormatValue(value)));
+}
+
+void MetricsWriter::AddGauge(absl::string_view name, absl::string_view help,
+                             const MetricLabels& labels, double value) {
+  GetFamily(name, "gauge", help)
+      ->samples.push_back(
+          absl::StrCat(name, FormatLabels(labels), " ", FormatValue(value)));
+}
+
+void MetricsWriter::AddHistogram(absl::string_view name,
+                                 absl::string_view help,
+                                 const MetricLabels& labels,
+                                 const DurationHistogram& histogram) {
+  Family* family = GetFamily(name, "histogram", help);
+
+  // Bucket `i` of a `LatencyHistogram` holds durations shorter than 2^i
+  // microseconds. The counts of the exported buckets are cumulative.
+  MetricLabels bucket_labels = labels;
+  bucket_labels.emplace_back("le", "");
+  int64_t cumulative = 0;
+  for (int i = 0; i < histogram.bucket_counts_size(); i++) {
+    cumulative += histogram.bucket_counts(i);
+    bucket_labels.back().second = absl::StrFormat("%g", std::ldexp(1e-6, i));
+    family->samples.push_back(absl::StrCat(
+        name, "_bucket", FormatLabels(bucket_labels), " ", cumulative));
+  }
+  bucket_labels.back().second = "+Inf";
+  family->samples.push_back(absl::StrCat(
+      name, "_bucket", FormatLabels(bucket_labels), " ", histogram.count()));
+  family->samples.push_back(
+      absl::StrCat(name, "_sum", FormatLabels(labels), " ",
+                   FormatValue(ToSeconds(histogram.total()))));
+  family->samples.push_back(absl::StrCat(name, "_count", FormatLabels(labels),
+                                         " ", histogram.count()));
+}
+
+std::string MetricsWriter::ToText() const {
+  std::string text;
+  for (const auto& entry : families_) {
+    const Family& family = entry.second;
+    if (!family.help.empty()) {
+      absl::StrAppend(&text, "# HELP ", entry.first, " ",
+                      EscapeHelp(family.help), "\n");
+    }
+    absl::StrAppend(&text, "# TYPE ", entry.first, " ", family.type, "\n");
+    for (const auto& sample : family.samples) {
+      absl::StrAppend(&text, sample, "\n");
+    }
+  }
+  return text;
+}
+
+MetricsRegistry::Metric* MetricsRegistry::GetMetric(
+    Type type, absl::string_view name, absl::string_view help,
+    const MetricLabels& labels) {
+  const std::string key = MetricKey(name, labels);
+  auto it = metrics_by_key_.find(key);
+  if (it != metrics_by_key_.end()) {
+    REVERB_CHECK(it->second->type == type)
+        << "Metric " << key << " was registered with another type.";
+    return it->second;
+  }
+  auto metric = absl::make_unique<Metric>();
+  metric->type = type;
+  metric->name = std::string(name);
+  metric->help = std::string(help);
+  metric->labels = labels;
+  switch (type) {
+    case Type::kCounter:
+      metric->counter = absl::make_unique<Counter>();
+      break;
+    case Type::kGauge:
+      metric->gauge = absl::make_unique<Gauge>();
+      break;
+    case Type::kHistogram:
+      metric->histogram = absl::make_unique<Histogram>();
+      break;
+  }
+  Metric* result = metric.get();
+  metrics_.push_back(std::move(metric));
+  metrics_by_key_[key] = result;
+  return result;
+}
+
+Counter* MetricsRegistry::GetCounter(absl::string_view name,
+                                     absl::string_view help,
+                                     const MetricLabels& labels) {
+  absl::MutexLock lock(&mu_);
+  return GetMetric(Type::kCounter, name, help, labels)->counter.get();
+}
+
+Gauge* MetricsRegistry::GetGauge(absl::string_view name,
+                                 absl::string_view help,
+                                 const MetricLabels& labels) {
+  absl::MutexLock lock(&mu_);
+  return GetMetric(Type::kGauge, name, help, labels)->gauge.get();
+}
+
+Histogram* MetricsRegistry::GetHistogram(absl::string_view name,
+                                         absl::string_view help,
+                                         const MetricLabels& labels) {
+  absl::MutexLock lock(&mu_);
+  return GetMetric(Type::kHistogram, name, help, labels)->histogram.get();
+}
+
+void MetricsRegistry::AddCollector(
+    std::function<void(MetricsWriter*)> collector) {
+  absl::MutexLock lock(&mu_);
+  collectors_.push_back(std::move(collector));
+}
+
+std::string MetricsRegistry::ToText() const {
+  MetricsWriter writer;
+  absl::MutexLock lock(&mu_);
+  for (const auto& metric : metrics_) {
+    switch (metric->type) {
+      case Type::kCounter:
+        writer.AddCounter(metric->name, metric->help, metric->labels,
+                          metric->counter->value());
+        break;
+      case Type::kGauge:
+        writer.AddGauge(metric->name, metric->help, metric->labels,
+                        metric->gauge->value());
+        break;
+      case Type::kHistogram:
+        writer.AddHistogram(metric->name, metric->help, metric->labels,
+                            metric->histogram->ToProto());
+        break;
+    }
+  }
+  for (const auto& collector : collectors_) {
+    collector(&writer);
+  }
+  return writer.ToText();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,180 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_METRICS_H_
+#define REVERB_CC_PLATFORM_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/latency_histogram.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Label names and values of a metric, e.g {{"table", "my_table"}}.
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Monotonically increasing value. Thread-safe.
+class Counter {
+ public:
+  void Increment(int64_t delta = 1) {
+    value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// Value which can go up and down. Thread-safe.
+class Gauge {
+ public:
+  void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+
+  void Add(int64_t delta) {
+    value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// Distribution of durations, bucketed like `LatencyHistogram`. Thread-safe.
+class Histogram {
+ public:
+  void Record(absl::Duration duration) ABSL_LOCKS_EXCLUDED(mu_);
+
+  DurationHistogram ToProto() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  mutable absl::Mutex mu_;
+  LatencyHistogram histogram_ ABSL_GUARDED_BY(mu_);
+};
+
+// Builds the Prometheus text exposition format (version 0.0.4) of a set of
+// metrics. Samples of the same metric are grouped under a single HELP and
+// TYPE header regardless of the order in which they are added. The first
+// `help` added for a metric is used.
+//
+// This object is NOT thread-safe.
+class MetricsWriter {
+ public:
+  void AddCounter(absl::string_view name, absl::string_view help,
+                  const MetricLabels& labels, double value);
+
+  void AddGauge(absl::string_view name, absl::string_view help,
+                const MetricLabels& labels, double value);
+
+  // Exports `histogram` in seconds, with the upper bounds of the buckets of
+  // `LatencyHistogram` as the `le` labels.
+  void AddHistogram(absl::string_view name, absl::string_view help,
+                    const MetricLabels& labels,
+                    const DurationHistogram& histogram);
+
+  std::string ToText() const;
+
+ private:
+  struct Family {
+    std::string type;
+    std::string help;
+    std::vector<std::string> samples;
+  };
+
+  Family* GetFamily(absl::string_view name, absl::string_view type,
+                    absl::string_view help);
+
+  // Families in the order in which they were first added.
+  std::vector<std::pair<std::string, Family>> families_;
+  flat_hash_map<std::string, size_t> family_index_;
+};
+
+// Owns the counters, gauges and histograms of a server and exports them,
+// together with the values of registered collectors, in the Prometheus text
+// format. The metrics are created on first use and live as long as the
+// registry, so callers look them up once and keep the returned pointers. The
+// metrics themselves are updated without going through the registry. All
+// methods are thread-safe.
+class MetricsRegistry {
+ public:
+  MetricsRegistry() = default;
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  // Returns the metric with `name` and `labels`, creating it if it doesn't
+  // exist yet. CHECK-fails if a metric of a different type has the same name
+  // and labels.
+  Counter* GetCounter(absl::string_view name, absl::string_view help,
+                      const MetricLabels& labels = {})
+      ABSL_LOCKS_EXCLUDED(mu_);
+  Gauge* GetGauge(absl::string_view name, absl::string_view help,
+                  const MetricLabels& labels = {}) ABSL_LOCKS_EXCLUDED(mu_);
+  Histogram* GetHistogram(absl::string_view name, absl::string_view help,
+                          const MetricLabels& labels = {})
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Registers `collector` to be called every time the metrics are exported.
+  // Used for values which are already tracked elsewhere (e.g the size of a
+  // table) so that they don't have to be mirrored on every update. The
+  // collector must not call the methods of the registry.
+  void AddCollector(std::function<void(MetricsWriter*)> collector)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // All metrics and collected values in the Prometheus text format.
+  std::string ToText() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  enum class Type { kCounter, kGauge, kHistogram };
+
+  struct Metric {
+    Type type;
+    std::string name;
+    std::string help;
+    MetricLabels labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  Metric* GetMetric(Type type, absl::string_view name, absl::string_view help,
+                    const MetricLabels& labels)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  mutable absl::Mutex mu_;
+  std::vector<std::unique_ptr<Metric>> metrics_ ABSL_GUARDED_BY(mu_);
+  flat_hash_map<std::string, Metric*> metrics_by_key_ ABSL_GUARDED_BY(mu_);
+  std::vector<std::function<void(MetricsWriter*)>> collectors_
+      ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_METRICS_H_
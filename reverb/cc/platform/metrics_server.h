@@ -0,0 +1,75 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_METRICS_SERVER_H_
+#define REVERB_CC_PLATFORM_METRICS_SERVER_H_
+
+#include <memory>
+#include <string>
+
+#include "reverb/cc/platform/metrics.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Minimal HTTP server which answers `GET /metrics` with the metrics of a
+// `MetricsRegistry` in the Prometheus text format. Requests are served one at
+// a time, which is sufficient for scrapers.
+//
+// If profiling is enabled the server also answers, in the pprof format:
+//
+//   * `GET /debug/pprof/profile?seconds=N`: CPU profile of the next N seconds
+//     (default 30). Collected on a thread of its own so the metrics keep being
+//     served in the meantime.
+//   * `GET /debug/pprof/heap`: snapshot of the live heap allocations.
+//
+// so `pprof http://<host>:<port>/debug/pprof/profile` works against a running
+// server. See ./profiler.h for what the profiles require of the binary.
+class MetricsServer {
+ public:
+  virtual ~MetricsServer() = default;
+
+  // Port that the server listens on.
+  virtual int port() const = 0;
+
+  // Stops serving and blocks until the serving thread has been joined.
+  virtual void Stop() = 0;
+};
+
+// Address which the server listens on unless told otherwise. The endpoints are
+// unauthenticated, and the profiles reveal the memory and code of the process,
+// so by default they are only reachable from the same host.
+constexpr char kDefaultMetricsAddress[] = "127.0.0.1";
+
+// Starts a `MetricsServer` for `registry` on `port` of `address`, or on an
+// unused port if `port` is 0. `address` is an IPv4 address, e.g "0.0.0.0" to
+// listen on all interfaces. The `/debug/pprof` endpoints are also served if
+// `enable_profiling`. `registry` must outlive the server.
+tensorflow::Status StartMetricsServer(const std::string& address, int port,
+                                      const MetricsRegistry* registry,
+                                      bool enable_profiling,
+                                      std::unique_ptr<MetricsServer>* server);
+// Same as above on `kDefaultMetricsAddress` and without the `/debug/pprof`
+// endpoints.
+tensorflow::Status StartMetricsServer(int port,
+                                      const MetricsRegistry* registry,
+                                      std::unique_ptr<MetricsServer>* server);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_METRICS_SERVER_H_
@@ -0,0 +1,239 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/metrics_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/metrics.h"
+#include "reverb/cc/platform/profiler.h"
+#include "reverb/cc/platform/thread.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/protobuf/error_codes.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+using ::testing::StartsWith;
+
+// Sends `request` to localhost:`port` and returns the full response.
+std::string Fetch(int port, absl::string_view request) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  EXPECT_GE(fd, 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  EXPECT_EQ(
+      connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), 0);
+  EXPECT_EQ(send(fd, request.data(), request.size(), 0), request.size());
+
+  std::string response;
+  char buffer[1024];
+  ssize_t received;
+  while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, received);
+  }
+  close(fd);
+  return response;
+}
+
+TEST(MetricsServerTest, ServesMetrics) {
+  MetricsRegistry registry;
+  registry.GetCounter("requests_total", "Requests.")->Increment(7);
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(0, &registry, &server));
+  EXPECT_GT(server->port(), 0);
+
+  const std::string response =
+      Fetch(server->port(), "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+  EXPECT_THAT(response, StartsWith("HTTP/1.1 200 OK\r\n"));
+  EXPECT_THAT(response, HasSubstr("text/plain; version=0.0.4"));
+  EXPECT_THAT(response, HasSubstr("\r\n\r\n# HELP requests_total"));
+  EXPECT_THAT(response, HasSubstr("requests_total 7\n"));
+}
+
+TEST(MetricsServerTest, ServesOnGivenAddress) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer("0.0.0.0", 0, &registry,
+                                  /*enable_profiling=*/false, &server));
+
+  EXPECT_THAT(Fetch(server->port(), "GET /metrics HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 200 OK\r\n"));
+}
+
+TEST(MetricsServerTest, RejectsInvalidAddress) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  for (const char* address : {"", "localhost", "::1", "127.0.0.256"}) {
+    EXPECT_EQ(StartMetricsServer(address, 0, &registry,
+                                 /*enable_profiling=*/false, &server)
+                  .code(),
+              tensorflow::error::INVALID_ARGUMENT)
+        << address;
+  }
+}
+
+TEST(MetricsServerTest, ClientWhichStopsReadingTimesOut) {
+  // The response is far larger than the socket buffers so sending it blocks
+  // until the client reads.
+  MetricsRegistry registry;
+  registry.GetCounter("large", std::string(16 << 20, 'x'));
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(0, &registry, &server));
+
+  const int stalled = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(stalled, 0);
+  int buffer_size = 4096;
+  setsockopt(stalled, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(server->port());
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(connect(stalled, reinterpret_cast<struct sockaddr*>(&addr),
+                    sizeof(addr)),
+            0);
+  const std::string request = "GET /metrics HTTP/1.1\r\n\r\n";
+  ASSERT_EQ(send(stalled, request.data(), request.size(), 0), request.size());
+
+  // Served once the send to the stalled client has timed out.
+  EXPECT_THAT(Fetch(server->port(), "GET /other HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 404 Not Found\r\n"));
+  close(stalled);
+}
+
+TEST(MetricsServerTest, UnknownPathIsNotFound) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(0, &registry, &server));
+
+  EXPECT_THAT(Fetch(server->port(), "GET /other HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 404 Not Found\r\n"));
+}
+
+TEST(MetricsServerTest, ProfilesAreNotServedUnlessEnabled) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(0, &registry, &server));
+
+  EXPECT_THAT(Fetch(server->port(),
+                    "GET /debug/pprof/profile?seconds=1 HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 404 Not Found\r\n"));
+  EXPECT_THAT(Fetch(server->port(), "GET /debug/pprof/heap HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 404 Not Found\r\n"));
+}
+
+TEST(MetricsServerTest, ServesCpuProfile) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(kDefaultMetricsAddress, 0, &registry,
+                                  /*enable_profiling=*/true, &server));
+
+  const std::string response = Fetch(
+      server->port(), "GET /debug/pprof/profile?seconds=1 HTTP/1.1\r\n\r\n");
+  if (CpuProfilerAvailable()) {
+    EXPECT_THAT(response, StartsWith("HTTP/1.1 200 OK\r\n"));
+  } else {
+    EXPECT_THAT(response, StartsWith("HTTP/1.1 501 Not Implemented\r\n"));
+  }
+}
+
+TEST(MetricsServerTest, MetricsAreServedWhileProfiling) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(kDefaultMetricsAddress, 0, &registry,
+                                  /*enable_profiling=*/true, &server));
+  if (!CpuProfilerAvailable()) GTEST_SKIP() << "CPU profiler not linked in.";
+
+  std::string profile;
+  auto profiler = StartThread("", [&] {
+    profile = Fetch(server->port(),
+                    "GET /debug/pprof/profile?seconds=2 HTTP/1.1\r\n\r\n");
+  });
+  absl::SleepFor(absl::Milliseconds(500));
+  EXPECT_THAT(Fetch(server->port(), "GET /metrics HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 200 OK\r\n"));
+  EXPECT_THAT(Fetch(server->port(),
+                    "GET /debug/pprof/profile?seconds=1 HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 503 Service Unavailable\r\n"));
+  profiler = nullptr;
+  EXPECT_THAT(profile, StartsWith("HTTP/1.1 200 OK\r\n"));
+}
+
+TEST(MetricsServerTest, RejectsInvalidProfileDuration) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(kDefaultMetricsAddress, 0, &registry,
+                                  /*enable_profiling=*/true, &server));
+
+  for (const char* seconds : {"0", "-1", "abc", "100000"}) {
+    EXPECT_THAT(
+        Fetch(server->port(),
+              absl::StrCat("GET /debug/pprof/profile?seconds=", seconds,
+                           " HTTP/1.1\r\n\r\n")),
+        StartsWith("HTTP/1.1 400 Bad Request\r\n"))
+        << seconds;
+  }
+}
+
+TEST(MetricsServerTest, HeapProfileReportsMissingProfiler) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(kDefaultMetricsAddress, 0, &registry,
+                                  /*enable_profiling=*/true, &server));
+
+  std::string profile;
+  const auto status = CollectHeapProfile(&profile);
+  const std::string response =
+      Fetch(server->port(), "GET /debug/pprof/heap HTTP/1.1\r\n\r\n");
+  if (status.ok()) {
+    EXPECT_THAT(response, StartsWith("HTTP/1.1 200 OK\r\n"));
+  } else {
+    EXPECT_THAT(response, Not(StartsWith("HTTP/1.1 200 OK\r\n")));
+    EXPECT_THAT(response, HasSubstr(status.error_message()));
+  }
+}
+
+TEST(MetricsServerTest, StopIsIdempotent) {
+  MetricsRegistry registry;
+  std::unique_ptr<MetricsServer> server;
+  TF_ASSERT_OK(StartMetricsServer(0, &registry, &server));
+  server->Stop();
+  server->Stop();
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
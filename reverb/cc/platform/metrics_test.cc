@@ -0,0 +1,107 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/metrics.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::HasSubstr;
+
+TEST(MetricsRegistryTest, ReturnsSameMetricForSameNameAndLabels) {
+  MetricsRegistry registry;
+  Counter* a = registry.GetCounter("calls_total", "Calls.", {{"m", "a"}});
+  Counter* b = registry.GetCounter("calls_total", "Calls.", {{"m", "b"}});
+  EXPECT_NE(a, b);
+  EXPECT_EQ(a, registry.GetCounter("calls_total", "Calls.", {{"m", "a"}}));
+}
+
+TEST(MetricsRegistryTest, ExportsCountersAndGauges) {
+  MetricsRegistry registry;
+  registry.GetCounter("calls_total", "Number of calls.", {{"m", "a"}})
+      ->Increment(3);
+  registry.GetCounter("calls_total", "Number of calls.", {{"m", "b"}})
+      ->Increment();
+  Gauge* gauge = registry.GetGauge("open_streams", "Open streams.");
+  gauge->Add(5);
+  gauge->Add(-2);
+
+  EXPECT_EQ(registry.ToText(),
+            "# HELP calls_total Number of calls.\n"
+            "# TYPE calls_total counter\n"
+            "calls_total{m=\"a\"} 3\n"
+            "calls_total{m=\"b\"} 1\n"
+            "# HELP open_streams Open streams.\n"
+            "# TYPE open_streams gauge\n"
+            "open_streams 3\n");
+}
+
+TEST(MetricsRegistryTest, ExportsHistogramsInSeconds) {
+  MetricsRegistry registry;
+  Histogram* histogram = registry.GetHistogram("latency_seconds", "");
+  histogram->Record(absl::Microseconds(3));
+  histogram->Record(absl::Microseconds(3));
+  histogram->Record(absl::Microseconds(1));
+
+  EXPECT_EQ(registry.ToText(),
+            "# TYPE latency_seconds histogram\n"
+            "latency_seconds_bucket{le=\"1e-06\"} 0\n"
+            "latency_seconds_bucket{le=\"2e-06\"} 1\n"
+            "latency_seconds_bucket{le=\"4e-06\"} 3\n"
+            "latency_seconds_bucket{le=\"+Inf\"} 3\n"
+            "latency_seconds_sum 7e-06\n"
+            "latency_seconds_count 3\n");
+}
+
+TEST(MetricsRegistryTest, CollectorsAreGroupedWithTheirFamily) {
+  MetricsRegistry registry;
+  registry.AddCollector([](MetricsWriter* writer) {
+    writer->AddGauge("size", "Size.", {{"table", "a"}}, 1);
+    writer->AddCounter("inserts_total", "Inserts.", {{"table", "a"}}, 10);
+    writer->AddGauge("size", "Size.", {{"table", "b"}}, 2);
+  });
+
+  EXPECT_EQ(registry.ToText(),
+            "# HELP size Size.\n"
+            "# TYPE size gauge\n"
+            "size{table=\"a\"} 1\n"
+            "size{table=\"b\"} 2\n"
+            "# HELP inserts_total Inserts.\n"
+            "# TYPE inserts_total counter\n"
+            "inserts_total{table=\"a\"} 10\n");
+}
+
+TEST(MetricsWriterTest, EscapesLabelValues) {
+  MetricsWriter writer;
+  writer.AddGauge("g", "", {{"name", "a\"b\\c\nd"}}, 1.5);
+  EXPECT_THAT(writer.ToText(), HasSubstr("g{name=\"a\\\"b\\\\c\\nd\"} 1.5\n"));
+}
+
+TEST(MetricsWriterTest, PrintsLargeIntegersInFull) {
+  MetricsWriter writer;
+  writer.AddCounter("bytes_total", "", {}, 12345678901.0);
+  EXPECT_THAT(writer.ToText(), HasSubstr("bytes_total 12345678901\n"));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,61 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_PLATFORM_NUMA_H_
+#define REVERB_CC_PLATFORM_NUMA_H_
+
+#include <memory>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Number of NUMA nodes of the host. 1 if the topology cannot be determined,
+// in which case all CPUs are treated as belonging to node 0.
+int NumNumaNodes();
+
+// NUMA node of the CPU that the calling thread is running on. Cheap enough to
+// be called for every operation (no system call on most platforms).
+int CurrentNumaNode();
+
+// Restricts the calling thread to the CPUs of a NUMA node and makes the node
+// the preferred node for the memory that the thread allocates (and touches
+// first) while the object is alive. The previous CPU affinity is restored,
+// and the memory policy of the thread is reset to the default, on
+// destruction. Binding is best effort: if the platform does not support it
+// then `bound()` returns false and the thread is left as is.
+class ScopedNumaBinding {
+ public:
+  virtual ~ScopedNumaBinding() = default;
+
+  ScopedNumaBinding(const ScopedNumaBinding&) = delete;
+  ScopedNumaBinding& operator=(const ScopedNumaBinding&) = delete;
+
+  // Whether the thread has been bound to the node.
+  virtual bool bound() const = 0;
+
+ protected:
+  ScopedNumaBinding() = default;
+};
+
+// Binds the calling thread to `node`, which must be in [0, NumNumaNodes()).
+// The returned object must be destroyed on the same thread.
+std::unique_ptr<ScopedNumaBinding> BindToNumaNode(int node);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_NUMA_H_
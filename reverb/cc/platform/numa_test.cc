@@ -0,0 +1,58 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/numa.h"
+
+#include <sched.h>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(NumaTest, CurrentNodeIsValid) {
+  EXPECT_GE(NumNumaNodes(), 1);
+  EXPECT_GE(CurrentNumaNode(), 0);
+  EXPECT_LT(CurrentNumaNode(), NumNumaNodes());
+}
+
+TEST(NumaTest, BindingIsScoped) {
+  cpu_set_t before;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(before), &before), 0);
+
+  for (int node = 0; node < NumNumaNodes(); node++) {
+    {
+      auto binding = BindToNumaNode(node);
+      if (binding->bound()) {
+        EXPECT_EQ(CurrentNumaNode(), node);
+      }
+    }
+    cpu_set_t after;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+    EXPECT_TRUE(CPU_EQUAL(&before, &after));
+  }
+}
+
+TEST(NumaTest, InvalidNodeDies) {
+  EXPECT_DEATH(BindToNumaNode(NumNumaNodes()), "Invalid NUMA node");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
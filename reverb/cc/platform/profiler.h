@@ -0,0 +1,51 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_PROFILER_H_
+#define REVERB_CC_PLATFORM_PROFILER_H_
+
+#include <string>
+
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Whether `CollectCpuProfile` is supported by the binary. The default
+// implementation requires the process to be linked with (or preloaded with)
+// the gperftools profiler, e.g `LD_PRELOAD=libprofiler.so`.
+bool CpuProfilerAvailable();
+
+// Profiles the CPU usage of the whole process for `duration` and populates
+// `profile` with the result in the pprof format. Returns early, with the
+// profile collected so far, if `stop` is notified. Only one profile can be
+// collected at a time; concurrent calls fail with Unavailable.
+tensorflow::Status CollectCpuProfile(absl::Duration duration,
+                                     const absl::Notification* stop,
+                                     std::string* profile);
+
+// Populates `profile` with a snapshot of the live heap allocations in the
+// pprof format. The default implementation requires the gperftools heap
+// profiler to be running, e.g because the process was started with
+// `HEAPPROFILE` set while linked with tcmalloc.
+tensorflow::Status CollectHeapProfile(std::string* profile);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_PROFILER_H_
@@ -15,11 +15,16 @@
 #ifndef REVERB_CC_PLATFORM_SERVER_H_
 #define REVERB_CC_PLATFORM_SERVER_H_
 
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "absl/time/time.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/client.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/support/stream_scheduler.h"
 #include "reverb/cc/table.h"
 
 namespace deepmind {
@@ -45,9 +50,101 @@ class Server {
   virtual std::unique_ptr<Client> InProcessClient() = 0;
 };
 
+struct ServerOptions {
+  // Number of threads which drive the calls using the asynchronous gRPC API.
+  // If 0 then the synchronous gRPC API is used, which holds a thread for as
+  // long as a stream is open. Servers with thousands of concurrent writers and
+  // samplers should set this to a small number, e.g the number of cores.
+  int num_async_threads = 0;
+
+  // If set then the server starts before the latest checkpoint has been
+  // loaded. The checkpoint is restored in the background while the tables
+  // accept inserts, and each table allows samples once the fraction of its
+  // checkpointed items given by `min_restored_fraction_to_sample` (or the
+  // default) has been restored. See `ReverbServiceImpl::Options`.
+  bool warm_start = false;
+  double default_min_restored_fraction_to_sample = 1.0;
+  internal::flat_hash_map<std::string, double> min_restored_fraction_to_sample;
+
+  // If positive then the server saves a checkpoint every
+  // `checkpoint_interval`, writing at most `checkpoint_max_bytes_per_second`
+  // (unlimited if <= 0). A run is skipped if the previous checkpoint is still
+  // in progress. The stats are reported by `ServerInfo`.
+  absl::Duration checkpoint_interval = absl::ZeroDuration();
+  int64_t checkpoint_max_bytes_per_second = 0;
+
+  // If positive then the metrics of the server (calls per method, size of the
+  // tables, rate limiter and chunk store stats) are served in the Prometheus
+  // text format at `http://<metrics_address>:<metrics_port>/metrics`.
+  int metrics_port = 0;
+
+  // IPv4 address which the metrics (and profiles) are served on. Defaults to
+  // the loopback address since the endpoints are unauthenticated. Set to
+  // "0.0.0.0" to serve them to other hosts.
+  std::string metrics_address = "127.0.0.1";
+
+  // If set (and `metrics_port` > 0) then CPU and heap profiles of the server
+  // are served in the pprof format at `/debug/pprof/profile?seconds=N` and
+  // `/debug/pprof/heap` of the metrics port. See ./metrics_server.h.
+  bool enable_profiling = false;
+
+  // NUMA node, keyed by table name, which each table is pinned to. See
+  // `ReverbServiceImpl::Options::table_numa_nodes`.
+  internal::flat_hash_map<std::string, int> table_numa_nodes;
+
+  // Rules, keyed by table name, by which the server derives items from the
+  // chunks it receives. See `ReverbServiceImpl::Options::table_item_rules`.
+  internal::flat_hash_map<std::string, std::vector<ItemRule>> table_item_rules;
+
+  // Read replicas. A server with `enable_replication` can be followed by
+  // replicas, and a server with a `primary_address` is a replica of the server
+  // at that address which serves samples from its own copies of the tables.
+  // A replica is reported to the clients of its primary at `replica_address`
+  // and, with `coordinate_replica_rate_limiting`, reports the samples it
+  // serves to the rate limiters of the primary. See `Replica` and
+  // `ReverbServiceImpl::Options`.
+  bool enable_replication = false;
+  std::string primary_address;
+  std::string replica_address;
+  bool coordinate_replica_rate_limiting = false;
+
+  // Watermarks on the memory held by the chunks of the server, disabled if
+  // <= 0. Inserts are slowed down above the soft limit and chunks are rejected
+  // above the hard limit. See `ReverbServiceImpl::Options`.
+  int64_t memory_soft_limit_bytes = 0;
+  int64_t memory_hard_limit_bytes = 0;
+
+  // If set then the operations which clients request from the tables are
+  // recorded to a trace file at this path, which the load generator can
+  // replay. See `ReverbServiceImpl::Options::workload_trace_path`.
+  std::string workload_trace_path;
+
+  // Priority classes by which the streams are scheduled, disabled if empty.
+  // See `ReverbServiceImpl::Options::stream_classes`.
+  internal::flat_hash_map<std::string, internal::StreamClassOptions>
+      stream_classes;
+  std::string default_stream_class = "default";
+  int max_concurrent_stream_operations = 8;
+
+  // If `tiering.spill_path` is set then the tensors of chunks which have not
+  // been loaded for `tiering.cold_after` are spilled to a file at that path
+  // and reloaded when they are sampled. See `ChunkStore::TieringOptions`.
+  ChunkStore::TieringOptions tiering;
+
+  // If set then chunks whose tensors are identical to those of a live chunk
+  // are stored as aliases of that chunk. See `ChunkStore::Options`.
+  bool deduplicate_chunks = false;
+};
+
+tensorflow::Status StartServer(std::vector<std::shared_ptr<Table>> tables,
+                               int port,
+                               std::shared_ptr<Checkpointer> checkpointer,
+                               std::unique_ptr<Server> *server);
+
 tensorflow::Status StartServer(std::vector<std::shared_ptr<Table>> tables,
                                int port,
                                std::shared_ptr<Checkpointer> checkpointer,
+                               const ServerOptions &options,
                                std::unique_ptr<Server> *server);
 
 }  // namespace reverb
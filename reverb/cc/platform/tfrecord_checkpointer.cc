@@ -15,31 +15,43 @@
 #include "reverb/cc/platform/tfrecord_checkpointer.h"
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <numeric>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <cstdint>
+#include "absl/base/thread_annotations.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/checkpointing/item_block.h"
+#include "reverb/cc/checkpointing/staged_uploader.h"
 #include "reverb/cc/chunk_store.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/bucketed_prioritized.h"
 #include "reverb/cc/selectors/fifo.h"
 #include "reverb/cc/selectors/heap.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/kary_prioritized.h"
 #include "reverb/cc/selectors/lifo.h"
 #include "reverb/cc/selectors/prioritized.h"
 #include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/chunk_spill_file.h"
+#include "reverb/cc/support/thread_pool.h"
 #include "reverb/cc/table.h"
 #include "reverb/cc/table_extensions/interface.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -56,7 +68,20 @@ namespace reverb {
 namespace {
 
 constexpr char kTablesFileName[] = "tables.tfrecord";
-constexpr char kChunksFileName[] = "chunks.tfrecord";
+// Chunk files are named `chunks-<shard>-of-<num_shards>.tfrecord`. Checkpoints
+// written before chunk files were sharded hold a single `chunks.tfrecord`.
+constexpr char kChunksFilePattern[] = "chunks*.tfrecord";
+// Chunk files written in the mapped format consist of a data file
+// `chunks-<shard>-of-<num_shards>.mapped` and a TFRecord file of
+// `MappedChunkIndexEntry` with the same name but the `.index` extension.
+constexpr char kMappedIndexFilePattern[] = "chunks*.index";
+constexpr char kChunksExtension[] = "tfrecord";
+constexpr char kMappedIndexExtension[] = "index";
+constexpr char kMappedDataExtension[] = "mapped";
+// Chunks of mapped files start on a page boundary so that every chunk can be
+// mapped without touching the pages of its neighbours.
+constexpr uint64_t kMappedChunkAlignment = 4096;
+constexpr char kManifestFileName[] = "manifest.pb";
 constexpr char kDoneFileName[] = "DONE";
 
 using RecordWriterUniquePtr =
@@ -93,6 +118,291 @@ tensorflow::Status OpenReader(const std::string& path,
   return tensorflow::Status::OK();
 }
 
+// Calls `fn` with the offset and content of every record in the TFRecord file
+// at `path`. Stops at the first error returned by `fn`.
+tensorflow::Status ForEachRecord(
+    const std::string& path,
+    const std::function<tensorflow::Status(tensorflow::uint64 offset,
+                                           const tensorflow::tstring& record)>&
+        fn) {
+  RecordReaderUniquePtr reader;
+  TF_RETURN_IF_ERROR(OpenReader(path, &reader));
+
+  tensorflow::uint64 offset = 0;
+  tensorflow::tstring record;
+  while (true) {
+    const tensorflow::uint64 record_offset = offset;
+    tensorflow::Status status = reader->ReadRecord(&offset, &record);
+    if (tensorflow::errors::IsOutOfRange(status)) {
+      return tensorflow::Status::OK();
+    }
+    TF_RETURN_IF_ERROR(status);
+    TF_RETURN_IF_ERROR(fn(record_offset, record));
+  }
+}
+
+// Reads the manifest of the checkpoint in `directory`, relative to `root_dir`.
+tensorflow::Status ReadManifest(const std::string& root_dir,
+                                const std::string& directory,
+                                TFRecordCheckpointManifest* manifest) {
+  const std::string path =
+      tensorflow::io::JoinPath(root_dir, directory, kManifestFileName);
+  if (!tensorflow::Env::Default()->FileExists(path).ok()) {
+    // Checkpoints written before checkpoints became incremental hold all of
+    // their chunks themselves.
+    manifest->add_chunk_directories(directory);
+    return tensorflow::Status::OK();
+  }
+  return tensorflow::ReadBinaryProto(tensorflow::Env::Default(), path,
+                                     manifest);
+}
+
+std::string ChunksFileName(int shard, int num_shards,
+                           absl::string_view extension) {
+  return absl::StrFormat("chunks-%05d-of-%05d.%s", shard, num_shards,
+                         extension);
+}
+
+// Name of the chunk file of part `part` of the chunks of shard `shard` when
+// the chunk files are uploaded in parts.
+std::string ChunksPartFileName(int shard, int num_shards, int part) {
+  return absl::StrFormat("chunks-%05d-of-%05d-%05d.%s", shard, num_shards,
+                         part, kChunksExtension);
+}
+
+// Limits the rate at which the files of a checkpoint are written. The budget
+// is shared by all the threads which write concurrently.
+class WriteThrottle {
+ public:
+  // A value <= 0 means that there is no limit.
+  explicit WriteThrottle(int64_t max_bytes_per_second)
+      : max_bytes_per_second_(max_bytes_per_second) {}
+
+  // Blocks until `num_bytes` can be written without exceeding the limit,
+  // averaged since the first call.
+  void Acquire(int64_t num_bytes) ABSL_LOCKS_EXCLUDED(mu_) {
+    if (max_bytes_per_second_ <= 0) return;
+    absl::Time deadline;
+    {
+      absl::MutexLock lock(&mu_);
+      if (num_bytes_ == 0) start_ = absl::Now();
+      num_bytes_ += num_bytes;
+      deadline = start_ + absl::Seconds(static_cast<double>(num_bytes_) /
+                                        max_bytes_per_second_);
+    }
+    absl::SleepFor(deadline - absl::Now());
+  }
+
+ private:
+  const int64_t max_bytes_per_second_;
+  absl::Mutex mu_;
+  absl::Time start_ ABSL_GUARDED_BY(mu_);
+  int64_t num_bytes_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+// Writes `chunks` to a new TFRecord file at `path` and adds the number of
+// bytes written to `num_bytes`.
+tensorflow::Status WriteChunks(
+    const std::string& path,
+    const std::vector<std::shared_ptr<ChunkStore::Chunk>>& chunks,
+    WriteThrottle* throttle, int64_t* num_bytes) {
+  RecordWriterUniquePtr writer;
+  TF_RETURN_IF_ERROR(OpenWriter(path, &writer));
+  for (const auto& chunk : chunks) {
+    std::shared_ptr<const ChunkData> data;
+    TF_RETURN_IF_ERROR(chunk->Load(&data));
+    const std::string record = data->SerializeAsString();
+    throttle->Acquire(record.size());
+    TF_RETURN_IF_ERROR(writer->WriteRecord(record));
+    *num_bytes += record.size();
+  }
+  return writer->Close();
+}
+
+// Serializes `chunks` into TFRecord files of about `part_bytes` in memory and
+// hands each to `uploader` as soon as it is full, to be written to
+// `dir_path`. Adds the number of bytes written to `num_bytes`.
+tensorflow::Status UploadChunks(
+    const std::string& dir_path, int shard, int num_shards,
+    const std::vector<std::shared_ptr<ChunkStore::Chunk>>& chunks,
+    int64_t part_bytes, WriteThrottle* throttle, StagedUploader* uploader,
+    int64_t* num_bytes) {
+  using ::tensorflow::io::RecordWriter;
+  std::string part;
+  int num_parts = 0;
+  auto upload_part = [&]() -> tensorflow::Status {
+    std::string data;
+    data.swap(part);
+    return uploader->Upload(
+        tensorflow::io::JoinPath(
+            dir_path, ChunksPartFileName(shard, num_shards, num_parts++)),
+        std::move(data));
+  };
+
+  char header[RecordWriter::kHeaderSize];
+  char footer[RecordWriter::kFooterSize];
+  for (const auto& chunk : chunks) {
+    std::shared_ptr<const ChunkData> data;
+    TF_RETURN_IF_ERROR(chunk->Load(&data));
+    const std::string record = data->SerializeAsString();
+    throttle->Acquire(record.size());
+    RecordWriter::PopulateHeader(header, record.data(), record.size());
+    RecordWriter::PopulateFooter(footer, record.data(), record.size());
+    part.append(header, sizeof(header));
+    part.append(record);
+    part.append(footer, sizeof(footer));
+    *num_bytes += record.size();
+    if (static_cast<int64_t>(part.size()) >= part_bytes) {
+      TF_RETURN_IF_ERROR(upload_part());
+    }
+  }
+  if (!part.empty()) TF_RETURN_IF_ERROR(upload_part());
+  return tensorflow::Status::OK();
+}
+
+// Writes `chunks` in the mapped format to a new data file at `data_path` and
+// its index to `index_path`. Adds the number of bytes written, including the
+// padding of the data file, to `num_bytes`.
+tensorflow::Status WriteMappedChunks(
+    const std::string& data_path, const std::string& index_path,
+    const std::vector<std::shared_ptr<ChunkStore::Chunk>>& chunks,
+    WriteThrottle* throttle, int64_t* num_bytes) {
+  std::unique_ptr<tensorflow::WritableFile> data_file;
+  TF_RETURN_IF_ERROR(
+      tensorflow::Env::Default()->NewWritableFile(data_path, &data_file));
+  RecordWriterUniquePtr index_writer;
+  TF_RETURN_IF_ERROR(OpenWriter(index_path, &index_writer));
+
+  const std::string padding(kMappedChunkAlignment, '\0');
+  uint64_t offset = 0;
+  for (const auto& chunk : chunks) {
+    std::shared_ptr<const ChunkData> data;
+    TF_RETURN_IF_ERROR(chunk->Load(&data));
+    const std::string record = data->SerializeAsString();
+
+    MappedChunkIndexEntry entry;
+    *entry.mutable_header() = chunk->data();
+    entry.mutable_header()->clear_data();
+    entry.set_offset(offset);
+    entry.set_size(record.size());
+    const std::string index_record = entry.SerializeAsString();
+
+    const uint64_t padding_size =
+        (kMappedChunkAlignment - record.size() % kMappedChunkAlignment) %
+        kMappedChunkAlignment;
+    throttle->Acquire(record.size() + padding_size + index_record.size());
+    TF_RETURN_IF_ERROR(data_file->Append(record));
+    TF_RETURN_IF_ERROR(data_file->Append(
+        absl::string_view(padding.data(), padding_size)));
+    TF_RETURN_IF_ERROR(index_writer->WriteRecord(index_record));
+    offset += record.size() + padding_size;
+    *num_bytes += record.size() + padding_size + index_record.size();
+  }
+  TF_RETURN_IF_ERROR(data_file->Close());
+  return index_writer->Close();
+}
+
+// Chunks read from one chunk file by `ReadChunks`.
+struct ReadChunksResult {
+  // Index of the directory in the manifest of the checkpoint.
+  int directory_index;
+
+  // The chunks which are referenced by the checkpoint.
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+
+  // Total number of chunks, and bytes, in the file.
+  int64_t num_chunks = 0;
+  int64_t num_bytes = 0;
+
+  tensorflow::Status status;
+};
+
+// Reads the chunks of the TFRecord file at `path` and inserts the ones whose
+// key is in `referenced_keys` into `chunk_store`.
+void ReadChunks(const std::string& path,
+                const internal::flat_hash_set<ChunkStore::Key>& referenced_keys,
+                ChunkStore* chunk_store, ReadChunksResult* result) {
+  result->status = ForEachRecord(path, [&](tensorflow::uint64 offset,
+                                           const tensorflow::tstring& record) {
+    ChunkData chunk_data;
+    if (!chunk_data.ParseFromArray(record.data(), record.size())) {
+      return tensorflow::errors::DataLoss(
+          "Could not parse TFRecord as ChunkData: '", record, "'");
+    }
+    result->num_chunks++;
+    result->num_bytes += record.size();
+    if (!referenced_keys.contains(chunk_data.chunk_key())) {
+      return tensorflow::Status::OK();
+    }
+    if (chunk_data.deprecated_data_size()) {
+      if (!chunk_data.data().tensors().empty()) {
+        return tensorflow::errors::Internal(
+            "Checkpoint ChunkData at offset: ", offset,
+            " has both data and deprecated_data.");
+      }
+      chunk_data.mutable_data()->mutable_tensors()->Swap(
+          chunk_data.mutable_deprecated_data());
+    }
+    result->chunks.push_back(chunk_store->Insert(std::move(chunk_data)));
+    return tensorflow::Status::OK();
+  });
+}
+
+// Reads the index of a chunk file written in the mapped format and inserts the
+// chunks whose key is in `referenced_keys` into `chunk_store` without reading
+// their data. The data file is opened once and shared by the chunks, which
+// keeps it readable even after the checkpoint has been deleted. The data file
+// must be on local disk.
+void ReadMappedChunks(
+    const std::string& index_path,
+    const internal::flat_hash_set<ChunkStore::Key>& referenced_keys,
+    ChunkStore* chunk_store, ReadChunksResult* result) {
+  const std::string data_path = absl::StrCat(
+      index_path.substr(0, index_path.size() - strlen(kMappedIndexExtension)),
+      kMappedDataExtension);
+  std::shared_ptr<internal::ChunkSpillFile> data_file;
+  auto read_entry = [&](tensorflow::uint64 offset,
+                        const tensorflow::tstring& record) {
+    MappedChunkIndexEntry entry;
+    if (!entry.ParseFromArray(record.data(), record.size())) {
+      return tensorflow::errors::DataLoss(
+          "Could not parse TFRecord at offset ", offset, " of ", index_path,
+          " as MappedChunkIndexEntry.");
+    }
+    result->num_chunks++;
+    result->num_bytes += record.size();
+    if (!referenced_keys.contains(entry.header().chunk_key())) {
+      return tensorflow::Status::OK();
+    }
+    if (data_file == nullptr) {
+      std::unique_ptr<internal::ChunkSpillFile> file;
+      TF_RETURN_IF_ERROR(internal::ChunkSpillFile::Open(data_path, &file));
+      data_file = std::move(file);
+    }
+    if (entry.offset() + entry.size() > data_file->size()) {
+      return tensorflow::errors::DataLoss(
+          "Chunk ", entry.header().chunk_key(), " at offset ", entry.offset(),
+          " exceeds the size of ", data_path, ".");
+    }
+    result->chunks.push_back(chunk_store->InsertMapped(
+        entry.header(), entry.size(), data_file,
+        {entry.offset(), entry.size()}));
+    return tensorflow::Status::OK();
+  };
+  result->status = ForEachRecord(index_path, read_entry);
+}
+
+// Logs the throughput of reading or writing `num_bytes` in `duration`.
+void LogThroughput(absl::string_view action, int64_t num_chunks,
+                   int64_t num_bytes, int num_files, absl::Duration duration) {
+  const double mb = num_bytes / (1024.0 * 1024.0);
+  const double seconds = absl::ToDoubleSeconds(duration);
+  REVERB_LOG(REVERB_INFO) << action << " " << num_chunks << " chunks ("
+                          << mb << " MB) in " << num_files << " files in "
+                          << duration << " ("
+                          << (seconds > 0 ? mb / seconds : 0) << " MB/s).";
+}
+
 inline tensorflow::Status WriteDone(const std::string& path) {
   std::unique_ptr<tensorflow::WritableFile> file;
   TF_RETURN_IF_ERROR(tensorflow::Env::Default()->NewWritableFile(
@@ -116,10 +426,22 @@ std::unique_ptr<ItemSelector> MakeDistribution(
     case KeyDistributionOptions::kUniform:
       return absl::make_unique<UniformSelector>();
     case KeyDistributionOptions::kPrioritized:
+      if (options.prioritized().buckets_per_doubling() > 0) {
+        return absl::make_unique<BucketedPrioritizedSelector>(
+            options.prioritized().priority_exponent(),
+            options.prioritized().buckets_per_doubling());
+      }
+      if (options.prioritized().branching_factor() > 0) {
+        return absl::make_unique<KAryPrioritizedSelector>(
+            options.prioritized().priority_exponent(),
+            options.prioritized().branching_factor());
+      }
       return absl::make_unique<PrioritizedSelector>(
-          options.prioritized().priority_exponent());
+          options.prioritized().priority_exponent(),
+          options.prioritized().reduced_precision());
     case KeyDistributionOptions::kHeap:
-      return absl::make_unique<HeapSelector>(options.heap().min_heap());
+      return absl::make_unique<HeapSelector>(
+          options.heap().min_heap(), options.heap().branching_factor());
     case KeyDistributionOptions::DISTRIBUTION_NOT_SET:
       REVERB_LOG(REVERB_FATAL) << "Selector not set";
     default:
@@ -136,11 +458,144 @@ inline size_t find_table_index(
   return -1;
 }
 
+// A table of a checkpoint and the blocks of its items. Checkpoints written
+// before the items were stored in blocks hold them in `checkpoint.items`.
+struct CheckpointedTable {
+  PriorityTableCheckpoint checkpoint;
+  std::vector<PrioritizedItemBlock> item_blocks;
+
+  int64_t num_items() const {
+    int64_t num_items = checkpoint.items_size();
+    for (const auto& block : item_blocks) num_items += block.keys_size();
+    return num_items;
+  }
+};
+
+// Reads the tables of the checkpoint in `dir_path` and the keys of the chunks
+// which their items reference. The record of each table is followed by the
+// records of its `num_item_blocks` item blocks.
+tensorflow::Status ReadTables(
+    const std::string& dir_path, std::vector<CheckpointedTable>* checkpoints,
+    internal::flat_hash_set<ChunkStore::Key>* referenced_keys) {
+  int64_t num_blocks_to_read = 0;
+  TF_RETURN_IF_ERROR(ForEachRecord(
+      tensorflow::io::JoinPath(dir_path, kTablesFileName),
+      [&](tensorflow::uint64 offset, const tensorflow::tstring& record) {
+        if (num_blocks_to_read > 0) {
+          num_blocks_to_read--;
+          auto& blocks = checkpoints->back().item_blocks;
+          blocks.emplace_back();
+          if (!blocks.back().ParseFromArray(record.data(), record.size())) {
+            return tensorflow::errors::DataLoss(
+                "Could not parse TFRecord as PrioritizedItemBlock of table ",
+                checkpoints->back().checkpoint.table_name());
+          }
+          referenced_keys->insert(blocks.back().chunk_keys().begin(),
+                                  blocks.back().chunk_keys().end());
+          return tensorflow::Status::OK();
+        }
+
+        checkpoints->emplace_back();
+        PriorityTableCheckpoint& checkpoint = checkpoints->back().checkpoint;
+        if (!checkpoint.ParseFromArray(record.data(), record.size())) {
+          return tensorflow::errors::DataLoss(
+              "Could not parse TFRecord as Checkpoint: '", record, "'");
+        }
+        for (const auto& item : checkpoint.items()) {
+          referenced_keys->insert(item.chunk_keys().begin(),
+                                  item.chunk_keys().end());
+        }
+        num_blocks_to_read = checkpoint.num_item_blocks();
+        return tensorflow::Status::OK();
+      }));
+  if (num_blocks_to_read > 0) {
+    return tensorflow::errors::DataLoss(
+        "Tables file of ", dir_path, " ends ", num_blocks_to_read,
+        " item blocks before the end of table ",
+        checkpoints->back().checkpoint.table_name());
+  }
+  return tensorflow::Status::OK();
+}
+
+// Calls `fn` with the items of `table` in the order in which they were
+// checkpointed. The blocks are decoded (and released) one at a time so that
+// only the items of one block are materialized at once.
+tensorflow::Status ForEachItem(
+    CheckpointedTable* table,
+    const std::function<tensorflow::Status(PrioritizedItem)>& fn) {
+  for (auto& item : *table->checkpoint.mutable_items()) {
+    TF_RETURN_IF_ERROR(fn(std::move(item)));
+  }
+  std::vector<PrioritizedItem> items;
+  for (auto& block : table->item_blocks) {
+    items.clear();
+    TF_RETURN_IF_ERROR(
+        DecodeItemBlock(block, table->checkpoint.table_name(), &items));
+    PrioritizedItemBlock().Swap(&block);
+    for (auto& item : items) {
+      TF_RETURN_IF_ERROR(fn(std::move(item)));
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+// Sets `indices[i]` to the index in `tables` of the table of `checkpoints[i]`.
+tensorflow::Status FindTables(const std::vector<CheckpointedTable>& checkpoints,
+                              const std::vector<std::shared_ptr<Table>>& tables,
+                              std::vector<int>* indices) {
+  for (const auto& checkpointed_table : checkpoints) {
+    const PriorityTableCheckpoint& checkpoint = checkpointed_table.checkpoint;
+    int index = find_table_index(&tables, checkpoint.table_name());
+    if (index == -1) {
+      std::vector<std::string> table_names;
+      for (const auto& table : tables) {
+        table_names.push_back(absl::StrCat("'", table->name(), "'"));
+      }
+      return tensorflow::errors::InvalidArgument(
+          "Trying to load table ", checkpoint.table_name(),
+          " but table was not found in provided list of tables. Available "
+          "tables: [",
+          absl::StrJoin(table_names, ", "), "]");
+    }
+    if (std::find(indices->begin(), indices->end(), index) != indices->end()) {
+      return tensorflow::errors::DataLoss("Checkpoint contains table ",
+                                          checkpoint.table_name(),
+                                          " more than once.");
+    }
+    indices->push_back(index);
+  }
+  return tensorflow::Status::OK();
+}
+
+// Pairs a checkpointed item with the chunks which it references.
+Table::Item MakeItem(
+    PrioritizedItem item,
+    const internal::flat_hash_map<ChunkStore::Key,
+                                  std::shared_ptr<ChunkStore::Chunk>>& chunks) {
+  Table::Item table_item;
+  for (const auto& key : item.chunk_keys()) {
+    auto it = chunks.find(key);
+    REVERB_CHECK(it != chunks.end());
+    table_item.chunks.push_back(it->second);
+  }
+  table_item.item = std::move(item);
+  return table_item;
+}
+
 }  // namespace
 
 TFRecordCheckpointer::TFRecordCheckpointer(std::string root_dir,
-                                           std::string group)
-    : root_dir_(std::move(root_dir)), group_(std::move(group)) {
+                                           std::string group, int num_shards,
+                                           bool mapped_chunks,
+                                           ChunkUploadOptions upload_options)
+    : root_dir_(std::move(root_dir)),
+      group_(std::move(group)),
+      num_shards_(num_shards),
+      mapped_chunks_(mapped_chunks),
+      upload_options_(upload_options) {
+  REVERB_CHECK_GE(num_shards_, 1);
+  REVERB_CHECK_GE(upload_options_.num_streams, 0);
+  REVERB_CHECK_GT(upload_options_.part_bytes, 0);
   REVERB_LOG(REVERB_INFO) << "Initializing TFRecordCheckpointer in "
                           << root_dir_;
 }
@@ -148,6 +603,15 @@ TFRecordCheckpointer::TFRecordCheckpointer(std::string root_dir,
 tensorflow::Status TFRecordCheckpointer::Save(std::vector<Table*> tables,
                                               int keep_latest,
                                               std::string* path) {
+  return Save(std::move(tables), keep_latest, SaveOptions(), path,
+              /*stats=*/nullptr);
+}
+
+tensorflow::Status TFRecordCheckpointer::Save(std::vector<Table*> tables,
+                                              int keep_latest,
+                                              const SaveOptions& options,
+                                              std::string* path,
+                                              SaveStats* stats) {
   if (keep_latest <= 0) {
     return tensorflow::errors::InvalidArgument(
         "TFRecordCheckpointer must have keep_latest > 0.");
@@ -156,12 +620,27 @@ tensorflow::Status TFRecordCheckpointer::Save(std::vector<Table*> tables,
     return tensorflow::errors::InvalidArgument(
         "Setting non-empty group is not supported");
   }
+  // The state of the rate limiter is stored per table so restoring the
+  // checkpoint would silently give every table a rate limiter of its own.
+  for (int i = 0; i < tables.size(); i++) {
+    for (int j = i + 1; j < tables.size(); j++) {
+      if (tables[i]->SharesRateLimiterWith(*tables[j])) {
+        return tensorflow::errors::FailedPrecondition(
+            "Tables ", tables[i]->name(), " and ", tables[j]->name(),
+            " share a rate limiter, which checkpoints can't restore.");
+      }
+    }
+  }
 
-  std::string dir_path =
-      tensorflow::io::JoinPath(root_dir_, absl::FormatTime(absl::Now()));
+  absl::MutexLock lock(&mu_);
+
+  const std::string directory = absl::FormatTime(absl::Now());
+  std::string dir_path = tensorflow::io::JoinPath(root_dir_, directory);
   TF_RETURN_IF_ERROR(
       tensorflow::Env::Default()->RecursivelyCreateDir(dir_path));
 
+  WriteThrottle throttle(options.max_bytes_per_second);
+  int64_t tables_num_bytes = 0;
   RecordWriterUniquePtr table_writer;
   TF_RETURN_IF_ERROR(OpenWriter(
       tensorflow::io::JoinPath(dir_path, kTablesFileName), &table_writer));
@@ -170,50 +649,248 @@ tensorflow::Status TFRecordCheckpointer::Save(std::vector<Table*> tables,
   for (Table* table : tables) {
     auto checkpoint = table->Checkpoint();
     chunks.merge(checkpoint.chunks);
-    TF_RETURN_IF_ERROR(
-        table_writer->WriteRecord(checkpoint.checkpoint.SerializeAsString()));
+
+    // The table is followed by the blocks of its items, one record each, so
+    // that no record holds more than `kCheckpointItemsPerBlock` items.
+    std::string record = checkpoint.checkpoint.SerializeAsString();
+    throttle.Acquire(record.size());
+    TF_RETURN_IF_ERROR(table_writer->WriteRecord(record));
+    tables_num_bytes += record.size();
+    for (auto& block : checkpoint.item_blocks) {
+      record = block.SerializeAsString();
+      PrioritizedItemBlock().Swap(&block);
+      throttle.Acquire(record.size());
+      TF_RETURN_IF_ERROR(table_writer->WriteRecord(record));
+      tables_num_bytes += record.size();
+    }
   }
 
   TF_RETURN_IF_ERROR(table_writer->Close());
   table_writer = nullptr;
 
-  RecordWriterUniquePtr chunk_writer;
-  TF_RETURN_IF_ERROR(OpenWriter(
-      tensorflow::io::JoinPath(dir_path, kChunksFileName), &chunk_writer));
+  // Count how many of the chunks of each existing chunk file are still
+  // referenced. Files where fewer than half are referenced are not reused.
+  std::vector<int64_t> num_referenced(chunk_files_.size(), 0);
+  for (const auto& chunk : chunks) {
+    auto it = persisted_chunks_.find(chunk->data().chunk_key());
+    if (it != persisted_chunks_.end()) ++num_referenced[it->second];
+  }
 
+  // The new chunk file is the first entry of the new `chunk_files_`.
+  std::vector<ChunkFile> chunk_files = {{directory, 0}};
+  std::vector<int> new_file_index(chunk_files_.size(), -1);
+  internal::flat_hash_map<ChunkStore::Key, int> persisted_chunks;
+  persisted_chunks.reserve(chunks.size());
+
+  // The chunks which have to be written are distributed over the shards.
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> shards(
+      num_shards_);
   for (const auto& chunk : chunks) {
-    TF_RETURN_IF_ERROR(
-        chunk_writer->WriteRecord(chunk->data().SerializeAsString()));
+    const ChunkStore::Key key = chunk->data().chunk_key();
+    auto it = persisted_chunks_.find(key);
+    if (it != persisted_chunks_.end() &&
+        2 * num_referenced[it->second] >= chunk_files_[it->second].num_chunks) {
+      int& index = new_file_index[it->second];
+      if (index == -1) {
+        index = chunk_files.size();
+        chunk_files.push_back(chunk_files_[it->second]);
+      }
+      persisted_chunks[key] = index;
+      continue;
+    }
+
+    shards[chunk_files[0].num_chunks++ % num_shards_].push_back(chunk);
+    persisted_chunks[key] = 0;
+  }
+
+  const absl::Time write_start = absl::Now();
+  std::vector<tensorflow::Status> statuses(num_shards_);
+  std::vector<int64_t> num_bytes(num_shards_, 0);
+  std::unique_ptr<StagedUploader> uploader;
+  if (!mapped_chunks_ && upload_options_.num_streams > 0) {
+    uploader = absl::make_unique<StagedUploader>(
+        upload_options_.num_streams, upload_options_.max_staged_bytes);
+  }
+  {
+    internal::ThreadPool pool(num_shards_, "checkpoint_writer");
+    for (int i = 0; i < num_shards_; i++) {
+      pool.Schedule([&, i] {
+        if (uploader != nullptr) {
+          statuses[i] = UploadChunks(dir_path, i, num_shards_, shards[i],
+                                     upload_options_.part_bytes, &throttle,
+                                     uploader.get(), &num_bytes[i]);
+        } else if (mapped_chunks_) {
+          statuses[i] = WriteMappedChunks(
+              tensorflow::io::JoinPath(
+                  dir_path,
+                  ChunksFileName(i, num_shards_, kMappedDataExtension)),
+              tensorflow::io::JoinPath(
+                  dir_path,
+                  ChunksFileName(i, num_shards_, kMappedIndexExtension)),
+              shards[i], &throttle, &num_bytes[i]);
+        } else {
+          statuses[i] = WriteChunks(
+              tensorflow::io::JoinPath(
+                  dir_path, ChunksFileName(i, num_shards_, kChunksExtension)),
+              shards[i], &throttle, &num_bytes[i]);
+        }
+      });
+    }
+  }  // Joins the threads of the pool.
+  if (uploader != nullptr) {
+    StagedUploader::Stats upload_stats;
+    statuses.push_back(uploader->Finish(&upload_stats));
+    REVERB_LOG(REVERB_INFO)
+        << "Uploaded " << upload_stats.num_files << " chunk files ("
+        << upload_stats.num_bytes / (1024.0 * 1024.0) << " MB) through "
+        << upload_options_.num_streams << " streams in "
+        << upload_stats.duration << ".";
+  }
+  for (const auto& status : statuses) TF_RETURN_IF_ERROR(status);
+  const int64_t chunks_num_bytes =
+      std::accumulate(num_bytes.begin(), num_bytes.end(), int64_t{0});
+  const absl::Duration write_duration = absl::Now() - write_start;
+  LogThroughput("Wrote", chunk_files[0].num_chunks, chunks_num_bytes,
+                num_shards_, write_duration);
+
+  TFRecordCheckpointManifest manifest;
+  for (const auto& file : chunk_files) {
+    manifest.add_chunk_directories(file.directory);
   }
-  TF_RETURN_IF_ERROR(chunk_writer->Close());
-  chunk_writer = nullptr;
+  TF_RETURN_IF_ERROR(tensorflow::WriteBinaryProto(
+      tensorflow::Env::Default(),
+      tensorflow::io::JoinPath(dir_path, kManifestFileName), manifest));
 
   // Both chunks and table checkpoint has now been written so we can proceed to
   // add the DONE-file.
   TF_RETURN_IF_ERROR(WriteDone(dir_path));
 
-  // Delete the older checkpoints.
+  chunk_files_ = std::move(chunk_files);
+  persisted_chunks_ = std::move(persisted_chunks);
+
+  TF_RETURN_IF_ERROR(DeleteOldCheckpoints(keep_latest));
+
+  if (stats != nullptr) {
+    stats->num_bytes_written = tables_num_bytes + chunks_num_bytes;
+    stats->write_duration = write_duration;
+  }
+  *path = std::move(dir_path);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status TFRecordCheckpointer::DeleteOldCheckpoints(
+    int keep_latest) {
+  auto* env = tensorflow::Env::Default();
   std::vector<std::string> filenames;
-  TF_RETURN_IF_ERROR(tensorflow::Env::Default()->GetMatchingPaths(
+  TF_RETURN_IF_ERROR(env->GetMatchingPaths(
       tensorflow::io::JoinPath(root_dir_, "*"), &filenames));
   std::sort(filenames.begin(), filenames.end());
-  int history_counter = 0;
-  for (auto it = filenames.rbegin(); it != filenames.rend(); it++) {
-    if (++history_counter > keep_latest) {
+
+  // Find the retained checkpoints and the chunk files they reference.
+  // Directories without DONE which are more recent than the oldest retained
+  // checkpoint could still be in the process of being written so they are left
+  // alone.
+  internal::flat_hash_set<std::string> referenced;
+  int num_retained = 0;
+  auto it = filenames.rbegin();
+  for (; it != filenames.rend() && num_retained < keep_latest; it++) {
+    if (!HasDone(*it)) continue;
+    num_retained++;
+
+    TFRecordCheckpointManifest manifest;
+    TF_RETURN_IF_ERROR(ReadManifest(
+        root_dir_, std::string(tensorflow::io::Basename(*it)), &manifest));
+    referenced.insert(manifest.chunk_directories().begin(),
+                      manifest.chunk_directories().end());
+  }
+
+  for (; it != filenames.rend(); it++) {
+    if (!referenced.contains(std::string(tensorflow::io::Basename(*it)))) {
       tensorflow::int64 undeleted_files;
       tensorflow::int64 undeleted_dirs;
-      TF_RETURN_IF_ERROR(tensorflow::Env::Default()->DeleteRecursively(
-          *it, &undeleted_files, &undeleted_dirs));
+      TF_RETURN_IF_ERROR(env->DeleteRecursively(*it, &undeleted_files,
+                                                &undeleted_dirs));
+      continue;
+    }
+
+    // Only the chunks are still needed. DONE is deleted first so that the
+    // directory is never mistaken for a complete checkpoint.
+    for (const char* name :
+         {kDoneFileName, kTablesFileName, kManifestFileName}) {
+      const std::string file_path = tensorflow::io::JoinPath(*it, name);
+      if (env->FileExists(file_path).ok()) {
+        TF_RETURN_IF_ERROR(env->DeleteFile(file_path));
+      }
     }
   }
 
-  *path = std::move(dir_path);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status TFRecordCheckpointer::ReadChunkFiles(
+    const TFRecordCheckpointManifest& manifest,
+    const internal::flat_hash_set<ChunkStore::Key>& referenced_keys,
+    ChunkStore* chunk_store, ChunkMap* chunk_by_key,
+    std::vector<ChunkFile>* chunk_files,
+    internal::flat_hash_map<ChunkStore::Key, int>* persisted_chunks) {
+  // The directories can hold chunk files of both formats as the format of
+  // the checkpointer which wrote them may differ.
+  std::vector<std::string> paths;
+  std::vector<bool> mapped;
+  std::vector<ReadChunksResult> results;
+  for (int i = 0; i < manifest.chunk_directories_size(); i++) {
+    for (const char* pattern : {kChunksFilePattern, kMappedIndexFilePattern}) {
+      std::vector<std::string> directory_paths;
+      TF_RETURN_IF_ERROR(tensorflow::Env::Default()->GetMatchingPaths(
+          tensorflow::io::JoinPath(root_dir_, manifest.chunk_directories(i),
+                                   pattern),
+          &directory_paths));
+      for (auto& path : directory_paths) {
+        paths.push_back(std::move(path));
+        mapped.push_back(pattern == kMappedIndexFilePattern);
+        results.emplace_back();
+        results.back().directory_index = i;
+      }
+    }
+  }
+  const absl::Time read_start = absl::Now();
+  {
+    internal::ThreadPool pool(num_shards_, "checkpoint_reader");
+    for (int i = 0; i < paths.size(); i++) {
+      pool.Schedule([&, i] {
+        if (mapped[i]) {
+          ReadMappedChunks(paths[i], referenced_keys, chunk_store,
+                           &results[i]);
+        } else {
+          ReadChunks(paths[i], referenced_keys, chunk_store, &results[i]);
+        }
+      });
+    }
+  }  // Joins the threads of the pool.
+
+  for (const std::string& directory : manifest.chunk_directories()) {
+    chunk_files->push_back({directory, 0});
+  }
+  int64_t num_bytes = 0;
+  for (auto& result : results) {
+    TF_RETURN_IF_ERROR(result.status);
+    (*chunk_files)[result.directory_index].num_chunks += result.num_chunks;
+    num_bytes += result.num_bytes;
+    for (auto& chunk : result.chunks) {
+      (*persisted_chunks)[chunk->data().chunk_key()] = result.directory_index;
+      (*chunk_by_key)[chunk->data().chunk_key()] = std::move(chunk);
+    }
+  }
+  LogThroughput("Read", chunk_by_key->size(), num_bytes, results.size(),
+                absl::Now() - read_start);
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status TFRecordCheckpointer::Load(
     absl::string_view relative_path, ChunkStore* chunk_store,
     std::vector<std::shared_ptr<Table>>* tables) {
+  absl::MutexLock lock(&mu_);
+
   const std::string dir_path =
       tensorflow::io::JoinPath(root_dir_, relative_path);
   REVERB_LOG(REVERB_INFO) << "Loading checkpoint from " << dir_path;
@@ -221,72 +898,36 @@ tensorflow::Status TFRecordCheckpointer::Load(
     return tensorflow::errors::InvalidArgument(
         absl::StrCat("Load called with invalid checkpoint path: ", dir_path));
   }
-  // Insert data first to ensure that all data referenced by the tables
-  // exists. Keep the map of chunks around so that none of the chunks are
-  // cleaned up before all the tables have been loaded.
-  internal::flat_hash_map<ChunkStore::Key, std::shared_ptr<ChunkStore::Chunk>>
-      chunk_by_key;
-  {
-    RecordReaderUniquePtr chunk_reader;
-    TF_RETURN_IF_ERROR(OpenReader(
-        tensorflow::io::JoinPath(dir_path, kChunksFileName), &chunk_reader));
 
-    ChunkData chunk_data;
-    tensorflow::Status chunk_status;
-    tensorflow::uint64 chunk_offset = 0;
-    tensorflow::tstring chunk_record;
-    do {
-      chunk_status = chunk_reader->ReadRecord(&chunk_offset, &chunk_record);
-      if (!chunk_status.ok()) break;
-      if (!chunk_data.ParseFromArray(chunk_record.data(),
-                                     chunk_record.size())) {
-        return tensorflow::errors::DataLoss(
-            "Could not parse TFRecord as ChunkData: '", chunk_record, "'");
-      }
-      if (chunk_data.deprecated_data_size()) {
-        if (!chunk_data.data().tensors().empty()) {
-          return tensorflow::errors::Internal(
-              "Checkpoint ChunkData at offset: ", chunk_offset,
-              " has both data and deprecated_data.");
-        }
-        chunk_data.mutable_data()->mutable_tensors()->Swap(
-            chunk_data.mutable_deprecated_data());
-      }
-      chunk_by_key[chunk_data.chunk_key()] = chunk_store->Insert(chunk_data);
-    } while (chunk_status.ok());
-    if (!tensorflow::errors::IsOutOfRange(chunk_status)) {
-      return chunk_status;
-    }
-  }
+  TFRecordCheckpointManifest manifest;
+  TF_RETURN_IF_ERROR(
+      ReadManifest(root_dir_, std::string(relative_path), &manifest));
 
-  RecordReaderUniquePtr table_reader;
-  TF_RETURN_IF_ERROR(OpenReader(
-      tensorflow::io::JoinPath(dir_path, kTablesFileName), &table_reader));
+  // The chunk files can be shared with other checkpoints and hold chunks that
+  // are not referenced by this one, so the tables are read first.
+  std::vector<CheckpointedTable> checkpoints;
+  internal::flat_hash_set<ChunkStore::Key> referenced_keys;
+  TF_RETURN_IF_ERROR(ReadTables(dir_path, &checkpoints, &referenced_keys));
 
-  PriorityTableCheckpoint checkpoint;
-  tensorflow::Status table_status;
-  tensorflow::uint64 table_offset = 0;
-  tensorflow::tstring table_record;
-  do {
-    table_status = table_reader->ReadRecord(&table_offset, &table_record);
-    if (!table_status.ok()) break;
-    if (!checkpoint.ParseFromArray(table_record.data(), table_record.size())) {
-      return tensorflow::errors::DataLoss(
-          "Could not parse TFRecord as Checkpoint: '", table_record, "'");
-    }
+  // Resolve the tables before any of them is replaced.
+  std::vector<int> table_indices;
+  TF_RETURN_IF_ERROR(FindTables(checkpoints, *tables, &table_indices));
 
-    int index = find_table_index(tables, checkpoint.table_name());
-    if (index == -1) {
-      std::vector<std::string> table_names;
-      for (const auto& table : *tables) {
-        table_names.push_back(absl::StrCat("'", table->name(), "'"));
-      }
-      return tensorflow::errors::InvalidArgument(
-          "Trying to load table ", checkpoint.table_name(),
-          " but table was not found in provided list of tables. Available "
-          "tables: [",
-          absl::StrJoin(table_names, ", "), "]");
-    }
+  // Insert data first to ensure that all data referenced by the tables
+  // exists. Keep the map of chunks around so that none of the chunks are
+  // cleaned up before all the tables have been loaded.
+  ChunkMap chunk_by_key;
+  std::vector<ChunkFile> chunk_files;
+  internal::flat_hash_map<ChunkStore::Key, int> persisted_chunks;
+  TF_RETURN_IF_ERROR(ReadChunkFiles(manifest, referenced_keys, chunk_store,
+                                    &chunk_by_key, &chunk_files,
+                                    &persisted_chunks));
+
+  // The tables are independent of each other so they are reconstructed in
+  // parallel. The items of each table are inserted in order.
+  auto load_table = [&](int i) {
+    PriorityTableCheckpoint& checkpoint = checkpoints[i].checkpoint;
+    const int index = table_indices[i];
 
     auto sampler = MakeDistribution(checkpoint.sampler());
     auto remover = MakeDistribution(checkpoint.remover());
@@ -306,43 +947,125 @@ tensorflow::Status TFRecordCheckpointer::Load(
         /*max_times_sampled=*/checkpoint.max_times_sampled(),
         /*rate_limiter=*/std::move(rate_limiter),
         /*extensions=*/std::move(extensions),
-        /*signature=*/std::move(signature));
+        /*signature=*/std::move(signature),
+        /*max_bytes=*/checkpoint.max_bytes(),
+        /*max_age=*/checkpoint.has_max_age()
+            ? absl::Seconds(checkpoint.max_age().seconds()) +
+                  absl::Nanoseconds(checkpoint.max_age().nanos())
+            : absl::InfiniteDuration(),
+        /*index_episodes=*/checkpoint.index_episodes(),
+        /*max_reserved_bytes=*/checkpoint.max_reserved_bytes());
     table->set_num_deleted_episodes_from_checkpoint(
         checkpoint.num_deleted_episodes());
 
-    for (const auto& checkpoint_item : checkpoint.items()) {
-      Table::Item insert_item;
-      insert_item.item = checkpoint_item;
-
-      for (const auto& key : checkpoint_item.chunk_keys()) {
-        REVERB_CHECK(chunk_by_key.contains(key));
-        insert_item.chunks.push_back(chunk_by_key[key]);
-      }
-
-      // The original table has already been destroyed so if this fails then
-      // there is way to recover.
-      TF_CHECK_OK(table->InsertCheckpointItem(std::move(insert_item)));
-    }
+    // The original table has already been destroyed so if this fails then
+    // there is way to recover.
+    TF_CHECK_OK(
+        ForEachItem(&checkpoints[i], [&](PrioritizedItem checkpoint_item) {
+          return table->InsertCheckpointItem(
+              MakeItem(std::move(checkpoint_item), chunk_by_key));
+        }));
 
     tables->at(index).swap(table);
-  } while (table_status.ok());
+  };
+  const absl::Time tables_start = absl::Now();
+  {
+    internal::ThreadPool pool(num_shards_, "checkpoint_loader");
+    for (int i = 0; i < checkpoints.size(); i++) {
+      pool.Schedule([&load_table, i] { load_table(i); });
+    }
+  }  // Joins the threads of the pool.
+  REVERB_LOG(REVERB_INFO) << "Loaded " << checkpoints.size() << " tables in "
+                          << absl::Now() - tables_start << ".";
 
-  if (!tensorflow::errors::IsOutOfRange(table_status)) {
-    return table_status;
-  }
+  // Chunks which are still referenced when the next checkpoint is saved don't
+  // have to be written again.
+  chunk_files_ = std::move(chunk_files);
+  persisted_chunks_ = std::move(persisted_chunks);
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status TFRecordCheckpointer::LoadLatest(
     ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) {
   REVERB_LOG(REVERB_INFO) << "Loading latest checkpoint from " << root_dir_;
+  std::string relative_path;
+  TF_RETURN_IF_ERROR(FindLatestCheckpoint(&relative_path));
+  return Load(relative_path, chunk_store, tables);
+}
+
+tensorflow::Status TFRecordCheckpointer::RestoreLatest(
+    ChunkStore* chunk_store,
+    const std::vector<std::shared_ptr<Table>>& tables) {
+  absl::MutexLock lock(&mu_);
+
+  std::string relative_path;
+  TF_RETURN_IF_ERROR(FindLatestCheckpoint(&relative_path));
+  const std::string dir_path =
+      tensorflow::io::JoinPath(root_dir_, relative_path);
+  REVERB_LOG(REVERB_INFO) << "Restoring checkpoint from " << dir_path
+                          << " into the serving tables";
+
+  TFRecordCheckpointManifest manifest;
+  TF_RETURN_IF_ERROR(ReadManifest(root_dir_, relative_path, &manifest));
+
+  std::vector<CheckpointedTable> checkpoints;
+  internal::flat_hash_set<ChunkStore::Key> referenced_keys;
+  TF_RETURN_IF_ERROR(ReadTables(dir_path, &checkpoints, &referenced_keys));
+
+  std::vector<int> table_indices;
+  TF_RETURN_IF_ERROR(FindTables(checkpoints, tables, &table_indices));
+
+  // Report the number of items to restore before the (slow) chunks are read.
+  for (int i = 0; i < tables.size(); i++) {
+    auto it = std::find(table_indices.begin(), table_indices.end(), i);
+    tables[i]->SetNumItemsToRestore(
+        it == table_indices.end()
+            ? 0
+            : checkpoints[it - table_indices.begin()].num_items());
+  }
+
+  ChunkMap chunk_by_key;
+  std::vector<ChunkFile> chunk_files;
+  internal::flat_hash_map<ChunkStore::Key, int> persisted_chunks;
+  TF_RETURN_IF_ERROR(ReadChunkFiles(manifest, referenced_keys, chunk_store,
+                                    &chunk_by_key, &chunk_files,
+                                    &persisted_chunks));
+
+  const absl::Time tables_start = absl::Now();
+  std::vector<tensorflow::Status> statuses(checkpoints.size());
+  {
+    internal::ThreadPool pool(num_shards_, "checkpoint_restorer");
+    for (int i = 0; i < checkpoints.size(); i++) {
+      pool.Schedule([&, i] {
+        Table* table = tables[table_indices[i]].get();
+        statuses[i] = ForEachItem(
+            &checkpoints[i], [&](PrioritizedItem checkpoint_item) {
+              return table->InsertRestoredItem(
+                  MakeItem(std::move(checkpoint_item), chunk_by_key));
+            });
+      });
+    }
+  }  // Joins the threads of the pool.
+  for (const auto& status : statuses) TF_RETURN_IF_ERROR(status);
+  REVERB_LOG(REVERB_INFO) << "Restored " << checkpoints.size()
+                          << " tables in " << absl::Now() - tables_start
+                          << ".";
+
+  chunk_files_ = std::move(chunk_files);
+  persisted_chunks_ = std::move(persisted_chunks);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status TFRecordCheckpointer::FindLatestCheckpoint(
+    std::string* relative_path) const {
   std::vector<std::string> filenames;
   TF_RETURN_IF_ERROR(tensorflow::Env::Default()->GetMatchingPaths(
       tensorflow::io::JoinPath(root_dir_, "*"), &filenames));
   std::sort(filenames.begin(), filenames.end());
   for (auto it = filenames.rbegin(); it != filenames.rend(); it++) {
     if (HasDone(*it)) {
-      return Load(tensorflow::io::Basename(*it), chunk_store, tables);
+      *relative_path = std::string(tensorflow::io::Basename(*it));
+      return tensorflow::Status::OK();
     }
   }
   return tensorflow::errors::NotFound(
@@ -15,19 +15,40 @@
 #ifndef REVERB_CC_PLATFORM_TFRECORD_CHECKPOINTER_H_
 #define REVERB_CC_PLATFORM_TFRECORD_CHECKPOINTER_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/table.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
 namespace reverb {
 
+// Configures staged uploads of the chunk files of a `TFRecordCheckpointer`.
+struct ChunkUploadOptions {
+  // Number of chunk files which are written concurrently. If > 0 then each
+  // shard serializes its chunks into parts of about `part_bytes`, each of
+  // which becomes a chunk file of its own, and a `StagedUploader` writes the
+  // parts while the shards serialize the next ones. If 0 (the default) every
+  // shard writes its chunks straight into a single chunk file.
+  int num_streams = 0;
+  int64_t part_bytes = int64_t{64} << 20;
+
+  // Bound on the memory held by the parts which have been serialized but not
+  // yet written.
+  int64_t max_staged_bytes = int64_t{1} << 30;
+};
+
 // Generates and stores proto checkpoints of PriorityTables and ChunkStore data
 // to a directory inside the top level `root_dir`.
 //
@@ -46,7 +67,10 @@ namespace reverb {
 //   <root_dir>/
 //     <timestamp of the checkpoint>/
 //       tables.tfrecord
-//       chunks.tfrecord
+//       chunks-00000-of-<num_shards>.tfrecord
+//       ...
+//       chunks-<num_shards - 1>-of-<num_shards>.tfrecord
+//       manifest.pb
 //       DONE
 //
 // DONE an empty file written once the checkpoint has been successfully written.
@@ -57,11 +81,59 @@ namespace reverb {
 // The most recent checkpoint can therefore be inferred from the name of the
 // directories within `root_dir`.
 //
+// `tables.tfrecord` holds a record for each table, followed by records of the
+// `PrioritizedItemBlock`s which encode its items. Checkpoints written before
+// the items were stored in blocks hold them in the record of the table
+// instead, which `Load` and `RestoreLatest` still accept.
+//
+// The chunks are distributed over `num_shards` files which are written, and
+// read back by `Load`, in parallel. `Load` also reconstructs the tables in
+// parallel. The throughput of both operations is logged.
+//
+// Checkpoints are incremental: the chunk files only hold the chunks which
+// were not already written by an earlier checkpoint of the same checkpointer
+// (or read by `Load`). The manifest, a `TFRecordCheckpointManifest`, lists the
+// checkpoint directories whose chunk files hold the rest. A chunk file is only
+// reused while at least half of its chunks are still referenced, otherwise the
+// referenced chunks are written again so that the old file can be deleted.
+//
+// When old checkpoints are deleted, the chunk files which are still referenced
+// by one of the retained checkpoints are kept. Such directories only hold
+// chunk files and are deleted once no longer referenced.
+//
+// If `mapped_chunks` is true then every chunk file is written in the mapped
+// format instead, i.e as a `chunks-<shard>-of-<num_shards>.mapped` file of
+// page aligned chunks and a `.index` file which holds the metadata and
+// location of each chunk. Loading such a checkpoint only reads the index: the
+// chunks are inserted into the `ChunkStore` without their tensors, which are
+// parsed from the memory mapped file the first time the chunk is loaded (and
+// released again when the chunk store spills the chunk). The duration of
+// `Load` therefore depends on the number of items and chunks rather than the
+// size of the data. Both formats can be read regardless of `mapped_chunks`,
+// but mapped files can only be read from local disk.
+//
+// If `upload_options.num_streams` > 0 then the chunk files are staged in
+// memory and uploaded in parts through parallel streams, which overlap with
+// the serialization of the chunks (see `ChunkUploadOptions`). This is meant
+// for a `root_dir` on a remote file system where every file is uploaded over
+// a single stream. The part files of shard `s` are named
+// `chunks-<s>-of-<num_shards>-<part>.tfrecord` and are read like any other
+// chunk file. The throughput of the uploads is logged and the time they took
+// is reported through `SaveStats::write_duration`. Staged uploads are not
+// used for the mapped format, which is only readable from local disk.
+//
 // If `group` is nonempty then the directory containing the checkpoint will be
 // created with `group` as group.
 class TFRecordCheckpointer : public Checkpointer {
  public:
-  explicit TFRecordCheckpointer(std::string root_dir, std::string group = "");
+  // Number of chunk files per checkpoint unless a different value is passed to
+  // the constructor.
+  static constexpr int kDefaultNumShards = 8;
+
+  explicit TFRecordCheckpointer(
+      std::string root_dir, std::string group = "",
+      int num_shards = kDefaultNumShards, bool mapped_chunks = false,
+      ChunkUploadOptions upload_options = ChunkUploadOptions());
 
   // Save a new checkpoint for every table in `tables` in sub directory
   // inside `root_dir_`. If the call is successful, the ABSOLUTE path to the
@@ -71,10 +143,16 @@ class TFRecordCheckpointer : public Checkpointer {
   // create it before proceeding.
   //
   // After a successful save, all but the `keep_latest` most recent checkpoints
-  // are deleted.
+  // are deleted, apart from the chunk files which they still reference.
   tensorflow::Status Save(std::vector<Table*> tables, int keep_latest,
                           std::string* path) override;
 
+  // Same as above but throttles the writes to `options.max_bytes_per_second`
+  // (shared by the shards) and reports the number of bytes written.
+  tensorflow::Status Save(std::vector<Table*> tables, int keep_latest,
+                          const SaveOptions& options, std::string* path,
+                          SaveStats* stats) override;
+
   // Attempts to load a checkpoint stored within `root_dir_`.
   tensorflow::Status Load(absl::string_view relative_path,
                           ChunkStore* chunk_store,
@@ -85,13 +163,74 @@ class TFRecordCheckpointer : public Checkpointer {
       ChunkStore* chunk_store,
       std::vector<std::shared_ptr<Table>>* tables) override;
 
+  // Finds the most recent checkpoint within `root_dir_` and inserts its items
+  // into `tables` without replacing them. The number of items to restore is
+  // reported to the tables as soon as the (small) table file has been read,
+  // the items are inserted once all the chunk files have been read. The
+  // rate limiter state and `num_deleted_episodes` of the checkpoint are not
+  // restored.
+  tensorflow::Status RestoreLatest(
+      ChunkStore* chunk_store,
+      const std::vector<std::shared_ptr<Table>>& tables) override;
+
   // TFRecordCheckpointer is neither copyable nor movable.
   TFRecordCheckpointer(const TFRecordCheckpointer&) = delete;
   TFRecordCheckpointer& operator=(const TFRecordCheckpointer&) = delete;
 
  private:
+  // A chunk file written by an earlier `Save` or read by `Load`.
+  struct ChunkFile {
+    // Name of the checkpoint directory, relative to `root_dir_`.
+    std::string directory;
+
+    // Total number of chunks in the file.
+    int64_t num_chunks;
+  };
+
+  using ChunkMap =
+      internal::flat_hash_map<ChunkStore::Key,
+                              std::shared_ptr<ChunkStore::Chunk>>;
+
+  // Sets `relative_path` to the most recent complete checkpoint.
+  tensorflow::Status FindLatestCheckpoint(std::string* relative_path) const;
+
+  // Reads the chunks in `referenced_keys` from the chunk files of `manifest`
+  // in parallel and inserts them into `chunk_store`. The chunk files and the
+  // file of each chunk are returned so that they can be reused by `Save`.
+  tensorflow::Status ReadChunkFiles(
+      const TFRecordCheckpointManifest& manifest,
+      const internal::flat_hash_set<ChunkStore::Key>& referenced_keys,
+      ChunkStore* chunk_store, ChunkMap* chunk_by_key,
+      std::vector<ChunkFile>* chunk_files,
+      internal::flat_hash_map<ChunkStore::Key, int>* persisted_chunks)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Deletes all but the `keep_latest` most recent complete checkpoints. The
+  // chunk files which are referenced by the retained checkpoints are kept.
+  tensorflow::Status DeleteOldCheckpoints(int keep_latest)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   const std::string root_dir_;
   const std::string group_;
+
+  // Number of files that the chunks of a checkpoint are written to. Also the
+  // number of threads used to write and load checkpoints.
+  const int num_shards_;
+
+  // Write the chunk files in the mapped format.
+  const bool mapped_chunks_;
+
+  // Staged uploads of the chunk files. Unused if `mapped_chunks_`.
+  const ChunkUploadOptions upload_options_;
+
+  // Serializes `Save`, `Load` and `RestoreLatest`.
+  absl::Mutex mu_;
+
+  // Chunk files of the most recent checkpoint written or loaded, and the file
+  // (index into `chunk_files_`) of each chunk referenced by that checkpoint.
+  std::vector<ChunkFile> chunk_files_ ABSL_GUARDED_BY(mu_);
+  internal::flat_hash_map<ChunkStore::Key, int> persisted_chunks_
+      ABSL_GUARDED_BY(mu_);
 };
 
 }  // namespace reverb
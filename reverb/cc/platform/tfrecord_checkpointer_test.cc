@@ -22,6 +22,11 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/checkpointing/interface.h"
+#include "reverb/cc/checkpointing/item_block.h"
 #include "reverb/cc/chunk_store.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/selectors/fifo.h"
@@ -35,6 +40,8 @@
 #include "tensorflow/core/framework/types.pb.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/lib/io/record_writer.h"
 #include "tensorflow/core/platform/env.h"
 
 namespace deepmind {
@@ -49,6 +56,59 @@ std::string MakeRoot() {
   return name;
 }
 
+// Returns the number of complete checkpoints among `paths`.
+int NumCheckpoints(const std::vector<std::string>& paths) {
+  int count = 0;
+  for (const auto& path : paths) {
+    if (tensorflow::Env::Default()
+            ->FileExists(tensorflow::io::JoinPath(path, "DONE"))
+            .ok()) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// Returns the paths of the chunk files of the checkpoint.
+std::vector<std::string> ChunkFiles(const std::string& checkpoint_path) {
+  std::vector<std::string> paths;
+  TF_CHECK_OK(tensorflow::Env::Default()->GetMatchingPaths(
+      tensorflow::io::JoinPath(checkpoint_path, "chunks*.tfrecord"), &paths));
+  return paths;
+}
+
+// Returns the number of chunks written to the chunk files of the checkpoint.
+int NumChunksWritten(const std::string& checkpoint_path) {
+  int count = 0;
+  for (const auto& path : ChunkFiles(checkpoint_path)) {
+    std::unique_ptr<tensorflow::RandomAccessFile> file;
+    TF_CHECK_OK(tensorflow::Env::Default()->NewRandomAccessFile(path, &file));
+    tensorflow::io::RecordReader reader(file.get());
+    tensorflow::uint64 offset = 0;
+    tensorflow::tstring record;
+    while (reader.ReadRecord(&offset, &record).ok()) count++;
+  }
+  return count;
+}
+
+// Returns the items of a checkpoint of `table`.
+std::vector<PrioritizedItem> CheckpointedItems(Table* table) {
+  auto checkpoint = table->Checkpoint();
+  std::vector<PrioritizedItem> items;
+  for (const auto& block : checkpoint.item_blocks) {
+    TF_CHECK_OK(DecodeItemBlock(block, table->name(), &items));
+  }
+  return items;
+}
+
+void InsertItems(Table* table, ChunkStore* chunk_store, int begin, int end) {
+  for (int i = begin; i < end; i++) {
+    auto chunk = chunk_store->Insert(testing::MakeChunkData(i));
+    TF_EXPECT_OK(table->InsertOrAssign(
+        {testing::MakePrioritizedItem(i, i, {chunk->data()}), {chunk}}));
+  }
+}
+
 std::unique_ptr<Table> MakeUniformTable(const std::string& name) {
   return absl::make_unique<Table>(
       name, absl::make_unique<UniformSelector>(),
@@ -89,6 +149,26 @@ TEST(TFRecordCheckpointerTest, CreatesDirectoryInRoot) {
   TF_EXPECT_OK(env->FileExists(path));
 }
 
+TEST(TFRecordCheckpointerTest, SaveFailsForTablesSharingARateLimiter) {
+  auto limiter = std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX);
+  auto make_table = [&limiter](const std::string& name) {
+    return absl::make_unique<Table>(name, absl::make_unique<UniformSelector>(),
+                                    absl::make_unique<FifoSelector>(), 1000, 0,
+                                    limiter);
+  };
+  auto first = make_table("first");
+  auto second = make_table("second");
+  auto other = MakeUniformTable("other");
+
+  TFRecordCheckpointer checkpointer(MakeRoot());
+  std::string path;
+  EXPECT_EQ(checkpointer.Save({other.get(), first.get(), second.get()}, 1,
+                              &path)
+                .code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  TF_EXPECT_OK(checkpointer.Save({other.get(), first.get()}, 1, &path));
+}
+
 TEST(TFRecordCheckpointerTest, SaveAndLoad) {
   ChunkStore chunk_store;
 
@@ -199,10 +279,14 @@ TEST(TFRecordCheckpointerTest, SaveDeletesOldData) {
           checkpointer.Save({tables[0].get(), tables[1].get(), tables[2].get()},
                             keep_latest, &path));
 
+      // The tables don't change so every checkpoint references the chunk file
+      // of the first one, which is kept after its tables have been deleted.
       std::vector<std::string> filenames;
       TF_ASSERT_OK(tensorflow::Env::Default()->GetMatchingPaths(
           tensorflow::io::JoinPath(root, "*"), &filenames));
-      ASSERT_EQ(filenames.size(), std::min(keep_latest, i + 1));
+      ASSERT_EQ(NumCheckpoints(filenames), std::min(keep_latest, i + 1));
+      ASSERT_EQ(filenames.size(),
+                std::min(keep_latest, i + 1) + (i >= keep_latest ? 1 : 0));
     }
   };
   test(1);  // Keep one checkpoint.
@@ -210,6 +294,328 @@ TEST(TFRecordCheckpointerTest, SaveDeletesOldData) {
   test(5);  // Edge case keep_latest > num_tables
 }
 
+TEST(TFRecordCheckpointerTest, SaveOnlyWritesNewChunks) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(tables[0].get(), &chunk_store, 0, 10);
+
+  auto root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root);
+  std::string first_path;
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &first_path));
+  EXPECT_EQ(NumChunksWritten(first_path), 10);
+
+  InsertItems(tables[0].get(), &chunk_store, 10, 15);
+  std::string second_path;
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &second_path));
+  EXPECT_EQ(NumChunksWritten(second_path), 5);
+
+  // The first checkpoint was deleted but its chunks are still required.
+  EXPECT_FALSE(tensorflow::Env::Default()
+                   ->FileExists(tensorflow::io::JoinPath(first_path, "DONE"))
+                   .ok());
+  EXPECT_EQ(NumChunksWritten(first_path), 10);
+
+  // Both the checkpointer which wrote the checkpoint and one which has never
+  // seen it can load the checkpoint.
+  auto check_load = [](Checkpointer* loader) {
+    ChunkStore loaded_chunk_store;
+    std::vector<std::shared_ptr<Table>> loaded_tables;
+    loaded_tables.push_back(MakeUniformTable("uniform"));
+    TF_ASSERT_OK(loader->LoadLatest(&loaded_chunk_store, &loaded_tables));
+    EXPECT_EQ(loaded_tables[0]->size(), 15);
+
+    std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+    TF_EXPECT_OK(loaded_chunk_store.Get(
+        {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14}, &chunks));
+  };
+  check_load(&checkpointer);
+  TFRecordCheckpointer other_checkpointer(root);
+  check_load(&other_checkpointer);
+}
+
+TEST(TFRecordCheckpointerTest, LoadedChunksAreNotWrittenAgain) {
+  ChunkStore chunk_store;
+  auto table = MakeUniformTable("uniform");
+  InsertItems(table.get(), &chunk_store, 0, 10);
+
+  auto root = MakeRoot();
+  std::string path;
+  TF_ASSERT_OK(TFRecordCheckpointer(root).Save({table.get()}, 1, &path));
+
+  TFRecordCheckpointer checkpointer(root);
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  TF_ASSERT_OK(checkpointer.LoadLatest(&loaded_chunk_store, &loaded_tables));
+
+  TF_ASSERT_OK(checkpointer.Save({loaded_tables[0].get()}, 1, &path));
+  EXPECT_EQ(NumChunksWritten(path), 0);
+}
+
+TEST(TFRecordCheckpointerTest, SaveRewritesChunksOfMostlyDeletedFiles) {
+  ChunkStore chunk_store;
+  auto table = MakeUniformTable("uniform");
+  InsertItems(table.get(), &chunk_store, 0, 10);
+
+  auto root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root);
+  std::string first_path;
+  TF_ASSERT_OK(checkpointer.Save({table.get()}, 1, &first_path));
+
+  // Only 4 of the 10 chunks of the first checkpoint are still referenced so
+  // they are written again and the first checkpoint can be deleted entirely.
+  TF_ASSERT_OK(table->MutateItems({}, {0, 1, 2, 3, 4, 5}));
+  std::string second_path;
+  TF_ASSERT_OK(checkpointer.Save({table.get()}, 1, &second_path));
+  EXPECT_EQ(NumChunksWritten(second_path), 4);
+  EXPECT_FALSE(tensorflow::Env::Default()->FileExists(first_path).ok());
+}
+
+TEST(TFRecordCheckpointerTest, SaveAndLoadShardedChunks) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  InsertItems(tables[0].get(), &chunk_store, 0, 50);
+  InsertItems(tables[1].get(), &chunk_store, 50, 100);
+
+  auto root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root, /*group=*/"", /*num_shards=*/3);
+  std::string path;
+  TF_ASSERT_OK(
+      checkpointer.Save({tables[0].get(), tables[1].get()}, 1, &path));
+  EXPECT_THAT(ChunkFiles(path), ::testing::SizeIs(3));
+  EXPECT_EQ(NumChunksWritten(path), 100);
+
+  // A checkpointer with a different number of shards reads all of them.
+  TFRecordCheckpointer loader(root, /*group=*/"", /*num_shards=*/2);
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  loaded_tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  TF_ASSERT_OK(loader.LoadLatest(&loaded_chunk_store, &loaded_tables));
+  for (int i = 0; i < tables.size(); i++) {
+    EXPECT_EQ(loaded_tables[i]->name(), tables[i]->name());
+    EXPECT_EQ(loaded_tables[i]->size(), 50);
+
+    // The items must have been inserted in their original order.
+    auto items = CheckpointedItems(loaded_tables[i].get());
+    auto want = CheckpointedItems(tables[i].get());
+    ASSERT_EQ(items.size(), want.size());
+    for (int j = 0; j < items.size(); j++) {
+      EXPECT_THAT(items[j], EqualsProto(want[j]));
+    }
+  }
+}
+
+TEST(TFRecordCheckpointerTest, SaveAndLoadStagedUploads) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(tables[0].get(), &chunk_store, 0, 30);
+
+  // Every chunk fills a part of its own.
+  ChunkUploadOptions upload_options;
+  upload_options.num_streams = 4;
+  upload_options.part_bytes = 1;
+  auto root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root, /*group=*/"", /*num_shards=*/2,
+                                    /*mapped_chunks=*/false, upload_options);
+  std::string path;
+  Checkpointer::SaveStats stats;
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1,
+                                 Checkpointer::SaveOptions(), &path, &stats));
+  EXPECT_THAT(ChunkFiles(path), ::testing::SizeIs(30));
+  EXPECT_EQ(NumChunksWritten(path), 30);
+  EXPECT_GT(stats.num_bytes_written, 0);
+  EXPECT_GT(stats.write_duration, absl::ZeroDuration());
+
+  // Only the new chunks are uploaded by the next checkpoint, and the old
+  // parts are still referenced.
+  InsertItems(tables[0].get(), &chunk_store, 30, 40);
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+  EXPECT_EQ(NumChunksWritten(path), 10);
+
+  TFRecordCheckpointer loader(root);
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  TF_ASSERT_OK(loader.LoadLatest(&loaded_chunk_store, &loaded_tables));
+  EXPECT_EQ(loaded_tables[0]->size(), 40);
+  auto items = CheckpointedItems(loaded_tables[0].get());
+  auto want = CheckpointedItems(tables[0].get());
+  ASSERT_EQ(items.size(), want.size());
+  for (int i = 0; i < items.size(); i++) {
+    EXPECT_THAT(items[i], EqualsProto(want[i]));
+  }
+}
+
+TEST(TFRecordCheckpointerTest, LoadsTablesWithoutItemBlocks) {
+  ChunkStore chunk_store;
+  auto table = MakePrioritizedTable("prioritized", 0.5);
+  InsertItems(table.get(), &chunk_store, 0, 50);
+
+  const std::string root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root);
+  std::string path;
+  TF_ASSERT_OK(checkpointer.Save({table.get()}, 1, &path));
+
+  // Rewrite the tables file in the format used before the items were stored
+  // in blocks, i.e with the items in the record of the table.
+  auto checkpoint = table->Checkpoint();
+  checkpoint.checkpoint.set_num_item_blocks(0);
+  for (auto& item : CheckpointedItems(table.get())) {
+    *checkpoint.checkpoint.add_items() = std::move(item);
+  }
+  {
+    std::unique_ptr<tensorflow::WritableFile> file;
+    TF_ASSERT_OK(tensorflow::Env::Default()->NewWritableFile(
+        tensorflow::io::JoinPath(path, "tables.tfrecord"), &file));
+    tensorflow::io::RecordWriter writer(file.get());
+    TF_ASSERT_OK(
+        writer.WriteRecord(checkpoint.checkpoint.SerializeAsString()));
+    TF_ASSERT_OK(writer.Close());
+    TF_ASSERT_OK(file->Close());
+  }
+
+  TFRecordCheckpointer loader(root);
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  TF_ASSERT_OK(loader.LoadLatest(&loaded_chunk_store, &loaded_tables));
+
+  auto items = CheckpointedItems(loaded_tables[0].get());
+  auto want = CheckpointedItems(table.get());
+  ASSERT_EQ(items.size(), 50);
+  ASSERT_EQ(items.size(), want.size());
+  for (int i = 0; i < items.size(); i++) {
+    EXPECT_THAT(items[i], EqualsProto(want[i]));
+  }
+}
+
+TEST(TFRecordCheckpointerTest, LoadsMappedChunksLazily) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(tables[0].get(), &chunk_store, 0, 20);
+
+  auto root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root, /*group=*/"", /*num_shards=*/2,
+                                    /*mapped_chunks=*/true);
+  std::string path;
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+  EXPECT_THAT(ChunkFiles(path), ::testing::IsEmpty());
+  std::vector<std::string> mapped_files;
+  TF_ASSERT_OK(tensorflow::Env::Default()->GetMatchingPaths(
+      tensorflow::io::JoinPath(path, "chunks*.mapped"), &mapped_files));
+  EXPECT_THAT(mapped_files, ::testing::SizeIs(2));
+
+  // The format of the files doesn't depend on the loading checkpointer.
+  TFRecordCheckpointer loader(root);
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  TF_ASSERT_OK(loader.LoadLatest(&loaded_chunk_store, &loaded_tables));
+  EXPECT_EQ(loaded_tables[0]->size(), 20);
+
+  std::vector<ChunkStore::Key> keys;
+  for (ChunkStore::Key key = 0; key < 20; key++) keys.push_back(key);
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  TF_ASSERT_OK(loaded_chunk_store.Get(keys, &chunks));
+  for (const auto& chunk : chunks) {
+    const ChunkData expected =
+        testing::MakeChunkData(chunk->data().chunk_key());
+    EXPECT_FALSE(chunk->IsResident());
+    EXPECT_THAT(chunk->data().sequence_range(),
+                EqualsProto(expected.sequence_range()));
+    EXPECT_EQ(chunk->DataByteSizeLong(), expected.ByteSizeLong());
+
+    std::shared_ptr<const ChunkData> data;
+    TF_ASSERT_OK(chunk->Load(&data));
+    EXPECT_THAT(*data, EqualsProto(expected));
+  }
+
+  // The loaded chunks are already persisted so they are not written again.
+  TF_ASSERT_OK(loader.Save({loaded_tables[0].get()}, 1, &path));
+  EXPECT_EQ(NumChunksWritten(path), 0);
+}
+
+TEST(TFRecordCheckpointerTest, RestoreLatestInsertsIntoServingTables) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(tables[0].get(), &chunk_store, 0, 50);
+
+  auto root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root);
+  std::string path;
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+
+  // The table is not replaced and keeps the item inserted before the restore.
+  TFRecordCheckpointer restorer(root);
+  ChunkStore restored_chunk_store;
+  std::vector<std::shared_ptr<Table>> restored_tables;
+  restored_tables.push_back(MakeUniformTable("uniform"));
+  restored_tables.push_back(MakeUniformTable("not_in_checkpoint"));
+  Table* restored = restored_tables[0].get();
+  for (auto& table : restored_tables) table->BeginRestore(1.0);
+  InsertItems(restored, &restored_chunk_store, 100, 101);
+
+  TF_ASSERT_OK(restorer.RestoreLatest(&restored_chunk_store, restored_tables));
+  EXPECT_EQ(restored_tables[0].get(), restored);
+  EXPECT_EQ(restored->size(), 51);
+  EXPECT_EQ(restored->info().restore_progress().total_items(), 50);
+  EXPECT_EQ(restored->info().restore_progress().restored_items(), 50);
+  EXPECT_TRUE(restored->info().restore_progress().ready_to_sample());
+  EXPECT_TRUE(
+      restored_tables[1]->info().restore_progress().ready_to_sample());
+  for (auto& table : restored_tables) table->EndRestore();
+}
+
+TEST(TFRecordCheckpointerTest, RestoreLatestInEmptyDir) {
+  TFRecordCheckpointer checkpointer(MakeRoot());
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  tables[0]->BeginRestore(1.0);
+  EXPECT_EQ(checkpointer.RestoreLatest(&chunk_store, tables).code(),
+            tensorflow::error::NOT_FOUND);
+  tables[0]->EndRestore();
+}
+
+TEST(TFRecordCheckpointerTest, SaveIsThrottledAndReportsBytesWritten) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(tables[0].get(), &chunk_store, 0, 50);
+
+  TFRecordCheckpointer checkpointer(MakeRoot());
+  std::string path;
+  Checkpointer::SaveStats stats;
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1,
+                                 Checkpointer::SaveOptions(), &path, &stats));
+  EXPECT_GT(stats.num_bytes_written, 0);
+
+  // Only the table is written again as the chunks have been persisted.
+  Checkpointer::SaveOptions options;
+  options.max_bytes_per_second = stats.num_bytes_written;
+  Checkpointer::SaveStats incremental_stats;
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, options, &path,
+                                 &incremental_stats));
+  EXPECT_LT(incremental_stats.num_bytes_written, stats.num_bytes_written);
+
+  // Writing more than `max_bytes_per_second` takes more than a second.
+  InsertItems(tables[0].get(), &chunk_store, 50, 150);
+  Checkpointer::SaveStats throttled_stats;
+  const absl::Time start = absl::Now();
+  TF_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, options, &path,
+                                 &throttled_stats));
+  EXPECT_GT(throttled_stats.num_bytes_written, stats.num_bytes_written);
+  EXPECT_GE(absl::Now() - start, absl::Seconds(1));
+}
+
 TEST(TFRecordCheckpointerTest, KeepLatestZeroReturnsError) {
   ChunkStore chunk_store;
 
@@ -46,11 +46,41 @@ class Thread {
   Thread() = default;
 };
 
+// Runs closures on a fixed set of threads which can be shared by many objects,
+// e.g a `ThreadPool` (see ../support/thread_pool.h). Used by components which
+// would otherwise start a dedicated (mostly idle) thread per instance to bound
+// the number of threads of a process.
+//
+// Implementations must be thread-safe.
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  // Schedules `fn` to be run by one of the threads of the executor.
+  virtual void Schedule(std::function<void()> fn) = 0;
+
+  // The maximum number of closures which run concurrently.
+  virtual int num_threads() const = 0;
+};
+
 // Starts a new thread that executes (a copy of) fn. The `name_prefix` may be
-// used by the implementation to label the new thread.
+// used by the implementation to label the new thread. The default
+// implementation names the thread after (the first 15 characters of)
+// `name_prefix` so that profiles can be attributed to it.
 std::unique_ptr<Thread> StartThread(absl::string_view name_prefix,
                                     std::function<void()> fn);
 
+// Same as above if `executor` is null. Otherwise `fn` is scheduled on
+// `executor` and the returned object blocks until `fn` has returned when
+// destroyed. A long running `fn` occupies a thread of `executor` until it
+// returns, so `executor` bounds how many of them run at the same time and the
+// others only start once a thread becomes available. If `fn` has not started
+// when the returned object is destroyed then it is never run. The thread of
+// `executor` is labelled like above while it runs `fn`.
+std::unique_ptr<Thread> StartThread(Executor* executor,
+                                    absl::string_view name_prefix,
+                                    std::function<void()> fn);
+
 }  // namespace internal
 }  // namespace reverb
 }  // namespace deepmind
@@ -14,6 +14,12 @@
 
 #include "reverb/cc/platform/thread.h"
 
+#include <pthread.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/synchronization/notification.h"
@@ -34,6 +40,98 @@ TEST(ThreadStdTest, ThreadRuns) {
   EXPECT_EQ(x, 7);
 }
 
+// Holds the scheduled closures until `RunAll` is called.
+class ManualExecutor : public Executor {
+ public:
+  void Schedule(std::function<void()> fn) override {
+    pending_.push_back(std::move(fn));
+  }
+
+  int num_threads() const override { return 1; }
+
+  void RunAll() {
+    for (auto& fn : pending_) fn();
+    pending_.clear();
+  }
+
+  int num_pending() const { return pending_.size(); }
+
+ private:
+  std::vector<std::function<void()>> pending_;
+};
+
+TEST(ThreadExecutorTest, NullExecutorStartsThread) {
+  absl::Notification n;
+  auto t = StartThread(nullptr, "", [&n] { n.Notify(); });
+  n.WaitForNotification();
+}
+
+TEST(ThreadExecutorTest, RunsOnExecutor) {
+  ManualExecutor executor;
+  int x = 0;
+  auto t = StartThread(&executor, "", [&x] { x = 7; });
+  EXPECT_EQ(executor.num_pending(), 1);
+  EXPECT_EQ(x, 0);
+  executor.RunAll();
+  EXPECT_EQ(x, 7);
+  t = nullptr;
+}
+
+TEST(ThreadExecutorTest, DestructorWaitsForRunningClosure) {
+  ManualExecutor executor;
+  absl::Notification started;
+  absl::Notification release;
+  bool done = false;
+  auto t = StartThread(&executor, "", [&] {
+    started.Notify();
+    release.WaitForNotification();
+    done = true;
+  });
+  auto runner = StartThread("", [&executor] { executor.RunAll(); });
+  started.WaitForNotification();
+  auto joiner = StartThread("", [&t] { t = nullptr; });
+  release.Notify();
+  joiner = nullptr;
+  EXPECT_TRUE(done);
+}
+
+#if defined(__linux__)
+std::string CurrentThreadName() {
+  char name[64] = {0};
+  pthread_getname_np(pthread_self(), name, sizeof(name));
+  return name;
+}
+
+TEST(ThreadStdTest, ThreadIsNamedAfterPrefix) {
+  std::string name;
+  auto t = StartThread("WriterItemConfirmer",
+                       [&name] { name = CurrentThreadName(); });
+  t = nullptr;
+  EXPECT_EQ(name, "WriterItemConfi");
+}
+
+TEST(ThreadExecutorTest, ExecutorThreadIsNamedWhileRunning) {
+  ManualExecutor executor;
+  std::string name;
+  auto t = StartThread(&executor, "SamplerWorker",
+                       [&name] { name = CurrentThreadName(); });
+  const std::string before = CurrentThreadName();
+  executor.RunAll();
+  t = nullptr;
+  EXPECT_EQ(name, "SamplerWorker");
+  EXPECT_EQ(CurrentThreadName(), before);
+}
+#endif
+
+TEST(ThreadExecutorTest, ClosureNotRunIfDestroyedBeforeStart) {
+  ManualExecutor executor;
+  bool ran = false;
+  auto t = StartThread(&executor, "", [&ran] { ran = true; });
+  t = nullptr;
+  executor.RunAll();
+  EXPECT_FALSE(ran);
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace reverb
@@ -0,0 +1,41 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_ZSTD_H_
+#define REVERB_CC_PLATFORM_ZSTD_H_
+
+#include <cstddef>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Compresses `input` with zstd at compression level `level` and stores the
+// result in `output`. CHECK-fails if zstd rejects the arguments, e.g an
+// invalid `level`.
+void ZstdCompressFromString(absl::string_view input, int level,
+                            std::string* output);
+
+// Uncompresses an `input` containing zstd-compressed data to the
+// `output_size` bytes at `output`. Returns false if `input` is corrupt or
+// does not uncompress to exactly `output_size` bytes.
+bool ZstdUncompressToBuffer(absl::string_view input, size_t output_size,
+                            char* output);
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_ZSTD_H_
@@ -15,20 +15,25 @@
 #include "reverb/cc/rate_limiter.h"
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <string>
 #include <utility>
 
 #include "google/protobuf/duration.pb.h"
 #include <cstdint>
 #include "absl/base/thread_annotations.h"
-#include "absl/container/fixed_array.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/errors.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/tracing.h"
 #include "reverb/cc/table.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -46,10 +51,45 @@ inline void EncodeAsDurationProto(const absl::Duration& d,
       absl::ToInt64Nanoseconds(d - absl::Seconds(proto->seconds())));
 }
 
+// Calls the pending callbacks, oldest first, until one of them returns true.
+void CallOldest(std::deque<std::function<bool()>>* callbacks) {
+  while (!callbacks->empty()) {
+    auto callback = std::move(callbacks->front());
+    callbacks->pop_front();
+    if (callback()) return;
+  }
+}
+
+// Calls and removes all pending callbacks.
+void CallAll(std::deque<std::function<bool()>>* callbacks) {
+  std::deque<std::function<bool()>> pending;
+  std::swap(pending, *callbacks);
+  for (auto& callback : pending) {
+    callback();
+  }
+}
+
+// Returns the largest `n` in [0, `max`] for which `allowed(n)` holds. `allowed`
+// must hold for all values smaller than such an `n`.
+int LargestAllowed(int max, const std::function<bool(int)>& allowed) {
+  int lo = 0;
+  int hi = max;
+  while (lo < hi) {
+    const int mid = lo + (hi - lo + 1) / 2;
+    if (allowed(mid)) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
 }  // namespace
 
-RateLimiter::RateLimiter(double samples_per_insert, int64_t min_size_to_sample,
-                         double min_diff, double max_diff)
+RateLimiter::RateLimiter(
+    double samples_per_insert, int64_t min_size_to_sample, double min_diff,
+    double max_diff, const RateLimiterEventHistoryOptions& history_options)
     : samples_per_insert_(samples_per_insert),
       min_diff_(min_diff),
       max_diff_(max_diff),
@@ -58,55 +98,80 @@ RateLimiter::RateLimiter(double samples_per_insert, int64_t min_size_to_sample,
       samples_(0),
       deletes_(0),
       cancelled_(false),
-      insert_stats_(),
-      sample_stats_() {
+      insert_stats_(history_options),
+      sample_stats_(history_options) {
   REVERB_CHECK_GT(min_size_to_sample, 0);
 }
 
-RateLimiter::RateLimiter(const RateLimiterCheckpoint& checkpoint)
+RateLimiter::RateLimiter(
+    const RateLimiterCheckpoint& checkpoint,
+    const RateLimiterEventHistoryOptions& history_options)
     : RateLimiter(/*samples_per_insert=*/checkpoint.samples_per_insert(),
                   /*min_size_to_sample=*/
                   checkpoint.min_size_to_sample(),
                   /*min_diff=*/checkpoint.min_diff(),
-                  /*max_diff=*/checkpoint.max_diff()) {
+                  /*max_diff=*/checkpoint.max_diff(), history_options) {
   inserts_ = checkpoint.insert_count();
   samples_ = checkpoint.sample_count();
   deletes_ = checkpoint.delete_count();
 }
 
 tensorflow::Status RateLimiter::RegisterTable(Table* table) {
-  if (table_) {
+  absl::MutexLock lock(&table_mu_);
+  if (std::find(tables_.begin(), tables_.end(), table) != tables_.end()) {
     return tensorflow::errors::FailedPrecondition(
-        "Attempting to registering a table ", table, " (name: ", table->name(),
-        ") with RateLimiter when is ",
-        "already registered with this limiter: ", table_,
-        " (name: ", table_->name(), ")");
+        "Attempting to register table ", table->name(),
+        " with a RateLimiter which it already is registered with.");
   }
-  table_ = table;
+  tables_.push_back(table);
   return tensorflow::Status::OK();
 }
 
 void RateLimiter::UnregisterTable(absl::Mutex* mu, Table* table) {
-  REVERB_CHECK_EQ(table, table_)
-      << "The wrong Table attempted to unregister this rate limiter.";
+  const int64_t num_items = table->size();
   absl::MutexLock lock(mu);
-  Reset(mu);
-  table_ = nullptr;
+  auto it = std::find(tables_.begin(), tables_.end(), table);
+  REVERB_CHECK(it != tables_.end())
+      << "The wrong Table attempted to unregister this rate limiter.";
+  ResetTable(mu, num_items);
+  tables_.erase(it);
+}
+
+void RateLimiter::ResetTable(absl::Mutex* mu, int64_t num_items) {
+  if (tables_.size() <= 1) {
+    Reset(mu);
+  } else {
+    deletes_ += num_items;
+    MaybeSignalCondVars(mu);
+  }
 }
 
 tensorflow::Status RateLimiter::AwaitCanInsert(absl::Mutex* mu,
                                                absl::Duration timeout) {
+  int num_inserts;
+  return AwaitCanInsert(mu, 1, &num_inserts, timeout);
+}
+
+tensorflow::Status RateLimiter::AwaitCanInsert(absl::Mutex* mu,
+                                               int max_inserts,
+                                               int* num_inserts,
+                                               absl::Duration timeout) {
+  REVERB_CHECK_GT(max_inserts, 0);
   const auto deadline = absl::Now() + timeout;
   {
-    auto event = insert_stats_.CreateEvent(mu);
+    auto event = insert_stats_.CreateEvent();
+    absl::optional<internal::ScopedSpan> span;
     while (!cancelled_ && !CanInsert(mu, 1)) {
       event.set_was_blocked();
+      if (!span.has_value()) span.emplace("RateLimiter::AwaitCanInsert");
       if (can_insert_cv_.WaitWithDeadline(mu, deadline)) {
         return errors::RateLimiterTimeout();
       }
     }
   }
   TF_RETURN_IF_ERROR(CheckIfCancelled());
+  *num_inserts = LargestAllowed(
+      max_inserts, [&](int n) { return n == 0 || CanInsert(mu, n); });
   return tensorflow::Status::OK();
 }
 
@@ -129,12 +194,25 @@ void RateLimiter::Reset(absl::Mutex* mu) {
 
 tensorflow::Status RateLimiter::AwaitAndFinalizeSample(absl::Mutex* mu,
                                                        absl::Duration timeout) {
+  int num_samples;
+  TF_RETURN_IF_ERROR(AwaitCanSample(mu, 1, &num_samples, timeout));
+  Sample(mu, num_samples);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status RateLimiter::AwaitCanSample(absl::Mutex* mu,
+                                               int max_samples,
+                                               int* num_samples,
+                                               absl::Duration timeout) {
+  REVERB_CHECK_GT(max_samples, 0);
   const auto deadline = absl::Now() + timeout;
 
   {
-    auto event = sample_stats_.CreateEvent(mu);
+    auto event = sample_stats_.CreateEvent();
+    absl::optional<internal::ScopedSpan> span;
     while (!cancelled_ && !CanSample(mu, 1)) {
       event.set_was_blocked();
+      if (!span.has_value()) span.emplace("RateLimiter::AwaitCanSample");
       if (can_sample_cv_.WaitWithDeadline(mu, deadline)) {
         return errors::RateLimiterTimeout();
       }
@@ -143,14 +221,20 @@ tensorflow::Status RateLimiter::AwaitAndFinalizeSample(absl::Mutex* mu,
 
   TF_RETURN_IF_ERROR(CheckIfCancelled());
 
-  samples_++;
-  MaybeSignalCondVars(mu);
+  *num_samples = LargestAllowed(
+      max_samples, [&](int n) { return n == 0 || CanSample(mu, n); });
   return tensorflow::Status::OK();
 }
 
+void RateLimiter::Sample(absl::Mutex* mu, int num_samples) {
+  if (num_samples == 0) return;
+  samples_ += num_samples;
+  MaybeSignalCondVars(mu);
+}
+
 bool RateLimiter::CanSample(absl::Mutex*, int num_samples) const {
   REVERB_CHECK_GT(num_samples, 0);
-  if (inserts_ - deletes_ < min_size_to_sample_) {
+  if (num_sample_blocks_ > 0 || inserts_ - deletes_ < min_size_to_sample_) {
     return false;
   }
   double diff = inserts_ * samples_per_insert_ - samples_ - num_samples;
@@ -168,10 +252,30 @@ bool RateLimiter::CanInsert(absl::Mutex*, int num_inserts) const {
   return diff <= max_diff_;
 }
 
+void RateLimiter::NotifyWhenCanSample(absl::Mutex* mu,
+                                      std::function<bool()> callback) {
+  if (cancelled_ || CanSample(mu, 1)) {
+    callback();
+  } else {
+    can_sample_callbacks_.push_back(std::move(callback));
+  }
+}
+
+void RateLimiter::NotifyWhenCanInsert(absl::Mutex* mu,
+                                      std::function<bool()> callback) {
+  if (cancelled_ || CanInsert(mu, 1)) {
+    callback();
+  } else {
+    can_insert_callbacks_.push_back(std::move(callback));
+  }
+}
+
 void RateLimiter::Cancel(absl::Mutex*) {
   cancelled_ = true;
   can_insert_cv_.SignalAll();
   can_sample_cv_.SignalAll();
+  CallAll(&can_insert_callbacks_);
+  CallAll(&can_sample_callbacks_);
 }
 
 RateLimiterCheckpoint RateLimiter::CheckpointReader(absl::Mutex*) const {
@@ -192,15 +296,29 @@ tensorflow::Status RateLimiter::CheckIfCancelled() const {
   return tensorflow::errors::Cancelled("RateLimiter has been cancelled");
 }
 
+void RateLimiter::BlockSamples(absl::Mutex*) { num_sample_blocks_++; }
+
+void RateLimiter::UnblockSamples(absl::Mutex* mu) {
+  REVERB_CHECK_GT(num_sample_blocks_, 0);
+  num_sample_blocks_--;
+  MaybeSignalCondVars(mu);
+}
+
 void RateLimiter::MaybeSignalCondVars(absl::Mutex* mu) {
-  if (CanInsert(mu, 1)) can_insert_cv_.Signal();
-  if (CanSample(mu, 1)) can_sample_cv_.Signal();
+  if (CanInsert(mu, 1)) {
+    can_insert_cv_.Signal();
+    CallOldest(&can_insert_callbacks_);
+  }
+  if (CanSample(mu, 1)) {
+    can_sample_cv_.Signal();
+    CallOldest(&can_sample_callbacks_);
+  }
 }
 
-RateLimiterInfo RateLimiter::Info(absl::Mutex* mu) const {
+RateLimiterInfo RateLimiter::Info(absl::Mutex*) const {
   RateLimiterInfo info_proto = InfoWithoutCallStats();
-  insert_stats_.ToProto(mu, info_proto.mutable_insert_stats());
-  sample_stats_.ToProto(mu, info_proto.mutable_sample_stats());
+  insert_stats_.ToProto(info_proto.mutable_insert_stats());
+  sample_stats_.ToProto(info_proto.mutable_sample_stats());
   return info_proto;
 }
 
@@ -213,99 +331,173 @@ RateLimiterInfo RateLimiter::InfoWithoutCallStats() const {
   return info_proto;
 }
 
+void RateLimiter::ExportMetrics(const RateLimiterInfo& info,
+                                const internal::MetricLabels& labels,
+                                internal::MetricsWriter* writer) {
+  for (const auto& call : {std::make_pair("insert", &info.insert_stats()),
+                           std::make_pair("sample", &info.sample_stats())}) {
+    internal::MetricLabels call_labels = labels;
+    call_labels.emplace_back("call", call.first);
+    const RateLimiterCallStats& stats = *call.second;
+    writer->AddCounter("reverb_rate_limiter_calls_total",
+                       "Calls which have been admitted by the rate limiter.",
+                       call_labels, stats.completed());
+    writer->AddCounter("reverb_rate_limiter_limited_calls_total",
+                       "Admitted calls which had to wait for the rate "
+                       "limiter.",
+                       call_labels, stats.limited());
+    writer->AddGauge("reverb_rate_limiter_pending_calls",
+                     "Calls which are waiting for the rate limiter.",
+                     call_labels, stats.pending());
+    writer->AddCounter("reverb_rate_limiter_wait_seconds_total",
+                       "Time that the admitted calls waited for the rate "
+                       "limiter.",
+                       call_labels,
+                       stats.completed_wait_time().seconds() +
+                           stats.completed_wait_time().nanos() * 1e-9);
+  }
+}
+
 RateLimiterEventHistory RateLimiter::GetEventHistory(
-    absl::Mutex* mu, size_t min_insert_event_id,
-    size_t min_sample_event_id) const {
-  return {insert_stats_.GetEventHistory(mu, min_insert_event_id),
-          sample_stats_.GetEventHistory(mu, min_sample_event_id)};
+    size_t min_insert_event_id, size_t min_sample_event_id) const {
+  return {insert_stats_.GetEventHistory(min_insert_event_id),
+          sample_stats_.GetEventHistory(min_sample_event_id)};
 }
 
-RateLimiter::StatsManager::StatsManager()
-    : events_(kEventHistoryBufferSize),
+RateLimiter::StatsManager::StatsManager(
+    const RateLimiterEventHistoryOptions& options)
+    : capacity_(options.capacity),
+      recording_period_(options.recording_period),
+      slots_(capacity_ > 0 ? absl::make_unique<Slot[]>(capacity_) : nullptr),
+      created_at_(absl::Now()),
       next_event_id_(0),
-      active_(),
+      next_position_(0),
+      pending_(0),
+      pending_start_us_(0),
       completed_(0),
       limited_(0),
-      total_wait_(absl::ZeroDuration()) {}
-
-RateLimiter::StatsManager::ScopedEvent RateLimiter::StatsManager::CreateEvent(
-    absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) {
-  // IDs are incremented with each event and the fixed size of `events_` means
-  // that it is theoretically possible for collisions between active events.
-  // However, this is EXTREMELY unlikely in practice as it would require
-  // `kEventHistoryBufferSize` (very large) calls to be blocked concurrently
-  // which would grind the system to a halt long before the buffer is exceeded.
-  const size_t id = next_event_id_++;
-  events_[id % events_.size()] = {id, absl::Now(), absl::ZeroDuration()};
-  active_.insert(id);
-  return ScopedEvent(this, &events_[id % events_.size()]);
-}
-
-void RateLimiter::StatsManager::CompleteEvent(RateLimiterEvent* event) {
-  active_.erase(event->id);
-  completed_++;
-  limited_ += event->blocked_for > absl::ZeroDuration() ? 1 : 0;
-  total_wait_ += event->blocked_for;
-}
-
-void RateLimiter::StatsManager::ToProto(absl::Mutex* mu,
-                                        RateLimiterCallStats* proto) const
-    ABSL_SHARED_LOCKS_REQUIRED(mu) {
-  const auto now = absl::Now();
-
-  proto->set_pending(active_.size());
-  proto->set_completed(completed_);
-  proto->set_limited(limited_);
-  EncodeAsDurationProto(total_wait_, proto->mutable_completed_wait_time());
-  absl::Duration pending_wait_time;
-  for (size_t id : active_) {
-    pending_wait_time += now - events_[id % events_.size()].start;
-  }
-  EncodeAsDurationProto(pending_wait_time, proto->mutable_pending_wait_time());
+      total_wait_ns_(0) {
+  REVERB_CHECK_GE(recording_period_, 1);
 }
 
-std::vector<RateLimiterEvent> RateLimiter::StatsManager::GetEventHistory(
-    absl::Mutex* mu, size_t min_event_id) const ABSL_SHARED_LOCKS_REQUIRED(mu) {
-  REVERB_CHECK_LE(min_event_id, next_event_id_);
-
-  if (const auto diff = next_event_id_ - min_event_id; diff >= events_.size()) {
-    REVERB_LOG(REVERB_ERROR)
-        << "Requested rate limiter events older that the maximum age. Request "
-           "will be rewritten to include the last "
-        << events_.size() << " events. This mean that (up to) "
-        << diff - events_.size() << " events will be ignored";
-    min_event_id = next_event_id_ - events_.size();
-  }
+RateLimiter::StatsManager::ScopedEvent
+RateLimiter::StatsManager::CreateEvent() {
+  return ScopedEvent(this,
+                     next_event_id_.fetch_add(1, std::memory_order_relaxed));
+}
 
-  // Non inclusive upper limit.
-  const size_t max_event_id =
-      active_.empty() ? next_event_id_
-                      : *std::min_element(active_.begin(), active_.end());
-  if (max_event_id < min_event_id + 1) {
-    return {};
-  }
+bool RateLimiter::StatsManager::IsRecorded(size_t id) const {
+  return capacity_ > 0 && id % recording_period_ == 0;
+}
+
+int64_t RateLimiter::StatsManager::MicrosSinceCreation(absl::Time time) const {
+  return absl::ToInt64Microseconds(time - created_at_);
+}
+
+void RateLimiter::StatsManager::StartBlocking(absl::Time start) {
+  pending_start_us_.fetch_add(MicrosSinceCreation(start),
+                              std::memory_order_relaxed);
+  pending_.fetch_add(1, std::memory_order_relaxed);
+}
 
-  std::vector<RateLimiterEvent> copy(max_event_id - min_event_id - 1);
-  for (size_t i = 0; i < copy.size(); i++) {
-    copy[i] = events_[(min_event_id + i) % events_.size()];
+void RateLimiter::StatsManager::CompleteEvent(size_t id, bool was_blocked,
+                                              absl::Time start) {
+  const bool recorded = IsRecorded(id);
+  const absl::Time now =
+      was_blocked || recorded ? absl::Now() : absl::InfinitePast();
+  const absl::Duration blocked_for =
+      was_blocked ? now - start : absl::ZeroDuration();
+
+  if (was_blocked) {
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    pending_start_us_.fetch_sub(MicrosSinceCreation(start),
+                                std::memory_order_relaxed);
+    limited_.fetch_add(1, std::memory_order_relaxed);
+    total_wait_ns_.fetch_add(absl::ToInt64Nanoseconds(blocked_for),
+                             std::memory_order_relaxed);
   }
+  completed_.fetch_add(1, std::memory_order_relaxed);
+
+  if (!recorded) return;
+
+  // Events complete while the lock of the parent table is held so writers
+  // never race each other. Readers don't take the lock and instead use the
+  // sequence of the slot to detect writes which overlapped with their copy.
+  const uint64_t position =
+      next_position_.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = slots_[position % capacity_];
+  slot.sequence.store(2 * position + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.id.store(id, std::memory_order_relaxed);
+  slot.start_ns.store(absl::ToUnixNanos(was_blocked ? start : now),
+                      std::memory_order_relaxed);
+  slot.blocked_for_ns.store(absl::ToInt64Nanoseconds(blocked_for),
+                            std::memory_order_relaxed);
+  slot.sequence.store(2 * (position + 1), std::memory_order_release);
+}
 
-  return copy;
+void RateLimiter::StatsManager::ToProto(RateLimiterCallStats* proto) const {
+  const int64_t now_us = MicrosSinceCreation(absl::Now());
+  const int64_t pending = pending_.load(std::memory_order_relaxed);
+  const int64_t pending_start_us =
+      pending_start_us_.load(std::memory_order_relaxed);
+
+  proto->set_pending(pending);
+  proto->set_completed(completed_.load(std::memory_order_relaxed));
+  proto->set_limited(limited_.load(std::memory_order_relaxed));
+  EncodeAsDurationProto(
+      absl::Nanoseconds(total_wait_ns_.load(std::memory_order_relaxed)),
+      proto->mutable_completed_wait_time());
+  EncodeAsDurationProto(
+      absl::Microseconds(std::max<int64_t>(
+          pending * now_us - pending_start_us, 0)),
+      proto->mutable_pending_wait_time());
+}
+
+std::vector<RateLimiterEvent> RateLimiter::StatsManager::GetEventHistory(
+    size_t min_event_id) const {
+  std::vector<RateLimiterEvent> events;
+  if (capacity_ == 0) return events;
+
+  const uint64_t end = next_position_.load(std::memory_order_acquire);
+  const uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+  events.reserve(end - begin);
+  for (uint64_t position = begin; position < end; position++) {
+    const Slot& slot = slots_[position % capacity_];
+    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    RateLimiterEvent event = {
+        slot.id.load(std::memory_order_relaxed),
+        absl::FromUnixNanos(slot.start_ns.load(std::memory_order_relaxed)),
+        absl::Nanoseconds(slot.blocked_for_ns.load(std::memory_order_relaxed)),
+    };
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Skip slots which are still being written or which have been overwritten
+    // by a more recent event while they were copied.
+    if (sequence != 2 * (position + 1) ||
+        slot.sequence.load(std::memory_order_relaxed) != sequence) {
+      continue;
+    }
+    if (event.id >= min_event_id) {
+      events.push_back(event);
+    }
+  }
+  return events;
 }
 
 RateLimiter::StatsManager::ScopedEvent::ScopedEvent(
-    RateLimiter::StatsManager* parent, RateLimiterEvent* event)
-    : parent_(parent), event_(event), was_blocked_(false) {}
+    RateLimiter::StatsManager* parent, size_t id)
+    : parent_(parent), id_(id), was_blocked_(false) {}
 
 void RateLimiter::StatsManager::ScopedEvent::set_was_blocked() {
+  if (was_blocked_) return;
   was_blocked_ = true;
+  start_ = absl::Now();
+  parent_->StartBlocking(start_);
 }
 
 RateLimiter::StatsManager::ScopedEvent::~ScopedEvent() {
-  if (was_blocked_) {
-    event_->blocked_for = absl::Now() - event_->start;
-  }
-  parent_->CompleteEvent(event_);
+  parent_->CompleteEvent(id_, was_blocked_, start_);
 }
 
 }  // namespace reverb
@@ -15,15 +15,19 @@
 #ifndef REVERB_CC_RATE_LIMITER_H_
 #define REVERB_CC_RATE_LIMITER_H_
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <cstdint>
 #include "absl/base/thread_annotations.h"
-#include "absl/container/fixed_array.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
-#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/metrics.h"
 #include "reverb/cc/schema.pb.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -34,8 +38,8 @@ class Table;
 
 constexpr absl::Duration kDefaultTimeout = absl::InfiniteDuration();
 
-// Maximum number of events in the ciruclar buffer owned by the StatsManager.
-constexpr size_t kEventHistoryBufferSize = 1000000;
+// Default number of events in the circular buffers owned by the StatsManagers.
+constexpr size_t kDefaultEventHistoryCapacity = 1 << 16;
 
 // Details about the waiting time for a call to the RateLimiter.
 struct RateLimiterEvent {
@@ -56,16 +60,45 @@ struct RateLimiterEventHistory {
   std::vector<RateLimiterEvent> sample;
 };
 
+// Configures which calls are recorded in the event history of a RateLimiter.
+// The call stats are exact regardless of these options.
+struct RateLimiterEventHistoryOptions {
+  // Maximum number of events kept per call type (sample/insert). Once the
+  // buffer is full the oldest events are overwritten. If 0 then no events are
+  // recorded.
+  size_t capacity = kDefaultEventHistoryCapacity;
+
+  // Only every `recording_period`-th call is recorded. Must be >= 1.
+  int64_t recording_period = 1;
+};
+
 // RateLimiter manages the data throughput for a `Table` by blocking
 // sample or insert calls if the ratio between the two deviates too much from
 // the ratio specified by `samples_per_insert`.
+//
+// A RateLimiter can be registered with several tables. The inserts and samples
+// of all of them are then counted against a single budget, which keeps the
+// ratios of tables that are written and sampled together from drifting apart.
+// The tables use the lock owned by the RateLimiter (see `table_mu_`) so a
+// single wait covers the whole group.
+//
+// Admitting the items of a group together is best effort. The server admits
+// items for several tables of a group at once only if they arrive in the same
+// batch of an insert stream, i.e. back to back and before the stream runs dry.
+// There is no marker of a group on the wire, so the items a writer creates for
+// the tables of a group may still be admitted one at a time. Checkpoints store
+// the state of the rate limiter per table and can't restore a shared one, so
+// saving tables which share a rate limiter fails.
 class RateLimiter {
  public:
   RateLimiter(double samples_per_insert, int64_t min_size_to_sample,
-              double min_diff, double max_diff);
+              double min_diff, double max_diff,
+              const RateLimiterEventHistoryOptions& history_options = {});
 
   // Construct and restore a RateLimiter from a previous checkpoint.
-  explicit RateLimiter(const RateLimiterCheckpoint& checkpoint);
+  explicit RateLimiter(
+      const RateLimiterCheckpoint& checkpoint,
+      const RateLimiterEventHistoryOptions& history_options = {});
 
   // Waits until the insert operation can proceed without violating the
   // conditions of the rate limiter.
@@ -78,6 +111,16 @@ class RateLimiter {
                                     absl::Duration timeout = kDefaultTimeout)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+  // Same as above but reserves a range of inserts in one step. Waits until at
+  // least one insert can proceed and then sets `num_inserts` to the number of
+  // inserts, at most `max_inserts`, that can proceed right away. The state is
+  // not modified and `Insert` must be called for every item that is inserted
+  // without releasing the lock in between. Dies if `max_inserts` is < 1.
+  tensorflow::Status AwaitCanInsert(absl::Mutex* mu, int max_inserts,
+                                    int* num_inserts,
+                                    absl::Duration timeout = kDefaultTimeout)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
   // Waits until the sample operation can proceed without violating the
   // conditions of the rate limiter. If the condition is fulfilled before the
   // timeout expires or `Cancel` called then the state is updated.
@@ -85,11 +128,28 @@ class RateLimiter {
       absl::Mutex* mu, absl::Duration timeout = kDefaultTimeout)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+  // Waits until at least one sample can proceed and then sets `num_samples` to
+  // the number of samples, at most `max_samples`, that can proceed right away.
+  // This allows a batch to be admitted with a single wakeup rather than one per
+  // sample. The state is not modified and the caller must call `Sample` with
+  // the number of samples it took without releasing the lock in between. Dies
+  // if `max_samples` is < 1.
+  tensorflow::Status AwaitCanSample(absl::Mutex* mu, int max_samples,
+                                    int* num_samples,
+                                    absl::Duration timeout = kDefaultTimeout)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
   // Register that an item has been inserted into the table. Caller must call
   // `AwaitCanInsert` before calling this method without releasing the lock in
   // between.
   void Insert(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+  // Register that `num_samples` items have been sampled from the table. Caller
+  // must call `AwaitCanSample` before calling this method without releasing the
+  // lock in between.
+  void Sample(absl::Mutex* mu, int num_samples)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
   // Register that an item have been deleted from the table.
   void Delete(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
@@ -99,6 +159,23 @@ class RateLimiter {
   // Unblocks any `Await` calls with a Cancelled-status.
   void Cancel(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+  // Calls `callback` once the state allows for a sample (respectively insert)
+  // operation to proceed or `Cancel` has been called. If this already is the
+  // case then `callback` is called right away. This allows callers to wait for
+  // the rate limiter without blocking a thread.
+  //
+  // Like the signals of the `Await` methods, every state change only "wakes"
+  // the oldest pending callback. The callback returns false if its caller no
+  // longer waits, in which case the next callback is called instead. All
+  // callbacks are called when the rate limiter is cancelled. The callback is
+  // called while `mu` is held so it must neither block nor call back into the
+  // table. Note that the operation may be claimed by another caller before the
+  // notified caller has retried it.
+  void NotifyWhenCanSample(absl::Mutex* mu, std::function<bool()> callback)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+  void NotifyWhenCanInsert(absl::Mutex* mu, std::function<bool()> callback)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
   // Returns true iff the current state would allow for `num_samples` to be
   // sampled. Dies if `num_samples` is < 1.
   bool CanSample(absl::Mutex* mu, int num_samples) const
@@ -120,30 +197,56 @@ class RateLimiter {
   // table.
   RateLimiterInfo InfoWithoutCallStats() const;
 
-  // Creates a copy of all COMPLETED events created since (inclusive)
-  // `min_X_event_id`.
-  RateLimiterEventHistory GetEventHistory(absl::Mutex* mu,
-                                          size_t min_insert_event_id,
-                                          size_t min_sample_event_id) const
-      ABSL_SHARED_LOCKS_REQUIRED(mu);
+  // Exports the call stats of `info`, as returned by `Info`, with `labels`.
+  static void ExportMetrics(const RateLimiterInfo& info,
+                            const internal::MetricLabels& labels,
+                            internal::MetricsWriter* writer);
+
+  // Creates a copy of the recorded COMPLETED events created since (inclusive)
+  // `min_X_event_id`, in the order in which they completed. Note that blocked
+  // calls complete after calls which were created later but weren't blocked.
+  // Only the most recent events are kept so older events may be missing. Does
+  // not require the lock of the parent table.
+  RateLimiterEventHistory GetEventHistory(size_t min_insert_event_id,
+                                          size_t min_sample_event_id) const;
 
  private:
   friend class Table;
-  // `Table` calls these methods on construction and destruction.
+  // `Table` calls these methods on construction and destruction. The items of
+  // an unregistered table are removed from the budget of the remaining tables.
   tensorflow::Status RegisterTable(Table* table);
   void UnregisterTable(absl::Mutex* mu, Table* table) ABSL_LOCKS_EXCLUDED(mu);
 
+  // Register that `table`, which held `num_items` items, has been reset. The
+  // state is only fully reset if no other table shares the rate limiter.
+  void ResetTable(absl::Mutex* mu, int64_t num_items)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
   // Checks if sample and insert operations can proceed and if so calls `Signal`
-  // on respective `CondVar`
-  void MaybeSignalCondVars(absl::Mutex* mu) ABSL_SHARED_LOCKS_REQUIRED(mu);
+  // on respective `CondVar` and the oldest pending callback. Only a single
+  // waiter is woken as it reserves as many operations as it needs. Whatever it
+  // leaves is passed on to the next waiter once it has committed its share.
+  void MaybeSignalCondVars(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
   // Returns Cancelled-status if `Cancel` have been called.
   tensorflow::Status CheckIfCancelled() const;
 
-  // Pointer to the table. We expect this to be available (if set), since it's
-  // set by a Table calling RegisterTable(this) after it stores a shared_ptr to
-  // this RateLimiter;.
-  Table* table_ = nullptr;
+  // Blocks (unblocks) all samples regardless of the state. Used by `Table`
+  // while restoring a checkpoint in the background. Calls are counted so the
+  // tables of a group can block the shared rate limiter independently.
+  void BlockSamples(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+  void UnblockSamples(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
+  // Pointers to the tables. We expect these to be available, since they are
+  // added by a Table calling RegisterTable(this) after it stores a shared_ptr
+  // to this RateLimiter and removed before the Table is destroyed. Guarded by
+  // `table_mu_`.
+  std::vector<Table*> tables_;
+
+  // The lock of the registered tables. Sharing the lock between the tables of
+  // a group is what allows the state to be shared and the items of a group to
+  // be admitted atomically.
+  absl::Mutex table_mu_;
 
   // The desired ratio between sample ops and insert operations. This can be
   // interpreted as the average number of times each item is sampled during
@@ -173,88 +276,113 @@ class RateLimiter {
   // Whether `Cancel` has been called.
   bool cancelled_;
 
+  // Number of `BlockSamples` calls that have not been matched by a call to
+  // `UnblockSamples`. No samples are allowed while positive.
+  int num_sample_blocks_ = 0;
+
   // Signal called on respective cv if operation can proceed after state change.
   absl::CondVar can_insert_cv_;
   absl::CondVar can_sample_cv_;
 
-  // The StatsManager maintains a circular buffer of `RateLimiterEvent` and a
-  // set of all time stats for calls of a single type (sample/insert).
+  // Callbacks registered with `NotifyWhenCanInsert` and `NotifyWhenCanSample`
+  // that have not been called yet, oldest first.
+  std::deque<std::function<bool()>> can_insert_callbacks_;
+  std::deque<std::function<bool()>> can_sample_callbacks_;
+
+  // The StatsManager maintains a bounded circular buffer of `RateLimiterEvent`
+  // and a set of all time stats for calls of a single type (sample/insert).
+  // Neither requires the lock of the parent table: the stats are kept in
+  // atomics and the buffer is a seqlock protected ring which readers copy
+  // without blocking the writers.
   class StatsManager {
    public:
-    StatsManager();
+    explicit StatsManager(const RateLimiterEventHistoryOptions& options);
 
     // ScopedEvent automatically marks the event as completed when it goes out
     // of scope.
     class ScopedEvent {
      public:
-      ScopedEvent(StatsManager* parent, RateLimiterEvent* event);
+      ScopedEvent(StatsManager* parent, size_t id);
 
       // Should be called to indicate that the event was blocked for any time at
       // all. If this is never called then `blocked_for` will remain as
-      // ZeroDuration, ignoring the actual wall time.
+      // ZeroDuration, ignoring the actual wall time. The wait is measured from
+      // the first call.
       void set_was_blocked();
 
       ~ScopedEvent();
 
      private:
       StatsManager* parent_;
-      RateLimiterEvent* event_;
+      size_t id_;
       bool was_blocked_;
+      absl::Time start_;
     };
 
-    // Creates an event using the current time as `start`. The event object is
-    // owned by the StatsManager and the pointer must only be used within the
-    // RateLimiter.
-    ScopedEvent CreateEvent(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
-
-    // Marks the event as completed by removing it from `active_` and
-    // updating the summary metrics. This method should only be called by
-    // ScopedEvent.
-    void CompleteEvent(RateLimiterEvent* event);
+    // Creates an event with a new ID. Calls which aren't blocked only pay for
+    // reading the clock if the event is recorded in the history.
+    ScopedEvent CreateEvent();
 
     // Encode the current state as a `RateLimiterCallStats`-proto.
-    void ToProto(absl::Mutex* mu, RateLimiterCallStats* proto) const
-        ABSL_SHARED_LOCKS_REQUIRED(mu);
+    void ToProto(RateLimiterCallStats* proto) const;
 
-    // Creates a copy of all events starting from `min_event_id` until (but not
-    // including) the oldest active event. If no events are currently active
-    // all events from `min_event_id` are included in the copy.
-    std::vector<RateLimiterEvent> GetEventHistory(absl::Mutex* mu,
-                                                  size_t min_event_id) const
-        ABSL_SHARED_LOCKS_REQUIRED(mu);
+    // Creates a copy of all recorded events with an ID >= `min_event_id`.
+    std::vector<RateLimiterEvent> GetEventHistory(size_t min_event_id) const;
 
    private:
-    // Preallocated buffer of events to avoid allocation while holding the lock
-    // on the parent table. The size of the FIXED SIZE
-    // (`kEventHistoryBufferSize`) container is set in the constructor of
-    // StatsManager.
-    absl::FixedArray<RateLimiterEvent> events_;
-
-    // Event IDs are incremented with each created events. Since no concurrent
-    // operations are possible we can safely assume that events with larger IDs
-    // were started after events with smaller IDs.
-    size_t next_event_id_;
-
-    // IDs of events that currently are "active". An event is "active" until
-    // for as long as the call is blocked. If no blocking occurs then the event
-    // will be added and removed from the set while holding the lock and thus
-    // it is never possible to observe an active event that weren't blocked by
-    // the rate limiter.
-    absl::flat_hash_set<size_t> active_;
+    // A slot of the ring buffer. `sequence` is odd while the slot is written
+    // and otherwise `2 * (position + 1)` of the event it holds, which lets
+    // readers detect slots that were overwritten while they were copied.
+    struct Slot {
+      std::atomic<uint64_t> sequence{0};
+      std::atomic<size_t> id{0};
+      std::atomic<int64_t> start_ns{0};
+      std::atomic<int64_t> blocked_for_ns{0};
+    };
+
+    // Called by ScopedEvent.
+    void StartBlocking(absl::Time start);
+    void CompleteEvent(size_t id, bool was_blocked, absl::Time start);
+
+    // Returns true if the event `id` should be recorded in the history.
+    bool IsRecorded(size_t id) const;
+
+    // Returns the number of microseconds between `created_at_` and `time`.
+    int64_t MicrosSinceCreation(absl::Time time) const;
+
+    const size_t capacity_;
+    const int64_t recording_period_;
+    const std::unique_ptr<Slot[]> slots_;
+
+    // Pending calls are recorded relative to the creation time so that their
+    // sum doesn't overflow.
+    const absl::Time created_at_;
+
+    // Event IDs are incremented with each created event and thus reflect the
+    // order in which the calls were made.
+    std::atomic<size_t> next_event_id_;
+
+    // Number of slots that have been written to `slots_`.
+    std::atomic<uint64_t> next_position_;
+
+    // Number of calls that are currently blocked and the sum of the times when
+    // they started waiting.
+    std::atomic<int64_t> pending_;
+    std::atomic<int64_t> pending_start_us_;
 
     // Number of calls that have been completed.
-    int64_t completed_;
+    std::atomic<int64_t> completed_;
 
     // Number of calls that were blocked for any time at all.
-    int64_t limited_;
+    std::atomic<int64_t> limited_;
 
     // The total time spent waiting for the all the blocked COMPLETED calls.
     // Note that concurrent calls are counted independently so the value can be
     // much larger than the "wall time" since the rate limiter was created.
-    absl::Duration total_wait_;
+    std::atomic<int64_t> total_wait_ns_;
   };
 
-  // Summary statistics and a (large) buffers of recent events.
+  // Summary statistics and bounded buffers of recent events.
   StatsManager insert_stats_;
   StatsManager sample_stats_;
 };
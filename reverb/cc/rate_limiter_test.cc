@@ -14,6 +14,7 @@
 
 #include "reverb/cc/rate_limiter.h"
 
+#include <cfloat>
 #include <memory>
 #include <vector>
 
@@ -35,6 +36,7 @@ namespace {
 
 using ::deepmind::reverb::testing::EqualsProto;
 using ::deepmind::reverb::testing::Partially;
+using ::testing::SizeIs;
 
 constexpr absl::Duration kTimeout = absl::Milliseconds(100);
 
@@ -459,6 +461,211 @@ TEST(RateLimiterTest, Info) {
                           "}"));
 }
 
+TEST(RateLimiterTest, NotifyWhenCanSampleCallsOldestPendingCallback) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1, /*min_diff=*/0.0,
+                                    /*max_diff=*/1.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+
+  // The first callback no longer waits so the second one is called instead.
+  std::vector<int> calls;
+  limiter->NotifyWhenCanSample(&mu, [&] {
+    calls.push_back(1);
+    return false;
+  });
+  limiter->NotifyWhenCanSample(&mu, [&] {
+    calls.push_back(2);
+    return true;
+  });
+  limiter->NotifyWhenCanSample(&mu, [&] {
+    calls.push_back(3);
+    return true;
+  });
+  EXPECT_THAT(calls, ::testing::IsEmpty());
+
+  limiter->Insert(&mu);
+  EXPECT_THAT(calls, ::testing::ElementsAre(1, 2));
+
+  // Callbacks are called right away when the operation can proceed.
+  limiter->NotifyWhenCanSample(&mu, [&] {
+    calls.push_back(4);
+    return true;
+  });
+  EXPECT_THAT(calls, ::testing::ElementsAre(1, 2, 4));
+
+  // All pending callbacks are called when the rate limiter is cancelled.
+  TF_EXPECT_OK(limiter->AwaitAndFinalizeSample(&mu, kTimeout));
+  ASSERT_FALSE(limiter->CanSample(&mu, 1));
+  limiter->NotifyWhenCanSample(&mu, [&] {
+    calls.push_back(5);
+    return true;
+  });
+  limiter->Cancel(&mu);
+  EXPECT_THAT(calls, ::testing::ElementsAre(1, 2, 4, 3, 5));
+}
+
+TEST(RateLimiterTest, NotifyWhenCanInsertIsCalledAfterSample) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1, /*min_diff=*/0.0,
+                                    /*max_diff=*/1.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+
+  limiter->Insert(&mu);
+  bool called = false;
+  limiter->NotifyWhenCanInsert(&mu, [&] { return called = true; });
+  EXPECT_FALSE(called);
+
+  TF_EXPECT_OK(limiter->AwaitAndFinalizeSample(&mu, kTimeout));
+  EXPECT_TRUE(called);
+}
+
+TEST(RateLimiterTest, AwaitCanSampleReservesAsManySamplesAsAllowed) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/3.0,
+                                    /*min_size_to_sample=*/1, /*min_diff=*/0.0,
+                                    /*max_diff=*/10.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+  limiter->Insert(&mu);  // diff = 3.0.
+
+  int num_samples;
+  TF_EXPECT_OK(limiter->AwaitCanSample(&mu, 2, &num_samples, kTimeout));
+  EXPECT_EQ(num_samples, 2);
+  TF_EXPECT_OK(limiter->AwaitCanSample(&mu, 5, &num_samples, kTimeout));
+  EXPECT_EQ(num_samples, 3);
+
+  // The state is only updated once the samples are registered.
+  limiter->Sample(&mu, num_samples);  // diff = 0.0.
+  EXPECT_FALSE(limiter->CanSample(&mu, 1));
+  EXPECT_EQ(limiter->AwaitCanSample(&mu, 5, &num_samples, kTimeout).code(),
+            tensorflow::error::DEADLINE_EXCEEDED);
+}
+
+TEST(RateLimiterTest, AwaitCanInsertReservesAsManyInsertsAsAllowed) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/2, /*min_diff=*/0.0,
+                                    /*max_diff=*/3.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+
+  int num_inserts;
+  TF_EXPECT_OK(limiter->AwaitCanInsert(&mu, 10, &num_inserts, kTimeout));
+  EXPECT_EQ(num_inserts, 3);
+  for (int i = 0; i < num_inserts; i++) {
+    limiter->Insert(&mu);  // diff = 3.0.
+  }
+  EXPECT_EQ(limiter->AwaitCanInsert(&mu, 10, &num_inserts, kTimeout).code(),
+            tensorflow::error::DEADLINE_EXCEEDED);
+
+  limiter->Sample(&mu, 2);  // diff = 1.0.
+  TF_EXPECT_OK(limiter->AwaitCanInsert(&mu, 10, &num_inserts, kTimeout));
+  EXPECT_EQ(num_inserts, 2);
+}
+
+TEST(RateLimiterTest, SampleWakesSingleWaiterWithBatch) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1, /*min_diff=*/0.0,
+                                    /*max_diff=*/4.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+  for (int i = 0; i < 4; i++) {
+    limiter->Insert(&mu);
+  }
+  ASSERT_FALSE(limiter->CanInsert(&mu, 1));
+
+  int calls = 0;
+  for (int i = 0; i < 3; i++) {
+    limiter->NotifyWhenCanInsert(&mu, [&] {
+      calls++;
+      return true;
+    });
+  }
+
+  // Registering a batch of samples only wakes a single waiter.
+  limiter->Sample(&mu, 3);
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(RateLimiterTest, EventHistoryKeepsMostRecentEvents) {
+  RateLimiterEventHistoryOptions options;
+  options.capacity = 3;
+  auto limiter = std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX,
+                                               options);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+  for (int i = 0; i < 5; i++) {
+    TF_EXPECT_OK(limiter->AwaitCanInsert(&mu, kTimeout));
+    limiter->Insert(&mu);
+  }
+
+  auto history = limiter->GetEventHistory(0, 0);
+  ASSERT_THAT(history.insert, SizeIs(3));
+  EXPECT_EQ(history.insert[0].id, 2);
+  EXPECT_EQ(history.insert[1].id, 3);
+  EXPECT_EQ(history.insert[2].id, 4);
+  EXPECT_THAT(history.sample, ::testing::IsEmpty());
+  EXPECT_THAT(limiter->GetEventHistory(4, 0).insert, SizeIs(1));
+
+  // The call stats cover all calls.
+  EXPECT_EQ(limiter->Info(&mu).insert_stats().completed(), 5);
+}
+
+TEST(RateLimiterTest, EventHistoryRecordsEveryNthCall) {
+  RateLimiterEventHistoryOptions options;
+  options.recording_period = 2;
+  auto limiter = std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX,
+                                               options);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+  for (int i = 0; i < 5; i++) {
+    TF_EXPECT_OK(limiter->AwaitCanInsert(&mu, kTimeout));
+    limiter->Insert(&mu);
+  }
+
+  auto history = limiter->GetEventHistory(0, 0);
+  ASSERT_THAT(history.insert, SizeIs(3));
+  EXPECT_EQ(history.insert[0].id, 0);
+  EXPECT_EQ(history.insert[1].id, 2);
+  EXPECT_EQ(history.insert[2].id, 4);
+  for (const auto& event : history.insert) {
+    EXPECT_EQ(event.blocked_for, absl::ZeroDuration());
+  }
+  EXPECT_EQ(limiter->Info(&mu).insert_stats().completed(), 5);
+}
+
+TEST(RateLimiterTest, EventHistoryRecordsBlockedCalls) {
+  auto limiter = std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+
+  // The table is empty so the sample is blocked until it times out.
+  EXPECT_EQ(limiter->AwaitAndFinalizeSample(&mu, kTimeout).code(),
+            tensorflow::error::DEADLINE_EXCEEDED);
+
+  auto history = limiter->GetEventHistory(0, 0);
+  ASSERT_THAT(history.sample, SizeIs(1));
+  EXPECT_GT(history.sample[0].blocked_for, absl::ZeroDuration());
+
+  auto stats = limiter->Info(&mu).sample_stats();
+  EXPECT_EQ(stats.pending(), 0);
+  EXPECT_EQ(stats.completed(), 1);
+  EXPECT_EQ(stats.limited(), 1);
+}
+
 TEST(RateLimiterDeathTest, DiesIfMinSizeToSampleNonPositive) {
   ASSERT_DEATH(RateLimiter(1, 0, 0, 5), "");
   ASSERT_DEATH(RateLimiter(1, -1, 0, 5), "");
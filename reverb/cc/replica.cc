@@ -0,0 +1,270 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/replica.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/support/cleanup.h"
+#include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace deepmind {
+namespace reverb {
+
+Replica::Replica(
+    std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> primary,
+    std::string primary_address, std::vector<std::shared_ptr<Table>> tables,
+    std::vector<std::shared_ptr<ReplicationLog>> logs,
+    std::shared_ptr<ChunkStore> chunk_store, Options options)
+    : primary_(std::move(primary)),
+      tables_(std::move(tables)),
+      logs_(std::move(logs)),
+      chunk_store_(std::move(chunk_store)),
+      options_(std::move(options)) {
+  REVERB_CHECK(options_.rate_limiting != RateLimiting::kCoordinated ||
+               logs_.size() == tables_.size())
+      << "Coordinated rate limiting requires the log of every table.";
+  info_.set_primary_address(std::move(primary_address));
+  thread_ = internal::StartThread("Replica", [this] { Run(); });
+}
+
+Replica::~Replica() { Stop(); }
+
+void Replica::Stop() {
+  {
+    absl::MutexLock lock(&mu_);
+    if (stopped_) return;
+    stopped_ = true;
+    if (context_ != nullptr) context_->TryCancel();
+  }
+  thread_ = nullptr;  // Joins thread.
+}
+
+ReplicationInfo Replica::info() const {
+  absl::MutexLock lock(&mu_);
+  return info_;
+}
+
+void Replica::Run() {
+  while (true) {
+    const tensorflow::Status status = Replicate();
+    absl::MutexLock lock(&mu_);
+    if (stopped_) return;
+    REVERB_LOG(REVERB_WARNING)
+        << "Replication from " << info_.primary_address()
+        << " failed, reconnecting in " << options_.reconnect_interval << ": "
+        << status;
+    mu_.AwaitWithTimeout(absl::Condition(&stopped_),
+                         options_.reconnect_interval);
+    if (stopped_) return;
+  }
+}
+
+tensorflow::Status Replica::Replicate() {
+  grpc::ClientContext context;
+  {
+    absl::MutexLock lock(&mu_);
+    if (stopped_) {
+      return tensorflow::errors::Cancelled("The replica has been stopped.");
+    }
+    context_ = &context;
+    info_.set_num_connections(info_.num_connections() + 1);
+  }
+  auto cleanup = internal::MakeCleanup([this] {
+    absl::MutexLock lock(&mu_);
+    context_ = nullptr;
+    info_.set_up_to_date(false);
+  });
+
+  auto stream = primary_->ReplicateStream(&context);
+  ReplicateStreamRequest request;
+  for (const auto& table : tables_) {
+    request.add_tables(table->name());
+  }
+  request.set_replica_address(options_.address);
+  if (!stream->Write(request)) {
+    return FromGrpcStatus(stream->Finish());
+  }
+
+  internal::ReplicationApplier applier(
+      tables_, chunk_store_.get(), options_.min_snapshot_fraction_to_sample);
+
+  // Samples which were served before the connection was established are not
+  // reported.
+  std::vector<int64_t> reported;
+  std::unique_ptr<internal::PeriodicClosure> reporter;
+  if (options_.rate_limiting == RateLimiting::kCoordinated) {
+    for (const auto& log : logs_) {
+      reported.push_back(log->num_samples());
+    }
+    reporter = absl::make_unique<internal::PeriodicClosure>(
+        [this, &stream, &reported] { ReportSamples(stream.get(), &reported); },
+        options_.sample_report_interval, "ReplicaSampleReporter");
+    TF_RETURN_IF_ERROR(reporter->Start());
+  }
+
+  tensorflow::Status status;
+  ReplicateStreamResponse response;
+  while (status.ok() && stream->Read(&response)) {
+    status = applier.Apply(response);
+    absl::MutexLock lock(&mu_);
+    info_.set_up_to_date(applier.up_to_date());
+    info_.set_num_events(info_.num_events() + response.events_size());
+  }
+  if (reporter != nullptr) TF_CHECK_OK(reporter->Stop());
+  if (!status.ok()) {
+    context.TryCancel();
+    stream->Finish();
+    return status;
+  }
+  status = FromGrpcStatus(stream->Finish());
+  if (status.ok()) {
+    return tensorflow::errors::Unavailable(
+        "The primary closed the replication stream.");
+  }
+  return status;
+}
+
+void Replica::ReportSamples(
+    grpc::ClientReaderWriterInterface<ReplicateStreamRequest,
+                                      ReplicateStreamResponse>* stream,
+    std::vector<int64_t>* reported) const {
+  ReplicateStreamRequest request;
+  for (size_t i = 0; i < logs_.size(); i++) {
+    const int64_t num_samples = logs_[i]->num_samples();
+    if (num_samples == (*reported)[i]) continue;
+    auto* count = request.add_samples();
+    count->set_table(tables_[i]->name());
+    count->set_num_samples(num_samples - (*reported)[i]);
+    (*reported)[i] = num_samples;
+  }
+  // A failed write also fails the reads of the stream, which reconnects.
+  if (request.samples_size() > 0) stream->Write(request);
+}
+
+namespace internal {
+
+ReplicationApplier::ReplicationApplier(
+    const std::vector<std::shared_ptr<Table>>& tables, ChunkStore* chunk_store,
+    double min_snapshot_fraction_to_sample)
+    : chunk_store_(chunk_store), num_snapshots_in_progress_(tables.size()) {
+  for (const auto& table : tables) {
+    tables_[table->name()].table = table.get();
+    // The snapshot replaces the items of earlier connections.
+    table->Reset().IgnoreError();
+    table->BeginRestore(min_snapshot_fraction_to_sample);
+  }
+}
+
+ReplicationApplier::~ReplicationApplier() {
+  for (auto& table : tables_) {
+    if (table.second.in_snapshot) table.second.table->EndRestore();
+  }
+}
+
+tensorflow::Status ReplicationApplier::Apply(
+    const ReplicateStreamResponse& response) {
+  auto it = tables_.find(response.table());
+  if (it == tables_.end()) {
+    return tensorflow::errors::Internal("Received events of table ",
+                                        response.table(),
+                                        " which is not replicated.");
+  }
+  TableState* state = &it->second;
+  Table* table = state->table;
+
+  // The chunks sent with the response are held until the items which
+  // reference them have been inserted.
+  internal::flat_hash_map<uint64_t, std::shared_ptr<ChunkStore::Chunk>>
+      received;
+  for (const auto& chunk : response.chunks()) {
+    received[chunk.chunk_key()] = chunk_store_->Insert(chunk);
+  }
+  if (state->in_snapshot) {
+    table->SetNumItemsToRestore(response.snapshot_size());
+  }
+
+  for (const auto& event : response.events()) {
+    switch (event.event_case()) {
+      case ReplicationEvent::kInsert: {
+        TF_RETURN_IF_ERROR(ApplyMutations(state));
+        Table::Item item;
+        item.item = event.insert();
+        for (uint64_t chunk_key : item.item.chunk_keys()) {
+          auto chunk = received.find(chunk_key);
+          item.chunks.push_back(chunk != received.end()
+                                    ? chunk->second
+                                    : chunks_.Find(chunk_key));
+          if (item.chunks.back() == nullptr) {
+            return tensorflow::errors::Internal(
+                "Chunk ", chunk_key, " of item ", item.item.key(),
+                " was not received from the primary.");
+          }
+        }
+        chunks_.Add(response.table(), item.item, item.chunks);
+        TF_RETURN_IF_ERROR(state->in_snapshot
+                               ? table->InsertRestoredItem(std::move(item))
+                               : table->InsertReplicatedItem(std::move(item)));
+        break;
+      }
+      case ReplicationEvent::kUpdate:
+        updates_.push_back(event.update());
+        break;
+      case ReplicationEvent::kDeleteKey:
+        deletes_.push_back(event.delete_key());
+        chunks_.Remove(response.table(), event.delete_key());
+        break;
+      case ReplicationEvent::kReset:
+        TF_RETURN_IF_ERROR(ApplyMutations(state));
+        TF_RETURN_IF_ERROR(table->Reset());
+        chunks_.RemoveTable(response.table());
+        break;
+      case ReplicationEvent::EVENT_NOT_SET:
+        return tensorflow::errors::Internal(
+            "Received a replication event without a mutation.");
+    }
+  }
+  num_events_ += response.events_size();
+  TF_RETURN_IF_ERROR(ApplyMutations(state));
+
+  if (response.end_of_snapshot() && state->in_snapshot) {
+    table->EndRestore();
+    state->in_snapshot = false;
+    num_snapshots_in_progress_--;
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ReplicationApplier::ApplyMutations(TableState* state) {
+  if (updates_.empty() && deletes_.empty()) return tensorflow::Status::OK();
+  auto status = state->table->MutateItems(updates_, deletes_);
+  updates_.clear();
+  deletes_.clear();
+  return status;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,190 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_REPLICA_H_
+#define REVERB_CC_REPLICA_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include <cstdint>
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/table_extensions/replication.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Keeps the tables of a replica in sync with the tables of the same names on
+// a primary server, so that the replica can serve samples of the tables from
+// its own copy. The replica opens a `ReplicateStream` to the primary, replaces
+// its tables with the snapshots that the primary sends and then applies the
+// mutations which the primary streams. If the stream fails (e.g because the
+// replica fell too far behind) then the replica reconnects and starts over
+// with new snapshots.
+//
+// The tables of the replica should be configured like those of the primary,
+// except for their rate limiters (see `RateLimiting`). Items are only
+// replicated from the primary so writes must not be sent to the replica.
+class Replica {
+ public:
+  // How the rate limiters of the replica relate to those of the primary.
+  enum class RateLimiting {
+    // The replica only enforces the rate limiters of its own tables, which
+    // are configured independently of those of the primary. Inserts received
+    // from the primary are registered with them without waiting.
+    kRelaxed,
+
+    // The replica also reports the samples it serves to the primary, which
+    // registers them with the rate limiters of its tables. The writers of the
+    // primary are then paced by the samples of all its replicas. The tables of
+    // the replica should use a permissive rate limiter (e.g `MinSize`) as the
+    // samples are otherwise limited twice.
+    kCoordinated,
+  };
+
+  struct Options {
+    // Address which clients can sample from the replica at. Reported by the
+    // `ServerInfo` of the primary which lets clients route their samples to
+    // the replicas (see `Client::NewReplicaSampler`).
+    std::string address;
+
+    RateLimiting rate_limiting = RateLimiting::kRelaxed;
+
+    // Fraction of the snapshot of a table which must have been received
+    // before the table allows samples, after every (re)connection.
+    double min_snapshot_fraction_to_sample = 1.0;
+
+    // How often the samples are reported with `RateLimiting::kCoordinated`.
+    absl::Duration sample_report_interval = absl::Milliseconds(100);
+
+    // Time to wait before reconnecting once the stream to the primary failed.
+    absl::Duration reconnect_interval = absl::Seconds(1);
+  };
+
+  // Starts replicating `tables` from the server at `primary_address`, which
+  // is reached through `primary`. `logs` must hold the `ReplicationLog` of
+  // every table, which counts its samples, with `RateLimiting::kCoordinated`
+  // and may be empty otherwise. The chunks received from the primary are
+  // inserted into `chunk_store`.
+  Replica(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> primary,
+          std::string primary_address,
+          std::vector<std::shared_ptr<Table>> tables,
+          std::vector<std::shared_ptr<ReplicationLog>> logs,
+          std::shared_ptr<ChunkStore> chunk_store, Options options);
+
+  // Calls `Stop`.
+  ~Replica();
+
+  // Closes the stream to the primary and joins the replication thread. The
+  // tables keep the items which have been replicated so far.
+  void Stop() ABSL_LOCKS_EXCLUDED(mu_);
+
+  ReplicationInfo info() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  // Loop run by `thread_`. Replicates until `Stop` is called.
+  void Run() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Opens a stream to the primary and applies its responses until the stream
+  // fails or `Stop` is called.
+  tensorflow::Status Replicate() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Writes the samples which have been served since the previous call to
+  // `stream`. `reported` holds the number of samples of each table which
+  // have been reported so far.
+  void ReportSamples(
+      grpc::ClientReaderWriterInterface<ReplicateStreamRequest,
+                                        ReplicateStreamResponse>* stream,
+      std::vector<int64_t>* reported) const;
+
+  const std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> primary_;
+  const std::vector<std::shared_ptr<Table>> tables_;
+  const std::vector<std::shared_ptr<ReplicationLog>> logs_;
+  const std::shared_ptr<ChunkStore> chunk_store_;
+  const Options options_;
+
+  mutable absl::Mutex mu_;
+  bool stopped_ ABSL_GUARDED_BY(mu_) = false;
+
+  // Context of the open stream, if any. Cancelled by `Stop`.
+  grpc::ClientContext* context_ ABSL_GUARDED_BY(mu_) = nullptr;
+
+  ReplicationInfo info_ ABSL_GUARDED_BY(mu_);
+
+  std::unique_ptr<internal::Thread> thread_;
+};
+
+namespace internal {
+
+// Applies the responses of a single `ReplicateStream` to the tables of a
+// replica. Not thread-safe.
+class ReplicationApplier {
+ public:
+  // The tables are reset and block samples until the given fraction of their
+  // snapshots has been applied, up to the end of the snapshot.
+  ReplicationApplier(const std::vector<std::shared_ptr<Table>>& tables,
+                     ChunkStore* chunk_store,
+                     double min_snapshot_fraction_to_sample);
+
+  // Ends the snapshots which have not been completed. The tables keep the
+  // items which have been applied.
+  ~ReplicationApplier();
+
+  tensorflow::Status Apply(const ReplicateStreamResponse& response);
+
+  // True once the snapshots of all tables have been applied.
+  bool up_to_date() const { return num_snapshots_in_progress_ == 0; }
+
+  // Number of events which have been applied.
+  int64_t num_events() const { return num_events_; }
+
+ private:
+  struct TableState {
+    Table* table;
+    bool in_snapshot = true;
+  };
+
+  // Applies the priority updates and deletes which have been collected.
+  tensorflow::Status ApplyMutations(TableState* state);
+
+  ChunkStore* const chunk_store_;
+  internal::flat_hash_map<std::string, TableState> tables_;
+  int num_snapshots_in_progress_;
+  int64_t num_events_ = 0;
+
+  // Chunks referenced by the items of the primary.
+  ReplicatedChunks chunks_;
+
+  // Consecutive updates and deletes are collected and applied together.
+  std::vector<KeyWithPriority> updates_;
+  std::vector<uint64_t> deletes_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_REPLICA_H_
@@ -0,0 +1,138 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/replica.h"
+
+#include <cfloat>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+std::shared_ptr<Table> MakeTable() {
+  return std::make_shared<Table>(
+      "dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), /*max_size=*/10,
+      /*max_times_sampled=*/0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX));
+}
+
+ChunkData MakeChunk(uint64_t key) {
+  return testing::MakeChunkData(key, testing::MakeSequenceRange(key, 0, 1));
+}
+
+// Adds an insert of item `key`, which references chunk `chunk_key`, to
+// `response`.
+void AddInsert(uint64_t key, uint64_t chunk_key,
+               ReplicateStreamResponse* response) {
+  PrioritizedItem item =
+      testing::MakePrioritizedItem(key, 1, {MakeChunk(chunk_key)});
+  item.set_table("dist");
+  *response->add_events()->mutable_insert() = std::move(item);
+}
+
+TEST(ReplicationApplierTest, AppliesSnapshotAndMutations) {
+  ChunkStore chunk_store;
+  std::shared_ptr<Table> table = MakeTable();
+  ReplicationApplier applier({table}, &chunk_store,
+                             /*min_snapshot_fraction_to_sample=*/1.0);
+  EXPECT_FALSE(applier.up_to_date());
+
+  ReplicateStreamResponse snapshot;
+  snapshot.set_table("dist");
+  snapshot.set_snapshot_size(1);
+  snapshot.set_end_of_snapshot(true);
+  *snapshot.add_chunks() = MakeChunk(1);
+  AddInsert(1, 1, &snapshot);
+  TF_ASSERT_OK(applier.Apply(snapshot));
+  EXPECT_TRUE(applier.up_to_date());
+  EXPECT_EQ(table->size(), 1);
+
+  // Chunk 1 isn't sent again as it is still referenced by item 1.
+  ReplicateStreamResponse mutations;
+  mutations.set_table("dist");
+  AddInsert(2, 1, &mutations);
+  *mutations.add_events()->mutable_update() =
+      testing::MakeKeyWithPriority(2, 5);
+  mutations.add_events()->set_delete_key(1);
+  TF_ASSERT_OK(applier.Apply(mutations));
+
+  std::vector<Table::Item> items = table->Copy();
+  ASSERT_THAT(items, ::testing::SizeIs(1));
+  EXPECT_EQ(items[0].item.key(), 2);
+  EXPECT_EQ(items[0].item.priority(), 5);
+  EXPECT_EQ(applier.num_events(), 4);
+
+  ReplicateStreamResponse reset;
+  reset.set_table("dist");
+  reset.add_events()->set_reset(true);
+  TF_ASSERT_OK(applier.Apply(reset));
+  EXPECT_EQ(table->size(), 0);
+}
+
+TEST(ReplicationApplierTest, ReplacesItemsOfEarlierConnections) {
+  ChunkStore chunk_store;
+  std::shared_ptr<Table> table = MakeTable();
+  ReplicateStreamResponse snapshot;
+  snapshot.set_table("dist");
+  snapshot.set_snapshot_size(1);
+  snapshot.set_end_of_snapshot(true);
+  *snapshot.add_chunks() = MakeChunk(1);
+  AddInsert(1, 1, &snapshot);
+  {
+    ReplicationApplier applier({table}, &chunk_store, 1.0);
+    TF_ASSERT_OK(applier.Apply(snapshot));
+  }
+  EXPECT_EQ(table->size(), 1);
+
+  ReplicationApplier applier({table}, &chunk_store, 1.0);
+  EXPECT_EQ(table->size(), 0);
+}
+
+TEST(ReplicationApplierTest, FailsOnMissingChunks) {
+  ChunkStore chunk_store;
+  std::shared_ptr<Table> table = MakeTable();
+  ReplicationApplier applier({table}, &chunk_store, 1.0);
+
+  ReplicateStreamResponse response;
+  response.set_table("dist");
+  AddInsert(1, 1, &response);
+  EXPECT_EQ(applier.Apply(response).code(), tensorflow::error::INTERNAL);
+
+  response.set_table("unknown");
+  EXPECT_EQ(applier.Apply(response).code(), tensorflow::error::INTERNAL);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,1072 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/reverb_service_async_impl.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "grpcpp/alarm.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/reverb_service_util.h"
+#include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/tracing.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+inline grpc::Status TableNotFound(absl::string_view name) {
+  return grpc::Status(grpc::StatusCode::NOT_FOUND,
+                      absl::StrCat("Priority table ", name, " was not found"));
+}
+
+inline grpc::Status Internal(const std::string& message) {
+  return grpc::Status(grpc::StatusCode::INTERNAL, message);
+}
+
+// Number of threads which run the blocking handlers of the unary calls.
+constexpr int kNumBlockingThreads = 4;
+
+// Lets the rate limiter of a table wake a call which is parked on an alarm.
+// The table may hold on to the callback after the call has been deleted so the
+// state is shared between the call and its callbacks.
+class Waker {
+ public:
+  explicit Waker(grpc::Alarm* alarm) : alarm_(alarm) {}
+
+  // Marks the call as parked. The alarm must have been set.
+  void Park() {
+    absl::MutexLock lock(&mu_);
+    parked_ = true;
+  }
+
+  // Fires the alarm early if the call is parked. Returns false if the call
+  // doesn't wait for the table, in which case the table notifies the next
+  // waiting call instead.
+  bool Wake() {
+    absl::MutexLock lock(&mu_);
+    if (!parked_ || cancelled_) return false;
+    parked_ = false;
+    alarm_->Cancel();
+    return true;
+  }
+
+  // Must be called when the alarm has fired.
+  void Unpark() {
+    absl::MutexLock lock(&mu_);
+    parked_ = false;
+  }
+
+  // Fires the alarm early if the call is parked and stops the call from being
+  // woken by the table. Called once the call has been cancelled.
+  void Cancel() {
+    absl::MutexLock lock(&mu_);
+    cancelled_ = true;
+    if (parked_) {
+      parked_ = false;
+      alarm_->Cancel();
+    }
+  }
+
+ private:
+  absl::Mutex mu_;
+  grpc::Alarm* alarm_;
+  bool parked_ ABSL_GUARDED_BY(mu_) = false;
+  bool cancelled_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+}  // namespace
+
+// State machine of a single call. All events of a call are delivered by the
+// same completion queue, which is polled by a single thread, so the events
+// are handled sequentially. The call deletes itself once it has finished and
+// no operations are pending.
+class ReverbServiceAsyncImpl::Call {
+ public:
+  enum class Event { kRequest, kRead, kWrite, kAlarm, kFinish, kDone };
+
+  explicit Call(ReverbServiceAsyncImpl* server) : server_(server) {
+    for (int i = 0; i < kNumEvents; i++) {
+      operations_[i] = {this, static_cast<Event>(i)};
+    }
+  }
+
+  virtual ~Call() = default;
+
+  // Waits for the next call of the method on `cq`.
+  void Start(grpc::ServerCompletionQueue* cq) {
+    cq_ = cq;
+    context_.AsyncNotifyWhenDone(&operations_[static_cast<int>(Event::kDone)]);
+    Request(cq);
+  }
+
+  // Handles the completion of the operation identified by `tag`.
+  static void Handle(void* tag, bool ok) {
+    auto* operation = static_cast<Operation*>(tag);
+    Call* call = operation->call;
+    call->pending_--;
+    switch (operation->event) {
+      case Event::kRequest:
+        // The server is shutting down.
+        if (!ok) {
+          delete call;
+          return;
+        }
+        // The done notification is only delivered once the call has started.
+        call->pending_++;
+        call->server_->RequestCall(call->New(), call->cq_);
+        call->trace_ = internal::ServerTraceContext(&call->context_);
+        break;
+      case Event::kFinish:
+        call->finished_ = true;
+        break;
+      case Event::kDone:
+        // Before the call has finished it can only be done if cancelled.
+        call->cancelled_ = call->context_.IsCancelled();
+        break;
+      default:
+        break;
+    }
+    {
+      // Spans recorded while handling the event, e.g by the table, belong to
+      // the trace of the call.
+      internal::ScopedTraceContext active(call->trace_);
+      call->OnEvent(operation->event, ok);
+    }
+    if (call->finished_ && call->pending_ == 0) delete call;
+  }
+
+ protected:
+  // Requests the next call of the method with `Tag(Event::kRequest)`.
+  virtual void Request(grpc::ServerCompletionQueue* cq) = 0;
+
+  // Creates an object which waits for the next call of the same method.
+  virtual std::unique_ptr<Call> New() const = 0;
+
+  // Handles the completion of the operation of `event`.
+  virtual void OnEvent(Event event, bool ok) = 0;
+
+  // Returns the tag of an operation which completes with `event`. Every call
+  // has at most one pending operation per event.
+  void* Tag(Event event) {
+    pending_++;
+    return &operations_[static_cast<int>(event)];
+  }
+
+  // Runs `fn` on the blocking executor of the server with the tag of an
+  // operation which completes with `event`, which `fn` must start (e.g
+  // `Finish`). The tag is taken on the polling thread as the counts of pending
+  // operations are not synchronized.
+  void RunBlocking(Event event, std::function<void(void* tag)> fn) {
+    void* tag = Tag(event);
+    server_->blocking_executor_->Schedule(
+        [trace = trace_, tag, fn = std::move(fn)] {
+          internal::ScopedTraceContext active(trace);
+          fn(tag);
+        });
+  }
+
+  ReverbServiceImpl* service() const { return server_->service_; }
+  ReverbService::AsyncService* async_service() const {
+    return &server_->async_service_;
+  }
+
+  ReverbServiceAsyncImpl* server_;
+  grpc::ServerCompletionQueue* cq_ = nullptr;
+  grpc::ServerContext context_;
+
+  // Whether the client has cancelled the call. Set when `Event::kDone` is
+  // delivered since `context_.IsCancelled` must not be called before.
+  bool cancelled_ = false;
+
+  // Whether `Finish` has been called.
+  bool finishing_ = false;
+
+  // Counts the call from the time it is accepted until it is deleted. Unary
+  // calls are counted by the handlers of the synchronous implementation.
+  std::unique_ptr<internal::ScopedRpcMetrics> rpc_;
+
+ private:
+  static constexpr int kNumEvents = static_cast<int>(Event::kDone) + 1;
+
+  struct Operation {
+    Call* call;
+    Event event;
+  };
+
+  Operation operations_[kNumEvents];
+  int pending_ = 0;
+  bool finished_ = false;
+
+  // Trace context of the call, see `internal::ServerTraceContext`.
+  internal::TraceContext trace_;
+};
+
+// Calls the synchronous implementation of a unary method of the service.
+template <typename RequestT, typename ResponseT>
+class ReverbServiceAsyncImpl::UnaryCall : public Call {
+ public:
+  using RequestMethod = void (ReverbService::AsyncService::*)(
+      grpc::ServerContext*, RequestT*,
+      grpc::ServerAsyncResponseWriter<ResponseT>*, grpc::CompletionQueue*,
+      grpc::ServerCompletionQueue*, void*);
+  using Handler = grpc::Status (ReverbServiceImpl::*)(grpc::ServerContext*,
+                                                      const RequestT*,
+                                                      ResponseT*);
+
+  UnaryCall(ReverbServiceAsyncImpl* server, RequestMethod request_method,
+            Handler handler)
+      : Call(server),
+        request_method_(request_method),
+        handler_(handler),
+        responder_(&context_) {}
+
+ protected:
+  void Request(grpc::ServerCompletionQueue* cq) override {
+    (async_service()->*request_method_)(&context_, &request_, &responder_, cq,
+                                         cq, Tag(Event::kRequest));
+  }
+
+  std::unique_ptr<Call> New() const override {
+    return absl::make_unique<UnaryCall>(server_, request_method_, handler_);
+  }
+
+  void OnEvent(Event event, bool ok) override {
+    if (event != Event::kRequest) return;
+    // The call is not deleted before the finish operation completes, so the
+    // members remain valid until the handler returns.
+    RunBlocking(Event::kFinish, [this](void* tag) {
+      grpc::Status status =
+          (service()->*handler_)(&context_, &request_, &response_);
+      responder_.Finish(response_, status, tag);
+    });
+  }
+
+ private:
+  const RequestMethod request_method_;
+  const Handler handler_;
+  RequestT request_;
+  ResponseT response_;
+  grpc::ServerAsyncResponseWriter<ResponseT> responder_;
+};
+
+// Base of the calls of bidirectional streaming methods.
+template <typename ResponseT, typename RequestT>
+class ReverbServiceAsyncImpl::StreamCall : public Call {
+ public:
+  explicit StreamCall(ReverbServiceAsyncImpl* server)
+      : Call(server), stream_(&context_) {}
+
+ protected:
+  // Finishes the call with `status` unless it is already finishing. Must not
+  // be called while a write is pending.
+  void Finish(const grpc::Status& status) {
+    if (finishing_) return;
+    finishing_ = true;
+    stream_.Finish(status, Tag(Event::kFinish));
+  }
+
+  grpc::ServerAsyncReaderWriter<ResponseT, RequestT> stream_;
+};
+
+class ReverbServiceAsyncImpl::InsertStreamCall
+    : public StreamCall<InsertStreamResponse, InsertStreamRequest> {
+ public:
+  explicit InsertStreamCall(ReverbServiceAsyncImpl* server)
+      : StreamCall(server),
+        deriver_(server->service_->item_rule_tables_),
+        waker_(std::make_shared<Waker>(&alarm_)) {}
+
+  ~InsertStreamCall() override {
+    if (stats_ != nullptr) service()->UnregisterInsertStream(stats_.get());
+  }
+
+ protected:
+  void Request(grpc::ServerCompletionQueue* cq) override {
+    async_service()->RequestInsertStream(&context_, &stream_, cq, cq,
+                                         Tag(Event::kRequest));
+  }
+
+  std::unique_ptr<Call> New() const override {
+    return absl::make_unique<InsertStreamCall>(server_);
+  }
+
+  void OnEvent(Event event, bool ok) override {
+    switch (event) {
+      case Event::kRequest:
+        rpc_ = absl::make_unique<internal::ScopedRpcMetrics>(
+            &service()->rpc_metrics_.insert_stream);
+        if (auto status = service()->CheckWritable(); !status.ok()) {
+          return Finish(status);
+        }
+        stats_ = absl::make_unique<internal::InsertStreamStats>(
+            context_.peer());
+        service()->RegisterInsertStream(stats_.get());
+        Read();
+        break;
+      case Event::kRead:
+        // All items have been inserted before the next request was read.
+        if (!ok) return Finish(grpc::Status::OK);
+        OnRequest();
+        break;
+      case Event::kWrite:
+        if (!ok) {
+          return Finish(Internal(absl::StrCat(
+              "Error when sending confirmation that item ",
+              confirmations_.front().keys().empty()
+                  ? confirmations_.front().key()
+                  : confirmations_.front().keys(0),
+              " has been successfully inserted/updated.")));
+        }
+        rpc_->AddSentBytes(confirmations_.front().ByteSizeLong());
+        confirmations_.pop_front();
+        WriteOrRead();
+        break;
+      case Event::kAlarm:
+        waker_->Unpark();
+        Insert();
+        break;
+      case Event::kDone:
+        waker_->Cancel();
+        break;
+      case Event::kFinish:
+        break;
+    }
+  }
+
+ private:
+  void Read() {
+    request_.Clear();
+    stream_.Read(&request_, Tag(Event::kRead));
+  }
+
+  void OnRequest() {
+    const int64_t bytes = request_.ByteSizeLong();
+    stats_->bytes.fetch_add(bytes, std::memory_order_relaxed);
+    rpc_->AddReceivedBytes(bytes);
+    if (request_.has_chunk() || request_.has_shared_memory_chunk()) {
+      if (auto status = service()->memory_admission_->AdmitChunk(request_);
+          !status.ok()) {
+        return Finish(status);
+      }
+      if (auto status =
+              internal::InsertStreamChunk(service()->chunk_store_.get(),
+                                          &request_, &chunks_, &deriver_,
+                                          &derived_);
+          !status.ok()) {
+        return Finish(status);
+      }
+      if (derived_.empty()) return Read();
+      return Insert();
+    }
+    if (!request_.has_item()) return Read();
+
+    const auto& table_name = request_.item().item().table();
+    table_ = service()->TableByName(table_name);
+    if (table_ == nullptr) return Finish(TableNotFound(table_name));
+
+    const auto item_key = request_.item().item().key();
+    const auto confirmation = internal::ConfirmationOf(request_.item());
+    Table::Item item;
+    if (auto status =
+            internal::PrepareInsertStreamItem(&request_, &chunks_, &item);
+        !status.ok()) {
+      return Finish(status);
+    }
+    items_.push_back(std::move(item));
+    items_confirmations_.emplace_back(item_key, confirmation);
+    Insert();
+  }
+
+  // Inserts the pending items, or parks the call if the rate limiter doesn't
+  // allow it yet.
+  void Insert() {
+    if (cancelled_) {
+      return Finish(grpc::Status(grpc::StatusCode::CANCELLED,
+                                 "Call has been cancelled"));
+    }
+
+    // The derived items are inserted after the pending item, in batches of
+    // consecutive items which target the same table.
+    while (!items_.empty() || NextDerivedBatch()) {
+      auto statuses = table_->TryInsertOrAssignBatch(&items_);
+      for (int i = 0; i < statuses.size(); i++) {
+        if (!statuses[i].ok()) return Finish(ToGrpcStatus(statuses[i]));
+
+        // Let caller know that the item has been inserted if requested by the
+        // caller.
+        internal::AddInsertStreamConfirmation(items_confirmations_[i].first,
+                                              items_confirmations_[i].second,
+                                              &confirmations_);
+      }
+      items_confirmations_.erase(
+          items_confirmations_.begin(),
+          items_confirmations_.begin() + statuses.size());
+      stats_->items.fetch_add(statuses.size(), std::memory_order_relaxed);
+
+      if (!items_.empty()) {
+        alarm_.Set(cq_, absl::ToChronoTime(absl::InfiniteFuture()),
+                   Tag(Event::kAlarm));
+        waker_->Park();
+        table_->NotifyWhenCanInsert(
+            [waker = waker_] { return waker->Wake(); });
+        return;
+      }
+    }
+    WriteOrRead();
+  }
+
+  // Moves the derived items at the front of `derived_` which target the same
+  // table into `items_`. Returns false if there are none.
+  bool NextDerivedBatch() {
+    if (next_derived_ == derived_.size()) {
+      derived_.clear();
+      next_derived_ = 0;
+      return false;
+    }
+    table_ = derived_[next_derived_].first;
+    while (next_derived_ < derived_.size() &&
+           derived_[next_derived_].first == table_) {
+      Table::Item& item = derived_[next_derived_++].second;
+      items_confirmations_.emplace_back(
+          item.item.key(), internal::InsertStreamConfirmation::kNone);
+      items_.push_back(std::move(item));
+    }
+    return true;
+  }
+
+  // Writes the next confirmation, or reads the next request once all
+  // confirmations have been written.
+  void WriteOrRead() {
+    if (confirmations_.empty()) return Read();
+    stream_.Write(confirmations_.front(), Tag(Event::kWrite));
+  }
+
+  InsertStreamRequest request_;
+  internal::InsertStreamChunks chunks_;
+
+  // Items derived from the chunks of the stream by the item rules of the
+  // tables. Those before `next_derived_` have been moved to `items_`.
+  internal::ItemDeriver deriver_;
+  internal::DerivedItems derived_;
+  size_t next_derived_ = 0;
+
+  // Reported by `ServerInfo` once the call has been accepted.
+  std::unique_ptr<internal::InsertStreamStats> stats_;
+
+  // Items which have not been inserted yet because the rate limiter blocked
+  // them, together with their keys and whether the caller wants to be sent a
+  // confirmation.
+  Table* table_ = nullptr;
+  std::vector<Table::Item> items_;
+  std::vector<std::pair<uint64_t, internal::InsertStreamConfirmation>>
+      items_confirmations_;
+
+  // Confirmations which have not been written yet. The front is being written.
+  std::deque<InsertStreamResponse> confirmations_;
+
+  grpc::Alarm alarm_;
+  std::shared_ptr<Waker> waker_;
+};
+
+// Applies every request of a `MutatePrioritiesStream` as soon as it has been
+// read. Unlike the synchronous implementation, requests are not merged with
+// those which arrive in the meantime as the completion queue has no notion of
+// requests that are "immediately available".
+class ReverbServiceAsyncImpl::MutatePrioritiesStreamCall : public Call {
+ public:
+  explicit MutatePrioritiesStreamCall(ReverbServiceAsyncImpl* server)
+      : Call(server), reader_(&context_) {}
+
+ protected:
+  void Request(grpc::ServerCompletionQueue* cq) override {
+    async_service()->RequestMutatePrioritiesStream(&context_, &reader_, cq, cq,
+                                                   Tag(Event::kRequest));
+  }
+
+  std::unique_ptr<Call> New() const override {
+    return absl::make_unique<MutatePrioritiesStreamCall>(server_);
+  }
+
+  void OnEvent(Event event, bool ok) override {
+    switch (event) {
+      case Event::kRequest:
+        rpc_ = absl::make_unique<internal::ScopedRpcMetrics>(
+            &service()->rpc_metrics_.mutate_priorities_stream);
+        if (auto status = service()->CheckWritable(); !status.ok()) {
+          return Finish(status);
+        }
+        Read();
+        break;
+      case Event::kRead:
+        // The client has closed the stream and all requests have been applied.
+        if (!ok) return Finish(grpc::Status::OK);
+        OnRequest();
+        break;
+      default:
+        break;
+    }
+  }
+
+ private:
+  void Read() {
+    request_.Clear();
+    reader_.Read(&request_, Tag(Event::kRead));
+  }
+
+  void OnRequest() {
+    rpc_->AddReceivedBytes(request_.ByteSizeLong());
+    Table* table = service()->TableByName(request_.table());
+    if (table == nullptr) return Finish(TableNotFound(request_.table()));
+
+    merger_.Add(request_);
+    if (auto status = merger_.Apply(table); !status.ok()) {
+      return Finish(ToGrpcStatus(status));
+    }
+    Read();
+  }
+
+  void Finish(const grpc::Status& status) {
+    if (finishing_) return;
+    finishing_ = true;
+    if (status.ok()) {
+      reader_.Finish(response_, status, Tag(Event::kFinish));
+    } else {
+      reader_.FinishWithError(status, Tag(Event::kFinish));
+    }
+  }
+
+  MutatePrioritiesRequest request_;
+  MutatePrioritiesResponse response_;
+  internal::PriorityUpdateMerger merger_;
+  grpc::ServerAsyncReader<MutatePrioritiesResponse, MutatePrioritiesRequest>
+      reader_;
+};
+
+class ReverbServiceAsyncImpl::SampleStreamCall
+    : public StreamCall<SampleStreamResponse, SampleStreamRequest> {
+ public:
+  explicit SampleStreamCall(ReverbServiceAsyncImpl* server)
+      : StreamCall(server), waker_(std::make_shared<Waker>(&alarm_)) {}
+
+  // The client reads every message which has been written unless it goes
+  // away, in which case the segments of the messages it hasn't read are
+  // removed. The messages which are never written remove their own segments.
+  ~SampleStreamCall() override {
+    if (cancelled_ || write_failed_) segments_.RemoveAll();
+  }
+
+ protected:
+  void Request(grpc::ServerCompletionQueue* cq) override {
+    async_service()->RequestSampleStream(&context_, &stream_, cq, cq,
+                                         Tag(Event::kRequest));
+  }
+
+  std::unique_ptr<Call> New() const override {
+    return absl::make_unique<SampleStreamCall>(server_);
+  }
+
+  void OnEvent(Event event, bool ok) override {
+    switch (event) {
+      case Event::kRequest:
+        rpc_ = absl::make_unique<internal::ScopedRpcMetrics>(
+            &service()->rpc_metrics_.sample_stream);
+        stream_.Read(&request_, Tag(Event::kRead));
+        break;
+      case Event::kRead:
+        if (!ok) {
+          return Finish(mix_.num_tables() == 0
+                            ? Internal("Could not read initial request")
+                            : grpc::Status::OK);
+        }
+        OnRequest();
+        break;
+      case Event::kWrite:
+        if (!ok) {
+          write_failed_ = true;
+          return Finish(Internal("Failed to write to Sample stream."));
+        }
+        messages_.front()->sent = true;
+        rpc_->AddSentBytes(messages_.front()->response.ByteSizeLong());
+        messages_.pop_front();
+        WriteOrSample();
+        break;
+      case Event::kAlarm:
+        waker_->Unpark();
+        Sample();
+        break;
+      case Event::kDone:
+        waker_->Cancel();
+        break;
+      case Event::kFinish:
+        break;
+    }
+  }
+
+ private:
+  void OnRequest() {
+    rpc_->AddReceivedBytes(request_.ByteSizeLong());
+    if (mix_.num_tables() == 0) {
+      timeout_ = ReverbServiceImpl::RateLimiterTimeout(request_);
+    }
+    internal::UpdateClientChunks(request_, &client_chunks_);
+
+    std::vector<std::pair<Table*, double>> tables;
+    if (auto status = service()->ValidateSampleStreamRequest(request_, &tables);
+        !status.ok()) {
+      return Finish(status);
+    }
+    mix_.Reset(std::move(tables));
+    flexible_batch_size_ =
+        ReverbServiceImpl::FlexibleBatchSize(request_, *mix_.table(0));
+    count_ = 0;
+    updates_.assign(request_.priority_updates().begin(),
+                    request_.priority_updates().end());
+    deletes_.assign(request_.delete_keys().begin(),
+                    request_.delete_keys().end());
+    writer_ = absl::make_unique<internal::SampleResponseWriter>(
+        [this](std::unique_ptr<internal::SampleResponseWriter::Message>
+                   message) {
+          messages_.push_back(std::move(message));
+          return true;
+        },
+        request_.max_response_bytes());
+    Sample();
+  }
+
+  // Samples the next batch, or parks the call if the rate limiter doesn't
+  // allow it yet, and writes it to the stream. Reads the next request once
+  // all samples of the current request have been written.
+  void Sample() {
+    if (cancelled_) {
+      return Finish(grpc::Status(grpc::StatusCode::CANCELLED,
+                                 "Call has been cancelled"));
+    }
+    if (count_ == request_.num_samples()) {
+      request_.Clear();
+      stream_.Read(&request_, Tag(Event::kRead));
+      return;
+    }
+
+    // The timeout applies to each batch, as it does for the synchronous
+    // service.
+    if (deadline_ == absl::InfinitePast()) deadline_ = absl::Now() + timeout_;
+
+    // When mixing tables, each batch is drawn from the table which is furthest
+    // behind its share and limited to the part of the batch allocated to it.
+    std::vector<Table::SampledItem> samples;
+    const int index = mix_.Next();
+    Table* table = mix_.table(index);
+    tensorflow::Status status;
+    if (request_.sample_episodes()) {
+      status = table->SampleEpisode(&samples, absl::ZeroDuration());
+    } else {
+      const int32_t max_batch_size = mix_.Allocate(std::min<int32_t>(
+          flexible_batch_size_, request_.num_samples() - count_))[index];
+      status = table->MutateAndSampleFlexibleBatch(
+          updates_, deletes_, &samples, max_batch_size, absl::ZeroDuration(),
+          request_.without_replacement());
+      // The mutations have been applied unless they failed, which finishes the
+      // call, so they aren't repeated when the call waits for the table.
+      updates_.clear();
+      deletes_.clear();
+    }
+    if (tensorflow::errors::IsDeadlineExceeded(status) &&
+        absl::Now() < deadline_) {
+      alarm_.Set(cq_, absl::ToChronoTime(deadline_), Tag(Event::kAlarm));
+      waker_->Park();
+      table->NotifyWhenCanSample([waker = waker_] { return waker->Wake(); });
+      return;
+    }
+    if (!status.ok()) return Finish(ToGrpcStatus(status));
+    deadline_ = absl::InfinitePast();
+    mix_.Record(index, samples.size());
+    count_ += request_.sample_episodes() ? 1 : samples.size();
+
+    // Stage spilled chunks of the later samples while the earlier ones are
+    // written to the stream.
+    for (const auto& sample : samples) {
+      service()->chunk_store_->Prefetch(sample.chunks);
+    }
+
+    if (auto status = internal::WriteSampleBatch(
+            client_chunks_, request_.shared_memory() ? &segments_ : nullptr,
+            request_.without_replacement() || request_.sample_episodes(),
+            &samples, writer_.get());
+        !status.ok()) {
+      return Finish(status);
+    }
+
+    // Don't hold back samples while waiting for the table.
+    writer_->Flush();
+    WriteOrSample();
+  }
+
+  // Writes the next message, or samples the next batch once all messages have
+  // been written.
+  void WriteOrSample() {
+    if (messages_.empty()) return Sample();
+    grpc::WriteOptions options;
+    options.set_no_compression();  // Data is already compressed.
+    stream_.Write(messages_.front()->response, options, Tag(Event::kWrite));
+  }
+
+  SampleStreamRequest request_;
+
+  // Tables and arguments of the current request. There are no tables until the
+  // first request has been read.
+  internal::TableMix mix_;
+  absl::Duration timeout_;
+  int32_t flexible_batch_size_ = 0;
+  int count_ = 0;
+
+  // Mutations of the current request which haven't been applied yet. They are
+  // applied with its first batch.
+  std::vector<KeyWithPriority> updates_;
+  std::vector<Table::Key> deletes_;
+
+  // Deadline of the rate limiter for the current batch, or `InfinitePast` if
+  // the call hasn't waited for the current batch yet.
+  absl::Time deadline_ = absl::InfinitePast();
+
+  // Chunks which the client has advertised as cached. These are sent as
+  // references rather than being sent again.
+  internal::ClientChunks client_chunks_;
+
+  // Packs the responses into `messages_`. The front of `messages_` is being
+  // written.
+  std::unique_ptr<internal::SampleResponseWriter> writer_;
+  std::deque<std::unique_ptr<internal::SampleResponseWriter::Message>>
+      messages_;
+
+  // Segments of the chunks which are passed through shared memory, and
+  // whether a write has failed, after which the client reads no more
+  // messages.
+  internal::SharedMemorySegments segments_;
+  bool write_failed_ = false;
+
+  grpc::Alarm alarm_;
+  std::shared_ptr<Waker> waker_;
+};
+
+// Replicas follow the tables through the synchronous service, which serves
+// each `ReplicateStream` with a dedicated thread.
+class ReverbServiceAsyncImpl::ReplicateStreamCall
+    : public StreamCall<ReplicateStreamResponse, ReplicateStreamRequest> {
+ public:
+  using StreamCall::StreamCall;
+
+ protected:
+  void Request(grpc::ServerCompletionQueue* cq) override {
+    async_service()->RequestReplicateStream(&context_, &stream_, cq, cq,
+                                            Tag(Event::kRequest));
+  }
+
+  std::unique_ptr<Call> New() const override {
+    return absl::make_unique<ReplicateStreamCall>(server_);
+  }
+
+  void OnEvent(Event event, bool ok) override {
+    if (event != Event::kRequest) return;
+    rpc_ = absl::make_unique<internal::ScopedRpcMetrics>(
+        &service()->rpc_metrics_.replicate_stream);
+    Finish(grpc::Status(
+        grpc::StatusCode::UNIMPLEMENTED,
+        "ReplicateStream is only served by the synchronous service."));
+  }
+};
+
+// Writes the pages of an `ExportTable` one at a time. The next page is only
+// copied once the previous one has been written, so a slow client holds at
+// most one page in memory.
+class ReverbServiceAsyncImpl::ExportTableCall : public Call {
+ public:
+  explicit ExportTableCall(ReverbServiceAsyncImpl* server)
+      : Call(server), writer_(&context_) {}
+
+ protected:
+  void Request(grpc::ServerCompletionQueue* cq) override {
+    async_service()->RequestExportTable(&context_, &request_, &writer_, cq, cq,
+                                        Tag(Event::kRequest));
+  }
+
+  std::unique_ptr<Call> New() const override {
+    return absl::make_unique<ExportTableCall>(server_);
+  }
+
+  void OnEvent(Event event, bool ok) override {
+    switch (event) {
+      case Event::kRequest: {
+        rpc_ = absl::make_unique<internal::ScopedRpcMetrics>(
+            &service()->rpc_metrics_.export_table);
+        rpc_->AddReceivedBytes(request_.ByteSizeLong());
+        Table* table = service()->TableByName(request_.table());
+        if (table == nullptr) return Finish(TableNotFound(request_.table()));
+        exporter_ = absl::make_unique<internal::TableExporter>(table, request_);
+        // Chunks which aren't decompressed are already compressed.
+        if (!request_.decompress_chunks()) options_.set_no_compression();
+        WriteNext();
+        break;
+      }
+      case Event::kWrite:
+        if (!ok) {
+          return Finish(Internal("Failed to write to ExportTable stream."));
+        }
+        if (exporter_->done()) return Finish(grpc::Status::OK);
+        WriteNext();
+        break;
+      default:
+        break;
+    }
+  }
+
+ private:
+  void WriteNext() {
+    if (cancelled_) {
+      return Finish(grpc::Status(grpc::StatusCode::CANCELLED,
+                                 "ExportTable was cancelled."));
+    }
+    if (auto status = exporter_->Next(&response_); !status.ok()) {
+      return Finish(ToGrpcStatus(status));
+    }
+    rpc_->AddSentBytes(response_.ByteSizeLong());
+    writer_.Write(response_, options_, Tag(Event::kWrite));
+  }
+
+  void Finish(const grpc::Status& status) {
+    if (finishing_) return;
+    finishing_ = true;
+    writer_.Finish(status, Tag(Event::kFinish));
+  }
+
+  ExportTableRequest request_;
+  ExportTableResponse response_;
+  grpc::WriteOptions options_;
+  std::unique_ptr<internal::TableExporter> exporter_;
+  grpc::ServerAsyncWriter<ExportTableResponse> writer_;
+};
+
+class ReverbServiceAsyncImpl::InitializeConnectionCall
+    : public StreamCall<InitializeConnectionResponse,
+                        InitializeConnectionRequest> {
+ public:
+  using StreamCall::StreamCall;
+
+ protected:
+  void Request(grpc::ServerCompletionQueue* cq) override {
+    async_service()->RequestInitializeConnection(&context_, &stream_, cq, cq,
+                                                 Tag(Event::kRequest));
+  }
+
+  std::unique_ptr<Call> New() const override {
+    return absl::make_unique<InitializeConnectionCall>(server_);
+  }
+
+  void OnEvent(Event event, bool ok) override {
+    switch (event) {
+      case Event::kRequest:
+        rpc_ = absl::make_unique<internal::ScopedRpcMetrics>(
+            &service()->rpc_metrics_.initialize_connection);
+        if (!IsLocalhostOrInProcess(context_.peer())) {
+          return Finish(grpc::Status::OK);
+        }
+        stream_.Read(&request_, Tag(Event::kRead));
+        break;
+      case Event::kRead:
+        if (response_.address() == 0) {
+          if (!ok) return Finish(Internal("Failed to read from stream"));
+          OnRequest();
+        } else {
+          // Wait for the client to confirm ownership transfer.
+          if (!ok) return Finish(Internal("Failed to read from stream."));
+          if (!request_.ownership_transferred()) {
+            return Finish(Internal("Received unexpected request"));
+          }
+          Finish(grpc::Status::OK);
+        }
+        break;
+      case Event::kWrite:
+        // The response without an address doesn't expect a confirmation.
+        if (response_.address() == 0) return Finish(grpc::Status::OK);
+        if (!ok) return Finish(Internal("Failed to write to stream."));
+        stream_.Read(&request_, Tag(Event::kRead));
+        break;
+      default:
+        break;
+    }
+  }
+
+ private:
+  void OnRequest() {
+    if (request_.pid() != getpid()) {
+      // Respond without populating the address field.
+      response_.set_address(0);
+      if (request_.has_shared_memory_probe()) {
+        // Reading the probe maps a file owned by the client.
+        return RunBlocking(Event::kWrite, [this](void* tag) {
+          ChunkData probe;
+          response_.set_shared_memory(
+              internal::ReadSharedMemoryChunk(request_.shared_memory_probe(),
+                                              &probe)
+                  .ok());
+          stream_.Write(response_, tag);
+        });
+      }
+      stream_.Write(response_, Tag(Event::kWrite));
+      return;
+    }
+
+    // Allocate a new shared pointer on the heap and transmit its memory
+    // address. The client will dereference and assume ownership of the object
+    // before sending its response. For simplicity, the client will copy the
+    // shared_ptr so the server is always responsible for cleaning up the heap
+    // allocated object.
+    if (request_.chunk_store()) {
+      // The chunk store is only shared with writers.
+      if (auto status = service()->CheckWritable(); !status.ok()) {
+        return Finish(status);
+      }
+      chunk_store_ptr_ = absl::make_unique<std::shared_ptr<ChunkStore>>(
+          service()->chunk_store_);
+      response_.set_address(reinterpret_cast<int64_t>(chunk_store_ptr_.get()));
+    } else {
+      auto it = service()->tables_.find(request_.table_name());
+      if (it == service()->tables_.end()) {
+        return Finish(TableNotFound(request_.table_name()));
+      }
+      table_ptr_ = absl::make_unique<std::shared_ptr<Table>>(it->second);
+      response_.set_address(reinterpret_cast<int64_t>(table_ptr_.get()));
+    }
+    stream_.Write(response_, Tag(Event::kWrite));
+  }
+
+  InitializeConnectionRequest request_;
+  InitializeConnectionResponse response_;
+  std::unique_ptr<std::shared_ptr<Table>> table_ptr_;
+  std::unique_ptr<std::shared_ptr<ChunkStore>> chunk_store_ptr_;
+};
+
+ReverbServiceAsyncImpl::ReverbServiceAsyncImpl(ReverbServiceImpl* service,
+                                               int num_threads)
+    : service_(service),
+      num_threads_(num_threads),
+      blocking_executor_(absl::make_unique<internal::ThreadPool>(
+          kNumBlockingThreads, "ReverbServiceBlocking")) {
+  REVERB_CHECK_GT(num_threads_, 0);
+}
+
+ReverbServiceAsyncImpl::~ReverbServiceAsyncImpl() { Stop(); }
+
+void ReverbServiceAsyncImpl::RegisterWith(grpc::ServerBuilder* builder) {
+  REVERB_CHECK(cqs_.empty()) << "RegisterWith() called twice?";
+  builder->RegisterService(&async_service_);
+  for (int i = 0; i < num_threads_; i++) {
+    cqs_.push_back(builder->AddCompletionQueue());
+  }
+}
+
+void ReverbServiceAsyncImpl::Start() {
+  REVERB_CHECK(threads_.empty()) << "Start() called twice?";
+  for (auto& cq : cqs_) {
+    RequestCalls(cq.get());
+    threads_.push_back(internal::StartThread(
+        "ReverbServiceCq", [cq = cq.get()] { Poll(cq); }));
+  }
+}
+
+void ReverbServiceAsyncImpl::Stop() {
+  {
+    absl::WriterMutexLock lock(&mu_);
+    if (stopped_) return;
+    stopped_ = true;
+  }
+  // The running handlers start operations on the completion queues, which
+  // must not happen once they have been shut down.
+  blocking_executor_ = nullptr;
+  for (auto& cq : cqs_) {
+    cq->Shutdown();
+  }
+  if (threads_.empty()) {
+    // Never started, but the completion queues must still be drained.
+    for (auto& cq : cqs_) {
+      Poll(cq.get());
+    }
+  }
+  // Joins the threads once the completion queues have been drained.
+  threads_.clear();
+}
+
+void ReverbServiceAsyncImpl::RequestCalls(grpc::ServerCompletionQueue* cq) {
+  RequestCall(
+      absl::make_unique<UnaryCall<CheckpointRequest, CheckpointResponse>>(
+          this, &ReverbService::AsyncService::RequestCheckpoint,
+          &ReverbServiceImpl::Checkpoint),
+      cq);
+  RequestCall(
+      absl::make_unique<
+          UnaryCall<MutatePrioritiesRequest, MutatePrioritiesResponse>>(
+          this, &ReverbService::AsyncService::RequestMutatePriorities,
+          &ReverbServiceImpl::MutatePriorities),
+      cq);
+  RequestCall(absl::make_unique<UnaryCall<ResetRequest, ResetResponse>>(
+                  this, &ReverbService::AsyncService::RequestReset,
+                  &ReverbServiceImpl::Reset),
+              cq);
+  RequestCall(
+      absl::make_unique<UnaryCall<ServerInfoRequest, ServerInfoResponse>>(
+          this, &ReverbService::AsyncService::RequestServerInfo,
+          &ReverbServiceImpl::ServerInfo),
+      cq);
+  RequestCall(absl::make_unique<InsertStreamCall>(this), cq);
+  RequestCall(absl::make_unique<MutatePrioritiesStreamCall>(this), cq);
+  RequestCall(absl::make_unique<SampleStreamCall>(this), cq);
+  RequestCall(absl::make_unique<InitializeConnectionCall>(this), cq);
+  RequestCall(absl::make_unique<ReplicateStreamCall>(this), cq);
+  RequestCall(absl::make_unique<ExportTableCall>(this), cq);
+}
+
+void ReverbServiceAsyncImpl::RequestCall(std::unique_ptr<Call> call,
+                                         grpc::ServerCompletionQueue* cq) {
+  absl::ReaderMutexLock lock(&mu_);
+  if (stopped_) return;
+  // The call deletes itself once it has completed.
+  call.release()->Start(cq);
+}
+
+void ReverbServiceAsyncImpl::Poll(grpc::ServerCompletionQueue* cq) {
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    Call::Handle(tag, ok);
+  }
+}
+
+}  // namespace reverb
+}  // namespace deepmind
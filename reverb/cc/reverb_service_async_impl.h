@@ -0,0 +1,130 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_REVERB_SERVICE_ASYNC_IMPL_H_
+#define REVERB_CC_REVERB_SERVICE_ASYNC_IMPL_H_
+
+#include <memory>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service_impl.h"
+#include "reverb/cc/support/thread_pool.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Serves the tables of a `ReverbServiceImpl` with the asynchronous (completion
+// queue) gRPC API. The synchronous service holds a gRPC thread for as long as
+// a stream is open, which means that a server with thousands of writers and
+// samplers runs thousands of threads. Here every call is instead a state
+// machine which is driven by the events of a completion queue, and a small
+// fixed number of threads polls the completion queues.
+//
+// Streams which are blocked by the rate limiter are parked, rather than
+// waiting on a thread, until the table notifies them that the operation can
+// proceed (see `Table::NotifyWhenCanSample`). The unary calls, which call the
+// blocking handlers of the synchronous service (e.g `Checkpoint`), and the
+// shared memory probes of `InitializeConnection` run on a separate pool of
+// threads so they never hold up the polling threads. Note that, since the
+// completion queue has no notion of requests that are "immediately available",
+// every `InsertStream` and `MutatePrioritiesStream` request is applied on its
+// own rather than batched with the next requests.
+//
+// Usage:
+//
+//   ReverbServiceAsyncImpl async_service(service.get(), num_threads);
+//   grpc::ServerBuilder builder;
+//   async_service.RegisterWith(&builder);
+//   auto server = builder.BuildAndStart();
+//   async_service.Start();
+//   ...
+//   service->Close();
+//   server->Shutdown();
+//   async_service.Stop();
+//
+class ReverbServiceAsyncImpl {
+ public:
+  // `service` implements the calls and must outlive this object. The calls
+  // are driven by `num_threads` threads, each polling its own completion
+  // queue.
+  ReverbServiceAsyncImpl(ReverbServiceImpl* service, int num_threads);
+
+  // Calls `Stop`.
+  ~ReverbServiceAsyncImpl();
+
+  // Registers the service and its completion queues with `builder`. Must be
+  // called once, before the server is built.
+  void RegisterWith(grpc::ServerBuilder* builder);
+
+  // Starts accepting calls and the threads polling the completion queues. Must
+  // be called once the server has been built and started.
+  void Start();
+
+  // Waits for the blocking handlers which are still running, shuts down the
+  // completion queues and joins the threads once all pending calls have
+  // completed. Must be called after the server has been shut down.
+  // The service should be closed before the server is shut down so that
+  // streams which are blocked on the rate limiter are finished.
+  void Stop();
+
+ private:
+  class Call;
+  template <typename RequestT, typename ResponseT>
+  class UnaryCall;
+  template <typename ResponseT, typename RequestT>
+  class StreamCall;
+  class InsertStreamCall;
+  class MutatePrioritiesStreamCall;
+  class SampleStreamCall;
+  class InitializeConnectionCall;
+  class ReplicateStreamCall;
+  class ExportTableCall;
+
+  // Requests the next call of every method on `cq`. Does nothing once `Stop`
+  // has been called.
+  void RequestCalls(grpc::ServerCompletionQueue* cq);
+
+  // Requests the next call of the same method as `call` on `cq`, unless `Stop`
+  // has been called. Takes ownership of `call`.
+  void RequestCall(std::unique_ptr<Call> call, grpc::ServerCompletionQueue* cq);
+
+  // Handles the events of `cq` until it has been shut down and drained.
+  static void Poll(grpc::ServerCompletionQueue* cq);
+
+  ReverbServiceImpl* service_;
+  const int num_threads_;
+
+  ReverbService::AsyncService async_service_;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+  std::vector<std::unique_ptr<internal::Thread>> threads_;
+
+  // Runs the blocking handlers so they don't hold up the polling threads.
+  // Destroyed by `Stop` before the completion queues are shut down.
+  std::unique_ptr<internal::ThreadPool> blocking_executor_;
+
+  // Held (shared) while new calls are requested so that the completion queues
+  // aren't shut down concurrently.
+  absl::Mutex mu_;
+  bool stopped_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_REVERB_SERVICE_ASYNC_IMPL_H_
@@ -0,0 +1,303 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/reverb_service_async_impl.h"
+
+#include <cfloat>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/reverb_service_impl.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Allows one more insert than there have been samples.
+std::shared_ptr<Table> MakeTable() {
+  return std::make_shared<Table>(
+      "dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), /*max_size=*/100,
+      /*max_times_sampled=*/0,
+      absl::make_unique<RateLimiter>(/*samples_per_insert=*/1.0,
+                                     /*min_size_to_sample=*/1,
+                                     /*min_diff=*/-DBL_MAX,
+                                     /*max_diff=*/1.0));
+}
+
+class ReverbServiceAsyncImplTest : public ::testing::TestWithParam<int> {
+ protected:
+  void SetUp() override {
+    table_ = MakeTable();
+    TF_ASSERT_OK(ReverbServiceImpl::Create({table_}, &service_));
+    async_service_ =
+        absl::make_unique<ReverbServiceAsyncImpl>(service_.get(), GetParam());
+
+    grpc::ServerBuilder builder;
+    async_service_->RegisterWith(&builder);
+    server_ = builder.BuildAndStart();
+    ASSERT_NE(server_, nullptr);
+    async_service_->Start();
+    stub_ = ReverbService::NewStub(
+        server_->InProcessChannel(grpc::ChannelArguments()));
+  }
+
+  void TearDown() override { Stop(); }
+
+  void Stop() {
+    if (async_service_ == nullptr) return;
+    service_->Close();
+    server_->Shutdown(std::chrono::system_clock::now() +
+                      std::chrono::seconds(5));
+    async_service_->Stop();
+    async_service_ = nullptr;
+  }
+
+  // Inserts an item which references a chunk of its own, with a tensor of
+  // `chunk_bytes`, and waits for the confirmation of the server.
+  grpc::Status Insert(uint64_t key, int64_t chunk_bytes = 0) {
+    grpc::ClientContext context;
+    auto stream = stub_->InsertStream(&context);
+
+    InsertStreamRequest chunk_request;
+    chunk_request.mutable_chunk()->set_chunk_key(key);
+    if (chunk_bytes > 0) {
+      chunk_request.mutable_chunk()
+          ->mutable_data()
+          ->add_tensors()
+          ->set_tensor_content(std::string(chunk_bytes, 'a'));
+    }
+    InsertStreamRequest item_request;
+    auto* item = item_request.mutable_item()->mutable_item();
+    item->set_key(key);
+    item->set_table("dist");
+    item->set_priority(1);
+    item->add_chunk_keys(key);
+    item_request.mutable_item()->set_send_confirmation(true);
+
+    InsertStreamResponse response;
+    if (stream->Write(chunk_request) && stream->Write(item_request) &&
+        stream->Read(&response)) {
+      EXPECT_EQ(response.key(), key);
+    }
+    stream->WritesDone();
+    return stream->Finish();
+  }
+
+  // Samples `num_samples` items and appends their keys to `keys`.
+  grpc::Status Sample(int num_samples, std::vector<uint64_t>* keys,
+                      int64_t timeout_ms = -1) {
+    grpc::ClientContext context;
+    auto stream = stub_->SampleStream(&context);
+
+    SampleStreamRequest request;
+    request.set_table("dist");
+    request.set_num_samples(num_samples);
+    request.set_flexible_batch_size(1);
+    request.mutable_rate_limiter_timeout()->set_milliseconds(timeout_ms);
+
+    if (stream->Write(request)) {
+      SampleStreamResponse response;
+      while (keys->size() < num_samples && stream->Read(&response)) {
+        if (response.has_info()) keys->push_back(response.info().item().key());
+      }
+    }
+    stream->WritesDone();
+    return stream->Finish();
+  }
+
+  std::shared_ptr<Table> table_;
+  std::unique_ptr<ReverbServiceImpl> service_;
+  std::unique_ptr<ReverbServiceAsyncImpl> async_service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<ReverbService::Stub> stub_;
+};
+
+TEST_P(ReverbServiceAsyncImplTest, SampleAfterInsertWorks) {
+  ASSERT_TRUE(Insert(1).ok());
+
+  std::vector<uint64_t> keys;
+  ASSERT_TRUE(Sample(1, &keys).ok());
+  EXPECT_THAT(keys, ::testing::ElementsAre(1));
+  EXPECT_EQ(table_->size(), 1);
+}
+
+TEST_P(ReverbServiceAsyncImplTest, SampleIsWokenByInsert) {
+  absl::Notification sampled;
+  std::vector<uint64_t> keys;
+  auto thread = internal::StartThread("", [&] {
+    EXPECT_TRUE(Sample(1, &keys).ok());
+    sampled.Notify();
+  });
+
+  // Blocking because there are no data to sample.
+  EXPECT_FALSE(sampled.WaitForNotificationWithTimeout(absl::Milliseconds(50)));
+
+  // The blocked sampler must not prevent the insert from being handled, even
+  // if there is a single polling thread.
+  ASSERT_TRUE(Insert(1).ok());
+  sampled.WaitForNotification();
+  EXPECT_THAT(keys, ::testing::ElementsAre(1));
+}
+
+TEST_P(ReverbServiceAsyncImplTest, InsertIsWokenBySample) {
+  ASSERT_TRUE(Insert(1).ok());
+
+  absl::Notification inserted;
+  auto thread = internal::StartThread("", [&] {
+    EXPECT_TRUE(Insert(2).ok());
+    inserted.Notify();
+  });
+
+  // The rate limiter only allows a single insert ahead of the samples.
+  EXPECT_FALSE(
+      inserted.WaitForNotificationWithTimeout(absl::Milliseconds(50)));
+
+  std::vector<uint64_t> keys;
+  ASSERT_TRUE(Sample(1, &keys).ok());
+  inserted.WaitForNotification();
+  EXPECT_EQ(table_->size(), 2);
+}
+
+TEST_P(ReverbServiceAsyncImplTest, SampleTimesOut) {
+  std::vector<uint64_t> keys;
+  const absl::Time start = absl::Now();
+  grpc::Status status = Sample(1, &keys, /*timeout_ms=*/50);
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::DEADLINE_EXCEEDED);
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(50));
+  EXPECT_THAT(keys, ::testing::IsEmpty());
+}
+
+TEST_P(ReverbServiceAsyncImplTest, UnaryCallsWork) {
+  ASSERT_TRUE(Insert(1).ok());
+
+  {
+    grpc::ClientContext context;
+    ServerInfoResponse response;
+    ASSERT_TRUE(
+        stub_->ServerInfo(&context, ServerInfoRequest(), &response).ok());
+    ASSERT_EQ(response.table_info_size(), 1);
+    EXPECT_EQ(response.table_info(0).current_size(), 1);
+  }
+
+  {
+    grpc::ClientContext context;
+    ResetRequest request;
+    request.set_table("dist");
+    ResetResponse response;
+    ASSERT_TRUE(stub_->Reset(&context, request, &response).ok());
+    EXPECT_EQ(table_->size(), 0);
+  }
+}
+
+TEST_P(ReverbServiceAsyncImplTest, MutatePrioritiesStreamWorks) {
+  ASSERT_TRUE(Insert(1).ok());
+
+  grpc::ClientContext context;
+  MutatePrioritiesResponse response;
+  auto stream = stub_->MutatePrioritiesStream(&context, &response);
+
+  MutatePrioritiesRequest request;
+  request.set_table("dist");
+  auto* update = request.add_updates();
+  update->set_key(1);
+  update->set_priority(2);
+  ASSERT_TRUE(stream->Write(request));
+  request.Clear();
+  request.set_table("dist");
+  request.add_delete_keys(1);
+  ASSERT_TRUE(stream->Write(request));
+  stream->WritesDone();
+  ASSERT_TRUE(stream->Finish().ok());
+  EXPECT_EQ(table_->size(), 0);
+}
+
+TEST_P(ReverbServiceAsyncImplTest, MutatePrioritiesStreamWithInvalidTable) {
+  grpc::ClientContext context;
+  MutatePrioritiesResponse response;
+  auto stream = stub_->MutatePrioritiesStream(&context, &response);
+
+  MutatePrioritiesRequest request;
+  request.set_table("invalid");
+  stream->Write(request);
+  stream->WritesDone();
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::NOT_FOUND);
+}
+
+TEST_P(ReverbServiceAsyncImplTest, StopFinishesBlockedStreams) {
+  absl::Notification finished;
+  auto thread = internal::StartThread("", [&] {
+    std::vector<uint64_t> keys;
+    EXPECT_FALSE(Sample(1, &keys).ok());
+    finished.Notify();
+  });
+
+  EXPECT_FALSE(
+      finished.WaitForNotificationWithTimeout(absl::Milliseconds(50)));
+  Stop();
+  finished.WaitForNotification();
+}
+
+TEST_P(ReverbServiceAsyncImplTest, CancelledSampleStreamRemovesSegments) {
+  ASSERT_TRUE(Insert(1, internal::kMinSharedMemoryChunkBytes).ok());
+
+  grpc::ClientContext context;
+  auto stream = stub_->SampleStream(&context);
+  SampleStreamRequest request;
+  request.set_table("dist");
+  request.set_num_samples(10);
+  request.set_flexible_batch_size(1);
+  request.set_shared_memory(true);
+  ASSERT_TRUE(stream->Write(request));
+
+  // The sampler goes away without reading the segments of the responses.
+  SampleStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  EXPECT_TRUE(response.has_shared_memory_data());
+  context.TryCancel();
+  EXPECT_FALSE(stream->Finish().ok());
+
+  // The segments are removed once the server has cleaned up the call.
+  const absl::Time deadline = absl::Now() + absl::Seconds(10);
+  while (!internal::ListSharedMemorySegmentsOfProcess().empty() &&
+         absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_THAT(internal::ListSharedMemorySegmentsOfProcess(),
+              ::testing::IsEmpty());
+}
+
+INSTANTIATE_TEST_SUITE_P(NumThreads, ReverbServiceAsyncImplTest,
+                         ::testing::Values(1, 4));
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
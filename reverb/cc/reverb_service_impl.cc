@@ -15,26 +15,45 @@
 #include "reverb/cc/reverb_service_impl.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <list>
 #include <memory>
+#include <utility>
 #include <vector>
 
+#include "google/protobuf/duration.pb.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/platform/hash_map.h"
-#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/grpc_utils.h"
+#include "reverb/cc/platform/heap_stats.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/numa.h"
 #include "reverb/cc/platform/thread.h"
+#include "reverb/cc/replica.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/reverb_service_util.h"
 #include "reverb/cc/sampler.h"
 #include "reverb/cc/support/cleanup.h"
 #include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/mpmc_queue.h"
 #include "reverb/cc/support/queue.h"
+#include "reverb/cc/support/reclaimer.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/stream_scheduler.h"
+#include "reverb/cc/support/tracing.h"
 #include "reverb/cc/support/uint128.h"
+#include "reverb/cc/table_extensions/replication.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -42,6 +61,22 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
+// Maximum number of items passed to a single `Table::InsertOrAssignBatch` call
+// by `InsertStream`.
+constexpr int kMaxInsertBatchSize = 128;
+
+// Maximum number of requests of a `MutatePrioritiesStream` which are read
+// ahead, and thus merged into a single `Table::MutateItems` call.
+constexpr int kMutatePrioritiesStreamQueueSize = 64;
+
+// A response of a `ReplicateStream` is written once its events and chunks
+// exceed this many bytes.
+constexpr int64_t kMaxReplicateStreamResponseBytes = 4 * 1024 * 1024;
+
+// Interval at which a `SampleStream` whose rate limiter blocks it checks
+// whether it has been cancelled, see `SampleScheduled`.
+constexpr absl::Duration kStreamSchedulerPollInterval = absl::Milliseconds(50);
+
 inline grpc::Status TableNotFound(absl::string_view name) {
   return grpc::Status(grpc::StatusCode::NOT_FOUND,
                       absl::StrCat("Priority table ", name, " was not found"));
@@ -51,19 +86,179 @@ inline grpc::Status Internal(const std::string& message) {
   return grpc::Status(grpc::StatusCode::INTERNAL, message);
 }
 
+// Bounds the total size of the requests which an `InsertStream` has read but
+// not yet processed.
+class ByteBudget {
+ public:
+  explicit ByteBudget(int64_t capacity) : capacity_(capacity) {}
+
+  // Blocks until `bytes` fit into the budget and then claims them. A request
+  // which is larger than the budget is let through once nothing else is
+  // claimed. Returns false if the budget has been closed.
+  bool Acquire(int64_t bytes) ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    auto fits = [this, bytes]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return closed_ || used_ == 0 || used_ + bytes <= capacity_;
+    };
+    mu_.Await(absl::Condition(&fits));
+    if (closed_) return false;
+    used_ += bytes;
+    return true;
+  }
+
+  void Release(int64_t bytes) ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    used_ -= bytes;
+  }
+
+  // Unblocks all pending and future calls to `Acquire`.
+  void Close() ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    closed_ = true;
+  }
+
+ private:
+  const int64_t capacity_;
+  absl::Mutex mu_;
+  int64_t used_ ABSL_GUARDED_BY(mu_) = 0;
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+// Binds the thread of a stream to the NUMA node of the table it operates on,
+// so that the chunks it parses and the items it inserts or samples are
+// allocated and read on the node of the table.
+class TableNumaBinding {
+ public:
+  // Binds the calling thread to the node of `table` unless the table isn't
+  // pinned or the thread is bound to the node already.
+  void BindTo(const Table& table) {
+    const int node = table.numa_node();
+    if (node < 0 || node == node_) return;
+    binding_ = nullptr;  // Restore the original affinity first.
+    binding_ = internal::BindToNumaNode(node);
+    node_ = node;
+  }
+
+ private:
+  int node_ = -1;
+  std::unique_ptr<internal::ScopedNumaBinding> binding_;
+};
+
+// Appends the data of `chunk` to `response` and adds its size to `bytes`.
+tensorflow::Status AddReplicatedChunk(const ChunkStore::Chunk& chunk,
+                                      ReplicateStreamResponse* response,
+                                      int64_t* bytes) {
+  std::shared_ptr<const ChunkData> data;
+  TF_RETURN_IF_ERROR(chunk.Load(&data));
+  *response->add_chunks() = *data;
+  *bytes += data->ByteSizeLong();
+  return tensorflow::Status::OK();
+}
+
 }  // namespace
 
+// A request of an `InsertStream` which has been read and processed by the
+// background thread of the stream.
+struct ReverbServiceImpl::InsertStreamEntry {
+  // Error which terminates the stream, if any.
+  grpc::Status status;
+
+  // Serialized size of the request.
+  int64_t bytes = 0;
+
+  // When the entry was pushed to the queue of the stream. Only set if the
+  // stream is traced.
+  absl::Time queued_at = absl::InfinitePast();
+
+  // The resolved item and the table to insert it into. `table` is null if the
+  // request contained a chunk.
+  Table* table = nullptr;
+  Table::Item item;
+  internal::InsertStreamConfirmation confirmation =
+      internal::InsertStreamConfirmation::kNone;
+
+  // Items which the item rules of the tables derived from the chunk of the
+  // request. They are inserted without confirmation.
+  internal::DerivedItems derived;
+};
+
+// A message of a `SampleStream` which has been sampled ahead by the background
+// thread of the stream.
+struct ReverbServiceImpl::SampleStreamEntry {
+  // Null for the last entry of the stream, which holds the status that the
+  // stream ends with.
+  std::unique_ptr<internal::SampleResponseWriter::Message> message;
+  grpc::Status status;
+
+  // Serialized size of the message.
+  int64_t bytes = 0;
+};
+
+ReverbServiceImpl::RpcMetricsByMethod::RpcMetricsByMethod(
+    internal::MetricsRegistry* registry)
+    : checkpoint(registry, "Checkpoint"),
+      export_table(registry, "ExportTable"),
+      initialize_connection(registry, "InitializeConnection"),
+      insert_stream(registry, "InsertStream"),
+      mutate_priorities(registry, "MutatePriorities"),
+      mutate_priorities_stream(registry, "MutatePrioritiesStream"),
+      replicate_stream(registry, "ReplicateStream"),
+      reset(registry, "Reset"),
+      sample_stream(registry, "SampleStream"),
+      server_info(registry, "ServerInfo") {}
+
 ReverbServiceImpl::ReverbServiceImpl(std::shared_ptr<Checkpointer> checkpointer)
-    : checkpointer_(std::move(checkpointer)) {}
+    : checkpointer_(std::move(checkpointer)), rpc_metrics_(&metrics_) {}
 
 tensorflow::Status ReverbServiceImpl::Create(
     std::vector<std::shared_ptr<Table>> tables,
     std::shared_ptr<Checkpointer> checkpointer,
     std::unique_ptr<ReverbServiceImpl>* service) {
+  return Create(std::move(tables), std::move(checkpointer), Options(),
+                service);
+}
+
+tensorflow::Status ReverbServiceImpl::Create(
+    std::vector<std::shared_ptr<Table>> tables,
+    std::shared_ptr<Checkpointer> checkpointer, const Options& options,
+    std::unique_ptr<ReverbServiceImpl>* service) {
+  if (options.insert_stream_queue_size <= 0) {
+    return tensorflow::errors::InvalidArgument(
+        "insert_stream_queue_size must be > 0 but got ",
+        options.insert_stream_queue_size);
+  }
+  if (options.memory_soft_limit_bytes > 0 &&
+      options.memory_hard_limit_bytes > 0 &&
+      options.memory_soft_limit_bytes > options.memory_hard_limit_bytes) {
+    return tensorflow::errors::InvalidArgument(
+        "memory_soft_limit_bytes (", options.memory_soft_limit_bytes,
+        ") must not exceed memory_hard_limit_bytes (",
+        options.memory_hard_limit_bytes, ").");
+  }
+  if (!options.primary_address.empty() && options.warm_start) {
+    return tensorflow::errors::InvalidArgument(
+        "A replica can't warm start as its tables are replaced with those of "
+        "the primary.");
+  }
+  if (!options.stream_classes.empty()) {
+    if (!options.stream_classes.contains(options.default_stream_class)) {
+      return tensorflow::errors::InvalidArgument(
+          "default_stream_class '", options.default_stream_class,
+          "' is not one of the stream classes.");
+    }
+    for (const auto& [name, class_options] : options.stream_classes) {
+      if (!(class_options.weight > 0)) {
+        return tensorflow::errors::InvalidArgument(
+            "Weight of stream class '", name, "' must be > 0 but got ",
+            class_options.weight, ".");
+      }
+    }
+  }
+
   // Can't use make_unique because it can't see the Impl's private constructor.
   auto new_service = std::unique_ptr<ReverbServiceImpl>(
       new ReverbServiceImpl(std::move(checkpointer)));
-  TF_RETURN_IF_ERROR(new_service->Initialize(std::move(tables)));
+  TF_RETURN_IF_ERROR(new_service->Initialize(std::move(tables), options));
   std::swap(new_service, *service);
   return tensorflow::Status::OK();
 }
@@ -75,46 +270,274 @@ tensorflow::Status ReverbServiceImpl::Create(
 }
 
 tensorflow::Status ReverbServiceImpl::Initialize(
-    std::vector<std::shared_ptr<Table>> tables) {
-  if (checkpointer_ != nullptr) {
-    auto status = checkpointer_->LoadLatest(&chunk_store_, &tables);
+    std::vector<std::shared_ptr<Table>> tables,
+    const Options& options) {
+  options_ = options;
+  std::unique_ptr<ChunkStore> chunk_store;
+  TF_RETURN_IF_ERROR(ChunkStore::Create(options.chunk_store, &chunk_store));
+  chunk_store_ = std::move(chunk_store);
+  memory_admission_ = absl::make_unique<internal::MemoryAdmission>(
+      options.memory_soft_limit_bytes, options.memory_hard_limit_bytes,
+      options.memory_max_read_delay, [store = chunk_store_.get()] {
+        return store->info().allocated_bytes();
+      });
+
+  // The logs must be added before the checkpoint is loaded as the tables are
+  // replaced by (empty) tables which inherit their extensions.
+  if (options.enable_replication || !options.primary_address.empty()) {
+    for (auto& table : tables) {
+      if (table->size() > 0) {
+        return tensorflow::errors::InvalidArgument(
+            "Table ", table->name(), " must be empty to be replicated.");
+      }
+      auto log = std::make_shared<ReplicationLog>();
+      table->UnsafeAddExtension(log);
+      replication_logs_[table->name()] = std::move(log);
+    }
+  }
+
+  if (checkpointer_ != nullptr && !options.warm_start) {
+    auto status = checkpointer_->LoadLatest(chunk_store_.get(), &tables);
     if (!status.ok() && !tensorflow::errors::IsNotFound(status)) {
       return status;
     }
   }
 
   for (auto& table : tables) {
-    tables_[table->name()] = std::move(table);
+    tables_[table->name()] = table;
+  }
+  for (const auto& [name, node] : options.table_numa_nodes) {
+    Table* table = TableByName(name);
+    if (table == nullptr) {
+      return tensorflow::errors::InvalidArgument(
+          "NUMA node set for unknown table ", name, ".");
+    }
+    if (node < 0 || node >= internal::NumNumaNodes()) {
+      return tensorflow::errors::InvalidArgument(
+          "NUMA node ", node, " of table ", name, " is not in [0, ",
+          internal::NumNumaNodes(), ").");
+    }
+    table->set_numa_node(node);
   }
+  for (const auto& [name, rules] : options.table_item_rules) {
+    Table* table = TableByName(name);
+    if (table == nullptr) {
+      return tensorflow::errors::InvalidArgument(
+          "Item rules set for unknown table ", name, ".");
+    }
+    for (const ItemRule& rule : rules) {
+      if (rule.length() <= 0 || rule.stride() <= 0) {
+        return tensorflow::errors::InvalidArgument(
+            "Item rules of table ", name,
+            " must have length and stride > 0 but got ", rule.length(),
+            " and ", rule.stride(), ".");
+      }
+    }
+    if (rules.empty()) continue;
+    table->set_item_rules(rules);
+    item_rule_tables_.push_back(table);
+  }
+  if (!options.stream_classes.empty()) {
+    stream_scheduler_ = absl::make_unique<internal::StreamScheduler>(
+        options.max_concurrent_stream_operations, options.stream_classes);
+    default_stream_class_ =
+        stream_scheduler_->FindClass(options.default_stream_class);
+    for (int i = 0; i < stream_scheduler_->num_classes(); i++) {
+      stream_class_metrics_.push_back(
+          absl::make_unique<internal::StreamClassMetrics>(
+              &metrics_, stream_scheduler_->class_name(i)));
+    }
+  }
+  if (!options.workload_trace_path.empty()) {
+    std::unique_ptr<internal::WorkloadTraceWriter> workload_trace;
+    TF_RETURN_IF_ERROR(internal::WorkloadTraceWriter::Create(
+        options.workload_trace_path, &workload_trace));
+    workload_trace_ = std::move(workload_trace);
+    for (auto& table : tables_) {
+      table.second->set_workload_trace(workload_trace_);
+    }
+  }
+
+  // The state of the tables and the chunk store is read from their existing
+  // stats when the metrics are exported rather than mirrored on every call.
+  metrics_.AddCollector([this](internal::MetricsWriter* writer) {
+    chunk_store_->ExportMetrics(writer);
+    for (const auto& table : tables_) {
+      table.second->ExportMetrics(writer);
+    }
+  });
 
   tables_state_id_ = absl::MakeUint128(absl::Uniform<uint64_t>(rnd_),
                                        absl::Uniform<uint64_t>(rnd_));
 
+  if (checkpointer_ != nullptr &&
+      options.checkpoint_interval > absl::ZeroDuration()) {
+    absl::MutexLock lock(&checkpoint_mu_);
+    EncodeAsDurationProto(options.checkpoint_interval,
+                          checkpoint_scheduler_info_.mutable_interval());
+    checkpoint_scheduler_info_.set_max_bytes_per_second(
+        options.checkpoint_max_bytes_per_second);
+    checkpoint_scheduler_ = absl::make_unique<internal::PeriodicClosure>(
+        [this] { RunScheduledCheckpoint(); }, options.checkpoint_interval,
+        "CheckpointScheduler");
+    TF_RETURN_IF_ERROR(checkpoint_scheduler_->Start());
+  }
+
+  if (checkpointer_ != nullptr && options.warm_start) {
+    for (auto& table : tables) {
+      double fraction = options.default_min_restored_fraction_to_sample;
+      auto it = options.min_restored_fraction_to_sample.find(table->name());
+      if (it != options.min_restored_fraction_to_sample.end()) {
+        fraction = it->second;
+      }
+      table->BeginRestore(fraction);
+    }
+    restore_thread_ = internal::StartThread(
+        "RestoreCheckpoint", [this, tables = std::move(tables)]() mutable {
+          RestoreLatestCheckpoint(std::move(tables));
+        });
+  }
+
+  if (!options.primary_address.empty()) {
+    std::vector<std::shared_ptr<Table>> replicated;
+    std::vector<std::shared_ptr<ReplicationLog>> logs;
+    for (const auto& [name, table] : tables_) {
+      replicated.push_back(table);
+      logs.push_back(replication_logs_[name]);
+    }
+    grpc::ChannelArguments arguments;
+    arguments.SetMaxReceiveMessageSize(-1);  // Unlimited.
+    arguments.SetMaxSendMessageSize(-1);     // Unlimited.
+    replica_ = absl::make_unique<Replica>(
+        /* grpc_gen:: */ReverbService::NewStub(CreateCustomGrpcChannel(
+            options.primary_address, MakeChannelCredentials(), arguments)),
+        options.primary_address, std::move(replicated), std::move(logs),
+        chunk_store_, options.replica);
+  }
+
   return tensorflow::Status::OK();
 }
 
+ReverbServiceImpl::~ReverbServiceImpl() {
+  if (replica_ != nullptr) replica_->Stop();
+  StopCheckpointScheduler();
+}
+
+void ReverbServiceImpl::RestoreLatestCheckpoint(
+    std::vector<std::shared_ptr<Table>> tables) {
+  const absl::Time start = absl::Now();
+  auto status = checkpointer_->RestoreLatest(chunk_store_.get(), tables);
+  if (status.ok()) {
+    REVERB_LOG(REVERB_INFO) << "Restored latest checkpoint in "
+                            << absl::Now() - start << ".";
+  } else if (tensorflow::errors::IsNotFound(status)) {
+    REVERB_LOG(REVERB_INFO) << "No checkpoint to restore: " << status;
+  } else {
+    // The tables keep serving the items which have been restored so far.
+    REVERB_LOG(REVERB_ERROR) << "Failed to restore latest checkpoint: "
+                             << status;
+  }
+  for (auto& table : tables) {
+    table->EndRestore();
+  }
+}
+
 grpc::Status ReverbServiceImpl::Checkpoint(grpc::ServerContext* context,
                                            const CheckpointRequest* request,
                                            CheckpointResponse* response) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.checkpoint);
+  rpc.AddReceivedBytes(request->ByteSizeLong());
   if (checkpointer_ == nullptr) {
     return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
                         "no Checkpointer configured for the replay service.");
   }
 
-  std::vector<Table*> tables;
-  for (auto& table : tables_) {
-    tables.push_back(table.second.get());
+  {
+    absl::MutexLock lock(&checkpoint_mu_);
+    num_checkpoints_in_progress_++;
   }
-
-  auto status = checkpointer_->Save(std::move(tables), 1,
-                                    response->mutable_checkpoint_path());
+  auto status =
+      SaveCheckpoint(Checkpointer::SaveOptions(),
+                     response->mutable_checkpoint_path(), /*stats=*/nullptr);
   if (!status.ok()) return ToGrpcStatus(status);
 
   REVERB_LOG(REVERB_INFO) << "Stored checkpoint to "
                           << response->checkpoint_path();
+  rpc.AddSentBytes(response->ByteSizeLong());
   return grpc::Status::OK;
 }
 
+tensorflow::Status ReverbServiceImpl::SaveCheckpoint(
+    const Checkpointer::SaveOptions& options, std::string* path,
+    Checkpointer::SaveStats* stats) {
+  auto done = internal::MakeCleanup([this] {
+    absl::MutexLock lock(&checkpoint_mu_);
+    num_checkpoints_in_progress_--;
+  });
+
+  std::vector<Table*> tables;
+  for (auto& table : tables_) {
+    tables.push_back(table.second.get());
+  }
+  return checkpointer_->Save(std::move(tables), 1, options, path, stats);
+}
+
+void ReverbServiceImpl::RunScheduledCheckpoint() {
+  {
+    absl::MutexLock lock(&checkpoint_mu_);
+    if (num_checkpoints_in_progress_ > 0) {
+      checkpoint_scheduler_info_.set_num_skipped(
+          checkpoint_scheduler_info_.num_skipped() + 1);
+      REVERB_LOG(REVERB_INFO) << "Skipping scheduled checkpoint as another "
+                                 "checkpoint is still in progress.";
+      return;
+    }
+    num_checkpoints_in_progress_++;
+  }
+
+  Checkpointer::SaveOptions options;
+  options.max_bytes_per_second = options_.checkpoint_max_bytes_per_second;
+  std::string path;
+  Checkpointer::SaveStats stats;
+  const absl::Time start = absl::Now();
+  auto status = SaveCheckpoint(options, &path, &stats);
+  const absl::Duration duration = absl::Now() - start;
+
+  absl::MutexLock lock(&checkpoint_mu_);
+  if (!status.ok()) {
+    REVERB_LOG(REVERB_ERROR) << "Scheduled checkpoint failed: " << status;
+    checkpoint_scheduler_info_.set_num_failed(
+        checkpoint_scheduler_info_.num_failed() + 1);
+    checkpoint_scheduler_info_.set_last_error(status.ToString());
+    return;
+  }
+  REVERB_LOG(REVERB_INFO) << "Stored scheduled checkpoint to " << path
+                          << " in " << duration << ".";
+  checkpoint_scheduler_info_.set_num_completed(
+      checkpoint_scheduler_info_.num_completed() + 1);
+  EncodeAsDurationProto(duration,
+                        checkpoint_scheduler_info_.mutable_last_duration());
+  checkpoint_scheduler_info_.set_last_bytes_written(stats.num_bytes_written);
+  checkpoint_scheduler_info_.set_last_checkpoint_path(path);
+}
+
+void ReverbServiceImpl::StopCheckpointScheduler() {
+  std::unique_ptr<internal::PeriodicClosure> scheduler;
+  {
+    absl::MutexLock lock(&checkpoint_mu_);
+    scheduler = std::move(checkpoint_scheduler_);
+  }
+  // The lock must not be held while the scheduled checkpoint (if any) is
+  // awaited.
+  if (scheduler != nullptr) TF_CHECK_OK(scheduler->Stop());
+}
+
+std::unique_ptr<internal::Thread> ReverbServiceImpl::StartStreamThread(
+    absl::string_view name, std::function<void()> fn) const {
+  return internal::StartThread(options_.stream_executor.get(), name,
+                               std::move(fn));
+}
+
 grpc::Status ReverbServiceImpl::InsertStream(
     grpc::ServerContext* context,
     grpc::ServerReaderWriter<InsertStreamResponse, InsertStreamRequest>*
@@ -126,94 +549,235 @@ grpc::Status ReverbServiceImpl::InsertStreamInternal(
     grpc::ServerContext* context,
     grpc::ServerReaderWriterInterface<InsertStreamResponse,
                                       InsertStreamRequest>* stream) {
-  // Start a background thread that unpacks the data ahead of time.
-  deepmind::reverb::internal::Queue<InsertStreamRequest> queue(1);
-  auto read_thread = internal::StartThread("ReadThread", [stream, &queue]() {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.insert_stream);
+  if (auto status = CheckWritable(); !status.ok()) return status;
+  internal::ScopedTraceContext remote(internal::ServerTraceContext(context));
+  internal::ScopedSpan call_span("ReverbService/InsertStream");
+  const internal::TraceContext trace = call_span.context();
+  internal::InsertStreamStats stats(context ? context->peer() : "");
+  const int stream_class = StreamClass(context);
+  RegisterInsertStream(&stats);
+  auto unregister =
+      internal::MakeCleanup([this, &stats] { UnregisterInsertStream(&stats); });
+
+  // Requests are read, have their chunks inserted into the chunk store and
+  // have their items resolved by a background thread so that this overlaps
+  // with the insertion of the earlier items into the tables. The requests
+  // which have been read ahead are bounded both by count and by size.
+  internal::MpmcQueue<InsertStreamEntry> queue(
+      options_.insert_stream_queue_size);
+  ByteBudget budget(options_.insert_stream_queue_bytes);
+  auto read_thread = StartStreamThread("ReadThread", [&]() {
+    internal::ScopedTraceContext active(trace);
+    // The request is reused rather than constructing a new one every time.
     InsertStreamRequest request;
-    while (stream->Read(&request) && queue.Push(std::move(request))) {
-      request = InsertStreamRequest();
+    internal::InsertStreamChunks chunks;
+    internal::ItemDeriver deriver(item_rule_tables_);
+    // The chunks of a request are parsed before its item names the table, so
+    // the thread moves to the node of a table once it has seen an item for
+    // it and allocates the following chunks there.
+    TableNumaBinding numa_binding;
+    while (true) {
+      if (const absl::Duration delay = memory_admission_->ReadDelay();
+          delay > absl::ZeroDuration()) {
+        internal::ScopedSpan span("InsertStream::MemoryBackpressure");
+        absl::SleepFor(delay);
+      }
+      if (!stream->Read(&request)) break;
+      InsertStreamEntry entry;
+      entry.bytes = request.ByteSizeLong();
+      stats.bytes.fetch_add(entry.bytes, std::memory_order_relaxed);
+      rpc.AddReceivedBytes(entry.bytes);
+      {
+        internal::ScopedStreamOperation operation(
+            stream_scheduler_.get(), stream_class,
+            ClassMetrics(stream_class), context);
+        internal::ScopedSpan span("InsertStream::ReadRequest");
+        if (operation.started()) {
+          entry.status =
+              ReadInsertStreamRequest(&request, &chunks, &deriver, &entry);
+          operation.Charge(entry.bytes);
+        } else {
+          entry.status = grpc::Status(
+              grpc::StatusCode::CANCELLED,
+              "InsertStream was cancelled while waiting for its turn.");
+          // Nobody else will read the segment of the request.
+          if (request.has_shared_memory_chunk()) {
+            internal::RemoveSharedMemoryChunk(request.shared_memory_chunk());
+          }
+        }
+      }
+      if (entry.table != nullptr) numa_binding.BindTo(*entry.table);
+      const bool failed = !entry.status.ok();
+      if (internal::IsTracing()) entry.queued_at = absl::Now();
+      if (!budget.Acquire(entry.bytes) || !queue.Push(std::move(entry)) ||
+          failed) {
+        break;
+      }
+      request.Clear();
     }
     queue.SetLastItemPushed();
   });
-  auto cleanup = internal::MakeCleanup([&queue] { queue.Close(); });
+  auto cleanup = internal::MakeCleanup([&queue, &budget] {
+    queue.Close();
+    budget.Close();
+  });
+
+  // Consecutive items targeting the same table are inserted with a single call
+  // to `Table::InsertOrAssignBatch`. Items targeting tables which share a rate
+  // limiter, e.g. the same trajectory written to a group of tables, are
+  // admitted together by `Table::InsertOrAssignGroupBatch`. The batch is
+  // flushed when the target table changes to one outside of the group and when
+  // no more requests are immediately available in `queue`.
+  Table* batch_table = nullptr;
+  std::vector<Table*> batch_tables;
+  bool batch_spans_tables = false;
+  std::vector<Table::Item> batch_items;
+  std::vector<std::pair<uint64_t, internal::InsertStreamConfirmation>>
+      batch_confirmations;
+
+  auto flush_batch = [&]() -> grpc::Status {
+    if (batch_items.empty()) return grpc::Status::OK;
 
-  internal::flat_hash_map<ChunkStore::Key, std::shared_ptr<ChunkStore::Chunk>>
-      chunks;
-
-  InsertStreamRequest request;
-  while (queue.Pop(&request)) {
-    if (request.has_chunk()) {
-      ChunkStore::Key key = request.chunk().chunk_key();
-      std::shared_ptr<ChunkStore::Chunk> chunk =
-          chunk_store_.Insert(std::move(*request.mutable_chunk()));
-      if (!chunk) {
-        return grpc::Status(grpc::StatusCode::CANCELLED,
-                            "Service has been closed");
+    std::vector<tensorflow::Status> statuses;
+    if (batch_spans_tables) {
+      std::vector<std::pair<Table*, Table::Item>> group_items;
+      group_items.reserve(batch_items.size());
+      for (int i = 0; i < batch_items.size(); i++) {
+        group_items.emplace_back(batch_tables[i], std::move(batch_items[i]));
       }
-      chunks[key] = std::move(chunk);
-    } else if (request.has_item()) {
-      Table::Item item;
-
-      auto push_or = [&chunks, &item](ChunkStore::Key key) -> grpc::Status {
-        auto it = chunks.find(key);
-        if (it == chunks.end()) {
-          return Internal(
-              absl::StrCat("Could not find sequence chunk ", key, "."));
-        }
-        item.chunks.push_back(it->second);
-        return grpc::Status::OK;
-      };
+      statuses = Table::InsertOrAssignGroupBatch(std::move(group_items));
+    } else {
+      statuses = batch_table->InsertOrAssignBatch(std::move(batch_items));
+    }
+    batch_items.clear();
+    batch_tables.clear();
+    batch_spans_tables = false;
 
-      for (ChunkStore::Key key : request.item().item().chunk_keys()) {
-        auto status = push_or(key);
-        if (!status.ok()) return status;
+    // Let caller know that the items have been inserted if requested by the
+    // caller. The confirmations of the batch are coalesced into a single
+    // response if the caller accepts it.
+    grpc::Status status;
+    std::vector<InsertStreamResponse> responses;
+    for (int i = 0; i < statuses.size(); i++) {
+      if (!statuses[i].ok()) {
+        status = ToGrpcStatus(statuses[i]);
+        break;
+      }
+      internal::AddInsertStreamConfirmation(batch_confirmations[i].first,
+                                            batch_confirmations[i].second,
+                                            &responses);
+    }
+    for (const auto& response : responses) {
+      internal::ScopedSpan span("InsertStream::WriteConfirmation");
+      if (!stream->Write(response)) {
+        return Internal(absl::StrCat(
+            "Error when sending confirmation that item ",
+            response.keys().empty() ? response.key() : response.keys(0),
+            " has been successfully inserted/updated."));
       }
+      rpc.AddSentBytes(response.ByteSizeLong());
+    }
+    stats.items.fetch_add(statuses.size(), std::memory_order_relaxed);
+    batch_confirmations.clear();
+    return status;
+  };
 
-      const auto& table_name = request.item().item().table();
-      Table* table = TableByName(table_name);
-      if (table == nullptr) return TableNotFound(table_name);
+  TableNumaBinding numa_binding;
+  auto add_to_batch =
+      [&](Table* table, Table::Item item,
+          internal::InsertStreamConfirmation confirmation) -> grpc::Status {
+    if (table != batch_table) {
+      numa_binding.BindTo(*table);
+      if (batch_table != nullptr && !batch_items.empty() &&
+          table->SharesRateLimiterWith(*batch_table)) {
+        batch_spans_tables = true;
+      } else if (auto status = flush_batch(); !status.ok()) {
+        return status;
+      }
+      batch_table = table;
+    }
+    batch_confirmations.emplace_back(item.item.key(), confirmation);
+    batch_tables.push_back(table);
+    batch_items.push_back(std::move(item));
+    return grpc::Status::OK;
+  };
 
-      const auto item_key = request.item().item().key();
-      item.item = std::move(*request.mutable_item()->mutable_item());
+  InsertStreamEntry entry;
+  while (queue.Pop(&entry)) {
+    budget.Release(entry.bytes);
+    if (entry.queued_at != absl::InfinitePast()) {
+      internal::RecordSpan("InsertStream::QueueWait", entry.queued_at,
+                           absl::Now());
+    }
 
-      if (auto status = table->InsertOrAssign(item); !status.ok()) {
-        return ToGrpcStatus(status);
-      }
+    // The items which were read before the failed request are still inserted.
+    if (!entry.status.ok()) {
+      if (auto status = flush_batch(); !status.ok()) return status;
+      return entry.status;
+    }
 
-      // Let caller know that the item has been inserted if requested by the
-      // caller.
-      if (request.item().send_confirmation()) {
-        InsertStreamResponse response;
-        response.set_key(item_key);
-        if (!stream->Write(response)) {
-          return Internal(absl::StrCat(
-              "Error when sending confirmation that item ", item_key,
-              " has been successfully inserted/updated."));
-        }
+    if (entry.table != nullptr) {
+      if (auto status = add_to_batch(entry.table, std::move(entry.item),
+                                     entry.confirmation);
+          !status.ok()) {
+        return status;
       }
-
-      // Only keep specified chunks.
-      absl::flat_hash_set<int64_t> keep_keys{
-          request.item().keep_chunk_keys().begin(),
-          request.item().keep_chunk_keys().end()};
-      for (auto it = chunks.cbegin(); it != chunks.cend();) {
-        if (keep_keys.find(it->first) == keep_keys.end()) {
-          chunks.erase(it++);
-        } else {
-          ++it;
-        }
+    }
+    for (auto& [table, item] : entry.derived) {
+      if (auto status = add_to_batch(table, std::move(item),
+                                     internal::InsertStreamConfirmation::kNone);
+          !status.ok()) {
+        return status;
       }
-      REVERB_CHECK_EQ(chunks.size(), keep_keys.size())
-          << "Kept less chunks than expected.";
+    }
+
+    // Insert the pending items rather than blocking on the next request.
+    if (queue.size() == 0 || batch_items.size() >= kMaxInsertBatchSize) {
+      if (auto status = flush_batch(); !status.ok()) return status;
     }
   }
 
-  return grpc::Status::OK;
+  return flush_batch();
+}
+
+grpc::Status ReverbServiceImpl::ReadInsertStreamRequest(
+    InsertStreamRequest* request, internal::InsertStreamChunks* chunks,
+    internal::ItemDeriver* deriver, InsertStreamEntry* entry) {
+  if (request->has_chunk() || request->has_shared_memory_chunk()) {
+    if (auto status = memory_admission_->AdmitChunk(*request); !status.ok()) {
+      return status;
+    }
+    return internal::InsertStreamChunk(chunk_store_.get(), request, chunks,
+                                       deriver, &entry->derived);
+  }
+  if (!request->has_item()) return grpc::Status::OK;
+
+  const auto& table_name = request->item().item().table();
+  entry->table = TableByName(table_name);
+  if (entry->table == nullptr) return TableNotFound(table_name);
+  entry->confirmation = internal::ConfirmationOf(request->item());
+  return internal::PrepareInsertStreamItem(request, chunks, &entry->item);
+}
+
+void ReverbServiceImpl::RegisterInsertStream(
+    const internal::InsertStreamStats* stats) {
+  absl::MutexLock lock(&insert_streams_mu_);
+  insert_streams_.insert(stats);
+}
+
+void ReverbServiceImpl::UnregisterInsertStream(
+    const internal::InsertStreamStats* stats) {
+  absl::MutexLock lock(&insert_streams_mu_);
+  insert_streams_.erase(stats);
 }
 
 grpc::Status ReverbServiceImpl::MutatePriorities(
     grpc::ServerContext* context, const MutatePrioritiesRequest* request,
     MutatePrioritiesResponse* response) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.mutate_priorities);
+  rpc.AddReceivedBytes(request->ByteSizeLong());
+  if (auto status = CheckWritable(); !status.ok()) return status;
   Table* table = TableByName(request->table());
   if (table == nullptr) return TableNotFound(request->table());
 
@@ -225,9 +789,264 @@ grpc::Status ReverbServiceImpl::MutatePriorities(
   return grpc::Status::OK;
 }
 
+grpc::Status ReverbServiceImpl::MutatePrioritiesStream(
+    grpc::ServerContext* context,
+    grpc::ServerReader<MutatePrioritiesRequest>* reader,
+    MutatePrioritiesResponse* response) {
+  return MutatePrioritiesStreamInternal(context, reader);
+}
+
+grpc::Status ReverbServiceImpl::MutatePrioritiesStreamInternal(
+    grpc::ServerContext* context,
+    grpc::ServerReaderInterface<MutatePrioritiesRequest>* reader) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.mutate_priorities_stream);
+  if (auto status = CheckWritable(); !status.ok()) return status;
+  // Requests are read by a background thread so that the requests which
+  // arrive while the table is being mutated are immediately available once
+  // the mutation completes. These are then merged and applied together.
+  internal::Queue<MutatePrioritiesRequest> queue(
+      kMutatePrioritiesStreamQueueSize);
+  auto read_thread = StartStreamThread("ReadThread", [&]() {
+    MutatePrioritiesRequest request;
+    while (reader->Read(&request)) {
+      rpc.AddReceivedBytes(request.ByteSizeLong());
+      if (!queue.Push(std::move(request))) break;
+      request.Clear();
+    }
+    queue.SetLastItemPushed();
+  });
+  auto cleanup = internal::MakeCleanup([&queue] { queue.Close(); });
+
+  internal::PriorityUpdateMerger merger;
+  MutatePrioritiesRequest request;
+  bool has_request = queue.Pop(&request);
+  while (has_request) {
+    Table* table = TableByName(request.table());
+    if (table == nullptr) return TableNotFound(request.table());
+
+    // Merge the requests for the same table which have already been read. A
+    // request for another table is applied in the next round.
+    merger.Add(request);
+    while ((has_request = queue.size() > 0 && queue.Pop(&request)) &&
+           request.table() == table->name()) {
+      merger.Add(request);
+    }
+
+    if (auto status = merger.Apply(table); !status.ok()) {
+      return ToGrpcStatus(status);
+    }
+    if (!has_request) has_request = queue.Pop(&request);
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status ReverbServiceImpl::ReplicateStream(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriter<ReplicateStreamResponse, ReplicateStreamRequest>*
+        stream) {
+  return ReplicateStreamInternal(context, stream);
+}
+
+grpc::Status ReverbServiceImpl::ReplicateStreamInternal(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriterInterface<ReplicateStreamResponse,
+                                      ReplicateStreamRequest>* stream) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.replicate_stream);
+  if (!options_.enable_replication) {
+    return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION,
+                        "Replication is not enabled on this server.");
+  }
+
+  ReplicateStreamRequest request;
+  if (!stream->Read(&request)) {
+    return Internal("Could not read initial request");
+  }
+  rpc.AddReceivedBytes(request.ByteSizeLong());
+  if (request.tables().empty()) {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        "`tables` must not be empty.");
+  }
+  std::vector<Table*> tables;
+  for (const auto& name : request.tables()) {
+    Table* table = TableByName(name);
+    if (table == nullptr) return TableNotFound(name);
+    tables.push_back(table);
+  }
+
+  // The feed is subscribed before the tables are copied so that it receives
+  // every mutation which the copies miss (see `ReplicationLog`).
+  auto feed = std::make_shared<ReplicationFeed>(
+      options_.replication_max_pending_events);
+  for (Table* table : tables) {
+    replication_logs_[table->name()]->Subscribe(feed);
+  }
+  auto unsubscribe = internal::MakeCleanup([this, &tables, &feed] {
+    feed->Close();
+    for (Table* table : tables) {
+      replication_logs_[table->name()]->Unsubscribe(feed.get());
+    }
+  });
+
+  ReplicaInfo info;
+  info.set_address(request.replica_address());
+  *info.mutable_tables() = request.tables();
+  RegisterReplica(&info);
+  auto unregister =
+      internal::MakeCleanup([this, &info] { UnregisterReplica(&info); });
+
+  // The later requests report the samples served by the replica. The stream
+  // ends once the replica closes it.
+  auto read_thread = StartStreamThread("ReadThread", [&]() {
+    ReplicateStreamRequest report;
+    while (stream->Read(&report)) {
+      rpc.AddReceivedBytes(report.ByteSizeLong());
+      for (const auto& samples : report.samples()) {
+        if (Table* table = TableByName(samples.table()); table != nullptr) {
+          table->RecordReplicaSamples(samples.num_samples());
+        }
+      }
+      report.Clear();
+    }
+    feed->Close();
+  });
+  // Unblocks the read thread if the stream fails before the replica closes
+  // it.
+  bool closed_by_replica = false;
+  auto cancel = internal::MakeCleanup([context, &closed_by_replica] {
+    if (context != nullptr && !closed_by_replica) context->TryCancel();
+  });
+
+  // Chunks which have been sent to the replica and are still referenced by
+  // its items.
+  ReplicatedChunks sent;
+  ReplicateStreamResponse response;
+  int64_t response_bytes = 0;
+  auto write = [&]() {
+    rpc.AddSentBytes(response.ByteSizeLong());
+    const bool ok = stream->Write(response);
+    response.Clear();
+    response_bytes = 0;
+    return ok;
+  };
+
+  for (Table* table : tables) {
+    std::vector<Table::Item> items = table->Copy();
+    response.set_table(table->name());
+    response.set_snapshot_size(items.size());
+    for (auto& item : items) {
+      for (const auto& chunk : item.chunks) {
+        if (sent.Contains(chunk->data().chunk_key())) continue;
+        if (auto status =
+                AddReplicatedChunk(*chunk, &response, &response_bytes);
+            !status.ok()) {
+          return ToGrpcStatus(status);
+        }
+      }
+      sent.Add(table->name(), item.item, {});
+      response_bytes += item.item.ByteSizeLong();
+      *response.add_events()->mutable_insert() = std::move(item.item);
+      if (response_bytes >= kMaxReplicateStreamResponseBytes) {
+        if (!write()) return Internal("Failed to write to Replicate stream.");
+        response.set_table(table->name());
+        response.set_snapshot_size(items.size());
+      }
+    }
+    response.set_end_of_snapshot(true);
+    if (!write()) return Internal("Failed to write to Replicate stream.");
+  }
+
+  std::vector<ReplicationFeed::Batch> batches;
+  while (true) {
+    auto status = feed->Pop(absl::InfiniteDuration(), &batches);
+    if (tensorflow::errors::IsCancelled(status)) break;
+    if (!status.ok()) return ToGrpcStatus(status);
+
+    for (auto& batch : batches) {
+      response.set_table(batch.table);
+      for (auto& event : batch.events) {
+        switch (event.type) {
+          case TableExtensionEvent::Type::kInsert: {
+            std::vector<uint64_t> keys;
+            for (uint64_t key : event.item.item.chunk_keys()) {
+              if (!sent.Contains(key)) keys.push_back(key);
+            }
+            // Chunks are only gone once the item has been deleted again, which
+            // a later event replicates, so the insert is skipped.
+            std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+            if (!chunk_store_->Get(keys, &chunks).ok()) break;
+            for (const auto& chunk : chunks) {
+              if (auto status =
+                      AddReplicatedChunk(*chunk, &response, &response_bytes);
+                  !status.ok()) {
+                return ToGrpcStatus(status);
+              }
+            }
+            sent.Add(batch.table, event.item.item, {});
+            response_bytes += event.item.item.ByteSizeLong();
+            *response.add_events()->mutable_insert() =
+                std::move(event.item.item);
+            break;
+          }
+          case TableExtensionEvent::Type::kUpdate: {
+            auto* update = response.add_events()->mutable_update();
+            update->set_key(event.item.item.key());
+            update->set_priority(event.item.item.priority());
+            response_bytes += update->ByteSizeLong();
+            break;
+          }
+          case TableExtensionEvent::Type::kDelete:
+            sent.Remove(batch.table, event.item.item.key());
+            response.add_events()->set_delete_key(event.item.item.key());
+            response_bytes += sizeof(uint64_t);
+            break;
+          case TableExtensionEvent::Type::kReset:
+            sent.RemoveTable(batch.table);
+            response.add_events()->set_reset(true);
+            break;
+          case TableExtensionEvent::Type::kSample:
+            break;
+        }
+        if (response_bytes >= kMaxReplicateStreamResponseBytes) {
+          if (!write()) return Internal("Failed to write to Replicate stream.");
+          response.set_table(batch.table);
+        }
+      }
+      if (response.events_size() > 0 && !write()) {
+        return Internal("Failed to write to Replicate stream.");
+      }
+      response.Clear();
+    }
+    batches.clear();
+  }
+
+  closed_by_replica = true;
+  return grpc::Status::OK;
+}
+
+void ReverbServiceImpl::RegisterReplica(const ReplicaInfo* info) {
+  absl::MutexLock lock(&replicas_mu_);
+  replicas_.insert(info);
+}
+
+void ReverbServiceImpl::UnregisterReplica(const ReplicaInfo* info) {
+  absl::MutexLock lock(&replicas_mu_);
+  replicas_.erase(info);
+}
+
+grpc::Status ReverbServiceImpl::CheckWritable() const {
+  if (replica_ == nullptr) return grpc::Status::OK;
+  return grpc::Status(
+      grpc::StatusCode::FAILED_PRECONDITION,
+      absl::StrCat("This server is a replica of ", options_.primary_address,
+                   " and does not accept writes."));
+}
+
 grpc::Status ReverbServiceImpl::Reset(grpc::ServerContext* context,
                                       const ResetRequest* request,
                                       ResetResponse* response) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.reset);
+  rpc.AddReceivedBytes(request->ByteSizeLong());
+  if (auto status = CheckWritable(); !status.ok()) return status;
   Table* table = TableByName(request->table());
   if (table == nullptr) return TableNotFound(request->table());
 
@@ -238,6 +1057,51 @@ grpc::Status ReverbServiceImpl::Reset(grpc::ServerContext* context,
   return grpc::Status::OK;
 }
 
+grpc::Status ReverbServiceImpl::ExportTable(
+    grpc::ServerContext* context, const ExportTableRequest* request,
+    grpc::ServerWriter<ExportTableResponse>* writer) {
+  return ExportTableInternal(context, request, writer);
+}
+
+grpc::Status ReverbServiceImpl::ExportTableInternal(
+    grpc::ServerContext* context, const ExportTableRequest* request,
+    grpc::ServerWriterInterface<ExportTableResponse>* writer) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.export_table);
+  rpc.AddReceivedBytes(request->ByteSizeLong());
+  Table* table = TableByName(request->table());
+  if (table == nullptr) return TableNotFound(request->table());
+
+  grpc::WriteOptions options;
+  // Chunks which aren't decompressed are already compressed.
+  if (!request->decompress_chunks()) options.set_no_compression();
+
+  internal::TableExporter exporter(table, *request);
+  const int stream_class = StreamClass(context);
+  ExportTableResponse response;
+  do {
+    if (context != nullptr && context->IsCancelled()) {
+      return grpc::Status(grpc::StatusCode::CANCELLED,
+                          "ExportTable was cancelled.");
+    }
+    internal::ScopedStreamOperation operation(
+        stream_scheduler_.get(), stream_class,
+        ClassMetrics(stream_class), context);
+    if (!operation.started()) {
+      return grpc::Status(grpc::StatusCode::CANCELLED,
+                          "ExportTable was cancelled.");
+    }
+    auto status = exporter.Next(&response);
+    if (!status.ok()) return ToGrpcStatus(status);
+    operation.End();
+    operation.Charge(response.ByteSizeLong());
+    rpc.AddSentBytes(response.ByteSizeLong());
+    if (!writer->Write(response, options)) {
+      return Internal("Failed to write to ExportTable stream.");
+    }
+  } while (!exporter.done());
+  return grpc::Status::OK;
+}
+
 grpc::Status ReverbServiceImpl::SampleStream(
     grpc::ServerContext* context,
     grpc::ServerReaderWriter<SampleStreamResponse, SampleStreamRequest>*
@@ -249,76 +1113,188 @@ grpc::Status ReverbServiceImpl::SampleStreamInternal(
     grpc::ServerContext* context,
     grpc::ServerReaderWriterInterface<SampleStreamResponse,
                                       SampleStreamRequest>* stream) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.sample_stream);
+  internal::ScopedTraceContext remote(internal::ServerTraceContext(context));
+  internal::ScopedSpan call_span("ReverbService/SampleStream");
+  const internal::TraceContext trace = call_span.context();
+
+  // The client reads every response which has been written to the stream
+  // unless it goes away, in which case the segments of the responses it hasn't
+  // read are removed once the sample thread has stopped writing segments. The
+  // responses which are never written remove their own segments.
+  internal::SharedMemorySegments segments;
+  bool write_failed = false;
+  auto remove_segments =
+      internal::MakeCleanup([context, &segments, &write_failed] {
+        if (write_failed || context->IsCancelled()) segments.RemoveAll();
+      });
+
+  // Requests are read, and their samples taken, by a background thread so that
+  // sampling (and waiting for the rate limiter) overlaps with writing the
+  // responses of the earlier samples to the stream. The responses which have
+  // been sampled ahead are bounded both by count and by size.
+  internal::Queue<SampleStreamEntry> queue(options_.sample_stream_queue_size);
+  ByteBudget budget(options_.sample_stream_queue_bytes);
+  auto sample_thread = StartStreamThread("SampleThread", [&]() {
+    internal::ScopedTraceContext active(trace);
+    SampleStreamEntry last;
+    last.status = SampleStreamRequests(
+        context, stream,
+        [&](std::unique_ptr<internal::SampleResponseWriter::Message> message) {
+          SampleStreamEntry entry;
+          entry.bytes = message->response.ByteSizeLong();
+          entry.message = std::move(message);
+          return budget.Acquire(entry.bytes) && queue.Push(std::move(entry));
+        },
+        &segments);
+    queue.Push(std::move(last));
+    queue.SetLastItemPushed();
+  });
+  auto cleanup = internal::MakeCleanup([&queue, &budget] {
+    queue.Close();
+    budget.Close();
+  });
+
+  grpc::WriteOptions options;
+  options.set_no_compression();  // Data is already compressed.
+  SampleStreamEntry entry;
+  while (queue.Pop(&entry)) {
+    budget.Release(entry.bytes);
+    if (entry.message == nullptr) return entry.status;
+    internal::ScopedSpan span("SampleStream::WriteResponse");
+    if (!stream->Write(entry.message->response, options)) {
+      write_failed = true;
+      return Internal("Failed to write to Sample stream.");
+    }
+    entry.message->sent = true;
+    rpc.AddSentBytes(entry.bytes);
+  }
+  return Internal("Sample stream was closed unexpectedly.");
+}
+
+grpc::Status ReverbServiceImpl::SampleStreamRequests(
+    grpc::ServerContext* context,
+    grpc::ServerReaderWriterInterface<SampleStreamResponse,
+                                      SampleStreamRequest>* stream,
+    const internal::SampleResponseWriter::Sink& sink,
+    internal::SharedMemorySegments* segments) {
   SampleStreamRequest request;
   if (!stream->Read(&request)) {
     return Internal("Could not read initial request");
   }
-  absl::Duration timeout =
-      absl::Milliseconds(request.has_rate_limiter_timeout()
-                             ? request.rate_limiter_timeout().milliseconds()
-                             : -1);
-  if (timeout < absl::ZeroDuration()) timeout = absl::InfiniteDuration();
+  const absl::Duration timeout = RateLimiterTimeout(request);
+
+  // Chunks which the client has advertised as cached. These are sent as
+  // references rather than being sent again.
+  internal::ClientChunks client_chunks;
+
+  // Tables of the requests and the number of samples drawn from each of them.
+  internal::TableMix mix;
+
+  // Samples are taken on the node of the (first) table of the request.
+  TableNumaBinding numa_binding;
+
+  // The bytes of the responses of every batch are charged to the priority
+  // class of the stream.
+  const int stream_class = StreamClass(context);
+  int64_t batch_bytes = 0;
+  const internal::SampleResponseWriter::Sink counting_sink =
+      [&](std::unique_ptr<internal::SampleResponseWriter::Message> message) {
+        batch_bytes += message->response.ByteSizeLong();
+        return sink(std::move(message));
+      };
 
   do {
-    if (request.num_samples() <= 0) {
-      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
-                          "`num_samples` must be > 0.");
-    }
-    if (request.flexible_batch_size() <= 0 &&
-        request.flexible_batch_size() != Sampler::kAutoSelectValue) {
-      return grpc::Status(
-          grpc::StatusCode::INVALID_ARGUMENT,
-          absl::StrCat("`flexible_batch_size` must be > 0 or ",
-                       Sampler::kAutoSelectValue, " (for auto tuning)."));
+    // Counted here as the requests are read by the sampling thread.
+    rpc_metrics_.sample_stream.received_bytes->Increment(
+        request.ByteSizeLong());
+    internal::UpdateClientChunks(request, &client_chunks);
+
+    std::vector<std::pair<Table*, double>> tables;
+    if (auto status = ValidateSampleStreamRequest(request, &tables);
+        !status.ok()) {
+      return status;
     }
-    Table* table = TableByName(request.table());
-    if (table == nullptr) return TableNotFound(request.table());
-    int32_t default_flexible_batch_size = table->DefaultFlexibleBatchSize();
+    mix.Reset(std::move(tables));
+    numa_binding.BindTo(*mix.table(0));
+    const int32_t flexible_batch_size =
+        FlexibleBatchSize(request, *mix.table(0));
 
     int count = 0;
+    internal::SampleResponseWriter writer(
+        stream_scheduler_ != nullptr ? counting_sink : sink,
+        request.max_response_bytes());
+
+    // The mutations of the request are applied with its first batch.
+    std::vector<KeyWithPriority> updates(request.priority_updates().begin(),
+                                         request.priority_updates().end());
+    std::vector<Table::Key> deletes(request.delete_keys().begin(),
+                                    request.delete_keys().end());
 
     while (!context->IsCancelled() && count != request.num_samples()) {
       std::vector<Table::SampledItem> samples;
-      int32_t max_batch_size = std::min<int32_t>(
-          request.flexible_batch_size() == Sampler::kAutoSelectValue
-              ? default_flexible_batch_size
-              : request.flexible_batch_size(),
-          request.num_samples() - count);
-      if (auto status =
-              table->SampleFlexibleBatch(&samples, max_batch_size, timeout);
-          !status.ok()) {
-        return ToGrpcStatus(status);
-      }
-      count += samples.size();
-
-      for (auto& sample : samples) {
-        for (int i = 0; i < sample.chunks.size(); i++) {
-          SampleStreamResponse response;
-          response.set_end_of_sequence(i + 1 == sample.chunks.size());
-
-          // Attach the info to the first message.
-          if (i == 0) {
-            *response.mutable_info()->mutable_item() = sample.item;
-            response.mutable_info()->set_probability(sample.probability);
-            response.mutable_info()->set_table_size(sample.table_size);
+      if (request.sample_episodes()) {
+        if (auto status = SampleScheduled(
+                context, stream_class, mix.table(0), timeout,
+                [&](absl::Duration table_timeout) {
+                  return mix.table(0)->SampleEpisode(&samples, table_timeout);
+                });
+            !status.ok()) {
+          return status;
+        }
+        count++;
+      } else {
+        int32_t max_batch_size = std::min<int32_t>(
+            flexible_batch_size, request.num_samples() - count);
+
+        // The batch is split across the tables, which are sampled one by one.
+        const std::vector<int32_t> allocation = mix.Allocate(max_batch_size);
+        for (int i = 0; i < mix.num_tables(); i++) {
+          if (allocation[i] == 0) continue;
+          std::vector<Table::SampledItem> table_samples;
+          if (auto status = SampleScheduled(
+                  context, stream_class, mix.table(i), timeout,
+                  [&](absl::Duration table_timeout) {
+                    auto status = mix.table(i)->MutateAndSampleFlexibleBatch(
+                        updates, deletes, &table_samples, allocation[i],
+                        table_timeout, request.without_replacement());
+                    // The mutations have been applied unless they failed, so
+                    // they aren't repeated if the sample is retried.
+                    updates.clear();
+                    deletes.clear();
+                    return status;
+                  });
+              !status.ok()) {
+            return status;
           }
+          mix.Record(i, table_samples.size());
+          std::move(table_samples.begin(), table_samples.end(),
+                    std::back_inserter(samples));
+        }
+        count += samples.size();
+      }
 
-          // We const cast to avoid copying the proto.
-          response.set_allocated_data(
-              const_cast<ChunkData*>(&sample.chunks[i]->data()));
+      // Stage spilled chunks of the later samples while the earlier ones are
+      // written to the stream.
+      for (const auto& sample : samples) {
+        chunk_store_->Prefetch(sample.chunks);
+      }
 
-          grpc::WriteOptions options;
-          options.set_no_compression();  // Data is already compressed.
-          bool ok = stream->Write(response, options);
-          response.release_data();
-          if (!ok) {
-            return Internal("Failed to write to Sample stream.");
-          }
+      if (auto status = internal::WriteSampleBatch(
+              client_chunks, request.shared_memory() ? segments : nullptr,
+              request.without_replacement() || request.sample_episodes(),
+              &samples, &writer);
+          !status.ok()) {
+        return status;
+      }
 
-          // We no longer need our chunk reference, so we free it.
-          sample.chunks[i] = nullptr;
-        }
+      // Don't hold back samples while waiting for the table.
+      if (!writer.Flush()) {
+        return Internal("Failed to write to Sample stream.");
       }
+      internal::ChargeStreamClass(stream_scheduler_.get(), stream_class,
+                                  ClassMetrics(stream_class), batch_bytes);
+      batch_bytes = 0;
     }
 
     request.Clear();
@@ -327,6 +1303,137 @@ grpc::Status ReverbServiceImpl::SampleStreamInternal(
   return grpc::Status::OK;
 }
 
+grpc::Status ReverbServiceImpl::SampleScheduled(
+    grpc::ServerContext* context, int stream_class, Table* table,
+    absl::Duration timeout,
+    const std::function<tensorflow::Status(absl::Duration)>& sample) {
+  if (stream_scheduler_ == nullptr) return ToGrpcStatus(sample(timeout));
+
+  const auto cancelled = [] {
+    return grpc::Status(
+        grpc::StatusCode::CANCELLED,
+        "SampleStream was cancelled while waiting for its turn.");
+  };
+  const absl::Time deadline = absl::Now() + timeout;
+  while (true) {
+    tensorflow::Status status;
+    {
+      internal::ScopedStreamOperation operation(stream_scheduler_.get(),
+                                                stream_class,
+                                                ClassMetrics(stream_class),
+                                                context);
+      if (!operation.started()) return cancelled();
+      status = sample(absl::ZeroDuration());
+    }
+    if (!tensorflow::errors::IsDeadlineExceeded(status) ||
+        absl::Now() >= deadline) {
+      return ToGrpcStatus(status);
+    }
+
+    // The rate limiter blocks the sample. Wait for it outside of the operation
+    // so that blocked streams don't hold up the others.
+    auto can_sample = std::make_shared<absl::Notification>();
+    table->NotifyWhenCanSample([can_sample] {
+      can_sample->Notify();
+      return true;
+    });
+    while (!can_sample->WaitForNotificationWithTimeout(std::min(
+        kStreamSchedulerPollInterval, deadline - absl::Now()))) {
+      if (context != nullptr && context->IsCancelled()) return cancelled();
+      if (absl::Now() >= deadline) return ToGrpcStatus(status);
+    }
+  }
+}
+
+absl::Duration ReverbServiceImpl::RateLimiterTimeout(
+    const SampleStreamRequest& request) {
+  absl::Duration timeout =
+      absl::Milliseconds(request.has_rate_limiter_timeout()
+                             ? request.rate_limiter_timeout().milliseconds()
+                             : -1);
+  if (timeout < absl::ZeroDuration()) timeout = absl::InfiniteDuration();
+  return timeout;
+}
+
+int32_t ReverbServiceImpl::FlexibleBatchSize(const SampleStreamRequest& request,
+                                             const Table& table) {
+  return request.flexible_batch_size() == Sampler::kAutoSelectValue
+             ? table.DefaultFlexibleBatchSize()
+             : request.flexible_batch_size();
+}
+
+grpc::Status ReverbServiceImpl::ValidateSampleStreamRequest(
+    const SampleStreamRequest& request,
+    std::vector<std::pair<Table*, double>>* tables) const {
+  if (request.num_samples() <= 0) {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        "`num_samples` must be > 0.");
+  }
+  if (request.flexible_batch_size() <= 0 &&
+      request.flexible_batch_size() != Sampler::kAutoSelectValue) {
+    return grpc::Status(
+        grpc::StatusCode::INVALID_ARGUMENT,
+        absl::StrCat("`flexible_batch_size` must be > 0 or ",
+                     Sampler::kAutoSelectValue, " (for auto tuning)."));
+  }
+  if (request.sample_episodes() && !request.tables().empty()) {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        "`tables` must not be set with `sample_episodes`.");
+  }
+  if (!request.priority_updates().empty() || !request.delete_keys().empty()) {
+    if (request.sample_episodes() || !request.tables().empty()) {
+      return grpc::Status(
+          grpc::StatusCode::INVALID_ARGUMENT,
+          "`priority_updates` and `delete_keys` must not be set with "
+          "`tables` or `sample_episodes`.");
+    }
+    if (auto status = CheckWritable(); !status.ok()) return status;
+  }
+  tables->clear();
+  if (request.tables().empty()) {
+    Table* table = TableByName(request.table());
+    if (table == nullptr) return TableNotFound(request.table());
+    tables->emplace_back(table, 1.0);
+    return grpc::Status::OK;
+  }
+  if (!request.table().empty()) {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        "`table` and `tables` must not both be set.");
+  }
+  for (const auto& table_weight : request.tables()) {
+    if (!(table_weight.weight() > 0)) {
+      return grpc::Status(
+          grpc::StatusCode::INVALID_ARGUMENT,
+          absl::StrCat("Weight of table '", table_weight.table(),
+                       "' must be > 0 but got ", table_weight.weight(), "."));
+    }
+    Table* table = TableByName(table_weight.table());
+    if (table == nullptr) return TableNotFound(table_weight.table());
+    for (const auto& [other, weight] : *tables) {
+      if (other == table) {
+        return grpc::Status(
+            grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrCat("Table '", table_weight.table(),
+                         "' is included more than once in `tables`."));
+      }
+    }
+    tables->emplace_back(table, table_weight.weight());
+  }
+  return grpc::Status::OK;
+}
+
+int ReverbServiceImpl::StreamClass(const grpc::ServerContext* context) const {
+  if (stream_scheduler_ == nullptr) return -1;
+  return internal::StreamClassOf(context, *stream_scheduler_,
+                                 default_stream_class_);
+}
+
+const internal::StreamClassMetrics* ReverbServiceImpl::ClassMetrics(
+    int stream_class) const {
+  if (stream_scheduler_ == nullptr) return nullptr;
+  return stream_class_metrics_[stream_class].get();
+}
+
 Table* ReverbServiceImpl::TableByName(absl::string_view name) const {
   auto it = tables_.find(name);
   if (it == tables_.end()) return nullptr;
@@ -334,18 +1441,83 @@ Table* ReverbServiceImpl::TableByName(absl::string_view name) const {
 }
 
 void ReverbServiceImpl::Close() {
+  if (replica_ != nullptr) replica_->Stop();
+  StopCheckpointScheduler();
   for (auto& table : tables_) {
     table.second->Close();
   }
+  if (stream_scheduler_ != nullptr) stream_scheduler_->Close();
+  if (workload_trace_ != nullptr) {
+    auto status = workload_trace_->Close();
+    if (!status.ok()) {
+      REVERB_LOG(REVERB_ERROR) << "Workload trace is incomplete: " << status;
+    }
+  }
 }
 
 grpc::Status ReverbServiceImpl::ServerInfo(grpc::ServerContext* context,
                                            const ServerInfoRequest* request,
                                            ServerInfoResponse* response) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.server_info);
+  rpc.AddReceivedBytes(request->ByteSizeLong());
+  const bool omit_signatures = request->has_tables_state_id() &&
+                               MessageToUint128(request->tables_state_id()) ==
+                                   tables_state_id_;
   for (const auto& iter : tables_) {
-    *response->add_table_info() = iter.second->info();
+    auto* info = response->add_table_info();
+    if (!request->allow_stale()) {
+      *info = iter.second->info();
+      if (omit_signatures) info->clear_signature();
+      continue;
+    }
+    // Snapshots don't hold the signature so it is only copied if requested.
+    *info = *iter.second->InfoSnapshot();
+    if (!omit_signatures && iter.second->signature()) {
+      *info->mutable_signature() = *iter.second->signature();
+    }
   }
   *response->mutable_tables_state_id() = Uint128ToMessage(tables_state_id_);
+  response->set_signatures_omitted(omit_signatures);
+
+  auto* reclaimer = internal::Reclaimer::Default();
+  auto* reclaimer_info = response->mutable_reclaimer_info();
+  reclaimer_info->set_pending(reclaimer->pending());
+  reclaimer_info->set_reclaimed(reclaimer->num_reclaimed());
+  reclaimer_info->set_overflowed(reclaimer->num_overflowed());
+
+  *response->mutable_chunk_store_info() = chunk_store_->info();
+  if (memory_admission_->enabled()) {
+    *response->mutable_memory_admission_info() = memory_admission_->info();
+  }
+  internal::HeapStats heap_stats;
+  if (internal::GetHeapStats(&heap_stats)) {
+    response->mutable_heap_info()->set_allocated_bytes(
+        heap_stats.allocated_bytes);
+    response->mutable_heap_info()->set_in_use_bytes(heap_stats.in_use_bytes);
+  }
+
+  if (options_.checkpoint_interval > absl::ZeroDuration() &&
+      checkpointer_ != nullptr) {
+    absl::MutexLock lock(&checkpoint_mu_);
+    *response->mutable_checkpoint_scheduler_info() =
+        checkpoint_scheduler_info_;
+  }
+
+  if (replica_ != nullptr) {
+    *response->mutable_replication_info() = replica_->info();
+  }
+  {
+    absl::MutexLock lock(&replicas_mu_);
+    for (const auto* info : replicas_) {
+      *response->add_replicas() = *info;
+    }
+  }
+
+  absl::MutexLock lock(&insert_streams_mu_);
+  for (const auto* stats : insert_streams_) {
+    *response->add_insert_streams() = stats->info();
+  }
+  rpc.AddSentBytes(response->ByteSizeLong());
   return grpc::Status::OK;
 }
 
@@ -358,6 +1530,7 @@ grpc::Status ReverbServiceImpl::InitializeConnection(
     grpc::ServerContext* context,
     grpc::ServerReaderWriter<InitializeConnectionResponse,
                              InitializeConnectionRequest>* stream) {
+  internal::ScopedRpcMetrics rpc(&rpc_metrics_.initialize_connection);
   if (!IsLocalhostOrInProcess(context->peer())) {
     return grpc::Status::OK;
   }
@@ -371,26 +1544,40 @@ grpc::Status ReverbServiceImpl::InitializeConnection(
     // Respond without populating the address field.
     InitializeConnectionResponse response;
     response.set_address(0);
+    if (request.has_shared_memory_probe()) {
+      ChunkData probe;
+      response.set_shared_memory(
+          internal::ReadSharedMemoryChunk(request.shared_memory_probe(), &probe)
+              .ok());
+    }
     stream->Write(response);
     return grpc::Status::OK;
   }
 
-  auto it = tables_.find(request.table_name());
-  if (it == tables_.end()) {
-    return TableNotFound(request.table_name());
-  }
-
   // Allocate a new shared pointer on the heap and transmit its memory address.
   // The client will dereference and assume ownership of the object before
   // sending its response. For simplicity, the client will copy the shared_ptr
   // so the server is always responsible for cleaning up the heap allocated
   // object.
-  auto* ptr = new std::shared_ptr<Table>(it->second);
-  auto cleanup = internal::MakeCleanup([&] { delete ptr; });
+  std::unique_ptr<std::shared_ptr<Table>> table_ptr;
+  std::unique_ptr<std::shared_ptr<ChunkStore>> chunk_store_ptr;
+  InitializeConnectionResponse response;
+  if (request.chunk_store()) {
+    // The chunk store is only shared with writers.
+    if (auto status = CheckWritable(); !status.ok()) return status;
+    chunk_store_ptr =
+        absl::make_unique<std::shared_ptr<ChunkStore>>(chunk_store_);
+    response.set_address(reinterpret_cast<int64_t>(chunk_store_ptr.get()));
+  } else {
+    auto it = tables_.find(request.table_name());
+    if (it == tables_.end()) {
+      return TableNotFound(request.table_name());
+    }
+    table_ptr = absl::make_unique<std::shared_ptr<Table>>(it->second);
+    response.set_address(reinterpret_cast<int64_t>(table_ptr.get()));
+  }
 
   // Send address to client.
-  InitializeConnectionResponse response;
-  response.set_address(reinterpret_cast<int64_t>(ptr));
   if (!stream->Write(response)) {
     return Internal("Failed to write to stream.");
   }
@@ -15,19 +15,35 @@
 #ifndef REVERB_CC_REVERB_SERVICE_IMPL_H_
 #define REVERB_CC_REVERB_SERVICE_IMPL_H_
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "grpcpp/grpcpp.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/numeric/int128.h"
 #include "absl/random/random.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/chunk_store.h"
 #include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/metrics.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/replica.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/reverb_service_util.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/support/stream_scheduler.h"
+#include "reverb/cc/support/workload_trace.h"
 #include "reverb/cc/table.h"
+#include "reverb/cc/table_extensions/replication.h"
 
 namespace deepmind {
 namespace reverb {
@@ -35,6 +51,143 @@ namespace reverb {
 // Implements ReverbService. See reverb_service.proto for documentation.
 class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::Service {
  public:
+  struct Options {
+    ChunkStore::Options chunk_store;
+
+    // Maximum number of requests of an `InsertStream` which are read, and
+    // have their chunks inserted into the chunk store, ahead of the item which
+    // is being inserted into its table.
+    int insert_stream_queue_size = 64;
+
+    // Maximum sum of the serialized sizes of the requests which are read ahead
+    // by an `InsertStream`. A single larger request is always let through.
+    int64_t insert_stream_queue_bytes = 64 * 1024 * 1024;
+
+    // Maximum number of responses of a `SampleStream` which are sampled ahead
+    // of the one being written to the stream.
+    //
+    // Note that items are sampled from the table, and thus counted by its rate
+    // limiter and by `times_sampled`, when they are sampled ahead rather than
+    // when they reach the client. Priority updates made in the meantime are
+    // not reflected by their `SampleInfo`, and they are lost if the stream is
+    // cancelled before they have been written. Smaller queues limit how stale
+    // the samples can get.
+    int sample_stream_queue_size = 16;
+
+    // Maximum sum of the serialized sizes of the responses which are sampled
+    // ahead by a `SampleStream`. A single larger response is always let
+    // through.
+    int64_t sample_stream_queue_bytes = 64 * 1024 * 1024;
+
+    // If set then the latest checkpoint is restored in the background rather
+    // than before `Create` returns. The tables accept inserts right away and
+    // allow samples once the fraction of their checkpointed items given by
+    // `min_restored_fraction_to_sample` (or the default) has been restored.
+    // The progress is reported by `TableInfo.restore_progress`. Calls to
+    // `Checkpoint` block until the restore has completed.
+    bool warm_start = false;
+    double default_min_restored_fraction_to_sample = 1.0;
+    internal::flat_hash_map<std::string, double>
+        min_restored_fraction_to_sample;
+
+    // If positive (and a checkpointer is set) then the service saves a
+    // checkpoint every `checkpoint_interval`. A scheduled checkpoint is
+    // skipped if another checkpoint, e.g one requested through `Checkpoint`,
+    // is still in progress. The stats are reported by `ServerInfo`.
+    absl::Duration checkpoint_interval = absl::ZeroDuration();
+
+    // Maximum number of bytes per second written by a scheduled checkpoint.
+    // A value <= 0 means that there is no limit.
+    int64_t checkpoint_max_bytes_per_second = 0;
+
+    // If set then the background loops of the `InsertStream`,
+    // `MutatePrioritiesStream` and `SampleStream` calls, which read the
+    // requests (and take the samples) ahead of the gRPC handler, run on
+    // `stream_executor` rather than on a dedicated thread per call. This
+    // bounds the number of threads of a server with many connected clients.
+    // A call only makes progress once a thread of the executor is available,
+    // so the executor should have a thread for every stream which is expected
+    // to be active at the same time.
+    std::shared_ptr<internal::Executor> stream_executor;
+
+    // NUMA node, keyed by table name, which each table is pinned to. The
+    // threads of the `InsertStream` and `SampleStream` calls of the
+    // synchronous service bind themselves to the node of the table they
+    // operate on, so the chunks they parse and the table state they touch are
+    // allocated on that node (first touch). The asynchronous service serves
+    // many calls per thread and doesn't rebind them. The local and remote
+    // accesses are reported by `TableInfo.numa`. Tables which are not listed
+    // are not pinned.
+    internal::flat_hash_map<std::string, int> table_numa_nodes;
+
+    // Rules, keyed by table name, by which the service derives the items of
+    // each table from the chunks that arrive on an `InsertStream` (see
+    // `ItemRule`). Writers can then stream only chunks (see
+    // `Writer::DeriveItemsOnServer`) rather than an item per step and table.
+    internal::flat_hash_map<std::string, std::vector<ItemRule>>
+        table_item_rules;
+
+    // If set then replicas can follow the tables of the service through
+    // `ReplicateStream`. Every table then logs its mutations, which costs a
+    // copy of the item per mutation. A replica which falls more than
+    // `replication_max_pending_events` events behind is disconnected, and
+    // resynchronizes from new snapshots when it reconnects.
+    bool enable_replication = false;
+    int64_t replication_max_pending_events = 1 << 20;
+
+    // If set then the service is a read replica of the tables of the server
+    // at `primary_address` (see `Replica`). The tables are replaced with
+    // those of the primary and kept in sync with them, and writes (inserts,
+    // priority mutations and resets) are rejected. Can't be combined with
+    // `warm_start`.
+    std::string primary_address;
+    Replica::Options replica;
+
+    // Watermarks on the memory allocated for the chunks of the server (see
+    // `ChunkStoreInfo.allocated_bytes`), disabled if <= 0. Above
+    // `memory_soft_limit_bytes` the `InsertStream`s wait before they read each
+    // request, which pushes back on the clients through gRPC flow control. The
+    // wait grows from zero at the soft limit to `memory_max_read_delay` at the
+    // hard limit. Chunks which would take the usage above
+    // `memory_hard_limit_bytes` fail their stream with RESOURCE_EXHAUSTED,
+    // while items, which let the removers free chunks, are still accepted.
+    // Only the synchronous service delays reads. The state is reported by
+    // `ServerInfo`.
+    int64_t memory_soft_limit_bytes = 0;
+    int64_t memory_hard_limit_bytes = 0;
+    absl::Duration memory_max_read_delay = absl::Milliseconds(100);
+
+    // If set then the inserts, samples, priority mutations and resets which
+    // clients request are recorded, without their data, to a trace file at
+    // this path (see workload_trace.proto and `Table::set_workload_trace`).
+    // `reverb/cc/tools:load_generator_main` replays such traces against a
+    // server.
+    std::string workload_trace_path;
+
+    // Priority classes of the streams, keyed by class name. Clients tag their
+    // streams with a class in the `reverb-priority-class` metadata entry (see
+    // `Sampler::Options::priority_class`). Streams which are untagged, or
+    // tagged with an unknown class, belong to `default_stream_class`, which
+    // must be one of the classes.
+    //
+    // The sample batches of the `SampleStream`s, the requests read by the
+    // `InsertStream`s and the responses of `ExportTable` are scheduled by
+    // class (see `internal::StreamScheduler`): at most
+    // `max_concurrent_stream_operations` of them (unlimited if <= 0) are
+    // processed at a time and the waiting ones start in weighted fair order
+    // of the bytes which their classes have been served. Classes over their
+    // bandwidth cap wait until they are back under it, which pushes back on
+    // their clients through gRPC flow control. Sample batches are scheduled
+    // while they sample from the tables and charged the bytes of their
+    // responses. The operations, bytes and waiting times of every class are
+    // reported as metrics. Only the synchronous service schedules streams.
+    // Empty (the default) disables the scheduling.
+    internal::flat_hash_map<std::string, internal::StreamClassOptions>
+        stream_classes;
+    std::string default_stream_class = "default";
+    int max_concurrent_stream_operations = 8;
+  };
+
   static tensorflow::Status Create(std::vector<std::shared_ptr<Table>> tables,
                                    std::shared_ptr<Checkpointer> checkpointer,
                                    std::unique_ptr<ReverbServiceImpl>* service);
@@ -42,6 +195,13 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::Service {
   static tensorflow::Status Create(std::vector<std::shared_ptr<Table>> tables,
                                    std::unique_ptr<ReverbServiceImpl>* service);
 
+  // Creates a service configured by `options`, e.g to spill cold chunks to
+  // local disk.
+  static tensorflow::Status Create(
+      std::vector<std::shared_ptr<Table>> tables,
+      std::shared_ptr<Checkpointer> checkpointer, const Options& options,
+      std::unique_ptr<ReverbServiceImpl>* service);
+
   grpc::Status Checkpoint(grpc::ServerContext* context,
                           const CheckpointRequest* request,
                           CheckpointResponse* response) override;
@@ -60,6 +220,15 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::Service {
                                 const MutatePrioritiesRequest* request,
                                 MutatePrioritiesResponse* response) override;
 
+  grpc::Status MutatePrioritiesStream(
+      grpc::ServerContext* context,
+      grpc::ServerReader<MutatePrioritiesRequest>* reader,
+      MutatePrioritiesResponse* response) override;
+
+  grpc::Status MutatePrioritiesStreamInternal(
+      grpc::ServerContext* context,
+      grpc::ServerReaderInterface<MutatePrioritiesRequest>* reader);
+
   grpc::Status Reset(grpc::ServerContext* context, const ResetRequest* request,
                      ResetResponse* response) override;
 
@@ -73,6 +242,24 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::Service {
       grpc::ServerReaderWriterInterface<SampleStreamResponse,
                                         SampleStreamRequest>* stream);
 
+  grpc::Status ReplicateStream(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<ReplicateStreamResponse, ReplicateStreamRequest>*
+          stream) override;
+
+  grpc::Status ReplicateStreamInternal(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriterInterface<ReplicateStreamResponse,
+                                        ReplicateStreamRequest>* stream);
+
+  grpc::Status ExportTable(
+      grpc::ServerContext* context, const ExportTableRequest* request,
+      grpc::ServerWriter<ExportTableResponse>* writer) override;
+
+  grpc::Status ExportTableInternal(
+      grpc::ServerContext* context, const ExportTableRequest* request,
+      grpc::ServerWriterInterface<ExportTableResponse>* writer);
+
   grpc::Status ServerInfo(grpc::ServerContext* context,
                           const ServerInfoRequest* request,
                           ServerInfoResponse* response) override;
@@ -85,34 +272,230 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::Service {
   // Gets a copy of the table lookup.
   internal::flat_hash_map<std::string, std::shared_ptr<Table>> tables() const;
 
-  // Closes all tables and the chunk store.
+  // Counters of the calls to every method together with the state of the
+  // tables, their rate limiters and the chunk store, which are collected when
+  // the metrics are exported.
+  const internal::MetricsRegistry& metrics() const { return metrics_; }
+
+  // Closes all tables and the chunk store. Stops the restore started by
+  // `Options::warm_start`, the scheduled checkpoints and the replication from
+  // the primary.
   void Close();
 
+  // Stops the scheduled checkpoints and the replication from the primary, and
+  // joins the thread of the restore started by `Options::warm_start`.
+  ~ReverbServiceImpl() override;
+
  private:
+  // Serves the same tables with the asynchronous gRPC API.
+  friend class ReverbServiceAsyncImpl;
+
   explicit ReverbServiceImpl(
       std::shared_ptr<Checkpointer> checkpointer = nullptr);
 
-  tensorflow::Status Initialize(std::vector<std::shared_ptr<Table>> tables);
+  tensorflow::Status Initialize(std::vector<std::shared_ptr<Table>> tables,
+                                const Options& options);
 
   // Lookups the table for a given name. Returns nullptr if not found.
   Table* TableByName(absl::string_view name) const;
 
+  // Timeout of the rate limiter requested by the first request of a
+  // `SampleStream`.
+  static absl::Duration RateLimiterTimeout(const SampleStreamRequest& request);
+
+  // Maximum number of items sampled from `table` per `SampleFlexibleBatch`
+  // call for `request`.
+  static int32_t FlexibleBatchSize(const SampleStreamRequest& request,
+                                   const Table& table);
+
+  // Checks the arguments of `request` and looks up the tables it samples from
+  // together with their weights. A request for a single `table` yields that
+  // table with weight 1.
+  grpc::Status ValidateSampleStreamRequest(
+      const SampleStreamRequest& request,
+      std::vector<std::pair<Table*, double>>* tables) const;
+
+  struct SampleStreamEntry;
+
+  // Calls `sample`, which samples from `table` with the rate limiter timeout
+  // it is passed, as an operation of the priority class `stream_class` (see
+  // `Options::stream_classes`). If the streams are scheduled then `sample` is
+  // called with a zero timeout, and while the rate limiter of `table` blocks
+  // it the operation ends and is retried once the rate limiter allows samples
+  // again, until `timeout` has passed. Streams which wait for their rate
+  // limiter thus don't hold up the others.
+  grpc::Status SampleScheduled(
+      grpc::ServerContext* context, int stream_class, Table* table,
+      absl::Duration timeout,
+      const std::function<tensorflow::Status(absl::Duration)>& sample);
+
+  // Reads the requests of a `SampleStream` and passes the responses of their
+  // samples to `sink` until the client closes the stream or an error occurs.
+  // The chunks which the requests ask to pass through shared memory are
+  // written to `segments`.
+  grpc::Status SampleStreamRequests(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriterInterface<SampleStreamResponse,
+                                        SampleStreamRequest>* stream,
+      const internal::SampleResponseWriter::Sink& sink,
+      internal::SharedMemorySegments* segments);
+
+  struct InsertStreamEntry;
+
+  // Inserts the chunk of `request` into the chunk store, adds it to `chunks`
+  // and derives items from it with `deriver`, or resolves the item of
+  // `request` into `entry`.
+  grpc::Status ReadInsertStreamRequest(InsertStreamRequest* request,
+                                       internal::InsertStreamChunks* chunks,
+                                       internal::ItemDeriver* deriver,
+                                       InsertStreamEntry* entry);
+
+  // Adds (respectively removes) the stats of an open `InsertStream` to those
+  // reported by `ServerInfo`.
+  void RegisterInsertStream(const internal::InsertStreamStats* stats)
+      ABSL_LOCKS_EXCLUDED(insert_streams_mu_);
+  void UnregisterInsertStream(const internal::InsertStreamStats* stats)
+      ABSL_LOCKS_EXCLUDED(insert_streams_mu_);
+
+  // Returns FAILED_PRECONDITION if the service is a replica and thus must not
+  // be written to.
+  grpc::Status CheckWritable() const;
+
+  // Adds (respectively removes) a replica which follows the tables through a
+  // `ReplicateStream` to those reported by `ServerInfo`.
+  void RegisterReplica(const ReplicaInfo* info)
+      ABSL_LOCKS_EXCLUDED(replicas_mu_);
+  void UnregisterReplica(const ReplicaInfo* info)
+      ABSL_LOCKS_EXCLUDED(replicas_mu_);
+
+  // Restores the latest checkpoint into the (serving) tables. Run by
+  // `restore_thread_` when `Options::warm_start` is set.
+  void RestoreLatestCheckpoint(std::vector<std::shared_ptr<Table>> tables);
+
+  // Saves a checkpoint of all tables with `checkpointer_`. The caller must
+  // have incremented `num_checkpoints_in_progress_`, which is decremented once
+  // the checkpoint has been saved.
+  tensorflow::Status SaveCheckpoint(const Checkpointer::SaveOptions& options,
+                                    std::string* path,
+                                    Checkpointer::SaveStats* stats)
+      ABSL_LOCKS_EXCLUDED(checkpoint_mu_);
+
+  // Called by `checkpoint_scheduler_` every `Options::checkpoint_interval`.
+  void RunScheduledCheckpoint() ABSL_LOCKS_EXCLUDED(checkpoint_mu_);
+
+  // Stops `checkpoint_scheduler_` unless it already has been stopped.
+  void StopCheckpointScheduler() ABSL_LOCKS_EXCLUDED(checkpoint_mu_);
+
+  // Priority class of the streams of `context`, see `Options::stream_classes`.
+  // Only meaningful if `stream_scheduler_` is set.
+  int StreamClass(const grpc::ServerContext* context) const;
+
+  // Metrics of the priority class `stream_class`, or null if the streams
+  // aren't scheduled.
+  const internal::StreamClassMetrics* ClassMetrics(int stream_class) const;
+
+  // Runs the background loop `fn` of a stream on `Options::stream_executor`,
+  // or on a dedicated thread if it is not set.
+  std::unique_ptr<internal::Thread> StartStreamThread(
+      absl::string_view name, std::function<void()> fn) const;
+
   // Checkpointer used to restore state in the constructor and to save data
   // when `Checkpoint` is called. Note that if `checkpointer_` is nullptr then
   // `Checkpoint` will return an `InvalidArgumentError`.
   std::shared_ptr<Checkpointer> checkpointer_;
 
-  // Stores chunks and keeps references to them.
-  ChunkStore chunk_store_;
+  // Stores chunks and keeps references to them. Shared with the writers of
+  // clients running in the same process (see `InitializeConnection`).
+  std::shared_ptr<ChunkStore> chunk_store_;
 
   // Priority tables. Must be destroyed after `chunk_store_`.
   internal::flat_hash_map<std::string, std::shared_ptr<Table>> tables_;
 
+  // Tables which have item rules, see `Options::table_item_rules`.
+  std::vector<Table*> item_rule_tables_;
+
+  // Records the operations of the tables, see `Options::workload_trace_path`.
+  // Null unless tracing.
+  std::shared_ptr<internal::WorkloadTraceWriter> workload_trace_;
+
   absl::BitGen rnd_;
 
   // A new id must be generated whenever a table is added, deleted, or has its
   // signature modified.
   absl::uint128 tables_state_id_;
+
+  Options options_;
+
+  // Stats of the open `InsertStream`s, reported by `ServerInfo`. The streams
+  // add and remove their own stats.
+  absl::Mutex insert_streams_mu_;
+  internal::flat_hash_set<const internal::InsertStreamStats*> insert_streams_
+      ABSL_GUARDED_BY(insert_streams_mu_);
+
+  // Admission of the chunks of the `InsertStream`s, see
+  // `Options::memory_soft_limit_bytes`. Null until the service is initialized.
+  std::unique_ptr<internal::MemoryAdmission> memory_admission_;
+
+  // Logs of the mutations of every table, keyed by table name, which the
+  // `ReplicateStream`s follow. Empty unless `Options::enable_replication` or
+  // `Options::primary_address` is set.
+  internal::flat_hash_map<std::string, std::shared_ptr<ReplicationLog>>
+      replication_logs_;
+
+  // Replicas which follow the tables through a `ReplicateStream`, reported
+  // by `ServerInfo`. The streams add and remove their own info.
+  absl::Mutex replicas_mu_;
+  internal::flat_hash_set<const ReplicaInfo*> replicas_
+      ABSL_GUARDED_BY(replicas_mu_);
+
+  // Number of checkpoints which are being saved, and the stats of the
+  // scheduled checkpoints.
+  absl::Mutex checkpoint_mu_;
+  int num_checkpoints_in_progress_ ABSL_GUARDED_BY(checkpoint_mu_) = 0;
+  CheckpointSchedulerInfo checkpoint_scheduler_info_
+      ABSL_GUARDED_BY(checkpoint_mu_);
+
+  // Saves a checkpoint every `Options::checkpoint_interval`. Null if there are
+  // no scheduled checkpoints or once the scheduler has been stopped.
+  std::unique_ptr<internal::PeriodicClosure> checkpoint_scheduler_
+      ABSL_GUARDED_BY(checkpoint_mu_);
+
+  // Metrics of the service, see `metrics()`.
+  internal::MetricsRegistry metrics_;
+
+  // Schedules the operations of the streams by priority class, see
+  // `Options::stream_classes`. Null if the streams aren't scheduled.
+  std::unique_ptr<internal::StreamScheduler> stream_scheduler_;
+  int default_stream_class_ = -1;
+
+  // Metrics of every priority class, indexed like the classes of
+  // `stream_scheduler_`.
+  std::vector<std::unique_ptr<internal::StreamClassMetrics>>
+      stream_class_metrics_;
+
+  struct RpcMetricsByMethod {
+    explicit RpcMetricsByMethod(internal::MetricsRegistry* registry);
+
+    internal::RpcMetrics checkpoint;
+    internal::RpcMetrics export_table;
+    internal::RpcMetrics initialize_connection;
+    internal::RpcMetrics insert_stream;
+    internal::RpcMetrics mutate_priorities;
+    internal::RpcMetrics mutate_priorities_stream;
+    internal::RpcMetrics replicate_stream;
+    internal::RpcMetrics reset;
+    internal::RpcMetrics sample_stream;
+    internal::RpcMetrics server_info;
+  };
+  const RpcMetricsByMethod rpc_metrics_;
+
+  // Replicates the tables from `Options::primary_address`. Null unless the
+  // service is a replica. Stopped before the tables are closed.
+  std::unique_ptr<Replica> replica_;
+
+  // Background restore of the latest checkpoint, see `Options::warm_start`.
+  // Declared last so that it is joined before the tables are destroyed.
+  std::unique_ptr<internal::Thread> restore_thread_;
 };
 
 }  // namespace reverb
@@ -14,24 +14,42 @@
 
 #include "reverb/cc/reverb_service_impl.h"
 
+#include <algorithm>
 #include <cfloat>
+#include <functional>
 #include <list>
+#include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/platform/checkpointing.h"
+#include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/fifo.h"
 #include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "reverb/cc/tensor_compression.h"
 #include "reverb/cc/testing/proto_test_util.h"
+#include "reverb/cc/testing/tensor_testutil.h"
+#include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/protobuf/struct.pb.h"
 
@@ -51,15 +69,33 @@ class FakeInsertStream
                                                InsertStreamRequest> {
  public:
   void AddChunk(int64_t key) {
+    ChunkData chunk;
+    chunk.set_chunk_key(key);
+    AddChunk(std::move(chunk));
+  }
+
+  void AddChunk(ChunkData chunk) {
+    InsertStreamRequest request;
+    *request.mutable_chunk() = std::move(chunk);
+    read_buffer_.push_back(std::move(request));
+  }
+
+  void AddRequest(InsertStreamRequest request) {
+    read_buffer_.push_back(std::move(request));
+  }
+
+  void AddSharedMemoryChunk(const ChunkData& chunk) {
     InsertStreamRequest request;
-    request.mutable_chunk()->set_chunk_key(key);
+    TF_CHECK_OK(internal::WriteSharedMemoryChunk(
+        chunk, request.mutable_shared_memory_chunk()));
     read_buffer_.push_back(std::move(request));
   }
 
   PrioritizedItem AddItem(absl::string_view table,
                           const std::vector<int64_t>& sequence_chunks,
                           const std::vector<int64_t>& keep_chunks = {},
-                          bool send_confirmation = false) {
+                          bool send_confirmation = false,
+                          bool batch_confirmations = false) {
     PrioritizedItem item;
     item.set_key(nextId++);
     item.set_table(table.data(), table.size());
@@ -75,10 +111,17 @@ class FakeInsertStream
                                                           keep_chunks.end()};
     *request.mutable_item()->mutable_item() = item;
     request.mutable_item()->set_send_confirmation(send_confirmation);
+    request.mutable_item()->set_batch_confirmations(batch_confirmations);
     read_buffer_.push_back(std::move(request));
     return item;
   }
 
+  void AddItem(PrioritizedItem item) {
+    InsertStreamRequest request;
+    *request.mutable_item()->mutable_item() = std::move(item);
+    read_buffer_.push_back(std::move(request));
+  }
+
   bool Read(InsertStreamRequest* request) override {
     if (read_buffer_.empty()) return false;
     *request = read_buffer_.front();
@@ -102,6 +145,21 @@ class FakeInsertStream
   std::vector<InsertStreamResponse> responses_;
 };
 
+// Blocks in `Read` once all requests have been read until `Unblock` is called.
+class BlockingInsertStream : public FakeInsertStream {
+ public:
+  bool Read(InsertStreamRequest* request) override {
+    if (FakeInsertStream::Read(request)) return true;
+    unblocked_.WaitForNotification();
+    return false;
+  }
+
+  void Unblock() { unblocked_.Notify(); }
+
+ private:
+  absl::Notification unblocked_;
+};
+
 class FakeSampleStream
     : public grpc::ServerReaderWriterInterface<SampleStreamResponse,
                                                SampleStreamRequest> {
@@ -120,8 +178,7 @@ class FakeSampleStream
 
   bool Read(SampleStreamRequest* request) override {
     if (requests_.empty()) return false;
-    request->set_table(requests_.front().table());
-    request->set_num_samples(requests_.front().num_samples());
+    *request = requests_.front();
     request->set_flexible_batch_size(-1);
     requests_.pop_front();
     return true;
@@ -139,6 +196,10 @@ class FakeSampleStream
     requests_.push_back(std::move(request));
   }
 
+  void AddRequest(SampleStreamRequest request) {
+    requests_.push_back(std::move(request));
+  }
+
   void SendInitialMetadata() override {}
 
  private:
@@ -147,6 +208,135 @@ class FakeSampleStream
   grpc::WriteOptions options_;
 };
 
+// Blocks every write until `Unblock` has been called.
+class BlockingSampleStream : public FakeSampleStream {
+ public:
+  bool Write(const SampleStreamResponse& response,
+             grpc::WriteOptions options) override {
+    unblocked_.WaitForNotification();
+    return FakeSampleStream::Write(response, options);
+  }
+
+  void Unblock() { unblocked_.Notify(); }
+
+ private:
+  absl::Notification unblocked_;
+};
+
+// Fails every write after the first `num_writes`, like a stream whose client
+// has gone away. The segments of the written responses are never read.
+class BrokenSampleStream : public FakeSampleStream {
+ public:
+  explicit BrokenSampleStream(int num_writes) : num_writes_(num_writes) {}
+
+  bool Write(const SampleStreamResponse& response,
+             grpc::WriteOptions options) override {
+    return num_writes_-- > 0 && FakeSampleStream::Write(response, options);
+  }
+
+ private:
+  int num_writes_;
+};
+
+class FakeMutatePrioritiesStream
+    : public grpc::ServerReaderInterface<MutatePrioritiesRequest> {
+ public:
+  void AddRequest(MutatePrioritiesRequest request) {
+    requests_.push_back(std::move(request));
+  }
+
+  bool Read(MutatePrioritiesRequest* request) override {
+    if (requests_.empty()) return false;
+    *request = requests_.front();
+    requests_.pop_front();
+    return true;
+  }
+
+  bool NextMessageSize(uint32_t* sz) override {
+    if (!requests_.empty()) *sz = requests_.front().ByteSizeLong();
+    return !requests_.empty();
+  }
+
+  void SendInitialMetadata() override {}
+
+ private:
+  std::list<MutatePrioritiesRequest> requests_;
+};
+
+// Reads the initial request and then blocks in `Read` until `Close` is called,
+// like a replica which keeps its stream open.
+class FakeReplicateStream
+    : public grpc::ServerReaderWriterInterface<ReplicateStreamResponse,
+                                               ReplicateStreamRequest> {
+ public:
+  explicit FakeReplicateStream(ReplicateStreamRequest request)
+      : request_(std::move(request)) {}
+
+  bool Read(ReplicateStreamRequest* request) override {
+    absl::MutexLock lock(&mu_);
+    if (!request_read_) {
+      request_read_ = true;
+      *request = request_;
+      return true;
+    }
+    mu_.Await(absl::Condition(&closed_));
+    return false;
+  }
+
+  bool Write(const ReplicateStreamResponse& response,
+             grpc::WriteOptions options) override {
+    absl::MutexLock lock(&mu_);
+    responses_.push_back(response);
+    num_events_ += response.events_size();
+    return true;
+  }
+
+  bool NextMessageSize(uint32_t*) override { return false; }
+  void SendInitialMetadata() override {}
+
+  void Close() {
+    absl::MutexLock lock(&mu_);
+    closed_ = true;
+  }
+
+  // Waits until the responses written so far hold `num_events` events.
+  std::vector<ReplicateStreamResponse> WaitForEvents(int num_events) {
+    absl::MutexLock lock(&mu_);
+    auto done = [this, num_events]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return num_events_ >= num_events;
+    };
+    mu_.Await(absl::Condition(&done));
+    return responses_;
+  }
+
+ private:
+  const ReplicateStreamRequest request_;
+  absl::Mutex mu_;
+  bool request_read_ ABSL_GUARDED_BY(mu_) = false;
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+  std::vector<ReplicateStreamResponse> responses_ ABSL_GUARDED_BY(mu_);
+  int num_events_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+class FakeExportTableWriter
+    : public grpc::ServerWriterInterface<ExportTableResponse> {
+ public:
+  bool Write(const ExportTableResponse& response,
+             grpc::WriteOptions options) override {
+    responses_.push_back(response);
+    return true;
+  }
+
+  void SendInitialMetadata() override {}
+
+  const std::vector<ExportTableResponse>& responses() const {
+    return responses_;
+  }
+
+ private:
+  std::vector<ExportTableResponse> responses_;
+};
+
 tensorflow::StructuredValue MakeSignature() {
   tensorflow::StructuredValue signature;
   auto* tensor_spec = signature.mutable_tensor_spec_value();
@@ -157,7 +347,8 @@ tensorflow::StructuredValue MakeSignature() {
 }
 
 std::unique_ptr<ReverbServiceImpl> MakeService(
-    int max_size, std::unique_ptr<Checkpointer> checkpointer) {
+    int max_size, std::unique_ptr<Checkpointer> checkpointer,
+    const ReverbServiceImpl::Options& options = {}) {
   std::vector<std::shared_ptr<Table>> tables;
 
   tables.push_back(absl::make_unique<Table>(
@@ -169,8 +360,8 @@ std::unique_ptr<ReverbServiceImpl> MakeService(
       std::vector<std::shared_ptr<TableExtension>>{},
       /*signature=*/absl::make_optional(MakeSignature())));
   std::unique_ptr<ReverbServiceImpl> service;
-  TF_CHECK_OK(ReverbServiceImpl::Create(std::move(tables),
-                                        std::move(checkpointer), &service));
+  TF_CHECK_OK(ReverbServiceImpl::Create(
+      std::move(tables), std::move(checkpointer), options, &service));
   return service;
 }
 
@@ -178,6 +369,39 @@ std::unique_ptr<ReverbServiceImpl> MakeService(int max_size) {
   return MakeService(max_size, nullptr);
 }
 
+// Creates a service with the tables "a" and "b" which hold one item each.
+std::unique_ptr<ReverbServiceImpl> MakeMixedService() {
+  std::vector<std::shared_ptr<Table>> tables;
+  for (const char* name : {"a", "b"}) {
+    tables.push_back(absl::make_unique<Table>(
+        name, absl::make_unique<UniformSelector>(),
+        absl::make_unique<FifoSelector>(), 10, 0,
+        absl::make_unique<RateLimiter>(kSamplesPerInsert, kMinSizeToSample,
+                                       kMinDiff, kMaxDiff)));
+  }
+  std::unique_ptr<ReverbServiceImpl> service;
+  TF_CHECK_OK(ReverbServiceImpl::Create(std::move(tables), &service));
+
+  FakeInsertStream stream;
+  stream.AddChunk(1);
+  stream.AddItem("a", {1}, {1});
+  stream.AddItem("b", {1});
+  REVERB_CHECK(service->InsertStreamInternal(nullptr, &stream).ok());
+  return service;
+}
+
+SampleStreamRequest MakeMixedRequest(
+    int num_samples, const std::vector<std::pair<std::string, double>>& mix) {
+  SampleStreamRequest request;
+  request.set_num_samples(num_samples);
+  for (const auto& [table, weight] : mix) {
+    auto* table_weight = request.add_tables();
+    table_weight->set_table(table);
+    table_weight->set_weight(weight);
+  }
+  return request;
+}
+
 TEST(ReverbServiceImplTest, SampleAfterInsertWorks) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
 
@@ -210,6 +434,365 @@ TEST(ReverbServiceImplTest, SampleAfterInsertWorks) {
   }
 }
 
+TEST(ReverbServiceImplTest, SampleStreamSamplesAheadOfBlockedWrites) {
+  ReverbServiceImpl::Options options;
+  options.sample_stream_queue_size = 4;
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, options);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  insert_stream.AddItem("dist", {1});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  BlockingSampleStream stream;
+  stream.AddRequest("dist", 10);
+  grpc::ServerContext context;
+  auto thread = internal::StartThread("SampleStream", [&] {
+    EXPECT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+  });
+
+  // The samples are taken while the first response is being written. A batch
+  // of samples is admitted by the rate limiter in a single call so the samples
+  // are counted through the item rather than through the call stats.
+  auto table = service->tables()["dist"];
+  auto times_sampled = [&] { return table->Copy(1)[0].item.times_sampled(); };
+  const absl::Time deadline = absl::Now() + absl::Seconds(10);
+  while (times_sampled() < options.sample_stream_queue_size &&
+         absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_GE(times_sampled(), options.sample_stream_queue_size);
+
+  stream.Unblock();
+  thread = nullptr;  // Joins the thread.
+  EXPECT_EQ(stream.responses().size(), 10);
+}
+
+TEST(ReverbServiceImplTest, ChunksArePassedThroughSharedMemory) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  ChunkData large;
+  large.set_chunk_key(1);
+  large.mutable_data()->add_tensors()->set_tensor_content(
+      std::string(internal::kMinSharedMemoryChunkBytes, 'a'));
+  ChunkData small;
+  small.set_chunk_key(2);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddSharedMemoryChunk(large);
+  insert_stream.AddSharedMemoryChunk(small);
+  insert_stream.AddItem("dist", {1, 2});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  FakeSampleStream stream;
+  SampleStreamRequest request;
+  request.set_table("dist");
+  request.set_num_samples(1);
+  request.set_shared_memory(true);
+  stream.AddRequest(request);
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+  ASSERT_EQ(stream.responses().size(), 2);
+
+  // Only the large chunk is worth passing through shared memory.
+  const SampleStreamResponse& first = stream.responses()[0];
+  EXPECT_FALSE(first.has_data());
+  ChunkData read;
+  TF_ASSERT_OK(
+      internal::ReadSharedMemoryChunk(first.shared_memory_data(), &read));
+  EXPECT_THAT(read, testing::EqualsProto(large));
+
+  const SampleStreamResponse& second = stream.responses()[1];
+  EXPECT_FALSE(second.has_shared_memory_data());
+  EXPECT_THAT(second.data(), testing::EqualsProto(small));
+}
+
+TEST(ReverbServiceImplTest, BrokenSampleStreamRemovesUnreadSegments) {
+  ReverbServiceImpl::Options options;
+  options.sample_stream_queue_size = 4;
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, options);
+
+  FakeInsertStream insert_stream;
+  for (int key = 1; key <= 10; key++) {
+    ChunkData chunk;
+    chunk.set_chunk_key(key);
+    chunk.mutable_data()->add_tensors()->set_tensor_content(
+        std::string(internal::kMinSharedMemoryChunkBytes, 'a'));
+    insert_stream.AddChunk(std::move(chunk));
+    insert_stream.AddItem("dist", {key});
+  }
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  // The first response is written but never read, and the responses which
+  // have been sampled ahead are never written.
+  BrokenSampleStream stream(/*num_writes=*/1);
+  SampleStreamRequest request;
+  request.set_table("dist");
+  request.set_num_samples(10);
+  request.set_shared_memory(true);
+  stream.AddRequest(request);
+  grpc::ServerContext context;
+  EXPECT_FALSE(service->SampleStreamInternal(&context, &stream).ok());
+  ASSERT_EQ(stream.responses().size(), 1);
+  ASSERT_TRUE(stream.responses()[0].has_shared_memory_data());
+
+  EXPECT_THAT(internal::ListSharedMemorySegmentsOfProcess(),
+              ::testing::IsEmpty());
+}
+
+TEST(ReverbServiceImplTest, SampleOnlySendsOverlappingBlocks) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({10, 3}));
+  tensor.flat<int>().setRandom();
+
+  ChunkData chunk;
+  chunk.set_chunk_key(1);
+  chunk.mutable_sequence_range()->set_start(0);
+  chunk.mutable_sequence_range()->set_end(9);
+  chunk.set_block_length(2);
+  CompressTensorBlocksAsProto(tensor, /*block_length=*/2,
+                              /*delta_encode=*/false, CODEC_SNAPPY,
+                              chunk.mutable_data()->add_tensors(),
+                              chunk.mutable_data()->add_block_indices());
+
+  // The item covers the time steps [3, 7) which overlap with the blocks
+  // [2, 4), [4, 6) and [6, 8).
+  PrioritizedItem item;
+  item.set_key(nextId++);
+  item.set_table("dist");
+  item.add_chunk_keys(1);
+  item.mutable_sequence_range()->set_offset(3);
+  item.mutable_sequence_range()->set_length(4);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(chunk);
+  insert_stream.AddItem(item);
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  FakeSampleStream stream;
+  stream.AddRequest("dist", 1);
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+  ASSERT_EQ(stream.responses().size(), 1);
+
+  const SampleStreamResponse& response = stream.responses()[0];
+  EXPECT_EQ(response.info().item().sequence_range().offset(), 1);
+  EXPECT_EQ(response.info().item().sequence_range().length(), 4);
+  EXPECT_EQ(response.data().chunk_key(), 1);
+  EXPECT_EQ(response.data().sequence_range().start(), 2);
+  EXPECT_EQ(response.data().sequence_range().end(), 7);
+  ASSERT_EQ(response.data().data().tensors_size(), 1);
+  EXPECT_EQ(response.data().data().tensors(0).tensor_shape().dim(0).size(), 6);
+  EXPECT_EQ(response.data().data().block_indices(0).limits_size(), 3);
+
+  tensorflow::Tensor output(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({4, 3}));
+  const ChunkData& data = response.data();
+  TF_ASSERT_OK(DecompressTensorBlockRowsInto(
+      data.data().tensors(0), data.data().block_indices(0),
+      data.block_length(), data.codec(), data.delta_encoded(), 1, 5, 0,
+      &output));
+  test::ExpectTensorEqual<int>(output, tensorflow::tensor::DeepCopy(
+                                           tensor.Slice(3, 7)));
+}
+
+TEST(ReverbServiceImplTest, SampleSendsReferencesToCachedChunks) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({10, 3}));
+  tensor.flat<int>().setRandom();
+
+  ChunkData chunk;
+  chunk.set_chunk_key(1);
+  chunk.mutable_sequence_range()->set_start(0);
+  chunk.mutable_sequence_range()->set_end(9);
+  CompressTensorAsProto(tensor, chunk.mutable_data()->add_tensors());
+
+  PrioritizedItem item;
+  item.set_key(nextId++);
+  item.set_table("dist");
+  item.add_chunk_keys(1);
+  item.mutable_sequence_range()->set_offset(3);
+  item.mutable_sequence_range()->set_length(4);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(chunk);
+  insert_stream.AddItem(item);
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  auto make_request = [](int64_t start, int64_t end) {
+    SampleStreamRequest request;
+    request.set_table("dist");
+    request.set_num_samples(1);
+    auto* cached = request.add_cached_chunks();
+    cached->set_chunk_key(1);
+    cached->set_start(start);
+    cached->set_end(end);
+    return request;
+  };
+
+  FakeSampleStream stream;
+  // The client doesn't hold the time steps [3, 5) of the item.
+  stream.AddRequest(make_request(5, 9));
+  // The client holds the entire chunk.
+  stream.AddRequest(make_request(0, 9));
+  // The client has evicted the chunk.
+  SampleStreamRequest evicted;
+  evicted.set_table("dist");
+  evicted.set_num_samples(1);
+  evicted.add_evicted_chunk_keys(1);
+  stream.AddRequest(evicted);
+
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+  ASSERT_EQ(stream.responses().size(), 3);
+
+  for (int i : {0, 2}) {
+    const auto& response = stream.responses()[i];
+    EXPECT_FALSE(response.data_is_cached());
+    EXPECT_EQ(response.data().data().tensors_size(), 1);
+  }
+
+  const auto& reference = stream.responses()[1];
+  EXPECT_TRUE(reference.data_is_cached());
+  EXPECT_EQ(reference.data().chunk_key(), 1);
+  EXPECT_EQ(reference.data().sequence_range().start(), 0);
+  EXPECT_EQ(reference.data().sequence_range().end(), 9);
+  EXPECT_EQ(reference.data().data().tensors_size(), 0);
+  EXPECT_EQ(reference.info().item().sequence_range().offset(), 3);
+}
+
+TEST(ReverbServiceImplTest, SampleOnlySendsReferencedColumns) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  ChunkData chunk;
+  chunk.set_chunk_key(1);
+  chunk.mutable_sequence_range()->set_start(0);
+  chunk.mutable_sequence_range()->set_end(9);
+  for (int width : {1, 2, 3}) {
+    tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                              tensorflow::TensorShape({10, width}));
+    tensor.flat<int>().setRandom();
+    CompressTensorAsProto(tensor, chunk.mutable_data()->add_tensors());
+  }
+
+  PrioritizedItem item;
+  item.set_key(nextId++);
+  item.set_table("dist");
+  item.add_chunk_keys(1);
+  item.mutable_sequence_range()->set_offset(3);
+  item.mutable_sequence_range()->set_length(4);
+  item.add_columns(2);
+  item.add_columns(0);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(chunk);
+  insert_stream.AddItem(item);
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  // The client holds the full chunk but it is sent anyway as the client
+  // can't tell the stripped chunk apart from the full one.
+  SampleStreamRequest request;
+  request.set_table("dist");
+  request.set_num_samples(1);
+  auto* cached = request.add_cached_chunks();
+  cached->set_chunk_key(1);
+  cached->set_start(0);
+  cached->set_end(9);
+
+  FakeSampleStream stream;
+  stream.AddRequest(request);
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+  ASSERT_EQ(stream.responses().size(), 1);
+
+  const SampleStreamResponse& response = stream.responses()[0];
+  EXPECT_FALSE(response.data_is_cached());
+  EXPECT_THAT(response.info().item().columns(), ::testing::ElementsAre(2, 0));
+  EXPECT_EQ(response.data().chunk_key(), 1);
+  ASSERT_EQ(response.data().data().tensors_size(), 2);
+  EXPECT_EQ(response.data().data().tensors(0).tensor_shape().dim(1).size(), 3);
+  EXPECT_EQ(response.data().data().tensors(1).tensor_shape().dim(1).size(), 1);
+}
+
+TEST(ReverbServiceImplTest, SamplePacksResponses) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  insert_stream.AddChunk(2);
+  insert_stream.AddItem("dist", {1, 2});
+  insert_stream.AddItem("dist", {2});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  SampleStreamRequest request;
+  request.set_table("dist");
+  request.set_num_samples(4);
+  request.set_max_response_bytes(1 << 20);
+
+  FakeSampleStream stream;
+  stream.AddRequest(request);
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+
+  // The default flexible batch size of the table allows all samples to be
+  // sampled at once, so the chunks of all samples are packed into a single
+  // message.
+  ASSERT_EQ(stream.responses().size(), 1);
+  const SampleStreamResponse& packed = stream.responses()[0];
+  EXPECT_FALSE(packed.has_info());
+  EXPECT_FALSE(packed.has_data());
+
+  int num_samples = 0;
+  int remaining_chunks = 0;
+  for (const auto& entry : packed.entries()) {
+    EXPECT_EQ(entry.entries_size(), 0);
+    if (remaining_chunks == 0) {
+      ASSERT_TRUE(entry.has_info());
+      remaining_chunks = entry.info().item().chunk_keys_size();
+      num_samples++;
+    }
+    EXPECT_EQ(entry.end_of_sequence(), --remaining_chunks == 0);
+  }
+  EXPECT_EQ(num_samples, 4);
+}
+
+TEST(ReverbServiceImplTest, SamplePacksResponsesUpToMaxBytes) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  insert_stream.AddChunk(2);
+  insert_stream.AddChunk(3);
+  insert_stream.AddItem("dist", {1, 2, 3});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  SampleStreamRequest request;
+  request.set_table("dist");
+  request.set_num_samples(1);
+  request.set_max_response_bytes(1);
+
+  FakeSampleStream stream;
+  stream.AddRequest(request);
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+
+  // Every chunk exceeds the limit so each is written on its own.
+  ASSERT_EQ(stream.responses().size(), 3);
+  for (int i = 0; i < 3; i++) {
+    const auto& packed = stream.responses()[i];
+    ASSERT_EQ(packed.entries_size(), 1);
+    EXPECT_EQ(packed.entries(0).has_info(), i == 0);
+    EXPECT_EQ(packed.entries(0).data().chunk_key(), i + 1);
+    EXPECT_EQ(packed.entries(0).end_of_sequence(), i == 2);
+  }
+}
+
 TEST(ReverbServiceImplTest, InsertChunksWithoutItemWorks) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   grpc::ServerContext context;
@@ -283,6 +866,132 @@ TEST(ReverbServiceImplTest, InsertStreamRespondsWithItemKeys) {
   EXPECT_EQ(stream.responses()[1].key(), first_id + 2);
 }
 
+TEST(ReverbServiceImplTest, InsertStreamCoalescesBatchedConfirmations) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  grpc::ServerContext context;
+
+  FakeInsertStream stream;
+  stream.AddChunk(1);
+  auto first_id = nextId;
+  stream.AddItem("dist", {1}, {1}, /*send_confirmation=*/true,
+                 /*batch_confirmations=*/true);
+  stream.AddItem("dist", {1}, {1}, /*send_confirmation=*/true,
+                 /*batch_confirmations=*/false);
+  stream.AddItem("dist", {1}, {1}, /*send_confirmation=*/false,
+                 /*batch_confirmations=*/true);
+  stream.AddItem("dist", {1}, {}, /*send_confirmation=*/true,
+                 /*batch_confirmations=*/true);
+  EXPECT_OK(service->InsertStreamInternal(&context, &stream));
+
+  // How many responses the batched confirmations are split across depends on
+  // how the items were batched by the server.
+  std::vector<uint64_t> batched;
+  std::vector<uint64_t> single;
+  for (const auto& response : stream.responses()) {
+    if (response.keys().empty()) {
+      single.push_back(response.key());
+    } else {
+      batched.insert(batched.end(), response.keys().begin(),
+                     response.keys().end());
+    }
+  }
+  EXPECT_THAT(batched, ::testing::ElementsAre(first_id, first_id + 3));
+  EXPECT_THAT(single, ::testing::ElementsAre(first_id + 1));
+}
+
+TEST(ReverbServiceImplTest, InsertStreamWithSmallQueueWorks) {
+  ReverbServiceImpl::Options options;
+  options.insert_stream_queue_size = 1;
+  options.insert_stream_queue_bytes = 1;
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(100, nullptr, options);
+  grpc::ServerContext context;
+
+  FakeInsertStream stream;
+  for (int i = 1; i <= 20; i++) {
+    stream.AddChunk(i);
+    stream.AddItem("dist", {i}, {}, /*send_confirmation=*/true);
+  }
+  EXPECT_OK(service->InsertStreamInternal(&context, &stream));
+  EXPECT_THAT(stream.responses(), ::testing::SizeIs(20));
+  EXPECT_EQ(service->tables()["dist"]->size(), 20);
+}
+
+TEST(ReverbServiceImplTest, InsertStreamRunsOnStreamExecutor) {
+  ReverbServiceImpl::Options options;
+  options.stream_executor =
+      std::make_shared<internal::ThreadPool>(1, "ReverbServiceImplTest");
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(100, nullptr, options);
+
+  // The streams run one after the other on the single thread of the executor.
+  for (int s = 0; s < 3; s++) {
+    grpc::ServerContext context;
+    FakeInsertStream stream;
+    for (int i = 1; i <= 5; i++) {
+      stream.AddChunk(s * 5 + i);
+      stream.AddItem("dist", {s * 5 + i}, {}, /*send_confirmation=*/true);
+    }
+    EXPECT_OK(service->InsertStreamInternal(&context, &stream));
+    EXPECT_THAT(stream.responses(), ::testing::SizeIs(5));
+  }
+  EXPECT_EQ(service->tables()["dist"]->size(), 15);
+}
+
+TEST(ReverbServiceImplTest, InsertStreamInsertsItemsReadBeforeError) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  grpc::ServerContext context;
+
+  FakeInsertStream stream;
+  stream.AddChunk(1);
+  stream.AddItem("dist", {1}, {1});
+  stream.AddItem("dist", {2});
+  stream.AddItem("dist", {1});
+  EXPECT_EQ(service->InsertStreamInternal(&context, &stream).error_code(),
+            grpc::StatusCode::INTERNAL);
+  EXPECT_EQ(service->tables()["dist"]->size(), 1);
+}
+
+TEST(ReverbServiceImplTest, ServerInfoReportsOpenInsertStreams) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  ServerInfoRequest request;
+  ServerInfoResponse info;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &request, &info).ok());
+  EXPECT_THAT(info.insert_streams(), ::testing::IsEmpty());
+
+  BlockingInsertStream stream;
+  stream.AddChunk(1);
+  stream.AddItem("dist", {1});
+  absl::Notification done;
+  auto thread = internal::StartThread("", [&] {
+    EXPECT_OK(service->InsertStreamInternal(nullptr, &stream));
+    done.Notify();
+  });
+
+  // The stream remains open until it is unblocked.
+  for (int i = 0; i < 1000; i++) {
+    info.Clear();
+    ASSERT_TRUE(service->ServerInfo(nullptr, &request, &info).ok());
+    if (info.insert_streams_size() == 1 &&
+        info.insert_streams(0).items() == 1) {
+      break;
+    }
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  ASSERT_THAT(info.insert_streams(), ::testing::SizeIs(1));
+  EXPECT_EQ(info.insert_streams(0).items(), 1);
+  EXPECT_GT(info.insert_streams(0).bytes(), 0);
+
+  stream.Unblock();
+  done.WaitForNotification();
+  thread = nullptr;  // Joins the thread.
+
+  info.Clear();
+  ASSERT_TRUE(service->ServerInfo(nullptr, &request, &info).ok());
+  EXPECT_THAT(info.insert_streams(), ::testing::IsEmpty());
+}
+
 TEST(ReverbServiceImplTest, SampleBlocksUntilEnoughInserts) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   absl::Notification notification;
@@ -309,6 +1018,91 @@ TEST(ReverbServiceImplTest, SampleBlocksUntilEnoughInserts) {
   thread = nullptr;  // Joins the thread.
 }
 
+TEST(ReverbServiceImplTest, SampleStreamMixesTablesByWeight) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeMixedService();
+
+  FakeSampleStream stream;
+  stream.AddRequest(MakeMixedRequest(8, {{"a", 1.0}, {"b", 3.0}}));
+  stream.AddRequest(MakeMixedRequest(4, {{"a", 1.0}, {"b", 3.0}}));
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+
+  absl::flat_hash_map<std::string, int> counts;
+  for (const auto& response : stream.responses()) {
+    if (response.has_info()) counts[response.info().item().table()]++;
+  }
+  EXPECT_EQ(counts["a"], 3);
+  EXPECT_EQ(counts["b"], 9);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsInvalidMix) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeMixedService();
+  grpc::ServerContext context;
+
+  std::vector<SampleStreamRequest> requests = {
+      MakeMixedRequest(1, {{"a", 1.0}, {"b", 0.0}}),
+      MakeMixedRequest(1, {{"a", 1.0}, {"a", 1.0}}),
+  };
+  requests.push_back(MakeMixedRequest(1, {{"a", 1.0}}));
+  requests.back().set_table("b");
+  for (const auto& request : requests) {
+    FakeSampleStream stream;
+    stream.AddRequest(request);
+    EXPECT_EQ(service->SampleStreamInternal(&context, &stream).error_code(),
+              grpc::StatusCode::INVALID_ARGUMENT);
+  }
+
+  FakeSampleStream stream;
+  stream.AddRequest(MakeMixedRequest(1, {{"a", 1.0}, {"missing", 1.0}}));
+  EXPECT_EQ(service->SampleStreamInternal(&context, &stream).error_code(),
+            grpc::StatusCode::NOT_FOUND);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamAppliesPriorityUpdates) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  PrioritizedItem first = insert_stream.AddItem("dist", {1});
+  PrioritizedItem second = insert_stream.AddItem("dist", {1});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  // The mutations are applied before the first sample of the request, so only
+  // the updated `second` can be sampled.
+  SampleStreamRequest request;
+  request.set_table("dist");
+  request.set_num_samples(2);
+  *request.add_priority_updates() =
+      testing::MakeKeyWithPriority(second.key(), 7);
+  request.add_delete_keys(first.key());
+  FakeSampleStream stream;
+  stream.AddRequest(request);
+  grpc::ServerContext context;
+  ASSERT_TRUE(service->SampleStreamInternal(&context, &stream).ok());
+
+  int num_samples = 0;
+  for (const auto& response : stream.responses()) {
+    if (!response.has_info()) continue;
+    EXPECT_EQ(response.info().item().key(), second.key());
+    EXPECT_EQ(response.info().item().priority(), 7);
+    num_samples++;
+  }
+  EXPECT_EQ(num_samples, 2);
+  EXPECT_EQ(service->tables()["dist"]->size(), 1);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsPriorityUpdatesOfMix) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeMixedService();
+
+  SampleStreamRequest request = MakeMixedRequest(1, {{"a", 1.0}, {"b", 1.0}});
+  request.add_delete_keys(1);
+  FakeSampleStream stream;
+  stream.AddRequest(request);
+  grpc::ServerContext context;
+  EXPECT_EQ(service->SampleStreamInternal(&context, &stream).error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
 TEST(ReverbServiceImplTest, MutateDeletionWorks) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
 
@@ -327,6 +1121,41 @@ TEST(ReverbServiceImplTest, MutateDeletionWorks) {
   EXPECT_EQ(service->tables()["dist"]->size(), 0);
 }
 
+TEST(ReverbServiceImplTest, MutatePrioritiesStreamAppliesAllRequests) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  PrioritizedItem first = insert_stream.AddItem("dist", {1}, {1});
+  PrioritizedItem second = insert_stream.AddItem("dist", {1}, {1});
+  PrioritizedItem third = insert_stream.AddItem("dist", {1});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  // The later update of `first` wins and the update of `third` is discarded by
+  // its deletion, exactly as if the requests were applied one by one.
+  FakeMutatePrioritiesStream stream;
+  MutatePrioritiesRequest request;
+  request.set_table("dist");
+  *request.add_updates() = testing::MakeKeyWithPriority(first.key(), 2);
+  *request.add_updates() = testing::MakeKeyWithPriority(third.key(), 2);
+  stream.AddRequest(request);
+  request.Clear();
+  request.set_table("dist");
+  *request.add_updates() = testing::MakeKeyWithPriority(first.key(), 5);
+  *request.add_updates() = testing::MakeKeyWithPriority(second.key(), 3);
+  request.add_delete_keys(third.key());
+  stream.AddRequest(request);
+  ASSERT_TRUE(service->MutatePrioritiesStreamInternal(nullptr, &stream).ok());
+
+  std::map<uint64_t, double> priorities;
+  for (const auto& item : service->tables()["dist"]->Copy()) {
+    priorities[item.item.key()] = item.item.priority();
+  }
+  EXPECT_THAT(priorities, ::testing::ElementsAre(
+                              ::testing::Pair(first.key(), 5),
+                              ::testing::Pair(second.key(), 3)));
+}
+
 TEST(ReverbServiceImplTest, AnyCallWithInvalidDistributionFails) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   grpc::ServerContext context;
@@ -343,6 +1172,12 @@ TEST(ReverbServiceImplTest, AnyCallWithInvalidDistributionFails) {
       service->MutatePriorities(nullptr, &mutate_request, nullptr).error_code(),
       grpc::StatusCode::NOT_FOUND);
 
+  FakeMutatePrioritiesStream mutate_stream;
+  mutate_stream.AddRequest(mutate_request);
+  EXPECT_EQ(service->MutatePrioritiesStreamInternal(nullptr, &mutate_stream)
+                .error_code(),
+            grpc::StatusCode::NOT_FOUND);
+
   FakeInsertStream stream;
   stream.AddChunk(1);
   stream.AddItem("invalid", {1});
@@ -368,6 +1203,337 @@ TEST(ReverbServiceImplTest, ResetWorks) {
   EXPECT_EQ(service->tables()["dist"]->size(), 0);
 }
 
+TEST(ReverbServiceImplTest, ReplicateStreamSendsSnapshotAndMutations) {
+  ReverbServiceImpl::Options options;
+  options.enable_replication = true;
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, options);
+
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  PrioritizedItem first = insert_stream.AddItem("dist", {1});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  ReplicateStreamRequest request;
+  request.add_tables("dist");
+  request.set_replica_address("replica:1234");
+  FakeReplicateStream stream(request);
+  grpc::Status status;
+  auto thread = internal::StartThread("ReplicateStream", [&] {
+    status = service->ReplicateStreamInternal(nullptr, &stream);
+  });
+
+  // The snapshot holds the item together with its chunk.
+  std::vector<ReplicateStreamResponse> responses = stream.WaitForEvents(1);
+  ASSERT_THAT(responses, ::testing::SizeIs(1));
+  EXPECT_EQ(responses[0].table(), "dist");
+  EXPECT_EQ(responses[0].snapshot_size(), 1);
+  EXPECT_TRUE(responses[0].end_of_snapshot());
+  ASSERT_THAT(responses[0].chunks(), ::testing::SizeIs(1));
+  EXPECT_EQ(responses[0].chunks(0).chunk_key(), 1);
+  ASSERT_THAT(responses[0].events(), ::testing::SizeIs(1));
+  EXPECT_EQ(responses[0].events(0).insert().key(), first.key());
+
+  ServerInfoRequest info_request;
+  ServerInfoResponse info;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &info_request, &info).ok());
+  ASSERT_THAT(info.replicas(), ::testing::SizeIs(1));
+  EXPECT_EQ(info.replicas(0).address(), "replica:1234");
+  EXPECT_THAT(info.replicas(0).tables(), ::testing::ElementsAre("dist"));
+
+  // Later mutations are streamed in the order they were applied.
+  FakeInsertStream second_insert_stream;
+  second_insert_stream.AddChunk(2);
+  PrioritizedItem second = second_insert_stream.AddItem("dist", {2});
+  ASSERT_TRUE(
+      service->InsertStreamInternal(nullptr, &second_insert_stream).ok());
+  MutatePrioritiesRequest mutate_request;
+  mutate_request.set_table("dist");
+  mutate_request.add_delete_keys(first.key());
+  MutatePrioritiesResponse mutate_response;
+  ASSERT_TRUE(
+      service->MutatePriorities(nullptr, &mutate_request, &mutate_response)
+          .ok());
+
+  responses = stream.WaitForEvents(3);
+  std::vector<ReplicationEvent> events;
+  std::vector<uint64_t> chunk_keys;
+  for (int i = 1; i < responses.size(); i++) {
+    events.insert(events.end(), responses[i].events().begin(),
+                  responses[i].events().end());
+    for (const auto& chunk : responses[i].chunks()) {
+      chunk_keys.push_back(chunk.chunk_key());
+    }
+  }
+  ASSERT_THAT(events, ::testing::SizeIs(2));
+  EXPECT_EQ(events[0].insert().key(), second.key());
+  EXPECT_EQ(events[1].delete_key(), first.key());
+  EXPECT_THAT(chunk_keys, ::testing::ElementsAre(2));
+
+  stream.Close();
+  thread = nullptr;  // Joins the thread.
+  EXPECT_TRUE(status.ok()) << status.error_message();
+
+  ASSERT_TRUE(service->ServerInfo(nullptr, &info_request, &info).ok());
+  EXPECT_THAT(info.replicas(), ::testing::IsEmpty());
+}
+
+TEST(ReverbServiceImplTest, ReplicateStreamFailsUnlessEnabled) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  ReplicateStreamRequest request;
+  request.add_tables("dist");
+  FakeReplicateStream stream(request);
+  stream.Close();
+  EXPECT_EQ(service->ReplicateStreamInternal(nullptr, &stream).error_code(),
+            grpc::StatusCode::FAILED_PRECONDITION);
+}
+
+TEST(ReverbServiceImplTest, ReplicaRejectsWrites) {
+  ReverbServiceImpl::Options options;
+  // Nothing listens on the port so the replica keeps reconnecting.
+  options.primary_address = "localhost:1";
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, options);
+
+  FakeInsertStream stream;
+  stream.AddChunk(1);
+  stream.AddItem("dist", {1});
+  EXPECT_EQ(service->InsertStreamInternal(nullptr, &stream).error_code(),
+            grpc::StatusCode::FAILED_PRECONDITION);
+
+  ResetRequest reset_request;
+  reset_request.set_table("dist");
+  ResetResponse reset_response;
+  EXPECT_EQ(
+      service->Reset(nullptr, &reset_request, &reset_response).error_code(),
+      grpc::StatusCode::FAILED_PRECONDITION);
+
+  ServerInfoRequest info_request;
+  ServerInfoResponse info;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &info_request, &info).ok());
+  EXPECT_EQ(info.replication_info().primary_address(), "localhost:1");
+  EXPECT_FALSE(info.replication_info().up_to_date());
+}
+
+TEST(ReverbServiceImplTest, ExportTableStreamsItemsInPages) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  insert_stream.AddChunk(2);
+  std::vector<PrioritizedItem> items;
+  items.push_back(insert_stream.AddItem("dist", {1}, {1, 2}));
+  items.push_back(insert_stream.AddItem("dist", {1, 2}, {2}));
+  items.push_back(insert_stream.AddItem("dist", {2}));
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  ExportTableRequest request;
+  request.set_table("dist");
+  request.set_max_items_per_response(2);
+  FakeExportTableWriter writer;
+  ASSERT_TRUE(service->ExportTableInternal(nullptr, &request, &writer).ok());
+
+  const auto& responses = writer.responses();
+  ASSERT_THAT(responses, ::testing::SizeIs(2));
+  EXPECT_EQ(responses[0].table_size(), 3);
+  EXPECT_EQ(responses[1].table_size(), 0);
+  EXPECT_THAT(responses[0].keys(),
+              ::testing::ElementsAre(items[0].key(), items[1].key()));
+  EXPECT_THAT(responses[0].chunk_keys(), ::testing::ElementsAre(1, 1, 2));
+  EXPECT_THAT(responses[0].chunk_key_offsets(),
+              ::testing::ElementsAre(0, 1, 3));
+  EXPECT_THAT(responses[0].column_offsets(), ::testing::ElementsAre(0, 0, 0));
+  ASSERT_THAT(responses[0].sequence_ranges(), ::testing::SizeIs(2));
+  EXPECT_EQ(responses[0].sequence_ranges(1).length(), 100);
+  ASSERT_THAT(responses[0].chunks(), ::testing::SizeIs(2));
+  EXPECT_EQ(responses[0].chunks(0).chunk_key(), 1);
+  EXPECT_EQ(responses[0].chunks(1).chunk_key(), 2);
+
+  // Chunks are only sent with the first page which references them.
+  EXPECT_THAT(responses[1].keys(), ::testing::ElementsAre(items[2].key()));
+  EXPECT_THAT(responses[1].chunk_keys(), ::testing::ElementsAre(2));
+  EXPECT_THAT(responses[1].chunk_key_offsets(), ::testing::ElementsAre(0, 1));
+  EXPECT_THAT(responses[1].chunks(), ::testing::IsEmpty());
+}
+
+TEST(ReverbServiceImplTest, ExportTableSkipsChunks) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  FakeInsertStream insert_stream;
+  insert_stream.AddChunk(1);
+  insert_stream.AddItem("dist", {1});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &insert_stream).ok());
+
+  ExportTableRequest request;
+  request.set_table("dist");
+  request.set_skip_chunks(true);
+  FakeExportTableWriter writer;
+  ASSERT_TRUE(service->ExportTableInternal(nullptr, &request, &writer).ok());
+  ASSERT_THAT(writer.responses(), ::testing::SizeIs(1));
+  EXPECT_THAT(writer.responses()[0].keys(), ::testing::SizeIs(1));
+  EXPECT_THAT(writer.responses()[0].chunk_keys(), ::testing::ElementsAre(1));
+  EXPECT_THAT(writer.responses()[0].chunks(), ::testing::IsEmpty());
+}
+
+TEST(ReverbServiceImplTest, ExportTableOfEmptyTableSendsOneResponse) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  ExportTableRequest request;
+  request.set_table("dist");
+  FakeExportTableWriter writer;
+  ASSERT_TRUE(service->ExportTableInternal(nullptr, &request, &writer).ok());
+  ASSERT_THAT(writer.responses(), ::testing::SizeIs(1));
+  EXPECT_EQ(writer.responses()[0].table_size(), 0);
+  EXPECT_THAT(writer.responses()[0].keys(), ::testing::IsEmpty());
+
+  request.set_table("missing");
+  EXPECT_EQ(
+      service->ExportTableInternal(nullptr, &request, &writer).error_code(),
+      grpc::StatusCode::NOT_FOUND);
+}
+
+ChunkData MakeTensorChunk(uint64_t key) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({100, 10}));
+  tensor.flat<int>().setZero();
+  ChunkData chunk;
+  chunk.set_chunk_key(key);
+  CompressTensorAsProto(tensor, chunk.mutable_data()->add_tensors(),
+                        CODEC_NONE);
+  return chunk;
+}
+
+TEST(ReverbServiceImplTest, InsertStreamIsDelayedAboveSoftMemoryLimit) {
+  ReverbServiceImpl::Options options;
+  options.memory_soft_limit_bytes = 1;
+  options.memory_max_read_delay = absl::Milliseconds(1);
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, options);
+
+  FakeInsertStream stream;
+  stream.AddChunk(MakeTensorChunk(1));
+  stream.AddItem("dist", {1});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &stream).ok());
+
+  ServerInfoRequest info_request;
+  ServerInfoResponse info;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &info_request, &info).ok());
+  EXPECT_EQ(info.table_info(0).current_size(), 1);
+  const MemoryAdmissionInfo& admission = info.memory_admission_info();
+  EXPECT_GT(admission.used_bytes(), 1);
+  EXPECT_EQ(admission.soft_limit_bytes(), 1);
+  EXPECT_EQ(admission.hard_limit_bytes(), 0);
+  // At least the read after the chunk is delayed.
+  EXPECT_GE(admission.num_delayed_requests(), 1);
+  EXPECT_EQ(admission.num_rejected_chunks(), 0);
+}
+
+TEST(ReverbServiceImplTest, InsertStreamRejectsChunksAboveHardMemoryLimit) {
+  ReverbServiceImpl::Options options;
+  options.memory_hard_limit_bytes = 1000;
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, options);
+
+  FakeInsertStream stream;
+  stream.AddChunk(MakeTensorChunk(1));
+  stream.AddItem("dist", {1});
+  EXPECT_EQ(service->InsertStreamInternal(nullptr, &stream).error_code(),
+            grpc::StatusCode::RESOURCE_EXHAUSTED);
+
+  ServerInfoRequest info_request;
+  ServerInfoResponse info;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &info_request, &info).ok());
+  EXPECT_EQ(info.table_info(0).current_size(), 0);
+  EXPECT_EQ(info.memory_admission_info().hard_limit_bytes(), 1000);
+  EXPECT_EQ(info.memory_admission_info().num_rejected_chunks(), 1);
+}
+
+TEST(ReverbServiceImplTest, ServerInfoOmitsMemoryAdmissionUnlessEnabled) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  ServerInfoRequest info_request;
+  ServerInfoResponse info;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &info_request, &info).ok());
+  EXPECT_FALSE(info.has_memory_admission_info());
+
+  ReverbServiceImpl::Options options;
+  options.memory_soft_limit_bytes = 2;
+  options.memory_hard_limit_bytes = 1;
+  std::unique_ptr<ReverbServiceImpl> invalid;
+  EXPECT_EQ(
+      ReverbServiceImpl::Create({}, nullptr, options, &invalid).code(),
+      tensorflow::error::INVALID_ARGUMENT);
+}
+
+ChunkData MakeEpisodeChunk(uint64_t key, uint64_t episode_id, int start,
+                           int end) {
+  ChunkData chunk;
+  chunk.set_chunk_key(key);
+  chunk.mutable_sequence_range()->set_episode_id(episode_id);
+  chunk.mutable_sequence_range()->set_start(start);
+  chunk.mutable_sequence_range()->set_end(end);
+  return chunk;
+}
+
+TEST(ReverbServiceImplTest, InsertStreamDerivesItemsFromItemRules) {
+  ReverbServiceImpl::Options options;
+  ItemRule& rule = options.table_item_rules["dist"].emplace_back();
+  rule.set_length(3);
+  rule.set_stride(2);
+  rule.set_priority(1.5);
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, options);
+
+  FakeInsertStream stream;
+  for (ChunkData chunk :
+       {MakeEpisodeChunk(1, 7, 0, 1), MakeEpisodeChunk(2, 7, 2, 3),
+        MakeEpisodeChunk(3, 7, 4, 5),
+        // A new episode whose first window is never completed.
+        MakeEpisodeChunk(4, 8, 0, 1)}) {
+    InsertStreamRequest request;
+    *request.mutable_chunk() = std::move(chunk);
+    request.set_derived_items_only(true);
+    stream.AddRequest(std::move(request));
+  }
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &stream).ok());
+
+  // The windows [0, 2] and [2, 4] fit into the first episode.
+  std::vector<Table::Item> items = service->tables()["dist"]->Copy();
+  ASSERT_EQ(items.size(), 2);
+  std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) {
+    return a.item.chunk_keys(0) < b.item.chunk_keys(0);
+  });
+  EXPECT_THAT(items[0].item.chunk_keys(), ::testing::ElementsAre(1, 2));
+  EXPECT_THAT(items[1].item.chunk_keys(), ::testing::ElementsAre(2, 3));
+  for (const auto& item : items) {
+    EXPECT_EQ(item.item.sequence_range().offset(), 0);
+    EXPECT_EQ(item.item.sequence_range().length(), 3);
+    EXPECT_EQ(item.item.priority(), 1.5);
+  }
+
+  ServerInfoRequest info_request;
+  ServerInfoResponse info;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &info_request, &info).ok());
+  EXPECT_THAT(info.table_info(0).item_rules(),
+              ::testing::ElementsAre(testing::EqualsProto(rule)));
+}
+
+TEST(ReverbServiceImplTest, CreateRejectsInvalidItemRules) {
+  ReverbServiceImpl::Options unknown_table;
+  unknown_table.table_item_rules["unknown"].emplace_back().set_length(1);
+  ReverbServiceImpl::Options invalid_stride;
+  invalid_stride.table_item_rules["dist"].emplace_back().set_length(1);
+  for (const auto& options : {unknown_table, invalid_stride}) {
+    std::vector<std::shared_ptr<Table>> tables;
+    tables.push_back(absl::make_unique<Table>(
+        "dist", absl::make_unique<UniformSelector>(),
+        absl::make_unique<FifoSelector>(), 10, 0,
+        absl::make_unique<RateLimiter>(kSamplesPerInsert, kMinSizeToSample,
+                                       kMinDiff, kMaxDiff)));
+    std::unique_ptr<ReverbServiceImpl> service;
+    EXPECT_EQ(ReverbServiceImpl::Create(std::move(tables), nullptr, options,
+                                        &service)
+                  .code(),
+              tensorflow::error::INVALID_ARGUMENT);
+  }
+}
+
 TEST(ReverbServiceImplTest, ServerInfoWorks) {
   auto service = MakeService(10);
 
@@ -383,7 +1549,14 @@ TEST(ReverbServiceImplTest, ServerInfoWorks) {
             std::make_pair(uint64_t{0}, uint64_t{0}));
 
   EXPECT_EQ(server_info_response.table_info_size(), 1);
-  const auto& table_info = server_info_response.table_info()[0];
+  TableInfo table_info = server_info_response.table_info()[0];
+  // Latency stats are covered by the table tests.
+  table_info.clear_latency_stats();
+
+  // No chunks have been inserted.
+  EXPECT_EQ(server_info_response.chunk_store_info().num_chunks(), 0);
+  EXPECT_EQ(server_info_response.chunk_store_info().data_bytes(), 0);
+  EXPECT_EQ(server_info_response.chunk_store_info().allocated_bytes(), 0);
 
   TableInfo expected_table_info;
   expected_table_info.set_name("dist");
@@ -407,6 +1580,71 @@ TEST(ReverbServiceImplTest, ServerInfoWorks) {
   EXPECT_THAT(table_info, testing::EqualsProto(expected_table_info));
 }
 
+TEST(ReverbServiceImplTest, ServerInfoOmitsUnchangedSignatures) {
+  auto service = MakeService(10);
+
+  ServerInfoRequest request;
+  ServerInfoResponse first;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &request, &first).ok());
+  EXPECT_FALSE(first.signatures_omitted());
+  ASSERT_EQ(first.table_info_size(), 1);
+  EXPECT_TRUE(first.table_info(0).has_signature());
+
+  for (bool allow_stale : {false, true}) {
+    *request.mutable_tables_state_id() = first.tables_state_id();
+    request.set_allow_stale(allow_stale);
+    ServerInfoResponse second;
+    ASSERT_TRUE(service->ServerInfo(nullptr, &request, &second).ok());
+    EXPECT_TRUE(second.signatures_omitted());
+    ASSERT_EQ(second.table_info_size(), 1);
+    EXPECT_FALSE(second.table_info(0).has_signature());
+    EXPECT_EQ(second.table_info(0).name(), "dist");
+    EXPECT_EQ(second.table_info(0).max_size(), 10);
+  }
+
+  // Signatures are sent if the client holds those of other tables.
+  request.mutable_tables_state_id()->set_low(first.tables_state_id().low() + 1);
+  ServerInfoResponse third;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &request, &third).ok());
+  EXPECT_FALSE(third.signatures_omitted());
+  EXPECT_TRUE(third.table_info(0).has_signature());
+}
+
+TEST(ReverbServiceImplTest, MetricsCountCallsAndExportTables) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+
+  FakeInsertStream stream;
+  stream.AddChunk(1);
+  stream.AddItem("dist", {1});
+  ASSERT_TRUE(service->InsertStreamInternal(nullptr, &stream).ok());
+
+  ServerInfoRequest request;
+  ServerInfoResponse response;
+  ASSERT_TRUE(service->ServerInfo(nullptr, &request, &response).ok());
+
+  const std::string text = service->metrics().ToText();
+  EXPECT_THAT(text, testing::HasSubstr(
+                        "reverb_rpc_calls_total{method=\"InsertStream\"} 1\n"));
+  EXPECT_THAT(text, testing::HasSubstr(
+                        "reverb_rpc_calls_total{method=\"ServerInfo\"} 1\n"));
+  EXPECT_THAT(text,
+              testing::HasSubstr(
+                  "reverb_rpc_active_calls{method=\"InsertStream\"} 0\n"));
+  EXPECT_THAT(text, testing::HasSubstr(
+                        "reverb_rpc_duration_seconds_count{method=\"Reset\"} "
+                        "0\n"));
+  EXPECT_THAT(text,
+              testing::HasSubstr("reverb_table_size{table=\"dist\"} 1\n"));
+  EXPECT_THAT(text,
+              testing::HasSubstr("reverb_table_max_size{table=\"dist\"} 10\n"));
+  EXPECT_THAT(text, testing::HasSubstr(
+                        "reverb_rate_limiter_calls_total{table=\"dist\","
+                        "call=\"insert\"} 1\n"));
+  EXPECT_THAT(text, testing::HasSubstr("reverb_chunk_store_chunks 1\n"));
+  EXPECT_THAT(text, testing::HasSubstr(
+                        "# TYPE reverb_table_lock_wait_seconds histogram\n"));
+}
+
 TEST(ReverbServiceImplTest, CheckpointCalledWithoutCheckpointer) {
   auto service = MakeService(10);
   CheckpointRequest request;
@@ -448,6 +1686,125 @@ TEST(ReverbServiceImplTest, CheckpointAndLoadFromCheckpoint) {
   EXPECT_EQ(loaded_service->tables()["dist"]->size(), 1);
 }
 
+// Returns the stats of the scheduled checkpoints once `done` holds for them.
+CheckpointSchedulerInfo AwaitCheckpointSchedulerInfo(
+    ReverbServiceImpl* service,
+    std::function<bool(const CheckpointSchedulerInfo&)> done) {
+  while (true) {
+    ServerInfoRequest request;
+    ServerInfoResponse response;
+    EXPECT_OK(service->ServerInfo(nullptr, &request, &response));
+    if (done(response.checkpoint_scheduler_info())) {
+      return response.checkpoint_scheduler_info();
+    }
+    absl::SleepFor(absl::Milliseconds(5));
+  }
+}
+
+TEST(ReverbServiceImplTest, SavesScheduledCheckpoints) {
+  std::string path = getenv("TEST_TMPDIR");
+  REVERB_CHECK(tensorflow::Env::Default()->CreateUniqueFileName(&path, "temp"));
+  ReverbServiceImpl::Options options;
+  options.checkpoint_interval = absl::Milliseconds(10);
+  options.checkpoint_max_bytes_per_second = 1 << 30;
+  auto service = MakeService(10, CreateDefaultCheckpointer(path), options);
+  {
+    FakeInsertStream stream;
+    stream.AddChunk(1);
+    stream.AddItem("dist", {1});
+    ASSERT_TRUE(service->InsertStreamInternal(nullptr, &stream).ok());
+  }
+
+  auto info = AwaitCheckpointSchedulerInfo(
+      service.get(), [](const CheckpointSchedulerInfo& info) {
+        return info.num_completed() >= 2;
+      });
+  EXPECT_EQ(info.num_failed(), 0);
+  EXPECT_EQ(info.max_bytes_per_second(), 1 << 30);
+  EXPECT_EQ(info.interval().nanos(), 10000000);
+  EXPECT_GT(info.last_bytes_written(), 0);
+  EXPECT_THAT(info.last_checkpoint_path(), ::testing::StartsWith(path));
+  service->Close();
+
+  auto loaded_service = MakeService(10, CreateDefaultCheckpointer(path));
+  EXPECT_EQ(loaded_service->tables()["dist"]->size(), 1);
+}
+
+// Blocks the saves which are not throttled, i.e those requested through
+// `Checkpoint`, until `Unblock` is called.
+class BlockingCheckpointer : public Checkpointer {
+ public:
+  tensorflow::Status Save(std::vector<Table*> tables, int keep_latest,
+                          std::string* path) override {
+    return Save(std::move(tables), keep_latest, SaveOptions(), path, nullptr);
+  }
+
+  tensorflow::Status Save(std::vector<Table*> tables, int keep_latest,
+                          const SaveOptions& options, std::string* path,
+                          SaveStats* stats) override {
+    if (options.max_bytes_per_second <= 0) {
+      saving_.Notify();
+      unblocked_.WaitForNotification();
+      *path = "requested";
+    } else {
+      *path = "scheduled";
+    }
+    if (stats != nullptr) stats->num_bytes_written = 123;
+    return tensorflow::Status::OK();
+  }
+
+  tensorflow::Status Load(
+      absl::string_view relative_path, ChunkStore* chunk_store,
+      std::vector<std::shared_ptr<Table>>* tables) override {
+    return tensorflow::errors::NotFound("");
+  }
+
+  tensorflow::Status LoadLatest(
+      ChunkStore* chunk_store,
+      std::vector<std::shared_ptr<Table>>* tables) override {
+    return tensorflow::errors::NotFound("");
+  }
+
+  void AwaitSaving() { saving_.WaitForNotification(); }
+  void Unblock() { unblocked_.Notify(); }
+
+ private:
+  absl::Notification saving_;
+  absl::Notification unblocked_;
+};
+
+TEST(ReverbServiceImplTest, SkipsScheduledCheckpointsWhileCheckpointing) {
+  auto checkpointer = absl::make_unique<BlockingCheckpointer>();
+  auto* blocking_checkpointer = checkpointer.get();
+  ReverbServiceImpl::Options options;
+  options.checkpoint_interval = absl::Milliseconds(1);
+  options.checkpoint_max_bytes_per_second = 1;
+  auto service = MakeService(10, std::move(checkpointer), options);
+
+  auto requested = internal::StartThread("", [&] {
+    CheckpointRequest request;
+    CheckpointResponse response;
+    EXPECT_OK(service->Checkpoint(nullptr, &request, &response));
+    EXPECT_EQ(response.checkpoint_path(), "requested");
+  });
+  blocking_checkpointer->AwaitSaving();
+  AwaitCheckpointSchedulerInfo(service.get(),
+                               [](const CheckpointSchedulerInfo& info) {
+                                 return info.num_skipped() >= 1;
+                               });
+  blocking_checkpointer->Unblock();
+  requested = nullptr;
+
+  auto info = AwaitCheckpointSchedulerInfo(
+      service.get(), [](const CheckpointSchedulerInfo& info) {
+        return info.num_completed() >= 1;
+      });
+  EXPECT_EQ(info.num_failed(), 0);
+  EXPECT_EQ(info.last_checkpoint_path(), "scheduled");
+  EXPECT_EQ(info.last_bytes_written(), 123);
+  service->Close();
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
@@ -0,0 +1,811 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/reverb_service_util.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/tensor_compression.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Defaults of the limits of `ExportTableRequest`.
+constexpr int kDefaultExportItemsPerResponse = 1000;
+constexpr int64_t kDefaultExportResponseBytes = 4 * 1024 * 1024;
+
+inline grpc::Status Internal(const std::string& message) {
+  return grpc::Status(grpc::StatusCode::INTERNAL, message);
+}
+
+// Returns the number of time steps in `chunk`.
+int64_t ChunkLength(const ChunkData& chunk) {
+  if (chunk.data().tensors().empty()) return 0;
+  const auto& shape = chunk.data().tensors(0).tensor_shape();
+  return shape.dim_size() == 0 ? 0 : shape.dim(0).size();
+}
+
+// Returns true if `chunk` is block encoded and some of its blocks don't
+// overlap with the time steps [`begin`, `end`).
+bool HasUnusedBlocks(const ChunkData& chunk, int64_t begin, int64_t end) {
+  const int64_t block_length = chunk.block_length();
+  if (block_length <= 0 || begin >= end) return false;
+  const int64_t num_blocks =
+      (ChunkLength(chunk) + block_length - 1) / block_length;
+  return begin / block_length > 0 || (end - 1) / block_length < num_blocks - 1;
+}
+
+// Returns true if the client holds the time steps [`begin`, `end`) of `chunk`.
+bool ClientHoldsRows(const ClientChunks& client_chunks, const ChunkData& chunk,
+                     int64_t begin, int64_t end) {
+  auto it = client_chunks.find(chunk.chunk_key());
+  if (it == client_chunks.end() || begin >= end) return false;
+  const int64_t start = chunk.sequence_range().start();
+  return it->second.first <= start + begin &&
+         start + end - 1 <= it->second.second;
+}
+
+// Copies the tensors at `columns` of `chunk`, in that order, into `out`
+// together with the metadata of `chunk`.
+grpc::Status SelectChunkColumns(
+    const ChunkData& chunk,
+    const google::protobuf::RepeatedField<int32_t>& columns, ChunkData* out) {
+  out->set_chunk_key(chunk.chunk_key());
+  *out->mutable_sequence_range() = chunk.sequence_range();
+  out->set_delta_encoded(chunk.delta_encoded());
+  out->set_codec(chunk.codec());
+  out->set_block_length(chunk.block_length());
+
+  const int num_tensors = chunk.data().tensors_size();
+  const bool has_block_indices = chunk.data().block_indices_size() > 0;
+  std::vector<bool> selected(num_tensors, false);
+  for (int column : columns) {
+    if (column < 0 || column >= num_tensors || selected[column]) {
+      return Internal(absl::StrCat(
+          "Item references invalid or repeated column ", column, " of chunk ",
+          chunk.chunk_key(), " which holds ", num_tensors, " tensors."));
+    }
+    selected[column] = true;
+    *out->mutable_data()->add_tensors() = chunk.data().tensors(column);
+    if (has_block_indices) {
+      *out->mutable_data()->add_block_indices() =
+          chunk.data().block_indices(column);
+    }
+  }
+  return grpc::Status::OK;
+}
+
+// Removes the shared memory segments of `response` and its entries.
+void RemoveSharedMemoryData(const SampleStreamResponse& response) {
+  if (response.has_shared_memory_data()) {
+    RemoveSharedMemoryChunk(response.shared_memory_data());
+  }
+  for (const auto& entry : response.entries()) {
+    if (entry.has_shared_memory_data()) {
+      RemoveSharedMemoryChunk(entry.shared_memory_data());
+    }
+  }
+}
+
+}  // namespace
+
+ItemDeriver::ItemDeriver(absl::Span<Table* const> tables) {
+  for (Table* table : tables) {
+    for (const ItemRule& rule : table->item_rules()) {
+      rules_.push_back({table, rule, /*next_start=*/0});
+    }
+  }
+}
+
+void ItemDeriver::Add(const SequenceRange& range,
+                      std::shared_ptr<ChunkStore::Chunk> chunk,
+                      DerivedItems* items) {
+  if (rules_.empty()) return;
+
+  if (!started_ || range.episode_id() != episode_id_ ||
+      range.start() != end_ + 1) {
+    started_ = true;
+    episode_id_ = range.episode_id();
+    chunks_.clear();
+    // The first item starts at the first multiple of the stride which is
+    // covered by the chunk.
+    for (Rule& rule : rules_) {
+      const int64_t stride = rule.rule.stride();
+      rule.next_start = (range.start() + stride - 1) / stride * stride;
+    }
+  }
+  end_ = range.end();
+  chunks_.push_back({range.start(), range.end(), std::move(chunk)});
+
+  int64_t oldest_start = end_ + 1;
+  for (Rule& rule : rules_) {
+    while (rule.next_start + rule.rule.length() - 1 <= end_) {
+      items->emplace_back(rule.table, MakeItem(rule, rule.next_start));
+      rule.next_start += rule.rule.stride();
+    }
+    oldest_start = std::min(oldest_start, rule.next_start);
+  }
+  while (!chunks_.empty() && chunks_.front().end < oldest_start) {
+    chunks_.pop_front();
+  }
+}
+
+Table::Item ItemDeriver::MakeItem(const Rule& rule, int64_t start) {
+  const int64_t end = start + rule.rule.length() - 1;
+  auto it = chunks_.begin();
+  while (it->end < start) ++it;
+
+  Table::Item item;
+  uint64_t key = 0;
+  while (key == 0) key = absl::Uniform<uint64_t>(bit_gen_);
+  item.item.set_key(key);
+  item.item.set_table(rule.table->name());
+  item.item.set_priority(rule.rule.priority());
+  item.item.mutable_sequence_range()->set_offset(start - it->start);
+  item.item.mutable_sequence_range()->set_length(rule.rule.length());
+  *item.item.mutable_columns() = rule.rule.columns();
+  for (; it != chunks_.end() && it->start <= end; ++it) {
+    item.item.add_chunk_keys(it->chunk->data().chunk_key());
+    item.chunks.push_back(it->chunk);
+  }
+  return item;
+}
+
+grpc::Status InsertStreamChunk(ChunkStore* chunk_store,
+                               InsertStreamRequest* request,
+                               InsertStreamChunks* chunks,
+                               ItemDeriver* deriver, DerivedItems* derived) {
+  if (request->has_shared_memory_chunk()) {
+    // Setting the chunk clears the reference so it must be copied first.
+    const SharedMemoryChunk ref = request->shared_memory_chunk();
+    if (auto status = ReadSharedMemoryChunk(ref, request->mutable_chunk());
+        !status.ok()) {
+      return ToGrpcStatus(status);
+    }
+  }
+
+  ChunkStore::Key key = request->chunk().chunk_key();
+  const SequenceRange range = request->chunk().sequence_range();
+  std::shared_ptr<ChunkStore::Chunk> chunk =
+      chunk_store->Insert(std::move(*request->mutable_chunk()));
+  if (!chunk) {
+    return grpc::Status(grpc::StatusCode::CANCELLED, "Service has been closed");
+  }
+  if (deriver != nullptr && deriver->enabled()) {
+    deriver->Add(range, chunk, derived);
+  }
+  if (!request->derived_items_only()) (*chunks)[key] = std::move(chunk);
+  return grpc::Status::OK;
+}
+
+grpc::Status PrepareInsertStreamItem(InsertStreamRequest* request,
+                                     InsertStreamChunks* chunks,
+                                     Table::Item* item) {
+  for (ChunkStore::Key key : request->item().item().chunk_keys()) {
+    auto it = chunks->find(key);
+    if (it == chunks->end()) {
+      return Internal(absl::StrCat("Could not find sequence chunk ", key, "."));
+    }
+    item->chunks.push_back(it->second);
+  }
+
+  // Only keep specified chunks. The item holds its own references so it is
+  // safe to release the chunks before the item has been inserted.
+  absl::flat_hash_set<int64_t> keep_keys{
+      request->item().keep_chunk_keys().begin(),
+      request->item().keep_chunk_keys().end()};
+  for (auto it = chunks->cbegin(); it != chunks->cend();) {
+    if (keep_keys.find(it->first) == keep_keys.end()) {
+      chunks->erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  REVERB_CHECK_EQ(chunks->size(), keep_keys.size())
+      << "Kept less chunks than expected.";
+
+  item->item = std::move(*request->mutable_item()->mutable_item());
+  return grpc::Status::OK;
+}
+
+InsertStreamConfirmation ConfirmationOf(
+    const InsertStreamRequest::PriorityInsertion& insertion) {
+  if (!insertion.send_confirmation()) return InsertStreamConfirmation::kNone;
+  return insertion.batch_confirmations() ? InsertStreamConfirmation::kBatched
+                                         : InsertStreamConfirmation::kSingle;
+}
+
+InsertStreamInfo InsertStreamStats::info() const {
+  InsertStreamInfo info;
+  info.set_peer(peer);
+  info.set_bytes(bytes.load(std::memory_order_relaxed));
+  info.set_items(items.load(std::memory_order_relaxed));
+
+  const absl::Duration duration = absl::Now() - start;
+  info.mutable_duration()->set_seconds(absl::ToInt64Seconds(duration));
+  info.mutable_duration()->set_nanos(absl::ToInt64Nanoseconds(
+      duration - absl::Seconds(info.duration().seconds())));
+  if (duration > absl::ZeroDuration()) {
+    info.set_throughput_mb_per_second(info.bytes() / 1e6 /
+                                      absl::ToDoubleSeconds(duration));
+  }
+  return info;
+}
+
+MemoryAdmission::MemoryAdmission(int64_t soft_limit_bytes,
+                                 int64_t hard_limit_bytes,
+                                 absl::Duration max_delay,
+                                 std::function<int64_t()> used_bytes)
+    : soft_limit_bytes_(std::max<int64_t>(soft_limit_bytes, 0)),
+      hard_limit_bytes_(std::max<int64_t>(hard_limit_bytes, 0)),
+      max_delay_(max_delay),
+      used_bytes_(std::move(used_bytes)) {}
+
+absl::Duration MemoryAdmission::ReadDelay() {
+  if (soft_limit_bytes_ == 0) return absl::ZeroDuration();
+  const int64_t used = used_bytes_();
+  if (used <= soft_limit_bytes_) return absl::ZeroDuration();
+
+  absl::Duration delay = max_delay_;
+  if (hard_limit_bytes_ > soft_limit_bytes_ && used < hard_limit_bytes_) {
+    delay = max_delay_ * (static_cast<double>(used - soft_limit_bytes_) /
+                          (hard_limit_bytes_ - soft_limit_bytes_));
+  }
+  num_delayed_requests_.fetch_add(1, std::memory_order_relaxed);
+  total_delay_ns_.fetch_add(absl::ToInt64Nanoseconds(delay),
+                            std::memory_order_relaxed);
+  return delay;
+}
+
+grpc::Status MemoryAdmission::AdmitChunk(const InsertStreamRequest& request) {
+  if (hard_limit_bytes_ == 0) return grpc::Status::OK;
+  int64_t bytes;
+  if (request.has_chunk()) {
+    bytes = request.chunk().ByteSizeLong();
+  } else if (request.has_shared_memory_chunk()) {
+    bytes = request.shared_memory_chunk().size();
+  } else {
+    return grpc::Status::OK;
+  }
+  const int64_t used = used_bytes_();
+  if (used + bytes <= hard_limit_bytes_) return grpc::Status::OK;
+  num_rejected_chunks_.fetch_add(1, std::memory_order_relaxed);
+  // The receiver owns the segment so it must be removed even if unread.
+  if (request.has_shared_memory_chunk()) {
+    RemoveSharedMemoryChunk(request.shared_memory_chunk());
+  }
+  return grpc::Status(
+      grpc::StatusCode::RESOURCE_EXHAUSTED,
+      absl::StrCat("The chunks held by the server use ", used,
+                   " bytes, so a chunk of ", bytes,
+                   " bytes would exceed the memory limit of ",
+                   hard_limit_bytes_, " bytes."));
+}
+
+MemoryAdmissionInfo MemoryAdmission::info() const {
+  MemoryAdmissionInfo info;
+  info.set_used_bytes(used_bytes_());
+  info.set_soft_limit_bytes(soft_limit_bytes_);
+  info.set_hard_limit_bytes(hard_limit_bytes_);
+  info.set_num_delayed_requests(
+      num_delayed_requests_.load(std::memory_order_relaxed));
+  const int64_t total_delay_ns =
+      total_delay_ns_.load(std::memory_order_relaxed);
+  info.mutable_total_delay()->set_seconds(total_delay_ns / 1000000000);
+  info.mutable_total_delay()->set_nanos(total_delay_ns % 1000000000);
+  info.set_num_rejected_chunks(
+      num_rejected_chunks_.load(std::memory_order_relaxed));
+  return info;
+}
+
+TraceContext ServerTraceContext(const grpc::ServerContext* context) {
+  if (context != nullptr) {
+    const auto& metadata = context->client_metadata();
+    auto it = metadata.find(kTraceparentMetadataKey);
+    TraceContext remote;
+    if (it != metadata.end() &&
+        TraceContext::FromTraceparent(
+            absl::string_view(it->second.data(), it->second.size()),
+            &remote)) {
+      return remote;
+    }
+  }
+  return StartTrace();
+}
+
+RpcMetrics::RpcMetrics(MetricsRegistry* registry, absl::string_view method)
+    : calls(registry->GetCounter("reverb_rpc_calls_total",
+                                 "Calls which have been started.",
+                                 {{"method", std::string(method)}})),
+      active_calls(registry->GetGauge("reverb_rpc_active_calls",
+                                      "Calls which have not finished yet.",
+                                      {{"method", std::string(method)}})),
+      received_bytes(registry->GetCounter(
+          "reverb_rpc_received_bytes_total",
+          "Serialized size of the requests which have been received.",
+          {{"method", std::string(method)}})),
+      sent_bytes(registry->GetCounter(
+          "reverb_rpc_sent_bytes_total",
+          "Serialized size of the responses which have been sent.",
+          {{"method", std::string(method)}})),
+      duration(registry->GetHistogram("reverb_rpc_duration_seconds",
+                                      "Time from the start to the end of "
+                                      "the calls.",
+                                      {{"method", std::string(method)}})) {}
+
+ScopedRpcMetrics::ScopedRpcMetrics(const RpcMetrics* metrics)
+    : metrics_(metrics), start_(absl::Now()) {
+  metrics_->calls->Increment();
+  metrics_->active_calls->Add(1);
+}
+
+ScopedRpcMetrics::~ScopedRpcMetrics() {
+  metrics_->active_calls->Add(-1);
+  metrics_->duration->Record(absl::Now() - start_);
+}
+
+StreamClassMetrics::StreamClassMetrics(MetricsRegistry* registry,
+                                       absl::string_view stream_class)
+    : operations(registry->GetCounter(
+          "reverb_stream_class_operations_total",
+          "Scheduled stream operations which have been started.",
+          {{"class", std::string(stream_class)}})),
+      bytes(registry->GetCounter(
+          "reverb_stream_class_bytes_total",
+          "Bytes which have been charged to the stream class.",
+          {{"class", std::string(stream_class)}})),
+      wait(registry->GetHistogram(
+          "reverb_stream_class_wait_seconds",
+          "Time which the stream operations waited before they started.",
+          {{"class", std::string(stream_class)}})),
+      duration(registry->GetHistogram(
+          "reverb_stream_class_operation_seconds",
+          "Time from the start to the end of the stream operations.",
+          {{"class", std::string(stream_class)}})) {}
+
+int StreamClassOf(const grpc::ServerContext* context,
+                  const StreamScheduler& scheduler, int default_class) {
+  if (context == nullptr) return default_class;
+  const auto& metadata = context->client_metadata();
+  auto it = metadata.find(kPriorityClassMetadataKey);
+  if (it == metadata.end()) return default_class;
+  const int index = scheduler.FindClass(
+      absl::string_view(it->second.data(), it->second.size()));
+  return index < 0 ? default_class : index;
+}
+
+ScopedStreamOperation::ScopedStreamOperation(StreamScheduler* scheduler,
+                                             int stream_class,
+                                             const StreamClassMetrics* metrics,
+                                             grpc::ServerContext* context)
+    : scheduler_(scheduler), stream_class_(stream_class), metrics_(metrics) {
+  if (scheduler_ == nullptr) return;
+  const absl::Time wait_start = absl::Now();
+  started_ = scheduler_->Acquire(stream_class_, [context] {
+    return context != nullptr && context->IsCancelled();
+  });
+  if (!started_) return;
+  running_ = true;
+  start_ = absl::Now();
+  metrics_->operations->Increment();
+  metrics_->wait->Record(start_ - wait_start);
+}
+
+void ScopedStreamOperation::End() {
+  if (!running_) return;
+  running_ = false;
+  scheduler_->Release(stream_class_);
+  metrics_->duration->Record(absl::Now() - start_);
+}
+
+void ScopedStreamOperation::Charge(int64_t bytes) {
+  if (started_) ChargeStreamClass(scheduler_, stream_class_, metrics_, bytes);
+}
+
+void ChargeStreamClass(StreamScheduler* scheduler, int stream_class,
+                       const StreamClassMetrics* metrics, int64_t bytes) {
+  if (scheduler == nullptr) return;
+  scheduler->Charge(stream_class, bytes);
+  metrics->bytes->Increment(bytes);
+}
+
+void PriorityUpdateMerger::Add(const MutatePrioritiesRequest& request) {
+  for (const auto& update : request.updates()) {
+    auto inserted = update_index_.emplace(update.key(), updates_.size());
+    if (inserted.second) {
+      updates_.push_back(update);
+    } else {
+      updates_[inserted.first->second].set_priority(update.priority());
+    }
+  }
+  deletes_.insert(deletes_.end(), request.delete_keys().begin(),
+                  request.delete_keys().end());
+}
+
+tensorflow::Status PriorityUpdateMerger::Apply(Table* table) {
+  auto status = table->MutateItems(updates_, deletes_);
+  updates_.clear();
+  update_index_.clear();
+  deletes_.clear();
+  return status;
+}
+
+void UpdateClientChunks(const SampleStreamRequest& request,
+                        ClientChunks* client_chunks) {
+  for (uint64_t key : request.evicted_chunk_keys()) {
+    client_chunks->erase(key);
+  }
+  for (const auto& chunk : request.cached_chunks()) {
+    (*client_chunks)[chunk.chunk_key()] = {chunk.start(), chunk.end()};
+  }
+}
+
+void TableMix::Reset(std::vector<std::pair<Table*, double>> tables) {
+  if (tables == tables_) return;
+  tables_ = std::move(tables);
+  counts_.assign(tables_.size(), 0);
+}
+
+int TableMix::Next() const {
+  int next = 0;
+  for (int i = 1; i < num_tables(); i++) {
+    if ((counts_[i] + 1) / tables_[i].second <
+        (counts_[next] + 1) / tables_[next].second) {
+      next = i;
+    }
+  }
+  return next;
+}
+
+std::vector<int32_t> TableMix::Allocate(int32_t num_samples) const {
+  if (num_tables() == 1) return {num_samples};
+  TableMix mix = *this;
+  std::vector<int32_t> allocation(tables_.size(), 0);
+  for (int32_t i = 0; i < num_samples; i++) {
+    const int next = mix.Next();
+    allocation[next]++;
+    mix.Record(next, 1);
+  }
+  return allocation;
+}
+
+void TableMix::Record(int index, int64_t num_samples) {
+  counts_[index] += num_samples;
+}
+
+SampleResponseWriter::Message::~Message() {
+  if (!sent) RemoveSharedMemoryData(response);
+  for (int index : borrowed) {
+    if (index < 0) {
+      response.release_data();
+    } else {
+      response.mutable_entries(index)->release_data();
+    }
+  }
+}
+
+SampleResponseWriter::SampleResponseWriter(Sink sink, int64_t max_bytes)
+    : sink_(std::move(sink)), max_bytes_(max_bytes) {}
+
+bool SampleResponseWriter::Write(SampleStreamResponse response,
+                                 std::shared_ptr<const ChunkData> chunk) {
+  if (chunk != nullptr) {
+    // We const cast to avoid copying the proto.
+    response.set_allocated_data(const_cast<ChunkData*>(chunk.get()));
+  }
+
+  if (max_bytes_ <= 0) {
+    auto message = absl::make_unique<Message>();
+    message->response.Swap(&response);
+    if (chunk != nullptr) {
+      message->borrowed.push_back(-1);
+      message->chunks.push_back(std::move(chunk));
+    }
+    return sink_(std::move(message));
+  }
+
+  const int64_t bytes = response.ByteSizeLong();
+  if (packed_bytes_ > 0 && packed_bytes_ + bytes > max_bytes_ && !Flush()) {
+    if (chunk != nullptr) response.release_data();
+    RemoveSharedMemoryData(response);
+    return false;
+  }
+  if (packed_ == nullptr) packed_ = absl::make_unique<Message>();
+  if (chunk != nullptr) {
+    packed_->borrowed.push_back(packed_->response.entries_size());
+    packed_->chunks.push_back(std::move(chunk));
+  }
+  packed_->response.add_entries()->Swap(&response);
+  packed_bytes_ += bytes;
+  return packed_bytes_ < max_bytes_ || Flush();
+}
+
+bool SampleResponseWriter::Flush() {
+  if (packed_ == nullptr) return true;
+  packed_bytes_ = 0;
+  return sink_(std::move(packed_));
+}
+
+BatchChunks FindBatchChunks(absl::Span<const Table::SampledItem> samples) {
+  flat_hash_map<uint64_t, int> counts;
+  for (const auto& sample : samples) {
+    if (!sample.item.columns().empty()) continue;
+    for (const auto& chunk : sample.chunks) {
+      counts[chunk->data().chunk_key()]++;
+    }
+  }
+  BatchChunks batch_chunks;
+  for (const auto& [key, count] : counts) {
+    if (count > 1) batch_chunks.emplace(key, false);
+  }
+  return batch_chunks;
+}
+
+grpc::Status WriteSampleResponses(const ClientChunks& client_chunks,
+                                  SharedMemorySegments* segments,
+                                  Table::SampledItem* sample,
+                                  SampleResponseWriter* writer,
+                                  BatchChunks* batch_chunks,
+                                  bool end_of_batch) {
+  // The time steps of the current chunk which are part of the sample.
+  int64_t offset = sample->item.sequence_range().offset();
+  int64_t remaining = sample->item.sequence_range().length();
+
+  for (int i = 0; i < sample->chunks.size(); i++) {
+    SampleStreamResponse response;
+    response.set_end_of_sequence(i + 1 == sample->chunks.size());
+    response.set_end_of_batch(end_of_batch && response.end_of_sequence());
+
+    // Attach the info to the first message.
+    if (i == 0) {
+      *response.mutable_info()->mutable_item() = sample->item;
+      response.mutable_info()->set_probability(sample->probability);
+      response.mutable_info()->set_table_size(sample->table_size);
+    }
+
+    std::shared_ptr<const ChunkData> data;
+    if (auto status = sample->chunks[i]->Load(&data); !status.ok()) {
+      return ToGrpcStatus(status);
+    }
+
+    // Items which reference a subset of the columns are only sent those
+    // columns. The client must not mistake the stripped chunk for the full
+    // one so it is never replaced by a reference to a cached chunk.
+    const bool select_columns = !sample->item.columns().empty();
+    if (select_columns) {
+      auto selected = std::make_shared<ChunkData>();
+      if (auto status =
+              SelectChunkColumns(*data, sample->item.columns(), selected.get());
+          !status.ok()) {
+        return status;
+      }
+      data = std::move(selected);
+    }
+
+    const int64_t end =
+        std::min<int64_t>(offset + remaining, ChunkLength(*data));
+
+    // Whether the chunk is shared with other samples of the batch and, if so,
+    // whether it has been sent already.
+    bool* retained = nullptr;
+    if (batch_chunks != nullptr && !select_columns) {
+      auto it = batch_chunks->find(data->chunk_key());
+      if (it != batch_chunks->end()) retained = &it->second;
+    }
+
+    // Chunks which the client already holds are replaced by a reference. Only
+    // the blocks of other block encoded chunks which overlap with the sample
+    // are sent, which means that the client doesn't have to decompress the
+    // rest of the chunk either.
+    if (!select_columns &&
+        ClientHoldsRows(client_chunks, *data, offset, end)) {
+      response.mutable_data()->set_chunk_key(data->chunk_key());
+      *response.mutable_data()->mutable_sequence_range() =
+          data->sequence_range();
+      response.set_data_is_cached(true);
+      data = nullptr;
+    } else if (retained != nullptr && *retained) {
+      response.mutable_data()->set_chunk_key(data->chunk_key());
+      *response.mutable_data()->mutable_sequence_range() =
+          data->sequence_range();
+      response.set_data_is_repeated(true);
+      data = nullptr;
+    } else if (retained != nullptr) {
+      // The other samples may use other blocks of the chunk so it is sent
+      // whole.
+      response.set_retain_data(true);
+      *retained = true;
+    } else if (HasUnusedBlocks(*data, offset, end)) {
+      int64_t slice_begin;
+      if (auto status = SliceBlockEncodedChunk(
+              *data, offset, end, response.mutable_data(), &slice_begin);
+          !status.ok()) {
+        return ToGrpcStatus(status);
+      }
+      if (i == 0) {
+        response.mutable_info()
+            ->mutable_item()
+            ->mutable_sequence_range()
+            ->set_offset(slice_begin);
+      }
+      data = nullptr;
+    }
+    remaining -= std::max<int64_t>(end - offset, 0);
+    offset = 0;
+
+    // Small chunks, and chunks which can't be written to shared memory, are
+    // sent inline.
+    const ChunkData& chunk = data ? *data : response.data();
+    if (segments != nullptr && !response.data_is_cached() &&
+        !response.data_is_repeated() &&
+        chunk.ByteSizeLong() >= kMinSharedMemoryChunkBytes) {
+      SharedMemoryChunk ref;
+      if (segments->Write(chunk, &ref).ok()) {
+        response.clear_data();
+        *response.mutable_shared_memory_data() = std::move(ref);
+        data = nullptr;
+      }
+    }
+
+    if (!writer->Write(std::move(response), std::move(data))) {
+      return Internal("Failed to write to Sample stream.");
+    }
+
+    // We no longer need our chunk reference, so we free it.
+    sample->chunks[i] = nullptr;
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status WriteSampleBatch(const ClientChunks& client_chunks,
+                              SharedMemorySegments* segments,
+                              bool without_replacement,
+                              std::vector<Table::SampledItem>* samples,
+                              SampleResponseWriter* writer) {
+  BatchChunks batch_chunks;
+  if (without_replacement) batch_chunks = FindBatchChunks(*samples);
+  for (size_t i = 0; i < samples->size(); i++) {
+    if (auto status = WriteSampleResponses(
+            client_chunks, segments, &(*samples)[i], writer,
+            without_replacement ? &batch_chunks : nullptr,
+            without_replacement && i + 1 == samples->size());
+        !status.ok()) {
+      return status;
+    }
+  }
+  return grpc::Status::OK;
+}
+
+TableExporter::TableExporter(const Table* table,
+                             const ExportTableRequest& request)
+    : table_(table),
+      max_items_(request.max_items_per_response() > 0
+                     ? request.max_items_per_response()
+                     : kDefaultExportItemsPerResponse),
+      max_bytes_(request.max_response_bytes() > 0
+                     ? request.max_response_bytes()
+                     : kDefaultExportResponseBytes),
+      decompress_chunks_(request.decompress_chunks()),
+      skip_chunks_(request.skip_chunks()),
+      keys_(table->Keys()) {
+  std::reverse(keys_.begin(), keys_.end());
+}
+
+tensorflow::Status TableExporter::Next(ExportTableResponse* response) {
+  response->Clear();
+  if (first_) {
+    response->set_table_size(keys_.size());
+    first_ = false;
+  }
+
+  int64_t bytes = 0;
+  while (response->keys_size() < max_items_) {
+    if (pending_.empty()) {
+      if (keys_.empty()) break;
+      const size_t num_keys = std::min<size_t>(
+          keys_.size(), max_items_ - response->keys_size());
+      std::vector<Table::Key> page(keys_.rbegin(), keys_.rbegin() + num_keys);
+      keys_.resize(keys_.size() - num_keys);
+      for (auto& item : table_->CopyItems(page)) {
+        pending_.push_back(std::move(item));
+      }
+      continue;
+    }
+
+    std::vector<std::shared_ptr<const ChunkData>> chunks;
+    int64_t item_bytes;
+    TF_RETURN_IF_ERROR(LoadChunks(pending_.front(), &chunks, &item_bytes));
+    item_bytes += pending_.front().item.ByteSizeLong();
+    if (response->keys_size() > 0 && bytes + item_bytes > max_bytes_) break;
+    bytes += item_bytes;
+    Append(pending_.front(), std::move(chunks), response);
+    pending_.pop_front();
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status TableExporter::LoadChunks(
+    const Table::Item& item,
+    std::vector<std::shared_ptr<const ChunkData>>* chunks, int64_t* bytes) {
+  *bytes = 0;
+  if (skip_chunks_) return tensorflow::Status::OK();
+  for (const auto& chunk : item.chunks) {
+    const ChunkStore::Key key = chunk->data().chunk_key();
+    if (sent_chunks_.contains(key) ||
+        std::any_of(chunks->begin(), chunks->end(),
+                    [key](const std::shared_ptr<const ChunkData>& loaded) {
+                      return loaded->chunk_key() == key;
+                    })) {
+      continue;
+    }
+    std::shared_ptr<const ChunkData> data;
+    TF_RETURN_IF_ERROR(chunk->Load(&data));
+    if (decompress_chunks_) {
+      auto decompressed = std::make_shared<ChunkData>();
+      TF_RETURN_IF_ERROR(DecompressChunk(*data, decompressed.get()));
+      data = std::move(decompressed);
+    }
+    *bytes += data->ByteSizeLong();
+    chunks->push_back(std::move(data));
+  }
+  return tensorflow::Status::OK();
+}
+
+void TableExporter::Append(
+    const Table::Item& item,
+    std::vector<std::shared_ptr<const ChunkData>> chunks,
+    ExportTableResponse* response) {
+  const PrioritizedItem& proto = item.item;
+  if (response->chunk_key_offsets().empty()) {
+    response->add_chunk_key_offsets(0);
+    response->add_column_offsets(0);
+  }
+  response->add_keys(proto.key());
+  response->add_priorities(proto.priority());
+  response->add_times_sampled(proto.times_sampled());
+  response->add_inserted_at_micros(proto.inserted_at().seconds() * 1000000 +
+                                   proto.inserted_at().nanos() / 1000);
+  *response->add_sequence_ranges() = proto.sequence_range();
+  for (const auto& chunk : item.chunks) {
+    response->add_chunk_keys(chunk->data().chunk_key());
+  }
+  response->add_chunk_key_offsets(response->chunk_keys_size());
+  for (int32_t column : proto.columns()) {
+    response->add_columns(column);
+  }
+  response->add_column_offsets(response->columns_size());
+  for (auto& chunk : chunks) {
+    sent_chunks_.insert(chunk->chunk_key());
+    *response->add_chunks() = *chunk;
+  }
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,508 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_REVERB_SERVICE_UTIL_H_
+#define REVERB_CC_REVERB_SERVICE_UTIL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "absl/random/random.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/metrics.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/stream_scheduler.h"
+#include "reverb/cc/support/tracing.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/lib/core/status.h"
+
+// Stream handling shared by the synchronous (`ReverbServiceImpl`) and the
+// asynchronous (`ReverbServiceAsyncImpl`) implementation of the service.
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Chunks referenced by an `InsertStream`, keyed by chunk key.
+using InsertStreamChunks =
+    flat_hash_map<ChunkStore::Key, std::shared_ptr<ChunkStore::Chunk>>;
+
+// Items derived by the item rules of the tables, together with the tables to
+// insert them into.
+using DerivedItems = std::vector<std::pair<Table*, Table::Item>>;
+
+// Derives the items of the tables which have item rules (see `ItemRule`) from
+// the chunks of an `InsertStream`. The chunks of an episode must arrive in
+// order. The deriver starts over when a chunk doesn't continue the episode of
+// the previous chunk (e.g a new episode or a writer which reconnected), so
+// items are never derived from chunks of different episodes or from chunks
+// with gaps between them.
+class ItemDeriver {
+ public:
+  // `tables` whose `item_rules` are empty are ignored.
+  explicit ItemDeriver(absl::Span<Table* const> tables);
+
+  // Whether any of the tables has item rules.
+  bool enabled() const { return !rules_.empty(); }
+
+  // Adds `chunk`, which covers the steps `range` of its episode, and appends
+  // the items which can be derived from the chunks received so far to
+  // `items`. Only the chunks which future items may reference are kept.
+  void Add(const SequenceRange& range, std::shared_ptr<ChunkStore::Chunk> chunk,
+           DerivedItems* items);
+
+ private:
+  struct Rule {
+    Table* table;
+    ItemRule rule;
+    // First step of the next item.
+    int64_t next_start;
+  };
+
+  struct StreamChunk {
+    int64_t start;
+    int64_t end;
+    std::shared_ptr<ChunkStore::Chunk> chunk;
+  };
+
+  // Builds the item of `rule` which starts at step `start`.
+  Table::Item MakeItem(const Rule& rule, int64_t start);
+
+  std::vector<Rule> rules_;
+
+  // The chunks of the current episode which future items may reference, in
+  // order. The last one ends at step `end_`.
+  bool started_ = false;
+  uint64_t episode_id_ = 0;
+  int64_t end_ = 0;
+  std::deque<StreamChunk> chunks_;
+
+  absl::BitGen bit_gen_;
+};
+
+// Moves the chunk of `request` into `chunk_store` and adds it to `chunks`
+// unless the request is `derived_items_only`. A chunk which has been passed
+// through shared memory is read (and its segment removed) first. If `deriver`
+// is non-null then the items it derives from the chunk are appended to
+// `derived`.
+grpc::Status InsertStreamChunk(ChunkStore* chunk_store,
+                               InsertStreamRequest* request,
+                               InsertStreamChunks* chunks,
+                               ItemDeriver* deriver = nullptr,
+                               DerivedItems* derived = nullptr);
+
+// Moves the item of `request` into `item` and resolves its chunks from
+// `chunks`. Afterwards only the chunks which the request asks to keep remain in
+// `chunks`.
+grpc::Status PrepareInsertStreamItem(InsertStreamRequest* request,
+                                     InsertStreamChunks* chunks,
+                                     Table::Item* item);
+
+// How the client of an `InsertStream` wants to be told that an item has been
+// inserted.
+enum class InsertStreamConfirmation {
+  kNone,
+  // A response with the key of the item.
+  kSingle,
+  // The key of the item in the `keys` of a response which may confirm other
+  // items too.
+  kBatched,
+};
+
+InsertStreamConfirmation ConfirmationOf(
+    const InsertStreamRequest::PriorityInsertion& insertion);
+
+// Appends the confirmation of the item `key` to `responses`. Confirmations
+// which the client accepts in batches are coalesced into the last response of
+// `responses` if that response is a batch too.
+template <typename Container>
+void AddInsertStreamConfirmation(uint64_t key,
+                                 InsertStreamConfirmation confirmation,
+                                 Container* responses) {
+  if (confirmation == InsertStreamConfirmation::kNone) return;
+  if (confirmation == InsertStreamConfirmation::kSingle) {
+    responses->emplace_back();
+    responses->back().set_key(key);
+    return;
+  }
+  if (responses->empty() || responses->back().keys().empty()) {
+    responses->emplace_back();
+  }
+  responses->back().add_keys(key);
+}
+
+// Counts the data received on an `InsertStream` for as long as it is open. The
+// counters are updated by the stream and read concurrently by `ServerInfo`.
+struct InsertStreamStats {
+  explicit InsertStreamStats(std::string peer)
+      : peer(std::move(peer)), start(absl::Now()) {}
+
+  // Reports the counters and the throughput since the stream was opened.
+  InsertStreamInfo info() const;
+
+  const std::string peer;
+  const absl::Time start;
+  std::atomic<int64_t> bytes{0};
+  std::atomic<int64_t> items{0};
+};
+
+// Admission control of the chunks written to the `InsertStream`s of a server
+// by the memory allocated for the chunks it holds. Above the soft limit the
+// streams read their requests more slowly, which pushes back on the clients
+// through gRPC flow control, and above the hard limit chunks are rejected.
+// Items are always admitted since they only cost a little memory and let the
+// removers of the tables free chunks. A limit <= 0 is disabled.
+class MemoryAdmission {
+ public:
+  // `used_bytes` returns the current usage and must be thread-safe.
+  MemoryAdmission(int64_t soft_limit_bytes, int64_t hard_limit_bytes,
+                  absl::Duration max_delay,
+                  std::function<int64_t()> used_bytes);
+
+  bool enabled() const {
+    return soft_limit_bytes_ > 0 || hard_limit_bytes_ > 0;
+  }
+
+  // Time to wait before the next request of a stream is read. Zero up to the
+  // soft limit and then growing linearly to `max_delay` at the hard limit (or
+  // `max_delay` straight away if there is no hard limit).
+  absl::Duration ReadDelay();
+
+  // Returns RESOURCE_EXHAUSTED if `request` holds a chunk which would take the
+  // usage above the hard limit. The shared memory segment of a rejected chunk
+  // is removed.
+  grpc::Status AdmitChunk(const InsertStreamRequest& request);
+
+  MemoryAdmissionInfo info() const;
+
+ private:
+  const int64_t soft_limit_bytes_;
+  const int64_t hard_limit_bytes_;
+  const absl::Duration max_delay_;
+  const std::function<int64_t()> used_bytes_;
+
+  std::atomic<int64_t> num_delayed_requests_{0};
+  std::atomic<int64_t> total_delay_ns_{0};
+  std::atomic<int64_t> num_rejected_chunks_{0};
+};
+
+// Trace context of a call: the context propagated by the client in the
+// `traceparent` metadata if present and valid, otherwise a new trace (which is
+// invalid unless tracing is enabled). `context` may be null.
+TraceContext ServerTraceContext(const grpc::ServerContext* context);
+
+// Metrics of the calls of a method of the service, labelled with the name of
+// the method.
+struct RpcMetrics {
+  RpcMetrics(MetricsRegistry* registry, absl::string_view method);
+
+  Counter* const calls;
+  Gauge* const active_calls;
+  Counter* const received_bytes;
+  Counter* const sent_bytes;
+  Histogram* const duration;
+};
+
+// Counts a call in `RpcMetrics` from construction until destruction.
+class ScopedRpcMetrics {
+ public:
+  explicit ScopedRpcMetrics(const RpcMetrics* metrics);
+  ~ScopedRpcMetrics();
+
+  ScopedRpcMetrics(const ScopedRpcMetrics&) = delete;
+  ScopedRpcMetrics& operator=(const ScopedRpcMetrics&) = delete;
+
+  // Counts the serialized size of a request (respectively a response).
+  void AddReceivedBytes(int64_t bytes) const {
+    metrics_->received_bytes->Increment(bytes);
+  }
+  void AddSentBytes(int64_t bytes) const {
+    metrics_->sent_bytes->Increment(bytes);
+  }
+
+ private:
+  const RpcMetrics* const metrics_;
+  const absl::Time start_;
+};
+
+// Metrics of the scheduled operations of the streams of a priority class,
+// labelled with the name of the class.
+struct StreamClassMetrics {
+  StreamClassMetrics(MetricsRegistry* registry, absl::string_view stream_class);
+
+  Counter* const operations;
+  Counter* const bytes;
+  Histogram* const wait;
+  Histogram* const duration;
+};
+
+// Index of the priority class which the client of a call has put in the
+// `kPriorityClassMetadataKey` metadata, or of `default_class` if the call is
+// untagged or tagged with an unknown class. `context` may be null.
+int StreamClassOf(const grpc::ServerContext* context,
+                  const StreamScheduler& scheduler, int default_class);
+
+// Charges `bytes` to the class `stream_class` of `scheduler` and counts them
+// in `metrics`. Does nothing if `scheduler` is null.
+void ChargeStreamClass(StreamScheduler* scheduler, int stream_class,
+                       const StreamClassMetrics* metrics, int64_t bytes);
+
+// An operation of a stream of class `stream_class` which is scheduled by
+// `scheduler` from construction until `End` (or destruction), and which is
+// recorded in `metrics`. Does nothing if `scheduler` is null.
+class ScopedStreamOperation {
+ public:
+  // Waits until the operation may start. `context` may be null.
+  ScopedStreamOperation(StreamScheduler* scheduler, int stream_class,
+                        const StreamClassMetrics* metrics,
+                        grpc::ServerContext* context);
+  ~ScopedStreamOperation() { End(); }
+
+  ScopedStreamOperation(const ScopedStreamOperation&) = delete;
+  ScopedStreamOperation& operator=(const ScopedStreamOperation&) = delete;
+
+  // False if the call was cancelled, or the scheduler closed, before the
+  // operation could start.
+  bool started() const { return started_; }
+
+  // Ends the operation unless it has ended already.
+  void End();
+
+  // Charges `bytes` to the class of the operation. Can be called once the
+  // operation has ended, e.g when its bytes are only known later.
+  void Charge(int64_t bytes);
+
+ private:
+  StreamScheduler* const scheduler_;
+  const int stream_class_;
+  const StreamClassMetrics* const metrics_;
+  bool started_ = true;
+  bool running_ = false;
+  absl::Time start_;
+};
+
+// Merges the requests of a `MutatePrioritiesStream` which target the same
+// table so that they can be applied with a single call to `Table::MutateItems`.
+// Only the last priority of each key is kept. Since items are never inserted
+// by the stream, applying all the updates before all the deletes has the same
+// effect as applying the requests one after another.
+class PriorityUpdateMerger {
+ public:
+  // Merges the updates and deletes of `request` into those added before.
+  void Add(const MutatePrioritiesRequest& request);
+
+  // Applies the merged operations to `table` and clears them.
+  tensorflow::Status Apply(Table* table);
+
+  bool empty() const { return updates_.empty() && deletes_.empty(); }
+
+ private:
+  std::vector<KeyWithPriority> updates_;
+  // Index of the update of each key in `updates_`.
+  flat_hash_map<Table::Key, size_t> update_index_;
+  std::vector<Table::Key> deletes_;
+};
+
+// Time steps (episode indices [first, last]) of the chunks which the client of
+// a `SampleStream` holds, keyed by chunk key.
+using ClientChunks = flat_hash_map<uint64_t, std::pair<int64_t, int64_t>>;
+
+// Applies the evictions and the newly cached chunks of `request`.
+void UpdateClientChunks(const SampleStreamRequest& request,
+                        ClientChunks* client_chunks);
+
+// Mixes the samples of a `SampleStream` which samples from several tables in
+// proportion to their weights. Tables are picked deterministically so that the
+// number of samples drawn from every table stays as close as possible to its
+// share of the total.
+class TableMix {
+ public:
+  // Replaces the mixed tables. The counts of the drawn samples are kept if the
+  // tables and weights are unchanged, so the shares hold across requests.
+  void Reset(std::vector<std::pair<Table*, double>> tables);
+
+  int num_tables() const { return tables_.size(); }
+
+  Table* table(int index) const { return tables_[index].first; }
+
+  // Index of the table which is furthest behind its share.
+  int Next() const;
+
+  // Number of samples to draw from every table in order to draw `num_samples`
+  // more samples while keeping as close as possible to the shares.
+  std::vector<int32_t> Allocate(int32_t num_samples) const;
+
+  // Records that `num_samples` samples have been drawn from table `index`.
+  void Record(int index, int64_t num_samples);
+
+ private:
+  std::vector<std::pair<Table*, double>> tables_;
+
+  // Number of samples drawn from every table.
+  std::vector<int64_t> counts_;
+};
+
+// Builds the messages of a `SampleStream`. If `max_bytes` > 0 then the
+// responses are packed into the `entries` of a single message until its size
+// reaches `max_bytes`, otherwise every response is a message of its own. The
+// chunks passed to `Write` are referenced rather than copied into the
+// messages, so they are held by the message until it is destroyed.
+class SampleResponseWriter {
+ public:
+  // A message which is ready to be written to the stream together with the
+  // chunks it references. The chunks are released, but not deleted, by
+  // `response` when the message is destroyed. The client only learns of the
+  // shared memory segments of `response` from the message, so they are
+  // removed when it is destroyed unless `sent` has been set.
+  struct Message {
+    ~Message();
+
+    SampleStreamResponse response;
+
+    // Set once `response` has been written to the stream.
+    bool sent = false;
+
+    // Indices of the entries of `response` which reference one of `chunks`.
+    // An index of -1 refers to the data of `response` itself.
+    std::vector<int> borrowed;
+    std::vector<std::shared_ptr<const ChunkData>> chunks;
+  };
+
+  // Writes `message` to the stream. Returns false if the stream has been
+  // closed.
+  using Sink = std::function<bool(std::unique_ptr<Message> message)>;
+
+  SampleResponseWriter(Sink sink, int64_t max_bytes);
+
+  // Writes or packs `response`. If `chunk` is non-null then it is used as the
+  // data of `response`. Returns false if the stream has been closed.
+  bool Write(SampleStreamResponse response,
+             std::shared_ptr<const ChunkData> chunk);
+
+  // Writes the packed responses, if any. Must be called before blocking on
+  // the table. Returns false if the stream has been closed.
+  bool Flush();
+
+ private:
+  Sink sink_;
+  const int64_t max_bytes_;
+
+  // Responses which have not been written yet and their total size.
+  std::unique_ptr<Message> packed_;
+  int64_t packed_bytes_ = 0;
+};
+
+// Chunks which are referenced by more than one sample of a batch, keyed by
+// chunk key and mapped to whether the chunk has been sent with `retain_data`
+// (see `SampleStreamRequest.without_replacement`).
+using BatchChunks = flat_hash_map<uint64_t, bool>;
+
+// Returns the chunks which are referenced by more than one of `samples`. The
+// chunks of items which reference a subset of the columns are stripped before
+// they are sent so these items are ignored.
+BatchChunks FindBatchChunks(absl::Span<const Table::SampledItem> samples);
+
+// Writes the responses of `sample` to `writer`. Chunks which the client holds
+// according to `client_chunks` are replaced by references and only the blocks
+// of block encoded chunks which overlap with the sample are sent. If
+// `segments` is non-null then the chunks are passed through shared memory
+// segments of the stream where possible. The chunk references of `sample` are
+// released as the chunks are written.
+//
+// If `batch_chunks` is non-null then the first sample which sends one of its
+// chunks sends it whole with `retain_data` and the following ones send a
+// reference with `data_is_repeated`. If `end_of_batch` is set then the last
+// response of `sample` is marked as the end of the batch.
+grpc::Status WriteSampleResponses(const ClientChunks& client_chunks,
+                                  SharedMemorySegments* segments,
+                                  Table::SampledItem* sample,
+                                  SampleResponseWriter* writer,
+                                  BatchChunks* batch_chunks = nullptr,
+                                  bool end_of_batch = false);
+
+// Writes the responses of a batch of `samples` with `WriteSampleResponses`. If
+// `without_replacement` is set then the chunks which are shared by several of
+// the samples are only sent once.
+grpc::Status WriteSampleBatch(const ClientChunks& client_chunks,
+                              SharedMemorySegments* segments,
+                              bool without_replacement,
+                              std::vector<Table::SampledItem>* samples,
+                              SampleResponseWriter* writer);
+
+// Builds the responses of an `ExportTable` call. The keys of the table are
+// copied when the exporter is created and the items are then copied in pages
+// with `Table::CopyItems`, so the lock of the table is only held while a page
+// is copied. Items which are deleted before their page is copied are skipped
+// and the others are exported as they were when their page was copied.
+class TableExporter {
+ public:
+  TableExporter(const Table* table, const ExportTableRequest& request);
+
+  // Fills `response` with the next page. The first response is built even if
+  // the table is empty.
+  tensorflow::Status Next(ExportTableResponse* response);
+
+  // Whether all items have been exported.
+  bool done() const { return !first_ && pending_.empty() && keys_.empty(); }
+
+ private:
+  // Appends `item` and the chunks it references to the columns of `response`.
+  void Append(const Table::Item& item,
+              std::vector<std::shared_ptr<const ChunkData>> chunks,
+              ExportTableResponse* response);
+
+  // Loads (and decompresses if requested) the chunks of `item` which haven't
+  // been sent yet. `bytes` is set to their total size.
+  tensorflow::Status LoadChunks(
+      const Table::Item& item,
+      std::vector<std::shared_ptr<const ChunkData>>* chunks, int64_t* bytes);
+
+  const Table* const table_;
+  const int max_items_;
+  const int64_t max_bytes_;
+  const bool decompress_chunks_;
+  const bool skip_chunks_;
+
+  // Keys of the items which haven't been copied yet, in reverse order.
+  std::vector<Table::Key> keys_;
+
+  // Items which have been copied but didn't fit into the previous page.
+  std::deque<Table::Item> pending_;
+
+  // Keys of the chunks which have been sent.
+  flat_hash_set<ChunkStore::Key> sent_chunks_;
+
+  bool first_ = true;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_REVERB_SERVICE_UTIL_H_
@@ -15,22 +15,43 @@
 #include "reverb/cc/sampler.h"
 
 #include <algorithm>
+#include <chrono>  // NOLINT(build/c++11) - grpc API requires it.
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <memory>
 #include <string>
 
 #include "grpcpp/impl/codegen/client_context.h"
 #include "grpcpp/impl/codegen/sync_stream.h"
 #include "absl/memory/memory.h"
+#include "absl/random/random.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "reverb/cc/errors.h"
+#include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/sampler_stats.h"
+#include "reverb/cc/support/cleanup.h"
 #include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/stream_scheduler.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "reverb/cc/support/tracing.h"
 #include "reverb/cc/table.h"
 #include "reverb/cc/tensor_compression.h"
+#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/errors.h"
@@ -39,12 +60,43 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
+// Returns the tables of a `Sampler` which samples from a single table.
+std::vector<TableWeight> SingleTable(const std::string& table_name) {
+  std::vector<TableWeight> tables(1);
+  tables[0].set_table(table_name);
+  tables[0].set_weight(1);
+  return tables;
+}
+
+// Returns the names of `tables` for use in error messages.
+std::string TableNames(const std::vector<TableWeight>& tables) {
+  return absl::StrJoin(tables, ", ",
+                       [](std::string* out, const TableWeight& table) {
+                         absl::StrAppend(out, table.table());
+                       });
+}
+
+// Chunks which a worker has advertised to the server as cached, and which the
+// server therefore may send as references. The entries are held until the
+// server has been told that they were evicted from the cache.
+using AdvertisedChunks =
+    internal::flat_hash_map<ChunkCache::Key,
+                            std::shared_ptr<const ChunkCache::Entry>>;
+
+// Returns the number of time steps in the chunk of `response`.
+inline int64_t ResponseChunkLength(const SampleStreamResponse& response) {
+  if (response.data_is_cached()) {
+    const auto& range = response.data().sequence_range();
+    return range.end() - range.start() + 1;
+  }
+  return response.data().data().tensors(0).tensor_shape().dim(0).size();
+}
+
 inline bool SampleIsDone(const std::vector<SampleStreamResponse>& sample) {
   if (sample.empty()) return false;
   int64_t chunk_length = 0;
   for (const auto& response : sample) {
-    chunk_length +=
-        response.data().data().tensors(0).tensor_shape().dim(0).size();
+    chunk_length += ResponseChunkLength(response);
   }
   const auto& range = sample.front().info().item().sequence_range();
   return chunk_length >= range.length() + range.offset();
@@ -59,75 +111,312 @@ tensorflow::Tensor InitializeTensor(T value, int64_t length) {
   return tensor;
 }
 
+// Returns the number of time steps in the chunk tensor `proto`.
+inline int64_t BatchSize(const tensorflow::TensorProto& proto) {
+  return proto.tensor_shape().dim_size() == 0
+             ? 0
+             : proto.tensor_shape().dim(0).size();
+}
+
+// Allocates the tensors of a sample with `length` time steps from `allocator`.
+// The dtypes and shapes (except for the first dimension) are taken from the
+// decompressed tensors of a chunk.
+void AllocateSampleTensors(const std::vector<tensorflow::Tensor>& chunk,
+                           int64_t length, tensorflow::Allocator* allocator,
+                           std::vector<tensorflow::Tensor>* tensors) {
+  tensors->clear();
+  tensors->reserve(chunk.size());
+  for (const auto& tensor : chunk) {
+    tensorflow::TensorShape shape = tensor.shape();
+    shape.set_dim(0, length);
+    tensors->emplace_back(allocator, tensor.dtype(), shape);
+  }
+}
+
+// Allocates the tensors of a sample with `length` time steps from `allocator`.
+// The dtypes and shapes (except for the first dimension) are taken from the
+// tensors of `chunk`, or only from those at the indices `columns` if
+// non-empty.
+tensorflow::Status AllocateSampleTensors(
+    const ChunkData& chunk, int64_t length, tensorflow::Allocator* allocator,
+    std::vector<tensorflow::Tensor>* tensors,
+    absl::Span<const int32_t> columns = {}) {
+  if (chunk.data().tensors().empty()) {
+    return tensorflow::errors::Internal("Chunk ", chunk.chunk_key(),
+                                        " does not hold any tensors.");
+  }
+  const int num_tensors =
+      columns.empty() ? chunk.data().tensors_size() : columns.size();
+  tensors->clear();
+  tensors->reserve(num_tensors);
+  for (int i = 0; i < num_tensors; i++) {
+    const int column = columns.empty() ? i : columns[i];
+    if (column < 0 || column >= chunk.data().tensors_size()) {
+      return tensorflow::errors::Internal(
+          "Column ", column, " is out of range for chunk ", chunk.chunk_key(),
+          " which holds ", chunk.data().tensors_size(), " tensors.");
+    }
+    const auto& proto = chunk.data().tensors(column);
+    tensorflow::TensorShape shape(proto.tensor_shape());
+    if (shape.dims() == 0) {
+      return tensorflow::errors::Internal(
+          "Chunk ", chunk.chunk_key(), " holds a scalar tensor. Chunk tensors "
+          "must have a leading time step dimension.");
+    }
+    shape.set_dim(0, length);
+    tensors->emplace_back(allocator, proto.dtype(), shape);
+  }
+  return tensorflow::Status::OK();
+}
+
+// Checks that `chunk` holds one tensor for each of the sample `tensors`.
+tensorflow::Status CheckChunkTensors(
+    const ChunkData& chunk, const std::vector<tensorflow::Tensor>& tensors) {
+  if (chunk.data().tensors_size() != static_cast<int>(tensors.size())) {
+    return tensorflow::errors::Internal(
+        "Chunks of the same sample must hold the same number of tensors, but "
+        "the first chunk holds ",
+        tensors.size(), " tensors while chunk ", chunk.chunk_key(), " holds ",
+        chunk.data().tensors_size(), " tensors.");
+  }
+  return tensorflow::Status::OK();
+}
+
+// Decompresses the time steps [`begin`, `end`) of `proto`, the tensor with
+// index `index` in `chunk`, into `output` starting at row `output_row`. Only
+// the blocks which overlap with the time steps are decompressed if `chunk` is
+// block encoded.
+tensorflow::Status DecompressChunkTensorInto(
+    const ChunkData& chunk, int index, const tensorflow::TensorProto& proto,
+    int64_t begin, int64_t end, int64_t output_row,
+    tensorflow::Tensor* output) {
+  if (chunk.block_length() <= 0) {
+    return DecompressTensorRowsInto(proto, chunk.codec(),
+                                    chunk.delta_encoded(), begin, end,
+                                    output_row, output);
+  }
+  if (index >= chunk.data().block_indices_size()) {
+    return tensorflow::errors::Internal("Block encoded chunk ",
+                                        chunk.chunk_key(),
+                                        " has no block index for tensor ",
+                                        index, ".");
+  }
+  return DecompressTensorBlockRowsInto(
+      proto, chunk.data().block_indices(index), chunk.block_length(),
+      chunk.codec(), chunk.delta_encoded(), begin, end, output_row, output);
+}
+
+tensorflow::Status BatchSizeMismatchError(int64_t expected, int64_t actual) {
+  return tensorflow::errors::Internal(
+      "Chunks of the same response must have identical batch size, but "
+      "first chunk has batch size ",
+      expected, " while the current chunk has batch size ", actual);
+}
+
+// Copies the rows [`begin`, `end`) of `src` into `output` starting at row
+// `output_row`. The rows are contiguous in both tensors so, unless they hold
+// strings, they are copied with a single memcpy. Returns Internal if the rows
+// are out of range or if the tensors differ in dtype or row shape.
+tensorflow::Status CopyTensorRowsInto(const tensorflow::Tensor& src,
+                                      int64_t begin, int64_t end,
+                                      int64_t output_row,
+                                      tensorflow::Tensor* output) {
+  bool valid = src.dtype() == output->dtype() && src.dims() > 0 &&
+               src.dims() == output->dims() && 0 <= begin && begin <= end &&
+               end <= src.dim_size(0) && 0 <= output_row &&
+               output_row + end - begin <= output->dim_size(0);
+  for (int i = 1; valid && i < src.dims(); i++) {
+    valid = src.dim_size(i) == output->dim_size(i);
+  }
+  if (!valid) {
+    return tensorflow::errors::Internal(
+        "Cannot copy the rows [", begin, ", ", end, ") of tensor (",
+        tensorflow::DataTypeString(src.dtype()), ", ",
+        src.shape().DebugString(), ") into tensor (",
+        tensorflow::DataTypeString(output->dtype()), ", ",
+        output->shape().DebugString(), ") at row ", output_row, ".");
+  }
+  if (begin == end) return tensorflow::Status::OK();
+  if (src.dtype() == tensorflow::DT_STRING) {
+    auto from = src.flat_outer_dims<tensorflow::tstring>();
+    auto to = output->flat_outer_dims<tensorflow::tstring>();
+    for (int64_t i = begin; i < end; i++) {
+      for (int64_t j = 0; j < from.dimension(1); j++) {
+        to(output_row + i - begin, j) = from(i, j);
+      }
+    }
+    return tensorflow::Status::OK();
+  }
+  const int64_t row_bytes = src.TotalBytes() / src.dim_size(0);
+  std::memcpy(
+      const_cast<char*>(output->tensor_data().data()) + output_row * row_bytes,
+      src.tensor_data().data() + begin * row_bytes, (end - begin) * row_bytes);
+  return tensorflow::Status::OK();
+}
+
+// Sets `tensor` to a tensor of type `dtype` and shape `shape` allocated from
+// `allocator`. The buffer of `tensor` is reused if it already has the
+// requested type and shape and isn't shared with any other tensor.
+void ReuseOrAllocateTensor(tensorflow::DataType dtype,
+                           const tensorflow::TensorShape& shape,
+                           tensorflow::Allocator* allocator,
+                           tensorflow::Tensor* tensor) {
+  if (tensor->dtype() == dtype && tensor->shape() == shape &&
+      tensor->RefCountIsOne()) {
+    return;
+  }
+  *tensor = tensorflow::Tensor(allocator, dtype, shape);
+}
+
+// Copies the time steps [`begin`, `end`) of `chunk` into `sequences` starting
+// at row `output_row`. The time steps are copied from the decompressed chunk
+// in `cache` (or in `advertised`, if non-null) if present, otherwise every
+// time step of the chunk is decompressed and the result is inserted into
+// `cache` for the samples which follow. If `is_reference` is true then `chunk`
+// doesn't hold any tensors and must be present.
+//
+// If `sequences` is empty then it is allocated from `allocator` to hold
+// `length` time steps. The cached chunks are allocated from the CPU allocator.
+tensorflow::Status CopyChunkRowsFromCache(
+    const ChunkData& chunk, bool is_reference, int64_t begin, int64_t end,
+    int64_t output_row, int64_t length, ChunkCache* cache,
+    const AdvertisedChunks* advertised, tensorflow::Allocator* allocator,
+    std::vector<tensorflow::Tensor>* sequences) {
+  const int64_t start = chunk.sequence_range().start();
+  auto entry = cache->Get(chunk.chunk_key(), start + begin, start + end);
+  if (entry == nullptr && advertised != nullptr) {
+    if (auto it = advertised->find(chunk.chunk_key());
+        it != advertised->end() &&
+        it->second->Contains(start + begin, start + end)) {
+      entry = it->second;
+    }
+  }
+  if (entry == nullptr && is_reference) {
+    return tensorflow::errors::Internal(
+        "Chunk ", chunk.chunk_key(), " was sent as a reference but the time "
+        "steps [", start + begin, ", ", start + end, ") are not held by the "
+        "sampler.");
+  }
+  if (entry == nullptr) {
+    if (!sequences->empty()) {
+      TF_RETURN_IF_ERROR(CheckChunkTensors(chunk, *sequences));
+    }
+    const auto& tensors = chunk.data().tensors();
+    const int64_t batch_size = tensors.empty() ? 0 : BatchSize(tensors.Get(0));
+
+    auto decompressed = std::make_shared<ChunkCache::Entry>();
+    decompressed->start = start;
+    TF_RETURN_IF_ERROR(AllocateSampleTensors(chunk, batch_size,
+                                             tensorflow::cpu_allocator(),
+                                             &decompressed->tensors));
+    for (int i = 0; i < tensors.size(); i++) {
+      if (BatchSize(tensors.Get(i)) != batch_size) {
+        return BatchSizeMismatchError(batch_size, BatchSize(tensors.Get(i)));
+      }
+      TF_RETURN_IF_ERROR(DecompressChunkTensorInto(
+          chunk, i, tensors.Get(i), 0, batch_size, 0,
+          &decompressed->tensors[i]));
+    }
+    cache->Insert(chunk.chunk_key(), decompressed);
+    entry = std::move(decompressed);
+  }
+
+  if (sequences->empty()) {
+    AllocateSampleTensors(entry->tensors, length, allocator, sequences);
+  } else if (entry->tensors.size() != sequences->size()) {
+    return tensorflow::errors::Internal(
+        "Chunks of the same sample must hold the same number of tensors, but "
+        "the first chunk holds ",
+        sequences->size(), " tensors while chunk ", chunk.chunk_key(),
+        " holds ", entry->tensors.size(), " tensors.");
+  }
+  for (int i = 0; i < sequences->size(); i++) {
+    TF_RETURN_IF_ERROR(CopyTensorRowsInto(
+        entry->tensors[i], start + begin - entry->start,
+        start + end - entry->start, output_row, &(*sequences)[i]));
+  }
+  return tensorflow::Status::OK();
+}
+
+// The output tensors of the sample are allocated up front and the relevant
+// time steps of each chunk are decompressed straight into them, thus avoiding
+// intermediate tensors and the concatenation of the chunks. The resulting
+// `Sample` holds a single chunk which spans the entire sample.
+//
+// If `cache` is non-null then the chunks are decompressed into, or copied
+// from, `cache` instead. `advertised` holds the chunks which the server may
+// send as references. The output tensors are allocated from `allocator`.
 tensorflow::Status AsSample(std::vector<SampleStreamResponse> responses,
+                            ChunkCache* cache,
+                            const AdvertisedChunks* advertised,
+                            tensorflow::Allocator* allocator,
                             std::unique_ptr<Sample>* sample) {
   const auto& info = responses.front().info();
 
-  // Extract all chunks belonging to this sample.
-  std::list<std::vector<tensorflow::Tensor>> chunks;
+  // The chunks of items which reference a subset of the columns only hold
+  // those columns so they must not be cached under the key of the full chunk.
+  if (!info.item().columns().empty()) cache = nullptr;
 
   // The chunks are not required to be aligned perfectly with the data so a
   // part of the first chunk is potentially stripped. The same applies to the
   // last part of the final chunk.
   int64_t offset = info.item().sequence_range().offset();
   int64_t remaining = info.item().sequence_range().length();
+  const int64_t length = remaining;
+
+  // With a cache the tensors are allocated once the first chunk has been
+  // found or decompressed since the first response may be a reference.
+  std::vector<tensorflow::Tensor> sequences;
+  if (cache == nullptr) {
+    TF_RETURN_IF_ERROR(AllocateSampleTensors(responses.front().data(),
+                                             remaining, allocator, &sequences));
+  }
+  int64_t output_row = 0;
 
   for (auto& response : responses) {
     REVERB_CHECK_GT(remaining, 0);
+    const int64_t end =
+        std::min<int64_t>(offset + remaining, ResponseChunkLength(response));
 
-    std::vector<tensorflow::Tensor> batches;
-    batches.resize(response.data().data().tensors_size());
-
-    int64_t batch_size = -1;
-
-    // Convert each chunk tensor and release the chunk memory afterwards.
-    int64_t insert_index = response.data().data().tensors_size() - 1;
-    while (!response.data().data().tensors().empty()) {
-      tensorflow::Tensor batch;
+    if (cache != nullptr) {
+      TF_RETURN_IF_ERROR(CopyChunkRowsFromCache(
+          response.data(), response.data_is_cached(), offset, end, output_row,
+          length, cache, advertised, allocator, &sequences));
+    } else {
+      if (response.data_is_cached()) {
+        return tensorflow::errors::Internal(
+            "Chunk ", response.data().chunk_key(),
+            " was sent as a reference but the sampler has no chunk cache.");
+      }
+      TF_RETURN_IF_ERROR(CheckChunkTensors(response.data(), sequences));
 
-      {
-        // This ensures we release the response proto after converting the
-        // result to a tensor.
+      // Decompress each chunk tensor and release the chunk memory afterwards.
+      const auto& tensors = response.data().data().tensors();
+      const int64_t batch_size = BatchSize(tensors.Get(0));
+      while (!tensors.empty()) {
+        const int index = tensors.size() - 1;
         auto chunk = absl::WrapUnique(response.mutable_data()
                                           ->mutable_data()
                                           ->mutable_tensors()
                                           ->ReleaseLast());
-        batch = DecompressTensorFromProto(*chunk);
-      }
-
-      if (response.data().delta_encoded()) {
-        batch = DeltaEncode(batch, /*encode=*/false);
-      }
-
-      if (batch_size < 0) {
-        batch_size = batch.dim_size(0);
-      } else {
-        if (batch_size != batch.dim_size(0)) {
-          return tensorflow::errors::Internal(
-              "Chunks of the same response must have identical batch size, but "
-              "first chunk has batch size ",
-              batch_size, " while the current chunk has batch size ",
-              batch.dim_size(0));
+        if (BatchSize(*chunk) != batch_size) {
+          return BatchSizeMismatchError(batch_size, BatchSize(*chunk));
         }
+        TF_RETURN_IF_ERROR(
+            DecompressChunkTensorInto(response.data(), index, *chunk, offset,
+                                      end, output_row, &sequences[index]));
       }
-
-      batch =
-          batch.Slice(offset, std::min<int64_t>(offset + remaining, batch_size));
-      if (!batch.IsAligned()) {
-        batch = tensorflow::tensor::DeepCopy(batch);
-      }
-
-      batches[insert_index--] = std::move(batch);
     }
 
-    chunks.push_back(std::move(batches));
-
-    remaining -= std::min<int64_t>(remaining, batch_size - offset);
+    output_row += end - offset;
+    remaining -= end - offset;
     offset = 0;
   }
 
   REVERB_CHECK_EQ(remaining, 0);
 
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  chunks.push_back(std::move(sequences));
   *sample = absl::make_unique<Sample>(info.item().key(), info.probability(),
                                       info.table_size(), info.item().priority(),
                                       std::move(chunks));
@@ -135,6 +424,8 @@ tensorflow::Status AsSample(std::vector<SampleStreamResponse> responses,
 }
 
 tensorflow::Status AsSample(const Table::SampledItem& sampled_item,
+                            ChunkCache* cache,
+                            tensorflow::Allocator* allocator,
                             std::unique_ptr<Sample>* sample) {
   // The chunks are not required to be aligned perfectly with the data so a
   // part of the first chunk is potentially stripped. The same applies to the
@@ -142,45 +433,65 @@ tensorflow::Status AsSample(const Table::SampledItem& sampled_item,
   int64_t offset = sampled_item.item.sequence_range().offset();
   int64_t remaining = sampled_item.item.sequence_range().length();
 
-  // Decompress and trim the chunks.
-  std::list<std::vector<tensorflow::Tensor>> chunks;
+  // Only the columns referenced by the item are decompressed. The cache holds
+  // every column of the chunks so it is bypassed for such items.
+  const auto& columns = sampled_item.item.columns();
+  if (!columns.empty()) cache = nullptr;
+
+  std::vector<tensorflow::Tensor> sequences;
+  int64_t output_row = 0;
+
   for (auto& chunk : sampled_item.chunks) {
     REVERB_CHECK_GT(remaining, 0);
 
-    std::vector<tensorflow::Tensor> batches;
-    batches.reserve(chunk->data().data().tensors_size());
+    std::shared_ptr<const ChunkData> data;
+    TF_RETURN_IF_ERROR(chunk->Load(&data));
 
-    int64_t batch_size = -1;
-    for (const auto& chunk_data : chunk->data().data().tensors()) {
-      tensorflow::Tensor batch = DecompressTensorFromProto(chunk_data);
-      if (chunk->data().delta_encoded()) {
-        batch = DeltaEncode(batch, /*encode=*/false);
-      }
-      if (batch_size < 0) {
-        batch_size = batch.dim_size(0);
-      } else {
-        if (batch_size != batch.dim_size(0)) {
-          return tensorflow::errors::Internal(
-              "Chunks of the same response must have identical batch size, but "
-              "first chunk has batch size ",
-              batch_size, " while the current chunk has batch size ",
-              batch.dim_size(0));
-        }
+    if (sequences.empty()) {
+      TF_RETURN_IF_ERROR(AllocateSampleTensors(*data, remaining, allocator,
+                                               &sequences, columns));
+    }
+    if (columns.empty()) {
+      TF_RETURN_IF_ERROR(CheckChunkTensors(*data, sequences));
+    }
+
+    const auto& tensors = data->data().tensors();
+    const int64_t batch_size = BatchSize(tensors.Get(0));
+    const int64_t end = std::min<int64_t>(offset + remaining, batch_size);
+
+    if (cache != nullptr) {
+      TF_RETURN_IF_ERROR(CopyChunkRowsFromCache(
+          *data, /*is_reference=*/false, offset, end, output_row,
+          sampled_item.item.sequence_range().length(), cache,
+          /*advertised=*/nullptr, allocator, &sequences));
+    }
+
+    for (int i = 0; cache == nullptr && i < sequences.size(); i++) {
+      const int column = columns.empty() ? i : columns[i];
+      if (column >= tensors.size()) {
+        return tensorflow::errors::Internal(
+            "Column ", column, " is out of range for chunk ",
+            data->chunk_key(), " which holds ", tensors.size(), " tensors.");
       }
-      batch = batch.Slice(offset,
-                          std::min<int64_t>(offset + remaining, batch_size));
-      if (!batch.IsAligned()) {
-        batch = tensorflow::tensor::DeepCopy(batch);
+      if (BatchSize(tensors.Get(column)) != batch_size) {
+        return BatchSizeMismatchError(batch_size,
+                                      BatchSize(tensors.Get(column)));
       }
-      batches.push_back(std::move(batch));
+      TF_RETURN_IF_ERROR(DecompressChunkTensorInto(*data, column,
+                                                   tensors.Get(column), offset,
+                                                   end, output_row,
+                                                   &sequences[i]));
     }
 
-    chunks.push_back(std::move(batches));
-    remaining -= std::min<int64_t>(remaining, batch_size - offset);
+    output_row += end - offset;
+    remaining -= end - offset;
     offset = 0;
   }
 
   REVERB_CHECK_EQ(remaining, 0);
+
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  chunks.push_back(std::move(sequences));
   *sample = absl::make_unique<deepmind::reverb::Sample>(
       sampled_item.item.key(), sampled_item.probability,
       sampled_item.table_size, sampled_item.item.priority(), std::move(chunks));
@@ -190,15 +501,48 @@ tensorflow::Status AsSample(const Table::SampledItem& sampled_item,
 
 class GrpcSamplerWorker : public SamplerWorker {
  public:
-  // Constructs a new worker without creating a stream to a server.
+  // Constructs a new worker without creating a stream to a server. If
+  // `persistent_stream` is set then the stream is kept open between calls to
+  // `FetchSamples` and only reopened after an error. If `decode_pool` is
+  // non-null then received samples are decoded on its threads while the
+  // stream is read, otherwise they are decoded by the thread reading the
+  // stream. If `autotuner` is non-null then it picks the size and the flexible
+  // batch size of the requests instead of `samples_per_request` and
+  // `flexible_batch_size`. If `mutations` is non-null then the mutations
+  // queued in it are sent with the next request. Latencies and counters are
+  // recorded in `stats` with the pushed samples attributed to `worker_id`. If
+  // `tables` holds more than one table then the server mixes their samples in
+  // proportion to their weights. The tensors of the samples are allocated from
+  // `allocator`. The streams are tagged with `priority_class` unless it is
+  // empty.
   GrpcSamplerWorker(
       std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
-      std::string table_name, int64_t samples_per_request,
-      int flexible_batch_size)
+      std::vector<TableWeight> tables, int64_t samples_per_request,
+      int flexible_batch_size, bool without_replacement,
+      int64_t max_response_bytes, bool shared_memory, ChunkCache* chunk_cache,
+      internal::ThreadPool* decode_pool, SamplerAutotuner* autotuner,
+      SamplerMutations* mutations, SamplerStatsRecorder* stats, int worker_id,
+      tensorflow::Allocator* allocator, std::string priority_class,
+      bool persistent_stream = false)
       : stub_(std::move(stub)),
-        table_name_(std::move(table_name)),
+        tables_(std::move(tables)),
         samples_per_request_(samples_per_request),
-        flexible_batch_size_(flexible_batch_size) {}
+        flexible_batch_size_(flexible_batch_size),
+        without_replacement_(without_replacement),
+        max_response_bytes_(max_response_bytes),
+        shared_memory_(shared_memory),
+        persistent_stream_(persistent_stream),
+        chunk_cache_(chunk_cache),
+        decode_pool_(decode_pool),
+        autotuner_(autotuner),
+        mutations_(mutations),
+        stats_(stats),
+        worker_id_(worker_id),
+        allocator_(allocator),
+        priority_class_(std::move(priority_class)),
+        max_pending_samples_(
+            decode_pool == nullptr ? 0 : 2 * decode_pool->num_threads()),
+        advertised_chunks_(std::make_shared<const AdvertisedChunks>()) {}
 
   // Cancels the stream and marks the worker as closed. Active and future
   // calls to `OpenStreamAndFetch` will return status `CANCELLED`.
@@ -208,66 +552,153 @@ class GrpcSamplerWorker : public SamplerWorker {
     if (context_ != nullptr) context_->TryCancel();
   }
 
-  // Opens a new `SampleStream` to a server and requests `num_samples` samples
-  // in batches with maximum size `samples_per_request`, with a timeout to
-  // pass to the `Table::Sample` call. Once complete (either
-  // done, from a non transient error, or from timing out), the stream is
-  // closed and the number of samples pushed to `queue` is returned together
+  // Opens a new `SampleStream` to a server (unless a persistent stream is
+  // already open) and requests `num_samples` samples in batches with maximum
+  // size `samples_per_request`, with a timeout to pass to the `Table::Sample`
+  // call. Once complete (either done, from a non transient error, or from
+  // timing out), the stream is closed unless it is persistent and no error
+  // occurred. The number of samples pushed to `queue` is returned together
   // with the status of the stream.  A timeout will cause the Status type
   // DeadlineExceeded to be returned.
   std::pair<int64_t, tensorflow::Status> FetchSamples(
       internal::Queue<std::unique_ptr<Sample>>* queue, int64_t num_samples,
       absl::Duration rate_limiter_timeout) override {
-    std::unique_ptr<grpc::ClientReaderWriterInterface<SampleStreamRequest,
-                                                      SampleStreamResponse>>
-        stream;
     {
       absl::MutexLock lock(&mu_);
       if (closed_) {
         return {0, tensorflow::errors::Cancelled("`Close` called on Sampler.")};
       }
-      context_ = absl::make_unique<grpc::ClientContext>();
-      context_->set_wait_for_ready(false);
-      stream = stub_->SampleStream(context_.get());
-    }
+      if (stream_ == nullptr) {
+        context_ = absl::make_unique<grpc::ClientContext>();
+        context_->set_wait_for_ready(false);
+        trace_ = internal::StartTrace();
+        if (trace_.valid()) {
+          context_->AddMetadata(internal::kTraceparentMetadataKey,
+                                trace_.ToTraceparent());
+        }
+        if (!priority_class_.empty()) {
+          context_->AddMetadata(internal::kPriorityClassMetadataKey,
+                                priority_class_);
+        }
+        stream_ = stub_->SampleStream(context_.get());
+        stats_->RecordStreamOpened();
 
+        // The server only knows about the chunks advertised on the new stream.
+        advertised_chunks_ = std::make_shared<const AdvertisedChunks>();
+        unpacked_.clear();
+        retained_chunks_.clear();
+      }
+    }
+    internal::ScopedTraceContext active(trace_);
+
+    // Closes the stream and returns its final status.
+    auto finish = [this] {
+      auto status = FromGrpcStatus(stream_->Finish());
+      stream_ = nullptr;
+      return status;
+    };
+
+    // Samples which have been read from the stream but not yet pushed to
+    // `queue`, in the order in which they were read.
+    std::deque<std::shared_ptr<PendingSample>> pending;
+    int64_t num_samples_read = 0;
     int64_t num_samples_returned = 0;
-    while (num_samples_returned < num_samples) {
+
+    // Pushes the samples which have already been read and then closes the
+    // stream. Returns `error` if set, otherwise the final status of the stream.
+    // Decoding errors take precedence over both.
+    auto close_stream = [&](tensorflow::Status error) {
+      auto pushed = PushDecoded(queue, 0, &pending, &num_samples_returned);
+      if (error.ok()) {
+        error = finish();
+      } else {
+        stream_ = nullptr;
+      }
+      return std::make_pair(num_samples_returned, pushed.ok() ? error : pushed);
+    };
+
+    while (num_samples_read < num_samples) {
       SampleStreamRequest request;
-      request.set_table(table_name_);
+      if (tables_.size() == 1) {
+        request.set_table(tables_.front().table());
+      } else {
+        request.mutable_tables()->Add(tables_.begin(), tables_.end());
+      }
+      const int64_t samples_per_request =
+          autotuner_ == nullptr
+              ? samples_per_request_
+              : autotuner_->max_in_flight_samples_per_worker();
       request.set_num_samples(
-          std::min(samples_per_request_, num_samples - num_samples_returned));
+          std::min(samples_per_request, num_samples - num_samples_read));
       request.mutable_rate_limiter_timeout()->set_milliseconds(
           NonnegativeDurationToInt64Millis(rate_limiter_timeout));
-      request.set_flexible_batch_size(flexible_batch_size_);
-
-      if (!stream->Write(request)) {
-        return {num_samples_returned, FromGrpcStatus(stream->Finish())};
+      request.set_flexible_batch_size(autotuner_ == nullptr
+                                          ? flexible_batch_size_
+                                          : autotuner_->flexible_batch_size());
+      request.set_max_response_bytes(max_response_bytes_);
+      request.set_shared_memory(shared_memory_);
+      request.set_without_replacement(without_replacement_);
+      if (chunk_cache_ != nullptr) AdvertiseCachedChunks(&request);
+      if (mutations_ != nullptr) AttachMutations(&request);
+
+      const absl::Time request_start = absl::Now();
+      {
+        internal::ScopedSpan span("Sampler::WriteRequest");
+        if (!stream_->Write(request)) {
+          return close_stream(tensorflow::Status::OK());
+        }
       }
 
       for (int64_t i = 0; i < request.num_samples(); i++) {
         std::vector<SampleStreamResponse> responses;
+        absl::optional<internal::ScopedSpan> read_span;
+        if (internal::IsTracing()) read_span.emplace("Sampler::ReadSample");
         while (!SampleIsDone(responses)) {
           SampleStreamResponse response;
-          if (!stream->Read(&response)) {
-            return {num_samples_returned, FromGrpcStatus(stream->Finish())};
+          if (!Read(stream_.get(), &response)) {
+            return close_stream(tensorflow::Status::OK());
+          }
+          if (i == 0 && responses.empty()) {
+            stats_->RecordFirstResponse(absl::Now() - request_start);
+          }
+          if (response.has_shared_memory_data()) {
+            if (auto status = internal::ReadSharedMemoryChunk(
+                    response.shared_memory_data(), response.mutable_data());
+                !status.ok()) {
+              return close_stream(status);
+            }
+            response.clear_shared_memory_data();
+          }
+          if (auto status = ResolveRepeatedChunk(&response); !status.ok()) {
+            return close_stream(status);
           }
           responses.push_back(std::move(response));
         }
-
-        std::unique_ptr<Sample> sample;
-        auto status = AsSample(std::move(responses), &sample);
-        if (!status.ok()) {
+        read_span.reset();
+
+        pending.push_back(Decode(std::move(responses)));
+        ++num_samples_read;
+        if (auto status = PushDecoded(queue, max_pending_samples_, &pending,
+                                      &num_samples_returned);
+            !status.ok()) {
+          stream_ = nullptr;
           return {num_samples_returned, status};
         }
-        if (!queue->Push(std::move(sample))) {
-          return {num_samples_returned,
-                  tensorflow::errors::Cancelled("`Close` called on Sampler")};
-        }
-        ++num_samples_returned;
       }
+
+      if (autotuner_ != nullptr) {
+        autotuner_->RecordRequest(request.num_samples(),
+                                  absl::Now() - request_start);
+      }
+    }
+
+    if (auto status = PushDecoded(queue, 0, &pending, &num_samples_returned);
+        !status.ok()) {
+      stream_ = nullptr;
+      return {num_samples_returned, status};
     }
 
+    if (!persistent_stream_) stream_ = nullptr;
     if (num_samples_returned != num_samples) {
       return {num_samples_returned,
               tensorflow::errors::Internal(
@@ -278,11 +709,145 @@ class GrpcSamplerWorker : public SamplerWorker {
   }
 
  private:
+  // A sample which has been read from the stream and is being decoded.
+  struct PendingSample {
+    absl::Notification decoded;
+    tensorflow::Status status;
+    std::unique_ptr<Sample> sample;
+  };
+
+  // Decodes `responses` into a sample on `decode_pool_`, or on the calling
+  // thread if there is no pool. The chunks advertised to the server at this
+  // point are held until the sample has been decoded since the responses may
+  // reference them.
+  std::shared_ptr<PendingSample> Decode(
+      std::vector<SampleStreamResponse> responses) {
+    auto pending = std::make_shared<PendingSample>();
+    auto decode = [pending, responses = std::move(responses),
+                   cache = chunk_cache_, advertised = advertised_chunks_,
+                   stats = stats_, allocator = allocator_,
+                   trace = internal::CurrentTraceContext()]() mutable {
+      internal::ScopedTraceContext active(trace);
+      internal::ScopedSpan span("Sampler::Decode");
+      const absl::Time start = absl::Now();
+      pending->status = AsSample(std::move(responses), cache, advertised.get(),
+                                 allocator, &pending->sample);
+      stats->RecordDecode(absl::Now() - start);
+      pending->decoded.Notify();
+    };
+    if (decode_pool_ == nullptr) {
+      decode();
+    } else {
+      decode_pool_->Schedule(std::move(decode));
+    }
+    return pending;
+  }
+
+  // Pushes the samples at the front of `pending` to `queue` as they are
+  // decoded, waiting for the decoding to complete while more than
+  // `max_pending` samples remain. Samples are pushed in the order in which
+  // they were read so the order, which FIFO tables rely on, is preserved.
+  tensorflow::Status PushDecoded(
+      internal::Queue<std::unique_ptr<Sample>>* queue, int max_pending,
+      std::deque<std::shared_ptr<PendingSample>>* pending,
+      int64_t* num_pushed) {
+    while (!pending->empty() &&
+           (static_cast<int>(pending->size()) > max_pending ||
+            pending->front()->decoded.HasBeenNotified())) {
+      auto& front = pending->front();
+      front->decoded.WaitForNotification();
+      TF_RETURN_IF_ERROR(front->status);
+      if (!queue->Push(std::move(front->sample))) {
+        return tensorflow::errors::Cancelled("`Close` called on Sampler");
+      }
+      pending->pop_front();
+      stats_->RecordSamplePushed(worker_id_);
+      ++*num_pushed;
+    }
+    return tensorflow::Status::OK();
+  }
+
+  // Reads the next (unpacked) response from `stream`. If the server packs
+  // multiple responses into one message then the remaining entries are kept
+  // in `unpacked_` and returned by the following calls.
+  bool Read(grpc::ClientReaderWriterInterface<SampleStreamRequest,
+                                              SampleStreamResponse>* stream,
+            SampleStreamResponse* response) {
+    if (unpacked_.empty()) {
+      if (!stream->Read(response)) return false;
+      stats_->RecordBytesReceived(response->ByteSizeLong());
+      if (response->entries().empty()) return true;
+      for (auto& entry : *response->mutable_entries()) {
+        unpacked_.push_back(std::move(entry));
+      }
+    }
+    *response = std::move(unpacked_.front());
+    unpacked_.pop_front();
+    return true;
+  }
+
+  // Replaces the reference of a `data_is_repeated` response with the chunk it
+  // references, and holds on to the chunks of `retain_data` responses until
+  // the end of the batch.
+  tensorflow::Status ResolveRepeatedChunk(SampleStreamResponse* response) {
+    if (response->data_is_repeated()) {
+      const uint64_t chunk_key = response->data().chunk_key();
+      auto it = retained_chunks_.find(chunk_key);
+      if (it == retained_chunks_.end()) {
+        return tensorflow::errors::Internal(
+            "Chunk ", chunk_key,
+            " was sent as a repeated reference but it was not retained.");
+      }
+      *response->mutable_data() = it->second;
+      response->set_data_is_repeated(false);
+    } else if (response->retain_data()) {
+      retained_chunks_[response->data().chunk_key()] = response->data();
+    }
+    if (response->end_of_batch()) retained_chunks_.clear();
+    return tensorflow::Status::OK();
+  }
+
+  // Moves the mutations queued in `mutations_` into the `priority_updates` and
+  // `delete_keys` of `request`.
+  void AttachMutations(SampleStreamRequest* request) {
+    std::vector<KeyWithPriority> updates;
+    std::vector<uint64_t> deletes;
+    if (!mutations_->Take(&updates, &deletes)) return;
+    request->mutable_priority_updates()->Add(updates.begin(), updates.end());
+    request->mutable_delete_keys()->Add(deletes.begin(), deletes.end());
+  }
+
+  // Adds the chunks which have been inserted into (or replaced in)
+  // `chunk_cache_` since the previous request to `request->cached_chunks` and
+  // the chunks which have been evicted to `request->evicted_chunk_keys`. The
+  // responses to a request are read before the next request is written, so
+  // holding on to the advertised entries until the server has been told about
+  // the eviction guarantees that referenced chunks are always available.
+  void AdvertiseCachedChunks(SampleStreamRequest* request) {
+    AdvertisedChunks cached;
+    for (auto& [key, entry] : chunk_cache_->Entries()) {
+      if (entry->num_timesteps() == 0) continue;
+      if (auto it = advertised_chunks_->find(key);
+          it == advertised_chunks_->end() || it->second != entry) {
+        auto* chunk = request->add_cached_chunks();
+        chunk->set_chunk_key(key);
+        chunk->set_start(entry->start);
+        chunk->set_end(entry->start + entry->num_timesteps() - 1);
+      }
+      cached.emplace(key, std::move(entry));
+    }
+    for (const auto& [key, entry] : *advertised_chunks_) {
+      if (!cached.contains(key)) request->add_evicted_chunk_keys(key);
+    }
+    advertised_chunks_ =
+        std::make_shared<const AdvertisedChunks>(std::move(cached));
+  }
+
   // Stub used to open `SampleStream`-streams to a server.
   std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub_;
 
-  // Name of the `Table` to sample from.
-  const std::string table_name_;
+  // The `Table`s to sample from and their weights.
+  const std::vector<TableWeight> tables_;
 
   // The maximum number of samples to request in a "batch".
   const int64_t samples_per_request_;
@@ -292,20 +857,273 @@ class GrpcSamplerWorker : public SamplerWorker {
   // `Table::SampleFlexibleBatch` (lock not released between samples).
   const int flexible_batch_size_;
 
+  // Whether the items of each flexible batch are distinct.
+  const bool without_replacement_;
+
+  // Size up to which the server packs chunks into a single response.
+  const int64_t max_response_bytes_;
+
+  // Whether the server is asked to pass chunks through shared memory.
+  const bool shared_memory_;
+
+  // Whether the stream is kept open between calls to `FetchSamples`.
+  const bool persistent_stream_;
+
+  // Cache of decompressed chunks shared with the other workers of the
+  // `Sampler`. Null if the cache is disabled.
+  ChunkCache* chunk_cache_;
+
+  // Threads shared with the other workers of the `Sampler` which decode the
+  // received samples. Null if samples are decoded by the thread reading the
+  // stream.
+  internal::ThreadPool* decode_pool_;
+
+  // Shared with the other workers of the `Sampler`. Null if autotuning is
+  // disabled.
+  SamplerAutotuner* autotuner_;
+
+  // Shared with the other workers of the `Sampler`. Null if the mutations are
+  // not sent by this worker.
+  SamplerMutations* mutations_;
+
+  // Shared with the other workers of the `Sampler`. Never null.
+  SamplerStatsRecorder* stats_;
+
+  // Id of the `Sampler` worker which the pushed samples are attributed to.
+  const int worker_id_;
+
+  // Allocates the tensors of the decoded samples. Never null.
+  tensorflow::Allocator* const allocator_;
+
+  // Priority class the streams are tagged with. Empty if untagged.
+  const std::string priority_class_;
+
+  // The maximum number of samples which are read ahead of the sample being
+  // decoded at the front of the queue.
+  const int max_pending_samples_;
+
+  // Chunks which have been advertised to the server on the active stream. The
+  // map is replaced rather than modified so samples which are being decoded
+  // can hold on to the version that was advertised when they were requested.
+  // Only accessed by the thread calling `FetchSamples`.
+  std::shared_ptr<const AdvertisedChunks> advertised_chunks_;
+
+  // Responses of the active stream which have been unpacked but not yet read.
+  // Only accessed by the thread calling `FetchSamples`.
+  std::deque<SampleStreamResponse> unpacked_;
+
+  // Chunks sent with `retain_data` in the current batch, keyed by chunk key.
+  internal::flat_hash_map<uint64_t, ChunkData> retained_chunks_;
+
   // Context of the active stream.
   std::unique_ptr<grpc::ClientContext> context_ ABSL_GUARDED_BY(mu_);
 
+  // Trace of the active stream. Started when the stream is opened and
+  // otherwise only accessed by the thread calling `FetchSamples`.
+  internal::TraceContext trace_;
+
+  // The active stream or nullptr if no stream is open. Opened under `mu_` but
+  // otherwise only accessed by the thread calling `FetchSamples`. Declared
+  // after `context_` as it must be destroyed before its context.
+  std::unique_ptr<grpc::ClientReaderWriterInterface<SampleStreamRequest,
+                                                    SampleStreamResponse>>
+      stream_;
+
   // True if `Cancel` has been called.
   bool closed_ ABSL_GUARDED_BY(mu_) = false;
 
   absl::Mutex mu_;
 };
 
+// Returns the rate at which a server should be sent sample requests relative
+// to the other servers given the `TableInfo` of the sampled table. Tables
+// whose sampler draws items in proportion to weights (e.g priorities) are
+// sampled in proportion to their total weight, which makes the probability of
+// every item the same as if the tables were one, and other tables in
+// proportion to their size. Servers which can't be sampled from yet get no
+// requests and the share of servers whose rate limiter is blocking sample
+// calls is reduced in proportion to the number of blocked calls.
+double SamplingWeight(const TableInfo& info) {
+  const auto& rate_limiter = info.rate_limiter_info();
+  if (info.current_size() == 0 ||
+      info.current_size() < rate_limiter.min_size_to_sample()) {
+    return 0;
+  }
+  const double weight = info.sampler_total_weight() > 0
+                            ? info.sampler_total_weight()
+                            : static_cast<double>(info.current_size());
+  return weight / (1 + rate_limiter.sample_stats().pending());
+}
+
+// Tracks the load of the servers of a multi server `Sampler` and picks the
+// server to send each sample request to. The `TableInfo` of the sampled table
+// is polled from every server through `ServerInfo` once on construction and
+// then periodically in a background thread. Servers which can't be reached
+// get no requests until they can.
+class ServerLoad {
+ public:
+  ServerLoad(
+      std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+          stubs,
+      std::string table_name, absl::Duration poll_interval)
+      : stubs_(std::move(stubs)),
+        table_name_(std::move(table_name)),
+        poll_interval_(poll_interval),
+        tables_state_ids_(stubs_.size()) {
+    REVERB_CHECK(!stubs_.empty());
+    Poll();
+    poller_ = absl::make_unique<internal::PeriodicClosure>(
+        [this] { Poll(); }, poll_interval_, "Sampler-ServerLoad");
+    REVERB_CHECK(poller_->Start().ok());
+  }
+
+  ~ServerLoad() { REVERB_CHECK(poller_->Stop().ok()); }
+
+  // Returns the index of a server picked at random in proportion to its
+  // weight. Servers are picked uniformly if none of them can be sampled from,
+  // in which case the requests block on the servers until the tables have
+  // been filled.
+  int Pick(absl::BitGen* bit_gen) const {
+    absl::MutexLock lock(&mu_);
+    double total = 0;
+    for (double weight : weights_) total += weight;
+    if (total <= 0) {
+      return absl::Uniform<int>(*bit_gen, 0, static_cast<int>(weights_.size()));
+    }
+    double remaining = absl::Uniform<double>(*bit_gen, 0, total);
+    int picked = 0;
+    for (int i = 0; i < weights_.size(); i++) {
+      if (weights_[i] <= 0) continue;
+      picked = i;
+      remaining -= weights_[i];
+      if (remaining < 0) break;
+    }
+    return picked;
+  }
+
+  int num_servers() const { return stubs_.size(); }
+
+ private:
+  void Poll() {
+    std::vector<double> weights(stubs_.size(), 0);
+    for (int i = 0; i < stubs_.size(); i++) {
+      grpc::ClientContext context;
+      context.set_deadline(std::chrono::system_clock::now() +
+                           absl::ToChronoMilliseconds(poll_interval_));
+      // Only the sizes and the rate limiter states are used.
+      ServerInfoRequest request;
+      request.set_allow_stale(true);
+      if (tables_state_ids_[i].has_value()) {
+        *request.mutable_tables_state_id() = *tables_state_ids_[i];
+      }
+      ServerInfoResponse response;
+      if (!stubs_[i]->ServerInfo(&context, request, &response).ok()) continue;
+      tables_state_ids_[i] = response.tables_state_id();
+      for (const auto& info : response.table_info()) {
+        if (info.name() == table_name_) weights[i] = SamplingWeight(info);
+      }
+    }
+    absl::MutexLock lock(&mu_);
+    weights_ = std::move(weights);
+  }
+
+  const std::vector<
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs_;
+  const std::string table_name_;
+
+  // Period of the polls. Also used as the deadline of each `ServerInfo` call.
+  const absl::Duration poll_interval_;
+
+  // `tables_state_id` of the last response of each server, which is sent
+  // back so that the server can omit the signatures. Only accessed by `Poll`.
+  std::vector<absl::optional<Uint128>> tables_state_ids_;
+
+  // Weight of each server, see `SamplingWeight`.
+  std::vector<double> weights_ ABSL_GUARDED_BY(mu_);
+  mutable absl::Mutex mu_;
+
+  // Calls `Poll` periodically. Declared last so it is stopped before the
+  // state it accesses is destroyed.
+  std::unique_ptr<internal::PeriodicClosure> poller_;
+};
+
+// Worker of a multi server `Sampler`. Holds a `GrpcSamplerWorker` with a
+// persistent stream for every server and sends each request of
+// `samples_per_request` samples to a server picked by `ServerLoad`.
+class MultiServerSamplerWorker : public SamplerWorker {
+ public:
+  MultiServerSamplerWorker(
+      std::shared_ptr<ServerLoad> load,
+      std::vector<std::unique_ptr<GrpcSamplerWorker>> workers,
+      int64_t samples_per_request, SamplerAutotuner* autotuner)
+      : load_(std::move(load)),
+        workers_(std::move(workers)),
+        samples_per_request_(samples_per_request),
+        autotuner_(autotuner) {
+    REVERB_CHECK_EQ(static_cast<int>(workers_.size()), load_->num_servers());
+  }
+
+  void Cancel() override {
+    for (auto& worker : workers_) worker->Cancel();
+  }
+
+  std::pair<int64_t, tensorflow::Status> FetchSamples(
+      internal::Queue<std::unique_ptr<Sample>>* queue, int64_t num_samples,
+      absl::Duration rate_limiter_timeout) override {
+    int64_t num_samples_returned = 0;
+    while (num_samples_returned < num_samples) {
+      auto* worker = workers_[load_->Pick(&bit_gen_)].get();
+      const int64_t samples_per_request =
+          autotuner_ == nullptr
+              ? samples_per_request_
+              : autotuner_->max_in_flight_samples_per_worker();
+      auto result = worker->FetchSamples(
+          queue,
+          std::min(samples_per_request, num_samples - num_samples_returned),
+          rate_limiter_timeout);
+      num_samples_returned += result.first;
+      if (!result.second.ok()) {
+        return {num_samples_returned, result.second};
+      }
+    }
+    return {num_samples_returned, tensorflow::Status::OK()};
+  }
+
+ private:
+  // Shared by all the workers of the `Sampler`.
+  std::shared_ptr<ServerLoad> load_;
+
+  // Worker of the server with the same index.
+  std::vector<std::unique_ptr<GrpcSamplerWorker>> workers_;
+
+  const int64_t samples_per_request_;
+
+  // Replaces `samples_per_request_` if non-null.
+  SamplerAutotuner* autotuner_;
+
+  // Only accessed by the thread calling `FetchSamples`.
+  absl::BitGen bit_gen_;
+};
+
 class LocalSamplerWorker : public SamplerWorker {
  public:
-  // Constructs a new worker without creating a stream to a server.
-  LocalSamplerWorker(std::shared_ptr<Table> table, int flexible_batch_size)
-      : table_(table), flexible_batch_size_(flexible_batch_size) {
+  // Constructs a new worker without creating a stream to a server. The
+  // mutations queued in `mutations` are applied with the next batch. Latencies
+  // are recorded in `stats` with the pushed samples attributed to `worker_id`.
+  // The tensors of the samples are allocated from `allocator`.
+  LocalSamplerWorker(std::shared_ptr<Table> table, int flexible_batch_size,
+                     bool without_replacement, ChunkCache* chunk_cache,
+                     SamplerMutations* mutations, SamplerStatsRecorder* stats,
+                     int worker_id, tensorflow::Allocator* allocator)
+      : table_(table),
+        flexible_batch_size_(flexible_batch_size),
+        without_replacement_(without_replacement),
+        chunk_cache_(chunk_cache),
+        mutations_(mutations),
+        stats_(stats),
+        worker_id_(worker_id),
+        allocator_(allocator) {
     REVERB_CHECK_GE(flexible_batch_size_, 1);
   }
 
@@ -320,6 +1138,9 @@ class LocalSamplerWorker : public SamplerWorker {
     static const auto kWakeupTimeout = absl::Seconds(3);
     auto final_deadline = absl::Now() + rate_limiter_timeout;
 
+    // There is no stream so every call is traced on its own.
+    internal::ScopedTraceContext active(internal::StartTrace());
+
     int64_t num_samples_returned = 0;
     while (num_samples_returned < num_samples) {
       {
@@ -342,8 +1163,14 @@ class LocalSamplerWorker : public SamplerWorker {
       auto batch_size = std::min<int>(flexible_batch_size_,
                                       num_samples - num_samples_returned);
 
+      // The mutations are applied even if the deadline is exceeded.
+      std::vector<KeyWithPriority> updates;
+      std::vector<uint64_t> deletes;
+      mutations_->Take(&updates, &deletes);
+
       std::vector<Table::SampledItem> items;
-      auto status = table_->SampleFlexibleBatch(&items, batch_size, timeout);
+      auto status = table_->MutateAndSampleFlexibleBatch(
+          updates, deletes, &items, batch_size, timeout, without_replacement_);
 
       // If the deadline is exceeded but the "real deadline" is still in the
       // future then we are only waking up to check for cancellation.
@@ -360,13 +1187,20 @@ class LocalSamplerWorker : public SamplerWorker {
       // Push sampled items to queue.
       for (const auto& item : items) {
         std::unique_ptr<Sample> sample;
-        if (status = AsSample(item, &sample); !status.ok()) {
-          return {num_samples_returned, status};
+        const absl::Time decode_start = absl::Now();
+        {
+          internal::ScopedSpan span("Sampler::Decode");
+          if (status = AsSample(item, chunk_cache_, allocator_, &sample);
+              !status.ok()) {
+            return {num_samples_returned, status};
+          }
         }
+        stats_->RecordDecode(absl::Now() - decode_start);
         if (!queue->Push(std::move(sample))) {
           return {num_samples_returned,
                   tensorflow::errors::Cancelled("`Close` called on Sampler")};
         }
+        stats_->RecordSamplePushed(worker_id_);
         ++num_samples_returned;
       }
     }
@@ -383,6 +1217,12 @@ class LocalSamplerWorker : public SamplerWorker {
  private:
   std::shared_ptr<Table> table_;
   const int flexible_batch_size_;
+  const bool without_replacement_;
+  ChunkCache* chunk_cache_;
+  SamplerMutations* mutations_;
+  SamplerStatsRecorder* stats_;
+  const int worker_id_;
+  tensorflow::Allocator* const allocator_;
   bool closed_ ABSL_GUARDED_BY(mu_) = false;
   absl::Mutex mu_;
 };
@@ -403,24 +1243,75 @@ int64_t GetNumWorkers(const Sampler::Options& options) {
                       max_samples / options.max_in_flight_samples_per_worker));
 }
 
+int64_t GetMaxResponseBytes(const Sampler::Options& options) {
+  return options.max_response_bytes == Sampler::kAutoSelectValue
+             ? Sampler::kDefaultMaxResponseBytes
+             : options.max_response_bytes;
+}
+
+tensorflow::Allocator* GetOutputAllocator(const Sampler::Options& options) {
+  return options.output_allocator == nullptr ? tensorflow::cpu_allocator()
+                                             : options.output_allocator;
+}
+
 std::vector<std::unique_ptr<SamplerWorker>> MakeGrpcWorkers(
     std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
-    const std::string& table_name, const Sampler::Options& options) {
+    const std::vector<TableWeight>& tables, const Sampler::Options& options,
+    ChunkCache* chunk_cache, internal::ThreadPool* decode_pool,
+    SamplerAutotuner* autotuner, SamplerMutations* mutations,
+    SamplerStatsRecorder* stats) {
   int64_t num_workers = GetNumWorkers(options);
   REVERB_CHECK_GE(num_workers, 1);
   std::vector<std::unique_ptr<SamplerWorker>> workers;
   workers.reserve(num_workers);
   for (int i = 0; i < num_workers; i++) {
     workers.push_back(absl::make_unique<GrpcSamplerWorker>(
-        stub, table_name, options.max_in_flight_samples_per_worker,
-        options.flexible_batch_size));
+        stub, tables, options.max_in_flight_samples_per_worker,
+        options.flexible_batch_size, options.without_replacement,
+        GetMaxResponseBytes(options), options.shared_memory, chunk_cache,
+        decode_pool, autotuner, mutations, stats, /*worker_id=*/i,
+        GetOutputAllocator(options), options.priority_class));
   }
 
   return workers;
 }
 
+std::vector<std::unique_ptr<SamplerWorker>> MakeMultiServerWorkers(
+    std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+        stubs,
+    const std::string& table_name, const Sampler::Options& options,
+    ChunkCache* chunk_cache, internal::ThreadPool* decode_pool,
+    SamplerAutotuner* autotuner, SamplerStatsRecorder* stats) {
+  int64_t num_workers = GetNumWorkers(options);
+  REVERB_CHECK_GE(num_workers, 1);
+  auto load = std::make_shared<ServerLoad>(stubs, table_name,
+                                           options.server_info_poll_interval);
+  std::vector<std::unique_ptr<SamplerWorker>> workers;
+  workers.reserve(num_workers);
+  for (int i = 0; i < num_workers; i++) {
+    std::vector<std::unique_ptr<GrpcSamplerWorker>> server_workers;
+    server_workers.reserve(stubs.size());
+    for (const auto& stub : stubs) {
+      server_workers.push_back(absl::make_unique<GrpcSamplerWorker>(
+          stub, SingleTable(table_name),
+          options.max_in_flight_samples_per_worker,
+          options.flexible_batch_size, options.without_replacement,
+          GetMaxResponseBytes(options), options.shared_memory, chunk_cache,
+          decode_pool, autotuner, /*mutations=*/nullptr, stats, /*worker_id=*/i,
+          GetOutputAllocator(options), options.priority_class,
+          /*persistent_stream=*/true));
+    }
+    workers.push_back(absl::make_unique<MultiServerSamplerWorker>(
+        load, std::move(server_workers),
+        options.max_in_flight_samples_per_worker, autotuner));
+  }
+  return workers;
+}
+
 std::vector<std::unique_ptr<SamplerWorker>> MakeLocalWorkers(
-    std::shared_ptr<Table> table, const Sampler::Options& options) {
+    std::shared_ptr<Table> table, const Sampler::Options& options,
+    ChunkCache* chunk_cache, SamplerMutations* mutations,
+    SamplerStatsRecorder* stats) {
   int64_t num_workers = GetNumWorkers(options);
   REVERB_CHECK_GE(num_workers, 1);
   int flexible_batch_size =
@@ -431,23 +1322,82 @@ std::vector<std::unique_ptr<SamplerWorker>> MakeLocalWorkers(
   std::vector<std::unique_ptr<SamplerWorker>> workers;
   workers.reserve(num_workers);
   for (int i = 0; i < num_workers; ++i) {
-    workers.push_back(
-        absl::make_unique<LocalSamplerWorker>(table, flexible_batch_size));
+    workers.push_back(absl::make_unique<LocalSamplerWorker>(
+        table, flexible_batch_size, options.without_replacement, chunk_cache,
+        mutations, stats, /*worker_id=*/i, GetOutputAllocator(options)));
   }
   return workers;
 }
 
 }  // namespace
 
+void SamplerMutations::Add(const std::vector<KeyWithPriority>& updates,
+                           const std::vector<uint64_t>& deletes) {
+  absl::MutexLock lock(&mu_);
+  updates_.insert(updates_.end(), updates.begin(), updates.end());
+  deletes_.insert(deletes_.end(), deletes.begin(), deletes.end());
+}
+
+bool SamplerMutations::Take(std::vector<KeyWithPriority>* updates,
+                            std::vector<uint64_t>* deletes) {
+  absl::MutexLock lock(&mu_);
+  if (updates_.empty() && deletes_.empty()) return false;
+  *updates = std::move(updates_);
+  *deletes = std::move(deletes_);
+  updates_.clear();
+  deletes_.clear();
+  return true;
+}
+
 Sampler::Sampler(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
                  const std::string& table_name, const Options& options,
                  internal::DtypesAndShapes dtypes_and_shapes)
-    : Sampler(MakeGrpcWorkers(std::move(stub), table_name, options), table_name,
-              options, std::move(dtypes_and_shapes)) {}
+    : Sampler(
+          [&](ChunkCache* chunk_cache, internal::ThreadPool* decode_pool,
+              SamplerAutotuner* autotuner, SamplerMutations* mutations,
+              SamplerStatsRecorder* stats) {
+            return MakeGrpcWorkers(std::move(stub), SingleTable(table_name),
+                                   options, chunk_cache, decode_pool,
+                                   autotuner, mutations, stats);
+          },
+          table_name, options, std::move(dtypes_and_shapes),
+          /*mutable_items=*/true) {}
 
-Sampler::Sampler(std::vector<std::unique_ptr<SamplerWorker>> workers,
-                 const std::string& table, const Options& options,
+Sampler::Sampler(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+                 const std::vector<TableWeight>& tables, const Options& options,
                  internal::DtypesAndShapes dtypes_and_shapes)
+    : Sampler(
+          [&](ChunkCache* chunk_cache, internal::ThreadPool* decode_pool,
+              SamplerAutotuner* autotuner, SamplerMutations*,
+              SamplerStatsRecorder* stats) {
+            REVERB_CHECK(!tables.empty());
+            return MakeGrpcWorkers(std::move(stub), tables, options,
+                                   chunk_cache, decode_pool, autotuner,
+                                   /*mutations=*/nullptr, stats);
+          },
+          TableNames(tables), options, std::move(dtypes_and_shapes),
+          /*mutable_items=*/false) {}
+
+Sampler::Sampler(
+    std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+        stubs,
+    const std::string& table_name, const Options& options,
+    internal::DtypesAndShapes dtypes_and_shapes)
+    : Sampler(
+          [&](ChunkCache* chunk_cache, internal::ThreadPool* decode_pool,
+              SamplerAutotuner* autotuner, SamplerMutations*,
+              SamplerStatsRecorder* stats) {
+            return MakeMultiServerWorkers(std::move(stubs), table_name,
+                                          options, chunk_cache, decode_pool,
+                                          autotuner, stats);
+          },
+          table_name, options, std::move(dtypes_and_shapes),
+          /*mutable_items=*/false) {}
+
+Sampler::Sampler(const WorkerFactory& make_workers, const std::string& table,
+                 const Options& options,
+                 internal::DtypesAndShapes dtypes_and_shapes,
+                 bool mutable_items)
     : table_(table),
       max_samples_(options.max_samples == kUnlimitedMaxSamples
                        ? INT64_MAX
@@ -456,31 +1406,95 @@ Sampler::Sampler(std::vector<std::unique_ptr<SamplerWorker>> workers,
                                   ? kDefaultMaxSamplesPerStream
                                   : options.max_samples_per_stream),
       rate_limiter_timeout_(options.rate_limiter_timeout),
-      workers_(std::move(workers)),
+      chunk_cache_(
+          options.chunk_cache_bytes > 0
+              ? absl::make_unique<ChunkCache>(options.chunk_cache_bytes)
+              : nullptr),
+      decode_pool_(options.num_decode_threads > 0
+                       ? absl::make_unique<internal::ThreadPool>(
+                             options.num_decode_threads, "SamplerDecode")
+                       : nullptr),
+      autotuner_(options.autotune
+                     ? absl::make_unique<SamplerAutotuner>(
+                           options.max_in_flight_samples_per_worker,
+                           options.flexible_batch_size == kAutoSelectValue
+                               ? kDefaultAutotuneMaxFlexibleBatchSize
+                               : options.flexible_batch_size)
+                     : nullptr),
+      mutations_(mutable_items ? absl::make_unique<SamplerMutations>()
+                               : nullptr),
+      worker_executor_(options.worker_executor),
+      output_allocator_(GetOutputAllocator(options)),
+      workers_(make_workers(chunk_cache_.get(), decode_pool_.get(),
+                            autotuner_.get(), mutations_.get(), &stats_)),
       active_sample_(nullptr),
       samples_(std::max<int>(options.num_workers, 1)),
-      dtypes_and_shapes_(std::move(dtypes_and_shapes)) {
+      validator_(dtypes_and_shapes.has_value()
+                     ? absl::make_unique<const internal::SignatureValidator>(
+                           std::move(*dtypes_and_shapes))
+                     : nullptr) {
   REVERB_CHECK_GT(max_samples_, 0);
   REVERB_CHECK_GT(options.max_in_flight_samples_per_worker, 0);
   REVERB_CHECK(options.num_workers == kAutoSelectValue ||
                options.num_workers > 0);
   REVERB_CHECK(options.flexible_batch_size == kAutoSelectValue ||
                options.flexible_batch_size > 0);
+  REVERB_CHECK_GE(options.chunk_cache_bytes, 0);
+  REVERB_CHECK_GE(options.num_decode_threads, 0);
+  REVERB_CHECK(options.max_response_bytes == kAutoSelectValue ||
+               options.max_response_bytes >= 0);
+  REVERB_CHECK_GT(options.server_info_poll_interval, absl::ZeroDuration());
 
   for (int i = 0; i < workers_.size(); i++) {
     worker_threads_.push_back(internal::StartThread(
-        absl::StrCat("SamplerWorker_", i),
+        worker_executor_.get(), absl::StrCat("SamplerWorker_", i),
         [this, worker = workers_[i].get()] { RunWorker(worker); }));
   }
 }
 
 Sampler::Sampler(std::shared_ptr<Table> table, const Options& options,
                  internal::DtypesAndShapes dtypes_and_shapes)
-    : Sampler(MakeLocalWorkers(table, options), table->name(), options,
-              std::move(dtypes_and_shapes)) {}
+    : Sampler(
+          [&](ChunkCache* chunk_cache, internal::ThreadPool*,
+              SamplerAutotuner*, SamplerMutations* mutations,
+              SamplerStatsRecorder* stats) {
+            return MakeLocalWorkers(table, options, chunk_cache, mutations,
+                                    stats);
+          },
+          table->name(), options, std::move(dtypes_and_shapes),
+          /*mutable_items=*/true) {}
 
 Sampler::~Sampler() { Close(); }
 
+ChunkCache::Stats Sampler::chunk_cache_stats() const {
+  return chunk_cache_ == nullptr ? ChunkCache::Stats() : chunk_cache_->stats();
+}
+
+SamplerAutotuner::Stats Sampler::autotune_stats() const {
+  return autotuner_ == nullptr ? SamplerAutotuner::Stats()
+                               : autotuner_->stats();
+}
+
+SamplerStats Sampler::stats() const { return stats_.ToProto(); }
+
+tensorflow::Status Sampler::MutatePriorities(
+    const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes) {
+  if (mutations_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition(
+        "MutatePriorities is not supported by samplers of several tables or "
+        "servers.");
+  }
+  {
+    absl::ReaderMutexLock lock(&mu_);
+    if (closed_) {
+      return tensorflow::errors::Cancelled("`Close` called on Sampler.");
+    }
+  }
+  mutations_->Add(updates, deletes);
+  return tensorflow::Status::OK();
+}
+
 tensorflow::Status Sampler::GetNextTimestep(
     std::vector<tensorflow::Tensor>* data, bool* end_of_sequence) {
   TF_RETURN_IF_ERROR(MaybeSampleNext());
@@ -512,53 +1526,101 @@ tensorflow::Status Sampler::GetNextSample(
   return tensorflow::Status::OK();
 }
 
+tensorflow::Status Sampler::GetNextBatch(
+    int64_t batch_size, std::vector<tensorflow::Tensor>* data) {
+  if (batch_size < 1) {
+    return tensorflow::errors::InvalidArgument("batch_size (", batch_size,
+                                               ") must be >= 1");
+  }
+
+  std::vector<std::unique_ptr<Sample>> samples;
+  samples.reserve(batch_size);
+  while (samples.size() < batch_size) {
+    std::unique_ptr<Sample> sample;
+    auto status = PopNextSample(&sample);
+    // Return what we have if `max_samples` was reached, or the rate limiter
+    // timed out, halfway through. The next call returns the error.
+    if ((tensorflow::errors::IsOutOfRange(status) ||
+         errors::IsRateLimiterTimeout(status)) &&
+        !samples.empty()) {
+      break;
+    }
+    TF_RETURN_IF_ERROR(status);
+    samples.push_back(std::move(sample));
+
+    absl::WriterMutexLock lock(&mu_);
+    if (++returned_ == max_samples_) samples_.Close();
+  }
+
+  samples.front()->PrepareBatch(samples.size(), data, output_allocator_);
+
+  // The spec describes a single time step so validate the first time step of
+  // the first sample in the batch.
+  if (validator_ != nullptr && samples.front()->num_timesteps() > 0) {
+    std::vector<tensorflow::Tensor> timestep;
+    timestep.reserve(data->size());
+    for (int i = 0; i < data->size(); i++) {
+      timestep.push_back(i < 4 ? (*data)[i].SubSlice(0)
+                               : (*data)[i].SubSlice(0).SubSlice(0));
+    }
+    TF_RETURN_IF_ERROR(
+        ValidateAgainstOutputSpec(timestep, /*time_step=*/true));
+  }
+
+  for (int64_t i = 0; i < samples.size(); i++) {
+    TF_RETURN_IF_ERROR(samples[i]->CopyIntoBatch(i, data));
+  }
+
+  return tensorflow::Status::OK();
+}
+
 tensorflow::Status Sampler::ValidateAgainstOutputSpec(
     const std::vector<tensorflow::Tensor>& data, bool time_step) {
-  if (!dtypes_and_shapes_) {
+  if (validator_ == nullptr) {
     return tensorflow::Status::OK();
   }
 
-  if (data.size() != dtypes_and_shapes_->size()) {
+  const absl::Time start = absl::Now();
+  auto record_validation = internal::MakeCleanup(
+      [this, start] { stats_.RecordValidation(absl::Now() - start); });
+
+  const auto& specs = validator_->specs();
+  if (data.size() != validator_->num_tensors()) {
     return tensorflow::errors::InvalidArgument(
         "Inconsistent number of tensors received from table '", table_,
-        "'.  Specification has ", dtypes_and_shapes_->size(),
+        "'.  Specification has ", specs.size(),
         " tensors, but data coming from the table shows ", data.size(),
-        " tensors.\nTable signature: ",
-        internal::DtypesShapesString(*dtypes_and_shapes_),
+        " tensors.\nTable signature: ", internal::DtypesShapesString(specs),
         ".\nIncoming tensor signature: ",
         internal::DtypesShapesString(internal::SpecsFromTensors(data)));
   }
 
+  // The outer dimension of data[i].shape() is skipped when validating whole
+  // samples since the spec doesn't have the sequence dimension.
+  const int skip_dims = time_step ? 0 : 1;
   for (int i = 0; i < data.size(); ++i) {
-    tensorflow::TensorShape elem_shape;
-    if (!time_step) {
-      // Remove the outer dimension from data[i].shape() so we can properly
-      // compare against the spec (which doesn't have the sequence dimension).
-      elem_shape = data[i].shape();
-      if (elem_shape.dims() == 0) {
-        return tensorflow::errors::InvalidArgument(
-            "Invalid tensor shape received from table '", table_,
-            "'.  "
-            "time_step is false but data[",
-            i,
-            "] has scalar shape "
-            "(no time dimension).");
-      }
-      elem_shape.RemoveDim(0);
+    if (!time_step && data[i].dims() == 0) {
+      return tensorflow::errors::InvalidArgument(
+          "Invalid tensor shape received from table '", table_,
+          "'.  "
+          "time_step is false but data[",
+          i,
+          "] has scalar shape "
+          "(no time dimension).");
     }
 
-    auto* shape_ptr = time_step ? &(data[i].shape()) : &elem_shape;
-    if (data[i].dtype() != dtypes_and_shapes_->at(i).dtype ||
-        !dtypes_and_shapes_->at(i).shape.IsCompatibleWith(*shape_ptr)) {
+    if (!validator_->IsCompatible(i, data[i].dtype(), data[i].shape(),
+                                  skip_dims)) {
+      tensorflow::TensorShape elem_shape = data[i].shape();
+      if (!time_step) elem_shape.RemoveDim(0);
       return tensorflow::errors::InvalidArgument(
           "Received incompatible tensor at flattened index ", i,
           " from table '", table_, "'.  Specification has (dtype, shape): (",
-          tensorflow::DataTypeString(dtypes_and_shapes_->at(i).dtype), ", ",
-          dtypes_and_shapes_->at(i).shape.DebugString(),
-          ").  Tensor has (dtype, shape): (",
+          tensorflow::DataTypeString(specs[i].dtype), ", ",
+          specs[i].shape.DebugString(), ").  Tensor has (dtype, shape): (",
           tensorflow::DataTypeString(data[i].dtype()), ", ",
-          shape_ptr->DebugString(), ").\nTable signature: ",
-          internal::DtypesShapesString(*dtypes_and_shapes_));
+          elem_shape.DebugString(), ").\nTable signature: ",
+          internal::DtypesShapesString(specs));
     }
   }
   return tensorflow::Status::OK();
@@ -592,7 +1654,14 @@ tensorflow::Status Sampler::MaybeSampleNext() {
 }
 
 tensorflow::Status Sampler::PopNextSample(std::unique_ptr<Sample>* sample) {
-  if (samples_.Pop(sample)) return tensorflow::Status::OK();
+  const int queue_size = autotuner_ == nullptr ? 0 : samples_.size();
+  const absl::Time start = absl::Now();
+  if (samples_.Pop(sample)) {
+    const absl::Time now = absl::Now();
+    stats_.RecordPop(now - start, now - (*sample)->ready_time());
+    if (autotuner_ != nullptr) autotuner_->RecordPop(now, queue_size);
+    return tensorflow::Status::OK();
+  }
 
   absl::ReaderMutexLock lock(&mu_);
   if (returned_ == max_samples_) {
@@ -644,7 +1713,7 @@ void Sampler::RunWorker(SamplerWorker* worker) {
 
 Sample::Sample(tensorflow::uint64 key, double probability,
                tensorflow::int64 table_size, double priority,
-               std::list<std::vector<tensorflow::Tensor>> chunks)
+               std::vector<std::vector<tensorflow::Tensor>> chunks)
     : key_(key),
       probability_(probability),
       table_size_(table_size),
@@ -652,8 +1721,10 @@ Sample::Sample(tensorflow::uint64 key, double probability,
       num_timesteps_(0),
       num_data_tensors_(0),
       chunks_(std::move(chunks)),
+      next_chunk_index_(0),
       next_timestep_index_(0),
-      next_timestep_called_(false) {
+      next_timestep_called_(false),
+      ready_time_(absl::Now()) {
   REVERB_CHECK(!chunks_.empty()) << "Must provide at least one chunk.";
   REVERB_CHECK(!chunks_.front().empty())
       << "Chunks must hold at least one tensor.";
@@ -667,15 +1738,22 @@ Sample::Sample(tensorflow::uint64 key, double probability,
 std::vector<tensorflow::Tensor> Sample::GetNextTimestep() {
   REVERB_CHECK(!is_end_of_sample());
 
-  // Construct the output tensors.
+  if (timestep_metadata_.empty()) {
+    timestep_metadata_ = {tensorflow::Tensor(key_),
+                          tensorflow::Tensor(probability_),
+                          tensorflow::Tensor(table_size_),
+                          tensorflow::Tensor(priority_)};
+  }
+
+  // Construct the output tensors. The metadata tensors are shared rather than
+  // allocated for every time step.
   std::vector<tensorflow::Tensor> result;
   result.reserve(num_data_tensors_ + 4);
-  result.push_back(tensorflow::Tensor(key_));
-  result.push_back(tensorflow::Tensor(probability_));
-  result.push_back(tensorflow::Tensor(table_size_));
-  result.push_back(tensorflow::Tensor(priority_));
+  result.insert(result.end(), timestep_metadata_.begin(),
+                timestep_metadata_.end());
 
-  for (const auto& t : chunks_.front()) {
+  auto& chunk = chunks_[next_chunk_index_];
+  for (const auto& t : chunk) {
     auto slice = t.SubSlice(next_timestep_index_);
     if (slice.IsAligned()) {
       result.push_back(std::move(slice));
@@ -686,9 +1764,10 @@ std::vector<tensorflow::Tensor> Sample::GetNextTimestep() {
 
   // Advance the iterator.
   ++next_timestep_index_;
-  if (next_timestep_index_ == chunks_.front().front().dim_size(0)) {
-    // Go to the next chunk.
-    chunks_.pop_front();
+  if (next_timestep_index_ == chunk.front().dim_size(0)) {
+    // Release the chunk and go to the next one.
+    chunk.clear();
+    ++next_chunk_index_;
     next_timestep_index_ = 0;
   }
   next_timestep_called_ = true;
@@ -696,7 +1775,9 @@ std::vector<tensorflow::Tensor> Sample::GetNextTimestep() {
   return result;
 }
 
-bool Sample::is_end_of_sample() const { return chunks_.empty(); }
+bool Sample::is_end_of_sample() const {
+  return next_chunk_index_ == static_cast<int64_t>(chunks_.size());
+}
 
 tensorflow::Status Sample::AsBatchedTimesteps(
     std::vector<tensorflow::Tensor>* data) {
@@ -713,26 +1794,126 @@ tensorflow::Status Sample::AsBatchedTimesteps(
   sequences[2] = InitializeTensor(table_size_, num_timesteps_);
   sequences[3] = InitializeTensor(priority_, num_timesteps_);
 
-  // Prepare the data for concatenation.
-  // data_tensors[i][j] is the j-th chunk of the i-th data tensor.
-  std::vector<std::vector<tensorflow::Tensor>> data_tensors(num_data_tensors_);
+  // Samples created by the `Sampler` hold a single chunk which spans the
+  // entire sample, so its tensors are returned without being copied.
+  if (chunks_.size() == 1) {
+    std::move(chunks_.front().begin(), chunks_.front().end(),
+              sequences.begin() + 4);
+    chunks_.front().clear();
+    next_chunk_index_ = chunks_.size();
+    std::swap(sequences, *data);
+    return tensorflow::Status::OK();
+  }
 
-  // Extract all chunks.
-  while (!chunks_.empty()) {
-    auto it_to = data_tensors.begin();
-    for (auto& batch : chunks_.front()) {
-      (it_to++)->push_back(std::move(batch));
+  // Otherwise the time steps of every chunk are copied straight into the
+  // output tensors, which are allocated once for the whole sample.
+  std::vector<tensorflow::Tensor> outputs;
+  AllocateSampleTensors(chunks_.front(), num_timesteps_,
+                        tensorflow::cpu_allocator(), &outputs);
+  int64_t output_row = 0;
+  for (auto& chunk : chunks_) {
+    if (chunk.size() != num_data_tensors_) {
+      return tensorflow::errors::Internal(
+          "Chunks of the same sample must hold the same number of tensors, "
+          "but the first chunk holds ",
+          num_data_tensors_, " tensors while another chunk holds ",
+          chunk.size(), " tensors.");
     }
-    chunks_.pop_front();
+    const int64_t length = chunk.front().dim_size(0);
+    for (int i = 0; i < num_data_tensors_; i++) {
+      TF_RETURN_IF_ERROR(
+          CopyTensorRowsInto(chunk[i], 0, length, output_row, &outputs[i]));
+    }
+    output_row += length;
+    chunk.clear();
   }
+  next_chunk_index_ = chunks_.size();
+
+  std::move(outputs.begin(), outputs.end(), sequences.begin() + 4);
+  std::swap(sequences, *data);
 
-  // Concatenate all chunks.
-  int64_t i = 4;
-  for (const auto& chunks : data_tensors) {
-    TF_RETURN_IF_ERROR(tensorflow::tensor::Concat(chunks, &sequences[i++]));
+  return tensorflow::Status::OK();
+}
+
+void Sample::PrepareBatch(int64_t batch_size,
+                          std::vector<tensorflow::Tensor>* batch,
+                          tensorflow::Allocator* allocator) const {
+  REVERB_CHECK(!is_end_of_sample()) << "Sample has already been consumed.";
+  if (allocator == nullptr) allocator = tensorflow::cpu_allocator();
+
+  batch->resize(num_data_tensors_ + 4);
+
+  const tensorflow::TensorShape metadata_shape({batch_size});
+  ReuseOrAllocateTensor(tensorflow::DT_UINT64, metadata_shape, allocator,
+                        &(*batch)[0]);
+  ReuseOrAllocateTensor(tensorflow::DT_DOUBLE, metadata_shape, allocator,
+                        &(*batch)[1]);
+  ReuseOrAllocateTensor(tensorflow::DT_INT64, metadata_shape, allocator,
+                        &(*batch)[2]);
+  ReuseOrAllocateTensor(tensorflow::DT_DOUBLE, metadata_shape, allocator,
+                        &(*batch)[3]);
+
+  const auto& chunk = chunks_[next_chunk_index_];
+  for (int i = 0; i < num_data_tensors_; i++) {
+    tensorflow::TensorShape shape = chunk[i].shape();
+    shape.set_dim(0, num_timesteps_);
+    shape.InsertDim(0, batch_size);
+    ReuseOrAllocateTensor(chunk[i].dtype(), shape, allocator,
+                          &(*batch)[i + 4]);
   }
+}
 
-  std::swap(sequences, *data);
+tensorflow::Status Sample::CopyIntoBatch(
+    int64_t index, std::vector<tensorflow::Tensor>* batch) {
+  if (next_timestep_called_ || is_end_of_sample()) {
+    return tensorflow::errors::DataLoss(
+        "Sample::CopyIntoBatch: Some time steps have been lost.");
+  }
+  if (batch->size() != num_data_tensors_ + 4) {
+    return tensorflow::errors::InvalidArgument(
+        "Batch has ", batch->size(), " tensors but sample requires ",
+        num_data_tensors_ + 4, ".");
+  }
+
+  // View each data tensor as [batch_size * N, ...] so that the time steps can
+  // be copied using row offsets. The views share the buffers of `batch`.
+  std::vector<tensorflow::Tensor> rows(num_data_tensors_);
+  for (int i = 0; i < num_data_tensors_; i++) {
+    const auto& src = chunks_.front()[i];
+    const auto& dst = (*batch)[i + 4];
+    tensorflow::TensorShape row_shape = src.shape();
+    row_shape.set_dim(0, dst.dims() > 1 ? dst.dim_size(0) * dst.dim_size(1)
+                                        : 0);
+    if (dst.dtype() != src.dtype() || dst.dims() != src.dims() + 1 ||
+        dst.dim_size(1) != num_timesteps_ || index >= dst.dim_size(0) ||
+        !rows[i].CopyFrom(dst, row_shape)) {
+      return tensorflow::errors::InvalidArgument(
+          "Sample of length ", num_timesteps_, " with tensor (",
+          tensorflow::DataTypeString(src.dtype()), ", ",
+          src.shape().DebugString(), ") at index ", i,
+          " cannot be copied into row ", index, " of batch tensor (",
+          tensorflow::DataTypeString(dst.dtype()), ", ",
+          dst.shape().DebugString(),
+          "). All samples of a batch must have the same length.");
+    }
+  }
+
+  (*batch)[0].flat<tensorflow::uint64>()(index) = key_;
+  (*batch)[1].flat<double>()(index) = probability_;
+  (*batch)[2].flat<tensorflow::int64>()(index) = table_size_;
+  (*batch)[3].flat<double>()(index) = priority_;
+
+  int64_t output_row = index * num_timesteps_;
+  for (auto& chunk : chunks_) {
+    const int64_t length = chunk.front().dim_size(0);
+    for (int i = 0; i < num_data_tensors_; i++) {
+      TF_RETURN_IF_ERROR(
+          CopyTensorRowsInto(chunk[i], 0, length, output_row, &rows[i]));
+    }
+    output_row += length;
+    chunk.clear();
+  }
+  next_chunk_index_ = chunks_.size();
 
   return tensorflow::Status::OK();
 }
@@ -769,6 +1950,24 @@ tensorflow::Status Sampler::Options::Validate() const {
         "flexible_batch_size (", flexible_batch_size, ") must be ",
         kAutoSelectValue, " or >= 1");
   }
+  if (max_response_bytes < 0 && max_response_bytes != kAutoSelectValue) {
+    return tensorflow::errors::InvalidArgument(
+        "max_response_bytes (", max_response_bytes, ") must be ",
+        kAutoSelectValue, " or >= 0");
+  }
+  if (chunk_cache_bytes < 0) {
+    return tensorflow::errors::InvalidArgument(
+        "chunk_cache_bytes (", chunk_cache_bytes, ") must be >= 0");
+  }
+  if (num_decode_threads < 0) {
+    return tensorflow::errors::InvalidArgument(
+        "num_decode_threads (", num_decode_threads, ") must be >= 0");
+  }
+  if (server_info_poll_interval <= absl::ZeroDuration()) {
+    return tensorflow::errors::InvalidArgument(
+        "server_info_poll_interval (", server_info_poll_interval,
+        ") must be > 0");
+  }
   return tensorflow::Status::OK();
 }
 
@@ -17,18 +17,26 @@
 
 #include <stddef.h>
 
-#include <list>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <cstdint>
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
+#include "reverb/cc/chunk_cache.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/sampler_autotuner.h"
+#include "reverb/cc/sampler_stats.h"
+#include "reverb/cc/schema.pb.h"
 #include "reverb/cc/support/queue.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/thread_pool.h"
 #include "reverb/cc/table.h"
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -54,10 +62,13 @@ class Sample {
  public:
   Sample(tensorflow::uint64 key, double probability,
          tensorflow::int64 table_size, double priority,
-         std::list<std::vector<tensorflow::Tensor>> chunks);
+         std::vector<std::vector<tensorflow::Tensor>> chunks);
 
   // Returns the next time step from this sample as a flat sequence of tensors.
-  // CHECK-fails if the entire sample has already been returned.
+  // CHECK-fails if the entire sample has already been returned. The data
+  // tensors are views of the chunk tensors unless the time step isn't aligned
+  // in memory, in which case it is copied. The metadata tensors are shared by
+  // all time steps of the sample.
   std::vector<tensorflow::Tensor> GetNextTimestep();
 
   // Returns the entire sample as a flat sequence of batched tensors.
@@ -70,9 +81,32 @@ class Sample {
   //   size and priority respectively.
   tensorflow::Status AsBatchedTimesteps(std::vector<tensorflow::Tensor>* data);
 
+  // Ensures that `batch` holds K+4 tensors with room for `batch_size` samples
+  // of the same signature and length as this one. The first four tensors have
+  // shape [batch_size] and hold the key, probability, table size and priority.
+  // The following K tensors have shape [batch_size, N, ...original_shape].
+  // Tensors already in `batch` are reused if they have the expected dtype and
+  // shape and are not referenced by anyone else. Otherwise new tensors are
+  // allocated from `allocator`, or from the CPU allocator if it is null.
+  void PrepareBatch(int64_t batch_size, std::vector<tensorflow::Tensor>* batch,
+                    tensorflow::Allocator* allocator = nullptr) const;
+
+  // Copies the entire sample into row `index` of `batch` (see
+  // `PrepareBatch`). Returns InvalidArgument if the length or signature of the
+  // sample does not match `batch`. Returns DataLoss if `GetNextTimestep()` has
+  // already been called on this sample.
+  tensorflow::Status CopyIntoBatch(int64_t index,
+                                   std::vector<tensorflow::Tensor>* batch);
+
   // Returns true if the end of the sample has been reached.
   ABSL_MUST_USE_RESULT bool is_end_of_sample() const;
 
+  // Total number of time steps in this sample.
+  int64_t num_timesteps() const { return num_timesteps_; }
+
+  // Time at which the sample was constructed, i.e when it was decoded.
+  absl::Time ready_time() const { return ready_time_; }
+
  private:
   // The key of the replay item this time step was sampled from.
   tensorflow::uint64 key_;
@@ -90,14 +124,45 @@ class Sample {
   // Number of data tensors per time step.
   int64_t num_data_tensors_;
 
-  // A list of tensor chunks.
-  std::list<std::vector<tensorflow::Tensor>> chunks_;
+  // The tensor chunks of the sample. The tensors of the chunks before
+  // `next_chunk_index_` have been returned and released.
+  std::vector<std::vector<tensorflow::Tensor>> chunks_;
+
+  // The chunk which holds the next time step to return.
+  int64_t next_chunk_index_;
 
-  // The next time step to return when GetNextTimestep() is called.
+  // The next time step (within the chunk) to return when GetNextTimestep() is
+  // called.
   int64_t next_timestep_index_;
 
+  // Scalar key, probability, table size and priority tensors returned with
+  // every time step. Created by the first call to GetNextTimestep().
+  std::vector<tensorflow::Tensor> timestep_metadata_;
+
   // True if GetNextTimestep() has been called on this sample.
   bool next_timestep_called_;
+
+  // Time at which the sample was constructed.
+  absl::Time ready_time_;
+};
+
+// Priority updates and deletions queued through `Sampler::MutatePriorities`
+// until a worker applies them together with its next batch. Thread safe.
+class SamplerMutations {
+ public:
+  // Appends `updates` and `deletes` to the queued mutations.
+  void Add(const std::vector<KeyWithPriority>& updates,
+           const std::vector<uint64_t>& deletes) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Moves the queued mutations into `updates` and `deletes` and empties the
+  // queue. Returns false if nothing was queued.
+  bool Take(std::vector<KeyWithPriority>* updates,
+            std::vector<uint64_t>* deletes) ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  absl::Mutex mu_;
+  std::vector<KeyWithPriority> updates_ ABSL_GUARDED_BY(mu_);
+  std::vector<uint64_t> deletes_ ABSL_GUARDED_BY(mu_);
 };
 
 // SamplerWorker implements strategy for fetching samples from table.
@@ -166,7 +231,9 @@ class Sampler {
   // caused by a non uniform number of SampleStream-connections across the
   // servers being maintained for a longer period. The same phenomenon is
   // present with more short lived connections but is mitigated by the round
-  // robin of the (more) frequently created new connections.
+  // robin of the (more) frequently created new connections. Samplers which
+  // are constructed with a stub per server don't reconnect at all and instead
+  // spread their requests according to the load of the servers.
   // TODO(b/147425281): Set this value higher for localhost connections.
   static const int kDefaultMaxSamplesPerStream = 10000;
 
@@ -177,6 +244,15 @@ class Sampler {
   // By default samples are fetched one by one.
   static const int kDefaultFlexibleBatchSize = 1;
 
+  // By default the server packs chunks into responses of up to 1MB. Smaller
+  // responses increase the per message overhead of gRPC while larger responses
+  // delay the first sample of the response.
+  static const int64_t kDefaultMaxResponseBytes = 1 << 20;
+
+  // Upper bound of the flexible batch size chosen when `Options::autotune` is
+  // set and `Options::flexible_batch_size` is auto selected.
+  static const int kDefaultAutotuneMaxFlexibleBatchSize = 16;
+
   struct Options {
     // `max_samples` is the maximum number of samples the object will return.
     // Must be a positive number or `kUnlimitedMaxSamples`.
@@ -222,6 +298,92 @@ class Sampler {
     // When set to `kAutoSelectValue`, `kDefaultFlexibleBatchSize` is used.
     int flexible_batch_size = kAutoSelectValue;
 
+    // `without_replacement` makes the items of each flexible batch distinct,
+    // which avoids duplicates when sampling small or highly skewed
+    // prioritized tables. Batches can then be smaller than
+    // `flexible_batch_size`, e.g a single item for FIFO or heap selectors (see
+    // `Table::SampleFlexibleBatch`). Over gRPC, chunks which are shared by
+    // several items of a batch are only sent once.
+    bool without_replacement = false;
+
+    // `chunk_cache_bytes` is the maximum total size of the decompressed chunks
+    // which are cached and shared by the workers. Items which overlap
+    // reference the same chunks so with the cache each chunk is decompressed
+    // once rather than once per sample. The time steps of the cached chunks
+    // are still copied into every sample.
+    //
+    // When set to 0 the cache is disabled and only the time steps which are
+    // part of a sample are decompressed.
+    int64_t chunk_cache_bytes = 0;
+
+    // `max_response_bytes` is the size up to which the server packs the chunks
+    // of consecutive samples into a single response. Packing reduces the per
+    // message overhead when the chunks are small. Single chunks larger than
+    // the limit are still sent. When set to 0 every chunk is sent as a
+    // separate response.
+    //
+    // When set to `kAutoSelectValue`, `kDefaultMaxResponseBytes` is used. Only
+    // used when sampling over gRPC.
+    int64_t max_response_bytes = kAutoSelectValue;
+
+    // `shared_memory` makes the server pass (large) chunks through shared
+    // memory rather than through the gRPC stream. Must only be set if the
+    // server has confirmed that it supports this (see `InitializeConnection`),
+    // which is done by `Client::NewSampler`. Only used when sampling over gRPC.
+    bool shared_memory = false;
+
+    // `num_decode_threads` is the number of threads, shared by all workers,
+    // which decompress and decode the samples received over gRPC. With
+    // decode threads the workers keep reading their streams while earlier
+    // samples are decoded, which matters when a single worker (e.g for FIFO
+    // tables) would otherwise be bound by decompressing large chunks. Samples
+    // are still returned in the order in which a worker received them.
+    //
+    // When set to 0, samples are decoded by the thread reading the stream.
+    // Only used when sampling over gRPC.
+    int num_decode_threads = 0;
+
+    // `autotune` makes the workers pick the number of samples to request at a
+    // time and the flexible batch size of the requests from the rate at which
+    // samples are consumed and the round trip time of the requests (see
+    // `SamplerAutotuner`). `max_in_flight_samples_per_worker` and
+    // `flexible_batch_size` (or `kDefaultAutotuneMaxFlexibleBatchSize` if auto
+    // selected) then act as upper bounds, which also bounds the memory held
+    // by samples in flight. The chosen values are exported through
+    // `autotune_stats`. Only used when sampling over gRPC.
+    bool autotune = false;
+
+    // `server_info_poll_interval` is how often the `TableInfo` of the table is
+    // polled from every server by a `Sampler` which samples from multiple
+    // servers. The info is used to spread the requests across the servers.
+    // Unused by other samplers.
+    absl::Duration server_info_poll_interval = absl::Seconds(1);
+
+    // `worker_executor` runs the loops of the workers instead of a dedicated
+    // thread per worker when set. Sharing an executor between the samplers of
+    // a process bounds the number of threads they use in total, but a worker
+    // only starts fetching samples once a thread of the executor is available
+    // so it should have enough threads for all the workers which are expected
+    // to be active at the same time.
+    std::shared_ptr<internal::Executor> worker_executor;
+
+    // `output_allocator` allocates the tensors of the decoded samples and of
+    // the batches returned by `GetNextBatch`, e.g a pinned host allocator so
+    // that the samples can be copied to an accelerator without first being
+    // staged in pinned memory. The tensors of the chunk cache and the
+    // metadata of single time steps are still allocated on the CPU. Must
+    // outlive the `Sampler` and free buffers from any thread.
+    //
+    // When null, the CPU allocator is used.
+    tensorflow::Allocator* output_allocator = nullptr;
+
+    // `priority_class` is the class of the streams opened by the workers on
+    // servers which schedule streams by priority class (see
+    // `ReverbServiceImpl::Options::stream_classes`). Servers put the streams
+    // of unknown classes, or without a class when empty, in their default
+    // class. Only used when sampling over gRPC.
+    std::string priority_class;
+
     // Checks that field values are valid and returns `InvalidArgument` if any
     // field value invalid.
     tensorflow::Status Validate() const;
@@ -237,6 +399,38 @@ class Sampler {
           const std::string& table_name, const Options& options,
           internal::DtypesAndShapes dtypes_and_shapes = absl::nullopt);
 
+  // Constructs a new `Sampler` which samples from several tables of the same
+  // server over a single gRPC stream per worker.
+  //
+  // `stub` is a connected gRPC stub to the ReverbService.
+  // `tables` holds the names of the tables and the weights in proportion to
+  //   which the server mixes their samples (see `SampleStreamRequest.tables`).
+  //   Must not be empty.
+  // `options` defines details of how to samples.
+  // `dtypes_and_shapes` describes the output signature (if any) to expect,
+  //   which all the tables must share.
+  Sampler(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+          const std::vector<TableWeight>& tables, const Options& options,
+          internal::DtypesAndShapes dtypes_and_shapes = absl::nullopt);
+
+  // Constructs a new `Sampler` which samples from multiple servers over gRPC.
+  //
+  // `stubs` holds one connected gRPC stub per server. Every worker keeps a
+  // stream to each of the servers open for the lifetime of the sampler and
+  // sends each request to a server picked at random in proportion to the
+  // total priority (or size) of its table, and away from servers whose rate
+  // limiter is blocking samples, as reported by periodic `ServerInfo` calls.
+  // Streams are only reopened after errors so `Options::max_samples_per_stream`
+  // has no effect.
+  // `table_name` is the name of the `Table` to sample from.
+  // `options` defines details of how to samples.
+  // `dtypes_and_shapes` describes the output signature (if any) to expect.
+  Sampler(
+      std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+          stubs,
+      const std::string& table_name, const Options& options,
+      internal::DtypesAndShapes dtypes_and_shapes = absl::nullopt);
+
   // Constructs a new `Sampler` which samples directly from local `table`.
   //
   // `table` is the table to sample from.
@@ -257,18 +451,67 @@ class Sampler {
   // error is encountered or `Close` has been called.
   tensorflow::Status GetNextSample(std::vector<tensorflow::Tensor>* data);
 
+  // Blocks until `batch_size` complete samples have been retrieved and writes
+  // them into `data` using the layout described in `Sample::PrepareBatch`. All
+  // samples of the batch must have the same length. Tensors passed in through
+  // `data` are reused when possible so callers which keep the vector between
+  // calls avoid allocating new batches. If `max_samples` is reached, or the
+  // rate limiter times out, before the batch is full then the samples received
+  // so far are returned as a smaller batch.
+  tensorflow::Status GetNextBatch(int64_t batch_size,
+                                  std::vector<tensorflow::Tensor>* data);
+
   // Cancels all workers and joins their threads. Any blocking or future call
-  // to `GetNextTimestep` or `GetNextSample` will return CancelledError without
-  // blocking.
+  // to `GetNextTimestep`, `GetNextSample` or `GetNextBatch` will return
+  // CancelledError without blocking.
   void Close();
 
+  // Returns the counters of the chunk cache. All counters are zero if the
+  // cache is disabled (see `Options::chunk_cache_bytes`).
+  ChunkCache::Stats chunk_cache_stats() const;
+
+  // Returns the values chosen by the autotuner and the observations they are
+  // based on. All values are zero unless `Options::autotune` is set.
+  SamplerAutotuner::Stats autotune_stats() const;
+
+  // Returns the latency of the stages which the samples pass through and the
+  // throughput of the workers. Meant for diagnosing a consumer which is
+  // starved of samples.
+  SamplerStats stats() const;
+
+  // Queues priority updates and deletions of items of the table. Rather than
+  // through a separate `MutatePriorities` call, they are sent with the next
+  // request of a worker (see `SampleStreamRequest.priority_updates`) and
+  // applied under the same table lock as the first batch of that request.
+  // Mutations are therefore only applied once a worker needs more samples,
+  // and are dropped if the request carrying them fails or if no further
+  // request is sent before `Close`. Local samplers apply them with the next
+  // batch sampled from the table in the same way.
+  //
+  // Returns FailedPrecondition for samplers of several tables or servers,
+  // where the table holding a key is ambiguous, and Cancelled after `Close`.
+  tensorflow::Status MutatePriorities(
+      const std::vector<KeyWithPriority>& updates,
+      const std::vector<uint64_t>& deletes);
+
   // Sampler is neither copyable nor movable.
   Sampler(const Sampler&) = delete;
   Sampler& operator=(const Sampler&) = delete;
 
  private:
-  Sampler(std::vector<std::unique_ptr<SamplerWorker>>, const std::string& table,
-          const Options& options, internal::DtypesAndShapes dtypes_and_shapes);
+  // Creates the workers of the sampler. The arguments are the chunk cache, the
+  // decode pool, the autotuner and the queued mutations to be shared by the
+  // workers, or nullptr if disabled, and the recorder of the stats.
+  using WorkerFactory =
+      std::function<std::vector<std::unique_ptr<SamplerWorker>>(
+          ChunkCache*, internal::ThreadPool*, SamplerAutotuner*,
+          SamplerMutations*, SamplerStatsRecorder*)>;
+
+  // `mutable_items` is false if the workers can't send the mutations of
+  // `MutatePriorities`, in which case the factory is passed nullptr for them.
+  Sampler(const WorkerFactory& make_workers, const std::string& table,
+          const Options& options, internal::DtypesAndShapes dtypes_and_shapes,
+          bool mutable_items);
 
   // Validates the `data` vector against `dtypes_and_shapes`.
   //
@@ -325,6 +568,32 @@ class Sampler {
   // `GetNextTimestep`.
   int64_t returned_ ABSL_GUARDED_BY(mu_) = 0;
 
+  // Decompressed chunks shared by the workers. Null if the cache is disabled.
+  // Must outlive `workers_`.
+  std::unique_ptr<ChunkCache> chunk_cache_;
+
+  // Threads which decode the samples received by the workers. Null if
+  // `Options::num_decode_threads` is 0. Must outlive `workers_`.
+  std::unique_ptr<internal::ThreadPool> decode_pool_;
+
+  // Tunes the requests of the workers if `Options::autotune` is set,
+  // otherwise null. Must outlive `workers_`.
+  std::unique_ptr<SamplerAutotuner> autotuner_;
+
+  // Mutations queued by `MutatePriorities` until a worker sends them. Null if
+  // the workers can't send them. Must outlive `workers_`.
+  std::unique_ptr<SamplerMutations> mutations_;
+
+  // Latency and throughput of the sampler. Must outlive `workers_`.
+  SamplerStatsRecorder stats_;
+
+  // Runs `worker_threads_` if `Options::worker_executor` is set, otherwise
+  // null. Must outlive `worker_threads_`.
+  std::shared_ptr<internal::Executor> worker_executor_;
+
+  // Allocates the tensors of the samples and batches. Never null.
+  tensorflow::Allocator* const output_allocator_;
+
   // Workers and threads managing the worker with the same index.
   std::vector<std::unique_ptr<SamplerWorker>> workers_;
   std::vector<std::unique_ptr<internal::Thread>> worker_threads_;
@@ -341,9 +610,10 @@ class Sampler {
   internal::Queue<std::unique_ptr<Sample>> samples_;
 
   // The dtypes and shapes users expect from either `GetNextTimestep` or
-  // `GetNextSample` (whichever they plan to call).  May be absl::nullopt,
-  // meaning unknown.
-  const internal::DtypesAndShapes dtypes_and_shapes_;
+  // `GetNextSample` (whichever they plan to call), compiled once so that every
+  // timestep and sample is checked without allocating. May be null, meaning
+  // unknown.
+  const std::unique_ptr<const internal::SignatureValidator> validator_;
   const internal::DtypesAndShapes dtypes_and_shapes_for_sequence_;
 
   // Set if `Close` called.
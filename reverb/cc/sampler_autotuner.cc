@@ -0,0 +1,131 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/sampler_autotuner.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Weight of a new observation in the smoothed values.
+constexpr double kSmoothing = 0.25;
+
+// Minimum duration over which pops are counted to estimate the pop rate.
+constexpr absl::Duration kRateWindow = absl::Milliseconds(100);
+
+// Factor by which the window exceeds the samples consumed during a round trip.
+constexpr double kHeadroom = 2;
+
+// The flexible batch size is chosen so that a full window is sampled in about
+// this many table lock acquisitions.
+constexpr int kLockAcquisitionsPerWindow = 4;
+
+double Smooth(double current, double observed) {
+  return current == 0 ? observed
+                      : (1 - kSmoothing) * current + kSmoothing * observed;
+}
+
+}  // namespace
+
+SamplerAutotuner::SamplerAutotuner(int64_t max_in_flight_samples_per_worker,
+                                   int max_flexible_batch_size)
+    : max_window_(max_in_flight_samples_per_worker),
+      max_flexible_batch_size_(max_flexible_batch_size) {
+  REVERB_CHECK_GE(max_window_, 1);
+  REVERB_CHECK_GE(max_flexible_batch_size_, 1);
+  absl::MutexLock lock(&mu_);
+  stats_.max_in_flight_samples_per_worker = max_window_;
+  UpdateLocked();
+}
+
+void SamplerAutotuner::RecordPop(absl::Time now, int queue_size) {
+  absl::MutexLock lock(&mu_);
+  if (queue_size == 0) {
+    ++stats_.consumer_waits;
+    ++waits_since_update_;
+  }
+  stats_.queue_depth = Smooth(stats_.queue_depth, queue_size);
+
+  // The first pop only marks the start of the first window.
+  if (rate_window_start_ == absl::InfinitePast()) {
+    rate_window_start_ = now;
+    return;
+  }
+  ++pops_in_rate_window_;
+  const absl::Duration elapsed = now - rate_window_start_;
+  if (elapsed >= kRateWindow) {
+    stats_.samples_per_second =
+        Smooth(stats_.samples_per_second,
+               pops_in_rate_window_ / absl::ToDoubleSeconds(elapsed));
+    pops_in_rate_window_ = 0;
+    rate_window_start_ = now;
+  }
+}
+
+void SamplerAutotuner::RecordRequest(int64_t num_samples,
+                                     absl::Duration round_trip) {
+  if (num_samples <= 0) return;
+  absl::MutexLock lock(&mu_);
+  stats_.round_trip_time =
+      stats_.round_trip_time == absl::ZeroDuration()
+          ? round_trip
+          : (1 - kSmoothing) * stats_.round_trip_time + kSmoothing * round_trip;
+  UpdateLocked();
+}
+
+void SamplerAutotuner::UpdateLocked() {
+  int64_t window = stats_.max_in_flight_samples_per_worker;
+
+  // Without an estimate of the pop rate the window is left as is.
+  if (stats_.samples_per_second > 0) {
+    const auto target = static_cast<int64_t>(
+        std::ceil(stats_.samples_per_second *
+                  absl::ToDoubleSeconds(stats_.round_trip_time) * kHeadroom));
+    window = std::max(target, window / 2);
+  }
+  if (waits_since_update_ > 0) {
+    window = std::max(window, 2 * stats_.max_in_flight_samples_per_worker);
+  }
+  waits_since_update_ = 0;
+
+  stats_.max_in_flight_samples_per_worker =
+      std::clamp<int64_t>(window, 1, max_window_);
+  stats_.flexible_batch_size = static_cast<int>(std::clamp<int64_t>(
+      (stats_.max_in_flight_samples_per_worker + kLockAcquisitionsPerWindow -
+       1) / kLockAcquisitionsPerWindow,
+      1, max_flexible_batch_size_));
+}
+
+int64_t SamplerAutotuner::max_in_flight_samples_per_worker() const {
+  absl::MutexLock lock(&mu_);
+  return stats_.max_in_flight_samples_per_worker;
+}
+
+int SamplerAutotuner::flexible_batch_size() const {
+  absl::MutexLock lock(&mu_);
+  return stats_.flexible_batch_size;
+}
+
+SamplerAutotuner::Stats SamplerAutotuner::stats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,103 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SAMPLER_AUTOTUNER_H_
+#define REVERB_CC_SAMPLER_AUTOTUNER_H_
+
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Picks the number of samples which the workers of a `Sampler` request at a
+// time (their in-flight window) and the flexible batch size of the requests.
+//
+// The window is sized so that the samples in flight cover the round trip of a
+// request at the rate at which the consumer pops samples, with some headroom.
+// If the consumer finds the queue of samples empty then the window is doubled,
+// and it is never shrunk by more than half at a time. The flexible batch size
+// follows the window so that a request is served in a few table lock
+// acquisitions. Both values are bounded by the limits passed on construction,
+// which thus bound the memory used by samples in flight.
+//
+// All public methods are thread safe.
+class SamplerAutotuner {
+ public:
+  struct Stats {
+    // The values currently chosen by the autotuner.
+    int64_t max_in_flight_samples_per_worker = 0;
+    int flexible_batch_size = 0;
+
+    // Smoothed rate at which the consumer pops samples.
+    double samples_per_second = 0;
+
+    // Smoothed time between sending a request and receiving its last sample.
+    absl::Duration round_trip_time = absl::ZeroDuration();
+
+    // Smoothed number of samples in the queue when the consumer pops one.
+    double queue_depth = 0;
+
+    // Number of pops which found the queue empty and thus had to wait.
+    int64_t consumer_waits = 0;
+  };
+
+  // `max_in_flight_samples_per_worker` and `max_flexible_batch_size` are the
+  // largest values which may be chosen. Both must be >= 1. Starts out using the
+  // largest window.
+  SamplerAutotuner(int64_t max_in_flight_samples_per_worker,
+                   int max_flexible_batch_size);
+
+  // Records that the consumer popped a sample at `now` from a queue which held
+  // `queue_size` samples (before the pop).
+  void RecordPop(absl::Time now, int queue_size) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records that a request of `num_samples` samples completed `round_trip`
+  // after it was sent and updates the chosen values.
+  void RecordRequest(int64_t num_samples, absl::Duration round_trip)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // The number of samples a worker should request next.
+  int64_t max_in_flight_samples_per_worker() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // The flexible batch size of the next request.
+  int flexible_batch_size() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  Stats stats() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  void UpdateLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const int64_t max_window_;
+  const int max_flexible_batch_size_;
+
+  mutable absl::Mutex mu_;
+  Stats stats_ ABSL_GUARDED_BY(mu_);
+
+  // Pops since `rate_window_start_`, which are turned into a rate sample once
+  // the window is long enough to smooth out bursts.
+  int64_t pops_in_rate_window_ ABSL_GUARDED_BY(mu_) = 0;
+  absl::Time rate_window_start_ ABSL_GUARDED_BY(mu_) = absl::InfinitePast();
+
+  // Number of pops which found the queue empty since the last update.
+  int64_t waits_since_update_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SAMPLER_AUTOTUNER_H_
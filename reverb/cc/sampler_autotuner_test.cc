@@ -0,0 +1,106 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/sampler_autotuner.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Pops `num_pops` samples evenly over `duration` starting at `*now`, which is
+// advanced to the end of the period. The queue is never found empty.
+void PopAtRate(SamplerAutotuner* autotuner, int num_pops,
+               absl::Duration duration, absl::Time* now) {
+  for (int i = 0; i < num_pops; i++) {
+    *now += duration / num_pops;
+    autotuner->RecordPop(*now, /*queue_size=*/1);
+  }
+}
+
+TEST(SamplerAutotunerTest, StartsWithLargestWindow) {
+  SamplerAutotuner autotuner(100, 16);
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 100);
+  EXPECT_EQ(autotuner.flexible_batch_size(), 16);
+}
+
+TEST(SamplerAutotunerTest, KeepsWindowWithoutPopRate) {
+  SamplerAutotuner autotuner(100, 16);
+  autotuner.RecordRequest(100, absl::Milliseconds(10));
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 100);
+}
+
+TEST(SamplerAutotunerTest, ShrinksWindowToCoverRoundTrip) {
+  SamplerAutotuner autotuner(100, 16);
+  absl::Time now = absl::UnixEpoch();
+
+  // 1000 samples per second with a round trip of 10ms gives a target of 20
+  // samples including the headroom. The window is halved at most per update.
+  PopAtRate(&autotuner, 200, absl::Milliseconds(200), &now);
+  autotuner.RecordRequest(100, absl::Milliseconds(10));
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 50);
+  autotuner.RecordRequest(50, absl::Milliseconds(10));
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 25);
+  autotuner.RecordRequest(25, absl::Milliseconds(10));
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 20);
+  autotuner.RecordRequest(20, absl::Milliseconds(10));
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 20);
+  EXPECT_EQ(autotuner.flexible_batch_size(), 5);
+
+  auto stats = autotuner.stats();
+  EXPECT_NEAR(stats.samples_per_second, 1000, 1);
+  EXPECT_EQ(stats.round_trip_time, absl::Milliseconds(10));
+  EXPECT_EQ(stats.consumer_waits, 0);
+}
+
+TEST(SamplerAutotunerTest, GrowsWindowWhenConsumerWaits) {
+  SamplerAutotuner autotuner(100, 16);
+  absl::Time now = absl::UnixEpoch();
+  PopAtRate(&autotuner, 200, absl::Milliseconds(200), &now);
+  for (int i = 0; i < 4; i++) {
+    autotuner.RecordRequest(10, absl::Milliseconds(10));
+  }
+  ASSERT_EQ(autotuner.max_in_flight_samples_per_worker(), 20);
+
+  autotuner.RecordPop(now, /*queue_size=*/0);
+  autotuner.RecordRequest(20, absl::Milliseconds(10));
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 40);
+  EXPECT_EQ(autotuner.stats().consumer_waits, 1);
+
+  // The window never exceeds the limit.
+  for (int i = 0; i < 4; i++) {
+    autotuner.RecordPop(now, /*queue_size=*/0);
+    autotuner.RecordRequest(20, absl::Milliseconds(10));
+  }
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 100);
+  EXPECT_EQ(autotuner.flexible_batch_size(), 16);
+}
+
+TEST(SamplerAutotunerTest, WindowIsAtLeastOne) {
+  SamplerAutotuner autotuner(8, 4);
+  absl::Time now = absl::UnixEpoch();
+  PopAtRate(&autotuner, 2, absl::Seconds(10), &now);
+  for (int i = 0; i < 10; i++) {
+    autotuner.RecordRequest(1, absl::Milliseconds(1));
+  }
+  EXPECT_EQ(autotuner.max_in_flight_samples_per_worker(), 1);
+  EXPECT_EQ(autotuner.flexible_batch_size(), 1);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
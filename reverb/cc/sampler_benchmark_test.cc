@@ -0,0 +1,202 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the sampling throughput over gRPC with and without packing the
+// chunks of several samples into a single `SampleStreamResponse`, for small
+// chunks (where the per message overhead dominates) and large chunks. Also
+// measures how long it takes to assemble the decoded chunks of a `Sample` into
+// sequences, batches and time steps for sequence lengths from 1 to 500. The
+// tests are tagged as manual and have to be run explicitly:
+//
+//   bazel test -c opt //reverb/cc:sampler_benchmark_test \
+//     --test_output=streamed
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/client.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/net.h"
+#include "reverb/cc/platform/server.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/writer.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr int kNumItems = 1000;
+constexpr int kNumSamples = 20000;
+
+struct Workload {
+  std::string name;
+  tensorflow::TensorShape step_shape;
+  tensorflow::DataType dtype;
+  int chunk_length;
+  int item_length;
+};
+
+std::vector<Workload> Workloads() {
+  return {
+      {"small_chunks(state[4],chunk_length=1)",
+       tensorflow::TensorShape({4}), tensorflow::DT_FLOAT, 1, 2},
+      {"large_chunks(frames[84,84],chunk_length=10)",
+       tensorflow::TensorShape({84, 84}), tensorflow::DT_UINT8, 10, 10},
+  };
+}
+
+std::shared_ptr<Table> MakeTable() {
+  return std::make_shared<Table>(
+      "table", std::make_shared<UniformSelector>(),
+      std::make_shared<FifoSelector>(), /*max_size=*/kNumItems,
+      /*max_times_sampled=*/0,
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-DBL_MAX,
+                                    /*max_diff=*/DBL_MAX));
+}
+
+void InsertItems(Client* client, const Workload& workload) {
+  std::unique_ptr<Writer> writer;
+  TF_ASSERT_OK(client->NewWriter(workload.chunk_length, workload.item_length,
+                                 /*delta_encoded=*/false, &writer));
+  tensorflow::Tensor step(workload.dtype, workload.step_shape);
+  for (int i = 0; i < kNumItems * workload.item_length; i++) {
+    TF_ASSERT_OK(writer->Append({step}));
+    if ((i + 1) % workload.item_length == 0) {
+      TF_ASSERT_OK(writer->CreateItem("table", workload.item_length, 1.0));
+    }
+  }
+  TF_ASSERT_OK(writer->Close());
+}
+
+double SamplesPerSecond(Client* client, int64_t max_response_bytes) {
+  Sampler::Options options;
+  options.max_samples = kNumSamples;
+  options.max_in_flight_samples_per_worker = 100;
+  options.num_workers = 1;
+  options.max_response_bytes = max_response_bytes;
+  std::unique_ptr<Sampler> sampler;
+  TF_EXPECT_OK(
+      client->NewSampler("table", options, absl::Seconds(10), &sampler));
+
+  const absl::Time start = absl::Now();
+  for (int i = 0; i < kNumSamples; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    TF_EXPECT_OK(sampler->GetNextSample(&sample));
+  }
+  return kNumSamples / absl::ToDoubleSeconds(absl::Now() - start);
+}
+
+// Makes a sample of `length` time steps of `step_shape` which is split into
+// chunks of (at most) `chunk_length` time steps.
+std::unique_ptr<Sample> MakeSample(const tensorflow::TensorShape& step_shape,
+                                   int length, int chunk_length) {
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  for (int start = 0; start < length; start += chunk_length) {
+    tensorflow::TensorShape shape = step_shape;
+    shape.InsertDim(0, std::min(chunk_length, length - start));
+    tensorflow::Tensor tensor(tensorflow::DT_FLOAT, shape);
+    tensor.flat<float>().setZero();
+    chunks.push_back({std::move(tensor)});
+  }
+  return absl::make_unique<Sample>(/*key=*/1, /*probability=*/1,
+                                   /*table_size=*/1, /*priority=*/1,
+                                   std::move(chunks));
+}
+
+// Returns the average time it takes `assemble` to consume a sample of `length`
+// time steps split into chunks of `chunk_length` time steps.
+absl::Duration TimePerSample(
+    int length, int chunk_length,
+    const std::function<void(Sample*)>& assemble) {
+  const tensorflow::TensorShape step_shape({84, 84});
+  constexpr int kNumAssembledSamples = 200;
+  absl::Duration total;
+  for (int i = 0; i < kNumAssembledSamples; i++) {
+    auto sample = MakeSample(step_shape, length, chunk_length);
+    const absl::Time start = absl::Now();
+    assemble(sample.get());
+    total += absl::Now() - start;
+  }
+  return total / kNumAssembledSamples;
+}
+
+TEST(SamplerBenchmark, SampleAssembly) {
+  for (int length : {1, 10, 50, 100, 500}) {
+    for (int chunk_length : {length, 10}) {
+      if (chunk_length > length) continue;
+      const absl::Duration sequence =
+          TimePerSample(length, chunk_length, [](Sample* sample) {
+            std::vector<tensorflow::Tensor> data;
+            TF_EXPECT_OK(sample->AsBatchedTimesteps(&data));
+          });
+      const absl::Duration batch =
+          TimePerSample(length, chunk_length, [](Sample* sample) {
+            std::vector<tensorflow::Tensor> data;
+            sample->PrepareBatch(1, &data);
+            TF_EXPECT_OK(sample->CopyIntoBatch(0, &data));
+          });
+      const absl::Duration timesteps =
+          TimePerSample(length, chunk_length, [](Sample* sample) {
+            while (!sample->is_end_of_sample()) sample->GetNextTimestep();
+          });
+      REVERB_LOG(REVERB_INFO)
+          << "length=" << length << " chunk_length=" << chunk_length
+          << ": sequence=" << sequence << " batch=" << batch
+          << " timesteps=" << timesteps;
+    }
+  }
+}
+
+TEST(SamplerBenchmark, PackedResponses) {
+  for (const auto& workload : Workloads()) {
+    const int port = internal::PickUnusedPortOrDie();
+    std::unique_ptr<Server> server;
+    TF_ASSERT_OK(StartServer({MakeTable()}, port, /*checkpointer=*/nullptr,
+                             &server));
+    Client client(absl::StrCat("localhost:", port));
+    InsertItems(&client, workload);
+
+    const double unpacked = SamplesPerSecond(&client, 0);
+    const double packed =
+        SamplesPerSecond(&client, Sampler::kDefaultMaxResponseBytes);
+    REVERB_LOG(REVERB_INFO)
+        << workload.name << ": unpacked=" << unpacked
+        << " samples/s packed=" << packed
+        << " samples/s speedup=" << packed / unpacked << "x";
+    server->Stop();
+  }
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,105 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/sampler_stats.h"
+
+#include <cstdint>
+
+#include "google/protobuf/duration.pb.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+inline void EncodeAsDurationProto(const absl::Duration& d,
+                                  google::protobuf::Duration* proto) {
+  proto->set_seconds(d / absl::Seconds(1));
+  proto->set_nanos((d - absl::Seconds(proto->seconds())) /
+                   absl::Nanoseconds(1));
+}
+
+}  // namespace
+
+SamplerStatsRecorder::SamplerStatsRecorder() : created_at_(absl::Now()) {}
+
+void SamplerStatsRecorder::RecordFirstResponse(absl::Duration duration) {
+  absl::MutexLock lock(&mu_);
+  first_response_.Record(duration);
+}
+
+void SamplerStatsRecorder::RecordDecode(absl::Duration duration) {
+  absl::MutexLock lock(&mu_);
+  decode_.Record(duration);
+}
+
+void SamplerStatsRecorder::RecordPop(absl::Duration pop_wait,
+                                     absl::Duration queue_wait) {
+  absl::MutexLock lock(&mu_);
+  pop_wait_.Record(pop_wait);
+  queue_wait_.Record(queue_wait);
+}
+
+void SamplerStatsRecorder::RecordValidation(absl::Duration duration) {
+  absl::MutexLock lock(&mu_);
+  validation_.Record(duration);
+}
+
+void SamplerStatsRecorder::RecordBytesReceived(int64_t num_bytes) {
+  absl::MutexLock lock(&mu_);
+  bytes_received_ += num_bytes;
+}
+
+void SamplerStatsRecorder::RecordStreamOpened() {
+  absl::MutexLock lock(&mu_);
+  streams_opened_++;
+}
+
+void SamplerStatsRecorder::RecordSamplePushed(int worker_id) {
+  REVERB_CHECK_GE(worker_id, 0);
+  absl::MutexLock lock(&mu_);
+  if (worker_id >= static_cast<int>(samples_per_worker_.size())) {
+    samples_per_worker_.resize(worker_id + 1, 0);
+  }
+  samples_per_worker_[worker_id]++;
+}
+
+SamplerStats SamplerStatsRecorder::ToProto() const {
+  const absl::Duration duration = absl::Now() - created_at_;
+  const double seconds = absl::ToDoubleSeconds(duration);
+
+  absl::MutexLock lock(&mu_);
+  SamplerStats proto;
+  *proto.mutable_first_response() = first_response_.ToProto();
+  *proto.mutable_decode() = decode_.ToProto();
+  *proto.mutable_queue_wait() = queue_wait_.ToProto();
+  *proto.mutable_pop_wait() = pop_wait_.ToProto();
+  *proto.mutable_validation() = validation_.ToProto();
+  proto.set_bytes_received(bytes_received_);
+  proto.set_streams_opened(streams_opened_);
+  EncodeAsDurationProto(duration, proto.mutable_duration());
+  for (int64_t samples : samples_per_worker_) {
+    auto* worker = proto.add_workers();
+    worker->set_samples(samples);
+    worker->set_samples_per_second(seconds > 0 ? samples / seconds : 0);
+  }
+  return proto;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,86 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SAMPLER_STATS_H_
+#define REVERB_CC_SAMPLER_STATS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/latency_histogram.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Collects the latency of the stages which samples pass through in a
+// `Sampler` together with the throughput of its workers. Used to tell whether
+// a consumer which is starved of samples is waiting on the server (rate
+// limiter or network), on decoding or on the validation of the samples.
+//
+// All public methods are thread safe.
+class SamplerStatsRecorder {
+ public:
+  SamplerStatsRecorder();
+
+  // Records the time between sending a request and receiving its first
+  // response.
+  void RecordFirstResponse(absl::Duration duration) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records the time spent decoding a sample.
+  void RecordDecode(absl::Duration duration) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records that the consumer popped a sample after waiting `pop_wait` for it
+  // and that the sample had been ready for `queue_wait`.
+  void RecordPop(absl::Duration pop_wait, absl::Duration queue_wait)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records the time spent validating a sample.
+  void RecordValidation(absl::Duration duration) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records that a message of `num_bytes` was received on a stream.
+  void RecordBytesReceived(int64_t num_bytes) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records that a new stream was opened.
+  void RecordStreamOpened() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Records that worker `worker_id` pushed a sample to the queue.
+  void RecordSamplePushed(int worker_id) ABSL_LOCKS_EXCLUDED(mu_);
+
+  SamplerStats ToProto() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  const absl::Time created_at_;
+
+  mutable absl::Mutex mu_;
+  internal::LatencyHistogram first_response_ ABSL_GUARDED_BY(mu_);
+  internal::LatencyHistogram decode_ ABSL_GUARDED_BY(mu_);
+  internal::LatencyHistogram queue_wait_ ABSL_GUARDED_BY(mu_);
+  internal::LatencyHistogram pop_wait_ ABSL_GUARDED_BY(mu_);
+  internal::LatencyHistogram validation_ ABSL_GUARDED_BY(mu_);
+  int64_t bytes_received_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t streams_opened_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Number of samples pushed by each worker, indexed by the worker id. Grown
+  // as workers report their first sample.
+  std::vector<int64_t> samples_per_worker_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SAMPLER_STATS_H_
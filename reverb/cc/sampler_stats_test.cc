@@ -0,0 +1,87 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/sampler_stats.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+TEST(SamplerStatsRecorderTest, StartsEmpty) {
+  SamplerStatsRecorder recorder;
+  SamplerStats stats = recorder.ToProto();
+  EXPECT_EQ(stats.first_response().count(), 0);
+  EXPECT_EQ(stats.decode().count(), 0);
+  EXPECT_EQ(stats.queue_wait().count(), 0);
+  EXPECT_EQ(stats.pop_wait().count(), 0);
+  EXPECT_EQ(stats.validation().count(), 0);
+  EXPECT_EQ(stats.bytes_received(), 0);
+  EXPECT_EQ(stats.streams_opened(), 0);
+  EXPECT_EQ(stats.workers_size(), 0);
+}
+
+TEST(SamplerStatsRecorderTest, RecordsLatencies) {
+  SamplerStatsRecorder recorder;
+  recorder.RecordFirstResponse(absl::Milliseconds(5));
+  recorder.RecordDecode(absl::Milliseconds(1));
+  recorder.RecordDecode(absl::Milliseconds(3));
+  recorder.RecordPop(absl::Milliseconds(2), absl::Milliseconds(7));
+  recorder.RecordValidation(absl::Microseconds(10));
+
+  SamplerStats stats = recorder.ToProto();
+  EXPECT_EQ(stats.first_response().count(), 1);
+  EXPECT_EQ(stats.first_response().max().nanos(), 5000000);
+  EXPECT_EQ(stats.decode().count(), 2);
+  EXPECT_EQ(stats.decode().total().nanos(), 4000000);
+  EXPECT_EQ(stats.pop_wait().max().nanos(), 2000000);
+  EXPECT_EQ(stats.queue_wait().max().nanos(), 7000000);
+  EXPECT_EQ(stats.validation().count(), 1);
+}
+
+TEST(SamplerStatsRecorderTest, RecordsCounters) {
+  SamplerStatsRecorder recorder;
+  recorder.RecordBytesReceived(100);
+  recorder.RecordBytesReceived(23);
+  recorder.RecordStreamOpened();
+  recorder.RecordStreamOpened();
+
+  SamplerStats stats = recorder.ToProto();
+  EXPECT_EQ(stats.bytes_received(), 123);
+  EXPECT_EQ(stats.streams_opened(), 2);
+}
+
+TEST(SamplerStatsRecorderTest, RecordsSamplesPerWorker) {
+  SamplerStatsRecorder recorder;
+  recorder.RecordSamplePushed(2);
+  recorder.RecordSamplePushed(0);
+  recorder.RecordSamplePushed(2);
+
+  SamplerStats stats = recorder.ToProto();
+  ASSERT_EQ(stats.workers_size(), 3);
+  EXPECT_EQ(stats.workers(0).samples(), 1);
+  EXPECT_EQ(stats.workers(1).samples(), 0);
+  EXPECT_EQ(stats.workers(2).samples(), 2);
+  EXPECT_GT(stats.workers(2).samples_per_second(),
+            stats.workers(0).samples_per_second());
+  EXPECT_EQ(stats.workers(1).samples_per_second(), 0);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
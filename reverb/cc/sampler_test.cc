@@ -14,7 +14,10 @@
 
 #include "reverb/cc/sampler.h"
 
+#include <atomic>
 #include <list>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "grpcpp/client_context.h"
@@ -27,14 +30,18 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "reverb/cc/errors.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/reverb_service_mock.grpc.pb.h"
+#include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/support/thread_pool.h"
 #include "reverb/cc/tensor_compression.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "reverb/cc/testing/tensor_testutil.h"
 #include "reverb/cc/testing/time_testutil.h"
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/framework/types.pb.h"
@@ -67,8 +74,7 @@ class FakeStream
 
   bool Read(SampleStreamResponse* response) override {
     if (!responses_.empty() && status_.ok()) {
-      *response->mutable_data() = responses_.front().data();
-      *response->mutable_info() = responses_.front().info();
+      *response = responses_.front();
       responses_.erase(responses_.begin());
       return true;
     }
@@ -97,6 +103,7 @@ class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
   grpc::ClientReaderWriterInterface<SampleStreamRequest, SampleStreamResponse>*
   SampleStreamRaw(grpc::ClientContext* context) override {
     absl::WriterMutexLock lock(&mu_);
+    ++num_streams_;
     if (!streams_.empty()) {
       FakeStream* stream = streams_.front().release();
       streams_.pop_front();
@@ -122,14 +129,40 @@ class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
         std::move(responses), std::move(status)));
   }
 
+  grpc::Status ServerInfo(grpc::ClientContext* context,
+                          const ServerInfoRequest& request,
+                          ServerInfoResponse* response) override {
+    absl::ReaderMutexLock lock(&mu_);
+    if (table_size_ >= 0) {
+      auto* info = response->add_table_info();
+      info->set_name("table");
+      info->set_current_size(table_size_);
+    }
+    return grpc::Status::OK;
+  }
+
+  // Sets the size of "table" reported by `ServerInfo`. No table is reported
+  // while the size is negative.
+  void SetTableSize(int64_t size) {
+    absl::WriterMutexLock lock(&mu_);
+    table_size_ = size;
+  }
+
   std::vector<SampleStreamRequest> requests() const {
     absl::ReaderMutexLock lock(&mu_);
     return requests_;
   }
 
+  int num_streams() const {
+    absl::ReaderMutexLock lock(&mu_);
+    return num_streams_;
+  }
+
  private:
   std::list<std::unique_ptr<FakeStream>> streams_ ABSL_GUARDED_BY(mu_);
   std::vector<SampleStreamRequest> requests_ ABSL_GUARDED_BY(mu_);
+  int num_streams_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t table_size_ ABSL_GUARDED_BY(mu_) = -1;
   mutable absl::Mutex mu_;
 };
 
@@ -252,6 +285,91 @@ void InsertItem(Table* table, uint64_t key, double priority,
       table->InsertOrAssign(MakeItem(key, priority, ranges, offset, length)));
 }
 
+TEST(SampleTest, GetNextTimestepReturnsViewsOfChunk) {
+  // Rows of 64 floats are aligned so no time step has to be copied.
+  tensorflow::Tensor first(tensorflow::DT_FLOAT,
+                           tensorflow::TensorShape({3, 64}));
+  tensorflow::Tensor second(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({2, 64}));
+  const char* first_data = first.tensor_data().data();
+  const char* second_data = second.tensor_data().data();
+  const int64_t row_bytes = 64 * sizeof(float);
+
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  chunks.push_back({std::move(first)});
+  chunks.push_back({std::move(second)});
+  Sample sample(/*key=*/1, /*probability=*/0.5, /*table_size=*/10,
+                /*priority=*/2, std::move(chunks));
+  EXPECT_EQ(sample.num_timesteps(), 5);
+
+  std::vector<std::vector<tensorflow::Tensor>> timesteps;
+  while (!sample.is_end_of_sample()) {
+    timesteps.push_back(sample.GetNextTimestep());
+  }
+  ASSERT_THAT(timesteps, SizeIs(5));
+
+  for (int i = 0; i < 5; i++) {
+    ASSERT_THAT(timesteps[i], SizeIs(5));
+    EXPECT_EQ(timesteps[i][4].shape(), tensorflow::TensorShape({64}));
+    const char* expected =
+        i < 3 ? first_data + i * row_bytes : second_data + (i - 3) * row_bytes;
+    EXPECT_EQ(timesteps[i][4].tensor_data().data(), expected);
+
+    // The metadata tensors are shared by all time steps.
+    for (int j = 0; j < 4; j++) {
+      EXPECT_EQ(timesteps[i][j].tensor_data().data(),
+                timesteps[0][j].tensor_data().data());
+    }
+  }
+  EXPECT_EQ(timesteps[4][0].scalar<tensorflow::uint64>()(), 1);
+  EXPECT_EQ(timesteps[4][3].scalar<double>()(), 2);
+}
+
+TEST(SampleTest, AsBatchedTimestepsReturnsSingleChunkWithoutCopy) {
+  tensorflow::Tensor chunk(tensorflow::DT_FLOAT,
+                           tensorflow::TensorShape({3, 5}));
+  const char* data = chunk.tensor_data().data();
+
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  chunks.push_back({std::move(chunk)});
+  Sample sample(1, 0.5, 10, 2, std::move(chunks));
+
+  std::vector<tensorflow::Tensor> batched;
+  TF_ASSERT_OK(sample.AsBatchedTimesteps(&batched));
+  ASSERT_THAT(batched, SizeIs(5));
+  EXPECT_EQ(batched[4].tensor_data().data(), data);
+  EXPECT_TRUE(sample.is_end_of_sample());
+}
+
+TEST(SampleTest, AsBatchedTimestepsCopiesChunksIntoSequence) {
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  chunks.push_back({MakeTensor(2)});
+  chunks.push_back({MakeTensor(3)});
+  Sample sample(1, 0.5, 10, 2, std::move(chunks));
+
+  std::vector<tensorflow::Tensor> batched;
+  TF_ASSERT_OK(sample.AsBatchedTimesteps(&batched));
+  ASSERT_THAT(batched, SizeIs(5));
+  tensorflow::Tensor expected;
+  TF_ASSERT_OK(tensorflow::tensor::Concat({MakeTensor(2), MakeTensor(3)},
+                                          &expected));
+  ExpectTensorEqual<tensorflow::uint64>(batched[4], expected);
+  EXPECT_EQ(batched[0].shape(), tensorflow::TensorShape({5}));
+  EXPECT_TRUE(sample.is_end_of_sample());
+}
+
+TEST(SampleTest, AsBatchedTimestepsRejectsChunksOfDifferentShapes) {
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  chunks.push_back({MakeTensor(2)});
+  chunks.push_back({tensorflow::Tensor(tensorflow::DT_UINT64,
+                                       tensorflow::TensorShape({3, 4}))});
+  Sample sample(1, 0.5, 10, 2, std::move(chunks));
+
+  std::vector<tensorflow::Tensor> batched;
+  EXPECT_EQ(sample.AsBatchedTimesteps(&batched).code(),
+            tensorflow::error::INTERNAL);
+}
+
 TEST(GrpcSamplerTest, SendsFirstRequest) {
   auto stub = MakeGoodStub({MakeResponse(1)});
   Sampler sampler(stub, "table", {1, 1, 1});
@@ -393,6 +511,176 @@ TEST(LocalSamplerTest, GetNextSampleReturnsWholeSequence) {
   ExpectTensorEqual<tensorflow::uint64>(second[4], MakeTensor(3));
 }
 
+TEST(LocalSamplerTest, GetNextBatchReturnsBatchedSamples) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 100.0, {3});
+  InsertItem(table.get(), 2, 101.0, {2, 1});
+
+  Sampler sampler(table, {2});
+
+  std::vector<tensorflow::Tensor> batch;
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_THAT(batch,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+
+  // Metadata has a single value per sample rather than per time step.
+  EXPECT_EQ(batch[0].shape(), tensorflow::TensorShape({2}));
+  EXPECT_EQ(batch[0].flat<tensorflow::uint64>()(0), 1);
+  EXPECT_EQ(batch[0].flat<tensorflow::uint64>()(1), 2);
+  EXPECT_EQ(batch[3].flat<double>()(0), 100.0);
+  EXPECT_EQ(batch[3].flat<double>()(1), 101.0);
+
+  EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({2, 3, 2}));
+  ExpectTensorEqual<tensorflow::uint64>(
+      tensorflow::tensor::DeepCopy(batch[4].SubSlice(0)), MakeTensor(3));
+  tensorflow::Tensor second;
+  TF_ASSERT_OK(tensorflow::tensor::Concat({MakeTensor(2), MakeTensor(1)},
+                                          &second));
+  ExpectTensorEqual<tensorflow::uint64>(
+      tensorflow::tensor::DeepCopy(batch[4].SubSlice(1)), second);
+}
+
+TEST(LocalSamplerTest, GetNextBatchReusesUnsharedTensors) {
+  auto table = MakeTable();
+  for (int i = 0; i < 6; i++) {
+    InsertItem(table.get(), i + 1, 1.0, {2});
+  }
+
+  Sampler sampler(table, {6});
+
+  std::vector<tensorflow::Tensor> batch;
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  const char* buffer = batch[4].tensor_data().data();
+
+  // The tensors are only referenced by `batch` so they are filled in place.
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_EQ(batch[4].tensor_data().data(), buffer);
+
+  // A tensor which is still referenced elsewhere must not be overwritten.
+  tensorflow::Tensor in_use = batch[4];
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_NE(batch[4].tensor_data().data(), buffer);
+  EXPECT_EQ(in_use.tensor_data().data(), buffer);
+}
+
+// Forwards to the CPU allocator and counts the allocations.
+class CountingAllocator : public tensorflow::Allocator {
+ public:
+  std::string Name() override { return "counting"; }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override {
+    num_allocations_++;
+    return tensorflow::cpu_allocator()->AllocateRaw(alignment, num_bytes);
+  }
+
+  void DeallocateRaw(void* ptr) override {
+    tensorflow::cpu_allocator()->DeallocateRaw(ptr);
+  }
+
+  int num_allocations() const { return num_allocations_; }
+
+ private:
+  std::atomic<int> num_allocations_{0};
+};
+
+TEST(LocalSamplerTest, SamplesAreAllocatedFromOutputAllocator) {
+  auto table = MakeTable();
+  for (int i = 0; i < 3; i++) {
+    InsertItem(table.get(), i + 1, 1.0, {2});
+  }
+
+  CountingAllocator allocator;
+  Sampler::Options options;
+  options.max_samples = 3;
+  options.output_allocator = &allocator;
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> sample;
+  TF_ASSERT_OK(sampler.GetNextSample(&sample));
+  ExpectTensorEqual<tensorflow::uint64>(sample[4], MakeTensor(2));
+  const int sample_allocations = allocator.num_allocations();
+  EXPECT_GE(sample_allocations, 1);
+
+  // The batch is allocated from the allocator as well.
+  std::vector<tensorflow::Tensor> batch;
+  TF_ASSERT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_GE(allocator.num_allocations(), sample_allocations + 5);
+}
+
+TEST(LocalSamplerTest, StatsRecordSamplesWithoutStreams) {
+  auto table = MakeTable();
+  for (int i = 0; i < 4; i++) {
+    InsertItem(table.get(), i + 1, 1.0, {2});
+  }
+
+  Sampler sampler(table, {4});
+
+  std::vector<tensorflow::Tensor> sample;
+  for (int i = 0; i < 4; i++) {
+    TF_ASSERT_OK(sampler.GetNextSample(&sample));
+  }
+
+  SamplerStats stats = sampler.stats();
+  EXPECT_EQ(stats.decode().count(), 4);
+  EXPECT_EQ(stats.pop_wait().count(), 4);
+  EXPECT_EQ(stats.first_response().count(), 0);
+  EXPECT_EQ(stats.bytes_received(), 0);
+  EXPECT_EQ(stats.streams_opened(), 0);
+  ASSERT_EQ(stats.workers_size(), 1);
+  EXPECT_EQ(stats.workers(0).samples(), 4);
+}
+
+TEST(LocalSamplerTest, GetNextBatchReturnsPartialBatchAtMaxSamples) {
+  auto table = MakeTable();
+  for (int i = 0; i < 3; i++) {
+    InsertItem(table.get(), i + 1, 1.0, {2});
+  }
+
+  Sampler::Options options;
+  options.max_samples = 3;
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> batch;
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({2, 2, 2}));
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({1, 2, 2}));
+  EXPECT_EQ(sampler.GetNextBatch(2, &batch).code(),
+            tensorflow::error::OUT_OF_RANGE);
+}
+
+TEST(LocalSamplerTest, GetNextBatchReturnsPartialBatchOnRateLimiterTimeout) {
+  auto table = MakeTable();
+  for (int i = 0; i < 3; i++) {
+    InsertItem(table.get(), i + 1, 1.0, {2});
+  }
+
+  // Items are removed once sampled so the table is empty after 3 samples.
+  Sampler::Options options;
+  options.rate_limiter_timeout = absl::Milliseconds(10);
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> batch;
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({2, 2, 2}));
+  TF_EXPECT_OK(sampler.GetNextBatch(2, &batch));
+  EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({1, 2, 2}));
+  EXPECT_TRUE(errors::IsRateLimiterTimeout(sampler.GetNextBatch(2, &batch)));
+  sampler.Close();
+}
+
+TEST(LocalSamplerTest, GetNextBatchRejectsSamplesOfDifferentLength) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {2});
+  InsertItem(table.get(), 2, 1.0, {3});
+
+  Sampler sampler(table, {2});
+
+  std::vector<tensorflow::Tensor> batch;
+  EXPECT_EQ(sampler.GetNextBatch(2, &batch).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+}
+
 TEST(GrpcSamplerTest, GetNextSampleTrimsSequence) {
   auto stub = MakeGoodStub({
       MakeResponse(5, false, 1, 6),   // Trim offset at the start.
@@ -465,6 +753,98 @@ TEST(LocalSamplerTest, GetNextSampleTrimsSequence) {
                                         start_and_end_trimmer_want);
 }
 
+TEST(LocalSamplerTest, OverlappingSamplesUseChunkCache) {
+  auto table = MakeTable();
+  std::vector<ChunkData> data = {
+      MakeChunkData(1, MakeSequenceRange(100, 0, 4)),
+      MakeChunkData(2, MakeSequenceRange(100, 5, 9)),
+  };
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  for (const auto& chunk : data) {
+    chunks.push_back(std::make_shared<ChunkStore::Chunk>(chunk));
+  }
+
+  // Both items span the two chunks but start at different time steps.
+  const std::vector<std::pair<int, int>> ranges = {{2, 5}, {3, 6}};
+  for (int i = 0; i < ranges.size(); i++) {
+    TableItem item;
+    item.chunks = chunks;
+    item.item = testing::MakePrioritizedItem(i + 1, 1.0, data);
+    item.item.mutable_sequence_range()->set_offset(ranges[i].first);
+    item.item.mutable_sequence_range()->set_length(ranges[i].second);
+    TF_EXPECT_OK(table->InsertOrAssign(item));
+  }
+
+  Sampler::Options options;
+  options.max_samples = 2;
+  options.chunk_cache_bytes = 1 << 20;
+  Sampler sampler(table, options);
+
+  tensorflow::Tensor episode;
+  TF_EXPECT_OK(tensorflow::tensor::Concat({MakeTensor(5), MakeTensor(5)},
+                                          &episode));
+  for (const auto& range : ranges) {
+    std::vector<tensorflow::Tensor> sample;
+    TF_EXPECT_OK(sampler.GetNextSample(&sample));
+    ASSERT_THAT(sample, SizeIs(5));
+    ExpectTensorEqual<tensorflow::uint64>(
+        sample[4], tensorflow::tensor::DeepCopy(episode.Slice(
+                       range.first, range.first + range.second)));
+  }
+
+  // The first sample decompresses both chunks and the second sample copies
+  // its time steps from the cache.
+  auto stats = sampler.chunk_cache_stats();
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.num_chunks, 2);
+}
+
+TEST(LocalSamplerTest, GetNextSampleOnlyDecodesReferencedColumns) {
+  auto table = MakeTable();
+  ChunkData data = MakeChunkData(1, MakeSequenceRange(100, 0, 4));
+  const auto ints = MakeConstantTensor<tensorflow::DT_INT32>({5}, 7);
+  const auto floats = MakeConstantTensor<tensorflow::DT_FLOAT>({5, 3}, 2.5);
+  CompressTensorAsProto(ints, data.mutable_data()->add_tensors());
+  CompressTensorAsProto(floats, data.mutable_data()->add_tensors());
+
+  TableItem item;
+  item.chunks = {std::make_shared<ChunkStore::Chunk>(data)};
+  item.item = testing::MakePrioritizedItem(1, 1.0, {data});
+  item.item.mutable_sequence_range()->set_length(5);
+  item.item.add_columns(2);
+  item.item.add_columns(0);
+  TF_EXPECT_OK(table->InsertOrAssign(item));
+
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.chunk_cache_bytes = 1 << 20;
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> sample;
+  TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  ASSERT_THAT(sample, SizeIs(6));  // ID, probability, table size, priority,
+                                   // and the two referenced columns.
+  ExpectTensorEqual<float>(sample[4], floats);
+  ExpectTensorEqual<tensorflow::uint64>(sample[5], MakeTensor(5));
+
+  // The cache holds full chunks so it isn't used for a subset of the columns.
+  auto stats = sampler.chunk_cache_stats();
+  EXPECT_EQ(stats.hits + stats.misses, 0);
+}
+
+TEST(LocalSamplerTest, ChunkCacheIsDisabledByDefault) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {5});
+
+  Sampler sampler(table, {1});
+  std::vector<tensorflow::Tensor> sample;
+  TF_EXPECT_OK(sampler.GetNextSample(&sample));
+
+  auto stats = sampler.chunk_cache_stats();
+  EXPECT_EQ(stats.hits + stats.misses, 0);
+}
+
 TEST(LocalSamplerTest, Close) {
   auto table = MakeTable();
   InsertItem(table.get(), 1, 1.0, {5});
@@ -564,6 +944,89 @@ TEST(GrpcSamplerTest, UnpacksDeltaEncodedTensors) {
   }
 }
 
+TEST(GrpcSamplerTest, AdvertisesCachedChunksAndResolvesReferences) {
+  SampleStreamResponse response = MakeResponse(4, false, 2, 10);
+  response.mutable_data()->set_chunk_key(7);
+  *response.mutable_data()->mutable_sequence_range() =
+      MakeSequenceRange(1, 0, 9);
+
+  // The second sample references the chunk sent with the first sample.
+  SampleStreamResponse reference;
+  *reference.mutable_info() = response.info();
+  auto* item = reference.mutable_info()->mutable_item();
+  item->mutable_sequence_range()->set_offset(5);
+  reference.mutable_data()->set_chunk_key(7);
+  *reference.mutable_data()->mutable_sequence_range() =
+      MakeSequenceRange(1, 0, 9);
+  reference.set_data_is_cached(true);
+
+  auto stub = MakeGoodStub({response, reference});
+  Sampler::Options options;
+  options.max_samples = 2;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.chunk_cache_bytes = 1 << 20;
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> first;
+  TF_EXPECT_OK(sampler.GetNextSample(&first));
+  ExpectTensorEqual<tensorflow::uint64>(
+      first[4], tensorflow::tensor::DeepCopy(MakeTensor(10).Slice(2, 6)));
+
+  std::vector<tensorflow::Tensor> second;
+  TF_EXPECT_OK(sampler.GetNextSample(&second));
+  ExpectTensorEqual<tensorflow::uint64>(
+      second[4], tensorflow::tensor::DeepCopy(MakeTensor(10).Slice(5, 9)));
+
+  auto requests = stub->requests();
+  ASSERT_GE(requests.size(), 2);
+  EXPECT_THAT(requests[0].cached_chunks(), SizeIs(0));
+  ASSERT_THAT(requests[1].cached_chunks(), SizeIs(1));
+  EXPECT_EQ(requests[1].cached_chunks(0).chunk_key(), 7);
+  EXPECT_EQ(requests[1].cached_chunks(0).start(), 0);
+  EXPECT_EQ(requests[1].cached_chunks(0).end(), 9);
+}
+
+TEST(GrpcSamplerTest, ReferenceWithoutChunkCacheIsAnError) {
+  SampleStreamResponse reference = MakeResponse(4, false, 0, 10);
+  reference.mutable_data()->mutable_data()->clear_tensors();
+  *reference.mutable_data()->mutable_sequence_range() =
+      MakeSequenceRange(1, 0, 9);
+  reference.set_data_is_cached(true);
+
+  auto stub = MakeGoodStub({reference});
+  Sampler sampler(stub, "table", {1, 1});
+  std::vector<tensorflow::Tensor> sample;
+  EXPECT_EQ(sampler.GetNextSample(&sample).code(),
+            tensorflow::error::INTERNAL);
+}
+
+TEST(GrpcSamplerTest, UnpacksPackedResponses) {
+  SampleStreamResponse packed;
+  *packed.add_entries() = MakeResponse(5);
+  *packed.add_entries() = MakeResponse(3, false, 1, 6);
+  auto stub = MakeGoodStub({packed, MakeResponse(2)});
+
+  Sampler sampler(stub, "table", {3, 3});
+  std::vector<tensorflow::Tensor> first;
+  TF_EXPECT_OK(sampler.GetNextSample(&first));
+  ExpectTensorEqual<tensorflow::uint64>(first[4], MakeTensor(5));
+
+  std::vector<tensorflow::Tensor> second;
+  TF_EXPECT_OK(sampler.GetNextSample(&second));
+  ExpectTensorEqual<tensorflow::uint64>(
+      second[4], tensorflow::tensor::DeepCopy(MakeTensor(6).Slice(1, 4)));
+
+  std::vector<tensorflow::Tensor> third;
+  TF_EXPECT_OK(sampler.GetNextSample(&third));
+  ExpectTensorEqual<tensorflow::uint64>(third[4], MakeTensor(2));
+
+  auto requests = stub->requests();
+  ASSERT_GE(requests.size(), 1);
+  EXPECT_EQ(requests[0].max_response_bytes(),
+            static_cast<int64_t>(Sampler::kDefaultMaxResponseBytes));
+}
+
 TEST(GrpcSamplerTest, GetNextTimestepForwardsFatalServerError) {
   const int kNumWorkers = 4;
   const int kItemLength = 10;
@@ -724,6 +1187,124 @@ TEST(LocalSamplerTest, GetNextSampleReturnsErrorIfMaximumSamplesExceeded) {
             tensorflow::error::OUT_OF_RANGE);
 }
 
+TEST(GrpcSamplerTest, AutotuneBoundsRequestsByOptions) {
+  std::vector<SampleStreamResponse> responses;
+  for (int i = 0; i < 40; i++) responses.push_back(MakeResponse(1));
+  auto stub = MakeGoodStub(std::move(responses));
+
+  Sampler::Options options;
+  options.max_samples = 40;
+  options.max_in_flight_samples_per_worker = 8;
+  options.num_workers = 1;
+  options.flexible_batch_size = 2;
+  options.autotune = true;
+  Sampler sampler(stub, "table", options);
+
+  for (int i = 0; i < 40; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    TF_ASSERT_OK(sampler.GetNextSample(&sample));
+  }
+
+  for (const auto& request : stub->requests()) {
+    EXPECT_GE(request.num_samples(), 1);
+    EXPECT_LE(request.num_samples(), 8);
+    EXPECT_GE(request.flexible_batch_size(), 1);
+    EXPECT_LE(request.flexible_batch_size(), 2);
+  }
+
+  auto stats = sampler.autotune_stats();
+  EXPECT_GE(stats.max_in_flight_samples_per_worker, 1);
+  EXPECT_LE(stats.max_in_flight_samples_per_worker, 8);
+  EXPECT_GT(stats.round_trip_time, absl::ZeroDuration());
+}
+
+TEST(GrpcSamplerTest, AutotuneIsDisabledByDefault) {
+  auto stub = MakeGoodStub({MakeResponse(1)});
+  Sampler sampler(stub, "table", {1, 1});
+
+  std::vector<tensorflow::Tensor> sample;
+  TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  EXPECT_EQ(sampler.autotune_stats().max_in_flight_samples_per_worker, 0);
+  EXPECT_EQ(stub->requests()[0].num_samples(), 1);
+}
+
+TEST(GrpcSamplerTest, StatsRecordStagesAndCounters) {
+  // Every sample is served on a separate stream.
+  auto stub = std::make_shared<FakeStub>();
+  int64_t bytes = 0;
+  for (int i = 1; i <= 3; i++) {
+    auto response = MakeResponse(i);
+    bytes += response.ByteSizeLong();
+    stub->AddStream({std::move(response)});
+  }
+
+  Sampler::Options options;
+  options.max_samples = 3;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.max_samples_per_stream = 1;
+  Sampler sampler(stub, "table", options);
+
+  for (int i = 0; i < 3; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    TF_ASSERT_OK(sampler.GetNextSample(&sample));
+  }
+
+  SamplerStats stats = sampler.stats();
+  EXPECT_EQ(stats.first_response().count(), 3);
+  EXPECT_EQ(stats.decode().count(), 3);
+  EXPECT_EQ(stats.queue_wait().count(), 3);
+  EXPECT_EQ(stats.pop_wait().count(), 3);
+  EXPECT_EQ(stats.bytes_received(), bytes);
+  EXPECT_EQ(stats.streams_opened(), 3);
+  EXPECT_EQ(stub->num_streams(), 3);
+  ASSERT_EQ(stats.workers_size(), 1);
+  EXPECT_EQ(stats.workers(0).samples(), 3);
+  EXPECT_GT(stats.workers(0).samples_per_second(), 0);
+}
+
+TEST(GrpcSamplerTest, DecodePoolPreservesOrderOfSamples) {
+  std::vector<SampleStreamResponse> responses;
+  for (int i = 1; i <= 20; i++) {
+    responses.push_back(MakeResponse(i));
+  }
+  auto stub = MakeGoodStub(responses);
+
+  Sampler::Options options;
+  options.max_samples = 20;
+  options.max_in_flight_samples_per_worker = 5;
+  options.num_workers = 1;
+  options.num_decode_threads = 4;
+  Sampler sampler(stub, "table", options);
+
+  for (int i = 1; i <= 20; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    TF_ASSERT_OK(sampler.GetNextSample(&sample));
+    ExpectTensorEqual<tensorflow::uint64>(sample[4], MakeTensor(i));
+  }
+
+  std::vector<tensorflow::Tensor> sample;
+  EXPECT_EQ(sampler.GetNextSample(&sample).code(),
+            tensorflow::error::OUT_OF_RANGE);
+}
+
+TEST(GrpcSamplerTest, DecodePoolForwardsFatalServerError) {
+  auto stub = MakeFlakyStub({MakeResponse(2), MakeResponse(2)},
+                            {grpc::Status(grpc::StatusCode::NOT_FOUND, "")});
+
+  Sampler::Options options;
+  options.num_decode_threads = 2;
+  Sampler sampler(stub, "table", options);
+
+  // The samples read before the stream failed may be returned before the error.
+  std::vector<tensorflow::Tensor> sample;
+  tensorflow::Status status;
+  for (int i = 0; i < 3 && status.ok(); i++) {
+    status = sampler.GetNextSample(&sample);
+  }
+  EXPECT_EQ(status.code(), tensorflow::error::NOT_FOUND);
+}
+
 TEST(GrpcSamplerTest, StressTestWithoutErrors) {
   const int kNumWorkers = 100;  // Should be larger than the number of CPUs.
   const int kMaxSamples = 10000;
@@ -787,6 +1368,34 @@ TEST(LocalSamplerTest, StressTestWithoutErrors) {
   sampler.Close();
 }
 
+TEST(LocalSamplerTest, SamplersShareWorkerExecutor) {
+  const int kMaxSamples = 100;
+  auto table = MakeTable(kMaxSamples);
+  for (int i = 0; i < kMaxSamples; i++) {
+    InsertItem(table.get(), i, 1.0, {1});
+  }
+
+  // Both samplers make progress while their workers are bounded by the
+  // threads of the shared executor.
+  Sampler::Options options;
+  options.num_workers = 4;
+  options.max_samples = kMaxSamples;
+  options.worker_executor =
+      std::make_shared<internal::ThreadPool>(8, "SamplerTest");
+  Sampler first(table, options);
+  Sampler second(table, options);
+
+  for (Sampler* sampler : {&first, &second}) {
+    for (int i = 0; i < kMaxSamples; i++) {
+      std::vector<tensorflow::Tensor> sample;
+      bool end_of_sequence;
+      TF_EXPECT_OK(sampler->GetNextTimestep(&sample, &end_of_sequence));
+    }
+  }
+  first.Close();
+  second.Close();
+}
+
 TEST(GrpcSamplerTest, StressTestWithTransientErrors) {
   const int kNumWorkers = 100;  // Should be larger than the number of CPUs.
   const int kMaxSamples = 10000;
@@ -825,6 +1434,160 @@ TEST(GrpcSamplerTest, StressTestWithTransientErrors) {
             tensorflow::error::OUT_OF_RANGE);
 }
 
+TEST(MultiServerSamplerTest, KeepsStreamsOpen) {
+  const int kNumSamples = 20;
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  std::vector<std::shared_ptr<FakeStub>> fakes;
+  for (int i = 0; i < 2; i++) {
+    fakes.push_back(MakeGoodStub(
+        std::vector<SampleStreamResponse>(kNumSamples, MakeResponse(1))));
+    fakes.back()->SetTableSize(10);
+    stubs.push_back(fakes.back());
+  }
+
+  Sampler::Options options;
+  options.max_samples = kNumSamples;
+  options.max_in_flight_samples_per_worker = 1;
+  options.max_samples_per_stream = 1;
+  Sampler sampler(stubs, "table", options);
+  for (int i = 0; i < kNumSamples; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  }
+  sampler.Close();
+
+  // Every request is a separate call to the worker but all requests to a
+  // server are sent on the same stream.
+  EXPECT_EQ(fakes[0]->requests().size() + fakes[1]->requests().size(),
+            kNumSamples);
+  for (const auto& fake : fakes) {
+    EXPECT_LE(fake->num_streams(), 1);
+  }
+}
+
+TEST(MultiServerSamplerTest, DoesNotSampleFromEmptyServers) {
+  const int kNumSamples = 10;
+  auto empty = MakeGoodStub({});
+  empty->SetTableSize(0);
+  auto missing = MakeGoodStub({});
+  auto full = MakeGoodStub(
+      std::vector<SampleStreamResponse>(kNumSamples, MakeResponse(1)));
+  full->SetTableSize(kNumSamples);
+
+  Sampler::Options options;
+  options.max_samples = kNumSamples;
+  options.max_in_flight_samples_per_worker = 1;
+  Sampler sampler({empty, missing, full}, "table", options);
+  for (int i = 0; i < kNumSamples; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  }
+  sampler.Close();
+
+  EXPECT_THAT(empty->requests(), SizeIs(0));
+  EXPECT_THAT(missing->requests(), SizeIs(0));
+  EXPECT_THAT(full->requests(), SizeIs(kNumSamples));
+}
+
+KeyWithPriority MakeKeyWithPriority(uint64_t key, double priority) {
+  KeyWithPriority update;
+  update.set_key(key);
+  update.set_priority(priority);
+  return update;
+}
+
+TEST(GrpcSamplerTest, SendsQueuedMutationsWithNextRequest) {
+  const int kNumSamples = 10;
+  auto stub = MakeGoodStub(
+      std::vector<SampleStreamResponse>(kNumSamples, MakeResponse(1)));
+
+  Sampler::Options options;
+  options.max_samples = kNumSamples;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> sample;
+  TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  TF_EXPECT_OK(
+      sampler.MutatePriorities({MakeKeyWithPriority(1, 0.5)}, {2, 3}));
+  for (int i = 1; i < kNumSamples; i++) {
+    TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  }
+  sampler.Close();
+
+  // The mutations are sent exactly once, with a request sent after the call.
+  auto requests = stub->requests();
+  ASSERT_THAT(requests, SizeIs(kNumSamples));
+  EXPECT_THAT(requests[0].priority_updates(), SizeIs(0));
+  int num_mutated = 0;
+  for (const auto& request : requests) {
+    if (request.priority_updates().empty()) continue;
+    EXPECT_THAT(request.priority_updates(),
+                ::testing::ElementsAre(
+                    testing::EqualsProto(MakeKeyWithPriority(1, 0.5))));
+    EXPECT_THAT(request.delete_keys(), ::testing::ElementsAre(2, 3));
+    ++num_mutated;
+  }
+  EXPECT_EQ(num_mutated, 1);
+}
+
+TEST(GrpcSamplerTest, MutatePrioritiesRejectsSeveralTables) {
+  std::vector<TableWeight> tables(2);
+  tables[0].set_table("a");
+  tables[0].set_weight(1);
+  tables[1].set_table("b");
+  tables[1].set_weight(1);
+  Sampler sampler(MakeGoodStub({}), tables, Sampler::Options());
+  EXPECT_EQ(sampler.MutatePriorities({MakeKeyWithPriority(1, 0.5)}, {}).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+}
+
+TEST(MultiServerSamplerTest, MutatePrioritiesIsRejected) {
+  Sampler sampler({MakeGoodStub({}), MakeGoodStub({})}, "table",
+                  Sampler::Options());
+  EXPECT_EQ(sampler.MutatePriorities({}, {1}).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+}
+
+TEST(LocalSamplerTest, AppliesQueuedMutationsWithNextBatch) {
+  const int kNumItems = 10;
+  auto table = MakeTable();
+  for (int key = 1; key <= kNumItems; key++) {
+    InsertItem(table.get(), key, 1.0, {1});
+  }
+
+  Sampler::Options options;
+  options.max_samples = kNumItems;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.flexible_batch_size = 1;
+  options.rate_limiter_timeout = absl::Milliseconds(10);
+  Sampler sampler(table, options);
+
+  // The worker can't have sampled more than a few items ahead of the first,
+  // so the last two are mutated before they are sampled.
+  std::vector<tensorflow::Tensor> sample;
+  TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  TF_EXPECT_OK(sampler.MutatePriorities(
+      {MakeKeyWithPriority(kNumItems - 1, 5.0)}, {kNumItems}));
+  for (int i = 1; i < kNumItems - 1; i++) {
+    TF_EXPECT_OK(sampler.GetNextSample(&sample));
+  }
+  ExpectTensorEqual<double>(
+      sample[3], MakeConstantTensor<tensorflow::DT_DOUBLE>({1}, 5.0));
+  EXPECT_TRUE(errors::IsRateLimiterTimeout(sampler.GetNextSample(&sample)));
+  EXPECT_EQ(table->size(), 0);
+}
+
+TEST(LocalSamplerTest, MutatePrioritiesAfterCloseIsCancelled) {
+  Sampler sampler(MakeTable(), Sampler::Options());
+  sampler.Close();
+  EXPECT_EQ(sampler.MutatePriorities({}, {1}).code(),
+            tensorflow::error::CANCELLED);
+}
+
 TEST(SamplerDeathTest, DiesIfMaxInFlightSamplesPerWorkerIsNonPositive) {
   Sampler::Options options;
 
@@ -922,6 +1685,32 @@ TEST(SamplerOptionsTest, ValidateChecksFlexibleBatchSize) {
   EXPECT_EQ(options.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
 }
 
+TEST(SamplerOptionsTest, ValidateChecksMaxResponseBytes) {
+  Sampler::Options options;
+  options.max_response_bytes = -2;
+  EXPECT_EQ(options.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
+  options.max_response_bytes = 0;
+  TF_EXPECT_OK(options.Validate());
+  options.max_response_bytes = Sampler::kAutoSelectValue;
+  TF_EXPECT_OK(options.Validate());
+}
+
+TEST(SamplerOptionsTest, ValidateChecksNumDecodeThreads) {
+  Sampler::Options options;
+  options.num_decode_threads = -1;
+  EXPECT_EQ(options.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
+  options.num_decode_threads = 4;
+  TF_EXPECT_OK(options.Validate());
+}
+
+TEST(SamplerOptionsTest, ValidateChecksChunkCacheBytes) {
+  Sampler::Options options;
+  options.chunk_cache_bytes = -1;
+  EXPECT_EQ(options.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
+  options.chunk_cache_bytes = 1 << 20;
+  TF_EXPECT_OK(options.Validate());
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
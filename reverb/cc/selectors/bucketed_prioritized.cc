@@ -0,0 +1,291 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/selectors/bucketed_prioritized.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/random/distributions.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Upper bound of `buckets_per_doubling` which lets the bucket of any finite
+// positive weight be represented as an int32.
+constexpr int kMaxBucketsPerDoubling = 1 << 20;
+
+// A priority of zero should correspond to zero probability, even if the
+// priority exponent is zero. So this modified version of std::pow is used to
+// turn priorities into weights. Expects base and exponent to be non-negative.
+inline double power(double base, double exponent) {
+  return base == 0. ? 0. : std::pow(base, exponent);
+}
+
+tensorflow::Status CheckValidPriority(double priority) {
+  if (std::isnan(priority))
+    return tensorflow::errors::InvalidArgument("Priority must not be NaN.");
+  if (priority < 0)
+    return tensorflow::errors::InvalidArgument(
+        "Priority must not be negative.");
+  return tensorflow::Status::OK();
+}
+
+}  // namespace
+
+constexpr int BucketedPrioritizedSelector::kDefaultBucketsPerDoubling;
+constexpr int32_t BucketedPrioritizedSelector::kZeroBucket;
+
+BucketedPrioritizedSelector::BucketedPrioritizedSelector(
+    double priority_exponent, int buckets_per_doubling)
+    : priority_exponent_(priority_exponent),
+      buckets_per_doubling_(buckets_per_doubling) {
+  REVERB_CHECK_GE(priority_exponent_, 0);
+  REVERB_CHECK_GE(buckets_per_doubling_, 1);
+  REVERB_CHECK_LE(buckets_per_doubling_, kMaxBucketsPerDoubling);
+}
+
+tensorflow::Status BucketedPrioritizedSelector::BucketOf(
+    double priority, int32_t* bucket) const {
+  TF_RETURN_IF_ERROR(CheckValidPriority(priority));
+  const double weight = power(priority, priority_exponent_);
+  if (!std::isfinite(weight)) {
+    return tensorflow::errors::InvalidArgument(
+        "Priority ", priority, " raised to ", priority_exponent_,
+        " must be finite.");
+  }
+  *bucket = weight == 0 ? kZeroBucket
+                        : static_cast<int32_t>(std::lround(
+                              std::log2(weight) * buckets_per_doubling_));
+  return tensorflow::Status::OK();
+}
+
+double BucketedPrioritizedSelector::BucketWeight(int32_t bucket) const {
+  if (bucket == kZeroBucket) return 0;
+  return std::exp2(static_cast<double>(bucket) / buckets_per_doubling_);
+}
+
+double BucketedPrioritizedSelector::QuantizedWeight(double priority) const {
+  int32_t bucket;
+  REVERB_CHECK(BucketOf(priority, &bucket).ok());
+  return BucketWeight(bucket);
+}
+
+tensorflow::Status BucketedPrioritizedSelector::Delete(Key key) {
+  if (!locations_.contains(key))
+    return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
+  RemoveFromBucket(key);
+  locations_.erase(key);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status BucketedPrioritizedSelector::Insert(Key key,
+                                                       double priority) {
+  int32_t bucket;
+  TF_RETURN_IF_ERROR(BucketOf(priority, &bucket));
+  if (locations_.contains(key)) {
+    return tensorflow::errors::InvalidArgument("Key ", key,
+                                               " already exists.");
+  }
+  AddToBucket(key, bucket);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status BucketedPrioritizedSelector::Update(Key key,
+                                                       double priority) {
+  int32_t bucket;
+  TF_RETURN_IF_ERROR(BucketOf(priority, &bucket));
+  const auto it = locations_.find(key);
+  if (it == locations_.end())
+    return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
+  // Most updates change the priority by less than a bucket.
+  if (it->second.bucket == bucket) return tensorflow::Status::OK();
+  RemoveFromBucket(key);
+  AddToBucket(key, bucket);
+  return tensorflow::Status::OK();
+}
+
+void BucketedPrioritizedSelector::AddToBucket(Key key, int32_t bucket) {
+  std::vector<Key>& keys = buckets_[bucket];
+  locations_[key] = {bucket, static_cast<uint32_t>(keys.size())};
+  keys.push_back(key);
+  alias_dirty_ = true;
+}
+
+void BucketedPrioritizedSelector::RemoveFromBucket(Key key) {
+  const Location location = locations_.at(key);
+  auto it = buckets_.find(location.bucket);
+  std::vector<Key>& keys = it->second;
+
+  // Replace the key that we want to remove with the last key of the bucket.
+  if (location.index != keys.size() - 1) {
+    keys[location.index] = keys.back();
+    locations_[keys[location.index]].index = location.index;
+  }
+  keys.pop_back();
+  if (keys.empty()) buckets_.erase(it);
+  alias_dirty_ = true;
+}
+
+void BucketedPrioritizedSelector::MaybeRebuildAliasTable() {
+  if (!alias_dirty_) return;
+  alias_dirty_ = false;
+  alias_.clear();
+  total_weight_ = 0;
+
+  std::vector<double> weights;
+  for (const auto& [bucket, keys] : buckets_) {
+    if (bucket == kZeroBucket) continue;
+    alias_.push_back({bucket, bucket, 1});
+    weights.push_back(BucketWeight(bucket) * keys.size());
+    total_weight_ += weights.back();
+  }
+  if (alias_.empty()) return;
+
+  // Scale the weights so that they average 1 and pair every entry which is
+  // below average with one which is above it.
+  std::vector<size_t> small;
+  std::vector<size_t> large;
+  for (size_t i = 0; i < weights.size(); i++) {
+    weights[i] *= alias_.size() / total_weight_;
+    (weights[i] < 1 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    const size_t s = small.back();
+    small.pop_back();
+    const size_t l = large.back();
+    alias_[s].threshold = weights[s];
+    alias_[s].alias = alias_[l].bucket;
+    weights[l] -= 1 - weights[s];
+    if (weights[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // Entries left over due to rounding errors have a scaled weight of ~1 and
+  // therefore always select their own bucket, which `threshold` already does.
+}
+
+ItemSelector::Key BucketedPrioritizedSelector::SampleWeighted(
+    int32_t* bucket) {
+  const AliasEntry& entry =
+      alias_[absl::Uniform<size_t>(bit_gen_, 0, alias_.size())];
+  *bucket = absl::Uniform<double>(bit_gen_, 0, 1) < entry.threshold
+                ? entry.bucket
+                : entry.alias;
+  const std::vector<Key>& keys = buckets_.at(*bucket);
+  return keys[absl::Uniform<size_t>(bit_gen_, 0, keys.size())];
+}
+
+ItemSelector::KeyWithProbability BucketedPrioritizedSelector::Sample() {
+  const size_t size = locations_.size();
+  REVERB_CHECK_NE(size, 0);
+  MaybeRebuildAliasTable();
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight_ == 0) {
+    const std::vector<Key>& keys = buckets_.at(kZeroBucket);
+    return {keys[absl::Uniform<size_t>(bit_gen_, 0, keys.size())], 1. / size};
+  }
+
+  int32_t bucket;
+  const Key key = SampleWeighted(&bucket);
+  return {key, BucketWeight(bucket) / total_weight_};
+}
+
+std::vector<ItemSelector::KeyWithProbability>
+BucketedPrioritizedSelector::SampleBatchWithoutReplacement(int batch_size) {
+  const size_t size = locations_.size();
+  REVERB_CHECK_NE(size, 0);
+  batch_size = std::min<size_t>(batch_size, size);
+  MaybeRebuildAliasTable();
+
+  std::vector<KeyWithProbability> samples;
+  samples.reserve(batch_size);
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight_ == 0) {
+    const std::vector<Key>& keys = buckets_.at(kZeroBucket);
+    for (size_t index : SampleDistinctIndices(size, batch_size, &bit_gen_)) {
+      samples.push_back({keys[index], 1. / size});
+    }
+    return samples;
+  }
+
+  // Every drawn key is masked by removing it from its bucket. Drawing stops
+  // early if only keys with zero weight remain.
+  const double total_weight = total_weight_;
+  std::vector<std::pair<Key, int32_t>> masked;
+  masked.reserve(batch_size);
+  while (samples.size() < static_cast<size_t>(batch_size)) {
+    MaybeRebuildAliasTable();
+    if (alias_.empty()) break;
+    int32_t bucket;
+    const Key key = SampleWeighted(&bucket);
+    samples.push_back({key, BucketWeight(bucket) / total_weight});
+    masked.emplace_back(key, bucket);
+    RemoveFromBucket(key);
+  }
+  for (const auto& [key, bucket] : masked) {
+    AddToBucket(key, bucket);
+  }
+  return samples;
+}
+
+void BucketedPrioritizedSelector::Clear() {
+  buckets_.clear();
+  locations_.clear();
+  alias_.clear();
+  total_weight_ = 0;
+  alias_dirty_ = false;
+}
+
+void BucketedPrioritizedSelector::Reserve(size_t num_keys) {
+  // The buckets are few and grow by doubling as keys move between them.
+  locations_.reserve(num_keys);
+}
+
+size_t BucketedPrioritizedSelector::ReservedBytesPerKey() const {
+  return internal::HashMapBytesPerElement<decltype(locations_)>();
+}
+
+KeyDistributionOptions BucketedPrioritizedSelector::options() const {
+  KeyDistributionOptions options;
+  options.mutable_prioritized()->set_priority_exponent(priority_exponent_);
+  options.mutable_prioritized()->set_buckets_per_doubling(
+      buckets_per_doubling_);
+  options.set_is_deterministic(false);
+  return options;
+}
+
+double BucketedPrioritizedSelector::TotalWeight() const {
+  if (!alias_dirty_) return total_weight_;
+  double total_weight = 0;
+  for (const auto& [bucket, keys] : buckets_) {
+    total_weight += BucketWeight(bucket) * keys.size();
+  }
+  return total_weight;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,163 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SELECTORS_BUCKETED_PRIORITIZED_H_
+#define REVERB_CC_SELECTORS_BUCKETED_PRIORITIZED_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/huge_page_allocator.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// BucketedPrioritizedSelector approximates `PrioritizedSelector` for tables
+// which are too large for the O(log n) cost of its sum tree. The exponentiated
+// priority of every key is rounded to the nearest power of
+// 2^(1 / `buckets_per_doubling`) and the keys are grouped into buckets of
+// equal rounded weight. A sample draws a bucket, in proportion to the summed
+// weight of its keys, from an alias table over the non-empty buckets and then
+// one of the keys of the bucket uniformly.
+//
+// The weight of a key is thus off by at most a factor 2^(1 / (2 *
+// `buckets_per_doubling`)), e.g ~4.4% with the default of 8 buckets, and the
+// probabilities returned with the samples are exact for the rounded weights.
+// Keys with zero priority are never sampled unless all keys have zero
+// priority, in which case keys are sampled uniformly.
+//
+// Inserts, deletes and updates move a key between buckets in O(1) time.
+// Samples take O(1) time, except for the first sample after a mutation which
+// changed the number of keys of a bucket. It rebuilds the alias table in O(B)
+// time, where B is the number of non-empty buckets, i.e at most
+// `buckets_per_doubling` times the log2 of the range of the weights.
+class BucketedPrioritizedSelector : public ItemSelector {
+ public:
+  static constexpr int kDefaultBucketsPerDoubling = 8;
+
+  BucketedPrioritizedSelector(
+      double priority_exponent,
+      int buckets_per_doubling = kDefaultBucketsPerDoubling);
+
+  // O(1) time.
+  tensorflow::Status Delete(Key key) override;
+
+  // The priority must be non-negative and its exponentiated value finite.
+  // O(1) time.
+  tensorflow::Status Insert(Key key, double priority) override;
+
+  // The priority must be non-negative and its exponentiated value finite.
+  // O(1) time.
+  tensorflow::Status Update(Key key, double priority) override;
+
+  // O(1) time unless the alias table has to be rebuilt, see above.
+  KeyWithProbability Sample() override;
+
+  // The drawn keys are masked by temporarily removing them from their
+  // buckets. O(k B) time.
+  std::vector<KeyWithProbability> SampleBatchWithoutReplacement(
+      int batch_size) override;
+
+  // O(n) time.
+  void Clear() override;
+
+  void Reserve(size_t num_keys) override;
+  size_t ReservedBytesPerKey() const override;
+
+  KeyDistributionOptions options() const override;
+
+  // Keys are sampled in proportion to their rounded exponentiated priority.
+  // O(B) time.
+  double TotalWeight() const override;
+
+  // Rounded weight which a key of `priority`, which must be valid, is sampled
+  // in proportion to.
+  double QuantizedWeight(double priority) const;
+
+ private:
+  // Bucket holding the keys with zero weight.
+  static constexpr int32_t kZeroBucket = std::numeric_limits<int32_t>::min();
+
+  struct Location {
+    // Keys of bucket `i` have a rounded weight of 2^(i /
+    // `buckets_per_doubling_`).
+    int32_t bucket;
+    // Index of the key in `buckets_[bucket]`.
+    uint32_t index;
+  };
+
+  // Returns the bucket of `priority` or an error if it isn't valid.
+  tensorflow::Status BucketOf(double priority, int32_t* bucket) const;
+
+  // Rounded weight of the keys of `bucket`.
+  double BucketWeight(int32_t bucket) const;
+
+  // Appends `key` to `bucket` (removes `key` from its bucket) and updates
+  // `locations_`.
+  void AddToBucket(Key key, int32_t bucket);
+  void RemoveFromBucket(Key key);
+
+  // Rebuilds `alias_` and `total_weight_` if the buckets have changed since
+  // they were last built.
+  void MaybeRebuildAliasTable();
+
+  // Draws a key, in proportion to its rounded weight, from the buckets of the
+  // alias table, which must have a positive total weight, and sets `bucket`
+  // to the bucket of the key.
+  Key SampleWeighted(int32_t* bucket);
+
+  // Controls the degree of prioritization. See `PrioritizedSelector`.
+  const double priority_exponent_;
+
+  // Number of buckets per factor 2 of the exponentiated priorities.
+  const int buckets_per_doubling_;
+
+  // Keys of every non-empty bucket.
+  internal::flat_hash_map<int32_t, std::vector<Key>> buckets_;
+
+  // Maps a key to its position in `buckets_`.
+  internal::HugePageHashMap<Key, Location> locations_;
+
+  // Alias table (see Vose, "A linear algorithm for generating random numbers
+  // with a given distribution") over the non-empty buckets with a positive
+  // weight. An entry is drawn uniformly and then selects `bucket` with
+  // probability `threshold` and `alias` otherwise.
+  struct AliasEntry {
+    int32_t bucket;
+    int32_t alias;
+    double threshold;
+  };
+  std::vector<AliasEntry> alias_;
+
+  // Sum of the rounded weights of all keys, as of when `alias_` was built.
+  double total_weight_ = 0;
+
+  // Whether the number of keys of any bucket has changed since `alias_` was
+  // built.
+  bool alias_dirty_ = false;
+
+  // Used for sampling, not thread-safe.
+  absl::BitGen bit_gen_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_BUCKETED_PRIORITIZED_H_
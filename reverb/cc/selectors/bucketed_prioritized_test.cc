@@ -0,0 +1,289 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/bucketed_prioritized.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+const double kInitialPriorityExponent = 1;
+
+class BucketedPrioritizedSelectorTest : public ::testing::TestWithParam<int> {
+};
+
+TEST_P(BucketedPrioritizedSelectorTest, ReturnValueSantiyChecks) {
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+
+  // Non existent keys cannot be deleted or updated.
+  EXPECT_EQ(prioritized.Delete(123).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.Update(123, 4).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Keys cannot be inserted twice.
+  TF_EXPECT_OK(prioritized.Insert(123, 4));
+  EXPECT_EQ(prioritized.Insert(123, 4).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Existing keys can be updated and sampled.
+  TF_EXPECT_OK(prioritized.Update(123, 5));
+  EXPECT_EQ(prioritized.Sample().key, 123);
+
+  // Negative priorities are not allowed.
+  EXPECT_EQ(prioritized.Update(123, -1).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.Insert(456, -1).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // NAN priorites are not allowed
+  EXPECT_EQ(prioritized.Update(123, NAN).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.Insert(456, NAN).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Infinite weights are not allowed.
+  EXPECT_EQ(prioritized.Update(123, INFINITY).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.Insert(456, INFINITY).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Existing keys cannot be deleted twice.
+  TF_EXPECT_OK(prioritized.Delete(123));
+  EXPECT_EQ(prioritized.Delete(123).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+}
+
+TEST_P(BucketedPrioritizedSelectorTest,
+       AllZeroPrioritiesResultsInUniformSampling) {
+  const int64_t kItems = 100;
+  const int64_t kSamples = 1000000;
+  double expected_probability = 1. / static_cast<double>(kItems);
+
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 0));
+  }
+  std::vector<int64_t> counts(kItems);
+  for (int i = 0; i < kSamples; i++) {
+    ItemSelector::KeyWithProbability sample = prioritized.Sample();
+    EXPECT_EQ(sample.probability, expected_probability);
+    counts[sample.key]++;
+  }
+  for (int64_t count : counts) {
+    EXPECT_NEAR(static_cast<double>(count) / static_cast<double>(kSamples),
+                expected_probability, 0.05);
+  }
+}
+
+TEST_P(BucketedPrioritizedSelectorTest, QuantizationErrorIsBounded) {
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  const double max_ratio = std::exp2(0.5 / GetParam());
+  absl::BitGen bit_gen;
+  for (int i = 0; i < 10000; i++) {
+    const double priority = absl::Uniform<double>(bit_gen, 1e-6, 1e6);
+    const double weight = prioritized.QuantizedWeight(priority);
+    EXPECT_LE(weight / priority, max_ratio * (1 + 1e-12));
+    EXPECT_GE(weight / priority, 1 / max_ratio * (1 - 1e-12));
+  }
+  EXPECT_EQ(prioritized.QuantizedWeight(0), 0);
+  EXPECT_DOUBLE_EQ(prioritized.QuantizedWeight(1), 1);
+  EXPECT_DOUBLE_EQ(prioritized.QuantizedWeight(4), 4);
+}
+
+TEST_P(BucketedPrioritizedSelectorTest,
+       SampledDistributionMatchesQuantizedProbabilities) {
+  const int kStart = 10;
+  const int kEnd = 100;
+  const int kSamples = 1000000;
+
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  double sum = 0;
+  absl::BitGen bit_gen_;
+  for (int i = 0; i < kEnd; i++) {
+    if (absl::Uniform<double>(bit_gen_, 0, 1) < 0.5) {
+      TF_EXPECT_OK(prioritized.Insert(i, i));
+    } else {
+      TF_EXPECT_OK(prioritized.Insert(i, 123));
+      TF_EXPECT_OK(prioritized.Update(i, i));
+    }
+    sum += prioritized.QuantizedWeight(i);
+  }
+  // Remove the first few items.
+  for (int i = 0; i < kStart; i++) {
+    TF_EXPECT_OK(prioritized.Delete(i));
+    sum -= prioritized.QuantizedWeight(i);
+  }
+  EXPECT_NEAR(prioritized.TotalWeight(), sum, 1e-9);
+
+  std::vector<int64_t> counts(kEnd);
+  for (int i = 0; i < kSamples; i++) {
+    ItemSelector::KeyWithProbability sample = prioritized.Sample();
+    counts[sample.key]++;
+    EXPECT_NEAR(sample.probability,
+                prioritized.QuantizedWeight(sample.key) / sum, 1e-9);
+  }
+  for (int k = 0; k < kStart; k++) EXPECT_EQ(counts[k], 0);
+  for (int k = kStart; k < kEnd; k++) {
+    EXPECT_NEAR(static_cast<double>(counts[k]) / static_cast<double>(kSamples),
+                prioritized.QuantizedWeight(k) / sum, 0.005);
+  }
+}
+
+TEST_P(BucketedPrioritizedSelectorTest, UpdatesMoveKeysBetweenBuckets) {
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 1));
+  }
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight(), 100);
+  prioritized.Sample();
+
+  // Emptying a bucket removes it from the alias table.
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(prioritized.Update(i, i == 42 ? 1024 : 0));
+  }
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight(), 1024);
+  auto sample = prioritized.Sample();
+  EXPECT_EQ(sample.key, 42);
+  EXPECT_EQ(sample.probability, 1);
+
+  // Deleting the only key with a non-zero priority makes sampling uniform.
+  TF_EXPECT_OK(prioritized.Delete(42));
+  EXPECT_EQ(prioritized.TotalWeight(), 0);
+  EXPECT_DOUBLE_EQ(prioritized.Sample().probability, 1. / 99);
+}
+
+TEST_P(BucketedPrioritizedSelectorTest, Clear) {
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i));
+  }
+  prioritized.Sample();
+  prioritized.Clear();
+  EXPECT_EQ(prioritized.TotalWeight(), 0);
+  TF_EXPECT_OK(prioritized.Insert(5, 1));
+  EXPECT_EQ(prioritized.Sample().key, 5);
+}
+
+TEST_P(BucketedPrioritizedSelectorTest, WithoutReplacementHasDistinctKeys) {
+  const int kItems = 10;
+  const int kBatches = 20000;
+
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  double sum = 0;
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i + 1));
+    sum += prioritized.QuantizedWeight(i + 1);
+  }
+  std::vector<int64_t> first_counts(kItems);
+  for (int i = 0; i < kBatches; i++) {
+    auto samples = prioritized.SampleBatchWithoutReplacement(4);
+    ASSERT_EQ(samples.size(), 4);
+    internal::flat_hash_set<ItemSelector::Key> keys;
+    for (const auto& sample : samples) {
+      EXPECT_TRUE(keys.insert(sample.key).second);
+      EXPECT_NEAR(sample.probability,
+                  prioritized.QuantizedWeight(sample.key + 1) / sum, 1e-9);
+    }
+    first_counts[samples.front().key]++;
+  }
+
+  // The first key of every batch is drawn from the full distribution.
+  for (int k = 0; k < kItems; k++) {
+    EXPECT_NEAR(static_cast<double>(first_counts[k]) / kBatches,
+                prioritized.QuantizedWeight(k + 1) / sum, 0.01);
+  }
+
+  // The masked keys have been restored.
+  EXPECT_NEAR(prioritized.TotalWeight(), sum, 1e-9);
+  EXPECT_EQ(prioritized.SampleBatchWithoutReplacement(kItems + 1).size(),
+            kItems);
+}
+
+TEST_P(BucketedPrioritizedSelectorTest,
+       WithoutReplacementSkipsZeroPriorities) {
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i < 7 ? 0 : 1));
+  }
+  auto samples = prioritized.SampleBatchWithoutReplacement(5);
+  ASSERT_EQ(samples.size(), 3);
+  for (const auto& sample : samples) {
+    EXPECT_GE(sample.key, 7);
+  }
+}
+
+TEST_P(BucketedPrioritizedSelectorTest,
+       WithoutReplacementWithAllZeroPriorities) {
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent,
+                                          GetParam());
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 0));
+  }
+  auto samples = prioritized.SampleBatchWithoutReplacement(5);
+  ASSERT_EQ(samples.size(), 5);
+  internal::flat_hash_set<ItemSelector::Key> keys;
+  for (const auto& sample : samples) {
+    EXPECT_TRUE(keys.insert(sample.key).second);
+    EXPECT_EQ(sample.probability, 0.1);
+  }
+}
+
+TEST_P(BucketedPrioritizedSelectorTest, SetsBucketsPerDoublingInOptions) {
+  BucketedPrioritizedSelector prioritized(0.1, GetParam());
+  KeyDistributionOptions expected;
+  expected.mutable_prioritized()->set_priority_exponent(0.1);
+  expected.mutable_prioritized()->set_buckets_per_doubling(GetParam());
+  expected.set_is_deterministic(false);
+  EXPECT_THAT(prioritized.options(), testing::EqualsProto(expected));
+}
+
+INSTANTIATE_TEST_SUITE_P(BucketsPerDoubling, BucketedPrioritizedSelectorTest,
+                         ::testing::Values(1, 8, 64));
+
+TEST(BucketedPrioritizedDeathTest, ClearThenSample) {
+  BucketedPrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i));
+  }
+  prioritized.Sample();
+  prioritized.Clear();
+  EXPECT_DEATH(prioritized.Sample(), "");
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -14,10 +14,15 @@
 
 #include "reverb/cc/selectors/fifo.h"
 
+#include <utility>
+#include <vector>
+
+#include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/reclaimer.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -25,6 +30,7 @@ namespace deepmind {
 namespace reverb {
 
 tensorflow::Status FifoSelector::Delete(ItemSelector::Key key) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
   auto it = key_to_iterator_.find(key);
   if (it == key_to_iterator_.end())
     return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
@@ -35,6 +41,7 @@ tensorflow::Status FifoSelector::Delete(ItemSelector::Key key) {
 
 tensorflow::Status FifoSelector::Insert(ItemSelector::Key key,
                                         double priority) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
   if (key_to_iterator_.find(key) != key_to_iterator_.end()) {
     return tensorflow::errors::InvalidArgument("Key ", key,
                                                " already inserted.");
@@ -45,6 +52,7 @@ tensorflow::Status FifoSelector::Insert(ItemSelector::Key key,
 
 tensorflow::Status FifoSelector::Update(ItemSelector::Key key,
                                         double priority) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
   if (key_to_iterator_.find(key) == key_to_iterator_.end()) {
     return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
   }
@@ -52,13 +60,73 @@ tensorflow::Status FifoSelector::Update(ItemSelector::Key key,
 }
 
 ItemSelector::KeyWithProbability FifoSelector::Sample() {
+  if (table_keys_ != nullptr) return {(*table_keys_)[slots_.front()], 1.};
   REVERB_CHECK(!keys_.empty());
   return {keys_.front(), 1.};
 }
 
+std::vector<ItemSelector::KeyWithProbability> FifoSelector::SampleBatch(
+    int batch_size) {
+  return std::vector<KeyWithProbability>(batch_size, Sample());
+}
+
 void FifoSelector::Clear() {
+  // Destroying the nodes of the list is O(n) so it is left to the reclaimer.
+  internal::Reclaimer::Default()->Reclaim(std::move(keys_));
   keys_.clear();
   key_to_iterator_.clear();
+  slots_.Clear();
+}
+
+void FifoSelector::Reserve(size_t num_keys) {
+  // The nodes of `keys_` are allocated one at a time.
+  if (table_keys_ != nullptr) {
+    slots_.Reserve(num_keys);
+  } else {
+    key_to_iterator_.reserve(num_keys);
+  }
+}
+
+size_t FifoSelector::ReservedBytesPerKey() const {
+  return table_keys_ != nullptr
+             ? internal::SlotList::kBytesPerSlot
+             : internal::HashMapBytesPerElement<decltype(key_to_iterator_)>();
+}
+
+tensorflow::Status FifoSelector::InsertAt(Slot slot, Key key, double priority) {
+  if (table_keys_ == nullptr) return Insert(key, priority);
+  slots_.PushBack(slot);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status FifoSelector::DeleteAt(Slot slot, Key key) {
+  if (table_keys_ == nullptr) return Delete(key);
+  slots_.Remove(slot);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status FifoSelector::UpdateAt(Slot slot, Key key, double priority) {
+  if (table_keys_ == nullptr) return Update(key, priority);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status FifoSelector::UpdateBatchAt(
+    absl::Span<const Slot> slots, absl::Span<const Key> keys,
+    absl::Span<const double> priorities) {
+  if (table_keys_ == nullptr) return UpdateBatch(keys, priorities);
+  return tensorflow::Status::OK();
+}
+
+bool FifoSelector::UseTableKeys(const std::vector<Key>* keys) {
+  if (keys == nullptr) {
+    table_keys_ = nullptr;
+    slots_.Clear();
+    return true;
+  }
+  if (table_keys_ == keys) return true;
+  if (table_keys_ != nullptr || !keys_.empty()) return false;
+  table_keys_ = keys;
+  return true;
 }
 
 KeyDistributionOptions FifoSelector::options() const {
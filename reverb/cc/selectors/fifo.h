@@ -16,10 +16,13 @@
 #define REVERB_CC_SELECTORS_FIFO_H_
 
 #include <list>
+#include <vector>
 
+#include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/slot_list.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
@@ -41,13 +44,35 @@ class FifoSelector : public ItemSelector {
 
   KeyWithProbability Sample() override;
 
+  // Sampling does not change the state so all samples of a batch are the same.
+  std::vector<KeyWithProbability> SampleBatch(int batch_size) override;
+
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+  size_t ReservedBytesPerKey() const override;
+
+  // Used by `Table` to keep the order of the keys in a `SlotList` rather than
+  // in a list and a map.
+  tensorflow::Status InsertAt(Slot slot, Key key, double priority) override;
+  tensorflow::Status DeleteAt(Slot slot, Key key) override;
+  tensorflow::Status UpdateAt(Slot slot, Key key, double priority) override;
+  tensorflow::Status UpdateBatchAt(
+      absl::Span<const Slot> slots, absl::Span<const Key> keys,
+      absl::Span<const double> priorities) override;
+  bool UseTableKeys(const std::vector<Key>* keys) override;
+
   KeyDistributionOptions options() const override;
 
  private:
   std::list<Key> keys_;
   internal::flat_hash_map<Key, std::list<Key>::iterator> key_to_iterator_;
+
+  // Keys of the table which the selector belongs to, or nullptr if the
+  // selector maintains its own keys. If set then the order of the keys is kept
+  // in `slots_` and `keys_` and `key_to_iterator_` are empty.
+  const std::vector<Key>* table_keys_ = nullptr;
+  internal::SlotList slots_;
 };
 
 }  // namespace reverb
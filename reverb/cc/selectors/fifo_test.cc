@@ -14,6 +14,7 @@
 
 #include "reverb/cc/selectors/fifo.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "gmock/gmock.h"
@@ -68,6 +69,72 @@ TEST(FifoSelectorTest, MatchesFifoOrdering) {
   }
 }
 
+TEST(FifoSelectorTest, SampleBatchRepeatsSample) {
+  FifoSelector fifo;
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(fifo.Insert(i, 0));
+  }
+  const ItemSelector::KeyWithProbability expected = fifo.Sample();
+  auto samples = fifo.SampleBatch(5);
+  ASSERT_EQ(samples.size(), 5);
+  for (const auto& sample : samples) {
+    EXPECT_EQ(sample.key, expected.key);
+    EXPECT_EQ(sample.probability, 1);
+  }
+}
+
+TEST(FifoSelectorTest, SampleBatchWithoutReplacementReturnsSingleKey) {
+  FifoSelector fifo;
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(fifo.Insert(i, 0));
+  }
+  auto samples = fifo.SampleBatchWithoutReplacement(5);
+  ASSERT_EQ(samples.size(), 1);
+  EXPECT_EQ(samples[0].key, 0);
+  EXPECT_EQ(samples[0].probability, 1);
+}
+
+TEST(FifoSelectorTest, UsesSlotsOfTableKeys) {
+  const int64_t kItems = 100;
+
+  // Mirrors the dense key array of a table.
+  std::vector<ItemSelector::Key> table_keys;
+  FifoSelector fifo;
+  ASSERT_TRUE(fifo.UseTableKeys(&table_keys));
+  auto delete_key = [&](ItemSelector::Key key) {
+    const size_t slot =
+        std::find(table_keys.begin(), table_keys.end(), key) -
+        table_keys.begin();
+    table_keys[slot] = table_keys.back();
+    table_keys.pop_back();
+    TF_EXPECT_OK(fifo.DeleteAt(slot, key));
+  };
+  for (int i = 0; i < kItems; i++) {
+    table_keys.push_back(i);
+    TF_EXPECT_OK(fifo.InsertAt(table_keys.size() - 1, i, 0));
+  }
+  for (int i = 0; i < kItems; i += 10) delete_key(i);
+  TF_EXPECT_OK(fifo.UpdateAt(0, table_keys[0], 1));
+
+  // Mutations without the slot are rejected.
+  EXPECT_EQ(fifo.Insert(1000, 0).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(fifo.Delete(1).code(), tensorflow::error::FAILED_PRECONDITION);
+
+  // Every 10th key was deleted and the others come out in insertion order.
+  for (int i = 0; i < kItems; i++) {
+    if (i % 10 == 0) continue;
+    ItemSelector::KeyWithProbability sample = fifo.Sample();
+    EXPECT_EQ(sample.key, i);
+    EXPECT_EQ(sample.probability, 1);
+    delete_key(sample.key);
+  }
+
+  // The keys of another table are refused.
+  std::vector<ItemSelector::Key> other_keys;
+  EXPECT_FALSE(fifo.UseTableKeys(&other_keys));
+}
+
 TEST(FifoSelectorTest, Options) {
   FifoSelector fifo;
   EXPECT_THAT(fifo.options(),
@@ -14,19 +14,48 @@
 
 #include "reverb/cc/selectors/heap.h"
 
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/dary_heap.h"
+#include "reverb/cc/support/reclaimer.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
 namespace reverb {
 
-HeapSelector::HeapSelector(bool min_heap)
-    : sign_(min_heap ? 1 : -1), update_count_(0) {}
+HeapSelector::HeapSelector(bool min_heap, int branching_factor)
+    : sign_(min_heap ? 1 : -1),
+      update_count_(0),
+      branching_factor_(branching_factor > 1 ? branching_factor : 0) {
+  if (branching_factor_ > 0) {
+    dary_heap_ = absl::make_unique<internal::DAryHeap>(branching_factor_);
+  }
+}
 
 tensorflow::Status HeapSelector::Delete(ItemSelector::Key key) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
+  if (dary_heap_ != nullptr) {
+    auto it = key_to_id_.find(key);
+    if (it == key_to_id_.end()) {
+      return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
+    }
+    const size_t id = it->second;
+    key_to_id_.erase(it);
+    dary_heap_->Remove(id);
+    if (id != dary_keys_.size() - 1) {
+      dary_keys_[id] = dary_keys_.back();
+      key_to_id_[dary_keys_[id]] = id;
+    }
+    dary_keys_.pop_back();
+    return tensorflow::Status::OK();
+  }
   auto it = nodes_.find(key);
   if (it == nodes_.end()) {
     return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
@@ -38,6 +67,16 @@ tensorflow::Status HeapSelector::Delete(ItemSelector::Key key) {
 
 tensorflow::Status HeapSelector::Insert(ItemSelector::Key key,
                                         double priority) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
+  if (dary_heap_ != nullptr) {
+    if (!key_to_id_.emplace(key, dary_keys_.size()).second) {
+      return tensorflow::errors::InvalidArgument("Key ", key,
+                                                 " already inserted.");
+    }
+    dary_heap_->Push(dary_keys_.size(), priority * sign_, update_count_++);
+    dary_keys_.push_back(key);
+    return tensorflow::Status::OK();
+  }
   if (nodes_.contains(key)) {
     return tensorflow::errors::InvalidArgument("Key ", key,
                                                " already inserted.");
@@ -50,6 +89,15 @@ tensorflow::Status HeapSelector::Insert(ItemSelector::Key key,
 
 tensorflow::Status HeapSelector::Update(ItemSelector::Key key,
                                         double priority) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
+  if (dary_heap_ != nullptr) {
+    auto it = key_to_id_.find(key);
+    if (it == key_to_id_.end()) {
+      return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
+    }
+    dary_heap_->Update(it->second, priority * sign_, update_count_++);
+    return tensorflow::Status::OK();
+  }
   if (!nodes_.contains(key)) {
     return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
   }
@@ -60,19 +108,106 @@ tensorflow::Status HeapSelector::Update(ItemSelector::Key key,
 }
 
 ItemSelector::KeyWithProbability HeapSelector::Sample() {
+  if (dary_heap_ != nullptr) {
+    const size_t top = dary_heap_->top();
+    return {table_keys_ != nullptr ? (*table_keys_)[top] : dary_keys_[top],
+            1.};
+  }
   REVERB_CHECK(!nodes_.empty());
   return {heap_.top()->key, 1.};
 }
 
+std::vector<ItemSelector::KeyWithProbability> HeapSelector::SampleBatch(
+    int batch_size) {
+  return std::vector<KeyWithProbability>(batch_size, Sample());
+}
+
 void HeapSelector::Clear() {
-  nodes_.clear();
+  // `heap_` only points into `nodes_`, whose (O(n)) destruction is left to the
+  // reclaimer.
   heap_.Clear();
+  internal::Reclaimer::Default()->Reclaim(std::move(nodes_));
+  nodes_.clear();
+  if (dary_heap_ != nullptr) dary_heap_->Clear();
+  dary_keys_.clear();
+  key_to_id_.clear();
+}
+
+void HeapSelector::Reserve(size_t num_keys) {
+  if (dary_heap_ == nullptr) {
+    // The nodes are allocated one at a time.
+    nodes_.reserve(num_keys);
+    return;
+  }
+  dary_heap_->Reserve(num_keys);
+  if (table_keys_ == nullptr) {
+    dary_keys_.reserve(num_keys);
+    key_to_id_.reserve(num_keys);
+  }
+}
+
+size_t HeapSelector::ReservedBytesPerKey() const {
+  if (dary_heap_ == nullptr) {
+    return internal::HashMapBytesPerElement<decltype(nodes_)>();
+  }
+  size_t bytes = internal::DAryHeap::BytesPerElement();
+  if (table_keys_ == nullptr) {
+    bytes +=
+        sizeof(Key) + internal::HashMapBytesPerElement<decltype(key_to_id_)>();
+  }
+  return bytes;
+}
+
+tensorflow::Status HeapSelector::InsertAt(Slot slot, Key key,
+                                          double priority) {
+  if (table_keys_ == nullptr) return Insert(key, priority);
+  dary_heap_->Push(slot, priority * sign_, update_count_++);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status HeapSelector::DeleteAt(Slot slot, Key key) {
+  if (table_keys_ == nullptr) return Delete(key);
+  dary_heap_->Remove(slot);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status HeapSelector::UpdateAt(Slot slot, Key key,
+                                          double priority) {
+  if (table_keys_ == nullptr) return Update(key, priority);
+  dary_heap_->Update(slot, priority * sign_, update_count_++);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status HeapSelector::UpdateBatchAt(
+    absl::Span<const Slot> slots, absl::Span<const Key> keys,
+    absl::Span<const double> priorities) {
+  if (table_keys_ == nullptr) return UpdateBatch(keys, priorities);
+  for (size_t i = 0; i < slots.size(); i++) {
+    dary_heap_->Update(slots[i], priorities[i] * sign_, update_count_++);
+  }
+  return tensorflow::Status::OK();
+}
+
+bool HeapSelector::UseTableKeys(const std::vector<Key>* keys) {
+  if (keys == nullptr) {
+    if (table_keys_ != nullptr) dary_heap_->Clear();
+    table_keys_ = nullptr;
+    return true;
+  }
+  if (table_keys_ == keys) return true;
+  // Only the d-ary heap is indexed by slots.
+  if (dary_heap_ == nullptr || table_keys_ != nullptr || !dary_keys_.empty()) {
+    return false;
+  }
+  table_keys_ = keys;
+  return true;
 }
 
 
 KeyDistributionOptions HeapSelector::options() const {
   KeyDistributionOptions options;
   options.mutable_heap()->set_min_heap(sign_ == 1);
+  options.mutable_heap()->set_branching_factor(branching_factor_);
   options.set_is_deterministic(true);
   return options;
 }
@@ -15,9 +15,14 @@
 #ifndef REVERB_CC_SELECTORS_HEAP_H_
 #define REVERB_CC_SELECTORS_HEAP_H_
 
+#include <memory>
+#include <vector>
+
 #include <cstdint>
+#include "absl/types/span.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/dary_heap.h"
 #include "reverb/cc/support/intrusive_heap.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -27,9 +32,15 @@ namespace reverb {
 // HeapSelector always samples the item with the lowest or highest priority
 // (controlled by `min_heap`). If multiple items share the same priority then
 // the least recently inserted or updated key is sampled.
+//
+// If `branching_factor` is greater than 1 then the keys are ordered by an
+// array backed `DAryHeap` with that many children per node instead of a heap
+// of individually allocated nodes. The d-ary heap keeps the priorities in
+// contiguous memory which makes updates of large tables cheaper, and when the
+// selector belongs to a table it is indexed by the slots of the table keys.
 class HeapSelector : public ItemSelector {
  public:
-  explicit HeapSelector(bool min_heap = true);
+  explicit HeapSelector(bool min_heap = true, int branching_factor = 0);
 
   // O(log n) time.
   tensorflow::Status Delete(Key key) override;
@@ -43,9 +54,25 @@ class HeapSelector : public ItemSelector {
   // O(1) time.
   KeyWithProbability Sample() override;
 
+  // Sampling does not change the state so all samples of a batch are the same.
+  std::vector<KeyWithProbability> SampleBatch(int batch_size) override;
+
   // O(n) time.
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+  size_t ReservedBytesPerKey() const override;
+
+  // Only used by the d-ary heap, which is then indexed by the slots of the
+  // table keys rather than by ids of its own.
+  tensorflow::Status InsertAt(Slot slot, Key key, double priority) override;
+  tensorflow::Status DeleteAt(Slot slot, Key key) override;
+  tensorflow::Status UpdateAt(Slot slot, Key key, double priority) override;
+  tensorflow::Status UpdateBatchAt(
+      absl::Span<const Slot> slots, absl::Span<const Key> keys,
+      absl::Span<const double> priorities) override;
+  bool UseTableKeys(const std::vector<Key>* keys) override;
+
   KeyDistributionOptions options() const override;
 
  private:
@@ -82,6 +109,17 @@ class HeapSelector : public ItemSelector {
 
   // Keep track of the number of inserts/updates for most-recent tie-breaking.
   uint64_t update_count_;
+
+  // Children per node of `dary_heap_`, or 0 if `heap_` and `nodes_` are used.
+  const int branching_factor_;
+
+  // Heap of the d-ary mode. Its ids index `table_keys_` if set, otherwise
+  // `dary_keys_` and `key_to_id_`, which are kept in sync with the heap by
+  // moving the last key into the id of a deleted key.
+  std::unique_ptr<internal::DAryHeap> dary_heap_;
+  std::vector<Key> dary_keys_;
+  internal::flat_hash_map<Key, size_t> key_to_id_;
+  const std::vector<Key>* table_keys_ = nullptr;
 };
 
 }  // namespace reverb
@@ -14,8 +14,13 @@
 
 #include "reverb/cc/selectors/heap.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/random/random.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/interface.h"
 #include "reverb/cc/testing/proto_test_util.h"
@@ -160,6 +165,21 @@ TEST(HeapSelectorTest, ProbabilityIsAlwaysOne) {
   }
 }
 
+TEST(HeapSelectorTest, SampleBatchRepeatsTopItem) {
+  HeapSelector heap;
+
+  TF_EXPECT_OK(heap.Insert(123, 2));
+  TF_EXPECT_OK(heap.Insert(124, 1));
+  TF_EXPECT_OK(heap.Insert(125, 3));
+
+  auto samples = heap.SampleBatch(3);
+  ASSERT_EQ(samples.size(), 3);
+  for (const auto& sample : samples) {
+    EXPECT_EQ(sample.key, 124);
+    EXPECT_EQ(sample.probability, 1);
+  }
+}
+
 TEST(HeapSelectorTest, Options) {
   HeapSelector min_heap;
   HeapSelector max_heap(false);
@@ -169,6 +189,102 @@ TEST(HeapSelectorTest, Options) {
   EXPECT_THAT(
       max_heap.options(),
       testing::EqualsProto("heap: { min_heap: false } is_deterministic: true"));
+
+  HeapSelector dary_heap(true, 4);
+  EXPECT_THAT(dary_heap.options(),
+              testing::EqualsProto("heap: { min_heap: true branching_factor: 4 "
+                                   "} is_deterministic: true"));
+}
+
+TEST(HeapSelectorTest, DAryHeapMatchesBinaryHeap) {
+  for (bool min_heap : {true, false}) {
+    for (int branching_factor : {2, 4, 8}) {
+      HeapSelector expected(min_heap);
+      HeapSelector heap(min_heap, branching_factor);
+      std::vector<ItemSelector::Key> keys;
+      absl::BitGen bit_gen;
+      for (int i = 0; i < 5000; i++) {
+        const double action = absl::Uniform<double>(bit_gen, 0, 1);
+        // Few distinct priorities so that ties are common.
+        const double priority = absl::Uniform<int>(bit_gen, 0, 20);
+        if (keys.empty() || action < 0.45) {
+          keys.push_back(i);
+          TF_ASSERT_OK(expected.Insert(i, priority));
+          TF_ASSERT_OK(heap.Insert(i, priority));
+        } else if (action < 0.7) {
+          const size_t index = absl::Uniform<size_t>(bit_gen, 0, keys.size());
+          TF_ASSERT_OK(expected.Delete(keys[index]));
+          TF_ASSERT_OK(heap.Delete(keys[index]));
+          keys[index] = keys.back();
+          keys.pop_back();
+        } else {
+          const size_t index = absl::Uniform<size_t>(bit_gen, 0, keys.size());
+          TF_ASSERT_OK(expected.Update(keys[index], priority));
+          TF_ASSERT_OK(heap.Update(keys[index], priority));
+        }
+        if (!keys.empty()) {
+          ASSERT_EQ(heap.Sample().key, expected.Sample().key);
+        }
+      }
+    }
+  }
+}
+
+TEST(HeapSelectorTest, DAryHeapUsesSlotsOfTableKeys) {
+  const int64_t kItems = 100;
+
+  // The pointer based heap keeps its own keys.
+  std::vector<ItemSelector::Key> table_keys;
+  HeapSelector binary_heap;
+  EXPECT_FALSE(binary_heap.UseTableKeys(&table_keys));
+
+  // Mirrors the dense key array of a table.
+  HeapSelector heap(true, 4);
+  ASSERT_TRUE(heap.UseTableKeys(&table_keys));
+  auto delete_key = [&](ItemSelector::Key key) {
+    const size_t slot =
+        std::find(table_keys.begin(), table_keys.end(), key) -
+        table_keys.begin();
+    table_keys[slot] = table_keys.back();
+    table_keys.pop_back();
+    TF_EXPECT_OK(heap.DeleteAt(slot, key));
+  };
+  for (int i = 0; i < kItems; i++) {
+    table_keys.push_back(i);
+    TF_EXPECT_OK(heap.InsertAt(table_keys.size() - 1, i, kItems - i));
+  }
+  for (int i = 0; i < kItems; i += 10) delete_key(i);
+
+  // Mutations without the slot are rejected.
+  EXPECT_EQ(heap.Insert(1000, 0).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(heap.Update(1, 0).code(), tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(heap.Delete(1).code(), tensorflow::error::FAILED_PRECONDITION);
+
+  // Give the keys their own order by priority, moving key 1 to the front.
+  std::vector<ItemSelector::Slot> slots;
+  std::vector<double> priorities;
+  for (size_t slot = 0; slot < table_keys.size(); slot++) {
+    slots.push_back(slot);
+    priorities.push_back(table_keys[slot]);
+  }
+  TF_EXPECT_OK(heap.UpdateBatchAt(slots, table_keys, priorities));
+  TF_EXPECT_OK(heap.UpdateAt(std::find(table_keys.begin(), table_keys.end(),
+                                       1) - table_keys.begin(),
+                             1, -1));
+
+  // Every 10th key was deleted and the others come out by priority.
+  for (int i = 1; i < kItems; i++) {
+    if (i % 10 == 0) continue;
+    ItemSelector::KeyWithProbability sample = heap.Sample();
+    EXPECT_EQ(sample.key, i);
+    EXPECT_EQ(sample.probability, 1);
+    delete_key(sample.key);
+  }
+
+  // The keys of another table are refused.
+  std::vector<ItemSelector::Key> other_keys;
+  EXPECT_FALSE(heap.UseTableKeys(&other_keys));
 }
 
 TEST(HeapSelectorDeathTest, SampleFromEmptySelector) {
@@ -180,6 +296,9 @@ TEST(HeapSelectorDeathTest, SampleFromEmptySelector) {
 
   TF_EXPECT_OK(heap.Delete(123));
   EXPECT_DEATH(heap.Sample(), "");
+
+  HeapSelector dary_heap(true, 4);
+  EXPECT_DEATH(dary_heap.Sample(), "");
 }
 
 }  // namespace
@@ -15,8 +15,17 @@
 #ifndef REVERB_CC_SELECTORS_INTERFACE_H_
 #define REVERB_CC_SELECTORS_INTERFACE_H_
 
+#include <algorithm>
+#include <vector>
+
+#include <cstddef>
 #include <cstdint>
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
@@ -32,6 +41,10 @@ class ItemSelector {
  public:
   using Key = uint64_t;
 
+  // Position of a key in the dense key array of the table (see
+  // `UseTableKeys`).
+  using Slot = size_t;
+
   struct KeyWithProbability {
     Key key;
     double probability;
@@ -51,15 +64,135 @@ class ItemSelector {
   // not exist.
   virtual tensorflow::Status Update(Key key, double priority) = 0;
 
+  // Updates the priorities of multiple keys. `keys` and `priorities` must have
+  // the same size. The updates are applied in order so if a key is repeated
+  // then its last priority is used. If an error is returned then the updates
+  // before the failing one have been applied. Implementations can override
+  // this to share work between the updates.
+  virtual tensorflow::Status UpdateBatch(absl::Span<const Key> keys,
+                                         absl::Span<const double> priorities) {
+    for (size_t i = 0; i < keys.size(); i++) {
+      TF_RETURN_IF_ERROR(Update(keys[i], priorities[i]));
+    }
+    return tensorflow::Status::OK();
+  }
+
+  // Variants of `Insert`, `Delete`, `Update` and `UpdateBatch` which also pass
+  // the slot of each key, which `Table` calls instead. A key is inserted into
+  // the slot after the last one and when a key is deleted the key in the last
+  // slot moves into its slot. Selectors which use the keys of the table can
+  // thus keep the state of each key at its slot in arrays rather than in maps
+  // keyed by key. The defaults ignore the slots.
+  virtual tensorflow::Status InsertAt(Slot slot, Key key, double priority) {
+    return Insert(key, priority);
+  }
+  virtual tensorflow::Status DeleteAt(Slot slot, Key key) {
+    return Delete(key);
+  }
+  virtual tensorflow::Status UpdateAt(Slot slot, Key key, double priority) {
+    return Update(key, priority);
+  }
+  virtual tensorflow::Status UpdateBatchAt(
+      absl::Span<const Slot> slots, absl::Span<const Key> keys,
+      absl::Span<const double> priorities) {
+    return UpdateBatch(keys, priorities);
+  }
+
   // Samples a key. Must contain keys when this is called.
   virtual KeyWithProbability Sample() = 0;
 
+  // Samples `batch_size` keys with replacement. The result is equivalent to
+  // calling `Sample` `batch_size` times without modifying the selector in
+  // between. Implementations can override this to share work between the
+  // samples. Must contain keys when this is called.
+  virtual std::vector<KeyWithProbability> SampleBatch(int batch_size) {
+    std::vector<KeyWithProbability> samples;
+    samples.reserve(batch_size);
+    for (int i = 0; i < batch_size; i++) {
+      samples.push_back(Sample());
+    }
+    return samples;
+  }
+
+  // Samples up to `batch_size` distinct keys. The probability of each key is
+  // the one `Sample` would return for it. Fewer keys are returned if the
+  // selector holds fewer keys or cannot tell more keys apart, e.g deterministic
+  // selectors, which always sample the same key until they are modified and
+  // therefore only return a single key by default. Must contain keys when this
+  // is called.
+  virtual std::vector<KeyWithProbability> SampleBatchWithoutReplacement(
+      int batch_size) {
+    return {Sample()};
+  }
+
   // Clear the distribution of all data.
   virtual void Clear() = 0;
 
+  // Allocates the structures for `num_keys` keys up front so that they don't
+  // have to grow (and be copied) while they are filled, which blocks the table
+  // for O(n) time. Called by the table after `UseTableKeys`. The reservation
+  // doesn't survive `Clear`. The default does nothing.
+  virtual void Reserve(size_t num_keys) {}
+
+  // Approximate memory which `Reserve` allocates per key.
+  virtual size_t ReservedBytesPerKey() const { return 0; }
+
+  // Offers the selector the keys of the table which it selects from, as a
+  // dense array indexed by slot which the table mutates under the same lock as
+  // it calls the selector and which holds exactly the inserted keys whenever
+  // the selector is sampled. A selector can use `keys`, and the slots passed to
+  // `InsertAt` etc, instead of maps of its own (e.g `UniformSelector` needs no
+  // state per key at all), in which case it returns true, leaves the
+  // validation of keys to the table and only needs to support the slot
+  // variants of the mutations. The table calls this with nullptr before `keys`
+  // is destroyed.
+  virtual bool UseTableKeys(const std::vector<Key>* keys) { return false; }
+
+  // Returns the sum of the weights which keys are sampled in proportion to, or
+  // a negative value if keys aren't sampled in proportion to weights (e.g
+  // FIFO). Allows the shards of a table to be sampled in proportion to their
+  // total weight, which keeps the sampling distribution across the shards
+  // equal to that of a single table.
+  virtual double TotalWeight() const { return -1; }
+
   // Options for dynamically constructing the distribution. Required when
   // reconstructing class from checkpoint.  Also used to query table metadata.
   virtual KeyDistributionOptions options() const = 0;
+
+ protected:
+  // Returned by the mutations without slot of selectors which use the keys of
+  // a table.
+  static tensorflow::Status SlotRequiredError() {
+    return tensorflow::errors::FailedPrecondition(
+        "The selector uses the keys of a table so it must be mutated with the "
+        "slots of the keys.");
+  }
+
+  // Returns `count` distinct indices in [0, `size`) in random order, where
+  // `count` must not exceed `size`. Used to sample keys uniformly without
+  // replacement. Floyd's algorithm takes a single draw per index however close
+  // `count` is to `size`.
+  static std::vector<size_t> SampleDistinctIndices(size_t size, size_t count,
+                                                   absl::BitGen* bit_gen) {
+    internal::flat_hash_set<size_t> selected;
+    selected.reserve(count);
+    std::vector<size_t> indices;
+    indices.reserve(count);
+    for (size_t j = size - count; j < size; j++) {
+      size_t index =
+          absl::Uniform<size_t>(absl::IntervalClosed, *bit_gen, 0, j);
+      if (!selected.insert(index).second) {
+        index = j;
+        selected.insert(index);
+      }
+      indices.push_back(index);
+    }
+
+    // The order in which the indices are selected is biased (e.g the last
+    // index is never selected first) so they are shuffled.
+    std::shuffle(indices.begin(), indices.end(), *bit_gen);
+    return indices;
+  }
 };
 
 }  // namespace reverb
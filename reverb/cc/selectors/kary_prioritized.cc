@@ -0,0 +1,377 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/selectors/kary_prioritized.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "absl/random/distributions.h"
+#include "absl/types/span.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/reclaimer.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Initial number of leaves. Matches the initial capacity of
+// `PrioritizedSelector`.
+constexpr size_t kInitialCapacity = 1 << 17;
+
+// A priority of zero should correspond to zero probability, even if the
+// priority exponent is zero. So this modified version of std::pow is used to
+// turn priorities into weights. Expects base and exponent to be non-negative.
+inline double power(double base, double exponent) {
+  return base == 0. ? 0. : std::pow(base, exponent);
+}
+
+tensorflow::Status CheckValidPriority(double priority) {
+  if (std::isnan(priority))
+    return tensorflow::errors::InvalidArgument("Priority must not be NaN.");
+  if (priority < 0)
+    return tensorflow::errors::InvalidArgument(
+        "Priority must not be negative.");
+  return tensorflow::Status::OK();
+}
+
+inline size_t RoundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+// Writes the inclusive prefix sums of the `B` values starting at `values` to
+// `prefix_sums`. The fixed trip count allows the compiler to unroll the loop.
+template <int B>
+inline void PrefixSumsFixed(const double* values, double* prefix_sums) {
+  double sum = 0;
+  for (int i = 0; i < B; i++) {
+    sum += values[i];
+    prefix_sums[i] = sum;
+  }
+}
+
+inline void PrefixSums(const double* values, int n, double* prefix_sums) {
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += values[i];
+    prefix_sums[i] = sum;
+  }
+}
+
+// Counts the prefix sums which are not greater than `*target` and reduces
+// `*target` by the sum of the children before the selected child. The count
+// is computed without branches so the compiler can vectorize the comparisons.
+template <int B>
+inline size_t FindChildFixed(const double* prefix_sums, double* target) {
+  size_t child = 0;
+  for (int i = 0; i < B; i++) {
+    child += prefix_sums[i] <= *target ? 1 : 0;
+  }
+  if (child == B) {
+    // Rounding errors can push the target beyond the last child. Fall back to
+    // the last child which has a non-zero weight.
+    child = B - 1;
+    while (child > 0 && prefix_sums[child] == prefix_sums[child - 1]) child--;
+  }
+  if (child > 0) *target -= prefix_sums[child - 1];
+  return child;
+}
+
+inline size_t FindChildGeneric(const double* prefix_sums, int n,
+                               double* target) {
+  size_t child = 0;
+  for (int i = 0; i < n; i++) {
+    child += prefix_sums[i] <= *target ? 1 : 0;
+  }
+  if (child == n) {
+    child = n - 1;
+    while (child > 0 && prefix_sums[child] == prefix_sums[child - 1]) child--;
+  }
+  if (child > 0) *target -= prefix_sums[child - 1];
+  return child;
+}
+
+}  // namespace
+
+KAryPrioritizedSelector::KAryPrioritizedSelector(double priority_exponent,
+                                                 int branching_factor)
+    : priority_exponent_(priority_exponent),
+      branching_factor_(branching_factor),
+      capacity_(0) {
+  REVERB_CHECK_GE(priority_exponent_, 0);
+  REVERB_CHECK_GE(branching_factor_, 2);
+  Resize(kInitialCapacity);
+}
+
+tensorflow::Status KAryPrioritizedSelector::Delete(Key key) {
+  const auto it = key_to_index_.find(key);
+  if (it == key_to_index_.end())
+    return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
+  const size_t index = it->second;
+  const size_t last_index = keys_.size() - 1;
+
+  if (index != last_index) {
+    // Replace the element that we want to remove with the last element.
+    SetLeaf(index, weights_[0][last_index]);
+    keys_[index] = keys_[last_index];
+    key_to_index_[keys_[index]] = index;
+  }
+
+  SetLeaf(last_index, 0);
+  keys_.pop_back();
+  key_to_index_.erase(key);
+
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status KAryPrioritizedSelector::Insert(Key key, double priority) {
+  TF_RETURN_IF_ERROR(CheckValidPriority(priority));
+  const size_t index = keys_.size();
+  if (!key_to_index_.try_emplace(key, index).second) {
+    return tensorflow::errors::InvalidArgument("Key ", key,
+                                               " already inserted.");
+  }
+  if (index == capacity_) {
+    Resize(capacity_ * 2);
+  }
+  keys_.push_back(key);
+  SetLeaf(index, power(priority, priority_exponent_));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status KAryPrioritizedSelector::Update(Key key, double priority) {
+  TF_RETURN_IF_ERROR(CheckValidPriority(priority));
+  const auto it = key_to_index_.find(key);
+  if (it == key_to_index_.end()) {
+    return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
+  }
+  SetLeaf(it->second, power(priority, priority_exponent_));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status KAryPrioritizedSelector::UpdateBatch(
+    absl::Span<const Key> keys, absl::Span<const double> priorities) {
+  REVERB_CHECK_EQ(keys.size(), priorities.size());
+
+  // Only the updates before the first invalid one are applied.
+  tensorflow::Status status;
+  std::vector<size_t> indices;
+  indices.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    status = CheckValidPriority(priorities[i]);
+    if (!status.ok()) break;
+    const auto it = key_to_index_.find(keys[i]);
+    if (it == key_to_index_.end()) {
+      status = tensorflow::errors::InvalidArgument("Key ", keys[i],
+                                                   " not found.");
+      break;
+    }
+    weights_[0][it->second] = power(priorities[i], priority_exponent_);
+    indices.push_back(it->second);
+  }
+  UpdateAncestors(std::move(indices));
+  return status;
+}
+
+ItemSelector::KeyWithProbability KAryPrioritizedSelector::Sample() {
+  const size_t size = keys_.size();
+  REVERB_CHECK_NE(size, 0);
+
+  // This should never be called concurrently from multiple threads.
+  const double target = absl::Uniform<double>(bit_gen_, 0, 1);
+  const double total_weight = weights_.back()[0];
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    const size_t pos = static_cast<size_t>(target * size);
+    return {keys_[pos], 1. / size};
+  }
+
+  const size_t index = FindLeaf(target * total_weight);
+  REVERB_CHECK_LT(index, size);
+  return {keys_[index], weights_[0][index] / total_weight};
+}
+
+std::vector<ItemSelector::KeyWithProbability>
+KAryPrioritizedSelector::SampleBatchWithoutReplacement(int batch_size) {
+  const size_t size = keys_.size();
+  REVERB_CHECK_NE(size, 0);
+  if (static_cast<size_t>(batch_size) > size) batch_size = size;
+
+  std::vector<KeyWithProbability> samples;
+  samples.reserve(batch_size);
+  const double total_weight = weights_.back()[0];
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    for (size_t index : SampleDistinctIndices(size, batch_size, &bit_gen_)) {
+      samples.push_back({keys_[index], 1. / size});
+    }
+    return samples;
+  }
+
+  // Drawing stops early if only keys with zero weight remain. As the prefix
+  // sums are recomputed whenever a leaf changes, restoring the weights leaves
+  // the tree exactly as it was.
+  std::vector<std::pair<size_t, double>> masked;
+  masked.reserve(batch_size);
+  while (samples.size() < static_cast<size_t>(batch_size)) {
+    const double remaining_weight = weights_.back()[0];
+    if (!(remaining_weight > 0)) break;
+    const size_t index =
+        FindLeaf(absl::Uniform<double>(bit_gen_, 0, 1) * remaining_weight);
+    const double weight = weights_[0][index];
+    if (index >= size || weight == 0) break;
+    samples.push_back({keys_[index], weight / total_weight});
+    masked.emplace_back(index, weight);
+    SetLeaf(index, 0);
+  }
+  for (const auto& [index, weight] : masked) {
+    SetLeaf(index, weight);
+  }
+  return samples;
+}
+
+void KAryPrioritizedSelector::Clear() {
+  // Rather than zeroing the levels in O(n) the tree is replaced by one of the
+  // initial capacity and the old one is released by the reclaimer.
+  auto* reclaimer = internal::Reclaimer::Default();
+  reclaimer->Reclaim(std::move(weights_));
+  reclaimer->Reclaim(std::move(prefix_sums_));
+  weights_.clear();
+  prefix_sums_.clear();
+  Resize(kInitialCapacity);
+  keys_.clear();
+  key_to_index_.clear();
+}
+
+void KAryPrioritizedSelector::Reserve(size_t num_keys) {
+  if (num_keys > capacity_) Resize(num_keys);
+  keys_.reserve(num_keys);
+  key_to_index_.reserve(num_keys);
+}
+
+size_t KAryPrioritizedSelector::ReservedBytesPerKey() const {
+  // A weight and a prefix sum per leaf, plus 1/(k - 1) as many for the inner
+  // nodes.
+  return 2 * sizeof(double) * branching_factor_ / (branching_factor_ - 1) +
+         sizeof(Key) +
+         internal::HashMapBytesPerElement<decltype(key_to_index_)>();
+}
+
+KeyDistributionOptions KAryPrioritizedSelector::options() const {
+  KeyDistributionOptions options;
+  options.mutable_prioritized()->set_priority_exponent(priority_exponent_);
+  options.mutable_prioritized()->set_branching_factor(branching_factor_);
+  options.set_is_deterministic(false);
+  return options;
+}
+
+double KAryPrioritizedSelector::TotalWeight() const {
+  return weights_.back()[0];
+}
+
+double KAryPrioritizedSelector::TotalWeightTestingOnly() const {
+  return TotalWeight();
+}
+
+void KAryPrioritizedSelector::SetLeaf(size_t index, double value) {
+  weights_[0][index] = value;
+  for (size_t level = 0; level + 1 < weights_.size(); level++) {
+    index /= branching_factor_;
+    UpdateNode(level, index);
+  }
+}
+
+void KAryPrioritizedSelector::UpdateAncestors(std::vector<size_t> indices) {
+  for (size_t level = 0; level + 1 < weights_.size() && !indices.empty();
+       level++) {
+    for (size_t& index : indices) index /= branching_factor_;
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    for (size_t node : indices) UpdateNode(level, node);
+  }
+}
+
+void KAryPrioritizedSelector::UpdateNode(size_t level, size_t node) {
+  const size_t first_child = node * branching_factor_;
+  const double* weights = weights_[level].data() + first_child;
+  double* prefix_sums = prefix_sums_[level].data() + first_child;
+  switch (branching_factor_) {
+    case 8:
+      PrefixSumsFixed<8>(weights, prefix_sums);
+      break;
+    case 16:
+      PrefixSumsFixed<16>(weights, prefix_sums);
+      break;
+    default:
+      PrefixSums(weights, branching_factor_, prefix_sums);
+  }
+  weights_[level + 1][node] = prefix_sums[branching_factor_ - 1];
+}
+
+void KAryPrioritizedSelector::Resize(size_t capacity) {
+  Level leaves = weights_.empty() ? Level() : std::move(weights_[0]);
+  leaves.resize(RoundUp(capacity, branching_factor_), 0);
+
+  weights_.clear();
+  prefix_sums_.clear();
+  weights_.push_back(std::move(leaves));
+  while (weights_.back().size() > 1) {
+    const size_t level = weights_.size() - 1;
+    const size_t num_nodes = weights_[level].size() / branching_factor_;
+    prefix_sums_.emplace_back(weights_[level].size(), 0);
+    weights_.emplace_back(
+        num_nodes > 1 ? RoundUp(num_nodes, branching_factor_) : 1, 0);
+    for (size_t node = 0; node < num_nodes; node++) {
+      UpdateNode(level, node);
+    }
+  }
+
+  capacity_ = capacity;
+}
+
+size_t KAryPrioritizedSelector::FindLeaf(double target_weight) const {
+  // Descend from the root to the leaf which contains `target_weight`. `index`
+  // is the index of the current node within its level.
+  size_t index = 0;
+  for (size_t level = weights_.size() - 1; level > 0; level--) {
+    const size_t first_child = index * branching_factor_;
+    index = first_child +
+            FindChild(prefix_sums_[level - 1].data() + first_child,
+                      &target_weight);
+  }
+  return index;
+}
+
+size_t KAryPrioritizedSelector::FindChild(const double* prefix_sums,
+                                          double* target) const {
+  switch (branching_factor_) {
+    case 8:
+      return FindChildFixed<8>(prefix_sums, target);
+    case 16:
+      return FindChildFixed<16>(prefix_sums, target);
+    default:
+      return FindChildGeneric(prefix_sums, branching_factor_, target);
+  }
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,154 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SELECTORS_KARY_PRIORITIZED_H_
+#define REVERB_CC_SELECTORS_KARY_PRIORITIZED_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/huge_page_allocator.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+// KAryPrioritizedSelector samples keys with the same probabilities as
+// `PrioritizedSelector` (proportional to the priority raised to a configurable
+// exponent) but stores the sums in a tree where each node has
+// `branching_factor` children.
+//
+// The keys are stored in the leaves and every level of the tree is stored in
+// separate arrays. For every node, the inclusive prefix sums of the weights of
+// its children are stored contiguously so with a branching factor of 8 (16)
+// they occupy one (two) cache lines. A tree holding 50M items is only 9 (7)
+// levels deep, compared to the 26 levels of the binary tree, and locating the
+// child which holds a sampled weight is a branch free compare of the target
+// against the prefix sums, which the compiler can vectorize.
+//
+// As the prefix sums of a node are always recomputed from the weights of its
+// children when a leaf changes, rounding errors do not accumulate and the tree
+// never has to be reinitialized.
+class KAryPrioritizedSelector : public ItemSelector {
+ public:
+  // The inner loops are specialized for branching factors of 8 and 16. Any
+  // other value >= 2 is also supported but slower.
+  static constexpr int kDefaultBranchingFactor = 8;
+
+  KAryPrioritizedSelector(double priority_exponent,
+                          int branching_factor = kDefaultBranchingFactor);
+
+  // O(b log_b n) time.
+  tensorflow::Status Delete(Key key) override;
+
+  // The priority must be non-negative. O(b log_b n) time.
+  tensorflow::Status Insert(Key key, double priority) override;
+
+  // The priority must be non-negative. O(b log_b n) time.
+  tensorflow::Status Update(Key key, double priority) override;
+
+  // The priorities must be non-negative. All leaves are set before their
+  // ancestors are recomputed, so ancestors shared by the keys are only
+  // recomputed once.
+  tensorflow::Status UpdateBatch(absl::Span<const Key> keys,
+                                 absl::Span<const double> priorities) override;
+
+  // O(b log_b n) time.
+  KeyWithProbability Sample() override;
+
+  // Like `PrioritizedSelector`, the drawn keys are masked by temporarily
+  // setting their weights to zero. O(k b log_b n) time.
+  std::vector<KeyWithProbability> SampleBatchWithoutReplacement(
+      int batch_size) override;
+
+  // O(n) time.
+  void Clear() override;
+
+  void Reserve(size_t num_keys) override;
+  size_t ReservedBytesPerKey() const override;
+
+  KeyDistributionOptions options() const override;
+
+  // Keys are sampled in proportion to their exponentiated priority.
+  double TotalWeight() const override;
+
+  // Returns the total weight of all keys for testing purposes only.
+  double TotalWeightTestingOnly() const;
+
+ private:
+  // The levels are aligned to cache lines so that the child sums of a node,
+  // which are stored contiguously, share as few cache lines as possible.
+  using Level = internal::HugePageVector<double>;
+
+  // Sets the exponentiated priority of the leaf at `index` and recomputes the
+  // prefix sums of all its ancestors.
+  void SetLeaf(size_t index, double value);
+
+  // Recomputes the prefix sums of the ancestors of the leaves at `indices`,
+  // each ancestor once.
+  void UpdateAncestors(std::vector<size_t> indices);
+
+  // Recomputes the prefix sums of the children of node `node` on level
+  // `level + 1` and updates the weight of the node.
+  void UpdateNode(size_t level, size_t node);
+
+  // Returns the index of the leaf which holds `target_weight`, which must be
+  // less than the total weight of the tree.
+  size_t FindLeaf(double target_weight) const;
+
+  // Allocates the levels required to hold `capacity` leaves and recomputes the
+  // prefix sums of all inner nodes.
+  void Resize(size_t capacity);
+
+  // Returns the number of children with an inclusive prefix sum not greater
+  // than `*target`, i.e. the index of the child that contains `*target`, and
+  // reduces `*target` by the sum of the children before it.
+  size_t FindChild(const double* prefix_sums, double* target) const;
+
+  // Controls the degree of prioritization. See `PrioritizedSelector`.
+  const double priority_exponent_;
+
+  // Number of children of each inner node.
+  const int branching_factor_;
+
+  // Number of leaves the tree can hold without being resized.
+  size_t capacity_;
+
+  // `weights_[0]` holds the exponentiated priorities of the keys and
+  // `weights_[i]` holds the sums of groups of `branching_factor_` consecutive
+  // nodes of `weights_[i - 1]`. The last level holds a single node, the root.
+  // `prefix_sums_[i]` holds the inclusive prefix sums of each group of
+  // `branching_factor_` consecutive nodes of `weights_[i]`. Every level but
+  // the root is padded with zeros to a multiple of `branching_factor_`.
+  std::vector<Level> weights_;
+  std::vector<Level> prefix_sums_;
+
+  // Key stored in each leaf. Only the first `keys_.size()` leaves are in use.
+  internal::HugePageVector<Key> keys_;
+
+  // Maps a key to the index of its leaf.
+  internal::HugePageHashMap<Key, size_t> key_to_index_;
+
+  // Used for sampling, not thread-safe.
+  absl::BitGen bit_gen_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_KARY_PRIORITIZED_H_
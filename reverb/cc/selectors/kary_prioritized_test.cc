@@ -0,0 +1,315 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/selectors/kary_prioritized.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+const double kInitialPriorityExponent = 1;
+
+class KAryPrioritizedSelectorTest : public ::testing::TestWithParam<int> {};
+
+TEST_P(KAryPrioritizedSelectorTest, ReturnValueSantiyChecks) {
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+
+  // Non existent keys cannot be deleted or updated.
+  EXPECT_EQ(prioritized.Delete(123).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.Update(123, 4).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Keys cannot be inserted twice.
+  TF_EXPECT_OK(prioritized.Insert(123, 4));
+  EXPECT_EQ(prioritized.Insert(123, 4).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Existing keys can be updated and sampled.
+  TF_EXPECT_OK(prioritized.Update(123, 5));
+  EXPECT_EQ(prioritized.Sample().key, 123);
+
+  // Negative priorities are not allowed.
+  EXPECT_EQ(prioritized.Update(123, -1).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.Insert(456, -1).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // NAN priorites are not allowed
+  EXPECT_EQ(prioritized.Update(123, NAN).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.Insert(456, NAN).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Existing keys cannot be deleted twice.
+  TF_EXPECT_OK(prioritized.Delete(123));
+  EXPECT_EQ(prioritized.Delete(123).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+}
+
+TEST_P(KAryPrioritizedSelectorTest, AllZeroPrioritiesResultsInUniformSampling) {
+  const int64_t kItems = 100;
+  const int64_t kSamples = 1000000;
+  double expected_probability = 1. / static_cast<double>(kItems);
+
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 0));
+  }
+  std::vector<int64_t> counts(kItems);
+  for (int i = 0; i < kSamples; i++) {
+    ItemSelector::KeyWithProbability sample = prioritized.Sample();
+    EXPECT_EQ(sample.probability, expected_probability);
+    counts[sample.key]++;
+  }
+  for (int64_t count : counts) {
+    EXPECT_NEAR(static_cast<double>(count) / static_cast<double>(kSamples),
+                expected_probability, 0.05);
+  }
+}
+
+TEST_P(KAryPrioritizedSelectorTest, SampledDistributionMatchesProbabilities) {
+  const int kStart = 10;
+  const int kEnd = 100;
+  const int kSamples = 1000000;
+
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  double sum = 0;
+  absl::BitGen bit_gen_;
+  for (int i = 0; i < kEnd; i++) {
+    if (absl::Uniform<double>(bit_gen_, 0, 1) < 0.5) {
+      TF_EXPECT_OK(prioritized.Insert(i, i));
+    } else {
+      TF_EXPECT_OK(prioritized.Insert(i, 123));
+      TF_EXPECT_OK(prioritized.Update(i, i));
+    }
+    sum += i;
+  }
+  // Remove the first few items.
+  for (int i = 0; i < kStart; i++) {
+    TF_EXPECT_OK(prioritized.Delete(i));
+    sum -= i;
+  }
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeightTestingOnly(), sum);
+
+  std::vector<int64_t> counts(kEnd);
+  internal::flat_hash_map<ItemSelector::Key, int64_t> probabilities;
+  for (int i = 0; i < kSamples; i++) {
+    ItemSelector::KeyWithProbability sample = prioritized.Sample();
+    probabilities[sample.key] = sample.probability;
+    counts[sample.key]++;
+    EXPECT_NEAR(sample.probability, sample.key / sum, 0.001);
+  }
+  for (int k = 0; k < kStart; k++) EXPECT_EQ(counts[k], 0);
+  for (int k = kStart; k < kEnd; k++) {
+    EXPECT_NEAR(static_cast<double>(counts[k]) / static_cast<double>(kSamples),
+                probabilities[k], 0.05);
+  }
+}
+
+TEST_P(KAryPrioritizedSelectorTest, GrowsBeyondInitialCapacity) {
+  const int kItems = (1 << 17) + 1000;
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i < kItems - 1 ? 0 : 1));
+  }
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 1);
+  auto sample = prioritized.Sample();
+  EXPECT_EQ(sample.key, kItems - 1);
+  EXPECT_EQ(sample.probability, 1);
+
+  // Deleting the only item with a non-zero priority moves the last item into
+  // its leaf.
+  TF_EXPECT_OK(prioritized.Delete(kItems - 1));
+  TF_EXPECT_OK(prioritized.Update(0, 2));
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 2);
+  EXPECT_EQ(prioritized.Sample().key, 0);
+}
+
+TEST_P(KAryPrioritizedSelectorTest, ReserveKeepsWeights) {
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i));
+  }
+  // Reserving (also for fewer keys than are held) doesn't change the tree.
+  prioritized.Reserve(5);
+  prioritized.Reserve(1000);
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 45);
+  for (int i = 10; i < 3000; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i < 1000 ? 0 : 1));
+  }
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 2045);
+  TF_EXPECT_OK(prioritized.Delete(9));
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 2036);
+  EXPECT_GT(prioritized.ReservedBytesPerKey(), 0);
+}
+
+TEST_P(KAryPrioritizedSelectorTest, Clear) {
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i));
+  }
+  prioritized.Clear();
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 0);
+  TF_EXPECT_OK(prioritized.Insert(5, 1));
+  EXPECT_EQ(prioritized.Sample().key, 5);
+}
+
+TEST_P(KAryPrioritizedSelectorTest, UpdateBatchMatchesUpdate) {
+  const int kItems = 1000;
+  absl::BitGen bit_gen;
+  for (int batch_size : {16, 2 * kItems}) {
+    KAryPrioritizedSelector batched(kInitialPriorityExponent, GetParam());
+    KAryPrioritizedSelector sequential(kInitialPriorityExponent, GetParam());
+    for (int i = 0; i < kItems; i++) {
+      TF_EXPECT_OK(batched.Insert(i, i));
+      TF_EXPECT_OK(sequential.Insert(i, i));
+    }
+
+    std::vector<ItemSelector::Key> keys;
+    std::vector<double> priorities;
+    for (int i = 0; i < batch_size; i++) {
+      keys.push_back(absl::Uniform<int>(bit_gen, 0, kItems));
+      priorities.push_back(absl::Uniform<int>(bit_gen, 0, 100));
+      TF_EXPECT_OK(sequential.Update(keys.back(), priorities.back()));
+    }
+    TF_EXPECT_OK(batched.UpdateBatch(keys, priorities));
+
+    // The priorities are integers so the sums are exact.
+    EXPECT_EQ(batched.TotalWeightTestingOnly(),
+              sequential.TotalWeightTestingOnly());
+    for (int i = 0; i < 100; i++) {
+      const auto sample = batched.Sample();
+      TF_EXPECT_OK(sequential.Update(sample.key, 0));
+      EXPECT_DOUBLE_EQ(sample.probability * batched.TotalWeightTestingOnly(),
+                       batched.TotalWeightTestingOnly() -
+                           sequential.TotalWeightTestingOnly());
+      TF_EXPECT_OK(batched.Update(sample.key, 0));
+    }
+  }
+}
+
+TEST_P(KAryPrioritizedSelectorTest, UpdateBatchAppliesUpdatesBeforeError) {
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  TF_EXPECT_OK(prioritized.Insert(1, 1));
+  TF_EXPECT_OK(prioritized.Insert(2, 1));
+  TF_EXPECT_OK(prioritized.Insert(3, 1));
+
+  EXPECT_EQ(prioritized.UpdateBatch({1, 2, 3}, {2, -1, 4}).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 4);
+
+  EXPECT_EQ(prioritized.UpdateBatch({3, 5}, {4, 4}).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.TotalWeightTestingOnly(), 7);
+}
+
+TEST_P(KAryPrioritizedSelectorTest, WithoutReplacementHasDistinctKeys) {
+  const int kItems = 10;
+  const int kBatches = 20000;
+
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  // Weights 1, 2, ..., 10.
+  const double sum = kItems * (kItems + 1) / 2;
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i + 1));
+  }
+  std::vector<int64_t> first_counts(kItems);
+  for (int i = 0; i < kBatches; i++) {
+    auto samples = prioritized.SampleBatchWithoutReplacement(4);
+    ASSERT_EQ(samples.size(), 4);
+    internal::flat_hash_set<ItemSelector::Key> keys;
+    for (const auto& sample : samples) {
+      EXPECT_TRUE(keys.insert(sample.key).second);
+      EXPECT_NEAR(sample.probability, (sample.key + 1) / sum, 1e-9);
+    }
+    first_counts[samples.front().key]++;
+  }
+
+  // The first key of every batch is drawn from the full distribution.
+  for (int k = 0; k < kItems; k++) {
+    EXPECT_NEAR(static_cast<double>(first_counts[k]) / kBatches,
+                (k + 1) / sum, 0.01);
+  }
+
+  // The masked weights have been restored.
+  EXPECT_NEAR(prioritized.TotalWeightTestingOnly(), sum, 1e-9);
+  EXPECT_EQ(prioritized.SampleBatchWithoutReplacement(kItems + 1).size(),
+            kItems);
+}
+
+TEST_P(KAryPrioritizedSelectorTest, WithoutReplacementSkipsZeroPriorities) {
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i < 7 ? 0 : 1));
+  }
+  auto samples = prioritized.SampleBatchWithoutReplacement(5);
+  ASSERT_EQ(samples.size(), 3);
+  for (const auto& sample : samples) {
+    EXPECT_GE(sample.key, 7);
+  }
+}
+
+TEST_P(KAryPrioritizedSelectorTest, WithoutReplacementWithAllZeroPriorities) {
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 0));
+  }
+  auto samples = prioritized.SampleBatchWithoutReplacement(5);
+  ASSERT_EQ(samples.size(), 5);
+  internal::flat_hash_set<ItemSelector::Key> keys;
+  for (const auto& sample : samples) {
+    EXPECT_TRUE(keys.insert(sample.key).second);
+    EXPECT_EQ(sample.probability, 0.1);
+  }
+}
+
+TEST_P(KAryPrioritizedSelectorTest, SetsBranchingFactorInOptions) {
+  KAryPrioritizedSelector prioritized(0.1, GetParam());
+  KeyDistributionOptions expected;
+  expected.mutable_prioritized()->set_priority_exponent(0.1);
+  expected.mutable_prioritized()->set_branching_factor(GetParam());
+  expected.set_is_deterministic(false);
+  EXPECT_THAT(prioritized.options(), testing::EqualsProto(expected));
+}
+
+INSTANTIATE_TEST_SUITE_P(BranchingFactors, KAryPrioritizedSelectorTest,
+                         ::testing::Values(2, 3, 8, 16));
+
+TEST(KAryPrioritizedDeathTest, ClearThenSample) {
+  KAryPrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i));
+  }
+  prioritized.Sample();
+  prioritized.Clear();
+  EXPECT_DEATH(prioritized.Sample(), "");
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -14,12 +14,19 @@
 
 #include "reverb/cc/selectors/prioritized.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
 
 #include "absl/random/distributions.h"
+#include "absl/types/span.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/reclaimer.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
@@ -27,10 +34,21 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
+// Initial capacity of the summary tree.
+constexpr size_t kInitialCapacity = 1 << 17;
+
 // If the approximation error at a node exceeds this threshold, the sum tree is
 // reinitialized.
 constexpr double kMaxApproximationError = 1e-4;
 
+// With reduced precision the sums of the nodes with smaller indices, i.e of
+// the top 16 levels of the tree, are stored as doubles.
+constexpr size_t kNumWideSums = (1 << 16) - 1;
+
+// If at least one in this many nodes is recomputed, the sums of all nodes are
+// recomputed in a single linear pass instead of along the updated paths.
+constexpr size_t kFullRecomputeRatio = 8;
+
 // A priority of zero should correspond to zero probability, even if the
 // priority exponent is zero. So this modified version of std::pow is used to
 // turn priorities into weights. Expects base and exponent to be non-negative.
@@ -38,6 +56,19 @@ inline double power(double base, double exponent) {
   return base == 0. ? 0. : std::pow(base, exponent);
 }
 
+// Rounds `value` towards zero so that the float sum of a node never exceeds
+// the sum of its value and the sums of its children, which would let a sample
+// fall into a gap which none of the nodes covers. Values beyond the range of
+// float are clamped.
+float ToFloat(double value) {
+  if (value >= std::numeric_limits<float>::max()) {
+    return std::numeric_limits<float>::max();
+  }
+  float rounded = static_cast<float>(value);
+  if (rounded > value) rounded = std::nextafter(rounded, 0.f);
+  return rounded;
+}
+
 tensorflow::Status CheckValidPriority(double priority) {
   if (std::isnan(priority))
     return tensorflow::errors::InvalidArgument("Priority must not be NaN.");
@@ -49,51 +80,44 @@ tensorflow::Status CheckValidPriority(double priority) {
 
 }  // namespace
 
-PrioritizedSelector::PrioritizedSelector(double priority_exponent)
-    : priority_exponent_(priority_exponent), capacity_(std::pow(2, 17)) {
+PrioritizedSelector::PrioritizedSelector(double priority_exponent,
+                                         bool reduced_precision)
+    : priority_exponent_(priority_exponent),
+      reduced_precision_(reduced_precision),
+      capacity_(kInitialCapacity) {
   REVERB_CHECK_GE(priority_exponent_, 0);
-  sum_tree_.resize(capacity_);
+  ResetTree();
 }
 
 tensorflow::Status PrioritizedSelector::Delete(Key key) {
-  const size_t last_index = key_to_index_.size() - 1;
+  if (table_keys_ != nullptr) return SlotRequiredError();
   const auto it = key_to_index_.find(key);
   if (it == key_to_index_.end())
     return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
   const size_t index = it->second;
+  key_to_index_.erase(it);
 
+  const size_t last_index = num_keys_ - 1;
   if (index != last_index) {
-    // Replace the element that we want to remove with the last element.
-    SetNode(index, NodeValue(last_index));
-    const Key last_key = sum_tree_[last_index].key;
-    sum_tree_[index].key = last_key;
-    key_to_index_[last_key] = index;
+    key_to_index_[NodeKey(last_index)] = index;
   }
-
-  SetNode(last_index, 0);
-  key_to_index_.erase(it);  // Note that this must occur after SetNode.
-
+  RemoveNode(index);
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status PrioritizedSelector::Insert(Key key, double priority) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
   TF_RETURN_IF_ERROR(CheckValidPriority(priority));
-  const size_t index = key_to_index_.size();
-  if (index == capacity_) {
-    capacity_ *= 2;
-    sum_tree_.resize(capacity_);
-  }
-  if (!key_to_index_.try_emplace(key, index).second) {
+  if (!key_to_index_.try_emplace(key, num_keys_).second) {
     return tensorflow::errors::InvalidArgument("Key ", key,
                                                " already inserted.");
   }
-  sum_tree_[index].key = key;
-
-  SetNode(index, power(priority, priority_exponent_));
+  AppendNode(key, power(priority, priority_exponent_));
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status PrioritizedSelector::Update(Key key, double priority) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
   TF_RETURN_IF_ERROR(CheckValidPriority(priority));
   const auto it = key_to_index_.find(key);
   if (it == key_to_index_.end()) {
@@ -103,73 +127,409 @@ tensorflow::Status PrioritizedSelector::Update(Key key, double priority) {
   return tensorflow::Status::OK();
 }
 
+tensorflow::Status PrioritizedSelector::UpdateBatch(
+    absl::Span<const Key> keys, absl::Span<const double> priorities) {
+  if (table_keys_ != nullptr) return SlotRequiredError();
+  REVERB_CHECK_EQ(keys.size(), priorities.size());
+
+  // Validate the updates before any changes are made. If an update is invalid
+  // then only the updates before it are applied.
+  tensorflow::Status status;
+  std::vector<size_t> indices;
+  indices.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    status = CheckValidPriority(priorities[i]);
+    if (!status.ok()) break;
+    const auto it = key_to_index_.find(keys[i]);
+    if (it == key_to_index_.end()) {
+      status = tensorflow::errors::InvalidArgument("Key ", keys[i],
+                                                   " not found.");
+      break;
+    }
+    indices.push_back(it->second);
+  }
+  SetNodes(indices, priorities);
+  return status;
+}
+
+tensorflow::Status PrioritizedSelector::InsertAt(Slot slot, Key key,
+                                                 double priority) {
+  if (table_keys_ == nullptr) return Insert(key, priority);
+  TF_RETURN_IF_ERROR(CheckValidPriority(priority));
+  REVERB_CHECK_EQ(slot, num_keys_);
+  AppendNode(key, power(priority, priority_exponent_));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status PrioritizedSelector::DeleteAt(Slot slot, Key key) {
+  if (table_keys_ == nullptr) return Delete(key);
+  REVERB_CHECK_LT(slot, num_keys_);
+  RemoveNode(slot);
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status PrioritizedSelector::UpdateAt(Slot slot, Key key,
+                                                 double priority) {
+  if (table_keys_ == nullptr) return Update(key, priority);
+  TF_RETURN_IF_ERROR(CheckValidPriority(priority));
+  REVERB_CHECK_LT(slot, num_keys_);
+  SetNode(slot, power(priority, priority_exponent_));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status PrioritizedSelector::UpdateBatchAt(
+    absl::Span<const Slot> slots, absl::Span<const Key> keys,
+    absl::Span<const double> priorities) {
+  if (table_keys_ == nullptr) return UpdateBatch(keys, priorities);
+  REVERB_CHECK_EQ(slots.size(), priorities.size());
+
+  // Only the updates before the first invalid priority are applied.
+  tensorflow::Status status;
+  size_t num_valid = 0;
+  for (; num_valid < slots.size(); num_valid++) {
+    status = CheckValidPriority(priorities[num_valid]);
+    if (!status.ok()) break;
+    REVERB_CHECK_LT(slots[num_valid], num_keys_);
+  }
+  SetNodes(slots.subspan(0, num_valid), priorities);
+  return status;
+}
+
+bool PrioritizedSelector::UseTableKeys(const std::vector<Key>* keys) {
+  if (keys == nullptr) {
+    if (table_keys_ != nullptr) Clear();
+    table_keys_ = nullptr;
+    return true;
+  }
+  if (table_keys_ == keys) return true;
+  if (table_keys_ != nullptr || num_keys_ != 0) return false;
+
+  // Release the memory of the (empty) map which is no longer used.
+  key_to_index_ = internal::HugePageHashMap<Key, size_t>();
+  table_keys_ = keys;
+  return true;
+}
+
+void PrioritizedSelector::AppendNode(Key key, double value) {
+  const size_t index = num_keys_;
+  if (index == capacity_) {
+    capacity_ *= 2;
+    ResizeTree();
+  }
+  SetNodeKey(index, key);
+  ++num_keys_;
+  SetNode(index, value);
+}
+
+void PrioritizedSelector::RemoveNode(size_t index) {
+  const size_t last_index = num_keys_ - 1;
+  if (index != last_index) {
+    // Replace the element that we want to remove with the last element.
+    SetNode(index, NodeValue(last_index));
+    SetNodeKey(index, NodeKey(last_index));
+  }
+  SetNode(last_index, 0);
+  --num_keys_;  // Note that this must occur after SetNode.
+}
+
+void PrioritizedSelector::SetNodes(absl::Span<const size_t> indices,
+                                   absl::Span<const double> priorities) {
+  // Write the new values of all the updated nodes before any sums are
+  // recomputed.
+  for (size_t i = 0; i < indices.size(); i++) {
+    SetNodeValue(indices[i], power(priorities[i], priority_exponent_));
+  }
+  RecomputeSums(indices);
+}
+
+void PrioritizedSelector::RecomputeSums(absl::Span<const size_t> indices) {
+  // Recompute the sums bottom-up. The parent of a node always has a smaller
+  // index than the node itself so by always processing the largest pending
+  // index, all children of a node are recomputed before the node itself and
+  // each node is recomputed exactly once. Since the sums are recomputed from
+  // the children rather than adjusted by the difference, no rounding errors are
+  // accumulated on the updated paths.
+  if (indices.size() * kFullRecomputeRatio >= num_keys_) {
+    for (size_t index = num_keys_; index-- > 0;) {
+      SetNodeSum(index, NodeValue(index) + NodeSum(2 * index + 1) +
+                            NodeSum(2 * index + 2));
+    }
+    return;
+  }
+  std::priority_queue<size_t> pending(indices.begin(), indices.end());
+  while (!pending.empty()) {
+    const size_t index = pending.top();
+    while (!pending.empty() && pending.top() == index) pending.pop();
+    SetNodeSum(index, NodeValue(index) + NodeSum(2 * index + 1) +
+                          NodeSum(2 * index + 2));
+    if (index != 0) pending.push((index - 1) / 2);
+  }
+}
+
 ItemSelector::KeyWithProbability PrioritizedSelector::Sample() {
-  const size_t size = key_to_index_.size();
+  const size_t size = num_keys_;
   REVERB_CHECK_NE(size, 0);
 
   // This should never be called concurrently from multiple threads.
   const double target = absl::Uniform<double>(bit_gen_, 0, 1);
-  const double total_weight = sum_tree_[0].sum;
+  const double total_weight = NodeSum(0);
 
   // All keys have zero priority so treat as if uniformly sampling.
   if (total_weight == 0) {
     const size_t pos = static_cast<size_t>(target * size);
-    return {sum_tree_[pos].key, 1. / size};
+    return {NodeKey(pos), 1. / size};
   }
 
+  double target_weight = target * total_weight;
+  const size_t index = FindNode(&target_weight);
+  REVERB_CHECK_LT(index, size);
+  const double picked_weight = NodeValue(index);
+  REVERB_LOG_IF(REVERB_ERROR, target_weight >= picked_weight)
+      << "Target weight should be smaller than picked weight (target_weight: "
+      << target_weight << " >= picked_weight:" << picked_weight << ").";
+  return {NodeKey(index), picked_weight / total_weight};
+}
+
+size_t PrioritizedSelector::FindNode(double* target_weight) const {
   // We begin traversing the `sum_tree_` from the root to the children in order
   // to find the `index` corresponding to the sampled `target_weight`.
   size_t index = 0;
-  double target_weight = target * total_weight;
   while (true) {
     // Go to the left sub tree if it contains our sampled `target_weight`.
     const size_t left_index = 2 * index + 1;
     const double left_sum = NodeSum(left_index);
-    if (target_weight < left_sum) {
+    if (*target_weight < left_sum) {
       index = left_index;
       continue;
     }
-    target_weight -= left_sum;
+    *target_weight -= left_sum;
     // Go to the right sub tree if it contains our sampled `target_weight`.
     const size_t right_index = 2 * index + 2;
     const double right_sum = NodeSum(right_index);
-    if (target_weight < right_sum) {
+    if (*target_weight < right_sum) {
       index = right_index;
       continue;
     }
-    target_weight -= right_sum;
+    *target_weight -= right_sum;
     // Otherwise it is the current index.
-    break;
+    return index;
   }
-  REVERB_CHECK_LT(index, size);
-  const double picked_weight = NodeValue(index);
-  REVERB_LOG_IF(REVERB_ERROR, target_weight >= picked_weight)
-      << "Target weight should be smaller than picked weight (target_weight: "
-      << target_weight << " >= picked_weight:" << picked_weight << ").";
-  return {sum_tree_[index].key, picked_weight / total_weight};
 }
 
-void PrioritizedSelector::Clear() {
-  for (size_t i = 0; i < key_to_index_.size(); ++i) {
-    sum_tree_[i].sum = 0;
-    sum_tree_[i].value = 0;
+std::vector<ItemSelector::KeyWithProbability> PrioritizedSelector::SampleBatch(
+    int batch_size) {
+  const size_t size = num_keys_;
+  REVERB_CHECK_NE(size, 0);
+
+  std::vector<KeyWithProbability> samples(batch_size);
+  const double total_weight = NodeSum(0);
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    for (auto& sample : samples) {
+      const double target = absl::Uniform<double>(bit_gen_, 0, 1);
+      sample = {NodeKey(static_cast<size_t>(target * size)), 1. / size};
+    }
+    return samples;
   }
+
+  // The targets are drawn independently, exactly like in `Sample`, and then
+  // sorted so that all targets which fall within the same sub tree are resolved
+  // together. The samples are returned in the order the targets were drawn.
+  std::vector<Target> targets(batch_size);
+  for (int i = 0; i < batch_size; i++) {
+    targets[i] = {absl::Uniform<double>(bit_gen_, 0, 1) * total_weight, i};
+  }
+  std::sort(targets.begin(), targets.end());
+
+  const Target* begin = targets.data();
+  SampleSubTree(0, 0, begin, begin + targets.size(), total_weight, &samples);
+  return samples;
+}
+
+std::vector<ItemSelector::KeyWithProbability>
+PrioritizedSelector::SampleBatchWithoutReplacement(int batch_size) {
+  const size_t size = num_keys_;
+  REVERB_CHECK_NE(size, 0);
+  if (static_cast<size_t>(batch_size) > size) batch_size = size;
+
+  std::vector<KeyWithProbability> samples;
+  samples.reserve(batch_size);
+  const double total_weight = NodeSum(0);
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    for (size_t index : SampleDistinctIndices(size, batch_size, &bit_gen_)) {
+      samples.push_back({NodeKey(index), 1. / size});
+    }
+    return samples;
+  }
+
+  // Every drawn key is masked by setting its value to zero. Drawing stops early
+  // if only keys with zero weight remain, which (due to rounding) can also
+  // show up as a drawn node which is already masked.
+  std::vector<size_t> masked;
+  std::vector<double> values;
+  masked.reserve(batch_size);
+  values.reserve(batch_size);
+  while (samples.size() < static_cast<size_t>(batch_size)) {
+    const double remaining_weight = NodeSum(0);
+    if (!(remaining_weight > 0)) break;
+    double target_weight =
+        absl::Uniform<double>(bit_gen_, 0, 1) * remaining_weight;
+    const size_t index = FindNode(&target_weight);
+    const double value = NodeValue(index);
+    if (index >= size || value == 0) break;
+    samples.push_back({NodeKey(index), value / total_weight});
+    masked.push_back(index);
+    values.push_back(value);
+    SetNode(index, 0);
+  }
+
+  // The sums are recomputed from the restored values rather than adjusted so
+  // the masking doesn't leave rounding errors behind.
+  for (size_t i = 0; i < masked.size(); i++) {
+    SetNodeValue(masked[i], values[i]);
+  }
+  RecomputeSums(masked);
+  return samples;
+}
+
+void PrioritizedSelector::SampleSubTree(
+    size_t index, double offset, const Target* begin, const Target* end,
+    double total_weight, std::vector<KeyWithProbability>* samples) const {
+  if (begin == end) return;
+
+  auto below = [](const Target& target, double weight) {
+    return target.first < weight;
+  };
+
+  // Targets smaller than the upper bound of the left sub tree belong to it.
+  const size_t left_index = 2 * index + 1;
+  const double left_end = offset + NodeSum(left_index);
+  const Target* left_targets_end =
+      std::lower_bound(begin, end, left_end, below);
+  SampleSubTree(left_index, offset, begin, left_targets_end, total_weight,
+                samples);
+
+  // Of the remaining targets, those smaller than the upper bound of the right
+  // sub tree belong to it.
+  const size_t right_index = 2 * index + 2;
+  const double right_end = left_end + NodeSum(right_index);
+  const Target* right_targets_end =
+      std::lower_bound(left_targets_end, end, right_end, below);
+  SampleSubTree(right_index, left_end, left_targets_end, right_targets_end,
+                total_weight, samples);
+
+  // Otherwise it is the current index.
+  if (right_targets_end == end) return;
+  REVERB_CHECK_LT(index, num_keys_);
+  const KeyWithProbability sample = {NodeKey(index),
+                                     NodeValue(index) / total_weight};
+  for (const Target* it = right_targets_end; it != end; ++it) {
+    (*samples)[it->second] = sample;
+  }
+}
+
+void PrioritizedSelector::Clear() {
+  // Rather than zeroing the nodes in O(n) the tree is replaced by one of the
+  // initial capacity and the old one is released by the reclaimer.
+  internal::Reclaimer::Default()->Reclaim(std::move(sum_tree_));
+  internal::Reclaimer::Default()->Reclaim(std::move(compact_tree_));
+  capacity_ = kInitialCapacity;
+  ResetTree();
+  num_keys_ = 0;
   key_to_index_.clear();
 }
 
+void PrioritizedSelector::Reserve(size_t num_keys) {
+  if (num_keys > capacity_) {
+    capacity_ = num_keys;
+    ResizeTree();
+  }
+  if (table_keys_ == nullptr) key_to_index_.reserve(num_keys);
+}
+
+size_t PrioritizedSelector::ReservedBytesPerKey() const {
+  size_t bytes = reduced_precision_ ? sizeof(CompactNode) : sizeof(Node);
+  if (table_keys_ == nullptr) {
+    bytes += internal::HashMapBytesPerElement<decltype(key_to_index_)>();
+  }
+  return bytes;
+}
+
 KeyDistributionOptions PrioritizedSelector::options() const {
   KeyDistributionOptions options;
   options.mutable_prioritized()->set_priority_exponent(priority_exponent_);
+  options.mutable_prioritized()->set_reduced_precision(reduced_precision_);
   options.set_is_deterministic(false);
   return options;
 }
 
+double PrioritizedSelector::TotalWeight() const { return NodeSum(0); }
+
 double PrioritizedSelector::NodeValue(size_t index) const {
-  return sum_tree_[index].value;
+  return reduced_precision_ ? compact_tree_[index].value
+                            : sum_tree_[index].value;
 }
 
 double PrioritizedSelector::NodeSum(size_t index) const {
-  return index < key_to_index_.size() ? sum_tree_[index].sum : 0;
+  if (index >= num_keys_) return 0;
+  if (!reduced_precision_) return sum_tree_[index].sum;
+  return index < kNumWideSums ? wide_sums_[index] : compact_tree_[index].sum;
+}
+
+ItemSelector::Key PrioritizedSelector::NodeKey(size_t index) const {
+  return reduced_precision_ ? compact_tree_[index].key : sum_tree_[index].key;
+}
+
+void PrioritizedSelector::SetNodeKey(size_t index, Key key) {
+  if (reduced_precision_) {
+    compact_tree_[index].key = key;
+  } else {
+    sum_tree_[index].key = key;
+  }
+}
+
+void PrioritizedSelector::SetNodeValue(size_t index, double value) {
+  if (reduced_precision_) {
+    compact_tree_[index].value = ToFloat(value);
+  } else {
+    sum_tree_[index].value = value;
+  }
+}
+
+void PrioritizedSelector::SetNodeSum(size_t index, double sum) {
+  if (!reduced_precision_) {
+    sum_tree_[index].sum = sum;
+  } else if (index < kNumWideSums) {
+    wide_sums_[index] = sum;
+  } else {
+    compact_tree_[index].sum = ToFloat(sum);
+  }
+}
+
+void PrioritizedSelector::ResizeTree() {
+  if (reduced_precision_) {
+    compact_tree_.resize(capacity_);
+  } else {
+    sum_tree_.resize(capacity_);
+  }
+}
+
+void PrioritizedSelector::ResetTree() {
+  if (reduced_precision_) {
+    compact_tree_ = internal::HugePageVector<CompactNode>(capacity_);
+    wide_sums_.assign(kNumWideSums, 0);
+  } else {
+    sum_tree_ = internal::HugePageVector<Node>(capacity_);
+  }
+}
+
+size_t PrioritizedSelector::TreeBytes() const {
+  return sum_tree_.capacity() * sizeof(Node) +
+         compact_tree_.capacity() * sizeof(CompactNode) +
+         wide_sums_.capacity() * sizeof(double);
 }
 
 double PrioritizedSelector::NodeSumTestingOnly(size_t index) const {
@@ -187,6 +547,18 @@ double PrioritizedSelector::NodeSumTestingOnly(size_t index) const {
                    NodeSum(2 * (i) + 2) - sum_tree_[(i)].value);
 
 void PrioritizedSelector::SetNode(size_t index, double value) {
+  if (reduced_precision_) {
+    // The sums are recomputed from the children, as adjusting the float sums
+    // by the difference would quickly accumulate rounding errors.
+    SetNodeValue(index, value);
+    while (true) {
+      SetNodeSum(index, NodeValue(index) + NodeSum(2 * index + 1) +
+                            NodeSum(2 * index + 2));
+      if (index == 0) return;
+      index = (index - 1) / 2;
+    }
+  }
+
   const double difference = value - NodeValue(index);
 
   // The floating point approximation error of the last node update.
@@ -216,8 +588,8 @@ void PrioritizedSelector::SetNode(size_t index, double value) {
 
 void PrioritizedSelector::ReinitializeSumTree() {
   // Re-initialize the sums from the leaves to the root node.
-  for (int64_t i = sum_tree_.size() - 1; i >= 0; --i) {
-    sum_tree_[i].sum = NodeValue(i) + NodeSum(2 * i + 1) + NodeSum(2 * i + 2);
+  for (int64_t i = capacity_ - 1; i >= 0; --i) {
+    SetNodeSum(i, NodeValue(i) + NodeSum(2 * i + 1) + NodeSum(2 * i + 2));
   }
 }
 
@@ -15,12 +15,15 @@
 #ifndef REVERB_CC_SELECTORS_PRIORITIZED_H_
 #define REVERB_CC_SELECTORS_PRIORITIZED_H_
 
+#include <utility>
 #include <vector>
 
 #include "absl/random/random.h"
+#include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/huge_page_allocator.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
@@ -37,12 +40,22 @@ namespace reverb {
 // roughly the same scale and the priority exponent is not large, e.g. less than
 // 2.
 //
+// With `reduced_precision` the exponentiated priorities and the sums of most
+// of the tree are stored as floats, which takes a third less memory (16 rather
+// than 24 bytes per slot). The sums of the top levels of the tree, which cover
+// many keys, are still kept as doubles. To keep the error of the float sums
+// bounded they are recomputed from the children on every update rather than
+// adjusted by the difference, which costs two more loads per level. The
+// exponentiated priorities are then only accurate to ~7 significant digits and
+// are clamped to the largest float.
+//
 // This was forked from:
 // ## proportional_picker.h
 //
 class PrioritizedSelector : public ItemSelector {
  public:
-  explicit PrioritizedSelector(double priority_exponent);
+  explicit PrioritizedSelector(double priority_exponent,
+                               bool reduced_precision = false);
 
   // O(log n) time.
   tensorflow::Status Delete(Key key) override;
@@ -53,17 +66,56 @@ class PrioritizedSelector : public ItemSelector {
   // The priority must be non-negative. O(log n) time.
   tensorflow::Status Update(Key key, double priority) override;
 
+  // All leaves are written first and then every affected inner node is
+  // recomputed from its children exactly once. O(k log n) time but, unlike k
+  // calls to `Update`, the nodes shared by the paths of multiple keys are only
+  // visited once.
+  tensorflow::Status UpdateBatch(absl::Span<const Key> keys,
+                                 absl::Span<const double> priorities) override;
+
   // O(log n) time.
   KeyWithProbability Sample() override;
 
+  // The targets of the batch are sorted and resolved in a single traversal of
+  // the sum tree so the upper levels, which are shared by the paths of most
+  // samples, are only visited once. O(k log k + k log n) time.
+  std::vector<KeyWithProbability> SampleBatch(int batch_size) override;
+
+  // The keys are drawn one by one and the weight of every drawn key is
+  // temporarily set to zero, so the following draws are proportional to the
+  // weights of the remaining keys. The weights are restored before returning.
+  // Only keys with a non-zero weight are returned unless all weights are zero,
+  // in which case the keys are sampled uniformly. O(k log n) time.
+  std::vector<KeyWithProbability> SampleBatchWithoutReplacement(
+      int batch_size) override;
+
   // O(n) time.
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+  size_t ReservedBytesPerKey() const override;
+
+  // Used by `Table`, whose slots are used as the indices of the leaves in
+  // `sum_tree_` so `key_to_index_` isn't needed.
+  tensorflow::Status InsertAt(Slot slot, Key key, double priority) override;
+  tensorflow::Status DeleteAt(Slot slot, Key key) override;
+  tensorflow::Status UpdateAt(Slot slot, Key key, double priority) override;
+  tensorflow::Status UpdateBatchAt(
+      absl::Span<const Slot> slots, absl::Span<const Key> keys,
+      absl::Span<const double> priorities) override;
+  bool UseTableKeys(const std::vector<Key>* keys) override;
+
   KeyDistributionOptions options() const override;
 
+  // Keys are sampled in proportion to their exponentiated priority.
+  double TotalWeight() const override;
+
   // Returns the sum stored at a node for testing purposes only.
   double NodeSumTestingOnly(size_t index) const;
 
+  // Bytes allocated for the sum tree.
+  size_t TreeBytes() const;
+
  private:
   struct Node {
     Key key;
@@ -78,6 +130,45 @@ class PrioritizedSelector : public ItemSelector {
     double value = 0;
   };
 
+  // Layout of the nodes with `reduced_precision`. The sums of the nodes in
+  // `wide_sums_` are stored there instead of in `sum`.
+  struct CompactNode {
+    Key key;
+    float sum = 0;
+    float value = 0;
+  };
+
+  // Target weight of a sample and the index of the sample in the batch.
+  using Target = std::pair<double, int>;
+
+  // Resolves the sorted targets in [`begin`, `end`) within the sub tree rooted
+  // at `index`, which covers the weights [`offset`, `offset` + sum). The
+  // selected keys are written to `samples` at the index of the target.
+  void SampleSubTree(size_t index, double offset, const Target* begin,
+                     const Target* end, double total_weight,
+                     std::vector<KeyWithProbability>* samples) const;
+
+  // Appends a node for `key` with the exponentiated priority `value`.
+  void AppendNode(Key key, double value);
+
+  // Replaces the node at `index` with the last node.
+  void RemoveNode(size_t index);
+
+  // Sets the values of the nodes at `indices` to the exponentiated
+  // `priorities` and recomputes the sums of their ancestors.
+  void SetNodes(absl::Span<const size_t> indices,
+                absl::Span<const double> priorities);
+
+  // Recomputes the sums of the nodes at `indices` and of their ancestors from
+  // the values of the nodes. If `indices` covers a large share of the nodes
+  // then all sums are recomputed, which takes O(n) time.
+  void RecomputeSums(absl::Span<const size_t> indices);
+
+  // Returns the index of the node which holds `target_weight`, which must be
+  // less than the total weight of the tree, and reduces `*target_weight` by
+  // the weight of the nodes before it.
+  size_t FindNode(double* target_weight) const;
+
   // Gets the individual value of a node in `sum_tree_` without the summed up
   // value of all its descendants.
   double NodeValue(size_t index) const;
@@ -86,6 +177,18 @@ class PrioritizedSelector : public ItemSelector {
   // If the index is out of bounds, then 0 is returned.
   double NodeSum(size_t index) const;
 
+  // Accessors of the fields of the nodes which hide the layout of the tree.
+  // The setters only write the node itself.
+  Key NodeKey(size_t index) const;
+  void SetNodeKey(size_t index, Key key);
+  void SetNodeValue(size_t index, double value);
+  void SetNodeSum(size_t index, double sum);
+
+  // Allocates a tree of `capacity_` nodes. The nodes in the current tree are
+  // kept if it is resized rather than reset.
+  void ResizeTree();
+  void ResetTree();
+
   // Sets the individual value of a node in the `sum_tree_`. This does not
   // include the value of the descendants. Usually, this operation's runtime is
   // in O(log n). However, if floating point rounding errors have accumulated to
@@ -105,15 +208,32 @@ class PrioritizedSelector : public ItemSelector {
   // probability (except for keys with zero priority).
   const double priority_exponent_;
 
+  // Whether the tree is stored in `compact_tree_` and `wide_sums_` rather than
+  // `sum_tree_`.
+  const bool reduced_precision_;
+
   // Capacity of the summary tree. Starts at ~130000 and grows exponentially.
   size_t capacity_;
 
   // A tree stored as a flat vector were each node is the sum of its children
-  // plus its own exponentiated priority.
-  std::vector<Node> sum_tree_;
+  // plus its own exponentiated priority. Empty if `reduced_precision_`.
+  internal::HugePageVector<Node> sum_tree_;
+
+  // The same tree with `reduced_precision_`, where the sums of the top levels
+  // are stored in `wide_sums_`.
+  internal::HugePageVector<CompactNode> compact_tree_;
+  internal::HugePageVector<double> wide_sums_;
+
+  // Number of keys, which occupy the first `num_keys_` nodes of `sum_tree_`.
+  size_t num_keys_ = 0;
+
+  // Maps a key to the index where this key can be found in `sum_tree_`. Empty
+  // if `table_keys_` is set.
+  internal::HugePageHashMap<Key, size_t> key_to_index_;
 
-  // Maps a key to the index where this key can be found in `sum_tree_`.
-  internal::flat_hash_map<Key, size_t> key_to_index_;
+  // Keys of the table which the selector belongs to, or nullptr if the
+  // selector maintains its own index of the keys.
+  const std::vector<Key>* table_keys_ = nullptr;
 
   // Used for sampling, not thread-safe.
   absl::BitGen bit_gen_;
@@ -0,0 +1,149 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the binary sum tree of `PrioritizedSelector` with the k-ary sum tree
+// of `KAryPrioritizedSelector`, the full with the reduced precision binary
+// tree, and the trees with the alias table over logarithmic buckets of
+// `BucketedPrioritizedSelector`. Besides the time per operation the memory of
+// the binary trees and the error of the reported probabilities (relative to
+// the exact priorities) are logged. The tables are large so the test is tagged
+// as manual and has to be run explicitly:
+//
+//   bazel test -c opt //reverb/cc/selectors:prioritized_benchmark_test \
+//     --test_output=streamed
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/selectors/bucketed_prioritized.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/kary_prioritized.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr int kNumSamples = 1000000;
+constexpr int kNumUpdates = 1000000;
+
+struct Candidate {
+  std::string name;
+  std::function<std::unique_ptr<ItemSelector>()> make;
+};
+
+std::vector<Candidate> Candidates() {
+  return {
+      {"binary", [] { return absl::make_unique<PrioritizedSelector>(1); }},
+      {"binary-f32",
+       [] {
+         return absl::make_unique<PrioritizedSelector>(
+             1, /*reduced_precision=*/true);
+       }},
+      {"8-ary",
+       [] { return absl::make_unique<KAryPrioritizedSelector>(1, 8); }},
+      {"16-ary",
+       [] { return absl::make_unique<KAryPrioritizedSelector>(1, 16); }},
+      {"bucketed",
+       [] { return absl::make_unique<BucketedPrioritizedSelector>(1); }},
+  };
+}
+
+double NanosPerOp(absl::Duration elapsed, int64_t num_ops) {
+  return absl::ToDoubleNanoseconds(elapsed) / num_ops;
+}
+
+void RunBenchmark(int64_t num_items) {
+  absl::BitGen bit_gen;
+  std::vector<double> priorities(num_items);
+  for (auto& priority : priorities) {
+    priority = absl::Uniform<double>(bit_gen, 0, 100);
+  }
+  std::vector<ItemSelector::Key> update_keys(kNumUpdates);
+  for (auto& key : update_keys) {
+    key = absl::Uniform<ItemSelector::Key>(bit_gen, 0, num_items);
+  }
+
+  for (const auto& candidate : Candidates()) {
+    auto selector = candidate.make();
+
+    absl::Time start = absl::Now();
+    for (int64_t i = 0; i < num_items; i++) {
+      TF_ASSERT_OK(selector->Insert(i, priorities[i]));
+    }
+    const absl::Duration insert_time = absl::Now() - start;
+
+    start = absl::Now();
+    int64_t checksum = 0;
+    for (int i = 0; i < kNumSamples; i++) {
+      checksum += selector->Sample().key;
+    }
+    const absl::Duration sample_time = absl::Now() - start;
+
+    // The probabilities are compared with those of the exact priorities, of
+    // which the sum is accumulated in long double.
+    long double exact_sum = 0;
+    for (double priority : priorities) exact_sum += priority;
+    double max_error = 0;
+    for (int i = 0; i < kNumSamples / 100; i++) {
+      const auto sample = selector->Sample();
+      const double exact = priorities[sample.key] / exact_sum;
+      max_error = std::max(max_error,
+                           std::abs(sample.probability - exact) / exact);
+    }
+
+    start = absl::Now();
+    for (int i = 0; i < kNumUpdates; i++) {
+      TF_ASSERT_OK(selector->Update(update_keys[i], i % 100));
+    }
+    const absl::Duration update_time = absl::Now() - start;
+
+    EXPECT_GT(checksum, 0);
+    std::string memory = "n/a";
+    if (auto* binary = dynamic_cast<PrioritizedSelector*>(selector.get())) {
+      memory = absl::StrCat(binary->TreeBytes() >> 20, "MiB");
+    }
+    REVERB_LOG(REVERB_INFO)
+        << candidate.name << " with " << num_items
+        << " items: insert=" << NanosPerOp(insert_time, num_items)
+        << "ns sample=" << NanosPerOp(sample_time, kNumSamples)
+        << "ns update=" << NanosPerOp(update_time, kNumUpdates)
+        << "ns tree=" << memory << " max_relative_error=" << max_error;
+  }
+}
+
+TEST(PrioritizedBenchmark, OneMillionItems) { RunBenchmark(1000000); }
+
+TEST(PrioritizedBenchmark, TenMillionItems) { RunBenchmark(10000000); }
+
+TEST(PrioritizedBenchmark, FiftyMillionItems) { RunBenchmark(50000000); }
+
+TEST(PrioritizedBenchmark, HundredMillionItems) { RunBenchmark(100000000); }
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
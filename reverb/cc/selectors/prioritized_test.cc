@@ -14,7 +14,9 @@
 
 #include "reverb/cc/selectors/prioritized.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <vector>
 
 #include "gmock/gmock.h"
@@ -22,6 +24,7 @@
 #include "absl/random/distributions.h"
 #include "absl/random/random.h"
 #include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
@@ -127,6 +130,246 @@ TEST(PrioritizedSelectorTest, SampledDistributionMatchesProbabilities) {
   }
 }
 
+TEST(PrioritizedSelectorTest, SampleBatchMatchesProbabilities) {
+  const int kStart = 10;
+  const int kEnd = 100;
+  const int kBatchSize = 1000;
+  const int kBatches = 1000;
+
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  double sum = 0;
+  for (int i = 0; i < kEnd; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i));
+    sum += i;
+  }
+  // Remove the first few items.
+  for (int i = 0; i < kStart; i++) {
+    TF_EXPECT_OK(prioritized.Delete(i));
+    sum -= i;
+  }
+  std::vector<int64_t> counts(kEnd);
+  for (int i = 0; i < kBatches; i++) {
+    auto samples = prioritized.SampleBatch(kBatchSize);
+    ASSERT_EQ(samples.size(), kBatchSize);
+    for (const auto& sample : samples) {
+      counts[sample.key]++;
+      EXPECT_NEAR(sample.probability, sample.key / sum, 0.001);
+    }
+  }
+  for (int k = 0; k < kStart; k++) EXPECT_EQ(counts[k], 0);
+  for (int k = kStart; k < kEnd; k++) {
+    EXPECT_NEAR(static_cast<double>(counts[k]) /
+                    static_cast<double>(kBatchSize * kBatches),
+                k / sum, 0.05);
+  }
+}
+
+TEST(PrioritizedSelectorTest, SampleBatchIsNotSorted) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 1));
+  }
+  // The targets are sorted internally but the samples must be returned in the
+  // order they were drawn. The probability of 100 independent samples being
+  // sorted is negligible.
+  auto samples = prioritized.SampleBatch(100);
+  EXPECT_FALSE(std::is_sorted(
+      samples.begin(), samples.end(),
+      [](const auto& a, const auto& b) { return a.key < b.key; }));
+}
+
+TEST(PrioritizedSelectorTest, SampleBatchWithAllZeroPriorities) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 0));
+  }
+  for (const auto& sample : prioritized.SampleBatch(100)) {
+    EXPECT_LT(sample.key, 10);
+    EXPECT_EQ(sample.probability, 0.1);
+  }
+}
+
+TEST(PrioritizedSelectorTest, WithoutReplacementHasDistinctKeys) {
+  const int kItems = 10;
+  const int kBatches = 20000;
+
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  // Weights 1, 2, ..., 10.
+  const double sum = kItems * (kItems + 1) / 2;
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i + 1));
+  }
+  std::vector<int64_t> first_counts(kItems);
+  for (int i = 0; i < kBatches; i++) {
+    auto samples = prioritized.SampleBatchWithoutReplacement(4);
+    ASSERT_EQ(samples.size(), 4);
+    internal::flat_hash_set<ItemSelector::Key> keys;
+    for (const auto& sample : samples) {
+      EXPECT_TRUE(keys.insert(sample.key).second);
+      EXPECT_NEAR(sample.probability, (sample.key + 1) / sum, 1e-9);
+    }
+    first_counts[samples.front().key]++;
+  }
+
+  // The first key of every batch is drawn from the full distribution.
+  for (int k = 0; k < kItems; k++) {
+    EXPECT_NEAR(static_cast<double>(first_counts[k]) / kBatches,
+                (k + 1) / sum, 0.01);
+  }
+
+  // The masked weights have been restored.
+  EXPECT_NEAR(prioritized.NodeSumTestingOnly(0), sum, 1e-9);
+  EXPECT_EQ(prioritized.SampleBatchWithoutReplacement(kItems + 1).size(),
+            kItems);
+}
+
+TEST(PrioritizedSelectorTest, WithoutReplacementSkipsZeroPriorities) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i < 7 ? 0 : 1));
+  }
+  auto samples = prioritized.SampleBatchWithoutReplacement(5);
+  ASSERT_EQ(samples.size(), 3);
+  for (const auto& sample : samples) {
+    EXPECT_GE(sample.key, 7);
+  }
+}
+
+TEST(PrioritizedSelectorTest, WithoutReplacementWithAllZeroPriorities) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 0));
+  }
+  auto samples = prioritized.SampleBatchWithoutReplacement(5);
+  ASSERT_EQ(samples.size(), 5);
+  internal::flat_hash_set<ItemSelector::Key> keys;
+  for (const auto& sample : samples) {
+    EXPECT_TRUE(keys.insert(sample.key).second);
+    EXPECT_EQ(sample.probability, 0.1);
+  }
+}
+
+TEST(PrioritizedSelectorTest, UpdateBatchMatchesUpdate) {
+  const int kItems = 1000;
+  absl::BitGen bit_gen;
+
+  // Small batches recompute the updated paths and large batches recompute the
+  // whole tree.
+  for (int batch_size : {16, 256, 2 * kItems}) {
+    PrioritizedSelector batched(kInitialPriorityExponent);
+    PrioritizedSelector sequential(kInitialPriorityExponent);
+    for (int i = 0; i < kItems; i++) {
+      TF_EXPECT_OK(batched.Insert(i, i));
+      TF_EXPECT_OK(sequential.Insert(i, i));
+    }
+
+    std::vector<ItemSelector::Key> keys;
+    std::vector<double> priorities;
+    for (int i = 0; i < batch_size; i++) {
+      keys.push_back(absl::Uniform<int>(bit_gen, 0, kItems));
+      priorities.push_back(absl::Uniform<double>(bit_gen, 0, 100));
+      TF_EXPECT_OK(sequential.Update(keys.back(), priorities.back()));
+    }
+    TF_EXPECT_OK(batched.UpdateBatch(keys, priorities));
+
+    for (int i = 0; i < kItems; i++) {
+      EXPECT_NEAR(batched.NodeSumTestingOnly(i),
+                  sequential.NodeSumTestingOnly(i), 1e-6)
+          << "batch_size: " << batch_size;
+    }
+  }
+}
+
+TEST(PrioritizedSelectorTest, UpdateBatchUsesLastPriorityOfRepeatedKey) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  TF_EXPECT_OK(prioritized.Insert(1, 1));
+  TF_EXPECT_OK(prioritized.Insert(2, 1));
+  TF_EXPECT_OK(prioritized.UpdateBatch({1, 2, 1}, {5, 0, 3}));
+  EXPECT_EQ(prioritized.NodeSumTestingOnly(0), 3);
+  auto sample = prioritized.Sample();
+  EXPECT_EQ(sample.key, 1);
+  EXPECT_EQ(sample.probability, 1);
+}
+
+TEST(PrioritizedSelectorTest, UpdateBatchAppliesUpdatesBeforeError) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  TF_EXPECT_OK(prioritized.Insert(1, 1));
+  TF_EXPECT_OK(prioritized.Insert(2, 1));
+  TF_EXPECT_OK(prioritized.Insert(3, 1));
+
+  EXPECT_EQ(prioritized.UpdateBatch({1, 2, 3}, {2, -1, 4}).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.NodeSumTestingOnly(0), 4);
+
+  EXPECT_EQ(prioritized.UpdateBatch({3, 5}, {4, 4}).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(prioritized.NodeSumTestingOnly(0), 7);
+}
+
+TEST(PrioritizedSelectorTest, SlotsOfTableKeysMatchOwnKeys) {
+  // `table_keys` mirrors the dense key array of a table which uses `slotted`.
+  std::vector<ItemSelector::Key> table_keys;
+  PrioritizedSelector slotted(kInitialPriorityExponent);
+  PrioritizedSelector keyed(kInitialPriorityExponent);
+  ASSERT_TRUE(slotted.UseTableKeys(&table_keys));
+
+  absl::BitGen bit_gen;
+  ItemSelector::Key next_key = 0;
+  for (int i = 0; i < 5000; i++) {
+    const double priority = absl::Uniform<double>(bit_gen, 0, 100);
+    const double action = absl::Uniform<double>(bit_gen, 0, 1);
+    if (table_keys.empty() || action < 0.5) {
+      table_keys.push_back(next_key);
+      TF_EXPECT_OK(slotted.InsertAt(table_keys.size() - 1, next_key, priority));
+      TF_EXPECT_OK(keyed.Insert(next_key++, priority));
+    } else if (action < 0.7) {
+      const size_t slot = absl::Uniform<size_t>(bit_gen, 0, table_keys.size());
+      const ItemSelector::Key key = table_keys[slot];
+      table_keys[slot] = table_keys.back();
+      table_keys.pop_back();
+      TF_EXPECT_OK(slotted.DeleteAt(slot, key));
+      TF_EXPECT_OK(keyed.Delete(key));
+    } else if (action < 0.9) {
+      const size_t slot = absl::Uniform<size_t>(bit_gen, 0, table_keys.size());
+      TF_EXPECT_OK(slotted.UpdateAt(slot, table_keys[slot], priority));
+      TF_EXPECT_OK(keyed.Update(table_keys[slot], priority));
+    } else {
+      const size_t slot = absl::Uniform<size_t>(bit_gen, 0, table_keys.size());
+      const ItemSelector::Slot slots[] = {slot};
+      const ItemSelector::Key keys[] = {table_keys[slot]};
+      const double priorities[] = {priority};
+      TF_EXPECT_OK(slotted.UpdateBatchAt(slots, keys, priorities));
+      TF_EXPECT_OK(keyed.UpdateBatch(keys, priorities));
+    }
+  }
+
+  // The selectors hold the same keys, though not at the same indices.
+  ASSERT_FALSE(table_keys.empty());
+  EXPECT_NEAR(slotted.TotalWeight(), keyed.TotalWeight(), 1e-6);
+  for (int i = 0; i < 1000; i++) {
+    const auto sample = slotted.Sample();
+    EXPECT_THAT(table_keys, testing::Contains(sample.key));
+  }
+
+  // Invalid priorities are still rejected.
+  EXPECT_EQ(slotted.InsertAt(table_keys.size(), next_key, -1).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_EQ(slotted.UpdateAt(0, table_keys[0], -1).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  // Mutations without the slot are rejected.
+  EXPECT_EQ(slotted.Insert(next_key, 1).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(slotted.Delete(table_keys[0]).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+
+  // The selector is empty once released by the table.
+  EXPECT_TRUE(slotted.UseTableKeys(nullptr));
+  EXPECT_EQ(slotted.TotalWeight(), 0);
+  TF_EXPECT_OK(slotted.Insert(1, 1));
+  EXPECT_EQ(slotted.Sample().key, 1);
+}
+
 TEST(PrioritizedSelectorTest, SetsPriorityExponentInOptions) {
   PrioritizedSelector prioritized_a(0.1);
   PrioritizedSelector prioritized_b(0.5);
@@ -140,6 +383,16 @@ TEST(PrioritizedSelectorTest, SetsPriorityExponentInOptions) {
           "prioritized: { priority_exponent: 0.5 } is_deterministic: false"));
 }
 
+TEST(PrioritizedSelectorTest, TotalWeightIsSumOfExponentiatedPriorities) {
+  PrioritizedSelector prioritized(2);
+  EXPECT_EQ(prioritized.TotalWeight(), 0);
+  TF_EXPECT_OK(prioritized.Insert(1, 1));
+  TF_EXPECT_OK(prioritized.Insert(2, 3));
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight(), 10);
+  TF_EXPECT_OK(prioritized.Delete(2));
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight(), 1);
+}
+
 TEST(PrioritizedSelector, RoundingErrors) {
   PrioritizedSelector prioritized(1.0);
 
@@ -157,6 +410,121 @@ TEST(PrioritizedSelector, RoundingErrors) {
   EXPECT_GE(prioritized.NodeSumTestingOnly(0), 0.0);
 }
 
+TEST(PrioritizedSelector, ClearAfterGrowingTree) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 200000; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, 1));
+  }
+  prioritized.Clear();
+  EXPECT_EQ(prioritized.NodeSumTestingOnly(0), 0);
+
+  TF_EXPECT_OK(prioritized.Insert(5, 1));
+  EXPECT_EQ(prioritized.Sample().key, 5);
+  EXPECT_EQ(prioritized.NodeSumTestingOnly(0), 1);
+}
+
+TEST(PrioritizedSelector, ReserveAllocatesTreeUpFront) {
+  for (bool reduced_precision : {false, true}) {
+    PrioritizedSelector prioritized(kInitialPriorityExponent,
+                                    reduced_precision);
+    prioritized.Reserve(300000);
+    const size_t reserved_bytes = prioritized.TreeBytes();
+
+    // The tree isn't resized while it is filled.
+    double sum = 0;
+    for (int i = 0; i < 300000; i++) {
+      TF_EXPECT_OK(prioritized.Insert(i, i % 7));
+      sum += i % 7;
+    }
+    EXPECT_EQ(prioritized.TreeBytes(), reserved_bytes);
+    EXPECT_NEAR(prioritized.TotalWeight(), sum, 1e-3);
+    const auto sample = prioritized.Sample();
+    EXPECT_NEAR(sample.probability * sum, sample.key % 7, 1e-3);
+
+    // Grows beyond the reservation as usual.
+    TF_EXPECT_OK(prioritized.Insert(300000, 1));
+    EXPECT_GT(prioritized.TreeBytes(), reserved_bytes);
+  }
+}
+
+TEST(PrioritizedSelector, ReducedPrecisionMatchesFullPrecision) {
+  PrioritizedSelector full(kInitialPriorityExponent);
+  PrioritizedSelector reduced(kInitialPriorityExponent,
+                              /*reduced_precision=*/true);
+  absl::BitGen bit_gen;
+
+  // Enough keys for sums to be stored both as doubles and as floats.
+  constexpr int kNumKeys = 200000;
+  for (int i = 0; i < kNumKeys; i++) {
+    const double priority = absl::Uniform<double>(bit_gen, 0, 100);
+    TF_EXPECT_OK(full.Insert(i, priority));
+    TF_EXPECT_OK(reduced.Insert(i, priority));
+  }
+  for (int i = 0; i < 500000; i++) {
+    const auto key = absl::Uniform<ItemSelector::Key>(bit_gen, 0, kNumKeys);
+    const double priority = absl::Uniform<double>(bit_gen, 0, 100);
+    TF_EXPECT_OK(full.Update(key, priority));
+    TF_EXPECT_OK(reduced.Update(key, priority));
+  }
+  for (int i = 0; i < kNumKeys / 2; i++) {
+    TF_EXPECT_OK(full.Delete(i));
+    TF_EXPECT_OK(reduced.Delete(i));
+  }
+
+  // The sums are recomputed from the children so the relative error is that
+  // of a float rather than an accumulation of rounding errors.
+  EXPECT_NEAR(reduced.TotalWeight(), full.TotalWeight(),
+              full.TotalWeight() * 1e-6);
+  for (size_t index : {1, 100, 70000, 99999}) {
+    EXPECT_NEAR(reduced.NodeSumTestingOnly(index),
+                full.NodeSumTestingOnly(index),
+                full.NodeSumTestingOnly(index) * 1e-6);
+  }
+  for (int i = 0; i < 10000; i++) {
+    const auto sample = reduced.Sample();
+    EXPECT_GE(sample.key, kNumKeys / 2);
+    EXPECT_GT(sample.probability, 0);
+  }
+  EXPECT_LT(reduced.TreeBytes(), full.TreeBytes());
+}
+
+TEST(PrioritizedSelector, ReducedPrecisionSampledDistribution) {
+  constexpr int kNumKeys = 100;
+  constexpr int kSamples = 1000000;
+  PrioritizedSelector prioritized(kInitialPriorityExponent,
+                                  /*reduced_precision=*/true);
+  double sum = 0;
+  for (int i = 0; i < kNumKeys; i++) {
+    TF_EXPECT_OK(prioritized.Insert(i, i));
+    sum += i;
+  }
+  std::vector<int64_t> counts(kNumKeys);
+  for (const auto& sample : prioritized.SampleBatch(kSamples)) {
+    EXPECT_NEAR(sample.probability, sample.key / sum, 1e-6);
+    counts[sample.key]++;
+  }
+  EXPECT_EQ(counts[0], 0);
+  for (int k = 1; k < kNumKeys; k++) {
+    EXPECT_NEAR(static_cast<double>(counts[k]) / kSamples, k / sum, 0.005);
+  }
+}
+
+TEST(PrioritizedSelector, ReducedPrecisionClampsLargeWeights) {
+  PrioritizedSelector prioritized(2, /*reduced_precision=*/true);
+  TF_EXPECT_OK(prioritized.Insert(1, 1e30));
+  TF_EXPECT_OK(prioritized.Insert(2, 1));
+  EXPECT_EQ(prioritized.TotalWeight(), std::numeric_limits<float>::max());
+  EXPECT_EQ(prioritized.Sample().key, 1);
+}
+
+TEST(PrioritizedSelector, SetsReducedPrecisionInOptions) {
+  PrioritizedSelector prioritized(0.5, /*reduced_precision=*/true);
+  EXPECT_THAT(prioritized.options(),
+              testing::EqualsProto("prioritized: { priority_exponent: 0.5 "
+                                   "reduced_precision: true } "
+                                   "is_deterministic: false"));
+}
+
 TEST(PrioritizedDeathTest, ClearThenSample) {
   PrioritizedSelector prioritized(kInitialPriorityExponent);
   for (int i = 0; i < 100; i++) {
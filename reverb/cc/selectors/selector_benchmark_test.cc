@@ -0,0 +1,365 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the time per `Insert`, `Update`, `Delete` and `Sample` and the heap
+// bytes per key of every `ItemSelector` for 10k to 100M keys, as well as the
+// time per operation of a mixed replay workload. The tables are large so the
+// test is tagged as manual and has to be run explicitly:
+//
+//   bazel test -c opt //reverb/cc/selectors:selector_benchmark_test \
+//     --test_output=streamed
+//
+// The `HugePages` test compares the sample throughput of the prioritized
+// selectors with their arrays backed by pages of every kind. Explicit huge
+// pages have to be reserved first, e.g for 2 MB pages:
+//
+//   echo 4096 | sudo tee /proc/sys/vm/nr_hugepages
+//
+// otherwise they fall back to smaller pages, which is logged.
+//
+// If the environment variable `REVERB_SELECTOR_TRACE` is set, the
+// `ReplaysTrace` test replays the file it points to against every selector.
+// Each line of the trace is one of the operations:
+//
+//   insert <key> <priority>
+//   update <key> <priority>
+//   delete <key>
+//   sample
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/heap_stats.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/heap.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/kary_prioritized.h"
+#include "reverb/cc/selectors/lifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/huge_page_allocator.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Number of timed operations of the sample, update and delete phases.
+constexpr int64_t kNumOps = 1000000;
+
+// Number of steps of the mixed workload. Each step inserts a key, deletes
+// the oldest key, samples `kMixedSampleBatchSize` keys and updates the
+// priorities of `kMixedUpdatesPerStep` keys, like a table at capacity which
+// is written to and trained on with prioritized replay.
+constexpr int64_t kMixedSteps = 100000;
+constexpr int kMixedSampleBatchSize = 8;
+constexpr int kMixedUpdatesPerStep = 8;
+
+struct Candidate {
+  std::string name;
+  std::function<std::unique_ptr<ItemSelector>()> make;
+};
+
+std::vector<Candidate> Candidates() {
+  return {
+      {"uniform", [] { return absl::make_unique<UniformSelector>(); }},
+      {"fifo", [] { return absl::make_unique<FifoSelector>(); }},
+      {"lifo", [] { return absl::make_unique<LifoSelector>(); }},
+      {"heap", [] { return absl::make_unique<HeapSelector>(); }},
+      {"heap_4ary",
+       [] { return absl::make_unique<HeapSelector>(/*min_heap=*/true, 4); }},
+      {"heap_8ary",
+       [] { return absl::make_unique<HeapSelector>(/*min_heap=*/true, 8); }},
+      {"prioritized",
+       [] { return absl::make_unique<PrioritizedSelector>(0.8); }},
+      {"prioritized_8ary",
+       [] { return absl::make_unique<KAryPrioritizedSelector>(0.8, 8); }},
+  };
+}
+
+// Deterministic priority in [0, 100) so that no per key storage is needed
+// for the inserts.
+double PriorityOf(ItemSelector::Key key) {
+  return ((key * 2654435761u) % 10000) / 100.0;
+}
+
+double NanosPerOp(absl::Duration elapsed, int64_t num_ops) {
+  return absl::ToDoubleNanoseconds(elapsed) / num_ops;
+}
+
+// Heap bytes currently handed out by the allocator, or -1 if unknown.
+int64_t InUseBytes() {
+  internal::HeapStats stats;
+  return internal::GetHeapStats(&stats) ? stats.in_use_bytes : -1;
+}
+
+// Draws `n` keys uniformly from [begin, end).
+std::vector<ItemSelector::Key> RandomKeys(int64_t n, ItemSelector::Key begin,
+                                          ItemSelector::Key end) {
+  absl::BitGen bit_gen;
+  std::vector<ItemSelector::Key> keys(n);
+  for (auto& key : keys) {
+    key = absl::Uniform<ItemSelector::Key>(bit_gen, begin, end);
+  }
+  return keys;
+}
+
+void RunBenchmark(int64_t num_keys) {
+  const auto update_keys = RandomKeys(kNumOps, 0, num_keys);
+  const auto mixed_update_keys =
+      RandomKeys(kMixedSteps * kMixedUpdatesPerStep, 0, num_keys);
+
+  // The mixed workload removes the oldest `kMixedSteps` keys so the delete
+  // phase removes (shuffled) keys from those which are left.
+  const int64_t num_deletes = std::min(kNumOps, num_keys);
+  std::vector<ItemSelector::Key> delete_keys(num_deletes);
+  for (int64_t i = 0; i < num_deletes; i++) {
+    delete_keys[i] = kMixedSteps + i;
+  }
+  absl::BitGen bit_gen;
+  std::shuffle(delete_keys.begin(), delete_keys.end(), bit_gen);
+
+  for (const auto& candidate : Candidates()) {
+    const int64_t bytes_before = InUseBytes();
+    auto selector = candidate.make();
+
+    absl::Time start = absl::Now();
+    for (int64_t key = 0; key < num_keys; key++) {
+      TF_ASSERT_OK(selector->Insert(key, PriorityOf(key)));
+    }
+    const absl::Duration insert_time = absl::Now() - start;
+    const int64_t bytes_after = InUseBytes();
+
+    start = absl::Now();
+    ItemSelector::Key checksum = 0;
+    for (int64_t i = 0; i < kNumOps; i++) {
+      checksum += selector->Sample().key;
+    }
+    const absl::Duration sample_time = absl::Now() - start;
+
+    start = absl::Now();
+    for (int64_t i = 0; i < kNumOps; i++) {
+      TF_ASSERT_OK(selector->Update(update_keys[i], i % 100));
+    }
+    const absl::Duration update_time = absl::Now() - start;
+
+    start = absl::Now();
+    int64_t next_update = 0;
+    for (int64_t step = 0; step < kMixedSteps; step++) {
+      TF_ASSERT_OK(
+          selector->Insert(num_keys + step, PriorityOf(num_keys + step)));
+      TF_ASSERT_OK(selector->Delete(step));
+      for (const auto& sample : selector->SampleBatch(kMixedSampleBatchSize)) {
+        checksum += sample.key;
+      }
+      // Shift the keys into the live window [step + 1, num_keys + step].
+      for (int i = 0; i < kMixedUpdatesPerStep; i++) {
+        TF_ASSERT_OK(selector->Update(
+            mixed_update_keys[next_update++] + step + 1, step % 100));
+      }
+    }
+    const absl::Duration mixed_time = absl::Now() - start;
+
+    start = absl::Now();
+    for (const auto key : delete_keys) {
+      TF_ASSERT_OK(selector->Delete(key));
+    }
+    const absl::Duration delete_time = absl::Now() - start;
+
+    EXPECT_GT(checksum, 0);
+    const double bytes_per_key =
+        bytes_before < 0 || bytes_after < 0
+            ? -1
+            : static_cast<double>(bytes_after - bytes_before) / num_keys;
+    REVERB_LOG(REVERB_INFO)
+        << candidate.name << " with " << num_keys
+        << " keys: insert=" << NanosPerOp(insert_time, num_keys)
+        << "ns sample=" << NanosPerOp(sample_time, kNumOps)
+        << "ns update=" << NanosPerOp(update_time, kNumOps)
+        << "ns delete=" << NanosPerOp(delete_time, num_deletes)
+        << "ns mixed_step=" << NanosPerOp(mixed_time, kMixedSteps)
+        << "ns bytes_per_key=" << bytes_per_key;
+  }
+}
+
+TEST(SelectorBenchmark, TenThousandKeys) { RunBenchmark(10000); }
+
+TEST(SelectorBenchmark, HundredThousandKeys) { RunBenchmark(100000); }
+
+TEST(SelectorBenchmark, OneMillionKeys) { RunBenchmark(1000000); }
+
+TEST(SelectorBenchmark, TenMillionKeys) { RunBenchmark(10000000); }
+
+TEST(SelectorBenchmark, HundredMillionKeys) { RunBenchmark(100000000); }
+
+// Samples `kNumOps` keys (and batches of `kMixedSampleBatchSize` keys) from
+// 10M and 100M keys spread over gigabytes, where nearly every descent of the
+// tree misses the TLB with regular pages.
+TEST(SelectorBenchmark, HugePages) {
+  const std::vector<std::pair<std::string, internal::PageKind>> kinds = {
+      {"regular", internal::PageKind::kRegular},
+      {"transparent", internal::PageKind::kTransparentHuge},
+      {"2mb", internal::PageKind::kHuge2MB},
+      {"1gb", internal::PageKind::kHuge1GB},
+  };
+  const std::vector<Candidate> candidates = {
+      {"prioritized",
+       [] { return absl::make_unique<PrioritizedSelector>(0.8); }},
+      {"prioritized_8ary",
+       [] { return absl::make_unique<KAryPrioritizedSelector>(0.8, 8); }},
+  };
+  for (int64_t num_keys : {10000000, 100000000}) {
+    for (const auto& candidate : candidates) {
+      for (const auto& kind : kinds) {
+        internal::HugePageOptions options;
+        options.pages = kind.second;
+        internal::ConfigureHugePages(options);
+
+        auto selector = candidate.make();
+        selector->Reserve(num_keys);
+        for (int64_t key = 0; key < num_keys; key++) {
+          TF_ASSERT_OK(selector->Insert(key, PriorityOf(key)));
+        }
+        const internal::HugePageStats stats = internal::GetHugePageStats();
+
+        ItemSelector::Key checksum = 0;
+        absl::Time start = absl::Now();
+        for (int64_t i = 0; i < kNumOps; i++) {
+          checksum += selector->Sample().key;
+        }
+        const absl::Duration sample_time = absl::Now() - start;
+
+        start = absl::Now();
+        for (int64_t i = 0; i < kNumOps / kMixedSampleBatchSize; i++) {
+          for (const auto& sample :
+               selector->SampleBatch(kMixedSampleBatchSize)) {
+            checksum += sample.key;
+          }
+        }
+        const absl::Duration batch_time = absl::Now() - start;
+
+        EXPECT_GT(checksum, 0);
+        REVERB_LOG(REVERB_INFO)
+            << candidate.name << " with " << num_keys << " keys on "
+            << kind.first
+            << " pages: sample=" << NanosPerOp(sample_time, kNumOps)
+            << "ns batched_sample=" << NanosPerOp(batch_time, kNumOps)
+            << "ns samples_per_s="
+            << kNumOps / absl::ToDoubleSeconds(sample_time)
+            << " mapped_mb(regular/transparent/2mb/1gb)="
+            << (stats.regular_bytes >> 20) << "/"
+            << (stats.transparent_huge_bytes >> 20) << "/"
+            << (stats.huge_2mb_bytes >> 20) << "/"
+            << (stats.huge_1gb_bytes >> 20)
+            << " fallbacks=" << stats.num_fallbacks;
+      }
+    }
+  }
+  internal::ConfigureHugePages(internal::HugePageOptions());
+}
+
+struct TraceOp {
+  enum Type { kInsert, kUpdate, kDelete, kSample };
+  Type type;
+  ItemSelector::Key key;
+  double priority;
+};
+
+bool ParseTraceLine(absl::string_view line, TraceOp* op) {
+  std::vector<absl::string_view> parts =
+      absl::StrSplit(line, ' ', absl::SkipEmpty());
+  op->key = 0;
+  op->priority = 0;
+  if (parts.size() == 1 && parts[0] == "sample") {
+    op->type = TraceOp::kSample;
+    return true;
+  }
+  if (parts.size() == 2 && parts[0] == "delete") {
+    op->type = TraceOp::kDelete;
+    return absl::SimpleAtoi(parts[1], &op->key);
+  }
+  if (parts.size() == 3 && (parts[0] == "insert" || parts[0] == "update")) {
+    op->type = parts[0] == "insert" ? TraceOp::kInsert : TraceOp::kUpdate;
+    return absl::SimpleAtoi(parts[1], &op->key) &&
+           absl::SimpleAtod(parts[2], &op->priority);
+  }
+  return false;
+}
+
+TEST(SelectorBenchmark, ReplaysTrace) {
+  const char* path = std::getenv("REVERB_SELECTOR_TRACE");
+  if (path == nullptr) {
+    REVERB_LOG(REVERB_INFO) << "REVERB_SELECTOR_TRACE is not set.";
+    return;
+  }
+  std::ifstream file(path);
+  ASSERT_TRUE(file.is_open()) << "Could not open " << path;
+  std::vector<TraceOp> trace;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty()) continue;
+    TraceOp op;
+    ASSERT_TRUE(ParseTraceLine(line, &op)) << "Invalid trace line: " << line;
+    trace.push_back(op);
+  }
+  ASSERT_FALSE(trace.empty());
+
+  for (const auto& candidate : Candidates()) {
+    auto selector = candidate.make();
+    ItemSelector::Key checksum = 0;
+    const absl::Time start = absl::Now();
+    for (const auto& op : trace) {
+      switch (op.type) {
+        case TraceOp::kInsert:
+          TF_ASSERT_OK(selector->Insert(op.key, op.priority));
+          break;
+        case TraceOp::kUpdate:
+          TF_ASSERT_OK(selector->Update(op.key, op.priority));
+          break;
+        case TraceOp::kDelete:
+          TF_ASSERT_OK(selector->Delete(op.key));
+          break;
+        case TraceOp::kSample:
+          checksum += selector->Sample().key;
+          break;
+      }
+    }
+    const absl::Duration elapsed = absl::Now() - start;
+    REVERB_LOG(REVERB_INFO)
+        << candidate.name << " replayed " << trace.size()
+        << " ops: " << NanosPerOp(elapsed, trace.size())
+        << "ns/op (checksum=" << checksum << ")";
+  }
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,102 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/selectors/slot_list.h"
+
+#include <cstdint>
+
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+void SlotList::PushBack(Slot slot) {
+  REVERB_CHECK_EQ(slot, size());
+  const int32_t index = static_cast<int32_t>(slot);
+  prev_.push_back(tail_);
+  next_.push_back(kNone);
+  if (tail_ != kNone) {
+    next_[tail_] = index;
+  } else {
+    head_ = index;
+  }
+  tail_ = index;
+}
+
+void SlotList::Remove(Slot slot) {
+  REVERB_CHECK_LT(slot, size());
+  const int32_t index = static_cast<int32_t>(slot);
+
+  // Unlink the slot.
+  int32_t prev = prev_[index];
+  int32_t next = next_[index];
+  if (prev != kNone) {
+    next_[prev] = next;
+  } else {
+    head_ = next;
+  }
+  if (next != kNone) {
+    prev_[next] = prev;
+  } else {
+    tail_ = prev;
+  }
+
+  // Move the last slot into the place of the removed one.
+  const int32_t last = static_cast<int32_t>(size()) - 1;
+  if (index != last) {
+    prev = prev_[last];
+    next = next_[last];
+    prev_[index] = prev;
+    next_[index] = next;
+    if (prev != kNone) {
+      next_[prev] = index;
+    } else {
+      head_ = index;
+    }
+    if (next != kNone) {
+      prev_[next] = index;
+    } else {
+      tail_ = index;
+    }
+  }
+  prev_.pop_back();
+  next_.pop_back();
+}
+
+ItemSelector::Slot SlotList::front() const {
+  REVERB_CHECK_NE(head_, kNone);
+  return head_;
+}
+
+ItemSelector::Slot SlotList::back() const {
+  REVERB_CHECK_NE(tail_, kNone);
+  return tail_;
+}
+
+void SlotList::Clear() {
+  prev_.clear();
+  next_.clear();
+  head_ = kNone;
+  tail_ = kNone;
+}
+
+void SlotList::Reserve(size_t num_slots) {
+  prev_.reserve(num_slots);
+  next_.reserve(num_slots);
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,72 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SELECTORS_SLOT_LIST_H_
+#define REVERB_CC_SELECTORS_SLOT_LIST_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "reverb/cc/selectors/interface.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Doubly linked list of the slots (see `ItemSelector::UseTableKeys`) of a table
+// in the order in which they were appended. The links are stored in arrays
+// indexed by slot so the list takes 8 bytes per slot and no allocation per
+// slot. Used by `FifoSelector` and `LifoSelector`.
+class SlotList {
+ public:
+  using Slot = ItemSelector::Slot;
+
+  // Appends `slot`, which must be the slot after the last one.
+  void PushBack(Slot slot);
+
+  // Unlinks `slot` and moves the last slot into its place.
+  void Remove(Slot slot);
+
+  // The oldest (newest) slot. Must not be empty.
+  Slot front() const;
+  Slot back() const;
+
+  size_t size() const { return prev_.size(); }
+  bool empty() const { return prev_.empty(); }
+
+  void Clear();
+
+  // Allocates the links of `num_slots` slots up front.
+  void Reserve(size_t num_slots);
+
+  // Memory which `Reserve` allocates per slot.
+  static constexpr size_t kBytesPerSlot = 2 * sizeof(int32_t);
+
+ private:
+  // Marks the absence of a link.
+  static constexpr int32_t kNone = -1;
+
+  // Links to the previous (next) slot of each slot.
+  std::vector<int32_t> prev_;
+  std::vector<int32_t> next_;
+
+  int32_t head_ = kNone;
+  int32_t tail_ = kNone;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_SLOT_LIST_H_
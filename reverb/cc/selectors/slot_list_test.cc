@@ -0,0 +1,91 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/selectors/slot_list.h"
+
+#include <algorithm>
+#include <list>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(SlotListTest, KeepsOrderOfAppends) {
+  SlotList list;
+  EXPECT_TRUE(list.empty());
+  list.PushBack(0);
+  list.PushBack(1);
+  list.PushBack(2);
+  EXPECT_EQ(list.size(), 3);
+  EXPECT_EQ(list.front(), 0);
+  EXPECT_EQ(list.back(), 2);
+
+  // The last slot (2) moves into the removed slot.
+  list.Remove(0);
+  EXPECT_EQ(list.size(), 2);
+  EXPECT_EQ(list.front(), 1);
+  EXPECT_EQ(list.back(), 0);
+
+  list.Clear();
+  EXPECT_TRUE(list.empty());
+}
+
+TEST(SlotListTest, MatchesListOfKeys) {
+  // `keys` mirrors the dense key array of a table and `order` the keys in the
+  // order in which they were inserted.
+  SlotList list;
+  std::vector<int> keys;
+  std::list<int> order;
+  absl::BitGen bit_gen;
+  int next_key = 0;
+  for (int i = 0; i < 10000; i++) {
+    if (keys.empty() || absl::Bernoulli(bit_gen, 0.6)) {
+      list.PushBack(keys.size());
+      keys.push_back(next_key);
+      order.push_back(next_key++);
+    } else {
+      const size_t slot = absl::Uniform<size_t>(bit_gen, 0, keys.size());
+      order.erase(std::find(order.begin(), order.end(), keys[slot]));
+      list.Remove(slot);
+      keys[slot] = keys.back();
+      keys.pop_back();
+    }
+    ASSERT_EQ(list.size(), keys.size());
+    if (!keys.empty()) {
+      ASSERT_EQ(keys[list.front()], order.front());
+      ASSERT_EQ(keys[list.back()], order.back());
+    }
+  }
+}
+
+TEST(SlotListDeathTest, FrontOfEmptyList) {
+  SlotList list;
+  EXPECT_DEATH(list.front(), "");
+}
+
+TEST(SlotListDeathTest, PushBackOfWrongSlot) {
+  SlotList list;
+  EXPECT_DEATH(list.PushBack(1), "");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -14,8 +14,12 @@
 
 #include "reverb/cc/selectors/uniform.h"
 
+#include <vector>
+
+#include "absl/random/distributions.h"
 #include "absl/strings/str_cat.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/schema.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -25,6 +29,7 @@ namespace deepmind {
 namespace reverb {
 
 tensorflow::Status UniformSelector::Delete(Key key) {
+  if (table_keys_ != nullptr) return tensorflow::Status::OK();
   const auto it = key_to_index_.find(key);
   if (it == key_to_index_.end())
     return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
@@ -43,6 +48,7 @@ tensorflow::Status UniformSelector::Delete(Key key) {
 }
 
 tensorflow::Status UniformSelector::Insert(Key key, double priority) {
+  if (table_keys_ != nullptr) return tensorflow::Status::OK();
   const size_t index = keys_.size();
   if (!key_to_index_.emplace(key, index).second)
     return tensorflow::errors::InvalidArgument("Key ", key,
@@ -52,18 +58,56 @@ tensorflow::Status UniformSelector::Insert(Key key, double priority) {
 }
 
 tensorflow::Status UniformSelector::Update(Key key, double priority) {
+  if (table_keys_ != nullptr) return tensorflow::Status::OK();
   if (key_to_index_.find(key) == key_to_index_.end())
     return tensorflow::errors::InvalidArgument("Key ", key, " not found.");
   return tensorflow::Status::OK();
 }
 
 ItemSelector::KeyWithProbability UniformSelector::Sample() {
-  REVERB_CHECK(!keys_.empty());
+  const std::vector<Key>& keys = this->keys();
+  REVERB_CHECK(!keys.empty());
 
   // This code is not thread-safe, because bit_gen_ is not protected by a mutex
   // and is not itself thread-safe.
-  const size_t index = absl::Uniform<size_t>(bit_gen_, 0, keys_.size());
-  return {keys_[index], 1.0 / static_cast<double>(keys_.size())};
+  const size_t index = absl::Uniform<size_t>(bit_gen_, 0, keys.size());
+  return {keys[index], 1.0 / static_cast<double>(keys.size())};
+}
+
+std::vector<ItemSelector::KeyWithProbability> UniformSelector::SampleBatch(
+    int batch_size) {
+  const std::vector<Key>& keys = this->keys();
+  REVERB_CHECK(!keys.empty());
+
+  // All samples share the same probability so the indices are drawn in a tight
+  // loop without any per sample bookkeeping. The keys are gathered in a second
+  // pass so the draws don't wait for the (likely cache missing) loads.
+  const size_t size = keys.size();
+  const double probability = 1.0 / static_cast<double>(size);
+  std::vector<KeyWithProbability> samples(batch_size);
+  for (auto& sample : samples) {
+    sample = {absl::Uniform<size_t>(bit_gen_, 0, size), probability};
+  }
+  for (auto& sample : samples) {
+    sample.key = keys[sample.key];
+  }
+  return samples;
+}
+
+std::vector<ItemSelector::KeyWithProbability>
+UniformSelector::SampleBatchWithoutReplacement(int batch_size) {
+  const std::vector<Key>& keys = this->keys();
+  REVERB_CHECK(!keys.empty());
+  const size_t size = keys.size();
+  if (static_cast<size_t>(batch_size) > size) batch_size = size;
+
+  const double probability = 1.0 / static_cast<double>(size);
+  std::vector<KeyWithProbability> samples;
+  samples.reserve(batch_size);
+  for (size_t index : SampleDistinctIndices(size, batch_size, &bit_gen_)) {
+    samples.push_back({keys[index], probability});
+  }
+  return samples;
 }
 
 void UniformSelector::Clear() {
@@ -71,6 +115,34 @@ void UniformSelector::Clear() {
   key_to_index_.clear();
 }
 
+void UniformSelector::Reserve(size_t num_keys) {
+  // The keys of a table need no state of their own.
+  if (table_keys_ != nullptr) return;
+  keys_.reserve(num_keys);
+  key_to_index_.reserve(num_keys);
+}
+
+size_t UniformSelector::ReservedBytesPerKey() const {
+  if (table_keys_ != nullptr) return 0;
+  return sizeof(Key) +
+         internal::HashMapBytesPerElement<decltype(key_to_index_)>();
+}
+
+bool UniformSelector::UseTableKeys(const std::vector<Key>* keys) {
+  if (keys == nullptr) {
+    table_keys_ = nullptr;
+    return true;
+  }
+  if (table_keys_ == keys) return true;
+  if (table_keys_ != nullptr || !keys_.empty()) return false;
+
+  // Release the memory of the (empty) containers which are no longer used.
+  keys_ = std::vector<Key>();
+  key_to_index_ = internal::flat_hash_map<Key, size_t>();
+  table_keys_ = keys;
+  return true;
+}
+
 KeyDistributionOptions UniformSelector::options() const {
   KeyDistributionOptions options;
   options.set_uniform(true);
@@ -78,5 +150,7 @@ KeyDistributionOptions UniformSelector::options() const {
   return options;
 }
 
+double UniformSelector::TotalWeight() const { return keys().size(); }
+
 }  // namespace reverb
 }  // namespace deepmind
@@ -29,6 +29,9 @@ namespace reverb {
 // Samples items uniformly and thus priority values have no effect. All
 // operations take O(1) time. See ItemSelector for documentation of
 // public methods.
+//
+// When used by a `Table` the keys are sampled from the dense key array of the
+// table (see `UseTableKeys`), so the selector itself holds no state per key.
 class UniformSelector : public ItemSelector {
  public:
   tensorflow::Status Delete(Key key) override;
@@ -39,17 +42,42 @@ class UniformSelector : public ItemSelector {
 
   KeyWithProbability Sample() override;
 
+  std::vector<KeyWithProbability> SampleBatch(int batch_size) override;
+
+  // The keys are in random order. O(k) time.
+  std::vector<KeyWithProbability> SampleBatchWithoutReplacement(
+      int batch_size) override;
+
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+  size_t ReservedBytesPerKey() const override;
+
+  // Accepts `keys` unless the selector already holds keys of its own or uses
+  // the keys of another table.
+  bool UseTableKeys(const std::vector<Key>* keys) override;
+
   KeyDistributionOptions options() const override;
 
+  // Every key has a weight of 1.
+  double TotalWeight() const override;
+
  private:
-  // All keys.
+  const std::vector<Key>& keys() const {
+    return table_keys_ != nullptr ? *table_keys_ : keys_;
+  }
+
+  // All keys, unless `table_keys_` is set.
   std::vector<Key> keys_;
 
-  // Maps a key to the index where this key can be found in `keys_.
+  // Maps a key to the index where this key can be found in `keys_. Empty if
+  // `table_keys_` is set.
   internal::flat_hash_map<Key, size_t> key_to_index_;
 
+  // Keys of the table which the selector belongs to, or nullptr if the
+  // selector maintains its own keys.
+  const std::vector<Key>* table_keys_ = nullptr;
+
   // Used for sampling, not thread-safe.
   absl::BitGen bit_gen_;
 };
@@ -18,6 +18,7 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
@@ -67,12 +68,129 @@ TEST(UniformSelectorTest, MatchesUniformSelector) {
   }
 }
 
+TEST(UniformSelectorTest, SampleBatchMatchesUniformSelector) {
+  const int64_t kItems = 100;
+  const int64_t kBatchSize = 1000;
+  const int64_t kBatches = 1000;
+  double expected_probability = 1. / static_cast<double>(kItems);
+
+  UniformSelector uniform;
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(uniform.Insert(i, 0));
+  }
+  std::vector<int64_t> counts(kItems);
+  for (int i = 0; i < kBatches; i++) {
+    auto samples = uniform.SampleBatch(kBatchSize);
+    ASSERT_EQ(samples.size(), kBatchSize);
+    for (const auto& sample : samples) {
+      EXPECT_EQ(sample.probability, expected_probability);
+      counts[sample.key]++;
+    }
+  }
+  for (int64_t count : counts) {
+    EXPECT_NEAR(static_cast<double>(count) /
+                    static_cast<double>(kBatchSize * kBatches),
+                expected_probability, 0.05);
+  }
+}
+
+TEST(UniformSelectorTest, SampleBatchWithoutReplacementHasDistinctKeys) {
+  const int64_t kItems = 100;
+  const int64_t kBatches = 10000;
+  double expected_probability = 1. / static_cast<double>(kItems);
+
+  UniformSelector uniform;
+  for (int i = 0; i < kItems; i++) {
+    TF_EXPECT_OK(uniform.Insert(i, 0));
+  }
+  std::vector<int64_t> counts(kItems);
+  std::vector<int64_t> first_counts(kItems);
+  for (int i = 0; i < kBatches; i++) {
+    auto samples = uniform.SampleBatchWithoutReplacement(kItems / 2);
+    ASSERT_EQ(samples.size(), kItems / 2);
+    internal::flat_hash_set<ItemSelector::Key> keys;
+    for (const auto& sample : samples) {
+      EXPECT_EQ(sample.probability, expected_probability);
+      EXPECT_TRUE(keys.insert(sample.key).second);
+      counts[sample.key]++;
+    }
+    first_counts[samples.front().key]++;
+  }
+  for (int i = 0; i < kItems; i++) {
+    EXPECT_NEAR(static_cast<double>(counts[i]) /
+                    static_cast<double>(kBatches * kItems / 2),
+                expected_probability, 0.05);
+    EXPECT_NEAR(static_cast<double>(first_counts[i]) /
+                    static_cast<double>(kBatches),
+                expected_probability, 0.05);
+  }
+
+  // A batch can hold every key.
+  EXPECT_EQ(uniform.SampleBatchWithoutReplacement(3).size(), 3);
+  auto all = uniform.SampleBatchWithoutReplacement(kItems);
+  internal::flat_hash_set<ItemSelector::Key> keys;
+  for (const auto& sample : all) keys.insert(sample.key);
+  EXPECT_EQ(keys.size(), kItems);
+
+  // Batches larger than the selector are truncated.
+  EXPECT_EQ(uniform.SampleBatchWithoutReplacement(kItems + 1).size(), kItems);
+}
+
+TEST(UniformSelectorTest, SamplesFromTableKeys) {
+  std::vector<ItemSelector::Key> table_keys = {1, 2, 3};
+  UniformSelector uniform;
+  ASSERT_TRUE(uniform.UseTableKeys(&table_keys));
+  EXPECT_TRUE(uniform.UseTableKeys(&table_keys));
+
+  // The table validates the keys so the selector doesn't.
+  TF_EXPECT_OK(uniform.Insert(4, 0));
+  TF_EXPECT_OK(uniform.Delete(4));
+  EXPECT_EQ(uniform.TotalWeight(), 3);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_THAT(uniform.Sample().key, testing::AnyOf(1, 2, 3));
+  }
+
+  // Mutations of the table keys are seen by the selector.
+  table_keys = {7};
+  EXPECT_EQ(uniform.Sample().key, 7);
+  for (const auto& sample : uniform.SampleBatch(10)) {
+    EXPECT_EQ(sample.key, 7);
+    EXPECT_EQ(sample.probability, 1);
+  }
+
+  // The keys of another table are refused.
+  std::vector<ItemSelector::Key> other_keys;
+  EXPECT_FALSE(uniform.UseTableKeys(&other_keys));
+
+  // Once released the selector maintains its own keys again.
+  EXPECT_TRUE(uniform.UseTableKeys(nullptr));
+  EXPECT_EQ(uniform.TotalWeight(), 0);
+  TF_EXPECT_OK(uniform.Insert(5, 0));
+  EXPECT_EQ(uniform.Sample().key, 5);
+}
+
+TEST(UniformSelectorTest, UseTableKeysIsRefusedWithKeys) {
+  std::vector<ItemSelector::Key> table_keys;
+  UniformSelector uniform;
+  TF_EXPECT_OK(uniform.Insert(1, 0));
+  EXPECT_FALSE(uniform.UseTableKeys(&table_keys));
+  EXPECT_EQ(uniform.Sample().key, 1);
+}
+
 TEST(UniformSelectorTest, Options) {
   UniformSelector uniform;
   EXPECT_THAT(uniform.options(),
               testing::EqualsProto("uniform: true is_deterministic: false"));
 }
 
+TEST(UniformSelectorTest, TotalWeightIsNumberOfKeys) {
+  UniformSelector uniform;
+  EXPECT_EQ(uniform.TotalWeight(), 0);
+  TF_EXPECT_OK(uniform.Insert(1, 5));
+  TF_EXPECT_OK(uniform.Insert(2, 7));
+  EXPECT_EQ(uniform.TotalWeight(), 2);
+}
+
 TEST(UniformDeathTest, ClearThenSample) {
   UniformSelector uniform;
   for (int i = 0; i < 100; i++) {
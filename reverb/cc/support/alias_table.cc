@@ -0,0 +1,80 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/alias_table.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/types/span.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+AliasTable::AliasTable(absl::Span<const double> weights)
+    : thresholds_(weights.size(), 1),
+      aliases_(weights.size()),
+      probabilities_(weights.size()) {
+  const size_t size = weights.size();
+  REVERB_CHECK_LE(size, std::numeric_limits<uint32_t>::max());
+  double total = 0;
+  for (double weight : weights) {
+    REVERB_CHECK_GE(weight, 0);
+    total += weight;
+  }
+
+  // Each column holds a mean weight of 1: the columns of the indices whose
+  // weight is below the mean are topped up with the weight of indices above
+  // it until every index has been assigned all of its weight.
+  std::vector<double> scaled(size);
+  std::vector<uint32_t> small;
+  std::vector<uint32_t> large;
+  for (uint32_t i = 0; i < size; i++) {
+    probabilities_[i] = total > 0 ? weights[i] / total : 1.0 / size;
+    scaled[i] = probabilities_[i] * size;
+    aliases_[i] = i;
+    (scaled[i] < 1 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    const uint32_t less = small.back();
+    small.pop_back();
+    const uint32_t more = large.back();
+    thresholds_[less] = scaled[less];
+    aliases_[less] = more;
+    scaled[more] -= 1 - scaled[less];
+    if (scaled[more] < 1) {
+      large.pop_back();
+      small.push_back(more);
+    }
+  }
+  // Whatever remains holds a weight of 1 up to rounding errors.
+}
+
+size_t AliasTable::Sample(absl::BitGen* bit_gen) const {
+  const size_t column = absl::Uniform<size_t>(*bit_gen, 0, size());
+  return absl::Uniform<double>(*bit_gen, 0, 1) < thresholds_[column]
+             ? column
+             : aliases_[column];
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
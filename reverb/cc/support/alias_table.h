@@ -0,0 +1,60 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_ALIAS_TABLE_H_
+#define REVERB_CC_SUPPORT_ALIAS_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "absl/types/span.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Samples indices in proportion to fixed weights in O(1) time per sample
+// (Walker's alias method, built in O(n) time with Vose's algorithm). The
+// table is immutable once built so any number of threads can sample it
+// concurrently, each with a bit generator of its own.
+class AliasTable {
+ public:
+  // `weights` must be non-negative. Indices are sampled uniformly if the
+  // weights sum to zero.
+  explicit AliasTable(absl::Span<const double> weights);
+
+  size_t size() const { return probabilities_.size(); }
+
+  // Samples an index. Must not be called on an empty table.
+  size_t Sample(absl::BitGen* bit_gen) const;
+
+  // Probability that `Sample` returns `index`.
+  double probability(size_t index) const { return probabilities_[index]; }
+
+ private:
+  // Column `i` returns `i` with probability `thresholds_[i]` and
+  // `aliases_[i]` otherwise.
+  std::vector<double> thresholds_;
+  std::vector<uint32_t> aliases_;
+  std::vector<double> probabilities_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_ALIAS_TABLE_H_
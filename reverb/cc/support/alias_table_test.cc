@@ -0,0 +1,74 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/alias_table.h"
+
+#include <cstddef>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Returns the fraction of `num_samples` samples of `table` which hit each
+// index.
+std::vector<double> SampleFrequencies(const AliasTable& table,
+                                      int num_samples) {
+  absl::BitGen bit_gen;
+  std::vector<double> frequencies(table.size());
+  for (int i = 0; i < num_samples; i++) {
+    frequencies[table.Sample(&bit_gen)] += 1.0 / num_samples;
+  }
+  return frequencies;
+}
+
+TEST(AliasTableTest, SamplesInProportionToWeights) {
+  const std::vector<double> weights = {1, 0, 3, 6, 0.5, 9.5};
+  AliasTable table(weights);
+  ASSERT_EQ(table.size(), weights.size());
+
+  const std::vector<double> frequencies = SampleFrequencies(table, 200000);
+  for (size_t i = 0; i < weights.size(); i++) {
+    EXPECT_DOUBLE_EQ(table.probability(i), weights[i] / 20);
+    EXPECT_NEAR(frequencies[i], weights[i] / 20, 0.01) << i;
+  }
+  EXPECT_EQ(frequencies[1], 0);
+}
+
+TEST(AliasTableTest, SamplesUniformlyIfAllWeightsAreZero) {
+  AliasTable table(std::vector<double>(4, 0));
+  const std::vector<double> frequencies = SampleFrequencies(table, 100000);
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_DOUBLE_EQ(table.probability(i), 0.25);
+    EXPECT_NEAR(frequencies[i], 0.25, 0.01) << i;
+  }
+}
+
+TEST(AliasTableTest, SingleWeight) {
+  AliasTable table(std::vector<double>{2});
+  absl::BitGen bit_gen;
+  for (int i = 0; i < 100; i++) EXPECT_EQ(table.Sample(&bit_gen), 0);
+  EXPECT_EQ(table.probability(0), 1);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,90 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/channel_pool.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/grpc_utils.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Channel argument which holds the index of the channel. It has no meaning to
+// gRPC but makes the arguments, and thereby the subchannels, of channels with
+// different indices distinct.
+constexpr char kChannelIndexArgument[] = "reverb.channel_pool_index";
+
+}  // namespace
+
+ChannelPool::ChannelPool(int num_channels, ChannelFactory factory)
+    : factory_(std::move(factory)), num_channels_(num_channels) {
+  REVERB_CHECK_GE(num_channels_, 1);
+}
+
+ChannelPool* ChannelPool::Default(const grpc::ChannelArguments& arguments) {
+  static auto* pool = new ChannelPool(
+      /*num_channels=*/1, [arguments](const std::string& address, int index) {
+        grpc::ChannelArguments channel_arguments = arguments;
+        channel_arguments.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        channel_arguments.SetInt(kChannelIndexArgument, index);
+        return CreateCustomGrpcChannel(address, MakeChannelCredentials(),
+                                       channel_arguments);
+      });
+  return pool;
+}
+
+std::vector<std::shared_ptr<grpc::ChannelInterface>> ChannelPool::GetChannels(
+    absl::string_view address) {
+  absl::MutexLock lock(&mu_);
+  auto& entries = channels_[std::string(address)];
+  if (entries.size() < static_cast<size_t>(num_channels_)) {
+    entries.resize(num_channels_);
+  }
+
+  std::vector<std::shared_ptr<grpc::ChannelInterface>> channels;
+  channels.reserve(num_channels_);
+  for (int i = 0; i < num_channels_; i++) {
+    std::shared_ptr<grpc::ChannelInterface> channel = entries[i].lock();
+    if (channel == nullptr) {
+      channel = factory_(std::string(address), i);
+      entries[i] = channel;
+    }
+    channels.push_back(std::move(channel));
+  }
+  return channels;
+}
+
+void ChannelPool::SetNumChannels(int num_channels) {
+  REVERB_CHECK_GE(num_channels, 1);
+  absl::MutexLock lock(&mu_);
+  num_channels_ = num_channels;
+}
+
+int ChannelPool::num_channels() const {
+  absl::MutexLock lock(&mu_);
+  return num_channels_;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,94 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_CHANNEL_POOL_H_
+#define REVERB_CC_SUPPORT_CHANNEL_POOL_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grpcpp/impl/codegen/channel_interface.h"
+#include "grpcpp/support/channel_arguments.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Shares gRPC channels between the clients of a process. The channels to an
+// address are created when first requested and are kept for as long as any
+// caller holds on to one of them, so clients (and the TF ops which each create
+// a client of their own) connected to the same server share connections
+// rather than opening one each.
+//
+// Each address is served by `num_channels` channels, each with its own
+// connection, so a caller which opens many streams can spread them over
+// several connections and parallelize the HTTP/2 framing, which is bound to a
+// single thread per connection.
+//
+// This object is thread-safe.
+class ChannelPool {
+ public:
+  // Creates the channel with index `index` (in [0, num_channels)) to
+  // `address`. Channels with different indices must not share a connection.
+  using ChannelFactory = std::function<std::shared_ptr<grpc::ChannelInterface>(
+      const std::string& address, int index)>;
+
+  ChannelPool(int num_channels, ChannelFactory factory);
+
+  // Process wide instance used by `Client`. Its channels are created with
+  // `CreateCustomGrpcChannel` and the given `arguments`, and are configured so
+  // that channels with different indices don't share their connection. The
+  // arguments of the first call are used and the instance is never destroyed.
+  static ChannelPool* Default(const grpc::ChannelArguments& arguments);
+
+  // Returns the `num_channels()` channels to `address`, creating those which
+  // don't exist (anymore).
+  std::vector<std::shared_ptr<grpc::ChannelInterface>> GetChannels(
+      absl::string_view address) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Sets the number of channels returned by `GetChannels`. Channels which have
+  // already been handed out are unaffected. Must be >= 1.
+  void SetNumChannels(int num_channels) ABSL_LOCKS_EXCLUDED(mu_);
+
+  int num_channels() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // ChannelPool is neither copyable nor movable.
+  ChannelPool(const ChannelPool&) = delete;
+  ChannelPool& operator=(const ChannelPool&) = delete;
+
+ private:
+  const ChannelFactory factory_;
+
+  mutable absl::Mutex mu_;
+
+  int num_channels_ ABSL_GUARDED_BY(mu_);
+
+  // The channels are only referenced weakly so connections to servers which
+  // are no longer used are closed.
+  internal::flat_hash_map<std::string,
+                          std::vector<std::weak_ptr<grpc::ChannelInterface>>>
+      channels_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_CHANNEL_POOL_H_
@@ -0,0 +1,95 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/channel_pool.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "grpcpp/create_channel.h"
+#include "grpcpp/security/credentials.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+// Pool whose factory records the address and index of every channel it
+// creates. The channels connect lazily so no server is needed.
+class ChannelPoolTest : public ::testing::Test {
+ protected:
+  ChannelPoolTest()
+      : pool_(/*num_channels=*/2, [this](const std::string& address,
+                                         int index) {
+          created_.emplace_back(address, index);
+          return grpc::CreateChannel(address,
+                                     grpc::InsecureChannelCredentials());
+        }) {}
+
+  std::vector<std::pair<std::string, int>> created_;
+  ChannelPool pool_;
+};
+
+TEST_F(ChannelPoolTest, CreatesNumChannelsPerAddress) {
+  auto channels = pool_.GetChannels("localhost:1");
+  ASSERT_EQ(channels.size(), 2);
+  EXPECT_NE(channels[0], channels[1]);
+  EXPECT_THAT(created_,
+              ElementsAre(Pair("localhost:1", 0), Pair("localhost:1", 1)));
+}
+
+TEST_F(ChannelPoolTest, SharesChannelsOfSameAddress) {
+  auto first = pool_.GetChannels("localhost:1");
+  auto second = pool_.GetChannels("localhost:1");
+  auto other = pool_.GetChannels("localhost:2");
+  EXPECT_EQ(first, second);
+  EXPECT_NE(first[0], other[0]);
+  EXPECT_EQ(created_.size(), 4);
+}
+
+TEST_F(ChannelPoolTest, RecreatesChannelsWhichAreNoLongerUsed) {
+  auto channels = pool_.GetChannels("localhost:1");
+  channels[1] = nullptr;
+  auto again = pool_.GetChannels("localhost:1");
+  EXPECT_EQ(again[0], channels[0]);
+  EXPECT_EQ(created_.size(), 3);
+  EXPECT_EQ(created_.back(), std::make_pair(std::string("localhost:1"), 1));
+}
+
+TEST_F(ChannelPoolTest, SetNumChannelsAppliesToLaterCalls) {
+  auto channels = pool_.GetChannels("localhost:1");
+  pool_.SetNumChannels(3);
+  EXPECT_EQ(pool_.num_channels(), 3);
+
+  auto more = pool_.GetChannels("localhost:1");
+  ASSERT_EQ(more.size(), 3);
+  EXPECT_EQ(more[0], channels[0]);
+  EXPECT_EQ(more[1], channels[1]);
+  EXPECT_EQ(created_.size(), 3);
+
+  pool_.SetNumChannels(1);
+  EXPECT_THAT(pool_.GetChannels("localhost:1"), ElementsAre(channels[0]));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,168 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/chunk_spill_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+tensorflow::Status ErrnoToStatus(const std::string& message) {
+  return tensorflow::errors::Internal(message, ": ", std::strerror(errno));
+}
+
+uint64_t PageSize() {
+  static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+}  // namespace
+
+tensorflow::Status ChunkSpillFile::Create(
+    const std::string& path, std::unique_ptr<ChunkSpillFile>* file) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return ErrnoToStatus(absl::StrCat("Failed to open spill file ", path));
+  }
+  file->reset(new ChunkSpillFile(path, fd, /*read_only=*/false));
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ChunkSpillFile::Open(const std::string& path,
+                                        std::unique_ptr<ChunkSpillFile>* file) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ErrnoToStatus(absl::StrCat("Failed to open chunk file ", path));
+  }
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < 0) {
+    close(fd);
+    return ErrnoToStatus(absl::StrCat("Failed to seek in chunk file ", path));
+  }
+  file->reset(new ChunkSpillFile(path, fd, /*read_only=*/true));
+  absl::MutexLock lock(&(*file)->mu_);
+  (*file)->end_ = size;
+  return tensorflow::Status::OK();
+}
+
+ChunkSpillFile::ChunkSpillFile(std::string path, int fd, bool read_only)
+    : path_(std::move(path)), fd_(fd), read_only_(read_only) {}
+
+ChunkSpillFile::~ChunkSpillFile() {
+  close(fd_);
+  if (read_only_) return;
+  if (unlink(path_.c_str()) != 0) {
+    REVERB_LOG(REVERB_WARNING) << "Failed to delete spill file " << path_
+                               << ": " << std::strerror(errno);
+  }
+}
+
+tensorflow::Status ChunkSpillFile::Append(const ChunkData& data,
+                                          Location* location) {
+  if (read_only_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Cannot append to read only chunk file ", path_);
+  }
+  std::string serialized = data.SerializeAsString();
+  {
+    absl::MutexLock lock(&mu_);
+    location->offset = end_;
+    location->size = serialized.size();
+    end_ += serialized.size();
+  }
+
+  // Concurrent appends write to disjoint ranges so the writes do not have to
+  // be serialized.
+  size_t written = 0;
+  while (written < serialized.size()) {
+    ssize_t n = pwrite(fd_, serialized.data() + written,
+                       serialized.size() - written, location->offset + written);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return ErrnoToStatus(absl::StrCat("Failed to write to spill file ",
+                                        path_));
+    }
+    written += n;
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status ChunkSpillFile::Read(const Location& location,
+                                        ChunkData* data) const {
+  if (location.size == 0) {
+    data->Clear();
+    return tensorflow::Status::OK();
+  }
+
+  // The offset of a mapping must be aligned to the page size.
+  const uint64_t begin = location.offset - location.offset % PageSize();
+  const uint64_t length = location.offset + location.size - begin;
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd_, begin);
+  if (mapped == MAP_FAILED) {
+    return ErrnoToStatus(absl::StrCat("Failed to map spill file ", path_));
+  }
+  madvise(mapped, length, MADV_SEQUENTIAL);
+  bool parsed = data->ParseFromArray(
+      static_cast<const char*>(mapped) + (location.offset - begin),
+      location.size);
+  munmap(mapped, length);
+
+  if (!parsed) {
+    return tensorflow::errors::DataLoss("Failed to parse chunk at offset ",
+                                        location.offset, " of file ", path_);
+  }
+  return tensorflow::Status::OK();
+}
+
+void ChunkSpillFile::Release(const Location& location) {
+  if (read_only_) return;
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+  // Only whole pages are deallocated so pages shared with neighbouring records
+  // are kept.
+  const uint64_t begin =
+      (location.offset + PageSize() - 1) / PageSize() * PageSize();
+  const uint64_t end =
+      (location.offset + location.size) / PageSize() * PageSize();
+  if (begin < end) {
+    fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, begin,
+              end - begin);
+  }
+#endif
+}
+
+uint64_t ChunkSpillFile::size() const {
+  absl::MutexLock lock(&mu_);
+  return end_;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
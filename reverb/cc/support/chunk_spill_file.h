@@ -0,0 +1,100 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_CHUNK_SPILL_FILE_H_
+#define REVERB_CC_SUPPORT_CHUNK_SPILL_FILE_H_
+
+#include <memory>
+#include <string>
+
+#include <cstdint>
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/schema.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Append-only file on local disk which holds serialized `ChunkData` evicted
+// from memory by a tiered `ChunkStore`. Records are written with `pwrite` and
+// read back through a read-only memory mapping of the pages which hold the
+// record, so repeated reads of hot regions are served from the page cache.
+//
+// The space of released records is returned to the file system by punching
+// holes into the file (where supported). The file is deleted when the object
+// is destroyed.
+//
+// Existing files, e.g the mapped chunk files of a checkpoint, can be opened
+// read only with `Open`. Such files are neither modified nor deleted.
+//
+// This object is thread-safe.
+class ChunkSpillFile {
+ public:
+  // Position of a record within the file.
+  struct Location {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // Creates (or truncates) the file at `path`.
+  static tensorflow::Status Create(const std::string& path,
+                                   std::unique_ptr<ChunkSpillFile>* file);
+
+  // Opens the existing file at `path` read only. The file must be on local
+  // disk.
+  static tensorflow::Status Open(const std::string& path,
+                                 std::unique_ptr<ChunkSpillFile>* file);
+
+  // Closes the file and deletes it unless it was opened with `Open`.
+  ~ChunkSpillFile();
+
+  // Serializes `data` and appends it to the end of the file. Fails if the file
+  // was opened with `Open`.
+  tensorflow::Status Append(const ChunkData& data, Location* location)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Parses the record at `location` into `data`.
+  tensorflow::Status Read(const Location& location, ChunkData* data) const;
+
+  // Releases the disk space of the record at `location`. The record must not
+  // be read afterwards. Failures are ignored as they only waste disk space.
+  // No-op for files opened with `Open`.
+  void Release(const Location& location);
+
+  // Number of bytes appended to the file, including released records.
+  uint64_t size() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  ChunkSpillFile(const ChunkSpillFile&) = delete;
+  ChunkSpillFile& operator=(const ChunkSpillFile&) = delete;
+
+ private:
+  ChunkSpillFile(std::string path, int fd, bool read_only);
+
+  const std::string path_;
+  const int fd_;
+  const bool read_only_;
+
+  mutable absl::Mutex mu_;
+
+  // Offset at which the next record is written.
+  uint64_t end_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_CHUNK_SPILL_FILE_H_
@@ -0,0 +1,132 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/chunk_spill_file.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::deepmind::reverb::testing::EqualsProto;
+
+std::string MakePath() {
+  std::string name;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(&name));
+  return name;
+}
+
+ChunkData MakeChunk(uint64_t key, int num_tensors) {
+  ChunkData chunk = testing::MakeChunkData(key);
+  for (int i = 0; i < num_tensors; i++) {
+    chunk.mutable_data()->add_tensors()->set_tensor_content(
+        std::string(5000, 'a' + i));
+  }
+  return chunk;
+}
+
+TEST(ChunkSpillFileTest, ReadReturnsAppendedChunks) {
+  std::unique_ptr<ChunkSpillFile> file;
+  TF_ASSERT_OK(ChunkSpillFile::Create(MakePath(), &file));
+
+  std::vector<ChunkData> chunks = {MakeChunk(1, 1), MakeChunk(2, 3),
+                                   MakeChunk(3, 0)};
+  std::vector<ChunkSpillFile::Location> locations(chunks.size());
+  for (int i = 0; i < chunks.size(); i++) {
+    TF_ASSERT_OK(file->Append(chunks[i], &locations[i]));
+  }
+
+  // Read in reverse to make sure that the reads are independent.
+  for (int i = chunks.size() - 1; i >= 0; i--) {
+    ChunkData read;
+    TF_ASSERT_OK(file->Read(locations[i], &read));
+    EXPECT_THAT(read, EqualsProto(chunks[i]));
+  }
+  EXPECT_EQ(file->size(), locations.back().offset + locations.back().size);
+}
+
+TEST(ChunkSpillFileTest, ReleaseKeepsOtherChunks) {
+  std::unique_ptr<ChunkSpillFile> file;
+  TF_ASSERT_OK(ChunkSpillFile::Create(MakePath(), &file));
+
+  ChunkSpillFile::Location first, second;
+  TF_ASSERT_OK(file->Append(MakeChunk(1, 4), &first));
+  TF_ASSERT_OK(file->Append(MakeChunk(2, 4), &second));
+  file->Release(first);
+
+  ChunkData read;
+  TF_ASSERT_OK(file->Read(second, &read));
+  EXPECT_THAT(read, EqualsProto(MakeChunk(2, 4)));
+}
+
+TEST(ChunkSpillFileTest, DestructorDeletesFile) {
+  std::string path = MakePath();
+  std::unique_ptr<ChunkSpillFile> file;
+  TF_ASSERT_OK(ChunkSpillFile::Create(path, &file));
+  TF_EXPECT_OK(tensorflow::Env::Default()->FileExists(path));
+  file = nullptr;
+  EXPECT_FALSE(tensorflow::Env::Default()->FileExists(path).ok());
+}
+
+TEST(ChunkSpillFileTest, OpenReadsExistingFileWithoutDeletingIt) {
+  std::string path = MakePath();
+  std::unique_ptr<ChunkSpillFile> writer;
+  TF_ASSERT_OK(ChunkSpillFile::Create(path, &writer));
+  ChunkSpillFile::Location location;
+  TF_ASSERT_OK(writer->Append(MakeChunk(1, 2), &location));
+
+  // Copy the file as the writer deletes it when destroyed.
+  std::string copy = MakePath();
+  TF_ASSERT_OK(tensorflow::Env::Default()->CopyFile(path, copy));
+  writer = nullptr;
+
+  std::unique_ptr<ChunkSpillFile> file;
+  TF_ASSERT_OK(ChunkSpillFile::Open(copy, &file));
+  EXPECT_EQ(file->size(), location.offset + location.size);
+
+  ChunkData read;
+  TF_ASSERT_OK(file->Read(location, &read));
+  EXPECT_THAT(read, EqualsProto(MakeChunk(1, 2)));
+
+  ChunkSpillFile::Location appended;
+  EXPECT_EQ(file->Append(MakeChunk(2, 1), &appended).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+
+  file->Release(location);
+  file = nullptr;
+  TF_EXPECT_OK(tensorflow::Env::Default()->FileExists(copy));
+}
+
+TEST(ChunkSpillFileTest, CreateFailsForInvalidPath) {
+  std::unique_ptr<ChunkSpillFile> file;
+  EXPECT_EQ(ChunkSpillFile::Create("/does/not/exist/spill", &file).code(),
+            tensorflow::error::INTERNAL);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
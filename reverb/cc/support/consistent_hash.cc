@@ -0,0 +1,41 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/consistent_hash.h"
+
+#include <cstdint>
+
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+int JumpConsistentHash(uint64_t key, int num_buckets) {
+  REVERB_CHECK_GT(num_buckets, 0);
+  int64_t bucket = -1;
+  int64_t next = 0;
+  while (next < num_buckets) {
+    bucket = next;
+    key = key * 2862933555777941757ULL + 1;
+    next = static_cast<int64_t>((bucket + 1) *
+                                (static_cast<double>(1LL << 31) /
+                                 static_cast<double>((key >> 33) + 1)));
+  }
+  return static_cast<int>(bucket);
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
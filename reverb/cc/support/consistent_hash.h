@@ -0,0 +1,36 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_CONSISTENT_HASH_H_
+#define REVERB_CC_SUPPORT_CONSISTENT_HASH_H_
+
+#include <cstdint>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Maps `key` to a bucket in [0, `num_buckets`) using the "jump" consistent
+// hash of Lamping and Veach. Keys are spread evenly across the buckets and
+// when the number of buckets grows from N to N + 1 only the keys which are
+// moved to the new bucket (roughly 1 / (N + 1) of all keys) change bucket.
+//
+// `num_buckets` must be positive.
+int JumpConsistentHash(uint64_t key, int num_buckets);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_CONSISTENT_HASH_H_
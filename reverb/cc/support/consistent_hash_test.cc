@@ -0,0 +1,66 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/consistent_hash.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(JumpConsistentHashTest, SingleBucket) {
+  for (uint64_t key = 0; key < 100; key++) {
+    EXPECT_EQ(JumpConsistentHash(key, 1), 0);
+  }
+}
+
+TEST(JumpConsistentHashTest, SpreadsKeysEvenly) {
+  const int kNumBuckets = 10;
+  const int kNumKeys = 100000;
+  std::vector<int> counts(kNumBuckets, 0);
+  for (uint64_t key = 0; key < kNumKeys; key++) {
+    int bucket = JumpConsistentHash(key * 0x9E3779B97F4A7C15ULL, kNumBuckets);
+    ASSERT_GE(bucket, 0);
+    ASSERT_LT(bucket, kNumBuckets);
+    counts[bucket]++;
+  }
+  for (int count : counts) {
+    EXPECT_NEAR(count, kNumKeys / kNumBuckets, kNumKeys / kNumBuckets / 10);
+  }
+}
+
+TEST(JumpConsistentHashTest, OnlyMovesKeysToNewBucket) {
+  const int kNumKeys = 10000;
+  int moved = 0;
+  for (uint64_t key = 0; key < kNumKeys; key++) {
+    int before = JumpConsistentHash(key, 4);
+    int after = JumpConsistentHash(key, 5);
+    if (before != after) {
+      EXPECT_EQ(after, 4);
+      moved++;
+    }
+  }
+  EXPECT_NEAR(moved, kNumKeys / 5, kNumKeys / 50);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,123 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/dary_heap.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+DAryHeap::DAryHeap(int arity) : arity_(arity) { REVERB_CHECK_GE(arity, 2); }
+
+void DAryHeap::Push(size_t id, double priority, uint64_t update_number) {
+  REVERB_CHECK_EQ(id, size());
+  heap_.emplace_back();
+  positions_.push_back(heap_.size() - 1);
+  SiftUp(heap_.size() - 1, {priority, update_number, id});
+}
+
+void DAryHeap::Update(size_t id, double priority, uint64_t update_number) {
+  REVERB_CHECK_LT(id, size());
+  const size_t pos = positions_[id];
+  heap_[pos].priority = priority;
+  heap_[pos].update_number = update_number;
+  Fix(pos);
+}
+
+void DAryHeap::Remove(size_t id) {
+  REVERB_CHECK_LT(id, size());
+
+  // Fill the position of the removed entry with the last entry of the heap.
+  const size_t pos = positions_[id];
+  const Entry last = heap_.back();
+  heap_.pop_back();
+  if (pos != heap_.size()) {
+    heap_[pos] = last;
+    positions_[last.id] = pos;
+    Fix(pos);
+  }
+
+  // Move the last id into the removed one.
+  const size_t last_id = positions_.size() - 1;
+  if (id != last_id) {
+    positions_[id] = positions_[last_id];
+    heap_[positions_[id]].id = id;
+  }
+  positions_.pop_back();
+}
+
+size_t DAryHeap::top() const {
+  REVERB_CHECK(!heap_.empty());
+  return heap_.front().id;
+}
+
+void DAryHeap::Clear() {
+  heap_.clear();
+  positions_.clear();
+}
+
+void DAryHeap::Reserve(size_t size) {
+  heap_.reserve(size);
+  positions_.reserve(size);
+}
+
+void DAryHeap::SiftUp(size_t pos, Entry entry) {
+  while (pos > 0) {
+    const size_t parent = (pos - 1) / arity_;
+    if (!Less(entry, heap_[parent])) break;
+    heap_[pos] = heap_[parent];
+    positions_[heap_[pos].id] = pos;
+    pos = parent;
+  }
+  heap_[pos] = entry;
+  positions_[entry.id] = pos;
+}
+
+void DAryHeap::SiftDown(size_t pos, Entry entry) {
+  const size_t size = heap_.size();
+  while (true) {
+    const size_t first_child = pos * arity_ + 1;
+    if (first_child >= size) break;
+    const size_t end = std::min(first_child + arity_, size);
+    size_t smallest = first_child;
+    for (size_t child = first_child + 1; child < end; child++) {
+      if (Less(heap_[child], heap_[smallest])) smallest = child;
+    }
+    if (!Less(heap_[smallest], entry)) break;
+    heap_[pos] = heap_[smallest];
+    positions_[heap_[pos].id] = pos;
+    pos = smallest;
+  }
+  heap_[pos] = entry;
+  positions_[entry.id] = pos;
+}
+
+void DAryHeap::Fix(size_t pos) {
+  const Entry entry = heap_[pos];
+  if (pos > 0 && Less(entry, heap_[(pos - 1) / arity_])) {
+    SiftUp(pos, entry);
+  } else {
+    SiftDown(pos, entry);
+  }
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
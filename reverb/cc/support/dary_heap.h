@@ -0,0 +1,99 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_DARY_HEAP_H_
+#define REVERB_CC_SUPPORT_DARY_HEAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Array backed min-heap with `arity` children per node, ordered by (priority,
+// update_number). Unlike `IntrusiveHeap`, which orders pointers to nodes that
+// are allocated one by one, the priorities and update numbers are stored in
+// the heap array itself so sifts only touch contiguous memory, and a wider
+// node makes the heap shallower.
+//
+// Elements are identified by dense ids in [0, size()) and the position of each
+// id in the heap is kept in a back-index array. Ids behave like the slots of a
+// table (see `ItemSelector::UseTableKeys`): `Push` takes the next id and
+// `Remove` moves the last id into the removed one.
+class DAryHeap {
+ public:
+  explicit DAryHeap(int arity);
+
+  // Adds the element `id`, which must be equal to `size()`. O(log n) time.
+  void Push(size_t id, double priority, uint64_t update_number);
+
+  // Changes the ordering of the element `id`. O(log n) time.
+  void Update(size_t id, double priority, uint64_t update_number);
+
+  // Removes the element `id` and moves the element with the last id into
+  // `id`. O(log n) time.
+  void Remove(size_t id);
+
+  // Id of the smallest element. Must not be empty. O(1) time.
+  size_t top() const;
+
+  size_t size() const { return heap_.size(); }
+  bool empty() const { return heap_.empty(); }
+
+  void Clear();
+
+  // Allocates the arrays for `size` elements up front.
+  void Reserve(size_t size);
+
+  // Memory which `Reserve` allocates per element.
+  static constexpr size_t BytesPerElement() {
+    return sizeof(Entry) + sizeof(size_t);
+  }
+
+ private:
+  struct Entry {
+    double priority;
+    uint64_t update_number;
+    size_t id;
+  };
+
+  static bool Less(const Entry& a, const Entry& b) {
+    return a.priority < b.priority ||
+           (a.priority == b.priority && a.update_number < b.update_number);
+  }
+
+  // Places `entry` at `pos` and moves it up (down) until the heap property
+  // holds, updating the back-indices of all moved entries.
+  void SiftUp(size_t pos, Entry entry);
+  void SiftDown(size_t pos, Entry entry);
+
+  // Restores the heap property after the entry at `pos` changed.
+  void Fix(size_t pos);
+
+  const size_t arity_;
+
+  // The entries in heap order.
+  std::vector<Entry> heap_;
+
+  // Position in `heap_` of each id.
+  std::vector<size_t> positions_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_DARY_HEAP_H_
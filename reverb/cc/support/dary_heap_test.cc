@@ -0,0 +1,116 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/dary_heap.h"
+
+#include <cstdint>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+class DAryHeapTest : public ::testing::TestWithParam<int> {};
+
+TEST_P(DAryHeapTest, PushPopInOrder) {
+  DAryHeap heap(GetParam());
+  const std::vector<double> priorities = {5, 3, 8, 1, 9, 2, 7, 3};
+  for (size_t i = 0; i < priorities.size(); i++) {
+    heap.Push(i, priorities[i], i);
+  }
+
+  // Removing the top moves the last id into its place, so the priorities of
+  // the ids are tracked to read back the order.
+  std::vector<double> by_id = priorities;
+  std::vector<double> popped;
+  while (!heap.empty()) {
+    const size_t top = heap.top();
+    popped.push_back(by_id[top]);
+    by_id[top] = by_id.back();
+    by_id.pop_back();
+    heap.Remove(top);
+  }
+  EXPECT_THAT(popped, ::testing::ElementsAre(1, 2, 3, 3, 5, 7, 8, 9));
+}
+
+TEST_P(DAryHeapTest, BreaksTiesByUpdateNumber) {
+  DAryHeap heap(GetParam());
+  heap.Push(0, 1, 10);
+  heap.Push(1, 1, 5);
+  heap.Push(2, 1, 7);
+  EXPECT_EQ(heap.top(), 1);
+  heap.Update(1, 1, 11);
+  EXPECT_EQ(heap.top(), 2);
+}
+
+TEST_P(DAryHeapTest, MatchesOrderedSet) {
+  // Mirrors the heap with an ordered set of (priority, update_number, key),
+  // where `keys` maps the ids of the heap to keys.
+  DAryHeap heap(GetParam());
+  std::set<std::tuple<double, uint64_t, int>> expected;
+  std::vector<std::pair<int, std::tuple<double, uint64_t, int>>> keys;
+  absl::BitGen bit_gen;
+  uint64_t update_number = 0;
+  int next_key = 0;
+  for (int i = 0; i < 20000; i++) {
+    const double action = absl::Uniform<double>(bit_gen, 0, 1);
+    // Few distinct priorities so that ties are common.
+    const double priority = absl::Uniform<int>(bit_gen, 0, 50);
+    if (keys.empty() || action < 0.45) {
+      auto entry = std::make_tuple(priority, update_number++, next_key);
+      heap.Push(keys.size(), priority, std::get<1>(entry));
+      keys.emplace_back(next_key++, entry);
+      expected.insert(entry);
+    } else if (action < 0.75) {
+      const size_t id = absl::Uniform<size_t>(bit_gen, 0, keys.size());
+      expected.erase(keys[id].second);
+      heap.Remove(id);
+      keys[id] = keys.back();
+      keys.pop_back();
+    } else {
+      const size_t id = absl::Uniform<size_t>(bit_gen, 0, keys.size());
+      expected.erase(keys[id].second);
+      keys[id].second = std::make_tuple(priority, update_number++,
+                                        keys[id].first);
+      expected.insert(keys[id].second);
+      heap.Update(id, priority, std::get<1>(keys[id].second));
+    }
+    ASSERT_EQ(heap.size(), expected.size());
+    if (!expected.empty()) {
+      ASSERT_EQ(keys[heap.top()].first, std::get<2>(*expected.begin()));
+    }
+  }
+
+  heap.Clear();
+  EXPECT_TRUE(heap.empty());
+}
+
+INSTANTIATE_TEST_SUITE_P(Arities, DAryHeapTest, ::testing::Values(2, 4, 8));
+
+TEST(DAryHeapDeathTest, TopOfEmptyHeap) {
+  DAryHeap heap(4);
+  EXPECT_DEATH(heap.top(), "");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
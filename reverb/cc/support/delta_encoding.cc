@@ -0,0 +1,239 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/delta_encoding.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define REVERB_HAVE_X86_KERNELS 1
+#define REVERB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Each kernel processes a prefix of a row and returns the number of columns it
+// processed. The remaining columns are processed by `ScalarKernel`. For
+// encoding `prev` is the previous row of the input and for decoding it is the
+// previous row of the output.
+
+struct ScalarKernel {
+  template <typename T, bool kEncode>
+  static int64_t Row(const T* src, const T* prev, T* dst, int64_t begin,
+                     int64_t cols) {
+    for (int64_t j = begin; j < cols; j++) {
+      dst[j] = kEncode ? static_cast<T>(src[j] - prev[j])
+                       : static_cast<T>(src[j] + prev[j]);
+    }
+    return cols;
+  }
+};
+
+#ifdef REVERB_HAVE_X86_KERNELS
+
+template <typename T>
+struct Sse2Ops;
+
+template <>
+struct Sse2Ops<uint8_t> {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi8(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi8(a, b); }
+};
+
+template <>
+struct Sse2Ops<uint16_t> {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi16(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi16(a, b); }
+};
+
+template <>
+struct Sse2Ops<uint32_t> {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+};
+
+template <>
+struct Sse2Ops<uint64_t> {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi64(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi64(a, b); }
+};
+
+// SSE2 is part of the x86-64 baseline so no runtime check is required.
+struct Sse2Kernel {
+  template <typename T, bool kEncode>
+  static int64_t Row(const T* src, const T* prev, T* dst, int64_t begin,
+                     int64_t cols) {
+    constexpr int64_t kLanes = sizeof(__m128i) / sizeof(T);
+    int64_t j = begin;
+    for (; j + kLanes <= cols; j += kLanes) {
+      const __m128i s =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j));
+      const __m128i p =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + j));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + j),
+                       kEncode ? Sse2Ops<T>::Sub(s, p) : Sse2Ops<T>::Add(s, p));
+    }
+    return j;
+  }
+};
+
+// The AVX2 helpers must carry the target attribute as well, otherwise they
+// can't be inlined into `Avx2Kernel::Row`.
+template <typename T>
+struct Avx2Ops;
+
+template <>
+struct Avx2Ops<uint8_t> {
+  REVERB_TARGET_AVX2 static __m256i Add(__m256i a, __m256i b) {
+    return _mm256_add_epi8(a, b);
+  }
+  REVERB_TARGET_AVX2 static __m256i Sub(__m256i a, __m256i b) {
+    return _mm256_sub_epi8(a, b);
+  }
+};
+
+template <>
+struct Avx2Ops<uint16_t> {
+  REVERB_TARGET_AVX2 static __m256i Add(__m256i a, __m256i b) {
+    return _mm256_add_epi16(a, b);
+  }
+  REVERB_TARGET_AVX2 static __m256i Sub(__m256i a, __m256i b) {
+    return _mm256_sub_epi16(a, b);
+  }
+};
+
+template <>
+struct Avx2Ops<uint32_t> {
+  REVERB_TARGET_AVX2 static __m256i Add(__m256i a, __m256i b) {
+    return _mm256_add_epi32(a, b);
+  }
+  REVERB_TARGET_AVX2 static __m256i Sub(__m256i a, __m256i b) {
+    return _mm256_sub_epi32(a, b);
+  }
+};
+
+template <>
+struct Avx2Ops<uint64_t> {
+  REVERB_TARGET_AVX2 static __m256i Add(__m256i a, __m256i b) {
+    return _mm256_add_epi64(a, b);
+  }
+  REVERB_TARGET_AVX2 static __m256i Sub(__m256i a, __m256i b) {
+    return _mm256_sub_epi64(a, b);
+  }
+};
+
+struct Avx2Kernel {
+  template <typename T, bool kEncode>
+  REVERB_TARGET_AVX2 static int64_t Row(const T* src, const T* prev, T* dst,
+                                        int64_t begin, int64_t cols) {
+    constexpr int64_t kLanes = sizeof(__m256i) / sizeof(T);
+    int64_t j = begin;
+    // Two registers per iteration to hide the latency of the loads.
+    for (; j + 2 * kLanes <= cols; j += 2 * kLanes) {
+      const auto* s = reinterpret_cast<const __m256i*>(src + j);
+      const auto* p = reinterpret_cast<const __m256i*>(prev + j);
+      auto* d = reinterpret_cast<__m256i*>(dst + j);
+      const __m256i s0 = _mm256_loadu_si256(s);
+      const __m256i s1 = _mm256_loadu_si256(s + 1);
+      const __m256i p0 = _mm256_loadu_si256(p);
+      const __m256i p1 = _mm256_loadu_si256(p + 1);
+      _mm256_storeu_si256(d, kEncode ? Avx2Ops<T>::Sub(s0, p0)
+                                     : Avx2Ops<T>::Add(s0, p0));
+      _mm256_storeu_si256(d + 1, kEncode ? Avx2Ops<T>::Sub(s1, p1)
+                                         : Avx2Ops<T>::Add(s1, p1));
+    }
+    for (; j + kLanes <= cols; j += kLanes) {
+      const __m256i s =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + j));
+      const __m256i p =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + j));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j),
+                          kEncode ? Avx2Ops<T>::Sub(s, p)
+                                  : Avx2Ops<T>::Add(s, p));
+    }
+    return j;
+  }
+};
+
+bool CpuSupportsAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+#endif  // REVERB_HAVE_X86_KERNELS
+
+template <typename Kernel, typename T, bool kEncode>
+void Rows(const T* src, T* dst, int64_t rows, int64_t cols) {
+  if (rows <= 0 || cols <= 0) return;
+  if (src != dst) std::memcpy(dst, src, cols * sizeof(T));
+  for (int64_t i = 1; i < rows; i++) {
+    const T* row_src = src + i * cols;
+    T* row_dst = dst + i * cols;
+    const T* prev = kEncode ? row_src - cols : row_dst - cols;
+    const int64_t done =
+        Kernel::template Row<T, kEncode>(row_src, prev, row_dst, 0, cols);
+    ScalarKernel::Row<T, kEncode>(row_src, prev, row_dst, done, cols);
+  }
+}
+
+template <typename Kernel, typename T>
+void Rows(const T* src, T* dst, int64_t rows, int64_t cols, bool encode) {
+  if (encode) {
+    Rows<Kernel, T, true>(src, dst, rows, cols);
+  } else {
+    Rows<Kernel, T, false>(src, dst, rows, cols);
+  }
+}
+
+}  // namespace
+
+template <typename T>
+void DeltaEncodeRows(const T* src, T* dst, int64_t rows, int64_t cols,
+                     bool encode) {
+#ifdef REVERB_HAVE_X86_KERNELS
+  if (CpuSupportsAvx2() && cols >= static_cast<int64_t>(32 / sizeof(T))) {
+    return Rows<Avx2Kernel>(src, dst, rows, cols, encode);
+  }
+  if (cols >= static_cast<int64_t>(16 / sizeof(T))) {
+    return Rows<Sse2Kernel>(src, dst, rows, cols, encode);
+  }
+#endif
+  Rows<ScalarKernel>(src, dst, rows, cols, encode);
+}
+
+template <typename T>
+void DeltaEncodeRowsScalar(const T* src, T* dst, int64_t rows, int64_t cols,
+                           bool encode) {
+  Rows<ScalarKernel>(src, dst, rows, cols, encode);
+}
+
+#define REVERB_INSTANTIATE_DELTA_ENCODE(T)                                   \
+  template void DeltaEncodeRows<T>(const T*, T*, int64_t, int64_t, bool);    \
+  template void DeltaEncodeRowsScalar<T>(const T*, T*, int64_t, int64_t, bool);
+
+REVERB_INSTANTIATE_DELTA_ENCODE(uint8_t)
+REVERB_INSTANTIATE_DELTA_ENCODE(uint16_t)
+REVERB_INSTANTIATE_DELTA_ENCODE(uint32_t)
+REVERB_INSTANTIATE_DELTA_ENCODE(uint64_t)
+
+#undef REVERB_INSTANTIATE_DELTA_ENCODE
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
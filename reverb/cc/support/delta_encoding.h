@@ -0,0 +1,54 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_DELTA_ENCODING_H_
+#define REVERB_CC_SUPPORT_DELTA_ENCODING_H_
+
+#include <cstdint>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Delta encodes (`encode=true`) or decodes (`encode=false`) a row major matrix
+// of `rows` x `cols` unsigned integers from `src` to `dst`. The rows are the
+// time steps so encoding computes `dst[i] = src[i] - src[i - 1]` and decoding
+// computes the prefix sum `dst[i] = src[i] + dst[i - 1]` of every column. The
+// first row is copied as is. `src` and `dst` must not overlap, except that
+// decoding may be done in place (`src == dst`).
+//
+// The prefix sum is sequential along the time axis but independent between
+// columns, so both directions are vectorized across the columns of a row. The
+// AVX2 kernels are used if the CPU supports them, otherwise SSE2 (x86-64) or
+// scalar kernels are used. Rows with fewer columns than fit into a vector
+// register are processed by the scalar kernels.
+//
+// `T` must be one of uint8_t, uint16_t, uint32_t and uint64_t. Signed integers
+// are delta encoded by reinterpreting them as unsigned integers of the same
+// width since the arithmetic is modulo 2^N.
+template <typename T>
+void DeltaEncodeRows(const T* src, T* dst, int64_t rows, int64_t cols,
+                     bool encode);
+
+// Same as `DeltaEncodeRows` but always uses the scalar kernels. Exposed for
+// tests and benchmarks.
+template <typename T>
+void DeltaEncodeRowsScalar(const T* src, T* dst, int64_t rows, int64_t cols,
+                           bool encode);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_DELTA_ENCODING_H_
@@ -0,0 +1,101 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the throughput of the vectorized and scalar delta encoding kernels
+// for every supported integer width and a few typical chunk shapes. The test
+// is tagged as manual and has to be run explicitly:
+//
+//   bazel test -c opt //reverb/cc/support:delta_encoding_benchmark_test \
+//     --test_output=streamed
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/support/delta_encoding.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Total number of bytes processed per measurement.
+constexpr int64_t kBytesPerMeasurement = int64_t{1} << 30;
+
+struct ChunkShape {
+  std::string name;
+  int64_t rows;  // Time steps in the chunk.
+  int64_t cols;  // Elements per time step.
+};
+
+std::vector<ChunkShape> Shapes() {
+  return {
+      {"atari_frames[10,84,84,1]", 10, 84 * 84},
+      {"rgb_frames[10,64,64,3]", 10, 64 * 64 * 3},
+      {"state[100,32]", 100, 32},
+      {"state[100,4]", 100, 4},
+  };
+}
+
+template <typename T, typename Fn>
+double GigabytesPerSecond(const ChunkShape& shape, bool encode, Fn fn) {
+  std::vector<T> src(shape.rows * shape.cols);
+  for (int64_t i = 0; i < src.size(); i++) src[i] = static_cast<T>(i * 7);
+  std::vector<T> dst(src.size());
+
+  const int64_t bytes = src.size() * sizeof(T);
+  const int64_t iterations = std::max<int64_t>(kBytesPerMeasurement / bytes, 1);
+  const absl::Time start = absl::Now();
+  for (int64_t i = 0; i < iterations; i++) {
+    fn(src.data(), dst.data(), shape.rows, shape.cols, encode);
+  }
+  const absl::Duration elapsed = absl::Now() - start;
+  EXPECT_NE(dst.back(), 1);  // Keeps the result alive.
+  return static_cast<double>(bytes * iterations) /
+         absl::ToDoubleSeconds(elapsed) / 1e9;
+}
+
+template <typename T>
+void RunBenchmark(const std::string& dtype) {
+  for (const auto& shape : Shapes()) {
+    for (bool encode : {true, false}) {
+      const double scalar =
+          GigabytesPerSecond<T>(shape, encode, DeltaEncodeRowsScalar<T>);
+      const double vectorized =
+          GigabytesPerSecond<T>(shape, encode, DeltaEncodeRows<T>);
+      REVERB_LOG(REVERB_INFO)
+          << dtype << " " << shape.name << (encode ? " encode" : " decode")
+          << ": scalar=" << scalar << "GB/s vectorized=" << vectorized
+          << "GB/s speedup=" << vectorized / scalar << "x";
+    }
+  }
+}
+
+TEST(DeltaEncodingBenchmark, Uint8) { RunBenchmark<uint8_t>("uint8"); }
+
+TEST(DeltaEncodingBenchmark, Uint16) { RunBenchmark<uint16_t>("uint16"); }
+
+TEST(DeltaEncodingBenchmark, Uint32) { RunBenchmark<uint32_t>("uint32"); }
+
+TEST(DeltaEncodingBenchmark, Uint64) { RunBenchmark<uint64_t>("uint64"); }
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,113 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/delta_encoding.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
+
+template <typename T>
+std::vector<T> RandomValues(int64_t n) {
+  absl::BitGen gen;
+  std::vector<T> values(n);
+  for (auto& value : values) {
+    value = absl::Uniform<T>(gen, 0, std::numeric_limits<T>::max());
+  }
+  return values;
+}
+
+template <typename T>
+class DeltaEncodingTest : public ::testing::Test {};
+
+using UnsignedTypes = ::testing::Types<uint8_t, uint16_t, uint32_t, uint64_t>;
+TYPED_TEST_SUITE(DeltaEncodingTest, UnsignedTypes);
+
+TYPED_TEST(DeltaEncodingTest, MatchesScalarKernels) {
+  // Covers rows narrower than a vector register, rows which are a multiple of
+  // the register width and rows with a remainder.
+  for (int64_t cols : {1, 3, 7, 16, 33, 64, 100, 84 * 84}) {
+    const int64_t rows = 11;
+    const auto input = RandomValues<TypeParam>(rows * cols);
+
+    for (bool encode : {true, false}) {
+      std::vector<TypeParam> expected(input.size());
+      std::vector<TypeParam> actual(input.size());
+      DeltaEncodeRowsScalar(input.data(), expected.data(), rows, cols, encode);
+      DeltaEncodeRows(input.data(), actual.data(), rows, cols, encode);
+      EXPECT_THAT(actual, ElementsAreArray(expected))
+          << "cols=" << cols << " encode=" << encode;
+    }
+  }
+}
+
+TYPED_TEST(DeltaEncodingTest, DecodeInvertsEncode) {
+  const int64_t rows = 5;
+  const int64_t cols = 257;
+  const auto input = RandomValues<TypeParam>(rows * cols);
+
+  std::vector<TypeParam> encoded(input.size());
+  std::vector<TypeParam> decoded(input.size());
+  DeltaEncodeRows(input.data(), encoded.data(), rows, cols, true);
+  DeltaEncodeRows(encoded.data(), decoded.data(), rows, cols, false);
+  EXPECT_THAT(decoded, ElementsAreArray(input));
+}
+
+TYPED_TEST(DeltaEncodingTest, DecodeInPlace) {
+  const int64_t rows = 7;
+  const int64_t cols = 100;
+  const auto input = RandomValues<TypeParam>(rows * cols);
+
+  std::vector<TypeParam> expected(input.size());
+  DeltaEncodeRowsScalar(input.data(), expected.data(), rows, cols, false);
+  std::vector<TypeParam> actual = input;
+  DeltaEncodeRows(actual.data(), actual.data(), rows, cols, false);
+  EXPECT_THAT(actual, ElementsAreArray(expected));
+}
+
+TYPED_TEST(DeltaEncodingTest, SingleRowIsCopied) {
+  const auto input = RandomValues<TypeParam>(50);
+  std::vector<TypeParam> output(input.size());
+  DeltaEncodeRows(input.data(), output.data(), 1, input.size(), true);
+  EXPECT_THAT(output, ElementsAreArray(input));
+}
+
+TEST(DeltaEncodingTest, DifferencesWrapAround) {
+  const std::vector<uint8_t> input = {10, 250, 5, 0, 20, 255};
+  std::vector<uint8_t> output(input.size());
+  DeltaEncodeRows(input.data(), output.data(), /*rows=*/3, /*cols=*/2, true);
+  EXPECT_THAT(output, ElementsAre(10, 250, 251, 6, 15, 255));
+
+  std::vector<uint8_t> decoded(input.size());
+  DeltaEncodeRows(output.data(), decoded.data(), 3, 2, false);
+  EXPECT_THAT(decoded, ElementsAreArray(input));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,68 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/expiry_queue.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+ExpiryQueue::ExpiryQueue(absl::Duration granularity, absl::Time start)
+    : granularity_(granularity) {
+  REVERB_CHECK_GT(granularity_, absl::ZeroDuration());
+  first_bucket_ = BucketOf(start);
+}
+
+int64_t ExpiryQueue::BucketOf(absl::Time time) const {
+  return (time - absl::UnixEpoch() + granularity_ - absl::Nanoseconds(1)) /
+         granularity_;
+}
+
+void ExpiryQueue::Push(absl::Time deadline, Entry entry) {
+  const int64_t bucket = std::max(BucketOf(deadline), first_bucket_);
+  const size_t offset = bucket - first_bucket_;
+  if (offset >= buckets_.size()) buckets_.resize(offset + 1);
+  buckets_[offset].push_back(entry);
+  size_++;
+}
+
+void ExpiryQueue::PopExpired(absl::Time now, std::vector<Entry>* expired) {
+  // Bucket `b` ends at `b * granularity_`.
+  const int64_t last_expired = (now - absl::UnixEpoch()) / granularity_;
+  while (first_bucket_ <= last_expired && !buckets_.empty()) {
+    std::vector<Entry>& bucket = buckets_.front();
+    size_ -= bucket.size();
+    expired->insert(expired->end(), bucket.begin(), bucket.end());
+    buckets_.pop_front();
+    first_bucket_++;
+  }
+  first_bucket_ = std::max(first_bucket_, last_expired + 1);
+}
+
+void ExpiryQueue::Clear() {
+  buckets_.clear();
+  size_ = 0;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,87 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_EXPIRY_QUEUE_H_
+#define REVERB_CC_SUPPORT_EXPIRY_QUEUE_H_
+
+#include <deque>
+#include <vector>
+
+#include <cstdint>
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Keys ordered by the time they expire at, in buckets of `granularity`: a key
+// is pushed into the bucket which ends at the first multiple of `granularity`
+// at or after its deadline and popped once the bucket has ended. Both take O(1)
+// time per key (amortized over the buckets passed), but keys can be popped up
+// to `granularity` after their deadline.
+//
+// Keys aren't removed before they expire. Instead every entry carries a `tag`,
+// e.g the insertion time of the item, which the caller compares to the
+// current state of the key to skip entries that are stale.
+//
+// This class is not thread-safe.
+class ExpiryQueue {
+ public:
+  struct Entry {
+    uint64_t key;
+    int64_t tag;
+  };
+
+  // `start` is the earliest time `PopExpired` is called with. Entries with
+  // deadlines before `start` (or before the last `PopExpired`) are pushed into
+  // the first bucket.
+  ExpiryQueue(absl::Duration granularity, absl::Time start);
+
+  // Adds an `entry` which expires at `deadline`.
+  void Push(absl::Time deadline, Entry entry);
+
+  // Appends the entries of the buckets which ended at or before `now` to
+  // `expired` and removes them from the queue.
+  void PopExpired(absl::Time now, std::vector<Entry>* expired);
+
+  // Removes all entries.
+  void Clear();
+
+  // Number of entries in the queue (including stale ones).
+  size_t size() const { return size_; }
+
+  absl::Duration granularity() const { return granularity_; }
+
+ private:
+  // Index of the bucket `time` belongs to, i.e `ceil(time / granularity_)`.
+  int64_t BucketOf(absl::Time time) const;
+
+  const absl::Duration granularity_;
+
+  // Index of `buckets_.front()`. The buckets before it have been popped.
+  int64_t first_bucket_;
+
+  // Entries of the buckets from `first_bucket_` and on. Entries which expire
+  // before `first_bucket_` are appended to the first bucket.
+  std::deque<std::vector<Entry>> buckets_;
+
+  size_t size_ = 0;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_EXPIRY_QUEUE_H_
@@ -0,0 +1,107 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/expiry_queue.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAre;
+
+MATCHER_P2(IsEntry, key, tag, "") {
+  return arg.key == key && arg.tag == tag;
+}
+
+const absl::Time kStart = absl::FromUnixSeconds(1000);
+
+std::vector<ExpiryQueue::Entry> PopExpired(ExpiryQueue* queue,
+                                           absl::Time now) {
+  std::vector<ExpiryQueue::Entry> expired;
+  queue->PopExpired(now, &expired);
+  return expired;
+}
+
+TEST(ExpiryQueueTest, PopsEntriesOnceTheirBucketHasEnded) {
+  ExpiryQueue queue(absl::Seconds(1), kStart);
+  queue.Push(kStart + absl::Milliseconds(1500), {1, 10});
+  queue.Push(kStart + absl::Seconds(2), {2, 20});
+  queue.Push(kStart + absl::Milliseconds(2500), {3, 30});
+  EXPECT_EQ(queue.size(), 3);
+
+  EXPECT_THAT(PopExpired(&queue, kStart + absl::Milliseconds(1500)),
+              IsEmpty());
+  EXPECT_THAT(PopExpired(&queue, kStart + absl::Seconds(2)),
+              ElementsAre(IsEntry(1, 10), IsEntry(2, 20)));
+  EXPECT_EQ(queue.size(), 1);
+  EXPECT_THAT(PopExpired(&queue, kStart + absl::Seconds(10)),
+              ElementsAre(IsEntry(3, 30)));
+  EXPECT_EQ(queue.size(), 0);
+}
+
+TEST(ExpiryQueueTest, EntriesWhichAlreadyExpiredArePoppedWithFirstBucket) {
+  ExpiryQueue queue(absl::Seconds(1), kStart);
+  EXPECT_THAT(PopExpired(&queue, kStart + absl::Seconds(5)), IsEmpty());
+
+  queue.Push(kStart + absl::Seconds(10), {1, 0});
+  queue.Push(kStart - absl::Hours(1), {2, 0});
+  EXPECT_THAT(PopExpired(&queue, kStart + absl::Seconds(6)),
+              ElementsAre(IsEntry(2, 0)));
+  EXPECT_THAT(PopExpired(&queue, kStart + absl::Seconds(10)),
+              ElementsAre(IsEntry(1, 0)));
+}
+
+TEST(ExpiryQueueTest, Clear) {
+  ExpiryQueue queue(absl::Seconds(1), kStart);
+  queue.Push(kStart + absl::Seconds(1), {1, 0});
+  queue.Clear();
+  EXPECT_EQ(queue.size(), 0);
+  queue.Push(kStart + absl::Seconds(1), {2, 0});
+  EXPECT_THAT(PopExpired(&queue, kStart + absl::Seconds(1)),
+              ElementsAre(IsEntry(2, 0)));
+}
+
+TEST(ExpiryQueueTest, ManyEntries) {
+  ExpiryQueue queue(absl::Milliseconds(10), kStart);
+  for (int i = 0; i < 1000; i++) {
+    queue.Push(kStart + absl::Milliseconds(i), {static_cast<uint64_t>(i), i});
+  }
+  std::vector<ExpiryQueue::Entry> expired;
+  for (int i = 0; i <= 1000; i += 7) {
+    const size_t before = expired.size();
+    queue.PopExpired(kStart + absl::Milliseconds(i), &expired);
+    for (size_t j = before; j < expired.size(); j++) {
+      EXPECT_LE(expired[j].tag, i);
+      EXPECT_GT(expired[j].tag, i - 7 - 10);
+    }
+  }
+  queue.PopExpired(kStart + absl::Seconds(2), &expired);
+  EXPECT_EQ(expired.size(), 1000);
+  EXPECT_EQ(queue.size(), 0);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
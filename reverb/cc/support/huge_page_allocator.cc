@@ -0,0 +1,155 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/huge_page_allocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/huge_pages.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr size_t k1GB = size_t{1} << 30;
+
+std::atomic<PageKind> configured_pages{PageKind::kRegular};
+
+// The mappings are few (one per large array) and are only created and freed
+// when the arrays grow, so a mutex suffices.
+struct Mappings {
+  absl::Mutex mu;
+  flat_hash_map<void*, PageKind> backings ABSL_GUARDED_BY(mu);
+  HugePageStats stats ABSL_GUARDED_BY(mu);
+  bool fallback_logged ABSL_GUARDED_BY(mu) = false;
+};
+
+Mappings* GetMappings() {
+  static auto* mappings = new Mappings();
+  return mappings;
+}
+
+int64_t* MappedBytes(HugePageStats* stats, PageKind kind) {
+  switch (kind) {
+    case PageKind::kRegular:
+      return &stats->regular_bytes;
+    case PageKind::kTransparentHuge:
+      return &stats->transparent_huge_bytes;
+    case PageKind::kHuge2MB:
+      return &stats->huge_2mb_bytes;
+    case PageKind::kHuge1GB:
+      return &stats->huge_1gb_bytes;
+  }
+  return &stats->regular_bytes;
+}
+
+const char* PageKindName(PageKind kind) {
+  switch (kind) {
+    case PageKind::kRegular:
+      return "regular";
+    case PageKind::kTransparentHuge:
+      return "transparent huge";
+    case PageKind::kHuge2MB:
+      return "2 MB";
+    case PageKind::kHuge1GB:
+      return "1 GB";
+  }
+  return "unknown";
+}
+
+// The size of a mapping only depends on `bytes`, and not on the configured
+// pages, so that allocations can be freed after the configuration changed.
+size_t MappingSize(size_t bytes) {
+  const size_t page = bytes >= k1GB ? k1GB : kMinHugePageAllocation;
+  return (bytes + page - 1) / page * page;
+}
+
+}  // namespace
+
+void ConfigureHugePages(HugePageOptions options) {
+  configured_pages.store(options.pages, std::memory_order_relaxed);
+}
+
+PageKind ConfiguredHugePages() {
+  return configured_pages.load(std::memory_order_relaxed);
+}
+
+HugePageStats GetHugePageStats() {
+  Mappings* mappings = GetMappings();
+  absl::MutexLock lock(&mappings->mu);
+  return mappings->stats;
+}
+
+void* AllocateHugePages(size_t bytes) {
+  if (bytes < kMinHugePageAllocation) {
+    return ::operator new(bytes, kHugePageAllocatorAlignment);
+  }
+
+  const size_t size = MappingSize(bytes);
+  PageKind pages = ConfiguredHugePages();
+  if (pages == PageKind::kHuge1GB && size % k1GB != 0) {
+    pages = PageKind::kHuge2MB;
+  }
+  PageKind backing;
+  void* data = MapPages(size, pages, &backing);
+  if (data == nullptr) throw std::bad_alloc();
+
+  Mappings* mappings = GetMappings();
+  absl::MutexLock lock(&mappings->mu);
+  mappings->backings[data] = backing;
+  mappings->stats.num_mappings++;
+  *MappedBytes(&mappings->stats, backing) += size;
+  if (backing != pages) {
+    mappings->stats.num_fallbacks++;
+    if (!mappings->fallback_logged) {
+      mappings->fallback_logged = true;
+      REVERB_LOG(REVERB_WARNING)
+          << PageKindName(pages) << " pages are unavailable so " << size
+          << " bytes are backed by " << PageKindName(backing)
+          << " pages instead. Further fallbacks are not logged.";
+    }
+  }
+  return data;
+}
+
+void DeallocateHugePages(void* data, size_t bytes) {
+  if (bytes < kMinHugePageAllocation) {
+    ::operator delete(data, kHugePageAllocatorAlignment);
+    return;
+  }
+
+  const size_t size = MappingSize(bytes);
+  {
+    Mappings* mappings = GetMappings();
+    absl::MutexLock lock(&mappings->mu);
+    auto it = mappings->backings.find(data);
+    REVERB_CHECK(it != mappings->backings.end())
+        << "Deallocation of memory which wasn't mapped by the allocator.";
+    mappings->stats.num_mappings--;
+    *MappedBytes(&mappings->stats, it->second) -= size;
+    mappings->backings.erase(it);
+  }
+  UnmapPages(data, size);
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
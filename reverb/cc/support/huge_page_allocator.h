@@ -0,0 +1,123 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_HUGE_PAGE_ALLOCATOR_H_
+#define REVERB_CC_SUPPORT_HUGE_PAGE_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/huge_pages.h"
+
+// Allocation of the large arrays of the tables and selectors (e.g the sum tree
+// of a `PrioritizedSelector` or the item index of a `Table`) from memory which
+// can be backed by huge pages. Random accesses to arrays of gigabytes miss the
+// TLB on almost every access with 4 KB pages, while a few hundred 2 MB (or a
+// few 1 GB) pages cover them.
+//
+// Allocations of at least `kMinHugePageAllocation` bytes are mapped directly
+// with the pages configured by `ConfigureHugePages` (regular pages by default)
+// and smaller allocations are served by the heap. Huge pages fall back to the
+// next smaller kind when they are unavailable, see `MapPages`.
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Smallest allocation which is mapped rather than allocated from the heap.
+constexpr size_t kMinHugePageAllocation = size_t{2} << 20;
+
+// Alignment of the allocations served by the heap. Mapped allocations are
+// aligned to pages.
+constexpr std::align_val_t kHugePageAllocatorAlignment{64};
+
+struct HugePageOptions {
+  // Pages which back the mapped allocations. 1 GB pages only back allocations
+  // of at least 1 GB, smaller ones use 2 MB pages instead.
+  PageKind pages = PageKind::kRegular;
+};
+
+// Configures the pages of the allocations made from now on by the whole
+// process. Existing allocations keep their pages.
+void ConfigureHugePages(HugePageOptions options);
+
+// Pages configured by `ConfigureHugePages`.
+PageKind ConfiguredHugePages();
+
+// Allocations which are currently mapped, and the bytes they map by the pages
+// which back them.
+struct HugePageStats {
+  int64_t num_mappings = 0;
+  int64_t regular_bytes = 0;
+  int64_t transparent_huge_bytes = 0;
+  int64_t huge_2mb_bytes = 0;
+  int64_t huge_1gb_bytes = 0;
+
+  // Number of mappings so far which are backed by smaller pages than
+  // configured.
+  int64_t num_fallbacks = 0;
+};
+
+HugePageStats GetHugePageStats();
+
+// Allocates (frees) `bytes` bytes. `bytes` must be the same for both calls.
+void* AllocateHugePages(size_t bytes);
+void DeallocateHugePages(void* data, size_t bytes);
+
+// Allocator of the standard library for containers of large arrays, see the
+// top of the file. Allocations from the heap are aligned to cache lines, so
+// that the nodes of trees which are stored contiguously share as few cache
+// lines as possible.
+template <typename T>
+struct HugePageAllocator {
+  using value_type = T;
+  static_assert(alignof(T) <= static_cast<size_t>(kHugePageAllocatorAlignment),
+                "Type is over-aligned.");
+
+  HugePageAllocator() = default;
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(AllocateHugePages(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) { DeallocateHugePages(p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const HugePageAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const HugePageAllocator<U>&) const {
+    return false;
+  }
+};
+
+template <typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
+
+template <class K, class V>
+using HugePageHashMap =
+    flat_hash_map<K, V, typename HashEq<K>::Hash, typename HashEq<K>::Eq,
+                  HugePageAllocator<std::pair<const K, V>>>;
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_HUGE_PAGE_ALLOCATOR_H_
@@ -0,0 +1,95 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/huge_page_allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/platform/huge_pages.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+class HugePageAllocatorTest : public ::testing::Test {
+ protected:
+  void TearDown() override { ConfigureHugePages(HugePageOptions()); }
+};
+
+TEST_F(HugePageAllocatorTest, SmallAllocationsAreNotMapped) {
+  const HugePageStats before = GetHugePageStats();
+  HugePageVector<double> small(1000, 1.0);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(small.data()) %
+                static_cast<size_t>(kHugePageAllocatorAlignment),
+            0);
+  EXPECT_EQ(GetHugePageStats().num_mappings, before.num_mappings);
+}
+
+TEST_F(HugePageAllocatorTest, LargeAllocationsAreMapped) {
+  const HugePageStats before = GetHugePageStats();
+  {
+    HugePageVector<double> large(kMinHugePageAllocation / sizeof(double) + 1);
+    EXPECT_EQ(large.back(), 0);
+    const HugePageStats during = GetHugePageStats();
+    EXPECT_EQ(during.num_mappings, before.num_mappings + 1);
+    EXPECT_EQ(during.regular_bytes,
+              before.regular_bytes + 2 * kMinHugePageAllocation);
+  }
+  const HugePageStats after = GetHugePageStats();
+  EXPECT_EQ(after.num_mappings, before.num_mappings);
+  EXPECT_EQ(after.regular_bytes, before.regular_bytes);
+}
+
+TEST_F(HugePageAllocatorTest, HugePagesFallBackWhenUnavailable) {
+  for (PageKind pages : {PageKind::kTransparentHuge, PageKind::kHuge2MB,
+                         PageKind::kHuge1GB}) {
+    HugePageOptions options;
+    options.pages = pages;
+    ConfigureHugePages(options);
+    EXPECT_EQ(ConfiguredHugePages(), pages);
+
+    HugePageVector<int64_t> values;
+    for (int64_t i = 0; i < 1000000; i++) values.push_back(i);
+    for (int64_t i = 0; i < 1000000; i += 1000) EXPECT_EQ(values[i], i);
+
+    const HugePageStats stats = GetHugePageStats();
+    EXPECT_GE(stats.num_mappings, 1);
+    EXPECT_GE(stats.regular_bytes + stats.transparent_huge_bytes +
+                  stats.huge_2mb_bytes + stats.huge_1gb_bytes,
+              values.capacity() * sizeof(int64_t));
+    // Less than 1 GB is never backed by 1 GB pages.
+    EXPECT_EQ(stats.huge_1gb_bytes, 0);
+  }
+}
+
+TEST_F(HugePageAllocatorTest, AllocationsSurviveReconfiguration) {
+  HugePageOptions options;
+  options.pages = PageKind::kHuge2MB;
+  ConfigureHugePages(options);
+  HugePageVector<uint8_t> mapped(3 * kMinHugePageAllocation);
+  ConfigureHugePages(HugePageOptions());
+  mapped.clear();
+  mapped.shrink_to_fit();
+  EXPECT_EQ(GetHugePageStats().num_mappings, 0);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
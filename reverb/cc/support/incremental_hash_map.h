@@ -0,0 +1,255 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_INCREMENTAL_HASH_MAP_H_
+#define REVERB_CC_SUPPORT_INCREMENTAL_HASH_MAP_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "reverb/cc/platform/hash_map.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Subset of the interface of `flat_hash_map` for maps which grow without
+// bound, e.g the chunks of a `ChunkStore`, where the O(n) rehash of a
+// `flat_hash_map` which has run out of capacity would stall the caller (and
+// everyone waiting for the lock it holds) for tens of milliseconds once the
+// map holds millions of elements.
+//
+// When the map runs out of capacity the elements are kept in place and a map
+// of twice the size is allocated. New elements are inserted into the new map
+// and every insert also moves `kMigrationsPerInsert` of the old elements to
+// it, so the old map is empty long before the new one is full and no single
+// insert moves more than a few elements. Lookups probe both maps while the
+// old one isn't empty.
+//
+// Unlike `flat_hash_map` an insert can move any element, so it invalidates
+// all iterators and references. `erase` only invalidates the erased element.
+template <class K, class V>
+class IncrementalHashMap {
+ private:
+  using Map = flat_hash_map<K, V>;
+
+ public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = typename Map::value_type;
+
+  // Number of elements of the old map which are moved by every insert. Any
+  // value above 1 drains the old map before the new one is full.
+  static constexpr int kMigrationsPerInsert = 2;
+
+  template <bool kConst>
+  class Iterator {
+   public:
+    using Owner = std::conditional_t<kConst, const IncrementalHashMap,
+                                     IncrementalHashMap>;
+    using Inner = std::conditional_t<kConst, typename Map::const_iterator,
+                                     typename Map::iterator>;
+    using reference =
+        std::conditional_t<kConst, const value_type&, value_type&>;
+    using pointer = std::conditional_t<kConst, const value_type*, value_type*>;
+
+    reference operator*() const { return *inner_; }
+    pointer operator->() const { return &*inner_; }
+
+    Iterator& operator++() {
+      ++inner_;
+      SkipToCurrent();
+      return *this;
+    }
+
+    bool operator==(const Iterator& other) const {
+      return in_old_ == other.in_old_ && inner_ == other.inner_;
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+   private:
+    friend class IncrementalHashMap;
+
+    Iterator(Owner* owner, bool in_old, Inner inner)
+        : owner_(owner), in_old_(in_old), inner_(inner) {
+      SkipToCurrent();
+    }
+
+    // The elements of the old map are visited before those of the new one.
+    void SkipToCurrent() {
+      if (in_old_ && inner_ == owner_->old_.end()) {
+        in_old_ = false;
+        inner_ = owner_->current_.begin();
+      }
+    }
+
+    Owner* owner_;
+    bool in_old_;
+    Inner inner_;
+  };
+
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  IncrementalHashMap() = default;
+
+  // The position of the migration points into `old_`, so the map can't be
+  // copied or moved. Use `swap` instead.
+  IncrementalHashMap(const IncrementalHashMap&) = delete;
+  IncrementalHashMap& operator=(const IncrementalHashMap&) = delete;
+
+  size_t size() const { return old_.size() + current_.size(); }
+  bool empty() const { return size() == 0; }
+
+  iterator begin() { return iterator(this, true, old_.begin()); }
+  iterator end() { return iterator(this, false, current_.end()); }
+  const_iterator begin() const {
+    return const_iterator(this, true, old_.begin());
+  }
+  const_iterator end() const {
+    return const_iterator(this, false, current_.end());
+  }
+
+  iterator find(const K& key) {
+    if (!old_.empty()) {
+      auto it = old_.find(key);
+      if (it != old_.end()) return iterator(this, true, it);
+    }
+    return iterator(this, false, current_.find(key));
+  }
+  const_iterator find(const K& key) const {
+    if (!old_.empty()) {
+      auto it = old_.find(key);
+      if (it != old_.end()) return const_iterator(this, true, it);
+    }
+    return const_iterator(this, false, current_.find(key));
+  }
+
+  bool contains(const K& key) const { return find(key) != end(); }
+
+  // Returns the value of `key`, which is value initialized if `key` is new.
+  V& operator[](const K& key) {
+    Migrate(kMigrationsPerInsert);
+    if (!old_.empty()) {
+      auto it = old_.find(key);
+      if (it != old_.end()) return it->second;
+    }
+    if (budget_ == 0) {
+      auto it = current_.find(key);
+      if (it != current_.end()) return it->second;
+      Grow();
+    }
+    auto [it, inserted] = current_.try_emplace(key);
+    if (inserted) --budget_;
+    return it->second;
+  }
+
+  void erase(iterator it) {
+    if (it.in_old_) {
+      if (it.inner_ == next_migration_) ++next_migration_;
+      old_.erase(it.inner_);
+    } else {
+      current_.erase(it.inner_);
+    }
+  }
+
+  size_t erase(const K& key) {
+    auto it = find(key);
+    if (it == end()) return 0;
+    erase(it);
+    return 1;
+  }
+
+  // Makes room for `size` elements up front. Unlike the growth of the map this
+  // takes O(n) time, so it is meant to be called while the map is empty.
+  void reserve(size_t size) {
+    size = std::max(size, this->size());
+    current_.reserve(size);
+    budget_ = std::max(budget_, size - current_.size());
+    Migrate(old_.size());
+  }
+
+  void clear() {
+    old_ = Map();
+    current_.clear();
+    budget_ = 0;
+  }
+
+  void swap(IncrementalHashMap& other) {
+    old_.swap(other.old_);
+    current_.swap(other.current_);
+    std::swap(next_migration_, other.next_migration_);
+    std::swap(budget_, other.budget_);
+  }
+
+ private:
+  // Smallest capacity of a new map.
+  static constexpr size_t kMinCapacity = 16;
+
+  // Moves up to `count` elements from `old_` to `current_`.
+  void Migrate(size_t count) {
+    if (old_.empty()) return;
+    for (; count > 0 && budget_ > 0 && next_migration_ != old_.end();
+         --count) {
+      auto it = next_migration_++;
+      current_.insert(old_.extract(it));
+      --budget_;
+    }
+    // Release the memory of the old map.
+    if (old_.empty()) old_ = Map();
+  }
+
+  // Replaces `current_` with an empty map of twice the size, which becomes
+  // the destination of the migration.
+  void Grow() {
+    const size_t capacity = std::max(2 * size(), kMinCapacity);
+    Map next;
+    next.reserve(capacity);
+
+    // The budget of `current_` outlasts the migration of `old_` (see
+    // `kMigrationsPerInsert`) so `old_` is normally empty by now. Any elements
+    // left are moved right away.
+    for (auto it = old_.begin(); it != old_.end();) {
+      auto migrated = it++;
+      next.insert(old_.extract(migrated));
+    }
+    old_ = std::move(current_);
+    current_ = std::move(next);
+    next_migration_ = old_.begin();
+    budget_ = capacity - current_.size();
+  }
+
+  // Elements which have yet to be moved to `current_` and the next of them to
+  // move.
+  Map old_;
+  typename Map::iterator next_migration_;
+
+  Map current_;
+
+  // Number of elements which can be inserted into `current_` before it would
+  // rehash. Every insert into an empty slot consumes one slot of the growth
+  // which `reserve` guarantees, and erases never make it smaller, so
+  // `current_` never rehashes itself.
+  size_t budget_ = 0;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_INCREMENTAL_HASH_MAP_H_
@@ -0,0 +1,132 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/incremental_hash_map.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/hash_map.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::Pair;
+using ::testing::UnorderedElementsAre;
+
+TEST(IncrementalHashMapTest, InsertFindErase) {
+  IncrementalHashMap<uint64_t, int> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.find(1), map.end());
+
+  map[1] = 10;
+  map[2] = 20;
+  ++map[2];
+  EXPECT_EQ(map.size(), 2);
+  EXPECT_TRUE(map.contains(1));
+  EXPECT_EQ(map.find(2)->second, 21);
+
+  EXPECT_EQ(map.erase(1), 1);
+  EXPECT_EQ(map.erase(1), 0);
+  map.erase(map.find(2));
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.begin(), map.end());
+}
+
+TEST(IncrementalHashMapTest, MatchesFlatHashMapWhileGrowing) {
+  IncrementalHashMap<uint64_t, int64_t> map;
+  flat_hash_map<uint64_t, int64_t> expected;
+  absl::BitGen bit_gen;
+  for (int i = 0; i < 100000; i++) {
+    const uint64_t key = absl::Uniform<uint64_t>(bit_gen, 0, 50000);
+    if (absl::Bernoulli(bit_gen, 0.3)) {
+      EXPECT_EQ(map.erase(key), expected.erase(key));
+    } else {
+      map[key] += i;
+      expected[key] += i;
+    }
+    ASSERT_EQ(map.size(), expected.size());
+  }
+
+  // Every element is visited exactly once by the iteration.
+  flat_hash_map<uint64_t, int64_t> visited;
+  for (const auto& entry : map) {
+    EXPECT_TRUE(visited.emplace(entry.first, entry.second).second);
+  }
+  EXPECT_EQ(visited, expected);
+  for (const auto& entry : expected) {
+    auto it = map.find(entry.first);
+    ASSERT_NE(it, map.end());
+    EXPECT_EQ(it->second, entry.second);
+  }
+}
+
+TEST(IncrementalHashMapTest, EraseWhileMigrating) {
+  IncrementalHashMap<uint64_t, int> map;
+  for (int i = 0; i < 1000; i++) map[i] = i;
+
+  // Erase every element, in iteration order, and insert new ones in between
+  // so that the migration progresses past the erased elements.
+  std::vector<uint64_t> keys;
+  for (const auto& entry : map) keys.push_back(entry.first);
+  for (uint64_t key : keys) {
+    EXPECT_EQ(map.erase(key), 1);
+    map[key + 1000] = 0;
+  }
+  EXPECT_EQ(map.size(), 1000);
+  for (uint64_t key : keys) {
+    EXPECT_FALSE(map.contains(key));
+    EXPECT_TRUE(map.contains(key + 1000));
+  }
+}
+
+TEST(IncrementalHashMapTest, HoldsMoveOnlyValues) {
+  IncrementalHashMap<uint64_t, std::unique_ptr<int>> map;
+  for (int i = 0; i < 1000; i++) map[i] = std::make_unique<int>(i);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_NE(map.find(i), map.end());
+    EXPECT_EQ(*map.find(i)->second, i);
+  }
+}
+
+TEST(IncrementalHashMapTest, ReserveClearAndSwap) {
+  IncrementalHashMap<uint64_t, int> map;
+  map.reserve(100);
+  for (int i = 0; i < 200; i++) map[i] = i;
+  EXPECT_EQ(map.size(), 200);
+
+  IncrementalHashMap<uint64_t, int> other;
+  other[1000] = 1;
+  map.swap(other);
+  EXPECT_THAT(map, UnorderedElementsAre(Pair(1000, 1)));
+  EXPECT_EQ(other.size(), 200);
+
+  other.clear();
+  EXPECT_TRUE(other.empty());
+  other[5] = 5;
+  EXPECT_THAT(other, UnorderedElementsAre(Pair(5, 5)));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
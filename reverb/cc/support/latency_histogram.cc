@@ -0,0 +1,110 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "google/protobuf/duration.pb.h"
+#include <cstdint>
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+inline void EncodeAsDurationProto(const absl::Duration& d,
+                                  google::protobuf::Duration* proto) {
+  proto->set_seconds(d / absl::Seconds(1));
+  proto->set_nanos((d - absl::Seconds(proto->seconds())) /
+                   absl::Nanoseconds(1));
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() { Clear(); }
+
+int LatencyHistogram::BucketIndex(absl::Duration duration) {
+  // The index is the number of bits required to represent the duration in
+  // microseconds, capped at the last bucket.
+  int64_t micros = absl::ToInt64Microseconds(duration);
+  int index = 0;
+  while (micros > 0 && index < kNumBuckets - 1) {
+    micros >>= 1;
+    index++;
+  }
+  return index;
+}
+
+void LatencyHistogram::Record(absl::Duration duration) {
+  duration = std::max(duration, absl::ZeroDuration());
+  buckets_[BucketIndex(duration)]++;
+  count_++;
+  total_ += duration;
+  max_ = std::max(max_, duration);
+}
+
+absl::Duration LatencyHistogram::Percentile(double quantile) const {
+  if (count_ == 0) return absl::ZeroDuration();
+  quantile = std::min(std::max(quantile, 0.0), 1.0);
+  // The rank (1-based) of the duration at `quantile`.
+  const int64_t rank =
+      std::max<int64_t>(1, static_cast<int64_t>(std::ceil(quantile * count_)));
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets - 1; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::min(absl::Microseconds(int64_t{1} << i), max_);
+    }
+  }
+  return max_;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (int i = 0; i < kNumBuckets; i++) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  total_ += other.total_;
+  max_ = std::max(max_, other.max_);
+}
+
+void LatencyHistogram::Clear() {
+  buckets_.fill(0);
+  count_ = 0;
+  total_ = absl::ZeroDuration();
+  max_ = absl::ZeroDuration();
+}
+
+DurationHistogram LatencyHistogram::ToProto() const {
+  DurationHistogram proto;
+  int num_buckets = kNumBuckets;
+  while (num_buckets > 0 && buckets_[num_buckets - 1] == 0) {
+    num_buckets--;
+  }
+  for (int i = 0; i < num_buckets; i++) {
+    proto.add_bucket_counts(buckets_[i]);
+  }
+  proto.set_count(count_);
+  EncodeAsDurationProto(total_, proto.mutable_total());
+  EncodeAsDurationProto(max_, proto.mutable_max());
+  return proto;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
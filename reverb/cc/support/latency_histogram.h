@@ -0,0 +1,110 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_LATENCY_HISTOGRAM_H_
+#define REVERB_CC_SUPPORT_LATENCY_HISTOGRAM_H_
+
+#include <array>
+
+#include <cstdint>
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Histogram of durations with exponentially sized buckets. Bucket 0 holds
+// durations shorter than 1 microsecond and bucket `i > 0` holds durations in
+// the range [2^(i-1), 2^i) microseconds. The last bucket also holds all longer
+// durations.
+//
+// Recording is a handful of arithmetic operations on fixed size storage so the
+// histogram is cheap enough to be updated on every call of hot code paths.
+//
+// This object is NOT thread-safe. The owner is responsible for synchronizing
+// access, typically by only recording while holding a lock it already owns.
+class LatencyHistogram {
+ public:
+  static constexpr int kNumBuckets = 32;
+
+  LatencyHistogram();
+
+  // Adds `duration` to the histogram. Negative durations are recorded as zero.
+  void Record(absl::Duration duration);
+
+  // Index of the bucket that `duration` is recorded in.
+  static int BucketIndex(absl::Duration duration);
+
+  // Number of durations recorded in bucket `index`.
+  int64_t bucket_count(int index) const { return buckets_[index]; }
+
+  // Total number of recorded durations.
+  int64_t count() const { return count_; }
+
+  // Sum of all recorded durations.
+  absl::Duration total() const { return total_; }
+
+  // Longest recorded duration.
+  absl::Duration max() const { return max_; }
+
+  // Upper bound of the bucket holding the `quantile` (in [0, 1]) of the
+  // recorded durations, capped at `max()`. The estimate is therefore at most a
+  // factor 2 larger than the exact quantile. Returns zero if the histogram is
+  // empty.
+  absl::Duration Percentile(double quantile) const;
+
+  // Adds all durations recorded in `other` to this histogram.
+  void Merge(const LatencyHistogram& other);
+
+  // Removes all recorded durations.
+  void Clear();
+
+  // Summary of the recorded durations.
+  DurationHistogram ToProto() const;
+
+ private:
+  std::array<int64_t, kNumBuckets> buckets_;
+  int64_t count_;
+  absl::Duration total_;
+  absl::Duration max_;
+};
+
+// Records the time between construction and destruction in a histogram. If
+// `histogram` is nullptr then nothing is recorded.
+class ScopedLatencyRecorder {
+ public:
+  explicit ScopedLatencyRecorder(LatencyHistogram* histogram)
+      : histogram_(histogram), start_(absl::Now()) {}
+
+  ~ScopedLatencyRecorder() {
+    if (histogram_ != nullptr) {
+      histogram_->Record(absl::Now() - start_);
+    }
+  }
+
+  ScopedLatencyRecorder(const ScopedLatencyRecorder&) = delete;
+  ScopedLatencyRecorder& operator=(const ScopedLatencyRecorder&) = delete;
+
+ private:
+  LatencyHistogram* histogram_;
+  absl::Time start_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_LATENCY_HISTOGRAM_H_
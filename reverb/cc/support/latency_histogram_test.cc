@@ -0,0 +1,156 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/latency_histogram.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(LatencyHistogramTest, BucketIndex) {
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::ZeroDuration()), 0);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Nanoseconds(999)), 0);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Microseconds(1)), 1);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Microseconds(2)), 2);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Microseconds(3)), 2);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Microseconds(4)), 3);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Microseconds(1023)), 10);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Microseconds(1024)), 11);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::Hours(24)),
+            LatencyHistogram::kNumBuckets - 1);
+  EXPECT_EQ(LatencyHistogram::BucketIndex(absl::InfiniteDuration()),
+            LatencyHistogram::kNumBuckets - 1);
+}
+
+TEST(LatencyHistogramTest, RecordUpdatesSummary) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.total(), absl::ZeroDuration());
+  EXPECT_EQ(histogram.max(), absl::ZeroDuration());
+
+  histogram.Record(absl::Microseconds(3));
+  histogram.Record(absl::Microseconds(2));
+  histogram.Record(absl::Milliseconds(1));
+
+  EXPECT_EQ(histogram.count(), 3);
+  EXPECT_EQ(histogram.total(), absl::Microseconds(1005));
+  EXPECT_EQ(histogram.max(), absl::Milliseconds(1));
+  EXPECT_EQ(histogram.bucket_count(2), 2);
+  EXPECT_EQ(histogram.bucket_count(10), 1);
+}
+
+TEST(LatencyHistogramTest, NegativeDurationsAreRecordedAsZero) {
+  LatencyHistogram histogram;
+  histogram.Record(-absl::Seconds(1));
+  EXPECT_EQ(histogram.count(), 1);
+  EXPECT_EQ(histogram.bucket_count(0), 1);
+  EXPECT_EQ(histogram.total(), absl::ZeroDuration());
+}
+
+TEST(LatencyHistogramTest, Clear) {
+  LatencyHistogram histogram;
+  histogram.Record(absl::Seconds(1));
+  histogram.Clear();
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.total(), absl::ZeroDuration());
+  EXPECT_EQ(histogram.max(), absl::ZeroDuration());
+  for (int i = 0; i < LatencyHistogram::kNumBuckets; i++) {
+    EXPECT_EQ(histogram.bucket_count(i), 0);
+  }
+}
+
+TEST(LatencyHistogramTest, PercentileOfEmptyHistogramIsZero) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Percentile(0.5), absl::ZeroDuration());
+}
+
+TEST(LatencyHistogramTest, PercentileIsUpperBoundOfBucket) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 90; i++) histogram.Record(absl::Microseconds(3));
+  for (int i = 0; i < 9; i++) histogram.Record(absl::Microseconds(100));
+  histogram.Record(absl::Milliseconds(5));
+
+  EXPECT_EQ(histogram.Percentile(0), absl::Microseconds(4));
+  EXPECT_EQ(histogram.Percentile(0.5), absl::Microseconds(4));
+  EXPECT_EQ(histogram.Percentile(0.9), absl::Microseconds(4));
+  EXPECT_EQ(histogram.Percentile(0.95), absl::Microseconds(128));
+  EXPECT_EQ(histogram.Percentile(0.99), absl::Microseconds(128));
+  EXPECT_EQ(histogram.Percentile(1), absl::Milliseconds(5));
+}
+
+TEST(LatencyHistogramTest, PercentileIsCappedAtMax) {
+  LatencyHistogram histogram;
+  histogram.Record(absl::Microseconds(600));
+  EXPECT_EQ(histogram.Percentile(0.5), absl::Microseconds(600));
+}
+
+TEST(LatencyHistogramTest, Merge) {
+  LatencyHistogram a;
+  a.Record(absl::Microseconds(3));
+  LatencyHistogram b;
+  b.Record(absl::Microseconds(2));
+  b.Record(absl::Milliseconds(1));
+
+  a.Merge(b);
+  EXPECT_EQ(a.count(), 3);
+  EXPECT_EQ(a.total(), absl::Microseconds(1005));
+  EXPECT_EQ(a.max(), absl::Milliseconds(1));
+  EXPECT_EQ(a.bucket_count(2), 2);
+  EXPECT_EQ(a.bucket_count(10), 1);
+}
+
+TEST(LatencyHistogramTest, ToProtoOmitsTrailingEmptyBuckets) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.ToProto().bucket_counts_size(), 0);
+
+  histogram.Record(absl::Microseconds(2));
+  histogram.Record(absl::Seconds(1) + absl::Microseconds(6));
+
+  DurationHistogram proto = histogram.ToProto();
+  EXPECT_EQ(proto.count(), 2);
+  EXPECT_EQ(proto.bucket_counts_size(), 21);
+  EXPECT_EQ(proto.bucket_counts(2), 1);
+  EXPECT_EQ(proto.bucket_counts(20), 1);
+  EXPECT_EQ(proto.total().seconds(), 1);
+  EXPECT_EQ(proto.total().nanos(), 8000);
+  EXPECT_EQ(proto.max().seconds(), 1);
+  EXPECT_EQ(proto.max().nanos(), 6000);
+}
+
+TEST(ScopedLatencyRecorderTest, RecordsOnDestruction) {
+  LatencyHistogram histogram;
+  {
+    ScopedLatencyRecorder recorder(&histogram);
+    absl::SleepFor(absl::Milliseconds(2));
+    EXPECT_EQ(histogram.count(), 0);
+  }
+  EXPECT_EQ(histogram.count(), 1);
+  EXPECT_GE(histogram.total(), absl::Milliseconds(2));
+}
+
+TEST(ScopedLatencyRecorderTest, NullHistogramIsIgnored) {
+  ScopedLatencyRecorder recorder(nullptr);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,366 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_MPMC_QUEUE_H_
+#define REVERB_CC_SUPPORT_MPMC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Lock-free variant of `Queue` (see queue.h) with the same semantics. Items
+// are passed through a bounded ring of cells which carry a sequence number
+// (Vyukov's bounded MPMC queue) so producers and consumers only contend on an
+// atomic position counter rather than on a mutex.
+//
+// Blocked calls first retry a few times, yielding the CPU in between, and then
+// park on a condition variable. The mutex of the condition variable is only
+// taken by parked threads and, when a thread is parked, by the calls that
+// unblock it.
+//
+// `size` is only approximate while items are being pushed or popped.
+template <typename T>
+class MpmcQueue {
+ public:
+  // `capacity` is the maximum number of elements which the queue can hold.
+  explicit MpmcQueue(int capacity) : capacity_(capacity), cells_(capacity) {
+    for (int i = 0; i < capacity; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Closes the queue. All pending and future calls to `Push()` and `Pop()` are
+  // unblocked and return false without performing the operation. Additional
+  // calls of Close after the first one have no effect.
+  void Close() {
+    closed_.store(true);
+    absl::MutexLock lock(&mu_);
+    not_full_.SignalAll();
+    not_empty_.SignalAll();
+  }
+
+  // Pushes an item to the queue. Blocks if the queue has reached `capacity`. On
+  // success, `true` is returned. If the queue is closed, `false` is returned.
+  bool Push(T x) {
+    pushers_.fetch_add(1);
+    bool pushed = false;
+    for (int attempt = 0;; attempt++) {
+      if (closed_.load() || last_item_pushed_.load()) break;
+      if (TryPush(&x)) {
+        pushed = true;
+        break;
+      }
+      if (attempt < kSpinAttempts) {
+        std::this_thread::yield();
+      } else {
+        Park(&not_full_, &waiting_producers_, absl::InfiniteFuture(), [this] {
+          return closed_.load() || last_item_pushed_.load() || CanPush();
+        });
+      }
+    }
+    pushers_.fetch_sub(1);
+    if (pushed) Notify(&not_empty_, &waiting_consumers_);
+    MaybeCloseAfterLastItem();
+    return pushed;
+  }
+
+  // Blocks until queue contains at least `batch_size` items then pops and
+  // pushes `batch_size` from the queue to `out`. See `Queue::PopBatch`.
+  tensorflow::Status PopBatch(int batch_size, absl::Duration timeout,
+                              std::vector<T>* out) {
+    if (batch_size > capacity_) {
+      return tensorflow::errors::InvalidArgument("Batch size (", batch_size,
+                                                 ") must be <= of queue size (",
+                                                 capacity_, ").");
+    }
+
+    const absl::Time deadline = absl::Now() + timeout;
+    for (int attempt = 0;; attempt++) {
+      if (closed_.load()) {
+        return tensorflow::errors::Cancelled("Queue is closed.");
+      }
+      if (last_item_pushed_.load()) {
+        return tensorflow::errors::ResourceExhausted(
+            "The last item have been pushed to the queue and the current size "
+            "(",
+            size(), ") is less than the batch size (", batch_size, ").");
+      }
+      if (TryPopBatch(batch_size, out)) {
+        Notify(&not_full_, &waiting_producers_);
+        MaybeCloseAfterLastItem();
+        return tensorflow::Status::OK();
+      }
+      if (attempt < kSpinAttempts) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (!Park(&not_empty_, &waiting_consumers_, deadline, [&] {
+            return closed_.load() || last_item_pushed_.load() ||
+                   CanPop(batch_size);
+          })) {
+        return tensorflow::errors::DeadlineExceeded(
+            "Timeout exceeeded before ", batch_size,
+            " items observed in queue.");
+      }
+    }
+  }
+
+  tensorflow::Status PopBatch(int batch_size, std::vector<T>* out) {
+    return PopBatch(batch_size, absl::InfiniteDuration(), out);
+  }
+
+  // Marks that no more items will be pushed to the queue.
+  void SetLastItemPushed() {
+    last_item_pushed_.store(true);
+    {
+      absl::MutexLock lock(&mu_);
+      not_full_.SignalAll();
+      not_empty_.SignalAll();
+    }
+    MaybeCloseAfterLastItem();
+  }
+
+  // Removes an element from the queue and move-assigns it to *item. Blocks if
+  // the queue is empty. On success, `true` is returned. If the queue was
+  // closed, `false` is returned.
+  //
+  // If called after `SetLastItemPushed` and the final item of the queue is
+  // returned then queue is closed.
+  bool Pop(T* item) {
+    for (int attempt = 0;; attempt++) {
+      if (closed_.load()) return false;
+      if (TryPop(item)) {
+        Notify(&not_full_, &waiting_producers_);
+        MaybeCloseAfterLastItem();
+        return true;
+      }
+      if (MaybeCloseAfterLastItem()) return false;
+      if (attempt < kSpinAttempts) {
+        std::this_thread::yield();
+      } else {
+        Park(&not_empty_, &waiting_consumers_, absl::InfiniteFuture(), [this] {
+          return closed_.load() || CanPop(1) ||
+                 (last_item_pushed_.load() && pushers_.load() == 0);
+        });
+      }
+    }
+  }
+
+  // Current number of elements.
+  int size() const {
+    const uint64_t begin = dequeue_pos_.value.load();
+    const uint64_t end = enqueue_pos_.value.load();
+    if (end <= begin) return 0;
+    return static_cast<int>(std::min<uint64_t>(end - begin, capacity_));
+  }
+
+ private:
+  // Number of times a blocked call retries before it parks.
+  static constexpr int kSpinAttempts = 64;
+
+  static constexpr int kCacheLineSize = 64;
+
+  struct Cell {
+    // Equal to the position of the cell when it is free to be pushed to and to
+    // the position + 1 once an item has been pushed to it.
+    std::atomic<uint64_t> sequence;
+    T value;
+  };
+
+  // Keeps the positions of the producers and of the consumers on separate
+  // cache lines.
+  struct PaddedPosition {
+    std::atomic<uint64_t> value{0};
+    char padding[kCacheLineSize - sizeof(std::atomic<uint64_t>)];
+  };
+
+  // Pushes `*x` if the queue is not full.
+  bool TryPush(T* x) {
+    uint64_t pos = enqueue_pos_.value.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos % capacity_];
+      const uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const int64_t diff =
+          static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.value.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.value.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(*x);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Pops an item into `*item` if the queue is not empty.
+  bool TryPop(T* item) {
+    uint64_t pos = dequeue_pos_.value.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos % capacity_];
+      const uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const int64_t diff =
+          static_cast<int64_t>(sequence) - static_cast<int64_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.value.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.value.load(std::memory_order_relaxed);
+      }
+    }
+    *item = std::move(cell->value);
+    cell->sequence.store(pos + capacity_, std::memory_order_release);
+    return true;
+  }
+
+  // Pops `batch_size` items into `out` if the queue holds that many. The items
+  // are claimed with a single update of the position so they are consecutive.
+  bool TryPopBatch(int batch_size, std::vector<T>* out) {
+    uint64_t pos = dequeue_pos_.value.load(std::memory_order_relaxed);
+    for (;;) {
+      bool stale = false;
+      for (int i = 0; i < batch_size; i++) {
+        const uint64_t sequence = cells_[(pos + i) % capacity_].sequence.load(
+            std::memory_order_acquire);
+        const int64_t diff =
+            static_cast<int64_t>(sequence) - static_cast<int64_t>(pos + i + 1);
+        if (diff < 0) return false;
+        if (diff > 0) {
+          stale = true;
+          break;
+        }
+      }
+      if (stale) {
+        pos = dequeue_pos_.value.load(std::memory_order_relaxed);
+      } else if (dequeue_pos_.value.compare_exchange_weak(
+                     pos, pos + batch_size, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    for (int i = 0; i < batch_size; i++) {
+      Cell& cell = cells_[(pos + i) % capacity_];
+      out->push_back(std::move(cell.value));
+      cell.sequence.store(pos + i + capacity_, std::memory_order_release);
+    }
+    return true;
+  }
+
+  // Whether a push would (probably) succeed. False positives only cause the
+  // caller to retry.
+  bool CanPush() const {
+    const uint64_t pos = enqueue_pos_.value.load(std::memory_order_relaxed);
+    const uint64_t sequence =
+        cells_[pos % capacity_].sequence.load(std::memory_order_acquire);
+    return static_cast<int64_t>(sequence) - static_cast<int64_t>(pos) >= 0;
+  }
+
+  // Whether `batch_size` items can (probably) be popped. False positives only
+  // cause the caller to retry.
+  bool CanPop(int batch_size) const {
+    const uint64_t pos = dequeue_pos_.value.load(std::memory_order_relaxed);
+    const uint64_t sequence = cells_[(pos + batch_size - 1) % capacity_]
+                                  .sequence.load(std::memory_order_acquire);
+    return static_cast<int64_t>(sequence) -
+               static_cast<int64_t>(pos + batch_size) >=
+           0;
+  }
+
+  // Closes the queue if `SetLastItemPushed` has been called, no push is in
+  // progress and the queue is empty. Returns true if the queue is closed.
+  bool MaybeCloseAfterLastItem() {
+    if (closed_.load()) return true;
+    if (!last_item_pushed_.load() || pushers_.load() != 0 ||
+        dequeue_pos_.value.load() != enqueue_pos_.value.load()) {
+      return false;
+    }
+    Close();
+    return true;
+  }
+
+  // Blocks until `ready` returns true or `deadline` is reached. Returns the
+  // final value of `ready`.
+  template <typename F>
+  bool Park(absl::CondVar* cv, std::atomic<int>* waiters, absl::Time deadline,
+            F ready) {
+    absl::MutexLock lock(&mu_);
+    waiters->fetch_add(1);
+    // Pairs with the fence in `Notify`: either the waiter observes the update
+    // or the notifier observes the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool is_ready = ready();
+    while (!is_ready) {
+      const bool timed_out = cv->WaitWithDeadline(&mu_, deadline);
+      is_ready = ready();
+      if (timed_out) break;
+    }
+    waiters->fetch_sub(1);
+    return is_ready;
+  }
+
+  // Wakes the threads parked on `cv` if there are any.
+  void Notify(absl::CondVar* cv, std::atomic<int>* waiters) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters->load(std::memory_order_relaxed) == 0) return;
+    absl::MutexLock lock(&mu_);
+    cv->SignalAll();
+  }
+
+  const int capacity_;
+  std::vector<Cell> cells_;
+  PaddedPosition enqueue_pos_;
+  PaddedPosition dequeue_pos_;
+
+  // Number of calls to `Push` in progress. The queue can only be closed after
+  // `SetLastItemPushed` once these have completed.
+  std::atomic<int> pushers_{0};
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> last_item_pushed_{false};
+
+  // Only used to park blocked calls.
+  absl::Mutex mu_;
+  absl::CondVar not_full_;
+  absl::CondVar not_empty_;
+  std::atomic<int> waiting_producers_{0};
+  std::atomic<int> waiting_consumers_{0};
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_MPMC_QUEUE_H_
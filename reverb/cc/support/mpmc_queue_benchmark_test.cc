@@ -0,0 +1,101 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the throughput of `Queue` and `MpmcQueue` when items are passed
+// from 1 producer to 1 consumer, from N producers to 1 consumer and from N
+// producers to M consumers. The test is tagged as manual and has to be run
+// explicitly:
+//
+//   bazel test -c opt //reverb/cc/support:mpmc_queue_benchmark_test \
+//     --test_output=streamed
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/support/mpmc_queue.h"
+#include "reverb/cc/support/queue.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr int kCapacity = 100;
+constexpr int64_t kItemsPerProducer = 1 << 20;
+
+// Returns the number of items per second passed through a `QueueType` by
+// `num_producers` producers and `num_consumers` consumers.
+template <typename QueueType>
+double ItemsPerSecond(int num_producers, int num_consumers) {
+  QueueType queue(kCapacity);
+  std::atomic<int64_t> popped(0);
+  std::atomic<int> producers_done(0);
+
+  const absl::Time start = absl::Now();
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int i = 0; i < num_consumers; i++) {
+    threads.push_back(StartThread("Consumer", [&queue, &popped] {
+      int64_t item;
+      int64_t count = 0;
+      while (queue.Pop(&item)) count++;
+      popped.fetch_add(count);
+    }));
+  }
+  for (int i = 0; i < num_producers; i++) {
+    threads.push_back(
+        StartThread("Producer", [&queue, &producers_done, num_producers] {
+          for (int64_t j = 0; j < kItemsPerProducer; j++) {
+            REVERB_CHECK(queue.Push(j));
+          }
+          if (producers_done.fetch_add(1) == num_producers - 1) {
+            queue.SetLastItemPushed();
+          }
+        }));
+  }
+  threads.clear();
+  const absl::Duration elapsed = absl::Now() - start;
+
+  EXPECT_EQ(popped.load(), kItemsPerProducer * num_producers);
+  return popped.load() / absl::ToDoubleSeconds(elapsed);
+}
+
+TEST(MpmcQueueBenchmark, ThroughputByProducersAndConsumers) {
+  struct Pattern {
+    int producers;
+    int consumers;
+  };
+  for (const Pattern& p : std::vector<Pattern>{
+           {1, 1}, {4, 1}, {8, 1}, {4, 4}, {8, 8}}) {
+    const double mutex = ItemsPerSecond<Queue<int64_t>>(p.producers,
+                                                        p.consumers);
+    const double lock_free =
+        ItemsPerSecond<MpmcQueue<int64_t>>(p.producers, p.consumers);
+    REVERB_LOG(REVERB_INFO)
+        << p.producers << ":" << p.consumers << " Queue=" << mutex
+        << " items/s MpmcQueue=" << lock_free
+        << " items/s speedup=" << lock_free / mutex;
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,296 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/mpmc_queue.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/protobuf/error_codes.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(MpmcQueueTest, PushAndPopAreConsistent) {
+  MpmcQueue<int> q(10);
+  int output;
+  for (int i = 0; i < 100; i++) {
+    q.Push(i);
+    q.Pop(&output);
+    EXPECT_EQ(output, i);
+  }
+}
+
+TEST(MpmcQueueTest, PushBlocksWhenFull) {
+  MpmcQueue<int> q(2);
+  ASSERT_TRUE(q.Push(1));
+  ASSERT_TRUE(q.Push(2));
+  absl::Notification n;
+  auto t = StartThread("", [&q, &n] {
+    REVERB_CHECK(q.Push(3));
+    n.Notify();
+  });
+  ASSERT_FALSE(n.HasBeenNotified());
+  int output;
+  ASSERT_TRUE(q.Pop(&output));
+  n.WaitForNotification();
+  EXPECT_EQ(output, 1);
+}
+
+TEST(MpmcQueueTest, PopBlocksWhenEmpty) {
+  MpmcQueue<int> q(2);
+  absl::Notification n;
+  int output;
+  auto t = StartThread("", [&q, &n, &output] {
+    REVERB_CHECK(q.Pop(&output));
+    n.Notify();
+  });
+  ASSERT_FALSE(n.HasBeenNotified());
+  ASSERT_TRUE(q.Push(1));
+  n.WaitForNotification();
+  EXPECT_EQ(output, 1);
+}
+
+TEST(MpmcQueueTest, AfterClosePushAndPopReturnFalse) {
+  MpmcQueue<int> q(2);
+  q.Close();
+  EXPECT_FALSE(q.Push(1));
+  EXPECT_FALSE(q.Pop(nullptr));
+}
+
+TEST(MpmcQueueTest, CloseUnblocksPush) {
+  MpmcQueue<int> q(2);
+  ASSERT_TRUE(q.Push(1));
+  ASSERT_TRUE(q.Push(2));
+  absl::Notification n;
+  bool ok;
+  auto t = StartThread("", [&q, &n, &ok] {
+    ok = q.Push(3);
+    n.Notify();
+  });
+  ASSERT_FALSE(n.HasBeenNotified());
+  q.Close();
+  n.WaitForNotification();
+  EXPECT_FALSE(ok);
+}
+
+TEST(MpmcQueueTest, CloseUnblocksPop) {
+  MpmcQueue<int> q(2);
+  absl::Notification n;
+  bool ok;
+  auto t = StartThread("", [&q, &n, &ok] {
+    int output;
+    ok = q.Pop(&output);
+    n.Notify();
+  });
+  ASSERT_FALSE(n.HasBeenNotified());
+  q.Close();
+  n.WaitForNotification();
+  EXPECT_FALSE(ok);
+}
+
+TEST(MpmcQueueTest, SizeReturnsNumberOfElements) {
+  MpmcQueue<int> q(3);
+  EXPECT_EQ(q.size(), 0);
+
+  q.Push(20);
+  q.Push(30);
+  EXPECT_EQ(q.size(), 2);
+
+  int v;
+  ASSERT_TRUE(q.Pop(&v));
+  EXPECT_EQ(q.size(), 1);
+}
+
+TEST(MpmcQueueTest, PushFailsAfterSetLastItemPushed) {
+  MpmcQueue<int> q(3);
+  q.SetLastItemPushed();
+  EXPECT_FALSE(q.Push(1));
+}
+
+TEST(MpmcQueueTest, ExistingItemsCanBePoppedAfterSetLastItemPushed) {
+  MpmcQueue<int> q(3);
+
+  q.Push(1);
+  q.Push(2);
+
+  q.SetLastItemPushed();
+
+  int v;
+  ASSERT_TRUE(q.Pop(&v));
+  EXPECT_EQ(v, 1);
+  ASSERT_TRUE(q.Pop(&v));
+  EXPECT_EQ(v, 2);
+
+  // Queue is now empty and no items can be pushed so it is effectively closed.
+  EXPECT_FALSE(q.Pop(&v));
+}
+
+TEST(MpmcQueueTest, BlockingPopReturnsIfSetLastItemPushedCalled) {
+  MpmcQueue<int> q(2);
+  absl::Notification n;
+  bool ok;
+  auto t = StartThread("", [&q, &n, &ok] {
+    int output;
+    ok = q.Pop(&output);
+    n.Notify();
+  });
+  ASSERT_FALSE(n.HasBeenNotified());
+  q.SetLastItemPushed();
+  n.WaitForNotification();
+  EXPECT_FALSE(ok);
+}
+
+TEST(MpmcQueueTest, PopBatchBlocksUntilBatchFull) {
+  MpmcQueue<int> q(10);
+
+  std::vector<int> v;
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(q.PopBatch(5, absl::ZeroDuration(), &v).code(),
+              tensorflow::error::DEADLINE_EXCEEDED);
+    EXPECT_TRUE(q.Push(i));
+  }
+
+  TF_EXPECT_OK(q.PopBatch(5, &v));
+}
+
+TEST(MpmcQueueTest, PopBatchEmitsItemsInOrder) {
+  MpmcQueue<int> q(10);
+
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(q.Push(i));
+  }
+
+  std::vector<int> v;
+  TF_EXPECT_OK(q.PopBatch(5, &v));
+  EXPECT_THAT(v, testing::ElementsAre(0, 1, 2, 3, 4));
+}
+
+TEST(MpmcQueueTest, PopBatchReturnsIfSetLastItemPushed) {
+  MpmcQueue<int> q(3);
+  absl::Notification n;
+  tensorflow::Status status;
+
+  auto thread = internal::StartThread("", [&] {
+    std::vector<int> out;
+    status = q.PopBatch(2, &out);
+    n.Notify();
+  });
+
+  // Inserting one item should not unblock it.
+  q.Push(1);
+  EXPECT_FALSE(n.WaitForNotificationWithTimeout(absl::Milliseconds(100)));
+
+  // Calling `SetLastItemPushed` should unblock the call as the batch can never
+  // be filled now.
+  q.SetLastItemPushed();
+  n.WaitForNotification();
+  EXPECT_EQ(status.code(), tensorflow::error::RESOURCE_EXHAUSTED);
+}
+
+TEST(MpmcQueueTest, PopBatchReturnsInvalidArgumentIfBatchSizeTooBig) {
+  MpmcQueue<int> q(3);
+  std::vector<int> v;
+  EXPECT_EQ(q.PopBatch(4, &v).code(), tensorflow::error::INVALID_ARGUMENT);
+}
+
+TEST(MpmcQueueTest, PopBatchReturnsCancelledIfClosedCalled) {
+  MpmcQueue<int> q(3);
+  absl::Notification n;
+  tensorflow::Status status;
+
+  auto thread = internal::StartThread("", [&] {
+    std::vector<int> out;
+    status = q.PopBatch(2, &out);
+    n.Notify();
+  });
+
+  // Inserting one item should not unblock it.
+  q.Push(1);
+  EXPECT_FALSE(n.WaitForNotificationWithTimeout(absl::Milliseconds(100)));
+
+  // Calling `Close` should unblock the call.
+  q.Close();
+  n.WaitForNotification();
+  EXPECT_EQ(status.code(), tensorflow::error::CANCELLED);
+}
+
+TEST(MpmcQueueTest, PopBatchTimesOutIfNotEnoughItems) {
+  MpmcQueue<int> q(10);
+  ASSERT_TRUE(q.Push(1));
+  std::vector<int> v;
+  EXPECT_EQ(q.PopBatch(2, absl::Milliseconds(10), &v).code(),
+            tensorflow::error::DEADLINE_EXCEEDED);
+  EXPECT_TRUE(v.empty());
+  EXPECT_EQ(q.size(), 1);
+}
+
+TEST(MpmcQueueTest, ConcurrentProducersAndConsumersSeeEveryItemOnce) {
+  constexpr int kNumThreads = 4;
+  constexpr int kItemsPerProducer = 10000;
+  MpmcQueue<int> q(16);
+
+  absl::Mutex mu;
+  std::vector<int> popped_count(kNumThreads * kItemsPerProducer, 0);
+  std::vector<std::unique_ptr<Thread>> consumers;
+  for (int i = 0; i < kNumThreads; i++) {
+    consumers.push_back(StartThread("", [&q, &mu, &popped_count, i] {
+      std::vector<int> popped;
+      int item;
+      while (true) {
+        // Half of the consumers pop pairs until the last item is pushed.
+        if (i % 2 == 1 && q.PopBatch(2, &popped).ok()) continue;
+        if (!q.Pop(&item)) break;
+        popped.push_back(item);
+      }
+      absl::MutexLock lock(&mu);
+      for (int value : popped) popped_count[value]++;
+    }));
+  }
+
+  std::atomic<int> producers_done(0);
+  std::vector<std::unique_ptr<Thread>> producers;
+  for (int i = 0; i < kNumThreads; i++) {
+    producers.push_back(StartThread("", [&q, &producers_done, i] {
+      for (int j = 0; j < kItemsPerProducer; j++) {
+        REVERB_CHECK(q.Push(i * kItemsPerProducer + j));
+      }
+      if (producers_done.fetch_add(1) == kNumThreads - 1) {
+        q.SetLastItemPushed();
+      }
+    }));
+  }
+
+  producers.clear();
+  consumers.clear();
+  for (int count : popped_count) {
+    EXPECT_EQ(count, 1);
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
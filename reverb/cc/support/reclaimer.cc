@@ -0,0 +1,119 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/reclaimer.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+thread_local bool is_reclaimer_thread = false;
+
+}  // namespace
+
+Reclaimer::Reclaimer(int64_t capacity) : capacity_(capacity) {
+  REVERB_CHECK_GT(capacity_, 0);
+  worker_ = StartThread("Reclaimer", [this] { RunWorker(); });
+}
+
+Reclaimer::~Reclaimer() {
+  {
+    absl::MutexLock lock(&mu_);
+    stopped_ = true;
+  }
+  worker_ = nullptr;  // Joins thread.
+}
+
+Reclaimer* Reclaimer::Default() {
+  static Reclaimer* reclaimer = new Reclaimer();
+  return reclaimer;
+}
+
+bool Reclaimer::IsReclaimerThread() { return is_reclaimer_thread; }
+
+void Reclaimer::Push(std::shared_ptr<void> object) {
+  {
+    absl::MutexLock lock(&mu_);
+    if (!stopped_ && pending_.size() < capacity_) {
+      pending_.push_back(std::move(object));
+      num_pushed_++;
+      return;
+    }
+    num_overflowed_++;
+  }
+  // `object` is destroyed on the calling thread when it goes out of scope.
+}
+
+void Reclaimer::RunWorker() {
+  is_reclaimer_thread = true;
+
+  auto trigger = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return stopped_ || !pending_.empty();
+  };
+
+  std::vector<std::shared_ptr<void>> batch;
+  while (true) {
+    {
+      absl::MutexLock lock(&mu_);
+      num_reclaimed_ += batch.size();
+      batch.clear();
+      mu_.Await(absl::Condition(&trigger));
+      if (stopped_ && pending_.empty()) return;
+      batch.swap(pending_);
+    }
+
+    // Destroy the objects without holding the lock. The (now empty) elements
+    // are cleared when the lock is acquired again.
+    for (auto& object : batch) {
+      object = nullptr;
+    }
+  }
+}
+
+void Reclaimer::Flush() {
+  absl::MutexLock lock(&mu_);
+  const int64_t target = num_pushed_;
+  auto trigger = [this, target]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return num_reclaimed_ >= target;
+  };
+  mu_.Await(absl::Condition(&trigger));
+}
+
+int64_t Reclaimer::pending() const {
+  absl::MutexLock lock(&mu_);
+  return num_pushed_ - num_reclaimed_;
+}
+
+int64_t Reclaimer::num_reclaimed() const {
+  absl::MutexLock lock(&mu_);
+  return num_reclaimed_;
+}
+
+int64_t Reclaimer::num_overflowed() const {
+  absl::MutexLock lock(&mu_);
+  return num_overflowed_;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,129 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_RECLAIMER_H_
+#define REVERB_CC_SUPPORT_RECLAIMER_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Default maximum number of objects which can be pending reclamation before
+// `Reclaimer::Reclaim` falls back to destroying objects on the calling thread.
+constexpr int64_t kDefaultReclaimerCapacity = 1000000;
+
+// Destroys objects on a background thread so that the (potentially expensive)
+// deallocation of large objects happens away from latency sensitive threads.
+//
+// Objects are handed over with `Reclaim` and destroyed in batches by a single
+// worker thread. The number of pending objects is bounded by `capacity`. If the
+// capacity is exceeded, or the reclaimer has been stopped, then the object is
+// destroyed on the calling thread instead. This keeps memory usage bounded when
+// objects are released faster than the worker can destroy them.
+//
+// Objects which are released as a side effect of the worker destroying another
+// object (e.g. a chunk whose last reference was held by a deleted item) can use
+// `IsReclaimerThread` to avoid being queued a second time.
+//
+// This object is thread-safe.
+class Reclaimer {
+ public:
+  explicit Reclaimer(int64_t capacity = kDefaultReclaimerCapacity);
+
+  // Destroys all pending objects and joins the worker thread.
+  ~Reclaimer();
+
+  // Process wide instance shared between all `Table` and `ChunkStore`. The
+  // instance is never destroyed.
+  static Reclaimer* Default();
+
+  // Returns true if called from the worker thread of any `Reclaimer`.
+  static bool IsReclaimerThread();
+
+  // Takes ownership of `object` and destroys it on the worker thread.
+  template <typename T>
+  void Reclaim(T object) {
+    Push(std::make_shared<T>(std::move(object)));
+  }
+
+  // Takes ownership of the objects and destroys them (in a single batch) on the
+  // worker thread.
+  template <typename T>
+  void ReclaimAll(std::vector<T> objects) {
+    if (objects.empty()) return;
+    Reclaim(std::move(objects));
+  }
+
+  // Blocks until all objects pushed before the call have been destroyed.
+  void Flush() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Current number of objects waiting to be destroyed.
+  int64_t pending() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Total number of objects destroyed by the worker thread.
+  int64_t num_reclaimed() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Total number of objects that were destroyed on the calling thread as the
+  // reclaimer was full.
+  int64_t num_overflowed() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Reclaimer is neither copyable nor movable.
+  Reclaimer(const Reclaimer&) = delete;
+  Reclaimer& operator=(const Reclaimer&) = delete;
+
+ private:
+  // Type erased implementation of `Reclaim`.
+  void Push(std::shared_ptr<void> object) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Loop run by `worker_`. Returns when `stopped_` is set and all pending
+  // objects have been destroyed.
+  void RunWorker() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Maximum size of `pending_`.
+  const int64_t capacity_;
+
+  mutable absl::Mutex mu_;
+
+  // Objects waiting to be destroyed by `worker_`.
+  std::vector<std::shared_ptr<void>> pending_ ABSL_GUARDED_BY(mu_);
+
+  // Total number of objects pushed and destroyed by `worker_`. `Flush` waits
+  // for `num_reclaimed_` to catch up with `num_pushed_`.
+  int64_t num_pushed_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_reclaimed_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Number of objects destroyed by the caller of `Reclaim` due to `capacity_`.
+  int64_t num_overflowed_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Set in the destructor to stop `worker_`.
+  bool stopped_ ABSL_GUARDED_BY(mu_) = false;
+
+  // Background thread which destroys the objects in `pending_`.
+  std::unique_ptr<Thread> worker_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_RECLAIMER_H_
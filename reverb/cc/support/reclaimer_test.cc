@@ -0,0 +1,148 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/reclaimer.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/notification.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Increments `destroyed` and records whether the destructor was called from
+// the reclaimer thread.
+class Tracked {
+ public:
+  Tracked(std::atomic<int>* destroyed, std::atomic<int>* on_reclaimer)
+      : destroyed_(destroyed), on_reclaimer_(on_reclaimer) {}
+
+  Tracked(Tracked&& other)
+      : destroyed_(other.destroyed_), on_reclaimer_(other.on_reclaimer_) {
+    other.destroyed_ = nullptr;
+    other.on_reclaimer_ = nullptr;
+  }
+
+  ~Tracked() {
+    if (destroyed_ == nullptr) return;
+    (*destroyed_)++;
+    if (Reclaimer::IsReclaimerThread()) (*on_reclaimer_)++;
+  }
+
+ private:
+  std::atomic<int>* destroyed_;
+  std::atomic<int>* on_reclaimer_;
+};
+
+TEST(ReclaimerTest, DestroysObjectsOnWorkerThread) {
+  std::atomic<int> destroyed(0);
+  std::atomic<int> on_reclaimer(0);
+  Reclaimer reclaimer;
+  for (int i = 0; i < 100; i++) {
+    reclaimer.Reclaim(Tracked(&destroyed, &on_reclaimer));
+  }
+  reclaimer.Flush();
+  EXPECT_EQ(destroyed, 100);
+  EXPECT_EQ(on_reclaimer, 100);
+  EXPECT_EQ(reclaimer.pending(), 0);
+  EXPECT_EQ(reclaimer.num_reclaimed(), 100);
+  EXPECT_EQ(reclaimer.num_overflowed(), 0);
+}
+
+TEST(ReclaimerTest, ReclaimAllCountsAsSingleObject) {
+  std::atomic<int> destroyed(0);
+  std::atomic<int> on_reclaimer(0);
+  Reclaimer reclaimer;
+  std::vector<Tracked> objects;
+  for (int i = 0; i < 10; i++) {
+    objects.emplace_back(&destroyed, &on_reclaimer);
+  }
+  reclaimer.ReclaimAll(std::move(objects));
+  reclaimer.Flush();
+  EXPECT_EQ(destroyed, 10);
+  EXPECT_EQ(on_reclaimer, 10);
+  EXPECT_EQ(reclaimer.num_reclaimed(), 1);
+}
+
+TEST(ReclaimerTest, DestroysOnCallerWhenFull) {
+  std::atomic<int> destroyed(0);
+  std::atomic<int> on_reclaimer(0);
+  Reclaimer reclaimer(/*capacity=*/1);
+
+  // Block the worker so that the first object remains pending.
+  absl::Notification started;
+  absl::Notification release;
+  reclaimer.Reclaim(std::shared_ptr<void>(nullptr, [&](void*) {
+    started.Notify();
+    release.WaitForNotification();
+  }));
+  started.WaitForNotification();
+
+  reclaimer.Reclaim(Tracked(&destroyed, &on_reclaimer));
+  reclaimer.Reclaim(Tracked(&destroyed, &on_reclaimer));
+  EXPECT_EQ(reclaimer.num_overflowed(), 1);
+  EXPECT_EQ(destroyed, 1);
+  EXPECT_EQ(on_reclaimer, 0);
+
+  release.Notify();
+  reclaimer.Flush();
+  EXPECT_EQ(destroyed, 2);
+  EXPECT_EQ(on_reclaimer, 1);
+}
+
+TEST(ReclaimerTest, DestructorDestroysPendingObjects) {
+  std::atomic<int> destroyed(0);
+  std::atomic<int> on_reclaimer(0);
+  {
+    Reclaimer reclaimer;
+    for (int i = 0; i < 100; i++) {
+      reclaimer.Reclaim(Tracked(&destroyed, &on_reclaimer));
+    }
+  }
+  EXPECT_EQ(destroyed, 100);
+}
+
+TEST(ReclaimerTest, ConcurrentReclaim) {
+  std::atomic<int> destroyed(0);
+  std::atomic<int> on_reclaimer(0);
+  Reclaimer reclaimer;
+  std::vector<std::unique_ptr<Thread>> bundle;
+  for (int i = 0; i < 10; i++) {
+    bundle.push_back(StartThread("", [&] {
+      for (int j = 0; j < 1000; j++) {
+        reclaimer.Reclaim(Tracked(&destroyed, &on_reclaimer));
+      }
+    }));
+  }
+  bundle.clear();  // Joins all threads.
+  reclaimer.Flush();
+  EXPECT_EQ(destroyed, 10000);
+  EXPECT_EQ(reclaimer.num_reclaimed() + reclaimer.num_overflowed(), 10000);
+}
+
+TEST(ReclaimerTest, IsReclaimerThreadIsFalseOnCaller) {
+  EXPECT_FALSE(Reclaimer::IsReclaimerThread());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
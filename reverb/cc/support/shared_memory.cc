@@ -0,0 +1,210 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/shared_memory.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Prefix of the names of all segments. Requests to read any other segment are
+// rejected so that peers can't make the receiver remove arbitrary segments.
+constexpr absl::string_view kNamePrefix = "/reverb-";
+
+// Directory in which shm_open creates the segments on Linux. Segments are
+// found by prefix through it.
+constexpr char kSegmentDir[] = "/dev/shm";
+
+tensorflow::Status ErrnoToStatus(const std::string& message) {
+  return tensorflow::errors::Internal(message, ": ", std::strerror(errno));
+}
+
+// Returns the prefix of the names of the segments of this process, which is
+// unique within the host. The random part guards against collisions with
+// segments which were left behind by an earlier process with the same pid.
+const std::string& ProcessPrefix() {
+  static const std::string* prefix = new std::string(
+      absl::StrCat(kNamePrefix, getpid(), "-",
+                   absl::Uniform<uint64_t>(absl::BitGen()), "-"));
+  return *prefix;
+}
+
+// Returns a name which is unique within the host.
+std::string NewSegmentName() {
+  static std::atomic<uint64_t> counter{0};
+  return absl::StrCat(ProcessPrefix(),
+                      counter.fetch_add(1, std::memory_order_relaxed));
+}
+
+// Returns a prefix which is unique within the host and doesn't prefix the
+// names returned by `NewSegmentName`.
+std::string NewStreamPrefix() {
+  static std::atomic<uint64_t> counter{0};
+  return absl::StrCat(ProcessPrefix(), "s",
+                      counter.fetch_add(1, std::memory_order_relaxed), "-");
+}
+
+// Returns the names of the existing segments which start with `prefix`.
+std::vector<std::string> ListSegments(absl::string_view prefix) {
+  std::vector<std::string> names;
+  DIR* dir = opendir(kSegmentDir);
+  if (dir == nullptr) return names;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name = absl::StrCat("/", entry->d_name);
+    if (absl::StartsWith(name, prefix)) names.push_back(std::move(name));
+  }
+  closedir(dir);
+  return names;
+}
+
+bool IsValidName(absl::string_view name) {
+  return absl::StartsWith(name, kNamePrefix) &&
+         name.find('/', kNamePrefix.size()) == absl::string_view::npos;
+}
+
+// Serializes `chunk` into a new segment called `name`.
+tensorflow::Status WriteSegment(const std::string& name, const ChunkData& chunk,
+                                SharedMemoryChunk* ref) {
+  const size_t size = chunk.ByteSizeLong();
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return ErrnoToStatus(absl::StrCat("Failed to create segment ", name));
+  }
+  auto fail = [&](const std::string& message) {
+    auto status = ErrnoToStatus(message);
+    close(fd);
+    shm_unlink(name.c_str());
+    return status;
+  };
+
+  if (ftruncate(fd, size) != 0) {
+    return fail(absl::StrCat("Failed to resize segment ", name));
+  }
+  if (size > 0) {
+    void* mapped =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+      return fail(absl::StrCat("Failed to map segment ", name));
+    }
+    chunk.SerializeWithCachedSizesToArray(static_cast<uint8_t*>(mapped));
+    munmap(mapped, size);
+  }
+  close(fd);
+
+  ref->set_name(name);
+  ref->set_size(size);
+  return tensorflow::Status::OK();
+}
+
+}  // namespace
+
+tensorflow::Status WriteSharedMemoryChunk(const ChunkData& chunk,
+                                          SharedMemoryChunk* ref) {
+  return WriteSegment(NewSegmentName(), chunk, ref);
+}
+
+tensorflow::Status ReadSharedMemoryChunk(const SharedMemoryChunk& ref,
+                                         ChunkData* chunk) {
+  if (!IsValidName(ref.name()) || ref.size() < 0) {
+    return tensorflow::errors::InvalidArgument("Invalid segment ", ref.name(),
+                                               " of size ", ref.size(), ".");
+  }
+
+  int fd = shm_open(ref.name().c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return ErrnoToStatus(absl::StrCat("Failed to open segment ", ref.name()));
+  }
+  // The segment is removed right away. The mapping stays valid until it is
+  // unmapped.
+  shm_unlink(ref.name().c_str());
+
+  // Reading beyond the end of the segment would raise SIGBUS.
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < ref.size()) {
+    close(fd);
+    return tensorflow::errors::InvalidArgument(
+        "Segment ", ref.name(), " is smaller than ", ref.size(), " bytes.");
+  }
+
+  if (ref.size() == 0) {
+    close(fd);
+    chunk->Clear();
+    return tensorflow::Status::OK();
+  }
+
+  void* mapped = mmap(nullptr, ref.size(), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return ErrnoToStatus(absl::StrCat("Failed to map segment ", ref.name()));
+  }
+  bool parsed = chunk->ParseFromArray(mapped, ref.size());
+  munmap(mapped, ref.size());
+
+  if (!parsed) {
+    return tensorflow::errors::DataLoss("Failed to parse chunk of segment ",
+                                        ref.name());
+  }
+  return tensorflow::Status::OK();
+}
+
+void RemoveSharedMemoryChunk(const SharedMemoryChunk& ref) {
+  if (IsValidName(ref.name())) shm_unlink(ref.name().c_str());
+}
+
+SharedMemorySegments::SharedMemorySegments() : prefix_(NewStreamPrefix()) {}
+
+tensorflow::Status SharedMemorySegments::Write(const ChunkData& chunk,
+                                               SharedMemoryChunk* ref) {
+  return WriteSegment(
+      absl::StrCat(prefix_, next_.fetch_add(1, std::memory_order_relaxed)),
+      chunk, ref);
+}
+
+void SharedMemorySegments::RemoveAll() {
+  // Nothing to remove, and no need to list the directory, if no segment has
+  // been written.
+  if (next_.load(std::memory_order_relaxed) == 0) return;
+  for (const std::string& name : ListSegments(prefix_)) {
+    shm_unlink(name.c_str());
+  }
+}
+
+std::vector<std::string> ListSharedMemorySegmentsOfProcess() {
+  return ListSegments(ProcessPrefix());
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
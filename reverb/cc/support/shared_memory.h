@@ -0,0 +1,88 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_SHARED_MEMORY_H_
+#define REVERB_CC_SUPPORT_SHARED_MEMORY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Passes chunks between processes on the same host through POSIX shared
+// memory rather than through the (loopback) gRPC stream. Each chunk is
+// serialized into a segment of its own which is created by the sender and
+// removed by the receiver once it has parsed the chunk, so the stream only
+// carries the name of the segment.
+//
+// Segments of messages which are lost, e.g because the stream is cancelled
+// before the receiver has read them, remain until the host is restarted unless
+// the sender removes them. Streams therefore write their segments through a
+// `SharedMemorySegments`, which names them after the stream, and the side
+// which knows that the receiver won't read any more of them removes them all
+// once the stream has ended.
+
+// Chunks smaller than this are sent inline as creating, mapping and removing a
+// segment costs more than copying them through the stream.
+constexpr int64_t kMinSharedMemoryChunkBytes = 64 * 1024;
+
+// Serializes `chunk` into a new segment and describes the segment in `ref`.
+tensorflow::Status WriteSharedMemoryChunk(const ChunkData& chunk,
+                                          SharedMemoryChunk* ref);
+
+// Parses the chunk of the segment `ref` into `chunk` and removes the segment.
+// Only segments created by `WriteSharedMemoryChunk` can be read.
+tensorflow::Status ReadSharedMemoryChunk(const SharedMemoryChunk& ref,
+                                         ChunkData* chunk);
+
+// Removes the segment `ref` if it still exists.
+void RemoveSharedMemoryChunk(const SharedMemoryChunk& ref);
+
+// The segments written for a single stream. Their names share a prefix which
+// is unique to the stream, so the segments which the receiver hasn't read can
+// be removed without knowing which ones it has read.
+class SharedMemorySegments {
+ public:
+  SharedMemorySegments();
+
+  // Like `WriteSharedMemoryChunk` but names the segment after the stream.
+  tensorflow::Status Write(const ChunkData& chunk, SharedMemoryChunk* ref);
+
+  // Removes the segments of the stream which still exist. Must only be called
+  // once the receiver won't read any more of them, i.e once the stream has
+  // ended, and not concurrently with `Write`.
+  void RemoveAll();
+
+ private:
+  const std::string prefix_;
+  std::atomic<uint64_t> next_{0};
+};
+
+// Returns the names of the segments written by this process which still exist.
+// Used by tests to check that segments are not leaked.
+std::vector<std::string> ListSharedMemorySegmentsOfProcess();
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_SHARED_MEMORY_H_
@@ -0,0 +1,129 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/shared_memory.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::deepmind::reverb::testing::EqualsProto;
+using ::testing::Contains;
+using ::testing::Not;
+
+TEST(SharedMemoryTest, ReadReturnsWrittenChunk) {
+  ChunkData chunk = testing::MakeChunkData(1);
+  chunk.mutable_data()->add_tensors()->set_tensor_content(
+      std::string(5000, 'a'));
+
+  SharedMemoryChunk ref;
+  TF_ASSERT_OK(WriteSharedMemoryChunk(chunk, &ref));
+  EXPECT_EQ(ref.size(), chunk.ByteSizeLong());
+
+  ChunkData read;
+  TF_ASSERT_OK(ReadSharedMemoryChunk(ref, &read));
+  EXPECT_THAT(read, EqualsProto(chunk));
+}
+
+TEST(SharedMemoryTest, EmptyChunk) {
+  SharedMemoryChunk ref;
+  TF_ASSERT_OK(WriteSharedMemoryChunk(ChunkData(), &ref));
+
+  ChunkData read = testing::MakeChunkData(1);
+  TF_ASSERT_OK(ReadSharedMemoryChunk(ref, &read));
+  EXPECT_THAT(read, EqualsProto(ChunkData()));
+}
+
+TEST(SharedMemoryTest, ReadRemovesSegment) {
+  SharedMemoryChunk ref;
+  TF_ASSERT_OK(WriteSharedMemoryChunk(testing::MakeChunkData(1), &ref));
+
+  ChunkData read;
+  TF_ASSERT_OK(ReadSharedMemoryChunk(ref, &read));
+  EXPECT_FALSE(ReadSharedMemoryChunk(ref, &read).ok());
+}
+
+TEST(SharedMemoryTest, RemovedSegmentCannotBeRead) {
+  SharedMemoryChunk ref;
+  TF_ASSERT_OK(WriteSharedMemoryChunk(testing::MakeChunkData(1), &ref));
+  RemoveSharedMemoryChunk(ref);
+
+  ChunkData read;
+  EXPECT_FALSE(ReadSharedMemoryChunk(ref, &read).ok());
+}
+
+TEST(SharedMemoryTest, RejectsForeignSegments) {
+  SharedMemoryChunk ref;
+  ref.set_name("/other-segment");
+  ChunkData read;
+  EXPECT_TRUE(
+      tensorflow::errors::IsInvalidArgument(ReadSharedMemoryChunk(ref, &read)));
+}
+
+TEST(SharedMemoryTest, RejectsSizeLargerThanSegment) {
+  SharedMemoryChunk ref;
+  TF_ASSERT_OK(WriteSharedMemoryChunk(testing::MakeChunkData(1), &ref));
+  ref.set_size(ref.size() + 4096);
+
+  ChunkData read;
+  EXPECT_TRUE(
+      tensorflow::errors::IsInvalidArgument(ReadSharedMemoryChunk(ref, &read)));
+}
+
+TEST(SharedMemoryTest, RemoveAllOnlyRemovesSegmentsOfStream) {
+  SharedMemorySegments stream;
+  SharedMemorySegments other_stream;
+  SharedMemoryChunk read_ref, unread_ref, other_ref, process_ref;
+  TF_ASSERT_OK(stream.Write(testing::MakeChunkData(1), &read_ref));
+  TF_ASSERT_OK(stream.Write(testing::MakeChunkData(2), &unread_ref));
+  TF_ASSERT_OK(other_stream.Write(testing::MakeChunkData(3), &other_ref));
+  TF_ASSERT_OK(WriteSharedMemoryChunk(testing::MakeChunkData(4), &process_ref));
+
+  ChunkData read;
+  TF_ASSERT_OK(ReadSharedMemoryChunk(read_ref, &read));
+  stream.RemoveAll();
+  EXPECT_FALSE(ReadSharedMemoryChunk(unread_ref, &read).ok());
+
+  TF_EXPECT_OK(ReadSharedMemoryChunk(other_ref, &read));
+  EXPECT_THAT(read, EqualsProto(testing::MakeChunkData(3)));
+  TF_EXPECT_OK(ReadSharedMemoryChunk(process_ref, &read));
+  EXPECT_THAT(read, EqualsProto(testing::MakeChunkData(4)));
+}
+
+TEST(SharedMemoryTest, ListsSegmentsOfProcess) {
+  SharedMemorySegments stream;
+  SharedMemoryChunk ref;
+  TF_ASSERT_OK(stream.Write(testing::MakeChunkData(1), &ref));
+  EXPECT_THAT(ListSharedMemorySegmentsOfProcess(), Contains(ref.name()));
+
+  stream.RemoveAll();
+  EXPECT_THAT(ListSharedMemorySegmentsOfProcess(),
+              Not(Contains(ref.name())));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -14,7 +14,10 @@
 
 #include "reverb/cc/support/signature.h"
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
@@ -201,6 +204,70 @@ std::vector<internal::TensorSpec> SpecsFromTensors(
 }
 
 
+SignatureValidator::SignatureValidator(std::vector<TensorSpec> specs)
+    : specs_(std::move(specs)) {
+  dtypes_.reserve(specs_.size());
+  ranks_.reserve(specs_.size());
+  dims_offsets_.reserve(specs_.size());
+  for (const auto& spec : specs_) {
+    dtypes_.push_back(spec.dtype);
+    ranks_.push_back(spec.shape.unknown_rank() ? -1 : spec.shape.dims());
+    dims_offsets_.push_back(dims_.size());
+    for (int d = 0; d < ranks_.back(); d++) {
+      dims_.push_back(spec.shape.dim_size(d));
+    }
+  }
+}
+
+template <typename Shape>
+bool SignatureValidator::IsShapeCompatible(int i, const Shape& shape,
+                                           int skip_dims) const {
+  const int rank = ranks_[i];
+  if (rank == -1) return true;
+  if (shape.dims() - skip_dims != rank) return false;
+  const int64_t* dims = dims_.data() + dims_offsets_[i];
+  for (int d = 0; d < rank; d++) {
+    const int64_t dim = shape.dim_size(d + skip_dims);
+    if (dims[d] != -1 && dim != -1 && dims[d] != dim) return false;
+  }
+  return true;
+}
+
+bool SignatureValidator::IsCompatible(int i, tensorflow::DataType dtype,
+                                      const tensorflow::TensorShape& shape,
+                                      int skip_dims) const {
+  return dtypes_[i] == dtype && IsShapeCompatible(i, shape, skip_dims);
+}
+
+bool SignatureValidator::IsCompatible(
+    int i, tensorflow::DataType dtype,
+    const tensorflow::PartialTensorShape& shape) const {
+  if (dtypes_[i] != dtype) return false;
+  // An unknown rank is compatible with every spec.
+  return shape.unknown_rank() || IsShapeCompatible(i, shape, 0);
+}
+
+int SignatureValidator::FindIncompatible(
+    const std::vector<tensorflow::Tensor>& tensors, int skip_dims) const {
+  for (int i = 0; i < tensors.size(); i++) {
+    if (!IsCompatible(i, tensors[i].dtype(), tensors[i].shape(), skip_dims)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+SignatureValidatorMap CompileSignatures(const FlatSignatureMap& signatures) {
+  SignatureValidatorMap validators;
+  for (const auto& table : signatures) {
+    validators[table.first] =
+        table.second.has_value()
+            ? std::make_shared<const SignatureValidator>(*table.second)
+            : nullptr;
+  }
+  return validators;
+}
+
 }  // namespace internal
 }  // namespace reverb
 }  // namespace deepmind
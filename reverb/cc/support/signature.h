@@ -15,6 +15,8 @@
 #ifndef REVERB_CC_SUPPORT_SIGNATURE_H_
 #define REVERB_CC_SUPPORT_SIGNATURE_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -66,6 +68,58 @@ std::string DtypesShapesString(const std::vector<tensorflow::Tensor>& tensors);
 std::vector<internal::TensorSpec> SpecsFromTensors(
     const std::vector<tensorflow::Tensor>& tensors);
 
+// Flattened signature compiled once into flat arrays of dtypes, ranks and
+// dimensions so that tensors can be checked against it with a tight loop and
+// without allocating. Unknown ranks and dimensions are stored as -1.
+//
+// This object is immutable and thus thread-safe.
+class SignatureValidator {
+ public:
+  explicit SignatureValidator(std::vector<TensorSpec> specs);
+
+  // The number of tensors of the signature.
+  int num_tensors() const { return dtypes_.size(); }
+
+  // The specs which the validator was compiled from, e.g for error messages.
+  const std::vector<TensorSpec>& specs() const { return specs_; }
+
+  // Returns true if a tensor of `dtype` and `shape`, without its first
+  // `skip_dims` dimensions, is compatible with the i:th spec.
+  bool IsCompatible(int i, tensorflow::DataType dtype,
+                    const tensorflow::TensorShape& shape,
+                    int skip_dims = 0) const;
+  bool IsCompatible(int i, tensorflow::DataType dtype,
+                    const tensorflow::PartialTensorShape& shape) const;
+
+  // Returns the index of the first of `tensors` which is incompatible with its
+  // spec (see `IsCompatible`) or -1 if all are compatible. `tensors` must have
+  // `num_tensors()` elements.
+  int FindIncompatible(const std::vector<tensorflow::Tensor>& tensors,
+                       int skip_dims = 0) const;
+
+ private:
+  template <typename Shape>
+  bool IsShapeCompatible(int i, const Shape& shape, int skip_dims) const;
+
+  std::vector<TensorSpec> specs_;
+  std::vector<tensorflow::DataType> dtypes_;
+  std::vector<int> ranks_;
+
+  // The dims of the i:th spec are `dims_[dims_offsets_[i]:][:ranks_[i]]`.
+  std::vector<int64_t> dims_;
+  std::vector<int> dims_offsets_;
+};
+
+// Map from table name to the compiled flattened signature of the table, null
+// if the table has no signature. Built by the `Client` once per
+// `tables_state_id` and shared by its writers.
+typedef internal::flat_hash_map<std::string,
+                                std::shared_ptr<const SignatureValidator>>
+    SignatureValidatorMap;
+
+// Compiles the signatures of `signatures`.
+SignatureValidatorMap CompileSignatures(const FlatSignatureMap& signatures);
+
 }  // namespace internal
 }  // namespace reverb
 }  // namespace deepmind
@@ -0,0 +1,121 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/signature.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/types/optional.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+SignatureValidator MakeValidator() {
+  return SignatureValidator({
+      {"fully_defined", tensorflow::DT_FLOAT,
+       tensorflow::PartialTensorShape({2, 3})},
+      {"unknown_dim", tensorflow::DT_INT32,
+       tensorflow::PartialTensorShape({-1, 3})},
+      {"unknown_rank", tensorflow::DT_INT64, tensorflow::PartialTensorShape()},
+  });
+}
+
+TEST(SignatureValidatorTest, KeepsSpecs) {
+  SignatureValidator validator = MakeValidator();
+  EXPECT_EQ(validator.num_tensors(), 3);
+  EXPECT_EQ(validator.specs()[1].name, "unknown_dim");
+}
+
+TEST(SignatureValidatorTest, ChecksDtype) {
+  SignatureValidator validator = MakeValidator();
+  EXPECT_TRUE(validator.IsCompatible(0, tensorflow::DT_FLOAT,
+                                     tensorflow::TensorShape({2, 3})));
+  EXPECT_FALSE(validator.IsCompatible(0, tensorflow::DT_DOUBLE,
+                                      tensorflow::TensorShape({2, 3})));
+}
+
+TEST(SignatureValidatorTest, ChecksShape) {
+  SignatureValidator validator = MakeValidator();
+  EXPECT_FALSE(validator.IsCompatible(0, tensorflow::DT_FLOAT,
+                                      tensorflow::TensorShape({2, 4})));
+  EXPECT_FALSE(validator.IsCompatible(0, tensorflow::DT_FLOAT,
+                                      tensorflow::TensorShape({2, 3, 1})));
+  EXPECT_TRUE(validator.IsCompatible(1, tensorflow::DT_INT32,
+                                     tensorflow::TensorShape({7, 3})));
+  EXPECT_FALSE(validator.IsCompatible(1, tensorflow::DT_INT32,
+                                      tensorflow::TensorShape({7, 4})));
+  EXPECT_TRUE(validator.IsCompatible(2, tensorflow::DT_INT64,
+                                     tensorflow::TensorShape({1, 2, 3})));
+  EXPECT_TRUE(validator.IsCompatible(2, tensorflow::DT_INT64,
+                                     tensorflow::TensorShape({})));
+}
+
+TEST(SignatureValidatorTest, SkipsLeadingDims) {
+  SignatureValidator validator = MakeValidator();
+  EXPECT_TRUE(validator.IsCompatible(0, tensorflow::DT_FLOAT,
+                                     tensorflow::TensorShape({5, 2, 3}),
+                                     /*skip_dims=*/1));
+  EXPECT_FALSE(validator.IsCompatible(0, tensorflow::DT_FLOAT,
+                                      tensorflow::TensorShape({2, 3}),
+                                      /*skip_dims=*/1));
+}
+
+TEST(SignatureValidatorTest, ChecksPartialShapes) {
+  SignatureValidator validator = MakeValidator();
+  EXPECT_TRUE(validator.IsCompatible(0, tensorflow::DT_FLOAT,
+                                     tensorflow::PartialTensorShape({-1, 3})));
+  EXPECT_TRUE(validator.IsCompatible(0, tensorflow::DT_FLOAT,
+                                     tensorflow::PartialTensorShape()));
+  EXPECT_FALSE(validator.IsCompatible(
+      0, tensorflow::DT_FLOAT, tensorflow::PartialTensorShape({-1, 4})));
+}
+
+TEST(SignatureValidatorTest, FindIncompatibleReturnsFirstMismatch) {
+  SignatureValidator validator = MakeValidator();
+  std::vector<tensorflow::Tensor> tensors = {
+      tensorflow::Tensor(tensorflow::DT_FLOAT, {2, 3}),
+      tensorflow::Tensor(tensorflow::DT_INT32, {1, 3}),
+      tensorflow::Tensor(tensorflow::DT_INT64, {4}),
+  };
+  EXPECT_EQ(validator.FindIncompatible(tensors), -1);
+
+  tensors[1] = tensorflow::Tensor(tensorflow::DT_INT32, {1, 2});
+  tensors[2] = tensorflow::Tensor(tensorflow::DT_FLOAT, {4});
+  EXPECT_EQ(validator.FindIncompatible(tensors), 1);
+}
+
+TEST(CompileSignaturesTest, CompilesTablesWithSignatures) {
+  FlatSignatureMap signatures;
+  signatures["with"] = std::vector<TensorSpec>{
+      {"x", tensorflow::DT_FLOAT, tensorflow::PartialTensorShape({})}};
+  signatures["without"] = absl::nullopt;
+
+  SignatureValidatorMap validators = CompileSignatures(signatures);
+  ASSERT_EQ(validators.size(), 2);
+  ASSERT_NE(validators["with"], nullptr);
+  EXPECT_EQ(validators["with"]->num_tensors(), 1);
+  EXPECT_EQ(validators["without"], nullptr);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
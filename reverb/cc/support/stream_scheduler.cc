@@ -0,0 +1,176 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/stream_scheduler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Interval at which `Acquire` polls its `cancelled` callback.
+constexpr absl::Duration kCancellationPollInterval = absl::Milliseconds(50);
+
+std::vector<std::string> SortedNames(
+    const flat_hash_map<std::string, StreamClassOptions>& classes) {
+  std::vector<std::string> names;
+  names.reserve(classes.size());
+  for (const auto& [name, options] : classes) names.push_back(name);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+}  // namespace
+
+StreamScheduler::StreamScheduler(
+    int capacity, const flat_hash_map<std::string, StreamClassOptions>& classes)
+    : capacity_(capacity), names_(SortedNames(classes)) {
+  const absl::Time now = absl::Now();
+  absl::MutexLock lock(&mu_);
+  classes_.resize(names_.size());
+  for (int i = 0; i < names_.size(); i++) {
+    Class& c = classes_[i];
+    c.options = classes.at(names_[i]);
+    REVERB_CHECK_GT(c.options.weight, 0)
+        << "Weight of stream class " << names_[i] << " must be > 0.";
+    c.tokens = std::max<double>(c.options.max_bytes_per_second, 0);
+    c.refilled_at = now;
+  }
+}
+
+int StreamScheduler::FindClass(absl::string_view name) const {
+  auto it = std::lower_bound(names_.begin(), names_.end(), name);
+  if (it == names_.end() || *it != name) return -1;
+  return it - names_.begin();
+}
+
+bool StreamScheduler::Acquire(int index,
+                              const std::function<bool()>& cancelled) {
+  absl::MutexLock lock(&mu_);
+  Class& c = classes_[index];
+  if (c.waiting.empty() && c.running == 0) {
+    c.virtual_time = std::max(c.virtual_time, virtual_clock_);
+  }
+  const uint64_t id = next_id_++;
+  c.waiting.push_back(id);
+
+  while (true) {
+    RefillLocked(absl::Now());
+    if (closed_ || (cancelled && cancelled())) {
+      RemoveWaitingLocked(index, id);
+      // The next operation of the class may be able to start now.
+      cv_.SignalAll();
+      return false;
+    }
+    if (CanStartLocked(index, id)) break;
+
+    absl::Duration wait = kCancellationPollInterval;
+    if (OverCapLocked(c)) {
+      wait = std::min(wait, absl::Seconds(-c.tokens /
+                                          c.options.max_bytes_per_second));
+    }
+    cv_.WaitWithTimeout(&mu_, wait);
+  }
+
+  c.waiting.pop_front();
+  c.running++;
+  running_++;
+  virtual_clock_ = c.virtual_time;
+  // Further operations may start if there is capacity left.
+  cv_.SignalAll();
+  return true;
+}
+
+void StreamScheduler::Release(int index) {
+  absl::MutexLock lock(&mu_);
+  REVERB_CHECK_GT(classes_[index].running, 0);
+  classes_[index].running--;
+  running_--;
+  cv_.SignalAll();
+}
+
+void StreamScheduler::Charge(int index, int64_t bytes) {
+  absl::MutexLock lock(&mu_);
+  Class& c = classes_[index];
+  RefillLocked(absl::Now());
+  c.virtual_time += bytes / c.options.weight;
+  if (c.options.max_bytes_per_second > 0) c.tokens -= bytes;
+  // The order in which the waiting operations start may have changed.
+  cv_.SignalAll();
+}
+
+void StreamScheduler::Close() {
+  absl::MutexLock lock(&mu_);
+  closed_ = true;
+  cv_.SignalAll();
+}
+
+int StreamScheduler::num_waiting(int index) const {
+  absl::MutexLock lock(&mu_);
+  return classes_[index].waiting.size();
+}
+
+void StreamScheduler::RefillLocked(absl::Time now) {
+  for (Class& c : classes_) {
+    if (c.options.max_bytes_per_second <= 0) continue;
+    const double rate = c.options.max_bytes_per_second;
+    c.tokens = std::min(
+        rate, c.tokens + rate * absl::ToDoubleSeconds(now - c.refilled_at));
+    c.refilled_at = now;
+  }
+}
+
+bool StreamScheduler::OverCapLocked(const Class& c) const {
+  return c.options.max_bytes_per_second > 0 && c.tokens < 0;
+}
+
+bool StreamScheduler::CanStartLocked(int index, uint64_t id) const {
+  const Class& c = classes_[index];
+  if (c.waiting.front() != id || OverCapLocked(c)) return false;
+  if (capacity_ <= 0) return true;
+  if (running_ >= capacity_) return false;
+  // Ties are broken by class index so that exactly one class is next.
+  for (int i = 0; i < classes_.size(); i++) {
+    const Class& other = classes_[i];
+    if (i == index || other.waiting.empty() || OverCapLocked(other)) continue;
+    if (other.virtual_time < c.virtual_time ||
+        (other.virtual_time == c.virtual_time && i < index)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void StreamScheduler::RemoveWaitingLocked(int index, uint64_t id) {
+  auto& waiting = classes_[index].waiting;
+  waiting.erase(std::find(waiting.begin(), waiting.end(), id));
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
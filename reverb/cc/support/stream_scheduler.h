@@ -0,0 +1,157 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_STREAM_SCHEDULER_H_
+#define REVERB_CC_SUPPORT_STREAM_SCHEDULER_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/hash_map.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Name of the gRPC metadata entry in which clients pass the priority class of
+// their streams.
+constexpr char kPriorityClassMetadataKey[] = "reverb-priority-class";
+
+struct StreamClassOptions {
+  // Share of the operations of the class, measured in bytes, relative to the
+  // weights of the other classes which have operations waiting. Must be > 0.
+  double weight = 1;
+
+  // Maximum number of bytes per second charged to the class, with bursts of up
+  // to a second worth of bytes. Operations of a class above its cap wait until
+  // it is back under the cap. A value <= 0 means that there is no limit.
+  int64_t max_bytes_per_second = 0;
+};
+
+// Schedules the operations of the streams of a server, e.g the sample batches
+// of `SampleStream`s, by their priority class. At most `capacity` operations
+// run at the same time and when more are waiting they start in weighted fair
+// order: every class has a virtual time which advances by the bytes charged to
+// it divided by its weight, and the next operation to start is the oldest one
+// of the class with the lowest virtual time. A class which has been idle
+// catches up with the virtual time of the last operation started, so it can't
+// bank credit while it has nothing to do. Classes over their bandwidth cap are
+// skipped until they are back under it, so the scheduler stays work
+// conserving. Operations of the same class start in the order they arrived.
+//
+// The bytes of an operation are usually only known once it has finished, so
+// they are charged separately from the release of the operation.
+//
+// This class is thread-safe.
+class StreamScheduler {
+ public:
+  // `capacity` <= 0 allows any number of concurrent operations, in which case
+  // only the bandwidth caps delay operations.
+  StreamScheduler(
+      int capacity,
+      const flat_hash_map<std::string, StreamClassOptions>& classes);
+
+  StreamScheduler(const StreamScheduler&) = delete;
+  StreamScheduler& operator=(const StreamScheduler&) = delete;
+
+  // Number of classes. Classes are identified by their index in [0,
+  // num_classes()), in the order of their names.
+  int num_classes() const { return names_.size(); }
+
+  // Index of the class called `name`, or -1 if there is no such class.
+  int FindClass(absl::string_view name) const;
+
+  const std::string& class_name(int index) const { return names_[index]; }
+
+  // Blocks until an operation of class `index` may start and then starts it.
+  // `cancelled`, if set, is polled while waiting. Returns false, without
+  // starting the operation, if `cancelled` returns true or the scheduler is
+  // closed.
+  bool Acquire(int index, const std::function<bool()>& cancelled = nullptr)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Ends an operation of class `index` started by `Acquire`.
+  void Release(int index) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Charges `bytes` to class `index`, which advances its virtual time and
+  // draws from its bandwidth cap.
+  void Charge(int index, int64_t bytes) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Unblocks all pending and future calls to `Acquire`, which return false.
+  void Close() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of operations of class `index` which are waiting to start. Used by
+  // tests.
+  int num_waiting(int index) const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  struct Class {
+    StreamClassOptions options;
+
+    // Bytes charged so far divided by the weight of the class.
+    double virtual_time = 0;
+
+    // Bytes which may be charged before the class is over its cap, refilled
+    // at `options.max_bytes_per_second`. Negative while over the cap.
+    double tokens = 0;
+    absl::Time refilled_at;
+
+    // Ids of the waiting operations in the order they arrived.
+    std::deque<uint64_t> waiting;
+    int running = 0;
+  };
+
+  // Adds the tokens which the classes have earned since they were last
+  // refilled.
+  void RefillLocked(absl::Time now) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  bool OverCapLocked(const Class& c) const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Whether the waiting operation `id` of class `index` is next to start.
+  bool CanStartLocked(int index, uint64_t id) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Removes the waiting operation `id` of class `index`.
+  void RemoveWaitingLocked(int index, uint64_t id)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const int capacity_;
+
+  // Names of the classes, sorted.
+  const std::vector<std::string> names_;
+
+  mutable absl::Mutex mu_;
+  absl::CondVar cv_;
+  std::vector<Class> classes_ ABSL_GUARDED_BY(mu_);
+  int running_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t next_id_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Virtual time of the class of the operation which started last.
+  double virtual_clock_ ABSL_GUARDED_BY(mu_) = 0;
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_STREAM_SCHEDULER_H_
@@ -0,0 +1,199 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/stream_scheduler.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+
+void WaitForWaiting(const StreamScheduler& scheduler, int index, int count) {
+  while (scheduler.num_waiting(index) != count) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+}
+
+TEST(StreamSchedulerTest, FindClass) {
+  StreamScheduler scheduler(1, {{"training", {}}, {"evaluation", {}}});
+  EXPECT_EQ(scheduler.num_classes(), 2);
+  EXPECT_EQ(scheduler.FindClass("evaluation"), 0);
+  EXPECT_EQ(scheduler.FindClass("training"), 1);
+  EXPECT_EQ(scheduler.FindClass("bulk"), -1);
+  EXPECT_EQ(scheduler.class_name(1), "training");
+}
+
+TEST(StreamSchedulerTest, OperationsStartImmediatelyUpToCapacity) {
+  StreamScheduler scheduler(2, {{"a", {}}});
+  ASSERT_TRUE(scheduler.Acquire(0));
+  ASSERT_TRUE(scheduler.Acquire(0));
+
+  absl::Notification started;
+  auto thread = StartThread("Acquire", [&] {
+    EXPECT_TRUE(scheduler.Acquire(0));
+    started.Notify();
+  });
+  WaitForWaiting(scheduler, 0, 1);
+  EXPECT_FALSE(started.HasBeenNotified());
+
+  scheduler.Release(0);
+  started.WaitForNotification();
+  thread = nullptr;
+}
+
+TEST(StreamSchedulerTest, WaitingOperationsStartInWeightedFairOrder) {
+  StreamScheduler scheduler(1, {{"a", {/*weight=*/3}}, {"b", {/*weight=*/1}}});
+
+  // Holds the only slot until all operations are waiting.
+  ASSERT_TRUE(scheduler.Acquire(0));
+
+  absl::Mutex mu;
+  std::vector<std::string> order;
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int index : {0, 1}) {
+    for (int i = 0; i < 4; i++) {
+      threads.push_back(StartThread("Operation", [&, index] {
+        ASSERT_TRUE(scheduler.Acquire(index));
+        {
+          absl::MutexLock lock(&mu);
+          order.push_back(scheduler.class_name(index));
+        }
+        scheduler.Charge(index, 300);
+        scheduler.Release(index);
+      }));
+    }
+  }
+  WaitForWaiting(scheduler, 0, 4);
+  WaitForWaiting(scheduler, 1, 4);
+
+  scheduler.Release(0);
+  threads.clear();
+
+  // Every operation of `a` advances its virtual time by 100 and every
+  // operation of `b` by 300. Ties go to `a`.
+  EXPECT_THAT(order, ElementsAre("a", "b", "a", "a", "a", "b", "b", "b"));
+}
+
+TEST(StreamSchedulerTest, IdleClassDoesNotBankCredit) {
+  StreamScheduler scheduler(1, {{"a", {}}, {"b", {}}});
+  for (int i = 0; i < 10; i++) {
+    ASSERT_TRUE(scheduler.Acquire(0));
+    scheduler.Charge(0, 100);
+    scheduler.Release(0);
+  }
+
+  // `b` has been idle while `a` was served 1000 bytes. It catches up with `a`
+  // rather than getting the next 1000 bytes to itself.
+  ASSERT_TRUE(scheduler.Acquire(1));
+  std::vector<int> order;
+  absl::Mutex mu;
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int index : {0, 1}) {
+    threads.push_back(StartThread("Operation", [&, index] {
+      for (int i = 0; i < 2; i++) {
+        ASSERT_TRUE(scheduler.Acquire(index));
+        {
+          absl::MutexLock lock(&mu);
+          order.push_back(index);
+        }
+        scheduler.Charge(index, 100);
+        scheduler.Release(index);
+      }
+    }));
+  }
+  WaitForWaiting(scheduler, 0, 1);
+  WaitForWaiting(scheduler, 1, 1);
+  scheduler.Charge(1, 100);
+  scheduler.Release(1);
+  threads.clear();
+
+  // Without catching up `b` would have gone first twice.
+  EXPECT_THAT(order, ElementsAre(0, 1, 0, 1));
+}
+
+TEST(StreamSchedulerTest, ClassOverCapWaitsWithoutBlockingOthers) {
+  StreamScheduler scheduler(
+      1, {{"capped", {/*weight=*/1, /*max_bytes_per_second=*/100000}},
+          {"free", {}}});
+
+  // Takes the class 20000 bytes over its cap, i.e 200ms worth of bytes.
+  ASSERT_TRUE(scheduler.Acquire(0));
+  scheduler.Charge(0, 120000);
+  scheduler.Release(0);
+
+  const absl::Time start = absl::Now();
+  absl::Notification started;
+  auto thread = StartThread("Capped", [&] {
+    EXPECT_TRUE(scheduler.Acquire(0));
+    started.Notify();
+    scheduler.Release(0);
+  });
+  WaitForWaiting(scheduler, 0, 1);
+
+  ASSERT_TRUE(scheduler.Acquire(1));
+  EXPECT_FALSE(started.HasBeenNotified());
+  scheduler.Release(1);
+
+  started.WaitForNotification();
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(150));
+  thread = nullptr;
+}
+
+TEST(StreamSchedulerTest, AcquireFailsWhenCancelled) {
+  StreamScheduler scheduler(1, {{"a", {}}});
+  ASSERT_TRUE(scheduler.Acquire(0));
+
+  absl::Notification cancel;
+  auto thread = StartThread("Acquire", [&] {
+    EXPECT_FALSE(
+        scheduler.Acquire(0, [&] { return cancel.HasBeenNotified(); }));
+  });
+  WaitForWaiting(scheduler, 0, 1);
+  cancel.Notify();
+  thread = nullptr;
+  EXPECT_EQ(scheduler.num_waiting(0), 0);
+}
+
+TEST(StreamSchedulerTest, AcquireFailsWhenClosed) {
+  StreamScheduler scheduler(1, {{"a", {}}});
+  ASSERT_TRUE(scheduler.Acquire(0));
+
+  auto thread = StartThread("Acquire", [&] {
+    EXPECT_FALSE(scheduler.Acquire(0));
+  });
+  WaitForWaiting(scheduler, 0, 1);
+  scheduler.Close();
+  thread = nullptr;
+  EXPECT_FALSE(scheduler.Acquire(0));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
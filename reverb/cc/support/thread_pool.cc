@@ -0,0 +1,67 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/thread_pool.h"
+
+#include "absl/strings/str_cat.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+ThreadPool::ThreadPool(int num_threads, absl::string_view name_prefix) {
+  REVERB_CHECK_GE(num_threads, 1);
+  threads_.reserve(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    threads_.push_back(
+        StartThread(absl::StrCat(name_prefix, "_", i), [this] { RunThread(); }));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    absl::MutexLock lock(&mu_);
+    stopped_ = true;
+  }
+  threads_.clear();  // Joins the threads.
+}
+
+void ThreadPool::Schedule(std::function<void()> fn) {
+  absl::MutexLock lock(&mu_);
+  REVERB_CHECK(!stopped_) << "Schedule called on a stopped ThreadPool.";
+  pending_.push_back(std::move(fn));
+}
+
+void ThreadPool::RunThread() {
+  auto trigger = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return stopped_ || !pending_.empty();
+  };
+
+  while (true) {
+    std::function<void()> fn;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(&trigger));
+      if (pending_.empty()) return;
+      fn = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    fn();
+  }
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
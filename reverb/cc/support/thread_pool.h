@@ -0,0 +1,69 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_THREAD_POOL_H_
+#define REVERB_CC_SUPPORT_THREAD_POOL_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Fixed size set of threads which run scheduled closures in the order in which
+// they were scheduled. Closures may complete in any order when the pool has
+// more than one thread.
+//
+// This object is thread-safe.
+class ThreadPool : public Executor {
+ public:
+  // Starts `num_threads` (>= 1) threads labelled with `name_prefix`.
+  ThreadPool(int num_threads, absl::string_view name_prefix);
+
+  // Runs the closures which are still pending and joins the threads.
+  ~ThreadPool() override;
+
+  // Schedules `fn` to be run by one of the threads of the pool.
+  void Schedule(std::function<void()> fn) override ABSL_LOCKS_EXCLUDED(mu_);
+
+  // The number of threads of the pool.
+  int num_threads() const override { return threads_.size(); }
+
+  // ThreadPool is neither copyable nor movable.
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+ private:
+  // Runs pending closures until the pool is stopped and no closures remain.
+  void RunThread() ABSL_LOCKS_EXCLUDED(mu_);
+
+  absl::Mutex mu_;
+  std::deque<std::function<void()>> pending_ ABSL_GUARDED_BY(mu_);
+  bool stopped_ ABSL_GUARDED_BY(mu_) = false;
+  std::vector<std::unique_ptr<Thread>> threads_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_THREAD_POOL_H_
@@ -0,0 +1,108 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/thread_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(ThreadPoolTest, RunsScheduledClosures) {
+  ThreadPool pool(4, "test");
+  EXPECT_EQ(pool.num_threads(), 4);
+
+  std::atomic<int> sum(0);
+  absl::BlockingCounter counter(100);
+  for (int i = 0; i < 100; i++) {
+    pool.Schedule([&, i] {
+      sum += i;
+      counter.DecrementCount();
+    });
+  }
+  counter.Wait();
+  EXPECT_EQ(sum, 4950);
+}
+
+TEST(ThreadPoolTest, RunsClosuresInParallel) {
+  ThreadPool pool(2, "test");
+
+  // The first closure only completes if the second one runs concurrently.
+  absl::Notification first_started;
+  absl::Notification second_done;
+  absl::Notification first_done;
+  pool.Schedule([&] {
+    first_started.Notify();
+    second_done.WaitForNotification();
+    first_done.Notify();
+  });
+  pool.Schedule([&] {
+    first_started.WaitForNotification();
+    second_done.Notify();
+  });
+  first_done.WaitForNotification();
+}
+
+TEST(ThreadPoolTest, DestructorRunsPendingClosures) {
+  std::atomic<int> runs(0);
+  {
+    ThreadPool pool(1, "test");
+    absl::Notification unblock;
+    pool.Schedule([&] { unblock.WaitForNotification(); });
+    for (int i = 0; i < 10; i++) {
+      pool.Schedule([&] { runs++; });
+    }
+    unblock.Notify();
+  }
+  EXPECT_EQ(runs, 10);
+}
+
+TEST(ThreadPoolTest, BoundsThreadsStartedOnPool) {
+  ThreadPool pool(2, "test");
+
+  std::atomic<int> running(0);
+  std::atomic<int> max_running(0);
+  std::atomic<int> runs(0);
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.push_back(StartThread(&pool, "test", [&] {
+      int now = ++running;
+      int max = max_running.load();
+      while (now > max && !max_running.compare_exchange_weak(max, now)) {
+      }
+      absl::SleepFor(absl::Milliseconds(5));
+      running--;
+      runs++;
+    }));
+  }
+  while (runs < 8) absl::SleepFor(absl::Milliseconds(1));
+  threads.clear();
+  EXPECT_LE(max_running, 2);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
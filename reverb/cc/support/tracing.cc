@@ -0,0 +1,231 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/tracing.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/numeric/int128.h"
+#include "absl/random/random.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Bit of the trace flags which marks the trace as sampled.
+constexpr uint8_t kSampledFlag = 0x01;
+
+std::atomic<bool> tracing_enabled{false};
+std::atomic<double> tracing_sample_rate{0};
+
+absl::Mutex* ExporterMutex() {
+  static auto* mu = new absl::Mutex();
+  return mu;
+}
+
+std::shared_ptr<SpanExporter>* Exporter() {
+  static auto* exporter = new std::shared_ptr<SpanExporter>();
+  return exporter;
+}
+
+TraceContext* ThreadContext() {
+  thread_local TraceContext context;
+  return &context;
+}
+
+absl::BitGen* ThreadBitGen() {
+  thread_local absl::BitGen bit_gen;
+  return &bit_gen;
+}
+
+uint64_t NewId() {
+  uint64_t id = 0;
+  while (id == 0) id = absl::Uniform<uint64_t>(*ThreadBitGen());
+  return id;
+}
+
+void Export(SpanRecord span) {
+  std::shared_ptr<SpanExporter> exporter;
+  {
+    absl::ReaderMutexLock lock(ExporterMutex());
+    exporter = *Exporter();
+  }
+  if (exporter != nullptr) exporter->Export(std::move(span));
+}
+
+// Parses `hex`, which must consist of lower case hex digits only.
+bool ParseHex(absl::string_view hex, uint64_t* value) {
+  *value = 0;
+  for (char c : hex) {
+    if (c >= '0' && c <= '9') {
+      *value = (*value << 4) | (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      *value = (*value << 4) | (c - 'a' + 10);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string FormatTraceId(absl::uint128 trace_id) {
+  return absl::StrFormat("%016x%016x", absl::Uint128High64(trace_id),
+                         absl::Uint128Low64(trace_id));
+}
+
+}  // namespace
+
+std::string TraceContext::ToTraceparent() const {
+  return absl::StrFormat("00-%s-%016x-%02x", FormatTraceId(trace_id), span_id,
+                         sampled ? kSampledFlag : 0);
+}
+
+bool TraceContext::FromTraceparent(absl::string_view header,
+                                   TraceContext* context) {
+  // version "-" trace-id "-" parent-id "-" trace-flags. Later versions may
+  // append fields, which are ignored.
+  uint64_t version, high, low, span_id, flags;
+  if (header.size() < 55 || header[2] != '-' || header[35] != '-' ||
+      header[52] != '-' || !ParseHex(header.substr(0, 2), &version) ||
+      version == 0xff || (version == 0 && header.size() != 55) ||
+      (header.size() > 55 && header[55] != '-') ||
+      !ParseHex(header.substr(3, 16), &high) ||
+      !ParseHex(header.substr(19, 16), &low) ||
+      !ParseHex(header.substr(36, 16), &span_id) ||
+      !ParseHex(header.substr(53, 2), &flags)) {
+    return false;
+  }
+  TraceContext parsed;
+  parsed.trace_id = absl::MakeUint128(high, low);
+  parsed.span_id = span_id;
+  parsed.sampled = (flags & kSampledFlag) != 0;
+  if (!parsed.valid()) return false;
+  *context = parsed;
+  return true;
+}
+
+std::string SpanRecord::DebugString() const {
+  std::string str = absl::StrCat(
+      "Span(name=", name, ", trace_id=", FormatTraceId(trace_id),
+      ", span_id=", absl::Hex(span_id, absl::kZeroPad16),
+      ", parent_span_id=", absl::Hex(parent_span_id, absl::kZeroPad16),
+      ", start=", absl::FormatTime(start),
+      ", duration=", absl::FormatDuration(end - start));
+  for (const auto& attribute : attributes) {
+    absl::StrAppend(&str, ", ", attribute.first, "=", attribute.second);
+  }
+  absl::StrAppend(&str, ")");
+  return str;
+}
+
+void LoggingSpanExporter::Export(SpanRecord span) {
+  REVERB_LOG(REVERB_INFO) << span.DebugString();
+}
+
+void InMemorySpanExporter::Export(SpanRecord span) {
+  absl::MutexLock lock(&mu_);
+  spans_.push_back(std::move(span));
+}
+
+std::vector<SpanRecord> InMemorySpanExporter::TakeSpans() {
+  absl::MutexLock lock(&mu_);
+  std::vector<SpanRecord> spans;
+  spans.swap(spans_);
+  return spans;
+}
+
+void ConfigureTracing(TracingOptions options) {
+  REVERB_CHECK(options.sample_rate >= 0 && options.sample_rate <= 1)
+      << "sample_rate must be in [0, 1] but got " << options.sample_rate;
+  absl::WriterMutexLock lock(ExporterMutex());
+  tracing_enabled.store(options.exporter != nullptr);
+  tracing_sample_rate.store(options.sample_rate);
+  *Exporter() = std::move(options.exporter);
+}
+
+TraceContext StartTrace() {
+  TraceContext context;
+  if (!tracing_enabled.load(std::memory_order_relaxed)) return context;
+  context.trace_id = absl::MakeUint128(NewId(), NewId());
+  context.span_id = NewId();
+  context.sampled = absl::Bernoulli(
+      *ThreadBitGen(), tracing_sample_rate.load(std::memory_order_relaxed));
+  return context;
+}
+
+const TraceContext& CurrentTraceContext() { return *ThreadContext(); }
+
+ScopedTraceContext::ScopedTraceContext(const TraceContext& context)
+    : previous_(*ThreadContext()) {
+  *ThreadContext() = context;
+}
+
+ScopedTraceContext::~ScopedTraceContext() { *ThreadContext() = previous_; }
+
+ScopedSpan::ScopedSpan(absl::string_view name)
+    : previous_(*ThreadContext()), context_(previous_) {
+  if (!previous_.sampled) return;
+  context_.span_id = NewId();
+  record_ = absl::make_unique<SpanRecord>();
+  record_->name = std::string(name);
+  record_->trace_id = context_.trace_id;
+  record_->span_id = context_.span_id;
+  record_->parent_span_id = previous_.span_id;
+  record_->start = absl::Now();
+  *ThreadContext() = context_;
+}
+
+ScopedSpan::~ScopedSpan() {
+  if (record_ == nullptr) return;
+  *ThreadContext() = previous_;
+  record_->end = absl::Now();
+  Export(std::move(*record_));
+}
+
+void ScopedSpan::AddAttribute(absl::string_view name,
+                              absl::string_view value) {
+  if (record_ == nullptr) return;
+  record_->attributes.emplace_back(std::string(name), std::string(value));
+}
+
+void RecordSpan(absl::string_view name, absl::Time start, absl::Time end) {
+  const TraceContext& parent = *ThreadContext();
+  if (!parent.sampled) return;
+  SpanRecord span;
+  span.name = std::string(name);
+  span.trace_id = parent.trace_id;
+  span.span_id = NewId();
+  span.parent_span_id = parent.span_id;
+  span.start = start;
+  span.end = end;
+  Export(std::move(span));
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,186 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_TRACING_H_
+#define REVERB_CC_SUPPORT_TRACING_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+// Optional tracing of the calls of the service. A trace covers a stream (or
+// unary call) from the client through the server and consists of spans, i.e
+// named intervals which have a parent span. The context of a trace is
+// propagated from the client to the server in the `traceparent` metadata of
+// the call, formatted as defined by https://www.w3.org/TR/trace-context/.
+//
+// The spans are only recorded if the trace is sampled. Whether a trace is
+// sampled is decided when the trace is started, by the client for streams it
+// opens or by the server for calls without a `traceparent`, according to the
+// `sample_rate` of the process. When tracing is disabled (the default) the
+// cost of a span is a check of a thread local.
+//
+// Spans are children of the context which is active on the current thread (see
+// `ScopedTraceContext`), so code which is called while handling a traced
+// stream, e.g `Table` or `ChunkStore`, can record spans without threading the
+// context through its signatures.
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Name of the gRPC metadata entry which carries the `TraceContext`.
+constexpr char kTraceparentMetadataKey[] = "traceparent";
+
+// Identifies a span and the trace it belongs to.
+struct TraceContext {
+  absl::uint128 trace_id = 0;
+  uint64_t span_id = 0;
+  bool sampled = false;
+
+  // Whether the context belongs to a trace. Contexts which are not valid are
+  // neither recorded nor propagated.
+  bool valid() const { return trace_id != 0 && span_id != 0; }
+
+  // Formats the context as a version 00 `traceparent` header.
+  std::string ToTraceparent() const;
+
+  // Parses a `traceparent` header. Returns false if `header` is malformed.
+  static bool FromTraceparent(absl::string_view header, TraceContext* context);
+};
+
+// A span which has ended.
+struct SpanRecord {
+  std::string name;
+  absl::uint128 trace_id = 0;
+  uint64_t span_id = 0;
+  uint64_t parent_span_id = 0;
+  absl::Time start;
+  absl::Time end;
+  std::vector<std::pair<std::string, std::string>> attributes;
+
+  // One line description of the span, e.g for logging.
+  std::string DebugString() const;
+};
+
+// Receives the spans of the sampled traces as they end. `Export` is called
+// inline from the threads which record the spans, which can hold locks (e.g
+// the lock of a table), so it must be thread-safe and must not block.
+class SpanExporter {
+ public:
+  virtual ~SpanExporter() = default;
+
+  virtual void Export(SpanRecord span) = 0;
+};
+
+// Logs every span at INFO level.
+class LoggingSpanExporter : public SpanExporter {
+ public:
+  void Export(SpanRecord span) override;
+};
+
+// Keeps the spans in memory. Used by tests.
+class InMemorySpanExporter : public SpanExporter {
+ public:
+  void Export(SpanRecord span) override ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Returns (and removes) the spans exported so far.
+  std::vector<SpanRecord> TakeSpans() ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  absl::Mutex mu_;
+  std::vector<SpanRecord> spans_ ABSL_GUARDED_BY(mu_);
+};
+
+struct TracingOptions {
+  // Fraction (in [0, 1]) of the traces started by this process which are
+  // sampled. Traces started by a peer are sampled if, and only if, the peer
+  // sampled them.
+  double sample_rate = 0;
+
+  // Receives the spans of the sampled traces. Tracing is disabled if null.
+  std::shared_ptr<SpanExporter> exporter;
+};
+
+// Configures tracing for the whole process. Spans which are in progress when
+// the configuration changes are exported with the new exporter.
+void ConfigureTracing(TracingOptions options);
+
+// Starts a new trace. Returns an invalid context if tracing is disabled.
+TraceContext StartTrace();
+
+// Context which is active on the current thread. Invalid if there is none.
+const TraceContext& CurrentTraceContext();
+
+// Makes `context` the active context of the current thread for the lifetime
+// of the object, e.g the context of a call when it is handled by a thread
+// which didn't start it.
+class ScopedTraceContext {
+ public:
+  explicit ScopedTraceContext(const TraceContext& context);
+  ~ScopedTraceContext();
+
+  ScopedTraceContext(const ScopedTraceContext&) = delete;
+  ScopedTraceContext& operator=(const ScopedTraceContext&) = delete;
+
+ private:
+  const TraceContext previous_;
+};
+
+// Records a span from construction until destruction as a child of the active
+// context, and makes the span the active context in the meantime. Does nothing
+// unless the active context is sampled.
+class ScopedSpan {
+ public:
+  explicit ScopedSpan(absl::string_view name);
+  ~ScopedSpan();
+
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+  // Whether the span is recorded.
+  bool recording() const { return record_ != nullptr; }
+
+  // Context of the span, or the (unsampled) active context if the span isn't
+  // recorded.
+  const TraceContext& context() const { return context_; }
+
+  void AddAttribute(absl::string_view name, absl::string_view value);
+
+ private:
+  const TraceContext previous_;
+  TraceContext context_;
+  std::unique_ptr<SpanRecord> record_;
+};
+
+// Records a span from `start` to `end` as a child of the active context if it
+// is sampled. Used where the interval has already been measured.
+void RecordSpan(absl::string_view name, absl::Time start, absl::Time end);
+
+// Whether the active context is sampled, i.e whether spans are recorded.
+inline bool IsTracing() { return CurrentTraceContext().sampled; }
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_TRACING_H_
@@ -0,0 +1,176 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/tracing.h"
+
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/numeric/int128.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+class TracingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    exporter_ = std::make_shared<InMemorySpanExporter>();
+  }
+
+  void TearDown() override { ConfigureTracing(TracingOptions()); }
+
+  void Enable(double sample_rate) {
+    TracingOptions options;
+    options.sample_rate = sample_rate;
+    options.exporter = exporter_;
+    ConfigureTracing(options);
+  }
+
+  std::shared_ptr<InMemorySpanExporter> exporter_;
+};
+
+TEST(TraceContextTest, TraceparentRoundTrip) {
+  TraceContext context;
+  context.trace_id = absl::MakeUint128(0x0af7651916cd43dd, 0x8448eb211c80319c);
+  context.span_id = 0xb7ad6b7169203331;
+  context.sampled = true;
+  EXPECT_EQ(context.ToTraceparent(),
+            "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01");
+
+  TraceContext parsed;
+  ASSERT_TRUE(
+      TraceContext::FromTraceparent(context.ToTraceparent(), &parsed));
+  EXPECT_EQ(parsed.trace_id, context.trace_id);
+  EXPECT_EQ(parsed.span_id, context.span_id);
+  EXPECT_TRUE(parsed.sampled);
+
+  context.sampled = false;
+  ASSERT_TRUE(
+      TraceContext::FromTraceparent(context.ToTraceparent(), &parsed));
+  EXPECT_FALSE(parsed.sampled);
+}
+
+TEST(TraceContextTest, FromTraceparentRejectsMalformedHeaders) {
+  TraceContext context;
+  for (const char* header : {
+           "",
+           "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331",
+           "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01-",
+           "00-0AF7651916CD43DD8448EB211C80319C-b7ad6b7169203331-01",
+           "00-00000000000000000000000000000000-b7ad6b7169203331-01",
+           "00-0af7651916cd43dd8448eb211c80319c-0000000000000000-01",
+           "ff-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01",
+           "00_0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01",
+       }) {
+    EXPECT_FALSE(TraceContext::FromTraceparent(header, &context)) << header;
+  }
+}
+
+TEST(TraceContextTest, FromTraceparentAcceptsFieldsOfLaterVersions) {
+  TraceContext context;
+  EXPECT_TRUE(TraceContext::FromTraceparent(
+      "01-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01-extra",
+      &context));
+  EXPECT_TRUE(context.sampled);
+}
+
+TEST_F(TracingTest, StartTraceIsInvalidWhenDisabled) {
+  EXPECT_FALSE(StartTrace().valid());
+}
+
+TEST_F(TracingTest, StartTraceSamplesBySampleRate) {
+  Enable(0);
+  TraceContext context = StartTrace();
+  EXPECT_TRUE(context.valid());
+  EXPECT_FALSE(context.sampled);
+
+  Enable(1);
+  context = StartTrace();
+  EXPECT_TRUE(context.valid());
+  EXPECT_TRUE(context.sampled);
+}
+
+TEST_F(TracingTest, SpansAreNestedUnderActiveContext) {
+  Enable(1);
+  const TraceContext root = StartTrace();
+  {
+    ScopedTraceContext active(root);
+    ScopedSpan outer("outer");
+    EXPECT_TRUE(outer.recording());
+    outer.AddAttribute("key", "value");
+    {
+      ScopedSpan inner("inner");
+      EXPECT_EQ(CurrentTraceContext().span_id, inner.context().span_id);
+      const absl::Time start = absl::Now();
+      RecordSpan("measured", start, start + absl::Microseconds(1));
+    }
+    EXPECT_EQ(CurrentTraceContext().span_id, outer.context().span_id);
+  }
+  EXPECT_FALSE(CurrentTraceContext().valid());
+
+  std::vector<SpanRecord> spans = exporter_->TakeSpans();
+  ASSERT_EQ(spans.size(), 3);
+  EXPECT_EQ(spans[0].name, "measured");
+  EXPECT_EQ(spans[1].name, "inner");
+  EXPECT_EQ(spans[2].name, "outer");
+  for (const auto& span : spans) {
+    EXPECT_EQ(span.trace_id, root.trace_id);
+    EXPECT_LE(span.start, span.end);
+  }
+  EXPECT_EQ(spans[0].parent_span_id, spans[1].span_id);
+  EXPECT_EQ(spans[1].parent_span_id, spans[2].span_id);
+  EXPECT_EQ(spans[2].parent_span_id, root.span_id);
+  EXPECT_THAT(spans[2].attributes,
+              ::testing::ElementsAre(std::make_pair("key", "value")));
+}
+
+TEST_F(TracingTest, UnsampledTracesAreNotRecorded) {
+  Enable(0);
+  {
+    ScopedTraceContext active(StartTrace());
+    ScopedSpan span("span");
+    EXPECT_FALSE(span.recording());
+    RecordSpan("measured", absl::Now(), absl::Now());
+  }
+  {
+    // No active context.
+    ScopedSpan span("span");
+    EXPECT_FALSE(span.recording());
+  }
+  EXPECT_TRUE(exporter_->TakeSpans().empty());
+}
+
+TEST_F(TracingTest, ActiveContextIsThreadLocal) {
+  Enable(1);
+  ScopedTraceContext active(StartTrace());
+  auto thread = StartThread("TracingTest", [] {
+    EXPECT_FALSE(CurrentTraceContext().valid());
+    ScopedSpan span("span");
+    EXPECT_FALSE(span.recording());
+  });
+  thread = nullptr;
+  EXPECT_TRUE(exporter_->TakeSpans().empty());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
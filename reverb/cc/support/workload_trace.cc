@@ -0,0 +1,277 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/workload_trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/workload_trace.pb.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/file_system.h"
+#include "tensorflow/core/platform/tstring.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Maximum size of `described_chunks_`.
+constexpr int kMaxDescribedChunks = 1 << 20;
+
+}  // namespace
+
+constexpr int WorkloadTraceWriter::kEventsPerBlock;
+constexpr int WorkloadTraceWriter::kMaxQueuedBlocks;
+constexpr absl::Duration WorkloadTraceWriter::kFlushInterval;
+
+tensorflow::Status WorkloadTraceWriter::Create(
+    const std::string& path, std::unique_ptr<WorkloadTraceWriter>* writer) {
+  std::unique_ptr<tensorflow::WritableFile> file;
+  TF_RETURN_IF_ERROR(tensorflow::Env::Default()->NewWritableFile(path, &file));
+  *writer = absl::WrapUnique(new WorkloadTraceWriter(std::move(file)));
+  return tensorflow::Status::OK();
+}
+
+WorkloadTraceWriter::WorkloadTraceWriter(
+    std::unique_ptr<tensorflow::WritableFile> file)
+    : file_(std::move(file)),
+      record_writer_(
+          absl::make_unique<tensorflow::io::RecordWriter>(file_.get())) {
+  thread_ = StartThread("WorkloadTraceWriter", [this] { WriteLoop(); });
+}
+
+WorkloadTraceWriter::~WorkloadTraceWriter() { Close().IgnoreError(); }
+
+WorkloadTraceEvent* WorkloadTraceWriter::AddEvent(absl::string_view table) {
+  if (closed_) return nullptr;
+
+  auto it = table_indices_.find(table);
+  if (it == table_indices_.end()) {
+    it = table_indices_.emplace(std::string(table), tables_.size()).first;
+    tables_.push_back(std::string(table));
+    block_.add_tables(std::string(table));
+  }
+
+  const int64_t now_ns = absl::GetCurrentTimeNanos();
+  if (block_.events_size() == 0) {
+    block_.set_start_time_ns(now_ns);
+    last_event_ns_ = now_ns;
+  }
+  WorkloadTraceEvent* event = block_.add_events();
+  event->set_time_delta_ns(std::max<int64_t>(0, now_ns - last_event_ns_));
+  event->set_table(it->second);
+  last_event_ns_ = std::max(last_event_ns_, now_ns);
+  return event;
+}
+
+void WorkloadTraceWriter::MaybeFinishBlock() {
+  if (block_.events_size() < kEventsPerBlock) return;
+
+  if (queued_blocks_.size() < kMaxQueuedBlocks) {
+    FinishBlock();
+    return;
+  }
+
+  // The writer has fallen behind so the events of the block are dropped.
+  // Chunks described by these events have to be described again.
+  num_dropped_events_ += block_.events_size();
+  block_.clear_events();
+  described_chunks_.clear();
+}
+
+void WorkloadTraceWriter::FinishBlock() {
+  if (block_.events_size() == 0) return;
+  block_.set_num_dropped_events(num_dropped_events_);
+  num_dropped_events_ = 0;
+  queued_blocks_.push_back(std::move(block_));
+  block_ = WorkloadTraceBlock();
+  for (const auto& table : tables_) {
+    block_.add_tables(table);
+  }
+}
+
+bool WorkloadTraceWriter::HasBlocksToWrite() const {
+  return closed_ || !queued_blocks_.empty();
+}
+
+void WorkloadTraceWriter::RecordInsert(
+    absl::string_view table, const PrioritizedItem& item,
+    absl::Span<const std::shared_ptr<ChunkStore::Chunk>> chunks) {
+  absl::MutexLock lock(&mu_);
+  WorkloadTraceEvent* event = AddEvent(table);
+  if (event == nullptr) return;
+
+  auto* insert = event->mutable_insert();
+  insert->set_key(item.key());
+  insert->set_priority(item.priority());
+  insert->set_offset(item.sequence_range().offset());
+  insert->set_length(item.sequence_range().length());
+  insert->set_num_columns(item.columns_size());
+
+  if (described_chunks_.size() + chunks.size() > kMaxDescribedChunks) {
+    described_chunks_.clear();
+  }
+  for (const auto& chunk : chunks) {
+    const uint64_t key = chunk->data().chunk_key();
+    insert->add_chunk_keys(key);
+    if (!described_chunks_.insert(key).second) continue;
+
+    auto* new_chunk = insert->add_new_chunks();
+    new_chunk->set_chunk_key(key);
+    new_chunk->set_num_bytes(chunk->DataByteSizeLong());
+    const auto& range = chunk->data().sequence_range();
+    new_chunk->set_episode_id(range.episode_id());
+    new_chunk->set_start(range.start());
+    new_chunk->set_end(range.end());
+  }
+  MaybeFinishBlock();
+}
+
+void WorkloadTraceWriter::RecordSample(absl::string_view table, int batch_size,
+                                       int num_samples) {
+  absl::MutexLock lock(&mu_);
+  WorkloadTraceEvent* event = AddEvent(table);
+  if (event == nullptr) return;
+  event->mutable_sample()->set_batch_size(batch_size);
+  event->mutable_sample()->set_num_samples(num_samples);
+  MaybeFinishBlock();
+}
+
+void WorkloadTraceWriter::RecordMutate(
+    absl::string_view table, absl::Span<const KeyWithPriority> updates,
+    absl::Span<const uint64_t> deletes) {
+  absl::MutexLock lock(&mu_);
+  WorkloadTraceEvent* event = AddEvent(table);
+  if (event == nullptr) return;
+  auto* mutate = event->mutable_mutate();
+  for (const auto& update : updates) {
+    mutate->add_update_keys(update.key());
+    mutate->add_update_priorities(update.priority());
+  }
+  for (uint64_t key : deletes) {
+    mutate->add_delete_keys(key);
+  }
+  MaybeFinishBlock();
+}
+
+void WorkloadTraceWriter::RecordReset(absl::string_view table) {
+  absl::MutexLock lock(&mu_);
+  WorkloadTraceEvent* event = AddEvent(table);
+  if (event == nullptr) return;
+  event->mutable_reset();
+  MaybeFinishBlock();
+}
+
+void WorkloadTraceWriter::WriteLoop() {
+  while (true) {
+    std::deque<WorkloadTraceBlock> blocks;
+    bool closed;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.AwaitWithTimeout(
+          absl::Condition(this, &WorkloadTraceWriter::HasBlocksToWrite),
+          kFlushInterval);
+      // Incomplete blocks are written on close and when the interval passed
+      // without the block filling up.
+      if (queued_blocks_.empty()) FinishBlock();
+      blocks.swap(queued_blocks_);
+      closed = closed_;
+    }
+
+    tensorflow::Status status;
+    for (const auto& block : blocks) {
+      if (!status.ok()) break;
+      status = record_writer_->WriteRecord(block.SerializeAsString());
+    }
+    if (status.ok() && !blocks.empty()) status = record_writer_->Flush();
+
+    if (!status.ok()) {
+      REVERB_LOG(REVERB_ERROR) << "Failed to write workload trace: " << status;
+      absl::MutexLock lock(&mu_);
+      status_ = status;
+      closed_ = true;
+      return;
+    }
+    if (closed) return;
+  }
+}
+
+tensorflow::Status WorkloadTraceWriter::Close() {
+  {
+    absl::MutexLock lock(&mu_);
+    if (thread_ == nullptr) return status_;
+    // The thread writes everything recorded up to this point before exiting.
+    FinishBlock();
+    closed_ = true;
+  }
+  // Joins the thread.
+  thread_ = nullptr;
+
+  absl::MutexLock lock(&mu_);
+  if (record_writer_ != nullptr) {
+    tensorflow::Status status = record_writer_->Close();
+    if (status.ok()) status = file_->Close();
+    if (status_.ok()) status_ = status;
+    record_writer_ = nullptr;
+  }
+  return status_;
+}
+
+tensorflow::Status ReadWorkloadTrace(const std::string& path,
+                                     std::vector<WorkloadTraceBlock>* blocks) {
+  std::unique_ptr<tensorflow::RandomAccessFile> file;
+  TF_RETURN_IF_ERROR(
+      tensorflow::Env::Default()->NewRandomAccessFile(path, &file));
+  tensorflow::io::RecordReader reader(file.get());
+
+  blocks->clear();
+  tensorflow::uint64 offset = 0;
+  tensorflow::tstring record;
+  while (true) {
+    tensorflow::Status status = reader.ReadRecord(&offset, &record);
+    if (tensorflow::errors::IsOutOfRange(status)) break;
+    TF_RETURN_IF_ERROR(status);
+    blocks->emplace_back();
+    if (!blocks->back().ParseFromArray(record.data(), record.size())) {
+      return tensorflow::errors::DataLoss("Could not parse block ",
+                                          blocks->size() - 1,
+                                          " of workload trace ", path);
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,132 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_WORKLOAD_TRACE_H_
+#define REVERB_CC_SUPPORT_WORKLOAD_TRACE_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/workload_trace.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Records the operations on the tables of a server to a trace file (see
+// workload_trace.proto). The events are buffered in memory and written by a
+// background thread, so recording never waits for the file. If the thread
+// falls behind then new events are dropped, and counted, rather than slowing
+// down the tables. The `Record` methods are thread safe.
+class WorkloadTraceWriter {
+ public:
+  // Maximum number of events per `WorkloadTraceBlock`.
+  static constexpr int kEventsPerBlock = 4096;
+
+  // Maximum number of complete blocks waiting to be written.
+  static constexpr int kMaxQueuedBlocks = 64;
+
+  // Interval at which incomplete blocks are written.
+  static constexpr absl::Duration kFlushInterval = absl::Seconds(1);
+
+  // Creates the trace file at `path`, replacing it if it exists.
+  static tensorflow::Status Create(
+      const std::string& path, std::unique_ptr<WorkloadTraceWriter>* writer);
+
+  // Calls `Close`.
+  ~WorkloadTraceWriter();
+
+  void RecordInsert(absl::string_view table, const PrioritizedItem& item,
+                    absl::Span<const std::shared_ptr<ChunkStore::Chunk>> chunks)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  void RecordSample(absl::string_view table, int batch_size, int num_samples)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  void RecordMutate(absl::string_view table,
+                    absl::Span<const KeyWithPriority> updates,
+                    absl::Span<const uint64_t> deletes)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  void RecordReset(absl::string_view table) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Writes the remaining events and closes the file. Events recorded
+  // afterwards are ignored. Returns the first error encountered while writing
+  // the trace. Must not be called concurrently with itself.
+  tensorflow::Status Close() ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  explicit WorkloadTraceWriter(std::unique_ptr<tensorflow::WritableFile> file);
+
+  // Appends an event of `table` to `block_`. Returns null if the writer has
+  // been closed.
+  WorkloadTraceEvent* AddEvent(absl::string_view table)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Queues `block_` to be written if it is full.
+  void MaybeFinishBlock() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Queues `block_`, unless it is empty, and starts a new one.
+  void FinishBlock() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  bool HasBlocksToWrite() const ABSL_SHARED_LOCKS_REQUIRED(mu_);
+
+  // Body of `thread_`.
+  void WriteLoop() ABSL_LOCKS_EXCLUDED(mu_);
+
+  std::unique_ptr<tensorflow::WritableFile> file_;
+  std::unique_ptr<tensorflow::io::RecordWriter> record_writer_;
+
+  mutable absl::Mutex mu_;
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+  tensorflow::Status status_ ABSL_GUARDED_BY(mu_);
+
+  WorkloadTraceBlock block_ ABSL_GUARDED_BY(mu_);
+  int64_t last_event_ns_ ABSL_GUARDED_BY(mu_) = 0;
+  std::deque<WorkloadTraceBlock> queued_blocks_ ABSL_GUARDED_BY(mu_);
+  int64_t num_dropped_events_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Index of each table in `WorkloadTraceBlock.tables`.
+  std::vector<std::string> tables_ ABSL_GUARDED_BY(mu_);
+  absl::flat_hash_map<std::string, int> table_indices_ ABSL_GUARDED_BY(mu_);
+
+  // Chunks which have been described by an event which was queued. Cleared
+  // when it grows too large, in which case chunks are described again.
+  absl::flat_hash_set<uint64_t> described_chunks_ ABSL_GUARDED_BY(mu_);
+
+  std::unique_ptr<Thread> thread_;
+};
+
+// Reads all blocks of the trace file at `path`.
+tensorflow::Status ReadWorkloadTrace(const std::string& path,
+                                     std::vector<WorkloadTraceBlock>* blocks);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_WORKLOAD_TRACE_H_
@@ -0,0 +1,160 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/workload_trace.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/substitute.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "reverb/cc/workload_trace.pb.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/status_matchers.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::deepmind::reverb::testing::EqualsProto;
+
+std::string MakePath() {
+  std::string name;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(&name));
+  return name;
+}
+
+std::vector<WorkloadTraceEvent> AllEvents(
+    const std::vector<WorkloadTraceBlock>& blocks) {
+  std::vector<WorkloadTraceEvent> events;
+  for (const auto& block : blocks) {
+    events.insert(events.end(), block.events().begin(), block.events().end());
+  }
+  return events;
+}
+
+TEST(WorkloadTraceWriterTest, RecordsEventsInOrder) {
+  const std::string path = MakePath();
+  std::unique_ptr<WorkloadTraceWriter> writer;
+  TF_ASSERT_OK(WorkloadTraceWriter::Create(path, &writer));
+
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks = {
+      std::make_shared<ChunkStore::Chunk>(testing::MakeChunkData(
+          10, testing::MakeSequenceRange(7, 0, 9))),
+  };
+  PrioritizedItem item = testing::MakePrioritizedItem(
+      1, 0.5, {testing::MakeChunkData(10)});
+  item.mutable_sequence_range()->set_offset(2);
+  item.mutable_sequence_range()->set_length(3);
+
+  writer->RecordInsert("a", item, chunks);
+  writer->RecordInsert("b", item, chunks);
+  writer->RecordSample("a", 16, 4);
+  writer->RecordMutate("b", {testing::MakeKeyWithPriority(1, 2)}, {3});
+  writer->RecordReset("a");
+  TF_ASSERT_OK(writer->Close());
+
+  std::vector<WorkloadTraceBlock> blocks;
+  TF_ASSERT_OK(ReadWorkloadTrace(path, &blocks));
+  ASSERT_GE(blocks.size(), 1);
+  EXPECT_THAT(blocks.back().tables(), ::testing::ElementsAre("a", "b"));
+  std::vector<WorkloadTraceEvent> events = AllEvents(blocks);
+  ASSERT_EQ(events.size(), 5);
+
+  // The chunk is only described by the first event which references it.
+  EXPECT_THAT(events[0].insert(),
+              EqualsProto(absl::Substitute(
+                  R"pb(
+                    key: 1
+                    priority: 0.5
+                    chunk_keys: 10
+                    offset: 2
+                    length: 3
+                    new_chunks {
+                      chunk_key: 10
+                      num_bytes: $0
+                      episode_id: 7
+                      start: 0
+                      end: 9
+                    }
+                  )pb",
+                  chunks[0]->DataByteSizeLong())));
+  EXPECT_EQ(events[1].table(), 1);
+  EXPECT_EQ(events[1].insert().new_chunks_size(), 0);
+  EXPECT_EQ(events[2].table(), 0);
+  EXPECT_THAT(events[2].sample(),
+              EqualsProto("batch_size: 16 num_samples: 4"));
+  EXPECT_THAT(events[3].mutate(), EqualsProto(R"pb(
+                update_keys: 1
+                update_priorities: 2
+                delete_keys: 3
+              )pb"));
+  EXPECT_TRUE(events[4].has_reset());
+}
+
+TEST(WorkloadTraceWriterTest, SplitsEventsIntoBlocks) {
+  const std::string path = MakePath();
+  std::unique_ptr<WorkloadTraceWriter> writer;
+  TF_ASSERT_OK(WorkloadTraceWriter::Create(path, &writer));
+
+  const int num_events = WorkloadTraceWriter::kEventsPerBlock + 10;
+  for (int i = 0; i < num_events; i++) {
+    writer->RecordSample(i % 2 == 0 ? "a" : "b", 1, 1);
+  }
+  TF_ASSERT_OK(writer->Close());
+
+  std::vector<WorkloadTraceBlock> blocks;
+  TF_ASSERT_OK(ReadWorkloadTrace(path, &blocks));
+  ASSERT_GE(blocks.size(), 2);
+  for (const auto& block : blocks) {
+    EXPECT_LE(block.events_size(), WorkloadTraceWriter::kEventsPerBlock);
+    EXPECT_THAT(block.tables(), ::testing::ElementsAre("a", "b"));
+  }
+
+  int64_t num_dropped = 0;
+  for (const auto& block : blocks) num_dropped += block.num_dropped_events();
+  EXPECT_EQ(AllEvents(blocks).size() + num_dropped, num_events);
+}
+
+TEST(WorkloadTraceWriterTest, EventsAfterCloseAreIgnored) {
+  const std::string path = MakePath();
+  std::unique_ptr<WorkloadTraceWriter> writer;
+  TF_ASSERT_OK(WorkloadTraceWriter::Create(path, &writer));
+  writer->RecordReset("a");
+  TF_ASSERT_OK(writer->Close());
+  writer->RecordReset("a");
+  TF_EXPECT_OK(writer->Close());
+
+  std::vector<WorkloadTraceBlock> blocks;
+  TF_ASSERT_OK(ReadWorkloadTrace(path, &blocks));
+  EXPECT_EQ(AllEvents(blocks).size(), 1);
+}
+
+TEST(ReadWorkloadTraceTest, ReturnsErrorIfFileIsMissing) {
+  std::vector<WorkloadTraceBlock> blocks;
+  EXPECT_FALSE(ReadWorkloadTrace(MakePath(), &blocks).ok());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -15,28 +15,45 @@
 #include "reverb/cc/table.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <functional>
 #include <initializer_list>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "google/protobuf/duration.pb.h"
 #include "google/protobuf/timestamp.pb.h"
 #include <cstdint>
+#include "absl/base/thread_annotations.h"
+#include "absl/container/inlined_vector.h"
 #include "absl/memory/memory.h"
+#include "absl/random/random.h"
+#include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/checkpointing/item_block.h"
 #include "reverb/cc/chunk_store.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/numa.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/support/alias_table.h"
+#include "reverb/cc/support/cleanup.h"
+#include "reverb/cc/support/incremental_hash_map.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "reverb/cc/support/reclaimer.h"
+#include "reverb/cc/support/tracing.h"
 #include "reverb/cc/table_extensions/interface.h"
 #include "tensorflow/core/platform/errors.h"
 #include "tensorflow/core/platform/status.h"
@@ -47,11 +64,13 @@ namespace {
 
 using Extensions = std::vector<std::shared_ptr<TableExtension>>;
 
-inline bool IsInsertedBefore(const PrioritizedItem& a,
-                             const PrioritizedItem& b) {
-  return a.inserted_at().seconds() < b.inserted_at().seconds() ||
-         (a.inserted_at().seconds() == b.inserted_at().seconds() &&
-          a.inserted_at().nanos() < b.inserted_at().nanos());
+// Number of items which `Checkpoint` copies per acquisition of the reader
+// lock on `data_mu_`.
+constexpr size_t kCheckpointBatchSize = 1024;
+
+inline bool IsInsertedBefore(const CompactTableItem& a,
+                             const CompactTableItem& b) {
+  return a.inserted_at_ns < b.inserted_at_ns;
 }
 
 inline void EncodeAsTimestampProto(absl::Time t,
@@ -61,61 +80,358 @@ inline void EncodeAsTimestampProto(absl::Time t,
   proto->set_nanos((t - absl::FromUnixSeconds(s)) / absl::Nanoseconds(1));
 }
 
+inline absl::Time DecodeTimestampProto(const google::protobuf::Timestamp& proto) {
+  return absl::FromUnixSeconds(proto.seconds()) +
+         absl::Nanoseconds(proto.nanos());
+}
+
+inline void EncodeAsDurationProto(absl::Duration d,
+                                  google::protobuf::Duration* proto) {
+  const int64_t s = absl::ToInt64Seconds(d);
+  proto->set_seconds(s);
+  proto->set_nanos((d - absl::Seconds(s)) / absl::Nanoseconds(1));
+}
+
+// Hands items deleted from the table over to the shared reclaimer so that the
+// items, and any chunks they were the last reference to, are deallocated away
+// from the calling thread. Must be called after the table lock is released.
+inline void ReclaimItems(std::vector<CompactTableItem> items) {
+  items.erase(std::remove_if(items.begin(), items.end(),
+                             [](const CompactTableItem& item) {
+                               return item.chunks.empty();
+                             }),
+              items.end());
+  internal::Reclaimer::Default()->ReclaimAll(std::move(items));
+}
+
+// Generator used to sample frozen tables, one per thread so that samplers
+// don't contend on it.
+absl::BitGen* ThreadBitGen() {
+  thread_local absl::BitGen bit_gen;
+  return &bit_gen;
+}
+
+// Scoped lock which records the time spent waiting to acquire `mu` in `wait`
+// and the time the lock was held in `hold`. The histograms are updated while
+// the lock is held so they can be guarded by `mu`.
+class ABSL_SCOPED_LOCKABLE InstrumentedMutexLock {
+ public:
+  InstrumentedMutexLock(absl::Mutex* mu, internal::LatencyHistogram* wait,
+                        internal::LatencyHistogram* hold)
+      ABSL_EXCLUSIVE_LOCK_FUNCTION(mu)
+      : mu_(mu), hold_(hold) {
+    const absl::Time start = absl::Now();
+    mu_->Lock();
+    acquired_at_ = absl::Now();
+    wait->Record(acquired_at_ - start);
+    internal::RecordSpan("Table::LockWait", start, acquired_at_);
+  }
+
+  ~InstrumentedMutexLock() ABSL_UNLOCK_FUNCTION() {
+    hold_->Record(absl::Now() - acquired_at_);
+    mu_->Unlock();
+  }
+
+  InstrumentedMutexLock(const InstrumentedMutexLock&) = delete;
+  InstrumentedMutexLock& operator=(const InstrumentedMutexLock&) = delete;
+
+ private:
+  absl::Mutex* const mu_;
+  internal::LatencyHistogram* const hold_;
+  absl::Time acquired_at_;
+};
+
 }  // namespace
 
+struct Table::FrozenState {
+  // `weights[i]` is the (unnormalized) sampling weight of `sampled_items[i]`.
+  FrozenState(std::vector<SampledItem> sampled_items,
+              absl::Span<const double> weights)
+      : items(std::move(sampled_items)), alias(weights) {
+    for (size_t i = 0; i < items.size(); i++) {
+      items[i].probability = alias.probability(i);
+    }
+  }
+
+  // The items which can be sampled, indexed as the weights of `alias`.
+  std::vector<SampledItem> items;
+  const internal::AliasTable alias;
+};
+
 Table::Table(std::string name, std::shared_ptr<ItemSelector> sampler,
              std::shared_ptr<ItemSelector> remover, int64_t max_size,
              int32_t max_times_sampled, std::shared_ptr<RateLimiter> rate_limiter,
              Extensions extensions,
-             absl::optional<tensorflow::StructuredValue> signature)
+             absl::optional<tensorflow::StructuredValue> signature,
+             int64_t max_bytes, absl::Duration max_age, bool index_episodes,
+             int64_t max_reserved_bytes)
     : sampler_(std::move(sampler)),
       remover_(std::move(remover)),
+      num_bytes_(0),
       num_deleted_episodes_(0),
       max_size_(max_size),
       max_times_sampled_(max_times_sampled),
+      max_bytes_(max_bytes),
+      max_reserved_bytes_(max_reserved_bytes),
+      max_age_(max_age),
       name_(std::move(name)),
       rate_limiter_(std::move(rate_limiter)),
       extensions_(std::move(extensions)),
+      mu_(rate_limiter_->table_mu_),
       signature_(std::move(signature)) {
+  sampler_uses_keys_ = sampler_->UseTableKeys(&keys_);
+  remover_uses_keys_ = remover_->UseTableKeys(&keys_);
+  if (max_reserved_bytes_ > 0) {
+    const size_t bytes_per_item =
+        internal::HashMapBytesPerElement<decltype(data_)>() + sizeof(Key) +
+        internal::HashMapBytesPerElement<decltype(episode_refs_)>() +
+        internal::HashMapBytesPerElement<
+            internal::flat_hash_map<ChunkStore::Key, ChunkRef>>() +
+        sampler_->ReservedBytesPerKey() + remover_->ReservedBytesPerKey();
+    reserved_items_ =
+        std::min<int64_t>(max_size_, max_reserved_bytes_ / bytes_per_item);
+    data_.reserve(reserved_items_);
+    keys_.reserve(reserved_items_);
+    episode_refs_.reserve(reserved_items_);
+    chunk_refs_.reserve(reserved_items_);
+    sampler_->Reserve(reserved_items_);
+    remover_->Reserve(reserved_items_);
+  }
+  if (index_episodes) {
+    episode_sampler_ =
+        absl::make_unique<PrioritizedSelector>(/*priority_exponent=*/1);
+  }
   TF_CHECK_OK(rate_limiter_->RegisterTable(this));
   for (auto& extension : extensions_) {
     TF_CHECK_OK(extension->RegisterTable(&mu_, this));
   }
+
+  if (max_age_ != absl::InfiniteDuration()) {
+    REVERB_CHECK_GT(max_age_, absl::ZeroDuration());
+    const absl::Duration granularity =
+        std::max(max_age_ / kExpiryBucketsPerMaxAge, kMinExpiryInterval);
+    expiry_queue_ =
+        absl::make_unique<internal::ExpiryQueue>(granularity, absl::Now());
+    expirer_ = absl::make_unique<internal::PeriodicClosure>(
+        [this] {
+          auto status = ExpireItems(absl::Now());
+          REVERB_LOG_IF(REVERB_ERROR, !status.ok())
+              << "Failed to delete the expired items of table " << name_
+              << ": " << status;
+        },
+        granularity, absl::StrCat("Expire_", name_));
+    TF_CHECK_OK(expirer_->Start());
+  }
 }
 
 Table::~Table() {
+  if (expirer_ != nullptr) TF_CHECK_OK(expirer_->Stop());
+  {
+    // Don't leave the tables which share the rate limiter blocked.
+    absl::MutexLock lock(&mu_);
+    if (restore_.blocks_samples) rate_limiter_->UnblockSamples(&mu_);
+  }
   rate_limiter_->UnregisterTable(&mu_, this);
   for (auto& extension : extensions_) {
     extension->UnregisterTable(&mu_, this);
   }
+
+  // The chunks may outlive the table if they are shared with other tables.
+  absl::MutexLock lock(&mu_);
+  ReleaseChunkReferences();
+
+  // The selectors may outlive the table too.
+  if (sampler_uses_keys_) sampler_->UseTableKeys(nullptr);
+  if (remover_uses_keys_) remover_->UseTableKeys(nullptr);
 }
 
 std::vector<Table::Item> Table::Copy(size_t count) const {
   std::vector<Item> items;
-  absl::MutexLock lock(&mu_);
+  absl::ReaderMutexLock lock(&data_mu_);
   items.reserve(count == 0 ? data_.size() : count);
   for (auto it = data_.cbegin();
        it != data_.cend() && (count == 0 || items.size() < count); it++) {
-    items.push_back(it->second);
+    items.push_back(ToItem(it->second));
   }
   return items;
 }
 
-tensorflow::Status Table::InsertOrAssign(Item item) {
-  auto key = item.item.key();
-  auto priority = item.item.priority();
+std::vector<Table::Key> Table::Keys() const {
+  absl::ReaderMutexLock lock(&data_mu_);
+  return keys_;
+}
 
+std::vector<Table::Item> Table::CopyItems(absl::Span<const Key> keys) const {
+  std::vector<Item> items;
+  items.reserve(keys.size());
+  absl::ReaderMutexLock lock(&data_mu_);
+  for (Key key : keys) {
+    auto it = data_.find(key);
+    if (it != data_.end()) items.push_back(ToItem(it->second));
+  }
+  return items;
+}
+
+tensorflow::Status Table::InsertOrAssign(Item item) {
   // If an item is deleted as part of the insert then we keep the data alive
   // until the lock has been released.
-  Item deleted_item;
+  std::vector<CompactTableItem> deleted_items;
+  tensorflow::Status status;
   {
-    absl::MutexLock lock(&mu_);
+    InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                               &latency_stats_.lock_hold);
+    TraceInsert(item);
+    status = InsertOrAssignInternal(std::move(item), &deleted_items);
+  }
+  ReclaimItems(std::move(deleted_items));
+  return status;
+}
 
-    /// If item already exists in table then update its priority.
-    if (data_.contains(key)) {
-      return UpdateItem(key, priority);
+std::vector<tensorflow::Status> Table::InsertOrAssignBatch(
+    std::vector<Item> items) {
+  internal::ScopedSpan span("Table::InsertOrAssignBatch");
+  // Allocate memory outside of critical section. The deleted items are kept
+  // alive until the lock has been released.
+  std::vector<tensorflow::Status> statuses(items.size());
+  std::vector<CompactTableItem> deleted_items;
+  deleted_items.reserve(items.size());
+  {
+    InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                               &latency_stats_.lock_hold);
+    // Inserts are reserved for the rest of the batch in a single step rather
+    // than waiting for the rate limiter once per item.
+    int reserved_inserts = 0;
+    for (int i = 0; i < items.size(); i++) {
+      if (auto status = CheckNotFrozen(); !status.ok()) {
+        statuses[i] = status;
+        continue;
+      }
+      if (reserved_inserts == 0 && !data_.contains(items[i].item.key())) {
+        if (auto status = rate_limiter_->AwaitCanInsert(
+                &mu_, items.size() - i, &reserved_inserts);
+            !status.ok()) {
+          statuses[i] = status;
+          continue;
+        }
+      }
+      TraceInsert(items[i]);
+      statuses[i] = InsertOrAssignInternal(std::move(items[i]), &deleted_items,
+                                           &reserved_inserts);
     }
+    // Let another insert call proceed if some of the reserved inserts turned
+    // into updates while waiting.
+    if (reserved_inserts > 0) {
+      rate_limiter_->MaybeSignalCondVars(&mu_);
+    }
+  }
+  ReclaimItems(std::move(deleted_items));
+  return statuses;
+}
+
+std::vector<tensorflow::Status> Table::InsertOrAssignGroupBatch(
+    std::vector<std::pair<Table*, Item>> items) {
+  internal::ScopedSpan span("Table::InsertOrAssignGroupBatch");
+  std::vector<tensorflow::Status> statuses(items.size());
+  if (items.empty()) return statuses;
+
+  Table* first = items.front().first;
+  for (const auto& table_and_item : items) {
+    REVERB_CHECK(table_and_item.first->SharesRateLimiterWith(*first))
+        << "Tables " << table_and_item.first->name() << " and "
+        << first->name() << " don't share a rate limiter.";
+  }
 
+  std::vector<CompactTableItem> deleted_items;
+  deleted_items.reserve(items.size());
+  {
+    InstrumentedMutexLock lock(&first->mu_, &first->latency_stats_.lock_wait,
+                               &first->latency_stats_.lock_hold);
+    const bool has_inserts = std::any_of(
+        items.begin(), items.end(), [](const std::pair<Table*, Item>& item) {
+          return !item.first->data_.contains(item.second.item.key());
+        });
+    tensorflow::Status status;
+    if (has_inserts) {
+      status = first->rate_limiter_->AwaitCanInsert(&first->mu_);
+    }
+    int inserts_left = 0;
+    for (int i = 0; i < items.size(); i++) {
+      if (!status.ok()) {
+        statuses[i] = status;
+        continue;
+      }
+      // Every new item is admitted by the single wait above.
+      int reserved_inserts = 1;
+      Table* table = items[i].first;
+      table->TraceInsert(items[i].second);
+      statuses[i] = table->InsertOrAssignInternal(
+          std::move(items[i].second), &deleted_items, &reserved_inserts);
+      inserts_left += reserved_inserts;
+    }
+    // Let another insert call proceed if all of the inserts turned into updates
+    // while waiting.
+    if (has_inserts && status.ok() && inserts_left == items.size()) {
+      first->rate_limiter_->MaybeSignalCondVars(&first->mu_);
+    }
+  }
+  ReclaimItems(std::move(deleted_items));
+  return statuses;
+}
+
+bool Table::SharesRateLimiterWith(const Table& other) const {
+  return rate_limiter_ == other.rate_limiter_;
+}
+
+std::vector<tensorflow::Status> Table::TryInsertOrAssignBatch(
+    std::vector<Item>* items) {
+  internal::ScopedSpan span("Table::TryInsertOrAssignBatch");
+  std::vector<tensorflow::Status> statuses;
+  statuses.reserve(items->size());
+  std::vector<CompactTableItem> deleted_items;
+  deleted_items.reserve(items->size());
+  {
+    InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                               &latency_stats_.lock_hold);
+    const tensorflow::Status cancelled = rate_limiter_->CheckIfCancelled();
+    for (auto& item : *items) {
+      // Once the rate limiter has been cancelled every item fails without
+      // being inserted.
+      if (!cancelled.ok()) {
+        statuses.push_back(cancelled);
+        continue;
+      }
+      // Updates never wait for the rate limiter and neither does anything
+      // once the table has been frozen.
+      if (frozen_state_ == nullptr && !data_.contains(item.item.key()) &&
+          !rate_limiter_->CanInsert(&mu_, 1)) {
+        break;
+      }
+      TraceInsert(item);
+      statuses.push_back(
+          InsertOrAssignInternal(std::move(item), &deleted_items));
+    }
+  }
+  items->erase(items->begin(), items->begin() + statuses.size());
+  ReclaimItems(std::move(deleted_items));
+  return statuses;
+}
+
+tensorflow::Status Table::InsertOrAssignInternal(
+    Item item, std::vector<CompactTableItem>* deleted_items,
+    int* reserved_inserts) {
+  TF_RETURN_IF_ERROR(CheckNotFrozen());
+  RecordNumaAccess();
+  auto key = item.item.key();
+  auto priority = item.item.priority();
+
+  /// If item already exists in table then update its priority.
+  if (data_.contains(key)) {
+    return UpdateItem(key, priority);
+  }
+
+  if (reserved_inserts != nullptr && *reserved_inserts > 0) {
+    --*reserved_inserts;
+  } else {
     // Wait for the insert to be staged. While waiting the lock is released but
     // once it returns the lock is acquired again. While waiting for the right
     // to insert the operation might have transformed into an update.
@@ -127,53 +443,78 @@ tensorflow::Status Table::InsertOrAssign(Item item) {
       rate_limiter_->MaybeSignalCondVars(&mu_);
       return UpdateItem(key, priority);
     }
+  }
 
-    // Set the insertion timestamp after the lock has been acquired as this
-    // represents the order it was inserted into the sampler and remover.
-    EncodeAsTimestampProto(absl::Now(), item.item.mutable_inserted_at());
-    data_[key] = std::move(item);
+  CompactTableItem compact_item = ToCompactItem(std::move(item));
 
-    TF_RETURN_IF_ERROR(sampler_->Insert(key, priority));
-    TF_RETURN_IF_ERROR(remover_->Insert(key, priority));
+  // Set the insertion timestamp after the lock has been acquired as this
+  // represents the order it was inserted into the sampler and remover.
+  compact_item.inserted_at_ns = absl::ToUnixNanos(absl::Now());
 
-    auto it = data_.find(key);
-    for (auto& extension : extensions_) {
-      extension->OnInsert(&mu_, it->second);
-    }
+  CompactTableItem* inserted;
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+    inserted = &EmplaceItem(std::move(compact_item));
 
-    // Increment references to the episode/s the item is referencing.
-    // We increment before a possible call to DeleteItem since the sampler can
-    // return this key.
-    for (const auto& chunk : it->second.chunks) {
-      ++episode_refs_[chunk->data().sequence_range().episode_id()];
-    }
+    // Increment references to the episode/s and chunks the item is
+    // referencing. We increment before a possible call to DeleteItem since the
+    // sampler can return this key.
+    AddReferences(*inserted);
+  }
 
-    // Remove an item if we exceeded `max_size_`.
-    if (data_.size() > max_size_) {
-      TF_RETURN_IF_ERROR(DeleteItem(remover_->Sample().key, &deleted_item));
+  {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.selector_insert);
+    TF_RETURN_IF_ERROR(sampler_->InsertAt(inserted->index, key, priority));
+    TF_RETURN_IF_ERROR(remover_->InsertAt(inserted->index, key, priority));
+  }
+
+  if (!extensions_.empty()) {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.extension_callbacks);
+    const Item inserted_item = ToItem(*inserted);
+    for (auto& extension : extensions_) {
+      extension->OnInsert(&mu_, inserted_item);
     }
+  }
 
-    // Now that the new item has been inserted and an older item has
-    // (potentially) been removed the insert can be finalized.
-    rate_limiter_->Insert(&mu_);
+  // Remove items until both `max_size_` and `max_bytes_` are respected.
+  while (data_.size() > max_size_ ||
+         (max_bytes_ > 0 && num_bytes_ > max_bytes_)) {
+    Key key_to_delete = 0;
+    {
+      internal::ScopedLatencyRecorder timer(&latency_stats_.selector_sample);
+      key_to_delete = remover_->Sample().key;
+    }
+    deleted_items->emplace_back();
+    TF_RETURN_IF_ERROR(DeleteItem(key_to_delete, &deleted_items->back()));
   }
 
+  // Now that the new item has been inserted and an older item has
+  // (potentially) been removed the insert can be finalized.
+  rate_limiter_->Insert(&mu_);
+
   return tensorflow::Status::OK();
 }
 
 tensorflow::Status Table::MutateItems(absl::Span<const KeyWithPriority> updates,
                                       absl::Span<const Key> deletes) {
-  std::vector<Item> deleted_items(deletes.size());
+  std::vector<CompactTableItem> deleted_items(deletes.size());
+  tensorflow::Status status;
   {
-    absl::MutexLock lock(&mu_);
-    for (int i = 0; i < deletes.size(); i++) {
-      TF_RETURN_IF_ERROR(DeleteItem(deletes[i], &deleted_items[i]));
+    InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                               &latency_stats_.lock_hold);
+    if (workload_trace_ != nullptr) {
+      workload_trace_->RecordMutate(name_, updates, deletes);
+    }
+    status = CheckNotFrozen();
+    for (int i = 0; i < deletes.size() && status.ok(); i++) {
+      status = DeleteItem(deletes[i], &deleted_items[i]);
     }
-    for (const auto& item : updates) {
-      TF_RETURN_IF_ERROR(UpdateItem(item.key(), item.priority()));
+    if (status.ok()) {
+      status = UpdateItems(updates);
     }
   }
-  return tensorflow::Status::OK();
+  ReclaimItems(std::move(deleted_items));
+  return status;
 }
 
 tensorflow::Status Table::Sample(SampledItem* sampled_item,
@@ -186,67 +527,236 @@ tensorflow::Status Table::Sample(SampledItem* sampled_item,
 
 tensorflow::Status Table::SampleFlexibleBatch(std::vector<SampledItem>* items,
                                               int batch_size,
-                                              absl::Duration timeout) {
+                                              absl::Duration timeout,
+                                              bool without_replacement) {
+  return MutateAndSampleFlexibleBatch({}, {}, items, batch_size, timeout,
+                                      without_replacement);
+}
+
+tensorflow::Status Table::MutateAndSampleFlexibleBatch(
+    absl::Span<const KeyWithPriority> updates, absl::Span<const Key> deletes,
+    std::vector<SampledItem>* items, int batch_size, absl::Duration timeout,
+    bool without_replacement) {
+  internal::ScopedSpan span("Table::SampleFlexibleBatch");
   // Allocate memory outside of critical section.
   items->reserve(batch_size);
 
+  // Frozen tables are sampled from their snapshot without taking the lock.
+  // Mutations take the locked path, which rejects them.
+  if (updates.empty() && deletes.empty()) {
+    if (const FrozenState* state = frozen_.load(std::memory_order_acquire);
+        state != nullptr) {
+      SampleFrozen(*state, batch_size, without_replacement, items);
+      return tensorflow::Status::OK();
+    }
+  }
+
   // Keep references to the (potentially) deleted items alive until the lock has
-  // been released.
-  std::vector<Item> deleted_items;
+  // been released and then hand them over to the reclaimer.
+  std::vector<CompactTableItem> deleted_items;
+  deleted_items.reserve(deletes.size());
+  auto reclaim_deleted_items = internal::MakeCleanup(
+      [&deleted_items] { ReclaimItems(std::move(deleted_items)); });
+
+  // Keys drawn from the sampler but not yet used. The keys for the rest of the
+  // batch are drawn in a single call and remain valid for as long as the table
+  // isn't modified, i.e. until an item is deleted or the extensions which are
+  // allowed to modify the table have been notified. Once the table has been
+  // modified the remaining keys are discarded and, to avoid drawing keys which
+  // are likely to be discarded as well, the remaining keys are drawn one by
+  // one. Without replacement the keys of the batch are only drawn once and
+  // the keys which are still in the table remain valid.
+  std::vector<ItemSelector::KeyWithProbability> samples;
+  size_t next_sample = 0;
   {
-    absl::MutexLock lock(&mu_);
-    for (int i = 0; i < batch_size; i++) {
-      if (auto status = rate_limiter_->AwaitAndFinalizeSample(&mu_, timeout);
-          !status.ok()) {
-        // Deadline exceeded errors encountered after the first call means that
-        // it was not possible to proceed with another sample without awaiting
-        // changes. If this happens then we simply return the items that we
-        // sampled so far.
-        if (i != 0 && tensorflow::errors::IsDeadlineExceeded(status)) {
-          return tensorflow::Status::OK();
+    InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                               &latency_stats_.lock_hold);
+
+    if (workload_trace_ != nullptr && (!updates.empty() || !deletes.empty())) {
+      workload_trace_->RecordMutate(name_, updates, deletes);
+    }
+    if (!updates.empty() || !deletes.empty()) {
+      TF_RETURN_IF_ERROR(CheckNotFrozen());
+    }
+    for (Key key : deletes) {
+      deleted_items.emplace_back();
+      TF_RETURN_IF_ERROR(DeleteItem(key, &deleted_items.back()));
+    }
+    if (!updates.empty()) TF_RETURN_IF_ERROR(UpdateItems(updates));
+
+    // The rate limiter admits as much of the batch as it allows in a single
+    // step. The samples are registered once the batch is complete so that
+    // waiting callers are woken once per batch rather than once per sample.
+    int reserved_samples;
+    TF_RETURN_IF_ERROR(rate_limiter_->AwaitCanSample(
+        &mu_, batch_size, &reserved_samples, timeout));
+
+    bool sample_one_at_a_time =
+        std::any_of(extensions_.begin(), extensions_.end(),
+                    [](const auto& e) { return e->CanModifyTable(); });
+    int num_samples = 0;
+    for (; num_samples < reserved_samples; num_samples++) {
+      // Deleting items, which happens when they reach `max_times_sampled_` or
+      // through the extensions, can take the table below the minimum size that
+      // the rate limiter requires for sampling. If this happens then we simply
+      // return the items that we sampled so far.
+      if (num_samples != 0 &&
+          !rate_limiter_->CanSample(&mu_, num_samples + 1)) {
+        break;
+      }
+
+      if (next_sample == samples.size()) {
+        if (without_replacement && num_samples != 0) break;
+        internal::ScopedLatencyRecorder timer(&latency_stats_.selector_sample);
+        if (without_replacement) {
+          samples = sampler_->SampleBatchWithoutReplacement(reserved_samples);
+        } else {
+          samples = sampler_->SampleBatch(
+              sample_one_at_a_time ? 1 : reserved_samples - num_samples);
         }
+        next_sample = 0;
+      }
+      const ItemSelector::KeyWithProbability sample = samples[next_sample++];
+      auto it = data_.find(sample.key);
+      if (without_replacement && it == data_.end()) break;
+      REVERB_CHECK(it != data_.end());
+
+      bool deleted;
+      if (auto status = SampleItem(&it->second, sample.probability, items,
+                                   &deleted_items, &deleted);
+          !status.ok()) {
+        rate_limiter_->Sample(&mu_, num_samples + 1);
         return status;
       }
+      if (deleted && !without_replacement) {
+        next_sample = samples.size();
+        sample_one_at_a_time = true;
+      }
+    }
+    rate_limiter_->Sample(&mu_, num_samples);
+    if (workload_trace_ != nullptr) {
+      workload_trace_->RecordSample(name_, batch_size, num_samples);
+    }
+  }
 
-      // All calls but the first should return immediately if the rate limiter
-      // does not allow for another sample call to proceed.
-      timeout = absl::ZeroDuration();
+  return tensorflow::Status::OK();
+}
 
-      auto sample = sampler_->Sample();
-      Item& item = data_[sample.key];
+void Table::SampleFrozen(const FrozenState& state, int batch_size,
+                         bool without_replacement,
+                         std::vector<SampledItem>* items) {
+  absl::BitGen* bit_gen = ThreadBitGen();
+  if (!without_replacement) {
+    for (int i = 0; i < batch_size; i++) {
+      items->push_back(state.items[state.alias.Sample(bit_gen)]);
+    }
+    return;
+  }
 
-      // Increment the sample count.
-      item.item.set_times_sampled(item.item.times_sampled() + 1);
+  // Duplicates are rejected. The number of draws is bounded so that items
+  // with a tiny probability don't stall the batch, which then ends early as
+  // it does for tables which aren't frozen.
+  const size_t num_items = std::min(
+      static_cast<size_t>(std::max(batch_size, 0)), state.items.size());
+  internal::flat_hash_set<size_t> drawn;
+  drawn.reserve(num_items);
+  for (size_t draws = 0; drawn.size() < num_items && draws < 4 * num_items + 16;
+       draws++) {
+    const size_t index = state.alias.Sample(bit_gen);
+    if (drawn.insert(index).second) items->push_back(state.items[index]);
+  }
+}
 
-      // Copy Details of the sampled item.
-      SampledItem sampled_item = {
-          .item = item.item,
-          .chunks = item.chunks,
-          .probability = sample.probability,
-          .table_size = static_cast<int64_t>(data_.size()),
-      };
-      items->push_back(std::move(sampled_item));
+tensorflow::Status Table::SampleEpisode(std::vector<SampledItem>* items,
+                                        absl::Duration timeout) {
+  internal::ScopedSpan span("Table::SampleEpisode");
+  std::vector<CompactTableItem> deleted_items;
+  auto reclaim_deleted_items = internal::MakeCleanup(
+      [&deleted_items] { ReclaimItems(std::move(deleted_items)); });
+
+  InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                             &latency_stats_.lock_hold);
+  if (episode_sampler_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition(
+        "Table ", name_, " does not index its episodes.");
+  }
 
-      // Notify extensions which item was sampled.
-      for (auto& extension : extensions_) {
-        extension->OnSample(&mu_, item);
-      }
+  int reserved_samples;
+  TF_RETURN_IF_ERROR(
+      rate_limiter_->AwaitCanSample(&mu_, 1, &reserved_samples, timeout));
+  if (episodes_.empty()) {
+    return tensorflow::errors::FailedPrecondition(
+        "Table ", name_, " holds no items which reference chunks.");
+  }
 
-      // If there is an upper bound of the number of times an item can be
-      // sampled and it is now reached then delete the item before the lock is
-      // released.
-      if (item.item.times_sampled() == max_times_sampled_) {
-        deleted_items.emplace_back();
-        TF_RETURN_IF_ERROR(DeleteItem(item.item.key(), &deleted_items.back()));
-      }
+  ItemSelector::KeyWithProbability episode;
+  {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.selector_sample);
+    episode = episode_sampler_->Sample();
+  }
+
+  // The keys are copied as sampled items can be deleted from the episode.
+  const std::vector<Key> keys = episodes_.at(episode.key).keys;
+  items->reserve(keys.size());
+  for (Key key : keys) {
+    // Extensions can delete items of the episode while it is sampled.
+    auto it = data_.find(key);
+    if (it == data_.end()) continue;
+    bool deleted;
+    if (auto status = SampleItem(&it->second, episode.probability, items,
+                                 &deleted_items, &deleted);
+        !status.ok()) {
+      rate_limiter_->Sample(&mu_, items->size());
+      return status;
     }
   }
+  rate_limiter_->Sample(&mu_, items->size());
+  return tensorflow::Status::OK();
+}
 
+tensorflow::Status Table::SampleItem(
+    CompactTableItem* item, double probability,
+    std::vector<SampledItem>* items,
+    std::vector<CompactTableItem>* deleted_items, bool* deleted) {
+  RecordNumaAccess();
+
+  // Increment the sample count.
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+    RecordPreImage(item->key);
+    item->times_sampled++;
+  }
+
+  // Copy Details of the sampled item.
+  SampledItem sampled_item = {
+      .item = ToPrioritizedItem(*item),
+      .chunks = {item->chunks.begin(), item->chunks.end()},
+      .probability = probability,
+      .table_size = static_cast<int64_t>(data_.size()),
+  };
+  items->push_back(std::move(sampled_item));
+
+  // Notify extensions which item was sampled.
+  if (!extensions_.empty()) {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.extension_callbacks);
+    const Item materialized_item{items->back().item, items->back().chunks};
+    for (auto& extension : extensions_) {
+      extension->OnSample(&mu_, materialized_item);
+    }
+  }
+
+  // If there is an upper bound of the number of times an item can be sampled
+  // and it is now reached then delete the item before the lock is released.
+  *deleted = item->times_sampled == max_times_sampled_;
+  if (*deleted) {
+    deleted_items->emplace_back();
+    TF_RETURN_IF_ERROR(DeleteItem(item->key, &deleted_items->back()));
+  }
   return tensorflow::Status::OK();
 }
 
 int64_t Table::size() const {
-  absl::MutexLock lock(&mu_);
+  absl::ReaderMutexLock lock(&data_mu_);
   return data_.size();
 }
 
@@ -254,41 +764,185 @@ const std::string& Table::name() const { return name_; }
 
 TableInfo Table::info() const {
   TableInfo info;
-
-  info.set_name(name_);
-  info.set_max_size(max_size_);
-  info.set_max_times_sampled(max_times_sampled_);
-
   if (signature_) {
     *info.mutable_signature() = *signature_;
   }
 
   absl::MutexLock lock(&mu_);
-  *info.mutable_rate_limiter_info() = rate_limiter_->Info(&mu_);
-  *info.mutable_sampler_options() = sampler_->options();
-  *info.mutable_remover_options() = remover_->options();
-  info.set_current_size(data_.size());
-  info.set_num_episodes(episode_refs_.size());
-  info.set_num_deleted_episodes(num_deleted_episodes_);
-
+  LockedFillInfo(&info);
   return info;
 }
 
+std::shared_ptr<const TableInfo> Table::InfoSnapshot() const {
+  std::shared_ptr<const InfoSnapshotEntry> snapshot =
+      std::atomic_load(&info_snapshot_);
+  const absl::Time now = absl::Now();
+  const absl::Duration age = snapshot == nullptr
+                                 ? absl::InfiniteDuration()
+                                 : now - snapshot->taken_at;
+
+  // Only waits for `mu_` if the snapshot is too old to be returned.
+  if (age >= kMaxInfoSnapshotAge) {
+    mu_.Lock();
+  } else if (age < kInfoSnapshotRefreshInterval || !mu_.TryLock()) {
+    return std::shared_ptr<const TableInfo>(snapshot, &snapshot->info);
+  }
+  auto entry = std::make_shared<InfoSnapshotEntry>();
+  LockedFillInfo(&entry->info);
+  mu_.Unlock();
+
+  entry->taken_at = now;
+  snapshot = std::move(entry);
+  std::atomic_store(&info_snapshot_, snapshot);
+  return std::shared_ptr<const TableInfo>(snapshot, &snapshot->info);
+}
+
+void Table::ExportMetrics(internal::MetricsWriter* writer) const {
+  const std::shared_ptr<const TableInfo> snapshot = InfoSnapshot();
+  const internal::MetricLabels labels = {{"table", name_}};
+  writer->AddGauge("reverb_table_size", "Number of items in the table.",
+                   labels, snapshot->current_size());
+  writer->AddGauge("reverb_table_max_size",
+                   "Maximum number of items in the table.", labels,
+                   snapshot->max_size());
+  writer->AddGauge("reverb_table_bytes",
+                   "Size of the unique chunks referenced by the table.",
+                   labels, snapshot->num_bytes());
+  writer->AddGauge("reverb_table_chunks",
+                   "Number of unique chunks referenced by the table.", labels,
+                   snapshot->num_chunks());
+  writer->AddGauge("reverb_table_episodes",
+                   "Number of episodes in the table.", labels,
+                   snapshot->num_episodes());
+  writer->AddCounter("reverb_table_deleted_episodes_total",
+                     "Number of episodes deleted from the table.", labels,
+                     snapshot->num_deleted_episodes());
+  writer->AddCounter("reverb_table_expired_items_total",
+                     "Number of items deleted as they reached max_age.",
+                     labels, snapshot->num_expired_items());
+  if (snapshot->has_numa()) {
+    for (const auto& locality :
+         {std::make_pair("local", snapshot->numa().num_local_accesses()),
+          std::make_pair("remote", snapshot->numa().num_remote_accesses())}) {
+      internal::MetricLabels locality_labels = labels;
+      locality_labels.emplace_back("locality", locality.first);
+      writer->AddCounter(
+          "reverb_table_numa_accesses_total",
+          "Number of inserts and samples by the NUMA node they ran on.",
+          locality_labels, locality.second);
+    }
+  }
+  RateLimiter::ExportMetrics(snapshot->rate_limiter_info(), labels, writer);
+
+  const TableLatencyStats& latency = snapshot->latency_stats();
+  writer->AddHistogram("reverb_table_lock_wait_seconds",
+                       "Time spent waiting for the table lock.", labels,
+                       latency.lock_wait());
+  writer->AddHistogram("reverb_table_lock_hold_seconds",
+                       "Time the table lock is held per call.", labels,
+                       latency.lock_hold());
+  for (const auto& op :
+       {std::make_pair("insert", &latency.selector_insert()),
+        std::make_pair("sample", &latency.selector_sample()),
+        std::make_pair("update", &latency.selector_update()),
+        std::make_pair("delete", &latency.selector_delete())}) {
+    internal::MetricLabels op_labels = labels;
+    op_labels.emplace_back("op", op.first);
+    writer->AddHistogram("reverb_table_selector_seconds",
+                         "Time spent in the selectors of the table.",
+                         op_labels, *op.second);
+  }
+  writer->AddHistogram("reverb_table_extension_callbacks_seconds",
+                       "Time spent in the extensions of the table.", labels,
+                       latency.extension_callbacks());
+}
+
+void Table::LockedFillInfo(TableInfo* info) const {
+  info->set_name(name_);
+  info->set_max_size(max_size_);
+  info->set_max_times_sampled(max_times_sampled_);
+  info->set_max_bytes(max_bytes_);
+  if (max_age_ != absl::InfiniteDuration()) {
+    EncodeAsDurationProto(max_age_, info->mutable_max_age());
+  }
+  info->set_num_expired_items(num_expired_items_);
+  info->set_frozen(frozen_state_ != nullptr);
+  if (numa_node_ >= 0) {
+    TableNumaInfo* numa = info->mutable_numa();
+    numa->set_node(numa_node_);
+    numa->set_num_local_accesses(
+        num_numa_local_accesses_.load(std::memory_order_relaxed));
+    numa->set_num_remote_accesses(
+        num_numa_remote_accesses_.load(std::memory_order_relaxed));
+  }
+  info->mutable_item_rules()->Add(item_rules_.begin(), item_rules_.end());
+  *info->mutable_rate_limiter_info() = rate_limiter_->Info(&mu_);
+  *info->mutable_sampler_options() = sampler_->options();
+  info->set_sampler_total_weight(sampler_->TotalWeight());
+  *info->mutable_remover_options() = remover_->options();
+  info->set_current_size(data_.size());
+  info->set_num_episodes(episode_refs_.size());
+  info->set_num_deleted_episodes(num_deleted_episodes_);
+  info->set_num_bytes(num_bytes_);
+  info->set_num_chunks(chunk_refs_.size());
+  *info->mutable_latency_stats() = latency_stats_.ToProto();
+  if (restore_.started) {
+    auto* progress = info->mutable_restore_progress();
+    progress->set_in_progress(restore_.in_progress);
+    progress->set_total_items(restore_.num_items);
+    progress->set_restored_items(restore_.num_restored);
+    progress->set_ready_to_sample(!restore_.blocks_samples);
+  }
+}
+
 void Table::Close() {
   absl::MutexLock lock(&mu_);
   rate_limiter_->Cancel(&mu_);
 }
 
-tensorflow::Status Table::DeleteItem(Table::Key key, Item* deleted_item) {
+tensorflow::Status Table::DeleteItem(Table::Key key,
+                                     CompactTableItem* deleted_item) {
   auto it = data_.find(key);
   if (it == data_.end()) return tensorflow::Status::OK();
 
-  for (auto& extension : extensions_) {
-    extension->OnDelete(&mu_, it->second);
+  if (!extensions_.empty()) {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.extension_callbacks);
+    const Item item = ToItem(it->second);
+    for (auto& extension : extensions_) {
+      extension->OnDelete(&mu_, item);
+    }
+  }
+
+  const ItemSelector::Slot slot = it->second.index;
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+
+    // Decrement counts to the episodes and chunks the item is referencing.
+    RemoveReferences(it->second);
+    EraseItem(it, deleted_item);
+  }
+  rate_limiter_->Delete(&mu_);
+
+  internal::ScopedLatencyRecorder timer(&latency_stats_.selector_delete);
+  TF_RETURN_IF_ERROR(sampler_->DeleteAt(slot, key));
+  TF_RETURN_IF_ERROR(remover_->DeleteAt(slot, key));
+  return tensorflow::Status::OK();
+}
+
+void Table::AddReferences(const CompactTableItem& item) {
+  for (const auto& chunk : item.chunks) {
+    ++episode_refs_[chunk->data().sequence_range().episode_id()];
+    ChunkRef& ref = chunk_refs_[chunk->data().chunk_key()];
+    if (++ref.count == 1) {
+      ref.chunk = chunk.get();
+      chunk->AddTableReference();
+      num_bytes_ += chunk->DataByteSizeLong();
+    }
   }
+}
 
-  // Decrement counts to the episodes the item is referencing.
-  for (const auto& chunk : it->second.chunks) {
+void Table::RemoveReferences(const CompactTableItem& item) {
+  for (const auto& chunk : item.chunks) {
     auto ep_it =
         episode_refs_.find(chunk->data().sequence_range().episode_id());
     REVERB_CHECK(ep_it != episode_refs_.end());
@@ -296,14 +950,127 @@ tensorflow::Status Table::DeleteItem(Table::Key key, Item* deleted_item) {
       episode_refs_.erase(ep_it);
       num_deleted_episodes_++;
     }
+
+    auto chunk_it = chunk_refs_.find(chunk->data().chunk_key());
+    REVERB_CHECK(chunk_it != chunk_refs_.end());
+    if (--(chunk_it->second.count) == 0) {
+      chunk_refs_.erase(chunk_it);
+      chunk->RemoveTableReference();
+      num_bytes_ -= chunk->DataByteSizeLong();
+    }
+  }
+}
+
+void Table::ReleaseChunkReferences() {
+  for (auto& entry : chunk_refs_) {
+    entry.second.chunk->RemoveTableReference();
+  }
+  chunk_refs_.clear();
+}
+
+void Table::RecordPreImage(Key key) {
+  if (checkpoint_ == nullptr) return;
+  auto& pre_images = checkpoint_->pre_images;
+  if (pre_images.contains(key)) return;
+
+  auto it = data_.find(key);
+  if (it != data_.end()) {
+    pre_images.emplace(key, it->second);
+    return;
+  }
+
+  // The key isn't in the table so it either did not exist when the checkpoint
+  // started or it was removed by a `Reset` since.
+  if (checkpoint_->reset_data != nullptr) {
+    auto reset_it = checkpoint_->reset_data->find(key);
+    if (reset_it != checkpoint_->reset_data->end()) {
+      pre_images.emplace(key, reset_it->second);
+      return;
+    }
   }
+  pre_images.emplace(key, absl::nullopt);
+}
 
-  *deleted_item = std::move(it->second);
+CompactTableItem& Table::EmplaceItem(CompactTableItem item) {
+  RecordPreImage(item.key);
+  const Key key = item.key;
+  item.index = static_cast<int32_t>(keys_.size());
+  keys_.push_back(key);
+  if (expiry_queue_ != nullptr) {
+    expiry_queue_->Push(absl::FromUnixNanos(item.inserted_at_ns) + max_age_,
+                        {key, item.inserted_at_ns});
+  }
+  IndexEpisodeItem(item);
+  return data_.emplace(key, std::move(item)).first->second;
+}
+
+void Table::EraseItem(ItemMap::iterator it, CompactTableItem* erased_item) {
+  RecordPreImage(it->first);
+
+  // Fill the position of the erased key with the last key. The moved key has
+  // to be recorded as a checkpoint in progress might already have passed its
+  // new position without having reached its old one.
+  const int32_t index = it->second.index;
+  const Key last_key = keys_.back();
+  if (last_key != it->first) {
+    RecordPreImage(last_key);
+    keys_[index] = last_key;
+    data_.find(last_key)->second.index = index;
+  }
+  keys_.pop_back();
+  UnindexEpisodeItem(it->second);
+
+  *erased_item = std::move(it->second);
   data_.erase(it);
-  rate_limiter_->Delete(&mu_);
-  TF_RETURN_IF_ERROR(sampler_->Delete(key));
-  TF_RETURN_IF_ERROR(remover_->Delete(key));
-  return tensorflow::Status::OK();
+}
+
+void Table::IndexEpisodeItem(const CompactTableItem& item) {
+  if (episode_sampler_ == nullptr || item.chunks.empty()) return;
+  const uint64_t episode_id =
+      item.chunks.front()->data().sequence_range().episode_id();
+  auto [it, inserted] = episodes_.try_emplace(episode_id);
+  it->second.keys.push_back(item.key);
+  it->second.priority += std::max(item.priority, 0.0);
+  if (inserted) {
+    TF_CHECK_OK(episode_sampler_->Insert(episode_id, it->second.priority));
+  } else {
+    TF_CHECK_OK(episode_sampler_->Update(episode_id, it->second.priority));
+  }
+}
+
+void Table::UnindexEpisodeItem(const CompactTableItem& item) {
+  if (episode_sampler_ == nullptr || item.chunks.empty()) return;
+  const uint64_t episode_id =
+      item.chunks.front()->data().sequence_range().episode_id();
+  auto it = episodes_.find(episode_id);
+  REVERB_CHECK(it != episodes_.end());
+  std::vector<Key>& keys = it->second.keys;
+
+  // Episodes are small so a linear scan is cheap, and it preserves the order
+  // of the remaining items.
+  keys.erase(std::find(keys.begin(), keys.end(), item.key));
+  if (keys.empty()) {
+    TF_CHECK_OK(episode_sampler_->Delete(episode_id));
+    episodes_.erase(it);
+    return;
+  }
+  // Rounding errors must not take the sum below zero.
+  it->second.priority =
+      std::max(it->second.priority - std::max(item.priority, 0.0), 0.0);
+  TF_CHECK_OK(episode_sampler_->Update(episode_id, it->second.priority));
+}
+
+void Table::UpdateEpisodePriority(const CompactTableItem& item,
+                                  double old_priority) {
+  if (episode_sampler_ == nullptr || item.chunks.empty()) return;
+  const uint64_t episode_id =
+      item.chunks.front()->data().sequence_range().episode_id();
+  EpisodeEntry& episode = episodes_.at(episode_id);
+  episode.priority =
+      std::max(episode.priority - std::max(old_priority, 0.0) +
+                   std::max(item.priority, 0.0),
+               0.0);
+  TF_CHECK_OK(episode_sampler_->Update(episode_id, episode.priority));
 }
 
 tensorflow::Status Table::UpdateItem(
@@ -312,74 +1079,412 @@ tensorflow::Status Table::UpdateItem(
   if (it == data_.end()) {
     return tensorflow::Status::OK();
   }
-  it->second.item.set_priority(priority);
-  TF_RETURN_IF_ERROR(sampler_->Update(key, priority));
-  TF_RETURN_IF_ERROR(remover_->Update(key, priority));
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+    RecordPreImage(key);
+    const double old_priority = it->second.priority;
+    it->second.priority = priority;
+    UpdateEpisodePriority(it->second, old_priority);
+  }
+  {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.selector_update);
+    TF_RETURN_IF_ERROR(sampler_->UpdateAt(it->second.index, key, priority));
+    TF_RETURN_IF_ERROR(remover_->UpdateAt(it->second.index, key, priority));
+  }
 
-  for (auto& extension : extensions_) {
-    if (std::none_of(
-            exclude.begin(), exclude.end(),
-            [ext_ptr = extension.get()](auto e) { return e == ext_ptr; })) {
-      extension->OnUpdate(&mu_, it->second);
+  if (!extensions_.empty()) {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.extension_callbacks);
+    const Item item = ToItem(it->second);
+    for (auto& extension : extensions_) {
+      if (std::none_of(
+              exclude.begin(), exclude.end(),
+              [ext_ptr = extension.get()](auto e) { return e == ext_ptr; })) {
+        extension->OnUpdate(&mu_, item);
+      }
     }
   }
 
   return tensorflow::Status::OK();
 }
 
-tensorflow::Status Table::Reset() {
-  absl::MutexLock lock(&mu_);
+tensorflow::Status Table::UpdateItems(
+    absl::Span<const KeyWithPriority> updates) {
+  std::vector<ItemSelector::Slot> slots;
+  std::vector<Key> keys;
+  std::vector<double> priorities;
+  slots.reserve(updates.size());
+  keys.reserve(updates.size());
+  priorities.reserve(updates.size());
+  for (const auto& update : updates) {
+    auto it = data_.find(update.key());
+    if (it != data_.end()) {
+      slots.push_back(it->second.index);
+      keys.push_back(update.key());
+      priorities.push_back(update.priority());
+    }
+  }
+  return UpdateItemsAt(slots, keys, priorities);
+}
 
-  for (auto& extension : extensions_) {
-    extension->OnReset(&mu_);
+tensorflow::Status Table::UpdateItemsAt(
+    absl::Span<const ItemSelector::Slot> slots, absl::Span<const Key> keys,
+    absl::Span<const double> priorities) {
+  if (keys.empty()) {
+    return tensorflow::Status::OK();
+  }
+
+  {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.selector_update);
+    TF_RETURN_IF_ERROR(sampler_->UpdateBatchAt(slots, keys, priorities));
+    TF_RETURN_IF_ERROR(remover_->UpdateBatchAt(slots, keys, priorities));
+  }
+
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+    for (int i = 0; i < keys.size(); i++) {
+      RecordPreImage(keys[i]);
+      CompactTableItem& item = data_.find(keys[i])->second;
+      const double old_priority = item.priority;
+      item.priority = priorities[i];
+      UpdateEpisodePriority(item, old_priority);
+    }
+  }
+
+  if (!extensions_.empty()) {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.extension_callbacks);
+    for (Key key : keys) {
+      auto it = data_.find(key);
+      if (it == data_.end()) continue;
+      const Item item = ToItem(it->second);
+      for (auto& extension : extensions_) {
+        extension->OnUpdate(&mu_, item);
+      }
+    }
+  }
+
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Table::TransformPriorities(
+    const std::function<double(const PriorityTransformInput&)>& transform) {
+  InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                             &latency_stats_.lock_hold);
+  TF_RETURN_IF_ERROR(CheckNotFrozen());
+  std::vector<ItemSelector::Slot> slots;
+  std::vector<Key> keys;
+  std::vector<double> priorities;
+  slots.reserve(data_.size());
+  keys.reserve(data_.size());
+  priorities.reserve(data_.size());
+  for (const auto& [key, item] : data_) {
+    const double priority = transform({
+        .key = key,
+        .priority = item.priority,
+        .inserted_at = absl::FromUnixNanos(item.inserted_at_ns),
+        .times_sampled = item.times_sampled,
+    });
+    if (priority == item.priority) continue;
+    if (std::isnan(priority) || priority < 0) {
+      // Apply the updates before the invalid one.
+      TF_RETURN_IF_ERROR(UpdateItemsAt(slots, keys, priorities));
+      return tensorflow::errors::InvalidArgument(
+          "Priority transform returned invalid priority ", priority,
+          " for item ", key, ".");
+    }
+    slots.push_back(item.index);
+    keys.push_back(key);
+    priorities.push_back(priority);
+  }
+  return UpdateItemsAt(slots, keys, priorities);
+}
+
+tensorflow::Status Table::ExpireItems(absl::Time now) {
+  std::vector<CompactTableItem> deleted_items;
+  auto reclaim_deleted_items = internal::MakeCleanup(
+      [&deleted_items] { ReclaimItems(std::move(deleted_items)); });
+
+  InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                             &latency_stats_.lock_hold);
+  if (expiry_queue_ == nullptr) return tensorflow::Status::OK();
+
+  std::vector<internal::ExpiryQueue::Entry> expired;
+  expiry_queue_->PopExpired(now, &expired);
+  for (const auto& entry : expired) {
+    // Skip the entries of items which have been deleted (and possibly
+    // inserted again) since.
+    auto it = data_.find(entry.key);
+    if (it == data_.end() || it->second.inserted_at_ns != entry.tag) continue;
+    deleted_items.emplace_back();
+    TF_RETURN_IF_ERROR(DeleteItem(entry.key, &deleted_items.back()));
+    num_expired_items_++;
+  }
+  return tensorflow::Status::OK();
+}
+
+struct Table::DetachedState {
+  // The table references are released before the items, which keep the chunks
+  // alive, are destroyed.
+  ~DetachedState() {
+    for (auto& entry : chunk_refs) {
+      entry.second.chunk->RemoveTableReference();
+    }
+  }
+
+  // Reserves the structures which are swapped into the table for `num_items`
+  // items.
+  void Reserve(int64_t num_items) {
+    if (num_items == 0) return;
+    data.reserve(num_items);
+    keys.reserve(num_items);
+    episode_refs.reserve(num_items);
+    chunk_refs.reserve(num_items);
+  }
+
+  ItemMap data;
+  std::vector<Key> keys;
+  internal::flat_hash_map<uint64_t, EpisodeEntry> episodes;
+  internal::flat_hash_map<uint64_t, int64_t> episode_refs;
+  internal::IncrementalHashMap<ChunkStore::Key, ChunkRef> chunk_refs;
+};
+
+tensorflow::Status Table::Reset() {
+  // The structures of the table are swapped for empty ones while holding the
+  // lock, which is O(1) regardless of the size of the table, and destroyed
+  // (together with the chunks they were the last reference to) by the
+  // reclaimer after the lock has been released. The empty structures are
+  // reserved before the lock is taken.
+  auto detached = absl::make_unique<DetachedState>();
+  detached->Reserve(reserved_items_);
+  auto reclaim_detached = internal::MakeCleanup([&detached] {
+    internal::Reclaimer::Default()->Reclaim(std::move(detached));
+  });
+
+  InstrumentedMutexLock lock(&mu_, &latency_stats_.lock_wait,
+                             &latency_stats_.lock_hold);
+  TF_RETURN_IF_ERROR(CheckNotFrozen());
+  if (workload_trace_ != nullptr) workload_trace_->RecordReset(name_);
+  int64_t num_deleted_items;
+
+  if (!extensions_.empty()) {
+    internal::ScopedLatencyRecorder timer(&latency_stats_.extension_callbacks);
+    for (auto& extension : extensions_) {
+      extension->OnReset(&mu_);
+    }
   }
 
   sampler_->Clear();
   remover_->Clear();
+  if (expiry_queue_ != nullptr) expiry_queue_->Clear();
+  if (episode_sampler_ != nullptr) episode_sampler_->Clear();
+  detached->episodes.swap(episodes_);
 
-  num_deleted_episodes_ = 0;
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+    num_deleted_episodes_ = 0;
+    detached->episode_refs.swap(episode_refs_);
+    num_bytes_ = 0;
+    detached->data.swap(data_);
+    detached->keys.swap(keys_);
+    num_deleted_items = detached->data.size();
+
+    // A checkpoint in progress still has to copy the items which it has not
+    // recorded yet, so they are handed to it rather than the reclaimer. Items
+    // inserted after the first reset are recorded as new in `pre_images` so
+    // later resets don't have to do this.
+    if (checkpoint_ != nullptr && checkpoint_->reset_data == nullptr) {
+      checkpoint_->reset_data =
+          absl::make_unique<ItemMap>(std::move(detached->data));
+      checkpoint_->reset_keys = std::move(detached->keys);
+
+      // The chunks are kept alive by the checkpoint rather than by `detached`,
+      // so the table references can't be released after the lock.
+      ReleaseChunkReferences();
+    } else {
+      detached->chunk_refs.swap(chunk_refs_);
+    }
+  }
+
+  rate_limiter_->ResetTable(&mu_, num_deleted_items);
+
+  return tensorflow::Status::OK();
+}
 
-  data_.clear();
+tensorflow::Status Table::Freeze() {
+  absl::MutexLock lock(&mu_);
+  if (frozen_state_ != nullptr) return tensorflow::Status::OK();
+  if (data_.empty()) {
+    return tensorflow::errors::FailedPrecondition("Table ", name_,
+                                                  " is empty.");
+  }
+  if (restore_.in_progress) {
+    return tensorflow::errors::FailedPrecondition("Table ", name_,
+                                                  " is being restored.");
+  }
+  if (max_times_sampled_ > 0 || max_age_ != absl::InfiniteDuration()) {
+    return tensorflow::errors::FailedPrecondition(
+        "Table ", name_,
+        " removes items when they are sampled or expire so it can't be "
+        "frozen.");
+  }
 
-  rate_limiter_->Reset(&mu_);
+  // The weights are derived from the options of the sampler rather than from
+  // its probabilities, which may be approximate (e.g bucketed selectors).
+  // Deterministic selectors always return the same item, with probability 1.
+  const KeyDistributionOptions options = sampler_->options();
+  std::vector<Key> keys;
+  std::vector<double> weights;
+  if (options.is_deterministic()) {
+    keys.push_back(sampler_->Sample().key);
+    weights.push_back(1);
+  } else if (options.has_uniform() || options.has_prioritized()) {
+    keys.reserve(data_.size());
+    weights.reserve(data_.size());
+    for (const auto& [key, item] : data_) {
+      double weight = 1;
+      if (options.has_prioritized()) {
+        weight = item.priority == 0
+                     ? 0
+                     : std::pow(item.priority,
+                                options.prioritized().priority_exponent());
+      }
+      keys.push_back(key);
+      weights.push_back(weight);
+    }
+  } else {
+    return tensorflow::errors::Unimplemented(
+        "Table ", name_, " can't be frozen with sampler ",
+        options.ShortDebugString(), ".");
+  }
 
+  std::vector<SampledItem> items;
+  items.reserve(keys.size());
+  for (Key key : keys) {
+    const CompactTableItem& item = data_.at(key);
+    items.push_back({
+        .item = ToPrioritizedItem(item),
+        .chunks = {item.chunks.begin(), item.chunks.end()},
+        .probability = 0,
+        .table_size = static_cast<int64_t>(data_.size()),
+    });
+  }
+  frozen_state_ = absl::make_unique<FrozenState>(std::move(items), weights);
+  frozen_.store(frozen_state_.get(), std::memory_order_release);
+  REVERB_LOG(REVERB_INFO) << "Froze table " << name_ << " with "
+                          << data_.size() << " items.";
   return tensorflow::Status::OK();
 }
 
+bool Table::frozen() const {
+  return frozen_.load(std::memory_order_acquire) != nullptr;
+}
+
+tensorflow::Status Table::CheckNotFrozen() const {
+  if (frozen_state_ == nullptr) return tensorflow::Status::OK();
+  return tensorflow::errors::FailedPrecondition(
+      "Table ", name_, " is frozen and can't be modified.");
+}
+
 Table::CheckpointAndChunks Table::Checkpoint() {
+  absl::MutexLock checkpoint_lock(&checkpoint_mu_);
+
   PriorityTableCheckpoint checkpoint;
   checkpoint.set_table_name(name());
   checkpoint.set_max_size(max_size_);
   checkpoint.set_max_times_sampled(max_times_sampled_);
+  checkpoint.set_max_bytes(max_bytes_);
+  checkpoint.set_max_reserved_bytes(max_reserved_bytes_);
+  if (max_age_ != absl::InfiniteDuration()) {
+    EncodeAsDurationProto(max_age_, checkpoint.mutable_max_age());
+  }
 
   if (signature_.has_value()) {
     *checkpoint.mutable_signature() = signature_.value();
   }
 
-  absl::MutexLock lock(&mu_);
+  {
+    absl::MutexLock lock(&mu_);
 
-  checkpoint.set_num_deleted_episodes(num_deleted_episodes_);
+    checkpoint.set_num_deleted_episodes(num_deleted_episodes_);
+    checkpoint.set_index_episodes(episode_sampler_ != nullptr);
 
-  *checkpoint.mutable_sampler() = sampler_->options();
-  *checkpoint.mutable_remover() = remover_->options();
+    *checkpoint.mutable_sampler() = sampler_->options();
+    *checkpoint.mutable_remover() = remover_->options();
 
-  // Note that is is important that the rate limiter checkpoint is
-  // finalized before the items are added
-  *checkpoint.mutable_rate_limiter() = rate_limiter_->CheckpointReader(&mu_);
+    // Note that is is important that the rate limiter checkpoint is
+    // finalized before the items are added
+    *checkpoint.mutable_rate_limiter() = rate_limiter_->CheckpointReader(&mu_);
 
-  absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
-  for (const auto& entry : data_) {
-    *checkpoint.add_items() = entry.second.item;
-    chunks.insert(entry.second.chunks.begin(), entry.second.chunks.end());
+    // From here on every mutation records the state of the item it mutates
+    // before it does so. The items are copied below without holding `mu_`.
+    absl::WriterMutexLock data_lock(&data_mu_);
+    checkpoint_ = absl::make_unique<CheckpointState>();
+  }
+
+  // Copy the items which have not been mutated since the checkpoint started.
+  // `keys_` is only ever modified by appending keys of new items, which are
+  // recorded as such, and by filling the position of a removed key with the
+  // last key, which is then recorded as well. Walking the positions in order
+  // therefore visits every key which existed at the start exactly once unless
+  // it has been recorded. The reader lock is released between batches so
+  // writers are never blocked for longer than it takes to copy one batch.
+  std::vector<CompactTableItem> items;
+  for (size_t next = 0;;) {
+    absl::ReaderMutexLock data_lock(&data_mu_);
+    const bool reset = checkpoint_->reset_data != nullptr;
+    const auto& keys = reset ? checkpoint_->reset_keys : keys_;
+    const auto& data = reset ? *checkpoint_->reset_data : data_;
+    if (next >= keys.size()) break;
+
+    const size_t end = std::min(keys.size(), next + kCheckpointBatchSize);
+    for (; next < end; next++) {
+      if (checkpoint_->pre_images.contains(keys[next])) continue;
+      items.push_back(data.find(keys[next])->second);
+    }
+  }
+
+  std::unique_ptr<CheckpointState> state;
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+    state = std::move(checkpoint_);
+  }
+  for (auto& entry : state->pre_images) {
+    if (entry.second.has_value()) {
+      items.push_back(std::move(entry.second).value());
+    }
   }
 
   // Sort the items in ascending order based on their insertion time. This makes
   // it possible to reconstruct ordered structures (Fifo) when the checkpoint is
   // loaded.
-  std::sort(checkpoint.mutable_items()->begin(),
-            checkpoint.mutable_items()->end(), IsInsertedBefore);
+  std::sort(items.begin(), items.end(), IsInsertedBefore);
 
-  return {std::move(checkpoint), std::move(chunks)};
+  // The items are encoded column by column rather than as `PrioritizedItem`
+  // so that neither the table name nor the chunk keys shared by consecutive
+  // items are repeated.
+  std::vector<PrioritizedItemBlock> item_blocks;
+  absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  ItemBlockEncoder encoder;
+  absl::InlinedVector<uint64_t, 2> chunk_keys;
+  for (const CompactTableItem& item : items) {
+    chunk_keys.clear();
+    for (const auto& chunk : item.chunks) {
+      chunk_keys.push_back(chunk->data().chunk_key());
+    }
+    encoder.Add(item.key, item.priority, item.times_sampled,
+                item.inserted_at_ns, item.offset, item.length, item.columns,
+                chunk_keys);
+    if (encoder.num_items() == kCheckpointItemsPerBlock) {
+      item_blocks.push_back(encoder.Finish());
+    }
+    chunks.insert(item.chunks.begin(), item.chunks.end());
+  }
+  if (encoder.num_items() > 0) {
+    item_blocks.push_back(encoder.Finish());
+  }
+  checkpoint.set_num_item_blocks(item_blocks.size());
+
+  // The items of `state` are destroyed here, without holding any lock.
+  return {std::move(checkpoint), std::move(item_blocks), std::move(chunks)};
 }
 
 tensorflow::Status Table::InsertCheckpointItem(Table::Item item) {
@@ -390,33 +1495,126 @@ tensorflow::Status Table::InsertCheckpointItem(Table::Item item) {
       << "InsertCheckpointItem called for item with already present key: "
       << item.item.key();
 
-  TF_RETURN_IF_ERROR(sampler_->Insert(item.item.key(), item.item.priority()));
-  TF_RETURN_IF_ERROR(remover_->Insert(item.item.key(), item.item.priority()));
+  // The item is inserted into the slot after the last one.
+  const ItemSelector::Slot slot = keys_.size();
+  TF_RETURN_IF_ERROR(
+      sampler_->InsertAt(slot, item.item.key(), item.item.priority()));
+  TF_RETURN_IF_ERROR(
+      remover_->InsertAt(slot, item.item.key(), item.item.priority()));
 
-  const auto key = item.item.key();
-  auto it = data_.emplace(key, std::move(item)).first;
-  for (auto& extension : extensions_) {
-    extension->OnInsert(&mu_, it->second);
+  CompactTableItem* inserted;
+  {
+    absl::WriterMutexLock data_lock(&data_mu_);
+    inserted = &EmplaceItem(ToCompactItem(std::move(item)));
+    AddReferences(*inserted);
   }
 
-  for (const auto& chunk : it->second.chunks) {
-    ++episode_refs_[chunk->data().sequence_range().episode_id()];
+  if (!extensions_.empty()) {
+    const Item inserted_item = ToItem(*inserted);
+    for (auto& extension : extensions_) {
+      extension->OnInsert(&mu_, inserted_item);
+    }
   }
 
   return tensorflow::Status::OK();
 }
 
-bool Table::Get(Table::Key key, Table::Item* item) {
+void Table::BeginRestore(double min_restored_fraction_to_sample) {
+  absl::MutexLock lock(&mu_);
+  REVERB_CHECK(!restore_.in_progress) << "Restore already in progress";
+  restore_ = RestoreState();
+  restore_.started = true;
+  restore_.in_progress = true;
+  restore_.min_restored_fraction_to_sample = min_restored_fraction_to_sample;
+  restore_.blocks_samples = true;
+  rate_limiter_->BlockSamples(&mu_);
+  MaybeUnblockRestoredSamples();
+}
+
+void Table::SetNumItemsToRestore(int64_t num_items) {
   absl::MutexLock lock(&mu_);
+  REVERB_CHECK(restore_.in_progress);
+  restore_.num_items = num_items;
+  MaybeUnblockRestoredSamples();
+}
+
+tensorflow::Status Table::InsertRestoredItem(Table::Item item) {
+  std::vector<CompactTableItem> deleted_items;
+  tensorflow::Status status;
+  {
+    absl::MutexLock lock(&mu_);
+    REVERB_CHECK(restore_.in_progress);
+    status = rate_limiter_->CheckIfCancelled();
+    if (status.ok()) {
+      // Restored items never wait for the rate limiter as that could block
+      // the restore until the table has been sampled from.
+      int reserved_inserts = 1;
+      status = InsertOrAssignInternal(std::move(item), &deleted_items,
+                                      &reserved_inserts);
+    }
+    if (status.ok()) {
+      restore_.num_restored++;
+      MaybeUnblockRestoredSamples();
+    }
+  }
+  ReclaimItems(std::move(deleted_items));
+  return status;
+}
+
+tensorflow::Status Table::InsertReplicatedItem(Table::Item item) {
+  std::vector<CompactTableItem> deleted_items;
+  tensorflow::Status status;
+  {
+    absl::MutexLock lock(&mu_);
+    status = rate_limiter_->CheckIfCancelled();
+    if (status.ok()) {
+      int reserved_inserts = 1;
+      status = InsertOrAssignInternal(std::move(item), &deleted_items,
+                                      &reserved_inserts);
+    }
+  }
+  ReclaimItems(std::move(deleted_items));
+  return status;
+}
+
+void Table::RecordReplicaSamples(int64_t num_samples) {
+  if (num_samples <= 0) return;
+  absl::MutexLock lock(&mu_);
+  const int64_t max_samples = std::numeric_limits<int>::max();
+  rate_limiter_->Sample(&mu_,
+                        static_cast<int>(std::min(num_samples, max_samples)));
+}
+
+void Table::EndRestore() {
+  absl::MutexLock lock(&mu_);
+  restore_.in_progress = false;
+  if (restore_.blocks_samples) {
+    restore_.blocks_samples = false;
+    rate_limiter_->UnblockSamples(&mu_);
+  }
+}
+
+void Table::MaybeUnblockRestoredSamples() {
+  if (!restore_.blocks_samples || restore_.num_items < 0) return;
+  const int64_t min_restored = static_cast<int64_t>(std::ceil(
+      restore_.min_restored_fraction_to_sample * restore_.num_items));
+  if (restore_.num_restored >= min_restored) {
+    restore_.blocks_samples = false;
+    rate_limiter_->UnblockSamples(&mu_);
+  }
+}
+
+bool Table::Get(Table::Key key, Table::Item* item) {
+  absl::ReaderMutexLock lock(&data_mu_);
   auto it = data_.find(key);
   if (it != data_.end()) {
-    *item = it->second;
+    *item = ToItem(it->second);
     return true;
   }
   return false;
 }
 
-const internal::flat_hash_map<Table::Key, Table::Item>* Table::RawLookup() {
+const Table::ItemMap* Table::RawLookup() {
   mu_.AssertHeld();
   return &data_;
 }
@@ -446,15 +1644,24 @@ bool Table::CanInsert(int num_inserts) const {
   return rate_limiter_->CanInsert(&mu_, num_inserts);
 }
 
+void Table::NotifyWhenCanSample(std::function<bool()> callback) {
+  absl::MutexLock lock(&mu_);
+  rate_limiter_->NotifyWhenCanSample(&mu_, std::move(callback));
+}
+
+void Table::NotifyWhenCanInsert(std::function<bool()> callback) {
+  absl::MutexLock lock(&mu_);
+  rate_limiter_->NotifyWhenCanInsert(&mu_, std::move(callback));
+}
+
 RateLimiterEventHistory Table::GetRateLimiterEventHistory(
     size_t min_insert_event_id, size_t min_sample_event_id) const {
-  absl::MutexLock lock(&mu_);
-  return rate_limiter_->GetEventHistory(&mu_, min_insert_event_id,
+  return rate_limiter_->GetEventHistory(min_insert_event_id,
                                         min_sample_event_id);
 }
 
 int64_t Table::num_episodes() const {
-  absl::MutexLock lock(&mu_);
+  absl::ReaderMutexLock lock(&data_mu_);
   return episode_refs_.size();
 }
 
@@ -479,17 +1686,93 @@ std::vector<std::shared_ptr<TableExtension>> Table::UnsafeClearExtensions() {
   return extensions;
 }
 
+int64_t Table::num_bytes() const {
+  absl::ReaderMutexLock lock(&data_mu_);
+  return num_bytes_;
+}
+
 int64_t Table::num_deleted_episodes() const {
-  absl::MutexLock lock(&mu_);
+  absl::ReaderMutexLock lock(&data_mu_);
   return num_deleted_episodes_;
 }
 
 void Table::set_num_deleted_episodes_from_checkpoint(int64_t value) {
   absl::MutexLock lock(&mu_);
+  absl::WriterMutexLock data_lock(&data_mu_);
   REVERB_CHECK(data_.empty() && num_deleted_episodes_ == 0);
   num_deleted_episodes_ = value;
 }
 
+CompactTableItem Table::ToCompactItem(Item item) {
+  CompactTableItem compact_item;
+  compact_item.key = item.item.key();
+  compact_item.priority = item.item.priority();
+  compact_item.inserted_at_ns =
+      absl::ToUnixNanos(DecodeTimestampProto(item.item.inserted_at()));
+  compact_item.times_sampled = item.item.times_sampled();
+  compact_item.offset = item.item.sequence_range().offset();
+  compact_item.length = item.item.sequence_range().length();
+  compact_item.columns.assign(item.item.columns().begin(),
+                              item.item.columns().end());
+  compact_item.chunks.reserve(item.chunks.size());
+  for (auto& chunk : item.chunks) {
+    compact_item.chunks.push_back(std::move(chunk));
+  }
+  return compact_item;
+}
+
+PrioritizedItem Table::ToPrioritizedItem(const CompactTableItem& item) const {
+  PrioritizedItem proto;
+  proto.set_key(item.key);
+  proto.set_table(name_);
+  for (const auto& chunk : item.chunks) {
+    proto.add_chunk_keys(chunk->data().chunk_key());
+  }
+  if (item.offset != 0 || item.length != 0) {
+    proto.mutable_sequence_range()->set_offset(item.offset);
+    proto.mutable_sequence_range()->set_length(item.length);
+  }
+  proto.mutable_columns()->Add(item.columns.begin(), item.columns.end());
+  proto.set_priority(item.priority);
+  proto.set_times_sampled(item.times_sampled);
+  EncodeAsTimestampProto(absl::FromUnixNanos(item.inserted_at_ns),
+                         proto.mutable_inserted_at());
+  return proto;
+}
+
+Table::Item Table::ToItem(const CompactTableItem& item) const {
+  return {ToPrioritizedItem(item), {item.chunks.begin(), item.chunks.end()}};
+}
+
+void Table::set_numa_node(int node) { numa_node_ = node; }
+
+int Table::numa_node() const { return numa_node_; }
+
+void Table::set_item_rules(std::vector<ItemRule> rules) {
+  item_rules_ = std::move(rules);
+}
+
+void Table::set_workload_trace(
+    std::shared_ptr<internal::WorkloadTraceWriter> trace) {
+  workload_trace_ = std::move(trace);
+}
+
+void Table::TraceInsert(const Item& item) const {
+  if (workload_trace_ == nullptr) return;
+  workload_trace_->RecordInsert(name_, item.item, item.chunks);
+}
+
+const std::vector<ItemRule>& Table::item_rules() const { return item_rules_; }
+
+void Table::RecordNumaAccess() const {
+  if (numa_node_ < 0) return;
+  if (internal::CurrentNumaNode() == numa_node_) {
+    num_numa_local_accesses_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    num_numa_remote_accesses_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
 int32_t Table::DefaultFlexibleBatchSize() const {
   const auto& rl_info = rate_limiter_->InfoWithoutCallStats();
   // When a samples per insert ratio is provided then match the batch size with
@@ -515,5 +1798,17 @@ int32_t Table::DefaultFlexibleBatchSize() const {
   return 1;
 }
 
+TableLatencyStats Table::LatencyStats::ToProto() const {
+  TableLatencyStats proto;
+  *proto.mutable_lock_wait() = lock_wait.ToProto();
+  *proto.mutable_lock_hold() = lock_hold.ToProto();
+  *proto.mutable_selector_insert() = selector_insert.ToProto();
+  *proto.mutable_selector_sample() = selector_sample.ToProto();
+  *proto.mutable_selector_update() = selector_update.ToProto();
+  *proto.mutable_selector_delete() = selector_delete.ToProto();
+  *proto.mutable_extension_callbacks() = extension_callbacks.ToProto();
+  return proto;
+}
+
 }  // namespace reverb
 }  // namespace deepmind
@@ -15,7 +15,9 @@
 #ifndef REVERB_CC_TABLE_H_
 #define REVERB_CC_TABLE_H_
 
+#include <atomic>
 #include <cstddef>
+#include <functional>
 #include <initializer_list>
 #include <memory>
 #include <string>
@@ -24,16 +26,25 @@
 
 #include <cstdint>
 #include "absl/base/thread_annotations.h"
+#include "absl/container/inlined_vector.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/chunk_store.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/metrics.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/expiry_queue.h"
+#include "reverb/cc/support/huge_page_allocator.h"
+#include "reverb/cc/support/incremental_hash_map.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/support/workload_trace.h"
 #include "reverb/cc/table_extensions/interface.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/protobuf/struct.pb.h"
@@ -48,6 +59,39 @@ struct TableItem {
   std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
 };
 
+// Compact representation of a `TableItem` used by `Table` to store its items.
+//
+// The fields of `PrioritizedItem` which are the same for all items of a table
+// (`table`) or which can be derived from `chunks` (`chunk_keys`) are not stored
+// and the remaining fields are packed into plain members. Protos are only
+// materialized at the boundaries of the table (e.g. `Sample`, `Copy`,
+// `Checkpoint` and the extension hooks).
+struct CompactTableItem {
+  // Most items reference one or two chunks so these are stored inline.
+  using Chunks = absl::InlinedVector<std::shared_ptr<ChunkStore::Chunk>, 2>;
+
+  uint64_t key;
+  double priority;
+
+  // Unix time, in nanoseconds, when the item was first inserted.
+  int64_t inserted_at_ns;
+
+  int32_t times_sampled;
+
+  // `sequence_range` of `PrioritizedItem`.
+  int32_t offset;
+  int32_t length;
+
+  // Position of `key` in `Table::keys_`. Maintained by the table.
+  int32_t index = 0;
+
+  // `columns` of `PrioritizedItem`. Empty unless the item only references a
+  // subset of the tensors of its chunks.
+  std::vector<int32_t> columns;
+
+  Chunks chunks;
+};
+
 // A `Table` is a structure for storing `TableItem` objects. The table uses two
 // instances of `ItemSelector`, one for sampling (`sampler`) and
 // another for removing (`remover`). All item operations (insert/update/delete)
@@ -76,11 +120,35 @@ struct TableItem {
 // two tables would not share any chunks and would this require twice the
 // amount of memory compared to two tables with the same type of remover.
 //
+// Inserts, samples and all other mutations of the table serialize on a single
+// lock (`mu_`), which is also held while the rate limiter is awaited. Only the
+// read only accessors (`Get`, `Copy`, `size`, `info` etc.) use a separate lock
+// (`data_mu_`) and therefore don't wait for the mutations. Concurrent writers
+// and samplers of one table do not scale with the number of threads; see
+// `table_benchmark_test` for the measurements.
+//
 class Table {
  public:
   using Key = ItemSelector::Key;
   using Item = TableItem;
 
+  // Index of the items of the table. Large tables hold it in huge pages, see
+  // `internal::ConfigureHugePages`.
+  using ItemMap = internal::HugePageHashMap<Key, CompactTableItem>;
+
+  // Snapshots returned by `InfoSnapshot` which are younger than this are
+  // returned without attempting to replace them.
+  static constexpr absl::Duration kInfoSnapshotRefreshInterval =
+      absl::Milliseconds(10);
+
+  // Snapshots returned by `InfoSnapshot` never are older than this.
+  static constexpr absl::Duration kMaxInfoSnapshotAge = absl::Seconds(1);
+
+  // Expired items are deleted in batches, `kExpiryBucketsPerMaxAge` times per
+  // `max_age` but at most every `kMinExpiryInterval`.
+  static constexpr int kExpiryBucketsPerMaxAge = 64;
+  static constexpr absl::Duration kMinExpiryInterval = absl::Milliseconds(1);
+
   // Used as the return of Sample(). Note that this returns the probability of
   // an item instead as opposed to the raw priority value.
   struct SampledItem {
@@ -95,6 +163,12 @@ class Table {
   // completed.
   struct CheckpointAndChunks {
     PriorityTableCheckpoint checkpoint;
+
+    // Items of the table ordered by insertion time (asc), in blocks of up to
+    // `kCheckpointItemsPerBlock` items. `checkpoint.num_item_blocks` is the
+    // number of blocks.
+    std::vector<PrioritizedItemBlock> item_blocks;
+
     absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
   };
 
@@ -106,16 +180,35 @@ class Table {
   // `max_times_sampled` is the maximum number of times we allow for an item to
   //   be sampled before it is deleted. No value lower than 1 will be used.
   // `rate_limiter` controls when sample and insert calls are allowed to
-  //   proceed.
+  //   proceed. A rate limiter can be shared by several tables, in which case
+  //   it enforces a combined budget of the inserts and samples of all of them.
+  //   Tables which share a rate limiter also share their lock.
   // `extensions` allows additional features to be injected into the table.
   // `signature` allows an optional declaration of the data that can be stored
   //   in this table.  writers and readers are responsible for checking against
   //   this signature, as it is available via RPC request.
+  // `max_bytes` is the maximum total size of the chunks referenced by the items
+  //   in this table. The remover is used to delete items until the table fits
+  //   after each insert. A value <= 0 means there is no limit.
+  // `max_age` is the time after its insertion that an item expires. Expired
+  //   items are deleted in batches by a background thread of the table, up to
+  //   `max_age / kExpiryBucketsPerMaxAge` late. Items never expire if
+  //   `max_age` is infinite.
+  // `index_episodes` makes the table maintain an index of the items of each
+  //   episode, which `SampleEpisode` samples whole episodes from.
+  // `max_reserved_bytes` caps the memory which is allocated up front for the
+  //   item index of the table and its selectors, which is otherwise grown
+  //   (and rehashed while holding the lock) as the table fills. The index is
+  //   reserved for `max_size` items or as many as fit in `max_reserved_bytes`,
+  //   whichever is fewer. A value <= 0 means that nothing is reserved.
   Table(std::string name, std::shared_ptr<ItemSelector> sampler,
         std::shared_ptr<ItemSelector> remover, int64_t max_size,
         int32_t max_times_sampled, std::shared_ptr<RateLimiter> rate_limiter,
         std::vector<std::shared_ptr<TableExtension>> extensions = {},
-        absl::optional<tensorflow::StructuredValue> signature = absl::nullopt);
+        absl::optional<tensorflow::StructuredValue> signature = absl::nullopt,
+        int64_t max_bytes = 0,
+        absl::Duration max_age = absl::InfiniteDuration(),
+        bool index_episodes = false, int64_t max_reserved_bytes = 0);
 
   ~Table();
 
@@ -123,7 +216,20 @@ class Table {
   // If `count` is `0` (default) then all items are copied.
   // If `count` is less than `size` then a subset is selected with in an
   // undefined manner.
-  std::vector<Item> Copy(size_t count = 0) const;
+  std::vector<Item> Copy(size_t count = 0) const ABSL_LOCKS_EXCLUDED(data_mu_)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
+
+  // Keys of the items that are currently in the table. Together with
+  // `CopyItems` this lets the items of a large table be copied in pages which
+  // each only hold the lock briefly, e.g to export the table.
+  std::vector<Key> Keys() const ABSL_LOCKS_EXCLUDED(data_mu_)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
+
+  // Copies the items of `keys`, in the same order, skipping keys which are
+  // not in the table (e.g because the items have been removed since `Keys`
+  // was called).
+  std::vector<Item> CopyItems(absl::Span<const Key> keys) const
+      ABSL_LOCKS_EXCLUDED(data_mu_) ABSL_NO_THREAD_SAFETY_ANALYSIS;
 
   // Attempts to insert an item into the distribution. If the item
   // already exists, the existing item is updated. Also applies the necessary
@@ -135,14 +241,90 @@ class Table {
   // that we insert the new item that exceeds the capacity BEFORE we run the
   // remover. This means that the newly inserted item could be deleted right
   // away.
+  //
+  // If `max_bytes_` is set then items are removed, using `remover_`, until the
+  // chunks referenced by the remaining items fit within the limit.
   tensorflow::Status InsertOrAssign(Item item);
 
+  // Same as calling `InsertOrAssign` once for each of `items`, in order, but
+  // without releasing the lock between the items. The lock is only released if
+  // the rate limiter blocks the insertion of one of the items.
+  //
+  // The returned vector holds one status per item, in the same order as
+  // `items`. A failed item does not prevent the remaining items from being
+  // inserted.
+  std::vector<tensorflow::Status> InsertOrAssignBatch(std::vector<Item> items);
+
+  // Inserts or updates items in several tables which share a rate limiter. The
+  // rate limiter is awaited once for the whole batch, after which all new
+  // items are admitted together without releasing the (shared) lock. This is
+  // used to write the same trajectory into a group of tables without waiting
+  // once per table, at the cost of exceeding the budget of the rate limiter by
+  // at most the size of the batch. Only the items of a single call are
+  // admitted together; see `RateLimiter` for what this means for the items a
+  // client writes. Dies if the tables don't share a rate limiter.
+  //
+  // The returned vector holds one status per item, in the same order as
+  // `items`.
+  static std::vector<tensorflow::Status> InsertOrAssignGroupBatch(
+      std::vector<std::pair<Table*, Item>> items)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
+
+  // Returns true if this table and `other` share a rate limiter.
+  bool SharesRateLimiterWith(const Table& other) const;
+
+  // Same as `InsertOrAssignBatch` but stops, rather than blocks, at the first
+  // item which the rate limiter does not allow to be inserted yet. The items
+  // that were processed are removed from the front of `items` and their
+  // statuses are returned. The remaining items can be retried once
+  // `NotifyWhenCanInsert` has called back. Once the table has been closed all
+  // items are processed, and fail, without blocking.
+  std::vector<tensorflow::Status> TryInsertOrAssignBatch(
+      std::vector<Item>* items);
+
   // Inserts an item without consulting or modifying the RateLimiter about the
   // operation.
   //
   // This should ONLY be used when restoring a `Table` from a checkpoint.
   tensorflow::Status InsertCheckpointItem(Item item);
 
+  // Prepares the table to restore a checkpoint while it serves traffic.
+  // Inserts proceed as usual but samples are blocked until at least
+  // `min_restored_fraction_to_sample` of the items announced through
+  // `SetNumItemsToRestore` have been inserted with `InsertRestoredItem`, or
+  // until `EndRestore` is called. The progress is reported by `info()`.
+  void BeginRestore(double min_restored_fraction_to_sample)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Sets the number of items that the restore will insert.
+  void SetNumItemsToRestore(int64_t num_items) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Inserts an item of the checkpoint that is being restored. Unlike
+  // `InsertCheckpointItem` the table may already hold items so the insert is
+  // registered with the RateLimiter (without waiting for it) and respects
+  // `max_size` and `max_bytes`. Must be called between `BeginRestore` and
+  // `EndRestore`. Returns Cancelled-status once the table has been closed.
+  tensorflow::Status InsertRestoredItem(Item item) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Marks the restore as completed, whether or not it succeeded, and allows
+  // samples to proceed.
+  void EndRestore() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Inserts (or assigns) an item which a replica has received from its
+  // primary. The primary has already admitted the item so the insert is
+  // registered with the RateLimiter without waiting for it, but otherwise
+  // behaves like `InsertOrAssign`. Returns Cancelled-status once the table has
+  // been closed.
+  tensorflow::Status InsertReplicatedItem(Item item) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Registers `num_samples` samples which replicas of the table have served
+  // with the RateLimiter, without waiting for it. The samples thus count
+  // against the budget of the table as if they had been served by the table
+  // itself, which paces the writers of the primary by the samples of all
+  // replicas. Used when replicas coordinate their rate limiting with the
+  // primary.
+  void RecordReplicaSamples(int64_t num_samples) ABSL_LOCKS_EXCLUDED(mu_);
+
   // Updates the priority or deletes items in this table distribution. All
   // operations in the arguments are applied in the order that they are listed.
   // Different operations can be set at the same time. Ignores non existing keys
@@ -151,6 +333,29 @@ class Table {
   tensorflow::Status MutateItems(absl::Span<const KeyWithPriority> updates,
                                  absl::Span<const Key> deletes);
 
+  // Fields of an item which the new priority computed by
+  // `TransformPriorities` can depend on.
+  struct PriorityTransformInput {
+    Key key;
+    double priority;
+    absl::Time inserted_at;
+    int32_t times_sampled;
+  };
+
+  // Sets the priority of every item to `transform(item)` in a single pass
+  // over the items, e.g to decay the priorities by age. Unlike a `MutateItems`
+  // call for all keys, neither the items nor the keys are copied and the
+  // selectors are updated with a single `UpdateBatchAt` call each, which
+  // recomputes the sum trees once. Items whose priority is unchanged are
+  // skipped and `OnUpdate` is called on all extensions for every other item.
+  //
+  // `transform` is called while holding the lock of the table, so it must be
+  // cheap and must not call the table. Returns InvalidArgument, after applying
+  // the updates before it, if `transform` returns an invalid priority.
+  tensorflow::Status TransformPriorities(
+      const std::function<double(const PriorityTransformInput&)>& transform)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
   // Attempts to sample an item from table with the sampling
   // strategy passed to the constructor. We only allow the sample operation if
   // the `rate_limiter_` allows it. If the item has reached
@@ -179,9 +384,42 @@ class Table {
   // operation to be "approved" by the rate limiter. The remaining items of the
   // batch will only be added if these can proceeed without releasing the lock
   // and awaiting state changes in the rate limiter.
+  //
+  // If `without_replacement` is set then the items of the batch are distinct.
+  // The keys of the whole batch are drawn up front with
+  // `ItemSelector::SampleBatchWithoutReplacement`, which masks the drawn keys
+  // rather than rejecting duplicates, so the batch can be smaller than what
+  // the rate limiter allows, e.g a single item for deterministic selectors.
+  // The batch also ends early if an extension deletes one of the drawn items
+  // before it has been reached.
   tensorflow::Status SampleFlexibleBatch(
       std::vector<SampledItem>* items, int batch_size,
-      absl::Duration timeout = kDefaultTimeout);
+      absl::Duration timeout = kDefaultTimeout,
+      bool without_replacement = false);
+
+  // Applies `updates` and `deletes` as `MutateItems` does and then samples as
+  // `SampleFlexibleBatch` does, without releasing the lock in between. The
+  // mutations are applied before waiting for the rate limiter, so they have
+  // been applied even if a DeadlineExceeded status is returned. Sampling is
+  // skipped if the mutations fail. Used to piggyback priority updates on the
+  // requests of a `SampleStream`.
+  tensorflow::Status MutateAndSampleFlexibleBatch(
+      absl::Span<const KeyWithPriority> updates, absl::Span<const Key> deletes,
+      std::vector<SampledItem>* items, int batch_size,
+      absl::Duration timeout = kDefaultTimeout,
+      bool without_replacement = false);
+
+  // Samples an episode, with probability proportional to the sum of the
+  // priorities of its items, and returns all of its items in the order they
+  // were inserted. The `probability` of every item is the probability of the
+  // episode. Each item is counted as a sample by the rate limiter, which is
+  // only awaited (for at most `timeout`) for the first one, and is handled as
+  // by `SampleFlexibleBatch` otherwise (i.e `times_sampled`, `OnSample` and
+  // `max_times_sampled`). The episode of an item is the `episode_id` of its
+  // first chunk. Returns FailedPrecondition unless the table was constructed
+  // with `index_episodes`.
+  tensorflow::Status SampleEpisode(std::vector<SampledItem>* items,
+                                   absl::Duration timeout = kDefaultTimeout);
 
   // Returns true iff the current state would allow for `num_samples` to be
   // sampled. Dies if `num_samples` is < 1.
@@ -198,6 +436,16 @@ class Table {
   // arguments to the table.
   bool CanInsert(int num_inserts) const;
 
+  // Calls `callback` once the rate limiter allows for a sample (respectively
+  // insert) operation to proceed or the table has been closed. This allows a
+  // caller to wait for the rate limiter without blocking a thread, by retrying
+  // the operation with a zero timeout (or `TryInsertOrAssignBatch`) once it
+  // has been notified. The callback is called while the table lock is held so
+  // it must neither block nor call back into the table. It returns false if
+  // its caller no longer waits. See `RateLimiter::NotifyWhenCanSample`.
+  void NotifyWhenCanSample(std::function<bool()> callback);
+  void NotifyWhenCanInsert(std::function<bool()> callback);
+
   // Appends the extension to the internal list. Note that this must be called
   // before any other operation is called. If called when the number of items
   // is non zero, death is triggered.
@@ -218,27 +466,67 @@ class Table {
   const std::vector<std::shared_ptr<TableExtension>>& extensions() const;
 
   // Lookup a single item. Returns true if found, else false.
-  bool Get(Key key, Item* item) ABSL_LOCKS_EXCLUDED(mu_);
+  bool Get(Key key, Item* item) ABSL_LOCKS_EXCLUDED(data_mu_)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
 
   // Get pointer to `data_`. Must only be called by extensions while lock held.
-  const internal::flat_hash_map<Key, Item>* RawLookup()
-      ABSL_ASSERT_EXCLUSIVE_LOCK(mu_);
+  const ItemMap* RawLookup() ABSL_ASSERT_EXCLUSIVE_LOCK(mu_);
 
   // Removes all items and resets the RateLimiter to its initial state.
   tensorflow::Status Reset();
 
+  // Makes the table read-only, e.g for offline datasets and evaluation
+  // buffers which are filled once and then only sampled. The items and the
+  // sampling distribution of the selector are captured in an immutable
+  // snapshot which `SampleFlexibleBatch` (and `Sample`) then read without
+  // taking any lock, so sample throughput scales with the number of threads.
+  //
+  // Samples of a frozen table bypass the rate limiter, the `times_sampled` of
+  // the items and the `OnSample` of the extensions. The `probability` of the
+  // samples is exact, also for selectors which approximate it otherwise (e.g
+  // bucketed prioritized selectors). Inserts, mutations and resets return
+  // FailedPrecondition once the table is frozen, and a table cannot be
+  // unfrozen. `SampleEpisode` still takes the lock. Frozen tables are
+  // checkpointed as usual but are restored unfrozen.
+  //
+  // Returns FailedPrecondition if the table is empty, if a restore is in
+  // progress or if items could be removed by sampling or expiry (i.e if
+  // `max_times_sampled` or `max_age` is set). Freezing a frozen table is a
+  // no-op.
+  tensorflow::Status Freeze() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Whether `Freeze` has been called.
+  bool frozen() const;
+
   // Generate a checkpoint from the table's current state.
-  CheckpointAndChunks Checkpoint() ABSL_LOCKS_EXCLUDED(mu_);
+  //
+  // The state is captured in O(1) while holding `mu_`. The items are then
+  // copied in small batches which only hold a reader lock on `data_mu_`, so
+  // inserts, samples and updates proceed while the checkpoint is generated.
+  // Items which are mutated before they have been copied have their state at
+  // the start of the checkpoint recorded by the mutation (copy-on-write), so
+  // the checkpoint is a consistent snapshot of the table. Concurrent calls are
+  // serialized.
+  CheckpointAndChunks Checkpoint()
+      ABSL_LOCKS_EXCLUDED(checkpoint_mu_, mu_, data_mu_);
 
   // Number of items in the table distribution.
-  int64_t size() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t size() const ABSL_LOCKS_EXCLUDED(data_mu_)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
+
+  // Total size (see `ChunkStore::Chunk::DataByteSizeLong`) of the unique chunks
+  // referenced by the items in the table.
+  int64_t num_bytes() const ABSL_LOCKS_EXCLUDED(data_mu_)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
 
   // Number of episodes in the table.
-  int64_t num_episodes() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_episodes() const ABSL_LOCKS_EXCLUDED(data_mu_)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
 
   // Number of episodes that previously were in the table but has since been
   // deleted.
-  int64_t num_deleted_episodes() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_deleted_episodes() const ABSL_LOCKS_EXCLUDED(data_mu_)
+      ABSL_NO_THREAD_SAFETY_ANALYSIS;
 
   // "Manually" set the number of deleted episodes. This is only intended to be
   // called when reconstructing a Table from a checkpoint and will trigger death
@@ -248,17 +536,34 @@ class Table {
 
   const std::string& name() const;
 
+  // Number of items which the structures of the table were reserved for. See
+  // `max_reserved_bytes`.
+  int64_t reserved_items() const { return reserved_items_; }
+
   // Metadata about the table, including the current state of the rate limiter.
   TableInfo info() const;
 
+  // Same as `info` but without the signature, and read from a snapshot which
+  // is shared by the callers so that frequent polling doesn't compete with
+  // inserts and samples for `mu_`. Snapshots are published through an atomic
+  // pointer swap. Snapshots that are older than `kInfoSnapshotRefreshInterval`
+  // are replaced if `mu_` is free and otherwise returned as is until they are
+  // older than `kMaxInfoSnapshotAge`.
+  std::shared_ptr<const TableInfo> InfoSnapshot() const
+      ABSL_LOCKS_EXCLUDED(mu_) ABSL_NO_THREAD_SAFETY_ANALYSIS;
+
+  // Exports the size, rate limiter stats and latency stats of `InfoSnapshot`
+  // labelled with the name of the table.
+  void ExportMetrics(internal::MetricsWriter* writer) const;
+
   // Signature (if any) of the table.
   const absl::optional<tensorflow::StructuredValue>& signature() const;
 
-  // Makes a copy of all COMPLETED rate limiter events since (inclusive)
-  // `min_X_event_id`.
+  // Makes a copy of the recorded COMPLETED rate limiter events since
+  // (inclusive) `min_X_event_id`. See `RateLimiter::GetEventHistory`. Does not
+  // take `mu_`.
   RateLimiterEventHistory GetRateLimiterEventHistory(
-      size_t min_insert_event_id, size_t min_sample_event_id) const
-      ABSL_LOCKS_EXCLUDED(mu_);
+      size_t min_insert_event_id, size_t min_sample_event_id) const;
 
   // Cancels pending calls and marks object as closed. Object must be
   // abandoned after `Close` called.
@@ -269,10 +574,121 @@ class Table {
       Key key, double priority, std::initializer_list<TableExtension*> exclude)
       ABSL_ASSERT_EXCLUSIVE_LOCK(mu_);
 
+  // Deletes the items which expired at or before `now` (see `max_age`). Called
+  // periodically by the table itself.
+  tensorflow::Status ExpireItems(absl::Time now) ABSL_LOCKS_EXCLUDED(mu_);
+
   // Suggestion of default batch size to use in `SampleFlexibleBatch`.
   int32_t DefaultFlexibleBatchSize() const;
 
+  // Pins the table to a NUMA node (see `ServerOptions::table_numa_nodes`).
+  // The table itself only counts whether its inserts and samples are handled
+  // on `node`, the service is responsible for running them there. Must be
+  // called before the table is used.
+  void set_numa_node(int node);
+
+  // NUMA node which the table is pinned to, or -1 if it isn't.
+  int numa_node() const;
+
+  // Sets the rules by which the service derives items of the table from the
+  // chunks it receives (see `ItemRule`). The table itself only reports them,
+  // the service creates the items. Must be called before the table is used.
+  void set_item_rules(std::vector<ItemRule> rules);
+
+  const std::vector<ItemRule>& item_rules() const;
+
+  // Records the inserts, samples, mutations and resets requested by clients
+  // to `trace` (see `ServerOptions::workload_trace_path`). Items restored from
+  // checkpoints or replicated from a primary aren't recorded, nor are the
+  // deletes and updates the table makes itself. Must be called before the
+  // table is used.
+  void set_workload_trace(
+      std::shared_ptr<internal::WorkloadTraceWriter> trace);
+
  private:
+  // Snapshot of a frozen table, see `Freeze`.
+  struct FrozenState;
+
+  // Snapshot of `info()` published by `InfoSnapshot`.
+  struct InfoSnapshotEntry {
+    TableInfo info;
+    absl::Time taken_at;
+  };
+
+  // Latency of the table internals. Surfaced through `info()`.
+  struct LatencyStats {
+    internal::LatencyHistogram lock_wait;
+    internal::LatencyHistogram lock_hold;
+    internal::LatencyHistogram selector_insert;
+    internal::LatencyHistogram selector_sample;
+    internal::LatencyHistogram selector_update;
+    internal::LatencyHistogram selector_delete;
+    internal::LatencyHistogram extension_callbacks;
+
+    TableLatencyStats ToProto() const;
+  };
+
+  // State of the restore started by `BeginRestore`.
+  struct RestoreState {
+    // Whether `BeginRestore` has been called.
+    bool started = false;
+    bool in_progress = false;
+    double min_restored_fraction_to_sample = 1.0;
+
+    // Number of items to restore, -1 until `SetNumItemsToRestore` is called.
+    int64_t num_items = -1;
+    int64_t num_restored = 0;
+
+    // Whether the table holds a `BlockSamples` of `rate_limiter_`.
+    bool blocks_samples = false;
+  };
+
+  // Items of an episode and the sum of their (non-negative) priorities, see
+  // `index_episodes`.
+  struct EpisodeEntry {
+    std::vector<Key> keys;
+    double priority = 0;
+  };
+
+  // Adds (removes) `item` to (from) `episodes_` and updates the weight of its
+  // episode in `episode_sampler_`. No-ops unless episodes are indexed.
+  void IndexEpisodeItem(const CompactTableItem& item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void UnindexEpisodeItem(const CompactTableItem& item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Updates the weight of the episode of `item` after its priority changed
+  // from `old_priority` to `item.priority`.
+  void UpdateEpisodePriority(const CompactTableItem& item, double old_priority)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Increments `times_sampled` of `item`, appends it to `items`, notifies the
+  // extensions and deletes the item (into `deleted_items`) if it has reached
+  // `max_times_sampled_`, in which case `deleted` is set.
+  tensorflow::Status SampleItem(CompactTableItem* item, double probability,
+                                std::vector<SampledItem>* items,
+                                std::vector<CompactTableItem>* deleted_items,
+                                bool* deleted)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Counts an insert or sample by the calling thread as a local or remote
+  // access if the table is pinned to a NUMA node.
+  void RecordNumaAccess() const;
+
+  // Unblocks samples if the restore has progressed far enough.
+  void MaybeUnblockRestoredSamples() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Returns FailedPrecondition if the table is frozen.
+  tensorflow::Status CheckNotFrozen() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Samples `batch_size` items from the snapshot of a frozen table.
+  static void SampleFrozen(const FrozenState& state, int batch_size,
+                           bool without_replacement,
+                           std::vector<SampledItem>* items);
+
+  // Populates every field of `info` but the signature.
+  void LockedFillInfo(TableInfo* info) const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Updates item priority in `data_`, `samper_`, `remover_` and calls
   // `OnUpdate` on all extensions not part of `exclude`.
   tensorflow::Status UpdateItem(
@@ -280,12 +696,87 @@ class Table {
       std::initializer_list<TableExtension*> exclude = {})
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Updates the priorities of all items in `updates` that exist in the table.
+  // Keys that cannot be found are ignored. The selectors are updated with a
+  // single `UpdateBatch` call each and `OnUpdate` is called on all extensions
+  // for every updated item.
+  tensorflow::Status UpdateItems(absl::Span<const KeyWithPriority> updates)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Implementation of `UpdateItems` for updates of items which are known to
+  // exist, given with their slots in `keys_`.
+  tensorflow::Status UpdateItemsAt(absl::Span<const ItemSelector::Slot> slots,
+                                   absl::Span<const Key> keys,
+                                   absl::Span<const double> priorities)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Implementation of `InsertOrAssign`. Items that had to be removed in order
+  // to respect `max_size_` and `max_bytes_` are appended to `deleted_items` so
+  // that their deallocation can be postponed until the lock has been released.
+  //
+  // If `reserved_inserts` is set and positive then an insert takes one of the
+  // inserts that the caller has reserved with the rate limiter, without
+  // releasing the lock since, rather than waiting for the rate limiter.
+  tensorflow::Status InsertOrAssignInternal(
+      Item item, std::vector<CompactTableItem>* deleted_items,
+      int* reserved_inserts = nullptr) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Records the insert of `item` to `workload_trace_`, if set.
+  void TraceInsert(const Item& item) const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Increments (decrements) the episode and chunk reference counts for the
+  // chunks of `item`.
+  void AddReferences(const CompactTableItem& item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_, data_mu_);
+  void RemoveReferences(const CompactTableItem& item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_, data_mu_);
+
+  // Releases the table references of all chunks in `chunk_refs_` and clears
+  // it.
+  void ReleaseChunkReferences() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Structures swapped out of the table by `Reset`, which are destroyed by the
+  // reclaimer once the lock has been released. Defined in table.cc.
+  struct DetachedState;
+
+  // Converts between the representation used by the public API and the
+  // representation used in `data_`.
+  static CompactTableItem ToCompactItem(Item item);
+  PrioritizedItem ToPrioritizedItem(const CompactTableItem& item) const;
+  Item ToItem(const CompactTableItem& item) const;
+
+  // State of the `Checkpoint` in progress.
+  struct CheckpointState {
+    // State, at the start of the checkpoint, of the items which have been
+    // mutated since. Items which did not exist at the start are mapped to
+    // `absl::nullopt`. Only the first mutation of each item is recorded.
+    internal::flat_hash_map<Key, absl::optional<CompactTableItem>> pre_images;
+
+    // Set by the first `Reset` during the checkpoint to the items (and keys)
+    // which the table held when it was reset. The checkpoint continues to copy
+    // its items from `reset_data` rather than `data_` from then on.
+    std::unique_ptr<ItemMap> reset_data;
+    std::vector<Key> reset_keys;
+  };
+
+  // Records the current state of `key` in `checkpoint_` unless there is no
+  // checkpoint in progress or the key has already been recorded. Must be
+  // called before every mutation of `data_`.
+  void RecordPreImage(Key key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_, data_mu_);
+
+  // Inserts (removes) the item into (from) `data_` and `keys_`. `EraseItem`
+  // moves the removed item into `erased_item`.
+  CompactTableItem& EmplaceItem(CompactTableItem item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_, data_mu_);
+  void EraseItem(ItemMap::iterator it, CompactTableItem* erased_item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_, data_mu_);
+
   // Deletes the item associated with the key from `data_`, `sampler_` and
   // `remover_`. Ignores the key if it cannot be found.
   //
   // The deleted item is returned in order to allow the deallocation of the
   // underlying item to be postponed until the lock has been released.
-  tensorflow::Status DeleteItem(Key key, Item* deleted_item)
+  tensorflow::Status DeleteItem(Key key, CompactTableItem* deleted_item)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // Distribution used for sampling.
@@ -296,11 +787,48 @@ class Table {
 
   // Bijection of key to item. Used for storing the chunks and timestep range of
   // each item.
-  internal::flat_hash_map<Key, Item> data_ ABSL_GUARDED_BY(mu_);
+  ItemMap data_ ABSL_GUARDED_BY(mu_);
+
+  // The keys of `data_` in a dense array indexed by `CompactTableItem::index`.
+  // Unlike the iterators of `data_` positions remain meaningful across
+  // mutations, which lets `Checkpoint` copy the items in batches.
+  std::vector<Key> keys_ ABSL_GUARDED_BY(mu_);
+
+  // Whether `sampler_` (`remover_`) selects from `keys_` rather than from a
+  // copy of the keys of its own. See `ItemSelector::UseTableKeys`.
+  bool sampler_uses_keys_ = false;
+  bool remover_uses_keys_ = false;
+
+  // Non-null while `Checkpoint` is in progress. Set and cleared while holding
+  // a writer lock on `data_mu_` and read by mutations in `RecordPreImage`.
+  std::unique_ptr<CheckpointState> checkpoint_ ABSL_GUARDED_BY(data_mu_);
 
   // Count of references from chunks referenced by items.
   internal::flat_hash_map<uint64_t, int64_t> episode_refs_ ABSL_GUARDED_BY(mu_);
 
+  // Items of each episode, keyed by episode id. Empty unless the table was
+  // constructed with `index_episodes`.
+  internal::flat_hash_map<uint64_t, EpisodeEntry> episodes_
+      ABSL_GUARDED_BY(mu_);
+
+  // Samples episode ids in proportion to `EpisodeEntry::priority`. Null unless
+  // the table was constructed with `index_episodes`.
+  std::unique_ptr<ItemSelector> episode_sampler_ ABSL_GUARDED_BY(mu_);
+
+  // Count of references to each chunk from the items in the table. The chunk
+  // is kept alive by the items so the raw pointer is valid while the entry
+  // exists. The number of chunks isn't bounded by `max_size_` so the map grows
+  // incrementally.
+  struct ChunkRef {
+    ChunkStore::Chunk* chunk;
+    int64_t count;
+  };
+  internal::IncrementalHashMap<ChunkStore::Key, ChunkRef> chunk_refs_
+      ABSL_GUARDED_BY(mu_);
+
+  // Sum of `DataByteSizeLong` of the chunks in `chunk_refs_`.
+  int64_t num_bytes_ ABSL_GUARDED_BY(mu_);
+
   // The total number of episodes that were at some point referenced by items
   // in the table but have since been removed. Is set to 0 when `Reset()`
   // called.
@@ -314,6 +842,33 @@ class Table {
   // A value <= 0 means there is no limit.
   const int32_t max_times_sampled_;
 
+  // Maximum value of `num_bytes_`. InsertOrAssign() uses the remover to delete
+  // items until the limit is respected. A value <= 0 means there is no limit.
+  const int64_t max_bytes_;
+
+  // See the constructor.
+  const int64_t max_reserved_bytes_;
+
+  // Number of items which `data_`, `keys_`, `episode_refs_`, `chunk_refs_`
+  // and the selectors were reserved for at construction. The structures of
+  // the table itself are reserved again by every `Reset`.
+  int64_t reserved_items_ = 0;
+
+  // Time after their insertion that items expire. Infinite if they don't.
+  const absl::Duration max_age_;
+
+  // Items ordered by the time they expire at, tagged with their
+  // `inserted_at_ns`. The entries of deleted items are skipped when they
+  // expire. Null unless `max_age_` is finite.
+  std::unique_ptr<internal::ExpiryQueue> expiry_queue_ ABSL_GUARDED_BY(mu_);
+
+  // Number of items deleted by `ExpireItems`.
+  int64_t num_expired_items_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Calls `ExpireItems` every `expiry_queue_->granularity()`. Null unless
+  // `max_age_` is finite.
+  std::unique_ptr<internal::PeriodicClosure> expirer_;
+
   // Name of the table.
   const std::string name_;
 
@@ -326,12 +881,60 @@ class Table {
   // of insert, delete, update or reset operations.
   std::vector<std::shared_ptr<TableExtension>> extensions_ ABSL_GUARDED_BY(mu_);
 
+  // Time spent waiting for and holding `mu_` in the insert, sample, mutate and
+  // reset calls, and time spent in the selectors and the extension hooks.
+  LatencyStats latency_stats_ ABSL_GUARDED_BY(mu_);
+
   // Synchronizes access to `sampler_`, `remover_`, 'rate_limiter_`,
-  // 'extensions_` and `data_`,
-  mutable absl::Mutex mu_;
+  // 'extensions_` and `data_`. The lock is owned by `rate_limiter_` and shared
+  // by all tables that use it.
+  absl::Mutex& mu_;
+
+  // Secondary lock which allows read only accessors (`Get`, `Copy`, `size`
+  // etc.) to inspect `data_`, `episode_refs_`, `chunk_refs_`, `num_bytes_` and
+  // `num_deleted_episodes_` without waiting for `mu_`, which is held while the
+  // rate limiter is awaited and while the selectors and extensions are updated.
+  //
+  // Every mutation of these fields is performed while holding BOTH `mu_` and a
+  // writer lock on `data_mu_`. Code that holds `mu_` (including extensions)
+  // can therefore read the fields without acquiring `data_mu_`, whereas code
+  // that does not hold `mu_` must hold at least a reader lock on `data_mu_`.
+  // The writer lock is only held for the duration of the container operation
+  // itself so readers are never blocked by the rate limiter or the selectors.
+  mutable absl::Mutex data_mu_ ABSL_ACQUIRED_AFTER(mu_);
+
+  // Serializes calls to `Checkpoint`.
+  absl::Mutex checkpoint_mu_ ABSL_ACQUIRED_BEFORE(mu_);
+
+  // Background restore of a checkpoint, see `BeginRestore`.
+  RestoreState restore_ ABSL_GUARDED_BY(mu_);
 
   // Optional signature for data in the table.
   const absl::optional<tensorflow::StructuredValue> signature_;
+
+  // NUMA node which the table is pinned to, or -1 if it isn't.
+  int numa_node_ = -1;
+
+  // Number of inserts and samples handled on and off `numa_node_`. Only
+  // counted if the table is pinned.
+  mutable std::atomic<int64_t> num_numa_local_accesses_{0};
+  mutable std::atomic<int64_t> num_numa_remote_accesses_{0};
+
+  // Rules by which the service derives items of the table.
+  std::vector<ItemRule> item_rules_;
+
+  // Receives the operations requested by clients. Null unless tracing.
+  std::shared_ptr<internal::WorkloadTraceWriter> workload_trace_;
+
+  // Latest snapshot returned by `InfoSnapshot`. Only accessed through
+  // `std::atomic_load` and `std::atomic_store`. Null until the first call.
+  mutable std::shared_ptr<const InfoSnapshotEntry> info_snapshot_;
+
+  // Snapshot of the table once it has been frozen. It is published through
+  // `frozen_` and never replaced, so samplers read it without a lock or a
+  // reference count.
+  std::unique_ptr<const FrozenState> frozen_state_ ABSL_GUARDED_BY(mu_);
+  std::atomic<const FrozenState*> frozen_{nullptr};
 };
 
 }  // namespace reverb
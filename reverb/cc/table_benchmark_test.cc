@@ -0,0 +1,395 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of `Table::InsertOrAssign`, `SampleFlexibleBatch`
+// and `MutateItems`, and the latency of `Checkpoint`, for combinations of
+// selectors, table sizes and numbers of concurrent threads. Inserts and
+// samples are also measured together with and without a rate limiter which
+// holds them to a fixed ratio, and with a thread which reads the table with
+// the read only accessors at the same time. The test is tagged as manual and
+// has to be run explicitly:
+//
+//   bazel test -c opt //reverb/cc:table_benchmark_test \
+//     --test_output=streamed
+//
+// Every measurement is logged as one line and, when run by bazel, written as
+// a row of `table_benchmark.csv` in the undeclared outputs of the test (see
+// `bazel-testlogs/reverb/cc/table_benchmark_test/test.outputs`) so that the
+// results can be compared across releases.
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/heap.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Total number of operations of a measurement, spread over its threads.
+constexpr int64_t kOpsPerMeasurement = 100000;
+constexpr int kNumCheckpoints = 5;
+constexpr int kMutateBatchSize = 16;
+constexpr double kRateLimiterErrorBuffer = 1000;
+
+const std::vector<int64_t>& TableSizes() {
+  static const auto* sizes = new std::vector<int64_t>{1000, 100000};
+  return *sizes;
+}
+
+const std::vector<int>& ThreadCounts() {
+  static const auto* counts = new std::vector<int>{1, 4, 16};
+  return *counts;
+}
+
+struct Selector {
+  std::string name;
+  std::function<std::shared_ptr<ItemSelector>()> make;
+};
+
+std::vector<Selector> Selectors() {
+  return {
+      {"uniform", [] { return std::make_shared<UniformSelector>(); }},
+      {"prioritized", [] { return std::make_shared<PrioritizedSelector>(1); }},
+      {"fifo", [] { return std::make_shared<FifoSelector>(); }},
+      {"heap", [] { return std::make_shared<HeapSelector>(); }},
+  };
+}
+
+// One row of the results.
+struct Measurement {
+  std::string operation;
+  std::string sampler;
+  std::string remover;
+  int64_t table_size;
+  int threads;
+  std::string rate_limiter;
+  int batch_size;
+  int64_t ops;
+  absl::Duration elapsed;
+};
+
+constexpr char kCsvHeader[] =
+    "operation,sampler,remover,table_size,threads,rate_limiter,batch_size,"
+    "ops,seconds,ops_per_second";
+
+// Logs `m` and appends it to the CSV file of the test (if run by bazel).
+void Report(const Measurement& m) {
+  const double seconds = absl::ToDoubleSeconds(m.elapsed);
+  const std::string row = absl::StrCat(
+      m.operation, ",", m.sampler, ",", m.remover, ",", m.table_size, ",",
+      m.threads, ",", m.rate_limiter, ",", m.batch_size, ",", m.ops, ",",
+      seconds, ",", m.ops / seconds);
+  REVERB_LOG(REVERB_INFO) << row;
+
+  static std::ofstream* csv = [] {
+    const char* dir = std::getenv("TEST_UNDECLARED_OUTPUTS_DIR");
+    if (dir == nullptr) return static_cast<std::ofstream*>(nullptr);
+    auto* file =
+        new std::ofstream(absl::StrCat(dir, "/table_benchmark.csv"));
+    *file << kCsvHeader << "\n";
+    return file;
+  }();
+  if (csv != nullptr) *csv << row << std::endl;
+}
+
+// All items reference the same chunk so that building them stays out of the
+// measurements.
+TableItem MakeItem(uint64_t key, double priority,
+                   const std::shared_ptr<ChunkStore::Chunk>& chunk) {
+  TableItem item;
+  item.chunks = {chunk};
+  item.item = testing::MakePrioritizedItem(key, priority, {chunk->data()});
+  return item;
+}
+
+// Rate limiter which never blocks once the table holds an item.
+std::shared_ptr<RateLimiter> MakeUnlimitedLimiter() {
+  return std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX);
+}
+
+// Rate limiter which keeps the number of samples and inserts, after the table
+// has been filled with `table_size` items, within an error buffer.
+std::shared_ptr<RateLimiter> MakeRatioLimiter(int64_t table_size) {
+  return std::make_shared<RateLimiter>(1.0, 1,
+                                       table_size - kRateLimiterErrorBuffer,
+                                       table_size + kRateLimiterErrorBuffer);
+}
+
+class TableBenchmark {
+ public:
+  TableBenchmark(const Selector& sampler, const Selector& remover,
+                 int64_t table_size, std::shared_ptr<RateLimiter> limiter)
+      : sampler_(sampler.name),
+        remover_(remover.name),
+        table_size_(table_size),
+        chunk_(std::make_shared<ChunkStore::Chunk>(testing::MakeChunkData(
+            1, testing::MakeSequenceRange(1, 0, 0)))),
+        table_(std::make_shared<Table>("benchmark", sampler.make(),
+                                       remover.make(), table_size,
+                                       /*max_times_sampled=*/0,
+                                       std::move(limiter))) {
+    absl::BitGen bit_gen;
+    for (int64_t key = 0; key < table_size_; key++) {
+      TF_CHECK_OK(table_->InsertOrAssign(
+          MakeItem(key, absl::Uniform<double>(bit_gen, 0, 100), chunk_)));
+    }
+  }
+
+  // Inserts new items, each of which makes the remover delete one.
+  Measurement InsertOrAssign(int num_threads) {
+    const int64_t ops_per_thread = kOpsPerMeasurement / num_threads;
+    std::vector<std::vector<TableItem>> items(num_threads);
+    for (int t = 0; t < num_threads; t++) {
+      for (int64_t i = 0; i < ops_per_thread; i++) {
+        const uint64_t key = next_key_++;
+        items[t].push_back(MakeItem(key, key % 100, chunk_));
+      }
+    }
+    return Run("insert", num_threads, /*batch_size=*/1, ops_per_thread,
+               [&](int t, int64_t i) {
+                 TF_CHECK_OK(table_->InsertOrAssign(std::move(items[t][i])));
+               });
+  }
+
+  Measurement SampleFlexibleBatch(int num_threads, int batch_size) {
+    const int64_t ops_per_thread = kOpsPerMeasurement / num_threads;
+    return Run("sample", num_threads, batch_size, ops_per_thread / batch_size,
+               [&](int, int64_t) {
+                 std::vector<Table::SampledItem> sampled;
+                 TF_CHECK_OK(table_->SampleFlexibleBatch(&sampled, batch_size));
+               });
+  }
+
+  // Updates the priorities of random items in batches.
+  Measurement MutateItems(int num_threads) {
+    const int64_t ops_per_thread = kOpsPerMeasurement / num_threads;
+    std::vector<uint64_t> keys;
+    for (const auto& item : table_->Copy()) keys.push_back(item.item.key());
+    std::vector<std::vector<KeyWithPriority>> updates(num_threads);
+    absl::BitGen bit_gen;
+    for (int t = 0; t < num_threads; t++) {
+      for (int64_t i = 0; i < ops_per_thread; i++) {
+        updates[t].push_back(testing::MakeKeyWithPriority(
+            keys[absl::Uniform<size_t>(bit_gen, 0, keys.size())],
+            absl::Uniform<double>(bit_gen, 0, 100)));
+      }
+    }
+    return Run("mutate", num_threads, kMutateBatchSize,
+               ops_per_thread / kMutateBatchSize, [&](int t, int64_t i) {
+                 TF_CHECK_OK(table_->MutateItems(
+                     absl::MakeConstSpan(updates[t].data() +
+                                             i * kMutateBatchSize,
+                                         kMutateBatchSize),
+                     {}));
+               });
+  }
+
+  // Checkpoints the table while `num_threads - 1` threads sample from it.
+  Measurement Checkpoint(int num_threads) {
+    absl::Notification done;
+    std::vector<std::unique_ptr<internal::Thread>> samplers;
+    for (int t = 0; t < num_threads - 1; t++) {
+      samplers.push_back(internal::StartThread("Sampler", [&] {
+        std::vector<Table::SampledItem> sampled;
+        while (!done.HasBeenNotified()) {
+          TF_CHECK_OK(table_->SampleFlexibleBatch(&sampled, 1));
+          sampled.clear();
+        }
+      }));
+    }
+    const absl::Time start = absl::Now();
+    for (int i = 0; i < kNumCheckpoints; i++) {
+      auto checkpoint = table_->Checkpoint();
+      int64_t num_items = 0;
+      for (const auto& block : checkpoint.item_blocks) {
+        num_items += block.keys_size();
+      }
+      EXPECT_EQ(num_items, table_size_);
+    }
+    const absl::Duration elapsed = absl::Now() - start;
+    done.Notify();
+    samplers.clear();
+    return {"checkpoint", sampler_, remover_, table_size_, num_threads,
+            "unlimited", /*batch_size=*/1, kNumCheckpoints, elapsed};
+  }
+
+  // Half of the threads insert new items while the other half samples.
+  Measurement InsertAndSample(int num_threads, const std::string& limiter) {
+    const int num_inserters = std::max(num_threads / 2, 1);
+    const int num_samplers = std::max(num_threads - num_inserters, 1);
+    const int64_t ops_per_thread =
+        kOpsPerMeasurement / (num_inserters + num_samplers);
+    std::vector<std::vector<TableItem>> items(num_inserters);
+    for (int t = 0; t < num_inserters; t++) {
+      for (int64_t i = 0; i < ops_per_thread; i++) {
+        const uint64_t key = next_key_++;
+        items[t].push_back(MakeItem(key, key % 100, chunk_));
+      }
+    }
+    Measurement m = Run(
+        "insert_and_sample", num_inserters + num_samplers, /*batch_size=*/1,
+        ops_per_thread, [&](int t, int64_t i) {
+          if (t < num_inserters) {
+            TF_CHECK_OK(table_->InsertOrAssign(std::move(items[t][i])));
+          } else {
+            std::vector<Table::SampledItem> sampled;
+            TF_CHECK_OK(table_->SampleFlexibleBatch(&sampled, 1));
+          }
+        });
+    m.rate_limiter = limiter;
+    return m;
+  }
+
+  // Same as `InsertAndSample` while another thread calls `Get` and `size`.
+  // The reads don't wait for the lock of the inserts and samples so their
+  // throughput should not drop with the number of threads. Returns the
+  // measurement of the inserts and samples followed by that of the reads.
+  std::vector<Measurement> InsertAndSampleWhileReading(int num_threads) {
+    std::atomic<bool> done(false);
+    std::atomic<int64_t> num_reads(0);
+    auto reader = internal::StartThread("Reader", [&] {
+      Table::Item item;
+      while (!done) {
+        // The item may have been removed, which costs the same lookup.
+        table_->Get(table_size_ - 1, &item);
+        EXPECT_LE(table_->size(), table_size_);
+        num_reads++;
+      }
+    });
+    Measurement writes = InsertAndSample(num_threads, "unlimited");
+    done = true;
+    reader = nullptr;  // Joins the thread.
+
+    Measurement reads = writes;
+    reads.operation = "read_while_inserting_and_sampling";
+    reads.ops = num_reads;
+    return {writes, reads};
+  }
+
+ private:
+  // Runs `op(thread, i)` for `i` in [0, `ops_per_thread`) on each of
+  // `num_threads` threads which start at the same time.
+  Measurement Run(const std::string& operation, int num_threads,
+                  int batch_size, int64_t ops_per_thread,
+                  const std::function<void(int, int64_t)>& op) {
+    absl::Notification start;
+    std::vector<std::unique_ptr<internal::Thread>> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.push_back(internal::StartThread("Benchmark", [&, t] {
+        start.WaitForNotification();
+        for (int64_t i = 0; i < ops_per_thread; i++) op(t, i);
+      }));
+    }
+    const absl::Time begin = absl::Now();
+    start.Notify();
+    threads.clear();  // Joins the threads.
+    return {operation,   sampler_,   remover_,
+            table_size_, num_threads, "unlimited",
+            batch_size,  num_threads * ops_per_thread * batch_size,
+            absl::Now() - begin};
+  }
+
+  const std::string sampler_;
+  const std::string remover_;
+  const int64_t table_size_;
+  const std::shared_ptr<ChunkStore::Chunk> chunk_;
+  const std::shared_ptr<Table> table_;
+
+  // Key of the next item inserted into the table. Keys [0, `table_size_`) are
+  // used to fill the table.
+  uint64_t next_key_ = table_size_;
+};
+
+TEST(TableBenchmark, OperationsBySelectorsTableSizeAndThreads) {
+  for (const Selector& sampler : Selectors()) {
+    for (const Selector& remover : Selectors()) {
+      for (int64_t table_size : TableSizes()) {
+        TableBenchmark benchmark(sampler, remover, table_size,
+                                 MakeUnlimitedLimiter());
+        for (int threads : ThreadCounts()) {
+          Report(benchmark.InsertOrAssign(threads));
+          Report(benchmark.SampleFlexibleBatch(threads, /*batch_size=*/1));
+          Report(benchmark.SampleFlexibleBatch(threads, /*batch_size=*/64));
+          Report(benchmark.MutateItems(threads));
+          Report(benchmark.Checkpoint(threads));
+        }
+      }
+    }
+  }
+}
+
+TEST(TableBenchmark, InsertAndSampleByRateLimiter) {
+  for (const Selector& sampler : Selectors()) {
+    const Selector remover = Selectors()[2];  // FIFO.
+    for (int64_t table_size : TableSizes()) {
+      for (int threads : ThreadCounts()) {
+        TableBenchmark unlimited(sampler, remover, table_size,
+                                 MakeUnlimitedLimiter());
+        Report(unlimited.InsertAndSample(threads, "unlimited"));
+        TableBenchmark ratio(sampler, remover, table_size,
+                             MakeRatioLimiter(table_size));
+        Report(ratio.InsertAndSample(threads, "samples_per_insert_1"));
+      }
+    }
+  }
+}
+
+TEST(TableBenchmark, ReadsWhileInsertingAndSampling) {
+  const Selector uniform = Selectors()[0];
+  const Selector fifo = Selectors()[2];
+  for (int64_t table_size : TableSizes()) {
+    for (int threads : ThreadCounts()) {
+      TableBenchmark benchmark(uniform, fifo, table_size,
+                               MakeUnlimitedLimiter());
+      for (const Measurement& m :
+           benchmark.InsertAndSampleWhileReading(threads)) {
+        Report(m);
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
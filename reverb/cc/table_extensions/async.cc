@@ -0,0 +1,150 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/table_extensions/async.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+
+AsyncTableExtension::AsyncTableExtension(internal::Executor* executor)
+    : executor_(executor) {}
+
+tensorflow::Status AsyncTableExtension::RegisterTable(absl::Mutex* mu,
+                                                      Table* table) {
+  {
+    absl::MutexLock lock(&mu_);
+    if (table_) {
+      return tensorflow::errors::FailedPrecondition(
+          "Attempting to registering a table ", table, " (name: ",
+          table->name(), ") with extension that has already been ",
+          "registered with: ", table_, " (name: ", table_->name(), ")");
+    }
+    table_ = table;
+    stopped_ = false;
+  }
+  auto run = [this] { RunWorker(); };
+  worker_ = executor_ == nullptr
+                ? internal::StartThread("AsyncTableExtension", run)
+                : internal::StartThread(executor_, "AsyncTableExtension", run);
+  return tensorflow::Status::OK();
+}
+
+void AsyncTableExtension::UnregisterTable(absl::Mutex* mu, Table* table) {
+  {
+    absl::MutexLock lock(&mu_);
+    REVERB_CHECK_EQ(table, table_)
+        << "The wrong Table attempted to unregister this extension.";
+    stopped_ = true;
+  }
+  worker_ = nullptr;  // Joins thread.
+
+  // The worker applies all pending events before it returns, unless the
+  // executor never ran it.
+  ApplyPending();
+
+  absl::MutexLock lock(&mu_);
+  table_ = nullptr;
+}
+
+void AsyncTableExtension::OnDelete(absl::Mutex* mu, const TableItem& item) {
+  Log(TableExtensionEvent::Type::kDelete, &item);
+}
+
+void AsyncTableExtension::OnInsert(absl::Mutex* mu, const TableItem& item) {
+  Log(TableExtensionEvent::Type::kInsert, &item);
+}
+
+void AsyncTableExtension::OnReset(absl::Mutex* mu) {
+  Log(TableExtensionEvent::Type::kReset, nullptr);
+}
+
+void AsyncTableExtension::OnUpdate(absl::Mutex* mu, const TableItem& item) {
+  Log(TableExtensionEvent::Type::kUpdate, &item);
+}
+
+void AsyncTableExtension::OnSample(absl::Mutex* mu, const TableItem& item) {
+  Log(TableExtensionEvent::Type::kSample, &item);
+}
+
+void AsyncTableExtension::Log(TableExtensionEvent::Type type,
+                              const TableItem* item) {
+  // The item is copied before the lock is acquired so that `RunWorker` only
+  // waits for the push.
+  TableExtensionEvent event{type, {}};
+  if (item != nullptr) event.item = item->item;
+
+  absl::MutexLock lock(&mu_);
+  pending_.push_back(std::move(event));
+  num_logged_++;
+}
+
+void AsyncTableExtension::RunWorker() {
+  auto trigger = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return stopped_ || !pending_.empty();
+  };
+
+  std::vector<TableExtensionEvent> batch;
+  while (true) {
+    {
+      absl::MutexLock lock(&mu_);
+      num_applied_ += batch.size();
+      batch.clear();
+      mu_.Await(absl::Condition(&trigger));
+      if (stopped_ && pending_.empty()) return;
+      batch.swap(pending_);
+    }
+    ApplyOnEvents(batch);
+  }
+}
+
+void AsyncTableExtension::ApplyPending() {
+  std::vector<TableExtensionEvent> batch;
+  {
+    absl::MutexLock lock(&mu_);
+    batch.swap(pending_);
+  }
+  if (batch.empty()) return;
+  ApplyOnEvents(batch);
+
+  absl::MutexLock lock(&mu_);
+  num_applied_ += batch.size();
+}
+
+void AsyncTableExtension::Flush() {
+  absl::MutexLock lock(&mu_);
+  const int64_t target = num_logged_;
+  auto trigger = [this, target]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return num_applied_ >= target;
+  };
+  mu_.Await(absl::Condition(&trigger));
+}
+
+int64_t AsyncTableExtension::pending() const {
+  absl::MutexLock lock(&mu_);
+  return num_logged_ - num_applied_;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
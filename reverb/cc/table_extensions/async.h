@@ -0,0 +1,127 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_TABLE_EXTENSIONS_ASYNC_H_
+#define REVERB_CC_TABLE_EXTENSIONS_ASYNC_H_
+
+#include <memory>
+#include <vector>
+
+#include <cstdint>
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/table_extensions/interface.h"
+#include "tensorflow/core/platform/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// A call of one of the hooks of a `TableExtension`.
+struct TableExtensionEvent {
+  enum class Type { kInsert, kDelete, kUpdate, kSample, kReset };
+
+  Type type;
+
+  // Item the hook was called with, without its chunks. Empty for `kReset`.
+  PrioritizedItem item;
+};
+
+// Table extension which applies the hooks of the parent table in the
+// background rather than while the table holds its lock.
+//
+// The hooks only log the event, which takes a lock that is never held while
+// the events are applied, and the events are then passed to `ApplyOnEvents` in
+// the order the hooks were called. This is intended for extensions which
+// observe the table, e.g to compute statistics over the items. Extensions which
+// must modify the table synchronously (i.e through `Table::UnsafeUpdateItem`)
+// should derive from `TableExtensionBase` instead.
+class AsyncTableExtension : public TableExtension {
+ public:
+  // The events are applied by a thread started on `executor`, which must
+  // outlive the registration of the extension. If null then a dedicated thread
+  // is started.
+  explicit AsyncTableExtension(internal::Executor* executor = nullptr);
+
+  // Called with the events logged since the previous call, in order. Calls are
+  // never concurrent with each other.
+  virtual void ApplyOnEvents(absl::Span<const TableExtensionEvent> events) = 0;
+
+  // Blocks until all events logged before the call have been applied.
+  void Flush() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of events which have been logged but not yet applied.
+  int64_t pending() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ protected:
+  // Starts the thread which applies the events.
+  tensorflow::Status RegisterTable(absl::Mutex* mu, Table* table)
+      ABSL_LOCKS_EXCLUDED(mu) override;
+
+  // Applies the pending events and stops the thread.
+  void UnregisterTable(absl::Mutex* mu, Table* table)
+      ABSL_LOCKS_EXCLUDED(mu) override;
+
+  void OnDelete(absl::Mutex* mu, const TableItem& item) override
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+  void OnInsert(absl::Mutex* mu, const TableItem& item) override
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+  void OnReset(absl::Mutex* mu) override ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+  void OnUpdate(absl::Mutex* mu, const TableItem& item) override
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+  void OnSample(absl::Mutex* mu, const TableItem& item) override
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
+  bool CanModifyTable() const override { return false; }
+
+ private:
+  void Log(TableExtensionEvent::Type type, const TableItem* item)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Loop run by `worker_`. Returns when `stopped_` is set and all pending
+  // events have been applied.
+  void RunWorker() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Applies `pending_` on the calling thread. Used once `worker_` has stopped.
+  void ApplyPending() ABSL_LOCKS_EXCLUDED(mu_);
+
+  internal::Executor* const executor_;
+
+  mutable absl::Mutex mu_;
+
+  // Events waiting to be applied by `worker_`.
+  std::vector<TableExtensionEvent> pending_ ABSL_GUARDED_BY(mu_);
+
+  // Total number of events logged and applied. `Flush` waits for
+  // `num_applied_` to catch up with `num_logged_`.
+  int64_t num_logged_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_applied_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Set in `UnregisterTable` to stop `worker_`.
+  bool stopped_ ABSL_GUARDED_BY(mu_) = false;
+
+  // The table the extension is registered with.
+  Table* table_ ABSL_GUARDED_BY(mu_) = nullptr;
+
+  // Background thread which applies the events in `pending_`.
+  std::unique_ptr<internal::Thread> worker_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_TABLE_EXTENSIONS_ASYNC_H_
@@ -0,0 +1,131 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/table_extensions/async.h"
+
+#include <cfloat>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+using Type = TableExtensionEvent::Type;
+
+// Records the type and key of the events it is applied with.
+class RecordingExtension : public AsyncTableExtension {
+ public:
+  using AsyncTableExtension::AsyncTableExtension;
+
+  void ApplyOnEvents(absl::Span<const TableExtensionEvent> events) override {
+    absl::MutexLock lock(&mu_);
+    for (const auto& event : events) {
+      events_.emplace_back(event.type, event.item.key());
+    }
+  }
+
+  std::vector<std::pair<Type, uint64_t>> events() {
+    absl::MutexLock lock(&mu_);
+    return events_;
+  }
+
+ private:
+  absl::Mutex mu_;
+  std::vector<std::pair<Type, uint64_t>> events_ ABSL_GUARDED_BY(mu_);
+};
+
+TableItem MakeItem(uint64_t key, double priority) {
+  const auto chunk =
+      testing::MakeChunkData(key, testing::MakeSequenceRange(key, 0, 1));
+  TableItem item;
+  item.item = testing::MakePrioritizedItem(key, priority, {chunk});
+  item.chunks.push_back(std::make_shared<ChunkStore::Chunk>(chunk));
+  return item;
+}
+
+std::unique_ptr<Table> MakeTable(std::shared_ptr<TableExtension> extension) {
+  return absl::make_unique<Table>(
+      "table", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), /*max_size=*/10,
+      /*max_times_sampled=*/0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX),
+      std::vector<std::shared_ptr<TableExtension>>{std::move(extension)});
+}
+
+TEST(AsyncTableExtensionTest, AppliesEventsInOrder) {
+  auto extension = std::make_shared<RecordingExtension>();
+  auto table = MakeTable(extension);
+
+  TF_ASSERT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  TF_ASSERT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+  TF_ASSERT_OK(table->MutateItems({testing::MakeKeyWithPriority(1, 5)}, {2}));
+  Table::SampledItem sample;
+  TF_ASSERT_OK(table->Sample(&sample));
+  TF_ASSERT_OK(table->Reset());
+
+  extension->Flush();
+  EXPECT_EQ(extension->pending(), 0);
+  EXPECT_THAT(extension->events(),
+              ElementsAre(Pair(Type::kInsert, 1), Pair(Type::kInsert, 2),
+                          Pair(Type::kUpdate, 1), Pair(Type::kDelete, 2),
+                          Pair(Type::kSample, 1), Pair(Type::kReset, 0)));
+}
+
+TEST(AsyncTableExtensionTest, AppliesPendingEventsWhenUnregistered) {
+  auto extension = std::make_shared<RecordingExtension>();
+  auto table = MakeTable(extension);
+  for (uint64_t key = 0; key < 100; key++) {
+    TF_ASSERT_OK(table->InsertOrAssign(MakeItem(key, 1)));
+  }
+  table = nullptr;
+
+  EXPECT_EQ(extension->pending(), 0);
+  EXPECT_EQ(extension->events().size(), 100);
+}
+
+TEST(AsyncTableExtensionTest, RunsOnExecutor) {
+  internal::ThreadPool pool(1, "AsyncTableExtensionTest");
+  auto extension = std::make_shared<RecordingExtension>(&pool);
+  auto table = MakeTable(extension);
+
+  TF_ASSERT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  extension->Flush();
+  EXPECT_THAT(extension->events(), ElementsAre(Pair(Type::kInsert, 1)));
+  table = nullptr;
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -61,6 +61,10 @@ class TableExtension {
   // Executed just before all items are deleted.
   virtual void OnReset(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) = 0;
 
+  // Whether the hooks can modify the parent `Table`. The table only draws the
+  // keys of a batch in a single step if none of its extensions can.
+  virtual bool CanModifyTable() const { return true; }
+
   // Table calls these methods on construction and destruction.
   virtual tensorflow::Status RegisterTable(absl::Mutex* mu, Table* table)
       ABSL_LOCKS_EXCLUDED(mu) = 0;
@@ -0,0 +1,104 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/table_extensions/priority_transform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+double PriorityTransform::Apply(const Table::PriorityTransformInput& item,
+                                absl::Time now, absl::Time previous) const {
+  double priority = item.priority;
+  if (half_life != absl::InfiniteDuration()) {
+    const absl::Duration age = now - std::max(previous, item.inserted_at);
+    if (age > absl::ZeroDuration()) {
+      priority *= std::exp2(-absl::FDivDuration(age, half_life));
+    }
+  }
+  if (exponent != 1 && priority != 0) {
+    priority = std::pow(priority, exponent);
+  }
+  return std::min(std::max(priority, min_priority), max_priority);
+}
+
+PriorityTransformExtension::PriorityTransformExtension(
+    PriorityTransform transform, absl::Duration period)
+    : transform_(transform), period_(period) {
+  REVERB_CHECK_GT(transform_.half_life, absl::ZeroDuration());
+  REVERB_CHECK_GE(transform_.min_priority, 0);
+  REVERB_CHECK_LE(transform_.min_priority, transform_.max_priority);
+  REVERB_CHECK_GT(period_, absl::ZeroDuration());
+}
+
+tensorflow::Status PriorityTransformExtension::Apply() {
+  absl::MutexLock apply_lock(&apply_mu_);
+  absl::MutexLock lock(&table_mu_);
+  if (table_ == nullptr) {
+    return tensorflow::errors::FailedPrecondition(
+        "PriorityTransformExtension is not registered with a table.");
+  }
+  const absl::Time now = absl::Now();
+  const absl::Time previous = previous_;
+  auto status = table_->TransformPriorities(
+      [this, now, previous](const Table::PriorityTransformInput& item) {
+        return transform_.Apply(item, now, previous);
+      });
+  previous_ = now;
+  return status;
+}
+
+tensorflow::Status PriorityTransformExtension::RegisterTable(absl::Mutex* mu,
+                                                             Table* table) {
+  TF_RETURN_IF_ERROR(TableExtensionBase::RegisterTable(mu, table));
+  if (period_ == absl::InfiniteDuration()) return tensorflow::Status::OK();
+  closure_ = absl::make_unique<internal::PeriodicClosure>(
+      [this] {
+        auto status = Apply();
+        REVERB_LOG_IF(REVERB_ERROR, !status.ok())
+            << "Failed to transform the priorities of the table: " << status;
+      },
+      period_, "PriorityTransform");
+  return closure_->Start();
+}
+
+void PriorityTransformExtension::UnregisterTable(absl::Mutex* mu,
+                                                 Table* table) {
+  // The closure is stopped first as `Apply` holds `table_mu_`.
+  if (closure_ != nullptr) {
+    TF_CHECK_OK(closure_->Stop());
+    closure_ = nullptr;
+  }
+  TableExtensionBase::UnregisterTable(mu, table);
+
+  absl::MutexLock lock(&apply_mu_);
+  previous_ = absl::InfinitePast();
+}
+
+}  // namespace reverb
+}  // namespace deepmind
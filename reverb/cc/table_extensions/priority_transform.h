@@ -0,0 +1,97 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_TABLE_EXTENSIONS_PRIORITY_TRANSFORM_H_
+#define REVERB_CC_TABLE_EXTENSIONS_PRIORITY_TRANSFORM_H_
+
+#include <limits>
+#include <memory>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/table_extensions/base.h"
+#include "tensorflow/core/platform/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Parametric transform of the priorities of the items of a table. The steps
+// are applied in the order of the fields.
+struct PriorityTransform {
+  // Priorities are multiplied by 0.5^(age / half_life), where age is the time
+  // since the previous application of the transform or since the item was
+  // inserted, whichever is later. Applied periodically this decays the priority
+  // of each item by its age since it was inserted (or last updated by another
+  // source). Disabled if infinite.
+  absl::Duration half_life = absl::InfiniteDuration();
+
+  // Priorities are then raised to this power. Note that this compounds when
+  // the transform is applied periodically.
+  double exponent = 1;
+
+  // Priorities are finally clamped to [min_priority, max_priority].
+  double min_priority = 0;
+  double max_priority = std::numeric_limits<double>::infinity();
+
+  // Returns the new priority of `item`. `previous` is the time of the previous
+  // application, or `absl::InfinitePast()` if there is none.
+  double Apply(const Table::PriorityTransformInput& item, absl::Time now,
+               absl::Time previous) const;
+};
+
+// Applies a `PriorityTransform` to all items of the parent table, either
+// periodically or when `Apply` is called. Each application is a single
+// `Table::TransformPriorities` call, i.e a single pass over the items while
+// holding the lock of the table once.
+class PriorityTransformExtension : public TableExtensionBase {
+ public:
+  // If `period` is finite then the transform is applied every `period` while
+  // the extension is registered with a table.
+  PriorityTransformExtension(PriorityTransform transform,
+                             absl::Duration period = absl::InfiniteDuration());
+
+  // Applies the transform to all items of the parent table. Returns
+  // FailedPrecondition if the extension isn't registered with a table.
+  tensorflow::Status Apply() ABSL_LOCKS_EXCLUDED(table_mu_, apply_mu_);
+
+ protected:
+  // Starts (stops) applying the transform periodically.
+  tensorflow::Status RegisterTable(absl::Mutex* mu, Table* table)
+      ABSL_LOCKS_EXCLUDED(mu) override;
+  void UnregisterTable(absl::Mutex* mu, Table* table)
+      ABSL_LOCKS_EXCLUDED(mu) override;
+
+ private:
+  const PriorityTransform transform_;
+  const absl::Duration period_;
+
+  // Serializes calls to `Apply` so that each application decays the
+  // priorities by the time since the previous one.
+  absl::Mutex apply_mu_ ABSL_ACQUIRED_BEFORE(table_mu_);
+
+  // Time of the previous application.
+  absl::Time previous_ ABSL_GUARDED_BY(apply_mu_) = absl::InfinitePast();
+
+  // Calls `Apply` every `period_`. Only set while registered with a table.
+  std::unique_ptr<internal::PeriodicClosure> closure_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_TABLE_EXTENSIONS_PRIORITY_TRANSFORM_H_
@@ -0,0 +1,153 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/table_extensions/priority_transform.h"
+
+#include <cfloat>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+TableItem MakeItem(uint64_t key, double priority) {
+  const auto chunk =
+      testing::MakeChunkData(key, testing::MakeSequenceRange(key, 0, 1));
+  TableItem item;
+  item.item = testing::MakePrioritizedItem(key, priority, {chunk});
+  item.chunks.push_back(std::make_shared<ChunkStore::Chunk>(chunk));
+  return item;
+}
+
+std::unique_ptr<Table> MakeTable(std::shared_ptr<TableExtension> extension) {
+  return absl::make_unique<Table>(
+      "table", absl::make_unique<PrioritizedSelector>(1),
+      absl::make_unique<FifoSelector>(), /*max_size=*/1000,
+      /*max_times_sampled=*/0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX),
+      std::vector<std::shared_ptr<TableExtension>>{std::move(extension)});
+}
+
+double GetPriority(Table* table, uint64_t key) {
+  TableItem item;
+  EXPECT_TRUE(table->Get(key, &item));
+  return item.item.priority();
+}
+
+Table::PriorityTransformInput MakeInput(double priority,
+                                        absl::Time inserted_at) {
+  return {.key = 1,
+          .priority = priority,
+          .inserted_at = inserted_at,
+          .times_sampled = 0};
+}
+
+TEST(PriorityTransformTest, IsIdentityByDefault) {
+  const absl::Time now = absl::Now();
+  EXPECT_EQ(PriorityTransform().Apply(MakeInput(3, now - absl::Hours(1)), now,
+                                      absl::InfinitePast()),
+            3);
+}
+
+TEST(PriorityTransformTest, DecaysByAge) {
+  PriorityTransform transform;
+  transform.half_life = absl::Seconds(10);
+  const absl::Time now = absl::Now();
+  const absl::Time inserted_at = now - absl::Seconds(20);
+
+  EXPECT_DOUBLE_EQ(
+      transform.Apply(MakeInput(8, inserted_at), now, absl::InfinitePast()), 2);
+
+  // Only the time since the previous application counts.
+  EXPECT_DOUBLE_EQ(transform.Apply(MakeInput(8, inserted_at), now,
+                                   now - absl::Seconds(10)),
+                   4);
+}
+
+TEST(PriorityTransformTest, RaisesToPowerThenClamps) {
+  PriorityTransform transform;
+  transform.exponent = 2;
+  transform.min_priority = 1;
+  transform.max_priority = 10;
+  const absl::Time now = absl::Now();
+
+  EXPECT_EQ(transform.Apply(MakeInput(3, now), now, now), 9);
+  EXPECT_EQ(transform.Apply(MakeInput(4, now), now, now), 10);
+  EXPECT_EQ(transform.Apply(MakeInput(0, now), now, now), 1);
+}
+
+TEST(PriorityTransformExtensionTest, ApplyTransformsAllItems) {
+  PriorityTransform transform;
+  transform.exponent = 2;
+  auto extension = std::make_shared<PriorityTransformExtension>(transform);
+  auto table = MakeTable(extension);
+  for (uint64_t key = 0; key < 100; key++) {
+    TF_ASSERT_OK(table->InsertOrAssign(MakeItem(key, key)));
+  }
+
+  TF_ASSERT_OK(extension->Apply());
+  for (uint64_t key = 0; key < 100; key++) {
+    EXPECT_EQ(GetPriority(table.get(), key), key * key);
+  }
+
+  // The selector has been updated too.
+  TF_ASSERT_OK(table->MutateItems({}, {99}));
+  Table::SampledItem sample;
+  TF_ASSERT_OK(table->Sample(&sample));
+  EXPECT_DOUBLE_EQ(sample.probability * 98 * 99 * 197 / 6,
+                   sample.item.priority());
+}
+
+TEST(PriorityTransformExtensionTest, ApplyFailsIfNotRegistered) {
+  PriorityTransformExtension extension{PriorityTransform()};
+  EXPECT_EQ(extension.Apply().code(), tensorflow::error::FAILED_PRECONDITION);
+}
+
+TEST(PriorityTransformExtensionTest, DecaysPeriodically) {
+  PriorityTransform transform;
+  transform.half_life = absl::Milliseconds(10);
+  auto extension = std::make_shared<PriorityTransformExtension>(
+      transform, absl::Milliseconds(5));
+  auto table = MakeTable(extension);
+  TF_ASSERT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+
+  const absl::Time deadline = absl::Now() + absl::Seconds(10);
+  while (GetPriority(table.get(), 1) > 0.5 && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(5));
+  }
+  EXPECT_LE(GetPriority(table.get(), 1), 0.5);
+  table = nullptr;
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
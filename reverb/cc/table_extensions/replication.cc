@@ -0,0 +1,171 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/table_extensions/replication.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+
+ReplicationFeed::ReplicationFeed(int64_t max_pending_events)
+    : max_pending_events_(max_pending_events) {}
+
+void ReplicationFeed::Push(absl::string_view table,
+                           absl::Span<const TableExtensionEvent> events) {
+  absl::MutexLock lock(&mu_);
+  if (closed_ || overflowed_) return;
+
+  Batch* batch = nullptr;
+  for (const auto& event : events) {
+    if (event.type == TableExtensionEvent::Type::kSample) continue;
+    if (++num_pending_events_ > max_pending_events_) {
+      overflowed_ = true;
+      pending_.clear();
+      num_pending_events_ = 0;
+      return;
+    }
+    if (batch == nullptr) {
+      pending_.push_back(Batch{std::string(table), {}});
+      batch = &pending_.back();
+    }
+    batch->events.push_back(event);
+  }
+}
+
+tensorflow::Status ReplicationFeed::Pop(absl::Duration timeout,
+                                        std::vector<Batch>* batches) {
+  absl::MutexLock lock(&mu_);
+  auto ready = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return closed_ || overflowed_ || !pending_.empty();
+  };
+  mu_.AwaitWithTimeout(absl::Condition(&ready), timeout);
+  if (closed_) {
+    return tensorflow::errors::Cancelled("The replication feed was closed.");
+  }
+  if (overflowed_) {
+    return tensorflow::errors::ResourceExhausted(
+        "More than ", max_pending_events_,
+        " events of the replicated tables are pending.");
+  }
+  batches->clear();
+  batches->swap(pending_);
+  num_pending_events_ = 0;
+  return tensorflow::Status::OK();
+}
+
+void ReplicationFeed::Close() {
+  absl::MutexLock lock(&mu_);
+  closed_ = true;
+  pending_.clear();
+  num_pending_events_ = 0;
+}
+
+void ReplicationLog::Subscribe(std::shared_ptr<ReplicationFeed> feed) {
+  // The events logged before the call may already be applied by the time the
+  // feed has been added. These are the events which the replica may see twice.
+  absl::MutexLock lock(&feeds_mu_);
+  feeds_.push_back(std::move(feed));
+}
+
+void ReplicationLog::Unsubscribe(const ReplicationFeed* feed) {
+  absl::MutexLock lock(&feeds_mu_);
+  feeds_.erase(
+      std::remove_if(feeds_.begin(), feeds_.end(),
+                     [feed](const auto& other) { return other.get() == feed; }),
+      feeds_.end());
+}
+
+void ReplicationLog::ApplyOnEvents(
+    absl::Span<const TableExtensionEvent> events) {
+  absl::MutexLock lock(&feeds_mu_);
+  for (auto& feed : feeds_) {
+    feed->Push(table_name_, events);
+  }
+}
+
+tensorflow::Status ReplicationLog::RegisterTable(absl::Mutex* mu,
+                                                 Table* table) {
+  TF_RETURN_IF_ERROR(AsyncTableExtension::RegisterTable(mu, table));
+  absl::MutexLock lock(&feeds_mu_);
+  table_name_ = table->name();
+  return tensorflow::Status::OK();
+}
+
+void ReplicationLog::OnSample(absl::Mutex* mu, const TableItem& item) {
+  num_samples_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool ReplicatedChunks::Contains(uint64_t key) const {
+  return chunks_.contains(key);
+}
+
+std::shared_ptr<ChunkStore::Chunk> ReplicatedChunks::Find(uint64_t key) const {
+  auto it = chunks_.find(key);
+  return it == chunks_.end() ? nullptr : it->second.chunk;
+}
+
+void ReplicatedChunks::Add(
+    absl::string_view table, const PrioritizedItem& item,
+    absl::Span<const std::shared_ptr<ChunkStore::Chunk>> chunks) {
+  auto& items = items_[table];
+  auto [it, inserted] = items.try_emplace(item.key());
+  if (!inserted) return;
+  it->second.assign(item.chunk_keys().begin(), item.chunk_keys().end());
+  for (int i = 0; i < item.chunk_keys_size(); i++) {
+    Entry& entry = chunks_[item.chunk_keys(i)];
+    entry.num_items++;
+    if (entry.chunk == nullptr && i < static_cast<int>(chunks.size())) {
+      entry.chunk = chunks[i];
+    }
+  }
+}
+
+void ReplicatedChunks::Remove(absl::string_view table, uint64_t key) {
+  auto items = items_.find(table);
+  if (items == items_.end()) return;
+  auto it = items->second.find(key);
+  if (it == items->second.end()) return;
+  Release(it->second);
+  items->second.erase(it);
+}
+
+void ReplicatedChunks::RemoveTable(absl::string_view table) {
+  auto items = items_.find(table);
+  if (items == items_.end()) return;
+  for (const auto& item : items->second) {
+    Release(item.second);
+  }
+  items_.erase(items);
+}
+
+void ReplicatedChunks::Release(absl::Span<const uint64_t> chunk_keys) {
+  for (uint64_t chunk_key : chunk_keys) {
+    auto it = chunks_.find(chunk_key);
+    if (--it->second.num_items == 0) chunks_.erase(it);
+  }
+}
+
+}  // namespace reverb
+}  // namespace deepmind
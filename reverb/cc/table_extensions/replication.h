@@ -0,0 +1,183 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_TABLE_EXTENSIONS_REPLICATION_H_
+#define REVERB_CC_TABLE_EXTENSIONS_REPLICATION_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/table_extensions/async.h"
+#include "tensorflow/core/platform/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Mutations of the tables which a single replica follows, in the order in
+// which each table applied them. Written to by the `ReplicationLog`s of the
+// tables and read by the `ReplicateStream` of the replica.
+class ReplicationFeed {
+ public:
+  // Consecutive events of a single table.
+  struct Batch {
+    std::string table;
+    std::vector<TableExtensionEvent> events;
+  };
+
+  // The feed overflows once more than `max_pending_events` events have been
+  // pushed but not yet popped, i.e when the replica can't keep up.
+  explicit ReplicationFeed(int64_t max_pending_events);
+
+  // Appends the events of `table` which mutate it, i.e all but `kSample`
+  // events. Does nothing once the feed has been closed or has overflowed.
+  void Push(absl::string_view table,
+            absl::Span<const TableExtensionEvent> events)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Waits for at most `timeout` for events to be pushed and then moves the
+  // pending batches, in the order they were pushed, to `batches`. Returns
+  // ResourceExhausted once the feed has overflowed, in which case the pending
+  // events have been dropped, and Cancelled once it has been closed.
+  tensorflow::Status Pop(absl::Duration timeout, std::vector<Batch>* batches)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Unblocks `Pop` and drops all pending and future events.
+  void Close() ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  const int64_t max_pending_events_;
+
+  absl::Mutex mu_;
+  std::vector<Batch> pending_ ABSL_GUARDED_BY(mu_);
+  int64_t num_pending_events_ ABSL_GUARDED_BY(mu_) = 0;
+  bool overflowed_ ABSL_GUARDED_BY(mu_) = false;
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+// Table extension which passes the mutations of its table to the feeds of
+// the replicas which follow the table. The events are passed on in the
+// background (see `AsyncTableExtension`), so following a table only costs the
+// primary a copy of the item per mutation while the table lock is held.
+//
+// A replica first subscribes its feed and then copies the items of the table
+// (see `Table::Copy`). The feed thus receives every mutation applied after
+// the copy, and possibly some which the copy already reflects. Replaying these
+// on top of the copy leaves the replica in the same state as the primary as
+// inserts of existing items only assign their priority and mutations of
+// missing items are ignored.
+//
+// Samples aren't replicated. They are only counted, which lets replicas
+// report the samples which they have served themselves (see `num_samples`).
+class ReplicationLog : public AsyncTableExtension {
+ public:
+  using AsyncTableExtension::AsyncTableExtension;
+
+  // Passes all events applied after the call to `feed`, until `Unsubscribe`
+  // is called with it.
+  void Subscribe(std::shared_ptr<ReplicationFeed> feed)
+      ABSL_LOCKS_EXCLUDED(feeds_mu_);
+  void Unsubscribe(const ReplicationFeed* feed) ABSL_LOCKS_EXCLUDED(feeds_mu_);
+
+  // Number of items which have been sampled from the table.
+  int64_t num_samples() const {
+    return num_samples_.load(std::memory_order_relaxed);
+  }
+
+  void ApplyOnEvents(absl::Span<const TableExtensionEvent> events) override
+      ABSL_LOCKS_EXCLUDED(feeds_mu_);
+
+ protected:
+  tensorflow::Status RegisterTable(absl::Mutex* mu, Table* table)
+      ABSL_LOCKS_EXCLUDED(mu) override;
+
+  void OnSample(absl::Mutex* mu, const TableItem& item) override
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
+ private:
+  mutable absl::Mutex feeds_mu_;
+
+  // Name of the table the extension is registered with.
+  std::string table_name_ ABSL_GUARDED_BY(feeds_mu_);
+
+  std::vector<std::shared_ptr<ReplicationFeed>> feeds_
+      ABSL_GUARDED_BY(feeds_mu_);
+
+  std::atomic<int64_t> num_samples_{0};
+};
+
+// Counts the replicated items, per table, which reference each chunk. The
+// primary uses it to send every chunk to a replica once, before the first item
+// which references it, and the replica to hold on to the chunk while items of
+// the primary reference it. Replicas thus keep the chunks of items which
+// their own tables have already removed (e.g because the items were sampled
+// `max_times_sampled` times) but which later items of the primary may still
+// reference. Not thread-safe.
+class ReplicatedChunks {
+ public:
+  // True if an item which is registered references chunk `key`.
+  bool Contains(uint64_t key) const;
+
+  // Chunk passed to `Add` with key `key`. Null if the chunk isn't referenced
+  // or was added without its data.
+  std::shared_ptr<ChunkStore::Chunk> Find(uint64_t key) const;
+
+  // Registers `item` of `table` unless it already has been registered.
+  // `chunks` is either empty or holds the chunks of `item.chunk_keys`, in the
+  // same order, which are then held until no registered item references them.
+  void Add(absl::string_view table, const PrioritizedItem& item,
+           absl::Span<const std::shared_ptr<ChunkStore::Chunk>> chunks);
+
+  // Unregisters item `key` of `table`. Ignores items which are not
+  // registered.
+  void Remove(absl::string_view table, uint64_t key);
+
+  // Unregisters all items of `table`.
+  void RemoveTable(absl::string_view table);
+
+  // Number of chunks referenced by the registered items.
+  int64_t num_chunks() const { return chunks_.size(); }
+
+ private:
+  struct Entry {
+    int64_t num_items = 0;
+    std::shared_ptr<ChunkStore::Chunk> chunk;
+  };
+
+  void Release(absl::Span<const uint64_t> chunk_keys);
+
+  internal::flat_hash_map<uint64_t, Entry> chunks_;
+
+  // Chunk keys of the registered items, keyed by table and item key.
+  internal::flat_hash_map<std::string,
+                          internal::flat_hash_map<uint64_t,
+                                                  std::vector<uint64_t>>>
+      items_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_TABLE_EXTENSIONS_REPLICATION_H_
@@ -0,0 +1,164 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/table_extensions/replication.h"
+
+#include <cfloat>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include "absl/memory/memory.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/errors.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+using Type = TableExtensionEvent::Type;
+
+TableItem MakeItem(uint64_t key, double priority,
+                   const std::vector<ChunkData>& chunks) {
+  TableItem item;
+  item.item = testing::MakePrioritizedItem(key, priority, chunks);
+  for (const auto& chunk : chunks) {
+    item.chunks.push_back(std::make_shared<ChunkStore::Chunk>(chunk));
+  }
+  return item;
+}
+
+TableItem MakeItem(uint64_t key, double priority) {
+  return MakeItem(key, priority,
+                  {testing::MakeChunkData(
+                      key, testing::MakeSequenceRange(key, 0, 1))});
+}
+
+std::unique_ptr<Table> MakeTable(std::shared_ptr<TableExtension> extension) {
+  return absl::make_unique<Table>(
+      "table", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), /*max_size=*/10,
+      /*max_times_sampled=*/0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX),
+      std::vector<std::shared_ptr<TableExtension>>{std::move(extension)});
+}
+
+std::vector<std::pair<Type, uint64_t>> PopEvents(ReplicationFeed* feed) {
+  std::vector<ReplicationFeed::Batch> batches;
+  TF_EXPECT_OK(feed->Pop(absl::ZeroDuration(), &batches));
+  std::vector<std::pair<Type, uint64_t>> events;
+  for (const auto& batch : batches) {
+    EXPECT_EQ(batch.table, "table");
+    for (const auto& event : batch.events) {
+      events.emplace_back(event.type, event.item.key());
+    }
+  }
+  return events;
+}
+
+TEST(ReplicationLogTest, PassesMutationsToSubscribedFeeds) {
+  auto log = std::make_shared<ReplicationLog>();
+  auto table = MakeTable(log);
+  auto feed = std::make_shared<ReplicationFeed>(/*max_pending_events=*/100);
+
+  TF_ASSERT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  log->Flush();
+  log->Subscribe(feed);
+
+  TF_ASSERT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+  TF_ASSERT_OK(table->MutateItems({testing::MakeKeyWithPriority(2, 5)}, {1}));
+  Table::SampledItem sample;
+  TF_ASSERT_OK(table->Sample(&sample));
+  TF_ASSERT_OK(table->Reset());
+  log->Flush();
+
+  EXPECT_THAT(PopEvents(feed.get()),
+              ElementsAre(Pair(Type::kInsert, 2), Pair(Type::kUpdate, 2),
+                          Pair(Type::kDelete, 1), Pair(Type::kReset, 0)));
+  EXPECT_EQ(log->num_samples(), 1);
+
+  log->Unsubscribe(feed.get());
+  TF_ASSERT_OK(table->InsertOrAssign(MakeItem(3, 1)));
+  log->Flush();
+  EXPECT_THAT(PopEvents(feed.get()), ::testing::IsEmpty());
+}
+
+TEST(ReplicationFeedTest, PopTimesOutWithoutEvents) {
+  ReplicationFeed feed(/*max_pending_events=*/1);
+  std::vector<ReplicationFeed::Batch> batches;
+  TF_EXPECT_OK(feed.Pop(absl::Milliseconds(1), &batches));
+  EXPECT_TRUE(batches.empty());
+}
+
+TEST(ReplicationFeedTest, OverflowsWhenTooManyEventsArePending) {
+  ReplicationFeed feed(/*max_pending_events=*/1);
+  TableExtensionEvent event{Type::kDelete, {}};
+  feed.Push("table", {event});
+  feed.Push("table", {event});
+
+  std::vector<ReplicationFeed::Batch> batches;
+  EXPECT_EQ(feed.Pop(absl::ZeroDuration(), &batches).code(),
+            tensorflow::error::RESOURCE_EXHAUSTED);
+}
+
+TEST(ReplicationFeedTest, PopFailsOnceClosed) {
+  ReplicationFeed feed(/*max_pending_events=*/1);
+  feed.Close();
+  std::vector<ReplicationFeed::Batch> batches;
+  EXPECT_TRUE(tensorflow::errors::IsCancelled(
+      feed.Pop(absl::InfiniteDuration(), &batches)));
+}
+
+TEST(ReplicatedChunksTest, HoldsChunksWhileItemsReferenceThem) {
+  const auto first =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(1, 0, 1));
+  const auto second =
+      testing::MakeChunkData(2, testing::MakeSequenceRange(1, 1, 2));
+  const TableItem a = MakeItem(10, 1, {first, second});
+  const TableItem b = MakeItem(11, 1, {second});
+
+  ReplicatedChunks chunks;
+  chunks.Add("table", a.item, a.chunks);
+  chunks.Add("table", b.item, {});
+  chunks.Add("table", b.item, b.chunks);
+  EXPECT_EQ(chunks.num_chunks(), 2);
+  EXPECT_EQ(chunks.Find(2), a.chunks[1]);
+
+  chunks.Remove("table", 10);
+  EXPECT_FALSE(chunks.Contains(1));
+  EXPECT_TRUE(chunks.Contains(2));
+
+  chunks.Remove("other", 11);
+  EXPECT_TRUE(chunks.Contains(2));
+  chunks.RemoveTable("table");
+  EXPECT_EQ(chunks.num_chunks(), 0);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
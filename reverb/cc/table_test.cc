@@ -26,14 +26,20 @@
 #include <cstdint>
 #include "absl/memory/memory.h"
 #include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/checkpointing/item_block.h"
 #include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/prioritized.h"
 #include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/reclaimer.h"
 #include "reverb/cc/table_extensions/interface.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "tensorflow/core/framework/tensor_shape.h"
@@ -52,7 +58,9 @@ const absl::Duration kTimeout = absl::Milliseconds(250);
 using ::deepmind::reverb::testing::Partially;
 using ::testing::ElementsAre;
 using ::testing::IsEmpty;
+using ::testing::Not;
 using ::testing::SizeIs;
+using ::testing::UnorderedElementsAre;
 
 MATCHER_P(HasItemKey, key, "") { return arg.item.key() == key; }
 
@@ -87,6 +95,17 @@ std::unique_ptr<Table> MakeUniformTable(const std::string& name,
                                   max_times_sampled, MakeLimiter(1));
 }
 
+// Decodes the items of the blocks of `checkpoint`.
+std::vector<PrioritizedItem> CheckpointedItems(
+    const Table::CheckpointAndChunks& checkpoint) {
+  std::vector<PrioritizedItem> items;
+  for (const auto& block : checkpoint.item_blocks) {
+    TF_CHECK_OK(
+        DecodeItemBlock(block, checkpoint.checkpoint.table_name(), &items));
+  }
+  return items;
+}
+
 TEST(TableTest, SetsName) {
   auto first = MakeUniformTable("first");
   auto second = MakeUniformTable("second");
@@ -114,6 +133,23 @@ TEST(TableTest, CopySubset) {
   EXPECT_THAT(table->Copy(2), SizeIs(2));
 }
 
+TEST(TableTest, CopyItemsSkipsRemovedKeys) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 123)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(5, 123)));
+  std::vector<Table::Key> keys = table->Keys();
+  EXPECT_THAT(keys, UnorderedElementsAre(3, 4, 5));
+
+  TF_EXPECT_OK(table->MutateItems({}, {4}));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(6, 123)));
+  std::vector<Table::Item> items = table->CopyItems(keys);
+  ASSERT_THAT(items, SizeIs(2));
+  EXPECT_NE(items[0].item.key(), 4);
+  EXPECT_NE(items[1].item.key(), 4);
+  EXPECT_THAT(items[0].chunks, SizeIs(1));
+}
+
 TEST(TableTest, InsertOrAssignOverwrites) {
   auto table = MakeUniformTable("dist");
   TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
@@ -124,6 +160,189 @@ TEST(TableTest, InsertOrAssignOverwrites) {
   EXPECT_EQ(items[0].item.priority(), 456);
 }
 
+TEST(TableTest, InsertOrAssignBatchInsertsAllItems) {
+  auto table = MakeUniformTable("dist");
+  std::vector<TableItem> items;
+  items.push_back(MakeItem(3, 123));
+  items.push_back(MakeItem(4, 456));
+  items.push_back(MakeItem(5, 789));
+
+  auto statuses = table->InsertOrAssignBatch(std::move(items));
+  ASSERT_THAT(statuses, SizeIs(3));
+  for (const auto& status : statuses) {
+    TF_EXPECT_OK(status);
+  }
+  EXPECT_EQ(table->size(), 3);
+  TableItem item;
+  ASSERT_TRUE(table->Get(4, &item));
+  EXPECT_EQ(item.item.priority(), 456);
+}
+
+TEST(TableTest, InsertOrAssignBatchOverwritesWithinBatch) {
+  auto table = MakeUniformTable("dist");
+  std::vector<TableItem> items;
+  items.push_back(MakeItem(3, 123));
+  items.push_back(MakeItem(3, 456));
+
+  auto statuses = table->InsertOrAssignBatch(std::move(items));
+  ASSERT_THAT(statuses, SizeIs(2));
+  TF_EXPECT_OK(statuses[0]);
+  TF_EXPECT_OK(statuses[1]);
+
+  auto copy = table->Copy();
+  ASSERT_THAT(copy, SizeIs(1));
+  EXPECT_EQ(copy[0].item.priority(), 456);
+}
+
+TEST(TableTest, InsertOrAssignBatchRespectsMaxSize) {
+  auto table = MakeUniformTable("dist", /*max_size=*/2);
+  std::vector<TableItem> items;
+  for (int i = 0; i < 5; i++) {
+    items.push_back(MakeItem(i, 123));
+  }
+  for (const auto& status : table->InsertOrAssignBatch(std::move(items))) {
+    TF_EXPECT_OK(status);
+  }
+
+  // The Fifo remover should have removed the oldest items.
+  EXPECT_THAT(table->Copy(),
+              UnorderedElementsAre(HasItemKey(3), HasItemKey(4)));
+}
+
+TEST(TableTest, InsertOrAssignBatchReturnsStatusPerItem) {
+  auto table = MakeUniformTable("dist");
+  table->Close();
+
+  std::vector<TableItem> items;
+  items.push_back(MakeItem(3, 123));
+  items.push_back(MakeItem(4, 123));
+  auto statuses = table->InsertOrAssignBatch(std::move(items));
+  ASSERT_THAT(statuses, SizeIs(2));
+  EXPECT_EQ(statuses[0].code(), tensorflow::error::CANCELLED);
+  EXPECT_EQ(statuses[1].code(), tensorflow::error::CANCELLED);
+}
+
+TEST(TableTest, InsertOrAssignBatchReservesInsertsInSingleCall) {
+  auto table = MakeUniformTable("dist");
+
+  std::vector<TableItem> items;
+  items.push_back(MakeItem(3, 123));
+  items.push_back(MakeItem(4, 123));
+  items.push_back(MakeItem(5, 123));
+  for (const auto& status : table->InsertOrAssignBatch(std::move(items))) {
+    TF_EXPECT_OK(status);
+  }
+  EXPECT_EQ(table->size(), 3);
+  EXPECT_EQ(table->info().rate_limiter_info().insert_stats().completed(), 1);
+}
+
+std::unique_ptr<Table> MakeTableWithLimiter(
+    const std::string& name, std::shared_ptr<RateLimiter> rate_limiter) {
+  return absl::make_unique<Table>(name, absl::make_unique<UniformSelector>(),
+                                  absl::make_unique<FifoSelector>(), 1000, 0,
+                                  std::move(rate_limiter));
+}
+
+TEST(TableTest, SharedRateLimiterEnforcesCombinedBudget) {
+  // Allows two inserts ahead of the samples across both tables.
+  auto limiter = std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, 2.0);
+  auto first = MakeTableWithLimiter("first", limiter);
+  auto second = MakeTableWithLimiter("second", limiter);
+
+  TF_EXPECT_OK(first->InsertOrAssign(MakeItem(1, 1)));
+  TF_EXPECT_OK(second->InsertOrAssign(MakeItem(2, 1)));
+  EXPECT_FALSE(first->CanInsert(1));
+  EXPECT_FALSE(second->CanInsert(1));
+
+  // A sample from either table makes room for an insert into the other one.
+  Table::SampledItem sample;
+  TF_EXPECT_OK(second->Sample(&sample));
+  EXPECT_TRUE(first->CanInsert(1));
+  std::vector<TableItem> items;
+  items.push_back(MakeItem(3, 1));
+  EXPECT_THAT(first->TryInsertOrAssignBatch(&items), SizeIs(1));
+  EXPECT_FALSE(second->CanInsert(1));
+}
+
+TEST(TableTest, InsertOrAssignGroupBatchAdmitsAllItemsTogether) {
+  // Allows a single insert ahead of the samples.
+  auto limiter = std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, 1.0);
+  auto first = MakeTableWithLimiter("first", limiter);
+  auto second = MakeTableWithLimiter("second", limiter);
+  auto third = MakeTableWithLimiter("third", limiter);
+
+  std::vector<std::pair<Table*, TableItem>> items;
+  items.emplace_back(first.get(), MakeItem(1, 1));
+  items.emplace_back(second.get(), MakeItem(1, 1));
+  items.emplace_back(third.get(), MakeItem(1, 1));
+  for (const auto& status :
+       Table::InsertOrAssignGroupBatch(std::move(items))) {
+    TF_EXPECT_OK(status);
+  }
+  EXPECT_EQ(first->size(), 1);
+  EXPECT_EQ(second->size(), 1);
+  EXPECT_EQ(third->size(), 1);
+  EXPECT_EQ(first->info().rate_limiter_info().insert_stats().completed(), 1);
+}
+
+TEST(TableTest, ResetOfSharedRateLimiterTableKeepsOtherTables) {
+  auto limiter = std::make_shared<RateLimiter>(1.0, 2, -DBL_MAX, DBL_MAX);
+  auto first = MakeTableWithLimiter("first", limiter);
+  auto second = MakeTableWithLimiter("second", limiter);
+  TF_EXPECT_OK(first->InsertOrAssign(MakeItem(1, 1)));
+  TF_EXPECT_OK(second->InsertOrAssign(MakeItem(2, 1)));
+  TF_EXPECT_OK(second->InsertOrAssign(MakeItem(3, 1)));
+  EXPECT_TRUE(second->CanSample(1));
+
+  // Only the item of the first table is removed from the budget.
+  TF_EXPECT_OK(first->Reset());
+  EXPECT_TRUE(second->CanSample(1));
+
+  TF_EXPECT_OK(first->InsertOrAssign(MakeItem(4, 1)));
+  first = nullptr;
+  EXPECT_TRUE(second->CanSample(1));
+  TF_EXPECT_OK(second->Reset());
+  EXPECT_FALSE(second->CanSample(1));
+}
+
+TEST(TableTest, TryInsertOrAssignBatchStopsAtRateLimiter) {
+  // Allows a single insert ahead of the samples.
+  auto table = absl::make_unique<Table>(
+      "dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), 1000, 0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, 1.0));
+
+  std::vector<TableItem> items;
+  items.push_back(MakeItem(3, 123));
+  items.push_back(MakeItem(4, 123));
+  items.push_back(MakeItem(5, 123));
+  auto statuses = table->TryInsertOrAssignBatch(&items);
+  ASSERT_THAT(statuses, SizeIs(1));
+  TF_EXPECT_OK(statuses[0]);
+  EXPECT_THAT(items, ElementsAre(HasItemKey(4), HasItemKey(5)));
+
+  // Updates of existing items don't wait for the rate limiter.
+  items.insert(items.begin(), MakeItem(3, 456));
+  statuses = table->TryInsertOrAssignBatch(&items);
+  ASSERT_THAT(statuses, SizeIs(1));
+  TF_EXPECT_OK(statuses[0]);
+  EXPECT_THAT(items, ElementsAre(HasItemKey(4), HasItemKey(5)));
+
+  // Nothing blocks, nor is inserted or updated, once the table has been
+  // closed.
+  table->Close();
+  items.insert(items.begin(), MakeItem(3, 789));
+  statuses = table->TryInsertOrAssignBatch(&items);
+  ASSERT_THAT(statuses, SizeIs(3));
+  for (const auto& status : statuses) {
+    EXPECT_EQ(status.code(), tensorflow::error::CANCELLED);
+  }
+  EXPECT_THAT(items, IsEmpty());
+  auto copy = table->Copy();
+  ASSERT_THAT(copy, ElementsAre(HasItemKey(3)));
+  EXPECT_EQ(copy[0].item.priority(), 456);
+}
+
 TEST(TableTest, UpdatesAreAppliedPartially) {
   auto table = MakeUniformTable("dist");
   TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
@@ -139,6 +358,55 @@ TEST(TableTest, UpdatesAreAppliedPartially) {
   EXPECT_EQ(items[0].item.priority(), 456);
 }
 
+TEST(TableTest, UpdatesAreAppliedInOrder) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(7, 456)));
+  TF_EXPECT_OK(table->MutateItems(
+      {
+          testing::MakeKeyWithPriority(3, 1),
+          testing::MakeKeyWithPriority(7, 2),
+          testing::MakeKeyWithPriority(3, 4),
+      },
+      {}));
+
+  Table::Item item;
+  ASSERT_TRUE(table->Get(3, &item));
+  EXPECT_EQ(item.item.priority(), 4);
+  ASSERT_TRUE(table->Get(7, &item));
+  EXPECT_EQ(item.item.priority(), 2);
+}
+
+TEST(TableTest, TransformPrioritiesUpdatesAllItems) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(7, 456)));
+  TF_EXPECT_OK(table->TransformPriorities(
+      [](const Table::PriorityTransformInput& item) {
+        return item.key == 3 ? item.priority : item.priority + item.key;
+      }));
+
+  Table::Item item;
+  ASSERT_TRUE(table->Get(3, &item));
+  EXPECT_EQ(item.item.priority(), 123);
+  ASSERT_TRUE(table->Get(7, &item));
+  EXPECT_EQ(item.item.priority(), 463);
+}
+
+TEST(TableTest, TransformPrioritiesRejectsInvalidPriorities) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+  EXPECT_EQ(table
+                ->TransformPriorities(
+                    [](const Table::PriorityTransformInput&) { return -1; })
+                .code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  Table::Item item;
+  ASSERT_TRUE(table->Get(3, &item));
+  EXPECT_EQ(item.item.priority(), 123);
+}
+
 TEST(TableTest, DeletesAreAppliedPartially) {
   auto table = MakeUniformTable("dist");
   TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
@@ -147,6 +415,48 @@ TEST(TableTest, DeletesAreAppliedPartially) {
   EXPECT_THAT(table->Copy(), ElementsAre(HasItemKey(7)));
 }
 
+TEST(TableTest, DeletedItemsAreReclaimedInBackground) {
+  auto table = MakeUniformTable("dist");
+  auto item = MakeItem(3, 123);
+  std::weak_ptr<ChunkStore::Chunk> chunk = item.chunks[0];
+  TF_EXPECT_OK(table->InsertOrAssign(std::move(item)));
+  EXPECT_FALSE(chunk.expired());
+
+  TF_EXPECT_OK(table->MutateItems({}, {3}));
+  internal::Reclaimer::Default()->Flush();
+  EXPECT_TRUE(chunk.expired());
+}
+
+TEST(TableTest, MutateAndSampleFlexibleBatchAppliesMutationsFirst) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(7, 456)));
+
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->MutateAndSampleFlexibleBatch(
+      {testing::MakeKeyWithPriority(7, 5)}, {3}, &items, 2));
+  ASSERT_THAT(items, SizeIs(2));
+  for (const auto& item : items) {
+    EXPECT_EQ(item.item.key(), 7);
+    EXPECT_EQ(item.item.priority(), 5);
+    EXPECT_EQ(item.table_size, 1);
+  }
+}
+
+TEST(TableTest, MutateAndSampleFlexibleBatchAppliesMutationsOnTimeout) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+
+  std::vector<Table::SampledItem> items;
+  EXPECT_EQ(table
+                ->MutateAndSampleFlexibleBatch({}, {3}, &items, 1,
+                                               absl::ZeroDuration())
+                .code(),
+            tensorflow::error::DEADLINE_EXCEEDED);
+  EXPECT_THAT(items, IsEmpty());
+  EXPECT_EQ(table->size(), 0);
+}
+
 TEST(TableTest, SampleBlocksWhenNotEnoughItems) {
   auto table = MakeUniformTable("dist");
 
@@ -166,6 +476,73 @@ TEST(TableTest, SampleBlocksWhenNotEnoughItems) {
   sample_thread = nullptr;  // Joins the thread.
 }
 
+TEST(TableTest, UniformSelectorSamplesFromTableKeys) {
+  // The same selector samples and removes, from the keys of the table.
+  auto uniform = std::make_shared<UniformSelector>();
+  auto table = absl::make_unique<Table>("dist", uniform, uniform,
+                                        /*max_size=*/2,
+                                        /*max_times_sampled=*/0,
+                                        MakeLimiter(1));
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 123)));
+  }
+  TF_EXPECT_OK(table->MutateItems({}, {table->Copy(1)[0].item.key()}));
+
+  const uint64_t remaining_key = table->Copy()[0].item.key();
+  for (int i = 0; i < 10; i++) {
+    Table::SampledItem sample;
+    TF_EXPECT_OK(table->Sample(&sample));
+    EXPECT_EQ(sample.item.key(), remaining_key);
+    EXPECT_EQ(sample.probability, 1);
+  }
+
+  // The selector keeps its own keys once the table is gone.
+  table = nullptr;
+  EXPECT_EQ(uniform->TotalWeight(), 0);
+  TF_EXPECT_OK(uniform->Insert(1, 1));
+  EXPECT_EQ(uniform->Sample().key, 1);
+}
+
+TEST(TableTest, PrioritizedSamplerAndFifoRemoverUseTableSlots) {
+  auto table = absl::make_unique<Table>(
+      "dist", std::make_shared<PrioritizedSelector>(1),
+      std::make_shared<FifoSelector>(), /*max_size=*/5,
+      /*max_times_sampled=*/0, MakeLimiter(1));
+
+  // The oldest items are removed first.
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 0)));
+  }
+  std::vector<uint64_t> keys;
+  for (const auto& item : table->Copy()) keys.push_back(item.item.key());
+  EXPECT_THAT(keys, UnorderedElementsAre(5, 6, 7, 8, 9));
+
+  // Only the items with a non-zero priority are sampled, also after the other
+  // items have been moved to new slots by deletes.
+  TF_EXPECT_OK(table->MutateItems(
+      {testing::MakeKeyWithPriority(6, 1), testing::MakeKeyWithPriority(9, 3)},
+      {5}));
+  TF_EXPECT_OK(table->MutateItems({}, {7}));
+  for (int i = 0; i < 100; i++) {
+    Table::SampledItem sample;
+    TF_EXPECT_OK(table->Sample(&sample));
+    EXPECT_THAT(sample.item.key(), testing::AnyOf(6, 9));
+    EXPECT_DOUBLE_EQ(sample.probability,
+                     sample.item.key() == 6 ? 0.25 : 0.75);
+  }
+
+  // The oldest remaining item is removed by the next insert.
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(10, 0)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(11, 0)));
+  keys.clear();
+  for (const auto& item : table->Copy()) keys.push_back(item.item.key());
+  EXPECT_THAT(keys, UnorderedElementsAre(8, 9, 10, 11, 6));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(12, 0)));
+  keys.clear();
+  for (const auto& item : table->Copy()) keys.push_back(item.item.key());
+  EXPECT_THAT(keys, UnorderedElementsAre(8, 9, 10, 11, 12));
+}
+
 TEST(TableTest, SampleMatchesInsert) {
   auto table = MakeUniformTable("dist");
 
@@ -174,6 +551,7 @@ TEST(TableTest, SampleMatchesInsert) {
 
   Table::SampledItem sample;
   TF_EXPECT_OK(table->Sample(&sample));
+  item.item.set_table("dist");
   item.item.set_times_sampled(1);
   sample.item.clear_inserted_at();
   EXPECT_THAT(sample.item, testing::EqualsProto(item.item));
@@ -221,6 +599,424 @@ TEST(TableTest, InsertDeletesWhenOverflowing) {
   }
 }
 
+TEST(TableTest, NumBytesCountsUniqueChunks) {
+  auto table = MakeUniformTable("dist");
+  auto first = MakeItem(1, 1);
+  const int64_t chunk_size = first.chunks[0]->DataByteSizeLong();
+
+  // Two items referencing the same chunk.
+  auto second = first;
+  second.item.set_key(2);
+  TF_EXPECT_OK(table->InsertOrAssign(std::move(first)));
+  TF_EXPECT_OK(table->InsertOrAssign(std::move(second)));
+  EXPECT_EQ(table->num_bytes(), chunk_size);
+
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 1)));
+  EXPECT_EQ(table->num_bytes(), 2 * chunk_size);
+
+  TF_EXPECT_OK(table->MutateItems({}, {1}));
+  EXPECT_EQ(table->num_bytes(), 2 * chunk_size);
+
+  TF_EXPECT_OK(table->MutateItems({}, {2}));
+  EXPECT_EQ(table->num_bytes(), chunk_size);
+
+  TF_EXPECT_OK(table->Reset());
+  EXPECT_EQ(table->num_bytes(), 0);
+}
+
+TEST(TableTest, ChunksSharedBetweenTablesAreCounted) {
+  ChunkStore store;
+  auto chunk = store.Insert(testing::MakeChunkData(100));
+  const int64_t chunk_size = chunk->DataByteSizeLong();
+
+  auto make_item = [&chunk](uint64_t key) {
+    TableItem item = MakeItem(key, 1);
+    item.chunks = {chunk};
+    return item;
+  };
+
+  auto first = MakeUniformTable("first");
+  auto second = MakeUniformTable("second");
+  TF_EXPECT_OK(first->InsertOrAssign(make_item(1)));
+  TF_EXPECT_OK(first->InsertOrAssign(make_item(2)));
+  EXPECT_EQ(chunk->num_table_references(), 1);
+  EXPECT_EQ(first->info().num_chunks(), 1);
+  EXPECT_EQ(store.info().num_shared_chunks(), 0);
+
+  TF_EXPECT_OK(second->InsertOrAssign(make_item(3)));
+  EXPECT_EQ(chunk->num_table_references(), 2);
+  EXPECT_EQ(store.info().num_shared_chunks(), 1);
+  EXPECT_EQ(store.info().shared_bytes(), chunk_size);
+
+  TF_EXPECT_OK(first->Reset());
+  EXPECT_EQ(chunk->num_table_references(), 1);
+  EXPECT_EQ(store.info().num_shared_chunks(), 0);
+  EXPECT_EQ(store.info().shared_bytes(), 0);
+
+  TF_EXPECT_OK(first->InsertOrAssign(make_item(4)));
+  EXPECT_EQ(store.info().num_shared_chunks(), 1);
+  second.reset();
+  EXPECT_EQ(chunk->num_table_references(), 1);
+  EXPECT_EQ(store.info().num_shared_chunks(), 0);
+}
+
+TEST(TableTest, InsertDeletesWhenExceedingMaxBytes) {
+  const int64_t chunk_size = MakeItem(1, 1).chunks[0]->DataByteSizeLong();
+  Table table(/*name=*/"dist", absl::make_unique<UniformSelector>(),
+              absl::make_unique<FifoSelector>(), /*max_size=*/100,
+              /*max_times_sampled=*/0, MakeLimiter(1), /*extensions=*/{},
+              /*signature=*/absl::nullopt,
+              /*max_bytes=*/chunk_size * 5 / 2);
+
+  for (int i = 1; i <= 5; i++) {
+    TF_EXPECT_OK(table.InsertOrAssign(MakeItem(i, 1)));
+    EXPECT_LE(table.num_bytes(), chunk_size * 5 / 2);
+  }
+
+  // Only the two most recent items fit within the limit.
+  EXPECT_THAT(table.Copy(),
+              UnorderedElementsAre(HasItemKey(4), HasItemKey(5)));
+  EXPECT_EQ(table.info().max_bytes(), chunk_size * 5 / 2);
+}
+
+TEST(TableTest, ItemLargerThanMaxBytesIsDeleted) {
+  const int64_t chunk_size = MakeItem(1, 1).chunks[0]->DataByteSizeLong();
+  Table table(/*name=*/"dist", absl::make_unique<UniformSelector>(),
+              absl::make_unique<FifoSelector>(), /*max_size=*/100,
+              /*max_times_sampled=*/0, MakeLimiter(1), /*extensions=*/{},
+              /*signature=*/absl::nullopt, /*max_bytes=*/chunk_size / 2);
+
+  TF_EXPECT_OK(table.InsertOrAssign(MakeItem(1, 1)));
+  EXPECT_EQ(table.size(), 0);
+  EXPECT_EQ(table.num_bytes(), 0);
+}
+
+std::unique_ptr<Table> MakeExpiringTable(absl::Duration max_age) {
+  return absl::make_unique<Table>(
+      /*name=*/"dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), /*max_size=*/100,
+      /*max_times_sampled=*/0, MakeLimiter(1), /*extensions=*/
+      std::vector<std::shared_ptr<TableExtension>>{},
+      /*signature=*/absl::nullopt, /*max_bytes=*/0, max_age);
+}
+
+TEST(TableTest, ExpireItemsDeletesItemsOlderThanMaxAge) {
+  auto table = MakeExpiringTable(absl::Hours(1));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+
+  // Items may expire up to one bucket late so wait out a full extra hour.
+  TF_EXPECT_OK(table->ExpireItems(absl::Now() + absl::Hours(2)));
+  EXPECT_EQ(table->size(), 0);
+  EXPECT_EQ(table->info().num_expired_items(), 2);
+  EXPECT_EQ(table->info().max_age().seconds(), 3600);
+}
+
+TEST(TableTest, ExpireItemsKeepsItemsYoungerThanMaxAge) {
+  auto table = MakeExpiringTable(absl::Hours(1));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+
+  TF_EXPECT_OK(table->ExpireItems(absl::Now() + absl::Minutes(30)));
+  EXPECT_EQ(table->size(), 1);
+  EXPECT_EQ(table->info().num_expired_items(), 0);
+}
+
+TEST(TableTest, ExpireItemsIgnoresReinsertedKeys) {
+  auto table = MakeExpiringTable(absl::Hours(1));
+  const absl::Time now = absl::Now();
+  auto make_item = [](absl::Time inserted_at) {
+    TableItem item = MakeItem(1, 1);
+    item.item.mutable_inserted_at()->set_seconds(
+        absl::ToUnixSeconds(inserted_at));
+    return item;
+  };
+  TF_EXPECT_OK(table->InsertCheckpointItem(make_item(now - absl::Minutes(50))));
+  TF_EXPECT_OK(table->MutateItems({}, {1}));
+  TF_EXPECT_OK(table->InsertCheckpointItem(make_item(now)));
+
+  // The entry of the deleted item is due but must not match the new item.
+  TF_EXPECT_OK(table->ExpireItems(now + absl::Minutes(15)));
+  EXPECT_EQ(table->size(), 1);
+  EXPECT_EQ(table->info().num_expired_items(), 0);
+}
+
+TEST(TableTest, ItemsNeverExpireWithoutMaxAge) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  TF_EXPECT_OK(table->ExpireItems(absl::InfiniteFuture()));
+  EXPECT_EQ(table->size(), 1);
+  EXPECT_FALSE(table->info().has_max_age());
+}
+
+std::unique_ptr<Table> MakeEpisodeTable(int32_t max_times_sampled = 0) {
+  return absl::make_unique<Table>(
+      /*name=*/"dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), /*max_size=*/100, max_times_sampled,
+      MakeLimiter(1), /*extensions=*/
+      std::vector<std::shared_ptr<TableExtension>>{},
+      /*signature=*/absl::nullopt, /*max_bytes=*/0,
+      /*max_age=*/absl::InfiniteDuration(), /*index_episodes=*/true);
+}
+
+TableItem MakeEpisodeItem(uint64_t key, double priority, uint64_t episode_id) {
+  return MakeItem(key, priority,
+                  {testing::MakeSequenceRange(episode_id, 0, 1)});
+}
+
+TEST(TableTest, SampleEpisodeReturnsAllItemsOfTheEpisode) {
+  auto table = MakeEpisodeTable();
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(1, 1, 10)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(2, 1, 10)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(3, 1, 10)));
+
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleEpisode(&items, kTimeout));
+  EXPECT_THAT(items, ElementsAre(HasItemKey(1), HasItemKey(2), HasItemKey(3)));
+  for (const auto& item : items) {
+    EXPECT_EQ(item.probability, 1);
+    EXPECT_EQ(item.item.times_sampled(), 1);
+  }
+}
+
+TEST(TableTest, SampleEpisodeIsWeightedByPriorityMass) {
+  auto table = MakeEpisodeTable();
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(1, 1, 10)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(2, 2, 10)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(3, 1, 20)));
+
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleEpisode(&items, kTimeout));
+  ASSERT_THAT(items, Not(IsEmpty()));
+  EXPECT_DOUBLE_EQ(items[0].probability, items.size() == 2 ? 0.75 : 0.25);
+
+  // Episode 10 loses all of its mass.
+  TF_EXPECT_OK(table->MutateItems(
+      {testing::MakeKeyWithPriority(1, 0), testing::MakeKeyWithPriority(2, 0)},
+      {}));
+  for (int i = 0; i < 10; i++) {
+    items.clear();
+    TF_EXPECT_OK(table->SampleEpisode(&items, kTimeout));
+    EXPECT_THAT(items, ElementsAre(HasItemKey(3)));
+  }
+}
+
+TEST(TableTest, SampleEpisodeSkipsDeletedItems) {
+  auto table = MakeEpisodeTable(/*max_times_sampled=*/1);
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(1, 1, 10)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(2, 1, 10)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeEpisodeItem(3, 1, 20)));
+  TF_EXPECT_OK(table->MutateItems({}, {1}));
+
+  std::vector<Table::SampledItem> items;
+  std::vector<uint64_t> keys;
+  while (table->size() > 0) {
+    items.clear();
+    TF_EXPECT_OK(table->SampleEpisode(&items, kTimeout));
+    ASSERT_THAT(items, SizeIs(1));
+    keys.push_back(items[0].item.key());
+  }
+  EXPECT_THAT(keys, UnorderedElementsAre(2, 3));
+}
+
+TEST(TableTest, SampleEpisodeSeparatesEpisodesOfDeduplicatedChunks) {
+  ChunkStore::Options options;
+  options.deduplicate = true;
+  std::unique_ptr<ChunkStore> store;
+  TF_ASSERT_OK(ChunkStore::Create(options, &store));
+
+  // The chunks of both episodes hold identical tensors.
+  auto first = store->Insert(
+      testing::MakeChunkData(100, testing::MakeSequenceRange(10, 0, 1)));
+  auto second = store->Insert(
+      testing::MakeChunkData(200, testing::MakeSequenceRange(20, 0, 1)));
+  ASSERT_EQ(store->info().num_deduplicated_keys(), 1);
+
+  auto make_item = [](uint64_t key, std::shared_ptr<ChunkStore::Chunk> chunk) {
+    TableItem item;
+    item.item = testing::MakePrioritizedItem(key, 1, {chunk->data()});
+    item.chunks = {std::move(chunk)};
+    return item;
+  };
+  auto table = MakeEpisodeTable();
+  TF_EXPECT_OK(table->InsertOrAssign(make_item(1, first)));
+  TF_EXPECT_OK(table->InsertOrAssign(make_item(2, second)));
+  EXPECT_EQ(table->num_episodes(), 2);
+
+  for (int i = 0; i < 10; i++) {
+    std::vector<Table::SampledItem> items;
+    TF_EXPECT_OK(table->SampleEpisode(&items, kTimeout));
+    ASSERT_THAT(items, SizeIs(1));
+    const uint64_t episode_id = items[0].item.key() == 1 ? 10 : 20;
+    EXPECT_EQ(items[0].chunks[0]->data().sequence_range().episode_id(),
+              episode_id);
+  }
+}
+
+TEST(TableTest, SampleEpisodeRequiresIndexEpisodes) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  std::vector<Table::SampledItem> items;
+  EXPECT_EQ(table->SampleEpisode(&items, kTimeout).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+}
+
+TEST(TableTest, FreezeRequiresItemsThatAreNeverRemoved) {
+  EXPECT_EQ(MakeUniformTable("dist")->Freeze().code(),
+            tensorflow::error::FAILED_PRECONDITION);
+
+  auto table = MakeUniformTable("dist", 10, /*max_times_sampled=*/1);
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  EXPECT_EQ(table->Freeze().code(), tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_FALSE(table->frozen());
+  EXPECT_FALSE(table->info().frozen());
+}
+
+TEST(TableTest, FrozenTableRejectsMutations) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  TF_EXPECT_OK(table->Freeze());
+  TF_EXPECT_OK(table->Freeze());
+  EXPECT_TRUE(table->frozen());
+  EXPECT_TRUE(table->info().frozen());
+
+  EXPECT_EQ(table->InsertOrAssign(MakeItem(2, 1)).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(table->InsertOrAssign(MakeItem(1, 2)).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_THAT(table->InsertOrAssignBatch({MakeItem(3, 1)}),
+              ElementsAre(Not(tensorflow::Status::OK())));
+  EXPECT_EQ(
+      table->MutateItems({testing::MakeKeyWithPriority(1, 5)}, {}).code(),
+      tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(table->MutateItems({}, {1}).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  std::vector<Table::SampledItem> items;
+  EXPECT_EQ(table
+                ->MutateAndSampleFlexibleBatch(
+                    {testing::MakeKeyWithPriority(1, 5)}, {}, &items, 1)
+                .code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(table->Reset().code(), tensorflow::error::FAILED_PRECONDITION);
+
+  EXPECT_EQ(table->size(), 1);
+  EXPECT_EQ(table->Copy()[0].item.priority(), 1);
+}
+
+TEST(TableTest, FrozenTableSamplesFromSnapshot) {
+  auto table = absl::make_unique<Table>(
+      "dist", std::make_shared<PrioritizedSelector>(1),
+      std::make_shared<FifoSelector>(), /*max_size=*/10,
+      /*max_times_sampled=*/0, MakeLimiter(1));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 3)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 0)));
+  TF_EXPECT_OK(table->Freeze());
+
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 100));
+  ASSERT_THAT(items, SizeIs(100));
+  for (const auto& sample : items) {
+    EXPECT_THAT(sample.item.key(), testing::AnyOf(1, 2));
+    EXPECT_DOUBLE_EQ(sample.probability, sample.item.key() == 1 ? 0.25 : 0.75);
+    EXPECT_EQ(sample.table_size, 3);
+    EXPECT_THAT(sample.chunks, SizeIs(1));
+  }
+
+  // Samples of frozen tables are not counted.
+  for (const auto& item : table->Copy()) {
+    EXPECT_EQ(item.item.times_sampled(), 0);
+  }
+
+  items.clear();
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 10, kTimeout,
+                                          /*without_replacement=*/true));
+  std::vector<uint64_t> keys;
+  for (const auto& sample : items) keys.push_back(sample.item.key());
+  EXPECT_THAT(keys, UnorderedElementsAre(1, 2));
+}
+
+TEST(TableTest, FrozenTableIsSampledConcurrently) {
+  auto table = MakeUniformTable("dist");
+  for (int i = 0; i < 100; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+  TF_ASSERT_OK(table->Freeze());
+
+  std::vector<std::unique_ptr<internal::Thread>> bundle;
+  for (int i = 0; i < 8; i++) {
+    bundle.push_back(internal::StartThread("", [&table] {
+      std::vector<Table::SampledItem> items;
+      for (int j = 0; j < 100; j++) {
+        items.clear();
+        TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 16));
+        EXPECT_THAT(items, SizeIs(16));
+        for (const auto& sample : items) {
+          EXPECT_LT(sample.item.key(), 100);
+          EXPECT_DOUBLE_EQ(sample.probability, 0.01);
+        }
+      }
+    }));
+  }
+  bundle.clear();  // Joins all threads.
+}
+
+TEST(TableTest, CountsNumaAccessesOfPinnedTables) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  EXPECT_FALSE(table->info().has_numa());
+
+  table->set_numa_node(0);
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+  Table::SampledItem item;
+  TF_EXPECT_OK(table->Sample(&item));
+
+  const TableNumaInfo numa = table->info().numa();
+  EXPECT_EQ(numa.node(), 0);
+  EXPECT_EQ(numa.num_local_accesses() + numa.num_remote_accesses(), 2);
+}
+
+TEST(TableTest, CopyRestoresItemFields) {
+  auto table = MakeUniformTable("dist");
+  auto item = MakeItem(3, 123,
+                       {testing::MakeSequenceRange(300, 0, 9),
+                        testing::MakeSequenceRange(300, 10, 19)});
+  item.item.mutable_sequence_range()->set_offset(5);
+  item.item.mutable_sequence_range()->set_length(10);
+  TF_EXPECT_OK(table->InsertOrAssign(item));
+
+  auto items = table->Copy();
+  ASSERT_THAT(items, SizeIs(1));
+  EXPECT_THAT(items[0].item, Partially(testing::EqualsProto(R"pb(
+                key: 3
+                table: "dist"
+                chunk_keys: 300
+                chunk_keys: 301
+                sequence_range { offset: 5 length: 10 }
+                priority: 123
+              )pb")));
+  EXPECT_TRUE(items[0].item.has_inserted_at());
+  EXPECT_EQ(items[0].chunks, item.chunks);
+}
+
+TEST(TableTest, CompactItemMemoryFootprint) {
+  // Compare the memory used to represent a typical item (two chunks) as a
+  // `TableItem` with the memory of the `CompactTableItem` stored by the table.
+  auto item = MakeItem(3, 123,
+                       {testing::MakeSequenceRange(300, 0, 9),
+                        testing::MakeSequenceRange(300, 10, 19)});
+  item.item.set_table("a_table_with_a_typical_name");
+  item.item.mutable_inserted_at()->set_seconds(1);
+
+  const size_t item_bytes =
+      sizeof(TableItem) - sizeof(PrioritizedItem) + item.item.SpaceUsedLong() +
+      item.chunks.capacity() * sizeof(std::shared_ptr<ChunkStore::Chunk>);
+  const size_t compact_item_bytes = sizeof(CompactTableItem);
+
+  REVERB_LOG(REVERB_INFO) << "Bytes per item: TableItem=" << item_bytes
+                          << ", CompactTableItem=" << compact_item_bytes;
+  EXPECT_LT(compact_item_bytes, item_bytes);
+}
+
 TEST(TableTest, ConcurrentCalls) {
   auto table = MakeUniformTable("dist", 1000);
 
@@ -414,6 +1210,57 @@ TEST(TableTest, ResetClearsAllData) {
   EXPECT_EQ(table->size(), 0);
 }
 
+TEST(TableTest, ResetReclaimsItemsInBackground) {
+  auto table = MakeUniformTable("dist");
+  auto item = MakeItem(3, 123);
+  std::weak_ptr<ChunkStore::Chunk> chunk = item.chunks[0];
+  TF_EXPECT_OK(table->InsertOrAssign(std::move(item)));
+  EXPECT_EQ(table->num_episodes(), 1);
+
+  TF_ASSERT_OK(table->Reset());
+  EXPECT_EQ(table->size(), 0);
+  EXPECT_EQ(table->num_episodes(), 0);
+  internal::Reclaimer::Default()->Flush();
+  EXPECT_TRUE(chunk.expired());
+
+  // The table starts over with fresh structures.
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 1)));
+  EXPECT_THAT(table->Copy(), ElementsAre(HasItemKey(4)));
+}
+
+TEST(TableTest, ReservesItemsUpToMaxReservedBytes) {
+  auto make_table = [](int64_t max_size, int64_t max_reserved_bytes) {
+    return absl::make_unique<Table>(
+        /*name=*/"dist", absl::make_unique<PrioritizedSelector>(1),
+        absl::make_unique<FifoSelector>(), max_size, /*max_times_sampled=*/0,
+        MakeLimiter(1), /*extensions=*/
+        std::vector<std::shared_ptr<TableExtension>>{},
+        /*signature=*/absl::nullopt, /*max_bytes=*/0,
+        /*max_age=*/absl::InfiniteDuration(), /*index_episodes=*/false,
+        max_reserved_bytes);
+  };
+  EXPECT_EQ(make_table(100, 0)->reserved_items(), 0);
+  EXPECT_EQ(make_table(100, 1 << 30)->reserved_items(), 100);
+
+  auto table = make_table(1 << 20, 1 << 20);
+  const int64_t reserved_items = table->reserved_items();
+  EXPECT_GT(reserved_items, 0);
+  EXPECT_LT(reserved_items, (1 << 20) / 32);
+  EXPECT_EQ(table->Checkpoint().checkpoint.max_reserved_bytes(), 1 << 20);
+
+  // The table grows beyond the reservation and is reserved again by resets.
+  for (int i = 0; i < 2 * reserved_items; i++) {
+    TF_ASSERT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+  EXPECT_EQ(table->size(), 2 * reserved_items);
+  TF_ASSERT_OK(table->Reset());
+  for (int i = 0; i < reserved_items; i++) {
+    TF_ASSERT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+  EXPECT_EQ(table->size(), reserved_items);
+  EXPECT_EQ(table->num_episodes(), reserved_items);
+}
+
 TEST(TableTest, ResetWhileConcurrentCalls) {
   auto table = MakeUniformTable("dist");
   std::vector<std::unique_ptr<internal::Thread>> bundle;
@@ -436,12 +1283,68 @@ TEST(TableTest, CheckpointOrderItems) {
   TF_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 124)));
 
   auto checkpoint = table->Checkpoint();
-  EXPECT_THAT(checkpoint.checkpoint.items(),
+  EXPECT_THAT(CheckpointedItems(checkpoint),
               ElementsAre(Partially(testing::EqualsProto("key: 1")),
                           Partially(testing::EqualsProto("key: 3")),
                           Partially(testing::EqualsProto("key: 2"))));
 }
 
+TEST(TableTest, CheckpointSplitsItemsIntoBlocks) {
+  auto table = MakeUniformTable("dist", kCheckpointItemsPerBlock + 1);
+  for (int i = 0; i <= kCheckpointItemsPerBlock; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  auto checkpoint = table->Checkpoint();
+  EXPECT_EQ(checkpoint.checkpoint.num_item_blocks(), 2);
+  EXPECT_THAT(checkpoint.checkpoint.items(), IsEmpty());
+  ASSERT_THAT(checkpoint.item_blocks, SizeIs(2));
+  EXPECT_EQ(checkpoint.item_blocks[0].keys_size(), kCheckpointItemsPerBlock);
+  EXPECT_EQ(checkpoint.item_blocks[1].keys_size(), 1);
+
+  std::vector<PrioritizedItem> items = CheckpointedItems(checkpoint);
+  ASSERT_THAT(items, SizeIs(kCheckpointItemsPerBlock + 1));
+  for (int i = 0; i < items.size(); i++) {
+    EXPECT_EQ(items[i].key(), i);
+    EXPECT_EQ(items[i].table(), "dist");
+    EXPECT_THAT(items[i].chunk_keys(), ElementsAre(i * 100));
+  }
+}
+
+TEST(TableTest, CheckpointIsConsistentWhileTableIsMutated) {
+  // The Fifo remover keeps the table at the last (up to) 100 inserted keys so
+  // a consistent snapshot always holds a contiguous range of keys.
+  auto table = MakeUniformTable("dist", /*max_size=*/100);
+
+  std::atomic<bool> stop(false);
+  auto writer = internal::StartThread("writer", [&] {
+    for (Table::Key key = 0; !stop.load(); key++) {
+      TF_EXPECT_OK(table->InsertOrAssign(MakeItem(key, 1)));
+      if (key % 7 == 0 && key >= 50) {
+        TF_EXPECT_OK(table->MutateItems(
+            {testing::MakeKeyWithPriority(key - 50, key)}, {}));
+      }
+      if (key % 5000 == 4999) {
+        TF_EXPECT_OK(table->Reset());
+      }
+    }
+  });
+
+  for (int i = 0; i < 200; i++) {
+    auto checkpoint = table->Checkpoint();
+    const auto items = CheckpointedItems(checkpoint);
+    ASSERT_LE(items.size(), 100);
+    for (int j = 1; j < items.size(); j++) {
+      ASSERT_EQ(items[j].key(), items[j - 1].key() + 1);
+    }
+    // Every item references a chunk of its own.
+    EXPECT_EQ(checkpoint.chunks.size(), items.size());
+  }
+
+  stop.store(true);
+  writer = nullptr;  // Joins the thread.
+}
+
 TEST(TableTest, CheckpointSanityCheck) {
   tensorflow::StructuredValue signature;
   auto* spec =
@@ -473,7 +1376,7 @@ TEST(TableTest, CheckpointSanityCheck) {
                 max_size: 10
                 max_times_sampled: 1
                 num_deleted_episodes: 0
-                items: { key: 1 }
+                num_item_blocks: 1
                 rate_limiter: {
                   samples_per_insert: 1.0
                   min_size_to_sample: 3
@@ -502,6 +1405,8 @@ TEST(TableTest, CheckpointSanityCheck) {
                   }
                 }
               )pb")));
+  EXPECT_THAT(CheckpointedItems(checkpoint),
+              ElementsAre(Partially(testing::EqualsProto("key: 1"))));
 }
 
 TEST(TableTest, BlocksSamplesWhenSizeToSmallDueToAutoDelete) {
@@ -718,6 +1623,31 @@ TEST(TableDeathTest, SetNumDeletedEpisodesFromCheckpointCalledTwice) {
   ASSERT_DEATH(table->set_num_deleted_episodes_from_checkpoint(1), "");
 }
 
+TEST(TableTest, InfoSnapshotMatchesInfo) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+
+  TableInfo snapshot = *table->InfoSnapshot();
+  TableInfo info = table->info();
+  snapshot.clear_latency_stats();
+  info.clear_latency_stats();
+  EXPECT_THAT(snapshot, testing::EqualsProto(info));
+}
+
+TEST(TableTest, InfoSnapshotIsRefreshedAfterMutation) {
+  auto table = MakeUniformTable("dist");
+  auto first = table->InfoSnapshot();
+  EXPECT_EQ(first->current_size(), 0);
+
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  absl::SleepFor(Table::kInfoSnapshotRefreshInterval);
+  auto second = table->InfoSnapshot();
+  EXPECT_EQ(second->current_size(), 1);
+
+  // Earlier snapshots remain valid after they have been replaced.
+  EXPECT_EQ(first->current_size(), 0);
+}
+
 TEST(TableTest, Info) {
   Table table(
       /*name=*/"dist",
@@ -741,7 +1671,19 @@ TEST(TableTest, Info) {
   Table::SampledItem sample;
   TF_EXPECT_OK(table.Sample(&sample));
 
-  EXPECT_THAT(table.info(), testing::EqualsProto(R"pb(
+  // The byte size of the chunks depends on the encoding so it is verified
+  // separately.
+  auto info = table.info();
+  EXPECT_EQ(info.num_bytes(), sample.chunks[0]->DataByteSizeLong());
+  info.clear_num_bytes();
+
+  // The latency depends on the machine so only the number of recorded calls
+  // is verified.
+  EXPECT_EQ(info.latency_stats().lock_wait().count(), 3);
+  EXPECT_EQ(info.latency_stats().lock_hold().count(), 3);
+  info.clear_latency_stats();
+
+  EXPECT_THAT(info, testing::EqualsProto(R"pb(
                 name: 'dist'
                 sampler_options { uniform: true }
                 remover_options { fifo: true is_deterministic: true }
@@ -766,9 +1708,240 @@ TEST(TableTest, Info) {
                 current_size: 1
                 num_episodes: 1
                 num_deleted_episodes: 6
+                num_chunks: 1
+                sampler_total_weight: 1
               )pb"));
 }
 
+TEST(TableTest, InfoIncludesLatencyStats) {
+  auto table = MakeUniformTable("dist");
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+  TF_EXPECT_OK(
+      table->MutateItems({testing::MakeKeyWithPriority(1, 5)}, {2}));
+  Table::SampledItem sample;
+  TF_EXPECT_OK(table->Sample(&sample));
+  TF_EXPECT_OK(table->Reset());
+
+  const TableLatencyStats stats = table->info().latency_stats();
+  EXPECT_EQ(stats.lock_wait().count(), 5);
+  EXPECT_EQ(stats.lock_hold().count(), 5);
+  EXPECT_EQ(stats.selector_insert().count(), 2);
+  EXPECT_EQ(stats.selector_update().count(), 1);
+  EXPECT_EQ(stats.selector_delete().count(), 1);
+  EXPECT_EQ(stats.selector_sample().count(), 1);
+  EXPECT_EQ(stats.extension_callbacks().count(), 0);
+
+  int64_t lock_hold_samples = 0;
+  for (int64_t count : stats.lock_hold().bucket_counts()) {
+    lock_hold_samples += count;
+  }
+  EXPECT_EQ(lock_hold_samples, 5);
+}
+
+TEST(TableTest, SampleFlexibleBatchDrawsKeysInSingleSelectorCall) {
+  auto table = MakeUniformTable("dist");
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 100));
+  ASSERT_THAT(items, SizeIs(100));
+  for (const auto& item : items) {
+    EXPECT_LT(item.item.key(), 10);
+    EXPECT_EQ(item.probability, 0.1);
+    EXPECT_EQ(item.table_size, 10);
+  }
+  EXPECT_EQ(table->info().latency_stats().selector_sample().count(), 1);
+}
+
+TEST(TableTest, SampleFlexibleBatchRedrawsKeysAfterDelete) {
+  auto table = MakeUniformTable("dist", /*max_size=*/1000,
+                                /*max_times_sampled=*/1);
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  // Every sample deletes the item so all keys must be unique.
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 10));
+  ASSERT_THAT(items, SizeIs(10));
+  internal::flat_hash_set<uint64_t> keys;
+  for (const auto& item : items) {
+    EXPECT_TRUE(keys.insert(item.item.key()).second);
+  }
+  EXPECT_EQ(table->size(), 0);
+}
+
+TEST(TableTest, SampleFlexibleBatchAdmitsBatchInSingleRateLimiterCall) {
+  // Allows three samples per insert.
+  auto table = absl::make_unique<Table>(
+      "dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), 1000, 0,
+      absl::make_unique<RateLimiter>(3.0, 1, 0.0, DBL_MAX));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 10));
+  EXPECT_THAT(items, SizeIs(3));
+  EXPECT_EQ(table->info().rate_limiter_info().sample_stats().completed(), 1);
+  EXPECT_FALSE(table->CanSample(1));
+}
+
+TEST(TableTest, SampleFlexibleBatchStopsBelowMinSizeToSample) {
+  auto table = absl::make_unique<Table>(
+      "dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), 1000, /*max_times_sampled=*/1,
+      MakeLimiter(/*min_size=*/3));
+  for (int i = 0; i < 5; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  // Every sample deletes an item so only three samples can be taken before
+  // the table is too small to sample from.
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 10));
+  EXPECT_THAT(items, SizeIs(3));
+  EXPECT_EQ(table->size(), 2);
+}
+
+TEST(TableTest, SampleFlexibleBatchWithoutReplacementHasDistinctItems) {
+  auto table = MakeUniformTable("dist");
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  // The batch is limited by the number of items rather than by `batch_size`.
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 100, kTimeout,
+                                          /*without_replacement=*/true));
+  ASSERT_THAT(items, SizeIs(10));
+  internal::flat_hash_set<uint64_t> keys;
+  for (const auto& item : items) {
+    EXPECT_TRUE(keys.insert(item.item.key()).second);
+    EXPECT_EQ(item.probability, 0.1);
+    EXPECT_EQ(item.item.times_sampled(), 1);
+  }
+  EXPECT_EQ(table->info().latency_stats().selector_sample().count(), 1);
+  EXPECT_EQ(table->info().rate_limiter_info().sample_stats().completed(), 1);
+}
+
+TEST(TableTest, SampleFlexibleBatchWithoutReplacementKeepsKeysAfterDelete) {
+  auto table = MakeUniformTable("dist", /*max_size=*/1000,
+                                /*max_times_sampled=*/1);
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  // The deleted items were drawn already so the rest of the batch is still
+  // valid and the keys aren't redrawn.
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 5, kTimeout,
+                                          /*without_replacement=*/true));
+  ASSERT_THAT(items, SizeIs(5));
+  internal::flat_hash_set<uint64_t> keys;
+  for (const auto& item : items) {
+    EXPECT_TRUE(keys.insert(item.item.key()).second);
+  }
+  EXPECT_EQ(table->size(), 5);
+  EXPECT_EQ(table->info().latency_stats().selector_sample().count(), 1);
+}
+
+TEST(TableTest, SampleFlexibleBatchWithoutReplacementFromFifo) {
+  auto table = absl::make_unique<Table>(
+      "dist", absl::make_unique<FifoSelector>(),
+      absl::make_unique<FifoSelector>(), 1000, 0, MakeLimiter(1));
+  for (int i = 0; i < 10; i++) {
+    TF_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  // Deterministic selectors only draw a single distinct key.
+  std::vector<Table::SampledItem> items;
+  TF_EXPECT_OK(table->SampleFlexibleBatch(&items, 5, kTimeout,
+                                          /*without_replacement=*/true));
+  ASSERT_THAT(items, SizeIs(1));
+  EXPECT_EQ(items[0].item.key(), 0);
+}
+
+TEST(TableTest, RestoreBlocksSamplesUntilFractionRestored) {
+  auto table = MakeUniformTable("dist");
+  table->BeginRestore(/*min_restored_fraction_to_sample=*/0.5);
+
+  // Live inserts are accepted but samples are blocked until the restore has
+  // progressed far enough, even though the rate limiter would allow them.
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(100, 1)));
+  EXPECT_FALSE(table->CanSample(1));
+  EXPECT_TRUE(table->info().restore_progress().in_progress());
+  EXPECT_EQ(table->info().restore_progress().total_items(), -1);
+
+  table->SetNumItemsToRestore(4);
+  TF_EXPECT_OK(table->InsertRestoredItem(MakeItem(1, 1)));
+  EXPECT_FALSE(table->CanSample(1));
+  EXPECT_FALSE(table->info().restore_progress().ready_to_sample());
+
+  TF_EXPECT_OK(table->InsertRestoredItem(MakeItem(2, 1)));
+  EXPECT_TRUE(table->CanSample(1));
+  EXPECT_THAT(table->info().restore_progress(),
+              testing::EqualsProto("in_progress: true total_items: 4 "
+                                   "restored_items: 2 ready_to_sample: true"));
+
+  TF_EXPECT_OK(table->InsertRestoredItem(MakeItem(3, 1)));
+  TF_EXPECT_OK(table->InsertRestoredItem(MakeItem(4, 1)));
+  table->EndRestore();
+  EXPECT_EQ(table->size(), 5);
+  EXPECT_FALSE(table->info().restore_progress().in_progress());
+}
+
+TEST(TableTest, RestoreUnblocksSampleWhenEnded) {
+  auto table = MakeUniformTable("dist");
+  table->BeginRestore(/*min_restored_fraction_to_sample=*/1.0);
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+
+  absl::Notification sampled;
+  auto sampler = internal::StartThread("", [&] {
+    Table::SampledItem item;
+    TF_EXPECT_OK(table->Sample(&item));
+    sampled.Notify();
+  });
+  EXPECT_FALSE(sampled.WaitForNotificationWithTimeout(absl::Milliseconds(50)));
+
+  // E.g no checkpoint was found.
+  table->EndRestore();
+  sampled.WaitForNotification();
+}
+
+TEST(TableTest, ReplicatedItemsAndSamplesBypassTheRateLimiter) {
+  auto table = absl::make_unique<Table>(
+      "dist", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), 1000, 0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, /*max_diff=*/1));
+  TF_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  EXPECT_FALSE(table->CanInsert(1));
+
+  // The primary has already admitted the item.
+  TF_EXPECT_OK(table->InsertReplicatedItem(MakeItem(2, 1)));
+  EXPECT_EQ(table->size(), 2);
+  EXPECT_FALSE(table->CanInsert(1));
+
+  // Samples served by replicas make room for more inserts.
+  table->RecordReplicaSamples(2);
+  EXPECT_TRUE(table->CanInsert(1));
+
+  table->Close();
+  EXPECT_EQ(table->InsertReplicatedItem(MakeItem(3, 1)).code(),
+            tensorflow::error::CANCELLED);
+}
+
+TEST(TableTest, InsertRestoredItemFailsAfterClose) {
+  auto table = MakeUniformTable("dist");
+  table->BeginRestore(/*min_restored_fraction_to_sample=*/1.0);
+  table->Close();
+  EXPECT_EQ(table->InsertRestoredItem(MakeItem(1, 1)).code(),
+            tensorflow::error::CANCELLED);
+  table->EndRestore();
+}
+
 TEST(TableTest, DefaultFlexibleBatchSize) {
   // If a sample to insert ratio is set then that should be used.
   Table samples_per_insert_table(
@@ -14,19 +14,59 @@
 
 #include "reverb/cc/tensor_compression.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/lz4.h"
 #include "reverb/cc/platform/snappy.h"
+#include "reverb/cc/platform/zstd.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/delta_encoding.h"
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/framework/types.pb.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
 namespace reverb {
 namespace {
 
+template <size_t kSize>
+struct FixedWidthUnsigned;
+
+template <>
+struct FixedWidthUnsigned<1> {
+  using Type = uint8_t;
+};
+
+template <>
+struct FixedWidthUnsigned<2> {
+  using Type = uint16_t;
+};
+
+template <>
+struct FixedWidthUnsigned<4> {
+  using Type = uint32_t;
+};
+
+template <>
+struct FixedWidthUnsigned<8> {
+  using Type = uint64_t;
+};
+
 template <typename T>
 tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode) {
   tensorflow::Tensor output(tensor.dtype(), tensor.shape());
@@ -39,21 +79,380 @@ tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode) {
   TF_CHECK_OK(output_reinterpret.BitcastFrom(
       output, tensorflow::DataTypeToEnum<T>::v(), output.shape()));
 
+  // TensorFlow's integer types are not necessarily the same types as the
+  // fixed width types of <cstdint> (e.g `long long` vs `long`).
+  using U = typename FixedWidthUnsigned<sizeof(T)>::Type;
   auto src = tensor_reinterpret.flat_outer_dims<T>();
   auto dst = output_reinterpret.flat_outer_dims<T>();
-  for (int j = 0; j < src.dimension(1); j++) {
-    dst(0, j) = src(0, j);
+  internal::DeltaEncodeRows(reinterpret_cast<const U*>(src.data()),
+                            reinterpret_cast<U*>(dst.data()), src.dimension(0),
+                            src.dimension(1), encode);
+  return output;
+}
+
+// Returns true if `DeltaEncode` transforms tensors of `dtype` with `dims`
+// dimensions.
+bool IsDeltaEncodable(tensorflow::DataType dtype, int dims) {
+  if (dims < 2) return false;
+  switch (dtype) {
+#define DELTA_ENCODABLE(T) case tensorflow::DataTypeToEnum<T>::value:
+    TF_CALL_INTEGRAL_TYPES(DELTA_ENCODABLE)
+#undef DELTA_ENCODABLE
+    return true;
+    default:
+      return false;
+  }
+}
+
+template <size_t kSize>
+void DeltaEncodeBytes(const char* src, char* dst, int64_t rows, int64_t cols,
+                      bool encode) {
+  using U = typename FixedWidthUnsigned<kSize>::Type;
+  internal::DeltaEncodeRows(reinterpret_cast<const U*>(src),
+                            reinterpret_cast<U*>(dst), rows, cols, encode);
+}
+
+// Delta encodes or decodes `rows` x `cols` elements of `element_size` bytes
+// from `src` to `dst`. Decoding can be done in place.
+void DeltaEncodeBytes(const char* src, char* dst, int64_t rows, int64_t cols,
+                      size_t element_size, bool encode) {
+  switch (element_size) {
+    case 1:
+      return DeltaEncodeBytes<1>(src, dst, rows, cols, encode);
+    case 2:
+      return DeltaEncodeBytes<2>(src, dst, rows, cols, encode);
+    case 4:
+      return DeltaEncodeBytes<4>(src, dst, rows, cols, encode);
+    case 8:
+      return DeltaEncodeBytes<8>(src, dst, rows, cols, encode);
+    default:
+      REVERB_LOG(REVERB_FATAL)
+          << "Unsupported element size for delta encoding: " << element_size;
+  }
+}
+
+// Compression level of zstd. Higher levels compress better but are slower to
+// compress (decompression speed is roughly the same for all levels).
+constexpr int kZstdCompressionLevel = 3;
+
+class NoneCodec : public TensorCodec {
+ public:
+  void Compress(absl::string_view input, std::string* output) const override {
+    output->assign(input.data(), input.size());
   }
-  for (int i = 1; i < src.dimension(0); i++) {
-    for (int j = 0; j < src.dimension(1); j++) {
-      dst(i, j) = src(i, j) + (encode ? -src(i - 1, j) : dst(i - 1, j));
+
+  bool Uncompress(absl::string_view input, size_t output_size,
+                  char* output) const override {
+    if (input.size() != output_size) return false;
+    std::memcpy(output, input.data(), output_size);
+    return true;
+  }
+};
+
+class SnappyCodec : public TensorCodec {
+ public:
+  void Compress(absl::string_view input, std::string* output) const override {
+    output->clear();
+    SnappyCompressFromString(input, output);
+  }
+
+  bool Uncompress(absl::string_view input, size_t output_size,
+                  char* output) const override {
+    return SnappyUncompressToString(input, output_size, output);
+  }
+};
+
+class ZstdCodec : public TensorCodec {
+ public:
+  void Compress(absl::string_view input, std::string* output) const override {
+    ZstdCompressFromString(input, kZstdCompressionLevel, output);
+  }
+
+  bool Uncompress(absl::string_view input, size_t output_size,
+                  char* output) const override {
+    return ZstdUncompressToBuffer(input, output_size, output);
+  }
+};
+
+class Lz4Codec : public TensorCodec {
+ public:
+  void Compress(absl::string_view input, std::string* output) const override {
+    Lz4CompressFromString(input, output);
+  }
+
+  bool Uncompress(absl::string_view input, size_t output_size,
+                  char* output) const override {
+    return Lz4UncompressToBuffer(input, output_size, output);
+  }
+};
+
+// Compresses the difference of every row to the previous row with zstd. See
+// `CODEC_TEMPORAL` for details. Input which does not consist of at least two
+// rows is compressed as is.
+class TemporalCodec : public TensorCodec {
+ public:
+  void Compress(absl::string_view input, std::string* output) const override {
+    CompressRows(input, input.size(), output);
+  }
+
+  bool Uncompress(absl::string_view input, size_t output_size,
+                  char* output) const override {
+    return UncompressRows(input, output_size, output_size, output);
+  }
+
+  void CompressRows(absl::string_view input, size_t row_bytes,
+                    std::string* output) const override {
+    if (!HasRows(input.size(), row_bytes)) {
+      ZstdCompressFromString(input, kZstdCompressionLevel, output);
+      return;
     }
+    std::string residuals(input.size(), '\0');
+    internal::DeltaEncodeRows(reinterpret_cast<const uint8_t*>(input.data()),
+                              reinterpret_cast<uint8_t*>(&residuals[0]),
+                              input.size() / row_bytes, row_bytes,
+                              /*encode=*/true);
+    ZstdCompressFromString(residuals, kZstdCompressionLevel, output);
   }
-  return output;
+
+  bool UncompressRows(absl::string_view input, size_t row_bytes,
+                      size_t output_size, char* output) const override {
+    if (!ZstdUncompressToBuffer(input, output_size, output)) return false;
+    if (HasRows(output_size, row_bytes)) {
+      auto* rows = reinterpret_cast<uint8_t*>(output);
+      internal::DeltaEncodeRows(rows, rows, output_size / row_bytes, row_bytes,
+                                /*encode=*/false);
+    }
+    return true;
+  }
+
+ private:
+  static bool HasRows(size_t size, size_t row_bytes) {
+    return row_bytes > 0 && size > row_bytes && size % row_bytes == 0;
+  }
+};
+
+class CodecRegistry {
+ public:
+  CodecRegistry() {
+    codecs_[CODEC_NONE] = absl::make_unique<NoneCodec>();
+    codecs_[CODEC_SNAPPY] = absl::make_unique<SnappyCodec>();
+    codecs_[CODEC_ZSTD] = absl::make_unique<ZstdCodec>();
+    codecs_[CODEC_LZ4] = absl::make_unique<Lz4Codec>();
+    codecs_[CODEC_TEMPORAL] = absl::make_unique<TemporalCodec>();
+  }
+
+  tensorflow::Status Register(CompressionCodec codec,
+                              std::unique_ptr<const TensorCodec> impl) {
+    absl::MutexLock lock(&mu_);
+    if (!codecs_.try_emplace(codec, std::move(impl)).second) {
+      return tensorflow::errors::AlreadyExists(
+          "An implementation of ", CompressionCodec_Name(codec),
+          " has already been registered.");
+    }
+    return tensorflow::Status::OK();
+  }
+
+  const TensorCodec* Get(CompressionCodec codec) const {
+    absl::MutexLock lock(&mu_);
+    auto it = codecs_.find(codec);
+    return it == codecs_.end() ? nullptr : it->second.get();
+  }
+
+ private:
+  mutable absl::Mutex mu_;
+  internal::flat_hash_map<int, std::unique_ptr<const TensorCodec>> codecs_
+      ABSL_GUARDED_BY(mu_);
+};
+
+CodecRegistry* Registry() {
+  static auto* registry = new CodecRegistry();
+  return registry;
+}
+
+const TensorCodec& GetCodecOrDie(CompressionCodec codec) {
+  const TensorCodec* impl = GetTensorCodec(codec);
+  REVERB_CHECK(impl != nullptr)
+      << "No implementation registered for codec " << codec;
+  return *impl;
+}
+
+// Layout of the rows (i.e. time steps) of a tensor.
+struct RowLayout {
+  RowLayout(tensorflow::DataType dtype, const tensorflow::TensorShape& shape)
+      : rows(shape.dim_size(0)),
+        row_elements(rows == 0 ? 0 : shape.num_elements() / rows),
+        element_size(tensorflow::DataTypeSize(dtype)),
+        row_bytes(row_elements * element_size),
+        dtype(dtype),
+        delta_encodable(IsDeltaEncodable(dtype, shape.dims())) {}
+
+  int64_t rows;
+  int64_t row_elements;
+  size_t element_size;
+  size_t row_bytes;
+  tensorflow::DataType dtype;
+  bool delta_encodable;
+};
+
+// Number of bytes of a row (i.e. time step) of a (non string) tensor. Scalars
+// and tensors without rows are treated as a single row.
+size_t RowBytes(const tensorflow::Tensor& tensor) {
+  if (tensor.dims() == 0 || tensor.dim_size(0) == 0) {
+    return tensor.TotalBytes();
+  }
+  return tensor.TotalBytes() / tensor.dim_size(0);
+}
+
+// Returns a pointer to row `row` of the (non string) `output`.
+char* OutputRow(const RowLayout& layout, int64_t row,
+                tensorflow::Tensor* output) {
+  return const_cast<char*>(output->tensor_data().data()) +
+         row * layout.row_bytes;
+}
+
+// Validates the arguments of `DecompressTensorRowsInto`.
+tensorflow::Status CheckRowsInto(const tensorflow::TensorProto& proto,
+                                 int64_t begin, int64_t end,
+                                 int64_t output_row,
+                                 const tensorflow::Tensor& output) {
+  if (proto.dtype() != output.dtype()) {
+    return tensorflow::errors::InvalidArgument(
+        "Chunk tensor has dtype ", tensorflow::DataTypeString(proto.dtype()),
+        " but the output has dtype ",
+        tensorflow::DataTypeString(output.dtype()), ".");
+  }
+
+  const tensorflow::TensorShape shape(proto.tensor_shape());
+  bool compatible = shape.dims() >= 1 && shape.dims() == output.dims();
+  for (int i = 1; compatible && i < shape.dims(); i++) {
+    compatible = shape.dim_size(i) == output.dim_size(i);
+  }
+  if (!compatible) {
+    return tensorflow::errors::InvalidArgument(
+        "Chunk tensor has shape ", shape.DebugString(),
+        " which is incompatible with the output shape ",
+        output.shape().DebugString(), ".");
+  }
+
+  const int64_t rows = shape.dim_size(0);
+  if (begin < 0 || begin > end || end > rows) {
+    return tensorflow::errors::InvalidArgument(
+        "Rows [", begin, ", ", end,
+        ") are out of range for a chunk tensor with ", rows, " rows.");
+  }
+  if (output_row < 0 || output_row + end - begin > output.dim_size(0)) {
+    return tensorflow::errors::InvalidArgument(
+        "Can't write ", end - begin, " rows at row ", output_row,
+        " of an output with ", output.dim_size(0), " rows.");
+  }
+  return tensorflow::Status::OK();
+}
+
+// Checks that `index` describes the blocks of a tensor with `rows` rows whose
+// compressed blocks are stored in `content`.
+tensorflow::Status CheckBlockIndex(const ChunkData::BlockIndex& index,
+                                   int64_t block_length, int64_t rows,
+                                   absl::string_view content) {
+  const int64_t num_blocks = (rows + block_length - 1) / block_length;
+  bool valid = index.limits_size() == num_blocks &&
+               (num_blocks == 0 ? content.empty()
+                                : index.limits(num_blocks - 1) ==
+                                      static_cast<int64_t>(content.size()));
+  for (int i = 0; valid && i < index.limits_size(); i++) {
+    valid = index.limits(i) >= (i == 0 ? 0 : index.limits(i - 1));
+  }
+  if (!valid) {
+    return tensorflow::errors::DataLoss(
+        "Block index does not describe ", num_blocks, " blocks of length ",
+        block_length, " stored in ", content.size(), " bytes.");
+  }
+  return tensorflow::Status::OK();
+}
+
+// String tensors are not compressed so there is nothing to gain from
+// decompressing them in place.
+tensorflow::Status CopyStringRowsInto(const tensorflow::TensorProto& proto,
+                                      int64_t begin, int64_t end,
+                                      int64_t output_row,
+                                      tensorflow::Tensor* output) {
+  tensorflow::Tensor tensor;
+  if (!tensor.FromProto(proto)) {
+    return tensorflow::errors::DataLoss("Failed to parse string tensor.");
+  }
+  auto src = tensor.flat_outer_dims<tensorflow::tstring>();
+  auto dst = output->flat_outer_dims<tensorflow::tstring>();
+  for (int64_t i = begin; i < end; i++) {
+    for (int64_t j = 0; j < src.dimension(1); j++) {
+      dst(output_row + i - begin, j) = src(i, j);
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+// Uncompresses `content`, which holds `rows` rows of `layout`, and writes the
+// rows [`begin`, `end`) to `dst`. If all rows are requested then `content` is
+// uncompressed directly into `dst`.
+tensorflow::Status UncompressRowsInto(absl::string_view content,
+                                      const TensorCodec& impl, int64_t rows,
+                                      const RowLayout& layout, bool delta,
+                                      int64_t begin, int64_t end, char* dst,
+                                      CompressionCodec codec) {
+  const auto uncompress_error = [codec] {
+    return tensorflow::errors::DataLoss(
+        "Failed to uncompress tensor with codec ", CompressionCodec_Name(codec),
+        ".");
+  };
+
+  if (begin == 0 && end == rows) {
+    if (!impl.UncompressRows(content, layout.row_bytes,
+                             rows * layout.row_bytes, dst)) {
+      return uncompress_error();
+    }
+    if (delta) {
+      DeltaEncodeBytes(dst, dst, rows, layout.row_elements,
+                       layout.element_size, /*encode=*/false);
+    }
+    return tensorflow::Status::OK();
+  }
+
+  // Only a part of the rows is requested so they have to be uncompressed into
+  // a temporary buffer first.
+  tensorflow::Tensor scratch(
+      layout.dtype, tensorflow::TensorShape({rows, layout.row_elements}));
+  char* src = const_cast<char*>(scratch.tensor_data().data());
+  if (!impl.UncompressRows(content, layout.row_bytes, rows * layout.row_bytes,
+                           src)) {
+    return uncompress_error();
+  }
+
+  if (delta) {
+    // Row `begin` depends on all the rows before it, so the prefix is decoded
+    // in place before the requested rows are decoded into `dst`.
+    if (begin > 0) {
+      DeltaEncodeBytes(src, src, begin + 1, layout.row_elements,
+                       layout.element_size, /*encode=*/false);
+    }
+    DeltaEncodeBytes(src + begin * layout.row_bytes, dst, end - begin,
+                     layout.row_elements, layout.element_size,
+                     /*encode=*/false);
+  } else {
+    std::memcpy(dst, src + begin * layout.row_bytes,
+                (end - begin) * layout.row_bytes);
+  }
+  return tensorflow::Status::OK();
 }
 
 }  // namespace
 
+tensorflow::Status RegisterTensorCodec(
+    CompressionCodec codec, std::unique_ptr<const TensorCodec> implementation) {
+  return Registry()->Register(codec, std::move(implementation));
+}
+
+const TensorCodec* GetTensorCodec(CompressionCodec codec) {
+  return Registry()->Get(codec);
+}
+
 tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode) {
   if (tensor.dims() < 2) return tensor;
 
@@ -79,32 +478,273 @@ std::vector<tensorflow::Tensor> DeltaEncodeList(
 }
 
 void CompressTensorAsProto(const tensorflow::Tensor& tensor,
-                           tensorflow::TensorProto* proto) {
+                           tensorflow::TensorProto* proto,
+                           CompressionCodec codec) {
   if (tensor.dtype() == tensorflow::DT_STRING) {
     tensor.AsProtoTensorContent(proto);
   } else {
     proto->set_dtype(tensor.dtype());
     tensor.shape().AsProto(proto->mutable_tensor_shape());
-    SnappyCompressFromString(tensor.tensor_data(),
-                             proto->mutable_tensor_content());
+    GetCodecOrDie(codec).CompressRows(tensor.tensor_data(), RowBytes(tensor),
+                                      proto->mutable_tensor_content());
   }
 }
 
-tensorflow::Tensor DecompressTensorFromProto(
-    const tensorflow::TensorProto& proto) {
+tensorflow::Status DecompressTensorFromProto(
+    const tensorflow::TensorProto& proto, CompressionCodec codec,
+    tensorflow::Tensor* tensor) {
   if (proto.dtype() == tensorflow::DT_STRING) {
-    tensorflow::Tensor tensor;
-    REVERB_CHECK(tensor.FromProto(proto));
-    return tensor;
-  } else {
-    tensorflow::Tensor tensor(proto.dtype(),
-                              tensorflow::TensorShape(proto.tensor_shape()));
-    const auto& tensor_content = proto.tensor_content();
-    SnappyUncompressToString(tensor_content,
-                             tensor.tensor_data().size(),
-                             const_cast<char*>(tensor.tensor_data().data()));
-    return tensor;
+    if (!tensor->FromProto(proto)) {
+      return tensorflow::errors::DataLoss("Failed to parse string tensor.");
+    }
+    return tensorflow::Status::OK();
+  }
+
+  if (!tensorflow::DataTypeCanUseMemcpy(proto.dtype()) ||
+      !tensorflow::TensorShape::IsValid(proto.tensor_shape())) {
+    return tensorflow::errors::DataLoss(
+        "Tensor has invalid dtype ", tensorflow::DataTypeString(proto.dtype()),
+        " or shape ", proto.tensor_shape().ShortDebugString(), ".");
+  }
+  const TensorCodec* impl = GetTensorCodec(codec);
+  if (impl == nullptr) {
+    return tensorflow::errors::DataLoss(
+        "No implementation registered for codec ", codec, ".");
+  }
+  tensorflow::Tensor decompressed(
+      proto.dtype(), tensorflow::TensorShape(proto.tensor_shape()));
+  if (!impl->UncompressRows(
+          proto.tensor_content(), RowBytes(decompressed),
+          decompressed.tensor_data().size(),
+          const_cast<char*>(decompressed.tensor_data().data()))) {
+    return tensorflow::errors::DataLoss(
+        "Failed to uncompress tensor with codec ", CompressionCodec_Name(codec),
+        ".");
+  }
+  *tensor = std::move(decompressed);
+  return tensorflow::Status::OK();
+}
+
+void CompressTensorBlocksAsProto(const tensorflow::Tensor& tensor,
+                                 int64_t block_length, bool delta_encode,
+                                 CompressionCodec codec,
+                                 tensorflow::TensorProto* proto,
+                                 ChunkData::BlockIndex* index) {
+  REVERB_CHECK_GT(block_length, 0);
+  REVERB_CHECK_GE(tensor.dims(), 1);
+  index->Clear();
+  if (tensor.dtype() == tensorflow::DT_STRING) {
+    tensor.AsProtoTensorContent(proto);
+    return;
+  }
+
+  proto->set_dtype(tensor.dtype());
+  tensor.shape().AsProto(proto->mutable_tensor_shape());
+
+  const TensorCodec& impl = GetCodecOrDie(codec);
+  const RowLayout layout(tensor.dtype(), tensor.shape());
+  const bool delta = delta_encode && layout.delta_encodable;
+  const char* data = tensor.tensor_data().data();
+
+  std::string* content = proto->mutable_tensor_content();
+  content->clear();
+  std::string encoded;
+  std::string compressed;
+  for (int64_t row = 0; row < layout.rows; row += block_length) {
+    const int64_t rows = std::min(block_length, layout.rows - row);
+    absl::string_view block(data + row * layout.row_bytes,
+                            rows * layout.row_bytes);
+    if (delta) {
+      encoded.resize(block.size());
+      DeltaEncodeBytes(block.data(), &encoded[0], rows, layout.row_elements,
+                       layout.element_size, /*encode=*/true);
+      block = encoded;
+    }
+    impl.CompressRows(block, layout.row_bytes, &compressed);
+    content->append(compressed);
+    index->add_limits(content->size());
+  }
+}
+
+tensorflow::Status DecompressTensorRowsInto(
+    const tensorflow::TensorProto& proto, CompressionCodec codec,
+    bool delta_encoded, int64_t begin, int64_t end, int64_t output_row,
+    tensorflow::Tensor* output) {
+  TF_RETURN_IF_ERROR(CheckRowsInto(proto, begin, end, output_row, *output));
+  if (begin == end) return tensorflow::Status::OK();
+  if (proto.dtype() == tensorflow::DT_STRING) {
+    return CopyStringRowsInto(proto, begin, end, output_row, output);
+  }
+
+  const RowLayout layout(proto.dtype(),
+                         tensorflow::TensorShape(proto.tensor_shape()));
+  return UncompressRowsInto(
+      proto.tensor_content(), GetCodecOrDie(codec), layout.rows, layout,
+      delta_encoded && layout.delta_encodable, begin, end,
+      OutputRow(layout, output_row, output), codec);
+}
+
+tensorflow::Status DecompressTensorBlockRowsInto(
+    const tensorflow::TensorProto& proto, const ChunkData::BlockIndex& index,
+    int64_t block_length, CompressionCodec codec, bool delta_encoded,
+    int64_t begin, int64_t end, int64_t output_row,
+    tensorflow::Tensor* output) {
+  TF_RETURN_IF_ERROR(CheckRowsInto(proto, begin, end, output_row, *output));
+  if (begin == end) return tensorflow::Status::OK();
+  if (proto.dtype() == tensorflow::DT_STRING) {
+    return CopyStringRowsInto(proto, begin, end, output_row, output);
+  }
+
+  const RowLayout layout(proto.dtype(),
+                         tensorflow::TensorShape(proto.tensor_shape()));
+  TF_RETURN_IF_ERROR(CheckBlockIndex(index, block_length, layout.rows,
+                                     proto.tensor_content()));
+
+  const TensorCodec& impl = GetCodecOrDie(codec);
+  const bool delta = delta_encoded && layout.delta_encodable;
+  for (int64_t block = begin / block_length; block * block_length < end;
+       block++) {
+    const int64_t first_row = block * block_length;
+    const int64_t rows = std::min(block_length, layout.rows - first_row);
+    const int64_t block_begin = std::max(begin, first_row) - first_row;
+    const int64_t block_end = std::min(end, first_row + rows) - first_row;
+    const int64_t start = block == 0 ? 0 : index.limits(block - 1);
+    const absl::string_view content =
+        absl::string_view(proto.tensor_content())
+            .substr(start, index.limits(block) - start);
+    TF_RETURN_IF_ERROR(UncompressRowsInto(
+        content, impl, rows, layout, delta, block_begin, block_end,
+        OutputRow(layout, output_row + first_row + block_begin - begin,
+                  output),
+        codec));
+  }
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status SliceBlockEncodedChunk(const ChunkData& chunk,
+                                          int64_t begin, int64_t end,
+                                          ChunkData* slice,
+                                          int64_t* slice_begin) {
+  const int64_t block_length = chunk.block_length();
+  if (block_length <= 0) {
+    return tensorflow::errors::InvalidArgument("Chunk ", chunk.chunk_key(),
+                                               " is not block encoded.");
+  }
+  if (chunk.data().tensors().empty()) {
+    return tensorflow::errors::InvalidArgument(
+        "Chunk ", chunk.chunk_key(), " does not hold any tensors.");
+  }
+  if (chunk.data().block_indices_size() != chunk.data().tensors_size()) {
+    return tensorflow::errors::DataLoss(
+        "Chunk ", chunk.chunk_key(), " has ", chunk.data().tensors_size(),
+        " tensors but ", chunk.data().block_indices_size(), " block indices.");
+  }
+
+  const int64_t rows =
+      tensorflow::TensorShape(chunk.data().tensors(0).tensor_shape())
+          .dim_size(0);
+  if (begin < 0 || begin >= end || end > rows) {
+    return tensorflow::errors::InvalidArgument(
+        "Rows [", begin, ", ", end, ") are out of range for chunk ",
+        chunk.chunk_key(), " with ", rows, " rows.");
+  }
+
+  const int64_t first_block = begin / block_length;
+  const int64_t last_block = (end - 1) / block_length;
+  const int64_t first_row = first_block * block_length;
+  const int64_t num_rows =
+      std::min((last_block + 1) * block_length, rows) - first_row;
+
+  slice->Clear();
+  slice->set_chunk_key(chunk.chunk_key());
+  *slice->mutable_sequence_range() = chunk.sequence_range();
+  slice->mutable_sequence_range()->set_start(chunk.sequence_range().start() +
+                                             first_row);
+  slice->mutable_sequence_range()->set_end(
+      slice->sequence_range().start() + num_rows - 1);
+  slice->set_delta_encoded(chunk.delta_encoded());
+  slice->set_codec(chunk.codec());
+  slice->set_block_length(block_length);
+
+  for (int i = 0; i < chunk.data().tensors_size(); i++) {
+    const auto& proto = chunk.data().tensors(i);
+    const auto& index = chunk.data().block_indices(i);
+    auto* sliced_proto = slice->mutable_data()->add_tensors();
+    auto* sliced_index = slice->mutable_data()->add_block_indices();
+
+    tensorflow::TensorShape shape(proto.tensor_shape());
+    if (shape.dims() == 0 || shape.dim_size(0) != rows) {
+      return tensorflow::errors::DataLoss(
+          "Tensors of chunk ", chunk.chunk_key(),
+          " must have identical batch size, but the first tensor has batch "
+          "size ",
+          rows, " while tensor ", i, " has shape ", shape.DebugString());
+    }
+
+    if (proto.dtype() == tensorflow::DT_STRING) {
+      tensorflow::Tensor tensor;
+      TF_RETURN_IF_ERROR(
+          DecompressTensorFromProto(proto, CODEC_SNAPPY, &tensor));
+      tensorflow::tensor::DeepCopy(
+          tensor.Slice(first_row, first_row + num_rows))
+          .AsProtoTensorContent(sliced_proto);
+      continue;
+    }
+
+    TF_RETURN_IF_ERROR(
+        CheckBlockIndex(index, block_length, rows, proto.tensor_content()));
+    const int64_t start = first_block == 0 ? 0 : index.limits(first_block - 1);
+    sliced_proto->set_dtype(proto.dtype());
+    shape.set_dim(0, num_rows);
+    shape.AsProto(sliced_proto->mutable_tensor_shape());
+    sliced_proto->set_tensor_content(proto.tensor_content().substr(
+        start, index.limits(last_block) - start));
+    for (int64_t block = first_block; block <= last_block; block++) {
+      sliced_index->add_limits(index.limits(block) - start);
+    }
+  }
+
+  *slice_begin = begin - first_row;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status DecompressChunk(const ChunkData& chunk,
+                                   ChunkData* decompressed) {
+  const bool block_encoded = chunk.block_length() > 0;
+  if (block_encoded &&
+      chunk.data().block_indices_size() != chunk.data().tensors_size()) {
+    return tensorflow::errors::DataLoss(
+        "Chunk ", chunk.chunk_key(), " has ", chunk.data().tensors_size(),
+        " tensors but ", chunk.data().block_indices_size(), " block indices.");
+  }
+
+  decompressed->Clear();
+  decompressed->set_chunk_key(chunk.chunk_key());
+  *decompressed->mutable_sequence_range() = chunk.sequence_range();
+  decompressed->set_codec(CODEC_NONE);
+
+  for (int i = 0; i < chunk.data().tensors_size(); i++) {
+    const auto& proto = chunk.data().tensors(i);
+    tensorflow::TensorShape shape(proto.tensor_shape());
+    if (shape.dims() == 0) {
+      return tensorflow::errors::DataLoss("Tensor ", i, " of chunk ",
+                                          chunk.chunk_key(),
+                                          " does not have a batch dimension.");
+    }
+    tensorflow::Tensor tensor(proto.dtype(), shape);
+    const int64_t rows = shape.dim_size(0);
+    if (rows > 0 && block_encoded) {
+      TF_RETURN_IF_ERROR(DecompressTensorBlockRowsInto(
+          proto, chunk.data().block_indices(i), chunk.block_length(),
+          chunk.codec(), chunk.delta_encoded(), 0, rows, 0, &tensor));
+    } else if (rows > 0) {
+      TF_RETURN_IF_ERROR(DecompressTensorRowsInto(
+          proto, chunk.codec(), chunk.delta_encoded(), 0, rows, 0, &tensor));
+    }
+    CompressTensorAsProto(tensor, decompressed->mutable_data()->add_tensors(),
+                          CODEC_NONE);
   }
+  return tensorflow::Status::OK();
 }
 
 }  // namespace reverb
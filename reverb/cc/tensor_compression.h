@@ -15,8 +15,17 @@
 #ifndef LEARNING_DEEPMIND_REPLAY_REVERB_TENSOR_COMPRESSION_H_
 #define LEARNING_DEEPMIND_REPLAY_REVERB_TENSOR_COMPRESSION_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "reverb/cc/schema.pb.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
 namespace reverb {
@@ -31,14 +40,113 @@ tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode);
 std::vector<tensorflow::Tensor> DeltaEncodeList(
     const std::vector<tensorflow::Tensor>& tensors, bool encode);
 
-// Compresses a Tensor with Zippy. The resulting `proto` must be read with
-// `DecompressTensorFromProto`. Note that string tensors are not compressed.
+// Compresses and uncompresses the content of tensors. Implementations must be
+// thread safe.
+class TensorCodec {
+ public:
+  virtual ~TensorCodec() = default;
+
+  // Compresses `input` and stores the result in `output`.
+  virtual void Compress(absl::string_view input, std::string* output) const = 0;
+
+  // Uncompresses `input` to the `output_size` bytes at `output`. Returns false
+  // if `input` is corrupt or does not uncompress to exactly `output_size`
+  // bytes.
+  virtual bool Uncompress(absl::string_view input, size_t output_size,
+                          char* output) const = 0;
+
+  // Same as `Compress` but `input` consists of rows (i.e. time steps) of
+  // `row_bytes` bytes. Codecs which exploit the similarity of consecutive rows
+  // override this while the default ignores the layout. The result must be
+  // uncompressed with `UncompressRows` and the same `row_bytes`.
+  virtual void CompressRows(absl::string_view input, size_t row_bytes,
+                            std::string* output) const {
+    Compress(input, output);
+  }
+
+  // Uncompresses the output of `CompressRows`.
+  virtual bool UncompressRows(absl::string_view input, size_t row_bytes,
+                              size_t output_size, char* output) const {
+    return Uncompress(input, output_size, output);
+  }
+};
+
+// Registers the implementation of `codec`. Codecs can't be replaced once
+// registered, so an error is returned if `codec` already has an
+// implementation. All values of `CompressionCodec` are registered by default.
+tensorflow::Status RegisterTensorCodec(
+    CompressionCodec codec, std::unique_ptr<const TensorCodec> implementation);
+
+// Returns the implementation of `codec` or nullptr if none is registered. The
+// implementation lives for the lifetime of the process.
+const TensorCodec* GetTensorCodec(CompressionCodec codec);
+
+// Compresses a Tensor with `codec`. The resulting `proto` must be read with
+// `DecompressTensorFromProto` using the same codec. Note that string tensors
+// are not compressed.
 void CompressTensorAsProto(const tensorflow::Tensor& tensor,
-                           tensorflow::TensorProto* proto);
+                           tensorflow::TensorProto* proto,
+                           CompressionCodec codec = CODEC_SNAPPY);
+
+// Decompresses a TensorProto built by calling `CompressTensorAsProto` with
+// `codec` into `tensor`. Returns DataLoss if `proto` is corrupt, e.g because it
+// was compressed with a different codec.
+tensorflow::Status DecompressTensorFromProto(
+    const tensorflow::TensorProto& proto, CompressionCodec codec,
+    tensorflow::Tensor* tensor);
+
+// Decompresses the rows (i.e. time steps) [`begin`, `end`) of the chunk tensor
+// `proto` into `output`, starting at row `output_row` of `output`. `proto`
+// must have been built by `CompressTensorAsProto` with `codec` and, if
+// `delta_encoded` is true, from a tensor encoded with `DeltaEncode`. `output`
+// must be allocated by the caller and have the dtype of `proto` and the same
+// dimensions except for the first.
+//
+// This allows the tensors of a sample to be allocated once and filled chunk by
+// chunk without creating (and concatenating) intermediate tensors. If all rows
+// are requested then the chunk is uncompressed directly into `output`.
+tensorflow::Status DecompressTensorRowsInto(
+    const tensorflow::TensorProto& proto, CompressionCodec codec,
+    bool delta_encoded, int64_t begin, int64_t end, int64_t output_row,
+    tensorflow::Tensor* output);
+
+// Splits the time steps (i.e. the first dimension) of `tensor` into blocks of
+// `block_length` time steps which are delta encoded (if `delta_encode`) and
+// compressed with `codec` independently of each other. The compressed blocks
+// are concatenated in the content of `proto` and their boundaries are stored
+// in `index`. String tensors are not compressed and `index` is left empty.
+//
+// See `ChunkData.block_length` for details.
+void CompressTensorBlocksAsProto(const tensorflow::Tensor& tensor,
+                                 int64_t block_length, bool delta_encode,
+                                 CompressionCodec codec,
+                                 tensorflow::TensorProto* proto,
+                                 ChunkData::BlockIndex* index);
+
+// Same as `DecompressTensorRowsInto` but for tensors which were compressed
+// with `CompressTensorBlocksAsProto`. Only the blocks which overlap with the
+// rows [`begin`, `end`) are decompressed.
+tensorflow::Status DecompressTensorBlockRowsInto(
+    const tensorflow::TensorProto& proto, const ChunkData::BlockIndex& index,
+    int64_t block_length, CompressionCodec codec, bool delta_encoded,
+    int64_t begin, int64_t end, int64_t output_row,
+    tensorflow::Tensor* output);
+
+// Creates a chunk in `slice` which only holds the blocks of the block encoded
+// `chunk` which overlap with the time steps [`begin`, `end`). The content of
+// the blocks is copied as is so nothing is decompressed. `slice_begin` is set
+// to the index of time step `begin` within `slice`.
+tensorflow::Status SliceBlockEncodedChunk(const ChunkData& chunk,
+                                          int64_t begin, int64_t end,
+                                          ChunkData* slice,
+                                          int64_t* slice_begin);
 
-// Assumes that the TensorProto was built by calling `CompressTensorAsProto`.
-tensorflow::Tensor DecompressTensorFromProto(
-    const tensorflow::TensorProto& proto);
+// Decompresses all tensors of `chunk` into `decompressed`, which is otherwise
+// a copy of `chunk` with codec `CODEC_NONE` and neither delta nor block
+// encoding. The tensors of `decompressed` can thus be read without knowing how
+// `chunk` was compressed, e.g by consumers of exported tables.
+tensorflow::Status DecompressChunk(const ChunkData& chunk,
+                                   ChunkData* decompressed);
 
 template <typename T>
 struct UnsignedType {
@@ -14,16 +14,25 @@
 
 #include "reverb/cc/tensor_compression.h"
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/string_view.h"
+#include "reverb/cc/schema.pb.h"
 #include "reverb/cc/testing/tensor_testutil.h"
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/framework/types.pb.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
 
 namespace deepmind {
 namespace reverb {
@@ -70,7 +79,8 @@ TEST(TensorCompressionTest, StringTensor) {
   tensorflow::TensorProto proto;
   CompressTensorAsProto(tensor, &proto);
 
-  tensorflow::Tensor result = DecompressTensorFromProto(proto);
+  tensorflow::Tensor result;
+  TF_ASSERT_OK(DecompressTensorFromProto(proto, CODEC_SNAPPY, &result));
   test::ExpectTensorEqual<tensorflow::tstring>(tensor, result);
 }
 
@@ -82,7 +92,8 @@ TEST(TensorCompressionTest, NonStringTensor) {
   tensorflow::TensorProto proto;
   CompressTensorAsProto(tensor, &proto);
 
-  tensorflow::Tensor result = DecompressTensorFromProto(proto);
+  tensorflow::Tensor result;
+  TF_ASSERT_OK(DecompressTensorFromProto(proto, CODEC_SNAPPY, &result));
   test::ExpectTensorEqual<int>(tensor, result);
 }
 
@@ -94,10 +105,461 @@ TEST(TensorCompressionTest, NonStringTensorWithDeltaEncoding) {
   tensorflow::TensorProto proto;
   CompressTensorAsProto(DeltaEncode(tensor, true), &proto);
 
-  tensorflow::Tensor result = DecompressTensorFromProto(proto);
+  tensorflow::Tensor result;
+  TF_ASSERT_OK(DecompressTensorFromProto(proto, CODEC_SNAPPY, &result));
   test::ExpectTensorEqual<int>(tensor, DeltaEncode(result, false));
 }
 
+class TensorCompressionCodecTest
+    : public ::testing::TestWithParam<CompressionCodec> {};
+
+TEST_P(TensorCompressionCodecTest, DecompressMatchesCompress) {
+  tensorflow::Tensor tensor(tensorflow::DT_UINT8,
+                            tensorflow::TensorShape({10, 84, 84}));
+  // Repetitive content so that every codec except none reduces the size.
+  auto flat = tensor.flat<tensorflow::uint8>();
+  for (int i = 0; i < flat.size(); i++) flat(i) = (i / 100) % 7;
+
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, &proto, GetParam());
+  if (GetParam() == CODEC_NONE) {
+    EXPECT_EQ(proto.tensor_content().size(), tensor.TotalBytes());
+  } else {
+    EXPECT_LT(proto.tensor_content().size(), tensor.TotalBytes());
+  }
+
+  tensorflow::Tensor result;
+  TF_ASSERT_OK(DecompressTensorFromProto(proto, GetParam(), &result));
+  test::ExpectTensorEqual<tensorflow::uint8>(tensor, result);
+}
+
+TEST_P(TensorCompressionCodecTest, EmptyTensor) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({0, 3}));
+
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, &proto, GetParam());
+
+  tensorflow::Tensor result;
+  TF_ASSERT_OK(DecompressTensorFromProto(proto, GetParam(), &result));
+  test::ExpectTensorEqual<float>(tensor, result);
+}
+
+TEST_P(TensorCompressionCodecTest, TruncatedInputIsRejected) {
+  const TensorCodec* codec = GetTensorCodec(GetParam());
+  ASSERT_NE(codec, nullptr);
+
+  std::string compressed;
+  codec->Compress("hello world", &compressed);
+  char output[11];
+  EXPECT_TRUE(codec->Uncompress(compressed, sizeof(output), output));
+  EXPECT_EQ(absl::string_view(output, sizeof(output)), "hello world");
+
+  compressed.pop_back();
+  EXPECT_FALSE(codec->Uncompress(compressed, sizeof(output), output));
+}
+
+TEST_P(TensorCompressionCodecTest, CorruptProtoReturnsDataLoss) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({10, 10}));
+  tensor.flat<int32_t>().setConstant(1);
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, &proto, GetParam());
+  proto.mutable_tensor_content()->resize(proto.tensor_content().size() / 2);
+
+  tensorflow::Tensor result;
+  EXPECT_EQ(DecompressTensorFromProto(proto, GetParam(), &result).code(),
+            tensorflow::error::DATA_LOSS);
+}
+
+INSTANTIATE_TEST_SUITE_P(AllCodecs, TensorCompressionCodecTest,
+                         ::testing::Values(CODEC_NONE, CODEC_SNAPPY,
+                                           CODEC_ZSTD, CODEC_LZ4,
+                                           CODEC_TEMPORAL));
+
+// Frames of a sprite which moves by one pixel per time step over a noisy
+// background which brightens a little every time step, so no two frames hold
+// the same byte sequences.
+tensorflow::Tensor MovingSpriteFrames(int64_t num_frames) {
+  tensorflow::Tensor frames(tensorflow::DT_UINT8,
+                            tensorflow::TensorShape({num_frames, 32, 32, 3}));
+  auto pixels = frames.tensor<tensorflow::uint8, 4>();
+  for (int64_t t = 0; t < num_frames; t++) {
+    for (int y = 0; y < 32; y++) {
+      for (int x = 0; x < 32; x++) {
+        for (int c = 0; c < 3; c++) {
+          const bool sprite = y >= 8 && y < 16 && x >= t && x < t + 8;
+          const int background = (y * 7919 + x * 104729 + c * 1299709) % 199;
+          pixels(t, y, x, c) = sprite ? 255 - c : background + t;
+        }
+      }
+    }
+  }
+  return frames;
+}
+
+TEST(TensorCompressionTest, TemporalCodecCompressesFramesBetterThanZstd) {
+  const tensorflow::Tensor frames = MovingSpriteFrames(16);
+
+  tensorflow::TensorProto zstd;
+  CompressTensorAsProto(frames, &zstd, CODEC_ZSTD);
+  tensorflow::TensorProto temporal;
+  CompressTensorAsProto(frames, &temporal, CODEC_TEMPORAL);
+  EXPECT_LT(temporal.tensor_content().size(), zstd.tensor_content().size());
+
+  tensorflow::Tensor result;
+  TF_ASSERT_OK(DecompressTensorFromProto(temporal, CODEC_TEMPORAL, &result));
+  test::ExpectTensorEqual<tensorflow::uint8>(frames, result);
+}
+
+TEST(TensorCompressionTest, TemporalCodecDecompressesBlockRows) {
+  const tensorflow::Tensor frames = MovingSpriteFrames(10);
+
+  tensorflow::TensorProto proto;
+  ChunkData::BlockIndex index;
+  CompressTensorBlocksAsProto(frames, /*block_length=*/4,
+                              /*delta_encode=*/false,
+                              CODEC_TEMPORAL, &proto, &index);
+  ASSERT_EQ(index.limits_size(), 3);
+
+  for (const auto& range : std::vector<std::pair<int64_t, int64_t>>{
+           {0, 10}, {1, 3}, {3, 9}, {5, 6}, {8, 10}}) {
+    const int64_t length = range.second - range.first;
+    tensorflow::Tensor output(tensorflow::DT_UINT8,
+                              tensorflow::TensorShape({length, 32, 32, 3}));
+    TF_ASSERT_OK(DecompressTensorBlockRowsInto(
+        proto, index, /*block_length=*/4, CODEC_TEMPORAL,
+        /*delta_encoded=*/false, range.first, range.second, 0, &output));
+    test::ExpectTensorEqual<tensorflow::uint8>(
+        output,
+        tensorflow::tensor::DeepCopy(frames.Slice(range.first, range.second)));
+  }
+}
+
+template <typename T>
+void DecompressRowsIntoMatchesSliceT(bool delta_encoded) {
+  tensorflow::Tensor tensor(tensorflow::DataTypeToEnum<T>::v(),
+                            tensorflow::TensorShape({9, 5, 3}));
+  tensor.flat<T>().setRandom();
+
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(delta_encoded ? DeltaEncode(tensor, true) : tensor,
+                        &proto, CODEC_ZSTD);
+
+  for (const auto& range : std::vector<std::pair<int64_t, int64_t>>{
+           {0, 9}, {0, 4}, {3, 9}, {2, 7}, {8, 9}}) {
+    const int64_t length = range.second - range.first;
+    tensorflow::Tensor output(tensorflow::DataTypeToEnum<T>::v(),
+                              tensorflow::TensorShape({length + 2, 5, 3}));
+    TF_ASSERT_OK(DecompressTensorRowsInto(proto, CODEC_ZSTD, delta_encoded,
+                                          range.first, range.second,
+                                          /*output_row=*/2, &output));
+    // The slices are deep copied as they are not necessarily aligned.
+    test::ExpectTensorEqual<T>(
+        tensorflow::tensor::DeepCopy(output.Slice(2, length + 2)),
+        tensorflow::tensor::DeepCopy(tensor.Slice(range.first, range.second)));
+  }
+}
+
+TEST(TensorCompressionTest, DecompressTensorRowsIntoMatchesSlice) {
+#define DECOMPRESS_ROWS_INTO(T)              \
+  DecompressRowsIntoMatchesSliceT<T>(false); \
+  DecompressRowsIntoMatchesSliceT<T>(true);
+  TF_CALL_INTEGRAL_TYPES(DECOMPRESS_ROWS_INTO)
+#undef DECOMPRESS_ROWS_INTO
+  DecompressRowsIntoMatchesSliceT<float>(false);
+  // Only integral tensors are delta encoded.
+  DecompressRowsIntoMatchesSliceT<float>(true);
+}
+
+TEST(TensorCompressionTest, DecompressTensorRowsIntoFillsOutputChunkByChunk) {
+  tensorflow::Tensor first(tensorflow::DT_INT32,
+                           tensorflow::TensorShape({4, 2}));
+  first.flat<int>().setRandom();
+  tensorflow::Tensor second(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({4, 2}));
+  second.flat<int>().setRandom();
+
+  tensorflow::TensorProto first_proto;
+  CompressTensorAsProto(DeltaEncode(first, true), &first_proto);
+  tensorflow::TensorProto second_proto;
+  CompressTensorAsProto(DeltaEncode(second, true), &second_proto);
+
+  // Time steps [1, 4) of the first chunk followed by [0, 2) of the second.
+  tensorflow::Tensor output(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({5, 2}));
+  TF_ASSERT_OK(DecompressTensorRowsInto(first_proto, CODEC_SNAPPY, true, 1, 4,
+                                        0, &output));
+  TF_ASSERT_OK(DecompressTensorRowsInto(second_proto, CODEC_SNAPPY, true, 0, 2,
+                                        3, &output));
+
+  using tensorflow::tensor::DeepCopy;
+  test::ExpectTensorEqual<int>(DeepCopy(output.Slice(0, 3)),
+                               DeepCopy(first.Slice(1, 4)));
+  test::ExpectTensorEqual<int>(DeepCopy(output.Slice(3, 5)),
+                               DeepCopy(second.Slice(0, 2)));
+}
+
+TEST(TensorCompressionTest, DecompressTensorRowsIntoStringTensor) {
+  tensorflow::Tensor tensor(tensorflow::DT_STRING,
+                            tensorflow::TensorShape({3}));
+  tensor.flat<tensorflow::tstring>()(0) = "a";
+  tensor.flat<tensorflow::tstring>()(1) = "b";
+  tensor.flat<tensorflow::tstring>()(2) = "c";
+
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, &proto);
+
+  tensorflow::Tensor output(tensorflow::DT_STRING,
+                            tensorflow::TensorShape({2}));
+  TF_ASSERT_OK(
+      DecompressTensorRowsInto(proto, CODEC_SNAPPY, false, 1, 3, 0, &output));
+  test::ExpectTensorEqual<tensorflow::tstring>(
+      output, tensorflow::tensor::DeepCopy(tensor.Slice(1, 3)));
+}
+
+TEST(TensorCompressionTest, DecompressTensorRowsIntoRejectsInvalidArguments) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({4, 2}));
+  tensor.flat<int>().setRandom();
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, &proto);
+
+  tensorflow::Tensor wrong_dtype(tensorflow::DT_FLOAT,
+                                 tensorflow::TensorShape({4, 2}));
+  EXPECT_EQ(DecompressTensorRowsInto(proto, CODEC_SNAPPY, false, 0, 4, 0,
+                                     &wrong_dtype)
+                .code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  tensorflow::Tensor wrong_shape(tensorflow::DT_INT32,
+                                 tensorflow::TensorShape({4, 3}));
+  EXPECT_EQ(DecompressTensorRowsInto(proto, CODEC_SNAPPY, false, 0, 4, 0,
+                                     &wrong_shape)
+                .code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  tensorflow::Tensor output(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({3, 2}));
+  // More rows than the chunk holds.
+  EXPECT_EQ(
+      DecompressTensorRowsInto(proto, CODEC_SNAPPY, false, 2, 5, 0, &output)
+          .code(),
+      tensorflow::error::INVALID_ARGUMENT);
+  // More rows than fit into the output.
+  EXPECT_EQ(
+      DecompressTensorRowsInto(proto, CODEC_SNAPPY, false, 0, 3, 1, &output)
+          .code(),
+      tensorflow::error::INVALID_ARGUMENT);
+}
+
+template <typename T>
+void DecompressBlockRowsIntoMatchesSliceT(bool delta_encoded) {
+  tensorflow::Tensor tensor(tensorflow::DataTypeToEnum<T>::v(),
+                            tensorflow::TensorShape({10, 4, 3}));
+  tensor.flat<T>().setRandom();
+
+  tensorflow::TensorProto proto;
+  ChunkData::BlockIndex index;
+  CompressTensorBlocksAsProto(tensor, /*block_length=*/3, delta_encoded,
+                              CODEC_LZ4, &proto, &index);
+  // Blocks of 3, 3, 3 and 1 time steps.
+  ASSERT_EQ(index.limits_size(), 4);
+  EXPECT_EQ(index.limits(3),
+            static_cast<int64_t>(proto.tensor_content().size()));
+
+  for (const auto& range : std::vector<std::pair<int64_t, int64_t>>{
+           {0, 10}, {0, 3}, {1, 2}, {2, 8}, {4, 10}, {9, 10}}) {
+    const int64_t length = range.second - range.first;
+    tensorflow::Tensor output(tensorflow::DataTypeToEnum<T>::v(),
+                              tensorflow::TensorShape({length + 1, 4, 3}));
+    TF_ASSERT_OK(DecompressTensorBlockRowsInto(
+        proto, index, /*block_length=*/3, CODEC_LZ4, delta_encoded,
+        range.first, range.second, /*output_row=*/1, &output));
+    test::ExpectTensorEqual<T>(
+        tensorflow::tensor::DeepCopy(output.Slice(1, length + 1)),
+        tensorflow::tensor::DeepCopy(tensor.Slice(range.first, range.second)));
+  }
+}
+
+TEST(TensorCompressionTest, DecompressTensorBlockRowsIntoMatchesSlice) {
+  DecompressBlockRowsIntoMatchesSliceT<tensorflow::uint8>(false);
+  DecompressBlockRowsIntoMatchesSliceT<tensorflow::uint8>(true);
+  DecompressBlockRowsIntoMatchesSliceT<tensorflow::int64>(true);
+  DecompressBlockRowsIntoMatchesSliceT<float>(false);
+}
+
+TEST(TensorCompressionTest, DecompressTensorBlockRowsIntoRejectsBadIndex) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({4, 2}));
+  tensor.flat<int>().setRandom();
+  tensorflow::TensorProto proto;
+  ChunkData::BlockIndex index;
+  CompressTensorBlocksAsProto(tensor, 2, false, CODEC_SNAPPY, &proto, &index);
+
+  tensorflow::Tensor output(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({4, 2}));
+  // The index was created for blocks of length 2.
+  EXPECT_EQ(DecompressTensorBlockRowsInto(proto, index, 3, CODEC_SNAPPY, false,
+                                          0, 4, 0, &output)
+                .code(),
+            tensorflow::error::DATA_LOSS);
+
+  index.set_limits(1, index.limits(1) + 1);
+  EXPECT_EQ(DecompressTensorBlockRowsInto(proto, index, 2, CODEC_SNAPPY, false,
+                                          0, 4, 0, &output)
+                .code(),
+            tensorflow::error::DATA_LOSS);
+}
+
+TEST(TensorCompressionTest, SliceBlockEncodedChunk) {
+  tensorflow::Tensor numbers(tensorflow::DT_INT32,
+                             tensorflow::TensorShape({10, 2}));
+  numbers.flat<int>().setRandom();
+  tensorflow::Tensor strings(tensorflow::DT_STRING,
+                             tensorflow::TensorShape({10}));
+  for (int i = 0; i < 10; i++) {
+    strings.flat<tensorflow::tstring>()(i) = std::to_string(i);
+  }
+
+  ChunkData chunk;
+  chunk.set_chunk_key(7);
+  chunk.mutable_sequence_range()->set_episode_id(3);
+  chunk.mutable_sequence_range()->set_start(20);
+  chunk.mutable_sequence_range()->set_end(29);
+  chunk.set_delta_encoded(true);
+  chunk.set_codec(CODEC_ZSTD);
+  chunk.set_block_length(4);
+  for (const auto* tensor : {&numbers, &strings}) {
+    CompressTensorBlocksAsProto(*tensor, 4, true, CODEC_ZSTD,
+                                chunk.mutable_data()->add_tensors(),
+                                chunk.mutable_data()->add_block_indices());
+  }
+
+  // Time steps [5, 9) are covered by the blocks [4, 8) and [8, 10).
+  ChunkData slice;
+  int64_t slice_begin;
+  TF_ASSERT_OK(SliceBlockEncodedChunk(chunk, 5, 9, &slice, &slice_begin));
+  EXPECT_EQ(slice_begin, 1);
+  EXPECT_EQ(slice.chunk_key(), 7);
+  EXPECT_EQ(slice.sequence_range().episode_id(), 3);
+  EXPECT_EQ(slice.sequence_range().start(), 24);
+  EXPECT_EQ(slice.sequence_range().end(), 29);
+  EXPECT_TRUE(slice.delta_encoded());
+  EXPECT_EQ(slice.codec(), CODEC_ZSTD);
+  EXPECT_EQ(slice.block_length(), 4);
+  ASSERT_EQ(slice.data().tensors_size(), 2);
+  EXPECT_LT(slice.data().tensors(0).tensor_content().size(),
+            chunk.data().tensors(0).tensor_content().size());
+
+  tensorflow::Tensor numbers_output(tensorflow::DT_INT32,
+                                    tensorflow::TensorShape({4, 2}));
+  TF_ASSERT_OK(DecompressTensorBlockRowsInto(
+      slice.data().tensors(0), slice.data().block_indices(0), 4, CODEC_ZSTD,
+      true, 1, 5, 0, &numbers_output));
+  test::ExpectTensorEqual<int>(numbers_output, tensorflow::tensor::DeepCopy(
+                                                   numbers.Slice(5, 9)));
+
+  tensorflow::Tensor strings_output(tensorflow::DT_STRING,
+                                    tensorflow::TensorShape({4}));
+  TF_ASSERT_OK(DecompressTensorBlockRowsInto(
+      slice.data().tensors(1), slice.data().block_indices(1), 4, CODEC_ZSTD,
+      true, 1, 5, 0, &strings_output));
+  test::ExpectTensorEqual<tensorflow::tstring>(
+      strings_output, tensorflow::tensor::DeepCopy(strings.Slice(5, 9)));
+
+  EXPECT_EQ(SliceBlockEncodedChunk(chunk, 5, 11, &slice, &slice_begin).code(),
+            tensorflow::error::INVALID_ARGUMENT);
+}
+
+TEST(TensorCompressionTest, DecompressChunk) {
+  tensorflow::Tensor numbers(tensorflow::DT_INT32,
+                             tensorflow::TensorShape({10, 2}));
+  numbers.flat<int>().setRandom();
+  tensorflow::Tensor strings(tensorflow::DT_STRING,
+                             tensorflow::TensorShape({10}));
+  for (int i = 0; i < 10; i++) {
+    strings.flat<tensorflow::tstring>()(i) = std::to_string(i);
+  }
+
+  for (int block_length : {0, 4}) {
+    ChunkData chunk;
+    chunk.set_chunk_key(7);
+    chunk.mutable_sequence_range()->set_start(20);
+    chunk.mutable_sequence_range()->set_end(29);
+    chunk.set_delta_encoded(true);
+    chunk.set_codec(CODEC_ZSTD);
+    chunk.set_block_length(block_length);
+    for (const auto* tensor : {&numbers, &strings}) {
+      if (block_length > 0) {
+        CompressTensorBlocksAsProto(*tensor, block_length, true, CODEC_ZSTD,
+                                    chunk.mutable_data()->add_tensors(),
+                                    chunk.mutable_data()->add_block_indices());
+      } else {
+        CompressTensorAsProto(DeltaEncode(*tensor, true),
+                              chunk.mutable_data()->add_tensors(),
+                              CODEC_ZSTD);
+      }
+    }
+
+    ChunkData decompressed;
+    TF_ASSERT_OK(DecompressChunk(chunk, &decompressed));
+    EXPECT_EQ(decompressed.chunk_key(), 7);
+    EXPECT_EQ(decompressed.sequence_range().start(), 20);
+    EXPECT_EQ(decompressed.sequence_range().end(), 29);
+    EXPECT_FALSE(decompressed.delta_encoded());
+    EXPECT_EQ(decompressed.codec(), CODEC_NONE);
+    EXPECT_EQ(decompressed.block_length(), 0);
+    ASSERT_EQ(decompressed.data().tensors_size(), 2);
+    EXPECT_EQ(decompressed.data().block_indices_size(), 0);
+
+    tensorflow::Tensor numbers_output;
+    ASSERT_TRUE(numbers_output.FromProto(decompressed.data().tensors(0)));
+    test::ExpectTensorEqual<int>(numbers_output, numbers);
+    tensorflow::Tensor strings_output;
+    ASSERT_TRUE(strings_output.FromProto(decompressed.data().tensors(1)));
+    test::ExpectTensorEqual<tensorflow::tstring>(strings_output, strings);
+  }
+}
+
+class ReversingCodec : public TensorCodec {
+ public:
+  void Compress(absl::string_view input, std::string* output) const override {
+    output->assign(input.rbegin(), input.rend());
+  }
+
+  bool Uncompress(absl::string_view input, size_t output_size,
+                  char* output) const override {
+    if (input.size() != output_size) return false;
+    std::copy(input.rbegin(), input.rend(), output);
+    return true;
+  }
+};
+
+TEST(TensorCompressionTest, RegisterTensorCodec) {
+  const auto kCustom = static_cast<CompressionCodec>(1000);
+  EXPECT_EQ(GetTensorCodec(kCustom), nullptr);
+  TF_EXPECT_OK(
+      RegisterTensorCodec(kCustom, absl::make_unique<ReversingCodec>()));
+  EXPECT_NE(GetTensorCodec(kCustom), nullptr);
+
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({2, 2}));
+  tensor.flat<int>().setRandom();
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, &proto, kCustom);
+  tensorflow::Tensor result;
+  TF_ASSERT_OK(DecompressTensorFromProto(proto, kCustom, &result));
+  test::ExpectTensorEqual<int>(tensor, result);
+}
+
+TEST(TensorCompressionTest, BuiltInCodecsCannotBeReplaced) {
+  EXPECT_EQ(
+      RegisterTensorCodec(CODEC_SNAPPY, absl::make_unique<ReversingCodec>())
+          .code(),
+      tensorflow::error::ALREADY_EXISTS);
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
@@ -0,0 +1,261 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/tools/load_generator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/client.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "reverb/cc/writer.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// How long `NewSampler` waits for the signature of the table.
+constexpr auto kValidationTimeout = absl::Seconds(10);
+
+// Returns a step of `num_bytes` pseudo random bytes so that the chunks don't
+// compress much better than real data would.
+tensorflow::Tensor MakeStep(int64_t num_bytes) {
+  tensorflow::Tensor step(tensorflow::DT_UINT8,
+                          tensorflow::TensorShape({num_bytes}));
+  auto flat = step.flat<uint8_t>();
+  uint32_t state = 1;
+  for (int64_t i = 0; i < num_bytes; i++) {
+    state = state * 1664525u + 1013904223u;
+    flat(i) = static_cast<uint8_t>(state >> 24);
+  }
+  return step;
+}
+
+std::string LatencySummary(const internal::LatencyHistogram& histogram) {
+  return absl::StrFormat(
+      "count=%d p50=%s p90=%s p99=%s max=%s", histogram.count(),
+      absl::FormatDuration(histogram.Percentile(0.5)),
+      absl::FormatDuration(histogram.Percentile(0.9)),
+      absl::FormatDuration(histogram.Percentile(0.99)),
+      absl::FormatDuration(histogram.max()));
+}
+
+void MergeInto(const LoadGeneratorReport& from, LoadGeneratorReport* to) {
+  to->steps_written += from.steps_written;
+  to->items_written += from.items_written;
+  to->bytes_written += from.bytes_written;
+  to->samples_received += from.samples_received;
+  to->bytes_received += from.bytes_received;
+  to->append_latency.Merge(from.append_latency);
+  to->confirmation_latency.Merge(from.confirmation_latency);
+  to->sample_latency.Merge(from.sample_latency);
+}
+
+// Appends steps and creates items until `stop` is set.
+tensorflow::Status RunWriter(const LoadGeneratorOptions& options,
+                             Client* client, const std::atomic<bool>* stop,
+                             LoadGeneratorReport* report) {
+  std::unique_ptr<Writer> writer;
+  TF_RETURN_IF_ERROR(client->NewWriter(
+      options.chunk_length, options.sequence_length, /*delta_encoded=*/false,
+      options.max_in_flight_items, &writer));
+
+  const tensorflow::Tensor step = MakeStep(options.step_bytes);
+  for (int64_t t = 0; !stop->load(); t++) {
+    const int num_items =
+        t + 1 >= options.sequence_length ? options.items_per_step : 0;
+    const absl::Time start = absl::Now();
+    TF_RETURN_IF_ERROR(writer->Append({step}));
+    for (int i = 0; i < num_items; i++) {
+      TF_RETURN_IF_ERROR(
+          writer->CreateItem(options.table, options.sequence_length, 1.0));
+    }
+    report->append_latency.Record(absl::Now() - start);
+    report->steps_written++;
+    report->items_written += num_items;
+    report->bytes_written += step.TotalBytes();
+
+    if (options.flush_interval_steps > 0 &&
+        (t + 1) % options.flush_interval_steps == 0) {
+      const absl::Time flush_start = absl::Now();
+      TF_RETURN_IF_ERROR(writer->Flush());
+      report->confirmation_latency.Record(absl::Now() - flush_start);
+    }
+  }
+  return writer->Close();
+}
+
+// Fetches samples until `stop` is set and the sampler has been closed.
+tensorflow::Status RunSampler(const LoadGeneratorOptions& options,
+                              Sampler* sampler, const std::atomic<bool>* stop,
+                              LoadGeneratorReport* report) {
+  std::vector<tensorflow::Tensor> data;
+  while (!stop->load()) {
+    const absl::Time start = absl::Now();
+    tensorflow::Status status =
+        options.sample_batch_size > 1
+            ? sampler->GetNextBatch(options.sample_batch_size, &data)
+            : sampler->GetNextSample(&data);
+    if (!status.ok()) {
+      // Calls which are blocked when the run ends are cancelled by `Close`.
+      return stop->load() ? tensorflow::Status::OK() : status;
+    }
+    report->sample_latency.Record(absl::Now() - start);
+    report->samples_received +=
+        options.sample_batch_size > 1 ? data[0].dim_size(0) : 1;
+    for (const auto& tensor : data) {
+      report->bytes_received += tensor.TotalBytes();
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace
+
+tensorflow::Status LoadGeneratorOptions::Validate() const {
+  if (server_address.empty()) {
+    return tensorflow::errors::InvalidArgument("server_address must be set.");
+  }
+  if (table.empty()) {
+    return tensorflow::errors::InvalidArgument("table must be set.");
+  }
+  if (duration <= absl::ZeroDuration()) {
+    return tensorflow::errors::InvalidArgument(
+        "duration must be positive but got ", absl::FormatDuration(duration));
+  }
+  if (num_writers < 0 || num_samplers < 0 || num_writers + num_samplers == 0) {
+    return tensorflow::errors::InvalidArgument(
+        "num_writers and num_samplers must be non-negative and at least one "
+        "must be positive but got ",
+        num_writers, " and ", num_samplers);
+  }
+  if (step_bytes <= 0 || chunk_length <= 0 || sequence_length <= 0 ||
+      max_in_flight_items <= 0) {
+    return tensorflow::errors::InvalidArgument(
+        "step_bytes, chunk_length, sequence_length and max_in_flight_items "
+        "must be positive.");
+  }
+  if (items_per_step < 0 || flush_interval_steps < 0) {
+    return tensorflow::errors::InvalidArgument(
+        "items_per_step and flush_interval_steps must be non-negative.");
+  }
+  if (sample_batch_size <= 0 || max_in_flight_samples_per_worker <= 0) {
+    return tensorflow::errors::InvalidArgument(
+        "sample_batch_size and max_in_flight_samples_per_worker must be "
+        "positive.");
+  }
+  return tensorflow::Status::OK();
+}
+
+std::string LoadGeneratorReport::ToString() const {
+  const double seconds = std::max(absl::ToDoubleSeconds(elapsed), 1e-9);
+  return absl::StrCat(
+      absl::StrFormat("elapsed: %s\n", absl::FormatDuration(elapsed)),
+      absl::StrFormat(
+          "writes: %d steps (%.1f/s), %d items (%.1f/s), %.2f MB/s\n",
+          steps_written, steps_written / seconds, items_written,
+          items_written / seconds, bytes_written / seconds / 1e6),
+      "  append latency: ", LatencySummary(append_latency), "\n",
+      "  confirmation latency: ", LatencySummary(confirmation_latency), "\n",
+      absl::StrFormat("samples: %d (%.1f/s), %.2f MB/s\n", samples_received,
+                      samples_received / seconds,
+                      bytes_received / seconds / 1e6),
+      "  sample latency: ", LatencySummary(sample_latency), "\n");
+}
+
+tensorflow::Status RunLoadGenerator(const LoadGeneratorOptions& options,
+                                    LoadGeneratorReport* report) {
+  TF_RETURN_IF_ERROR(options.Validate());
+  Client client(options.server_address);
+
+  Sampler::Options sampler_options;
+  sampler_options.num_workers = options.num_workers_per_sampler;
+  sampler_options.flexible_batch_size = options.flexible_batch_size;
+  sampler_options.max_in_flight_samples_per_worker =
+      options.max_in_flight_samples_per_worker;
+  std::vector<std::unique_ptr<Sampler>> samplers(options.num_samplers);
+  for (auto& sampler : samplers) {
+    TF_RETURN_IF_ERROR(client.NewSampler(options.table, sampler_options,
+                                         kValidationTimeout, &sampler));
+  }
+
+  std::atomic<bool> stop(false);
+  std::vector<LoadGeneratorReport> writer_reports(options.num_writers);
+  std::vector<tensorflow::Status> writer_status(options.num_writers);
+  std::vector<LoadGeneratorReport> sampler_reports(options.num_samplers);
+  std::vector<tensorflow::Status> sampler_status(options.num_samplers);
+
+  const absl::Time start = absl::Now();
+  std::vector<std::unique_ptr<internal::Thread>> writer_threads;
+  for (int i = 0; i < options.num_writers; i++) {
+    writer_threads.push_back(internal::StartThread(
+        "LoadGeneratorWriter",
+        [&options, &client, &stop, &writer_reports, &writer_status, i] {
+          writer_status[i] =
+              RunWriter(options, &client, &stop, &writer_reports[i]);
+        }));
+  }
+  std::vector<std::unique_ptr<internal::Thread>> sampler_threads;
+  for (int i = 0; i < options.num_samplers; i++) {
+    sampler_threads.push_back(internal::StartThread(
+        "LoadGeneratorSampler",
+        [&options, &samplers, &stop, &sampler_reports, &sampler_status, i] {
+          sampler_status[i] = RunSampler(options, samplers[i].get(), &stop,
+                                         &sampler_reports[i]);
+        }));
+  }
+
+  absl::SleepFor(options.duration);
+  stop.store(true);
+
+  // The writers are joined first so that inserts which are blocked by the
+  // rate limiter can complete while the samplers are still running.
+  writer_threads.clear();
+  for (auto& sampler : samplers) {
+    sampler->Close();
+  }
+  sampler_threads.clear();
+  report->elapsed = absl::Now() - start;
+
+  for (const auto& writer_report : writer_reports) {
+    MergeInto(writer_report, report);
+  }
+  for (const auto& sampler_report : sampler_reports) {
+    MergeInto(sampler_report, report);
+  }
+  for (const auto& status : writer_status) {
+    TF_RETURN_IF_ERROR(status);
+  }
+  for (const auto& status : sampler_status) {
+    TF_RETURN_IF_ERROR(status);
+  }
+  return tensorflow::Status::OK();
+}
+
+}  // namespace reverb
+}  // namespace deepmind
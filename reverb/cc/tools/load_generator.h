@@ -0,0 +1,103 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_TOOLS_LOAD_GENERATOR_H_
+#define REVERB_CC_TOOLS_LOAD_GENERATOR_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/time/time.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Configuration of a synthetic workload run against an existing table by
+// `RunLoadGenerator`.
+struct LoadGeneratorOptions {
+  // Address of the server (e.g "localhost:8000") and name of the table which
+  // is written to and sampled from. The table must already exist.
+  std::string server_address;
+  std::string table;
+
+  // How long the writers and samplers run for.
+  absl::Duration duration = absl::Seconds(10);
+
+  // `num_writers` writers each append steps holding a single DT_UINT8 tensor
+  // of `step_bytes` bytes. Once a writer has appended `sequence_length` steps
+  // it creates `items_per_step` items of `sequence_length` steps after every
+  // appended step.
+  int num_writers = 1;
+  int64_t step_bytes = 1024;
+  int chunk_length = 10;
+  int sequence_length = 10;
+  int items_per_step = 1;
+  int max_in_flight_items = 100;
+
+  // Every `flush_interval_steps` steps the writers wait for the server to
+  // confirm all their pending items. If 0 then the writers only flush when
+  // they are closed.
+  int flush_interval_steps = 100;
+
+  // `num_samplers` samplers each call `GetNextBatch` with `sample_batch_size`
+  // (or `GetNextSample` if it is 1). See `Sampler::Options` for the others.
+  int num_samplers = 1;
+  int sample_batch_size = 1;
+  int num_workers_per_sampler = Sampler::kAutoSelectValue;
+  int flexible_batch_size = Sampler::kAutoSelectValue;
+  int max_in_flight_samples_per_worker = 100;
+
+  // Returns InvalidArgument if any of the options is out of range.
+  tensorflow::Status Validate() const;
+};
+
+// Throughput and latencies measured by `RunLoadGenerator`.
+struct LoadGeneratorReport {
+  absl::Duration elapsed;
+
+  int64_t steps_written = 0;
+  int64_t items_written = 0;
+  int64_t bytes_written = 0;
+
+  // Samples are counted individually, i.e a batch of 8 counts as 8 samples.
+  int64_t samples_received = 0;
+  int64_t bytes_received = 0;
+
+  // Time spent appending a step and creating the items which end on it.
+  internal::LatencyHistogram append_latency;
+
+  // Time spent in `Writer::Flush`, i.e waiting for the server to confirm the
+  // items created since the previous flush.
+  internal::LatencyHistogram confirmation_latency;
+
+  // Time spent in each `GetNextSample` or `GetNextBatch` call.
+  internal::LatencyHistogram sample_latency;
+
+  // Human readable summary with rates and latency percentiles.
+  std::string ToString() const;
+};
+
+// Runs the workload described by `options` until `options.duration` has
+// passed and writes the measurements to `report`. Returns the first error
+// encountered by any writer or sampler.
+tensorflow::Status RunLoadGenerator(const LoadGeneratorOptions& options,
+                                    LoadGeneratorReport* report);
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_TOOLS_LOAD_GENERATOR_H_
@@ -0,0 +1,124 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Generates a synthetic insert and sample load against a table of a running
+// server and prints the throughput and latencies, e.g:
+//
+//   bazel run -c opt //reverb/cc/tools:load_generator_main -- \
+//     --server_address=localhost:8000 --table=my_table \
+//     --num_writers=4 --step_bytes=65536 --num_samplers=2 --batch_size=32
+//
+// or replays a workload trace recorded by a server (see
+// `ServerOptions::workload_trace_path`) against it, e.g twice as fast:
+//
+//   bazel run -c opt //reverb/cc/tools:load_generator_main -- \
+//     --server_address=localhost:8000 --trace=/tmp/trace --speedup=2
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/time.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/tools/load_generator.h"
+#include "reverb/cc/tools/trace_replayer.h"
+#include "tensorflow/core/lib/core/status.h"
+
+ABSL_FLAG(std::string, server_address, "localhost:8000",
+          "Address of the server.");
+ABSL_FLAG(std::string, table, "", "Table to write to and sample from.");
+ABSL_FLAG(absl::Duration, duration, absl::Seconds(10),
+          "How long to generate load for.");
+
+ABSL_FLAG(int, num_writers, 1, "Number of concurrent writers.");
+ABSL_FLAG(int64_t, step_bytes, 1024, "Size of each appended step.");
+ABSL_FLAG(int, chunk_length, 10, "Number of steps per chunk.");
+ABSL_FLAG(int, sequence_length, 10, "Number of steps per item.");
+ABSL_FLAG(int, items_per_step, 1, "Number of items created per step.");
+ABSL_FLAG(int, max_in_flight_items, 100,
+          "Maximum number of unconfirmed items per writer.");
+ABSL_FLAG(int, flush_interval_steps, 100,
+          "Steps between the flushes which measure insert confirmation. 0 "
+          "disables the periodic flushes.");
+
+ABSL_FLAG(int, num_samplers, 1, "Number of concurrent samplers.");
+ABSL_FLAG(int, batch_size, 1,
+          "Samples per GetNextBatch call, or GetNextSample if 1.");
+ABSL_FLAG(int, num_workers, deepmind::reverb::Sampler::kAutoSelectValue,
+          "Number of workers per sampler.");
+ABSL_FLAG(int, flexible_batch_size,
+          deepmind::reverb::Sampler::kAutoSelectValue,
+          "Maximum number of items sampled by the table in a single call.");
+ABSL_FLAG(int, max_in_flight_samples_per_worker, 100,
+          "Number of samples requested by a worker at a time.");
+
+ABSL_FLAG(std::string, trace, "",
+          "If set then the workload trace at this path is replayed instead "
+          "of generating a synthetic load. The options of the synthetic load "
+          "are ignored.");
+ABSL_FLAG(double, speedup, 1,
+          "Factor by which the trace is replayed faster than it was recorded. "
+          "If <= 0 then the trace is replayed as fast as possible.");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+
+  if (!absl::GetFlag(FLAGS_trace).empty()) {
+    deepmind::reverb::TraceReplayOptions options;
+    options.server_address = absl::GetFlag(FLAGS_server_address);
+    options.trace_path = absl::GetFlag(FLAGS_trace);
+    options.speedup = absl::GetFlag(FLAGS_speedup);
+    options.max_in_flight_items = absl::GetFlag(FLAGS_max_in_flight_items);
+
+    deepmind::reverb::TraceReplayReport report;
+    const tensorflow::Status status =
+        deepmind::reverb::ReplayWorkloadTrace(options, &report);
+    std::cout << report.ToString();
+    if (!status.ok()) {
+      std::cerr << "Trace replay failed: " << status.ToString() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  deepmind::reverb::LoadGeneratorOptions options;
+  options.server_address = absl::GetFlag(FLAGS_server_address);
+  options.table = absl::GetFlag(FLAGS_table);
+  options.duration = absl::GetFlag(FLAGS_duration);
+  options.num_writers = absl::GetFlag(FLAGS_num_writers);
+  options.step_bytes = absl::GetFlag(FLAGS_step_bytes);
+  options.chunk_length = absl::GetFlag(FLAGS_chunk_length);
+  options.sequence_length = absl::GetFlag(FLAGS_sequence_length);
+  options.items_per_step = absl::GetFlag(FLAGS_items_per_step);
+  options.max_in_flight_items = absl::GetFlag(FLAGS_max_in_flight_items);
+  options.flush_interval_steps = absl::GetFlag(FLAGS_flush_interval_steps);
+  options.num_samplers = absl::GetFlag(FLAGS_num_samplers);
+  options.sample_batch_size = absl::GetFlag(FLAGS_batch_size);
+  options.num_workers_per_sampler = absl::GetFlag(FLAGS_num_workers);
+  options.flexible_batch_size = absl::GetFlag(FLAGS_flexible_batch_size);
+  options.max_in_flight_samples_per_worker =
+      absl::GetFlag(FLAGS_max_in_flight_samples_per_worker);
+
+  deepmind::reverb::LoadGeneratorReport report;
+  const tensorflow::Status status =
+      deepmind::reverb::RunLoadGenerator(options, &report);
+  std::cout << report.ToString();
+  if (!status.ok()) {
+    std::cerr << "Load generator failed: " << status.ToString() << std::endl;
+    return 1;
+  }
+  return 0;
+}
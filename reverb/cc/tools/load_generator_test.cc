@@ -0,0 +1,134 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/tools/load_generator.h"
+
+#include <cfloat>
+#include <memory>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/net.h"
+#include "reverb/cc/platform/server.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/protobuf/error_codes.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+class LoadGeneratorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    port_ = internal::PickUnusedPortOrDie();
+    auto table = std::make_shared<Table>(
+        "table", std::make_shared<UniformSelector>(),
+        std::make_shared<FifoSelector>(), /*max_size=*/1000,
+        /*max_times_sampled=*/0,
+        std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                      /*min_size_to_sample=*/1,
+                                      /*min_diff=*/-DBL_MAX,
+                                      /*max_diff=*/DBL_MAX));
+    TF_ASSERT_OK(
+        StartServer({table}, port_, /*checkpointer=*/nullptr, &server_));
+  }
+
+  void TearDown() override { server_->Stop(); }
+
+  LoadGeneratorOptions MakeOptions() const {
+    LoadGeneratorOptions options;
+    options.server_address = absl::StrCat("localhost:", port_);
+    options.table = "table";
+    options.duration = absl::Milliseconds(500);
+    options.step_bytes = 64;
+    options.chunk_length = 2;
+    options.sequence_length = 3;
+    options.items_per_step = 2;
+    options.flush_interval_steps = 10;
+    return options;
+  }
+
+  int port_;
+  std::unique_ptr<Server> server_;
+};
+
+TEST_F(LoadGeneratorTest, WritesAndSamples) {
+  LoadGeneratorOptions options = MakeOptions();
+  options.num_writers = 2;
+  options.num_samplers = 2;
+  LoadGeneratorReport report;
+  TF_ASSERT_OK(RunLoadGenerator(options, &report));
+
+  EXPECT_GE(report.elapsed, options.duration);
+  EXPECT_GT(report.steps_written, 0);
+  EXPECT_EQ(report.bytes_written, report.steps_written * 64);
+  EXPECT_GT(report.items_written, 0);
+  EXPECT_EQ(report.append_latency.count(), report.steps_written);
+  EXPECT_GT(report.confirmation_latency.count(), 0);
+  EXPECT_GT(report.samples_received, 0);
+  EXPECT_GT(report.bytes_received, 0);
+  EXPECT_EQ(report.sample_latency.count(), report.samples_received);
+  EXPECT_THAT(report.ToString(), ::testing::HasSubstr("sample latency: "));
+}
+
+TEST_F(LoadGeneratorTest, CountsSamplesOfBatches) {
+  LoadGeneratorOptions options = MakeOptions();
+  options.sample_batch_size = 4;
+  LoadGeneratorReport report;
+  TF_ASSERT_OK(RunLoadGenerator(options, &report));
+
+  EXPECT_GT(report.sample_latency.count(), 0);
+  EXPECT_EQ(report.samples_received, report.sample_latency.count() * 4);
+}
+
+TEST_F(LoadGeneratorTest, WritersOnly) {
+  LoadGeneratorOptions options = MakeOptions();
+  options.num_samplers = 0;
+  LoadGeneratorReport report;
+  TF_ASSERT_OK(RunLoadGenerator(options, &report));
+
+  EXPECT_GT(report.steps_written, 0);
+  EXPECT_EQ(report.samples_received, 0);
+}
+
+TEST(LoadGeneratorOptionsTest, Validate) {
+  LoadGeneratorOptions options;
+  options.server_address = "localhost:1234";
+  options.table = "table";
+  TF_EXPECT_OK(options.Validate());
+
+  LoadGeneratorOptions no_table = options;
+  no_table.table = "";
+  EXPECT_EQ(no_table.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
+
+  LoadGeneratorOptions no_clients = options;
+  no_clients.num_writers = 0;
+  no_clients.num_samplers = 0;
+  EXPECT_EQ(no_clients.Validate().code(),
+            tensorflow::error::INVALID_ARGUMENT);
+
+  LoadGeneratorOptions no_steps = options;
+  no_steps.step_bytes = 0;
+  EXPECT_EQ(no_steps.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,473 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/tools/trace_replayer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/client.h"
+#include "reverb/cc/platform/grpc_utils.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "reverb/cc/support/workload_trace.h"
+#include "reverb/cc/tensor_compression.h"
+#include "reverb/cc/workload_trace.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// How long `NewSampler` waits for the signature of the table.
+constexpr auto kValidationTimeout = absl::Seconds(10);
+
+// An event of the trace together with its time relative to the start of the
+// trace.
+struct ScheduledEvent {
+  absl::Duration time;
+  const std::string* table;
+  const WorkloadTraceEvent* event;
+};
+
+std::string LatencySummary(const internal::LatencyHistogram& histogram) {
+  return absl::StrFormat(
+      "count=%d p50=%s p90=%s p99=%s max=%s", histogram.count(),
+      absl::FormatDuration(histogram.Percentile(0.5)),
+      absl::FormatDuration(histogram.Percentile(0.9)),
+      absl::FormatDuration(histogram.Percentile(0.99)),
+      absl::FormatDuration(histogram.max()));
+}
+
+// Paces the replay by the schedule of the trace.
+class Clock {
+ public:
+  Clock(absl::Time start, double speedup) : start_(start), speedup_(speedup) {}
+
+  // Sleeps until `time` (relative to the start of the trace) is due and
+  // returns how late the caller was for it.
+  absl::Duration WaitFor(absl::Duration time) const {
+    if (speedup_ <= 0) return absl::ZeroDuration();
+    const absl::Time due = start_ + time / speedup_;
+    const absl::Time now = absl::Now();
+    if (now < due) {
+      absl::SleepFor(due - now);
+      return absl::ZeroDuration();
+    }
+    return now - due;
+  }
+
+ private:
+  const absl::Time start_;
+  const double speedup_;
+};
+
+// Synthetic chunk of the size and sequence range described by `chunk`. The
+// data is not compressed so the size on the wire matches the traced one.
+ChunkData MakeChunk(const WorkloadTraceChunk& chunk) {
+  const int64_t num_steps =
+      std::max<int64_t>(1, chunk.end() - chunk.start() + 1);
+  const int64_t step_bytes =
+      std::max<int64_t>(1, chunk.num_bytes() / num_steps);
+  tensorflow::Tensor tensor(tensorflow::DT_UINT8,
+                            tensorflow::TensorShape({num_steps, step_bytes}));
+  tensor.flat<uint8_t>().setZero();
+
+  ChunkData data;
+  data.set_chunk_key(chunk.chunk_key());
+  data.mutable_sequence_range()->set_episode_id(chunk.episode_id());
+  data.mutable_sequence_range()->set_start(chunk.start());
+  data.mutable_sequence_range()->set_end(chunk.end());
+  data.set_codec(CODEC_NONE);
+  CompressTensorAsProto(tensor, data.mutable_data()->add_tensors(), CODEC_NONE);
+  return data;
+}
+
+// Inserts the items of the trace over a single `InsertStream`, keeping the
+// chunks on the stream for as long as later items of the trace reference
+// them. The confirmations are read by a background thread.
+class InsertReplayer {
+ public:
+  InsertReplayer(/* grpc_gen:: */ReverbService::StubInterface* stub,
+                 int max_in_flight_items)
+      : max_in_flight_items_(max_in_flight_items),
+        stream_(stub->InsertStream(&context_)) {
+    reader_ = internal::StartThread("TraceReplayConfirmations",
+                                    [this] { ReadConfirmations(); });
+  }
+
+  ~InsertReplayer() { Finish().IgnoreError(); }
+
+  // Sends the chunks which are not yet on the stream and then the item.
+  // `last_uses` holds the index of the last insert which references each
+  // chunk and `index` is the index of this insert.
+  tensorflow::Status Insert(
+      const std::string& table, const WorkloadTraceEvent::Insert& insert,
+      const absl::flat_hash_map<uint64_t, WorkloadTraceChunk>& chunks,
+      const absl::flat_hash_map<uint64_t, int64_t>& last_uses, int64_t index,
+      TraceReplayReport* report) {
+    for (uint64_t key : insert.chunk_keys()) {
+      if (sent_chunks_.contains(key)) continue;
+      InsertStreamRequest request;
+      *request.mutable_chunk() = MakeChunk(chunks.at(key));
+      report->chunks_sent++;
+      report->bytes_sent += request.chunk().ByteSizeLong();
+      if (!stream_->Write(request)) return StreamError();
+      sent_chunks_.insert(key);
+    }
+
+    // Chunks are released by the stream once an item doesn't keep them.
+    InsertStreamRequest request;
+    auto* item = request.mutable_item();
+    for (auto it = sent_chunks_.begin(); it != sent_chunks_.end();) {
+      if (last_uses.at(*it) > index) {
+        item->add_keep_chunk_keys(*it);
+        ++it;
+      } else {
+        sent_chunks_.erase(it++);
+      }
+    }
+    item->set_send_confirmation(true);
+    item->set_batch_confirmations(true);
+    auto* prioritized = item->mutable_item();
+    prioritized->set_key(insert.key());
+    prioritized->set_table(table);
+    prioritized->set_priority(insert.priority());
+    *prioritized->mutable_chunk_keys() = insert.chunk_keys();
+    prioritized->mutable_sequence_range()->set_offset(insert.offset());
+    prioritized->mutable_sequence_range()->set_length(insert.length());
+
+    bool stream_closed;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(this, &InsertReplayer::CanSendItem));
+      stream_closed = reader_done_;
+      if (!stream_closed) in_flight_[insert.key()] = absl::Now();
+    }
+    if (stream_closed || !stream_->Write(request)) return StreamError();
+    report->items_inserted++;
+    return tensorflow::Status::OK();
+  }
+
+  // Waits for the server to confirm all items sent so far.
+  tensorflow::Status WaitForConfirmations() {
+    bool confirmed;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(this, &InsertReplayer::AllConfirmed));
+      confirmed = in_flight_.empty();
+    }
+    return confirmed ? tensorflow::Status::OK() : StreamError();
+  }
+
+  // Closes the stream and returns its status.
+  tensorflow::Status Finish() {
+    if (reader_ == nullptr) return status_;
+    stream_->WritesDone();
+    reader_ = nullptr;
+    status_ = FromGrpcStatus(stream_->Finish());
+    return status_;
+  }
+
+  // Latencies of the confirmed items. Must be called after `Finish`.
+  const internal::LatencyHistogram& latency() const { return latency_; }
+
+ private:
+  bool CanSendItem() const ABSL_SHARED_LOCKS_REQUIRED(mu_) {
+    return in_flight_.size() < max_in_flight_items_ || reader_done_;
+  }
+
+  bool AllConfirmed() const ABSL_SHARED_LOCKS_REQUIRED(mu_) {
+    return in_flight_.empty() || reader_done_;
+  }
+
+  void ReadConfirmations() {
+    InsertStreamResponse response;
+    while (stream_->Read(&response)) {
+      const absl::Time now = absl::Now();
+      absl::MutexLock lock(&mu_);
+      auto confirm = [&](uint64_t key) {
+        auto it = in_flight_.find(key);
+        if (it == in_flight_.end()) return;
+        latency_.Record(now - it->second);
+        in_flight_.erase(it);
+      };
+      if (response.keys().empty()) confirm(response.key());
+      for (uint64_t key : response.keys()) confirm(key);
+    }
+    absl::MutexLock lock(&mu_);
+    reader_done_ = true;
+  }
+
+  tensorflow::Status StreamError() {
+    TF_RETURN_IF_ERROR(Finish());
+    return tensorflow::errors::Unavailable("Insert stream closed early.");
+  }
+
+  const int max_in_flight_items_;
+  grpc::ClientContext context_;
+  std::unique_ptr<grpc::ClientReaderWriterInterface<InsertStreamRequest,
+                                                    InsertStreamResponse>>
+      stream_;
+  std::unique_ptr<internal::Thread> reader_;
+  tensorflow::Status status_;
+
+  // Chunks which the stream holds. Only accessed by the caller.
+  absl::flat_hash_set<uint64_t> sent_chunks_;
+
+  mutable absl::Mutex mu_;
+  // Send time of the items which have not been confirmed yet. Items which
+  // are sent again before they are confirmed are only measured once.
+  absl::flat_hash_map<uint64_t, absl::Time> in_flight_ ABSL_GUARDED_BY(mu_);
+  bool reader_done_ ABSL_GUARDED_BY(mu_) = false;
+  internal::LatencyHistogram latency_ ABSL_GUARDED_BY(mu_);
+};
+
+// Takes the samples of `events`, which all belong to the same table, on
+// schedule.
+void ReplaySamples(const std::vector<ScheduledEvent>& events,
+                   const Clock& clock, Sampler* sampler,
+                   TraceReplayReport* report) {
+  std::vector<tensorflow::Tensor> data;
+  for (const auto& scheduled : events) {
+    report->max_lag = std::max(report->max_lag, clock.WaitFor(scheduled.time));
+    const auto& sample = scheduled.event->sample();
+    report->samples_requested += sample.batch_size();
+    for (int i = 0; i < sample.num_samples(); i++) {
+      const absl::Time start = absl::Now();
+      // Samples which are still blocked by the rate limiter when the replay
+      // ends are cancelled by `Close`.
+      if (!sampler->GetNextSample(&data).ok()) return;
+      report->sample_latency.Record(absl::Now() - start);
+      report->samples_received++;
+    }
+  }
+}
+
+}  // namespace
+
+tensorflow::Status TraceReplayOptions::Validate() const {
+  if (server_address.empty()) {
+    return tensorflow::errors::InvalidArgument("server_address must be set.");
+  }
+  if (trace_path.empty()) {
+    return tensorflow::errors::InvalidArgument("trace_path must be set.");
+  }
+  if (max_in_flight_items <= 0) {
+    return tensorflow::errors::InvalidArgument(
+        "max_in_flight_items must be positive but got ", max_in_flight_items);
+  }
+  if (drain_timeout < absl::ZeroDuration()) {
+    return tensorflow::errors::InvalidArgument(
+        "drain_timeout must be non-negative but got ",
+        absl::FormatDuration(drain_timeout));
+  }
+  return tensorflow::Status::OK();
+}
+
+std::string TraceReplayReport::ToString() const {
+  const double seconds = std::max(absl::ToDoubleSeconds(elapsed), 1e-9);
+  return absl::StrCat(
+      absl::StrFormat("elapsed: %s (trace: %s, %d dropped events)\n",
+                      absl::FormatDuration(elapsed),
+                      absl::FormatDuration(trace_duration),
+                      trace_dropped_events),
+      absl::StrFormat("max lag: %s\n", absl::FormatDuration(max_lag)),
+      absl::StrFormat(
+          "inserts: %d items (%.1f/s), %d skipped, %d chunks, %.2f MB/s\n",
+          items_inserted, items_inserted / seconds, items_skipped,
+          chunks_sent, bytes_sent / seconds / 1e6),
+      "  insert latency: ", LatencySummary(insert_latency), "\n",
+      absl::StrFormat("samples: %d of %d requested (%.1f/s)\n",
+                      samples_received, samples_requested,
+                      samples_received / seconds),
+      "  sample latency: ", LatencySummary(sample_latency), "\n",
+      absl::StrFormat("mutations: %d, resets: %d\n", mutations, resets),
+      "  mutate latency: ", LatencySummary(mutate_latency), "\n");
+}
+
+tensorflow::Status ReplayWorkloadTrace(const TraceReplayOptions& options,
+                                       TraceReplayReport* report) {
+  TF_RETURN_IF_ERROR(options.Validate());
+  std::vector<WorkloadTraceBlock> blocks;
+  TF_RETURN_IF_ERROR(internal::ReadWorkloadTrace(options.trace_path, &blocks));
+
+  // The samples are replayed per table, everything else in order.
+  std::vector<ScheduledEvent> events;
+  absl::flat_hash_map<std::string, std::vector<ScheduledEvent>>
+      samples_by_table;
+  const int64_t start_ns = blocks.empty() ? 0 : blocks[0].start_time_ns();
+  for (const auto& block : blocks) {
+    report->trace_dropped_events += block.num_dropped_events();
+    int64_t time_ns = block.start_time_ns() - start_ns;
+    for (const auto& event : block.events()) {
+      time_ns += event.time_delta_ns();
+      if (event.table() < 0 || event.table() >= block.tables_size()) {
+        return tensorflow::errors::DataLoss("Event of trace ",
+                                            options.trace_path,
+                                            " references an unknown table.");
+      }
+      ScheduledEvent scheduled{absl::Nanoseconds(time_ns),
+                               &block.tables(event.table()), &event};
+      report->trace_duration = scheduled.time;
+      if (event.has_sample()) {
+        samples_by_table[*scheduled.table].push_back(scheduled);
+      } else {
+        events.push_back(scheduled);
+      }
+    }
+  }
+
+  // Index of the last insert which references each chunk.
+  absl::flat_hash_map<uint64_t, int64_t> last_uses;
+  for (int64_t i = 0; i < events.size(); i++) {
+    for (uint64_t key : events[i].event->insert().chunk_keys()) {
+      last_uses[key] = i;
+    }
+  }
+
+  Client client(options.server_address);
+  Sampler::Options sampler_options;
+  sampler_options.num_workers = 1;
+  sampler_options.max_in_flight_samples_per_worker = 1;
+  std::vector<std::vector<ScheduledEvent>> samples;
+  std::vector<std::unique_ptr<Sampler>> samplers;
+  for (auto& entry : samples_by_table) {
+    samples.push_back(std::move(entry.second));
+    samplers.emplace_back();
+    TF_RETURN_IF_ERROR(client.NewSampler(entry.first, sampler_options,
+                                         kValidationTimeout, &samplers.back()));
+  }
+
+  grpc::ChannelArguments arguments;
+  arguments.SetMaxReceiveMessageSize(-1);  // Unlimited.
+  arguments.SetMaxSendMessageSize(-1);     // Unlimited.
+  auto stub = /* grpc_gen:: */ReverbService::NewStub(CreateCustomGrpcChannel(
+      options.server_address, MakeChannelCredentials(), arguments));
+  InsertReplayer inserts(stub.get(), options.max_in_flight_items);
+
+  const absl::Time start = absl::Now();
+  const Clock clock(start, options.speedup);
+
+  absl::Mutex samplers_mu;
+  int num_running_samplers = samplers.size();
+  std::vector<TraceReplayReport> sampler_reports(samplers.size());
+  std::vector<std::unique_ptr<internal::Thread>> sampler_threads;
+  for (int i = 0; i < samplers.size(); i++) {
+    sampler_threads.push_back(internal::StartThread(
+        "TraceReplaySampler", [&, i] {
+          ReplaySamples(samples[i], clock, samplers[i].get(),
+                        &sampler_reports[i]);
+          absl::MutexLock lock(&samplers_mu);
+          num_running_samplers--;
+        }));
+  }
+
+  // Chunks described by the trace so far.
+  absl::flat_hash_map<uint64_t, WorkloadTraceChunk> chunks;
+  tensorflow::Status status;
+  for (int64_t i = 0; i < events.size() && status.ok(); i++) {
+    const ScheduledEvent& scheduled = events[i];
+    report->max_lag = std::max(report->max_lag, clock.WaitFor(scheduled.time));
+    const WorkloadTraceEvent& event = *scheduled.event;
+    if (event.has_insert()) {
+      const auto& insert = event.insert();
+      for (const auto& chunk : insert.new_chunks()) {
+        chunks[chunk.chunk_key()] = chunk;
+      }
+      if (!std::all_of(insert.chunk_keys().begin(), insert.chunk_keys().end(),
+                       [&chunks](uint64_t key) {
+                         return chunks.contains(key);
+                       })) {
+        report->items_skipped++;
+        continue;
+      }
+      status = inserts.Insert(*scheduled.table, insert, chunks, last_uses, i,
+                              report);
+    } else if (event.has_mutate()) {
+      // Mutations and resets must see the items inserted before them.
+      status = inserts.WaitForConfirmations();
+      if (!status.ok()) break;
+      const auto& mutate = event.mutate();
+      std::vector<KeyWithPriority> updates(mutate.update_keys_size());
+      for (int j = 0; j < updates.size(); j++) {
+        updates[j].set_key(mutate.update_keys(j));
+        updates[j].set_priority(j < mutate.update_priorities_size()
+                                    ? mutate.update_priorities(j)
+                                    : 0);
+      }
+      const std::vector<uint64_t> deletes(mutate.delete_keys().begin(),
+                                          mutate.delete_keys().end());
+      const absl::Time mutate_start = absl::Now();
+      status = client.MutatePriorities(*scheduled.table, updates, deletes);
+      report->mutate_latency.Record(absl::Now() - mutate_start);
+      report->mutations++;
+    } else if (event.has_reset()) {
+      status = inserts.WaitForConfirmations();
+      if (!status.ok()) break;
+      status = client.Reset(*scheduled.table);
+      report->resets++;
+    }
+  }
+  if (status.ok()) status = inserts.WaitForConfirmations();
+  tensorflow::Status finish_status = inserts.Finish();
+  if (status.ok()) status = finish_status;
+
+  {
+    absl::MutexLock lock(&samplers_mu);
+    samplers_mu.AwaitWithTimeout(
+        absl::Condition(
+            +[](int* n) { return *n == 0; }, &num_running_samplers),
+        options.drain_timeout);
+  }
+  for (auto& sampler : samplers) {
+    sampler->Close();
+  }
+  sampler_threads.clear();
+  report->elapsed = absl::Now() - start;
+
+  report->insert_latency.Merge(inserts.latency());
+  for (const auto& sampler_report : sampler_reports) {
+    report->samples_requested += sampler_report.samples_requested;
+    report->samples_received += sampler_report.samples_received;
+    report->sample_latency.Merge(sampler_report.sample_latency);
+    report->max_lag = std::max(report->max_lag, sampler_report.max_lag);
+  }
+  return status;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
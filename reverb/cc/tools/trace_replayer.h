@@ -0,0 +1,107 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_TOOLS_TRACE_REPLAYER_H_
+#define REVERB_CC_TOOLS_TRACE_REPLAYER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/time/time.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Configuration of the replay of a workload trace (see
+// `ServerOptions::workload_trace_path`) by `ReplayWorkloadTrace`.
+struct TraceReplayOptions {
+  // Address of the server (e.g "localhost:8000") which the trace is replayed
+  // against. It must have tables with the names of the traced tables, which
+  // should be configured like the traced ones.
+  std::string server_address;
+
+  // Path of the trace file.
+  std::string trace_path;
+
+  // The events are replayed `speedup` times faster than they were recorded.
+  // If <= 0 then every event is replayed as soon as the previous ones have
+  // been, i.e as fast as the server allows.
+  double speedup = 1;
+
+  // Maximum number of inserted items which the server has not yet confirmed.
+  int max_in_flight_items = 1000;
+
+  // How long the samples which are still pending after the last event are
+  // waited for before the samplers are closed.
+  absl::Duration drain_timeout = absl::Seconds(10);
+
+  // Returns InvalidArgument if any of the options is out of range.
+  tensorflow::Status Validate() const;
+};
+
+// Throughput and latencies measured by `ReplayWorkloadTrace`.
+struct TraceReplayReport {
+  absl::Duration elapsed;
+
+  // Duration of the trace, i.e from its first to its last event, and the
+  // number of events which were lost when it was recorded.
+  absl::Duration trace_duration;
+  int64_t trace_dropped_events = 0;
+
+  int64_t items_inserted = 0;
+  int64_t chunks_sent = 0;
+  int64_t bytes_sent = 0;
+
+  // Inserts which couldn't be replayed because a chunk they reference was
+  // described by an event which was dropped from the trace.
+  int64_t items_skipped = 0;
+
+  int64_t samples_requested = 0;
+  int64_t samples_received = 0;
+  int64_t mutations = 0;
+  int64_t resets = 0;
+
+  // How far the replay fell behind the schedule of the trace (scaled by
+  // `speedup`) at worst. Always 0 if the replay isn't paced.
+  absl::Duration max_lag;
+
+  // Time from sending an item until the server confirmed it.
+  internal::LatencyHistogram insert_latency;
+
+  // Time spent in each `GetNextSample` call.
+  internal::LatencyHistogram sample_latency;
+
+  // Time spent in each `MutatePriorities` call.
+  internal::LatencyHistogram mutate_latency;
+
+  // Human readable summary with rates and latency percentiles.
+  std::string ToString() const;
+};
+
+// Replays the trace described by `options` and writes the measurements to
+// `report`. The items are inserted with the keys, priorities and chunk
+// structure of the trace but with synthetic data of the recorded size, so
+// mutations, deletes and shared chunks behave as they did on the traced
+// server. Inserts, mutations and resets are replayed in order on a single
+// stream while the samples of each table are taken on a sampler of their own.
+// Returns the first error encountered.
+tensorflow::Status ReplayWorkloadTrace(const TraceReplayOptions& options,
+                                       TraceReplayReport* report);
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_TOOLS_TRACE_REPLAYER_H_
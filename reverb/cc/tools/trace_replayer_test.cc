@@ -0,0 +1,182 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/tools/trace_replayer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/net.h"
+#include "reverb/cc/platform/server.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/workload_trace.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "reverb/cc/tools/load_generator.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/protobuf/error_codes.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+std::string MakePath() {
+  std::string name;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(&name));
+  return name;
+}
+
+std::shared_ptr<Table> MakeTable() {
+  return std::make_shared<Table>(
+      "table", std::make_shared<UniformSelector>(),
+      std::make_shared<FifoSelector>(), /*max_size=*/1000,
+      /*max_times_sampled=*/0,
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-DBL_MAX,
+                                    /*max_diff=*/DBL_MAX));
+}
+
+class TraceReplayerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    port_ = internal::PickUnusedPortOrDie();
+    table_ = MakeTable();
+    TF_ASSERT_OK(
+        StartServer({table_}, port_, /*checkpointer=*/nullptr, &server_));
+  }
+
+  void TearDown() override { server_->Stop(); }
+
+  TraceReplayOptions MakeOptions(const std::string& trace_path) const {
+    TraceReplayOptions options;
+    options.server_address = absl::StrCat("localhost:", port_);
+    options.trace_path = trace_path;
+    options.speedup = 0;
+    options.drain_timeout = absl::Seconds(5);
+    return options;
+  }
+
+  int port_;
+  std::shared_ptr<Table> table_;
+  std::unique_ptr<Server> server_;
+};
+
+TEST_F(TraceReplayerTest, ReplaysTraceOfLoadGenerator) {
+  // Record the workload of the load generator on a traced server.
+  const std::string trace_path = MakePath();
+  {
+    const int port = internal::PickUnusedPortOrDie();
+    ServerOptions server_options;
+    server_options.workload_trace_path = trace_path;
+    std::unique_ptr<Server> server;
+    TF_ASSERT_OK(StartServer({MakeTable()}, port, /*checkpointer=*/nullptr,
+                             server_options, &server));
+
+    LoadGeneratorOptions options;
+    options.server_address = absl::StrCat("localhost:", port);
+    options.table = "table";
+    options.duration = absl::Milliseconds(300);
+    options.step_bytes = 64;
+    options.chunk_length = 2;
+    options.sequence_length = 3;
+    LoadGeneratorReport report;
+    TF_ASSERT_OK(RunLoadGenerator(options, &report));
+    ASSERT_GT(report.items_written, 0);
+
+    // Stopping the server completes the trace.
+    server->Stop();
+  }
+
+  TraceReplayReport report;
+  TF_ASSERT_OK(ReplayWorkloadTrace(MakeOptions(trace_path), &report));
+  EXPECT_GT(report.items_inserted, 0);
+  EXPECT_EQ(report.items_skipped, 0);
+  EXPECT_GT(report.chunks_sent, 0);
+  EXPECT_EQ(report.insert_latency.count(), report.items_inserted);
+  EXPECT_GT(report.samples_received, 0);
+  EXPECT_EQ(report.sample_latency.count(), report.samples_received);
+  EXPECT_EQ(report.max_lag, absl::ZeroDuration());
+  EXPECT_EQ(table_->size(), std::min<int64_t>(report.items_inserted, 1000));
+  EXPECT_THAT(report.ToString(), ::testing::HasSubstr("insert latency: "));
+}
+
+TEST_F(TraceReplayerTest, ReplaysMutationsAndResets) {
+  const std::string trace_path = MakePath();
+  {
+    std::unique_ptr<internal::WorkloadTraceWriter> writer;
+    TF_ASSERT_OK(internal::WorkloadTraceWriter::Create(trace_path, &writer));
+    std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks = {
+        std::make_shared<ChunkStore::Chunk>(testing::MakeChunkData(
+            10, testing::MakeSequenceRange(1, 0, 1))),
+    };
+    for (uint64_t key : {1, 2, 3}) {
+      PrioritizedItem item = testing::MakePrioritizedItem(
+          key, 1, {testing::MakeChunkData(10)});
+      item.mutable_sequence_range()->set_offset(0);
+      item.mutable_sequence_range()->set_length(2);
+      writer->RecordInsert("table", item, chunks);
+    }
+    writer->RecordMutate("table", {testing::MakeKeyWithPriority(1, 5)}, {2});
+    TF_ASSERT_OK(writer->Close());
+  }
+
+  TraceReplayReport report;
+  TF_ASSERT_OK(ReplayWorkloadTrace(MakeOptions(trace_path), &report));
+  EXPECT_EQ(report.items_inserted, 3);
+  EXPECT_EQ(report.chunks_sent, 1);
+  EXPECT_EQ(report.mutations, 1);
+
+  std::vector<Table::Item> items = table_->Copy();
+  ASSERT_EQ(items.size(), 2);
+  std::sort(items.begin(), items.end(),
+            [](const Table::Item& a, const Table::Item& b) {
+              return a.item.key() < b.item.key();
+            });
+  EXPECT_EQ(items[0].item.key(), 1);
+  EXPECT_EQ(items[0].item.priority(), 5);
+  EXPECT_EQ(items[1].item.key(), 3);
+}
+
+TEST(TraceReplayOptionsTest, Validate) {
+  TraceReplayOptions options;
+  options.server_address = "localhost:1234";
+  options.trace_path = "/tmp/trace";
+  TF_EXPECT_OK(options.Validate());
+
+  TraceReplayOptions no_trace = options;
+  no_trace.trace_path = "";
+  EXPECT_EQ(no_trace.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
+
+  TraceReplayOptions no_items = options;
+  no_items.max_in_flight_items = 0;
+  EXPECT_EQ(no_items.Validate().code(), tensorflow::error::INVALID_ARGUMENT);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -15,6 +15,7 @@
 #include "reverb/cc/writer.h"
 
 #include <algorithm>
+#include <cstring>
 #include <iterator>
 #include <string>
 #include <utility>
@@ -23,7 +24,9 @@
 #include "absl/base/thread_annotations.h"
 #include "absl/flags/flag.h"
 #include "absl/functional/bind_front.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/synchronization/mutex.h"
 #include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/platform/logging.h"
@@ -31,10 +34,12 @@
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/queue.h"
+#include "reverb/cc/support/shared_memory.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/thread_pool.h"
 #include "reverb/cc/tensor_compression.h"
 #include "tensorflow/core/framework/tensor.h"
-#include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/errors.h"
 
@@ -42,6 +47,15 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
+// Maximum number of items a local writer queues for insertion. Like when the
+// gRPC stream is flow controlled, writers block once it has been reached.
+constexpr int kLocalInsertQueueSize = 1024;
+
+// Chunks smaller than this are compressed on the calling thread even if the
+// writer has a compression pool, as scheduling the columns would cost more
+// than compressing them.
+constexpr int64_t kMinParallelCompressionBytes = 64 * 1024;
+
 int PositiveModulo(int value, int divisor) {
   if (divisor == 0) return value;
 
@@ -54,59 +68,152 @@ int PositiveModulo(int value, int divisor) {
   }
 }
 
+// Number of timesteps in `chunk`. Chunks hold at most `chunk_length_`
+// timesteps but may be shorter, e.g when cut by `max_chunk_bytes_` or `Flush`.
+int64_t NumTimesteps(const ChunkData& chunk) {
+  return chunk.sequence_range().end() - chunk.sequence_range().start() + 1;
+}
+
+// Returns the shape of a single timestep of `tensor`, which holds one
+// timestep, or a batch of timesteps if `batched`.
+tensorflow::TensorShape TimestepShape(const tensorflow::Tensor& tensor,
+                                      bool batched) {
+  tensorflow::TensorShape shape = tensor.shape();
+  if (batched) shape.RemoveDim(0);
+  return shape;
+}
+
+// Number of bytes of a single timestep of `tensor`. See `TimestepShape`.
+int64_t TimestepBytes(const tensorflow::Tensor& tensor, bool batched) {
+  if (!batched) return tensor.TotalBytes();
+  return tensor.dim_size(0) == 0 ? 0 : tensor.TotalBytes() / tensor.dim_size(0);
+}
+
+// Copies the rows [`begin`, `end`) of `src` into `dst` starting at row
+// `dst_row`. The tensors must have the same dtype and shape, except for the
+// first dimension.
+void CopyRowsInto(const tensorflow::Tensor& src, int64_t begin, int64_t end,
+                  int64_t dst_row, tensorflow::Tensor* dst) {
+  if (begin == end || src.NumElements() == 0) return;
+  if (src.dtype() == tensorflow::DT_STRING) {
+    auto from = src.flat_outer_dims<tensorflow::tstring>();
+    auto to = dst->flat_outer_dims<tensorflow::tstring>();
+    for (int64_t i = begin; i < end; i++) {
+      for (int64_t j = 0; j < from.dimension(1); j++) {
+        to(dst_row + i - begin, j) = from(i, j);
+      }
+    }
+    return;
+  }
+  const int64_t row_bytes = src.TotalBytes() / src.dim_size(0);
+  std::memcpy(
+      const_cast<char*>(dst->tensor_data().data()) + dst_row * row_bytes,
+      src.tensor_data().data() + begin * row_bytes, (end - begin) * row_bytes);
+}
+
 }  // namespace
 
 Writer::Writer(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
                int chunk_length, int max_timesteps, bool delta_encoded,
-               std::shared_ptr<internal::FlatSignatureMap> signatures,
-               absl::optional<int> max_in_flight_items)
+               std::shared_ptr<internal::SignatureValidatorMap> signatures,
+               absl::optional<int> max_in_flight_items, CompressionCodec codec,
+               int block_length, bool shared_memory,
+               int64_t max_pending_bytes,
+               std::shared_ptr<internal::ThreadPool> compression_pool,
+               int64_t max_chunk_bytes)
     : stub_(std::move(stub)),
       chunk_length_(chunk_length),
+      max_chunk_bytes_(max_chunk_bytes),
       max_timesteps_(max_timesteps),
       delta_encoded_(delta_encoded),
+      codec_(codec),
+      block_length_(block_length),
+      shared_memory_(shared_memory),
       max_in_flight_items_(std::move(max_in_flight_items)),
       num_items_in_flight_(0),
+      max_pending_bytes_(max_pending_bytes),
+      compression_pool_(std::move(compression_pool)),
       signatures_(std::move(signatures)),
       next_chunk_key_(NewID()),
       episode_id_(NewID()),
       index_within_episode_(0),
       closed_(false),
-      inserted_dtypes_and_shapes_(max_timesteps) {}
+      inserted_dtypes_and_shapes_(max_timesteps) {
+  if (max_pending_bytes_ > 0) {
+    async_worker_thread_ = internal::StartThread(
+        "WriterAsyncWorker", absl::bind_front(&Writer::AsyncWorker, this));
+  }
+}
+
+Writer::Writer(std::shared_ptr<ChunkStore> chunk_store, LocalTableLookup tables,
+               int chunk_length, int max_timesteps, bool delta_encoded,
+               std::shared_ptr<internal::SignatureValidatorMap> signatures,
+               absl::optional<int> max_in_flight_items, CompressionCodec codec,
+               int block_length, int64_t max_pending_bytes,
+               std::shared_ptr<internal::ThreadPool> compression_pool,
+               int64_t max_chunk_bytes)
+    : Writer(/*stub=*/nullptr, chunk_length, max_timesteps, delta_encoded,
+             std::move(signatures), std::move(max_in_flight_items), codec,
+             block_length, /*shared_memory=*/false, max_pending_bytes,
+             std::move(compression_pool), max_chunk_bytes) {
+  chunk_store_ = std::move(chunk_store);
+  local_table_lookup_ = std::move(tables);
+}
 
 Writer::~Writer() {
   if (!closed_) Close().IgnoreError();
+  StopAsyncWorker();
 }
 
 tensorflow::Status Writer::Append(std::vector<tensorflow::Tensor> data) {
+  if (max_pending_bytes_ == 0) return AppendInternal(std::move(data));
   if (closed_) {
     return tensorflow::errors::FailedPrecondition(
         "Calling method Append after Close has been called");
   }
-  if (!buffer_.empty() && buffer_.front().size() != data.size()) {
-    return tensorflow::errors::InvalidArgument(
-        "Number of tensors per timestep was inconsistent. Previously it was ",
-        buffer_.front().size(), ", but is now ", data.size(), ".");
+  int64_t num_bytes = 0;
+  for (const auto& tensor : data) num_bytes += tensor.TotalBytes();
+  return EnqueueAsync(
+      [this, data = std::move(data)]() mutable {
+        return AppendInternal(std::move(data));
+      },
+      num_bytes);
+}
+
+tensorflow::Status Writer::AppendInternal(
+    std::vector<tensorflow::Tensor> data) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method Append after Close has been called");
   }
+  TF_RETURN_IF_ERROR(PrepareBuffer(data, /*batched=*/false));
 
   // Store flattened signature into inserted_dtypes_and_shapes_
-  internal::DtypesAndShapes dtypes_and_shapes_t(0);
-  dtypes_and_shapes_t->reserve(data.size());
-  for (const auto& t : data) {
-    dtypes_and_shapes_t->push_back(
-        {/*name=*/"", t.dtype(), tensorflow::PartialTensorShape(t.shape())});
-  }
+  auto dtypes_and_shapes_t = TimestepSpecs(data, /*batched=*/false);
   std::swap(dtypes_and_shapes_t,
             inserted_dtypes_and_shapes_[insert_dtypes_and_shapes_location_]);
   insert_dtypes_and_shapes_location_ =
       (insert_dtypes_and_shapes_location_ + 1) % max_timesteps_;
 
-  buffer_.push_back(std::move(data));
-  if (buffer_.size() < chunk_length_) return tensorflow::Status::OK();
+  int64_t num_bytes = 0;
+  for (int i = 0; i < data.size(); i++) {
+    // View the timestep as a batch of one.
+    tensorflow::Tensor row;
+    tensorflow::TensorShape shape = data[i].shape();
+    shape.InsertDim(0, 1);
+    REVERB_CHECK(row.CopyFrom(data[i], shape));
+    CopyRowsInto(row, 0, 1, buffer_size_, &buffer_[i]);
+    num_bytes += data[i].TotalBytes();
+  }
+  buffer_size_++;
+  buffer_bytes_ += num_bytes;
+  if (!BufferIsFull()) return tensorflow::Status::OK();
 
   auto status = Finish(/*retry_on_unavailable=*/true);
   if (!status.ok()) {
     // Undo adding stuff to the buffer and undo the dtypes_and_shapes_ changes.
-    buffer_.pop_back();
+    buffer_size_--;
+    buffer_bytes_ -= num_bytes;
     insert_dtypes_and_shapes_location_ =
         PositiveModulo(insert_dtypes_and_shapes_location_ - 1, max_timesteps_);
     std::swap(dtypes_and_shapes_t,
@@ -133,25 +240,189 @@ tensorflow::Status Writer::AppendSequence(
     }
   }
 
-  for (int i = 0; i < sequence[0].dim_size(0); i++) {
-    std::vector<tensorflow::Tensor> step;
-    step.reserve(sequence.size());
-    for (const auto& column : sequence) {
-      step.push_back(column.SubSlice(i));
+  if (max_pending_bytes_ == 0) {
+    return AppendSequenceInternal(std::move(sequence));
+  }
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method AppendSequence after Close has been called");
+  }
+  int64_t num_bytes = 0;
+  for (const auto& tensor : sequence) num_bytes += tensor.TotalBytes();
+  return EnqueueAsync(
+      [this, sequence = std::move(sequence)]() mutable {
+        return AppendSequenceInternal(std::move(sequence));
+      },
+      num_bytes);
+}
+
+tensorflow::Status Writer::AppendSequenceInternal(
+    std::vector<tensorflow::Tensor> sequence) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method AppendSequence after Close has been called");
+  }
+  const int64_t num_steps = sequence[0].dim_size(0);
+
+  // The rows of string tensors differ in size so chunks could be cut at
+  // different timesteps than by `Append`. Such sequences are appended one
+  // timestep at a time instead.
+  if (std::any_of(sequence.begin(), sequence.end(), [](const auto& tensor) {
+        return tensor.dtype() == tensorflow::DT_STRING;
+      })) {
+    for (int i = 0; i < num_steps; i++) {
+      std::vector<tensorflow::Tensor> step;
+      step.reserve(sequence.size());
+      for (const auto& column : sequence) {
+        step.push_back(column.SubSlice(i));
+      }
+      TF_RETURN_IF_ERROR(AppendInternal(std::move(step)));
+    }
+    return tensorflow::Status::OK();
+  }
+
+  int64_t step_bytes = 0;
+  for (const auto& tensor : sequence) {
+    step_bytes += TimestepBytes(tensor, /*batched=*/true);
+  }
+  const auto dtypes_and_shapes_t = TimestepSpecs(sequence, /*batched=*/true);
+
+  // The timesteps are copied in bulk up to the end of the current chunk,
+  // which is then finished just like by `Append`.
+  for (int64_t begin = 0; begin < num_steps;) {
+    TF_RETURN_IF_ERROR(PrepareBuffer(sequence, /*batched=*/true));
+    int64_t end =
+        std::min<int64_t>(num_steps, begin + buffer_capacity_ - buffer_size_);
+    if (max_chunk_bytes_ > 0 && step_bytes > 0) {
+      const int64_t rows_left =
+          (max_chunk_bytes_ - buffer_bytes_ + step_bytes - 1) / step_bytes;
+      end = std::min(end, begin + std::max<int64_t>(rows_left, 1));
+    }
+
+    std::shared_ptr<const std::vector<internal::TensorSpec>> replaced;
+    for (int64_t t = begin; t < end; t++) {
+      replaced = dtypes_and_shapes_t;
+      std::swap(replaced, inserted_dtypes_and_shapes_
+                              [insert_dtypes_and_shapes_location_]);
+      insert_dtypes_and_shapes_location_ =
+          (insert_dtypes_and_shapes_location_ + 1) % max_timesteps_;
+    }
+    for (int i = 0; i < sequence.size(); i++) {
+      CopyRowsInto(sequence[i], begin, end, buffer_size_, &buffer_[i]);
+    }
+    buffer_size_ += end - begin;
+    buffer_bytes_ += (end - begin) * step_bytes;
+    begin = end;
+    if (!BufferIsFull()) continue;
+
+    auto status = Finish(/*retry_on_unavailable=*/true);
+    if (!status.ok()) {
+      // Like `Append`, only the timestep which completed the chunk is undone.
+      buffer_size_--;
+      buffer_bytes_ -= step_bytes;
+      insert_dtypes_and_shapes_location_ = PositiveModulo(
+          insert_dtypes_and_shapes_location_ - 1, max_timesteps_);
+      std::swap(replaced, inserted_dtypes_and_shapes_
+                              [insert_dtypes_and_shapes_location_]);
+      return status;
     }
-    TF_RETURN_IF_ERROR(Append(std::move(step)));
   }
 
   return tensorflow::Status::OK();
 }
 
+tensorflow::Status Writer::PrepareBuffer(
+    const std::vector<tensorflow::Tensor>& data, bool batched) {
+  if (buffer_size_ > 0) {
+    if (buffer_.size() != data.size()) {
+      return tensorflow::errors::InvalidArgument(
+          "Number of tensors per timestep was inconsistent. Previously it "
+          "was ",
+          buffer_.size(), ", but is now ", data.size(), ".");
+    }
+    for (int i = 0; i < data.size(); i++) {
+      tensorflow::TensorShape buffered = buffer_[i].shape();
+      buffered.RemoveDim(0);
+      const tensorflow::TensorShape shape = TimestepShape(data[i], batched);
+      if (data[i].dtype() != buffer_[i].dtype() || shape != buffered) {
+        return tensorflow::errors::InvalidArgument(
+            "Timesteps of the same chunk must have identical dtypes and "
+            "shapes, but tensor ", i, " of the buffered timesteps has dtype ",
+            tensorflow::DataTypeString(buffer_[i].dtype()), " and shape ",
+            buffered.DebugString(), " while it has dtype ",
+            tensorflow::DataTypeString(data[i].dtype()), " and shape ",
+            shape.DebugString(), " in the new timestep.");
+      }
+    }
+    return tensorflow::Status::OK();
+  }
+
+  // Room is made for as many timesteps as the chunk can hold. The tensors of
+  // the previous chunk are reused if the dtypes and shapes haven't changed.
+  int64_t step_bytes = 0;
+  for (const auto& tensor : data) step_bytes += TimestepBytes(tensor, batched);
+  buffer_capacity_ = chunk_length_;
+  if (max_chunk_bytes_ > 0 && step_bytes > 0) {
+    buffer_capacity_ = std::min<int64_t>(
+        buffer_capacity_, (max_chunk_bytes_ + step_bytes - 1) / step_bytes);
+  }
+  buffer_.resize(data.size());
+  for (int i = 0; i < data.size(); i++) {
+    tensorflow::TensorShape shape = TimestepShape(data[i], batched);
+    shape.InsertDim(0, buffer_capacity_);
+    if (buffer_[i].dtype() != data[i].dtype() || buffer_[i].shape() != shape ||
+        !buffer_[i].RefCountIsOne()) {
+      buffer_[i] = tensorflow::Tensor(data[i].dtype(), shape);
+    }
+  }
+  return tensorflow::Status::OK();
+}
+
+bool Writer::BufferIsFull() const {
+  return buffer_size_ >= buffer_capacity_ ||
+         (max_chunk_bytes_ > 0 && buffer_bytes_ >= max_chunk_bytes_);
+}
+
 tensorflow::Status Writer::CreateItem(const std::string& table,
                                       int num_timesteps, double priority) {
+  return CreateItem(table, num_timesteps, priority, /*columns=*/{});
+}
+
+tensorflow::Status Writer::CreateItem(const std::string& table,
+                                      int num_timesteps, double priority,
+                                      const std::vector<int>& columns) {
+  if (max_pending_bytes_ == 0) {
+    return CreateItemInternal(table, num_timesteps, priority, columns);
+  }
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method CreateItem after Close has been called");
+  }
+  return EnqueueAsync(
+      [this, table, num_timesteps, priority, columns] {
+        return CreateItemInternal(table, num_timesteps, priority, columns);
+      },
+      /*num_bytes=*/0);
+}
+
+tensorflow::Status Writer::CreateItemInternal(const std::string& table,
+                                              int num_timesteps,
+                                              double priority,
+                                              const std::vector<int>& columns) {
   if (closed_) {
     return tensorflow::errors::FailedPrecondition(
         "Calling method CreateItem after Close has been called");
   }
-  if (num_timesteps > chunks_.size() * chunk_length_ + buffer_.size()) {
+  if (derive_items_on_server_) {
+    return tensorflow::errors::FailedPrecondition(
+        "CreateItem can't be called once the items are derived by the "
+        "server.");
+  }
+  int64_t num_buffered_timesteps = buffer_size_;
+  for (const ChunkData& chunk : chunks_) {
+    num_buffered_timesteps += NumTimesteps(chunk);
+  }
+  if (num_timesteps > num_buffered_timesteps) {
     return tensorflow::errors::InvalidArgument(
         "Argument `num_timesteps` is larger than number of buffered "
         "timesteps.");
@@ -161,10 +432,43 @@ tensorflow::Status Writer::CreateItem(const std::string& table,
         "`num_timesteps` must be <= `max_timesteps`");
   }
 
-  const internal::DtypesAndShapes* dtypes_and_shapes = nullptr;
-  TF_RETURN_IF_ERROR(GetFlatSignature(table, &dtypes_and_shapes));
-  CHECK(dtypes_and_shapes != nullptr);
-  if (dtypes_and_shapes->has_value()) {
+  absl::flat_hash_set<int> seen_columns;
+  for (int column : columns) {
+    if (column < 0) {
+      return tensorflow::errors::InvalidArgument(
+          "Column indices must be non-negative but got ", column);
+    }
+    if (!seen_columns.insert(column).second) {
+      return tensorflow::errors::InvalidArgument(
+          "Column ", column, " was referenced more than once.");
+    }
+  }
+  if (!columns.empty() && num_timesteps > 0) {
+    const auto& latest = inserted_dtypes_and_shapes_[PositiveModulo(
+        insert_dtypes_and_shapes_location_ - 1, max_timesteps_)];
+    const int num_tensors = latest != nullptr ? latest->size() : 0;
+    for (int column : columns) {
+      if (column >= num_tensors) {
+        return tensorflow::errors::InvalidArgument(
+            "Column ", column, " is out of range as timesteps only have ",
+            num_tensors, " tensors.");
+      }
+    }
+  }
+
+  // Maps the i:th tensor of the item to the column of the timesteps.
+  const int num_columns = columns.size();
+  auto column_at = [&columns](int i) {
+    return columns.empty() ? i : columns[i];
+  };
+
+  const internal::SignatureValidator* signature = nullptr;
+  TF_RETURN_IF_ERROR(GetFlatSignature(table, &signature));
+  if (signature != nullptr) {
+    const auto& signature_specs = signature->specs();
+    // Consecutive timesteps usually share the same dtypes and shapes, which
+    // then only have to be checked once.
+    const std::vector<internal::TensorSpec>* checked = nullptr;
     for (int t = 0; t < num_timesteps; ++t) {
       // Subtract 1 from the location since it is currently pointing to the next
       // write.
@@ -172,31 +476,46 @@ tensorflow::Status Writer::CreateItem(const std::string& table,
           insert_dtypes_and_shapes_location_ - 1 - t, max_timesteps_);
       const auto& dtypes_and_shapes_t =
           inserted_dtypes_and_shapes_[check_offset];
-      if (!dtypes_and_shapes_t.has_value()) {
+      if (dtypes_and_shapes_t == nullptr) {
         return tensorflow::errors::Internal(
             "Unexpected missing dtypes and shapes while calling CreateItem: "
             "expected a value at index ",
             check_offset, " (timestep offset ", t, ")");
       }
+      if (dtypes_and_shapes_t.get() == checked) continue;
 
-      if (dtypes_and_shapes_t->size() != (*dtypes_and_shapes)->size()) {
+      const int num_item_tensors =
+          columns.empty() ? dtypes_and_shapes_t->size() : num_columns;
+      if (!columns.empty() && num_columns != signature->num_tensors()) {
+        return tensorflow::errors::InvalidArgument(
+            "Unable to CreateItem to table ", table, " because the item "
+            "references ", num_columns, " columns, but table requires ",
+            signature->num_tensors(), " tensors per entry.  Table "
+            "signature: ", internal::DtypesShapesString(signature_specs));
+      }
+      if (num_item_tensors != signature->num_tensors()) {
         return tensorflow::errors::InvalidArgument(
             "Unable to CreateItem to table ", table,
             " because Append was called with a tensor signature "
             "inconsistent with table signature.  Append for timestep "
             "offset ",
             t, " was called with ", dtypes_and_shapes_t->size(),
-            " tensors, but table requires ", (*dtypes_and_shapes)->size(),
+            " tensors, but table requires ", signature->num_tensors(),
             " tensors per entry.  Table signature: ",
-            internal::DtypesShapesString(**dtypes_and_shapes));
+            internal::DtypesShapesString(signature_specs));
       }
 
-      for (int c = 0; c < dtypes_and_shapes_t->size(); ++c) {
-        const auto& signature_dtype_and_shape = (**dtypes_and_shapes)[c];
+      for (int i = 0; i < num_item_tensors; ++i) {
+        const int c = column_at(i);
+        if (c >= dtypes_and_shapes_t->size()) {
+          return tensorflow::errors::InvalidArgument(
+              "Column ", c, " is out of range as timestep offset ", t,
+              " only has ", dtypes_and_shapes_t->size(), " tensors.");
+        }
         const auto& seen_dtype_and_shape = (*dtypes_and_shapes_t)[c];
-        if (seen_dtype_and_shape.dtype != signature_dtype_and_shape.dtype ||
-            !signature_dtype_and_shape.shape.IsCompatibleWith(
-                seen_dtype_and_shape.shape)) {
+        if (!signature->IsCompatible(i, seen_dtype_and_shape.dtype,
+                                     seen_dtype_and_shape.shape)) {
+          const auto& signature_dtype_and_shape = signature_specs[i];
           return tensorflow::errors::InvalidArgument(
               "Unable to CreateItem to table ", table,
               " because Append was called with a tensor signature "
@@ -210,20 +529,22 @@ tensorflow::Status Writer::CreateItem(const std::string& table,
               " and shape compatible with ",
               signature_dtype_and_shape.shape.DebugString(),
               ".  (Flattened) table signature: ",
-              internal::DtypesShapesString(**dtypes_and_shapes));
+              internal::DtypesShapesString(signature_specs));
         }
       }
+      checked = dtypes_and_shapes_t.get();
     }
   }
 
-  int remaining = num_timesteps - buffer_.size();
-  int num_chunks =
-      remaining / chunk_length_ + (remaining % chunk_length_ ? 1 : 0);
-
-  // Don't use additional chunks if the entire episode is contained in the
-  // current buffer.
-  if (remaining < 0) {
-    num_chunks = 0;
+  // Walk back through the chunks until they cover the timesteps which are not
+  // in the current buffer. The item starts `offset` timesteps into the first
+  // chunk it references.
+  int64_t remaining = num_timesteps - buffer_size_;
+  int num_chunks = 0;
+  int64_t offset = -remaining;
+  for (auto it = chunks_.rbegin(); offset < 0; ++it) {
+    offset += NumTimesteps(*it);
+    num_chunks++;
   }
 
   PrioritizedItem item;
@@ -231,20 +552,20 @@ tensorflow::Status Writer::CreateItem(const std::string& table,
   item.set_table(table.data(), table.size());
   item.set_priority(priority);
   item.mutable_sequence_range()->set_length(num_timesteps);
-  item.mutable_sequence_range()->set_offset(
-      (chunk_length_ - (remaining % chunk_length_)) % chunk_length_);
+  item.mutable_sequence_range()->set_offset(offset);
+  item.mutable_columns()->Add(columns.begin(), columns.end());
 
   for (auto it = std::next(chunks_.begin(), chunks_.size() - num_chunks);
        it != chunks_.end(); it++) {
     item.add_chunk_keys(it->chunk_key());
   }
-  if (!buffer_.empty()) {
+  if (buffer_size_ > 0) {
     item.add_chunk_keys(next_chunk_key_);
   }
 
   pending_items_.push_back(item);
 
-  if (buffer_.empty()) {
+  if (buffer_size_ == 0) {
     auto status = WriteWithRetries(/*retry_on_unavailable=*/true);
     if (!status.ok()) pending_items_.pop_back();
     return status;
@@ -254,6 +575,15 @@ tensorflow::Status Writer::CreateItem(const std::string& table,
 }
 
 tensorflow::Status Writer::Flush() {
+  if (max_pending_bytes_ == 0) return FlushInternal();
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method Flush after Close has been called");
+  }
+  return RunAsync([this] { return FlushInternal(); });
+}
+
+tensorflow::Status Writer::FlushInternal() {
   if (closed_) {
     return tensorflow::errors::FailedPrecondition(
         "Calling method Flush after Close has been called");
@@ -271,16 +601,23 @@ tensorflow::Status Writer::Flush() {
 
 std::string Writer::DebugString() const {
   std::string str = absl::StrCat(
-      "Writer(chunk_length=", chunk_length_, ", max_timesteps=", max_timesteps_,
+      "Writer(chunk_length=", chunk_length_, ", max_chunk_bytes=",
+      max_chunk_bytes_, ", max_timesteps=", max_timesteps_,
       ", delta_encoded=", delta_encoded_, ", max_in_flight_items=");
   if (max_in_flight_items_.has_value()) {
     absl::StrAppend(&str, max_in_flight_items_.value());
   } else {
     absl::StrAppend(&str, "nullopt");
   }
-  absl::StrAppend(&str, ", episode_id=", episode_id_,
-                  ", index_within_episode=", index_within_episode_,
-                  ", closed=", closed_, ")");
+  absl::StrAppend(&str, ", codec=", CompressionCodec_Name(codec_),
+                  ", block_length=", block_length_,
+                  ", max_pending_bytes=", max_pending_bytes_);
+  // The position in the episode is owned by the worker of async writers.
+  if (max_pending_bytes_ == 0) {
+    absl::StrAppend(&str, ", episode_id=", episode_id_,
+                    ", index_within_episode=", index_within_episode_);
+  }
+  absl::StrAppend(&str, ", closed=", closed_, ")");
   return str;
 }
 
@@ -332,6 +669,19 @@ void Writer::StartItemConfirmationWorker() {
 }
 
 tensorflow::Status Writer::Close(bool retry_on_unavailable) {
+  if (max_pending_bytes_ == 0) return CloseInternal(retry_on_unavailable);
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method Close after Close has been called");
+  }
+  auto status = RunAsync([this, retry_on_unavailable] {
+    return CloseInternal(retry_on_unavailable);
+  });
+  if (closed_) StopAsyncWorker();
+  return status;
+}
+
+tensorflow::Status Writer::CloseInternal(bool retry_on_unavailable) {
   if (closed_) {
     return tensorflow::errors::FailedPrecondition(
         "Calling method Close after Close has been called");
@@ -348,6 +698,13 @@ tensorflow::Status Writer::Close(bool retry_on_unavailable) {
           << "The Writer will be closed although the server was Unavailable";
     }
   }
+  if (local_insert_worker_thread_ != nullptr) {
+    auto status = StopLocalInsertWorker();
+    if (!status.ok()) {
+      REVERB_LOG(REVERB_INFO)
+          << "Received error when inserting items: " << status.ToString();
+    }
+  }
   if (stream_) {
     stream_->WritesDone();
     REVERB_LOG_IF(REVERB_ERROR, !ConfirmItems(0))
@@ -359,70 +716,126 @@ tensorflow::Status Writer::Close(bool retry_on_unavailable) {
                 << FormatGrpcStatus(status);
     }
     stream_ = nullptr;
+    trace_ = internal::TraceContext();
+    segments_.RemoveAll();
   }
   chunks_.clear();
+  local_chunks_.clear();
+  buffer_.clear();
+  buffer_size_ = 0;
   closed_ = true;
   return tensorflow::Status::OK();
 }
 
-tensorflow::Status Writer::Finish(bool retry_on_unavailable) {
-  std::vector<tensorflow::Tensor> batched_tensors;
-  for (int i = 0; i < buffer_[0].size(); ++i) {
-    std::vector<tensorflow::Tensor> tensors(buffer_.size());
-    for (int j = 0; j < buffer_.size(); ++j) {
-      const tensorflow::Tensor& item = buffer_[j][i];
-      tensorflow::TensorShape shape = item.shape();
-      shape.InsertDim(0, 1);
-      // This should never fail due to dtype or shape differences, because the
-      // dtype of tensors[j] is UNKNOWN and `shape` has the same number of
-      // elements as `item`.
-      REVERB_CHECK(tensors[j].CopyFrom(item, shape));
-    }
-    batched_tensors.emplace_back();
-    TF_RETURN_IF_ERROR(
-        tensorflow::tensor::Concat(tensors, &batched_tensors.back()));
+tensorflow::Status Writer::EncodeColumn(int column,
+                                        tensorflow::TensorProto* proto,
+                                        ChunkData::BlockIndex* index) const {
+  // The buffered timesteps are already batched so the tensor is compressed
+  // without copying it.
+  tensorflow::Tensor batched = buffer_[column].Slice(0, buffer_size_);
+
+  if (block_length_ > 0) {
+    // The blocks are delta encoded independently of each other.
+    CompressTensorBlocksAsProto(batched, block_length_, delta_encoded_, codec_,
+                                proto, index);
+  } else {
+    if (delta_encoded_) batched = DeltaEncode(batched, true);
+    CompressTensorAsProto(batched, proto, codec_);
   }
+  return tensorflow::Status::OK();
+}
 
+tensorflow::Status Writer::Finish(bool retry_on_unavailable) {
+  internal::ScopedTraceContext active(trace_);
   ChunkData chunk;
   chunk.set_chunk_key(next_chunk_key_);
   chunk.mutable_sequence_range()->set_episode_id(episode_id_);
   chunk.mutable_sequence_range()->set_start(index_within_episode_);
   chunk.mutable_sequence_range()->set_end(index_within_episode_ +
-                                          buffer_.size() - 1);
+                                          buffer_size_ - 1);
+
+  chunk.set_codec(codec_);
+  chunk.set_delta_encoded(delta_encoded_);
+  if (block_length_ > 0) chunk.set_block_length(block_length_);
 
-  if (delta_encoded_) {
-    batched_tensors = DeltaEncodeList(batched_tensors, true);
-    chunk.set_delta_encoded(true);
+  // The columns are encoded independently of each other into protos which are
+  // allocated up front, so the chunk is the same whether or not the columns
+  // are encoded in parallel.
+  const int num_columns = buffer_.size();
+  std::vector<tensorflow::TensorProto*> protos(num_columns);
+  std::vector<ChunkData::BlockIndex*> indices(num_columns, nullptr);
+  for (int i = 0; i < num_columns; ++i) {
+    protos[i] = chunk.mutable_data()->add_tensors();
+    if (block_length_ > 0) {
+      indices[i] = chunk.mutable_data()->add_block_indices();
+    }
   }
 
-  for (const auto& tensor : batched_tensors) {
-    CompressTensorAsProto(tensor, chunk.mutable_data()->add_tensors());
+  std::vector<tensorflow::Status> statuses(num_columns);
+  auto encode = [&](int i) {
+    statuses[i] = EncodeColumn(i, protos[i], indices[i]);
+  };
+  {
+    internal::ScopedSpan span("Writer::EncodeChunk");
+    if (compression_pool_ != nullptr && num_columns > 1 &&
+        buffer_bytes_ >= kMinParallelCompressionBytes) {
+      absl::BlockingCounter pending(num_columns - 1);
+      for (int i = 1; i < num_columns; ++i) {
+        compression_pool_->Schedule([&encode, &pending, i] {
+          encode(i);
+          pending.DecrementCount();
+        });
+      }
+      encode(0);
+      pending.Wait();
+    } else {
+      for (int i = 0; i < num_columns; ++i) encode(i);
+    }
   }
+  for (auto& status : statuses) TF_RETURN_IF_ERROR(status);
 
   chunks_.push_back(std::move(chunk));
 
   auto status = WriteWithRetries(retry_on_unavailable);
   if (status.ok()) {
-    index_within_episode_ += buffer_.size();
-    buffer_.clear();
+    // The tensors of `buffer_` are kept for the next chunk.
+    index_within_episode_ += buffer_size_;
+    buffer_size_ = 0;
+    buffer_bytes_ = 0;
     next_chunk_key_ = NewID();
-    while ((chunks_.size() - 1) * chunk_length_ >= max_timesteps_) {
+
+    // The oldest chunk is dropped once the newer ones alone cover
+    // `max_timesteps_`.
+    int64_t num_chunked_timesteps = 0;
+    for (const ChunkData& chunk : chunks_) {
+      num_chunked_timesteps += NumTimesteps(chunk);
+    }
+    while (num_chunked_timesteps - NumTimesteps(chunks_.front()) >=
+           max_timesteps_) {
+      num_chunked_timesteps -= NumTimesteps(chunks_.front());
       streamed_chunk_keys_.erase(chunks_.front().chunk_key());
+      local_chunks_.erase(chunks_.front().chunk_key());
       chunks_.pop_front();
     }
   } else {
+    local_chunks_.erase(chunks_.back().chunk_key());
     chunks_.pop_back();
   }
   return status;
 }
 
 tensorflow::Status Writer::WriteWithRetries(bool retry_on_unavailable) {
+  if (chunk_store_ != nullptr) return InsertPendingDataLocally();
   while (true) {
     if (WritePendingData()) return tensorflow::Status::OK();
     stream_->WritesDone();
     TF_RETURN_IF_ERROR(StopItemConfirmationWorker());
     auto status = FromGrpcStatus(stream_->Finish());
     stream_ = nullptr;
+    trace_ = internal::TraceContext();
+    // The server won't read the requests which were still buffered when the
+    // stream failed.
+    segments_.RemoveAll();
     if (!tensorflow::errors::IsUnavailable(status) ||
         !retry_on_unavailable)
       return status;
@@ -431,11 +844,19 @@ tensorflow::Status Writer::WriteWithRetries(bool retry_on_unavailable) {
 
 bool Writer::WritePendingData() {
   if (!stream_) {
-    streamed_chunk_keys_.clear();
+    // The server derived items from the chunks sent on the previous stream, so
+    // sending them again would derive those items again.
+    if (!derive_items_on_server_) streamed_chunk_keys_.clear();
     context_ = absl::make_unique<grpc::ClientContext>();
+    trace_ = internal::StartTrace();
+    if (trace_.valid()) {
+      context_->AddMetadata(internal::kTraceparentMetadataKey,
+                            trace_.ToTraceparent());
+    }
     stream_ = stub_->InsertStream(context_.get());
     StartItemConfirmationWorker();
   }
+  internal::ScopedTraceContext active(trace_);
 
   // Stream all chunks which are referenced by the pending items and haven't
   // already been sent. After the items has been inserted we want the server
@@ -449,14 +870,23 @@ bool Writer::WritePendingData() {
   }
   std::vector<uint64_t> keep_chunk_keys;
   for (const ChunkData& chunk : chunks_) {
-    if (item_chunk_keys.contains(chunk.chunk_key()) &&
+    if ((derive_items_on_server_ ||
+         item_chunk_keys.contains(chunk.chunk_key())) &&
         !streamed_chunk_keys_.contains(chunk.chunk_key())) {
       InsertStreamRequest request;
-      request.set_allocated_chunk(const_cast<ChunkData*>(&chunk));
+      request.set_derived_items_only(derive_items_on_server_);
+      const bool shared_memory =
+          shared_memory_ &&
+          chunk.ByteSizeLong() >= internal::kMinSharedMemoryChunkBytes &&
+          segments_.Write(chunk, request.mutable_shared_memory_chunk()).ok();
+      if (!shared_memory) {
+        request.set_allocated_chunk(const_cast<ChunkData*>(&chunk));
+      }
       grpc::WriteOptions options;
       options.set_no_compression();
+      internal::ScopedSpan span("Writer::WriteChunk");
       bool ok = stream_->Write(request, options);
-      request.release_chunk();
+      if (!shared_memory) request.release_chunk();
       if (!ok) return false;
       streamed_chunk_keys_.insert(chunk.chunk_key());
     }
@@ -475,7 +905,12 @@ bool Writer::WritePendingData() {
         keep_chunk_keys.begin(), keep_chunk_keys.end()};
     request.mutable_item()->set_send_confirmation(
         max_in_flight_items_.has_value());
-    if (!stream_->Write(request)) return false;
+    request.mutable_item()->set_batch_confirmations(
+        max_in_flight_items_.has_value());
+    {
+      internal::ScopedSpan span("Writer::WriteItem");
+      if (!stream_->Write(request)) return false;
+    }
     pending_items_.pop_front();
     if (request.item().send_confirmation()) {
       absl::MutexLock lock(&mu_);
@@ -486,6 +921,238 @@ bool Writer::WritePendingData() {
   return true;
 }
 
+tensorflow::Status Writer::InsertPendingDataLocally() {
+  if (local_insert_worker_thread_ == nullptr) StartLocalInsertWorker();
+
+  absl::flat_hash_set<uint64_t> item_chunk_keys;
+  for (const auto& item : pending_items_) {
+    for (uint64_t key : item.chunk_keys()) {
+      item_chunk_keys.insert(key);
+    }
+  }
+  for (ChunkData& chunk : chunks_) {
+    if (item_chunk_keys.contains(chunk.chunk_key()) &&
+        !local_chunks_.contains(chunk.chunk_key())) {
+      // The data is moved to the store as it is never resent. The key and the
+      // range are kept since `chunks_` is used to reference the chunk.
+      ChunkData data;
+      data.Swap(&chunk);
+      chunk.set_chunk_key(data.chunk_key());
+      *chunk.mutable_sequence_range() = data.sequence_range();
+      local_chunks_[chunk.chunk_key()] = chunk_store_->Insert(std::move(data));
+    }
+  }
+
+  while (!pending_items_.empty()) {
+    const PrioritizedItem& item = pending_items_.front();
+    auto it = local_tables_.find(item.table());
+    if (it == local_tables_.end()) {
+      std::shared_ptr<Table> table;
+      TF_RETURN_IF_ERROR(local_table_lookup_(item.table(), &table));
+      it = local_tables_.emplace(item.table(), std::move(table)).first;
+    }
+
+    LocalInsertion insertion;
+    insertion.table = it->second;
+    for (uint64_t key : item.chunk_keys()) {
+      auto chunk = local_chunks_.find(key);
+      if (chunk == local_chunks_.end()) {
+        return tensorflow::errors::Internal("Could not find sequence chunk ",
+                                            key, ".");
+      }
+      insertion.item.chunks.push_back(chunk->second);
+    }
+    insertion.item.item = item;
+
+    if (max_in_flight_items_.has_value()) {
+      if (!ConfirmItems(max_in_flight_items_.value() - 1)) {
+        return StopLocalInsertWorker();
+      }
+      absl::MutexLock lock(&mu_);
+      ++num_items_in_flight_;
+    }
+    if (!local_insertions_->Push(std::move(insertion))) {
+      return StopLocalInsertWorker();
+    }
+    pending_items_.pop_front();
+  }
+  return tensorflow::Status::OK();
+}
+
+void Writer::StartLocalInsertWorker() {
+  {
+    absl::MutexLock lock(&mu_);
+    REVERB_CHECK_EQ(num_items_in_flight_, 0);
+    item_confirmation_worker_running_ = true;
+  }
+  local_insertions_ =
+      absl::make_unique<internal::Queue<LocalInsertion>>(kLocalInsertQueueSize);
+  local_insert_worker_thread_ = internal::StartThread(
+      "WriterLocalInserter",
+      absl::bind_front(&Writer::LocalInsertWorker, this));
+}
+
+tensorflow::Status Writer::StopLocalInsertWorker() {
+  local_insertions_->SetLastItemPushed();
+  local_insert_worker_thread_ = nullptr;  // Joins thread.
+  local_insertions_ = nullptr;
+
+  absl::MutexLock lock(&mu_);
+  num_items_in_flight_ = 0;
+  tensorflow::Status status = std::move(local_insert_status_);
+  local_insert_status_ = tensorflow::Status::OK();
+  return status;
+}
+
+void Writer::LocalInsertWorker() {
+  LocalInsertion insertion;
+  while (local_insertions_->Pop(&insertion)) {
+    auto status = insertion.table->InsertOrAssign(std::move(insertion.item));
+    insertion = LocalInsertion();
+
+    absl::MutexLock lock(&mu_);
+    if (!status.ok()) {
+      local_insert_status_ = std::move(status);
+      // Fail the pending and future calls to `Push` as the stream would.
+      local_insertions_->Close();
+      break;
+    }
+    if (max_in_flight_items_.has_value()) --num_items_in_flight_;
+  }
+  absl::MutexLock lock(&mu_);
+  item_confirmation_worker_running_ = false;
+}
+
+tensorflow::Status Writer::SetEpisodeId(uint64_t episode_id) {
+  if (max_pending_bytes_ == 0) return SetEpisodeIdInternal(episode_id);
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method SetEpisodeId after Close has been called");
+  }
+  return RunAsync(
+      [this, episode_id] { return SetEpisodeIdInternal(episode_id); });
+}
+
+tensorflow::Status Writer::SetEpisodeIdInternal(uint64_t episode_id) {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method SetEpisodeId after Close has been called");
+  }
+  if (index_within_episode_ > 0 || buffer_size_ > 0) {
+    return tensorflow::errors::FailedPrecondition(
+        "SetEpisodeId must be called before any timestep is appended.");
+  }
+  episode_id_ = episode_id;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Writer::DeriveItemsOnServer() {
+  if (max_pending_bytes_ == 0) return DeriveItemsOnServerInternal();
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method DeriveItemsOnServer after Close has been called");
+  }
+  return RunAsync([this] { return DeriveItemsOnServerInternal(); });
+}
+
+tensorflow::Status Writer::DeriveItemsOnServerInternal() {
+  if (closed_) {
+    return tensorflow::errors::FailedPrecondition(
+        "Calling method DeriveItemsOnServer after Close has been called");
+  }
+  if (chunk_store_ != nullptr) {
+    return tensorflow::errors::FailedPrecondition(
+        "DeriveItemsOnServer is only supported by writers which stream to a "
+        "server.");
+  }
+  if (index_within_episode_ > 0 || buffer_size_ > 0) {
+    return tensorflow::errors::FailedPrecondition(
+        "DeriveItemsOnServer must be called before any timestep is appended.");
+  }
+  derive_items_on_server_ = true;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Writer::EnqueueAsync(
+    std::function<tensorflow::Status()> run, int64_t num_bytes) {
+  absl::MutexLock lock(&async_mu_);
+  auto ready = [this, num_bytes]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(async_mu_) {
+    return !async_status_.ok() || pending_bytes_ == 0 ||
+           pending_bytes_ + num_bytes <= max_pending_bytes_;
+  };
+  async_mu_.Await(absl::Condition(&ready));
+  if (!async_status_.ok()) {
+    tensorflow::Status status = std::move(async_status_);
+    async_status_ = tensorflow::Status::OK();
+    return status;
+  }
+  AsyncWork work;
+  work.run = std::move(run);
+  work.num_bytes = num_bytes;
+  async_work_.push_back(std::move(work));
+  pending_bytes_ += num_bytes;
+  return tensorflow::Status::OK();
+}
+
+tensorflow::Status Writer::RunAsync(std::function<tensorflow::Status()> run) {
+  tensorflow::Status status;
+  absl::Notification done;
+  {
+    absl::MutexLock lock(&async_mu_);
+    AsyncWork work;
+    work.run = std::move(run);
+    work.status = &status;
+    work.done = &done;
+    async_work_.push_back(std::move(work));
+  }
+  done.WaitForNotification();
+  return status;
+}
+
+void Writer::AsyncWorker() {
+  while (true) {
+    AsyncWork work;
+    bool drop;
+    {
+      absl::MutexLock lock(&async_mu_);
+      auto ready = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(async_mu_) {
+        return !async_work_.empty() || async_stop_requested_;
+      };
+      async_mu_.Await(absl::Condition(&ready));
+      if (async_work_.empty()) return;
+      work = std::move(async_work_.front());
+      async_work_.pop_front();
+      drop = work.done == nullptr && !async_status_.ok();
+    }
+
+    tensorflow::Status status;
+    if (!drop) status = work.run();
+    // Release the timesteps (and whatever else the closure holds) before the
+    // bytes are returned to the budget.
+    work.run = nullptr;
+
+    absl::MutexLock lock(&async_mu_);
+    pending_bytes_ -= work.num_bytes;
+    if (work.done != nullptr) {
+      *work.status = async_status_.ok() ? std::move(status)
+                                        : std::move(async_status_);
+      async_status_ = tensorflow::Status::OK();
+      work.done->Notify();
+    } else if (!status.ok() && async_status_.ok()) {
+      async_status_ = std::move(status);
+    }
+  }
+}
+
+void Writer::StopAsyncWorker() {
+  if (async_worker_thread_ == nullptr) return;
+  {
+    absl::MutexLock lock(&async_mu_);
+    async_stop_requested_ = true;
+  }
+  async_worker_thread_ = nullptr;  // Joins the thread.
+}
+
 uint64_t Writer::NewID() {
   return absl::Uniform<uint64_t>(bit_gen_, 0, UINT64_MAX);
 }
@@ -501,12 +1168,10 @@ bool Writer::ConfirmItems(int limit) {
 
 tensorflow::Status Writer::GetFlatSignature(
     absl::string_view table,
-    const internal::DtypesAndShapes** dtypes_and_shapes) const {
-  static const auto* empty_dtypes_and_shapes =
-      new internal::DtypesAndShapes(absl::nullopt);
+    const internal::SignatureValidator** signature) const {
   if (!signatures_) {
     // No signatures available, return an unknown set.
-    *dtypes_and_shapes = empty_dtypes_and_shapes;
+    *signature = nullptr;
     return tensorflow::Status::OK();
   }
   auto iter = signatures_->find(table);
@@ -520,10 +1185,43 @@ tensorflow::Status Writer::GetFlatSignature(
         "' in signature cache.  Available tables: [",
         absl::StrJoin(table_names, ", "), "].");
   }
-  *dtypes_and_shapes = &(iter->second);
+  *signature = iter->second.get();
   return tensorflow::Status::OK();
 }
 
+std::shared_ptr<const std::vector<internal::TensorSpec>> Writer::TimestepSpecs(
+    const std::vector<tensorflow::Tensor>& tensors, bool batched) const {
+  const auto& latest = inserted_dtypes_and_shapes_[PositiveModulo(
+      insert_dtypes_and_shapes_location_ - 1, max_timesteps_)];
+  const int skip_dims = batched ? 1 : 0;
+  auto matches = [&](const internal::TensorSpec& spec,
+                     const tensorflow::Tensor& tensor) {
+    if (spec.dtype != tensor.dtype() ||
+        spec.shape.dims() != tensor.dims() - skip_dims) {
+      return false;
+    }
+    for (int d = 0; d < spec.shape.dims(); d++) {
+      if (spec.shape.dim_size(d) != tensor.dim_size(d + skip_dims)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (latest != nullptr && latest->size() == tensors.size() &&
+      std::equal(latest->begin(), latest->end(), tensors.begin(), matches)) {
+    return latest;
+  }
+
+  auto specs = std::make_shared<std::vector<internal::TensorSpec>>();
+  specs->reserve(tensors.size());
+  for (const auto& tensor : tensors) {
+    specs->push_back({/*name=*/"", tensor.dtype(),
+                      tensorflow::PartialTensorShape(
+                          TimestepShape(tensor, batched))});
+  }
+  return specs;
+}
+
 void Writer::ItemConfirmationWorker() {
   InsertStreamResponse response;
   while (true) {
@@ -545,8 +1243,10 @@ void Writer::ItemConfirmationWorker() {
       if (item_confirmation_worker_stop_requested_) break;
     }
     if (!stream_->Read(&response)) break;
+
+    // Servers which don't coalesce confirmations only set `key`.
     absl::WriterMutexLock lock(&mu_);
-    num_items_in_flight_--;
+    num_items_in_flight_ -= std::max(response.keys_size(), 1);
   }
   absl::WriterMutexLock lock(&mu_);
   item_confirmation_worker_running_ = false;
@@ -15,6 +15,8 @@
 #ifndef LEARNING_DEEPMIND_REPLAY_REVERB_WRITER_H_
 #define LEARNING_DEEPMIND_REPLAY_REVERB_WRITER_H_
 
+#include <deque>
+#include <functional>
 #include <list>
 #include <memory>
 #include <vector>
@@ -27,15 +29,23 @@
 #include "absl/random/random.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "absl/types/optional.h"
+#include "reverb/cc/chunk_store.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/queue.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "reverb/cc/support/tracing.h"
+#include "reverb/cc/table.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/hash/hash.h"
@@ -44,21 +54,65 @@ namespace deepmind {
 namespace reverb {
 
 // None of the methods are thread safe.
+//
+// If `max_pending_bytes` > 0 then the writer is asynchronous: `Append`,
+// `AppendSequence` and `CreateItem` only queue their work, which is done in
+// order by a background thread. The batching, compression and streaming of the
+// chunks thus happen off the calling thread. The call blocks while the queued
+// timesteps hold more than `max_pending_bytes` bytes. `Flush` waits until all
+// queued work has been done. Errors of the queued work are returned (once) by
+// the next call; the work queued after the failure is dropped until then.
 class Writer {
  public:
   static constexpr absl::optional<int> kDefaultMaxInFlightItems = absl::nullopt;
 
   // The client must not be deleted while any of its writer instances exist.
+  //
+  // If `shared_memory` is set then (large) chunks are passed to the server
+  // through shared memory. The server must have confirmed that it supports this
+  // (see `InitializeConnection`).
+  //
+  // If `compression_pool` is set then the columns of (large) chunks are
+  // batched and compressed in parallel by its threads. The pool may be shared
+  // by several writers.
+  //
+  // If `max_chunk_bytes` > 0 then a chunk is also cut once the (uncompressed)
+  // tensors of its timesteps hold at least `max_chunk_bytes` bytes, even if it
+  // has fewer than `chunk_length` timesteps. This keeps the chunks of large
+  // timesteps from growing beyond what gRPC and the chunk store handle well.
   Writer(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
          int chunk_length, int max_timesteps, bool delta_encoded = false,
-         std::shared_ptr<internal::FlatSignatureMap> signatures = nullptr,
-         absl::optional<int> max_in_flight_items = absl::nullopt);
+         std::shared_ptr<internal::SignatureValidatorMap> signatures = nullptr,
+         absl::optional<int> max_in_flight_items = absl::nullopt,
+         CompressionCodec codec = CODEC_SNAPPY, int block_length = 0,
+         bool shared_memory = false, int64_t max_pending_bytes = 0,
+         std::shared_ptr<internal::ThreadPool> compression_pool = nullptr,
+         int64_t max_chunk_bytes = 0);
+
+  // Looks up a table of a server running in the same process.
+  using LocalTableLookup = std::function<tensorflow::Status(
+      absl::string_view table, std::shared_ptr<Table>* out)>;
+
+  // Creates a writer which inserts its chunks into `chunk_store` and its items
+  // into the tables returned by `tables` directly, rather than streaming them
+  // to the server over gRPC. Items are inserted by a background thread, in
+  // order, and count as in flight until they have been inserted.
+  Writer(std::shared_ptr<ChunkStore> chunk_store, LocalTableLookup tables,
+         int chunk_length, int max_timesteps, bool delta_encoded = false,
+         std::shared_ptr<internal::SignatureValidatorMap> signatures = nullptr,
+         absl::optional<int> max_in_flight_items = absl::nullopt,
+         CompressionCodec codec = CODEC_SNAPPY, int block_length = 0,
+         int64_t max_pending_bytes = 0,
+         std::shared_ptr<internal::ThreadPool> compression_pool = nullptr,
+         int64_t max_chunk_bytes = 0);
+
   ~Writer();
 
   // Appends a timestamp to internal `buffer_`. If the size of the buffer
-  // reached `chunk_length_` then its content is batched and inserted into
-  // `chunks_`. If `pending_items_` is not empty then its items are streamed to
-  // the ReverbService and popped.
+  // reached `chunk_length_` (or its tensors hold `max_chunk_bytes_` bytes)
+  // then its content is batched and inserted into `chunks_`. If
+  // `pending_items_` is not empty then its items are streamed to the
+  // ReverbService and popped.
   //
   // If all operations are successful then `buffer_` is cleared, a new
   // `next_chunk_key_` is set and old items are removed from `chunks_` until its
@@ -67,7 +121,8 @@ class Writer {
 
   // Appends a batched sequence of timesteps. Equivalent to calling `Append` `T`
   // times where `T` is batch size of `sequence`. The shapes of the elements of
-  // `sequence` thus have `[T] + shape_of_single_timestep_element`.
+  // `sequence` thus have `[T] + shape_of_single_timestep_element`. The
+  // timesteps of each chunk are copied into `buffer_` in bulk.
   tensorflow::Status AppendSequence(std::vector<tensorflow::Tensor> sequence);
 
   // Adds a new PrioritizedItem to `table` spanning the last `num_timesteps` and
@@ -77,6 +132,16 @@ class Writer {
   tensorflow::Status CreateItem(const std::string& table, int num_timesteps,
                                 double priority);
 
+  // Like `CreateItem` above but the item only references the tensors at the
+  // (flattened) indices `columns` of the appended timesteps, in that order.
+  // Only the referenced columns are validated against the signature of
+  // `table` and sent to the samplers of the item. The chunks are still stored
+  // once with all their columns so items of different tables can share them.
+  // An empty `columns` references all tensors.
+  tensorflow::Status CreateItem(const std::string& table, int num_timesteps,
+                                double priority,
+                                const std::vector<int>& columns);
+
   // TODO(b/154929199): There should probably be a method for ending an episode
   // even if you don't want to close the stream.
 
@@ -97,10 +162,59 @@ class Writer {
   // python API.
   tensorflow::Status Flush();
 
+  // Replaces the random id of the episode which the timesteps are appended to.
+  // Must be called before the first timestep is appended. Used to route the
+  // episodes of sharded tables to shards by their id (see `ShardedClient`).
+  tensorflow::Status SetEpisodeId(uint64_t episode_id);
+
+  // Streams every chunk to the server as soon as it is complete, rather than
+  // with the first item which references it, so that the server can derive
+  // the items of the tables with item rules from them (see `ItemRule`). The
+  // server doesn't keep the chunks for items sent by the writer, so
+  // `CreateItem` fails afterwards. Chunks are not sent again when the stream
+  // is reconnected; items which would span the reconnect are not derived.
+  // Must be called before the first timestep is appended. Only supported by
+  // writers which stream to a server.
+  tensorflow::Status DeriveItemsOnServer();
+
   // Returns a summary string description.
   std::string DebugString() const;
 
+  // Returns true if the calls only queue their work (see class comment).
+  bool asynchronous() const { return max_pending_bytes_ > 0; }
+
  private:
+  // Implementations of the public methods of the same name. Called directly
+  // by synchronous writers and by `async_worker_thread_` otherwise.
+  tensorflow::Status AppendInternal(std::vector<tensorflow::Tensor> data);
+  tensorflow::Status AppendSequenceInternal(
+      std::vector<tensorflow::Tensor> sequence);
+  tensorflow::Status CreateItemInternal(const std::string& table,
+                                        int num_timesteps, double priority,
+                                        const std::vector<int>& columns);
+  tensorflow::Status FlushInternal();
+  tensorflow::Status CloseInternal(bool retry_on_unavailable);
+  tensorflow::Status SetEpisodeIdInternal(uint64_t episode_id);
+  tensorflow::Status DeriveItemsOnServerInternal();
+
+  // Queues `run` for `async_worker_thread_`. Blocks while the queued work
+  // holds more than `max_pending_bytes_` bytes, unless nothing is queued.
+  // Returns the error of earlier work (if any) rather than queuing `run`.
+  tensorflow::Status EnqueueAsync(std::function<tensorflow::Status()> run,
+                                  int64_t num_bytes)
+      ABSL_LOCKS_EXCLUDED(async_mu_);
+
+  // Queues `run` for `async_worker_thread_` and blocks until it has been
+  // called. Returns the error of earlier work (if any) or else that of `run`.
+  tensorflow::Status RunAsync(std::function<tensorflow::Status()> run)
+      ABSL_LOCKS_EXCLUDED(async_mu_);
+
+  // Runs the queued work in order until `StopAsyncWorker` is called.
+  void AsyncWorker() ABSL_LOCKS_EXCLUDED(async_mu_);
+
+  // Stops and joins `async_worker_thread_` once the queued work has been done.
+  void StopAsyncWorker() ABSL_LOCKS_EXCLUDED(async_mu_);
+
   // Creates a new batch from the content of `buffer_` and inserts it into
   // `chunks_`. If `pending_items_` is not empty then the items are streamed to
   // the ReverbService and popped.
@@ -112,6 +226,22 @@ class Writer {
   // is popped from `chunks_`.
   tensorflow::Status Finish(bool retry_on_unavailable);
 
+  // Makes room in `buffer_` for timesteps with the tensors of `data`, which
+  // hold a single timestep, or a batch of timesteps if `batched`. Returns an
+  // error if the dtypes or shapes differ from those of the timesteps already
+  // in `buffer_`. When the buffer is empty it is (re)allocated to hold as many
+  // timesteps as a chunk, unless the tensors of the previous chunk fit.
+  tensorflow::Status PrepareBuffer(const std::vector<tensorflow::Tensor>& data,
+                                   bool batched);
+
+  // True if `buffer_` holds enough timesteps (or bytes) to be chunked.
+  bool BufferIsFull() const;
+
+  // Batches column `column` of `buffer_` and compresses it into `proto` (and
+  // `index` if `block_length_` > 0). Columns may be encoded concurrently.
+  tensorflow::Status EncodeColumn(int column, tensorflow::TensorProto* proto,
+                                  ChunkData::BlockIndex* index) const;
+
   // Retries `WritePendingData` until sucessful or, if retry_on_unavailable is
   // true, until non transient errors encountered
   tensorflow::Status WriteWithRetries(bool retry_on_unavailable);
@@ -120,6 +250,24 @@ class Writer {
   // items in `pending_items_`
   bool WritePendingData();
 
+  // Same as `WriteWithRetries` but inserts the chunks into `chunk_store_` and
+  // queues the items for `LocalInsertWorker`. Only used if `chunk_store_` is
+  // set. Errors of earlier insertions are returned (once) by the next call.
+  tensorflow::Status InsertPendingDataLocally();
+
+  // Inserts the items of `local_insertions_` until the queue is closed or the
+  // insertion of an item fails. Takes the role of
+  // `item_confirmation_worker_thread_` for local writers.
+  void LocalInsertWorker() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Spawns `local_insert_worker_thread_`.
+  void StartLocalInsertWorker() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Waits for the queued items to be inserted, joins
+  // `local_insert_worker_thread_` and returns the error of the failed
+  // insertion (if any).
+  tensorflow::Status StopLocalInsertWorker() ABSL_LOCKS_EXCLUDED(mu_);
+
   // Helper for generating a random ID.
   uint64_t NewID();
 
@@ -162,15 +310,70 @@ class Writer {
       stream_;
   std::unique_ptr<grpc::ClientContext> context_;
 
+  // Trace of `stream_`, started when the stream is opened. Invalid while there
+  // is no stream or if tracing is disabled.
+  internal::TraceContext trace_;
+
+  // Chunk store of a server running in the same process. If set then chunks
+  // and items are inserted directly and `stub_` is never used.
+  std::shared_ptr<ChunkStore> chunk_store_;
+
+  // Looks up the tables of the server which owns `chunk_store_`.
+  LocalTableLookup local_table_lookup_;
+
+  // Tables which items have been inserted into by `InsertPendingDataLocally`.
+  internal::flat_hash_map<std::string, std::shared_ptr<Table>> local_tables_;
+
+  // Chunks of `chunks_` which have been inserted into `chunk_store_`. The
+  // references are released when the chunks are removed from `chunks_`.
+  internal::flat_hash_map<uint64_t, std::shared_ptr<ChunkStore::Chunk>>
+      local_chunks_;
+
+  // An item waiting to be inserted by `local_insert_worker_thread_`.
+  struct LocalInsertion {
+    std::shared_ptr<Table> table;
+    Table::Item item;
+  };
+  std::unique_ptr<internal::Queue<LocalInsertion>> local_insertions_;
+  std::unique_ptr<internal::Thread> local_insert_worker_thread_;
+
+  // Error of the first item which `local_insert_worker_thread_` failed to
+  // insert.
+  tensorflow::Status local_insert_status_ ABSL_GUARDED_BY(mu_);
+
   // The number of timesteps to batch in each chunk.
   const int chunk_length_;
 
+  // If > 0 then chunks are cut early once the timesteps of `buffer_` hold at
+  // least this many bytes.
+  const int64_t max_chunk_bytes_;
+
   // The maximum number of recent timesteps which new items can reference.
   const int max_timesteps_;
 
   // Whether chunks should be delta encoded before compressed.
   const bool delta_encoded_;
 
+  // Codec used to compress the tensors of the chunks.
+  const CompressionCodec codec_;
+
+  // If > 0 then the time steps of the chunks are compressed in blocks of this
+  // length which can be decompressed independently. See
+  // `ChunkData.block_length`.
+  const int block_length_;
+
+  // Whether chunks are passed to the server through shared memory.
+  const bool shared_memory_;
+
+  // Segments of the chunks passed through shared memory. The server removes
+  // the segments it reads, and the ones it hasn't read once `stream_` has
+  // finished are removed by the writer.
+  internal::SharedMemorySegments segments_;
+
+  // Whether all chunks are streamed for the server to derive items from. See
+  // `DeriveItemsOnServer`.
+  bool derive_items_on_server_ = false;
+
   // The maximum number if items that is allowed to be "in flight" (i.e sent to
   // the server but not yet confirmed to be completed) at the same time. If this
   // value is reached and an item is about to be sent then the operation will
@@ -197,16 +400,50 @@ class Writer {
 
   // Protects access to `num_items_in_flight_`,
   // `item_confirmation_worker_running_`,
-  // `item_confirmation_worker_stop_requested_` and
-  // `item_confirmation_worker_thread_`.
+  // `item_confirmation_worker_stop_requested_`,
+  // `item_confirmation_worker_thread_` and `local_insert_status_`.
   absl::Mutex mu_;
 
   // Worker thread that reads item confirmations from the stream.
   std::unique_ptr<internal::Thread> item_confirmation_worker_thread_
       ABSL_GUARDED_BY(mu_) = nullptr;
 
-  // Cache mapping table name to cached flattened signature.
-  std::shared_ptr<internal::FlatSignatureMap> signatures_;
+  // If > 0 then the writer is asynchronous and the timesteps queued for
+  // `async_worker_thread_` may hold at most this many bytes.
+  const int64_t max_pending_bytes_;
+
+  // Work queued by an asynchronous writer. If `done` is set then it is
+  // notified, and `status` set, once `run` has been called. Work without
+  // `done` is dropped while `async_status_` holds an error.
+  struct AsyncWork {
+    std::function<tensorflow::Status()> run;
+    int64_t num_bytes = 0;
+    tensorflow::Status* status = nullptr;
+    absl::Notification* done = nullptr;
+  };
+
+  // Protects `async_work_`, `pending_bytes_`, `async_status_` and
+  // `async_stop_requested_`.
+  absl::Mutex async_mu_;
+  std::deque<AsyncWork> async_work_ ABSL_GUARDED_BY(async_mu_);
+
+  // Bytes of the timesteps of `async_work_` and of the work being done.
+  int64_t pending_bytes_ ABSL_GUARDED_BY(async_mu_) = 0;
+
+  // Error of the first queued work which failed and has not yet been returned.
+  tensorflow::Status async_status_ ABSL_GUARDED_BY(async_mu_);
+
+  bool async_stop_requested_ ABSL_GUARDED_BY(async_mu_) = false;
+
+  // Does the work of `async_work_`. Only set if `max_pending_bytes_` > 0.
+  std::unique_ptr<internal::Thread> async_worker_thread_;
+
+  // Threads which compress the columns of large chunks in parallel. May be
+  // shared with other writers. If nullptr then columns are compressed serially.
+  std::shared_ptr<internal::ThreadPool> compression_pool_;
+
+  // Cache mapping table name to cached compiled flattened signature.
+  std::shared_ptr<internal::SignatureValidatorMap> signatures_;
 
   // Bit generator used by `NewID`.
   absl::BitGen bit_gen_;
@@ -218,8 +455,17 @@ class Writer {
   // written to the ReverbService immediately.
   std::list<PrioritizedItem> pending_items_;
 
-  // Timesteps not yet batched up and put into `chunks_`.
-  std::vector<std::vector<tensorflow::Tensor>> buffer_;
+  // Timesteps not yet batched up and put into `chunks_`, stored by column:
+  // the first `buffer_size_` rows of `buffer_[i]` hold tensor `i` of each
+  // buffered timestep. The tensors have room for `buffer_capacity_` timesteps
+  // so appending a timestep copies it into its row, and the rows are
+  // compressed as is once the chunk is full.
+  std::vector<tensorflow::Tensor> buffer_;
+  int64_t buffer_size_ = 0;
+  int64_t buffer_capacity_ = 0;
+
+  // Total bytes of the tensors of `buffer_`.
+  int64_t buffer_bytes_ = 0;
 
   // Batched timesteps that can be referenced by new items.
   std::list<ChunkData> chunks_;
@@ -242,17 +488,26 @@ class Writer {
   // Set of signatures passed to Append in a circular buffer.  Each
   // entry is the flat list of tensor dtypes and shapes in past Append
   // calls.  The vector itself is of length max_time_steps_ and Append
-  // updates the DtypesAndShapes at index append_dtypes_and_shapes_location_.
-  std::vector<internal::DtypesAndShapes> inserted_dtypes_and_shapes_;
+  // updates the entry at index insert_dtypes_and_shapes_location_. Timesteps
+  // with the same dtypes and shapes as the previous one share its entry, so
+  // appending them does not allocate. Null if unknown.
+  std::vector<std::shared_ptr<const std::vector<internal::TensorSpec>>>
+      inserted_dtypes_and_shapes_;
   int insert_dtypes_and_shapes_location_ = 0;
 
-  // Get a pointer to the DtypesAndShapes flattened signature for `table`.
-  // Returns a nullopt signature if no signatures were provided to the Writer on
-  // initialization.  Raises an InvalidArgument if the table is not in
-  // signatures_.
+  // Get a pointer to the compiled flattened signature for `table`. Returns a
+  // null signature if no signatures were provided to the Writer on
+  // initialization or if the table has no signature.  Raises an
+  // InvalidArgument if the table is not in signatures_.
   tensorflow::Status GetFlatSignature(
       absl::string_view table,
-      const internal::DtypesAndShapes** dtypes_and_shapes) const;
+      const internal::SignatureValidator** signature) const;
+
+  // Returns the dtypes and shapes of the timesteps of `tensors`, which hold a
+  // batch of timesteps if `batched`. Returns the entry of the latest timestep
+  // if it matches.
+  std::shared_ptr<const std::vector<internal::TensorSpec>> TimestepSpecs(
+      const std::vector<tensorflow::Tensor>& tensors, bool batched) const;
 };
 
 }  // namespace reverb
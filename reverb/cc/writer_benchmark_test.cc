@@ -0,0 +1,104 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the latency of finalizing (batching and compressing) the chunks of
+// a writer with and without a compression pool for an increasing number of
+// columns. The test is tagged as manual and has to be run explicitly:
+//
+//   bazel test -c opt //reverb/cc:writer_benchmark_test \
+//     --test_output=streamed
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/thread_pool.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/writer.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr int kChunkLength = 10;
+constexpr int kNumChunks = 50;
+constexpr int kNumThreads = 8;
+
+// Returns a timestep of `num_columns` images, e.g the cameras of an
+// observation dict.
+std::vector<tensorflow::Tensor> MakeTimestep(int num_columns, int t) {
+  std::vector<tensorflow::Tensor> timestep;
+  for (int c = 0; c < num_columns; c++) {
+    tensorflow::Tensor tensor(tensorflow::DT_UINT8, {64, 64, 3});
+    auto flat = tensor.flat<uint8_t>();
+    for (int i = 0; i < flat.size(); i++) flat(i) = (i * (c + 1) + t) % 251;
+    timestep.push_back(std::move(tensor));
+  }
+  return timestep;
+}
+
+// Returns the mean time spent by the `Append` calls which finalize a chunk.
+absl::Duration MeanFinalizeLatency(
+    int num_columns, std::shared_ptr<internal::ThreadPool> pool) {
+  // No items are created so the chunks are finalized but never inserted.
+  Writer writer(
+      std::make_shared<ChunkStore>(),
+      [](absl::string_view table, std::shared_ptr<Table>* out) {
+        return tensorflow::errors::NotFound(table);
+      },
+      kChunkLength, kChunkLength, /*delta_encoded=*/false,
+      /*signatures=*/nullptr, /*max_in_flight_items=*/absl::nullopt,
+      CODEC_SNAPPY, /*block_length=*/0, /*max_pending_bytes=*/0,
+      std::move(pool));
+
+  absl::Duration total;
+  for (int chunk = 0; chunk < kNumChunks; chunk++) {
+    for (int t = 0; t < kChunkLength - 1; t++) {
+      TF_EXPECT_OK(writer.Append(MakeTimestep(num_columns, t)));
+    }
+    auto last = MakeTimestep(num_columns, kChunkLength - 1);
+    const absl::Time start = absl::Now();
+    TF_EXPECT_OK(writer.Append(std::move(last)));
+    total += absl::Now() - start;
+  }
+  return total / kNumChunks;
+}
+
+TEST(WriterBenchmark, FinalizeLatencyByNumColumns) {
+  auto pool =
+      std::make_shared<internal::ThreadPool>(kNumThreads, "WriterBenchmark");
+  for (int num_columns : {1, 2, 4, 8, 16, 32}) {
+    const absl::Duration serial = MeanFinalizeLatency(num_columns, nullptr);
+    const absl::Duration parallel = MeanFinalizeLatency(num_columns, pool);
+    REVERB_LOG(REVERB_INFO)
+        << "columns=" << num_columns << " serial=" << serial
+        << " parallel(" << kNumThreads << " threads)=" << parallel
+        << " speedup=" << absl::FDivDuration(serial, parallel);
+  }
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -15,6 +15,7 @@
 #include "reverb/cc/writer.h"
 
 #include <algorithm>
+#include <cfloat>
 #include <queue>
 #include <string>
 
@@ -23,17 +24,25 @@
 #include "grpcpp/impl/codegen/sync_stream.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/memory/memory.h"
 #include "absl/synchronization/notification.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
 #include "reverb/cc/client.h"
 #include "reverb/cc/platform/thread.h"
+#include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/reverb_service_mock.grpc.pb.h"
+#include "reverb/cc/selectors/fifo.h"
 #include "reverb/cc/support/grpc_util.h"
 #include "reverb/cc/support/queue.h"
+#include "reverb/cc/support/shared_memory.h"
+#include "reverb/cc/support/thread_pool.h"
 #include "reverb/cc/support/uint128.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/tensor_compression.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_util.h"
@@ -50,6 +59,8 @@ using ::deepmind::reverb::testing::Partially;
 using ::tensorflow::errors::Internal;
 using ::tensorflow::errors::Unavailable;
 using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Not;
 using ::testing::SizeIs;
 
 constexpr auto kNotificationTimeout = absl::Milliseconds(200);
@@ -140,11 +151,23 @@ class FakeInsertStream
     if (written_item_ids_.empty()) {
       return false;
     }
+    if (batch_responses_) {
+      for (; !written_item_ids_.empty(); written_item_ids_.pop()) {
+        response->add_keys(written_item_ids_.front());
+      }
+      return true;
+    }
     response->set_key(written_item_ids_.front());
     written_item_ids_.pop();
     return true;
   }
 
+  // Confirms all written items with a single response, like servers which
+  // coalesce the confirmations.
+  void set_batch_responses(bool batch_responses) {
+    batch_responses_ = batch_responses;
+  }
+
   grpc::Status Finish() override {
     return num_success_writes_ >= 0 ? grpc::Status::OK : bad_status_;
   }
@@ -168,6 +191,7 @@ class FakeInsertStream
   int num_success_writes_;
   grpc::Status bad_status_;
   internal::Queue<uint64_t>* response_ids_;
+  bool batch_responses_ = false;
 };
 
 class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
@@ -267,6 +291,25 @@ TEST(WriterTest, OnlySendsChunksWhichAreUsedByItems) {
                           requests[1].chunk().chunk_key()));
 }
 
+TEST(WriterTest, DeriveItemsOnServerSendsEveryChunk) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  Writer writer(stub, 2, 10);
+  TF_ASSERT_OK(writer.DeriveItemsOnServer());
+  for (int i = 0; i < 4; i++) {
+    TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  }
+  ASSERT_THAT(requests, SizeIs(2));
+  for (const auto& request : requests) {
+    EXPECT_THAT(request, IsChunk());
+    EXPECT_TRUE(request.derived_items_only());
+  }
+  EXPECT_EQ(writer.CreateItem("dist", 1, 1.0).code(),
+            tensorflow::error::FAILED_PRECONDITION);
+  EXPECT_EQ(writer.DeriveItemsOnServer().code(),
+            tensorflow::error::FAILED_PRECONDITION);
+}
+
 TEST(WriterTest, DoesNotSendAlreadySentChunks) {
   std::vector<InsertStreamRequest> requests;
   auto stub = MakeGoodStub(&requests);
@@ -595,6 +638,124 @@ TEST(WriterTest, DeltaEncode) {
           IsItemWithRangeAndPriorityAndTable(0, 3, 1.0, "dist")));
 }
 
+TEST(WriterTest, CodecIsSetOnChunks) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  Writer writer(stub, /*chunk_length=*/2, /*max_timesteps=*/4,
+                /*delta_encoded=*/false, /*signatures=*/nullptr,
+                /*max_in_flight_items=*/absl::nullopt, CODEC_ZSTD);
+
+  TF_EXPECT_OK(writer.Append(MakeTimestep()));
+  TF_EXPECT_OK(writer.Append(MakeTimestep()));
+  TF_EXPECT_OK(writer.CreateItem("dist", 2, 1.0));
+
+  ASSERT_THAT(requests, SizeIs(2));
+  const ChunkData& chunk = requests[0].chunk();
+  EXPECT_EQ(chunk.codec(), CODEC_ZSTD);
+  for (const auto& tensor : chunk.data().tensors()) {
+    tensorflow::Tensor batch;
+    TF_ASSERT_OK(DecompressTensorFromProto(tensor, CODEC_ZSTD, &batch));
+    EXPECT_EQ(batch.dim_size(0), 2);
+  }
+}
+
+TEST(WriterTest, LargeChunksArePassedThroughSharedMemory) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  Writer writer(stub, /*chunk_length=*/1, /*max_timesteps=*/2,
+                /*delta_encoded=*/false, /*signatures=*/nullptr,
+                /*max_in_flight_items=*/absl::nullopt, CODEC_NONE,
+                /*block_length=*/0, /*shared_memory=*/true);
+
+  TF_EXPECT_OK(writer.Append(
+      MakeTimestep(/*num_tensors=*/1, tensorflow::TensorShape({20000}))));
+  TF_EXPECT_OK(writer.Append(MakeTimestep()));
+  TF_EXPECT_OK(writer.CreateItem("dist", 2, 1.0));
+
+  ASSERT_THAT(requests, SizeIs(3));
+  ASSERT_TRUE(requests[0].has_shared_memory_chunk());
+  ChunkData chunk;
+  TF_ASSERT_OK(internal::ReadSharedMemoryChunk(
+      requests[0].shared_memory_chunk(), &chunk));
+  EXPECT_EQ(chunk.sequence_range().start(), 0);
+  EXPECT_GE(chunk.ByteSizeLong(), internal::kMinSharedMemoryChunkBytes);
+
+  // Small chunks are still sent inline.
+  EXPECT_TRUE(requests[1].has_chunk());
+  EXPECT_EQ(requests[1].chunk().sequence_range().start(), 1);
+}
+
+TEST(WriterTest, FailedStreamRemovesUnreadSegments) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeFlakyStub(&requests, /*num_success=*/1, /*num_fail=*/1,
+                            ToGrpcStatus(Internal("")));
+  Writer writer(stub, /*chunk_length=*/1, /*max_timesteps=*/1,
+                /*delta_encoded=*/false, /*signatures=*/nullptr,
+                /*max_in_flight_items=*/absl::nullopt, CODEC_NONE,
+                /*block_length=*/0, /*shared_memory=*/true);
+
+  // The chunk is written to the stream, which then fails before the server
+  // has read the segment.
+  TF_EXPECT_OK(writer.Append(
+      MakeTimestep(/*num_tensors=*/1, tensorflow::TensorShape({20000}))));
+  EXPECT_FALSE(writer.CreateItem("dist", 1, 1.0).ok());
+  ASSERT_THAT(requests, Not(IsEmpty()));
+  ASSERT_TRUE(requests[0].has_shared_memory_chunk());
+
+  EXPECT_THAT(internal::ListSharedMemorySegmentsOfProcess(), IsEmpty());
+}
+
+TEST(WriterTest, ClosedStreamRemovesUnreadSegments) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  Writer writer(stub, /*chunk_length=*/1, /*max_timesteps=*/1,
+                /*delta_encoded=*/false, /*signatures=*/nullptr,
+                /*max_in_flight_items=*/absl::nullopt, CODEC_NONE,
+                /*block_length=*/0, /*shared_memory=*/true);
+
+  TF_EXPECT_OK(writer.Append(
+      MakeTimestep(/*num_tensors=*/1, tensorflow::TensorShape({20000}))));
+  TF_EXPECT_OK(writer.CreateItem("dist", 1, 1.0));
+  ASSERT_TRUE(requests[0].has_shared_memory_chunk());
+
+  TF_EXPECT_OK(writer.Close());
+  EXPECT_THAT(internal::ListSharedMemorySegmentsOfProcess(), IsEmpty());
+}
+
+TEST(WriterTest, BlockLengthIsSetOnChunks) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  Writer writer(stub, /*chunk_length=*/5, /*max_timesteps=*/5,
+                /*delta_encoded=*/true, /*signatures=*/nullptr,
+                /*max_in_flight_items=*/absl::nullopt, CODEC_SNAPPY,
+                /*block_length=*/2);
+
+  for (int i = 0; i < 5; i++) {
+    TF_EXPECT_OK(writer.Append(MakeTimestep(/*num_tensors=*/2)));
+  }
+  TF_EXPECT_OK(writer.CreateItem("dist", 5, 1.0));
+
+  ASSERT_THAT(requests, SizeIs(2));
+  const ChunkData& chunk = requests[0].chunk();
+  EXPECT_EQ(chunk.block_length(), 2);
+  EXPECT_TRUE(chunk.delta_encoded());
+  ASSERT_EQ(chunk.data().block_indices_size(), 2);
+  for (int i = 0; i < chunk.data().tensors_size(); i++) {
+    // Blocks of 2, 2 and 1 time steps.
+    EXPECT_EQ(chunk.data().block_indices(i).limits_size(), 3);
+
+    tensorflow::Tensor batch(tensorflow::DT_FLOAT,
+                             tensorflow::TensorShape({5}));
+    TF_ASSERT_OK(DecompressTensorBlockRowsInto(
+        chunk.data().tensors(i), chunk.data().block_indices(i),
+        chunk.block_length(), chunk.codec(), chunk.delta_encoded(), 0, 5, 0,
+        &batch));
+    for (int j = 0; j < 5; j++) {
+      EXPECT_EQ(batch.flat<float>()(j), 1.0);
+    }
+  }
+}
+
 TEST(WriterTest, MultiChunkItemsAreCorrect) {
   std::vector<InsertStreamRequest> requests;
   auto stub = MakeGoodStub(&requests);
@@ -708,6 +869,40 @@ TEST(WriterTest, WriteTimeStepsNumTensorsDontMatchBoundedSignatureError) {
                   "but table requires 1 tensors per entry."));
 }
 
+TEST(WriterTest, CreateItemWithColumnsOnlyChecksReferencedColumns) {
+  std::vector<InsertStreamRequest> requests;
+  tensorflow::StructuredValue signature = MakeSignature();
+  auto stub = MakeGoodStub(&requests, &signature);
+  Client client(stub);
+  std::unique_ptr<Writer> writer;
+  TF_EXPECT_OK(client.NewWriter(2, 6, /*delta_encoded=*/false, &writer));
+
+  TF_ASSERT_OK(writer->Append(MakeTimestep(/*num_tensors=*/3)));
+  TF_ASSERT_OK(writer->Append(MakeTimestep(/*num_tensors=*/3)));
+  TF_ASSERT_OK(writer->CreateItem("dist", 2, 1.0, /*columns=*/{2}));
+  ASSERT_THAT(requests, SizeIs(2));
+
+  // The chunk holds every column while the item only references one of them.
+  EXPECT_EQ(requests[0].chunk().data().tensors_size(), 3);
+  EXPECT_THAT(requests[1].item().item().columns(), ElementsAre(2));
+}
+
+TEST(WriterTest, CreateItemRejectsInvalidColumns) {
+  std::vector<InsertStreamRequest> requests;
+  Client client(MakeGoodStub(&requests));
+  std::unique_ptr<Writer> writer;
+  TF_EXPECT_OK(client.NewWriter(2, 6, /*delta_encoded=*/false, &writer));
+
+  TF_ASSERT_OK(writer->Append(MakeTimestep(/*num_tensors=*/2)));
+  EXPECT_TRUE(tensorflow::errors::IsInvalidArgument(
+      writer->CreateItem("dist", 1, 1.0, /*columns=*/{-1})));
+  EXPECT_TRUE(tensorflow::errors::IsInvalidArgument(
+      writer->CreateItem("dist", 1, 1.0, /*columns=*/{2})));
+  EXPECT_TRUE(tensorflow::errors::IsInvalidArgument(
+      writer->CreateItem("dist", 1, 1.0, /*columns=*/{1, 1})));
+  TF_EXPECT_OK(writer->CreateItem("dist", 1, 1.0, /*columns=*/{1, 0}));
+}
+
 TEST(WriterTest, WriteTimeStepsInconsistentDtypeError) {
   std::vector<InsertStreamRequest> requests;
   tensorflow::StructuredValue signature = MakeSignature(tensorflow::DT_INT32);
@@ -903,6 +1098,130 @@ TEST(WriterTest, BlocksWhenMaxInFlighItemsReached) {
   ASSERT_TRUE(response_ids->Push(3));
 }
 
+TEST(WriterTest, CountsBatchedConfirmations) {
+  std::vector<InsertStreamRequest> requests;
+  auto* stream =
+      new FakeInsertStream(&requests, 10000, ToGrpcStatus(Internal("")));
+  stream->set_batch_responses(true);
+  auto stub = std::make_shared<FakeStub>(std::list<FakeInsertStream*>{stream});
+  Writer writer(stub, 1, 2, false, nullptr, 100);
+
+  for (int i = 0; i < 3; i++) {
+    TF_ASSERT_OK(writer.Append(MakeTimestep()));
+    TF_ASSERT_OK(writer.CreateItem("dist", 1, 1.0));
+  }
+
+  // Only completes if every key of the batched responses is counted.
+  TF_ASSERT_OK(writer.Flush());
+  for (const auto& request : requests) {
+    if (request.has_item()) {
+      EXPECT_TRUE(request.item().batch_confirmations());
+    }
+  }
+}
+
+// Writer which inserts directly into `chunk_store` and the table "dist".
+std::unique_ptr<Writer> MakeLocalWriter(
+    std::shared_ptr<ChunkStore> chunk_store, std::shared_ptr<Table> table,
+    int chunk_length, int max_timesteps,
+    absl::optional<int> max_in_flight_items = absl::nullopt) {
+  return absl::make_unique<Writer>(
+      std::move(chunk_store),
+      [table](absl::string_view name, std::shared_ptr<Table>* out) {
+        if (name != table->name()) {
+          return tensorflow::errors::NotFound("Table ", name, " not found.");
+        }
+        *out = table;
+        return tensorflow::Status::OK();
+      },
+      chunk_length, max_timesteps, /*delta_encoded=*/false,
+      /*signatures=*/nullptr, std::move(max_in_flight_items));
+}
+
+std::shared_ptr<Table> MakeLocalTable(
+    std::shared_ptr<RateLimiter> rate_limiter =
+        std::make_shared<RateLimiter>(1, 1, 0, 100)) {
+  return std::make_shared<Table>(
+      /*name=*/"dist", /*sampler=*/std::make_shared<FifoSelector>(),
+      /*remover=*/std::make_shared<FifoSelector>(), /*max_size=*/100,
+      /*max_times_sampled=*/1, std::move(rate_limiter));
+}
+
+TEST(WriterTest, LocalWriterInsertsChunksAndItems) {
+  auto chunk_store = std::make_shared<ChunkStore>();
+  auto table = MakeLocalTable();
+  auto writer = MakeLocalWriter(chunk_store, table, /*chunk_length=*/2,
+                                /*max_timesteps=*/4);
+
+  TF_ASSERT_OK(writer->Append(MakeTimestep()));
+  TF_ASSERT_OK(writer->Append(MakeTimestep()));
+  TF_ASSERT_OK(writer->CreateItem("dist", 2, 1.0));
+  TF_ASSERT_OK(writer->Append(MakeTimestep()));
+  TF_ASSERT_OK(writer->CreateItem("dist", 3, 2.0));
+  TF_ASSERT_OK(writer->Close());
+
+  auto items = table->Copy();
+  ASSERT_THAT(items, SizeIs(2));
+  std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) {
+    return a.item.priority() < b.item.priority();
+  });
+  EXPECT_THAT(items[0].chunks, SizeIs(1));
+  EXPECT_THAT(items[1].chunks, SizeIs(2));
+  EXPECT_EQ(items[1].item.sequence_range().length(), 3);
+
+  // The items of the table share the chunks of the store.
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  TF_ASSERT_OK(chunk_store->Get({items[1].item.chunk_keys(0),
+                                 items[1].item.chunk_keys(1)},
+                                &chunks));
+  EXPECT_EQ(chunks[0], items[1].chunks[0]);
+  EXPECT_EQ(chunks[1]->data().sequence_range().start(), 2);
+  EXPECT_EQ(chunks[1]->data().data().tensors_size(), 1);
+}
+
+TEST(WriterTest, LocalWriterReturnsErrorOfMissingTable) {
+  auto writer = MakeLocalWriter(std::make_shared<ChunkStore>(),
+                                MakeLocalTable(), /*chunk_length=*/1,
+                                /*max_timesteps=*/1);
+  TF_ASSERT_OK(writer->Append(MakeTimestep()));
+  EXPECT_TRUE(tensorflow::errors::IsNotFound(
+      writer->CreateItem("unknown", 1, 1.0)));
+  TF_EXPECT_OK(writer->CreateItem("dist", 1, 1.0));
+}
+
+TEST(WriterTest, LocalWriterBlocksWhenMaxInFlightItemsReached) {
+  // Only a single item can be inserted before the table is sampled.
+  auto table =
+      MakeLocalTable(std::make_shared<RateLimiter>(1, 1, -DBL_MAX, 1));
+  auto writer = MakeLocalWriter(std::make_shared<ChunkStore>(), table,
+                                /*chunk_length=*/1, /*max_timesteps=*/1,
+                                /*max_in_flight_items=*/1);
+
+  // The second item is in flight until the table has been sampled.
+  TF_ASSERT_OK(writer->Append(MakeTimestep()));
+  TF_ASSERT_OK(writer->CreateItem("dist", 1, 1.0));
+  TF_ASSERT_OK(writer->Append(MakeTimestep()));
+  TF_ASSERT_OK(writer->CreateItem("dist", 1, 1.0));
+
+  absl::Notification notification;
+  auto thread = internal::StartThread("InsertItem", [&] {
+    TF_ASSERT_OK(writer->Append(MakeTimestep()));
+    TF_ASSERT_OK(writer->CreateItem("dist", 1, 1.0));
+    notification.Notify();
+  });
+  ASSERT_FALSE(
+      notification.WaitForNotificationWithTimeout(kNotificationTimeout));
+
+  Table::SampledItem sample;
+  TF_ASSERT_OK(table->Sample(&sample));
+  notification.WaitForNotification();
+
+  // Unblock the insertion of the last item.
+  TF_ASSERT_OK(table->Sample(&sample));
+  TF_EXPECT_OK(writer->Close());
+  EXPECT_EQ(table->size(), 1);
+}
+
 TEST(WriterTest, AppendSequenceBehavesLikeMutlipleAppendCalls) {
   const auto kBatchSize = 10;
   const auto kChunkLength = 5;
@@ -978,6 +1297,247 @@ TEST(WriterTest, AppendSequenceCalledWithNonEqualBatchSizes) {
           "1: Tensor<name: '', dtype: float, shape: [3]>."));
 }
 
+TEST(WriterTest, AsyncWriterSendsQueuedWorkOnFlush) {
+  std::vector<InsertStreamRequest> requests;
+  Writer writer(MakeGoodStub(&requests), /*chunk_length=*/2,
+                /*max_timesteps=*/4, /*delta_encoded=*/false,
+                /*signatures=*/nullptr, /*max_in_flight_items=*/absl::nullopt,
+                CODEC_SNAPPY, /*block_length=*/0, /*shared_memory=*/false,
+                /*max_pending_bytes=*/1024);
+
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.CreateItem("dist", 2, 1.0));
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.CreateItem("dist", 1, 2.0));
+  TF_ASSERT_OK(writer.Flush());
+
+  EXPECT_THAT(requests,
+              ElementsAre(IsChunk(),
+                          IsItemWithRangeAndPriorityAndTable(0, 2, 1.0, "dist"),
+                          IsChunk(),
+                          IsItemWithRangeAndPriorityAndTable(0, 1, 2.0,
+                                                             "dist")));
+  TF_ASSERT_OK(writer.Close());
+}
+
+TEST(WriterTest, AsyncWriterReturnsErrorOfQueuedWorkOnNextCall) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeFlakyStub(&requests, 0, 1, ToGrpcStatus(Internal("")));
+  Writer writer(stub, 2, 10, false, nullptr, absl::nullopt, CODEC_SNAPPY, 0,
+                false, /*max_pending_bytes=*/1024);
+
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  // The item is only queued so the error is returned by the next call.
+  TF_ASSERT_OK(writer.CreateItem("dist", 1, 1.0));
+  EXPECT_EQ(writer.Flush().code(), tensorflow::error::INTERNAL);
+  EXPECT_THAT(requests, SizeIs(1));
+
+  // The error is only returned once.
+  TF_EXPECT_OK(writer.Flush());
+}
+
+TEST(WriterTest, AsyncWriterBlocksWhenMaxPendingBytesReached) {
+  std::vector<InsertStreamRequest> requests;
+  auto pair = MakeStubWithExplicitResponseQueue(&requests);
+  auto response_ids = std::move(pair.second);
+  // Every timestep holds a single float so at most two are queued.
+  Writer writer(pair.first, 1, 2, false, nullptr, /*max_in_flight_items=*/1,
+                CODEC_SNAPPY, 0, false, /*max_pending_bytes=*/8);
+
+  // The worker blocks on the second item until the first one is confirmed.
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.CreateItem("dist", 1, 1.0));
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.CreateItem("dist", 1, 1.0));
+
+  absl::Notification notification;
+  auto thread = internal::StartThread("Append", [&writer, &notification] {
+    for (int i = 0; i < 3; i++) {
+      TF_ASSERT_OK(writer.Append(MakeTimestep()));
+    }
+    notification.Notify();
+  });
+
+  // Two timesteps fit in the budget but the third one has to wait.
+  ASSERT_FALSE(
+      notification.WaitForNotificationWithTimeout(kNotificationTimeout));
+
+  // Confirming the first item unblocks the worker and thus the append.
+  ASSERT_TRUE(response_ids->Push(1));
+  notification.WaitForNotification();
+
+  ASSERT_TRUE(response_ids->Push(2));
+  TF_ASSERT_OK(writer.Flush());
+}
+
+TEST(WriterTest, CompressionPoolProducesIdenticalChunks) {
+  auto pool = std::make_shared<internal::ThreadPool>(4, "WriterTest");
+  for (int block_length : {0, 3}) {
+    for (bool delta_encoded : {false, true}) {
+      std::vector<InsertStreamRequest> serial_requests;
+      std::vector<InsertStreamRequest> parallel_requests;
+      Writer serial(MakeGoodStub(&serial_requests), 5, 5, delta_encoded,
+                    nullptr, absl::nullopt, CODEC_SNAPPY, block_length);
+      Writer parallel(MakeGoodStub(&parallel_requests), 5, 5, delta_encoded,
+                      nullptr, absl::nullopt, CODEC_SNAPPY, block_length,
+                      /*shared_memory=*/false, /*max_pending_bytes=*/0, pool);
+
+      // Large enough for the columns to be compressed in parallel.
+      for (int t = 0; t < 5; t++) {
+        std::vector<tensorflow::Tensor> timestep;
+        for (int c = 0; c < 4; c++) {
+          tensorflow::Tensor tensor(tensorflow::DT_INT32, {64, 64});
+          for (int i = 0; i < tensor.NumElements(); i++) {
+            tensor.flat<int32_t>()(i) = (i % 97) * (c + 1) + t;
+          }
+          timestep.push_back(std::move(tensor));
+        }
+        TF_ASSERT_OK(serial.Append(timestep));
+        TF_ASSERT_OK(parallel.Append(std::move(timestep)));
+      }
+      TF_ASSERT_OK(serial.CreateItem("dist", 5, 1.0));
+      TF_ASSERT_OK(parallel.CreateItem("dist", 5, 1.0));
+
+      ASSERT_THAT(serial_requests, SizeIs(2));
+      ASSERT_THAT(parallel_requests, SizeIs(2));
+      EXPECT_EQ(serial_requests[0].chunk().data().SerializeAsString(),
+                parallel_requests[0].chunk().data().SerializeAsString());
+      EXPECT_EQ(parallel_requests[0].chunk().data().tensors_size(), 4);
+    }
+  }
+}
+
+TEST(WriterTest, ChunksAreCutAtMaxChunkBytes) {
+  std::vector<InsertStreamRequest> requests;
+  // Every timestep holds a single float so chunks are cut after 2 timesteps.
+  Writer writer(MakeGoodStub(&requests), /*chunk_length=*/10,
+                /*max_timesteps=*/10, false, nullptr, absl::nullopt,
+                CODEC_SNAPPY, 0, false, 0, nullptr, /*max_chunk_bytes=*/8);
+
+  for (int i = 0; i < 5; i++) {
+    TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  }
+  TF_ASSERT_OK(writer.CreateItem("dist", 5, 1.0));
+  EXPECT_THAT(requests, SizeIs(0));
+  TF_ASSERT_OK(writer.Flush());
+
+  ASSERT_THAT(requests,
+              ElementsAre(IsChunk(), IsChunk(), IsChunk(),
+                          IsItemWithRangeAndPriorityAndTable(0, 5, 1.0,
+                                                             "dist")));
+  EXPECT_EQ(requests[0].chunk().sequence_range().end(), 1);
+  EXPECT_EQ(requests[1].chunk().sequence_range().start(), 2);
+  EXPECT_EQ(requests[1].chunk().sequence_range().end(), 3);
+  EXPECT_EQ(requests[2].chunk().sequence_range().start(), 4);
+  EXPECT_EQ(requests[2].chunk().sequence_range().end(), 4);
+  EXPECT_EQ(requests[3].item().item().chunk_keys_size(), 3);
+}
+
+TEST(WriterTest, ItemsSpanChunksShorterThanChunkLength) {
+  std::vector<InsertStreamRequest> requests;
+  Writer writer(MakeGoodStub(&requests), /*chunk_length=*/2,
+                /*max_timesteps=*/4);
+
+  // Flushing cuts the first chunk after a single timestep.
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.CreateItem("dist", 1, 1.0));
+  TF_ASSERT_OK(writer.Flush());
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_ASSERT_OK(writer.CreateItem("dist", 3, 2.0));
+
+  ASSERT_THAT(requests, SizeIs(4));
+  EXPECT_THAT(requests[3],
+              IsItemWithRangeAndPriorityAndTable(0, 3, 2.0, "dist"));
+  EXPECT_THAT(requests[3].item().item().chunk_keys(),
+              ElementsAre(requests[0].chunk().chunk_key(),
+                          requests[2].chunk().chunk_key()));
+
+  // The oldest chunk is still kept as the newer one only covers 2 of the 4
+  // `max_timesteps`.
+  TF_ASSERT_OK(writer.CreateItem("dist", 2, 3.0));
+  EXPECT_THAT(requests[4],
+              IsItemWithRangeAndPriorityAndTable(0, 2, 3.0, "dist"));
+  EXPECT_THAT(requests[4].item().keep_chunk_keys(), SizeIs(2));
+}
+
+TEST(WriterTest, AppendRejectsTimestepsOfDifferentShapeWithinChunk) {
+  std::vector<InsertStreamRequest> requests;
+  Writer writer(MakeGoodStub(&requests), /*chunk_length=*/2,
+                /*max_timesteps=*/4);
+
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  const tensorflow::TensorShape vector_shape{2};
+  auto status = writer.Append(MakeTimestep(/*num_tensors=*/1, vector_shape));
+  EXPECT_EQ(status.code(), tensorflow::error::INVALID_ARGUMENT);
+  EXPECT_THAT(status.error_message(),
+              ::testing::HasSubstr("must have identical dtypes and shapes"));
+
+  // The shape may change once the chunk is complete.
+  TF_ASSERT_OK(writer.Append(MakeTimestep()));
+  TF_EXPECT_OK(writer.Append(MakeTimestep(/*num_tensors=*/1, vector_shape)));
+}
+
+TEST(WriterTest, AppendSequenceCutsSameChunksAsAppend) {
+  constexpr int kNumSteps = 10;
+
+  // The columns hold a distinct value for every timestep.
+  std::vector<std::vector<tensorflow::Tensor>> steps;
+  std::vector<tensorflow::Tensor> sequence = {
+      tensorflow::Tensor(tensorflow::DT_FLOAT, {kNumSteps}),
+      tensorflow::Tensor(tensorflow::DT_INT32, {kNumSteps, 2}),
+  };
+  for (int t = 0; t < kNumSteps; t++) {
+    sequence[0].flat<float>()(t) = t;
+    sequence[1].matrix<int32_t>()(t, 0) = 2 * t;
+    sequence[1].matrix<int32_t>()(t, 1) = 2 * t + 1;
+    steps.push_back({tensorflow::Tensor(static_cast<float>(t)),
+                     tensorflow::tensor::DeepCopy(sequence[1].SubSlice(t))});
+  }
+
+  // Every timestep holds 12 bytes so chunks are cut after 3 timesteps.
+  std::vector<InsertStreamRequest> simple_requests;
+  std::vector<InsertStreamRequest> batch_requests;
+  Writer simple_writer(MakeGoodStub(&simple_requests), /*chunk_length=*/4,
+                       kNumSteps, false, nullptr, absl::nullopt, CODEC_SNAPPY,
+                       0, false, 0, nullptr, /*max_chunk_bytes=*/30);
+  Writer batch_writer(MakeGoodStub(&batch_requests), /*chunk_length=*/4,
+                      kNumSteps, false, nullptr, absl::nullopt, CODEC_SNAPPY,
+                      0, false, 0, nullptr, /*max_chunk_bytes=*/30);
+
+  for (const auto& step : steps) {
+    TF_ASSERT_OK(simple_writer.Append(step));
+  }
+  TF_ASSERT_OK(batch_writer.AppendSequence(sequence));
+  TF_ASSERT_OK(simple_writer.CreateItem("dist", kNumSteps, 1.0));
+  TF_ASSERT_OK(batch_writer.CreateItem("dist", kNumSteps, 1.0));
+  TF_ASSERT_OK(simple_writer.Flush());
+  TF_ASSERT_OK(batch_writer.Flush());
+
+  ASSERT_THAT(simple_requests, SizeIs(5));
+  ASSERT_THAT(batch_requests, SizeIs(5));
+  for (int i = 0; i < 4; i++) {
+    const auto& simple_chunk = simple_requests[i].chunk();
+    EXPECT_THAT(batch_requests[i].chunk().sequence_range(),
+                testing::EqualsProto(simple_chunk.sequence_range()));
+    EXPECT_EQ(batch_requests[i].chunk().data().SerializeAsString(),
+              simple_chunk.data().SerializeAsString());
+  }
+  EXPECT_EQ(batch_requests[3].chunk().sequence_range().start(), 9);
+
+  // The second chunk holds the timesteps [3, 6).
+  tensorflow::Tensor column;
+  TF_ASSERT_OK(DecompressTensorFromProto(
+      batch_requests[1].chunk().data().tensors(1), CODEC_SNAPPY, &column));
+  ASSERT_EQ(column.dim_size(0), 3);
+  for (int t = 0; t < 3; t++) {
+    EXPECT_EQ(column.matrix<int32_t>()(t, 0), 2 * (t + 3));
+    EXPECT_EQ(column.matrix<int32_t>()(t, 1), 2 * (t + 3) + 1);
+  }
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
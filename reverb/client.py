@@ -74,7 +74,7 @@ trajectories then the `insert`-method should be used.
 
 """
 
-from typing import Any, Dict, Generator, List, Optional
+from typing import Any, Dict, Generator, List, Optional, Sequence, Tuple
 
 from absl import logging
 from reverb import errors
@@ -86,6 +86,9 @@ import tree
 from reverb.cc import schema_pb2
 from tensorflow.python.saved_model import nested_structure_coder  # pylint: disable=g-direct-tensorflow-import
 
+# Codecs which can be passed to `Client.writer`.
+_CODECS = ('snappy', 'zstd', 'lz4', 'temporal', 'none')
+
 
 class Writer:
   """Writer is used for streaming data of arbitrary length.
@@ -203,7 +206,56 @@ class Writer:
     """
     self._writer.AppendSequence(tree.flatten(sequence))
 
-  def create_item(self, table: str, num_timesteps: int, priority: float):
+  def append_batch(self,
+                   sequence: Any,
+                   items: Sequence[Tuple[int, str, int, float]] = ()):
+    """Appends a sequence of data and creates items in between its steps.
+
+    A call to `append_batch` is equivalent to calling `append` for each step of
+    `sequence` (see `append_sequence`) and `create_item` right after the step
+    for each of its items, but only crosses into C++ (and releases the GIL)
+    once. This is useful for actors which step many environments at a time.
+
+    For example:
+
+    ```python
+
+      with client.writer(max_sequence_length=2) as writer:
+        sequence = np.array([[1, 2, 3],
+                             [4, 5, 6]])
+
+        # Insert two timesteps, create an item that references [1, 2, 3] once
+        # the first has been inserted and one that references both steps once
+        # the second has been inserted.
+        writer.append_batch([sequence], items=[(0, 'my_table', 1, 1.0),
+                                               (1, 'my_table', 2, 1.0)])
+
+    ```
+
+    Args:
+      sequence: Batched (possibly nested) structure to make available for items
+        to reference.
+      items: (step, table, num_timesteps, priority) tuples of the items to
+        create. `step` is the index into `sequence` of the step after which the
+        item is created. See `create_item` for the other fields.
+
+    Raises:
+      ValueError: If the num_timesteps of any item is < 1, if `step` is out of
+        range for any item or if the elements of `sequence` do not share the
+        same leading dimension.
+      StatusNotOk: See `create_item`.
+    """
+    for _, _, num_timesteps, _ in items:
+      if num_timesteps < 1:
+        raise ValueError(
+            'num_timesteps (%d) must be a positive integer' % num_timesteps)
+    self._writer.AppendBatch(tree.flatten(sequence), list(items))
+
+  def create_item(self,
+                  table: str,
+                  num_timesteps: int,
+                  priority: float,
+                  columns: Optional[List[int]] = None):
     """Creates an item and sends it to the ReverbService.
 
     This method is what effectively makes data available for sampling. See the
@@ -218,15 +270,24 @@ class Writer:
         item should reference.
       priority: The priority used for determining the sample probability of the
         new item.
+      columns: Indices into the flattened structure of the appended timesteps
+        which the item references, in the order that they should be sampled.
+        Only these columns are validated against the signature of `table` and
+        sent to the samplers of the item, while the data is still stored once
+        and shared with the items of other tables. If None then the item
+        references every column.
 
     Raises:
-      ValueError: If num_timesteps is < 1.
+      ValueError: If num_timesteps is < 1 or if `columns` is empty.
       StatusNotOk: If num_timesteps is > than the timesteps currently available
-        in the buffer.
+        in the buffer or if `columns` holds invalid or repeated indices.
     """
     if num_timesteps < 1:
       raise ValueError('num_timesteps (%d) must be a positive integer')
-    self._writer.CreateItem(table, num_timesteps, priority)
+    if columns is not None and not columns:
+      raise ValueError('columns must be None or a non-empty list of indices.')
+    self._writer.CreateItem(table, num_timesteps, priority,
+                            list(columns or []))
 
   def flush(self):
     """Flushes the stream to the ReverbService.
@@ -261,6 +322,106 @@ class Writer:
     self._writer.Close(retry_on_unavailable)
 
 
+def _next_sequence(
+    sampler: pybind.Sampler) -> List[replay_sample.ReplaySample]:
+  """Returns the timesteps of the next sample of `sampler`."""
+  sequence = []
+  last = False
+  while not last:
+    step, last = sampler.GetNextTimestep()
+    key = int(step[0])
+    probability = float(step[1])
+    table_size = int(step[2])
+    priority = float(step[3])
+    data = step[4:]
+    sequence.append(
+        replay_sample.ReplaySample(
+            info=replay_sample.SampleInfo(key, probability, table_size,
+                                          priority),
+            data=data))
+  return sequence
+
+
+class Sampler:
+  """Sampler streams samples from a table and updates the sampled items.
+
+  Unlike `Client.mutate_priorities`, the updates of `mutate_priorities` don't
+  need a call of their own. They are sent with the next request of the stream
+  and applied together with the batch it samples.
+
+  See Client.sampler for documentation.
+  """
+
+  def __init__(self, internal_sampler: pybind.Sampler):
+    """Constructor for Sampler (must only be called by Client.sampler)."""
+    self._sampler = internal_sampler
+    self._closed = False
+
+  def __enter__(self) -> 'Sampler':
+    if self._closed:
+      raise ValueError('Cannot reuse already closed Sampler')
+    return self
+
+  def __exit__(self, *_):
+    self.close()
+
+  def __del__(self):
+    if not self._closed:
+      self.close()
+
+  def sample(self) -> List[replay_sample.ReplaySample]:
+    """Blocks until the next sample is received and returns its timesteps.
+
+    See `Client.sample` for the layout of the sample.
+    """
+    return _next_sequence(self._sampler)
+
+  def sample_batch(self, batch_size: int) -> replay_sample.ReplaySample:
+    """Blocks until the next `batch_size` samples are received.
+
+    See `Client.sample_batch` for the layout of the batch.
+
+    Args:
+      batch_size: The number of items in the batch.
+
+    Returns:
+      A `ReplaySample` whose info fields have shape [batch_size] and whose data
+      has shape [batch_size, sequence_length, ...].
+    """
+    batch = self._sampler.GetNextBatch(batch_size)
+    return replay_sample.ReplaySample(
+        info=replay_sample.SampleInfo(*batch[:4]), data=batch[4:])
+
+  def mutate_priorities(self,
+                        updates: Dict[int, float] = None,
+                        deletes: List[int] = None):
+    """Queues updates and/or deletions of items of the table.
+
+    The mutations are sent with the next request of the stream, i.e once the
+    samples which have already been requested are used up, and applied before
+    the items of that request are sampled. They are dropped if the request
+    fails or if the sampler is closed before another request is sent.
+
+    Args:
+      updates: Mapping from priority item key to new priority value. If a key
+        cannot be found then it is ignored.
+      deletes: List of keys for priority items to delete. If a key cannot be
+        found then it is ignored.
+    """
+    if updates is None:
+      updates = {}
+    if deletes is None:
+      deletes = []
+    self._sampler.MutatePriorities(list(updates.items()), deletes)
+
+  def close(self):
+    """Closes the stream and cancels any blocked `sample` calls."""
+    if self._closed:
+      return
+    self._closed = True
+    self._sampler.Close()
+
+
 class Client:
   """Client for interacting with a Reverb ReverbService from Python.
 
@@ -315,7 +476,11 @@ class Client:
              max_sequence_length: int,
              delta_encoded: bool = False,
              chunk_length: Optional[int] = None,
-             max_in_flight_items: Optional[int] = None) -> Writer:
+             max_in_flight_items: Optional[int] = None,
+             codec: str = 'snappy',
+             block_length: int = 0,
+             max_pending_bytes: int = 0,
+             max_chunk_bytes: int = 0) -> Writer:
     """Constructs a writer with a `max_sequence_length` buffer.
 
     The writer can be used to stream data of any length. `max_sequence_length`
@@ -354,6 +519,32 @@ class Client:
         NOT include items that are in the client buffer due to the current chunk
         not having reached its desired length yet. None (default) result in an
         unlimited number of "in flight" items.
+      codec: Codec used to compress the tensors of the chunks. One of
+        'snappy' (default), 'zstd', 'lz4', 'temporal' or 'none'. 'zstd'
+        compresses images considerably better than 'snappy' at the cost of more
+        CPU while 'none' avoids spending CPU on data that does not compress
+        well, e.g low dimensional float states. 'temporal' compresses the
+        difference between consecutive timesteps with zstd, which suits stacks
+        of uint8 image frames. Use it together with `block_length` to keep
+        the cost of sampling short items low.
+      block_length: If > 0 then the timesteps of each chunk are compressed in
+        blocks of `block_length` timesteps. Samples then only transmit and
+        decompress the blocks they overlap with rather than the entire chunk,
+        which helps when items are much shorter than `chunk_length` (e.g with
+        overlapping windows). 0 (default) compresses each chunk as a whole.
+      max_pending_bytes: If > 0 then the writer is asynchronous. `append`,
+        `append_sequence` and `create_item` then only queue their work, and
+        the chunks are batched, compressed and sent to the server by a
+        background thread. The calls block while the queued timesteps hold
+        more than `max_pending_bytes` bytes and `flush` waits for all queued
+        work to be done. Errors are raised by the call following the one
+        which queued the failed work. 0 (default) does all work in the calling
+        thread.
+      max_chunk_bytes: If > 0 then a chunk is also cut once the (uncompressed)
+        tensors of its timesteps hold at least `max_chunk_bytes` bytes, even if
+        it has fewer than `chunk_length` timesteps. Keeps the chunks of large
+        observations small without making those of small observations tiny.
+        0 (default) cuts chunks after exactly `chunk_length` timesteps.
 
     Returns:
       A `Writer` with `max_sequence_length`.
@@ -363,6 +554,10 @@ class Client:
       ValueError: if chunk_length > max_sequence_length.
       ValueError: if chunk_length < 1.
       ValueError: If max_in_flight_items < 1.
+      ValueError: If codec is not one of the supported codecs.
+      ValueError: If block_length < 0.
+      ValueError: If max_pending_bytes < 0.
+      ValueError: If max_chunk_bytes < 0.
     """
     if max_sequence_length < 1:
       raise ValueError('max_sequence_length (%d) must be a positive integer' %
@@ -381,9 +576,24 @@ class Client:
           f'max_in_flight_items ({max_in_flight_items}) must be None or a '
           f'positive integer')
 
+    if codec not in _CODECS:
+      raise ValueError(
+          f'codec ({codec}) must be one of {", ".join(_CODECS)}')
+
+    if block_length < 0:
+      raise ValueError(f'block_length ({block_length}) must be >= 0')
+
+    if max_pending_bytes < 0:
+      raise ValueError(
+          f'max_pending_bytes ({max_pending_bytes}) must be >= 0')
+
+    if max_chunk_bytes < 0:
+      raise ValueError(f'max_chunk_bytes ({max_chunk_bytes}) must be >= 0')
+
     return Writer(
         self._client.NewWriter(chunk_length, max_sequence_length, delta_encoded,
-                               max_in_flight_items))
+                               max_in_flight_items, codec, block_length,
+                               max_pending_bytes, max_chunk_bytes))
 
   def sample(
       self,
@@ -434,23 +644,92 @@ class Client:
                                       validation_timeout_ms)
 
     for _ in range(num_samples):
-      sequence = []
-      last = False
-
-      while not last:
-        step, last = sampler.GetNextTimestep()
-        key = int(step[0])
-        probability = float(step[1])
-        table_size = int(step[2])
-        priority = float(step[3])
-        data = step[4:]
-        sequence.append(
-            replay_sample.ReplaySample(
-                info=replay_sample.SampleInfo(key, probability, table_size,
-                                              priority),
-                data=data))
-
-      yield sequence
+      yield _next_sequence(sampler)
+
+  def sample_batch(
+      self,
+      table: str,
+      batch_size: int,
+      num_batches: int = 1,
+      validation_timeout_ms: int = 3000
+  ) -> Generator[replay_sample.ReplaySample, None, None]:
+    """Samples `num_batches` batches of `batch_size` items from `table`.
+
+    Unlike `sample`, the samples of a batch are fetched with a single call into
+    C++ and returned as stacked numpy arrays. All the items of a batch must
+    have the same length.
+
+    Args:
+      table: Name of the priority table to sample from.
+      batch_size: The number of items in each batch.
+      num_batches: (default to 1) The number of batches to fetch.
+      validation_timeout_ms: See `sample`.
+
+    Yields:
+      `ReplaySample`s whose info fields have shape [batch_size] and whose data
+      has shape [batch_size, sequence_length, ...].
+
+    Raises:
+      ValueError: If `batch_size` or `num_batches` is < 1.
+    """
+    if batch_size < 1:
+      raise ValueError(f'batch_size ({batch_size}) must be a positive integer')
+    if num_batches < 1:
+      raise ValueError(
+          f'num_batches ({num_batches}) must be a positive integer')
+    sampler = self._client.NewSampler(table, batch_size * num_batches,
+                                      batch_size, validation_timeout_ms)
+    for _ in range(num_batches):
+      batch = sampler.GetNextBatch(batch_size)
+      yield replay_sample.ReplaySample(
+          info=replay_sample.SampleInfo(*batch[:4]), data=batch[4:])
+
+  def sampler(self,
+              table: str,
+              max_samples: int = -1,
+              buffer_size: int = 1,
+              validation_timeout_ms: int = 3000) -> Sampler:
+    """Constructs a sampler which keeps a stream to `table` open.
+
+    Unlike `sample`, the returned `Sampler` can send priority updates of the
+    items it has sampled on its stream (see `Sampler.mutate_priorities`). Its
+    stream is closed by `close`, or when leaving its contextmanager scope:
+
+    ```python
+
+        with client.sampler('my_table') as sampler:
+          for _ in range(num_steps):
+            sample = sampler.sample()
+            sampler.mutate_priorities(
+                updates={sample[0].info.key: calc_priority(sample)})
+
+    ```
+
+    Args:
+      table: Name of the priority table to sample from.
+      max_samples: The maximum number of samples to fetch. -1 (default) means
+        unlimited.
+      buffer_size: The number of samples each worker of the sampler requests
+        at a time. Mutations are sent with the next request, so smaller
+        buffers apply them sooner.
+      validation_timeout_ms: See `sample`.
+
+    Returns:
+      A `Sampler` of `table`.
+
+    Raises:
+      ValueError: If `max_samples` is neither -1 nor positive, or if
+        `buffer_size` is < 1.
+    """
+    if max_samples != -1 and max_samples < 1:
+      raise ValueError(
+          f'max_samples ({max_samples}) must be -1 or a positive integer')
+    if buffer_size < 1:
+      raise ValueError(
+          f'buffer_size ({buffer_size}) must be a positive integer')
+    return Sampler(
+        self._client.NewSampler(table, max_samples, buffer_size,
+                                validation_timeout_ms))
 
   def mutate_priorities(self,
                         table: str,
@@ -29,6 +29,7 @@ from reverb import server
 import tensorflow.compat.v1 as tf
 
 TABLE_NAME = 'table'
+UNTYPED_TABLE_NAME = 'untyped_table'
 
 
 class ClientTest(absltest.TestCase):
@@ -46,12 +47,20 @@ class ClientTest(absltest.TestCase):
                 rate_limiter=rate_limiters.MinSize(3),
                 signature=tf.TensorSpec(dtype=tf.int64, shape=()),
             ),
+            server.Table(
+                name=UNTYPED_TABLE_NAME,
+                sampler=item_selectors.Uniform(),
+                remover=item_selectors.Fifo(),
+                max_size=1000,
+                rate_limiter=rate_limiters.MinSize(1),
+            ),
         ],
         port=None)
     cls.client = client.Client(f'localhost:{cls.server.port}')
 
   def tearDown(self):
     self.client.reset(TABLE_NAME)
+    self.client.reset(UNTYPED_TABLE_NAME)
     super().tearDown()
 
   @classmethod
@@ -145,6 +154,91 @@ class ClientTest(absltest.TestCase):
     with self.assertRaises(ValueError):
       self.client.writer(1, max_in_flight_items=-1)
 
+  def test_writer_raises_if_codec_unknown(self):
+    with self.assertRaises(ValueError):
+      self.client.writer(1, codec='gzip')
+
+  def test_writer_with_codec(self):
+    for codec in ('none', 'snappy', 'zstd', 'lz4', 'temporal'):
+      with self.client.writer(2, codec=codec) as writer:
+        writer.append([np.arange(100, dtype=np.int32)])
+        writer.create_item(UNTYPED_TABLE_NAME, 1, 1.0)
+
+      sample = next(self.client.sample(UNTYPED_TABLE_NAME, 1))[0]
+      np.testing.assert_array_equal(sample.data[0],
+                                    np.arange(100, dtype=np.int32))
+      self.client.reset(UNTYPED_TABLE_NAME)
+
+  def test_writer_raises_if_block_length_negative(self):
+    with self.assertRaises(ValueError):
+      self.client.writer(1, block_length=-1)
+
+  def test_writer_with_block_length(self):
+    with self.client.writer(10, chunk_length=10, delta_encoded=True,
+                            block_length=3) as writer:
+      for i in range(10):
+        writer.append([np.full((2, 2), i, dtype=np.int32)])
+      writer.create_item(UNTYPED_TABLE_NAME, 4, 1.0)
+
+    sample = next(self.client.sample(UNTYPED_TABLE_NAME, 1))
+    self.assertLen(sample, 4)
+    for i, step in enumerate(sample):
+      np.testing.assert_array_equal(step.data[0],
+                                    np.full((2, 2), 6 + i, dtype=np.int32))
+
+  def test_writer_raises_if_max_pending_bytes_negative(self):
+    with self.assertRaises(ValueError):
+      self.client.writer(1, max_pending_bytes=-1)
+
+  def test_async_writer(self):
+    with self.client.writer(4, chunk_length=2,
+                            max_pending_bytes=1024) as writer:
+      for i in range(4):
+        writer.append([i])
+      for _ in range(3):
+        writer.create_item(TABLE_NAME, 3, 1.0)
+
+    sample = next(self.client.sample(TABLE_NAME, 1))
+    self.assertLen(sample, 3)
+    for i, step in enumerate(sample):
+      self.assertEqual(step.data[0], 1 + i)
+
+  def test_writer_raises_if_max_chunk_bytes_negative(self):
+    with self.assertRaises(ValueError):
+      self.client.writer(1, max_chunk_bytes=-1)
+
+  def test_writer_with_max_chunk_bytes(self):
+    # Chunks are cut after every timestep as each one holds 8 bytes.
+    with self.client.writer(5, chunk_length=5, max_chunk_bytes=8) as writer:
+      for i in range(5):
+        writer.append([i])
+      for _ in range(3):
+        writer.create_item(TABLE_NAME, 3, 1.0)
+
+    sample = next(self.client.sample(TABLE_NAME, 1))
+    self.assertLen(sample, 3)
+    for i, step in enumerate(sample):
+      self.assertEqual(step.data[0], 2 + i)
+
+  def test_writer_raises_if_columns_empty(self):
+    with self.client.writer(1) as writer:
+      writer.append([0])
+      with self.assertRaises(ValueError):
+        writer.create_item(TABLE_NAME, 1, 1.0, columns=[])
+
+  def test_writer_create_item_with_columns(self):
+    # The table only holds the second (int64) column of the timesteps. Three
+    # items are created as the table can't be sampled before that.
+    with self.client.writer(1) as writer:
+      writer.append([np.zeros([100], np.float32), 7])
+      for _ in range(3):
+        writer.create_item(TABLE_NAME, 1, 1.0, columns=[1])
+
+    sample = next(self.client.sample(TABLE_NAME, 1))
+    self.assertLen(sample, 1)
+    self.assertLen(sample[0].data, 1)
+    self.assertEqual(sample[0].data[0], 7)
+
   def test_writer_works_with_no_retries(self):
     # If the server responds correctly, the writer ignores the no retries arg.
     writer = self.client.writer(2)
@@ -168,6 +262,56 @@ class ClientTest(absltest.TestCase):
     for freq in freqs:
       self.assertAlmostEqual(freq, 0.25, delta=0.05)
 
+  def test_writer_append_batch(self):
+    # Items of length 2 are created after every step but the first, plus a
+    # single step item after the first.
+    items = [(0, TABLE_NAME, 1, 1.0)]
+    items += [(i, TABLE_NAME, 2, 1.0) for i in range(1, 4)]
+    with self.client.writer(2) as writer:
+      writer.append_batch([np.arange(4)], items=items[::-1])
+
+    sequences = set()
+    for sample in self.client.sample(TABLE_NAME, 100):
+      sequences.add(tuple(int(step.data[0]) for step in sample))
+    self.assertEqual(sequences, {(0,), (0, 1), (1, 2), (2, 3)})
+
+  def test_writer_append_batch_without_items(self):
+    with self.client.writer(3) as writer:
+      writer.append_batch([np.arange(3)])
+      writer.create_item(TABLE_NAME, 3, 1.0)
+      writer.create_item(TABLE_NAME, 2, 1.0)
+      writer.create_item(TABLE_NAME, 1, 1.0)
+
+    self.assertLen(self._get_sample_frequency(100), 3)
+
+  def test_writer_append_batch_raises_if_step_out_of_range(self):
+    with self.client.writer(2) as writer:
+      with self.assertRaises(ValueError):
+        writer.append_batch([np.arange(2)], items=[(2, TABLE_NAME, 1, 1.0)])
+
+  def test_writer_append_batch_raises_if_num_timesteps_lt_1(self):
+    with self.client.writer(2) as writer:
+      with self.assertRaises(ValueError):
+        writer.append_batch([np.arange(2)], items=[(0, TABLE_NAME, 0, 1.0)])
+
+  def test_sample_batch(self):
+    with self.client.writer(2) as writer:
+      for i in range(3):
+        writer.append_sequence([np.array([2 * i, 2 * i + 1])])
+        writer.create_item(TABLE_NAME, 2, 1.0)
+
+    batches = list(self.client.sample_batch(TABLE_NAME, 4, num_batches=2))
+    self.assertLen(batches, 2)
+    for batch in batches:
+      self.assertEqual(batch.info.key.shape, (4,))
+      self.assertEqual(batch.data[0].shape, (4, 2))
+      np.testing.assert_array_equal(batch.data[0][:, 1] - batch.data[0][:, 0],
+                                    np.ones(4))
+
+  def test_sample_batch_raises_if_batch_size_lt_1(self):
+    with self.assertRaises(ValueError):
+      next(self.client.sample_batch(TABLE_NAME, 0))
+
   def test_mutate_priorities_update(self):
     self.client.insert([0], {TABLE_NAME: 1.0})
     self.client.insert([0], {TABLE_NAME: 1.0})
@@ -202,6 +346,36 @@ class ClientTest(absltest.TestCase):
     after = self._get_sample_frequency()
     self.assertLen(after, 3)
 
+  def test_sampler_sends_mutations_on_stream(self):
+    # One more item than the rate limiter needs so the deletion doesn't block
+    # sampling.
+    for i in range(4):
+      self.client.insert(i, {TABLE_NAME: 1.0})
+
+    with self.client.sampler(TABLE_NAME) as sampler:
+      key = sampler.sample()[0].info.key
+      sampler.mutate_priorities(updates={key: 0.5})
+
+      # The update is applied with a later request of the stream.
+      for _ in range(1000):
+        sample = sampler.sample()[0]
+        if sample.info.key == key and sample.info.priority == 0.5:
+          break
+      else:
+        self.fail('The priority update was never applied.')
+
+      sampler.mutate_priorities(deletes=[key])
+      for _ in range(1000):
+        self.assertLen(sampler.sample(), 1)
+        if self.client.server_info()[TABLE_NAME].current_size == 3:
+          break
+      else:
+        self.fail('The item was never deleted.')
+
+  def test_sampler_raises_if_buffer_size_lt_1(self):
+    with self.assertRaises(ValueError):
+      self.client.sampler(TABLE_NAME, buffer_size=0)
+
   def test_reset(self):
     self.client.insert([0], {TABLE_NAME: 1.0})
     self.client.insert([0], {TABLE_NAME: 1.0})
@@ -228,7 +402,7 @@ class ClientTest(absltest.TestCase):
     self.client.insert([0], {TABLE_NAME: 1.0})
     self.client.insert([0], {TABLE_NAME: 1.0})
     server_info = self.client.server_info()
-    self.assertLen(server_info, 1)
+    self.assertLen(server_info, 2)
     self.assertIn(TABLE_NAME, server_info)
     info = server_info[TABLE_NAME]
     self.assertEqual(info.current_size, 3)
@@ -15,7 +15,7 @@
 
 """TFClient provides tf-ops for interacting with Reverb."""
 
-from typing import Any, List, Optional, Union
+from typing import Any, List, Mapping, Optional, Sequence, Union
 
 from reverb import client as reverb_client
 from reverb import replay_sample
@@ -48,8 +48,8 @@ class ReplayDataset(tf.data.Dataset):
   """
 
   def __init__(self,
-               server_address: Union[str, tf.Tensor],
-               table: Union[str, tf.Tensor],
+               server_address: Union[str, tf.Tensor, Sequence[str]],
+               table: Union[str, tf.Tensor, Mapping[str, float]],
                dtypes: Any,
                shapes: Any,
                max_in_flight_samples_per_worker: int,
@@ -58,12 +58,25 @@ class ReplayDataset(tf.data.Dataset):
                sequence_length: Optional[int] = None,
                emit_timesteps: bool = True,
                rate_limiter_timeout_ms: int = -1,
-               flexible_batch_size: int = -1):
+               flexible_batch_size: int = -1,
+               batch_size: Optional[int] = None,
+               drop_remainder: bool = False,
+               max_samples: int = -1,
+               pinned_memory: bool = False):
     """Constructs a new ReplayDataset.
 
     Args:
-      server_address: Address of gRPC ReverbService.
-      table: Probability table to sample from.
+      server_address: Address of gRPC ReverbService. Alternatively a sequence of
+        the addresses of several servers, which must share the signature of
+        `table`, to sample from. Each iterator then keeps streams open to all
+        of the servers and merges their samples into a single queue, sending
+        more requests to the servers whose table holds more items. Cannot be
+        combined with a mapping of `table`s.
+      table: Probability table to sample from. Alternatively a mapping from the
+        names of several tables, which must share the same signature, to the
+        weights in proportion to which their samples are mixed. The mixing is
+        done by the server so the samples of all tables are fetched over a
+        single stream per worker.
       dtypes: Dtypes of the data output. Can be nested.
       shapes: Shapes of the data output. Can be nested.
       max_in_flight_samples_per_worker: The number of samples requested in each
@@ -107,7 +120,26 @@ class ReplayDataset(tf.data.Dataset):
         Larger `flexible_batch_size` values result a bias towards sampling over
         inserts. In highly overloaded systems this results in higher sample QPS
         and lower insert QPS compared to lower `flexible_batch_size` values.
-
+      batch_size: (Defaults to None, i.e. not batched) If set, each element of
+        the dataset holds `batch_size` complete sequences which are written
+        directly into tensors of shape `[batch_size, sequence_length, ...]`.
+        This avoids the copies made by a subsequent `Dataset.batch`. The info
+        fields have shape `[batch_size]`. Requires `emit_timesteps` to be False.
+        The last batch holds fewer samples if `max_samples` is reached or the
+        rate limiter times out halfway through it so, as with `Dataset.batch`,
+        the batch dimension is only known statically if `drop_remainder` is
+        set.
+      drop_remainder: (Defaults to False) If set, a last batch which holds fewer
+        than `batch_size` samples is dropped. Requires `batch_size` to be set.
+      max_samples: (Defaults to -1, i.e unlimited) The number of elements each
+        iterator returns before the end of the sequence. Elements are batches if
+        `batch_size` is set and samples (not timesteps) otherwise.
+      pinned_memory: (Defaults to False) If set, the samples are decompressed
+        into tensors allocated from pinned host memory, which GPUs can copy
+        from without staging the tensors in another buffer first. Has no effect
+        if there is no GPU. Combine with
+        `tf.data.experimental.prefetch_to_device` to overlap the copy of a
+        batch to the device with the decoding of the next ones.
 
     Raises:
       ValueError: If `dtypes` and `shapes` don't share the same structure.
@@ -120,8 +152,38 @@ class ReplayDataset(tf.data.Dataset):
         `sequence_length` as its leading dimension.
       ValueError: If `rate_limiter_timeout_ms < -1`.
       ValueError: If `flexible_batch_size` is not a positive integer or -1.
+      ValueError: If `batch_size` is not a positive integer or None.
+      ValueError: If `batch_size` is set and `emit_timesteps is True`.
+      ValueError: If `drop_remainder` is set but `batch_size` is not.
+      ValueError: If `max_samples` is not a positive integer or -1.
+      ValueError: If `table` is an empty mapping or holds a weight <= 0.
+      ValueError: If `server_address` is an empty sequence.
+      ValueError: If `server_address` is a sequence and `table` a mapping.
     """
     tree.assert_same_structure(dtypes, shapes, False)
+    server_addresses = []
+    if isinstance(server_address, (list, tuple)):
+      if not server_address:
+        raise ValueError('server_address must not be an empty sequence')
+      if isinstance(table, Mapping):
+        raise ValueError(
+            'table must not be a mapping when server_address is a sequence')
+      server_addresses = list(server_address)
+      server_address = ''
+
+    mixed_tables = []
+    mixed_table_weights = []
+    if isinstance(table, Mapping):
+      if not table:
+        raise ValueError('table must not be an empty mapping')
+      for name, weight in sorted(table.items()):
+        if weight <= 0:
+          raise ValueError(
+              'Weight of table %s (%s) must be positive' % (name, weight))
+        mixed_tables.append(name)
+        mixed_table_weights.append(float(weight))
+      table = ''
+
     if max_in_flight_samples_per_worker < 1:
       raise ValueError(
           'max_in_flight_samples_per_worker (%d) must be a positive integer' %
@@ -145,6 +207,16 @@ class ReplayDataset(tf.data.Dataset):
       raise ValueError(
           'flexible_batch_size (%d) must be a positive integer or -1' %
           flexible_batch_size)
+    if batch_size is not None and batch_size < 1:
+      raise ValueError(
+          'batch_size (%s) must be None or a positive integer' % batch_size)
+    if batch_size is not None and emit_timesteps:
+      raise ValueError('emit_timesteps must be False when batch_size is set')
+    if drop_remainder and batch_size is None:
+      raise ValueError('drop_remainder can only be set when batch_size is set')
+    if max_samples < 1 and max_samples != -1:
+      raise ValueError(
+          'max_samples (%d) must be a positive integer or -1' % max_samples)
 
     # Add the info fields.
     dtypes = replay_sample.ReplaySample(replay_sample.SampleInfo.tf_dtypes(),
@@ -171,13 +243,24 @@ class ReplayDataset(tf.data.Dataset):
 
       tree.map_structure_with_path(_validate_batch_dim, shapes.data)
 
+    # Batches hold a single info value per sequence and prepend the batch
+    # dimension to the data.
+    if batch_size is not None:
+      batch_dim = tf.TensorShape([batch_size if drop_remainder else None])
+      shapes = replay_sample.ReplaySample(
+          replay_sample.SampleInfo(batch_dim, batch_dim, batch_dim, batch_dim),
+          tree.map_structure(batch_dim.concatenate, shapes.data))
+
     # The tf.data API doesn't fully support lists so we convert all uses of
     # lists into tuples.
     dtypes = _convert_lists_to_tuples(dtypes)
     shapes = _convert_lists_to_tuples(shapes)
 
     self._server_address = server_address
+    self._server_addresses = server_addresses
     self._table = table
+    self._mixed_tables = mixed_tables
+    self._mixed_table_weights = mixed_table_weights
     self._dtypes = dtypes
     self._shapes = shapes
     self._sequence_length = sequence_length
@@ -186,6 +269,10 @@ class ReplayDataset(tf.data.Dataset):
     self._num_workers_per_iterator = num_workers_per_iterator
     self._max_samples_per_stream = max_samples_per_stream
     self._rate_limiter_timeout_ms = rate_limiter_timeout_ms
+    self._batch_size = batch_size
+    self._drop_remainder = drop_remainder
+    self._max_samples = max_samples
+    self._pinned_memory = pinned_memory
 
     if _is_tf1_runtime():
       # Disabling to avoid errors given the different tf.data.Dataset init args
@@ -199,7 +286,7 @@ class ReplayDataset(tf.data.Dataset):
 
   @classmethod
   def from_table_signature(cls,
-                           server_address: str,
+                           server_address: Union[str, Sequence[str]],
                            table: str,
                            max_in_flight_samples_per_worker: int,
                            num_workers_per_iterator: int = -1,
@@ -208,14 +295,20 @@ class ReplayDataset(tf.data.Dataset):
                            emit_timesteps: bool = True,
                            rate_limiter_timeout_ms: int = -1,
                            get_signature_timeout_secs: Optional[int] = None,
-                           flexible_batch_size: int = -1):
+                           flexible_batch_size: int = -1,
+                           batch_size: Optional[int] = None,
+                           drop_remainder: bool = False,
+                           max_samples: int = -1,
+                           pinned_memory: bool = False):
     """Constructs a ReplayDataset using the table's signature to infer specs.
 
     Note: The signature must be provided to `Table` at construction. See
     `Table.__init__` (./server.py) for more details.
 
     Args:
-      server_address: Address of gRPC ReverbService.
+      server_address: Address of gRPC ReverbService. See __init__ for sampling
+        from several servers, in which case the signature is read from the
+        first one.
       table: Table to read the signature and sample from.
       max_in_flight_samples_per_worker: See __init__ for details.
       num_workers_per_iterator: See __init__ for details.
@@ -227,6 +320,10 @@ class ReplayDataset(tf.data.Dataset):
         respond when fetching the table signature. By default no timeout is set
         and the call will block indefinitely if the server does not respond.
       flexible_batch_size: See __init__ for details.
+      batch_size: See __init__ for details.
+      drop_remainder: See __init__ for details.
+      max_samples: See __init__ for details.
+      pinned_memory: See __init__ for details.
 
     Returns:
       ReplayDataset using the specs defined by the table signature to build
@@ -239,16 +336,22 @@ class ReplayDataset(tf.data.Dataset):
         exceeded.
       ValueError: See __init__.
     """
-    client = reverb_client.Client(server_address)
+    signature_address = server_address
+    if isinstance(server_address, (list, tuple)):
+      if not server_address:
+        raise ValueError('server_address must not be an empty sequence')
+      signature_address = server_address[0]
+
+    client = reverb_client.Client(signature_address)
     info = client.server_info(get_signature_timeout_secs)
     if table not in info:
       raise ValueError(
-          f'Server at {server_address} does not contain any table named '
+          f'Server at {signature_address} does not contain any table named '
           f'{table}. Found: {", ".join(sorted(info.keys()))}.')
 
     if not info[table].signature:
       raise ValueError(
-          f'Table {table} at {server_address} does not have a signature.')
+          f'Table {table} at {signature_address} does not have a signature.')
 
     shapes = tree.map_structure(lambda x: x.shape, info[table].signature)
     dtypes = tree.map_structure(lambda x: x.dtype, info[table].signature)
@@ -268,15 +371,26 @@ class ReplayDataset(tf.data.Dataset):
         sequence_length=sequence_length,
         emit_timesteps=emit_timesteps,
         rate_limiter_timeout_ms=rate_limiter_timeout_ms,
-        flexible_batch_size=flexible_batch_size)
+        flexible_batch_size=flexible_batch_size,
+        batch_size=batch_size,
+        drop_remainder=drop_remainder,
+        max_samples=max_samples,
+        pinned_memory=pinned_memory)
 
   def _as_variant_tensor(self):
     return gen_dataset_op.reverb_dataset(
         server_address=self._server_address,
         table=self._table,
+        mixed_tables=self._mixed_tables,
+        mixed_table_weights=self._mixed_table_weights,
+        server_addresses=self._server_addresses,
         dtypes=tree.flatten(self._dtypes),
         shapes=tree.flatten(self._shapes),
         emit_timesteps=self._emit_timesteps,
+        batch_size=self._batch_size or -1,
+        drop_remainder=self._drop_remainder,
+        max_samples=self._max_samples,
+        pinned_memory=self._pinned_memory,
         sequence_length=self._sequence_length or -1,
         max_in_flight_samples_per_worker=self._max_in_flight_samples_per_worker,
         num_workers_per_iterator=self._num_workers_per_iterator,
@@ -173,6 +173,32 @@ class ReplayDatasetTest(tf.test.TestCase, parameterized.TestCase):
           'flexible_batch_size': 0,
           'want_error': ValueError,
       },
+      {
+          'testcase_name': 'batch_size_is_0',
+          'batch_size': 0,
+          'emit_timesteps': False,
+          'sequence_length': 3,
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'batch_size_with_emit_timesteps',
+          'batch_size': 2,
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'drop_remainder_without_batch_size',
+          'drop_remainder': True,
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'max_samples_is_0',
+          'max_samples': 0,
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'max_samples_is_1',
+          'max_samples': 1,
+      },
   )
   def test_sampler_parameter_validation(self, **kwargs):
     dtypes = (tf.float32,)
@@ -492,6 +518,141 @@ class ReplayDatasetTest(tf.test.TestCase, parameterized.TestCase):
       np.testing.assert_array_equal(
           sample.data[0], np.zeros((sequence_length, 3, 3), dtype=np.float32))
 
+  @parameterized.parameters(('dist',), ('signatured',),
+                            ('bounded_spec_signatured',))
+  def test_iterate_with_batch_size(self, table_name):
+    self._populate_replay(sequence_length=3, max_time_steps=3)
+
+    dataset = reverb_dataset.ReplayDataset(
+        self._client.server_address,
+        table=table_name,
+        dtypes=(tf.float32,),
+        shapes=(tf.TensorShape([3, 3, 3]),),
+        emit_timesteps=False,
+        sequence_length=3,
+        batch_size=2,
+        max_in_flight_samples_per_worker=100)
+
+    got = self._sample_from(dataset, 10)
+    for sample in got:
+      self.assertIsInstance(sample, replay_sample.ReplaySample)
+
+      # The info fields hold a single value per sequence.
+      self.assertEqual(sample.info.key.shape, (2,))
+      np.testing.assert_array_equal(sample.data[0],
+                                    np.zeros((2, 3, 3, 3), dtype=np.float32))
+
+  @parameterized.parameters((False,), (True,))
+  def test_iterate_with_pinned_memory(self, emit_timesteps):
+    self._populate_replay(sequence_length=3, max_time_steps=3)
+
+    # Without a GPU the pinned allocator is the CPU allocator so the samples
+    # are the same.
+    dataset = reverb_dataset.ReplayDataset(
+        self._client.server_address,
+        table='dist',
+        dtypes=(tf.float32,),
+        shapes=(tf.TensorShape([3, 3] if emit_timesteps else [3, 3, 3]),),
+        emit_timesteps=emit_timesteps,
+        sequence_length=3,
+        pinned_memory=True,
+        max_in_flight_samples_per_worker=100)
+
+    for sample in self._sample_from(dataset, 10):
+      np.testing.assert_array_equal(
+          sample.data[0],
+          np.zeros([3, 3] if emit_timesteps else [3, 3, 3], dtype=np.float32))
+
+  @parameterized.parameters((False,), (True,))
+  def test_iterate_with_batch_size_and_max_samples(self, drop_remainder):
+    self._populate_replay(sequence_length=3, max_time_steps=3)
+
+    dataset = reverb_dataset.ReplayDataset(
+        self._client.server_address,
+        table='dist',
+        dtypes=(tf.float32,),
+        shapes=(tf.TensorShape([3, 3, 3]),),
+        emit_timesteps=False,
+        sequence_length=3,
+        batch_size=2,
+        drop_remainder=drop_remainder,
+        max_samples=3,
+        max_in_flight_samples_per_worker=100)
+
+    # The batch dimension is only static if partial batches are dropped.
+    self.assertEqual(
+        tf.compat.dimension_value(dataset.element_spec.info.key.shape[0]),
+        2 if drop_remainder else None)
+
+    # `max_samples` counts batches rather than samples.
+    got = self._sample_from(dataset, 3)
+    self.assertEqual([sample.info.key.shape for sample in got], [(2,)] * 3)
+    with self.assertRaises(tf.errors.OutOfRangeError):
+      self._sample_from(dataset, 4)
+
+  def test_iterate_mixed_tables(self):
+    self._populate_replay(sequence_length=3, max_time_steps=3)
+
+    dataset = reverb_dataset.ReplayDataset(
+        self._client.server_address,
+        table={'dist': 1.0, 'signatured': 3.0},
+        dtypes=(tf.float32,),
+        shapes=(tf.TensorShape([3, 3, 3]),),
+        emit_timesteps=False,
+        sequence_length=3,
+        max_in_flight_samples_per_worker=100)
+
+    got = self._sample_from(dataset, 10)
+    for sample in got:
+      self.assertIsInstance(sample, replay_sample.ReplaySample)
+      np.testing.assert_array_equal(sample.data[0],
+                                    np.zeros((3, 3, 3), dtype=np.float32))
+
+  @parameterized.parameters(({},), ({'dist': 0},), ({'dist': 1, 'x': -1},))
+  def test_mixed_tables_validation(self, table):
+    with self.assertRaises(ValueError):
+      reverb_dataset.ReplayDataset(
+          self._client.server_address,
+          table=table,
+          dtypes=(tf.float32,),
+          shapes=(tf.TensorShape([3, 3]),),
+          max_in_flight_samples_per_worker=100)
+
+  def test_iterate_multiple_servers(self):
+    self._populate_replay(sequence_length=3, max_time_steps=3)
+    other_server = make_server()
+    other_client = client.Client(f'localhost:{other_server.port}')
+    with other_client.writer(3) as writer:
+      for _ in range(10):
+        for _ in range(3):
+          writer.append([np.ones((3, 3), dtype=np.float32)])
+        writer.create_item(table='signatured', num_timesteps=3, priority=1)
+
+    dataset = reverb_dataset.ReplayDataset.from_table_signature(
+        [self._client.server_address, other_client.server_address],
+        table='signatured',
+        emit_timesteps=False,
+        sequence_length=3,
+        max_in_flight_samples_per_worker=1,
+        num_workers_per_iterator=2)
+
+    # Both servers hold items so the samples of both must be merged.
+    got = self._sample_from(dataset, 100)
+    self.assertEqual(
+        {float(sample.data[0, 0, 0]) for sample in got}, {0.0, 1.0})
+    other_server.stop()
+
+  @parameterized.parameters(([],), (['localhost:1234'],))
+  def test_multiple_servers_validation(self, server_address):
+    table = {'dist': 1.0} if server_address else 'dist'
+    with self.assertRaises(ValueError):
+      reverb_dataset.ReplayDataset(
+          server_address,
+          table=table,
+          dtypes=(tf.float32,),
+          shapes=(tf.TensorShape([3, 3]),),
+          max_in_flight_samples_per_worker=100)
+
   @parameterized.parameters(
       ('dist', 1),
       ('dist', 3),
@@ -18,9 +18,11 @@ import functools
 
 from reverb import pybind
 
+BucketedPrioritized = pybind.BucketedPrioritizedSelector
 Fifo = pybind.FifoSelector
 Lifo = pybind.LifoSelector
 MaxHeap = functools.partial(pybind.HeapSelector, False)  # pylint: disable=invalid-name
 MinHeap = functools.partial(pybind.HeapSelector, True)  # pylint: disable=invalid-name
+KAryPrioritized = pybind.KAryPrioritizedSelector
 Prioritized = pybind.PrioritizedSelector
 Uniform = pybind.UniformSelector
@@ -12,11 +12,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "numpy/arrayobject.h"
 #include "absl/container/inlined_vector.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "pybind11/numpy.h"
@@ -28,18 +36,27 @@
 #include "reverb/cc/platform/server.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/sampler.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/bucketed_prioritized.h"
 #include "reverb/cc/selectors/fifo.h"
 #include "reverb/cc/selectors/heap.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/kary_prioritized.h"
 #include "reverb/cc/selectors/lifo.h"
 #include "reverb/cc/selectors/prioritized.h"
 #include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/huge_page_allocator.h"
+#include "reverb/cc/support/tracing.h"
 #include "reverb/cc/table.h"
 #include "reverb/cc/table_extensions/interface.h"
 #include "reverb/cc/writer.h"
+#include "tensorflow/core/framework/allocation_description.pb.h"
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/lib/core/refcount.h"
 
 namespace {
 
@@ -295,6 +312,55 @@ inline tensorflow::Status VerifyDtypeIsSupported(
   return tensorflow::Status::OK();
 }
 
+// Exposes the data of an ndarray to a tensor without copying it. Holds a
+// reference to the array until the last tensor using the buffer is destroyed.
+class NdArrayTensorBuffer : public tensorflow::TensorBuffer {
+ public:
+  // Steals the reference to `array`, which must be C contiguous.
+  explicit NdArrayTensorBuffer(PyArrayObject *array)
+      : tensorflow::TensorBuffer(PyArray_DATA(array)),
+        array_(array),
+        size_(PyArray_NBYTES(array)) {}
+
+  ~NdArrayTensorBuffer() override {
+    // The tensor is usually released while the GIL is not held (e.g. by
+    // `Writer::Append`) so it has to be acquired before touching the array.
+    if (!Py_IsInitialized()) return;
+    PyGILState_STATE state = PyGILState_Ensure();
+    Py_DECREF(array_);
+    PyGILState_Release(state);
+  }
+
+  size_t size() const override { return size_; }
+
+  tensorflow::TensorBuffer *root_buffer() override { return this; }
+
+  void FillAllocationDescription(
+      tensorflow::AllocationDescription *proto) const override {
+    proto->set_requested_bytes(size_);
+    proto->set_allocator_name("NdArrayTensorBuffer");
+  }
+
+  bool OwnsMemory() const override { return false; }
+
+ private:
+  PyArrayObject *array_;
+  const size_t size_;
+};
+
+// Returns true if the data of `array` can be used by a tensor as is. Eigen
+// expects the data of tensors to be aligned.
+bool CanShareNdArrayData(PyArrayObject *array) {
+  return PyArray_NBYTES(array) > 0 &&
+         reinterpret_cast<uintptr_t>(PyArray_DATA(array)) %
+                 tensorflow::Allocator::kAllocatorAlignment ==
+             0;
+}
+
+// Converts `ndarray` into `out_tensor`. Non string arrays which are C
+// contiguous and aligned are shared with the tensor rather than copied so the
+// caller must not modify them while the tensor is alive. Other arrays are
+// copied.
 tensorflow::Status NdArrayToTensor(PyObject *ndarray,
                                    tensorflow::Tensor *out_tensor) {
   DCHECK(out_tensor != nullptr);
@@ -323,7 +389,14 @@ tensorflow::Status NdArrayToTensor(PyObject *ndarray,
     nelems *= dims[i];
   }
 
-  if (tensorflow::DataTypeCanUseMemcpy(dtype)) {
+  if (tensorflow::DataTypeCanUseMemcpy(dtype) &&
+      CanShareNdArrayData(py_array)) {
+    auto *buffer = new NdArrayTensorBuffer(
+        reinterpret_cast<PyArrayObject *>(array_safe.release()));
+    tensorflow::core::ScopedUnref unref(buffer);
+    *out_tensor =
+        tensorflow::Tensor(dtype, tensorflow::TensorShape(dims), buffer);
+  } else if (tensorflow::DataTypeCanUseMemcpy(dtype)) {
     *out_tensor = tensorflow::Tensor(dtype, tensorflow::TensorShape(dims));
     size_t size = PyArray_NBYTES(py_array);
     memcpy(out_tensor->data(), PyArray_DATA(py_array), size);
@@ -343,6 +416,16 @@ tensorflow::Status NdArrayToTensor(PyObject *ndarray,
   return tensorflow::Status::OK();
 }
 
+// Destructor of the capsules which keep the tensors viewed by ndarrays alive.
+void DeleteTensorCapsule(PyObject *capsule) {
+  delete static_cast<tensorflow::Tensor *>(
+      PyCapsule_GetPointer(capsule, nullptr));
+}
+
+// Converts `tensor` into `out_ndarray`. Non string tensors which are the only
+// owner of their buffer are viewed by the array rather than copied. Others,
+// e.g. timesteps sliced from a sample, are copied so the array can be modified
+// without affecting other tensors.
 tensorflow::Status TensorToNdArray(const tensorflow::Tensor &tensor,
                                    PyObject **out_ndarray) {
   TF_RETURN_IF_ERROR(VerifyDtypeIsSupported(tensor.dtype()));
@@ -356,6 +439,32 @@ tensorflow::Status TensorToNdArray(const tensorflow::Tensor &tensor,
     dims[i] = tensor.dim_size(i);
   }
 
+  if (tensorflow::DataTypeCanUseMemcpy(tensor.dtype()) &&
+      tensor.NumElements() > 0 && tensor.RefCountIsOne()) {
+    auto capsule = make_safe(PyCapsule_New(new tensorflow::Tensor(tensor),
+                                           nullptr, &DeleteTensorCapsule));
+    if (!capsule) {
+      Py_DECREF(descr);
+      return tensorflow::errors::Internal("Could not allocate capsule");
+    }
+    // Steals the reference to `descr`.
+    auto safe_out_ndarray = make_safe(PyArray_NewFromDescr(
+        &PyArray_Type, descr, dims.size(), dims.data(), /*strides=*/nullptr,
+        const_cast<char *>(tensor.tensor_data().data()), NPY_ARRAY_CARRAY,
+        /*obj=*/nullptr));
+    if (!safe_out_ndarray) {
+      return tensorflow::errors::Internal("Could not allocate ndarray");
+    }
+    // Steals the reference to `capsule`.
+    if (PyArray_SetBaseObject(
+            reinterpret_cast<PyArrayObject *>(safe_out_ndarray.get()),
+            capsule.release()) != 0) {
+      return tensorflow::errors::Internal("Could not set base of ndarray");
+    }
+    *out_ndarray = safe_out_ndarray.release();
+    return tensorflow::Status::OK();
+  }
+
   // Allocate an empty array of the desired shape and type.
   auto safe_out_ndarray =
       make_safe(PyArray_Empty(dims.size(), dims.data(), descr, 0));
@@ -459,6 +568,76 @@ namespace {
 
 namespace py = pybind11;
 
+// Asynchronous writers hold on to the appended tensors until their queued work
+// is done. The tensors may share the data of the caller's ndarrays (see
+// `NdArrayToTensor`) so they are copied to let the caller reuse the arrays.
+void MaybeCopyForWriter(const Writer &writer,
+                        std::vector<tensorflow::Tensor> *tensors) {
+  if (!writer.asynchronous()) return;
+  for (auto &tensor : *tensors) {
+    if (tensorflow::DataTypeCanUseMemcpy(tensor.dtype())) {
+      tensor = tensorflow::tensor::DeepCopy(tensor);
+    }
+  }
+}
+
+// An item created by `AppendBatch` once the step with index `step` of the
+// batch has been appended: (step, table, num_timesteps, priority).
+using BatchItem = std::tuple<int, std::string, int, double>;
+
+// Appends the steps of `sequence` and creates `items` in between them, all
+// without returning to Python. Equivalent to calling `Append` for each step
+// and `CreateItem` for the items of that step right after it.
+tensorflow::Status AppendBatch(Writer *writer,
+                               std::vector<tensorflow::Tensor> sequence,
+                               std::vector<BatchItem> items) {
+  if (sequence.empty()) {
+    return tensorflow::errors::InvalidArgument(
+        "AppendBatch called with empty data.");
+  }
+  for (int i = 0; i < sequence.size(); i++) {
+    if (sequence[i].dims() == 0 ||
+        sequence[i].dim_size(0) != sequence[0].dim_size(0)) {
+      return tensorflow::errors::InvalidArgument(
+          "AppendBatch called with scalar tensor or tensors of non equal "
+          "batch dimension at index ",
+          i, ".");
+    }
+  }
+  const int64_t num_steps = sequence[0].dim_size(0);
+  for (const auto &item : items) {
+    if (std::get<0>(item) < 0 || std::get<0>(item) >= num_steps) {
+      return tensorflow::errors::InvalidArgument(
+          "AppendBatch called with item at step ", std::get<0>(item),
+          " but the batch only holds ", num_steps, " steps.");
+    }
+  }
+  std::stable_sort(items.begin(), items.end(),
+                   [](const BatchItem &a, const BatchItem &b) {
+                     return std::get<0>(a) < std::get<0>(b);
+                   });
+  MaybeCopyForWriter(*writer, &sequence);
+
+  // The steps between consecutive items are appended with a single call.
+  int64_t appended = 0;
+  auto append_until = [&](int64_t end) {
+    if (end == appended) return tensorflow::Status::OK();
+    std::vector<tensorflow::Tensor> slices;
+    slices.reserve(sequence.size());
+    for (const auto &tensor : sequence) {
+      slices.push_back(tensor.Slice(appended, end));
+    }
+    appended = end;
+    return writer->AppendSequence(std::move(slices));
+  };
+  for (const auto &item : items) {
+    TF_RETURN_IF_ERROR(append_until(std::get<0>(item) + 1));
+    TF_RETURN_IF_ERROR(writer->CreateItem(std::get<1>(item), std::get<2>(item),
+                                          std::get<3>(item)));
+  }
+  return append_until(num_steps);
+}
+
 PYBIND11_MODULE(libpybind, m) {
   // Initialization code to use numpy types in the type casters.
   ImportNumpy();
@@ -468,7 +647,22 @@ PYBIND11_MODULE(libpybind, m) {
 
   py::class_<PrioritizedSelector, ItemSelector,
              std::shared_ptr<PrioritizedSelector>>(m, "PrioritizedSelector")
-      .def(py::init<double>(), py::arg("priority_exponent"));
+      .def(py::init<double, bool>(), py::arg("priority_exponent"),
+           py::arg("reduced_precision") = false);
+
+  py::class_<KAryPrioritizedSelector, ItemSelector,
+             std::shared_ptr<KAryPrioritizedSelector>>(
+      m, "KAryPrioritizedSelector")
+      .def(py::init<double, int>(), py::arg("priority_exponent"),
+           py::arg("branching_factor") =
+               KAryPrioritizedSelector::kDefaultBranchingFactor);
+
+  py::class_<BucketedPrioritizedSelector, ItemSelector,
+             std::shared_ptr<BucketedPrioritizedSelector>>(
+      m, "BucketedPrioritizedSelector")
+      .def(py::init<double, int>(), py::arg("priority_exponent"),
+           py::arg("buckets_per_doubling") =
+               BucketedPrioritizedSelector::kDefaultBucketsPerDoubling);
 
   py::class_<FifoSelector, ItemSelector, std::shared_ptr<FifoSelector>>(
       m, "FifoSelector")
@@ -484,7 +678,8 @@ PYBIND11_MODULE(libpybind, m) {
 
   py::class_<HeapSelector, ItemSelector, std::shared_ptr<HeapSelector>>(
       m, "HeapSelector")
-      .def(py::init<bool>(), py::arg("min_heap"));
+      .def(py::init<bool, int>(), py::arg("min_heap"),
+           py::arg("branching_factor") = 0);
 
   py::class_<TableExtension, std::shared_ptr<TableExtension>>
       unused_table_extension(m, "TableExtension");
@@ -504,7 +699,10 @@ PYBIND11_MODULE(libpybind, m) {
                   const std::vector<std::shared_ptr<TableExtension>>
                       &extensions,
                   const absl::optional<std::string> &serialized_signature =
-                      absl::nullopt) -> Table * {
+                      absl::nullopt,
+                  int64_t max_bytes = 0,
+                  double max_age_seconds = 0,
+                  int64_t max_reserved_bytes = 0) -> Table * {
                  absl::optional<tensorflow::StructuredValue> signature =
                      absl::nullopt;
                  if (serialized_signature) {
@@ -519,22 +717,48 @@ PYBIND11_MODULE(libpybind, m) {
                  }
                  return new Table(name, sampler, remover, max_size,
                                   max_times_sampled, rate_limiter, extensions,
-                                  std::move(signature));
+                                  std::move(signature), max_bytes,
+                                  max_age_seconds > 0
+                                      ? absl::Seconds(max_age_seconds)
+                                      : absl::InfiniteDuration(),
+                                  /*index_episodes=*/false,
+                                  max_reserved_bytes);
                }),
            py::arg("name"), py::arg("sampler"), py::arg("remover"),
            py::arg("max_size"), py::arg("max_times_sampled"),
-           py::arg("rate_limiter"), py::arg("extensions"), py::arg("signature"))
+           py::arg("rate_limiter"), py::arg("extensions"), py::arg("signature"),
+           py::arg("max_bytes") = 0, py::arg("max_age_seconds") = 0,
+           py::arg("max_reserved_bytes") = 0)
       .def("name", &Table::name)
       .def("can_sample", &Table::CanSample,
            py::call_guard<py::gil_scoped_release>())
       .def("can_insert", &Table::CanInsert,
-           py::call_guard<py::gil_scoped_release>());
+           py::call_guard<py::gil_scoped_release>())
+      .def("freeze", &Table::Freeze, py::call_guard<py::gil_scoped_release>())
+      .def("frozen", &Table::frozen);
 
   py::class_<Writer>(m, "Writer")
-      .def("Append", &Writer::Append, py::call_guard<py::gil_scoped_release>())
-      .def("AppendSequence", &Writer::AppendSequence,
+      .def(
+          "Append",
+          [](Writer *writer, std::vector<tensorflow::Tensor> data) {
+            MaybeCopyForWriter(*writer, &data);
+            return writer->Append(std::move(data));
+          },
+          py::call_guard<py::gil_scoped_release>())
+      .def(
+          "AppendSequence",
+          [](Writer *writer, std::vector<tensorflow::Tensor> sequence) {
+            MaybeCopyForWriter(*writer, &sequence);
+            return writer->AppendSequence(std::move(sequence));
+          },
+          py::call_guard<py::gil_scoped_release>())
+      .def("AppendBatch", &AppendBatch, py::arg("sequence"), py::arg("items"),
            py::call_guard<py::gil_scoped_release>())
-      .def("CreateItem", &Writer::CreateItem,
+      .def("CreateItem",
+           py::overload_cast<const std::string &, int, double,
+                             const std::vector<int> &>(&Writer::CreateItem),
+           py::arg("table"), py::arg("num_timesteps"), py::arg("priority"),
+           py::arg("columns") = std::vector<int>(),
            py::call_guard<py::gil_scoped_release>())
       .def(
           "Flush",
@@ -555,23 +779,70 @@ PYBIND11_MODULE(libpybind, m) {
             return std::make_pair(std::move(sample), end_of_sequence);
           },
           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "GetNextBatch",
+          [](Sampler *sampler, int64_t batch_size) {
+            std::vector<tensorflow::Tensor> batch;
+            tensorflow::Status status;
+            {
+              // The GIL is released once for the whole batch.
+              py::gil_scoped_release g;
+              status = sampler->GetNextBatch(batch_size, &batch);
+            }
+            MaybeRaiseFromStatus(status);
+            return batch;
+          },
+          py::arg("batch_size"))
+      .def("Stats",
+           [](Sampler *sampler) {
+             return py::bytes(sampler->stats().SerializeAsString());
+           })
+      .def(
+          "MutatePriorities",
+          [](Sampler *sampler,
+             const std::vector<std::pair<uint64_t, double>> &updates,
+             const std::vector<uint64_t> &deletes) {
+            std::vector<KeyWithPriority> update_protos;
+            for (const auto &update : updates) {
+              update_protos.emplace_back();
+              update_protos.back().set_key(update.first);
+              update_protos.back().set_priority(update.second);
+            }
+            MaybeRaiseFromStatus(
+                sampler->MutatePriorities(update_protos, deletes));
+          },
+          py::call_guard<py::gil_scoped_release>())
       .def("Close", &Sampler::Close, py::call_guard<py::gil_scoped_release>());
 
   py::class_<Client>(m, "Client")
       .def(py::init<std::string>(), py::arg("server_name"))
+      .def_static("SetNumChannelsPerServer", &Client::SetNumChannelsPerServer,
+                  py::arg("num_channels"))
       .def(
           "NewWriter",
           [](Client *client, int chunk_length, int max_timesteps,
-             bool delta_encoded, absl::optional<int> max_in_flight_items) {
+             bool delta_encoded, absl::optional<int> max_in_flight_items,
+             const std::string &codec, int block_length,
+             int64_t max_pending_bytes, int64_t max_chunk_bytes) {
+            CompressionCodec codec_enum;
+            if (!CompressionCodec_Parse(
+                    absl::StrCat("CODEC_", absl::AsciiStrToUpper(codec)),
+                    &codec_enum)) {
+              MaybeRaiseFromStatus(tensorflow::errors::InvalidArgument(
+                  "Unknown codec '", codec, "'."));
+            }
             std::unique_ptr<Writer> writer;
-            MaybeRaiseFromStatus(
-                client->NewWriter(chunk_length, max_timesteps, delta_encoded,
-                                  std::move(max_in_flight_items), &writer));
+            MaybeRaiseFromStatus(client->NewWriter(
+                chunk_length, max_timesteps, delta_encoded,
+                std::move(max_in_flight_items), codec_enum, block_length,
+                max_pending_bytes, max_chunk_bytes, &writer));
             return writer;
           },
           py::call_guard<py::gil_scoped_release>(), py::arg("chunk_length"),
           py::arg("max_timesteps"), py::arg("delta_encoded") = false,
-          py::arg("max_in_flight_items") = absl::nullopt)
+          py::arg("max_in_flight_items") = absl::nullopt,
+          py::arg("codec") = "snappy", py::arg("block_length") = 0,
+          py::arg("max_pending_bytes") = 0, py::arg("max_chunk_bytes") = 0)
       .def(
           "NewSampler",
           [](Client *client, const std::string &table, int64_t max_samples,
@@ -655,18 +926,163 @@ PYBIND11_MODULE(libpybind, m) {
       },
       py::call_guard<py::gil_scoped_release>());
 
+  // Spans of the sampled traces are logged. `sample_rate` only applies to the
+  // traces started by this process, see `internal::TracingOptions`.
+  m.def(
+      "configure_tracing",
+      [](double sample_rate, bool enabled) {
+        if (sample_rate < 0 || sample_rate > 1) {
+          MaybeRaiseFromStatus(tensorflow::errors::InvalidArgument(
+              "sample_rate must be in [0, 1] but got ", sample_rate));
+        }
+        internal::TracingOptions options;
+        options.sample_rate = sample_rate;
+        if (enabled) {
+          options.exporter = std::make_shared<internal::LoggingSpanExporter>();
+        }
+        internal::ConfigureTracing(std::move(options));
+      },
+      py::arg("sample_rate"), py::arg("enabled") = true);
+
+  // Pages of the large arrays of the tables and selectors created from now on,
+  // see `internal::ConfigureHugePages`. One of "regular", "transparent", "2mb"
+  // or "1gb".
+  m.def("configure_huge_pages", [](const std::string &pages) {
+    internal::HugePageOptions options;
+    if (pages == "regular") {
+      options.pages = internal::PageKind::kRegular;
+    } else if (pages == "transparent") {
+      options.pages = internal::PageKind::kTransparentHuge;
+    } else if (pages == "2mb") {
+      options.pages = internal::PageKind::kHuge2MB;
+    } else if (pages == "1gb") {
+      options.pages = internal::PageKind::kHuge1GB;
+    } else {
+      MaybeRaiseFromStatus(tensorflow::errors::InvalidArgument(
+          "pages must be one of regular, transparent, 2mb or 1gb but got ",
+          pages));
+    }
+    internal::ConfigureHugePages(options);
+  });
+
   py::class_<Server, std::shared_ptr<Server>>(m, "Server")
       .def(
           py::init([](std::vector<std::shared_ptr<Table>> priority_tables,
                       int port,
-                      std::shared_ptr<Checkpointer> checkpointer = nullptr) {
+                      std::shared_ptr<Checkpointer> checkpointer = nullptr,
+                      int num_async_threads = 0, bool warm_start = false,
+                      double default_min_restored_fraction_to_sample = 1.0,
+                      const std::map<std::string, double>&
+                          min_restored_fraction_to_sample = {},
+                      double checkpoint_interval_seconds = 0,
+                      int64_t checkpoint_max_bytes_per_second = 0,
+                      int metrics_port = 0,
+                      const std::map<std::string, int>& table_numa_nodes = {},
+                      bool enable_replication = false,
+                      const std::string& primary_address = "",
+                      const std::string& replica_address = "",
+                      bool coordinate_replica_rate_limiting = false,
+                      int64_t memory_soft_limit_bytes = 0,
+                      int64_t memory_hard_limit_bytes = 0,
+                      const std::map<std::string,
+                                     std::vector<std::tuple<int, int, double>>>&
+                          table_item_rules = {},
+                      bool enable_profiling = false,
+                      const std::string& workload_trace_path = "",
+                      const std::map<std::string, std::pair<double, int64_t>>&
+                          stream_classes = {},
+                      const std::string& default_stream_class = "default",
+                      int max_concurrent_stream_operations = 8,
+                      const std::string& spill_path = "",
+                      double spill_cold_after_seconds = 300,
+                      double spill_scan_interval_seconds = 30,
+                      int prefetch_queue_size = 10000,
+                      bool deduplicate_chunks = false,
+                      const std::string& metrics_address = "127.0.0.1") {
+            ServerOptions options;
+            options.num_async_threads = num_async_threads;
+            options.warm_start = warm_start;
+            options.default_min_restored_fraction_to_sample =
+                default_min_restored_fraction_to_sample;
+            options.min_restored_fraction_to_sample.insert(
+                min_restored_fraction_to_sample.begin(),
+                min_restored_fraction_to_sample.end());
+            options.checkpoint_interval =
+                absl::Seconds(checkpoint_interval_seconds);
+            options.checkpoint_max_bytes_per_second =
+                checkpoint_max_bytes_per_second;
+            options.metrics_port = metrics_port;
+            options.metrics_address = metrics_address;
+            options.enable_profiling = enable_profiling;
+            options.table_numa_nodes.insert(table_numa_nodes.begin(),
+                                            table_numa_nodes.end());
+            options.enable_replication = enable_replication;
+            options.primary_address = primary_address;
+            options.replica_address = replica_address;
+            options.coordinate_replica_rate_limiting =
+                coordinate_replica_rate_limiting;
+            options.memory_soft_limit_bytes = memory_soft_limit_bytes;
+            options.memory_hard_limit_bytes = memory_hard_limit_bytes;
+            options.workload_trace_path = workload_trace_path;
+            for (const auto& [name, limits] : stream_classes) {
+              auto& stream_class = options.stream_classes[name];
+              stream_class.weight = limits.first;
+              stream_class.max_bytes_per_second = limits.second;
+            }
+            options.default_stream_class = default_stream_class;
+            options.max_concurrent_stream_operations =
+                max_concurrent_stream_operations;
+            options.tiering.spill_path = spill_path;
+            options.tiering.cold_after =
+                absl::Seconds(spill_cold_after_seconds);
+            options.tiering.scan_interval =
+                absl::Seconds(spill_scan_interval_seconds);
+            options.tiering.prefetch_queue_size = prefetch_queue_size;
+            options.deduplicate_chunks = deduplicate_chunks;
+            for (const auto& [table, rules] : table_item_rules) {
+              auto& table_rules = options.table_item_rules[table];
+              for (const auto& [length, stride, priority] : rules) {
+                ItemRule& rule = table_rules.emplace_back();
+                rule.set_length(length);
+                rule.set_stride(stride);
+                rule.set_priority(priority);
+              }
+            }
             std::unique_ptr<Server> server;
             MaybeRaiseFromStatus(StartServer(std::move(priority_tables), port,
-                                             std::move(checkpointer), &server));
+                                             std::move(checkpointer), options,
+                                             &server));
             return server.release();
           }),
           py::arg("priority_tables"), py::arg("port"),
-          py::arg("checkpointer") = nullptr)
+          py::arg("checkpointer") = nullptr, py::arg("num_async_threads") = 0,
+          py::arg("warm_start") = false,
+          py::arg("default_min_restored_fraction_to_sample") = 1.0,
+          py::arg("min_restored_fraction_to_sample") =
+              std::map<std::string, double>(),
+          py::arg("checkpoint_interval_seconds") = 0,
+          py::arg("checkpoint_max_bytes_per_second") = 0,
+          py::arg("metrics_port") = 0,
+          py::arg("table_numa_nodes") = std::map<std::string, int>(),
+          py::arg("enable_replication") = false,
+          py::arg("primary_address") = "", py::arg("replica_address") = "",
+          py::arg("coordinate_replica_rate_limiting") = false,
+          py::arg("memory_soft_limit_bytes") = 0,
+          py::arg("memory_hard_limit_bytes") = 0,
+          py::arg("table_item_rules") =
+              std::map<std::string,
+                       std::vector<std::tuple<int, int, double>>>(),
+          py::arg("enable_profiling") = false,
+          py::arg("workload_trace_path") = "",
+          py::arg("stream_classes") =
+              std::map<std::string, std::pair<double, int64_t>>(),
+          py::arg("default_stream_class") = "default",
+          py::arg("max_concurrent_stream_operations") = 8,
+          py::arg("spill_path") = "", py::arg("spill_cold_after_seconds") = 300,
+          py::arg("spill_scan_interval_seconds") = 30,
+          py::arg("prefetch_queue_size") = 10000,
+          py::arg("deduplicate_chunks") = false,
+          py::arg("metrics_address") = "127.0.0.1")
       .def("Stop", &Server::Stop, py::call_guard<py::gil_scoped_release>())
       .def("Wait", &Server::Wait, py::call_guard<py::gil_scoped_release>())
       .def("InProcessClient", &Server::InProcessClient,
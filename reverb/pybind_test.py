@@ -18,6 +18,7 @@ from absl.testing import absltest
 from absl.testing import parameterized
 import numpy as np
 import reverb
+from reverb.cc import schema_pb2
 
 TABLE_NAME = 'queue'
 
@@ -71,6 +72,43 @@ class TestNdArrayToTensorAndBack(parameterized.TestCase):
     got = sample[0].data[0]
     np.testing.assert_array_equal(data, got)
 
+  @parameterized.parameters(
+      (np.arange(64, dtype=np.float32).reshape([8, 8])[:, ::2],),
+      (np.asfortranarray(np.arange(64, dtype=np.int32).reshape([8, 8])),),
+      (np.frombuffer(b'\x00' + bytes(range(64)), dtype=np.uint8)[1:],),
+      (np.zeros([0, 3], dtype=np.float32),),
+  )
+  def test_non_shareable_arrays_are_copied(self, data):
+    with self._client.writer(1) as writer:
+      writer.append([data])
+      writer.create_item(TABLE_NAME, 1, 1)
+
+    sample = next(self._client.sample(TABLE_NAME))
+    np.testing.assert_array_equal(data, sample[0].data[0])
+
+  @parameterized.parameters((0,), (1 << 20,))
+  def test_arrays_can_be_modified_after_append(self, max_pending_bytes):
+    data = np.zeros([64, 64], dtype=np.float32)
+    with self._client.writer(
+        2, max_pending_bytes=max_pending_bytes) as writer:
+      for i in range(2):
+        data[:] = i
+        writer.append([data])
+      writer.create_item(TABLE_NAME, 2, 1)
+
+    sample = next(self._client.sample(TABLE_NAME))
+    for i in range(2):
+      np.testing.assert_array_equal(sample[i].data[0], np.full([64, 64], i))
+
+  def test_sampled_arrays_are_writable(self):
+    with self._client.writer(1) as writer:
+      writer.append([np.ones([64, 64], dtype=np.float32)])
+      writer.create_item(TABLE_NAME, 1, 1)
+
+    got = next(self._client.sample(TABLE_NAME))[0].data[0]
+    got[:] = 2
+    np.testing.assert_array_equal(got, np.full([64, 64], 2))
+
   def test_stress_string_memory_leak(self):
     with self._client.writer(1) as writer:
       for i in range(100):
@@ -83,5 +121,31 @@ class TestNdArrayToTensorAndBack(parameterized.TestCase):
       np.testing.assert_array_equal(got, b'string_' + (b'a' * 100 * i))
 
 
+class SamplerStatsTest(absltest.TestCase):
+
+  def test_stats_are_readable(self):
+    server = reverb.Server(
+        tables=[reverb.Table.queue(TABLE_NAME, 10)], port=None)
+    client = server.in_process_client()
+    with client.writer(1) as writer:
+      for i in range(2):
+        writer.append([np.array(i)])
+        writer.create_item(TABLE_NAME, 1, 1)
+
+    sampler = client._client.NewSampler(TABLE_NAME, 2, 1, 3000)
+    for _ in range(2):
+      sampler.GetNextTimestep()
+
+    stats = schema_pb2.SamplerStats.FromString(sampler.Stats())
+    self.assertEqual(stats.pop_wait.count, 2)
+    self.assertEqual(stats.decode.count, 2)
+    self.assertEqual(sum(worker.samples for worker in stats.workers), 2)
+    self.assertGreater(stats.streams_opened, 0)
+    self.assertGreater(stats.bytes_received, 0)
+
+    sampler.Close()
+    server.stop()
+
+
 if __name__ == '__main__':
   absltest.main()
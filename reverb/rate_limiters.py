@@ -24,7 +24,18 @@ from reverb import pybind
 
 
 class RateLimiter(metaclass=abc.ABCMeta):
-  """Abstract base class for RateLimiters."""
+  """Abstract base class for RateLimiters.
+
+  A RateLimiter can be passed to more than one table. The inserts and samples
+  of all of these tables are then counted against a single budget.
+
+  Items written to several tables of such a group are admitted together only
+  on a best-effort basis. The server admits them at once only if they arrive
+  back to back on the same stream, before the stream runs dry. Otherwise each
+  item is admitted on its own, so the budget may block some tables of the
+  group before others. Checkpoints can't restore a shared rate limiter, so
+  checkpointing a server whose tables share one fails.
+  """
 
   def __init__(self, internal_limiter: pybind.RateLimiter):
     self.internal_limiter = internal_limiter
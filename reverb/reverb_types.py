@@ -24,13 +24,16 @@ import tensorflow.compat.v1 as tf
 from reverb.cc import schema_pb2
 
 
+BucketedPrioritized = pybind.BucketedPrioritizedSelector
 Fifo = pybind.FifoSelector
 Heap = pybind.HeapSelector
+KAryPrioritized = pybind.KAryPrioritizedSelector
 Lifo = pybind.LifoSelector
 Prioritized = pybind.PrioritizedSelector
 Uniform = pybind.UniformSelector
 
-SelectorType = Union[Fifo, Heap, Lifo, Prioritized, Uniform]
+SelectorType = Union[BucketedPrioritized, Fifo, Heap, KAryPrioritized, Lifo,
+                     Prioritized, Uniform]
 
 # Note that this is effectively treated as `Any`; see b/109648354.
 SpecNest = Union[
@@ -21,7 +21,7 @@ service.
 
 import abc
 import collections
-from typing import Optional, Sequence, Union
+from typing import Mapping, Optional, Sequence, Tuple, Union
 
 from absl import logging
 import portpicker
@@ -106,7 +106,10 @@ class Table:
                rate_limiter: rate_limiters.RateLimiter,
                max_times_sampled: int = 0,
                extensions: Sequence[TableExtensionBase] = (),
-               signature: Optional[reverb_types.SpecNest] = None):
+               signature: Optional[reverb_types.SpecNest] = None,
+               max_bytes: int = 0,
+               max_age_seconds: float = 0,
+               max_reserved_bytes: int = 0):
     """Constructor of the Table.
 
     Args:
@@ -125,6 +128,19 @@ class Table:
         the table.
       signature: Optional nested structure containing `tf.TypeSpec` objects,
         describing the storage schema for this table.
+      max_bytes: The maximum total size (in bytes) of the data referenced by
+        the items in the table. After each insert the `remover` is used to
+        remove items until the data fits. Note that data shared with other
+        tables is counted in full by each table. Any value < 1 is ignored and
+        means there is no limit.
+      max_age_seconds: Time (in seconds) after their insertion that items are
+        deleted from the table, whether or not they have been sampled. Any
+        value <= 0 is ignored and means that items never expire.
+      max_reserved_bytes: Cap (in bytes) of the memory which is allocated when
+        the table is constructed for the index of up to `max_size` items, which
+        otherwise grows (and pauses inserts and samples while it does) as the
+        table fills up. Any value < 1 is ignored and means that nothing is
+        allocated up front.
 
     Raises:
       ValueError: If name is empty.
@@ -159,7 +175,10 @@ class Table:
         max_times_sampled=max_times_sampled,
         rate_limiter=rate_limiter.internal_limiter,
         extensions=internal_extensions,
-        signature=signature_proto_str)
+        signature=signature_proto_str,
+        max_bytes=max_bytes,
+        max_age_seconds=max_age_seconds,
+        max_reserved_bytes=max_reserved_bytes)
 
   @classmethod
   def queue(cls,
@@ -227,6 +246,27 @@ class Table:
     """Returns True if an insert operation is permitted at the current state."""
     return self.internal_table.can_insert(num_inserts)
 
+  def freeze(self):
+    """Makes the table read-only so that it is sampled without locking.
+
+    Intended for tables which are filled once and then only sampled, e.g
+    offline datasets. The samples bypass the rate limiter and inserts,
+    updates and resets fail once the table is frozen. Tables cannot be
+    unfrozen.
+
+    Raises:
+      RuntimeError: If the table is empty or removes items when they are
+        sampled or expire.
+      NotImplementedError: If the sampler is neither uniform, prioritized nor
+        deterministic.
+    """
+    self.internal_table.freeze()
+
+  @property
+  def frozen(self) -> bool:
+    """Whether `freeze` has been called."""
+    return self.internal_table.frozen()
+
 
 class Server:
   """Reverb replay server.
@@ -245,7 +285,35 @@ class Server:
   def __init__(self,
                tables: Sequence[Table] = None,
                port: Union[int, None] = None,
-               checkpointer: checkpointers.CheckpointerBase = None):
+               checkpointer: checkpointers.CheckpointerBase = None,
+               num_async_threads: int = 0,
+               warm_start: bool = False,
+               min_restored_fraction_to_sample: Union[
+                   float, Mapping[str, float]] = 1.0,
+               checkpoint_interval_seconds: Optional[float] = None,
+               checkpoint_max_bytes_per_second: Optional[int] = None,
+               metrics_port: Optional[int] = None,
+               table_numa_nodes: Optional[Mapping[str, int]] = None,
+               enable_replication: bool = False,
+               primary_address: Optional[str] = None,
+               replica_address: Optional[str] = None,
+               replica_rate_limiting: str = 'relaxed',
+               memory_soft_limit_bytes: Optional[int] = None,
+               memory_hard_limit_bytes: Optional[int] = None,
+               table_item_rules: Optional[Mapping[
+                   str, Sequence[Tuple[int, int, float]]]] = None,
+               enable_profiling: bool = False,
+               workload_trace_path: Optional[str] = None,
+               stream_classes: Optional[Mapping[str, Tuple[float,
+                                                           int]]] = None,
+               default_stream_class: str = 'default',
+               max_concurrent_stream_operations: int = 8,
+               spill_path: Optional[str] = None,
+               spill_cold_after_seconds: float = 300,
+               spill_scan_interval_seconds: float = 30,
+               prefetch_queue_size: int = 10000,
+               deduplicate_chunks: bool = False,
+               metrics_address: str = '127.0.0.1'):
     """Constructor of Server serving the ReverbService.
 
     Args:
@@ -255,10 +323,112 @@ class Server:
       checkpointer: Checkpointer used for storing/loading checkpoints. If None
         (default) then `checkpointers.default_checkpointer` is used to
         construct the checkpointer.
+      num_async_threads: Number of threads which serve the calls using the
+        asynchronous gRPC API. If 0 (default) then the synchronous gRPC API is
+        used, which holds a thread for as long as a stream is open. Servers
+        with thousands of concurrent writers and samplers should use a small
+        number of threads (e.g the number of cores) instead.
+      warm_start: If True then the server starts serving before the latest
+        checkpoint has been loaded. The checkpoint is restored in the
+        background while the tables accept inserts. The progress is reported
+        by `TableInfo.restore_progress`.
+      min_restored_fraction_to_sample: Only used if `warm_start` is set.
+        Fraction of the checkpointed items of a table which must have been
+        restored before samples are allowed. Either a single value for all
+        tables or a mapping from table name to value, in which case tables
+        that are not in the mapping wait for the full restore.
+      checkpoint_interval_seconds: If set then the server saves a checkpoint
+        every `checkpoint_interval_seconds`. A run is skipped if the previous
+        checkpoint is still in progress. The stats are reported by
+        `ServerInfo`.
+      checkpoint_max_bytes_per_second: Maximum rate at which the scheduled
+        checkpoints write data. If None (default) then there is no limit.
+      metrics_port: If set then the metrics of the server (calls per method,
+        table sizes, rate limiter and chunk store stats) are served in the
+        Prometheus text format at
+        `http://<metrics_address>:<metrics_port>/metrics`.
+      table_numa_nodes: Optional mapping from table name to the NUMA node
+        which the table is pinned to. The threads of the synchronous gRPC API
+        which insert into or sample from a pinned table run on its node, and
+        the accesses from each node are reported by `TableInfo.numa`.
+      enable_replication: If True then read replicas can follow the tables of
+        the server. Every table then logs its mutations for the replicas.
+      primary_address: If set then the server is a read replica of the
+        server at this address, which must have `enable_replication` set. The
+        tables are replaced with copies of the tables of the same names on
+        the primary, which are kept in sync, and writes are rejected. The
+        state of the replication is reported by `ServerInfo`.
+      replica_address: Only used if `primary_address` is set. Address at
+        which clients of the primary can sample from this replica, as
+        reported by the `ServerInfo` of the primary.
+      replica_rate_limiting: Only used if `primary_address` is set. With
+        'relaxed' (default) the replica only enforces the rate limiters of its
+        own tables. With 'coordinated' the replica also reports the samples it
+        serves to the primary, whose rate limiters then pace the writers by the
+        samples of all replicas.
+      memory_soft_limit_bytes: If set then the insert streams read their
+        requests more slowly while the chunks held by the server use more than
+        this many bytes, which pushes back on the writers.
+      memory_hard_limit_bytes: If set then chunks which would take the memory
+        held by the chunks above this many bytes are rejected with
+        RESOURCE_EXHAUSTED. Items are still accepted so the tables can remove
+        items and free their chunks. The state of both limits is reported by
+        `ServerInfo`.
+      table_item_rules: Optional mapping from table name to the rules by which
+        the server creates the items of the table itself, as `(length, stride,
+        priority)` tuples. For every step of an episode which is a multiple of
+        `stride` the server inserts an item of the following `length` steps
+        with `priority` once their chunks have arrived on the same stream.
+        Writers then only need to stream the chunks.
+      enable_profiling: If True then CPU and heap profiles of the server are
+        served in the pprof format at `/debug/pprof/profile?seconds=N` and
+        `/debug/pprof/heap` of `metrics_port`, which must be set. The profiles
+        require the gperftools profilers to be linked in or preloaded.
+      workload_trace_path: If set then the inserts, samples, priority mutations
+        and resets requested by clients are recorded, without their data, to a
+        trace file at this path. The trace is complete once the server has
+        stopped and can be replayed against another server with the
+        `--trace` flag of `reverb/cc/tools:load_generator`.
+      stream_classes: If set then the streams of the server are scheduled by
+        priority class. Maps the name of each class to its
+        `(weight, max_bytes_per_second)`. Clients tag their streams with a
+        class (see `priority_class` of the samplers) and streams which aren't
+        tagged with a known class belong to `default_stream_class`. At most
+        `max_concurrent_stream_operations` sample batches, insert requests and
+        export responses are processed at a time, and the waiting ones start
+        in proportion to the weights of their classes. Classes with a positive
+        `max_bytes_per_second` are throttled to that bandwidth.
+      default_stream_class: Class of the streams which aren't tagged with one
+        of `stream_classes`. Must be one of them when they are set.
+      max_concurrent_stream_operations: Number of scheduled operations which
+        are processed at a time, unlimited if <= 0. Unused unless
+        `stream_classes` is set.
+      spill_path: If set then the tensors of chunks which have not been
+        sampled for `spill_cold_after_seconds` are spilled to a file at this
+        path on local disk, and only their metadata is kept in memory. Spilled
+        chunks are read back when they are sampled. The file is truncated when
+        the server starts.
+      spill_cold_after_seconds: Only used if `spill_path` is set. Time after
+        which a chunk which hasn't been loaded is spilled.
+      spill_scan_interval_seconds: Only used if `spill_path` is set. How often
+        the chunks are scanned for cold chunks.
+      prefetch_queue_size: Only used if `spill_path` is set. Maximum number of
+        spilled chunks which are queued to be read back ahead of the samples
+        that reference them.
+      deduplicate_chunks: If True then chunks whose tensors are identical to
+        those of a chunk which the server already holds share the tensors of
+        that chunk rather than being stored again, at the cost of hashing the
+        tensors of every chunk. The saved bytes are reported by the
+        `ChunkStoreInfo` of the `ServerInfo` call.
+      metrics_address: IPv4 address which the metrics (and profiles) of
+        `metrics_port` are served on. The endpoints are unauthenticated so the
+        default only serves them to the local host. Use '0.0.0.0' to serve them
+        on all interfaces.
 
     Raises:
       ValueError: If tables is empty.
       ValueError: If multiple Table in tables share names.
+      ValueError: If `replica_rate_limiting` is invalid.
     """
     if not tables:
       raise ValueError('At least one table must be provided')
@@ -268,14 +438,49 @@ class Server:
       raise ValueError('Multiple items in tables have the same name: {}'.format(
           ', '.join(duplicates)))
 
+    if replica_rate_limiting not in ('relaxed', 'coordinated'):
+      raise ValueError(
+          "replica_rate_limiting must be 'relaxed' or 'coordinated' but got "
+          f'{replica_rate_limiting!r}')
+
     if port is None:
       port = portpicker.pick_unused_port()
 
     if checkpointer is None:
       checkpointer = checkpointers.default_checkpointer()
 
+    if isinstance(min_restored_fraction_to_sample, (int, float)):
+      default_fraction = float(min_restored_fraction_to_sample)
+      fractions = {}
+    else:
+      default_fraction = 1.0
+      fractions = dict(min_restored_fraction_to_sample)
+
     self._server = pybind.Server([table.internal_table for table in tables],
-                                 port, checkpointer.internal_checkpointer())
+                                 port, checkpointer.internal_checkpointer(),
+                                 num_async_threads, warm_start,
+                                 default_fraction, fractions,
+                                 checkpoint_interval_seconds or 0,
+                                 checkpoint_max_bytes_per_second or 0,
+                                 metrics_port or 0,
+                                 dict(table_numa_nodes or {}),
+                                 enable_replication, primary_address or '',
+                                 replica_address or '',
+                                 replica_rate_limiting == 'coordinated',
+                                 memory_soft_limit_bytes or 0,
+                                 memory_hard_limit_bytes or 0,
+                                 {
+                                     name: list(rules) for name, rules in
+                                     (table_item_rules or {}).items()
+                                 }, enable_profiling,
+                                 workload_trace_path or '',
+                                 dict(stream_classes or {}),
+                                 default_stream_class,
+                                 max_concurrent_stream_operations,
+                                 spill_path or '', spill_cold_after_seconds,
+                                 spill_scan_interval_seconds,
+                                 prefetch_queue_size, deduplicate_chunks,
+                                 metrics_address)
     self._port = port
 
   def __del__(self):
@@ -19,7 +19,13 @@ Note: Most of the functionality is tested through ./client_test.py. This file
 only contains a few extra cases which does not fit well in the client tests.
 """
 
+import os
+import time
+import urllib.request
+
 from absl.testing import absltest
+import numpy as np
+import portpicker
 from reverb import item_selectors
 from reverb import rate_limiters
 from reverb import server
@@ -68,6 +74,21 @@ class ServerTest(absltest.TestCase):
     with self.assertRaises(ValueError):
       server.Server(tables=[], port=None)
 
+  def test_max_bytes(self):
+    table = server.Table(
+        name=TABLE_NAME,
+        sampler=item_selectors.Uniform(),
+        remover=item_selectors.Fifo(),
+        max_size=100,
+        rate_limiter=rate_limiters.MinSize(1),
+        max_bytes=1 << 20)
+    my_server = server.Server(tables=[table], port=None)
+    my_client = my_server.in_process_client()
+    info = my_client.server_info()[TABLE_NAME]
+    self.assertEqual(info.max_bytes, 1 << 20)
+    del my_client
+    my_server.stop()
+
   def test_can_sample(self):
     table = server.Table(
         name=TABLE_NAME,
@@ -89,6 +110,79 @@ class ServerTest(absltest.TestCase):
     del my_client
     my_server.stop()
 
+  def test_spills_cold_chunks(self):
+    table = server.Table(
+        name=TABLE_NAME,
+        sampler=item_selectors.Uniform(),
+        remover=item_selectors.Fifo(),
+        max_size=100,
+        rate_limiter=rate_limiters.MinSize(1))
+    spill_path = os.path.join(self.create_tempdir().full_path, 'spill')
+    my_server = server.Server(
+        tables=[table],
+        port=None,
+        spill_path=spill_path,
+        spill_cold_after_seconds=0,
+        spill_scan_interval_seconds=0.01)
+    my_client = my_server.in_process_client()
+    my_client.insert(np.arange(100), {TABLE_NAME: 1.0})
+    self.assertTrue(os.path.exists(spill_path))
+    # Give the scanner time to spill the chunk before it is read back.
+    time.sleep(0.1)
+    sample = next(my_client.sample(TABLE_NAME, 1))[0]
+    np.testing.assert_array_equal(sample.data[0], np.arange(100))
+    del my_client
+    my_server.stop()
+
+  def test_deduplicates_chunks(self):
+    table = server.Table(
+        name=TABLE_NAME,
+        sampler=item_selectors.Fifo(),
+        remover=item_selectors.Fifo(),
+        max_size=100,
+        max_times_sampled=1,
+        rate_limiter=rate_limiters.MinSize(1))
+    my_server = server.Server(
+        tables=[table], port=None, deduplicate_chunks=True)
+    my_client = my_server.in_process_client()
+    my_client.insert(np.arange(100), {TABLE_NAME: 1.0})
+    my_client.insert(np.arange(100), {TABLE_NAME: 1.0})
+    samples = [sample[0] for sample in my_client.sample(TABLE_NAME, 2)]
+    self.assertNotEqual(samples[0].info.key, samples[1].info.key)
+    for sample in samples:
+      np.testing.assert_array_equal(sample.data[0], np.arange(100))
+    del my_client
+    my_server.stop()
+
+  def test_serves_metrics_on_loopback(self):
+    table = server.Table(
+        name=TABLE_NAME,
+        sampler=item_selectors.Fifo(),
+        remover=item_selectors.Fifo(),
+        max_size=100,
+        rate_limiter=rate_limiters.MinSize(1))
+    metrics_port = portpicker.pick_unused_port()
+    my_server = server.Server(
+        tables=[table], port=None, metrics_port=metrics_port)
+    with urllib.request.urlopen(
+        f'http://127.0.0.1:{metrics_port}/metrics') as response:
+      self.assertEqual(response.status, 200)
+    my_server.stop()
+
+  def test_raises_on_invalid_metrics_address(self):
+    table = server.Table(
+        name=TABLE_NAME,
+        sampler=item_selectors.Fifo(),
+        remover=item_selectors.Fifo(),
+        max_size=100,
+        rate_limiter=rate_limiters.MinSize(1))
+    with self.assertRaises(ValueError):
+      server.Server(
+          tables=[table],
+          port=None,
+          metrics_port=portpicker.pick_unused_port(),
+          metrics_address='localhost')
+
 
 if __name__ == '__main__':
   absltest.main()
@@ -80,19 +80,31 @@ class TFClient:
              data: Sequence[tf.Tensor],
              tables: tf.Tensor,
              priorities: tf.Tensor,
-             name: Optional[str] = None):
+             name: Optional[str] = None,
+             chunk_length: int = 1,
+             max_in_flight_items: int = 0):
     """Inserts a trajectory into one or more tables.
 
     The content of `tables` and `priorities` are zipped to create the
     prioritized items. That is, an item with priority `priorities[i]` is
     inserted into `tables[i]`.
 
+    The returned op keeps a stream to the server open across runs and appends
+    `data` of every run as the next timestep of the stream.
+
     Args:
       data: Tensors to insert as the trajectory.
       tables: Rank 1 tensor with the names of the tables to create prioritized
         items in.
       priorities: Rank 1 tensor with priorities of the new items.
       name: Optional name for the client operation.
+      chunk_length: Number of runs whose data is batched into a single chunk.
+        Only used if `max_in_flight_items` is > 0.
+      max_in_flight_items: If 0 then every run blocks until the server has
+        confirmed the new items. Otherwise the items are confirmed
+        asynchronously and a run only blocks while more than
+        `max_in_flight_items` items are unconfirmed. Note that the items are
+        only sent once their chunk is complete.
 
     Returns:
       A tf-op for performing the insert.
@@ -101,6 +113,7 @@ class TFClient:
       ValueError: If tables is not a string tensor of rank 1.
       ValueError: If priorities is not a float64 tensor of rank 1.
       ValueError: If priorities and tables does not have the same shape.
+      ValueError: If chunk_length < 1 or max_in_flight_items < 0.
     """
     if tables.dtype != tf.string or tables.shape.rank != 1:
       raise ValueError('tables must be a string tensor of rank 1')
@@ -108,10 +121,20 @@ class TFClient:
       raise ValueError('priorities must be a float64 tensor of rank 1')
     if not tables.shape.is_compatible_with(priorities.shape):
       raise ValueError('priorities and tables must have the same shape')
+    if chunk_length < 1:
+      raise ValueError('chunk_length must be >= 1')
+    if max_in_flight_items < 0:
+      raise ValueError('max_in_flight_items must be >= 0')
 
     with tf.name_scope(name, f'{self._name}_insert', ['insert']) as scope:
       return gen_client_ops.reverb_client_insert(
-          self._handle, data, tables, priorities, name=scope)
+          self._handle,
+          data,
+          tables,
+          priorities,
+          chunk_length=chunk_length,
+          max_in_flight_items=max_in_flight_items,
+          name=scope)
 
   def update_priorities(self,
                         table: str,
@@ -16,6 +16,7 @@
 """Tests for tf_client."""
 
 from concurrent import futures
+import time
 
 import numpy as np
 from reverb import client as reverb_client
@@ -273,6 +274,52 @@ class InsertOpTest(tf.test.TestCase):
         np.testing.assert_equal(
             np.array([1, 2, 3], dtype=np.int8), sample.data[0])
 
+  def test_insert_reuses_stream_across_runs(self):
+    with self.session() as session:
+      client = tf_client.TFClient(self._client.server_address)
+      value = tf.placeholder(tf.int8, shape=[3])
+      insert_op = client.insert(
+          data=[value],
+          tables=tf.constant(['dist']),
+          priorities=tf.constant([1.0], dtype=tf.float64))
+
+      for i in range(5):
+        session.run(insert_op, feed_dict={value: [i, i, i]})
+
+      info = self._client.server_info()
+      self.assertEqual(info['dist'].current_size, 5)
+
+  def test_insert_batches_chunks_across_runs(self):
+    with self.session() as session:
+      client = tf_client.TFClient(self._client.server_address)
+      value = tf.placeholder(tf.int8, shape=[3])
+      insert_op = client.insert(
+          data=[value],
+          tables=tf.constant(['dist']),
+          priorities=tf.constant([1.0], dtype=tf.float64),
+          chunk_length=2,
+          max_in_flight_items=10)
+
+      # The items are only sent once their chunk is complete.
+      for i in range(4):
+        session.run(insert_op, feed_dict={value: [i, i, i]})
+
+      # Wait for the items to be confirmed asynchronously.
+      for _ in range(100):
+        if self._client.server_info()['dist'].current_size == 4:
+          break
+        time.sleep(0.1)
+      self.assertEqual(self._client.server_info()['dist'].current_size, 4)
+
+  def test_checks_chunk_length_and_max_in_flight_items(self):
+    client = tf_client.TFClient(self._client.server_address)
+    tables = tf.constant(['dist'])
+    priorities = tf.constant([1.0], dtype=tf.float64)
+    with self.assertRaises(ValueError):
+      client.insert(self.data, tables, priorities, chunk_length=0)
+    with self.assertRaises(ValueError):
+      client.insert(self.data, tables, priorities, max_in_flight_items=-1)
+
 
 if __name__ == '__main__':
   tf.disable_eager_execution()